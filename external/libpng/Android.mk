@@ -31,6 +31,12 @@ my_src_files_arm := \
 			arm/filter_neon.S \
 			arm/filter_neon_intrinsics.c
 
+# These compile to nothing unless the compiler may use SSE2; see
+# PNG_INTEL_SSE_OPT in pngpriv.h.
+my_src_files_x86 := \
+			intel/intel_init.c \
+			intel/filter_sse2_intrinsics.c
+
 
 common_CFLAGS := -std=gnu89 #-fvisibility=hidden ## -fomit-frame-pointer
 
@@ -38,7 +44,7 @@ common_CFLAGS := -std=gnu89 #-fvisibility=hidden ## -fomit-frame-pointer
 # =====================================================
 
 include $(CLEAR_VARS)
-LOCAL_SRC_FILES := $(common_SRC_FILES)
+LOCAL_SRC_FILES := $(common_SRC_FILES) $(my_src_files_x86)
 LOCAL_CFLAGS += $(common_CFLAGS)
 LOCAL_ASFLAGS += $(common_ASFLAGS)
 LOCAL_EXPORT_C_INCLUDE_DIRS := $(LOCAL_PATH)
@@ -59,6 +65,8 @@ LOCAL_ASFLAGS += $(common_ASFLAGS)
 LOCAL_SRC_FILES_arm := $(my_src_files_arm)
 LOCAL_CFLAGS_arm64 := $(my_cflags_arm64)
 LOCAL_SRC_FILES_arm64 := $(my_src_files_arm)
+LOCAL_SRC_FILES_x86 := $(my_src_files_x86)
+LOCAL_SRC_FILES_x86_64 := $(my_src_files_x86)
 LOCAL_SANITIZE := never
 LOCAL_EXPORT_C_INCLUDE_DIRS := $(LOCAL_PATH)
 LOCAL_SHARED_LIBRARIES := libz
@@ -77,6 +85,8 @@ LOCAL_ASFLAGS += $(common_ASFLAGS)
 LOCAL_SRC_FILES_arm := $(my_src_files_arm)
 LOCAL_CFLAGS_arm64 := $(my_cflags_arm64)
 LOCAL_SRC_FILES_arm64 := $(my_src_files_arm)
+LOCAL_SRC_FILES_x86 := $(my_src_files_x86)
+LOCAL_SRC_FILES_x86_64 := $(my_src_files_x86)
 LOCAL_EXPORT_C_INCLUDE_DIRS := $(LOCAL_PATH)
 LOCAL_SHARED_LIBRARIES := libz
 LOCAL_MODULE:= libpng
@@ -0,0 +1,432 @@
+
+/* filter_sse2_intrinsics.c - SSE2 optimised filter functions
+ *
+ * Copyright (C) 2014 The Android Open Source Project
+ * Based on arm/filter_neon_intrinsics.c.
+ *
+ * This code is released under the libpng license.
+ * For conditions of distribution and use, see the disclaimer
+ * and license in png.h
+ */
+
+#include "../pngpriv.h"
+
+#if PNG_INTEL_SSE_OPT > 0
+
+#include <emmintrin.h>
+
+/* Rows are not aligned, and the pixels of a 3 byte format straddle any
+ * alignment anyway, so pixels are moved in and out of the registers with
+ * memcpy(), which compilers turn into plain unaligned loads and stores.
+ */
+static __m128i
+load4(png_const_bytep p)
+{
+   png_uint_32 tmp;
+   memcpy(&tmp, p, 4);
+   return _mm_cvtsi32_si128((int)tmp);
+}
+
+static void
+store4(png_bytep p, __m128i v)
+{
+   png_uint_32 tmp = (png_uint_32)_mm_cvtsi128_si32(v);
+   memcpy(p, &tmp, 4);
+}
+
+static __m128i
+load3(png_const_bytep p)
+{
+   png_uint_32 tmp = 0;
+   memcpy(&tmp, p, 3);
+   return _mm_cvtsi32_si128((int)tmp);
+}
+
+static void
+store3(png_bytep p, __m128i v)
+{
+   png_uint_32 tmp = (png_uint_32)_mm_cvtsi128_si32(v);
+   memcpy(p, &tmp, 3);
+}
+
+/* The average of each pair of bytes, rounded down as the PNG specification
+ * requires; _mm_avg_epu8 rounds up.
+ */
+static __m128i
+avg_floor(__m128i a, __m128i b)
+{
+   __m128i odd = _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1));
+   return _mm_sub_epi8(_mm_avg_epu8(a, b), odd);
+}
+
+/* The Paeth predictor of 16-bit lanes holding byte values: whichever of a
+ * (left), b (above) and c (upper left) is nearest to a + b - c, preferring
+ * them in that order on ties.
+ */
+static __m128i
+paeth_predict(__m128i a, __m128i b, __m128i c)
+{
+   __m128i zero = _mm_setzero_si128();
+   __m128i pa = _mm_sub_epi16(b, c);
+   __m128i pb = _mm_sub_epi16(a, c);
+   __m128i pc = _mm_add_epi16(pa, pb);
+   __m128i smallest, take_a, take_b;
+
+   pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+   pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+   pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+   smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+
+   take_a = _mm_cmpeq_epi16(smallest, pa);
+   take_b = _mm_andnot_si128(take_a, _mm_cmpeq_epi16(smallest, pb));
+   return _mm_or_si128(_mm_or_si128(_mm_and_si128(take_a, a),
+      _mm_and_si128(take_b, b)),
+      _mm_andnot_si128(_mm_or_si128(take_a, take_b), c));
+}
+
+#ifdef PNG_READ_SUPPORTED
+
+/* Reversing Sub, Avg and Paeth depends on the pixel just reversed, so the
+ * decoding functions below work one pixel at a time; the gain is in doing
+ * the whole pixel at once and, for Paeth, in not branching.
+ */
+
+void
+png_read_filter_row_up_sse2(png_row_infop row_info, png_bytep row,
+   png_const_bytep prev_row)
+{
+   png_size_t i = 0;
+   png_size_t rowbytes = row_info->rowbytes;
+
+   for (; i + 16 <= rowbytes; i += 16)
+   {
+      __m128i x = _mm_loadu_si128((const __m128i*)(row + i));
+      __m128i b = _mm_loadu_si128((const __m128i*)(prev_row + i));
+      _mm_storeu_si128((__m128i*)(row + i), _mm_add_epi8(x, b));
+   }
+
+   for (; i < rowbytes; i++)
+      row[i] = (png_byte)((row[i] + prev_row[i]) & 0xff);
+}
+
+void
+png_read_filter_row_sub3_sse2(png_row_infop row_info, png_bytep row,
+   png_const_bytep prev_row)
+{
+   png_bytep rp = row;
+   png_bytep rp_stop = row + row_info->rowbytes;
+   __m128i a = _mm_setzero_si128();
+
+   PNG_UNUSED(prev_row)
+
+   for (; rp < rp_stop; rp += 3)
+   {
+      a = _mm_add_epi8(a, load3(rp));
+      store3(rp, a);
+   }
+}
+
+void
+png_read_filter_row_sub4_sse2(png_row_infop row_info, png_bytep row,
+   png_const_bytep prev_row)
+{
+   png_bytep rp = row;
+   png_bytep rp_stop = row + row_info->rowbytes;
+   __m128i a = _mm_setzero_si128();
+
+   PNG_UNUSED(prev_row)
+
+   for (; rp < rp_stop; rp += 4)
+   {
+      a = _mm_add_epi8(a, load4(rp));
+      store4(rp, a);
+   }
+}
+
+void
+png_read_filter_row_avg3_sse2(png_row_infop row_info, png_bytep row,
+   png_const_bytep prev_row)
+{
+   png_bytep rp = row;
+   png_const_bytep pp = prev_row;
+   png_bytep rp_stop = row + row_info->rowbytes;
+   __m128i a = _mm_setzero_si128();
+
+   for (; rp < rp_stop; rp += 3, pp += 3)
+   {
+      a = _mm_add_epi8(load3(rp), avg_floor(a, load3(pp)));
+      store3(rp, a);
+   }
+}
+
+void
+png_read_filter_row_avg4_sse2(png_row_infop row_info, png_bytep row,
+   png_const_bytep prev_row)
+{
+   png_bytep rp = row;
+   png_const_bytep pp = prev_row;
+   png_bytep rp_stop = row + row_info->rowbytes;
+   __m128i a = _mm_setzero_si128();
+
+   for (; rp < rp_stop; rp += 4, pp += 4)
+   {
+      a = _mm_add_epi8(load4(rp), avg_floor(a, load4(pp)));
+      store4(rp, a);
+   }
+}
+
+void
+png_read_filter_row_paeth3_sse2(png_row_infop row_info, png_bytep row,
+   png_const_bytep prev_row)
+{
+   png_bytep rp = row;
+   png_const_bytep pp = prev_row;
+   png_bytep rp_stop = row + row_info->rowbytes;
+   __m128i zero = _mm_setzero_si128();
+   __m128i a = zero, c = zero;
+
+   for (; rp < rp_stop; rp += 3, pp += 3)
+   {
+      __m128i b = _mm_unpacklo_epi8(load3(pp), zero);
+      __m128i x = load3(rp);
+
+      x = _mm_add_epi8(x, _mm_packus_epi16(paeth_predict(a, b, c), zero));
+      store3(rp, x);
+      a = _mm_unpacklo_epi8(x, zero);
+      c = b;
+   }
+}
+
+void
+png_read_filter_row_paeth4_sse2(png_row_infop row_info, png_bytep row,
+   png_const_bytep prev_row)
+{
+   png_bytep rp = row;
+   png_const_bytep pp = prev_row;
+   png_bytep rp_stop = row + row_info->rowbytes;
+   __m128i zero = _mm_setzero_si128();
+   __m128i a = zero, c = zero;
+
+   for (; rp < rp_stop; rp += 4, pp += 4)
+   {
+      __m128i b = _mm_unpacklo_epi8(load4(pp), zero);
+      __m128i x = load4(rp);
+
+      x = _mm_add_epi8(x, _mm_packus_epi16(paeth_predict(a, b, c), zero));
+      store4(rp, x);
+      a = _mm_unpacklo_epi8(x, zero);
+      c = b;
+   }
+}
+#endif /* PNG_READ_SUPPORTED */
+
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+
+/* Filtering for the encoder only depends on the unfiltered rows, so the
+ * functions below do 16 bytes at a time.  Each one stores the filtered row
+ * in 'dp' and returns the "minimum sum of absolute differences" measure
+ * png_write_find_filter() compares the filters by, the sum of the filtered
+ * bytes taken as signed values.  Like the generic code they give up once
+ * the sum passes 'limit', returning a sum that is no longer exact but still
+ * above it.
+ */
+
+/* Adds the absolute values of the signed bytes of 'x' to the two 64-bit
+ * lanes of 'sums'.
+ */
+static __m128i
+add_abs_sum(__m128i sums, __m128i x)
+{
+   __m128i zero = _mm_setzero_si128();
+   __m128i negative = _mm_cmpgt_epi8(zero, x);
+   __m128i abs = _mm_sub_epi8(_mm_xor_si128(x, negative), negative);
+   return _mm_add_epi64(sums, _mm_sad_epu8(abs, zero));
+}
+
+static png_uint_32
+total(__m128i sums)
+{
+   return (png_uint_32)_mm_cvtsi128_si32(sums) +
+      (png_uint_32)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+}
+
+#define PNG_ABS_BYTE(v) ((v) < 128 ? (v) : 256 - (v))
+
+png_uint_32
+png_write_sum_row_sse2(png_const_bytep rp, png_size_t row_bytes)
+{
+   png_size_t i = 0;
+   __m128i sums = _mm_setzero_si128();
+   png_uint_32 sum;
+
+   for (; i + 16 <= row_bytes; i += 16)
+      sums = add_abs_sum(sums, _mm_loadu_si128((const __m128i*)(rp + i)));
+
+   sum = total(sums);
+   for (; i < row_bytes; i++)
+      sum += PNG_ABS_BYTE(rp[i]);
+
+   return sum;
+}
+
+png_uint_32
+png_write_filter_row_sub_sse2(png_bytep dp, png_const_bytep rp,
+   png_size_t bpp, png_size_t row_bytes, png_uint_32 limit)
+{
+   png_size_t i;
+   __m128i sums = _mm_setzero_si128();
+   png_uint_32 sum = 0;
+
+   for (i = 0; i < bpp && i < row_bytes; i++)
+   {
+      dp[i] = rp[i];
+      sum += PNG_ABS_BYTE(dp[i]);
+   }
+
+   for (; i + 16 <= row_bytes; i += 16)
+   {
+      __m128i x = _mm_loadu_si128((const __m128i*)(rp + i));
+      __m128i a = _mm_loadu_si128((const __m128i*)(rp + i - bpp));
+      x = _mm_sub_epi8(x, a);
+      _mm_storeu_si128((__m128i*)(dp + i), x);
+      sums = add_abs_sum(sums, x);
+      if (sum + total(sums) > limit)
+         return sum + total(sums);
+   }
+
+   sum += total(sums);
+   for (; i < row_bytes; i++)
+   {
+      dp[i] = (png_byte)((rp[i] - rp[i - bpp]) & 0xff);
+      sum += PNG_ABS_BYTE(dp[i]);
+      if (sum > limit)
+         break;
+   }
+
+   return sum;
+}
+
+png_uint_32
+png_write_filter_row_up_sse2(png_bytep dp, png_const_bytep rp,
+   png_const_bytep pp, png_size_t row_bytes, png_uint_32 limit)
+{
+   png_size_t i;
+   __m128i sums = _mm_setzero_si128();
+   png_uint_32 sum;
+
+   for (i = 0; i + 16 <= row_bytes; i += 16)
+   {
+      __m128i x = _mm_loadu_si128((const __m128i*)(rp + i));
+      __m128i b = _mm_loadu_si128((const __m128i*)(pp + i));
+      x = _mm_sub_epi8(x, b);
+      _mm_storeu_si128((__m128i*)(dp + i), x);
+      sums = add_abs_sum(sums, x);
+      if (total(sums) > limit)
+         return total(sums);
+   }
+
+   sum = total(sums);
+   for (; i < row_bytes; i++)
+   {
+      dp[i] = (png_byte)((rp[i] - pp[i]) & 0xff);
+      sum += PNG_ABS_BYTE(dp[i]);
+      if (sum > limit)
+         break;
+   }
+
+   return sum;
+}
+
+png_uint_32
+png_write_filter_row_avg_sse2(png_bytep dp, png_const_bytep rp,
+   png_const_bytep pp, png_size_t bpp, png_size_t row_bytes,
+   png_uint_32 limit)
+{
+   png_size_t i;
+   __m128i sums = _mm_setzero_si128();
+   png_uint_32 sum = 0;
+
+   for (i = 0; i < bpp && i < row_bytes; i++)
+   {
+      dp[i] = (png_byte)((rp[i] - (pp[i] / 2)) & 0xff);
+      sum += PNG_ABS_BYTE(dp[i]);
+   }
+
+   for (; i + 16 <= row_bytes; i += 16)
+   {
+      __m128i x = _mm_loadu_si128((const __m128i*)(rp + i));
+      __m128i a = _mm_loadu_si128((const __m128i*)(rp + i - bpp));
+      __m128i b = _mm_loadu_si128((const __m128i*)(pp + i));
+      x = _mm_sub_epi8(x, avg_floor(a, b));
+      _mm_storeu_si128((__m128i*)(dp + i), x);
+      sums = add_abs_sum(sums, x);
+      if (sum + total(sums) > limit)
+         return sum + total(sums);
+   }
+
+   sum += total(sums);
+   for (; i < row_bytes; i++)
+   {
+      dp[i] = (png_byte)((rp[i] - ((rp[i - bpp] + pp[i]) / 2)) & 0xff);
+      sum += PNG_ABS_BYTE(dp[i]);
+      if (sum > limit)
+         break;
+   }
+
+   return sum;
+}
+
+png_uint_32
+png_write_filter_row_paeth_sse2(png_bytep dp, png_const_bytep rp,
+   png_const_bytep pp, png_size_t bpp, png_size_t row_bytes,
+   png_uint_32 limit)
+{
+   png_size_t i;
+   __m128i zero = _mm_setzero_si128();
+   __m128i sums = zero;
+   png_uint_32 sum = 0;
+
+   for (i = 0; i < bpp && i < row_bytes; i++)
+   {
+      dp[i] = (png_byte)((rp[i] - pp[i]) & 0xff);
+      sum += PNG_ABS_BYTE(dp[i]);
+   }
+
+   for (; i + 16 <= row_bytes; i += 16)
+   {
+      __m128i x = _mm_loadu_si128((const __m128i*)(rp + i));
+      __m128i a = _mm_loadu_si128((const __m128i*)(rp + i - bpp));
+      __m128i b = _mm_loadu_si128((const __m128i*)(pp + i));
+      __m128i c = _mm_loadu_si128((const __m128i*)(pp + i - bpp));
+      __m128i lo = paeth_predict(_mm_unpacklo_epi8(a, zero),
+         _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero));
+      __m128i hi = paeth_predict(_mm_unpackhi_epi8(a, zero),
+         _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero));
+      x = _mm_sub_epi8(x, _mm_packus_epi16(lo, hi));
+      _mm_storeu_si128((__m128i*)(dp + i), x);
+      sums = add_abs_sum(sums, x);
+      if (sum + total(sums) > limit)
+         return sum + total(sums);
+   }
+
+   sum += total(sums);
+   for (; i < row_bytes; i++)
+   {
+      int a = rp[i - bpp], b = pp[i], c = pp[i - bpp];
+      int p = b - c;
+      int pc = a - c;
+      int pa = p < 0 ? -p : p;
+      int pb = pc < 0 ? -pc : pc;
+      pc = (p + pc) < 0 ? -(p + pc) : p + pc;
+      p = (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+
+      dp[i] = (png_byte)((rp[i] - p) & 0xff);
+      sum += PNG_ABS_BYTE(dp[i]);
+      if (sum > limit)
+         break;
+   }
+
+   return sum;
+}
+#endif /* PNG_WRITE_FILTER_SUPPORTED */
+#endif /* PNG_INTEL_SSE_OPT > 0 */
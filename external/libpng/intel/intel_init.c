@@ -0,0 +1,47 @@
+
+/* intel_init.c - SSE2 optimised filter functions
+ *
+ * Copyright (C) 2014 The Android Open Source Project
+ * Based on arm/arm_init.c.
+ *
+ * This code is released under the libpng license.
+ * For conditions of distribution and use, see the disclaimer
+ * and license in png.h
+ */
+
+#include "../pngpriv.h"
+
+#ifdef PNG_READ_SUPPORTED
+#if PNG_INTEL_SSE_OPT > 0
+
+void
+png_init_filter_functions_sse2(png_structp pp, unsigned int bpp)
+{
+   /* SSE2 is part of every x86-64 processor, and pngpriv.h only turns this
+    * code on for 32-bit builds that the compiler was allowed to use SSE2 in,
+    * so unlike the NEON code there is no run-time check to make.
+    *
+    * The code handles 3 and 4 byte pixels, which account for nearly all the
+    * RGB and RGBA images in practice; other pixel sizes keep the generic
+    * implementations.
+    */
+   pp->read_filter[PNG_FILTER_VALUE_UP-1] = png_read_filter_row_up_sse2;
+
+   if (bpp == 3)
+   {
+      pp->read_filter[PNG_FILTER_VALUE_SUB-1] = png_read_filter_row_sub3_sse2;
+      pp->read_filter[PNG_FILTER_VALUE_AVG-1] = png_read_filter_row_avg3_sse2;
+      pp->read_filter[PNG_FILTER_VALUE_PAETH-1] =
+         png_read_filter_row_paeth3_sse2;
+   }
+
+   else if (bpp == 4)
+   {
+      pp->read_filter[PNG_FILTER_VALUE_SUB-1] = png_read_filter_row_sub4_sse2;
+      pp->read_filter[PNG_FILTER_VALUE_AVG-1] = png_read_filter_row_avg4_sse2;
+      pp->read_filter[PNG_FILTER_VALUE_PAETH-1] =
+         png_read_filter_row_paeth4_sse2;
+   }
+}
+#endif /* PNG_INTEL_SSE_OPT > 0 */
+#endif /* PNG_READ_SUPPORTED */
@@ -180,6 +180,29 @@
 #  endif
 #endif /* PNG_ARM_NEON_OPT > 0 */
 
+#ifndef PNG_INTEL_SSE_OPT
+   /* SSE2 optimizations are controlled the same way: every x86-64 CPU has
+    * SSE2, and for 32-bit x86 the compiler says whether it may be used
+    * (-msse2 with GCC, /arch:SSE2 with MSVC.)  Set PNG_INTEL_SSE_OPT to 0 in
+    * CPPFLAGS to use the generic code.
+    */
+#  if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || \
+      (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#     define PNG_INTEL_SSE_OPT 1
+#  else
+#     define PNG_INTEL_SSE_OPT 0
+#  endif
+#endif
+
+#if PNG_INTEL_SSE_OPT > 0
+   /* The decoding functions are hooked in like the NEON ones, the encoding
+    * ones are called directly by png_write_find_filter().
+    */
+#  ifndef PNG_FILTER_OPTIMIZATIONS
+#     define PNG_FILTER_OPTIMIZATIONS png_init_filter_functions_sse2
+#  endif
+#endif /* PNG_INTEL_SSE_OPT > 0 */
+
 /* Is this a build of a DLL where compilation of the object modules requires
  * different preprocessor settings to those required for a simple library?  If
  * so PNG_BUILD_DLL must be set.
@@ -1208,6 +1231,41 @@ PNG_INTERNAL_FUNCTION(void,png_read_filter_row_paeth3_neon,(png_row_infop
 PNG_INTERNAL_FUNCTION(void,png_read_filter_row_paeth4_neon,(png_row_infop
     row_info, png_bytep row, png_const_bytep prev_row),PNG_EMPTY);
 
+PNG_INTERNAL_FUNCTION(void,png_read_filter_row_up_sse2,(png_row_infop row_info,
+    png_bytep row, png_const_bytep prev_row),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(void,png_read_filter_row_sub3_sse2,(png_row_infop
+    row_info, png_bytep row, png_const_bytep prev_row),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(void,png_read_filter_row_sub4_sse2,(png_row_infop
+    row_info, png_bytep row, png_const_bytep prev_row),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(void,png_read_filter_row_avg3_sse2,(png_row_infop
+    row_info, png_bytep row, png_const_bytep prev_row),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(void,png_read_filter_row_avg4_sse2,(png_row_infop
+    row_info, png_bytep row, png_const_bytep prev_row),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(void,png_read_filter_row_paeth3_sse2,(png_row_infop
+    row_info, png_bytep row, png_const_bytep prev_row),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(void,png_read_filter_row_paeth4_sse2,(png_row_infop
+    row_info, png_bytep row, png_const_bytep prev_row),PNG_EMPTY);
+
+#ifdef PNG_WRITE_FILTER_SUPPORTED
+/* Filter a row for png_write_find_filter(), returning the sum it compares the
+ * filters by; see intel/filter_sse2_intrinsics.c.
+ */
+PNG_INTERNAL_FUNCTION(png_uint_32,png_write_sum_row_sse2,(png_const_bytep rp,
+    png_size_t row_bytes),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(png_uint_32,png_write_filter_row_sub_sse2,(png_bytep dp,
+    png_const_bytep rp, png_size_t bpp, png_size_t row_bytes,
+    png_uint_32 limit),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(png_uint_32,png_write_filter_row_up_sse2,(png_bytep dp,
+    png_const_bytep rp, png_const_bytep pp, png_size_t row_bytes,
+    png_uint_32 limit),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(png_uint_32,png_write_filter_row_avg_sse2,(png_bytep dp,
+    png_const_bytep rp, png_const_bytep pp, png_size_t bpp,
+    png_size_t row_bytes, png_uint_32 limit),PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(png_uint_32,png_write_filter_row_paeth_sse2,(png_bytep
+    dp, png_const_bytep rp, png_const_bytep pp, png_size_t bpp,
+    png_size_t row_bytes, png_uint_32 limit),PNG_EMPTY);
+#endif
+
 /* Choose the best filter to use and filter the row data */
 PNG_INTERNAL_FUNCTION(void,png_write_find_filter,(png_structrp png_ptr,
     png_row_infop row_info),PNG_EMPTY);
@@ -1930,6 +1988,8 @@ PNG_INTERNAL_FUNCTION(void, PNG_FILTER_OPTIMIZATIONS, (png_structp png_ptr,
     */
 PNG_INTERNAL_FUNCTION(void, png_init_filter_functions_neon,
    (png_structp png_ptr, unsigned int bpp), PNG_EMPTY);
+PNG_INTERNAL_FUNCTION(void, png_init_filter_functions_sse2,
+   (png_structp png_ptr, unsigned int bpp), PNG_EMPTY);
 #endif
 
 #ifdef PNG_INDEX_SUPPORTED
@@ -2380,8 +2380,11 @@ png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
     */
    if ((filter_to_do & PNG_FILTER_NONE) && filter_to_do != PNG_FILTER_NONE)
    {
-      png_bytep rp;
       png_uint_32 sum = 0;
+#if PNG_INTEL_SSE_OPT > 0
+      sum = png_write_sum_row_sse2(row_buf + 1, row_bytes);
+#else
+      png_bytep rp;
       png_size_t i;
       int v;
 
@@ -2390,6 +2393,7 @@ png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
          v = *rp;
          sum += (v < 128) ? v : 256 - v;
       }
+#endif
 
 #ifdef PNG_WRITE_WEIGHTED_FILTER_SUPPORTED
       if (png_ptr->heuristic_method == PNG_FILTER_HEURISTIC_WEIGHTED)
@@ -2456,10 +2460,12 @@ png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
 
    else if (filter_to_do & PNG_FILTER_SUB)
    {
-      png_bytep rp, dp, lp;
       png_uint_32 sum = 0, lmins = mins;
+#if PNG_INTEL_SSE_OPT == 0
+      png_bytep rp, dp, lp;
       png_size_t i;
       int v;
+#endif
 
 #ifdef PNG_WRITE_WEIGHTED_FILTER_SUPPORTED
       /* We temporarily increase the "minimum sum" by the factor we
@@ -2499,6 +2505,10 @@ png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
       }
 #endif
 
+#if PNG_INTEL_SSE_OPT > 0
+      sum = png_write_filter_row_sub_sse2(png_ptr->sub_row + 1, row_buf + 1,
+          bpp, row_bytes, lmins);
+#else
       for (i = 0, rp = row_buf + 1, dp = png_ptr->sub_row + 1; i < bpp;
            i++, rp++, dp++)
       {
@@ -2517,6 +2527,7 @@ png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
          if (sum > lmins)  /* We are already worse, don't continue. */
             break;
       }
+#endif
 
 #ifdef PNG_WRITE_WEIGHTED_FILTER_SUPPORTED
       if (png_ptr->heuristic_method == PNG_FILTER_HEURISTIC_WEIGHTED)
@@ -2577,10 +2588,12 @@ png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
 
    else if (filter_to_do & PNG_FILTER_UP)
    {
-      png_bytep rp, dp, pp;
       png_uint_32 sum = 0, lmins = mins;
+#if PNG_INTEL_SSE_OPT == 0
+      png_bytep rp, dp, pp;
       png_size_t i;
       int v;
+#endif
 
 
 #ifdef PNG_WRITE_WEIGHTED_FILTER_SUPPORTED
@@ -2617,6 +2630,10 @@ png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
       }
 #endif
 
+#if PNG_INTEL_SSE_OPT > 0
+      sum = png_write_filter_row_up_sse2(png_ptr->up_row + 1, row_buf + 1,
+          prev_row + 1, row_bytes, lmins);
+#else
       for (i = 0, rp = row_buf + 1, dp = png_ptr->up_row + 1,
           pp = prev_row + 1; i < row_bytes; i++)
       {
@@ -2627,6 +2644,7 @@ png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
          if (sum > lmins)  /* We are already worse, don't continue. */
             break;
       }
+#endif
 
 #ifdef PNG_WRITE_WEIGHTED_FILTER_SUPPORTED
       if (png_ptr->heuristic_method == PNG_FILTER_HEURISTIC_WEIGHTED)
@@ -2691,10 +2709,12 @@ png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
 
    else if (filter_to_do & PNG_FILTER_AVG)
    {
-      png_bytep rp, dp, pp, lp;
       png_uint_32 sum = 0, lmins = mins;
+#if PNG_INTEL_SSE_OPT == 0
+      png_bytep rp, dp, pp, lp;
       png_size_t i;
       int v;
+#endif
 
 #ifdef PNG_WRITE_WEIGHTED_FILTER_SUPPORTED
       if (png_ptr->heuristic_method == PNG_FILTER_HEURISTIC_WEIGHTED)
@@ -2730,6 +2750,10 @@ png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
       }
 #endif
 
+#if PNG_INTEL_SSE_OPT > 0
+      sum = png_write_filter_row_avg_sse2(png_ptr->avg_row + 1, row_buf + 1,
+          prev_row + 1, bpp, row_bytes, lmins);
+#else
       for (i = 0, rp = row_buf + 1, dp = png_ptr->avg_row + 1,
            pp = prev_row + 1; i < bpp; i++)
       {
@@ -2748,6 +2772,7 @@ png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
          if (sum > lmins)  /* We are already worse, don't continue. */
             break;
       }
+#endif
 
 #ifdef PNG_WRITE_WEIGHTED_FILTER_SUPPORTED
       if (png_ptr->heuristic_method == PNG_FILTER_HEURISTIC_WEIGHTED)
@@ -2832,10 +2857,12 @@ png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
 
    else if (filter_to_do & PNG_FILTER_PAETH)
    {
-      png_bytep rp, dp, pp, cp, lp;
       png_uint_32 sum = 0, lmins = mins;
+#if PNG_INTEL_SSE_OPT == 0
+      png_bytep rp, dp, pp, cp, lp;
       png_size_t i;
       int v;
+#endif
 
 #ifdef PNG_WRITE_WEIGHTED_FILTER_SUPPORTED
       if (png_ptr->heuristic_method == PNG_FILTER_HEURISTIC_WEIGHTED)
@@ -2871,6 +2898,10 @@ png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
       }
 #endif
 
+#if PNG_INTEL_SSE_OPT > 0
+      sum = png_write_filter_row_paeth_sse2(png_ptr->paeth_row + 1,
+          row_buf + 1, prev_row + 1, bpp, row_bytes, lmins);
+#else
       for (i = 0, rp = row_buf + 1, dp = png_ptr->paeth_row + 1,
           pp = prev_row + 1; i < bpp; i++)
       {
@@ -2923,6 +2954,7 @@ png_write_find_filter(png_structrp png_ptr, png_row_infop row_info)
          if (sum > lmins)  /* We are already worse, don't continue. */
             break;
       }
+#endif
 
 #ifdef PNG_WRITE_WEIGHTED_FILTER_SUPPORTED
       if (png_ptr->heuristic_method == PNG_FILTER_HEURISTIC_WEIGHTED)
@@ -47,6 +47,30 @@
 #endif /* BYFOUR */
 
 /* Local functions for crc concatenation */
+/*
+   Hardware CRC-32, unless NO_CRC32_SIMD is defined.  On x86 with a gcc or
+   clang new enough for per-function targets, buffers of 64 bytes or more are
+   folded with carry-less multiplies when cpuid reports PCLMULQDQ and SSE4.1.
+   On ARMv8 targets built with the CRC extension, its CRC32 instructions are
+   used for everything.
+ */
+#if !defined(NO_CRC32_SIMD) && (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#  define CRC32_PCLMUL
+#  include <cpuid.h>
+#  include <smmintrin.h>
+#  include <wmmintrin.h>
+   local int crc32_pclmul_available OF((void));
+   local z_crc_t crc32_pclmul OF((z_crc_t crc, const unsigned char FAR *buf,
+                                  unsigned len));
+#elif !defined(NO_CRC32_SIMD) && defined(__ARM_FEATURE_CRC32)
+#  define CRC32_ARMV8
+#  include <arm_acle.h>
+   local unsigned long crc32_armv8 OF((unsigned long crc,
+                                       const unsigned char FAR *buf,
+                                       unsigned len));
+#endif
+
 local unsigned long gf2_matrix_times OF((unsigned long *mat,
                                          unsigned long vec));
 local void gf2_matrix_square OF((unsigned long *square, unsigned long *mat));
@@ -213,6 +237,22 @@ unsigned long ZEXPORT crc32(crc, buf, len)
         make_crc_table();
 #endif /* DYNAMIC_CRC_TABLE */
 
+#ifdef CRC32_ARMV8
+    return crc32_armv8(crc, buf, len);
+#endif /* CRC32_ARMV8 */
+
+#ifdef CRC32_PCLMUL
+    if (len >= 64 && crc32_pclmul_available()) {
+        unsigned chunk = len & ~15U;
+
+        crc = ~crc32_pclmul(~(z_crc_t)crc, buf, chunk) & 0xffffffffUL;
+        buf += chunk;
+        len -= chunk;
+        if (len == 0)
+            return crc;
+    }
+#endif /* CRC32_PCLMUL */
+
 #ifdef BYFOUR
     if (sizeof(void *) == sizeof(ptrdiff_t)) {
         z_crc_t endian;
@@ -321,6 +361,154 @@ local unsigned long crc32_big(crc, buf, len)
 
 #endif /* BYFOUR */
 
+#ifdef CRC32_PCLMUL
+
+/* ========================================================================= */
+local int crc32_pclmul_state = -1;    /* unknown until first asked */
+
+local int crc32_pclmul_available()
+{
+    unsigned eax, ebx, ecx, edx;
+    int state;
+
+    state = crc32_pclmul_state;
+    if (state < 0) {
+        /* bit 1 of ecx is PCLMULQDQ, bit 19 is SSE4.1; racing here is benign */
+        state = __get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+                (ecx & (1U << 1)) != 0 && (ecx & (1U << 19)) != 0;
+        crc32_pclmul_state = state;
+    }
+    return state;
+}
+
+/* ========================================================================= */
+/*
+   Fold 64 bytes at a time into four 128-bit lanes, then fold those into one,
+   and Barrett-reduce it to 32 bits, following Gopal et al., "Fast CRC
+   Computation for Generic Polynomials Using PCLMULQDQ Instruction" (Intel,
+   2009).  The constants are the bit-reflected ones for the zlib polynomial.
+   "crc" is the pre-conditioned (inverted) CRC, len >= 64 and a multiple of
+   16.
+ */
+__attribute__((target("sse4.1,pclmul")))
+local z_crc_t crc32_pclmul(crc, buf, len)
+    z_crc_t crc;
+    const unsigned char FAR *buf;
+    unsigned len;
+{
+    static const unsigned long long __attribute__((aligned(16)))
+        k1k2[2] = { 0x0154442bd4ULL, 0x01c6e41596ULL },
+        k3k4[2] = { 0x01751997d0ULL, 0x00ccaa009eULL },
+        k5k0[2] = { 0x0163cd6124ULL, 0x0000000000ULL },
+        poly[2] = { 0x01db710641ULL, 0x01f7011641ULL };
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    x0 = _mm_load_si128((const __m128i *)k1k2);
+    buf += 64;
+    len -= 64;
+
+    /* fold 64 bytes at a time */
+    while (len >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        y5 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+        y6 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+        y7 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+        y8 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+        buf += 64;
+        len -= 64;
+    }
+
+    /* fold the four lanes into one */
+    x0 = _mm_load_si128((const __m128i *)k3k4);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    /* fold the remaining 16 bytes at a time */
+    while (len >= 16) {
+        x2 = _mm_loadu_si128((const __m128i *)buf);
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        buf += 16;
+        len -= 16;
+    }
+
+    /* fold 128 bits to 64 */
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* Barrett-reduce to 32 bits */
+    x0 = _mm_load_si128((const __m128i *)poly);
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (z_crc_t)_mm_extract_epi32(x1, 1);
+}
+
+#endif /* CRC32_PCLMUL */
+
+#ifdef CRC32_ARMV8
+
+/* ========================================================================= */
+local unsigned long crc32_armv8(crc, buf, len)
+    unsigned long crc;
+    const unsigned char FAR *buf;
+    unsigned len;
+{
+    register z_crc_t c;
+
+    c = ~(z_crc_t)crc;
+    while (len && ((ptrdiff_t)buf & 7)) {
+        c = __crc32b(c, *buf++);
+        len--;
+    }
+    while (len >= 8) {
+        c = __crc32d(c, *(const unsigned long long FAR *)(const void FAR *)buf);
+        buf += 8;
+        len -= 8;
+    }
+    while (len) {
+        c = __crc32b(c, *buf++);
+        len--;
+    }
+    return (unsigned long)~c;
+}
+
+#endif /* CRC32_ARMV8 */
+
 #define GF2_DIM 32      /* dimension of GF(2) vectors (length of CRC) */
 
 /* ========================================================================= */
@@ -267,16 +267,30 @@ unsigned start;         /* inflate()'s starting value for strm->avail_out */
                 }
                 else {
                     from = out - dist;          /* copy direct from output */
-                    do {                        /* minimum length is three */
-                        PUP(out) = PUP(from);
-                        PUP(out) = PUP(from);
-                        PUP(out) = PUP(from);
-                        len -= 3;
-                    } while (len > 2);
-                    if (len) {
-                        PUP(out) = PUP(from);
-                        if (len > 1)
+                    if (dist >= 8) {            /* eight bytes never overlap */
+                        while (len >= 8) {
+                            zmemcpy(out + OFF, from + OFF, 8);
+                            out += 8;
+                            from += 8;
+                            len -= 8;
+                        }
+                        while (len) {
                             PUP(out) = PUP(from);
+                            len--;
+                        }
+                    }
+                    else {
+                        do {                    /* minimum length is three */
+                            PUP(out) = PUP(from);
+                            PUP(out) = PUP(from);
+                            PUP(out) = PUP(from);
+                            len -= 3;
+                        } while (len > 2);
+                        if (len) {
+                            PUP(out) = PUP(from);
+                            if (len > 1)
+                                PUP(out) = PUP(from);
+                        }
                     }
                 }
             }
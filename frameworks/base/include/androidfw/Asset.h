@@ -86,6 +86,14 @@ public:
      */
     virtual const void* getBuffer(bool wordAligned) = 0;
 
+    /*
+     * Copy the entire contents of the file into "buf", which must hold
+     * getLength() bytes; the read position afterwards is unspecified.
+     * Unlike getBuffer(), the asset keeps no copy of its own: compressed
+     * data is inflated straight into "buf".
+     */
+    virtual bool copyTo(void* buf);
+
     /*
      * Get the total amount of data that can be read.
      */
@@ -295,6 +303,7 @@ public:
     virtual off64_t seek(off64_t offset, int whence);
     virtual void close(void);
     virtual const void* getBuffer(bool wordAligned);
+    virtual bool copyTo(void* buf);
     virtual off64_t getLength(void) const { return mUncompressedLen; }
     virtual off64_t getRemainingLength(void) const { return mUncompressedLen-mOffset; }
     virtual int openFileDescriptor(off64_t* outStart, off64_t* outLength) const { return -1; }
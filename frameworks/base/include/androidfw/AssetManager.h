@@ -23,6 +23,7 @@
 #include <androidfw/Asset.h>
 #include <androidfw/AssetDir.h>
 #include <androidfw/ZipFileRO.h>
+#include <utils/HashedKeyedVector.h>
 #include <utils/KeyedVector.h>
 #include <utils/SortedVector.h>
 #include <utils/String16.h>
@@ -102,6 +103,17 @@ public:
     bool addAssetPath(const String8& path, int32_t* cookie);
     bool addOverlayPath(const String8& path, int32_t* cookie);
 
+    /*
+     * Opens the zips of "paths" and, if "loadTables", reads their
+     * resources.arsc, on up to "numThreads" threads, so that adding them
+     * with addAssetPath() afterwards only finds what was loaded.  The paths
+     * are still added, and get their cookies, only as they are passed to
+     * addAssetPath().  Pass false for "loadTables" to call
+     * setResourceTableFile() on them.
+     */
+    void preloadAssetPaths(const Vector<String8>& paths, bool loadTables,
+        size_t numThreads = 1);
+
     /*                                                                       
      * Convenience for adding the standard system assets.  Uses the
      * ANDROID_ROOT environment variable to find them.
@@ -123,6 +135,22 @@ public:
      */
     String8 getAssetPath(const int32_t cookie) const;
 
+    /*
+     * Return the zip of an asset path, which stays open as long as the
+     * path is in the manager, or NULL if the path is a directory.
+     */
+    ZipFileRO* getZipFile(const int32_t cookie);
+
+    /*
+     * Use the file at 'tablePath', which must hold exactly the uncompressed
+     * resources.arsc of the zip added as 'cookie', as that zip's resource
+     * table.  The file is mapped when resources are first loaded, so a
+     * compressed table is never inflated.  Returns "false" if 'cookie' is
+     * not a zip, the file can't be opened, or the zip's resource table
+     * was already loaded.
+     */
+    bool setResourceTableFile(const int32_t cookie, const String8& tablePath);
+
     /*
      * Set the current locale and vendor.  The locale can change during
      * the lifetime of an AssetManager if the user updates the device's
@@ -195,7 +223,7 @@ public:
 
     /*
      * Get the type of a file in the asset hierarchy.  They will either
-     * be "regular" or "directory".  [Currently only works for "regular".]
+     * be "regular" or "directory".
      *
      * Can also be used as a quick test for existence of a file.
      */
@@ -228,11 +256,24 @@ public:
 
     /**
      * Generate idmap data to translate resources IDs between a package and a
-     * corresponding overlay package.
+     * corresponding overlay package.  Idmaps already made in this process
+     * for the same paths and CRCs are reused.
      */
     bool createIdmap(const char* targetApkPath, const char* overlayApkPath,
         uint32_t targetCrc, uint32_t overlayCrc, uint32_t** outData, size_t* outSize);
 
+    /**
+     * Generate the idmaps of many overlay packages of one target, as
+     * createIdmap() does for each, loading the target's table only once
+     * and sharing the overlays among up to "numThreads" threads.
+     * outData[i] and outSizes[i] receive the idmap for overlayApkPaths[i],
+     * to be free(3)d by the caller, or NULL and 0 if none could be made.
+     * Returns the number of idmaps made.
+     */
+    size_t createIdmaps(const char* targetApkPath, uint32_t targetCrc,
+        const Vector<String8>& overlayApkPaths, const Vector<uint32_t>& overlayCrcs,
+        uint32_t** outData, size_t* outSizes, size_t numThreads = 1);
+
 private:
     struct asset_path
     {
@@ -252,7 +293,7 @@ private:
     String8 createPathNameLocked(const asset_path& path, const char* locale,
         const char* vendor);
     String8 createPathNameLocked(const asset_path& path, const char* rootDir);
-    String8 createZipSourceNameLocked(const String8& zipFileName,
+    static String8 createZipSourceNameLocked(const String8& zipFileName,
         const String8& dirName, const String8& fileName);
 
     ZipFileRO* getZipFileLocked(const asset_path& path);
@@ -269,13 +310,19 @@ private:
         const SortedVector<AssetDir::FileInfo>* pContents);
 
     void loadFileNameCacheLocked(void);
-    void fncScanLocked(SortedVector<AssetDir::FileInfo>* pMergedInfo,
-        const char* dirName);
-    bool fncScanAndMergeDirLocked(
-        SortedVector<AssetDir::FileInfo>* pMergedInfo,
-        const asset_path& path, const char* locale, const char* vendor,
-        const char* dirName);
+    void validateFileNameCacheLocked(void);
+    void fncScanLocked(int32_t cookie);
+    void fncScanAndMergeDirLocked(int32_t cookie, const String8& dirPath,
+        const String8& dirName);
+    void fncAddLocked(int32_t cookie, const String8& name);
     void purgeFileNameCacheLocked(void);
+    static bool normalizeCacheName(const char* fileName, String8* outName);
+    bool lookupFileNameCacheLocked(const char* fileName, bool isDirectory, String8* outName,
+        const Vector<int32_t>** outCookies) const;
+    bool isInFileNameCacheLocked(const asset_path& ap, const char* fileName, bool isDirectory,
+        bool* outFound) const;
+    Asset* openCachedNonAssetLocked(const String8& fileName, AccessMode mode,
+        const Vector<int32_t>* cookies, int32_t* outCookie);
 
     const ResTable* getResTable(bool required = true) const;
     void setLocaleLocked(const char* locale);
@@ -284,6 +331,19 @@ private:
 
     Asset* openIdmapLocked(const struct asset_path& ap) const;
 
+    static bool resolveAssetPath(const String8& path, asset_path* outPath);
+
+    struct PreloadBatch;
+    class PreloadThread;
+    void preloadAssetPathLocked(const String8& path, bool loadTables);
+
+    struct IdmapBatch;
+    class IdmapThread;
+    Asset* openIdmapTableLocked(const String8& apkPath);
+    bool createIdmapLocked(const ResTable& target, const char* targetApkPath,
+        const char* overlayApkPath, uint32_t targetCrc, uint32_t overlayCrc,
+        uint32_t** outData, size_t* outSize);
+
     void addSystemOverlays(const char* pathOverlaysList, const String8& targetPackagePath,
             ResTable* sharedRes, size_t offset) const;
 
@@ -303,6 +363,16 @@ private:
 
         void addOverlay(const asset_path& ap);
         bool getOverlay(size_t idx, asset_path* out) const;
+
+        /*
+         * Put the files and subdirectories of "dirName" in the archive,
+         * with their source names, into "outContents" (if not NULL).  The
+         * directories of the whole archive are indexed the first time this
+         * is called, so later listings don't walk the central directory.
+         * Returns false if the archive has no such directory.
+         */
+        bool getDirectory(const String8& dirName,
+                SortedVector<AssetDir::FileInfo>* outContents);
         
     protected:
         ~SharedZip();
@@ -320,6 +390,18 @@ private:
 
         Vector<asset_path> mOverlays;
 
+        void buildDirectoriesLocked();
+        static size_t addDirectory(const String8& zipName, const String8& dirPath,
+                KeyedVector<String8, size_t>* dirs,
+                Vector<Vector<AssetDir::FileInfo> >* entries);
+        static int compareDirectoryEntries(const AssetDir::FileInfo* lhs,
+                const AssetDir::FileInfo* rhs);
+
+        // The contents of each directory by its path, "" for the top.
+        Mutex mDirectoriesLock;
+        bool mDirectoriesBuilt;
+        KeyedVector<String8, SortedVector<AssetDir::FileInfo> > mDirectories;
+
         static Mutex gLock;
         static DefaultKeyedVector<String8, wp<SharedZip> > gOpen;
     };
@@ -348,6 +430,9 @@ private:
         ResTable* getZipResourceTable(const String8& path);
         ResTable* setZipResourceTable(const String8& path, ResTable* res);
 
+        bool getZipDirectory(const String8& path, const String8& dirName,
+                SortedVector<AssetDir::FileInfo>* outContents);
+
         // generate path, e.g. "common/en-US-noogle.zip"
         static String8 getPathName(const char* path);
 
@@ -360,12 +445,24 @@ private:
         void closeZip(int idx);
 
         int getIndex(const String8& zip) const;
+
+        // Lookups open archives as they need them, while holding mLock
+        // of the AssetManager only for reading.
+        mutable Mutex mLock;
         mutable Vector<String8> mZipPath;
         mutable Vector<sp<SharedZip> > mZipFile;
     };
 
-    // Protect all internal state.
+    // Protect all internal state.  Lookups hold it for reading, so that
+    // they never wait on each other; adding paths and changing the
+    // configuration hold it for writing.
+#if !defined(_WIN32)
+    mutable RWLock  mLock;
+#else
     mutable Mutex   mLock;
+#endif
+    // Serializes loading the file name cache by lookups.
+    mutable Mutex   mCacheLock;
 
     ZipSet          mZipSet;
 
@@ -377,17 +474,21 @@ private:
     ResTable_config* mConfig;
 
     /*
-     * Cached data for "loose" files.  This lets us avoid poking at the
-     * filesystem when searching for loose assets.  Each entry is the
-     * "extended partial" path, e.g. "default/default/foo/bar.txt".  The
-     * full set of files is present, including ".EXCLUDE" entries.
+     * Cached names of the files in every asset path, loose or zipped.
+     * This lets us avoid poking at the filesystem, and at archives that
+     * don't have a file, when searching for assets.  Each key is a
+     * normalized path relative to the asset path, e.g. "assets/foo/bar.txt"
+     * or "default/default/foo.txt", and directories end in '/'.  The value
+     * is the cookies of the asset paths that have it, lowest first, so the
+     * last one takes precedence.  Nothing here depends on the locale or
+     * vendor, so changing the configuration keeps the cache.
      *
-     * We do not cache directory names.  We don't retain the ".gz",
-     * because to our clients "foo" and "foo.gz" both look like "foo".
+     * Loose "foo.gz" is cached as both "foo.gz" and "foo", because to our
+     * clients "foo" and "foo.gz" both look like "foo".
      */
     CacheMode       mCacheMode;         // is the cache enabled?
-    bool            mCacheValid;        // clear when locale or vendor changes
-    SortedVector<AssetDir::FileInfo> mCache;
+    size_t          mCachedPaths;       // asset paths scanned into mCache
+    HashedKeyedVector<String8, Vector<int32_t> > mCache;
 };
 
 }; // namespace android
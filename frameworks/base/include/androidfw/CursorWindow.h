@@ -23,6 +23,7 @@
 
 #include <binder/Parcel.h>
 #include <utils/String8.h>
+#include <utils/Vector.h>
 
 #if LOG_NDEBUG
 
@@ -78,6 +79,19 @@ public:
         friend class CursorWindow;
     } __attribute((packed));
 
+    /**
+     * A field to append with appendRow().  Integers are in l and floats in d.
+     * Strings and blobs are the size bytes at data, including the terminating
+     * null for strings.
+     */
+    struct FieldValue {
+        int32_t type;
+        int64_t l;
+        double d;
+        const void* data;
+        size_t size;
+    };
+
     ~CursorWindow();
 
     static status_t create(const String8& name, size_t size, CursorWindow** outCursorWindow);
@@ -101,6 +115,19 @@ public:
     status_t allocRow();
     status_t freeLastRow();
 
+    /**
+     * Allocate a row and fill in all of its fields from values, which holds
+     * one value per column.  If the row doesn't fit, nothing is appended.
+     */
+    status_t appendRow(const FieldValue* values);
+
+    /**
+     * Append up to numRows rows from values, getNumColumns() values per row,
+     * stopping at the first row that doesn't fit.  The number of rows appended
+     * is returned in outNumAppended.
+     */
+    status_t appendRows(const FieldValue* values, size_t numRows, size_t* outNumAppended);
+
     status_t putBlob(uint32_t row, uint32_t column, const void* value, size_t size);
     status_t putString(uint32_t row, uint32_t column, const char* value, size_t sizeIncludingNull);
     status_t putLong(uint32_t row, uint32_t column, int64_t value);
@@ -166,6 +193,11 @@ private:
     bool mReadOnly;
     Header* mHeader;
 
+    // Offsets of the row slot chunks in list order, so that finding a row
+    // doesn't walk the list.  Only kept for windows this process writes; a
+    // window from a parcel may be refilled by its owner at any time.
+    Vector<uint32_t> mChunkOffsets;
+
     inline void* offsetToPtr(uint32_t offset) {
         return static_cast<uint8_t*>(mData) + offset;
     }
@@ -492,12 +492,15 @@ public:
     void uninit();
 
     // Return string entry as UTF16; if the pool is UTF8, the string will
-    // be converted before returning.
+    // be converted before returning, and the copy kept until uninit().
+    // Safe to call from several threads at once.
     inline const char16_t* stringAt(const ResStringPool_ref& ref, size_t* outLen) const {
         return stringAt(ref.index, outLen);
     }
     const char16_t* stringAt(size_t idx, size_t* outLen) const;
 
+    // Return the UTF8 bytes of a string entry in place, without decoding
+    // or caching anything; callers that only need UTF8 should prefer this.
     // Note: returns null if the string pool is not UTF8.
     const char* string8At(size_t idx, size_t* outLen) const;
 
@@ -508,6 +511,12 @@ public:
     const ResStringPool_span* styleAt(const ResStringPool_ref& ref) const;
     const ResStringPool_span* styleAt(size_t idx) const;
 
+    // setTo() only checks the header and the bounds of the arrays; each
+    // string and style is checked when it is read.  This checks all of
+    // them at once, for a pool from data that isn't trusted, without
+    // decoding or caching anything.  Returns BAD_TYPE at the first bad one.
+    status_t validate() const;
+
     ssize_t indexOfString(const char16_t* str, size_t strLen) const;
 
     size_t size() const;
@@ -518,18 +527,28 @@ public:
     bool isUTF8() const;
 
 private:
+    ssize_t indexOfStringHashed(const void* str, size_t strLen) const;
+    void buildIndexLocked() const;
+
     status_t                    mError;
     void*                       mOwnedData;
     const ResStringPool_header* mHeader;
     size_t                      mSize;
-    mutable Mutex               mDecodeLock;
     const uint32_t*             mEntries;
     const uint32_t*             mEntryStyles;
     const void*                 mStrings;
+    // UTF-16 copies of the strings of a UTF-8 pool, decoded by stringAt()
+    // on first use and published without a lock.
     char16_t mutable**          mCache;
     uint32_t                    mStringPoolSize;    // number of uint16_t
     const uint32_t*             mStyles;
     uint32_t                    mStylePoolSize;    // number of uint32_t
+
+    // Hash index used by indexOfString() on large unsorted pools; built
+    // on first use.
+    mutable Mutex               mIndexLock;
+    uint32_t mutable*           mIndex;
+    mutable size_t              mIndexMask;
 };
 
 /**
@@ -758,9 +777,13 @@ public:
     int32_t getAttributeData(size_t idx) const;
     ssize_t getAttributeValue(size_t idx, Res_value* outValue) const;
 
+    // Neither of these allocates for ASCII names or a resource ID.  aapt
+    // writes the attributes sorted by resource ID, which the lookup by ID
+    // binary searches before scanning them all.
     ssize_t indexOfAttribute(const char* ns, const char* attr) const;
     ssize_t indexOfAttribute(const char16_t* ns, size_t nsLen,
                              const char16_t* attr, size_t attrLen) const;
+    ssize_t indexOfAttribute(uint32_t attrResId) const;
 
     ssize_t indexOfID() const;
     ssize_t indexOfClass() const;
@@ -794,6 +817,15 @@ public:
 
     status_t setTo(const void* data, size_t size, bool copyData=false);
 
+    // Like setTo() without copying, for a block this process flattened
+    // itself: the nodes aren't validated as they are read.  "data" must
+    // stay alive and unchanged while the tree uses it.  Never use these
+    // for data read from an APK or any other file.
+    status_t setToTrusted(const void* data, size_t size);
+    // The same, but the tree takes ownership of "data", which must come
+    // from malloc(), even if it can't be used.
+    status_t adoptTrusted(void* data, size_t size);
+
     status_t getError() const;
 
     void uninit();
@@ -807,6 +839,7 @@ private:
 
     status_t                    mError;
     void*                       mOwnedData;
+    bool                        mTrusted;
     const ResXMLTree_header*    mHeader;
     size_t                      mSize;
     const uint8_t*              mDataEnd;
@@ -1274,6 +1307,10 @@ struct ResTable_typeSpec
  * index from entriesStart; a value of NO_ENTRY means that entry is
  * not defined.
  *
+ * With FLAG_SPARSE, the array instead holds a ResTable_sparseTypeEntry
+ * for each entry that is defined, sorted by entry index, so that a
+ * configuration defining few of the type's entries stays small.
+ *
  * There may be multiple of these chunks for a particular resource type,
  * supply different configuration variations for the resource values of
  * that type.
@@ -1294,8 +1331,13 @@ struct ResTable_type
     // resource identifier).  0 is invalid.
     uint8_t id;
     
-    // Must be 0.
-    uint8_t res0;
+    enum {
+        // The entry indices are ResTable_sparseTypeEntry, found by a
+        // binary search.  Only readers that know this flag can use such
+        // a table; aapt writes it when asked to.
+        FLAG_SPARSE = 0x01
+    };
+    uint8_t flags;
     // Must be 0.
     uint16_t res1;
     
@@ -1309,6 +1351,27 @@ struct ResTable_type
     ResTable_config config;
 };
 
+/**
+ * An entry index of a ResTable_type with FLAG_SPARSE.
+ */
+union ResTable_sparseTypeEntry {
+    // The raw value, for reading the index as a uint32_t.
+    uint32_t entry;
+    struct {
+        // The index of the entry in its type.
+        uint16_t idx;
+        // The offset of the entry from entriesStart, divided by 4.
+        uint16_t offset;
+    };
+};
+
+/**
+ * The offset from entriesStart of entry "entryIndex" of a dense or sparse
+ * type chunk, or ResTable_type::NO_ENTRY if the chunk does not define it.
+ * The caller must have checked that the entry indices fit in the chunk.
+ */
+uint32_t getTypeEntryOffset(const ResTable_type* type, uint32_t entryIndex);
+
 /**
  * This is the beginning of information about an entry in the resource
  * table.  It holds the reference to the name of this entry, and is
@@ -1489,16 +1552,40 @@ public:
     status_t addMapping(const String16& packageName, uint8_t packageId);
 
     // Performs the actual conversion of build-time resource ID to run-time
-    // resource ID.
-    inline status_t lookupResourceId(uint32_t* resId) const;
-    inline status_t lookupResourceValue(Res_value* value) const;
+    // resource ID.  Every value read from a package goes through these, so
+    // they are a single look up in mLookupTable, kept here to be inlined.
+    inline status_t lookupResourceId(uint32_t* resId) const {
+        const uint8_t translatedId = mLookupTable[*resId >> 24];
+        if (translatedId == 0) {
+            return missingMapping(*resId);
+        }
+        *resId = (*resId & 0x00ffffff) | (((uint32_t) translatedId) << 24);
+        return NO_ERROR;
+    }
+
+    inline status_t lookupResourceValue(Res_value* value) const {
+        if (value->dataType != Res_value::TYPE_DYNAMIC_REFERENCE) {
+            return NO_ERROR;
+        }
+        status_t err = lookupResourceId(&value->data);
+        if (err != NO_ERROR) {
+            return err;
+        }
+        value->dataType = Res_value::TYPE_REFERENCE;
+        return NO_ERROR;
+    }
 
     inline const KeyedVector<String16, uint8_t>& entries() const {
         return mEntries;
     }
 
 private:
+    status_t missingMapping(uint32_t resId) const;
+
     const uint8_t                   mAssignedPackageId;
+    // Run-time package ID by build-time package ID, 0 if unknown.  App and
+    // system IDs map to themselves and 0x00, a shared library referring to
+    // itself, to mAssignedPackageId.
     uint8_t                         mLookupTable[256];
     KeyedVector<String16, uint8_t>  mEntries;
 };
@@ -1523,6 +1610,13 @@ public:
     status_t add(Asset* asset, const int32_t cookie=-1, bool copyData=false);
     status_t add(Asset* asset, Asset* idmapAsset, const int32_t cookie=-1, bool copyData=false);
 
+    // Like add(asset, idmapAsset, cookie), but the table takes ownership of
+    // "asset" and deletes it along with itself, so that its buffer -- for a
+    // stored, aligned table a read-only mapping of the file -- is used in
+    // place rather than copied.  "asset" is deleted at once if it can't be
+    // added or its data had to be copied anyway.
+    status_t addOwned(Asset* asset, Asset* idmapAsset, const int32_t cookie=-1);
+
     status_t add(ResTable* src);
     status_t addEmpty(const int32_t cookie);
 
@@ -1544,6 +1638,30 @@ public:
 
     bool getResourceName(uint32_t resID, bool allowUtf8, resource_name* outName) const;
 
+    // The name of a resource as UTF-8, none of it terminated: spans of the
+    // table's string pools or, for those in UTF-16, of copies the table
+    // keeps.  They stay valid until the table changes.
+    struct resource_name8
+    {
+        const char* package;
+        size_t packageLen;
+        const char* type;
+        size_t typeLen;
+        const char* name;
+        size_t nameLen;
+    };
+
+    // Like getResourceName(), but from an index of the names of every
+    // entry of the resource's type, built the first time that type is
+    // looked up; each later lookup is a few loads, with no lock taken and
+    // nothing decoded or allocated.
+    bool getResourceName8(uint32_t resID, resource_name8* outName) const;
+
+    // Builds the index getResourceName8() uses for every type at once.
+    // getResourceName() uses it too, once built, when it may return UTF-8.
+    // For tools that go on to look up the names of many resources.
+    void indexResourceNames() const;
+
     bool getResourceFlags(uint32_t resID, uint32_t* outFlags) const;
 
     /**
@@ -1610,6 +1728,13 @@ public:
     ssize_t getBagLocked(uint32_t resID, const bag_entry** outBag,
             uint32_t* outTypeSpecFlags=NULL) const;
 
+    /**
+     * Find the mapping for 'name' among the 'count' entries of a bag
+     * retrieved above.  A bag holds its inherited mappings too, sorted by
+     * name, so this is a binary search.  Returns NULL if there is none.
+     */
+    static const bag_entry* findBagEntry(const bag_entry* bag, size_t count, uint32_t name);
+
     void unlock() const;
 
     class Theme {
@@ -1652,6 +1777,19 @@ public:
                 uint32_t* inoutTypeSpecFlags = NULL,
                 ResTable_config* inoutConfig = NULL) const;
 
+        /**
+         * Retrieve 'count' attributes of the theme at once, each resolved
+         * as getAttribute() followed by resolveAttributeReference() would.
+         * outBlocks[i] is the table index of outValues[i], or a negative
+         * error code if attrs[i] could not be resolved; the type spec
+         * flags of each are put in outTypeSpecFlags[i] if it is not NULL.
+         *
+         * @return size_t How many of the attributes were resolved.
+         */
+        size_t resolveAttributes(const uint32_t* attrs, size_t count,
+                Res_value* outValues, ssize_t* outBlocks,
+                uint32_t* outTypeSpecFlags = NULL) const;
+
         void dumpToLog() const;
         
     private:
@@ -1664,6 +1802,8 @@ public:
             Res_value value;
         };
 
+        // 'entries' is the data of a SharedBuffer, shared between themes
+        // copied with setTo() until one of them changes it.
         struct type_info {
             size_t numEntries;
             theme_entry* entries;
@@ -1683,6 +1823,62 @@ public:
     void setParameters(const ResTable_config* params);
     void getParameters(ResTable_config* params) const;
 
+    /**
+     * Freezes the table once it is fully loaded, or thaws it again.  While
+     * frozen, add() and setParameters() fail and nothing that reads the
+     * table takes a lock, so any number of threads may look resources up
+     * and resolve bags at once; only computing a bag not seen before
+     * briefly locks.  lock() and unlock() do nothing, and the bag returned
+     * by lockBag() stays valid without it.  Freezing and thawing must not
+     * race with readers.
+     */
+    status_t setFrozen(bool frozen);
+    bool isFrozen() const;
+
+    /**
+     * Loading a table checks its chunk headers, and each string and entry
+     * is checked when it is first read, so a large table that is trusted
+     * loads without touching most of it.  With full validation, the
+     * tables added afterwards have every string of their pools and every
+     * entry of their types checked as they are added instead, so that
+     * one from an APK that isn't trusted is rejected up front.  Either
+     * way nothing is read out of bounds.
+     */
+    void setFullValidation(bool full);
+    bool getFullValidation() const;
+
+    /**
+     * What the cache of bags computed by lockBag() and getBagLocked()
+     * holds, and how it has been used.  Bags read while the table is
+     * frozen, which takes no lock, aren't counted as hits.
+     */
+    struct BagCacheStats {
+        size_t bags;        // bags cached
+        size_t bytes;       // memory they take
+        size_t hits;        // bags found in the cache
+        size_t misses;      // bags computed
+        size_t evictions;   // bags dropped to stay under the limit
+    };
+
+    /**
+     * Limits the memory the bag cache may take to about maxBytes, 0
+     * meaning no limit.  When over it, the least recently used bags are
+     * dropped the next time lockBag() or lock() is called, so that no bag
+     * is dropped while the caller holds it; it goes over by no more than
+     * the bags one locked call computes.  Nothing is dropped while the
+     * table is frozen.
+     */
+    void setBagCacheLimit(size_t maxBytes);
+    size_t getBagCacheLimit() const;
+    void getBagCacheStats(BagCacheStats* outStats) const;
+
+    /**
+     * Drops the least recently used bags until the cache takes no more
+     * than maxBytes.  Like setParameters(), this must not be called while
+     * a bag is held, and fails with INVALID_OPERATION while frozen.
+     */
+    status_t trimBagCache(size_t maxBytes = 0);
+
     // Retrieve an identifier (which can be passed to getResource)
     // for a given resource name.  The 'name' can be fully qualified
     // (<package>:<type>.<basename>) or the package or type components
@@ -1704,6 +1900,16 @@ public:
                                   const char** outErrorMsg = NULL,
                                   bool* outPublicOnly = NULL);
 
+    // Like the above, but without copying: the parts of the name point into
+    // "refStr", or into "defType" and "defPackage" when they are used, and
+    // are not terminated.  type8 and name8 are NULL.
+    static bool expandResourceRef(const char16_t* refStr, size_t refLen,
+                                  resource_name* outName,
+                                  const String16* defType = NULL,
+                                  const String16* defPackage = NULL,
+                                  const char** outErrorMsg = NULL,
+                                  bool* outPublicOnly = NULL);
+
     static bool stringToInt(const char16_t* s, size_t len, Res_value* outValue);
     static bool stringToFloat(const char16_t* s, size_t len, Res_value* outValue);
 
@@ -1807,7 +2013,19 @@ public:
             uint32_t* pTargetCrc, uint32_t* pOverlayCrc,
             String8* pTargetPath, String8* pOverlayPath);
 
-    void print(bool inclValues) const;
+    enum PrintFormat {
+        // The text "aapt dump resources" has always printed.
+        PRINT_TEXT,
+        // A JSON object a line for each value of each resource in each
+        // config, for tools to read.
+        PRINT_JSON_LINES,
+    };
+
+    // Writes the table to stdout.  Its types are formatted by up to
+    // "numThreads" threads at once, each into a buffer of its own, and the
+    // buffers written in order, so the output is the same for any count.
+    void print(bool inclValues, size_t numThreads = 1,
+            PrintFormat format = PRINT_TEXT) const;
     static String8 normalizeForOutput(const char* input);
 
 private:
@@ -1824,6 +2042,25 @@ private:
 
     ssize_t getResourcePackageIndex(uint32_t resID) const;
 
+    ssize_t buildBagLocked(uint32_t resID, const bag_entry** outBag,
+            uint32_t* outTypeSpecFlags) const;
+    const bag_set* getFrozenBag(uint32_t resID) const;
+    void cacheBagLocked(bag_set* set, bag_set** slot) const;
+    void useBagLocked(bag_set* set) const;
+    void uncacheBagLocked(bag_set* set) const;
+    void trimBagCacheLocked(size_t maxBytes) const;
+
+    // One of the names an enum or flags attribute gives its values.
+    struct value_name {
+        String16 name;
+        Res_value value;
+    };
+    const Vector<value_name>* getFrozenValueNames(uint32_t attrID) const;
+    static const value_name* findValueName(const Vector<value_name>& names,
+            const char16_t* name, size_t nameLen);
+    void clearValueNames();
+    void clearConfigurations();
+
     status_t getEntry(
         const PackageGroup* packageGroup, int typeIndex, int entryIndex,
         const ResTable_config* config,
@@ -1835,12 +2072,42 @@ private:
     status_t parsePackage(
         const ResTable_package* const pkg, const Header* const header);
 
-    void print_value(const Package* pkg, const Res_value& value) const;
+    struct PrintBatch;
+    class PrintThread;
+
+    void print_type(const PackageGroup* pg, size_t typeIndex, ssize_t configIndex,
+            bool inclValues, String8* out) const;
+    void print_type_json(const PackageGroup* pg, size_t typeIndex, ssize_t configIndex,
+            bool inclValues, String8* out) const;
+    void print_value(const Package* pkg, const Res_value& value, String8* out) const;
+    void print_value_json(const Package* pkg, const Res_value& value, String8* out) const;
     
     mutable Mutex               mLock;
 
     status_t                    mError;
 
+    bool                        mFrozen;
+
+    bool                        mFullValidation;
+
+    // The bags in the caches of the package groups, most recently used
+    // first, with what they add up to.  Guarded by mLock.
+    mutable bag_set*            mNewestBag;
+    mutable bag_set*            mOldestBag;
+    mutable BagCacheStats       mBagCacheStats;
+    size_t                      mBagCacheLimit;
+
+    // The value names of the enum and flags attributes stringToValue()
+    // has parsed while frozen, each sorted by name.
+    mutable Mutex               mValueNamesLock;
+    mutable KeyedVector<uint32_t, Vector<value_name>*> mValueNames;
+
+    // The unique configurations getConfigurations() found, without and
+    // with mipmaps ignored, until packages are added.
+    mutable Mutex               mConfigurationsLock;
+    mutable Vector<ResTable_config> mConfigurations[2];
+    mutable bool                mHaveConfigurations[2];
+
     ResTable_config             mParams;
 
     // Array of all resource tables.
@@ -22,6 +22,7 @@
 #include <zlib.h>
 
 #include <utils/Compat.h>
+#include <utils/Vector.h>
 
 namespace android {
 
@@ -29,6 +30,7 @@ class StreamingZipInflater {
 public:
     static const size_t INPUT_CHUNK_SIZE = 64 * 1024;
     static const size_t OUTPUT_CHUNK_SIZE = 64 * 1024;
+    static const size_t DEFAULT_CHECKPOINT_INTERVAL = 1024 * 1024;
 
     // Flavor that pages in the compressed data from a fd
     StreamingZipInflater(int fd, off64_t compDataStart, size_t uncompSize, size_t compSize);
@@ -42,14 +44,31 @@ public:
     // be NULL, in which case the data is consumed and discarded.
     ssize_t read(void* outBuf, size_t count);
 
-    // seeking backwards requires uncompressing fom the beginning, so is very
-    // expensive.  seeking forwards only requires uncompressing from the current
-    // position to the destination.
+    // seeking backwards requires uncompressing fom the beginning, or from the
+    // closest checkpoint before the destination, so is expensive.  seeking
+    // forwards only requires uncompressing from the current position, or a
+    // checkpoint past it, to the destination.
     off64_t seekAbsolute(off64_t absoluteInputPosition);
 
+    // Keep a copy of the inflater's state about every 'interval' bytes of
+    // uncompressed data, made the first time that data is decoded, for
+    // seekAbsolute() to start from.  Each one costs about 40KB, most of it
+    // zlib's window.  0, the default, keeps none.
+    void setCheckpointInterval(size_t interval) { mCheckpointInterval = interval; }
+
 private:
+    // A copy of mInflateState, and where in the data it had got to.
+    struct Checkpoint {
+        off64_t outPosition;    // uncompressed bytes decoded before it
+        size_t inOffset;        // compressed bytes consumed before it
+        z_stream state;         // owns a copy of zlib's internal state, which
+                                // points back at it, so it mustn't move
+    };
+
     void initInflateState();
     int readNextChunk();
+    void saveCheckpoint();
+    void restoreCheckpoint(const Checkpoint& checkpoint);
 
     // where to find the uncompressed data
     int mFd;
@@ -77,6 +96,10 @@ private:
     // input state bookkeeping
     size_t mInNextChunkOffset;  // offset from start of blob at which the next input chunk lies
     // the z_stream contains state about input block consumption
+
+    // random access; the checkpoints are in order of position
+    size_t mCheckpointInterval;
+    Vector<Checkpoint*> mCheckpoints;
 };
 
 }
@@ -22,8 +22,7 @@
 namespace android {
 
 struct TypeVariant {
-    TypeVariant(const ResTable_type* data)
-        : data(data) {}
+    TypeVariant(const ResTable_type* data);
 
     class iterator {
     public:
@@ -70,10 +69,15 @@ struct TypeVariant {
     }
 
     iterator endEntries() const {
-        return iterator(this, dtohl(data->entryCount));
+        return iterator(this, mLength);
     }
 
     const ResTable_type* data;
+
+private:
+    // The number of entry indices iterated over: for a sparse type, one
+    // past the last index it defines.
+    uint32_t mLength;
 };
 
 } // namespace android
@@ -152,6 +152,33 @@ public:
      */
     bool uncompressEntry(ZipEntryRO entry, int fd) const;
 
+    /*
+     * One entry for uncompressEntries(): the data of "entry" goes into
+     * "buffer", which holds "size" bytes, and "ok" is set to whether it
+     * did.
+     */
+    struct Extraction {
+        ZipEntryRO entry;
+        void* buffer;
+        size_t size;
+        bool ok;
+    };
+
+    /*
+     * Uncompress a list of entries, each into its own buffer.  The whole
+     * archive is mapped once for all of them rather than each entry being
+     * read on its own, and with "numThreads" > 1 the entries are shared
+     * among that many threads.  If the archive can't be mapped they are
+     * uncompressed one at a time with uncompressEntry().  With "checkCrc"
+     * an entry whose data doesn't match the CRC of its central directory
+     * entry isn't "ok" either; the check is made by the thread that
+     * uncompressed it, while the data is still in its cache.
+     *
+     * Returns the number of entries that couldn't be uncompressed.
+     */
+    size_t uncompressEntries(Extraction* entries, size_t count,
+        size_t numThreads = 1, bool checkCrc = false) const;
+
     ~ZipFileRO();
 
 private:
@@ -311,6 +311,27 @@ Asset::~Asset(void)
 }
 
 
+/*
+ * Copy the whole asset by reading it from the start.  Assets that can do
+ * better override this.
+ */
+bool Asset::copyTo(void* buf)
+{
+    if (seek(0, SEEK_SET) != 0) {
+        return false;
+    }
+    const size_t length = getLength();
+    size_t copied = 0;
+    while (copied < length) {
+        const ssize_t actual = read((char*)buf + copied, length - copied);
+        if (actual <= 0) {
+            return false;
+        }
+        copied += actual;
+    }
+    return true;
+}
+
 /*
  * Do generic seek() housekeeping.  Pass in the offset/whence values from
  * the seek request, along with the current chunk offset and the chunk
@@ -724,6 +745,7 @@ status_t _CompressedAsset::openChunk(int fd, off64_t offset,
 
     if (uncompressedLen > StreamingZipInflater::OUTPUT_CHUNK_SIZE) {
         mZipInflater = new StreamingZipInflater(mFd, offset, uncompressedLen, compressedLen);
+        mZipInflater->setCheckpointInterval(StreamingZipInflater::DEFAULT_CHECKPOINT_INTERVAL);
     }
 
     return NO_ERROR;
@@ -748,6 +770,7 @@ status_t _CompressedAsset::openChunk(FileMap* dataMap, size_t uncompressedLen)
 
     if (uncompressedLen > StreamingZipInflater::OUTPUT_CHUNK_SIZE) {
         mZipInflater = new StreamingZipInflater(dataMap, uncompressedLen);
+        mZipInflater->setCheckpointInterval(StreamingZipInflater::DEFAULT_CHECKPOINT_INTERVAL);
     }
     return NO_ERROR;
 }
@@ -797,7 +820,8 @@ ssize_t _CompressedAsset::read(void* buf, size_t count)
  *
  * If we're working in a streaming mode, this is going to be fairly
  * expensive, because it requires plowing through a bunch of compressed
- * data.
+ * data, though no more than the inflater's checkpoint interval's worth
+ * once the data before the new position has been read.
  */
 off64_t _CompressedAsset::seek(off64_t offset, int whence)
 {
@@ -837,6 +861,27 @@ void _CompressedAsset::close(void)
     }
 }
 
+/*
+ * Expand the data into "buf", in a single pass when it is mapped, unless
+ * getBuffer() has expanded it already.
+ */
+bool _CompressedAsset::copyTo(void* buf)
+{
+    if (mBuf != NULL) {
+        memcpy(buf, mBuf, mUncompressedLen);
+        return true;
+    }
+    if (mMap != NULL) {
+        return ZipUtils::inflateToBuffer(mMap->getDataPtr(), buf,
+                mUncompressedLen, mCompressedLen);
+    }
+    assert(mFd >= 0);
+    if (lseek(mFd, mStart, SEEK_SET) != mStart) {
+        return false;
+    }
+    return ZipUtils::inflateToBuffer(mFd, buf, mUncompressedLen, mCompressedLen);
+}
+
 /*
  * Get a pointer to a read-only buffer of data.
  *
@@ -64,6 +64,14 @@
 
 using namespace android;
 
+#if !defined(_WIN32)
+typedef RWLock::AutoRLock AutoReadLock;
+typedef RWLock::AutoWLock AutoWriteLock;
+#else
+typedef AutoMutex AutoReadLock;
+typedef AutoMutex AutoWriteLock;
+#endif
+
 static const bool kIsDebug = false;
 
 /*
@@ -152,7 +160,7 @@ int32_t AssetManager::getGlobalCount()
 AssetManager::AssetManager(CacheMode cacheMode)
     : mLocale(NULL), mVendor(NULL),
       mResources(NULL), mConfig(new ResTable_config),
-      mCacheMode(cacheMode), mCacheValid(false)
+      mCacheMode(cacheMode), mCachedPaths(0)
 {
     int count = android_atomic_inc(&gCount) + 1;
     if (kIsDebug) {
@@ -176,28 +184,35 @@ AssetManager::~AssetManager(void)
     delete[] mVendor;
 }
 
-bool AssetManager::addAssetPath(const String8& path, int32_t* cookie)
+bool AssetManager::resolveAssetPath(const String8& path, asset_path* outPath)
 {
-    AutoMutex _l(mLock);
-
-    asset_path ap;
-
     String8 realPath(path);
     if (kAppZipName) {
         realPath.appendPath(kAppZipName);
     }
-    ap.type = ::getFileType(realPath.string());
-    if (ap.type == kFileTypeRegular) {
-        ap.path = realPath;
+    outPath->type = ::getFileType(realPath.string());
+    if (outPath->type == kFileTypeRegular) {
+        outPath->path = realPath;
     } else {
-        ap.path = path;
-        ap.type = ::getFileType(path.string());
-        if (ap.type != kFileTypeDirectory && ap.type != kFileTypeRegular) {
+        outPath->path = path;
+        outPath->type = ::getFileType(path.string());
+        if (outPath->type != kFileTypeDirectory && outPath->type != kFileTypeRegular) {
             ALOGW("Asset path %s is neither a directory nor file (type=%d).",
-                 path.string(), (int)ap.type);
+                 path.string(), (int)outPath->type);
             return false;
         }
     }
+    return true;
+}
+
+bool AssetManager::addAssetPath(const String8& path, int32_t* cookie)
+{
+    AutoWriteLock _l(mLock);
+
+    asset_path ap;
+    if (!resolveAssetPath(path, &ap)) {
+        return false;
+    }
 
     // Skip if we have it already.
     for (size_t i=0; i<mAssetPaths.size(); i++) {
@@ -248,7 +263,7 @@ bool AssetManager::addOverlayPath(const String8& packagePath, int32_t* cookie)
 {
     const String8 idmapPath = idmapPathForPackagePath(packagePath);
 
-    AutoMutex _l(mLock);
+    AutoWriteLock _l(mLock);
 
     for (size_t i = 0; i < mAssetPaths.size(); ++i) {
         if (mAssetPaths[i].idmap == idmapPath) {
@@ -309,27 +324,324 @@ bool AssetManager::addOverlayPath(const String8& packagePath, int32_t* cookie)
     return true;
  }
 
+/*
+ * Idmaps made in this process, by the paths and CRCs they were made for.
+ * The map is made on first use, as strings can't be made this early.
+ */
+static Mutex gIdmapCacheLock;
+static KeyedVector<String8, Vector<uint8_t> >* gIdmapCache = NULL;
+static const size_t kMaxCachedIdmaps = 512;
+
+static String8 idmapCacheKey(const char* targetApkPath, const char* overlayApkPath,
+        uint32_t targetCrc, uint32_t overlayCrc)
+{
+    return String8::format("%08x %08x %s %s", targetCrc, overlayCrc,
+            targetApkPath, overlayApkPath);
+}
+
+static bool findCachedIdmap(const String8& key, uint32_t** outData, size_t* outSize)
+{
+    AutoMutex _l(gIdmapCacheLock);
+    const ssize_t idx = gIdmapCache != NULL ? gIdmapCache->indexOfKey(key) : -1;
+    if (idx < 0) {
+        return false;
+    }
+    const Vector<uint8_t>& idmap = gIdmapCache->valueAt(idx);
+    if ((*outData = (uint32_t*) malloc(idmap.size())) == NULL) {
+        return false;
+    }
+    memcpy(*outData, idmap.array(), idmap.size());
+    *outSize = idmap.size();
+    return true;
+}
+
+static void cacheIdmap(const String8& key, const uint32_t* data, size_t size)
+{
+    AutoMutex _l(gIdmapCacheLock);
+    if (gIdmapCache == NULL) {
+        gIdmapCache = new KeyedVector<String8, Vector<uint8_t> >;
+    }
+    if (gIdmapCache->size() >= kMaxCachedIdmaps) {
+        gIdmapCache->clear();
+    }
+    Vector<uint8_t> idmap;
+    idmap.appendArray((const uint8_t*) data, size);
+    gIdmapCache->add(key, idmap);
+}
+
+Asset* AssetManager::openIdmapTableLocked(const String8& apkPath)
+{
+    asset_path ap;
+    ap.type = kFileTypeRegular;
+    ap.path = apkPath;
+    Asset* ass = openNonAssetInPathLocked("resources.arsc", Asset::ACCESS_BUFFER, ap);
+    if (ass == NULL) {
+        ALOGW("failed to find resources.arsc in %s\n", ap.path.string());
+    }
+    return ass;
+}
+
+bool AssetManager::createIdmapLocked(const ResTable& target, const char* targetApkPath,
+        const char* overlayApkPath, uint32_t targetCrc, uint32_t overlayCrc,
+        uint32_t** outData, size_t* outSize)
+{
+    const String8 key(idmapCacheKey(targetApkPath, overlayApkPath, targetCrc, overlayCrc));
+    if (findCachedIdmap(key, outData, outSize)) {
+        return true;
+    }
+
+    Asset* ass = openIdmapTableLocked(String8(overlayApkPath));
+    if (ass == NULL) {
+        return false;
+    }
+    bool created;
+    {
+        // The table refers to the asset's buffer, so it goes first.
+        ResTable overlay;
+        overlay.add(ass);
+        created = target.createIdmap(overlay, targetCrc, overlayCrc,
+                targetApkPath, overlayApkPath, (void**)outData, outSize) == NO_ERROR;
+    }
+    delete ass;
+
+    if (created) {
+        cacheIdmap(key, *outData, *outSize);
+    }
+    return created;
+}
+
 bool AssetManager::createIdmap(const char* targetApkPath, const char* overlayApkPath,
         uint32_t targetCrc, uint32_t overlayCrc, uint32_t** outData, size_t* outSize)
 {
-    AutoMutex _l(mLock);
-    const String8 paths[2] = { String8(targetApkPath), String8(overlayApkPath) };
-    ResTable tables[2];
-
-    for (int i = 0; i < 2; ++i) {
-        asset_path ap;
-        ap.type = kFileTypeRegular;
-        ap.path = paths[i];
-        Asset* ass = openNonAssetInPathLocked("resources.arsc", Asset::ACCESS_BUFFER, ap);
-        if (ass == NULL) {
-            ALOGW("failed to find resources.arsc in %s\n", ap.path.string());
-            return false;
+    AutoReadLock _l(mLock);
+
+    const String8 key(idmapCacheKey(targetApkPath, overlayApkPath, targetCrc, overlayCrc));
+    if (findCachedIdmap(key, outData, outSize)) {
+        return true;
+    }
+
+    Asset* ass = openIdmapTableLocked(String8(targetApkPath));
+    if (ass == NULL) {
+        return false;
+    }
+    bool created;
+    {
+        ResTable target;
+        target.add(ass);
+        created = createIdmapLocked(target, targetApkPath, overlayApkPath,
+                targetCrc, overlayCrc, outData, outSize);
+    }
+    delete ass;
+    return created;
+}
+
+/*
+ * The overlays of a createIdmaps() call still to be done, taken in turn
+ * by each of its threads.
+ */
+struct AssetManager::IdmapBatch {
+    AssetManager* am;
+    const ResTable* target;
+    const char* targetApkPath;
+    uint32_t targetCrc;
+    const Vector<String8>* overlayApkPaths;
+    const Vector<uint32_t>* overlayCrcs;
+    uint32_t** outData;
+    size_t* outSizes;
+    Vector<size_t> todo;
+    volatile int32_t next;
+
+    void run()
+    {
+        for (;;) {
+            const size_t i = (size_t) android_atomic_inc(&next);
+            if (i >= todo.size()) {
+                return;
+            }
+            const size_t overlay = todo[i];
+            if (!am->createIdmapLocked(*target, targetApkPath,
+                        (*overlayApkPaths)[overlay].string(), targetCrc,
+                        (*overlayCrcs)[overlay], &outData[overlay], &outSizes[overlay])) {
+                outData[overlay] = NULL;
+                outSizes[overlay] = 0;
+            }
+        }
+    }
+};
+
+class AssetManager::IdmapThread : public Thread {
+public:
+    IdmapThread(IdmapBatch* batch) : Thread(false), mBatch(batch) {}
+
+private:
+    virtual bool threadLoop()
+    {
+        mBatch->run();
+        return false;
+    }
+
+    IdmapBatch* mBatch;
+};
+
+size_t AssetManager::createIdmaps(const char* targetApkPath, uint32_t targetCrc,
+        const Vector<String8>& overlayApkPaths, const Vector<uint32_t>& overlayCrcs,
+        uint32_t** outData, size_t* outSizes, size_t numThreads)
+{
+    AutoReadLock _l(mLock);
+
+    IdmapBatch batch;
+    batch.am = this;
+    batch.target = NULL;
+    batch.targetApkPath = targetApkPath;
+    batch.targetCrc = targetCrc;
+    batch.overlayApkPaths = &overlayApkPaths;
+    batch.overlayCrcs = &overlayCrcs;
+    batch.outData = outData;
+    batch.outSizes = outSizes;
+    batch.next = 0;
+
+    // The target's table is only needed for overlays not made before.
+    const size_t N = overlayApkPaths.size();
+    for (size_t i = 0; i < N; i++) {
+        outData[i] = NULL;
+        outSizes[i] = 0;
+        const String8 key(idmapCacheKey(targetApkPath, overlayApkPaths[i].string(),
+                targetCrc, i < overlayCrcs.size() ? overlayCrcs[i] : 0));
+        if (i >= overlayCrcs.size()) {
+            ALOGW("idmap: no CRC given for overlay %s\n", overlayApkPaths[i].string());
+        } else if (!findCachedIdmap(key, &outData[i], &outSizes[i])) {
+            batch.todo.add(i);
         }
-        tables[i].add(ass);
     }
 
-    return tables[0].createIdmap(tables[1], targetCrc, overlayCrc,
-            targetApkPath, overlayApkPath, (void**)outData, outSize) == NO_ERROR;
+    if (!batch.todo.isEmpty()) {
+        Asset* ass = openIdmapTableLocked(String8(targetApkPath));
+        if (ass != NULL) {
+            ResTable target;
+            target.add(ass);
+            batch.target = &target;
+
+            if (numThreads > batch.todo.size()) {
+                numThreads = batch.todo.size();
+            }
+            Vector<sp<IdmapThread> > threads;
+            for (size_t i = 1; i < numThreads; i++) {
+                sp<IdmapThread> thread = new IdmapThread(&batch);
+                if (thread->run("idmap", PRIORITY_NORMAL) == NO_ERROR) {
+                    threads.add(thread);
+                }
+            }
+            batch.run();
+            for (size_t i = 0; i < threads.size(); i++) {
+                threads[i]->join();
+            }
+        }
+        delete ass;
+    }
+
+    size_t created = 0;
+    for (size_t i = 0; i < N; i++) {
+        if (outData[i] != NULL) {
+            created++;
+        }
+    }
+    return created;
+}
+
+/*
+ * The paths of a preloadAssetPaths() call, taken in turn by each of its
+ * threads.
+ */
+struct AssetManager::PreloadBatch {
+    AssetManager* am;
+    const Vector<String8>* paths;
+    bool loadTables;
+    volatile int32_t next;
+
+    void run()
+    {
+        for (;;) {
+            const size_t i = (size_t) android_atomic_inc(&next);
+            if (i >= paths->size()) {
+                return;
+            }
+            am->preloadAssetPathLocked((*paths)[i], loadTables);
+        }
+    }
+};
+
+class AssetManager::PreloadThread : public Thread {
+public:
+    PreloadThread(PreloadBatch* batch) : Thread(false), mBatch(batch) {}
+
+private:
+    virtual bool threadLoop()
+    {
+        mBatch->run();
+        return false;
+    }
+
+    PreloadBatch* mBatch;
+};
+
+void AssetManager::preloadAssetPaths(const Vector<String8>& paths, bool loadTables,
+        size_t numThreads)
+{
+    AutoReadLock _l(mLock);
+
+    PreloadBatch batch;
+    batch.am = this;
+    batch.paths = &paths;
+    batch.loadTables = loadTables;
+    batch.next = 0;
+
+    if (numThreads > paths.size()) {
+        numThreads = paths.size();
+    }
+    Vector<sp<PreloadThread> > threads;
+    for (size_t i = 1; i < numThreads; i++) {
+        sp<PreloadThread> thread = new PreloadThread(&batch);
+        if (thread->run("preload", PRIORITY_NORMAL) == NO_ERROR) {
+            threads.add(thread);
+        }
+    }
+    batch.run();
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i]->join();
+    }
+}
+
+void AssetManager::preloadAssetPathLocked(const String8& path, bool loadTables)
+{
+    asset_path ap;
+    if (!resolveAssetPath(path, &ap) || ap.type != kFileTypeRegular) {
+        return;
+    }
+
+    // Opened outside the ZipSet's lock, so that the other threads can open
+    // theirs meanwhile; the ZipSet then keeps it open until it is added.
+    sp<SharedZip> shared = SharedZip::get(ap.path);
+    ZipFileRO* zip = mZipSet.getZip(ap.path);
+    if (zip == NULL || !loadTables || mZipSet.getZipResourceTableAsset(ap.path) != NULL) {
+        return;
+    }
+
+    ZipEntryRO entry = zip->findEntryByName("resources.arsc");
+    if (entry == NULL) {
+        return;
+    }
+    Asset* ass = openAssetFromZipLocked(zip, entry, Asset::ACCESS_BUFFER,
+            String8("resources.arsc"));
+    zip->releaseEntry(entry);
+    if (ass == NULL) {
+        return;
+    }
+    // Inflated here, rather than by setZipResourceTableAsset() while it
+    // holds the global lock of every SharedZip.
+    ass->getBuffer(true);
+    ass->setAssetSource(createZipSourceNameLocked(ZipSet::getPathName(ap.path.string()),
+            String8(""), String8("resources.arsc")));
+    mZipSet.setZipResourceTableAsset(ap.path, ass);
 }
 
 bool AssetManager::addDefaultAssets()
@@ -345,14 +657,14 @@ bool AssetManager::addDefaultAssets()
 
 int32_t AssetManager::nextAssetPath(const int32_t cookie) const
 {
-    AutoMutex _l(mLock);
+    AutoReadLock _l(mLock);
     const size_t next = static_cast<size_t>(cookie) + 1;
     return next > mAssetPaths.size() ? -1 : next;
 }
 
 String8 AssetManager::getAssetPath(const int32_t cookie) const
 {
-    AutoMutex _l(mLock);
+    AutoReadLock _l(mLock);
     const size_t which = static_cast<size_t>(cookie) - 1;
     if (which < mAssetPaths.size()) {
         return mAssetPaths[which].path;
@@ -360,6 +672,41 @@ String8 AssetManager::getAssetPath(const int32_t cookie) const
     return String8();
 }
 
+ZipFileRO* AssetManager::getZipFile(const int32_t cookie)
+{
+    AutoReadLock _l(mLock);
+    const size_t which = static_cast<size_t>(cookie) - 1;
+    if (which >= mAssetPaths.size() || mAssetPaths[which].type == kFileTypeDirectory) {
+        return NULL;
+    }
+    return getZipFileLocked(mAssetPaths[which]);
+}
+
+bool AssetManager::setResourceTableFile(const int32_t cookie, const String8& tablePath)
+{
+    AutoWriteLock _l(mLock);
+    const size_t which = static_cast<size_t>(cookie) - 1;
+    if (which >= mAssetPaths.size() || mResources != NULL) {
+        return false;
+    }
+    const asset_path& ap = mAssetPaths[which];
+    if (ap.type == kFileTypeDirectory) {
+        return false;
+    }
+
+    Asset* ass = Asset::createFromFile(tablePath.string(), Asset::ACCESS_BUFFER);
+    if (ass == NULL) {
+        return false;
+    }
+    // Another asset manager may have loaded the zip's table already.
+    if (mZipSet.getZipResourceTableAsset(ap.path) != NULL) {
+        delete ass;
+        return false;
+    }
+    mZipSet.setZipResourceTableAsset(ap.path, ass);
+    return true;
+}
+
 /*
  * Set the current locale.  Use NULL to indicate no locale.
  *
@@ -368,7 +715,7 @@ String8 AssetManager::getAssetPath(const int32_t cookie) const
  */
 void AssetManager::setLocale(const char* locale)
 {
-    AutoMutex _l(mLock);
+    AutoWriteLock _l(mLock);
     setLocaleLocked(locale);
 }
 
@@ -383,12 +730,8 @@ static const int kTlPrefixLen = sizeof(kTlPrefix) - 1;
 
 void AssetManager::setLocaleLocked(const char* locale)
 {
-    if (mLocale != NULL) {
-        /* previously set, purge cached data */
-        purgeFileNameCacheLocked();
-        //mZipSet.purgeLocale();
-        delete[] mLocale;
-    }
+    // The file name cache has every locale's files, so it is kept.
+    delete[] mLocale;
 
     // If we're attempting to set a locale that starts with "fil",
     // we should convert it to "tl" for backwards compatibility since
@@ -440,20 +783,15 @@ void AssetManager::setLocaleLocked(const char* locale)
  */
 void AssetManager::setVendor(const char* vendor)
 {
-    AutoMutex _l(mLock);
+    AutoWriteLock _l(mLock);
 
-    if (mVendor != NULL) {
-        /* previously set, purge cached data */
-        purgeFileNameCacheLocked();
-        //mZipSet.purgeVendor();
-        delete[] mVendor;
-    }
+    delete[] mVendor;
     mVendor = strdupNew(vendor);
 }
 
 void AssetManager::setConfiguration(const ResTable_config& config, const char* locale)
 {
-    AutoMutex _l(mLock);
+    AutoWriteLock _l(mLock);
     *mConfig = config;
     if (locale) {
         setLocaleLocked(locale);
@@ -468,7 +806,7 @@ void AssetManager::setConfiguration(const ResTable_config& config, const char* l
 
 void AssetManager::getConfiguration(ResTable_config* outConfig) const
 {
-    AutoMutex _l(mLock);
+    AutoReadLock _l(mLock);
     *outConfig = *mConfig;
 }
 
@@ -498,17 +836,22 @@ void AssetManager::getConfiguration(ResTable_config* outConfig) const
  */
 Asset* AssetManager::open(const char* fileName, AccessMode mode)
 {
-    AutoMutex _l(mLock);
+    AutoReadLock _l(mLock);
 
     LOG_FATAL_IF(mAssetPaths.size() == 0, "No assets added to AssetManager");
 
 
-    if (mCacheMode != CACHE_OFF && !mCacheValid)
-        loadFileNameCacheLocked();
+    validateFileNameCacheLocked();
 
     String8 assetName(kAssetsRoot);
     assetName.appendPath(fileName);
 
+    String8 cachedName;
+    const Vector<int32_t>* cookies;
+    if (lookupFileNameCacheLocked(assetName.string(), false, &cachedName, &cookies)) {
+        return openCachedNonAssetLocked(cachedName, mode, cookies, NULL);
+    }
+
     /*
      * For each top-level asset path, search for the asset.
      */
@@ -535,13 +878,18 @@ Asset* AssetManager::open(const char* fileName, AccessMode mode)
  */
 Asset* AssetManager::openNonAsset(const char* fileName, AccessMode mode, int32_t* outCookie)
 {
-    AutoMutex _l(mLock);
+    AutoReadLock _l(mLock);
 
     LOG_FATAL_IF(mAssetPaths.size() == 0, "No assets added to AssetManager");
 
 
-    if (mCacheMode != CACHE_OFF && !mCacheValid)
-        loadFileNameCacheLocked();
+    validateFileNameCacheLocked();
+
+    String8 cachedName;
+    const Vector<int32_t>* cookies;
+    if (lookupFileNameCacheLocked(fileName, false, &cachedName, &cookies)) {
+        return openCachedNonAssetLocked(cachedName, mode, cookies, outCookie);
+    }
 
     /*
      * For each top-level asset path, search for the asset.
@@ -566,14 +914,18 @@ Asset* AssetManager::openNonAsset(const int32_t cookie, const char* fileName, Ac
 {
     const size_t which = static_cast<size_t>(cookie) - 1;
 
-    AutoMutex _l(mLock);
+    AutoReadLock _l(mLock);
 
     LOG_FATAL_IF(mAssetPaths.size() == 0, "No assets added to AssetManager");
 
-    if (mCacheMode != CACHE_OFF && !mCacheValid)
-        loadFileNameCacheLocked();
+    validateFileNameCacheLocked();
 
     if (which < mAssetPaths.size()) {
+        bool found;
+        if (isInFileNameCacheLocked(mAssetPaths.itemAt(which), fileName, false, &found)
+                && !found) {
+            return NULL;
+        }
         ALOGV("Looking for non-asset '%s' in '%s'\n", fileName,
                 mAssetPaths.itemAt(which).path.string());
         Asset* pAsset = openNonAssetInPathLocked(
@@ -589,8 +941,8 @@ Asset* AssetManager::openNonAsset(const int32_t cookie, const char* fileName, Ac
 /*
  * Get the type of a file in the asset namespace.
  *
- * This currently only works for regular files.  All others (including
- * directories) will return kFileTypeNonexistent.
+ * Directories are found in the archives' directory indexes and in the
+ * loose asset directories.  Anything else will return kFileTypeNonexistent.
  */
 FileType AssetManager::getFileType(const char* fileName)
 {
@@ -604,10 +956,39 @@ FileType AssetManager::getFileType(const char* fileName)
     pAsset = open(fileName, Asset::ACCESS_STREAMING);
     delete pAsset;
 
-    if (pAsset == NULL)
-        return kFileTypeNonexistent;
-    else
+    if (pAsset != NULL)
         return kFileTypeRegular;
+
+    AutoReadLock _l(mLock);
+
+    validateFileNameCacheLocked();
+
+    String8 dirName(kAssetsRoot);
+    dirName.appendPath(fileName);
+
+    String8 cachedName;
+    const Vector<int32_t>* cookies;
+    if (lookupFileNameCacheLocked(dirName.string(), true, &cachedName, &cookies)) {
+        return cookies != NULL ? kFileTypeDirectory : kFileTypeNonexistent;
+    }
+
+    size_t i = mAssetPaths.size();
+    while (i > 0) {
+        i--;
+        const asset_path& ap = mAssetPaths.itemAt(i);
+        if (ap.type == kFileTypeRegular) {
+            if (mZipSet.getZipDirectory(ap.path, dirName, NULL)) {
+                return kFileTypeDirectory;
+            }
+        } else {
+            String8 path(createPathNameLocked(ap, kAssetsRoot));
+            path.appendPath(fileName);
+            if (::getFileType(path.string()) == kFileTypeDirectory) {
+                return kFileTypeDirectory;
+            }
+        }
+    }
+    return kFileTypeNonexistent;
 }
 
 bool AssetManager::appendPathToResTable(const asset_path& ap) const {
@@ -685,13 +1066,15 @@ bool AssetManager::appendPathToResTable(const asset_path& ap) const {
             mResources->add(sharedRes);
         } else {
             ALOGV("Parsing resources for %s", ap.path.string());
-            mResources->add(ass, idmap, nextEntryIdx + 1, !shared);
+            if (shared) {
+                mResources->add(ass, idmap, nextEntryIdx + 1, false);
+            } else {
+                // The table keeps the asset, and so its mapping, rather
+                // than a copy of its data.
+                mResources->addOwned(ass, idmap, nextEntryIdx + 1);
+            }
         }
         onlyEmptyResources = false;
-
-        if (!shared) {
-            delete ass;
-        }
     } else {
         ALOGV("Installing empty resources in to table %p\n", mResources);
         mResources->addEmpty(nextEntryIdx + 1);
@@ -707,14 +1090,18 @@ bool AssetManager::appendPathToResTable(const asset_path& ap) const {
 
 const ResTable* AssetManager::getResTable(bool required) const
 {
-    ResTable* rt = mResources;
-    if (rt) {
-        return rt;
+    {
+        // The table is built holding mLock for writing, so a reader
+        // never sees one that is partly built.
+        AutoReadLock _l(mLock);
+        if (mResources != NULL) {
+            return mResources;
+        }
     }
 
     // Iterate through all asset packages, collecting resources from each.
 
-    AutoMutex _l(mLock);
+    AutoWriteLock _l(mLock);
 
     if (mResources != NULL) {
         return mResources;
@@ -724,9 +1111,7 @@ const ResTable* AssetManager::getResTable(bool required) const
         LOG_FATAL_IF(mAssetPaths.size() == 0, "No assets added to AssetManager");
     }
 
-    if (mCacheMode != CACHE_OFF && !mCacheValid) {
-        const_cast<AssetManager*>(this)->loadFileNameCacheLocked();
-    }
+    const_cast<AssetManager*>(this)->validateFileNameCacheLocked();
 
     mResources = new ResTable();
     updateResourceParamsLocked();
@@ -827,7 +1212,7 @@ const ResTable& AssetManager::getResources(bool required) const
 
 bool AssetManager::isUpToDate()
 {
-    AutoMutex _l(mLock);
+    AutoReadLock _l(mLock);
     return mZipSet.isUpToDate();
 }
 
@@ -948,16 +1333,24 @@ Asset* AssetManager::openInLocaleVendorLocked(const char* fileName, AccessMode m
     Asset* pAsset = NULL;
 
     if (ap.type == kFileTypeDirectory) {
-        if (mCacheMode == CACHE_OFF) {
+        String8 name((locale != NULL) ? locale : kDefaultLocale);
+        name.appendPath((vendor != NULL) ? vendor : kDefaultVendor);
+        name.appendPath(fileName);
+        String8 excludeName(name);
+        excludeName.append(kExcludeExtension);
+
+        bool found = false;
+        bool excluded = false;
+        if (!isInFileNameCacheLocked(ap, name.string(), false, &found)) {
             /* look at the filesystem on disk */
             String8 path(createPathNameLocked(ap, locale, vendor));
             path.appendPath(fileName);
     
-            String8 excludeName(path);
-            excludeName.append(kExcludeExtension);
-            if (::getFileType(excludeName.string()) != kFileTypeNonexistent) {
+            String8 excludePath(path);
+            excludePath.append(kExcludeExtension);
+            if (::getFileType(excludePath.string()) != kFileTypeNonexistent) {
                 /* say no more */
-                //printf("+++ excluding '%s'\n", (const char*) excludeName);
+                //printf("+++ excluding '%s'\n", (const char*) excludePath);
                 return kExcludedAsset;
             }
     
@@ -976,24 +1369,18 @@ Asset* AssetManager::openInLocaleVendorLocked(const char* fileName, AccessMode m
             String8 path(createPathNameLocked(ap, locale, vendor));
             path.appendPath(fileName);
     
-            AssetDir::FileInfo tmpInfo;
-            bool found = false;
-    
-            String8 excludeName(path);
-            excludeName.append(kExcludeExtension);
-    
-            if (mCache.indexOf(excludeName) != NAME_NOT_FOUND) {
+            if (isInFileNameCacheLocked(ap, excludeName.string(), false, &excluded)
+                    && excluded) {
                 /* go no farther */
                 //printf("+++ Excluding '%s'\n", (const char*) excludeName);
                 return kExcludedAsset;
             }
 
             /*
-             * File compression extensions (".gz") don't get stored in the
-             * name cache, so we have to try both here.
+             * The cache has "foo" for a loose "foo.gz", so we have to try
+             * both here.
              */
-            if (mCache.indexOf(path) != NAME_NOT_FOUND) {
-                found = true;
+            if (found) {
                 pAsset = openAssetFromFileLocked(path, mode);
                 if (pAsset == NULL) {
                     /* try again, this time with ".gz" */
@@ -1205,7 +1592,7 @@ Asset* AssetManager::openAssetFromZipLocked(const ZipFileRO* pZipFile,
  */
 AssetDir* AssetManager::openDir(const char* dirName)
 {
-    AutoMutex _l(mLock);
+    AutoReadLock _l(mLock);
 
     AssetDir* pDir = NULL;
     SortedVector<AssetDir::FileInfo>* pMergedInfo = NULL;
@@ -1215,8 +1602,7 @@ AssetDir* AssetManager::openDir(const char* dirName)
 
     //printf("+++ openDir(%s) in '%s'\n", dirName, (const char*) mAssetBase);
 
-    if (mCacheMode != CACHE_OFF && !mCacheValid)
-        loadFileNameCacheLocked();
+    validateFileNameCacheLocked();
 
     pDir = new AssetDir;
 
@@ -1268,7 +1654,7 @@ AssetDir* AssetManager::openDir(const char* dirName)
  */
 AssetDir* AssetManager::openNonAssetDir(const int32_t cookie, const char* dirName)
 {
-    AutoMutex _l(mLock);
+    AutoReadLock _l(mLock);
 
     AssetDir* pDir = NULL;
     SortedVector<AssetDir::FileInfo>* pMergedInfo = NULL;
@@ -1278,8 +1664,7 @@ AssetDir* AssetManager::openNonAssetDir(const int32_t cookie, const char* dirNam
 
     //printf("+++ openDir(%s) in '%s'\n", dirName, (const char*) mAssetBase);
 
-    if (mCacheMode != CACHE_OFF && !mCacheValid)
-        loadFileNameCacheLocked();
+    validateFileNameCacheLocked();
 
     pDir = new AssetDir;
 
@@ -1328,68 +1713,24 @@ bool AssetManager::scanAndMergeDirLocked(SortedVector<AssetDir::FileInfo>* pMerg
 
     //printf("scanAndMergeDir: %s %s %s %s\n", appName, locale, vendor,dirName);
 
-    if (mCacheValid) {
-        int i, start, count;
-
-        pContents = new SortedVector<AssetDir::FileInfo>;
-
-        /*
-         * Get the basic partial path and find it in the cache.  That's
-         * the start point for the search.
-         */
-        path = createPathNameLocked(ap, rootDir);
-        if (dirName[0] != '\0')
-            path.appendPath(dirName);
+    path = createPathNameLocked(ap, rootDir);
+    if (dirName[0] != '\0')
+        path.appendPath(dirName);
 
-        start = mCache.indexOf(path);
-        if (start == NAME_NOT_FOUND) {
-            //printf("+++ not found in cache: dir '%s'\n", (const char*) path);
-            delete pContents;
-            return false;
-        }
-
-        /*
-         * The match string looks like "common/default/default/foo/bar/".
-         * The '/' on the end ensures that we don't match on the directory
-         * itself or on ".../foo/barfy/".
-         */
-        path.append("/");
-
-        count = mCache.size();
-
-        /*
-         * Pick out the stuff in the current dir by examining the pathname.
-         * It needs to match the partial pathname prefix, and not have a '/'
-         * (fssep) anywhere after the prefix.
-         */
-        for (i = start+1; i < count; i++) {
-            if (mCache[i].getFileName().length() > path.length() &&
-                strncmp(mCache[i].getFileName().string(), path.string(), path.length()) == 0)
-            {
-                const char* name = mCache[i].getFileName().string();
-                // XXX THIS IS BROKEN!  Looks like we need to store the full
-                // path prefix separately from the file path.
-                if (strchr(name + path.length(), '/') == NULL) {
-                    /* grab it, reducing path to just the filename component */
-                    AssetDir::FileInfo tmp = mCache[i];
-                    tmp.setFileName(tmp.getFileName().getPathLeaf());
-                    pContents->add(tmp);
-                }
-            } else {
-                /* no longer in the dir or its subdirs */
-                break;
-            }
-
-        }
-    } else {
-        path = createPathNameLocked(ap, rootDir);
-        if (dirName[0] != '\0')
-            path.appendPath(dirName);
-        pContents = scanDirLocked(path);
-        if (pContents == NULL)
-            return false;
+    /*
+     * Don't look on disk for a directory the cache says isn't there.
+     */
+    String8 cacheName(rootDir != NULL ? rootDir : "");
+    cacheName.appendPath(dirName);
+    bool found;
+    if (isInFileNameCacheLocked(ap, cacheName.string(), true, &found) && !found) {
+        return false;
     }
 
+    pContents = scanDirLocked(path);
+    if (pContents == NULL)
+        return false;
+
     // if we wanted to do an incremental cache fill, we would do it here
 
     /*
@@ -1509,109 +1850,24 @@ SortedVector<AssetDir::FileInfo>* AssetManager::scanDirLocked(const String8& pat
 bool AssetManager::scanAndMergeZipLocked(SortedVector<AssetDir::FileInfo>* pMergedInfo,
     const asset_path& ap, const char* rootDir, const char* baseDirName)
 {
-    ZipFileRO* pZip;
-    Vector<String8> dirs;
-    AssetDir::FileInfo info;
     SortedVector<AssetDir::FileInfo> contents;
-    String8 sourceName, zipName, dirName;
+    String8 dirName;
 
-    pZip = mZipSet.getZip(ap.path);
-    if (pZip == NULL) {
+    if (mZipSet.getZip(ap.path) == NULL) {
         ALOGW("Failure opening zip %s\n", ap.path.string());
         return false;
     }
 
-    zipName = ZipSet::getPathName(ap.path.string());
-
     /* convert "sounds" to "rootDir/sounds" */
     if (rootDir != NULL) dirName = rootDir;
     dirName.appendPath(baseDirName);
 
     /*
-     * Scan through the list of files, looking for a match.  The files in
-     * the Zip table of contents are not in sorted order, so we have to
-     * process the entire list.  We're looking for a string that begins
-     * with the characters in "dirName", is followed by a '/', and has no
-     * subsequent '/' in the stuff that follows.
-     *
-     * What makes this especially fun is that directories are not stored
-     * explicitly in Zip archives, so we have to infer them from context.
-     * When we see "sounds/foo.wav" we have to leave a note to ourselves
-     * to insert a directory called "sounds" into the list.  We store
-     * these in temporary vector so that we only return each one once.
-     *
-     * Name comparisons are case-sensitive to match UNIX filesystem
-     * semantics.
+     * The archive's directories, which Zip archives don't store
+     * explicitly, are inferred from its entry names once and kept with
+     * the SharedZip; see SharedZip::buildDirectoriesLocked().
      */
-    int dirNameLen = dirName.length();
-    void *iterationCookie;
-    if (!pZip->startIteration(&iterationCookie, dirName.string(), NULL)) {
-        ALOGW("ZipFileRO::startIteration returned false");
-        return false;
-    }
-
-    ZipEntryRO entry;
-    while ((entry = pZip->nextEntry(iterationCookie)) != NULL) {
-        char nameBuf[256];
-
-        if (pZip->getEntryFileName(entry, nameBuf, sizeof(nameBuf)) != 0) {
-            // TODO: fix this if we expect to have long names
-            ALOGE("ARGH: name too long?\n");
-            continue;
-        }
-        //printf("Comparing %s in %s?\n", nameBuf, dirName.string());
-        if (dirNameLen == 0 || nameBuf[dirNameLen] == '/')
-        {
-            const char* cp;
-            const char* nextSlash;
-
-            cp = nameBuf + dirNameLen;
-            if (dirNameLen != 0)
-                cp++;       // advance past the '/'
-
-            nextSlash = strchr(cp, '/');
-//xxx this may break if there are bare directory entries
-            if (nextSlash == NULL) {
-                /* this is a file in the requested directory */
-
-                info.set(String8(nameBuf).getPathLeaf(), kFileTypeRegular);
-
-                info.setSourceName(
-                    createZipSourceNameLocked(zipName, dirName, info.getFileName()));
-
-                contents.add(info);
-                //printf("FOUND: file '%s'\n", info.getFileName().string());
-            } else {
-                /* this is a subdir; add it if we don't already have it*/
-                String8 subdirName(cp, nextSlash - cp);
-                size_t j;
-                size_t N = dirs.size();
-
-                for (j = 0; j < N; j++) {
-                    if (subdirName == dirs[j]) {
-                        break;
-                    }
-                }
-                if (j == N) {
-                    dirs.add(subdirName);
-                }
-
-                //printf("FOUND: dir '%s'\n", subdirName.string());
-            }
-        }
-    }
-
-    pZip->endIteration(iterationCookie);
-
-    /*
-     * Add the set of unique directories.
-     */
-    for (int i = 0; i < (int) dirs.size(); i++) {
-        info.set(dirs[i], kFileTypeDirectory);
-        info.setSourceName(
-            createZipSourceNameLocked(zipName, dirName, info.getFileName()));
-        contents.add(info);
-    }
+    mZipSet.getZipDirectory(ap.path, dirName, &contents);
 
     mergeInfoLocked(pMergedInfo, &contents);
 
@@ -1654,6 +1910,18 @@ void AssetManager::mergeInfoLocked(SortedVector<AssetDir::FileInfo>* pMergedInfo
     int mergeMax, contMax;
     int mergeIdx, contIdx;
 
+    /*
+     * The first place scanned, and any that adds nothing, needn't be
+     * merged at all; the vectors share their storage until written.
+     */
+    if (pContents->isEmpty()) {
+        return;
+    }
+    if (pMergedInfo->isEmpty()) {
+        *pMergedInfo = *pContents;
+        return;
+    }
+
     pNewSorted = new SortedVector<AssetDir::FileInfo>;
     mergeMax = pMergedInfo->size();
     contMax = pContents->size();
@@ -1717,33 +1985,31 @@ void AssetManager::mergeInfoLocked(SortedVector<AssetDir::FileInfo>* pMergedInfo
 
 
 /*
- * Load all files into the file name cache.  We want to do this across
- * all combinations of { appname, locale, vendor }, performing a recursive
- * directory traversal.
+ * Load the asset paths added since the file name cache was last loaded
+ * into it.  Each asset path is scanned once, a directory by a recursive
+ * traversal and an archive by walking its central directory, and stays
+ * in the cache until purge(); the locale and vendor don't matter to it.
  *
- * This is not the most efficient data structure.  Also, gathering the
- * information as we needed it (file-by-file or directory-by-directory)
- * would be faster.  However, on the actual device, 99% of the files will
- * live in Zip archives, so this list will be very small.  The trouble
- * is that we have to check the "loose" files first, so it's important
- * that we don't beat the filesystem silly looking for files that aren't
- * there.
+ * On the actual device, 99% of the files will live in Zip archives, and
+ * looking a name up here tells us which of them to search, rather than
+ * asking each archive in turn.  It also means that we don't beat the
+ * filesystem silly looking for loose files that aren't there.
  *
  * Note on thread safety: this is the only function that causes updates
- * to mCache, and anybody who tries to use it will call here if !mCacheValid,
- * so we need to employ a mutex here.
+ * to mCache, and anybody who tries to use it will call here if it hasn't
+ * seen every asset path, so we need to employ a mutex here.
  */
 void AssetManager::loadFileNameCacheLocked(void)
 {
-    assert(!mCacheValid);
-    assert(mCache.size() == 0);
-
 #ifdef DO_TIMINGS   // need to link against -lrt for this now
     DurationTimer timer;
     timer.start();
 #endif
 
-    fncScanLocked(&mCache, "");
+    const size_t N = mAssetPaths.size();
+    for (size_t i = mCachedPaths; i < N; i++) {
+        fncScanLocked(static_cast<int32_t>(i + 1));
+    }
 
 #ifdef DO_TIMINGS
     timer.stop();
@@ -1752,105 +2018,141 @@ void AssetManager::loadFileNameCacheLocked(void)
 #endif
 
 #if 0
-    int i;
     printf("CACHED FILE LIST (%d entries):\n", mCache.size());
-    for (i = 0; i < (int) mCache.size(); i++) {
-        printf(" %d: (%d) '%s'\n", i,
-            mCache.itemAt(i).getFileType(),
-            (const char*) mCache.itemAt(i).getFileName());
+    for (size_t i = 0; i < mCache.size(); i++) {
+        printf(" %d: (%d paths) '%s'\n", (int) i, (int) mCache[i].size(),
+            (const char*) mCache.keyAt(i));
     }
 #endif
 
-    mCacheValid = true;
+    __atomic_store_n(&mCachedPaths, N, __ATOMIC_RELEASE);
 }
 
 /*
- * Scan up to 8 versions of the specified directory.
+ * Load the file name cache if it is enabled and is missing asset paths.
+ * Lookups call this holding mLock only for reading, so the first one to
+ * get here loads it and the others wait for it.
  */
-void AssetManager::fncScanLocked(SortedVector<AssetDir::FileInfo>* pMergedInfo,
-    const char* dirName)
+void AssetManager::validateFileNameCacheLocked(void)
 {
-    size_t i = mAssetPaths.size();
-    while (i > 0) {
-        i--;
-        const asset_path& ap = mAssetPaths.itemAt(i);
-        fncScanAndMergeDirLocked(pMergedInfo, ap, NULL, NULL, dirName);
-        if (mLocale != NULL)
-            fncScanAndMergeDirLocked(pMergedInfo, ap, mLocale, NULL, dirName);
-        if (mVendor != NULL)
-            fncScanAndMergeDirLocked(pMergedInfo, ap, NULL, mVendor, dirName);
-        if (mLocale != NULL && mVendor != NULL)
-            fncScanAndMergeDirLocked(pMergedInfo, ap, mLocale, mVendor, dirName);
+    if (mCacheMode == CACHE_OFF
+            || __atomic_load_n(&mCachedPaths, __ATOMIC_ACQUIRE) == mAssetPaths.size()) {
+        return;
+    }
+    AutoMutex _l(mCacheLock);
+    if (mCachedPaths != mAssetPaths.size()) {
+        loadFileNameCacheLocked();
     }
 }
 
 /*
- * Recursively scan this directory and all subdirs.
- *
- * This is similar to scanAndMergeDir, but we don't remove the .EXCLUDE
- * files, and we prepend the extended partial path to the filenames.
+ * Add every file and directory of the asset path "cookie" to the cache.
  */
-bool AssetManager::fncScanAndMergeDirLocked(
-    SortedVector<AssetDir::FileInfo>* pMergedInfo,
-    const asset_path& ap, const char* locale, const char* vendor,
-    const char* dirName)
+void AssetManager::fncScanLocked(int32_t cookie)
 {
-    SortedVector<AssetDir::FileInfo>* pContents;
-    String8 partialPath;
-    String8 fullPath;
-
-    // XXX This is broken -- the filename cache needs to hold the base
-    // asset path separately from its filename.
-    
-    partialPath = createPathNameLocked(ap, locale, vendor);
-    if (dirName[0] != '\0') {
-        partialPath.appendPath(dirName);
+    const asset_path& ap = mAssetPaths.itemAt(cookie - 1);
+    if (ap.type == kFileTypeDirectory) {
+        fncScanAndMergeDirLocked(cookie, ap.path, String8());
+        return;
     }
 
-    fullPath = partialPath;
-    pContents = scanDirLocked(fullPath);
-    if (pContents == NULL) {
-        return false;       // directory did not exist
+    ZipFileRO* pZip = getZipFileLocked(ap);
+    if (pZip == NULL) {
+        return;
+    }
+    void* iterationCookie;
+    if (!pZip->startIteration(&iterationCookie)) {
+        ALOGW("ZipFileRO::startIteration returned false");
+        return;
     }
 
-    /*
-     * Scan all subdirectories of the current dir, merging what we find
-     * into "pMergedInfo".
-     */
-    for (int i = 0; i < (int) pContents->size(); i++) {
-        if (pContents->itemAt(i).getFileType() == kFileTypeDirectory) {
-            String8 subdir(dirName);
-            subdir.appendPath(pContents->itemAt(i).getFileName());
+    // Zip entry names are at most 64 KiB.
+    const size_t kNameBufSize = 0x10000;
+    char* nameBuf = new char[kNameBufSize];
+    ZipEntryRO entry;
+    while ((entry = pZip->nextEntry(iterationCookie)) != NULL) {
+        String8 name;
+        if (pZip->getEntryFileName(entry, nameBuf, kNameBufSize) != 0
+                || !normalizeCacheName(nameBuf, &name) || name.isEmpty()) {
+            // Lookups of a name like this search the archives themselves.
+            continue;
+        }
 
-            fncScanAndMergeDirLocked(pMergedInfo, ap, locale, vendor, subdir.string());
+        // Archives needn't have entries for their directories, so each
+        // file adds the directories it is in.
+        for (const char* slash = strchr(name.string(), '/'); slash != NULL;
+                slash = strchr(slash + 1, '/')) {
+            fncAddLocked(cookie, String8(name.string(), slash - name.string() + 1));
+        }
+        if (nameBuf[strlen(nameBuf) - 1] == '/') {
+            name.append("/");
         }
+        fncAddLocked(cookie, name);
     }
+    delete[] nameBuf;
+    pZip->endIteration(iterationCookie);
+}
 
-    /*
-     * To be consistent, we want entries for the root directory.  If
-     * we're the root, add one now.
-     */
-    if (dirName[0] == '\0') {
-        AssetDir::FileInfo tmpInfo;
-
-        tmpInfo.set(String8(""), kFileTypeDirectory);
-        tmpInfo.setSourceName(createPathNameLocked(ap, locale, vendor));
-        pContents->add(tmpInfo);
+/*
+ * Recursively add the directory "dirPath" on disk, which is "dirName" in
+ * its asset path, and everything in it to the cache.
+ */
+void AssetManager::fncScanAndMergeDirLocked(int32_t cookie, const String8& dirPath,
+    const String8& dirName)
+{
+    DIR* dir = opendir(dirPath.string());
+    if (dir == NULL) {
+        return;
+    }
+    if (!dirName.isEmpty()) {
+        fncAddLocked(cookie, dirName + "/");
     }
 
-    /*
-     * We want to prepend the extended partial path to every entry in
-     * "pContents".  It's the same value for each entry, so this will
-     * not change the sorting order of the vector contents.
-     */
-    for (int i = 0; i < (int) pContents->size(); i++) {
-        const AssetDir::FileInfo& info = pContents->itemAt(i);
-        pContents->editItemAt(i).setFileName(partialPath.appendPathCopy(info.getFileName()));
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 ||
+            strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        FileType fileType;
+#ifdef _DIRENT_HAVE_D_TYPE
+        if (entry->d_type == DT_REG)
+            fileType = kFileTypeRegular;
+        else if (entry->d_type == DT_DIR)
+            fileType = kFileTypeDirectory;
+        else
+            fileType = kFileTypeUnknown;
+#else
+        fileType = ::getFileType(dirPath.appendPathCopy(entry->d_name).string());
+#endif
+
+        String8 name(dirName.appendPathCopy(entry->d_name));
+        if (fileType == kFileTypeDirectory) {
+            fncScanAndMergeDirLocked(cookie, dirPath.appendPathCopy(entry->d_name), name);
+        } else if (fileType == kFileTypeRegular) {
+            fncAddLocked(cookie, name);
+            if (strcasecmp(name.getPathExtension().string(), ".gz") == 0) {
+                fncAddLocked(cookie, name.getBasePath());
+            }
+        }
     }
+    closedir(dir);
+}
 
-    mergeInfoLocked(pMergedInfo, pContents);
-    delete pContents;
-    return true;
+/*
+ * Note that asset path "cookie" has "name".  Asset paths are scanned in
+ * the order they were added, so each cookie list stays sorted.
+ */
+void AssetManager::fncAddLocked(int32_t cookie, const String8& name)
+{
+    ssize_t idx = mCache.indexOfKey(name);
+    if (idx < 0) {
+        Vector<int32_t> cookies;
+        cookies.add(cookie);
+        mCache.add(name, cookies);
+    } else if (mCache[idx].top() != cookie) {
+        mCache.editValueAt(idx).add(cookie);
+    }
 }
 
 /*
@@ -1858,10 +2160,119 @@ bool AssetManager::fncScanAndMergeDirLocked(
  */
 void AssetManager::purgeFileNameCacheLocked(void)
 {
-    mCacheValid = false;
+    mCachedPaths = 0;
     mCache.clear();
 }
 
+/*
+ * Put "fileName" in the form the file name cache keys are in, without
+ * "." components, empty ones or a trailing '/'.  Returns false if it has
+ * a ".." component, which the cache doesn't try to resolve.
+ */
+/*static*/ bool AssetManager::normalizeCacheName(const char* fileName, String8* outName)
+{
+    outName->setTo("");
+    const char* p = fileName;
+    while (*p != '\0') {
+        const char* end = strchr(p, '/');
+        if (end == NULL) {
+            end = p + strlen(p);
+        }
+        const size_t len = end - p;
+        if (len == 2 && p[0] == '.' && p[1] == '.') {
+            return false;
+        }
+        if (len > 0 && !(len == 1 && p[0] == '.')) {
+            if (!outName->isEmpty()) {
+                outName->append("/");
+            }
+            outName->append(p, len);
+        }
+        p = *end != '\0' ? end + 1 : end;
+    }
+    return true;
+}
+
+/*
+ * Look "fileName", a file or else a directory if "isDirectory", up in the
+ * file name cache.  Returns false if the cache can't say where it is: it
+ * is off or not loaded, or the name is one it doesn't normalize.
+ * Otherwise sets "outName" to the normalized name and "outCookies" to the
+ * asset paths that have it, or NULL if none do.
+ */
+bool AssetManager::lookupFileNameCacheLocked(const char* fileName, bool isDirectory,
+    String8* outName, const Vector<int32_t>** outCookies) const
+{
+    if (mCacheMode == CACHE_OFF || mCachedPaths != mAssetPaths.size()
+            || !normalizeCacheName(fileName, outName)) {
+        return false;
+    }
+    if (isDirectory) {
+        if (outName->isEmpty()) {
+            return false;   // the top of an asset path isn't cached
+        }
+        outName->append("/");
+    }
+    ssize_t idx = mCache.indexOfKey(*outName);
+    *outCookies = idx >= 0 ? &mCache[idx] : NULL;
+    return true;
+}
+
+/*
+ * Set "outFound" to whether the asset path "ap" has "fileName", according
+ * to the file name cache.  Returns false if the cache can't say.
+ */
+bool AssetManager::isInFileNameCacheLocked(const asset_path& ap, const char* fileName,
+    bool isDirectory, bool* outFound) const
+{
+    int32_t cookie = 0;
+    for (size_t i = 0; i < mAssetPaths.size(); i++) {
+        if (&mAssetPaths.itemAt(i) == &ap) {
+            cookie = static_cast<int32_t>(i + 1);
+            break;
+        }
+    }
+    String8 name;
+    const Vector<int32_t>* cookies;
+    if (cookie == 0 || !lookupFileNameCacheLocked(fileName, isDirectory, &name, &cookies)) {
+        return false;
+    }
+    *outFound = false;
+    if (cookies != NULL) {
+        for (size_t i = 0; i < cookies->size() && !*outFound; i++) {
+            *outFound = cookies->itemAt(i) == cookie;
+        }
+    }
+    return true;
+}
+
+/*
+ * Open "fileName" from the last of the asset paths "cookies" that has it,
+ * as the file name cache found them.
+ */
+Asset* AssetManager::openCachedNonAssetLocked(const String8& fileName, AccessMode mode,
+    const Vector<int32_t>* cookies, int32_t* outCookie)
+{
+    if (cookies == NULL) {
+        return NULL;
+    }
+    size_t i = cookies->size();
+    while (i > 0) {
+        i--;
+        const int32_t cookie = cookies->itemAt(i);
+        const asset_path& ap = mAssetPaths.itemAt(cookie - 1);
+        ALOGV("Opening cached '%s' in '%s'\n", fileName.string(), ap.path.string());
+        Asset* pAsset = openNonAssetInPathLocked(fileName.string(), mode, ap);
+        if (pAsset != NULL) {
+            if (outCookie != NULL) *outCookie = cookie;
+            return pAsset != kExcludedAsset ? pAsset : NULL;
+        }
+        ALOGD("Expected file not found: '%s' in '%s'\n", fileName.string(),
+                ap.path.string());
+    }
+    return NULL;
+}
+
 /*
  * ===========================================================================
  *      AssetManager::SharedZip
@@ -1874,7 +2285,7 @@ DefaultKeyedVector<String8, wp<AssetManager::SharedZip> > AssetManager::SharedZi
 
 AssetManager::SharedZip::SharedZip(const String8& path, time_t modWhen)
     : mPath(path), mZipFile(NULL), mModWhen(modWhen),
-      mResourceTableAsset(NULL), mResourceTable(NULL)
+      mResourceTableAsset(NULL), mResourceTable(NULL), mDirectoriesBuilt(false)
 {
     if (kIsDebug) {
         ALOGI("Creating SharedZip %p %s\n", this, (const char*)mPath);
@@ -1889,19 +2300,29 @@ AssetManager::SharedZip::SharedZip(const String8& path, time_t modWhen)
 sp<AssetManager::SharedZip> AssetManager::SharedZip::get(const String8& path,
         bool createIfNotPresent)
 {
-    AutoMutex _l(gLock);
     time_t modWhen = getFileModDate(path);
+    {
+        AutoMutex _l(gLock);
+        sp<SharedZip> zip = gOpen.valueFor(path).promote();
+        if (zip != NULL && zip->mModWhen == modWhen) {
+            return zip;
+        }
+        if (zip == NULL && !createIfNotPresent) {
+            return NULL;
+        }
+    }
+
+    // Opening reads the central directory, which is done without the lock
+    // so that several archives can be opened at once.  Should another
+    // thread open the same one meanwhile, the first to finish is kept.
+    sp<SharedZip> opened = new SharedZip(path, modWhen);
+    AutoMutex _l(gLock);
     sp<SharedZip> zip = gOpen.valueFor(path).promote();
     if (zip != NULL && zip->mModWhen == modWhen) {
         return zip;
     }
-    if (zip == NULL && !createIfNotPresent) {
-        return NULL;
-    }
-    zip = new SharedZip(path, modWhen);
-    gOpen.add(path, zip);
-    return zip;
-
+    gOpen.add(path, opened);
+    return opened;
 }
 
 ZipFileRO* AssetManager::SharedZip::getZip()
@@ -1970,6 +2391,134 @@ bool AssetManager::SharedZip::getOverlay(size_t idx, asset_path* out) const
     return true;
 }
 
+bool AssetManager::SharedZip::getDirectory(const String8& dirName,
+        SortedVector<AssetDir::FileInfo>* outContents)
+{
+    AutoMutex _l(mDirectoriesLock);
+    if (!mDirectoriesBuilt) {
+        buildDirectoriesLocked();
+        mDirectoriesBuilt = true;
+    }
+    ssize_t idx = mDirectories.indexOfKey(dirName);
+    if (idx < 0) {
+        return false;
+    }
+    if (outContents != NULL) {
+        *outContents = mDirectories.valueAt(idx);
+    }
+    return true;
+}
+
+/*
+ * Sort by name, with a directory after a file of the same name so that
+ * it replaces the file when added to a SortedVector.
+ */
+/*static*/ int AssetManager::SharedZip::compareDirectoryEntries(
+        const AssetDir::FileInfo* lhs, const AssetDir::FileInfo* rhs)
+{
+    int cmp = strcmp(lhs->getFileName().string(), rhs->getFileName().string());
+    if (cmp != 0) {
+        return cmp;
+    }
+    return (int) (lhs->getFileType() == kFileTypeDirectory)
+            - (int) (rhs->getFileType() == kFileTypeDirectory);
+}
+
+/*
+ * Returns the index in "entries" of the directory "dirPath", adding it
+ * and any parents not seen before.
+ */
+/*static*/ size_t AssetManager::SharedZip::addDirectory(const String8& zipName,
+        const String8& dirPath, KeyedVector<String8, size_t>* dirs,
+        Vector<Vector<AssetDir::FileInfo> >* entries)
+{
+    ssize_t idx = dirs->indexOfKey(dirPath);
+    if (idx >= 0) {
+        return dirs->valueAt(idx);
+    }
+
+    String8 parentPath(dirPath.getPathDir());
+    String8 leaf(dirPath.getPathLeaf());
+    size_t parent = addDirectory(zipName, parentPath, dirs, entries);
+
+    AssetDir::FileInfo info;
+    info.set(leaf, kFileTypeDirectory);
+    info.setSourceName(createZipSourceNameLocked(zipName, parentPath, leaf));
+    entries->editItemAt(parent).add(info);
+
+    size_t dir = entries->size();
+    entries->add();
+    dirs->add(dirPath, dir);
+    return dir;
+}
+
+/*
+ * Walk the central directory once, filing every entry under its
+ * directory and inferring the directories themselves from the names:
+ * "sounds/foo.wav" puts a directory "sounds" at the top.  Name
+ * comparisons are case-sensitive to match UNIX filesystem semantics.
+ */
+void AssetManager::SharedZip::buildDirectoriesLocked()
+{
+    if (mZipFile == NULL) {
+        return;
+    }
+
+    const String8 zipName(ZipSet::getPathName(mPath.string()));
+    KeyedVector<String8, size_t> dirs;
+    Vector<Vector<AssetDir::FileInfo> > entries;
+    dirs.add(String8(), 0);
+    entries.add();
+
+    void *iterationCookie;
+    if (!mZipFile->startIteration(&iterationCookie)) {
+        ALOGW("ZipFileRO::startIteration returned false");
+        return;
+    }
+
+    ZipEntryRO entry;
+    while ((entry = mZipFile->nextEntry(iterationCookie)) != NULL) {
+        char nameBuf[256];
+
+        if (mZipFile->getEntryFileName(entry, nameBuf, sizeof(nameBuf)) != 0) {
+            // TODO: fix this if we expect to have long names
+            ALOGE("ARGH: name too long?\n");
+            continue;
+        }
+
+        String8 name(nameBuf);
+        String8 dirPath(name.getPathDir());
+        size_t dir = addDirectory(zipName, dirPath, &dirs, &entries);
+
+        // A bare directory entry, "sounds/", only adds its directory.
+        const char* leaf = strrchr(nameBuf, '/');
+        leaf = leaf != NULL ? leaf + 1 : nameBuf;
+        if (*leaf == '\0') {
+            continue;
+        }
+
+        AssetDir::FileInfo info;
+        info.set(String8(leaf), kFileTypeRegular);
+        info.setSourceName(createZipSourceNameLocked(zipName, dirPath, info.getFileName()));
+        entries.editItemAt(dir).add(info);
+    }
+
+    mZipFile->endIteration(iterationCookie);
+
+    // Added in order, each item goes at the end of its SortedVector.
+    for (size_t i = 0; i < dirs.size(); i++) {
+        Vector<AssetDir::FileInfo>& dirEntries = entries.editItemAt(dirs.valueAt(i));
+        dirEntries.sort(compareDirectoryEntries);
+
+        SortedVector<AssetDir::FileInfo> contents;
+        contents.setCapacity(dirEntries.size());
+        for (size_t j = 0; j < dirEntries.size(); j++) {
+            contents.add(dirEntries[j]);
+        }
+        mDirectories.add(dirs.keyAt(i), contents);
+    }
+}
+
 AssetManager::SharedZip::~SharedZip()
 {
     if (kIsDebug) {
@@ -2024,6 +2573,7 @@ void AssetManager::ZipSet::closeZip(int idx)
  */
 ZipFileRO* AssetManager::ZipSet::getZip(const String8& path)
 {
+    AutoMutex _l(mLock);
     int idx = getIndex(path);
     sp<SharedZip> zip = mZipFile[idx];
     if (zip == NULL) {
@@ -2035,6 +2585,7 @@ ZipFileRO* AssetManager::ZipSet::getZip(const String8& path)
 
 Asset* AssetManager::ZipSet::getZipResourceTableAsset(const String8& path)
 {
+    AutoMutex _l(mLock);
     int idx = getIndex(path);
     sp<SharedZip> zip = mZipFile[idx];
     if (zip == NULL) {
@@ -2047,6 +2598,7 @@ Asset* AssetManager::ZipSet::getZipResourceTableAsset(const String8& path)
 Asset* AssetManager::ZipSet::setZipResourceTableAsset(const String8& path,
                                                  Asset* asset)
 {
+    AutoMutex _l(mLock);
     int idx = getIndex(path);
     sp<SharedZip> zip = mZipFile[idx];
     // doesn't make sense to call before previously accessing.
@@ -2055,6 +2607,7 @@ Asset* AssetManager::ZipSet::setZipResourceTableAsset(const String8& path,
 
 ResTable* AssetManager::ZipSet::getZipResourceTable(const String8& path)
 {
+    AutoMutex _l(mLock);
     int idx = getIndex(path);
     sp<SharedZip> zip = mZipFile[idx];
     if (zip == NULL) {
@@ -2067,12 +2620,26 @@ ResTable* AssetManager::ZipSet::getZipResourceTable(const String8& path)
 ResTable* AssetManager::ZipSet::setZipResourceTable(const String8& path,
                                                     ResTable* res)
 {
+    AutoMutex _l(mLock);
     int idx = getIndex(path);
     sp<SharedZip> zip = mZipFile[idx];
     // doesn't make sense to call before previously accessing.
     return zip->setResourceTable(res);
 }
 
+bool AssetManager::ZipSet::getZipDirectory(const String8& path, const String8& dirName,
+                                            SortedVector<AssetDir::FileInfo>* outContents)
+{
+    AutoMutex _l(mLock);
+    int idx = getIndex(path);
+    sp<SharedZip> zip = mZipFile[idx];
+    if (zip == NULL) {
+        zip = SharedZip::get(path);
+        mZipFile.editItemAt(idx) = zip;
+    }
+    return zip->getDirectory(dirName, outContents);
+}
+
 /*
  * Generate the partial pathname for the specified archive.  The caller
  * gets to prepend the asset root directory.
@@ -2086,6 +2653,7 @@ ResTable* AssetManager::ZipSet::setZipResourceTable(const String8& path,
 
 bool AssetManager::ZipSet::isUpToDate()
 {
+    AutoMutex _l(mLock);
     const size_t N = mZipFile.size();
     for (size_t i=0; i<N; i++) {
         if (mZipFile[i] != NULL && !mZipFile[i]->isUpToDate()) {
@@ -2097,6 +2665,7 @@ bool AssetManager::ZipSet::isUpToDate()
 
 void AssetManager::ZipSet::addOverlay(const String8& path, const asset_path& overlay)
 {
+    AutoMutex _l(mLock);
     int idx = getIndex(path);
     sp<SharedZip> zip = mZipFile[idx];
     zip->addOverlay(overlay);
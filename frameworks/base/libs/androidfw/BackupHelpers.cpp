@@ -21,8 +21,10 @@
 #include <utils/KeyedVector.h>
 #include <utils/ByteOrder.h>
 #include <utils/String8.h>
+#include <utils/Vector.h>
 
 #include <errno.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <sys/stat.h>
@@ -34,6 +36,7 @@
 #include <fcntl.h>
 #include <zlib.h>
 
+#include <cutils/atomic.h>
 #include <cutils/log.h>
 
 namespace android {
@@ -140,6 +143,86 @@ read_snapshot_file(int fd, KeyedVector<String8,FileState>* snapshot)
     return 0;
 }
 
+/*
+ * Buffers the writes of a snapshot file, so that each entry doesn't cost
+ * three write() calls.  The first error sticks and is returned by flush().
+ */
+class SnapshotWriter
+{
+public:
+    SnapshotWriter(int fd) : m_fd(fd), m_used(0), m_error(0) {}
+
+    void writeHeader(int fileCount, int totalSize);
+    void writeEntry(const String8& name, FileState s);
+    int flush();
+
+private:
+    void write(const void* data, int size);
+
+    enum { BUFSIZE = 32*1024 };
+
+    int m_fd;
+    int m_used;
+    int m_error;
+    char m_buf[BUFSIZE];
+};
+
+void
+SnapshotWriter::writeHeader(int fileCount, int totalSize)
+{
+    LOGP("write_snapshot_file fd=%d\n", m_fd);
+    SnapshotHeader header = { MAGIC0, fileCount, MAGIC1, totalSize };
+    write(&header, sizeof(header));
+}
+
+void
+SnapshotWriter::writeEntry(const String8& name, FileState s)
+{
+    int nameLen = s.nameLen = name.length();
+    write(&s, sizeof(FileState));
+
+    // filename is not NULL terminated, but it is padded
+    write(name.string(), nameLen);
+    int paddingLen = ROUND_UP[nameLen % 4];
+    if (paddingLen != 0) {
+        int padding = 0xabababab;
+        write(&padding, paddingLen);
+    }
+}
+
+void
+SnapshotWriter::write(const void* data, int size)
+{
+    if (m_error != 0) {
+        return;
+    }
+    if (m_used + size > BUFSIZE && flush() != 0) {
+        return;
+    }
+    if (size > BUFSIZE) {
+        if (::write(m_fd, data, size) != size) {
+            m_error = errno != 0 ? errno : 1;
+            ALOGW("write_snapshot_file error writing %d bytes %s", size, strerror(errno));
+        }
+        return;
+    }
+    memcpy(m_buf + m_used, data, size);
+    m_used += size;
+}
+
+int
+SnapshotWriter::flush()
+{
+    if (m_error == 0 && m_used > 0) {
+        if (::write(m_fd, m_buf, m_used) != m_used) {
+            m_error = errno != 0 ? errno : 1;
+            ALOGW("write_snapshot_file error writing %d bytes %s", m_used, strerror(errno));
+        }
+        m_used = 0;
+    }
+    return m_error;
+}
+
 static int
 write_snapshot_file(int fd, const KeyedVector<String8,FileRec>& snapshot)
 {
@@ -156,49 +239,15 @@ write_snapshot_file(int fd, const KeyedVector<String8,FileRec>& snapshot)
         }
     }
 
-    LOGP("write_snapshot_file fd=%d\n", fd);
-
-    int amt;
-    SnapshotHeader header = { MAGIC0, fileCount, MAGIC1, bytesWritten };
-
-    amt = write(fd, &header, sizeof(header));
-    if (amt != sizeof(header)) {
-        ALOGW("write_snapshot_file error writing header %s", strerror(errno));
-        return errno;
-    }
-
+    SnapshotWriter writer(fd);
+    writer.writeHeader(fileCount, bytesWritten);
     for (int i=0; i<N; i++) {
-        FileRec r = snapshot.valueAt(i);
+        const FileRec& r = snapshot.valueAt(i);
         if (!r.deleted) {
-            const String8& name = snapshot.keyAt(i);
-            int nameLen = r.s.nameLen = name.length();
-
-            amt = write(fd, &r.s, sizeof(FileState));
-            if (amt != sizeof(FileState)) {
-                ALOGW("write_snapshot_file error writing header %s", strerror(errno));
-                return 1;
-            }
-
-            // filename is not NULL terminated, but it is padded
-            amt = write(fd, name.string(), nameLen);
-            if (amt != nameLen) {
-                ALOGW("write_snapshot_file error writing filename %s", strerror(errno));
-                return 1;
-            }
-            int paddingLen = ROUND_UP[nameLen % 4];
-            if (paddingLen != 0) {
-                int padding = 0xabababab;
-                amt = write(fd, &padding, paddingLen);
-                if (amt != paddingLen) {
-                    ALOGW("write_snapshot_file error writing %d bytes of filename padding %s",
-                            paddingLen, strerror(errno));
-                    return 1;
-                }
-            }
+            writer.writeEntry(snapshot.keyAt(i), r.s);
         }
     }
-
-    return 0;
+    return writer.flush();
 }
 
 static int
@@ -208,16 +257,22 @@ write_delete_file(BackupDataWriter* dataStream, const String8& key)
     return dataStream->WriteEntityHeader(key, -1);
 }
 
+/*
+ * Sends the contents of fd as the entity key.  If outCrc isn't NULL, the
+ * CRC-32 of the contents is returned in it, saving back_up_files() a
+ * separate pass over files it backs up.
+ */
 static int
 write_update_file(BackupDataWriter* dataStream, int fd, int mode, const String8& key,
-        char const* realFilename)
+        char const* realFilename, int* outCrc = NULL)
 {
     LOGP("write_update_file %s (%s) : mode 0%o\n", realFilename, key.string(), mode);
 
-    const int bufsize = 4*1024;
+    const int bufsize = 32*1024;
     int err;
     int amt;
     int fileSize;
+    uLong crc = crc32(0L, Z_NULL, 0);
     int bytesLeft;
     file_metadata_v1 metadata;
 
@@ -254,6 +309,7 @@ write_update_file(BackupDataWriter* dataStream, int fd, int mode, const String8&
         if (bytesLeft < 0) {
             amt += bytesLeft; // Plus a negative is minus.  Don't write more than we promised.
         }
+        crc = crc32(crc, (Bytef*)buf, amt);
         err = dataStream->WriteEntityData(buf, amt);
         if (err != 0) {
             free(buf);
@@ -279,64 +335,148 @@ write_update_file(BackupDataWriter* dataStream, int fd, int mode, const String8&
                 " You aren't doing proper locking!", realFilename, fileSize, fileSize-bytesLeft);
     }
 
+    if (outCrc != NULL) {
+        *outCrc = crc;
+    }
     free(buf);
     return NO_ERROR;
 }
 
 static int
-write_update_file(BackupDataWriter* dataStream, const String8& key, char const* realFilename)
-{
-    int err;
-    struct stat st;
-
-    err = stat(realFilename, &st);
-    if (err < 0) {
-        return errno;
-    }
-
-    int fd = open(realFilename, O_RDONLY);
-    if (fd == -1) {
-        return errno;
-    }
-
-    err = write_update_file(dataStream, fd, st.st_mode, key, realFilename);
-    close(fd);
-    return err;
-}
-
-static int
-compute_crc32(const char* file, FileRec* out) {
+compute_crc32(const char* file, int* outCrc) {
     int fd = open(file, O_RDONLY);
     if (fd < 0) {
         return -1;
     }
 
-    const int bufsize = 4*1024;
+    // Large reads let zlib's crc32() use the hardware CRC instructions on
+    // long runs.  The file isn't mapped: if it were truncated while we read
+    // it, the mapping would fault.
+    const int bufsize = 64*1024;
     int amt;
 
     char* buf = (char*)malloc(bufsize);
-    int crc = crc32(0L, Z_NULL, 0);
+    uLong crc = crc32(0L, Z_NULL, 0);
 
-    lseek(fd, 0, SEEK_SET);
-
-    while ((amt = read(fd, buf, bufsize)) != 0) {
+    while ((amt = read(fd, buf, bufsize)) > 0) {
         crc = crc32(crc, (Bytef*)buf, amt);
     }
 
     close(fd);
     free(buf);
 
-    out->s.crc32 = crc;
+    *outCrc = crc;
     return NO_ERROR;
 }
 
+/*
+ * A file back_up_files() was asked to back up.  Unlike FileRec, it
+ * doesn't copy the file's name.
+ */
+struct ScannedFile {
+    String8 key;
+    char const* file;
+    bool deleted;
+    // The stat data matches the old snapshot, so only the CRC can tell
+    // whether the file changed.
+    bool checkCrc;
+    FileState s;
+};
+
+static int
+compare_scanned_files(const ScannedFile* a, const ScannedFile* b)
+{
+    return a->key.compare(b->key);
+}
+
+/*
+ * The CRCs back_up_files() needs before it can decide what to send, which
+ * a few threads compute side by side.  Each thread takes the next file
+ * that needs one until none are left.
+ */
+struct CrcScan {
+    Vector<ScannedFile>* files;
+    Vector<size_t> pending;
+    volatile int32_t next;
+};
+
+static void*
+crc_scan_thread(void* cookie)
+{
+    CrcScan* scan = static_cast<CrcScan*>(cookie);
+    const int32_t N = scan->pending.size();
+    int32_t i;
+    while ((i = android_atomic_inc(&scan->next)) < N) {
+        ScannedFile& f = scan->files->editItemAt(scan->pending[i]);
+        if (compute_crc32(f.file, &f.s.crc32) != NO_ERROR) {
+            ALOGW("Unable to open file %s", f.file);
+            f.deleted = true;
+        }
+    }
+    return NULL;
+}
+
+static void
+compute_crcs(Vector<ScannedFile>* files)
+{
+    CrcScan scan;
+    scan.files = files;
+    scan.next = 0;
+    const size_t N = files->size();
+    for (size_t i=0; i<N; i++) {
+        if (files->itemAt(i).checkCrc) {
+            scan.pending.add(i);
+        }
+    }
+
+    const int MAX_THREADS = 4;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threadCount = cpus < 1 ? 1 : (cpus < MAX_THREADS ? cpus : MAX_THREADS);
+    if ((size_t)threadCount > scan.pending.size()) {
+        threadCount = scan.pending.size();
+    }
+
+    // The calling thread scans too, so it starts one fewer.
+    pthread_t threads[MAX_THREADS];
+    int started = 0;
+    while (started < threadCount - 1
+            && pthread_create(&threads[started], NULL, crc_scan_thread, &scan) == 0) {
+        started++;
+    }
+    crc_scan_thread(&scan);
+    for (int i=0; i<started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+/*
+ * Backs up f, whose key is key, and records the CRC of what was sent in
+ * the new snapshot.  If the file can't be opened it is left out of the
+ * new snapshot, and if it was in the old one its entity is deleted.
+ */
+static void
+back_up_scanned_file(BackupDataWriter* dataStream, ScannedFile& f, bool inOldSnapshot)
+{
+    int fd = open(f.file, O_RDONLY);
+    if (fd < 0) {
+        ALOGE("Unable to read file for backup: %s", f.file);
+        f.deleted = true;
+        if (inOldSnapshot) {
+            write_delete_file(dataStream, f.key);
+        }
+        return;
+    }
+    write_update_file(dataStream, fd, f.s.mode, f.key, f.file, &f.s.crc32);
+    close(fd);
+}
+
 int
 back_up_files(int oldSnapshotFD, BackupDataWriter* dataStream, int newSnapshotFD,
         char const* const* files, char const* const* keys, int fileCount)
 {
     int err;
     KeyedVector<String8,FileState> oldSnapshot;
-    KeyedVector<String8,FileRec> newSnapshot;
+    Vector<ScannedFile> newSnapshot;
 
     if (oldSnapshotFD != -1) {
         err = read_snapshot_file(oldSnapshotFD, &oldSnapshot);
@@ -346,39 +486,49 @@ back_up_files(int oldSnapshotFD, BackupDataWriter* dataStream, int newSnapshotFD
         }
     }
 
+    newSnapshot.setCapacity(fileCount);
     for (int i=0; i<fileCount; i++) {
-        String8 key(keys[i]);
-        FileRec r;
-        char const* file = files[i];
-        r.file = file;
+        ScannedFile f;
+        f.key = keys[i];
+        f.file = files[i];
         struct stat st;
 
-        err = stat(file, &st);
+        err = stat(f.file, &st);
         if (err != 0) {
             // not found => treat as deleted
             continue;
+        }
+        f.deleted = false;
+        f.s.modTime_sec = st.st_mtime;
+        f.s.modTime_nsec = 0; // workaround sim breakage
+        //f.s.modTime_nsec = st.st_mtime_nsec;
+        f.s.mode = st.st_mode;
+        f.s.size = st.st_size;
+        f.s.crc32 = 0;
+
+        // A file whose stat data differs from the old snapshot is sent
+        // whatever its CRC, so that is computed while sending it.
+        ssize_t old = oldSnapshot.indexOfKey(f.key);
+        if (old >= 0) {
+            const FileState& o = oldSnapshot.valueAt(old);
+            f.checkCrc = o.modTime_sec == f.s.modTime_sec && o.modTime_nsec == f.s.modTime_nsec
+                    && o.mode == f.s.mode && o.size == f.s.size;
         } else {
-            r.deleted = false;
-            r.s.modTime_sec = st.st_mtime;
-            r.s.modTime_nsec = 0; // workaround sim breakage
-            //r.s.modTime_nsec = st.st_mtime_nsec;
-            r.s.mode = st.st_mode;
-            r.s.size = st.st_size;
-
-            if (newSnapshot.indexOfKey(key) >= 0) {
-                LOGP("back_up_files key already in use '%s'", key.string());
-                return -1;
-            }
+            f.checkCrc = false;
+        }
+        newSnapshot.add(f);
+    }
 
-            // compute the CRC
-            if (compute_crc32(file, &r) != NO_ERROR) {
-                ALOGW("Unable to open file %s", file);
-                continue;
-            }
+    newSnapshot.sort(compare_scanned_files);
+    for (size_t i=1; i<newSnapshot.size(); i++) {
+        if (newSnapshot[i-1].key == newSnapshot[i].key) {
+            LOGP("back_up_files key already in use '%s'", newSnapshot[i].key.string());
+            return -1;
         }
-        newSnapshot.add(key, r);
     }
 
+    compute_crcs(&newSnapshot);
+
     int n = 0;
     int N = oldSnapshot.size();
     int m = 0;
@@ -386,8 +536,8 @@ back_up_files(int oldSnapshotFD, BackupDataWriter* dataStream, int newSnapshotFD
 
     while (n<N && m<M) {
         const String8& p = oldSnapshot.keyAt(n);
-        const String8& q = newSnapshot.keyAt(m);
-        FileRec& g = newSnapshot.editValueAt(m);
+        ScannedFile& g = newSnapshot.editItemAt(m);
+        const String8& q = g.key;
         int cmp = p.compare(q);
         if (cmp < 0) {
             // file present in oldSnapshot, but not present in newSnapshot
@@ -396,8 +546,13 @@ back_up_files(int oldSnapshotFD, BackupDataWriter* dataStream, int newSnapshotFD
             n++;
         } else if (cmp > 0) {
             // file added
-            LOGP("file added: %s crc=0x%08x", g.file.string(), g.s.crc32);
-            write_update_file(dataStream, q, g.file.string());
+            LOGP("file added: %s", g.file);
+            back_up_scanned_file(dataStream, g, false);
+            m++;
+        } else if (g.deleted) {
+            // the file is there but couldn't be read
+            write_delete_file(dataStream, p);
+            n++;
             m++;
         } else {
             // same file exists in both old and new; check whether to update
@@ -408,15 +563,8 @@ back_up_files(int oldSnapshotFD, BackupDataWriter* dataStream, int newSnapshotFD
                     f.modTime_sec, f.modTime_nsec, f.mode, f.size, f.crc32);
             LOGP("  new: modTime=%d,%d mode=%04o size=%-3d crc32=0x%08x",
                     g.s.modTime_sec, g.s.modTime_nsec, g.s.mode, g.s.size, g.s.crc32);
-            if (f.modTime_sec != g.s.modTime_sec || f.modTime_nsec != g.s.modTime_nsec
-                    || f.mode != g.s.mode || f.size != g.s.size || f.crc32 != g.s.crc32) {
-                int fd = open(g.file.string(), O_RDONLY);
-                if (fd < 0) {
-                    ALOGE("Unable to read file for backup: %s", g.file.string());
-                } else {
-                    write_update_file(dataStream, fd, g.s.mode, p, g.file.string());
-                    close(fd);
-                }
+            if (!g.checkCrc || f.crc32 != g.s.crc32) {
+                back_up_scanned_file(dataStream, g, true);
             }
             n++;
             m++;
@@ -431,13 +579,33 @@ back_up_files(int oldSnapshotFD, BackupDataWriter* dataStream, int newSnapshotFD
 
     // these were added
     while (m<M) {
-        const String8& q = newSnapshot.keyAt(m);
-        FileRec& g = newSnapshot.editValueAt(m);
-        write_update_file(dataStream, q, g.file.string());
+        ScannedFile& g = newSnapshot.editItemAt(m);
+        if (!g.deleted) {
+            back_up_scanned_file(dataStream, g, false);
+        }
         m++;
     }
 
-    err = write_snapshot_file(newSnapshotFD, newSnapshot);
+    // Every CRC is known now, so the snapshot is written straight from
+    // the scanned files.
+    int entryCount = 0;
+    int totalSize = sizeof(SnapshotHeader);
+    for (int i=0; i<M; i++) {
+        const ScannedFile& g = newSnapshot[i];
+        if (!g.deleted) {
+            totalSize += sizeof(FileState) + round_up(g.key.length());
+            entryCount++;
+        }
+    }
+    SnapshotWriter writer(newSnapshotFD);
+    writer.writeHeader(entryCount, totalSize);
+    for (int i=0; i<M; i++) {
+        const ScannedFile& g = newSnapshot[i];
+        if (!g.deleted) {
+            writer.writeEntry(g.key, g.s);
+        }
+    }
+    err = writer.flush();
 
     return 0;
 }
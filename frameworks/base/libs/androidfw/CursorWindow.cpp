@@ -141,6 +141,9 @@ status_t CursorWindow::clear() {
 
     RowSlotChunk* firstChunk = static_cast<RowSlotChunk*>(offsetToPtr(mHeader->firstChunkOffset));
     firstChunk->nextChunkOffset = 0;
+
+    mChunkOffsets.clear();
+    mChunkOffsets.add(mHeader->firstChunkOffset);
     return OK;
 }
 
@@ -198,6 +201,64 @@ status_t CursorWindow::freeLastRow() {
     return OK;
 }
 
+status_t CursorWindow::appendRow(const FieldValue* values) {
+    status_t result = allocRow();
+    if (result) {
+        return result;
+    }
+
+    // The new row's directory is filled in directly rather than going
+    // through getFieldSlot() for each column.
+    RowSlot* rowSlot = getRowSlot(mHeader->numRows - 1);
+    FieldSlot* fieldDir = static_cast<FieldSlot*>(offsetToPtr(rowSlot->offset));
+    for (uint32_t column = 0; column < mHeader->numColumns; column++) {
+        const FieldValue& value = values[column];
+        FieldSlot* fieldSlot = &fieldDir[column];
+        switch (value.type) {
+        case FIELD_TYPE_NULL:
+            break;
+        case FIELD_TYPE_INTEGER:
+            fieldSlot->data.l = value.l;
+            break;
+        case FIELD_TYPE_FLOAT:
+            fieldSlot->data.d = value.d;
+            break;
+        case FIELD_TYPE_STRING:
+        case FIELD_TYPE_BLOB: {
+            uint32_t offset = alloc(value.size);
+            if (!offset) {
+                freeLastRow();
+                return NO_MEMORY;
+            }
+            memcpy(offsetToPtr(offset), value.data, value.size);
+            fieldSlot->data.buffer.offset = offset;
+            fieldSlot->data.buffer.size = value.size;
+            break;
+        }
+        default:
+            ALOGE("Field type %d of column %d is not valid.", value.type, column);
+            freeLastRow();
+            return BAD_VALUE;
+        }
+        fieldSlot->type = value.type;
+    }
+    return OK;
+}
+
+status_t CursorWindow::appendRows(const FieldValue* values, size_t numRows,
+        size_t* outNumAppended) {
+    status_t result = OK;
+    size_t row = 0;
+    for (; row < numRows; row++) {
+        result = appendRow(values + row * mHeader->numColumns);
+        if (result) {
+            break;
+        }
+    }
+    *outNumAppended = row;
+    return result;
+}
+
 uint32_t CursorWindow::alloc(size_t size, bool aligned) {
     uint32_t padding;
     if (aligned) {
@@ -221,35 +282,42 @@ uint32_t CursorWindow::alloc(size_t size, bool aligned) {
 }
 
 CursorWindow::RowSlot* CursorWindow::getRowSlot(uint32_t row) {
-    uint32_t chunkPos = row;
+    uint32_t chunkIndex = row / ROW_SLOT_CHUNK_NUM_ROWS;
+    uint32_t chunkPos = row % ROW_SLOT_CHUNK_NUM_ROWS;
+    if (chunkIndex < mChunkOffsets.size()) {
+        RowSlotChunk* chunk = static_cast<RowSlotChunk*>(
+                offsetToPtr(mChunkOffsets[chunkIndex]));
+        return &chunk->slots[chunkPos];
+    }
+
     RowSlotChunk* chunk = static_cast<RowSlotChunk*>(
             offsetToPtr(mHeader->firstChunkOffset));
-    while (chunkPos >= ROW_SLOT_CHUNK_NUM_ROWS) {
+    while (chunkIndex > 0) {
         chunk = static_cast<RowSlotChunk*>(offsetToPtr(chunk->nextChunkOffset));
-        chunkPos -= ROW_SLOT_CHUNK_NUM_ROWS;
+        chunkIndex--;
     }
     return &chunk->slots[chunkPos];
 }
 
 CursorWindow::RowSlot* CursorWindow::allocRowSlot() {
-    uint32_t chunkPos = mHeader->numRows;
-    RowSlotChunk* chunk = static_cast<RowSlotChunk*>(
-            offsetToPtr(mHeader->firstChunkOffset));
-    while (chunkPos > ROW_SLOT_CHUNK_NUM_ROWS) {
-        chunk = static_cast<RowSlotChunk*>(offsetToPtr(chunk->nextChunkOffset));
-        chunkPos -= ROW_SLOT_CHUNK_NUM_ROWS;
-    }
-    if (chunkPos == ROW_SLOT_CHUNK_NUM_ROWS) {
-        if (!chunk->nextChunkOffset) {
-            chunk->nextChunkOffset = alloc(sizeof(RowSlotChunk), true /*aligned*/);
-            if (!chunk->nextChunkOffset) {
-                return NULL;
-            }
+    // Only writable windows get here, and clear() has started their
+    // chunk list, so the last chunk in it is the one to append to.
+    uint32_t chunkIndex = mHeader->numRows / ROW_SLOT_CHUNK_NUM_ROWS;
+    uint32_t chunkPos = mHeader->numRows % ROW_SLOT_CHUNK_NUM_ROWS;
+    if (chunkIndex == mChunkOffsets.size()) {
+        RowSlotChunk* lastChunk = static_cast<RowSlotChunk*>(
+                offsetToPtr(mChunkOffsets[chunkIndex - 1]));
+        uint32_t chunkOffset = alloc(sizeof(RowSlotChunk), true /*aligned*/);
+        if (!chunkOffset) {
+            return NULL;
         }
-        chunk = static_cast<RowSlotChunk*>(offsetToPtr(chunk->nextChunkOffset));
+        RowSlotChunk* chunk = static_cast<RowSlotChunk*>(offsetToPtr(chunkOffset));
         chunk->nextChunkOffset = 0;
-        chunkPos = 0;
+        lastChunk->nextChunkOffset = chunkOffset;
+        mChunkOffsets.add(chunkOffset);
     }
+    // Chunks left over by freeLastRow() are still in the list and get reused.
+    RowSlotChunk* chunk = static_cast<RowSlotChunk*>(offsetToPtr(mChunkOffsets[chunkIndex]));
     mHeader->numRows += 1;
     return &chunk->slots[chunkPos];
 }
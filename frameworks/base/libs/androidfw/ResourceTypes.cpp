@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
 #include <limits>
 #include <type_traits>
 
@@ -31,9 +32,12 @@
 #include <androidfw/ResourceTypes.h>
 #include <androidfw/TypeWrappers.h>
 #include <utils/Atomic.h>
+#include <utils/BasicHashtable.h>
 #include <utils/ByteOrder.h>
 #include <utils/Debug.h>
+#include <utils/JenkinsHash.h>
 #include <utils/Log.h>
+#include <utils/SharedBuffer.h>
 #include <utils/String16.h>
 #include <utils/String8.h>
 
@@ -415,13 +419,17 @@ Res_png_9patch* Res_png_9patch::deserialize(void* inData)
 // --------------------------------------------------------------------
 // --------------------------------------------------------------------
 
+// Unsorted pools with at least this many strings are searched through a
+// hash index rather than scanned.
+static const size_t kMinIndexedStrings = 64;
+
 ResStringPool::ResStringPool()
-    : mError(NO_INIT), mOwnedData(NULL), mHeader(NULL), mCache(NULL)
+    : mError(NO_INIT), mOwnedData(NULL), mHeader(NULL), mCache(NULL), mIndex(NULL)
 {
 }
 
 ResStringPool::ResStringPool(const void* data, size_t size, bool copyData)
-    : mError(NO_INIT), mOwnedData(NULL), mHeader(NULL), mCache(NULL)
+    : mError(NO_INIT), mOwnedData(NULL), mHeader(NULL), mCache(NULL), mIndex(NULL)
 {
     setTo(data, size, copyData);
 }
@@ -642,6 +650,10 @@ void ResStringPool::uninit()
         free(mCache);
         mCache = NULL;
     }
+    if (mIndex != NULL) {
+        free(mIndex);
+        mIndex = NULL;
+    }
     if (mOwnedData) {
         free(mOwnedData);
         mOwnedData = NULL;
@@ -718,9 +730,12 @@ const char16_t* ResStringPool::stringAt(size_t idx, size_t* u16len) const
 
                 // encLen must be less than 0x7FFF due to encoding.
                 if ((uint32_t)(u8str+u8len-strings) < mStringPoolSize) {
-                    AutoMutex lock(mDecodeLock);
-
-                    if (mCache == NULL) {
+                    // Readers never block one another: the table and each
+                    // decoded string are published with a compare-and-swap,
+                    // and a thread that loses the race frees its own copy
+                    // and returns the winner's.
+                    char16_t** cache = __atomic_load_n(&mCache, __ATOMIC_ACQUIRE);
+                    if (cache == NULL) {
 #ifndef __ANDROID__
                         if (kDebugStringPoolNoisy) {
                             ALOGI("CREATING STRING CACHE OF %zu bytes",
@@ -731,16 +746,24 @@ const char16_t* ResStringPool::stringAt(size_t idx, size_t* u16len) const
                         ALOGW("CREATING STRING CACHE OF %zu bytes",
                                 static_cast<size_t>(mHeader->stringCount*sizeof(char16_t**)));
 #endif
-                        mCache = (char16_t**)calloc(mHeader->stringCount, sizeof(char16_t**));
-                        if (mCache == NULL) {
+                        char16_t** newCache =
+                                (char16_t**)calloc(mHeader->stringCount, sizeof(char16_t**));
+                        if (newCache == NULL) {
                             ALOGW("No memory trying to allocate decode cache table of %d bytes\n",
                                     (int)(mHeader->stringCount*sizeof(char16_t**)));
                             return NULL;
                         }
+                        if (__atomic_compare_exchange_n(&mCache, &cache, newCache, false,
+                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                            cache = newCache;
+                        } else {
+                            free(newCache);
+                        }
                     }
 
-                    if (mCache[idx] != NULL) {
-                        return mCache[idx];
+                    char16_t* cached = __atomic_load_n(&cache[idx], __ATOMIC_ACQUIRE);
+                    if (cached != NULL) {
+                        return cached;
                     }
 
                     ssize_t actualLen = utf8_to_utf16_length(u8str, u8len);
@@ -762,7 +785,11 @@ const char16_t* ResStringPool::stringAt(size_t idx, size_t* u16len) const
                         ALOGI("Caching UTF8 string: %s", u8str);
                     }
                     utf8_to_utf16(u8str, u8len, u16str);
-                    mCache[idx] = u16str;
+                    if (!__atomic_compare_exchange_n(&cache[idx], &cached, u16str, false,
+                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                        free(u16str);
+                        return cached;
+                    }
                     return u16str;
                 } else {
                     ALOGW("Bad string block: string #%lld extends to %lld, past end at %lld\n",
@@ -841,6 +868,90 @@ const ResStringPool_span* ResStringPool::styleAt(size_t idx) const
     return NULL;
 }
 
+status_t ResStringPool::validate() const
+{
+    if (mError != NO_ERROR) {
+        return mError;
+    }
+
+    const bool isUTF8 = (mHeader->flags&ResStringPool_header::UTF8_FLAG) != 0;
+    for (size_t idx = 0; idx < mHeader->stringCount; idx++) {
+        if (!isUTF8) {
+            const uint16_t* strings = (const uint16_t*)mStrings;
+            const size_t off = mEntries[idx]/sizeof(uint16_t);
+            const size_t lenChars = off+1 < mStringPoolSize
+                    && (strings[off] & 0x8000) != 0 ? 2 : 1;
+            if (off+lenChars >= mStringPoolSize) {
+                ALOGW("Bad string block: string #%d entry is at %d, past end at %d\n",
+                        (int)idx, (int)(off*sizeof(uint16_t)),
+                        (int)(mStringPoolSize*sizeof(uint16_t)));
+                return BAD_TYPE;
+            }
+            const uint16_t* str = strings+off;
+            const size_t len = decodeLength(&str);
+            const size_t end = (size_t)(str-strings);
+            if (len >= mStringPoolSize-end || str[len] != 0) {
+                ALOGW("Bad string block: string #%d is not 0-terminated in the pool\n",
+                        (int)idx);
+                return BAD_TYPE;
+            }
+        } else {
+            const uint8_t* strings = (const uint8_t*)mStrings;
+            const size_t off = mEntries[idx];
+            // Two lengths of one or two bytes each.
+            size_t pos = off;
+            for (int i = 0; i < 2; i++) {
+                if (pos >= mStringPoolSize) {
+                    break;
+                }
+                pos += (strings[pos] & 0x80) != 0 ? 2 : 1;
+            }
+            if (pos >= mStringPoolSize) {
+                ALOGW("Bad string block: string #%d entry is at %d, past end at %d\n",
+                        (int)idx, (int)off, (int)mStringPoolSize);
+                return BAD_TYPE;
+            }
+            const uint8_t* u8str = strings+off;
+            const size_t u16len = decodeLength(&u8str);
+            const size_t u8len = decodeLength(&u8str);
+            const size_t end = (size_t)(u8str-strings);
+            if (u8len >= mStringPoolSize-end || u8str[u8len] != 0) {
+                ALOGW("Bad string block: string #%d is not 0-terminated in the pool\n",
+                        (int)idx);
+                return BAD_TYPE;
+            }
+            const ssize_t actualLen = utf8_to_utf16_length(u8str, u8len);
+            if (actualLen < 0 || (size_t)actualLen != u16len) {
+                ALOGW("Bad string block: string #%d decoded length is not correct\n",
+                        (int)idx);
+                return BAD_TYPE;
+            }
+        }
+    }
+
+    const size_t spanWords = sizeof(ResStringPool_span)/sizeof(uint32_t);
+    for (size_t idx = 0; idx < mHeader->styleCount; idx++) {
+        size_t pos = mEntryStyles[idx]/sizeof(uint32_t);
+        while (pos < mStylePoolSize && mStyles[pos] != ResStringPool_span::END) {
+            const ResStringPool_span* span = (const ResStringPool_span*)(mStyles+pos);
+            if (spanWords > mStylePoolSize-pos
+                    || span->name.index >= mHeader->stringCount
+                    || span->firstChar > span->lastChar) {
+                ALOGW("Bad string block: style #%d has a bad span at %d\n",
+                        (int)idx, (int)(pos*sizeof(uint32_t)));
+                return BAD_TYPE;
+            }
+            pos += spanWords;
+        }
+        if (pos >= mStylePoolSize) {
+            ALOGW("Bad string block: style #%d is not 0xFFFFFFFF-terminated\n", (int)idx);
+            return BAD_TYPE;
+        }
+    }
+
+    return NO_ERROR;
+}
+
 ssize_t ResStringPool::indexOfString(const char16_t* str, size_t strLen) const
 {
     if (mError != NO_ERROR) {
@@ -902,6 +1013,9 @@ ssize_t ResStringPool::indexOfString(const char16_t* str, size_t strLen) const
             // block, start searching at the back.
             String8 str8(str, strLen);
             const size_t str8Len = str8.size();
+            if (mHeader->stringCount >= kMinIndexedStrings) {
+                return indexOfStringHashed(str8.string(), str8Len);
+            }
             for (int i=mHeader->stringCount-1; i>=0; i--) {
                 const char* s = string8At(i, &len);
                 if (kDebugStringPoolNoisy) {
@@ -951,6 +1065,9 @@ ssize_t ResStringPool::indexOfString(const char16_t* str, size_t strLen) const
             // most often this happens because we want to get IDs for style
             // span tags; since those always appear at the end of the string
             // block, start searching at the back.
+            if (mHeader->stringCount >= kMinIndexedStrings) {
+                return indexOfStringHashed(str, strLen);
+            }
             for (int i=mHeader->stringCount-1; i>=0; i--) {
                 const char16_t* s = stringAt(i, &len);
                 if (kDebugStringPoolNoisy) {
@@ -969,6 +1086,95 @@ ssize_t ResStringPool::indexOfString(const char16_t* str, size_t strLen) const
     return NAME_NOT_FOUND;
 }
 
+/*
+ * Hashes a string the way the index stores it: the UTF-8 bytes for UTF-8
+ * pools, the UTF-16 code units otherwise.
+ */
+static inline uint32_t hashPoolString(const void* str, size_t len, bool utf8)
+{
+    if (utf8) {
+        return JenkinsHashWhiten(JenkinsHashMixBytes(0, (const uint8_t*)str, len));
+    }
+    return JenkinsHashWhiten(JenkinsHashMixShorts(0, (const uint16_t*)str, len));
+}
+
+static const uint32_t kEmptyIndexSlot = 0xffffffff;
+
+void ResStringPool::buildIndexLocked() const
+{
+    const bool utf8 = isUTF8();
+    const size_t N = mHeader->stringCount;
+    size_t capacity = 16;
+    while (capacity < N * 2) {
+        capacity *= 2;
+    }
+    uint32_t* index = (uint32_t*)malloc(capacity * sizeof(uint32_t));
+    if (index == NULL) {
+        return;
+    }
+    memset(index, 0xff, capacity * sizeof(uint32_t));
+    const size_t mask = capacity - 1;
+
+    // Later strings replace earlier copies, so lookups find the last one,
+    // as the backwards linear search used to.
+    for (size_t i = 0; i < N; i++) {
+        size_t len;
+        const void* s = utf8 ? (const void*)string8At(i, &len) : (const void*)stringAt(i, &len);
+        if (s == NULL) {
+            continue;
+        }
+        size_t slot = hashPoolString(s, len, utf8) & mask;
+        while (index[slot] != kEmptyIndexSlot) {
+            size_t otherLen;
+            const void* other = utf8 ? (const void*)string8At(index[slot], &otherLen)
+                                     : (const void*)stringAt(index[slot], &otherLen);
+            if (otherLen == len && memcmp(other, s, len * (utf8 ? 1 : sizeof(char16_t))) == 0) {
+                break;
+            }
+            slot = (slot + 1) & mask;
+        }
+        index[slot] = i;
+    }
+
+    // Published last: indexOfStringHashed() reads it without the lock.
+    mIndexMask = mask;
+    __atomic_store_n(&mIndex, index, __ATOMIC_RELEASE);
+}
+
+/*
+ * Looks "str" up in the hash index, building it if needed.  "str" is
+ * UTF-8 for UTF-8 pools and UTF-16 otherwise; "strLen" counts its units.
+ */
+ssize_t ResStringPool::indexOfStringHashed(const void* str, size_t strLen) const
+{
+    // The index is never changed once built, so only building it locks.
+    const uint32_t* index = __atomic_load_n(&mIndex, __ATOMIC_ACQUIRE);
+    if (index == NULL) {
+        AutoMutex _l(mIndexLock);
+        if (mIndex == NULL) {
+            buildIndexLocked();
+            if (mIndex == NULL) {
+                return NO_MEMORY;
+            }
+        }
+        index = mIndex;
+    }
+
+    const bool utf8 = isUTF8();
+    const size_t unitSize = utf8 ? 1 : sizeof(char16_t);
+    size_t slot = hashPoolString(str, strLen, utf8) & mIndexMask;
+    while (index[slot] != kEmptyIndexSlot) {
+        size_t len;
+        const void* s = utf8 ? (const void*)string8At(index[slot], &len)
+                             : (const void*)stringAt(index[slot], &len);
+        if (s != NULL && len == strLen && memcmp(s, str, len * unitSize) == 0) {
+            return index[slot];
+        }
+        slot = (slot + 1) & mIndexMask;
+    }
+    return NAME_NOT_FOUND;
+}
+
 size_t ResStringPool::size() const
 {
     return (mError == NO_ERROR) ? mHeader->stringCount : 0;
@@ -1313,12 +1519,108 @@ ssize_t ResXMLParser::getAttributeValue(size_t idx, Res_value* outValue) const
     return BAD_TYPE;
 }
 
+static bool isAscii(const char* str, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        if ((unsigned char) str[i] >= 0x80) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool equalsAscii(const char16_t* str16, size_t len16, const char* ascii, size_t len)
+{
+    if (str16 == NULL || len16 != len) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (str16[i] != (char16_t) ascii[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool equalsAscii(const char* str8, size_t len8, const char* ascii, size_t len)
+{
+    return str8 != NULL && len8 == len && memcmp(str8, ascii, len) == 0;
+}
+
 ssize_t ResXMLParser::indexOfAttribute(const char* ns, const char* attr) const
 {
-    String16 nsStr(ns != NULL ? ns : "");
-    String16 attrStr(attr);
-    return indexOfAttribute(ns ? nsStr.string() : NULL, ns ? nsStr.size() : 0,
-                            attrStr.string(), attrStr.size());
+    if (mEventCode != START_TAG || attr == NULL) {
+        return NAME_NOT_FOUND;
+    }
+
+    const size_t nsLen = ns != NULL ? strlen(ns) : 0;
+    const size_t attrLen = strlen(attr);
+    if (!isAscii(ns, nsLen) || !isAscii(attr, attrLen)) {
+        String16 nsStr(ns != NULL ? ns : "");
+        String16 attrStr(attr);
+        return indexOfAttribute(ns ? nsStr.string() : NULL, ns ? nsStr.size() : 0,
+                                attrStr.string(), attrStr.size());
+    }
+
+    // ASCII names are compared straight against the pool's strings, in
+    // whichever encoding it keeps them.
+    const bool utf8 = mTree.mStrings.isUTF8();
+    const size_t N = getAttributeCount();
+    for (size_t i=0; i<N; i++) {
+        size_t curNsLen = 0, curAttrLen = 0;
+        bool found;
+        if (utf8) {
+            const char* curAttr = getAttributeName8(i, &curAttrLen);
+            found = equalsAscii(curAttr, curAttrLen, attr, attrLen);
+            if (found) {
+                const char* curNs = getAttributeNamespace8(i, &curNsLen);
+                found = ns == NULL ? curNs == NULL : equalsAscii(curNs, curNsLen, ns, nsLen);
+            }
+        } else {
+            const char16_t* curAttr = getAttributeName(i, &curAttrLen);
+            found = equalsAscii(curAttr, curAttrLen, attr, attrLen);
+            if (found) {
+                const char16_t* curNs = getAttributeNamespace(i, &curNsLen);
+                found = ns == NULL ? curNs == NULL : equalsAscii(curNs, curNsLen, ns, nsLen);
+            }
+        }
+        if (found) {
+            return i;
+        }
+    }
+    return NAME_NOT_FOUND;
+}
+
+ssize_t ResXMLParser::indexOfAttribute(uint32_t attrResId) const
+{
+    if (mEventCode != START_TAG || attrResId == 0) {
+        return NAME_NOT_FOUND;
+    }
+
+    // aapt writes the attributes without a resource ID first, then the
+    // rest in the order of their IDs.
+    const size_t N = getAttributeCount();
+    size_t lo = 0, hi = N;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        const uint32_t resId = getAttributeNameResID(mid);
+        if (resId == attrResId) {
+            return mid;
+        }
+        if (resId < attrResId) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    // Other tools may not have sorted them.
+    for (size_t i=0; i<N; i++) {
+        if (getAttributeNameResID(i) == attrResId) {
+            return i;
+        }
+    }
+    return NAME_NOT_FOUND;
 }
 
 ssize_t ResXMLParser::indexOfAttribute(const char16_t* ns, size_t nsLen,
@@ -1454,7 +1756,7 @@ ResXMLParser::event_code_t ResXMLParser::nextNode()
             return (mEventCode=END_DOCUMENT);
         }
 
-        if (mTree.validateNode(next) != NO_ERROR) {
+        if (!mTree.mTrusted && mTree.validateNode(next) != NO_ERROR) {
             mCurNode = NULL;
             return (mEventCode=BAD_DOCUMENT);
         }
@@ -1522,7 +1824,7 @@ static volatile int32_t gCount = 0;
 ResXMLTree::ResXMLTree(const DynamicRefTable* dynamicRefTable)
     : ResXMLParser(*this)
     , mDynamicRefTable(dynamicRefTable)
-    , mError(NO_INIT), mOwnedData(NULL)
+    , mError(NO_INIT), mOwnedData(NULL), mTrusted(false)
 {
     if (kDebugResXMLTree) {
         ALOGI("Creating ResXMLTree %p #%d\n", this, android_atomic_inc(&gCount)+1);
@@ -1533,7 +1835,7 @@ ResXMLTree::ResXMLTree(const DynamicRefTable* dynamicRefTable)
 ResXMLTree::ResXMLTree()
     : ResXMLParser(*this)
     , mDynamicRefTable(NULL)
-    , mError(NO_INIT), mOwnedData(NULL)
+    , mError(NO_INIT), mOwnedData(NULL), mTrusted(false)
 {
     if (kDebugResXMLTree) {
         ALOGI("Creating ResXMLTree %p #%d\n", this, android_atomic_inc(&gCount)+1);
@@ -1651,6 +1953,21 @@ status_t ResXMLTree::getError() const
     return mError;
 }
 
+status_t ResXMLTree::setToTrusted(const void* data, size_t size)
+{
+    status_t err = setTo(data, size, false);
+    mTrusted = err == NO_ERROR;
+    return err;
+}
+
+status_t ResXMLTree::adoptTrusted(void* data, size_t size)
+{
+    // setTo() has freed whatever the tree owned before.
+    status_t err = setToTrusted(data, size);
+    mOwnedData = data;
+    return err;
+}
+
 void ResXMLTree::uninit()
 {
     mError = NO_INIT;
@@ -1659,6 +1976,7 @@ void ResXMLTree::uninit()
         free(mOwnedData);
         mOwnedData = NULL;
     }
+    mTrusted = false;
     restart();
 }
 
@@ -2905,16 +3223,18 @@ String8 ResTable_config::toString() const {
 
 struct ResTable::Header
 {
-    Header(ResTable* _owner) : owner(_owner), ownedData(NULL), header(NULL),
+    Header(ResTable* _owner) : owner(_owner), ownedData(NULL), ownedAsset(NULL), header(NULL),
         resourceIDMap(NULL), resourceIDMapSize(0) { }
 
     ~Header()
     {
         free(resourceIDMap);
+        delete ownedAsset;
     }
 
     const ResTable* const           owner;
     void*                           ownedData;
+    Asset*                          ownedAsset;     // holds the data when not copied
     const ResTable_header*          header;
     size_t                          size;
     const uint8_t*                  dataEnd;
@@ -2980,14 +3300,22 @@ struct ResTable::PackageGroup
     PackageGroup(ResTable* _owner, const String16& _name, uint32_t _id)
         : owner(_owner)
         , name(_name)
+        , name8(_name)
         , id(_id)
         , largestTypeId(0)
         , bags(NULL)
         , dynamicRefTable(static_cast<uint8_t>(_id))
-    { }
+    {
+        memset(nameIndexes, 0, sizeof(nameIndexes));
+        memset(resolvedEntries, 0, sizeof(resolvedEntries));
+        memset(entryNames, 0, sizeof(entryNames));
+    }
 
     ~PackageGroup() {
         clearBagCache();
+        clearNameIndex();
+        clearResolvedEntries();
+        clearEntryNames();
         const size_t numTypes = types.size();
         for (size_t i = 0; i < numTypes; i++) {
             const TypeList& typeList = types[i];
@@ -3029,8 +3357,10 @@ struct ResTable::PackageGroup
                             printf("type->entryCount=%zu\n", N);
                         }
                         for (size_t j = 0; j < N; j++) {
-                            if (typeBags[j] && typeBags[j] != (bag_set*)0xFFFFFFFF)
+                            if (typeBags[j] && typeBags[j] != (bag_set*)0xFFFFFFFF) {
+                                owner->uncacheBagLocked(typeBags[j]);
                                 free(typeBags[j]);
+                            }
                         }
                         free(typeBags);
                     }
@@ -3041,6 +3371,202 @@ struct ResTable::PackageGroup
         }
     }
 
+    // Creates the bag table of every type up front, so that only the
+    // slots in them change while the owning ResTable is frozen.
+    status_t allocateBagCache() {
+        if (!bags) {
+            bags = new ByteBucketArray<bag_set**>();
+        }
+        const size_t numTypes = types.size();
+        for (size_t i = 0; i < numTypes; i++) {
+            const TypeList& typeList = types[i];
+            if (typeList.isEmpty() || typeList[0]->entryCount == 0 || bags->get(i)) {
+                continue;
+            }
+            bag_set** typeSet = (bag_set**)calloc(typeList[0]->entryCount, sizeof(bag_set*));
+            if (!typeSet) {
+                return NO_MEMORY;
+            }
+            bags->set(i, typeSet);
+        }
+        return NO_ERROR;
+    }
+
+    // A type index and entry name, as looked up by identifierForName().
+    struct NameKey {
+        NameKey(size_t _typeIndex, const char16_t* _name, size_t _nameLen)
+            : typeIndex(_typeIndex), name(_name), nameLen(_nameLen) { }
+
+        bool operator==(const NameKey& o) const {
+            return typeIndex == o.typeIndex && nameLen == o.nameLen
+                    && memcmp(name, o.name, nameLen * sizeof(char16_t)) == 0;
+        }
+
+        hash_t hash() const {
+            return JenkinsHashWhiten(JenkinsHashMixShorts(typeIndex,
+                    reinterpret_cast<const uint16_t*>(name), nameLen));
+        }
+
+        size_t typeIndex;
+        const char16_t* name;
+        size_t nameLen;
+    };
+
+    struct NameIndexEntry {
+        NameIndexEntry(size_t _typeIndex, const String16& _name, size_t _entryIndex)
+            : typeIndex(_typeIndex), name(_name), entryIndex(_entryIndex) { }
+
+        NameKey getKey() const { return NameKey(typeIndex, name.string(), name.size()); }
+
+        size_t typeIndex;
+        String16 name;
+        size_t entryIndex;
+    };
+
+    typedef BasicHashtable<NameKey, NameIndexEntry> NameIndex;
+
+    // Returns the index of every named entry of one type of the group,
+    // building it the first time that type is looked up; most types of a
+    // big included package never are.  The index stays valid until the
+    // group changes.
+    const NameIndex* getNameIndex(size_t typeIndex) const {
+        if (typeIndex >= kMaxNameIndexes) {
+            return NULL;
+        }
+        // Once built, the index is read without the lock.
+        NameIndex* index = __atomic_load_n(&nameIndexes[typeIndex], __ATOMIC_ACQUIRE);
+        if (index == NULL) {
+            AutoMutex _l(nameIndexLock);
+            index = nameIndexes[typeIndex];
+            if (index == NULL) {
+                index = buildNameIndex(typeIndex);
+                __atomic_store_n(&nameIndexes[typeIndex], index, __ATOMIC_RELEASE);
+            }
+        }
+        return index;
+    }
+
+    void clearNameIndex() {
+        AutoMutex _l(nameIndexLock);
+        for (size_t i = 0; i < kMaxNameIndexes; i++) {
+            delete nameIndexes[i];
+            __atomic_store_n(&nameIndexes[i], (NameIndex*)NULL, __ATOMIC_RELEASE);
+        }
+    }
+
+    // The entry getEntry() picked for one entry of a type under the owning
+    // table's parameters; 'type' is NULL if none of the configs matching
+    // them defines it.
+    struct ResolvedEntry {
+        const ResTable_type* type;
+        const Package* package;
+        uint32_t offset;
+        uint32_t specFlags;
+        uint8_t actualTypeIndex;
+        uint8_t ready;
+    };
+
+    // Returns the entry cached for 'entryIndex' of type 'typeIndex', or
+    // NULL if it has not been resolved under the current parameters.
+    const ResolvedEntry* getResolvedEntry(size_t typeIndex, size_t entryIndex) const {
+        if (typeIndex >= kMaxNameIndexes) {
+            return NULL;
+        }
+        // A slot is only written once, before it is marked ready.
+        const ResolvedEntry* typeEntries =
+                __atomic_load_n(&resolvedEntries[typeIndex], __ATOMIC_ACQUIRE);
+        if (typeEntries == NULL || entryIndex >= types[typeIndex][0]->entryCount) {
+            return NULL;
+        }
+        const ResolvedEntry* resolved = &typeEntries[entryIndex];
+        return __atomic_load_n(&resolved->ready, __ATOMIC_ACQUIRE) ? resolved : NULL;
+    }
+
+    void setResolvedEntry(size_t typeIndex, size_t entryIndex,
+                          const ResolvedEntry& resolved) const {
+        if (typeIndex >= kMaxNameIndexes) {
+            return;
+        }
+        const TypeList& typeList = types[typeIndex];
+        if (typeList.isEmpty() || entryIndex >= typeList[0]->entryCount) {
+            return;
+        }
+        AutoMutex _l(resolvedEntryLock);
+        ResolvedEntry* typeEntries = resolvedEntries[typeIndex];
+        if (typeEntries == NULL) {
+            typeEntries = (ResolvedEntry*)calloc(typeList[0]->entryCount,
+                                                 sizeof(ResolvedEntry));
+            if (typeEntries == NULL) {
+                return;
+            }
+            __atomic_store_n(&resolvedEntries[typeIndex], typeEntries, __ATOMIC_RELEASE);
+        }
+        ResolvedEntry* slot = &typeEntries[entryIndex];
+        if (!slot->ready) {
+            *slot = resolved;
+            slot->ready = 0;
+            __atomic_store_n(&slot->ready, (uint8_t)1, __ATOMIC_RELEASE);
+        }
+    }
+
+    // Forgets every resolved entry, when the parameters or the types of
+    // the group change.
+    void clearResolvedEntries() {
+        AutoMutex _l(resolvedEntryLock);
+        for (size_t i = 0; i < kMaxNameIndexes; i++) {
+            free(resolvedEntries[i]);
+            __atomic_store_n(&resolvedEntries[i], (ResolvedEntry*)NULL, __ATOMIC_RELEASE);
+        }
+    }
+
+    // The UTF-8 type and key of one entry, as getResourceName8() returns
+    // them; 'name' is NULL if no config defines the entry.
+    struct EntryName {
+        const char* type;
+        const char* name;
+        uint32_t typeLen;
+        uint32_t nameLen;
+    };
+
+    struct EntryNames {
+        EntryNames() : entries(NULL), count(0) { }
+        ~EntryNames() { free(entries); }
+
+        EntryName* entries;
+        size_t count;
+        // The strings of UTF-16 pools, converted; 'entries' point into them.
+        Vector<String8> decoded;
+    };
+
+    // Returns the names of every entry of one type of the group, looked up
+    // through 'table' the first time they are asked for if 'build' is set.
+    // They stay valid until the group changes.
+    const EntryNames* getEntryNames(const ResTable* table, size_t typeIndex,
+                                    bool build) const {
+        if (typeIndex >= kMaxNameIndexes) {
+            return NULL;
+        }
+        // Once built, the names are read without the lock.
+        EntryNames* names = __atomic_load_n(&entryNames[typeIndex], __ATOMIC_ACQUIRE);
+        if (names == NULL && build) {
+            AutoMutex _l(entryNameLock);
+            names = entryNames[typeIndex];
+            if (names == NULL) {
+                names = buildEntryNames(table, typeIndex);
+                __atomic_store_n(&entryNames[typeIndex], names, __ATOMIC_RELEASE);
+            }
+        }
+        return names;
+    }
+
+    void clearEntryNames() {
+        AutoMutex _l(entryNameLock);
+        for (size_t i = 0; i < kMaxNameIndexes; i++) {
+            delete entryNames[i];
+            __atomic_store_n(&entryNames[i], (EntryNames*)NULL, __ATOMIC_RELEASE);
+        }
+    }
+
     ssize_t findType16(const char16_t* type, size_t len) const {
         const size_t N = packages.size();
         for (size_t i = 0; i < N; i++) {
@@ -3054,6 +3580,7 @@ struct ResTable::PackageGroup
 
     const ResTable* const           owner;
     String16 const                  name;
+    String8 const                   name8;
     uint32_t const                  id;
 
     // This is mainly used to keep track of the loaded packages
@@ -3075,6 +3602,138 @@ struct ResTable::PackageGroup
     // by having these tables in a per-package scope rather than
     // per-package-group.
     DynamicRefTable                 dynamicRefTable;
+
+private:
+    enum { kMaxNameIndexes = 256 };
+
+    NameIndex* buildNameIndex(size_t ti) const {
+        NameIndex* index = new NameIndex();
+
+        // Visit the entries in the order findEntry() used to search them,
+        // keeping the first one found for each name.
+        const TypeList& typeList = types[ti];
+        for (size_t i = 0; i < typeList.size(); i++) {
+            const Type* t = typeList[i];
+            const ResStringPool& keyStrings = t->package->keyStrings;
+
+            // An entry usually has the same key in every config, and a
+            // name already seen adds nothing, so only remember the key
+            // each entry had the last time it was indexed.
+            const uint32_t noKey = 0xffffffff;
+            Vector<uint32_t> lastKeys;
+            lastKeys.insertAt(noKey, 0, t->entryCount);
+
+            for (size_t j = 0; j < t->configs.size(); j++) {
+                const TypeVariant tv(t->configs[j]);
+                for (TypeVariant::iterator iter = tv.beginEntries();
+                     iter != tv.endEntries();
+                     iter++) {
+                    const ResTable_entry* entry = *iter;
+                    if (entry == NULL) {
+                        continue;
+                    }
+
+                    const size_t keyIndex = dtohl(entry->key.index);
+                    if (iter.index() < lastKeys.size()) {
+                        if (lastKeys[iter.index()] == keyIndex) {
+                            continue;
+                        }
+                        lastKeys.editItemAt(iter.index()) = keyIndex;
+                    }
+
+                    String16 name;
+                    size_t len;
+                    if (keyStrings.isUTF8()) {
+                        const char* name8 = keyStrings.string8At(keyIndex, &len);
+                        if (name8 == NULL) {
+                            continue;
+                        }
+                        name = String16(name8, len);
+                    } else {
+                        const char16_t* name16 = keyStrings.stringAt(keyIndex, &len);
+                        if (name16 == NULL) {
+                            continue;
+                        }
+                        name = String16(name16, len);
+                    }
+
+                    NameKey key(ti, name.string(), name.size());
+                    const hash_t hash = key.hash();
+                    if (index->find(-1, hash, key) < 0) {
+                        index->add(hash, NameIndexEntry(ti, name, iter.index()));
+                    }
+                }
+            }
+        }
+        return index;
+    }
+
+    // Returns the UTF-8 form of 'ref', converting it into 'names' if its
+    // pool is in UTF-16.
+    static const char* entryNameString(const StringPoolRef& ref, EntryNames* names,
+                                       size_t* outLen) {
+        const char* str8 = ref.string8(outLen);
+        if (str8 != NULL) {
+            return str8;
+        }
+        const char16_t* str16 = ref.string16(outLen);
+        if (str16 == NULL) {
+            return NULL;
+        }
+        names->decoded.add(String8(str16, *outLen));
+        const String8& decoded = names->decoded.top();
+        *outLen = decoded.size();
+        return decoded.string();
+    }
+
+    EntryNames* buildEntryNames(const ResTable* table, size_t typeIndex) const {
+        EntryNames* names = new EntryNames;
+        const TypeList& typeList = types[typeIndex];
+        if (typeList.isEmpty() || typeList[0]->entryCount == 0) {
+            return names;
+        }
+        names->entries = (EntryName*)calloc(typeList[0]->entryCount, sizeof(EntryName));
+        if (names->entries == NULL) {
+            return names;
+        }
+        names->count = typeList[0]->entryCount;
+
+        // Every entry names its type in one of a few packages, so a type
+        // string is only converted again when the package changes.
+        const Package* lastPackage = NULL;
+        const char* type = NULL;
+        size_t typeLen = 0;
+        for (size_t e = 0; e < names->count; e++) {
+            Entry entry;
+            if (table->getEntry(this, typeIndex, e, NULL, &entry) != NO_ERROR) {
+                continue;
+            }
+            if (type == NULL || entry.package != lastPackage) {
+                type = entryNameString(entry.typeStr, names, &typeLen);
+                lastPackage = entry.package;
+            }
+            size_t nameLen;
+            const char* name = entryNameString(entry.keyStr, names, &nameLen);
+            if (type == NULL || name == NULL) {
+                continue;
+            }
+            EntryName& entryName = names->entries[e];
+            entryName.type = type;
+            entryName.typeLen = typeLen;
+            entryName.name = name;
+            entryName.nameLen = nameLen;
+        }
+        return names;
+    }
+
+    mutable Mutex                   nameIndexLock;
+    mutable NameIndex*              nameIndexes[kMaxNameIndexes];
+
+    mutable Mutex                   resolvedEntryLock;
+    mutable ResolvedEntry*          resolvedEntries[kMaxNameIndexes];
+
+    mutable Mutex                   entryNameLock;
+    mutable EntryNames*             entryNames[kMaxNameIndexes];
 };
 
 struct ResTable::bag_set
@@ -3082,6 +3741,11 @@ struct ResTable::bag_set
     size_t numAttrs;    // number in array
     size_t availAttrs;  // total space in array
     uint32_t typeSpecFlags;
+    // The bag's place in the owning table's use order, and the slot of
+    // its package group's cache that holds it.
+    bag_set* newer;
+    bag_set* older;
+    bag_set** slot;
     // Followed by 'numAttr' bag_entry structures.
 };
 
@@ -3106,25 +3770,22 @@ void ResTable::Theme::free_package(package_info* pi)
     for (size_t j = 0; j <= Res_MAXTYPE; j++) {
         theme_entry* te = pi->types[j].entries;
         if (te != NULL) {
-            free(te);
+            SharedBuffer::bufferFromData(te)->release();
         }
     }
     free(pi);
 }
 
+// The copy shares the entries of each type with 'pi' until either theme
+// applies a style that changes them.
 ResTable::Theme::package_info* ResTable::Theme::copy_package(package_info* pi)
 {
     package_info* newpi = (package_info*)malloc(sizeof(package_info));
+    memcpy(newpi, pi, sizeof(package_info));
     for (size_t j = 0; j <= Res_MAXTYPE; j++) {
-        size_t cnt = pi->types[j].numEntries;
-        newpi->types[j].numEntries = cnt;
-        theme_entry* te = pi->types[j].entries;
+        theme_entry* te = newpi->types[j].entries;
         if (te != NULL) {
-            theme_entry* newte = (theme_entry*)malloc(cnt*sizeof(theme_entry));
-            newpi->types[j].entries = newte;
-            memcpy(newte, te, cnt*sizeof(theme_entry));
-        } else {
-            newpi->types[j].entries = NULL;
+            SharedBuffer::bufferFromData(te)->acquire();
         }
     }
     return newpi;
@@ -3183,15 +3844,26 @@ status_t ResTable::Theme::applyStyle(uint32_t resID, bool force)
             }
             curType = t;
             curEntries = curPI->types[t].entries;
+            SharedBuffer* sb;
             if (curEntries == NULL) {
                 PackageGroup* const grp = mTable.mPackageGroups[curPackageIndex];
                 const TypeList& typeList = grp->types[t];
                 int cnt = typeList.isEmpty() ? 0 : typeList[0]->entryCount;
-                curEntries = (theme_entry*)malloc(cnt*sizeof(theme_entry));
-                memset(curEntries, Res_value::TYPE_NULL, cnt*sizeof(theme_entry));
-                curPI->types[t].numEntries = cnt;
-                curPI->types[t].entries = curEntries;
+                sb = SharedBuffer::alloc(cnt*sizeof(theme_entry));
+                if (sb != NULL) {
+                    memset(sb->data(), Res_value::TYPE_NULL, cnt*sizeof(theme_entry));
+                    curPI->types[t].numEntries = cnt;
+                }
+            } else {
+                // Copied only if another theme still shares them.
+                sb = SharedBuffer::bufferFromData(curEntries)->edit();
+            }
+            if (sb == NULL) {
+                mTable.unlock();
+                return NO_MEMORY;
             }
+            curEntries = (theme_entry*)sb->data();
+            curPI->types[t].entries = curEntries;
             numEntries = curPI->types[t].numEntries;
         }
         if (e >= numEntries) {
@@ -3353,6 +4025,27 @@ ssize_t ResTable::Theme::resolveAttributeReference(Res_value* inOutValue,
             inoutTypeSpecFlags, inoutConfig);
 }
 
+size_t ResTable::Theme::resolveAttributes(const uint32_t* attrs, size_t count,
+        Res_value* outValues, ssize_t* outBlocks, uint32_t* outTypeSpecFlags) const
+{
+    size_t resolved = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t typeSpecFlags = 0;
+        ssize_t block = getAttribute(attrs[i], &outValues[i], &typeSpecFlags);
+        if (block >= 0) {
+            block = mTable.resolveReference(&outValues[i], block, NULL, &typeSpecFlags);
+        }
+        outBlocks[i] = block;
+        if (outTypeSpecFlags != NULL) {
+            outTypeSpecFlags[i] = typeSpecFlags;
+        }
+        if (block >= 0) {
+            resolved++;
+        }
+    }
+    return resolved;
+}
+
 void ResTable::Theme::dumpToLog() const
 {
     ALOGI("Theme %p:\n", this);
@@ -3377,9 +4070,12 @@ void ResTable::Theme::dumpToLog() const
 }
 
 ResTable::ResTable()
-    : mError(NO_INIT), mNextPackageId(2)
+    : mError(NO_INIT), mFrozen(false), mFullValidation(false), mNewestBag(NULL),
+      mOldestBag(NULL), mBagCacheLimit(0), mNextPackageId(2)
 {
+    memset(&mBagCacheStats, 0, sizeof(mBagCacheStats));
     memset(&mParams, 0, sizeof(mParams));
+    mHaveConfigurations[0] = mHaveConfigurations[1] = false;
     memset(mPackageMap, 0, sizeof(mPackageMap));
     if (kDebugTableSuperNoisy) {
         ALOGI("Creating ResTable %p\n", this);
@@ -3387,9 +4083,12 @@ ResTable::ResTable()
 }
 
 ResTable::ResTable(const void* data, size_t size, const int32_t cookie, bool copyData)
-    : mError(NO_INIT), mNextPackageId(2)
+    : mError(NO_INIT), mFrozen(false), mFullValidation(false), mNewestBag(NULL),
+      mOldestBag(NULL), mBagCacheLimit(0), mNextPackageId(2)
 {
+    memset(&mBagCacheStats, 0, sizeof(mBagCacheStats));
     memset(&mParams, 0, sizeof(mParams));
+    mHaveConfigurations[0] = mHaveConfigurations[1] = false;
     memset(mPackageMap, 0, sizeof(mPackageMap));
     addInternal(data, size, NULL, 0, cookie, copyData);
     LOG_FATAL_IF(mError != NO_ERROR, "Error parsing resource table");
@@ -3452,9 +4151,26 @@ status_t ResTable::add(Asset* asset, Asset* idmapAsset, const int32_t cookie, bo
             idmapData, idmapSize, cookie, copyData);
 }
 
+status_t ResTable::addOwned(Asset* asset, Asset* idmapAsset, const int32_t cookie) {
+    const size_t headerCount = mHeaders.size();
+    status_t err = add(asset, idmapAsset, cookie, false);
+    if (mHeaders.size() > headerCount && mHeaders[headerCount]->ownedData == NULL) {
+        mHeaders[headerCount]->ownedAsset = asset;
+    } else {
+        delete asset;
+    }
+    return err;
+}
+
 status_t ResTable::add(ResTable* src)
 {
+    if (mFrozen) {
+        ALOGW("Cannot add to a frozen ResTable");
+        return INVALID_OPERATION;
+    }
+
     mError = src->mError;
+    clearConfigurations();
 
     for (size_t i=0; i<src->mHeaders.size(); i++) {
         mHeaders.add(src->mHeaders[i]);
@@ -3486,6 +4202,11 @@ status_t ResTable::add(ResTable* src)
 }
 
 status_t ResTable::addEmpty(const int32_t cookie) {
+    if (mFrozen) {
+        ALOGW("Cannot add to a frozen ResTable");
+        return INVALID_OPERATION;
+    }
+
     Header* header = new Header(this);
     header->index = mHeaders.size();
     header->cookie = cookie;
@@ -3509,6 +4230,13 @@ status_t ResTable::addInternal(const void* data, size_t dataSize, const void* id
         return NO_ERROR;
     }
 
+    clearConfigurations();
+
+    if (mFrozen) {
+        ALOGW("Cannot add to a frozen ResTable");
+        return INVALID_OPERATION;
+    }
+
     if (dataSize < sizeof(ResTable_header)) {
         ALOGE("Invalid data. Size(%d) is smaller than a ResTable_header(%d).",
                 (int) dataSize, (int) sizeof(ResTable_header));
@@ -3593,6 +4321,9 @@ status_t ResTable::addInternal(const void* data, size_t dataSize, const void* id
                 // Only use the first string chunk; ignore any others that
                 // may appear.
                 status_t err = header->values.setTo(chunk, csize);
+                if (err == NO_ERROR && mFullValidation) {
+                    err = header->values.validate();
+                }
                 if (err != NO_ERROR) {
                     return (mError=err);
                 }
@@ -3643,6 +4374,9 @@ status_t ResTable::getError() const
 void ResTable::uninit()
 {
     mError = NO_INIT;
+    mFrozen = false;
+    clearValueNames();
+    clearConfigurations();
     size_t N = mPackageGroups.size();
     for (size_t i=0; i<N; i++) {
         PackageGroup* g = mPackageGroups[i];
@@ -3692,14 +4426,31 @@ bool ResTable::getResourceName(uint32_t resID, bool allowUtf8, resource_name* ou
         return false;
     }
 
+    outName->package = grp->name.string();
+    outName->packageLen = grp->name.size();
+
+    // The index, if indexResourceNames() has built it, has the name as UTF-8.
+    const PackageGroup::EntryNames* names = allowUtf8 ? grp->getEntryNames(this, t, false) : NULL;
+    if (names != NULL) {
+        if (static_cast<size_t>(e) >= names->count || names->entries[e].name == NULL) {
+            return false;
+        }
+        const PackageGroup::EntryName& entryName = names->entries[e];
+        outName->type = NULL;
+        outName->type8 = entryName.type;
+        outName->typeLen = entryName.typeLen;
+        outName->name = NULL;
+        outName->name8 = entryName.name;
+        outName->nameLen = entryName.nameLen;
+        return true;
+    }
+
     Entry entry;
     status_t err = getEntry(grp, t, e, NULL, &entry);
     if (err != NO_ERROR) {
         return false;
     }
 
-    outName->package = grp->name.string();
-    outName->packageLen = grp->name.size();
     if (allowUtf8) {
         outName->type8 = entry.typeStr.string8(&outName->typeLen);
         outName->name8 = entry.keyStr.string8(&outName->nameLen);
@@ -3725,6 +4476,58 @@ bool ResTable::getResourceName(uint32_t resID, bool allowUtf8, resource_name* ou
     return true;
 }
 
+bool ResTable::getResourceName8(uint32_t resID, resource_name8* outName) const
+{
+    if (mError != NO_ERROR) {
+        return false;
+    }
+
+    const ssize_t p = getResourcePackageIndex(resID);
+    const int t = Res_GETTYPE(resID);
+    const int e = Res_GETENTRY(resID);
+    if (p < 0 || t < 0) {
+        ALOGW("No known package or type when getting name for resource number 0x%08x", resID);
+        return false;
+    }
+
+    const PackageGroup* const grp = mPackageGroups[p];
+    if (grp == NULL) {
+        ALOGW("Bad identifier when getting name for resource number 0x%08x", resID);
+        return false;
+    }
+
+    const PackageGroup::EntryNames* names = grp->getEntryNames(this, t, true);
+    if (names == NULL || static_cast<size_t>(e) >= names->count
+            || names->entries[e].name == NULL) {
+        return false;
+    }
+    const PackageGroup::EntryName& entryName = names->entries[e];
+    outName->package = grp->name8.string();
+    outName->packageLen = grp->name8.size();
+    outName->type = entryName.type;
+    outName->typeLen = entryName.typeLen;
+    outName->name = entryName.name;
+    outName->nameLen = entryName.nameLen;
+    return true;
+}
+
+void ResTable::indexResourceNames() const
+{
+    if (mError != NO_ERROR) {
+        return;
+    }
+    const size_t numGroups = mPackageGroups.size();
+    for (size_t i = 0; i < numGroups; i++) {
+        const PackageGroup* grp = mPackageGroups[i];
+        const size_t numTypes = grp->types.size();
+        for (size_t t = 0; t < numTypes; t++) {
+            if (!grp->types[t].isEmpty()) {
+                grp->getEntryNames(this, t, true);
+            }
+        }
+    }
+}
+
 ssize_t ResTable::getResource(uint32_t resID, Res_value* outValue, bool mayBeBag, uint16_t density,
         uint32_t* outSpecFlags, ResTable_config* outConfig) const
 {
@@ -3756,13 +4559,16 @@ ssize_t ResTable::getResource(uint32_t resID, Res_value* outValue, bool mayBeBag
     }
 
     // Allow overriding density
-    ResTable_config desiredConfig = mParams;
+    const ResTable_config* desiredConfig = &mParams;
+    ResTable_config densityConfig;
     if (density > 0) {
-        desiredConfig.density = density;
+        densityConfig = mParams;
+        densityConfig.density = density;
+        desiredConfig = &densityConfig;
     }
 
     Entry entry;
-    status_t err = getEntry(grp, t, e, &desiredConfig, &entry);
+    status_t err = getEntry(grp, t, e, desiredConfig, &entry);
     if (err != NO_ERROR) {
         // Only log the failure when we're not running on the host as
         // part of a tool. The caller will do its own logging.
@@ -3867,7 +4673,16 @@ const char16_t* ResTable::valueToString(
 
 ssize_t ResTable::lockBag(uint32_t resID, const bag_entry** outBag) const
 {
+    if (mFrozen) {
+        // A computed bag never changes while the table is frozen, so
+        // there is nothing to hold until unlockBag().
+        return getBagLocked(resID, outBag);
+    }
+
     mLock.lock();
+    if (mBagCacheLimit != 0 && mBagCacheStats.bytes > mBagCacheLimit) {
+        trimBagCacheLocked(mBagCacheLimit);
+    }
     ssize_t err = getBagLocked(resID, outBag);
     if (err < NO_ERROR) {
         //printf("*** get failed!  unlocking\n");
@@ -3879,21 +4694,87 @@ ssize_t ResTable::lockBag(uint32_t resID, const bag_entry** outBag) const
 void ResTable::unlockBag(const bag_entry* /*bag*/) const
 {
     //printf("<<< unlockBag %p\n", this);
-    mLock.unlock();
+    if (!mFrozen) {
+        mLock.unlock();
+    }
 }
 
 void ResTable::lock() const
 {
-    mLock.lock();
+    if (!mFrozen) {
+        mLock.lock();
+        // Nothing is held from the bag cache between calls to lock().
+        if (mBagCacheLimit != 0 && mBagCacheStats.bytes > mBagCacheLimit) {
+            trimBagCacheLocked(mBagCacheLimit);
+        }
+    }
 }
 
 void ResTable::unlock() const
 {
-    mLock.unlock();
+    if (!mFrozen) {
+        mLock.unlock();
+    }
 }
 
 ssize_t ResTable::getBagLocked(uint32_t resID, const bag_entry** outBag,
         uint32_t* outTypeSpecFlags) const
+{
+    if (!mFrozen) {
+        return buildBagLocked(resID, outBag, outTypeSpecFlags);
+    }
+
+    const bag_set* set = getFrozenBag(resID);
+    if (set == NULL) {
+        // Not computed yet, or resID is bad and building it will say so.
+        AutoMutex _l(mLock);
+        return buildBagLocked(resID, outBag, outTypeSpecFlags);
+    }
+    if (outTypeSpecFlags != NULL) {
+        *outTypeSpecFlags = set->typeSpecFlags;
+    }
+    *outBag = (const bag_entry*)(set+1);
+    return set->numAttrs;
+}
+
+/*
+ * Returns the bag of resID if it has already been computed, without
+ * locking.  Only valid while the table is frozen: the bag tables of every
+ * type were created by setFrozen(), so the only thing that can change
+ * under a reader is the slot of a bag being published.
+ */
+const ResTable::bag_set* ResTable::getFrozenBag(uint32_t resID) const
+{
+    if (mError != NO_ERROR) {
+        return NULL;
+    }
+
+    const ssize_t p = getResourcePackageIndex(resID);
+    const int t = Res_GETTYPE(resID);
+    const int e = Res_GETENTRY(resID);
+    if (p < 0 || t < 0) {
+        return NULL;
+    }
+
+    const PackageGroup* const grp = mPackageGroups[p];
+    if (grp == NULL || grp->bags == NULL) {
+        return NULL;
+    }
+    const TypeList& typeConfigs = grp->types[t];
+    if (typeConfigs.isEmpty() || e >= (int)typeConfigs[0]->entryCount) {
+        return NULL;
+    }
+
+    bag_set** typeSet = grp->bags->get(t);
+    if (typeSet == NULL) {
+        return NULL;
+    }
+    bag_set* set = __atomic_load_n(&typeSet[e], __ATOMIC_ACQUIRE);
+    return set != (bag_set*)0xFFFFFFFF ? set : NULL;
+}
+
+ssize_t ResTable::buildBagLocked(uint32_t resID, const bag_entry** outBag,
+        uint32_t* outTypeSpecFlags) const
 {
     if (mError != NO_ERROR) {
         return mError;
@@ -3939,6 +4820,7 @@ ssize_t ResTable::getBagLocked(uint32_t resID, const bag_entry** outBag,
             bag_set* set = typeSet[e];
             if (set) {
                 if (set != (bag_set*)0xFFFFFFFF) {
+                    useBagLocked(set);
                     if (outTypeSpecFlags != NULL) {
                         *outTypeSpecFlags = set->typeSpecFlags;
                     }
@@ -3970,6 +4852,7 @@ ssize_t ResTable::getBagLocked(uint32_t resID, const bag_entry** outBag,
 
     // Mark that we are currently working on this one.
     typeSet[e] = (bag_set*)0xFFFFFFFF;
+    mBagCacheStats.misses++;
 
     if (kDebugTableNoisy) {
         ALOGI("Building bag: %x\n", resID);
@@ -3998,8 +4881,12 @@ ssize_t ResTable::getBagLocked(uint32_t resID, const bag_entry** outBag,
         ALOGI("Creating new bag, entrySize=0x%08x, parent=0x%08x\n", entrySize, parent);
     }
 
-    // This is what we are building.
-    bag_set* set = NULL;
+    // This is what we are building.  The parent's attributes, if any, are
+    // merged with this map's as both are walked in attribute order, so
+    // the bag is only written once however many each has.
+    const bag_entry* parentBag = NULL;
+    size_t NP = 0;
+    uint32_t parentTypeSpecFlags = 0;
 
     if (parent) {
         uint32_t resolvedParent = parent;
@@ -4014,46 +4901,30 @@ ssize_t ResTable::getBagLocked(uint32_t resID, const bag_entry** outBag,
             return UNKNOWN_ERROR;
         }
 
-        const bag_entry* parentBag;
-        uint32_t parentTypeSpecFlags = 0;
-        const ssize_t NP = getBagLocked(resolvedParent, &parentBag, &parentTypeSpecFlags);
-        const size_t NT = ((NP >= 0) ? NP : 0) + N;
-        set = (bag_set*)malloc(sizeof(bag_set)+sizeof(bag_entry)*NT);
-        if (set == NULL) {
-            return NO_MEMORY;
-        }
-        if (NP > 0) {
-            memcpy(set+1, parentBag, NP*sizeof(bag_entry));
-            set->numAttrs = NP;
-            if (kDebugTableNoisy) {
-                ALOGI("Initialized new bag with %zd inherited attributes.\n", NP);
-            }
-        } else {
-            if (kDebugTableNoisy) {
-                ALOGI("Initialized new bag with no inherited attributes.\n");
-            }
-            set->numAttrs = 0;
+        const ssize_t parentCount = buildBagLocked(resolvedParent, &parentBag,
+                                                   &parentTypeSpecFlags);
+        if (parentCount > 0) {
+            NP = parentCount;
         }
-        set->availAttrs = NT;
-        set->typeSpecFlags = parentTypeSpecFlags;
-    } else {
-        set = (bag_set*)malloc(sizeof(bag_set)+sizeof(bag_entry)*N);
-        if (set == NULL) {
-            return NO_MEMORY;
+        if (kDebugTableNoisy) {
+            ALOGI("Initializing new bag with %zu inherited attributes.\n", NP);
         }
-        set->numAttrs = 0;
-        set->availAttrs = N;
-        set->typeSpecFlags = 0;
     }
 
-    set->typeSpecFlags |= entry.specFlags;
+    bag_set* set = (bag_set*)malloc(sizeof(bag_set)+sizeof(bag_entry)*(NP+N));
+    if (set == NULL) {
+        return NO_MEMORY;
+    }
+    set->numAttrs = 0;
+    set->availAttrs = NP+N;
+    set->typeSpecFlags = parentTypeSpecFlags | entry.specFlags;
 
     // Now merge in the new attributes...
     size_t curOff = (reinterpret_cast<uintptr_t>(entry.entry) - reinterpret_cast<uintptr_t>(entry.type))
         + dtohs(entry.entry->size);
     const ResTable_map* map;
     bag_entry* entries = (bag_entry*)(set+1);
-    size_t curEntry = 0;
+    size_t curParent = 0;
     uint32_t pos = 0;
     if (kDebugTableNoisy) {
         ALOGI("Starting with set %p, entries=%p, avail=%zu\n", set, entries, set->availAttrs);
@@ -4066,10 +4937,10 @@ ssize_t ResTable::getBagLocked(uint32_t resID, const bag_entry** outBag,
         if (curOff > (dtohl(entry.type->header.size)-sizeof(ResTable_map))) {
             ALOGW("ResTable_map at %d is beyond type chunk data %d",
                  (int)curOff, dtohl(entry.type->header.size));
+            free(set);
             return BAD_TYPE;
         }
         map = (const ResTable_map*)(((const uint8_t*)entry.type) + curOff);
-        N++;
 
         uint32_t newName = htodl(map->name.ident);
         if (!Res_INTERNALID(newName)) {
@@ -4078,55 +4949,30 @@ ssize_t ResTable::getBagLocked(uint32_t resID, const bag_entry** outBag,
             if (grp->dynamicRefTable.lookupResourceId(&newName) != NO_ERROR) {
                 ALOGE("Failed resolving ResTable_map name at %d with ident 0x%08x",
                         (int) curOff, (int) newName);
+                free(set);
                 return UNKNOWN_ERROR;
             }
         }
 
-        bool isInside;
-        uint32_t oldName = 0;
-        while ((isInside=(curEntry < set->numAttrs))
-                && (oldName=entries[curEntry].map.name.ident) < newName) {
+        // Inherited attributes before this one are kept; one it
+        // redefines is replaced.
+        while (curParent < NP && parentBag[curParent].map.name.ident < newName) {
             if (kDebugTableNoisy) {
                 ALOGI("#%zu: Keeping existing attribute: 0x%08x\n",
-                        curEntry, entries[curEntry].map.name.ident);
+                        set->numAttrs, parentBag[curParent].map.name.ident);
             }
-            curEntry++;
+            entries[set->numAttrs++] = parentBag[curParent++];
         }
-
-        if ((!isInside) || oldName != newName) {
-            // This is a new attribute...  figure out what to do with it.
-            if (set->numAttrs >= set->availAttrs) {
-                // Need to alloc more memory...
-                const size_t newAvail = set->availAttrs+N;
-                set = (bag_set*)realloc(set,
-                                        sizeof(bag_set)
-                                        + sizeof(bag_entry)*newAvail);
-                if (set == NULL) {
-                    return NO_MEMORY;
-                }
-                set->availAttrs = newAvail;
-                entries = (bag_entry*)(set+1);
-                if (kDebugTableNoisy) {
-                    ALOGI("Reallocated set %p, entries=%p, avail=%zu\n",
-                            set, entries, set->availAttrs);
-                }
-            }
-            if (isInside) {
-                // Going in the middle, need to make space.
-                memmove(entries+curEntry+1, entries+curEntry,
-                        sizeof(bag_entry)*(set->numAttrs-curEntry));
-                set->numAttrs++;
-            }
+        if (curParent < NP && parentBag[curParent].map.name.ident == newName) {
             if (kDebugTableNoisy) {
-                ALOGI("#%zu: Inserting new attribute: 0x%08x\n", curEntry, newName);
-            }
-        } else {
-            if (kDebugTableNoisy) {
-                ALOGI("#%zu: Replacing existing attribute: 0x%08x\n", curEntry, oldName);
+                ALOGI("#%zu: Replacing existing attribute: 0x%08x\n", set->numAttrs, newName);
             }
+            curParent++;
+        } else if (kDebugTableNoisy) {
+            ALOGI("#%zu: Inserting new attribute: 0x%08x\n", set->numAttrs, newName);
         }
 
-        bag_entry* cur = entries+curEntry;
+        bag_entry* cur = entries+set->numAttrs;
 
         cur->stringBlock = entry.package->header->index;
         cur->map.name.ident = newName;
@@ -4134,28 +4980,32 @@ ssize_t ResTable::getBagLocked(uint32_t resID, const bag_entry** outBag,
         status_t err = grp->dynamicRefTable.lookupResourceValue(&cur->map.value);
         if (err != NO_ERROR) {
             ALOGE("Reference item(0x%08x) in bag could not be resolved.", cur->map.value.data);
+            free(set);
             return UNKNOWN_ERROR;
         }
 
         if (kDebugTableNoisy) {
             ALOGI("Setting entry #%zu %p: block=%zd, name=0x%08d, type=%d, data=0x%08x\n",
-                    curEntry, cur, cur->stringBlock, cur->map.name.ident,
+                    set->numAttrs, cur, cur->stringBlock, cur->map.name.ident,
                     cur->map.value.dataType, cur->map.value.data);
         }
 
         // On to the next!
-        curEntry++;
+        set->numAttrs++;
         pos++;
         const size_t size = dtohs(map->value.size);
         curOff += size + sizeof(*map)-sizeof(map->value);
     };
 
-    if (curEntry > set->numAttrs) {
-        set->numAttrs = curEntry;
+    // The inherited attributes after the last new one.
+    while (curParent < NP) {
+        entries[set->numAttrs++] = parentBag[curParent++];
     }
 
-    // And this is it...
-    typeSet[e] = set;
+    // And this is it...  Readers of a frozen table may look at the slot
+    // at any time, so the bag must be complete before it is.
+    cacheBagLocked(set, &typeSet[e]);
+    __atomic_store_n(&typeSet[e], set, __ATOMIC_RELEASE);
     if (set) {
         if (outTypeSpecFlags != NULL) {
             *outTypeSpecFlags = set->typeSpecFlags;
@@ -4169,8 +5019,124 @@ ssize_t ResTable::getBagLocked(uint32_t resID, const bag_entry** outBag,
     return BAD_INDEX;
 }
 
+// Adds a bag just computed into slot to the use order, as the newest.
+void ResTable::cacheBagLocked(bag_set* set, bag_set** slot) const
+{
+    set->slot = slot;
+    set->older = mNewestBag;
+    set->newer = NULL;
+    if (mNewestBag != NULL) {
+        mNewestBag->newer = set;
+    } else {
+        mOldestBag = set;
+    }
+    mNewestBag = set;
+    mBagCacheStats.bags++;
+    mBagCacheStats.bytes += sizeof(bag_set) + sizeof(bag_entry) * set->availAttrs;
+}
+
+// Moves a bag found in the cache to the front of the use order.
+void ResTable::useBagLocked(bag_set* set) const
+{
+    mBagCacheStats.hits++;
+    if (set == mNewestBag) {
+        return;
+    }
+    set->newer->older = set->older;
+    if (set->older != NULL) {
+        set->older->newer = set->newer;
+    } else {
+        mOldestBag = set->newer;
+    }
+    set->older = mNewestBag;
+    set->newer = NULL;
+    mNewestBag->newer = set;
+    mNewestBag = set;
+}
+
+// Takes a bag out of the use order; the caller frees it.
+void ResTable::uncacheBagLocked(bag_set* set) const
+{
+    if (set->newer != NULL) {
+        set->newer->older = set->older;
+    } else {
+        mNewestBag = set->older;
+    }
+    if (set->older != NULL) {
+        set->older->newer = set->newer;
+    } else {
+        mOldestBag = set->newer;
+    }
+    mBagCacheStats.bags--;
+    mBagCacheStats.bytes -= sizeof(bag_set) + sizeof(bag_entry) * set->availAttrs;
+}
+
+void ResTable::trimBagCacheLocked(size_t maxBytes) const
+{
+    while (mOldestBag != NULL && mBagCacheStats.bytes > maxBytes) {
+        bag_set* set = mOldestBag;
+        // Bags copy their parent's entries, so none points into another.
+        *set->slot = NULL;
+        uncacheBagLocked(set);
+        free(set);
+        mBagCacheStats.evictions++;
+    }
+}
+
+void ResTable::setBagCacheLimit(size_t maxBytes)
+{
+    AutoMutex _l(mLock);
+    mBagCacheLimit = maxBytes;
+}
+
+size_t ResTable::getBagCacheLimit() const
+{
+    return mBagCacheLimit;
+}
+
+void ResTable::getBagCacheStats(BagCacheStats* outStats) const
+{
+    AutoMutex _l(mLock);
+    *outStats = mBagCacheStats;
+}
+
+status_t ResTable::trimBagCache(size_t maxBytes)
+{
+    AutoMutex _l(mLock);
+    if (mFrozen) {
+        ALOGW("Cannot trim the bag cache of a frozen ResTable");
+        return INVALID_OPERATION;
+    }
+    trimBagCacheLocked(maxBytes);
+    return NO_ERROR;
+}
+
+const ResTable::bag_entry* ResTable::findBagEntry(const bag_entry* bag, size_t count,
+                                                  uint32_t name)
+{
+    size_t low = 0;
+    size_t high = count;
+    while (low < high) {
+        const size_t mid = low + (high - low) / 2;
+        const uint32_t midName = bag[mid].map.name.ident;
+        if (midName < name) {
+            low = mid + 1;
+        } else if (midName > name) {
+            high = mid;
+        } else {
+            return &bag[mid];
+        }
+    }
+    return NULL;
+}
+
 void ResTable::setParameters(const ResTable_config* params)
 {
+    if (mFrozen) {
+        ALOGW("Cannot change the parameters of a frozen ResTable");
+        return;
+    }
+
     mLock.lock();
     if (kDebugTableGetEntry) {
         ALOGI("Setting parameters: %s\n", params->toString().string());
@@ -4181,15 +5147,132 @@ void ResTable::setParameters(const ResTable_config* params)
             ALOGI("CLEARING BAGS FOR GROUP %zu!", i);
         }
         mPackageGroups[i]->clearBagCache();
+        mPackageGroups[i]->clearResolvedEntries();
     }
     mLock.unlock();
 }
 
 void ResTable::getParameters(ResTable_config* params) const
 {
-    mLock.lock();
+    lock();
     *params = mParams;
-    mLock.unlock();
+    unlock();
+}
+
+status_t ResTable::setFrozen(bool frozen)
+{
+    AutoMutex _l(mLock);
+    if (frozen && !mFrozen) {
+        for (size_t i = 0; i < mPackageGroups.size(); i++) {
+            status_t err = mPackageGroups[i]->allocateBagCache();
+            if (err != NO_ERROR) {
+                return err;
+            }
+        }
+    }
+    if (!frozen) {
+        // Packages may be added again, and are what the names came from.
+        clearValueNames();
+    }
+    mFrozen = frozen;
+    return NO_ERROR;
+}
+
+void ResTable::clearValueNames()
+{
+    AutoMutex _l(mValueNamesLock);
+    for (size_t i = 0; i < mValueNames.size(); i++) {
+        delete mValueNames.valueAt(i);
+    }
+    mValueNames.clear();
+}
+
+/*
+ * Returns the names attrID gives its enum or flag values, sorted by name
+ * and each with the value of the first bag entry of that name.  They are
+ * resolved on the first call and kept until the table is thawed.  Only
+ * valid while the table is frozen; returns NULL if attrID has no bag.
+ */
+const Vector<ResTable::value_name>* ResTable::getFrozenValueNames(uint32_t attrID) const
+{
+    {
+        AutoMutex _l(mValueNamesLock);
+        const ssize_t i = mValueNames.indexOfKey(attrID);
+        if (i >= 0) {
+            return mValueNames.valueAt(i);
+        }
+    }
+
+    const bag_entry* bag;
+    const ssize_t cnt = getResourcePackageIndex(attrID) >= 0 ? lockBag(attrID, &bag) : -1;
+    if (cnt < 0) {
+        return NULL;
+    }
+    Vector<value_name>* names = new Vector<value_name>();
+    resource_name rname;
+    for (ssize_t i = 0; i < cnt; i++) {
+        if (!Res_INTERNALID(bag[i].map.name.ident)
+                && getResourceName(bag[i].map.name.ident, false, &rname)) {
+            value_name name;
+            name.name.setTo(rname.name, rname.nameLen);
+            name.value = bag[i].map.value;
+            names->add(name);
+        }
+    }
+    unlockBag(bag);
+
+    // Stable, so that findValueName() finds the first of a name in the bag.
+    std::stable_sort(names->editArray(), names->editArray() + names->size(),
+            [](const value_name& a, const value_name& b) {
+                return strzcmp16(a.name.string(), a.name.size(),
+                        b.name.string(), b.name.size()) < 0;
+            });
+
+    AutoMutex _l(mValueNamesLock);
+    const ssize_t i = mValueNames.indexOfKey(attrID);
+    if (i >= 0) {
+        // Another thread got here first.
+        delete names;
+        return mValueNames.valueAt(i);
+    }
+    mValueNames.add(attrID, names);
+    return names;
+}
+
+const ResTable::value_name* ResTable::findValueName(const Vector<value_name>& names,
+        const char16_t* name, size_t nameLen)
+{
+    size_t low = 0;
+    size_t high = names.size();
+    while (low < high) {
+        const size_t mid = low + (high - low) / 2;
+        const String16& midName = names[mid].name;
+        if (strzcmp16(midName.string(), midName.size(), name, nameLen) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low < names.size() && strzcmp16(names[low].name.string(), names[low].name.size(),
+            name, nameLen) == 0) {
+        return &names[low];
+    }
+    return NULL;
+}
+
+bool ResTable::isFrozen() const
+{
+    return mFrozen;
+}
+
+void ResTable::setFullValidation(bool full)
+{
+    mFullValidation = full;
+}
+
+bool ResTable::getFullValidation() const
+{
+    return mFullValidation;
 }
 
 struct id_name_map {
@@ -4368,42 +5451,27 @@ nope:
 
 uint32_t ResTable::findEntry(const PackageGroup* group, ssize_t typeIndex, const char16_t* name,
         size_t nameLen, uint32_t* outTypeSpecFlags) const {
-    const TypeList& typeList = group->types[typeIndex];
-    const size_t typeCount = typeList.size();
-    for (size_t i = 0; i < typeCount; i++) {
-        const Type* t = typeList[i];
-        const ssize_t ei = t->package->keyStrings.indexOfString(name, nameLen);
-        if (ei < 0) {
-            continue;
-        }
-
-        const size_t configCount = t->configs.size();
-        for (size_t j = 0; j < configCount; j++) {
-            const TypeVariant tv(t->configs[j]);
-            for (TypeVariant::iterator iter = tv.beginEntries();
-                 iter != tv.endEntries();
-                 iter++) {
-                const ResTable_entry* entry = *iter;
-                if (entry == NULL) {
-                    continue;
-                }
+    const PackageGroup::NameIndex* index = group->getNameIndex(typeIndex);
+    if (index == NULL) {
+        return 0;
+    }
+    const PackageGroup::NameKey key(typeIndex, name, nameLen);
+    const ssize_t idx = index->find(-1, key.hash(), key);
+    if (idx < 0) {
+        return 0;
+    }
 
-                if (dtohl(entry->key.index) == (size_t) ei) {
-                    uint32_t resId = Res_MAKEID(group->id - 1, typeIndex, iter.index());
-                    if (outTypeSpecFlags) {
-                        Entry result;
-                        if (getEntry(group, typeIndex, iter.index(), NULL, &result) != NO_ERROR) {
-                            ALOGW("Failed to find spec flags for 0x%08x", resId);
-                            return 0;
-                        }
-                        *outTypeSpecFlags = result.specFlags;
-                    }
-                    return resId;
-                }
-            }
+    const size_t entryIndex = index->entryAt(idx).entryIndex;
+    uint32_t resId = Res_MAKEID(group->id - 1, typeIndex, entryIndex);
+    if (outTypeSpecFlags) {
+        Entry result;
+        if (getEntry(group, typeIndex, entryIndex, NULL, &result) != NO_ERROR) {
+            ALOGW("Failed to find spec flags for 0x%08x", resId);
+            return 0;
         }
+        *outTypeSpecFlags = result.specFlags;
     }
-    return 0;
+    return resId;
 }
 
 bool ResTable::expandResourceRef(const char16_t* refStr, size_t refLen,
@@ -4414,6 +5482,24 @@ bool ResTable::expandResourceRef(const char16_t* refStr, size_t refLen,
                                  const String16* defPackage,
                                  const char** outErrorMsg,
                                  bool* outPublicOnly)
+{
+    resource_name name;
+    if (!expandResourceRef(refStr, refLen, &name, defType, defPackage,
+            outErrorMsg, outPublicOnly)) {
+        return false;
+    }
+    *outPackage = String16(name.package, name.packageLen);
+    *outType = String16(name.type, name.typeLen);
+    *outName = String16(name.name, name.nameLen);
+    return true;
+}
+
+bool ResTable::expandResourceRef(const char16_t* refStr, size_t refLen,
+                                 resource_name* outName,
+                                 const String16* defType,
+                                 const String16* defPackage,
+                                 const char** outErrorMsg,
+                                 bool* outPublicOnly)
 {
     const char16_t* packageEnd = NULL;
     const char16_t* typeEnd = NULL;
@@ -4440,8 +5526,11 @@ bool ResTable::expandResourceRef(const char16_t* refStr, size_t refLen,
         }
     }
 
+    outName->type8 = NULL;
+    outName->name8 = NULL;
     if (packageEnd) {
-        *outPackage = String16(p, packageEnd-p);
+        outName->package = p;
+        outName->packageLen = packageEnd-p;
         p = packageEnd+1;
     } else {
         if (!defPackage) {
@@ -4450,10 +5539,12 @@ bool ResTable::expandResourceRef(const char16_t* refStr, size_t refLen,
             }
             return false;
         }
-        *outPackage = *defPackage;
+        outName->package = defPackage->string();
+        outName->packageLen = defPackage->size();
     }
     if (typeEnd) {
-        *outType = String16(p, typeEnd-p);
+        outName->type = p;
+        outName->typeLen = typeEnd-p;
         p = typeEnd+1;
     } else {
         if (!defType) {
@@ -4462,22 +5553,24 @@ bool ResTable::expandResourceRef(const char16_t* refStr, size_t refLen,
             }
             return false;
         }
-        *outType = *defType;
+        outName->type = defType->string();
+        outName->typeLen = defType->size();
     }
-    *outName = String16(p, end-p);
-    if(**outPackage == 0) {
+    outName->name = p;
+    outName->nameLen = end-p;
+    if (outName->packageLen == 0 || outName->package[0] == 0) {
         if(outErrorMsg) {
             *outErrorMsg = "Resource package cannot be an empty string";
         }
         return false;
     }
-    if(**outType == 0) {
+    if (outName->typeLen == 0 || outName->type[0] == 0) {
         if(outErrorMsg) {
             *outErrorMsg = "Resource type cannot be an empty string";
         }
         return false;
     }
-    if(**outName == 0) {
+    if (outName->nameLen == 0 || outName->name[0] == 0) {
         if(outErrorMsg) {
             *outErrorMsg = "Resource id cannot be an empty string";
         }
@@ -4743,6 +5836,35 @@ bool ResTable::stringToFloat(const char16_t* s, size_t len, Res_value* outValue)
     return false;
 }
 
+/*
+ * Whether s could be an integer, float or dimension, judged by its first
+ * character: a digit, sign or point, the start of the "inf" and "nan"
+ * that strtof() also accepts, or of a unit alone, which stringToFloat()
+ * takes as zero of it.  Most values are names or text, and skip both
+ * parsers on this.
+ */
+static bool mayStartNumber(const char16_t* s, size_t len)
+{
+    while (len > 0 && isspace16(*s)) {
+        s++;
+        len--;
+    }
+    if (len == 0) {
+        return false;
+    }
+    const char16_t c = *s;
+    if ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.'
+            || c == 'i' || c == 'I' || c == 'n' || c == 'N') {
+        return true;
+    }
+    for (const unit_entry* cur = unitNames; cur->name; cur++) {
+        if (c == cur->name[0]) {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool ResTable::stringToValue(Res_value* outValue, String16* outString,
                              const char16_t* s, size_t len,
                              bool preserveSpaces, bool coerceType,
@@ -4787,27 +5909,26 @@ bool ResTable::stringToValue(Res_value* outValue, String16* outString,
         ssize_t cnt = p >= 0 ? lockBag(attrID, &bag) : -1;
         //printf("For attr 0x%08x got bag of %d\n", attrID, cnt);
         if (cnt >= 0) {
-            while (cnt > 0) {
-                //printf("Entry 0x%08x = 0x%08x\n", bag->map.name.ident, bag->map.value.data);
-                switch (bag->map.name.ident) {
-                case ResTable_map::ATTR_TYPE:
-                    attrType = bag->map.value.data;
-                    break;
-                case ResTable_map::ATTR_MIN:
-                    attrMin = bag->map.value.data;
-                    break;
-                case ResTable_map::ATTR_MAX:
-                    attrMax = bag->map.value.data;
-                    break;
-                case ResTable_map::ATTR_L10N:
-                    l10nReq = bag->map.value.data;
-                    break;
-                }
-                bag++;
-                cnt--;
+            // An enum or flags attribute also maps each of its names, so
+            // only look up the four this needs.
+            const bag_entry* found = findBagEntry(bag, cnt, ResTable_map::ATTR_TYPE);
+            if (found != NULL) {
+                attrType = found->map.value.data;
             }
-            unlockBag(bag);
-        } else if (accessor && accessor->getAttributeType(attrID, &attrType)) {
+            found = findBagEntry(bag, cnt, ResTable_map::ATTR_MIN);
+            if (found != NULL) {
+                attrMin = found->map.value.data;
+            }
+            found = findBagEntry(bag, cnt, ResTable_map::ATTR_MAX);
+            if (found != NULL) {
+                attrMax = found->map.value.data;
+            }
+            found = findBagEntry(bag, cnt, ResTable_map::ATTR_L10N);
+            if (found != NULL) {
+                l10nReq = found->map.value.data;
+            }
+            unlockBag(bag);
+        } else if (accessor && accessor->getAttributeType(attrID, &attrType)) {
             fromAccessor = true;
             if (attrType == ResTable_map::TYPE_ENUM
                     || attrType == ResTable_map::TYPE_FLAGS
@@ -5087,7 +6208,9 @@ bool ResTable::stringToValue(Res_value* outValue, String16* outString,
         return false;
     }
 
-    if (stringToInt(s, len, outValue)) {
+    const bool mayBeNumber = mayStartNumber(s, len);
+
+    if (mayBeNumber && stringToInt(s, len, outValue)) {
         if ((attrType&ResTable_map::TYPE_INTEGER) == 0) {
             // If this type does not allow integers, but does allow floats,
             // fall through on this error case because the float type should
@@ -5110,7 +6233,7 @@ bool ResTable::stringToValue(Res_value* outValue, String16* outString,
         }
     }
 
-    if (stringToFloat(s, len, outValue)) {
+    if (mayBeNumber && stringToFloat(s, len, outValue)) {
         if (outValue->dataType == Res_value::TYPE_DIMENSION) {
             if ((attrType&ResTable_map::TYPE_DIMENSION) != 0) {
                 return true;
@@ -5185,9 +6308,19 @@ bool ResTable::stringToValue(Res_value* outValue, String16* outString,
     }
 
     if ((attrType&ResTable_map::TYPE_ENUM) != 0) {
-        const ssize_t p = getResourcePackageIndex(attrID);
+        const Vector<value_name>* names = mFrozen ? getFrozenValueNames(attrID) : NULL;
         const bag_entry* bag;
-        ssize_t cnt = p >= 0 ? lockBag(attrID, &bag) : -1;
+        ssize_t cnt = -1;
+        if (names != NULL) {
+            const value_name* found = findValueName(*names, s, len);
+            if (found != NULL) {
+                outValue->dataType = found->value.dataType;
+                outValue->data = found->value.data;
+                return true;
+            }
+        } else if (getResourcePackageIndex(attrID) >= 0) {
+            cnt = lockBag(attrID, &bag);
+        }
         //printf("Got %d for enum\n", cnt);
         if (cnt >= 0) {
             resource_name rname;
@@ -5224,9 +6357,38 @@ bool ResTable::stringToValue(Res_value* outValue, String16* outString,
     }
 
     if ((attrType&ResTable_map::TYPE_FLAGS) != 0) {
-        const ssize_t p = getResourcePackageIndex(attrID);
+        const Vector<value_name>* names = mFrozen ? getFrozenValueNames(attrID) : NULL;
         const bag_entry* bag;
-        ssize_t cnt = p >= 0 ? lockBag(attrID, &bag) : -1;
+        ssize_t cnt = -1;
+        if (names != NULL) {
+            bool failed = false;
+            outValue->dataType = Res_value::TYPE_INT_HEX;
+            outValue->data = 0;
+            const char16_t* end = s + len;
+            const char16_t* pos = s;
+            while (pos < end && !failed) {
+                const char16_t* start = pos;
+                pos++;
+                while (pos < end && *pos != '|') {
+                    pos++;
+                }
+                const value_name* found = findValueName(*names, start, pos-start);
+                if (found != NULL) {
+                    outValue->data |= found->value.data;
+                } else {
+                    // Didn't find this flag identifier.
+                    failed = true;
+                }
+                if (pos < end) {
+                    pos++;
+                }
+            }
+            if (!failed) {
+                return true;
+            }
+        } else if (getResourcePackageIndex(attrID) >= 0) {
+            cnt = lockBag(attrID, &bag);
+        }
         //printf("Got %d for flags\n", cnt);
         if (cnt >= 0) {
             bool failed = false;
@@ -5519,44 +6681,130 @@ const DynamicRefTable* ResTable::getDynamicRefTableForCookie(int32_t cookie) con
     return NULL;
 }
 
-void ResTable::getConfigurations(Vector<ResTable_config>* configs, bool ignoreMipmap) const
+namespace {
+
+// A configuration as compare() sees it, for finding the unique ones.
+struct ConfigKey {
+    ConfigKey(const ResTable_config* _config) : config(_config) { }
+
+    bool operator==(const ConfigKey& o) const {
+        return config->compare(*o.config) == 0;
+    }
+
+    // Mixes exactly the fields compare() looks at.
+    hash_t hash() const {
+        uint32_t script, variant[2];
+        memcpy(&script, config->localeScript, sizeof(script));
+        memcpy(variant, config->localeVariant, sizeof(variant));
+        uint32_t hash = JenkinsHashMix(0, config->imsi);
+        hash = JenkinsHashMix(hash, config->locale);
+        hash = JenkinsHashMix(hash, script);
+        hash = JenkinsHashMix(hash, variant[0]);
+        hash = JenkinsHashMix(hash, variant[1]);
+        hash = JenkinsHashMix(hash, config->screenType);
+        hash = JenkinsHashMix(hash, config->input);
+        hash = JenkinsHashMix(hash, config->screenSize);
+        hash = JenkinsHashMix(hash, config->version);
+        hash = JenkinsHashMix(hash, config->screenConfig);
+        hash = JenkinsHashMix(hash, config->screenSizeDp);
+        return JenkinsHashWhiten(hash);
+    }
+
+    const ResTable_config* config;
+};
+
+struct ConfigSetEntry {
+    ConfigSetEntry(const ResTable_config& _config) : config(_config) { }
+
+    ConfigKey getKey() const { return ConfigKey(&config); }
+
+    ResTable_config config;
+};
+
+typedef BasicHashtable<ConfigKey, ConfigSetEntry> ConfigSet;
+
+// Adds "config" to "configs" unless "seen" has one equal to it.
+void addUniqueConfig(const ResTable_config& config, ConfigSet* seen,
+        Vector<ResTable_config>* configs)
 {
-    const size_t packageCount = mPackageGroups.size();
-    for (size_t i = 0; i < packageCount; i++) {
-        const PackageGroup* packageGroup = mPackageGroups[i];
-        const size_t typeCount = packageGroup->types.size();
-        for (size_t j = 0; j < typeCount; j++) {
-            const TypeList& typeList = packageGroup->types[j];
-            const size_t numTypes = typeList.size();
-            for (size_t k = 0; k < numTypes; k++) {
-                const Type* type = typeList[k];
-                const ResStringPool& typeStrings = type->package->typeStrings;
-                if (ignoreMipmap && typeStrings.string8ObjectAt(
-                            type->typeSpec->id - 1) == "mipmap") {
-                    continue;
-                }
+    const ConfigKey key(&config);
+    const hash_t hash = key.hash();
+    if (seen->find(-1, hash, key) < 0) {
+        seen->add(hash, ConfigSetEntry(config));
+        configs->add(config);
+    }
+}
 
-                const size_t numConfigs = type->configs.size();
-                for (size_t m = 0; m < numConfigs; m++) {
-                    const ResTable_type* config = type->configs[m];
-                    ResTable_config cfg;
-                    memset(&cfg, 0, sizeof(ResTable_config));
-                    cfg.copyFromDtoH(config->config);
-                    // only insert unique
-                    const size_t N = configs->size();
-                    size_t n;
-                    for (n = 0; n < N; n++) {
-                        if (0 == (*configs)[n].compare(cfg)) {
-                            break;
-                        }
+} // namespace
+
+void ResTable::clearConfigurations()
+{
+    AutoMutex _l(mConfigurationsLock);
+    for (size_t i = 0; i < 2; i++) {
+        mConfigurations[i].clear();
+        mHaveConfigurations[i] = false;
+    }
+}
+
+void ResTable::getConfigurations(Vector<ResTable_config>* configs, bool ignoreMipmap) const
+{
+    const size_t which = ignoreMipmap ? 1 : 0;
+    Vector<ResTable_config> unique;
+    bool haveUnique;
+    {
+        AutoMutex _l(mConfigurationsLock);
+        haveUnique = mHaveConfigurations[which];
+        if (haveUnique) {
+            unique = mConfigurations[which];
+        }
+    }
+
+    if (!haveUnique) {
+        ConfigSet seen;
+        const size_t packageCount = mPackageGroups.size();
+        for (size_t i = 0; i < packageCount; i++) {
+            const PackageGroup* packageGroup = mPackageGroups[i];
+            const size_t typeCount = packageGroup->types.size();
+            for (size_t j = 0; j < typeCount; j++) {
+                const TypeList& typeList = packageGroup->types[j];
+                const size_t numTypes = typeList.size();
+                for (size_t k = 0; k < numTypes; k++) {
+                    const Type* type = typeList[k];
+                    const ResStringPool& typeStrings = type->package->typeStrings;
+                    if (ignoreMipmap && typeStrings.string8ObjectAt(
+                                type->typeSpec->id - 1) == "mipmap") {
+                        continue;
                     }
-                    // if we didn't find it
-                    if (n == N) {
-                        configs->add(cfg);
+
+                    const size_t numConfigs = type->configs.size();
+                    for (size_t m = 0; m < numConfigs; m++) {
+                        const ResTable_type* config = type->configs[m];
+                        ResTable_config cfg;
+                        memset(&cfg, 0, sizeof(ResTable_config));
+                        cfg.copyFromDtoH(config->config);
+                        addUniqueConfig(cfg, &seen, &unique);
                     }
                 }
             }
         }
+
+        AutoMutex _l(mConfigurationsLock);
+        mConfigurations[which] = unique;
+        mHaveConfigurations[which] = true;
+    }
+
+    // The vectors share their storage until one is changed.
+    if (configs->isEmpty()) {
+        *configs = unique;
+        return;
+    }
+    ConfigSet seen;
+    for (size_t i = 0; i < configs->size(); i++) {
+        const ConfigKey key(&(*configs)[i]);
+        seen.add(key.hash(), ConfigSetEntry((*configs)[i]));
+    }
+    for (size_t i = 0; i < unique.size(); i++) {
+        addUniqueConfig(unique[i], &seen, configs);
     }
 }
 
@@ -5568,18 +6816,18 @@ void ResTable::getLocales(Vector<String8>* locales) const
     ALOGV("called getConfigurations size=%d", (int)configs.size());
     const size_t I = configs.size();
 
+    SortedVector<String8> seen;
+    for (size_t i = 0; i < locales->size(); i++) {
+        seen.add((*locales)[i]);
+    }
+
     char locale[RESTABLE_MAX_LOCALE_LEN];
     for (size_t i=0; i<I; i++) {
         configs[i].getBcp47Locale(locale);
-        const size_t J = locales->size();
-        size_t j;
-        for (j=0; j<J; j++) {
-            if (0 == strcmp(locale, (*locales)[j].string())) {
-                break;
-            }
-        }
-        if (j == J) {
-            locales->add(String8(locale));
+        const String8 name(locale);
+        if (seen.indexOf(name) < 0) {
+            seen.add(name);
+            locales->add(name);
         }
     }
 }
@@ -5648,6 +6896,33 @@ bool ResTable::getResourceFlags(uint32_t resID, uint32_t* outFlags) const {
     return true;
 }
 
+uint32_t getTypeEntryOffset(const ResTable_type* type, uint32_t entryIndex)
+{
+    const uint32_t entryCount = dtohl(type->entryCount);
+    const uint32_t* const eindex = reinterpret_cast<const uint32_t*>(
+            reinterpret_cast<const uint8_t*>(type) + dtohs(type->header.headerSize));
+    if ((type->flags & ResTable_type::FLAG_SPARSE) == 0) {
+        return entryIndex < entryCount ? dtohl(eindex[entryIndex]) : ResTable_type::NO_ENTRY;
+    }
+
+    const ResTable_sparseTypeEntry* const entries =
+            reinterpret_cast<const ResTable_sparseTypeEntry*>(eindex);
+    size_t low = 0;
+    size_t high = entryCount;
+    while (low < high) {
+        const size_t mid = low + (high - low) / 2;
+        const uint32_t idx = dtohs(entries[mid].idx);
+        if (idx < entryIndex) {
+            low = mid + 1;
+        } else if (idx > entryIndex) {
+            high = mid;
+        } else {
+            return uint32_t(dtohs(entries[mid].offset)) * 4;
+        }
+    }
+    return ResTable_type::NO_ENTRY;
+}
+
 status_t ResTable::getEntry(
         const PackageGroup* packageGroup, int typeIndex, int entryIndex,
         const ResTable_config* config,
@@ -5667,8 +6942,25 @@ status_t ResTable::getEntry(
     ResTable_config bestConfig;
     memset(&bestConfig, 0, sizeof(bestConfig));
 
+    // Lookups under the table's own parameters always pick the same
+    // entry until they change, so that choice is kept for each entry.
+    const bool useResolved = config == &mParams;
+    const PackageGroup::ResolvedEntry* resolved = useResolved
+            ? packageGroup->getResolvedEntry(typeIndex, entryIndex) : NULL;
+    if (resolved != NULL) {
+        if (resolved->type == NULL) {
+            return BAD_INDEX;
+        }
+        bestType = resolved->type;
+        bestOffset = resolved->offset;
+        bestPackage = resolved->package;
+        specFlags = resolved->specFlags;
+        actualTypeIndex = resolved->actualTypeIndex;
+        bestConfig.copyFromDtoH(bestType->config);
+    }
+
     // Iterate over the Types of each package.
-    const size_t typeCount = typeList.size();
+    const size_t typeCount = resolved != NULL ? 0 : typeList.size();
     for (size_t i = 0; i < typeCount; i++) {
         const Type* const typeSpec = typeList[i];
 
@@ -5721,10 +7013,7 @@ status_t ResTable::getEntry(
             }
 
             // Check if there is the desired entry in this type.
-            const uint32_t* const eindex = reinterpret_cast<const uint32_t*>(
-                    reinterpret_cast<const uint8_t*>(thisType) + dtohs(thisType->header.headerSize));
-
-            uint32_t thisOffset = dtohl(eindex[realEntryIndex]);
+            uint32_t thisOffset = getTypeEntryOffset(thisType, realEntryIndex);
             if (thisOffset == ResTable_type::NO_ENTRY) {
                 // There is no entry for this index and configuration.
                 continue;
@@ -5754,6 +7043,17 @@ status_t ResTable::getEntry(
         }
     }
 
+    if (useResolved && resolved == NULL) {
+        PackageGroup::ResolvedEntry newEntry;
+        memset(&newEntry, 0, sizeof(newEntry));
+        newEntry.type = bestType;
+        newEntry.package = bestPackage;
+        newEntry.offset = bestOffset;
+        newEntry.specFlags = specFlags;
+        newEntry.actualTypeIndex = actualTypeIndex;
+        packageGroup->setResolvedEntry(typeIndex, entryIndex, newEntry);
+    }
+
     if (bestType == NULL) {
         return BAD_INDEX;
     }
@@ -5789,6 +7089,82 @@ status_t ResTable::getEntry(
     return NO_ERROR;
 }
 
+/*
+ * Checks every entry of "type" the way getEntry() checks the one it
+ * reads, and its value or map besides, for full validation.  parsePackage()
+ * has already checked that the entry index fits in the chunk.
+ */
+static status_t validateTypeEntries(const ResTable_type* type, const ResStringPool& keyStrings)
+{
+    const uint32_t typeSize = dtohl(type->header.size);
+    const uint32_t entriesStart = dtohl(type->entriesStart);
+    const uint32_t entryCount = dtohl(type->entryCount);
+    const bool sparse = (type->flags & ResTable_type::FLAG_SPARSE) != 0;
+    const uint32_t* const eindex = reinterpret_cast<const uint32_t*>(
+            reinterpret_cast<const uint8_t*>(type) + dtohs(type->header.headerSize));
+    const ResTable_sparseTypeEntry* const sparseEntries =
+            reinterpret_cast<const ResTable_sparseTypeEntry*>(eindex);
+
+    for (uint32_t i = 0; i < entryCount; i++) {
+        uint32_t offset;
+        if (sparse) {
+            // getTypeEntryOffset() binary searches these.
+            if (i > 0 && dtohs(sparseEntries[i].idx) <= dtohs(sparseEntries[i-1].idx)) {
+                ALOGW("ResTable_type sparse entry %d is out of order", (int)i);
+                return BAD_TYPE;
+            }
+            offset = uint32_t(dtohs(sparseEntries[i].offset)) * 4;
+        } else {
+            offset = dtohl(eindex[i]);
+            if (offset == ResTable_type::NO_ENTRY) {
+                continue;
+            }
+        }
+
+        if (offset > typeSize || entriesStart > typeSize - offset
+                || entriesStart + offset > typeSize - sizeof(ResTable_entry)) {
+            ALOGW("ResTable_entry %d at 0x%x is beyond type chunk data 0x%x",
+                    (int)i, offset, typeSize);
+            return BAD_TYPE;
+        }
+        offset += entriesStart;
+        if ((offset & 0x3) != 0) {
+            ALOGW("ResTable_entry at 0x%x is not on an integer boundary", offset);
+            return BAD_TYPE;
+        }
+
+        const ResTable_entry* const entry = reinterpret_cast<const ResTable_entry*>(
+                reinterpret_cast<const uint8_t*>(type) + offset);
+        const uint16_t entrySize = dtohs(entry->size);
+        if (entrySize < sizeof(*entry) || entrySize > typeSize - offset) {
+            ALOGW("ResTable_entry at 0x%x has a bad size 0x%x", offset, entrySize);
+            return BAD_TYPE;
+        }
+        if (dtohl(entry->key.index) >= keyStrings.size()) {
+            ALOGW("ResTable_entry at 0x%x has a key 0x%x past the key strings",
+                    offset, dtohl(entry->key.index));
+            return BAD_TYPE;
+        }
+
+        const size_t dataSize = typeSize - offset - entrySize;
+        if ((dtohs(entry->flags) & ResTable_entry::FLAG_COMPLEX) != 0) {
+            const ResTable_map_entry* const map =
+                    reinterpret_cast<const ResTable_map_entry*>(entry);
+            if (entrySize < sizeof(*map)
+                    || dtohl(map->count) > dataSize / sizeof(ResTable_map)) {
+                ALOGW("ResTable_map_entry at 0x%x has maps beyond type chunk data 0x%x",
+                        offset, typeSize);
+                return BAD_TYPE;
+            }
+        } else if (dataSize < sizeof(Res_value)) {
+            ALOGW("ResTable_entry at 0x%x has a value beyond type chunk data 0x%x",
+                    offset, typeSize);
+            return BAD_TYPE;
+        }
+    }
+    return NO_ERROR;
+}
+
 status_t ResTable::parsePackage(const ResTable_package* const pkg,
                                 const Header* const header)
 {
@@ -5859,6 +7235,12 @@ status_t ResTable::parsePackage(const ResTable_package* const pkg,
 
     err = package->keyStrings.setTo(base+dtohl(pkg->keyStrings),
                                   header->dataEnd-(base+dtohl(pkg->keyStrings)));
+    if (err == NO_ERROR && mFullValidation) {
+        err = package->typeStrings.validate();
+        if (err == NO_ERROR) {
+            err = package->keyStrings.validate();
+        }
+    }
     if (err != NO_ERROR) {
         delete group;
         delete package;
@@ -5897,6 +7279,11 @@ status_t ResTable::parsePackage(const ResTable_package* const pkg,
         }
     }
 
+    // The new package's types get merged into the group.
+    group->clearNameIndex();
+    group->clearResolvedEntries();
+    group->clearEntryNames();
+
     err = group->packages.add(package);
     if (err < NO_ERROR) {
         return (mError=err);
@@ -6017,6 +7404,10 @@ status_t ResTable::parsePackage(const ResTable_package* const pkg,
                 return (mError=BAD_TYPE);
             }
 
+            if (mFullValidation && validateTypeEntries(type, package->keyStrings) != NO_ERROR) {
+                return (mError=BAD_TYPE);
+            }
+
             if (newEntryCount > 0) {
                 uint8_t typeIndex = type->id - 1;
                 ssize_t idmapIndex = idmapEntries.indexOfKey(type->id);
@@ -6031,7 +7422,9 @@ status_t ResTable::parsePackage(const ResTable_package* const pkg,
                 }
 
                 Type* t = typeList.editItemAt(typeList.size() - 1);
-                if (newEntryCount != t->entryCount) {
+                // A sparse type lists only the entries it defines.
+                if ((type->flags & ResTable_type::FLAG_SPARSE) != 0
+                        ? newEntryCount > t->entryCount : newEntryCount != t->entryCount) {
                     ALOGE("ResTable_type entry count inconsistent: given %d, previously %d",
                         (int)newEntryCount, (int)t->entryCount);
                     return (mError=BAD_TYPE);
@@ -6091,6 +7484,11 @@ DynamicRefTable::DynamicRefTable(uint8_t packageId)
     // Reserved package ids
     mLookupTable[APP_PACKAGE_ID] = APP_PACKAGE_ID;
     mLookupTable[SYS_PACKAGE_ID] = SYS_PACKAGE_ID;
+
+    // The package ID is 0x00. That means that a shared library is accessing
+    // its own local resource, so we fix up the resource with the calling
+    // package ID.
+    mLookupTable[0] = packageId;
 }
 
 status_t DynamicRefTable::load(const ResTable_lib_header* const header)
@@ -6161,56 +7559,41 @@ status_t DynamicRefTable::addMapping(const String16& packageName, uint8_t packag
     if (index < 0) {
         return UNKNOWN_ERROR;
     }
-    mLookupTable[mEntries.valueAt(index)] = packageId;
+    // App package IDs are absolute, and 0x00 always means the package
+    // itself, whatever a library table says.
+    const uint8_t buildTimeId = mEntries.valueAt(index);
+    if (buildTimeId != 0 && buildTimeId != APP_PACKAGE_ID) {
+        mLookupTable[buildTimeId] = packageId;
+    }
     return NO_ERROR;
 }
 
-status_t DynamicRefTable::lookupResourceId(uint32_t* resId) const {
-    uint32_t res = *resId;
-    size_t packageId = Res_GETPACKAGE(res) + 1;
-
-    if (packageId == APP_PACKAGE_ID) {
-        // No lookup needs to be done, app package IDs are absolute.
-        return NO_ERROR;
-    }
-
-    if (packageId == 0) {
-        // The package ID is 0x00. That means that a shared library is accessing
-        // its own local resource, so we fix up the resource with the calling
-        // package ID.
-        *resId |= ((uint32_t) mAssignedPackageId) << 24;
-        return NO_ERROR;
-    }
-
-    // Do a proper lookup.
-    uint8_t translatedId = mLookupTable[packageId];
-    if (translatedId == 0) {
-        ALOGV("DynamicRefTable(0x%02x): No mapping for build-time package ID 0x%02x.",
-                (uint8_t)mAssignedPackageId, (uint8_t)packageId);
-        for (size_t i = 0; i < 256; i++) {
-            if (mLookupTable[i] != 0) {
-                ALOGV("e[0x%02x] -> 0x%02x", (uint8_t)i, mLookupTable[i]);
-            }
+status_t DynamicRefTable::missingMapping(uint32_t resId) const {
+    ALOGV("DynamicRefTable(0x%02x): No mapping for build-time package ID 0x%02x.",
+            (uint8_t)mAssignedPackageId, (uint8_t)(resId >> 24));
+    for (size_t i = 0; i < 256; i++) {
+        if (mLookupTable[i] != 0) {
+            ALOGV("e[0x%02x] -> 0x%02x", (uint8_t)i, mLookupTable[i]);
         }
-        return UNKNOWN_ERROR;
     }
-
-    *resId = (res & 0x00ffffff) | (((uint32_t) translatedId) << 24);
-    return NO_ERROR;
+    return UNKNOWN_ERROR;
 }
 
-status_t DynamicRefTable::lookupResourceValue(Res_value* value) const {
-    if (value->dataType != Res_value::TYPE_DYNAMIC_REFERENCE) {
-        return NO_ERROR;
+/*
+ * Whether identifierForName() would look "name" up as it is, rather than
+ * as an internal name or a reference with a package or type in it.
+ */
+static bool isPlainEntryName(const char16_t* name, size_t nameLen)
+{
+    if (nameLen == 0 || name[0] == '^' || name[0] == '@') {
+        return false;
     }
-
-    status_t err = lookupResourceId(&value->data);
-    if (err != NO_ERROR) {
-        return err;
+    for (size_t i = 0; i < nameLen; i++) {
+        if (name[i] == ':' || name[i] == '/') {
+            return false;
+        }
     }
-
-    value->dataType = Res_value::TYPE_REFERENCE;
-    return NO_ERROR;
+    return true;
 }
 
 struct IdmapTypeMap {
@@ -6253,6 +7636,18 @@ status_t ResTable::createIdmap(const ResTable& overlay,
     strcpy16_dtoh(tmpName, overlayPackageStruct->name, sizeof(overlayPackageStruct->name)/sizeof(overlayPackageStruct->name[0]));
     const String16 overlayPackage(tmpName);
 
+    // The overlay's group for that package, as identifierForName() would
+    // pick it, so that each target type is looked up in it only once.
+    const PackageGroup* overlayGroup = NULL;
+    for (size_t i = 0; i < overlay.mPackageGroups.size(); ++i) {
+        if (overlay.mPackageGroups[i]->name == overlayPackage) {
+            overlayGroup = overlay.mPackageGroups[i];
+            break;
+        }
+    }
+    const String16 attr("attr");
+    const String16 attrPrivate("^attr-private");
+
     for (size_t typeIndex = 0; typeIndex < pg->types.size(); ++typeIndex) {
         const TypeList& typeList = pg->types[typeIndex];
         if (typeList.isEmpty()) {
@@ -6265,6 +7660,11 @@ status_t ResTable::createIdmap(const ResTable& overlay,
         typeMap.overlayTypeId = -1;
         typeMap.entryOffset = 0;
 
+        // The overlay types an entry of this type may match, in the order
+        // identifierForName() tries them; found with the first named entry.
+        Vector<ssize_t> overlayTypes;
+        bool overlayTypesFound = false;
+
         for (size_t entryIndex = 0; entryIndex < typeConfigs->entryCount; ++entryIndex) {
             uint32_t resID = Res_MAKEID(pg->id - 1, typeIndex, entryIndex);
             resource_name resName;
@@ -6275,14 +7675,38 @@ status_t ResTable::createIdmap(const ResTable& overlay,
                 continue;
             }
 
-            const String16 overlayType(resName.type, resName.typeLen);
-            const String16 overlayName(resName.name, resName.nameLen);
-            uint32_t overlayResID = overlay.identifierForName(overlayName.string(),
-                                                              overlayName.size(),
-                                                              overlayType.string(),
-                                                              overlayType.size(),
-                                                              overlayPackage.string(),
-                                                              overlayPackage.size());
+            if (!overlayTypesFound && overlayGroup != NULL) {
+                for (size_t pi = 0; pi < overlayGroup->packages.size(); ++pi) {
+                    const Package* package = overlayGroup->packages[pi];
+                    ssize_t ti = package->typeStrings.indexOfString(resName.type,
+                            resName.typeLen);
+                    if (ti >= 0) {
+                        overlayTypes.add(ti + package->typeIdOffset);
+                    }
+                    if (strzcmp16(attr.string(), attr.size(),
+                                resName.type, resName.typeLen) == 0) {
+                        ti = package->typeStrings.indexOfString(attrPrivate.string(),
+                                attrPrivate.size());
+                        if (ti >= 0) {
+                            overlayTypes.add(ti + package->typeIdOffset);
+                        }
+                    }
+                }
+                overlayTypesFound = true;
+            }
+
+            uint32_t overlayResID = 0;
+            if (isPlainEntryName(resName.name, resName.nameLen)) {
+                for (size_t i = 0; i < overlayTypes.size() && overlayResID == 0; ++i) {
+                    overlayResID = overlay.findEntry(overlayGroup, overlayTypes[i],
+                            resName.name, resName.nameLen, NULL);
+                }
+            } else {
+                // identifierForName() treats these names specially.
+                overlayResID = overlay.identifierForName(resName.name, resName.nameLen,
+                        resName.type, resName.typeLen,
+                        overlayPackage.string(), overlayPackage.size());
+            }
             if (overlayResID == 0) {
                 if (typeMap.entryMap.isEmpty()) {
                     typeMap.entryOffset++;
@@ -6399,12 +7823,10 @@ bool ResTable::getIdmapInfo(const void* idmap, size_t sizeBytes,
 }
 
 
-#define CHAR16_TO_CSTR(c16, len) (String8(String16(c16,len)).string())
-
 #define CHAR16_ARRAY_EQ(constant, var, len) \
         ((len == (sizeof(constant)/sizeof(constant[0]))) && (0 == memcmp((var), (constant), (len))))
 
-static void print_complex(uint32_t complex, bool isFraction)
+static void print_complex(uint32_t complex, bool isFraction, String8* out)
 {
     const float MANTISSA_MULT =
         1.0f / (1<<Res_value::COMPLEX_MANTISSA_SHIFT);
@@ -6417,23 +7839,23 @@ static void print_complex(uint32_t complex, bool isFraction)
                    <<Res_value::COMPLEX_MANTISSA_SHIFT))
             * RADIX_MULTS[(complex>>Res_value::COMPLEX_RADIX_SHIFT)
                             & Res_value::COMPLEX_RADIX_MASK];
-    printf("%f", value);
+    out->appendFormat("%f", value);
 
     if (!isFraction) {
         switch ((complex>>Res_value::COMPLEX_UNIT_SHIFT)&Res_value::COMPLEX_UNIT_MASK) {
-            case Res_value::COMPLEX_UNIT_PX: printf("px"); break;
-            case Res_value::COMPLEX_UNIT_DIP: printf("dp"); break;
-            case Res_value::COMPLEX_UNIT_SP: printf("sp"); break;
-            case Res_value::COMPLEX_UNIT_PT: printf("pt"); break;
-            case Res_value::COMPLEX_UNIT_IN: printf("in"); break;
-            case Res_value::COMPLEX_UNIT_MM: printf("mm"); break;
-            default: printf(" (unknown unit)"); break;
+            case Res_value::COMPLEX_UNIT_PX: out->append("px"); break;
+            case Res_value::COMPLEX_UNIT_DIP: out->append("dp"); break;
+            case Res_value::COMPLEX_UNIT_SP: out->append("sp"); break;
+            case Res_value::COMPLEX_UNIT_PT: out->append("pt"); break;
+            case Res_value::COMPLEX_UNIT_IN: out->append("in"); break;
+            case Res_value::COMPLEX_UNIT_MM: out->append("mm"); break;
+            default: out->append(" (unknown unit)"); break;
         }
     } else {
         switch ((complex>>Res_value::COMPLEX_UNIT_SHIFT)&Res_value::COMPLEX_UNIT_MASK) {
-            case Res_value::COMPLEX_UNIT_FRACTION: printf("%%"); break;
-            case Res_value::COMPLEX_UNIT_FRACTION_PARENT: printf("%%p"); break;
-            default: printf(" (unknown unit)"); break;
+            case Res_value::COMPLEX_UNIT_FRACTION: out->append("%"); break;
+            case Res_value::COMPLEX_UNIT_FRACTION_PARENT: out->append("%p"); break;
+            default: out->append(" (unknown unit)"); break;
         }
     }
 }
@@ -6442,312 +7864,643 @@ static void print_complex(uint32_t complex, bool isFraction)
 String8 ResTable::normalizeForOutput( const char *input )
 {
     String8 ret;
-    char buff[2];
-    buff[1] = '\0';
 
-    while (*input != '\0') {
+    // All interesting characters are in the ASCII zone, so we are making our own lives
+    // easier by scanning the string one byte at a time, and copying the runs between
+    // them at once.
+    const char* run = input;
+    for (; *input != '\0'; input++) {
+        const char* escaped;
         switch (*input) {
-            // All interesting characters are in the ASCII zone, so we are making our own lives
-            // easier by scanning the string one byte at a time.
         case '\\':
-            ret += "\\\\";
+            escaped = "\\\\";
             break;
         case '\n':
-            ret += "\\n";
+            escaped = "\\n";
             break;
         case '"':
-            ret += "\\\"";
+            escaped = "\\\"";
             break;
         default:
-            buff[0] = *input;
-            ret += buff;
-            break;
+            continue;
         }
-
-        input++;
+        ret.append(run, input - run);
+        ret.append(escaped);
+        run = input + 1;
     }
+    ret.append(run, input - run);
 
     return ret;
 }
 
-void ResTable::print_value(const Package* pkg, const Res_value& value) const
+// Appends 'str' to 'out' as a JSON string, quotes and all.
+static void appendJsonString(String8* out, const char* str, size_t len)
+{
+    out->append("\"");
+    const char* run = str;
+    const char* const end = str + len;
+    for (const char* p = str; p < end; p++) {
+        const unsigned char c = *p;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        out->append(run, p - run);
+        switch (c) {
+        case '"': out->append("\\\""); break;
+        case '\\': out->append("\\\\"); break;
+        case '\n': out->append("\\n"); break;
+        case '\t': out->append("\\t"); break;
+        default: out->appendFormat("\\u%04x", c); break;
+        }
+        run = p + 1;
+    }
+    out->append(run, end - run);
+    out->append("\"");
+}
+
+void ResTable::print_value(const Package* pkg, const Res_value& value, String8* out) const
 {
     if (value.dataType == Res_value::TYPE_NULL) {
         if (value.data == Res_value::DATA_NULL_UNDEFINED) {
-            printf("(null)\n");
+            out->append("(null)\n");
         } else if (value.data == Res_value::DATA_NULL_EMPTY) {
-            printf("(null empty)\n");
+            out->append("(null empty)\n");
         } else {
             // This should never happen.
-            printf("(null) 0x%08x\n", value.data);
+            out->appendFormat("(null) 0x%08x\n", value.data);
         }
     } else if (value.dataType == Res_value::TYPE_REFERENCE) {
-        printf("(reference) 0x%08x\n", value.data);
+        out->appendFormat("(reference) 0x%08x\n", value.data);
     } else if (value.dataType == Res_value::TYPE_DYNAMIC_REFERENCE) {
-        printf("(dynamic reference) 0x%08x\n", value.data);
+        out->appendFormat("(dynamic reference) 0x%08x\n", value.data);
     } else if (value.dataType == Res_value::TYPE_ATTRIBUTE) {
-        printf("(attribute) 0x%08x\n", value.data);
+        out->appendFormat("(attribute) 0x%08x\n", value.data);
     } else if (value.dataType == Res_value::TYPE_STRING) {
         size_t len;
         const char* str8 = pkg->header->values.string8At(
                 value.data, &len);
         if (str8 != NULL) {
-            printf("(string8) \"%s\"\n", normalizeForOutput(str8).string());
+            out->append("(string8) \"");
+            out->append(normalizeForOutput(str8));
+            out->append("\"\n");
         } else {
             const char16_t* str16 = pkg->header->values.stringAt(
                     value.data, &len);
             if (str16 != NULL) {
-                printf("(string16) \"%s\"\n",
-                    normalizeForOutput(String8(str16, len).string()).string());
+                out->append("(string16) \"");
+                out->append(normalizeForOutput(String8(str16, len).string()));
+                out->append("\"\n");
             } else {
-                printf("(string) null\n");
+                out->append("(string) null\n");
             }
         }
     } else if (value.dataType == Res_value::TYPE_FLOAT) {
-        printf("(float) %g\n", *(const float*)&value.data);
+        out->appendFormat("(float) %g\n", *(const float*)&value.data);
     } else if (value.dataType == Res_value::TYPE_DIMENSION) {
-        printf("(dimension) ");
-        print_complex(value.data, false);
-        printf("\n");
+        out->append("(dimension) ");
+        print_complex(value.data, false, out);
+        out->append("\n");
     } else if (value.dataType == Res_value::TYPE_FRACTION) {
-        printf("(fraction) ");
-        print_complex(value.data, true);
-        printf("\n");
+        out->append("(fraction) ");
+        print_complex(value.data, true, out);
+        out->append("\n");
     } else if (value.dataType >= Res_value::TYPE_FIRST_COLOR_INT
             || value.dataType <= Res_value::TYPE_LAST_COLOR_INT) {
-        printf("(color) #%08x\n", value.data);
+        out->appendFormat("(color) #%08x\n", value.data);
     } else if (value.dataType == Res_value::TYPE_INT_BOOLEAN) {
-        printf("(boolean) %s\n", value.data ? "true" : "false");
+        out->appendFormat("(boolean) %s\n", value.data ? "true" : "false");
     } else if (value.dataType >= Res_value::TYPE_FIRST_INT
             || value.dataType <= Res_value::TYPE_LAST_INT) {
-        printf("(int) 0x%08x or %d\n", value.data, value.data);
+        out->appendFormat("(int) 0x%08x or %d\n", value.data, value.data);
     } else {
-        printf("(unknown type) t=0x%02x d=0x%08x (s=0x%04x r=0x%02x)\n",
+        out->appendFormat("(unknown type) t=0x%02x d=0x%08x (s=0x%04x r=0x%02x)\n",
                (int)value.dataType, (int)value.data,
                (int)value.size, (int)value.res0);
     }
 }
 
-void ResTable::print(bool inclValues) const
+// The JSON form of a value: its raw type and data, and what they mean as
+// "kind" and "value".  Unlike the text, every int type is told apart.
+void ResTable::print_value_json(const Package* pkg, const Res_value& value, String8* out) const
+{
+    out->appendFormat("{\"dataType\":%d,\"data\":%u,\"kind\":", (int)value.dataType, value.data);
+    switch (value.dataType) {
+    case Res_value::TYPE_NULL:
+        out->append(value.data == Res_value::DATA_NULL_EMPTY ? "\"empty\"" : "\"null\"");
+        break;
+    case Res_value::TYPE_REFERENCE:
+        out->appendFormat("\"reference\",\"value\":\"0x%08x\"", value.data);
+        break;
+    case Res_value::TYPE_DYNAMIC_REFERENCE:
+        out->appendFormat("\"dynamic-reference\",\"value\":\"0x%08x\"", value.data);
+        break;
+    case Res_value::TYPE_ATTRIBUTE:
+        out->appendFormat("\"attribute\",\"value\":\"0x%08x\"", value.data);
+        break;
+    case Res_value::TYPE_STRING: {
+        out->append("\"string\",\"value\":");
+        size_t len;
+        const char* str8 = pkg->header->values.string8At(value.data, &len);
+        if (str8 != NULL) {
+            appendJsonString(out, str8, len);
+        } else {
+            const char16_t* str16 = pkg->header->values.stringAt(value.data, &len);
+            if (str16 != NULL) {
+                const String8 str(str16, len);
+                appendJsonString(out, str.string(), str.size());
+            } else {
+                out->append("null");
+            }
+        }
+        break;
+    }
+    case Res_value::TYPE_FLOAT: {
+        const float f = *(const float*)&value.data;
+        if (f == f && f - f == 0) {
+            out->appendFormat("\"float\",\"value\":%.9g", f);
+        } else {
+            // Infinities and NaNs have no JSON number.
+            out->append("\"float\",\"value\":null");
+        }
+        break;
+    }
+    case Res_value::TYPE_DIMENSION:
+    case Res_value::TYPE_FRACTION: {
+        const bool isFraction = value.dataType == Res_value::TYPE_FRACTION;
+        out->append(isFraction ? "\"fraction\",\"value\":\"" : "\"dimension\",\"value\":\"");
+        print_complex(value.data, isFraction, out);
+        out->append("\"");
+        break;
+    }
+    case Res_value::TYPE_INT_BOOLEAN:
+        out->appendFormat("\"boolean\",\"value\":%s", value.data ? "true" : "false");
+        break;
+    default:
+        if (value.dataType >= Res_value::TYPE_FIRST_COLOR_INT
+                && value.dataType <= Res_value::TYPE_LAST_COLOR_INT) {
+            out->appendFormat("\"color\",\"value\":\"#%08x\"", value.data);
+        } else if (value.dataType >= Res_value::TYPE_FIRST_INT
+                && value.dataType <= Res_value::TYPE_LAST_INT) {
+            out->appendFormat("\"int\",\"value\":%d", (int32_t)value.data);
+        } else {
+            out->append("\"unknown\"");
+        }
+        break;
+    }
+    out->append("}");
+}
+
+// Formats the lines of one config of a type or, for a configIndex of -1,
+// the lines before its configs.
+void ResTable::print_type(const PackageGroup* pg, size_t typeIndex, ssize_t configIndex,
+        bool inclValues, String8* out) const
 {
-    if (mError != 0) {
-        printf("mError=0x%x (%s)\n", mError, strerror(mError));
+    const TypeList& typeList = pg->types[typeIndex];
+    if (typeList.isEmpty()) {
+        return;
     }
-    size_t pgCount = mPackageGroups.size();
-    printf("Package Groups (%d)\n", (int)pgCount);
-    for (size_t pgIndex=0; pgIndex<pgCount; pgIndex++) {
-        const PackageGroup* pg = mPackageGroups[pgIndex];
-        printf("Package Group %d id=0x%02x packageCount=%d name=%s\n",
-                (int)pgIndex, pg->id, (int)pg->packages.size(),
-                String8(pg->name).string());
+    const Type* typeConfigs = typeList[0];
+    // Use the real ID of the group's last package, since the ID may have
+    // been assigned if this package is a shared library.
+    const int packageId = pg->packages.isEmpty() ? pg->id : pg->packages.top()->package->id;
+    const size_t NTC = typeConfigs->configs.size();
+    if (configIndex < 0) {
+        out->appendFormat("    type %d configCount=%d entryCount=%d\n",
+               (int)typeIndex, (int)NTC, (int)typeConfigs->entryCount);
+        if (typeConfigs->typeSpecFlags != NULL) {
+            for (size_t entryIndex=0; entryIndex<typeConfigs->entryCount; entryIndex++) {
+                uint32_t resID = (0xff000000 & ((packageId)<<24))
+                            | (0x00ff0000 & ((typeIndex+1)<<16))
+                            | (0x0000ffff & (entryIndex));
+                // Since we are creating resID without actually
+                // iterating over them, we have no idea which is a
+                // dynamic reference. We must check.
+                if (packageId == 0) {
+                    pg->dynamicRefTable.lookupResourceId(&resID);
+                }
+
+                resource_name8 resName;
+                if (this->getResourceName8(resID, &resName)) {
+                    out->appendFormat("      spec resource 0x%08x %.*s:%.*s/%.*s: flags=0x%08x\n",
+                        resID,
+                        (int) resName.packageLen, resName.package,
+                        (int) resName.typeLen, resName.type,
+                        (int) resName.nameLen, resName.name,
+                        dtohl(typeConfigs->typeSpecFlags[entryIndex]));
+                } else {
+                    out->appendFormat("      INVALID TYPE CONFIG FOR RESOURCE 0x%08x\n", resID);
+                }
+            }
+        }
+        return;
+    }
+
+    const ResTable_type* type = typeConfigs->configs[configIndex];
+    if ((((uint64_t)type)&0x3) != 0) {
+        out->appendFormat("      NON-INTEGER ResTable_type ADDRESS: %p\n", type);
+        return;
+    }
+    String8 configStr = type->config.toString();
+    out->appendFormat("      config %s:\n", configStr.size() > 0
+            ? configStr.string() : "(default)");
+    size_t entryCount = dtohl(type->entryCount);
+    uint32_t entriesStart = dtohl(type->entriesStart);
+    if ((entriesStart&0x3) != 0) {
+        out->appendFormat("      NON-INTEGER ResTable_type entriesStart OFFSET: 0x%x\n",
+                entriesStart);
+        return;
+    }
+    uint32_t typeSize = dtohl(type->header.size);
+    if ((typeSize&0x3) != 0) {
+        out->appendFormat("      NON-INTEGER ResTable_type header.size: 0x%x\n", typeSize);
+        return;
+    }
+    const bool sparse = (type->flags & ResTable_type::FLAG_SPARSE) != 0;
+    for (size_t i=0; i<entryCount; i++) {
+        const uint32_t* const eindex = (const uint32_t*)
+            (((const uint8_t*)type) + dtohs(type->header.headerSize));
+
+        size_t entryIndex = i;
+        uint32_t thisOffset;
+        if (sparse) {
+            const ResTable_sparseTypeEntry* const entry =
+                    (const ResTable_sparseTypeEntry*) (eindex + i);
+            entryIndex = dtohs(entry->idx);
+            thisOffset = uint32_t(dtohs(entry->offset)) * 4;
+        } else {
+            thisOffset = dtohl(eindex[i]);
+        }
+        if (thisOffset == ResTable_type::NO_ENTRY) {
+            continue;
+        }
+
+        uint32_t resID = (0xff000000 & ((packageId)<<24))
+                    | (0x00ff0000 & ((typeIndex+1)<<16))
+                    | (0x0000ffff & (entryIndex));
+        if (packageId == 0) {
+            pg->dynamicRefTable.lookupResourceId(&resID);
+        }
+        resource_name8 resName;
+        if (this->getResourceName8(resID, &resName)) {
+            out->appendFormat("        resource 0x%08x %.*s:%.*s/%.*s: ", resID,
+                    (int) resName.packageLen, resName.package,
+                    (int) resName.typeLen, resName.type,
+                    (int) resName.nameLen, resName.name);
+        } else {
+            out->appendFormat("        INVALID RESOURCE 0x%08x: ", resID);
+        }
+        if ((thisOffset&0x3) != 0) {
+            out->appendFormat("NON-INTEGER OFFSET: 0x%x\n", thisOffset);
+            continue;
+        }
+        if ((thisOffset+sizeof(ResTable_entry)) > typeSize) {
+            out->appendFormat("OFFSET OUT OF BOUNDS: 0x%x+0x%x (size is 0x%x)\n",
+                   entriesStart, thisOffset, typeSize);
+            continue;
+        }
+
+        const ResTable_entry* ent = (const ResTable_entry*)
+            (((const uint8_t*)type) + entriesStart + thisOffset);
+        if (((entriesStart + thisOffset)&0x3) != 0) {
+            out->appendFormat("NON-INTEGER ResTable_entry OFFSET: 0x%x\n",
+                 (entriesStart + thisOffset));
+            continue;
+        }
+
+        uintptr_t esize = dtohs(ent->size);
+        if ((esize&0x3) != 0) {
+            out->appendFormat("NON-INTEGER ResTable_entry SIZE: %p\n", (void *)esize);
+            continue;
+        }
+        if ((thisOffset+esize) > typeSize) {
+            out->appendFormat("ResTable_entry OUT OF BOUNDS: 0x%x+0x%x+%p (size is 0x%x)\n",
+                   entriesStart, thisOffset, (void *)esize, typeSize);
+            continue;
+        }
+
+        const Res_value* valuePtr = NULL;
+        const ResTable_map_entry* bagPtr = NULL;
+        Res_value value;
+        if ((dtohs(ent->flags)&ResTable_entry::FLAG_COMPLEX) != 0) {
+            out->append("<bag>");
+            bagPtr = (const ResTable_map_entry*)ent;
+        } else {
+            valuePtr = (const Res_value*)
+                (((const uint8_t*)ent) + esize);
+            value.copyFrom_dtoh(*valuePtr);
+            out->appendFormat("t=0x%02x d=0x%08x (s=0x%04x r=0x%02x)",
+                   (int)value.dataType, (int)value.data,
+                   (int)value.size, (int)value.res0);
+        }
+
+        if ((dtohs(ent->flags)&ResTable_entry::FLAG_PUBLIC) != 0) {
+            out->append(" (PUBLIC)");
+        }
+        out->append("\n");
+
+        if (inclValues) {
+            if (valuePtr != NULL) {
+                out->append("          ");
+                print_value(typeConfigs->package, value, out);
+            } else if (bagPtr != NULL) {
+                const int N = dtohl(bagPtr->count);
+                const uint8_t* baseMapPtr = (const uint8_t*)ent;
+                size_t mapOffset = esize;
+                const ResTable_map* mapPtr = (ResTable_map*)(baseMapPtr+mapOffset);
+                const uint32_t parent = dtohl(bagPtr->parent.ident);
+                uint32_t resolvedParent = parent;
+                if (Res_GETPACKAGE(resolvedParent) + 1 == 0) {
+                    status_t err = pg->dynamicRefTable.lookupResourceId(&resolvedParent);
+                    if (err != NO_ERROR) {
+                        resolvedParent = 0;
+                    }
+                }
+                out->appendFormat("          Parent=0x%08x(Resolved=0x%08x), Count=%d\n",
+                        parent, resolvedParent, N);
+                for (int i=0; i<N && mapOffset < (typeSize-sizeof(ResTable_map)); i++) {
+                    out->appendFormat("          #%i (Key=0x%08x): ",
+                        i, dtohl(mapPtr->name.ident));
+                    value.copyFrom_dtoh(mapPtr->value);
+                    print_value(typeConfigs->package, value, out);
+                    const size_t size = dtohs(mapPtr->value.size);
+                    mapOffset += size + sizeof(*mapPtr)-sizeof(mapPtr->value);
+                    mapPtr = (ResTable_map*)(baseMapPtr+mapOffset);
+                }
+            }
+        }
+    }
+}
+
+// Like print_type(), but only the resources of the config, one JSON object
+// a line; entries the text would report as malformed are left out.
+void ResTable::print_type_json(const PackageGroup* pg, size_t typeIndex, ssize_t configIndex,
+        bool inclValues, String8* out) const
+{
+    const TypeList& typeList = pg->types[typeIndex];
+    if (typeList.isEmpty() || configIndex < 0) {
+        return;
+    }
+    const Type* typeConfigs = typeList[0];
+    const int packageId = pg->packages.isEmpty() ? pg->id : pg->packages.top()->package->id;
+    const ResTable_type* type = typeConfigs->configs[configIndex];
+    const uint32_t entriesStart = dtohl(type->entriesStart);
+    const uint32_t typeSize = dtohl(type->header.size);
+    if ((((uint64_t)type)&0x3) != 0 || (entriesStart&0x3) != 0 || (typeSize&0x3) != 0) {
+        return;
+    }
+    const String8 configStr = type->config.toString();
+    const size_t entryCount = dtohl(type->entryCount);
+    const bool sparse = (type->flags & ResTable_type::FLAG_SPARSE) != 0;
+    const uint32_t* const eindex = (const uint32_t*)
+        (((const uint8_t*)type) + dtohs(type->header.headerSize));
+    for (size_t i=0; i<entryCount; i++) {
+        size_t entryIndex = i;
+        uint32_t thisOffset;
+        if (sparse) {
+            const ResTable_sparseTypeEntry* const entry =
+                    (const ResTable_sparseTypeEntry*) (eindex + i);
+            entryIndex = dtohs(entry->idx);
+            thisOffset = uint32_t(dtohs(entry->offset)) * 4;
+        } else {
+            thisOffset = dtohl(eindex[i]);
+        }
+        if (thisOffset == ResTable_type::NO_ENTRY || (thisOffset&0x3) != 0
+                || (thisOffset+sizeof(ResTable_entry)) > typeSize) {
+            continue;
+        }
+        const ResTable_entry* ent = (const ResTable_entry*)
+            (((const uint8_t*)type) + entriesStart + thisOffset);
+        const uintptr_t esize = dtohs(ent->size);
+        if ((esize&0x3) != 0 || (thisOffset+esize) > typeSize) {
+            continue;
+        }
+
+        uint32_t resID = (0xff000000 & ((packageId)<<24))
+                    | (0x00ff0000 & ((typeIndex+1)<<16))
+                    | (0x0000ffff & (entryIndex));
+        if (packageId == 0) {
+            pg->dynamicRefTable.lookupResourceId(&resID);
+        }
+        out->appendFormat("{\"id\":\"0x%08x\"", resID);
+        resource_name8 resName;
+        if (this->getResourceName8(resID, &resName)) {
+            out->append(",\"package\":");
+            appendJsonString(out, resName.package, resName.packageLen);
+            out->append(",\"type\":");
+            appendJsonString(out, resName.type, resName.typeLen);
+            out->append(",\"name\":");
+            appendJsonString(out, resName.name, resName.nameLen);
+        }
+        out->append(",\"config\":");
+        appendJsonString(out, configStr.string(), configStr.size());
+        out->appendFormat(",\"public\":%s",
+                (dtohs(ent->flags)&ResTable_entry::FLAG_PUBLIC) != 0 ? "true" : "false");
+
+        Res_value value;
+        if ((dtohs(ent->flags)&ResTable_entry::FLAG_COMPLEX) == 0) {
+            value.copyFrom_dtoh(*(const Res_value*)(((const uint8_t*)ent) + esize));
+            if (inclValues) {
+                out->append(",\"value\":");
+                print_value_json(typeConfigs->package, value, out);
+            }
+        } else {
+            const ResTable_map_entry* bagPtr = (const ResTable_map_entry*)ent;
+            const int N = dtohl(bagPtr->count);
+            uint32_t parent = dtohl(bagPtr->parent.ident);
+            if (Res_GETPACKAGE(parent) + 1 == 0
+                    && pg->dynamicRefTable.lookupResourceId(&parent) != NO_ERROR) {
+                parent = 0;
+            }
+            out->appendFormat(",\"parent\":\"0x%08x\",\"count\":%d", parent, N);
+            if (inclValues) {
+                out->append(",\"bag\":[");
+                const uint8_t* baseMapPtr = (const uint8_t*)ent;
+                size_t mapOffset = esize;
+                for (int i=0; i<N && mapOffset < (typeSize-sizeof(ResTable_map)); i++) {
+                    const ResTable_map* mapPtr = (ResTable_map*)(baseMapPtr+mapOffset);
+                    out->appendFormat("%s{\"key\":\"0x%08x\",\"value\":", i > 0 ? "," : "",
+                            dtohl(mapPtr->name.ident));
+                    value.copyFrom_dtoh(mapPtr->value);
+                    print_value_json(typeConfigs->package, value, out);
+                    out->append("}");
+                    mapOffset += dtohs(mapPtr->value.size)
+                            + sizeof(*mapPtr)-sizeof(mapPtr->value);
+                }
+                out->append("]");
+            }
+        }
+        out->append("}\n");
+    }
+}
+
+/*
+ * The parts of a print() still to be formatted, in the order they are
+ * written: a package group's own lines, then for each of its types the
+ * type's own lines and one part for each of its configs.  Each of
+ * its threads takes the next one in turn, and the calling thread writes
+ * each as soon as it and all those before it are done.
+ */
+struct ResTable::PrintBatch {
+    struct Part {
+        const PackageGroup* group;
+        size_t groupIndex;
+        ssize_t typeIndex;      // -1 for the group's own lines
+        ssize_t configIndex;    // -1 for the type's own lines
+        String8 text;
+        bool done;
+    };
+
+    const ResTable* table;
+    bool inclValues;
+    PrintFormat format;
+    Vector<Part> parts;
+    Part* items;                // parts.editArray(), once they are all added
+    volatile int32_t next;
+    Mutex lock;
+    Condition partDone;
+
+    void format_part(Part* part) const
+    {
+        if (part->typeIndex >= 0) {
+            if (format == PRINT_JSON_LINES) {
+                table->print_type_json(part->group, part->typeIndex, part->configIndex,
+                        inclValues, &part->text);
+            } else {
+                table->print_type(part->group, part->typeIndex, part->configIndex,
+                        inclValues, &part->text);
+            }
+            return;
+        }
+        if (format == PRINT_JSON_LINES) {
+            return;
+        }
+
+        const PackageGroup* pg = part->group;
+        part->text.appendFormat("Package Group %d id=0x%02x packageCount=%d name=%s\n",
+                (int)part->groupIndex, pg->id, (int)pg->packages.size(),
+                pg->name8.string());
 
         const KeyedVector<String16, uint8_t>& refEntries = pg->dynamicRefTable.entries();
         const size_t refEntryCount = refEntries.size();
         if (refEntryCount > 0) {
-            printf("  DynamicRefTable entryCount=%d:\n", (int) refEntryCount);
+            part->text.appendFormat("  DynamicRefTable entryCount=%d:\n", (int) refEntryCount);
             for (size_t refIndex = 0; refIndex < refEntryCount; refIndex++) {
-                printf("    0x%02x -> %s\n",
+                part->text.appendFormat("    0x%02x -> %s\n",
                         refEntries.valueAt(refIndex),
                         String8(refEntries.keyAt(refIndex)).string());
             }
-            printf("\n");
+            part->text.append("\n");
         }
 
-        int packageId = pg->id;
         size_t pkgCount = pg->packages.size();
         for (size_t pkgIndex=0; pkgIndex<pkgCount; pkgIndex++) {
             const Package* pkg = pg->packages[pkgIndex];
-            // Use a package's real ID, since the ID may have been assigned
-            // if this package is a shared library.
-            packageId = pkg->package->id;
             char16_t tmpName[sizeof(pkg->package->name)/sizeof(pkg->package->name[0])];
             strcpy16_dtoh(tmpName, pkg->package->name, sizeof(pkg->package->name)/sizeof(pkg->package->name[0]));
-            printf("  Package %d id=0x%02x name=%s\n", (int)pkgIndex,
+            part->text.appendFormat("  Package %d id=0x%02x name=%s\n", (int)pkgIndex,
                     pkg->package->id, String8(tmpName).string());
         }
+    }
+
+    void run()
+    {
+        for (;;) {
+            const size_t i = (size_t) android_atomic_inc(&next);
+            if (i >= parts.size()) {
+                return;
+            }
+            Part* part = &items[i];
+            format_part(part);
+            AutoMutex _l(lock);
+            part->done = true;
+            partDone.broadcast();
+        }
+    }
+};
+
+class ResTable::PrintThread : public Thread {
+public:
+    PrintThread(PrintBatch* batch) : Thread(false), mBatch(batch) {}
+
+private:
+    virtual bool threadLoop()
+    {
+        mBatch->run();
+        return false;
+    }
+
+    PrintBatch* mBatch;
+};
+
+void ResTable::print(bool inclValues, size_t numThreads, PrintFormat format) const
+{
+    if (format == PRINT_TEXT) {
+        if (mError != 0) {
+            printf("mError=0x%x (%s)\n", mError, strerror(mError));
+        }
+        printf("Package Groups (%d)\n", (int)mPackageGroups.size());
+    }
+
+    // Every entry's name is looked up at least once.
+    indexResourceNames();
 
+    PrintBatch batch;
+    batch.table = this;
+    batch.inclValues = inclValues;
+    batch.format = format;
+    batch.next = 0;
+    size_t pgCount = mPackageGroups.size();
+    for (size_t pgIndex=0; pgIndex<pgCount; pgIndex++) {
+        const PackageGroup* pg = mPackageGroups[pgIndex];
+        PrintBatch::Part part;
+        part.group = pg;
+        part.groupIndex = pgIndex;
+        part.done = false;
+        part.typeIndex = -1;
+        part.configIndex = -1;
+        batch.parts.add(part);
         for (size_t typeIndex=0; typeIndex < pg->types.size(); typeIndex++) {
             const TypeList& typeList = pg->types[typeIndex];
             if (typeList.isEmpty()) {
                 continue;
             }
-            const Type* typeConfigs = typeList[0];
-            const size_t NTC = typeConfigs->configs.size();
-            printf("    type %d configCount=%d entryCount=%d\n",
-                   (int)typeIndex, (int)NTC, (int)typeConfigs->entryCount);
-            if (typeConfigs->typeSpecFlags != NULL) {
-                for (size_t entryIndex=0; entryIndex<typeConfigs->entryCount; entryIndex++) {
-                    uint32_t resID = (0xff000000 & ((packageId)<<24))
-                                | (0x00ff0000 & ((typeIndex+1)<<16))
-                                | (0x0000ffff & (entryIndex));
-                    // Since we are creating resID without actually
-                    // iterating over them, we have no idea which is a
-                    // dynamic reference. We must check.
-                    if (packageId == 0) {
-                        pg->dynamicRefTable.lookupResourceId(&resID);
-                    }
-
-                    resource_name resName;
-                    if (this->getResourceName(resID, true, &resName)) {
-                        String8 type8;
-                        String8 name8;
-                        if (resName.type8 != NULL) {
-                            type8 = String8(resName.type8, resName.typeLen);
-                        } else {
-                            type8 = String8(resName.type, resName.typeLen);
-                        }
-                        if (resName.name8 != NULL) {
-                            name8 = String8(resName.name8, resName.nameLen);
-                        } else {
-                            name8 = String8(resName.name, resName.nameLen);
-                        }
-                        printf("      spec resource 0x%08x %s:%s/%s: flags=0x%08x\n",
-                            resID,
-                            CHAR16_TO_CSTR(resName.package, resName.packageLen),
-                            type8.string(), name8.string(),
-                            dtohl(typeConfigs->typeSpecFlags[entryIndex]));
-                    } else {
-                        printf("      INVALID TYPE CONFIG FOR RESOURCE 0x%08x\n", resID);
-                    }
-                }
+            part.typeIndex = typeIndex;
+            for (ssize_t c = -1; c < (ssize_t) typeList[0]->configs.size(); c++) {
+                part.configIndex = c;
+                batch.parts.add(part);
             }
-            for (size_t configIndex=0; configIndex<NTC; configIndex++) {
-                const ResTable_type* type = typeConfigs->configs[configIndex];
-                if ((((uint64_t)type)&0x3) != 0) {
-                    printf("      NON-INTEGER ResTable_type ADDRESS: %p\n", type);
-                    continue;
-                }
-                String8 configStr = type->config.toString();
-                printf("      config %s:\n", configStr.size() > 0
-                        ? configStr.string() : "(default)");
-                size_t entryCount = dtohl(type->entryCount);
-                uint32_t entriesStart = dtohl(type->entriesStart);
-                if ((entriesStart&0x3) != 0) {
-                    printf("      NON-INTEGER ResTable_type entriesStart OFFSET: 0x%x\n", entriesStart);
-                    continue;
-                }
-                uint32_t typeSize = dtohl(type->header.size);
-                if ((typeSize&0x3) != 0) {
-                    printf("      NON-INTEGER ResTable_type header.size: 0x%x\n", typeSize);
-                    continue;
-                }
-                for (size_t entryIndex=0; entryIndex<entryCount; entryIndex++) {
-                    const uint32_t* const eindex = (const uint32_t*)
-                        (((const uint8_t*)type) + dtohs(type->header.headerSize));
-
-                    uint32_t thisOffset = dtohl(eindex[entryIndex]);
-                    if (thisOffset == ResTable_type::NO_ENTRY) {
-                        continue;
-                    }
-
-                    uint32_t resID = (0xff000000 & ((packageId)<<24))
-                                | (0x00ff0000 & ((typeIndex+1)<<16))
-                                | (0x0000ffff & (entryIndex));
-                    if (packageId == 0) {
-                        pg->dynamicRefTable.lookupResourceId(&resID);
-                    }
-                    resource_name resName;
-                    if (this->getResourceName(resID, true, &resName)) {
-                        String8 type8;
-                        String8 name8;
-                        if (resName.type8 != NULL) {
-                            type8 = String8(resName.type8, resName.typeLen);
-                        } else {
-                            type8 = String8(resName.type, resName.typeLen);
-                        }
-                        if (resName.name8 != NULL) {
-                            name8 = String8(resName.name8, resName.nameLen);
-                        } else {
-                            name8 = String8(resName.name, resName.nameLen);
-                        }
-                        printf("        resource 0x%08x %s:%s/%s: ", resID,
-                                CHAR16_TO_CSTR(resName.package, resName.packageLen),
-                                type8.string(), name8.string());
-                    } else {
-                        printf("        INVALID RESOURCE 0x%08x: ", resID);
-                    }
-                    if ((thisOffset&0x3) != 0) {
-                        printf("NON-INTEGER OFFSET: 0x%x\n", thisOffset);
-                        continue;
-                    }
-                    if ((thisOffset+sizeof(ResTable_entry)) > typeSize) {
-                        printf("OFFSET OUT OF BOUNDS: 0x%x+0x%x (size is 0x%x)\n",
-                               entriesStart, thisOffset, typeSize);
-                        continue;
-                    }
-
-                    const ResTable_entry* ent = (const ResTable_entry*)
-                        (((const uint8_t*)type) + entriesStart + thisOffset);
-                    if (((entriesStart + thisOffset)&0x3) != 0) {
-                        printf("NON-INTEGER ResTable_entry OFFSET: 0x%x\n",
-                             (entriesStart + thisOffset));
-                        continue;
-                    }
+        }
+    }
 
-                    uintptr_t esize = dtohs(ent->size);
-                    if ((esize&0x3) != 0) {
-                        printf("NON-INTEGER ResTable_entry SIZE: %p\n", (void *)esize);
-                        continue;
-                    }
-                    if ((thisOffset+esize) > typeSize) {
-                        printf("ResTable_entry OUT OF BOUNDS: 0x%x+0x%x+%p (size is 0x%x)\n",
-                               entriesStart, thisOffset, (void *)esize, typeSize);
-                        continue;
-                    }
+    batch.items = batch.parts.editArray();
 
-                    const Res_value* valuePtr = NULL;
-                    const ResTable_map_entry* bagPtr = NULL;
-                    Res_value value;
-                    if ((dtohs(ent->flags)&ResTable_entry::FLAG_COMPLEX) != 0) {
-                        printf("<bag>");
-                        bagPtr = (const ResTable_map_entry*)ent;
-                    } else {
-                        valuePtr = (const Res_value*)
-                            (((const uint8_t*)ent) + esize);
-                        value.copyFrom_dtoh(*valuePtr);
-                        printf("t=0x%02x d=0x%08x (s=0x%04x r=0x%02x)",
-                               (int)value.dataType, (int)value.data,
-                               (int)value.size, (int)value.res0);
-                    }
+    if (numThreads > batch.parts.size()) {
+        numThreads = batch.parts.size();
+    }
+    Vector<sp<PrintThread> > threads;
+    for (size_t i = 0; numThreads > 1 && i < numThreads; i++) {
+        sp<PrintThread> thread = new PrintThread(&batch);
+        if (thread->run("print", PRIORITY_NORMAL) == NO_ERROR) {
+            threads.add(thread);
+        }
+    }
 
-                    if ((dtohs(ent->flags)&ResTable_entry::FLAG_PUBLIC) != 0) {
-                        printf(" (PUBLIC)");
-                    }
-                    printf("\n");
-
-                    if (inclValues) {
-                        if (valuePtr != NULL) {
-                            printf("          ");
-                            print_value(typeConfigs->package, value);
-                        } else if (bagPtr != NULL) {
-                            const int N = dtohl(bagPtr->count);
-                            const uint8_t* baseMapPtr = (const uint8_t*)ent;
-                            size_t mapOffset = esize;
-                            const ResTable_map* mapPtr = (ResTable_map*)(baseMapPtr+mapOffset);
-                            const uint32_t parent = dtohl(bagPtr->parent.ident);
-                            uint32_t resolvedParent = parent;
-                            if (Res_GETPACKAGE(resolvedParent) + 1 == 0) {
-                                status_t err = pg->dynamicRefTable.lookupResourceId(&resolvedParent);
-                                if (err != NO_ERROR) {
-                                    resolvedParent = 0;
-                                }
-                            }
-                            printf("          Parent=0x%08x(Resolved=0x%08x), Count=%d\n",
-                                    parent, resolvedParent, N);
-                            for (int i=0; i<N && mapOffset < (typeSize-sizeof(ResTable_map)); i++) {
-                                printf("          #%i (Key=0x%08x): ",
-                                    i, dtohl(mapPtr->name.ident));
-                                value.copyFrom_dtoh(mapPtr->value);
-                                print_value(typeConfigs->package, value);
-                                const size_t size = dtohs(mapPtr->value.size);
-                                mapOffset += size + sizeof(*mapPtr)-sizeof(mapPtr->value);
-                                mapPtr = (ResTable_map*)(baseMapPtr+mapOffset);
-                            }
-                        }
-                    }
-                }
+    fflush(stdout);
+    for (size_t i = 0; i < batch.parts.size(); i++) {
+        PrintBatch::Part& part = batch.items[i];
+        if (threads.isEmpty()) {
+            batch.format_part(&part);
+        } else {
+            AutoMutex _l(batch.lock);
+            while (!part.done) {
+                batch.partDone.wait(batch.lock);
             }
         }
+        fwrite(part.text.string(), 1, part.text.size(), stdout);
+        part.text.clear();
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i]->join();
     }
 }
 
@@ -64,6 +64,8 @@ StreamingZipInflater::StreamingZipInflater(int fd, off64_t compDataStart,
     mOutBufSize = StreamingZipInflater::OUTPUT_CHUNK_SIZE;
     mOutBuf = new uint8_t[mOutBufSize];
 
+    mCheckpointInterval = 0;
+
     initInflateState();
 }
 
@@ -82,6 +84,8 @@ StreamingZipInflater::StreamingZipInflater(FileMap* dataMap, size_t uncompSize)
     mOutBufSize = StreamingZipInflater::OUTPUT_CHUNK_SIZE;
     mOutBuf = new uint8_t[mOutBufSize];
 
+    mCheckpointInterval = 0;
+
     initInflateState();
 }
 
@@ -89,6 +93,11 @@ StreamingZipInflater::~StreamingZipInflater() {
     // tear down the in-flight zip state just in case
     ::inflateEnd(&mInflateState);
 
+    for (size_t i = 0; i < mCheckpoints.size(); i++) {
+        ::inflateEnd(&mCheckpoints[i]->state);
+        delete mCheckpoints[i];
+    }
+
     if (mDataMap == NULL) {
         delete [] mInBuf;
     }
@@ -198,6 +207,15 @@ ssize_t StreamingZipInflater::read(void* outBuf, size_t count) {
                 // Note how much data we got, and off we go
                 mOutDeliverable = 0;
                 mOutLastDecoded = mOutBufSize - mInflateState.avail_out;
+
+                if (result != Z_STREAM_END && mCheckpointInterval > 0) {
+                    const off64_t last = mCheckpoints.isEmpty() ? 0
+                            : mCheckpoints.top()->outPosition;
+                    if (mOutCurPosition + (off64_t) mOutLastDecoded
+                            >= last + (off64_t) mCheckpointInterval) {
+                        saveCheckpoint();
+                    }
+                }
             }
         }
     }
@@ -227,18 +245,85 @@ int StreamingZipInflater::readNextChunk() {
     return 0;
 }
 
-// seeking backwards requires uncompressing fom the beginning, so is very
-// expensive.  seeking forwards only requires uncompressing from the current
-// position to the destination.
+/*
+ * Note the state the inflater is in after its last inflate() call, which
+ * has decoded everything up to the end of what is in mOutBuf.
+ */
+void StreamingZipInflater::saveCheckpoint() {
+    Checkpoint* checkpoint = new Checkpoint;
+    if (::inflateCopy(&checkpoint->state, &mInflateState) != Z_OK) {
+        ALOGW("Unable to save inflate checkpoint; seeks will be slower");
+        delete checkpoint;
+        mCheckpointInterval = 0;
+        return;
+    }
+    checkpoint->outPosition = mOutCurPosition + mOutLastDecoded;
+    if (mDataMap == NULL) {
+        checkpoint->inOffset = mInNextChunkOffset - mInflateState.avail_in;
+    } else {
+        checkpoint->inOffset = mInflateState.next_in - mInBuf;
+    }
+    mCheckpoints.push(checkpoint);
+    ALOGV("Saved inflate checkpoint at %lld", (long long) checkpoint->outPosition);
+}
+
+/*
+ * Pick up from a checkpoint.  The current inflate state must have been torn
+ * down first.
+ */
+void StreamingZipInflater::restoreCheckpoint(const Checkpoint& checkpoint) {
+    initInflateState();
+    if (::inflateCopy(&mInflateState, const_cast<z_stream*>(&checkpoint.state)) != Z_OK) {
+        ALOGW("Unable to restore inflate checkpoint");
+        initInflateState();
+        return;
+    }
+    mStreamNeedsInit = false;
+    mOutCurPosition = checkpoint.outPosition;
+    mInflateState.next_out = (Bytef*) mOutBuf;
+    mInflateState.avail_out = mOutBufSize;
+    if (mDataMap == NULL) {
+        ::lseek(mFd, mInFileStart + checkpoint.inOffset, SEEK_SET);
+        mInNextChunkOffset = checkpoint.inOffset;
+        mInflateState.next_in = (Bytef*) mInBuf;
+        mInflateState.avail_in = 0; // set when a chunk is read in
+    } else {
+        mInflateState.next_in = (Bytef*) mInBuf + checkpoint.inOffset;
+        mInflateState.avail_in = mInBufSize - checkpoint.inOffset;
+    }
+}
+
+// seeking backwards requires uncompressing fom the beginning, or from the
+// closest checkpoint before the destination, so is expensive.  seeking
+// forwards only requires uncompressing from the current position, or a
+// checkpoint past it, to the destination.
 off64_t StreamingZipInflater::seekAbsolute(off64_t absoluteInputPosition) {
-    if (absoluteInputPosition < mOutCurPosition) {
-        // rewind and reprocess the data from the beginning
+    // the last checkpoint at or before the destination
+    const Checkpoint* checkpoint = NULL;
+    size_t lo = 0, hi = mCheckpoints.size();
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (mCheckpoints[mid]->outPosition <= absoluteInputPosition) {
+            checkpoint = mCheckpoints[mid];
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (absoluteInputPosition < mOutCurPosition
+            || (checkpoint != NULL && checkpoint->outPosition > mOutCurPosition)) {
+        // rewind and reprocess the data from the beginning, or the checkpoint
         if (!mStreamNeedsInit) {
             ::inflateEnd(&mInflateState);
         }
-        initInflateState();
-        read(NULL, absoluteInputPosition);
-    } else if (absoluteInputPosition > mOutCurPosition) {
+        if (checkpoint != NULL) {
+            restoreCheckpoint(*checkpoint);
+        } else {
+            initInflateState();
+        }
+    }
+    if (absoluteInputPosition > mOutCurPosition) {
         read(NULL, absoluteInputPosition - mOutCurPosition);
     }
     // else if the target position *is* our current position, do nothing
@@ -18,10 +18,27 @@
 
 namespace android {
 
+TypeVariant::TypeVariant(const ResTable_type* data)
+    : data(data), mLength(dtohl(data->entryCount)) {
+    if ((data->flags & ResTable_type::FLAG_SPARSE) != 0 && mLength > 0) {
+        const uintptr_t containerEnd = reinterpret_cast<uintptr_t>(data)
+                + dtohl(data->header.size);
+        const ResTable_sparseTypeEntry* const entries =
+                reinterpret_cast<const ResTable_sparseTypeEntry*>(
+                        reinterpret_cast<uintptr_t>(data) + dtohs(data->header.headerSize));
+        if (reinterpret_cast<uintptr_t>(entries + mLength) > containerEnd) {
+            ALOGE("Type's entry indices extend beyond its boundaries");
+            mLength = 0;
+        } else {
+            mLength = dtohs(entries[mLength - 1].idx) + 1;
+        }
+    }
+}
+
 TypeVariant::iterator& TypeVariant::iterator::operator++() {
     mIndex++;
-    if (mIndex > dtohl(mTypeVariant->data->entryCount)) {
-        mIndex = dtohl(mTypeVariant->data->entryCount);
+    if (mIndex > mTypeVariant->mLength) {
+        mIndex = mTypeVariant->mLength;
     }
     return *this;
 }
@@ -29,7 +46,7 @@ TypeVariant::iterator& TypeVariant::iterator::operator++() {
 const ResTable_entry* TypeVariant::iterator::operator*() const {
     const ResTable_type* type = mTypeVariant->data;
     const uint32_t entryCount = dtohl(type->entryCount);
-    if (mIndex >= entryCount) {
+    if (mIndex >= mTypeVariant->mLength) {
         return NULL;
     }
 
@@ -42,7 +59,7 @@ const ResTable_entry* TypeVariant::iterator::operator*() const {
         return NULL;
     }
 
-    const uint32_t entryOffset = dtohl(entryIndices[mIndex]);
+    const uint32_t entryOffset = getTypeEntryOffset(type, mIndex);
     if (entryOffset == ResTable_type::NO_ENTRY) {
         return NULL;
     }
@@ -20,10 +20,12 @@
 #define LOG_TAG "zipro"
 //#define LOG_NDEBUG 0
 #include <androidfw/ZipFileRO.h>
+#include <cutils/atomic.h>
 #include <utils/Log.h>
 #include <utils/Compat.h>
 #include <utils/misc.h>
 #include <utils/threads.h>
+#include <utils/Vector.h>
 #include <ziparchive/zip_archive.h>
 
 #include <zlib.h>
@@ -33,6 +35,7 @@
 #include <errno.h>
 #include <assert.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 using namespace android;
 
@@ -252,3 +255,188 @@ bool ZipFileRO::uncompressEntry(ZipEntryRO entry, int fd) const
 
     return true;
 }
+
+/*
+ * Copy or inflate an entry out of a mapping of the whole archive.  Like
+ * uncompressEntry(), this doesn't verify the data's CRC.
+ */
+static bool uncompressMappedEntry(const uint8_t* archive, size_t archiveLen,
+    const ZipEntry& ze, void* buffer, size_t size)
+{
+    const size_t dataLen = ze.method == ZipFileRO::kCompressStored
+            ? ze.uncompressed_length : ze.compressed_length;
+    if (ze.offset < 0 || (uint64_t) ze.offset > archiveLen
+            || dataLen > archiveLen - ze.offset || size < ze.uncompressed_length) {
+        ALOGW("Zip: entry at %lld doesn't fit the archive or the buffer",
+            (long long) ze.offset);
+        return false;
+    }
+    const uint8_t* data = archive + ze.offset;
+
+    if (ze.method == ZipFileRO::kCompressStored) {
+        memcpy(buffer, data, ze.uncompressed_length);
+        return true;
+    }
+    if (ze.method != ZipFileRO::kCompressDeflated) {
+        ALOGW("Zip: unknown compression method %d", ze.method);
+        return false;
+    }
+    if (ze.uncompressed_length == 0) {
+        return true;
+    }
+
+    z_stream zstream;
+    memset(&zstream, 0, sizeof(zstream));
+    zstream.next_in = (Bytef*) data;
+    zstream.avail_in = dataLen;
+    zstream.next_out = (Bytef*) buffer;
+    zstream.avail_out = ze.uncompressed_length;
+
+    // Raw deflate, with no zlib header.
+    int zerr = inflateInit2(&zstream, -MAX_WBITS);
+    if (zerr != Z_OK) {
+        ALOGW("Zip: inflateInit2 failed (%d)", zerr);
+        return false;
+    }
+    zerr = inflate(&zstream, Z_FINISH);
+    const bool ok = zerr == Z_STREAM_END
+            && zstream.total_out == ze.uncompressed_length;
+    if (!ok) {
+        ALOGW("Zip: inflate of entry at %lld failed (zerr=%d, %lu of %u bytes)",
+            (long long) ze.offset, zerr, zstream.total_out, ze.uncompressed_length);
+    }
+    inflateEnd(&zstream);
+    return ok;
+}
+
+/*
+ * Check uncompressed entry data against the CRC in the central directory.
+ */
+static bool crcMatches(const ZipEntry& ze, const void* buffer)
+{
+    const uint8_t* data = (const uint8_t*) buffer;
+    uLong crc = crc32(0L, Z_NULL, 0);
+    for (uint32_t left = ze.uncompressed_length; left > 0; ) {
+        const uInt n = left < (1U << 30) ? left : (1U << 30);
+        crc = crc32(crc, data, n);
+        data += n;
+        left -= n;
+    }
+    if (crc != ze.crc32) {
+        ALOGW("Zip: CRC of entry at %lld is %08lx, not %08x",
+            (long long) ze.offset, (unsigned long) crc, ze.crc32);
+        return false;
+    }
+    return true;
+}
+
+namespace {
+
+struct Batch {
+    const uint8_t* archive;
+    size_t archiveLen;
+    ZipFileRO::Extraction* entries;
+    size_t count;
+    bool checkCrc;
+    volatile int32_t next;
+};
+
+/*
+ * Takes the next entry of the batch until there are none left, so that a
+ * few large entries don't leave the other threads idle.
+ */
+void uncompressBatch(Batch* batch)
+{
+    for (;;) {
+        const size_t i = (size_t) android_atomic_inc(&batch->next);
+        if (i >= batch->count) {
+            return;
+        }
+        ZipFileRO::Extraction& e = batch->entries[i];
+        const _ZipEntryRO* zipEntry = reinterpret_cast<_ZipEntryRO*>(e.entry);
+        e.ok = zipEntry != NULL && uncompressMappedEntry(batch->archive,
+            batch->archiveLen, zipEntry->entry, e.buffer, e.size)
+            && (!batch->checkCrc || crcMatches(zipEntry->entry, e.buffer));
+    }
+}
+
+class UncompressThread : public Thread {
+public:
+    UncompressThread(Batch* batch) : Thread(false), mBatch(batch) {}
+
+private:
+    virtual bool threadLoop()
+    {
+        uncompressBatch(mBatch);
+        return false;
+    }
+
+    Batch* mBatch;
+};
+
+} // namespace
+
+/*
+ * Uncompress a list of entries from a single mapping of the archive.
+ *
+ * libziparchive reads an entry by seeking the archive's descriptor, so
+ * only the mapped path may be shared among threads.
+ */
+size_t ZipFileRO::uncompressEntries(Extraction* entries, size_t count,
+    size_t numThreads, bool checkCrc) const
+{
+    FileMap* map = NULL;
+    const int fd = GetFileDescriptor(mHandle);
+    struct stat st;
+    if (count > 0 && fstat(fd, &st) == 0 && st.st_size > 0
+            && (uint64_t) st.st_size <= (uint64_t) SIZE_MAX) {
+        map = new FileMap();
+        if (!map->create(mFileName, fd, 0, (size_t) st.st_size, true)) {
+            delete map;
+            map = NULL;
+        }
+    }
+
+    if (map == NULL) {
+        for (size_t i = 0; i < count; i++) {
+            const _ZipEntryRO* zipEntry = reinterpret_cast<_ZipEntryRO*>(entries[i].entry);
+            entries[i].ok = zipEntry != NULL
+                && uncompressEntry(entries[i].entry, entries[i].buffer, entries[i].size)
+                && (!checkCrc || crcMatches(zipEntry->entry, entries[i].buffer));
+        }
+    } else {
+        Batch batch;
+        batch.archive = (const uint8_t*) map->getDataPtr();
+        batch.archiveLen = map->getDataLength();
+        batch.entries = entries;
+        batch.count = count;
+        batch.checkCrc = checkCrc;
+        batch.next = 0;
+
+        if (numThreads > count) {
+            numThreads = count;
+        }
+        Vector<sp<UncompressThread> > threads;
+        for (size_t i = 1; i < numThreads; i++) {
+            sp<UncompressThread> thread = new UncompressThread(&batch);
+            if (thread->run("zipro", PRIORITY_NORMAL) == NO_ERROR) {
+                threads.add(thread);
+            }
+        }
+        // This thread takes its share too, and all of them if no others
+        // could be started.
+        uncompressBatch(&batch);
+        for (size_t i = 0; i < threads.size(); i++) {
+            threads[i]->join();
+        }
+        delete map;
+    }
+
+    size_t failed = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!entries[i].ok) {
+            failed++;
+        }
+    }
+    return failed;
+}
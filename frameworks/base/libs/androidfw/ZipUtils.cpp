@@ -22,6 +22,7 @@
 
 #include <androidfw/ZipUtils.h>
 #include <androidfw/ZipFileRO.h>
+#include <cutils/threads.h>
 #include <utils/Log.h>
 #include <utils/Compat.h>
 
@@ -40,6 +41,64 @@ static inline unsigned long get4LE(const unsigned char* buf) {
 
 static const unsigned long kReadBufSize = 32768;
 
+/*
+ * The raw inflate stream the last inflateToBuffer() on this thread left
+ * for the next, which only has to reset it rather than have zlib set up
+ * its state and window again for every entry.
+ */
+static thread_store_t gIdleInflater = THREAD_STORE_INITIALIZER;
+
+static void freeInflater(void* p)
+{
+    z_stream* zstream = static_cast<z_stream*>(p);
+    inflateEnd(zstream);
+    delete zstream;
+}
+
+/*
+ * Take this thread's idle inflate stream, reset, or set up a new one.
+ * Returns NULL, with the zlib error in "outErr", if that fails.
+ */
+static z_stream* acquireInflater(int* outErr)
+{
+    *outErr = Z_OK;
+    z_stream* zstream = static_cast<z_stream*>(thread_store_get(&gIdleInflater));
+    if (zstream != NULL) {
+        thread_store_set(&gIdleInflater, NULL, freeInflater);
+        if (inflateReset(zstream) == Z_OK) {
+            return zstream;
+        }
+        freeInflater(zstream);
+    }
+
+    zstream = new z_stream;
+    memset(zstream, 0, sizeof(*zstream));
+    zstream->zalloc = Z_NULL;
+    zstream->zfree = Z_NULL;
+    zstream->opaque = Z_NULL;
+    zstream->data_type = Z_UNKNOWN;
+
+    /*
+     * Use the undocumented "negative window bits" feature to tell zlib
+     * that there's no zlib header waiting for it.
+     */
+    *outErr = inflateInit2(zstream, -MAX_WBITS);
+    if (*outErr != Z_OK) {
+        delete zstream;
+        return NULL;
+    }
+    return zstream;
+}
+
+static void releaseInflater(z_stream* zstream)
+{
+    if (thread_store_get(&gIdleInflater) == NULL) {
+        thread_store_set(&gIdleInflater, zstream, freeInflater);
+    } else {
+        freeInflater(zstream);
+    }
+}
+
 /*
  * Utility function that expands zip/gzip "deflate" compressed data
  * into a buffer.
@@ -56,7 +115,7 @@ static const unsigned long kReadBufSize = 32768;
 {
     bool result = false;
 
-    z_stream zstream;
+    z_stream* zstream;
     int zerr;
     unsigned long compRemaining;
 
@@ -66,24 +125,10 @@ static const unsigned long kReadBufSize = 32768;
     compRemaining = compressedLen;
 
     /*
-     * Initialize the zlib stream.
-     */
-    memset(&zstream, 0, sizeof(zstream));
-    zstream.zalloc = Z_NULL;
-    zstream.zfree = Z_NULL;
-    zstream.opaque = Z_NULL;
-    zstream.next_in = NULL;
-    zstream.avail_in = 0;
-    zstream.next_out = (Bytef*) buf;
-    zstream.avail_out = uncompressedLen;
-    zstream.data_type = Z_UNKNOWN;
-
-    /*
-     * Use the undocumented "negative window bits" feature to tell zlib
-     * that there's no zlib header waiting for it.
+     * Get this thread's zlib stream.
      */
-    zerr = inflateInit2(&zstream, -MAX_WBITS);
-    if (zerr != Z_OK) {
+    zstream = acquireInflater(&zerr);
+    if (zstream == NULL) {
         if (zerr == Z_VERSION_ERROR) {
             ALOGE("Installed zlib is not compatible with linked version (%s)\n",
                 ZLIB_VERSION);
@@ -92,6 +137,10 @@ static const unsigned long kReadBufSize = 32768;
         }
         goto bail;
     }
+    zstream->next_in = NULL;
+    zstream->avail_in = 0;
+    zstream->next_out = (Bytef*) buf;
+    zstream->avail_out = uncompressedLen;
 
     /*
      * Loop while we have data.
@@ -100,7 +149,7 @@ static const unsigned long kReadBufSize = 32768;
         unsigned long getSize;
 
         /* read as much as we can */
-        if (zstream.avail_in == 0) {
+        if (zstream->avail_in == 0) {
             getSize = (compRemaining > kReadBufSize) ?
                         kReadBufSize : compRemaining;
             ALOGV("+++ reading %ld bytes (%ld left)\n",
@@ -116,12 +165,16 @@ static const unsigned long kReadBufSize = 32768;
 
             compRemaining -= nextSize;
 
-            zstream.next_in = nextBuffer;
-            zstream.avail_in = nextSize;
+            zstream->next_in = nextBuffer;
+            zstream->avail_in = nextSize;
         }
 
-        /* uncompress the data */
-        zerr = inflate(&zstream, Z_NO_FLUSH);
+        /*
+         * Uncompress the data.  Once all of it has been read, Z_FINISH
+         * lets zlib inflate straight into "buf" without keeping a window
+         * of the output; buffers are read in one go, so one call does.
+         */
+        zerr = inflate(zstream, compRemaining == 0 ? Z_FINISH : Z_NO_FLUSH);
         if (zerr != Z_OK && zerr != Z_STREAM_END) {
             ALOGD("zlib inflate call failed (zerr=%d)\n", zerr);
             goto z_bail;
@@ -132,9 +185,9 @@ static const unsigned long kReadBufSize = 32768;
 
     assert(zerr == Z_STREAM_END);       /* other errors should've been caught */
 
-    if ((long) zstream.total_out != uncompressedLen) {
+    if ((long) zstream->total_out != uncompressedLen) {
         ALOGW("Size mismatch on inflated file (%ld vs %ld)\n",
-            zstream.total_out, uncompressedLen);
+            zstream->total_out, uncompressedLen);
         goto z_bail;
     }
 
@@ -142,7 +195,7 @@ static const unsigned long kReadBufSize = 32768;
     result = true;
 
 z_bail:
-    inflateEnd(&zstream);        /* free up any allocated structures */
+    releaseInflater(zstream);    /* kept for the next call */
 
 bail:
     return result;
@@ -21,6 +21,7 @@
 LOCAL_PATH:= $(call my-dir)
 
 testFiles := \
+    AssetManager_test.cpp \
     AttributeFinder_test.cpp \
     ByteBucketArray_test.cpp \
     Config_test.cpp \
@@ -28,6 +29,7 @@ testFiles := \
     Idmap_test.cpp \
     ResTable_test.cpp \
     Split_test.cpp \
+    StreamingZipInflater_test.cpp \
     TestHelpers.cpp \
     Theme_test.cpp \
     TypeWrappers_test.cpp \
@@ -77,6 +79,7 @@ LOCAL_SHARED_LIBRARIES := \
     libcutils \
     libutils \
     libui \
+    libz \
 
 include $(BUILD_NATIVE_TEST)
 endif # Not SDK_ONLY
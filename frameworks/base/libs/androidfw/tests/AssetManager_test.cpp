@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <androidfw/Asset.h>
+#include <androidfw/AssetManager.h>
+#include <utils/String8.h>
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace android {
+
+static void writeFile(const String8& path, const char* contents) {
+    FILE* fp = fopen(path.string(), "wb");
+    ASSERT_TRUE(fp != NULL);
+    fputs(contents, fp);
+    fclose(fp);
+}
+
+// Two loose asset paths, the second overlaying a file of the first.
+class AssetManagerTest : public testing::Test {
+protected:
+    virtual void SetUp() {
+        const char* dir = getenv("TMPDIR");
+        mBase = String8(dir != NULL ? dir : "/tmp");
+        mBase.appendFormat("/assetmanager_test_%d", (int) getpid());
+        mOne = mBase.appendPathCopy("one");
+        mTwo = mBase.appendPathCopy("two");
+        const char* dirs[] = { "", "/one", "/one/assets", "/two", "/two/assets",
+                "/two/assets/sub" };
+        for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+            ASSERT_EQ(0, mkdir((mBase + dirs[i]).string(), 0700));
+        }
+        writeFile(mOne.appendPathCopy("AndroidManifest.xml"), "manifest");
+        writeFile(mOne.appendPathCopy("assets/shared.txt"), "one");
+        writeFile(mOne.appendPathCopy("assets/only1.txt"), "only");
+        writeFile(mTwo.appendPathCopy("AndroidManifest.xml"), "manifest");
+        writeFile(mTwo.appendPathCopy("assets/shared.txt"), "two");
+        writeFile(mTwo.appendPathCopy("assets/sub/deep.txt"), "deep");
+    }
+
+    virtual void TearDown() {
+        const char* files[] = { "/one/AndroidManifest.xml", "/one/assets/shared.txt",
+                "/one/assets/only1.txt", "/one/assets/late.txt", "/two/AndroidManifest.xml",
+                "/two/assets/shared.txt", "/two/assets/sub/deep.txt" };
+        for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+            unlink((mBase + files[i]).string());
+        }
+        const char* dirs[] = { "/two/assets/sub", "/two/assets", "/two", "/one/assets",
+                "/one", "" };
+        for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+            rmdir((mBase + dirs[i]).string());
+        }
+    }
+
+    void addPaths(AssetManager* am) {
+        int32_t cookie;
+        ASSERT_TRUE(am->addAssetPath(mOne, &cookie));
+        ASSERT_EQ(1, cookie);
+        ASSERT_TRUE(am->addAssetPath(mTwo, &cookie));
+        ASSERT_EQ(2, cookie);
+    }
+
+    static String8 readAsset(Asset* asset) {
+        String8 contents;
+        if (asset != NULL) {
+            contents.setTo((const char*) asset->getBuffer(false), asset->getLength());
+            delete asset;
+        }
+        return contents;
+    }
+
+    void checkLookups(AssetManager::CacheMode mode) {
+        AssetManager am(mode);
+        addPaths(&am);
+
+        EXPECT_STREQ("two", readAsset(am.open("shared.txt", Asset::ACCESS_BUFFER)).string());
+        EXPECT_STREQ("only", readAsset(am.open("only1.txt", Asset::ACCESS_BUFFER)).string());
+        EXPECT_STREQ("deep", readAsset(am.open("sub//./deep.txt", Asset::ACCESS_BUFFER))
+                .string());
+        EXPECT_TRUE(am.open("missing.txt", Asset::ACCESS_BUFFER) == NULL);
+
+        int32_t cookie = 0;
+        delete am.openNonAsset("assets/only1.txt", Asset::ACCESS_BUFFER, &cookie);
+        EXPECT_EQ(1, cookie);
+        delete am.openNonAsset("assets/shared.txt", Asset::ACCESS_BUFFER, &cookie);
+        EXPECT_EQ(2, cookie);
+        EXPECT_TRUE(am.openNonAsset(2, "assets/only1.txt", Asset::ACCESS_BUFFER) == NULL);
+        EXPECT_STREQ("one", readAsset(am.openNonAsset(1, "assets/shared.txt",
+                Asset::ACCESS_BUFFER)).string());
+
+        EXPECT_EQ(kFileTypeRegular, am.getFileType("sub/deep.txt"));
+        EXPECT_EQ(kFileTypeNonexistent, am.getFileType("nosuchdir"));
+    }
+
+    String8 mBase;
+    String8 mOne;
+    String8 mTwo;
+};
+
+TEST_F(AssetManagerTest, LooksUpAssetsWithoutCache) {
+    checkLookups(AssetManager::CACHE_OFF);
+}
+
+TEST_F(AssetManagerTest, LooksUpAssetsInCache) {
+    checkLookups(AssetManager::CACHE_DEFER);
+
+    // Without the cache a loose directory opens as if it were a file.
+    AssetManager am(AssetManager::CACHE_DEFER);
+    addPaths(&am);
+    EXPECT_EQ(kFileTypeDirectory, am.getFileType("sub"));
+}
+
+TEST_F(AssetManagerTest, CacheSurvivesLocaleChange) {
+    AssetManager am(AssetManager::CACHE_DEFER);
+    addPaths(&am);
+    EXPECT_TRUE(am.open("late.txt", Asset::ACCESS_BUFFER) == NULL);
+
+    // A file added once the cache is loaded stays unseen until purge().
+    writeFile(mOne.appendPathCopy("assets/late.txt"), "late");
+    am.setLocale("fr");
+    am.setVendor("acme");
+    EXPECT_TRUE(am.open("late.txt", Asset::ACCESS_BUFFER) == NULL);
+    EXPECT_STREQ("two", readAsset(am.open("shared.txt", Asset::ACCESS_BUFFER)).string());
+
+    am.purge();
+    EXPECT_STREQ("late", readAsset(am.open("late.txt", Asset::ACCESS_BUFFER)).string());
+}
+
+} // namespace android
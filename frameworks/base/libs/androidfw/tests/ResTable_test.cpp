@@ -19,6 +19,7 @@
 #include <codecvt>
 #include <locale>
 #include <string>
+#include <vector>
 
 #include <utils/String8.h>
 #include <utils/String16.h>
@@ -66,6 +67,27 @@ TEST(ResTableTest, resourceNameIsResolved) {
     ASSERT_EQ(base::R::string::test1, resID);
 }
 
+TEST(ResTableTest, resourceNameIsReturnedAsUtf8) {
+    ResTable table;
+    ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len));
+
+    ResTable::resource_name8 name;
+    ASSERT_TRUE(table.getResourceName8(base::R::integer::number1, &name));
+    EXPECT_EQ(std::string("com.android.test.basic"), std::string(name.package, name.packageLen));
+    EXPECT_EQ(std::string("integer"), std::string(name.type, name.typeLen));
+    EXPECT_EQ(std::string("number1"), std::string(name.name, name.nameLen));
+    EXPECT_FALSE(table.getResourceName8(base::R::integer::number2 + 100, &name));
+
+    // Once indexed, getResourceName() gives the same name as UTF-8.
+    table.indexResourceNames();
+    ResTable::resource_name name16;
+    ASSERT_TRUE(table.getResourceName(base::R::string::test2, true, &name16));
+    ASSERT_TRUE(name16.name8 != NULL);
+    EXPECT_EQ(std::string("test2"), std::string(name16.name8, name16.nameLen));
+    ASSERT_TRUE(table.getResourceName(base::R::string::test2, false, &name16));
+    EXPECT_EQ(String16("test2"), String16(name16.name, name16.nameLen));
+}
+
 TEST(ResTableTest, noParentThemeIsAppliedCorrectly) {
     ResTable table;
     ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len));
@@ -106,6 +128,71 @@ TEST(ResTableTest, parentThemeIsAppliedCorrectly) {
     ASSERT_EQ(base::R::integer::number1, val.data);
 }
 
+TEST(ResTableTest, styleBagMergesParentInOrder) {
+    ResTable table;
+    ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len));
+
+    const ResTable::bag_entry* bag;
+    ssize_t count = table.lockBag(base::R::style::Theme2, &bag);
+    ASSERT_EQ(2, count);
+    EXPECT_LT(bag[0].map.name.ident, bag[1].map.name.ident);
+
+    const ResTable::bag_entry* found =
+            ResTable::findBagEntry(bag, count, base::R::attr::attr1);
+    ASSERT_TRUE(found != NULL);
+    EXPECT_EQ(uint32_t(300), found->map.value.data);
+
+    found = ResTable::findBagEntry(bag, count, base::R::attr::attr2);
+    ASSERT_TRUE(found != NULL);
+    EXPECT_EQ(base::R::integer::number1, found->map.value.data);
+
+    EXPECT_TRUE(ResTable::findBagEntry(bag, count, base::R::attr::attr2 + 1) == NULL);
+    table.unlockBag(bag);
+}
+
+TEST(ResTableTest, copiedThemeChangesIndependently) {
+    ResTable table;
+    ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len));
+
+    ResTable::Theme theme(table);
+    ASSERT_EQ(NO_ERROR, theme.applyStyle(base::R::style::Theme1));
+
+    ResTable::Theme copy(table);
+    ASSERT_EQ(NO_ERROR, copy.setTo(theme));
+    ASSERT_EQ(NO_ERROR, copy.applyStyle(base::R::style::Theme2, true));
+
+    Res_value val;
+    ASSERT_GE(copy.getAttribute(base::R::attr::attr1, &val), 0);
+    EXPECT_EQ(uint32_t(300), val.data);
+    ASSERT_GE(theme.getAttribute(base::R::attr::attr1, &val), 0);
+    EXPECT_EQ(uint32_t(100), val.data);
+}
+
+TEST(ResTableTest, themeResolvesAttributesAtOnce) {
+    ResTable table;
+    ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len));
+
+    ResTable::Theme theme(table);
+    ASSERT_EQ(NO_ERROR, theme.applyStyle(base::R::style::Theme1));
+
+    const uint32_t attrs[] = { base::R::attr::attr1, base::R::attr::attr2,
+                               base::R::attr::attr2 + 1 };
+    Res_value values[3];
+    ssize_t blocks[3];
+    EXPECT_EQ(size_t(2), theme.resolveAttributes(attrs, 3, values, blocks));
+
+    ASSERT_GE(blocks[0], 0);
+    EXPECT_EQ(Res_value::TYPE_INT_DEC, values[0].dataType);
+    EXPECT_EQ(uint32_t(100), values[0].data);
+
+    // attr2 refers to integer/number1, which is followed.
+    ASSERT_GE(blocks[1], 0);
+    EXPECT_EQ(Res_value::TYPE_INT_DEC, values[1].dataType);
+    EXPECT_EQ(uint32_t(200), values[1].data);
+
+    EXPECT_LT(blocks[2], 0);
+}
+
 TEST(ResTableTest, libraryThemeIsAppliedCorrectly) {
     ResTable table;
     ASSERT_EQ(NO_ERROR, table.add(lib_arsc, lib_arsc_len));
@@ -165,6 +252,167 @@ TEST(ResTableTest, resourcesStillAccessibleAfterParameterChange) {
     table.unlockBag(entry);
 }
 
+TEST(ResTableTest, frozenTableRefusesChanges) {
+    ResTable table;
+    ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len));
+    ASSERT_EQ(NO_ERROR, table.setFrozen(true));
+    EXPECT_TRUE(table.isFrozen());
+
+    EXPECT_EQ(INVALID_OPERATION, table.add(lib_arsc, lib_arsc_len));
+    EXPECT_EQ(size_t(1), table.getTableCount());
+
+    ResTable_config param;
+    memset(&param, 0, sizeof(param));
+    param.density = 320;
+    table.setParameters(&param);
+    table.getParameters(&param);
+    EXPECT_EQ(0, param.density);
+
+    ASSERT_EQ(NO_ERROR, table.setFrozen(false));
+    EXPECT_EQ(NO_ERROR, table.add(lib_arsc, lib_arsc_len));
+}
+
+TEST(ResTableTest, frozenTableResolvesBags) {
+    ResTable table;
+    ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len));
+    ASSERT_EQ(NO_ERROR, table.setFrozen(true));
+
+    // Built on the first lookup, then found again without building.
+    const ResTable::bag_entry* entry;
+    ssize_t count = table.lockBag(base::R::array::integerArray1, &entry);
+    ASSERT_GE(count, 0);
+    table.unlockBag(entry);
+
+    const ResTable::bag_entry* again;
+    EXPECT_EQ(count, table.lockBag(base::R::array::integerArray1, &again));
+    EXPECT_EQ(entry, again);
+    table.unlockBag(again);
+
+    // Bags with a parent are built through the parent's.
+    ResTable::Theme theme(table);
+    ASSERT_EQ(NO_ERROR, theme.applyStyle(base::R::style::Theme2));
+    Res_value val;
+    uint32_t specFlags = 0;
+    ASSERT_GE(theme.getAttribute(base::R::attr::attr1, &val, &specFlags), 0);
+    EXPECT_EQ(uint32_t(300), val.data);
+}
+
+TEST(ResTableTest, bagCacheCountsAndTrims) {
+    ResTable table;
+    ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len));
+
+    const ResTable::bag_entry* entry;
+    ssize_t count = table.lockBag(base::R::array::integerArray1, &entry);
+    ASSERT_GE(count, 0);
+    table.unlockBag(entry);
+    ASSERT_GE(table.lockBag(base::R::array::integerArray1, &entry), 0);
+    table.unlockBag(entry);
+
+    ResTable::BagCacheStats stats;
+    table.getBagCacheStats(&stats);
+    EXPECT_EQ(size_t(1), stats.bags);
+    EXPECT_GT(stats.bytes, size_t(0));
+    EXPECT_EQ(size_t(1), stats.hits);
+    EXPECT_EQ(size_t(1), stats.misses);
+
+    ASSERT_EQ(NO_ERROR, table.trimBagCache());
+    table.getBagCacheStats(&stats);
+    EXPECT_EQ(size_t(0), stats.bags);
+    EXPECT_EQ(size_t(0), stats.bytes);
+    EXPECT_EQ(size_t(1), stats.evictions);
+
+    // A dropped bag is computed again.
+    EXPECT_EQ(count, table.lockBag(base::R::array::integerArray1, &entry));
+    table.unlockBag(entry);
+    table.getBagCacheStats(&stats);
+    EXPECT_EQ(size_t(2), stats.misses);
+}
+
+TEST(ResTableTest, bagCacheLimitKeepsTheNewestBags) {
+    ResTable table;
+    ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len));
+    table.setBagCacheLimit(1);
+
+    // Theme2 is built through its parent, so both end up cached.
+    const ResTable::bag_entry* entry;
+    ASSERT_GE(table.lockBag(base::R::style::Theme2, &entry), 0);
+    table.unlockBag(entry);
+    ResTable::BagCacheStats stats;
+    table.getBagCacheStats(&stats);
+    EXPECT_EQ(size_t(2), stats.bags);
+
+    // Each lock drops what the last one left, keeping only its own bag.
+    ASSERT_GE(table.lockBag(base::R::array::integerArray1, &entry), 0);
+    table.unlockBag(entry);
+    table.getBagCacheStats(&stats);
+    EXPECT_EQ(size_t(1), stats.bags);
+    EXPECT_EQ(size_t(2), stats.evictions);
+
+    // Nothing is dropped from a frozen table.
+    ASSERT_EQ(NO_ERROR, table.setFrozen(true));
+    EXPECT_EQ(INVALID_OPERATION, table.trimBagCache());
+    ResTable::Theme theme(table);
+    ASSERT_EQ(NO_ERROR, theme.applyStyle(base::R::style::Theme2));
+    table.getBagCacheStats(&stats);
+    EXPECT_EQ(size_t(3), stats.bags);
+}
+
+TEST(ResTableTest, stringToValueClassifiesNumbers) {
+    ResTable table;
+    ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len));
+
+    Res_value val;
+    const String16 dimension("12dp");
+    ASSERT_TRUE(table.stringToValue(&val, NULL, dimension.string(), dimension.size(),
+            false, false));
+    EXPECT_EQ(Res_value::TYPE_DIMENSION, val.dataType);
+
+    // A unit alone is zero of it.
+    const String16 unit("dp");
+    ASSERT_TRUE(table.stringToValue(&val, NULL, unit.string(), unit.size(), false, false));
+    EXPECT_EQ(Res_value::TYPE_DIMENSION, val.dataType);
+
+    const String16 hex("0x1f");
+    ASSERT_TRUE(table.stringToValue(&val, NULL, hex.string(), hex.size(), false, false));
+    EXPECT_EQ(Res_value::TYPE_INT_HEX, val.dataType);
+    EXPECT_EQ(uint32_t(0x1f), val.data);
+
+    const String16 text("hello");
+    String16 str;
+    ASSERT_TRUE(table.stringToValue(&val, &str, text.string(), text.size(), false, false));
+    EXPECT_EQ(Res_value::TYPE_STRING, val.dataType);
+    EXPECT_EQ(text, str);
+}
+
+TEST(ResTableTest, expandedResourceRefPointsIntoTheRef) {
+    const String16 ref("@*android:drawable/icon");
+    const String16 defType("string");
+    const String16 defPackage("com.android.test.basic");
+    ResTable::resource_name name;
+    bool publicOnly = true;
+    ASSERT_TRUE(ResTable::expandResourceRef(ref.string(), ref.size(), &name,
+            &defType, &defPackage, NULL, &publicOnly));
+    EXPECT_FALSE(publicOnly);
+    EXPECT_EQ(ref.string() + 2, name.package);
+    EXPECT_EQ(String16("android"), String16(name.package, name.packageLen));
+    EXPECT_EQ(String16("drawable"), String16(name.type, name.typeLen));
+    EXPECT_EQ(String16("icon"), String16(name.name, name.nameLen));
+
+    const String16 bare("test1");
+    ASSERT_TRUE(ResTable::expandResourceRef(bare.string(), bare.size(), &name,
+            &defType, &defPackage, NULL, &publicOnly));
+    EXPECT_TRUE(publicOnly);
+    EXPECT_EQ(defPackage.string(), name.package);
+    EXPECT_EQ(defType.string(), name.type);
+    EXPECT_EQ(bare.string(), name.name);
+
+    const char* errorMsg = NULL;
+    const String16 empty("@android:string/");
+    EXPECT_FALSE(ResTable::expandResourceRef(empty.string(), empty.size(), &name,
+            NULL, NULL, &errorMsg));
+    EXPECT_STREQ("Resource id cannot be an empty string", errorMsg);
+}
+
 TEST(ResTableTest, resourceIsOverridenWithBetterConfig) {
     ResTable table;
     ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len));
@@ -189,6 +437,33 @@ TEST(ResTableTest, resourceIsOverridenWithBetterConfig) {
     ASSERT_EQ(uint32_t(400), val.data);
 }
 
+TEST(ResTableTest, repeatedLookupsFollowParameterChanges) {
+    ResTable table;
+    ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len));
+
+    ResTable_config param;
+    memset(&param, 0, sizeof(param));
+    param.language[0] = 's';
+    param.language[1] = 'v';
+    param.country[0] = 'S';
+    param.country[1] = 'E';
+    table.setParameters(&param);
+
+    // The second lookup finds the entry the first one picked.
+    Res_value val;
+    for (int i = 0; i < 2; i++) {
+        ASSERT_GE(table.getResource(base::R::integer::number1, &val, MAY_NOT_BE_BAG), 0);
+        ASSERT_EQ(uint32_t(400), val.data);
+    }
+
+    memset(&param, 0, sizeof(param));
+    table.setParameters(&param);
+    for (int i = 0; i < 2; i++) {
+        ASSERT_GE(table.getResource(base::R::integer::number1, &val, MAY_NOT_BE_BAG), 0);
+        ASSERT_EQ(uint32_t(200), val.data);
+    }
+}
+
 TEST(ResTableTest, emptyTableHasSensibleDefaults) {
     const int32_t assetCookie = 1;
 
@@ -282,4 +557,183 @@ TEST(ResTableTest, U16StringToInt) {
     testU16StringToInt(u"0x1ffffffff", 0U, false, true);
 }
 
+TEST(ResTableTest, dynamicRefTableMapsPackageIds) {
+    // A library table naming one shared library, built as package 0x02.
+    struct {
+        ResTable_lib_header header;
+        ResTable_lib_entry entry;
+    } lib;
+    memset(&lib, 0, sizeof(lib));
+    lib.header.header.type = htods(RES_TABLE_LIBRARY_TYPE);
+    lib.header.header.headerSize = htods(sizeof(lib.header));
+    lib.header.header.size = htodl(sizeof(lib));
+    lib.header.count = htodl(1);
+    lib.entry.packageId = htodl(0x02);
+    const String16 libName("com.android.test.lib");
+    for (size_t i = 0; i < libName.size(); i++) {
+        lib.entry.packageName[i] = htods(libName.string()[i]);
+    }
+
+    DynamicRefTable table(0x03);
+    ASSERT_EQ(NO_ERROR, table.load(&lib.header));
+    ASSERT_EQ(NO_ERROR, table.addMapping(libName, 0x05));
+
+    uint32_t id = 0x7f010000;
+    ASSERT_EQ(NO_ERROR, table.lookupResourceId(&id));
+    EXPECT_EQ(0x7f010000u, id);
+    id = 0x01010000;
+    ASSERT_EQ(NO_ERROR, table.lookupResourceId(&id));
+    EXPECT_EQ(0x01010000u, id);
+    id = 0x00020001;
+    ASSERT_EQ(NO_ERROR, table.lookupResourceId(&id));
+    EXPECT_EQ(0x03020001u, id);
+    id = 0x02010003;
+    ASSERT_EQ(NO_ERROR, table.lookupResourceId(&id));
+    EXPECT_EQ(0x05010003u, id);
+    id = 0x04010000;
+    EXPECT_NE(NO_ERROR, table.lookupResourceId(&id));
+
+    Res_value value;
+    value.dataType = Res_value::TYPE_DYNAMIC_REFERENCE;
+    value.data = 0x02010001;
+    ASSERT_EQ(NO_ERROR, table.lookupResourceValue(&value));
+    EXPECT_EQ(Res_value::TYPE_REFERENCE, value.dataType);
+    EXPECT_EQ(0x05010001u, value.data);
+}
+
+
+static bool containsConfig(const Vector<ResTable_config>& configs,
+        const ResTable_config& config) {
+    for (size_t i = 0; i < configs.size(); i++) {
+        if (configs[i].compare(config) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+TEST(ResTableTest, configurationsAreUniqueAndFollowAdds) {
+    ResTable table;
+    ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len));
+
+    Vector<ResTable_config> configs;
+    table.getConfigurations(&configs);
+    ASSERT_FALSE(configs.isEmpty());
+    for (size_t i = 0; i < configs.size(); i++) {
+        for (size_t j = i + 1; j < configs.size(); j++) {
+            EXPECT_NE(0, configs[i].compare(configs[j]));
+        }
+    }
+
+    // Asking again, or with some configs already given, adds nothing new.
+    Vector<ResTable_config> again;
+    again.add(configs[configs.size() - 1]);
+    table.getConfigurations(&again);
+    EXPECT_EQ(configs.size(), again.size());
+
+    ResTable libTable;
+    ASSERT_EQ(NO_ERROR, libTable.add(lib_arsc, lib_arsc_len));
+    Vector<ResTable_config> libConfigs;
+    libTable.getConfigurations(&libConfigs);
+
+    ASSERT_EQ(NO_ERROR, table.add(lib_arsc, lib_arsc_len));
+    Vector<ResTable_config> combined;
+    table.getConfigurations(&combined);
+    for (size_t i = 0; i < libConfigs.size(); i++) {
+        EXPECT_TRUE(containsConfig(combined, libConfigs[i]));
+    }
+    for (size_t i = 0; i < configs.size(); i++) {
+        EXPECT_TRUE(containsConfig(combined, configs[i]));
+    }
+
+    Vector<String8> locales;
+    table.getLocales(&locales);
+    for (size_t i = 0; i < locales.size(); i++) {
+        for (size_t j = i + 1; j < locales.size(); j++) {
+            EXPECT_NE(locales[i], locales[j]);
+        }
+    }
+}
+
+/**
+ * An asset over data it doesn't own, noting when it is deleted.
+ */
+class BorrowedAsset : public Asset {
+public:
+    BorrowedAsset(const void* data, size_t length, bool* deleted)
+        : mData(data), mLength(length), mDeleted(deleted) { }
+    virtual ~BorrowedAsset() { *mDeleted = true; }
+
+    virtual ssize_t read(void*, size_t) { return -1; }
+    virtual off64_t seek(off64_t, int) { return -1; }
+    virtual void close() { }
+    virtual const void* getBuffer(bool) { return mData; }
+    virtual off64_t getLength() const { return mLength; }
+    virtual off64_t getRemainingLength() const { return mLength; }
+    virtual int openFileDescriptor(off64_t*, off64_t*) const { return -1; }
+
+private:
+    const void* mData;
+    size_t mLength;
+    bool* mDeleted;
+};
+
+TEST(ResTableTest, ownedAssetIsUsedInPlace) {
+    bool deleted = false;
+    {
+        ResTable table;
+        ASSERT_EQ(NO_ERROR, table.addOwned(
+                new BorrowedAsset(basic_arsc, basic_arsc_len, &deleted), NULL));
+        EXPECT_TRUE(IsStringEqual(table, base::R::string::test1, "test1"));
+
+        // The string pool points into the asset's data rather than a copy.
+        const ResStringPool* pool = table.getTableStringBlock(0);
+        size_t len;
+        const uint8_t* p = (const uint8_t*) pool->string8At(0, &len);
+        if (p == NULL) {
+            p = (const uint8_t*) pool->stringAt(0, &len);
+        }
+        ASSERT_TRUE(p != NULL);
+        EXPECT_TRUE(p >= basic_arsc && p < basic_arsc + basic_arsc_len);
+        EXPECT_FALSE(deleted);
+    }
+    EXPECT_TRUE(deleted);
+
+    // One that can't be added is deleted at once.
+    deleted = false;
+    ResTable table;
+    EXPECT_NE(NO_ERROR, table.addOwned(new BorrowedAsset(basic_arsc, 4, &deleted), NULL));
+    EXPECT_TRUE(deleted);
+}
+
+TEST(ResTableTest, fullValidationAcceptsAValidTable) {
+    ResTable table;
+    table.setFullValidation(true);
+    ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len));
+    EXPECT_TRUE(IsStringEqual(table, base::R::string::test1, "test1"));
+}
+
+TEST(ResTableTest, fullValidationRejectsABadStringUpFront) {
+    // Point the first string of the table's pool past the end of the pool.
+    std::vector<uint8_t> data(basic_arsc, basic_arsc + basic_arsc_len);
+    const ResTable_header* header = reinterpret_cast<const ResTable_header*>(&data[0]);
+    ResStringPool_header* pool = reinterpret_cast<ResStringPool_header*>(
+            &data[dtohs(header->header.headerSize)]);
+    ASSERT_EQ(RES_STRING_POOL_TYPE, dtohs(pool->header.type));
+    ASSERT_LT(0u, dtohl(pool->stringCount));
+    uint32_t* entries = reinterpret_cast<uint32_t*>(
+            reinterpret_cast<uint8_t*>(pool) + dtohs(pool->header.headerSize));
+    entries[0] = htodl(dtohl(pool->header.size));
+
+    // Loaded as usual, the bad string is only found when it is read.
+    ResTable lazy;
+    ASSERT_EQ(NO_ERROR, lazy.add(&data[0], data.size()));
+    size_t len;
+    EXPECT_TRUE(lazy.getTableStringBlock(0)->stringAt(0, &len) == NULL);
+
+    ResTable full;
+    full.setFullValidation(true);
+    EXPECT_NE(NO_ERROR, full.add(&data[0], data.size()));
+}
+
 }
@@ -243,4 +243,26 @@ TEST(SplitFeatureTest, TestNewResourceIsAccessibleByName) {
                                                               package.string(), package.size()));
 }
 
+TEST(SplitFeatureTest, TestNameLookupSeesResourcesAddedLater) {
+    ResTable table;
+    ASSERT_EQ(NO_ERROR, table.add(basic_arsc, basic_arsc_len));
+
+    const String16 type("string");
+    const String16 package("com.android.test.basic");
+    const String16 name1("test1");
+    ASSERT_EQ(base::R::string::test1, table.identifierForName(name1.string(), name1.size(),
+                                                              type.string(), type.size(),
+                                                              package.string(), package.size()));
+
+    const String16 name3("test3");
+    ASSERT_EQ(0u, table.identifierForName(name3.string(), name3.size(),
+                                          type.string(), type.size(),
+                                          package.string(), package.size()));
+
+    ASSERT_EQ(NO_ERROR, table.add(feature_arsc, feature_arsc_len));
+    ASSERT_EQ(base::R::string::test3, table.identifierForName(name3.string(), name3.size(),
+                                                              type.string(), type.size(),
+                                                              package.string(), package.size()));
+}
+
 } // namespace
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <androidfw/StreamingZipInflater.h>
+#include <utils/FileMap.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace android {
+
+// Several checkpoints' worth of data that deflates, but not to nothing.
+static const size_t kDataSize = 3 * 1024 * 1024 + 123;
+static const size_t kInterval = 256 * 1024;
+
+class StreamingZipInflaterTest : public testing::Test {
+protected:
+    virtual void SetUp() {
+        mData.insertAt((uint8_t) 0, 0, kDataSize);
+        uint32_t seed = 1;
+        for (size_t i = 0; i < kDataSize; i++) {
+            seed = seed * 1103515245 + 12345;
+            mData.editItemAt(i) = (uint8_t) ('a' + (seed >> 16) % 8);
+        }
+
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        ASSERT_EQ(Z_OK, deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+                8, Z_DEFAULT_STRATEGY));
+        mDeflated.insertAt((uint8_t) 0, 0, deflateBound(&zs, kDataSize));
+        zs.next_in = (Bytef*) mData.array();
+        zs.avail_in = kDataSize;
+        zs.next_out = (Bytef*) mDeflated.editArray();
+        zs.avail_out = mDeflated.size();
+        ASSERT_EQ(Z_STREAM_END, deflate(&zs, Z_FINISH));
+        mDeflated.removeItemsAt(zs.total_out, mDeflated.size() - zs.total_out);
+        deflateEnd(&zs);
+
+        const char* dir = getenv("TMPDIR");
+        mPath = String8(dir != NULL ? dir : "/tmp");
+        mPath.appendFormat("/szipinf_test_%d", (int) getpid());
+        FILE* fp = fopen(mPath.string(), "wb");
+        ASSERT_TRUE(fp != NULL);
+        ASSERT_EQ(mDeflated.size(), fwrite(mDeflated.array(), 1, mDeflated.size(), fp));
+        fclose(fp);
+        mFd = open(mPath.string(), O_RDONLY);
+        ASSERT_GE(mFd, 0);
+    }
+
+    virtual void TearDown() {
+        close(mFd);
+        unlink(mPath.string());
+    }
+
+    // Seek to each of a few positions, out of order, and check what is read there.
+    void checkRandomAccess(StreamingZipInflater* inflater) {
+        const off64_t positions[] = {
+            kDataSize - 10, 5, 2 * kInterval + 7, kInterval - 1, kDataSize / 2, 0,
+            kDataSize - kInterval, 3 * kInterval,
+        };
+        uint8_t buf[1000];
+        for (size_t i = 0; i < sizeof(positions) / sizeof(positions[0]); i++) {
+            const off64_t pos = positions[i];
+            const size_t expected = kDataSize - pos < sizeof(buf) ? kDataSize - pos : sizeof(buf);
+            ASSERT_EQ(pos, inflater->seekAbsolute(pos));
+            ASSERT_EQ((ssize_t) expected, inflater->read(buf, sizeof(buf))) << "at " << pos;
+            EXPECT_EQ(0, memcmp(buf, mData.array() + pos, expected)) << "at " << pos;
+        }
+    }
+
+    Vector<uint8_t> mData;
+    Vector<uint8_t> mDeflated;
+    String8 mPath;
+    int mFd;
+};
+
+TEST_F(StreamingZipInflaterTest, SeeksInMappedDataWithCheckpoints) {
+    FileMap* map = new FileMap();
+    ASSERT_TRUE(map->create(mPath.string(), mFd, 0, mDeflated.size(), true));
+    StreamingZipInflater inflater(map, kDataSize);
+    inflater.setCheckpointInterval(kInterval);
+    checkRandomAccess(&inflater);
+    delete map;
+}
+
+TEST_F(StreamingZipInflaterTest, SeeksInFileDataWithCheckpoints) {
+    StreamingZipInflater inflater(mFd, 0, kDataSize, mDeflated.size());
+    inflater.setCheckpointInterval(kInterval);
+    checkRandomAccess(&inflater);
+}
+
+TEST_F(StreamingZipInflaterTest, SeeksWithoutCheckpoints) {
+    StreamingZipInflater inflater(mFd, 0, kDataSize, mDeflated.size());
+    checkRandomAccess(&inflater);
+}
+
+} // namespace android
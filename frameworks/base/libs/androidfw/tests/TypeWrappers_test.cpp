@@ -106,4 +106,88 @@ TEST(TypeVariantIteratorTest, shouldIterateOverTypeWithoutErrors) {
     free(data);
 }
 
+void* createSparseTypeData() {
+    ResTable_type t;
+    memset(&t, 0, sizeof(t));
+    t.header.type = RES_TABLE_TYPE_TYPE;
+    t.header.headerSize = sizeof(t);
+    t.id = 1;
+    t.flags = ResTable_type::FLAG_SPARSE;
+    t.entryCount = 2;
+
+    // Entries 1 and 4 of 6 are defined.
+    ResTable_sparseTypeEntry entries[2];
+    t.entriesStart = t.header.headerSize + sizeof(entries);
+
+    ResTable_entry e[2];
+    Res_value v[2];
+    memset(e, 0, sizeof(e));
+    memset(v, 0, sizeof(v));
+    for (int i = 0; i < 2; i++) {
+        entries[i].idx = i == 0 ? 1 : 4;
+        entries[i].offset = i * (sizeof(e[i]) + sizeof(v[i])) / 4;
+        e[i].size = sizeof(e[i]);
+        e[i].key.index = i;
+    }
+    t.header.size = t.entriesStart + sizeof(e) + sizeof(v);
+
+    uint8_t* data = (uint8_t*)malloc(t.header.size);
+    uint8_t* p = data;
+    memcpy(p, &t, sizeof(t));
+    p += sizeof(t);
+    memcpy(p, entries, sizeof(entries));
+    p += sizeof(entries);
+    for (int i = 0; i < 2; i++) {
+        memcpy(p, &e[i], sizeof(e[i]));
+        p += sizeof(e[i]);
+        memcpy(p, &v[i], sizeof(v[i]));
+        p += sizeof(v[i]);
+    }
+    return data;
+}
+
+TEST(TypeVariantIteratorTest, shouldIterateOverSparseType) {
+    ResTable_type* data = (ResTable_type*) createSparseTypeData();
+
+    TypeVariant v(data);
+
+    // Every index up to the last one defined is visited.
+    TypeVariant::iterator iter = v.beginEntries();
+    for (uint32_t i = 0; i < 5; i++, iter++) {
+        ASSERT_NE(v.endEntries(), iter);
+        ASSERT_EQ(i, iter.index());
+        if (i == 1) {
+            ASSERT_TRUE(NULL != *iter);
+            ASSERT_EQ(uint32_t(0), iter->key.index);
+        } else if (i == 4) {
+            ASSERT_TRUE(NULL != *iter);
+            ASSERT_EQ(uint32_t(1), iter->key.index);
+        } else {
+            ASSERT_TRUE(NULL == *iter);
+        }
+    }
+    ASSERT_EQ(v.endEntries(), iter);
+
+    free(data);
+}
+
+TEST(TypeVariantIteratorTest, shouldFindEntryOffsets) {
+    ResTable_type* dense = (ResTable_type*) createTypeData();
+    EXPECT_EQ(uint32_t(0), getTypeEntryOffset(dense, 0));
+    EXPECT_EQ(uint32_t(ResTable_type::NO_ENTRY), getTypeEntryOffset(dense, 1));
+    EXPECT_EQ(uint32_t(sizeof(ResTable_entry) + sizeof(Res_value)),
+              getTypeEntryOffset(dense, 2));
+    EXPECT_EQ(uint32_t(ResTable_type::NO_ENTRY), getTypeEntryOffset(dense, 3));
+    free(dense);
+
+    ResTable_type* sparse = (ResTable_type*) createSparseTypeData();
+    EXPECT_EQ(uint32_t(ResTable_type::NO_ENTRY), getTypeEntryOffset(sparse, 0));
+    EXPECT_EQ(uint32_t(0), getTypeEntryOffset(sparse, 1));
+    EXPECT_EQ(uint32_t(ResTable_type::NO_ENTRY), getTypeEntryOffset(sparse, 2));
+    EXPECT_EQ(uint32_t(sizeof(ResTable_entry) + sizeof(Res_value)),
+              getTypeEntryOffset(sparse, 4));
+    EXPECT_EQ(uint32_t(ResTable_type::NO_ENTRY), getTypeEntryOffset(sparse, 5));
+    free(sparse);
+}
+
 } // namespace android
@@ -22,6 +22,7 @@
 
 #include <fcntl.h>
 #include <string.h>
+#include <zlib.h>
 
 namespace android {
 
@@ -61,4 +62,34 @@ TEST_F(ZipUtilsTest, ZipTimeConvertSuccess) {
             << "Second was improperly converted.";
 }
 
+TEST_F(ZipUtilsTest, InflateToExactBuffer) {
+    unsigned char data[4096];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (unsigned char) (i % 251);
+    }
+
+    // Raw deflate, as stored in zip entries.
+    unsigned char compressed[8192];
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    ASSERT_EQ(Z_OK, deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED,
+            -MAX_WBITS, 8, Z_DEFAULT_STRATEGY));
+    zs.next_in = data;
+    zs.avail_in = sizeof(data);
+    zs.next_out = compressed;
+    zs.avail_out = sizeof(compressed);
+    ASSERT_EQ(Z_STREAM_END, deflate(&zs, Z_FINISH));
+    const long compressedLen = zs.total_out;
+    deflateEnd(&zs);
+
+    unsigned char out[sizeof(data)];
+    ASSERT_TRUE(ZipUtils::inflateToBuffer(compressed, out, sizeof(out),
+            compressedLen));
+    EXPECT_EQ(0, memcmp(data, out, sizeof(data)));
+
+    // Data that does not end where the caller says it should is rejected.
+    EXPECT_FALSE(ZipUtils::inflateToBuffer(compressed, out, sizeof(out) - 1,
+            compressedLen));
+}
+
 }
@@ -4,16 +4,31 @@
 
 #include "AaptAssets.h"
 #include "AaptConfig.h"
+#include "AaptContext.h"
 #include "AaptUtil.h"
+#include "CompileCache.h"
 #include "Main.h"
+#include "MappedFile.h"
 #include "ResourceFilter.h"
+#include "StartupProfile.h"
+#include "WorkQueue.h"
 
+#include <androidfw/ZipFileRO.h>
+#include <cutils/atomic.h>
 #include <utils/misc.h>
 #include <utils/SortedVector.h>
 
+#include <algorithm>
 #include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
 
 static const char* kAssetDir = "assets";
 static const char* kResourceDir = "res";
@@ -22,8 +37,6 @@ static const char* kMipmapDir = "mipmap";
 static const char* kInvalidChars = "/\\:";
 static const size_t kMaxAssetFileName = 100;
 
-static const String8 kResString(kResourceDir);
-
 /*
  * Names of asset files must meet the following criteria:
  *
@@ -59,10 +72,15 @@ static bool validateFileName(const char* fileName)
 // The default to use if no other ignore pattern is defined.
 const char * const gDefaultIgnoreAssets =
     "!.svn:!.git:!.ds_store:!*.scc:.*:<dir>_*:!CVS:!thumbs.db:!picasa.ini:!*~";
-// The ignore pattern that can be passed via --ignore-assets in Main.cpp
-const char * gUserIgnoreAssets = NULL;
 
-static bool isHidden(const char *root, const char *path)
+/*
+ * "type" is the type of "root"/"path" if it is already known; otherwise it
+ * is looked up only if one of the patterns needs it.  Unless "report" is
+ * set, ignored entries are skipped quietly.  Safe to call from several
+ * threads at once.
+ */
+static bool isHidden(const char *root, const char *path,
+        FileType type = kFileTypeUnknown, bool report = true)
 {
     // Patterns syntax:
     // - Delimiter is :
@@ -82,7 +100,8 @@ static bool isHidden(const char *root, const char *path)
     }
 
     const char *delim = ":";
-    const char *p = gUserIgnoreAssets;
+    // The run's --ignore-assets, which handleCommand() put in its context.
+    const char *p = AaptContext::current()->getIgnoreAssets();
     if (!p || !p[0]) {
         p = getenv("ANDROID_AAPT_IGNORE");
     }
@@ -95,18 +114,26 @@ static bool isHidden(const char *root, const char *path)
     bool chatty = true;
     char *matchedPattern = NULL;
 
-    String8 fullPath(root);
-    fullPath.appendPath(path);
-    FileType type = getFileType(fullPath);
-
     int plen = strlen(path);
 
-    // Note: we don't have strtok_r under mingw.
-    for(char *token = strtok(patterns, delim);
-            !ignore && token != NULL;
-            token = strtok(NULL, delim)) {
+    // Note: we don't have strtok_r under mingw, and strtok() isn't
+    // reentrant, so split on the delimiter by hand.
+    char *next = patterns;
+    while (!ignore && next != NULL) {
+        char *token = next;
+        next = strpbrk(next, delim);
+        if (next != NULL) *next++ = '\0';
+        if (token[0] == '\0') continue;
+
         chatty = token[0] != '!';
         if (!chatty) token++; // skip !
+        if (strncasecmp(token, "<dir>" , 5) == 0 || strncasecmp(token, "<file>", 6) == 0) {
+            if (type == kFileTypeUnknown) {
+                String8 fullPath(root);
+                fullPath.appendPath(path);
+                type = getFileType(fullPath);
+            }
+        }
         if (strncasecmp(token, "<dir>" , 5) == 0) {
             if (type != kFileTypeDirectory) continue;
             token += 5;
@@ -134,7 +161,12 @@ static bool isHidden(const char *root, const char *path)
         }
     }
 
-    if (ignore && chatty) {
+    if (ignore && chatty && report) {
+        if (type == kFileTypeUnknown) {
+            String8 fullPath(root);
+            fullPath.appendPath(path);
+            type = getFileType(fullPath);
+        }
         fprintf(stderr, "    (skipping %s '%s' due to ANDROID_AAPT_IGNORE pattern '%s')\n",
                 type == kFileTypeDirectory ? "dir" : "file",
                 path,
@@ -463,8 +495,100 @@ AaptGroupEntry::toDirName(const String8& resType) const
 // =========================================================================
 // =========================================================================
 
+static volatile int32_t gSpoolCounter = 0;
+
+AaptFile::~AaptFile()
+{
+    free(mData);
+    delete mSpool;
+    if (mSpoolPath.length() > 0) {
+        ::remove(mSpoolPath.string());
+    }
+}
+
+const void* AaptFile::getData() const
+{
+    return mSpool != NULL ? mSpool->getData() : mData;
+}
+
+status_t AaptFile::spoolData(const char* dir)
+{
+    if (mData == NULL || mDataSize == 0) {
+        return NO_ERROR;
+    }
+
+    String8 path(dir);
+#ifdef _WIN32
+    path.appendPath(String8::format("aapt-spool.%d.%d", _getpid(),
+            android_atomic_inc(&gSpoolCounter)));
+#else
+    path.appendPath(String8::format("aapt-spool.%d.%d", getpid(),
+            android_atomic_inc(&gSpoolCounter)));
+#endif
+    FILE* fp = fopen(path.string(), "wb");
+    if (fp == NULL) {
+        return UNKNOWN_ERROR;
+    }
+    bool ok = fwrite(mData, 1, mDataSize, fp) == mDataSize;
+    ok = (fclose(fp) == 0) && ok;
+    MappedFile* spool = NULL;
+    if (ok) {
+        spool = new MappedFile();
+        if (spool->open(path.string()) != NO_ERROR || spool->getSize() != mDataSize) {
+            delete spool;
+            spool = NULL;
+        }
+    }
+    if (spool == NULL) {
+        ::remove(path.string());
+        return UNKNOWN_ERROR;
+    }
+
+#ifdef _WIN32
+    // A mapped file can't be removed here until the mapping is gone.
+    mSpoolPath = path;
+#else
+    ::remove(path.string());
+#endif
+    free(mData);
+    mData = NULL;
+    mBufferSize = 0;
+    mDataAccount.set(0);
+    mSpool = spool;
+    return NO_ERROR;
+}
+
+/*
+ * Copies spooled data back into the heap so that it can be edited.
+ * Returns false if there is no memory for it.
+ */
+bool AaptFile::unspoolData()
+{
+    if (mSpool == NULL) {
+        return true;
+    }
+    void* buf = malloc(mDataSize);
+    if (buf == NULL) {
+        return false;
+    }
+    memcpy(buf, mSpool->getData(), mDataSize);
+    delete mSpool;
+    mSpool = NULL;
+    if (mSpoolPath.length() > 0) {
+        ::remove(mSpoolPath.string());
+        mSpoolPath = String8();
+    }
+    mData = buf;
+    mBufferSize = mDataSize;
+    mDataAccount.set(mDataSize);
+    return true;
+}
+
 void* AaptFile::editData(size_t size)
 {
+    if (!unspoolData()) {
+        return NULL;
+    }
     if (size <= mBufferSize) {
         mDataSize = size;
         return mData;
@@ -477,9 +601,28 @@ void* AaptFile::editData(size_t size)
     mData = buf;
     mDataSize = size;
     mBufferSize = allocSize;
+    mDataAccount.set(allocSize);
     return buf;
 }
 
+status_t AaptFile::reserveData(size_t size)
+{
+    if (!unspoolData()) {
+        return NO_MEMORY;
+    }
+    if (size <= mBufferSize) {
+        return NO_ERROR;
+    }
+    void* buf = realloc(mData, size);
+    if (buf == NULL) {
+        return NO_MEMORY;
+    }
+    mData = buf;
+    mBufferSize = size;
+    mDataAccount.set(size);
+    return NO_ERROR;
+}
+
 void* AaptFile::editDataInRange(size_t offset, size_t size)
 {
     return (void*)(((uint8_t*) editData(offset + size)) + offset);
@@ -487,6 +630,9 @@ void* AaptFile::editDataInRange(size_t offset, size_t size)
 
 void* AaptFile::editData(size_t* outSize)
 {
+    if (!unspoolData()) {
+        return NULL;
+    }
     if (outSize) {
         *outSize = mDataSize;
     }
@@ -495,6 +641,9 @@ void* AaptFile::editData(size_t* outSize)
 
 void* AaptFile::padData(size_t wordSize)
 {
+    if (!unspoolData()) {
+        return NULL;
+    }
     const size_t extra = mDataSize%wordSize;
     if (extra == 0) {
         return mData;
@@ -522,10 +671,30 @@ status_t AaptFile::writeData(const void* data, size_t size)
 
 void AaptFile::clearData()
 {
+    delete mSpool;
+    mSpool = NULL;
+    if (mSpoolPath.length() > 0) {
+        ::remove(mSpoolPath.string());
+        mSpoolPath = String8();
+    }
     if (mData != NULL) free(mData);
     mData = NULL;
     mDataSize = 0;
     mBufferSize = 0;
+    mDataAccount.set(0);
+}
+
+void* AaptFile::releaseData()
+{
+    if (!unspoolData()) {
+        return NULL;
+    }
+    void* data = mData;
+    mData = NULL;
+    mDataSize = 0;
+    mBufferSize = 0;
+    mDataAccount.set(0);
+    return data;
 }
 
 String8 AaptFile::getPrintableSource() const
@@ -676,42 +845,196 @@ status_t AaptDir::addLeafFile(const String8& leafName, const sp<AaptFile>& file,
     return group->addFile(file, overwrite);
 }
 
-ssize_t AaptDir::slurpFullTree(Bundle* bundle, const String8& srcDir,
-                            const AaptGroupEntry& kind, const String8& resType,
-                            sp<FilePathStore>& fullResPaths, const bool overwrite)
+// =========================================================================
+// =========================================================================
+// =========================================================================
+
+/*
+ * A directory as read by scanTree(): the names of its entries, in order,
+ * and what each of them is, so that building the AaptDir tree from it
+ * doesn't go back to the disk.  Subdirectories that are not hidden have
+ * been read as well.
+ */
+struct ScannedDir {
+    struct Entry {
+        Entry() : type(kFileTypeUnknown), dir(NULL) { }
+
+        bool operator<(const Entry& other) const {
+            return strcmp(name.string(), other.name.string()) < 0;
+        }
+
+        String8 name;
+        FileType type;
+        ScannedDir* dir;
+    };
+
+    ScannedDir() : openErrno(0) { }
+    ~ScannedDir() {
+        for (size_t i = 0; i < entries.size(); i++) {
+            delete entries[i].dir;
+        }
+    }
+
+    int openErrno;          // set if opendir() failed
+    Vector<Entry> entries;
+};
+
+/*
+ * The type of "entry" in "dir", which is "dirPath".  The entry's d_type
+ * answers for most of them; the rest, symlinks among them, are looked up
+ * relative to the open directory, which follows symlinks as getFileType()
+ * does.
+ */
+static FileType direntType(DIR* dir, const struct dirent* entry, const String8& dirPath)
 {
-    Vector<String8> fileNames;
-    {
-        DIR* dir = NULL;
+#ifndef _WIN32
+    if (entry->d_type == DT_DIR) {
+        return kFileTypeDirectory;
+    } else if (entry->d_type == DT_REG) {
+        return kFileTypeRegular;
+    }
+
+    struct stat sb;
+    if (fstatat(dirfd(dir), entry->d_name, &sb, 0) < 0) {
+        return kFileTypeNonexistent;
+    }
+    if (S_ISREG(sb.st_mode)) {
+        return kFileTypeRegular;
+    } else if (S_ISDIR(sb.st_mode)) {
+        return kFileTypeDirectory;
+    }
+    return kFileTypeUnknown;
+#else
+    (void) dir;
+    String8 path(dirPath);
+    path.appendPath(entry->d_name);
+    return getFileType(path.string());
+#endif
+}
 
-        dir = opendir(srcDir.string());
-        if (dir == NULL) {
-            fprintf(stderr, "ERROR: opendir(%s): %s\n", srcDir.string(), strerror(errno));
-            return UNKNOWN_ERROR;
+static void scanDir(const String8& path, ScannedDir* out)
+{
+    DIR* dir = opendir(path.string());
+    if (dir == NULL) {
+        out->openErrno = errno;
+        return;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
         }
+        ScannedDir::Entry e;
+        e.name = entry->d_name;
+        e.type = direntType(dir, entry, path);
+        out->entries.add(e);
+    }
+    closedir(dir);
 
-        /*
-         * Slurp the filenames out of the directory.
-         */
-        while (1) {
-            struct dirent* entry;
+    // readdir() order depends on the filesystem; keep the build's independent of it.
+    std::sort(out->entries.editArray(), out->entries.editArray() + out->entries.size());
+}
 
-            entry = readdir(dir);
-            if (entry == NULL)
-                break;
+class ScanDirWorkUnit : public WorkQueue::WorkUnit {
+public:
+    ScanDirWorkUnit(const String8& path, ScannedDir* out) : mPath(path), mOut(out) { }
 
-            if (isHidden(srcDir.string(), entry->d_name))
-                continue;
+    virtual bool run() {
+        scanDir(mPath, mOut);
+        return true;
+    }
+
+private:
+    String8 mPath;
+    ScannedDir* mOut;
+};
+
+/*
+ * Read the tree at "path" into "root".  It is read a level at a time, and
+ * the directories of a level are read on up to bundle->getJobs() threads,
+ * since on network and container filesystems each one is a round trip.
+ */
+static void scanTree(Bundle* bundle, const String8& path, ScannedDir* root)
+{
+    const int jobs = bundle->getJobs();
+    Vector<ScannedDir*> level;
+    Vector<String8> levelPaths;
+
+    level.add(root);
+    levelPaths.add(path);
+    while (!level.isEmpty()) {
+        const size_t N = level.size();
+        if (N > 1 && jobs > 1) {
+            WorkQueue::Group group(WorkQueue::getShared());
+            for (size_t i = 0; i < N; i++) {
+                ScanDirWorkUnit* w = new ScanDirWorkUnit(levelPaths[i], level[i]);
+                if (group.schedule(w, 0) != NO_ERROR) {
+                    w->run();
+                    delete w;
+                }
+            }
+            group.wait();
+        } else {
+            for (size_t i = 0; i < N; i++) {
+                scanDir(levelPaths[i], level[i]);
+            }
+        }
 
-            String8 name(entry->d_name);
-            fileNames.add(name);
-            // Add fully qualified path for dependency purposes
-            // if we're collecting them
-            if (fullResPaths != NULL) {
-                fullResPaths->add(srcDir.appendPathCopy(name));
+        Vector<ScannedDir*> nextLevel;
+        Vector<String8> nextPaths;
+        for (size_t i = 0; i < N; i++) {
+            Vector<ScannedDir::Entry>& entries = level[i]->entries;
+            for (size_t j = 0; j < entries.size(); j++) {
+                ScannedDir::Entry& e = entries.editItemAt(j);
+                if (e.type != kFileTypeDirectory
+                        || isHidden(levelPaths[i].string(), e.name.string(), e.type, false)) {
+                    continue;
+                }
+                e.dir = new ScannedDir;
+                nextLevel.add(e.dir);
+                nextPaths.add(levelPaths[i].appendPathCopy(e.name));
             }
         }
-        closedir(dir);
+        level = nextLevel;
+        levelPaths = nextPaths;
+    }
+}
+
+ssize_t AaptDir::slurpFullTree(Bundle* bundle, const String8& srcDir,
+                            const AaptGroupEntry& kind, const String8& resType,
+                            sp<FilePathStore>& fullResPaths, const bool overwrite)
+{
+    ScannedDir scanned;
+    scanTree(bundle, srcDir, &scanned);
+    return addScannedTree(bundle, scanned, srcDir, kind, resType, fullResPaths, overwrite);
+}
+
+ssize_t AaptDir::addScannedTree(Bundle* bundle, const ScannedDir& scanned,
+                            const String8& srcDir, const AaptGroupEntry& kind,
+                            const String8& resType, sp<FilePathStore>& fullResPaths,
+                            const bool overwrite)
+{
+    if (scanned.openErrno != 0) {
+        fprintf(stderr, "ERROR: opendir(%s): %s\n", srcDir.string(),
+                strerror(scanned.openErrno));
+        return UNKNOWN_ERROR;
+    }
+
+    Vector<const ScannedDir::Entry*> entries;
+    const size_t N = scanned.entries.size();
+    size_t i;
+    for (i = 0; i < N; i++) {
+        const ScannedDir::Entry& e = scanned.entries[i];
+        if (isHidden(srcDir.string(), e.name.string(), e.type))
+            continue;
+
+        entries.add(&e);
+        // Add fully qualified path for dependency purposes
+        // if we're collecting them
+        if (fullResPaths != NULL) {
+            fullResPaths->add(srcDir.appendPathCopy(e.name));
+        }
     }
 
     ssize_t count = 0;
@@ -719,35 +1042,32 @@ ssize_t AaptDir::slurpFullTree(Bundle* bundle, const String8& srcDir,
     /*
      * Stash away the files and recursively descend into subdirectories.
      */
-    const size_t N = fileNames.size();
-    size_t i;
-    for (i = 0; i < N; i++) {
-        String8 pathName(srcDir);
-        FileType type;
+    for (i = 0; i < entries.size(); i++) {
+        const ScannedDir::Entry& e = *entries[i];
 
-        pathName.appendPath(fileNames[i].string());
-        type = getFileType(pathName.string());
-        if (type == kFileTypeDirectory) {
+        String8 pathName(srcDir);
+        pathName.appendPath(e.name.string());
+        if (e.type == kFileTypeDirectory) {
             sp<AaptDir> subdir;
             bool notAdded = false;
-            if (mDirs.indexOfKey(fileNames[i]) >= 0) {
-                subdir = mDirs.valueFor(fileNames[i]);
+            if (mDirs.indexOfKey(e.name) >= 0) {
+                subdir = mDirs.valueFor(e.name);
             } else {
-                subdir = new AaptDir(fileNames[i], mPath.appendPathCopy(fileNames[i]));
+                subdir = new AaptDir(e.name, mPath.appendPathCopy(e.name));
                 notAdded = true;
             }
-            ssize_t res = subdir->slurpFullTree(bundle, pathName, kind,
-                                                resType, fullResPaths, overwrite);
+            ssize_t res = subdir->addScannedTree(bundle, *e.dir, pathName, kind,
+                                                 resType, fullResPaths, overwrite);
             if (res < NO_ERROR) {
                 return res;
             }
             if (res > 0 && notAdded) {
-                mDirs.add(fileNames[i], subdir);
+                mDirs.add(e.name, subdir);
             }
             count += res;
-        } else if (type == kFileTypeRegular) {
+        } else if (e.type == kFileTypeRegular) {
             sp<AaptFile> file = new AaptFile(pathName, kind, resType);
-            status_t err = addLeafFile(fileNames[i], file, overwrite);
+            status_t err = addLeafFile(e.name, file, overwrite);
             if (err != NO_ERROR) {
                 return err;
             }
@@ -900,6 +1220,43 @@ status_t AaptSymbols::applyJavaSymbols(const sp<AaptSymbols>& javaSymbols)
     return err;
 }
 
+void AaptSymbols::sortByName()
+{
+    SortedVector<String8> names;
+    size_t N = mSymbols.size();
+    names.setCapacity(N);
+    for (size_t i=0; i<N; i++) {
+        names.add(mSymbols.keyAt(i));
+    }
+    Vector<AaptSymbolEntry> entries;
+    entries.setCapacity(N);
+    for (size_t i=0; i<N; i++) {
+        entries.add(mSymbols.valueFor(names[i]));
+    }
+    mSymbols.clear();
+    mSymbols.setCapacity(N);
+    for (size_t i=0; i<N; i++) {
+        mSymbols.add(names[i], entries[i]);
+    }
+
+    names.clear();
+    N = mNestedSymbols.size();
+    for (size_t i=0; i<N; i++) {
+        names.add(mNestedSymbols.keyAt(i));
+    }
+    Vector<sp<AaptSymbols> > nested;
+    nested.setCapacity(N);
+    for (size_t i=0; i<N; i++) {
+        nested.add(mNestedSymbols.valueFor(names[i]));
+    }
+    mNestedSymbols.clear();
+    mNestedSymbols.setCapacity(N);
+    for (size_t i=0; i<N; i++) {
+        mNestedSymbols.add(names[i], nested[i]);
+        nested[i]->sortByName();
+    }
+}
+
 // =========================================================================
 // =========================================================================
 // =========================================================================
@@ -910,6 +1267,11 @@ AaptAssets::AaptAssets()
       mChanged(false), mHaveIncludedAssets(false),
       mRes(NULL) {}
 
+AaptAssets::~AaptAssets()
+{
+    delete mRes;
+}
+
 const SortedVector<AaptGroupEntry>& AaptAssets::getGroupEntries() const {
     if (mChanged) {
     }
@@ -978,7 +1340,8 @@ sp<AaptFile> AaptAssets::addFile(
 void AaptAssets::addResource(const String8& leafName, const String8& path,
                 const sp<AaptFile>& file, const String8& resType)
 {
-    sp<AaptDir> res = AaptDir::makeDir(kResString);
+    static const String8 resDir(kResourceDir);
+    sp<AaptDir> res = AaptDir::makeDir(resDir);
     String8 dirname = file->getGroupEntry().toDirName(resType);
     sp<AaptDir> subdir = res->makeDir(dirname);
     sp<AaptGroup> grr = new AaptGroup(leafName, path);
@@ -1155,9 +1518,11 @@ ssize_t AaptAssets::slurpResourceTree(Bundle* bundle, const String8& srcDir)
 {
     ssize_t err = 0;
 
-    DIR* dir = opendir(srcDir.string());
-    if (dir == NULL) {
-        fprintf(stderr, "ERROR: opendir(%s): %s\n", srcDir.string(), strerror(errno));
+    ScannedDir scanned;
+    scanTree(bundle, srcDir, &scanned);
+    if (scanned.openErrno != 0) {
+        fprintf(stderr, "ERROR: opendir(%s): %s\n", srcDir.string(),
+                strerror(scanned.openErrno));
         return UNKNOWN_ERROR;
     }
 
@@ -1167,25 +1532,22 @@ ssize_t AaptAssets::slurpResourceTree(Bundle* bundle, const String8& srcDir)
      * Run through the directory, looking for dirs that match the
      * expected pattern.
      */
-    while (1) {
-        struct dirent* entry = readdir(dir);
-        if (entry == NULL) {
-            break;
-        }
-
-        if (isHidden(srcDir.string(), entry->d_name)) {
+    const size_t N = scanned.entries.size();
+    for (size_t i = 0; i < N; i++) {
+        const ScannedDir::Entry& entry = scanned.entries[i];
+        if (isHidden(srcDir.string(), entry.name.string(), entry.type)) {
             continue;
         }
 
         String8 subdirName(srcDir);
-        subdirName.appendPath(entry->d_name);
+        subdirName.appendPath(entry.name);
 
         AaptGroupEntry group;
         String8 resType;
-        bool b = group.initFromDirName(entry->d_name, &resType);
+        bool b = group.initFromDirName(entry.name.string(), &resType);
         if (!b) {
             fprintf(stderr, "invalid resource directory name: %s %s\n", srcDir.string(),
-                    entry->d_name);
+                    entry.name.string());
             err = -1;
             continue;
         }
@@ -1195,17 +1557,15 @@ ssize_t AaptAssets::slurpResourceTree(Bundle* bundle, const String8& srcDir)
             const char *verString = group.getVersionString().string();
             int dirVersionInt = atoi(verString + 1); // skip 'v' in version name
             if (dirVersionInt > maxResInt) {
-              fprintf(stderr, "max res %d, skipping %s\n", maxResInt, entry->d_name);
+              fprintf(stderr, "max res %d, skipping %s\n", maxResInt, entry.name.string());
               continue;
             }
         }
 
-        FileType type = getFileType(subdirName.string());
-
-        if (type == kFileTypeDirectory) {
+        if (entry.type == kFileTypeDirectory) {
             sp<AaptDir> dir = makeDir(resType);
-            ssize_t res = dir->slurpFullTree(bundle, subdirName, group,
-                                                resType, mFullResPaths);
+            ssize_t res = dir->addScannedTree(bundle, *entry.dir, subdirName, group,
+                                              resType, mFullResPaths, false);
             if (res < 0) {
                 count = res;
                 goto bail;
@@ -1230,9 +1590,6 @@ ssize_t AaptAssets::slurpResourceTree(Bundle* bundle, const String8& srcDir)
     }
 
 bail:
-    closedir(dir);
-    dir = NULL;
-
     if (err != 0) {
         return err;
     }
@@ -1353,6 +1710,12 @@ status_t AaptAssets::filter(Bundle* bundle)
         return NO_ERROR;
     }
 
+    if (bundle->getPruneConfigs() && !reqFilter.isEmpty()) {
+        // The filter can't be copied; it is cheap to parse again.
+        mPruneFilter = new WeakResourceFilter();
+        mPruneFilter->parse(bundle->getConfigurations());
+    }
+
     if (bundle->getVerbose()) {
         if (!reqFilter.isEmpty()) {
             printf("Applying required filter: %s\n",
@@ -1490,6 +1853,11 @@ status_t AaptAssets::filter(Bundle* bundle)
     return NO_ERROR;
 }
 
+bool AaptAssets::isPruned(const ResTable_config& config) const
+{
+    return mPruneFilter != NULL && !mPruneFilter->match(config);
+}
+
 sp<AaptSymbols> AaptAssets::getSymbolsFor(const String8& name)
 {
     sp<AaptSymbols> sym = mSymbols.valueFor(name);
@@ -1532,6 +1900,20 @@ status_t AaptAssets::applyJavaSymbols()
     return NO_ERROR;
 }
 
+bool AaptAssets::needsResourceSymbols(const Bundle* bundle) const
+{
+    return bundle->getRClassDir() != NULL || bundle->getCheckpointFile() != NULL
+            || mJavaSymbols.size() > 0;
+}
+
+void AaptAssets::sortSymbols()
+{
+    const size_t N = mSymbols.size();
+    for (size_t i=0; i<N; i++) {
+        mSymbols.valueAt(i)->sortByName();
+    }
+}
+
 bool AaptAssets::isJavaSymbol(const AaptSymbolEntry& sym, bool includePrivate) const {
     //printf("isJavaSymbol %s: public=%d, includePrivate=%d, isJavaSymbol=%d\n",
     //        sym.name.string(), sym.isPublic ? 1 : 0, includePrivate ? 1 : 0,
@@ -1542,51 +1924,133 @@ bool AaptAssets::isJavaSymbol(const AaptSymbolEntry& sym, bool includePrivate) c
     return false;
 }
 
+/*
+ * Points an included package at an uncompressed copy of its resource table
+ * in the resource cache, making the copy on the first run, so that later
+ * runs map the table instead of inflating it.  Copies are keyed by the CRC
+ * and sizes the zip records for the table, so finding one reads none of
+ * the data.  On any failure the package is just loaded as usual.
+ */
+static void useCachedResourceTable(const Bundle* bundle, AssetManager* assets,
+        const String8& path, int32_t cookie)
+{
+    ZipFileRO* zip = assets->getZipFile(cookie);
+    if (zip == NULL) {
+        return;
+    }
+
+    ZipEntryRO entry = zip->findEntryByName("resources.arsc");
+    if (entry == NULL) {
+        return;
+    }
+    uint16_t method;
+    uint32_t uncompLen, compLen, crc32;
+    if (!zip->getEntryInfo(entry, &method, &uncompLen, &compLen, NULL, NULL, &crc32)
+            || method == ZipFileRO::kCompressStored) {
+        // A stored table is already mapped straight from the zip.
+        zip->releaseEntry(entry);
+        return;
+    }
+
+    CompileCache::Key key("included-arsc-v1");
+    key.add((int32_t)crc32);
+    key.add((int32_t)uncompLen);
+    key.add((int32_t)compLen);
+    const String8 digest(key.digest());
+    // Inflating the table is quicker than fetching it from a server.
+    const CompileCache cache(bundle->getResourceCacheDir(), false);
+
+    String8 tablePath(cache.find(digest));
+    if (tablePath.isEmpty()) {
+        void* data = malloc(uncompLen);
+        if (data != NULL && zip->uncompressEntry(entry, data, uncompLen)
+                && cache.put(digest, data, uncompLen) == NO_ERROR) {
+            tablePath = cache.find(digest);
+        }
+        free(data);
+    }
+    zip->releaseEntry(entry);
+
+    if (!tablePath.isEmpty() && assets->setResourceTableFile(cookie, tablePath)
+            && bundle->getVerbose()) {
+        printf("Using cached resource table of %s: %s\n", path.string(), tablePath.string());
+    }
+}
+
 status_t AaptAssets::buildIncludedResources(Bundle* bundle)
 {
     if (mHaveIncludedAssets) {
         return NO_ERROR;
     }
 
-    // Add in all includes.
+    // The includes are opened and their tables inflated on up to --jobs
+    // threads; they are still added, and numbered, in the order given.  With
+    // a resource cache only the zips are opened, so that a cached table can
+    // still take the place of each zip's own.
     const Vector<String8>& includes = bundle->getPackageIncludes();
+    const String8& featureOfBase = bundle->getFeatureOfPackage();
+    Vector<String8> preload(includes);
+    if (!featureOfBase.isEmpty()) {
+        preload.add(featureOfBase);
+    }
+    mIncludedAssets.preloadAssetPaths(preload, bundle->getResourceCacheDir() == NULL,
+            bundle->getJobs() > 0 ? bundle->getJobs() : 1);
+
+    // Add in all includes.
     const size_t packageIncludeCount = includes.size();
     for (size_t i = 0; i < packageIncludeCount; i++) {
         if (bundle->getVerbose()) {
             printf("Including resources from package: %s\n", includes[i].string());
         }
 
-        if (!mIncludedAssets.addAssetPath(includes[i], NULL)) {
+        int32_t cookie;
+        if (!mIncludedAssets.addAssetPath(includes[i], &cookie)) {
             fprintf(stderr, "ERROR: Asset package include '%s' not found.\n",
                     includes[i].string());
             return UNKNOWN_ERROR;
         }
+        if (bundle->getResourceCacheDir() != NULL) {
+            useCachedResourceTable(bundle, &mIncludedAssets, includes[i], cookie);
+        }
     }
 
-    const String8& featureOfBase = bundle->getFeatureOfPackage();
     if (!featureOfBase.isEmpty()) {
         if (bundle->getVerbose()) {
             printf("Including base feature resources from package: %s\n",
                     featureOfBase.string());
         }
 
-        if (!mIncludedAssets.addAssetPath(featureOfBase, NULL)) {
+        int32_t cookie;
+        if (!mIncludedAssets.addAssetPath(featureOfBase, &cookie)) {
             fprintf(stderr, "ERROR: base feature package '%s' not found.\n",
                     featureOfBase.string());
             return UNKNOWN_ERROR;
         }
+        if (bundle->getResourceCacheDir() != NULL) {
+            useCachedResourceTable(bundle, &mIncludedAssets, featureOfBase, cookie);
+        }
     }
 
     mHaveIncludedAssets = true;
+    StartupProfile::mark("openIncludes");
 
-    return NO_ERROR;
+    // Only addIncludedResources() changes the table from here on, so it is
+    // frozen to let the compile stages read it from several threads
+    // without taking its lock.
+    const ResTable& res = getIncludedResources();
+    StartupProfile::mark("loadIncludedTable");
+    return const_cast<ResTable&>(res).setFrozen(true);
 }
 
 status_t AaptAssets::addIncludedResources(const sp<AaptFile>& file)
 {
     const ResTable& res = getIncludedResources();
     // XXX dirty!
-    return const_cast<ResTable&>(res).add(file->getData(), file->getSize());
+    ResTable& table = const_cast<ResTable&>(res);
+    table.setFrozen(false);
+    status_t err = table.add(file->getData(), file->getSize());
+    table.setFrozen(true);
+    return err;
 }
 
 const ResTable& AaptAssets::getIncludedResources() const
@@ -10,6 +10,7 @@
 #include <androidfw/ResourceTypes.h>
 #include <stdlib.h>
 #include <set>
+#include <utils/HashedKeyedVector.h>
 #include <utils/KeyedVector.h>
 #include <utils/RefBase.h>
 #include <utils/SortedVector.h>
@@ -19,13 +20,13 @@
 #include "AaptConfig.h"
 #include "Bundle.h"
 #include "ConfigDescription.h"
+#include "MemStats.h"
 #include "SourcePos.h"
 #include "ZipFile.h"
 
 using namespace android;
 
 extern const char * const gDefaultIgnoreAssets;
-extern const char * gUserIgnoreAssets;
 
 bool valid_symbol_name(const String8& str);
 
@@ -140,11 +141,14 @@ inline int strictly_order_type(const AaptGroupEntry& lhs, const AaptGroupEntry&
 
 class AaptGroup;
 class FilePathStore;
+class MappedFile;
+class WeakResourceFilter;
+struct ScannedDir;
 
 /**
  * A single asset file we know about.
  */
-class AaptFile : public RefBase
+class AaptFile : public LightRefBase<AaptFile>
 {
 public:
     AaptFile(const String8& sourceFile, const AaptGroupEntry& groupEntry,
@@ -155,28 +159,41 @@ public:
         , mData(NULL)
         , mDataSize(0)
         , mBufferSize(0)
+        , mDataAccount(MemStats::FILE_DATA)
+        , mSpool(NULL)
         , mCompression(ZipEntry::kCompressStored)
         {
             //printf("new AaptFile created %s\n", (const char*)sourceFile);
         }
-    virtual ~AaptFile() {
-        free(mData);
-    }
+    virtual ~AaptFile();
 
     const String8& getPath() const { return mPath; }
     const AaptGroupEntry& getGroupEntry() const { return mGroupEntry; }
 
     // Data API.  If there is data attached to the file,
     // getSourceFile() is not used.
-    bool hasData() const { return mData != NULL; }
-    const void* getData() const { return mData; }
+    bool hasData() const { return mData != NULL || mSpool != NULL; }
+    const void* getData() const;
     size_t getSize() const { return mDataSize; }
     void* editData(size_t size);
     void* editData(size_t* outSize = NULL);
+    // Makes room for "size" bytes of data without changing getSize(), so
+    // that growing to a size known in advance takes one allocation and
+    // leaves no slack.
+    status_t reserveData(size_t size);
     void* editDataInRange(size_t offset, size_t size);
     void* padData(size_t wordSize);
     status_t writeData(const void* data, size_t size);
     void clearData();
+    // Hands the data, from malloc(), over to the caller and leaves the file
+    // empty.  Returns NULL if there is none, or no memory to bring it back
+    // from the spool.
+    void* releaseData();
+    // Moves the data out of the heap into a file in "dir", which getData()
+    // then reads through a read-only mapping.  Editing the data again
+    // brings it back into the heap.  On failure the data stays where it was.
+    status_t spoolData(const char* dir);
+    bool isSpooled() const { return mSpool != NULL; }
 
     const String8& getResourceType() const { return mResourceType; }
 
@@ -200,14 +217,19 @@ private:
     void* mData;
     size_t mDataSize;
     size_t mBufferSize;
+    MemAccount mDataAccount;
+    MappedFile* mSpool;
+    String8 mSpoolPath;     // only while the spool file can't be removed yet
     int mCompression;
+
+    bool unspoolData();
 };
 
 /**
  * A group of related files (the same file, with different
  * vendor/locale variations).
  */
-class AaptGroup : public RefBase
+class AaptGroup : public LightRefBase<AaptGroup>
 {
 public:
     AaptGroup(const String8& leaf, const String8& path)
@@ -240,7 +262,7 @@ private:
  * A single directory of assets, which can contain files and other
  * sub-directories.
  */
-class AaptDir : public RefBase
+class AaptDir : public LightRefBase<AaptDir>
 {
 public:
     AaptDir(const String8& leaf, const String8& path)
@@ -296,6 +318,14 @@ private:
                                   const String8& resType,
                                   sp<FilePathStore>& fullResPaths,
                                   const bool overwrite=false);
+    /* slurpFullTree() from a tree that scanTree() has already read */
+    ssize_t addScannedTree(Bundle* bundle,
+                           const ScannedDir& scanned,
+                           const String8& srcDir,
+                           const AaptGroupEntry& kind,
+                           const String8& resType,
+                           sp<FilePathStore>& fullResPaths,
+                           const bool overwrite);
 
     String8 mLeaf;
     String8 mPath;
@@ -359,9 +389,17 @@ public:
     String8 stringVal;
 };
 
+// AaptSymbolEntry is trivially movable because all of its fields, including
+// the strings and the SourcePos, are trivially movable.  This keeps inserts
+// into large symbol tables from copying every entry after the new one.
+namespace android {
+    ANDROID_TRIVIAL_MOVE_TRAIT(AaptSymbolEntry);
+};
+
 /**
  * A group of related symbols (such as indices into a string block)
- * that have been generated from the assets.
+ * that have been generated from the assets.  Symbols are kept in the
+ * order they were added until sortByName() is called.
  */
 class AaptSymbols : public RefBase
 {
@@ -450,9 +488,13 @@ public:
 
     status_t applyJavaSymbols(const sp<AaptSymbols>& javaSymbols);
 
-    const KeyedVector<String8, AaptSymbolEntry>& getSymbols() const
+    // Puts the symbols, and those of every nested group, in name order,
+    // the order the R classes list them in.
+    void sortByName();
+
+    const HashedKeyedVector<String8, AaptSymbolEntry>& getSymbols() const
         { return mSymbols; }
-    const DefaultKeyedVector<String8, sp<AaptSymbols> >& getNestedSymbols() const
+    const DefaultHashedKeyedVector<String8, sp<AaptSymbols> >& getNestedSymbols() const
         { return mNestedSymbols; }
 
     const String16& getComment(const String8& name) const
@@ -487,9 +529,9 @@ private:
         return mDefSymbol;
     }
 
-    KeyedVector<String8, AaptSymbolEntry>           mSymbols;
-    DefaultKeyedVector<String8, sp<AaptSymbols> >   mNestedSymbols;
-    AaptSymbolEntry                                 mDefSymbol;
+    HashedKeyedVector<String8, AaptSymbolEntry>         mSymbols;
+    DefaultHashedKeyedVector<String8, sp<AaptSymbols> > mNestedSymbols;
+    AaptSymbolEntry                                     mDefSymbol;
 };
 
 class ResourceTypeSet : public RefBase,
@@ -515,7 +557,7 @@ class AaptAssets : public AaptDir
 {
 public:
     AaptAssets();
-    virtual ~AaptAssets() { delete mRes; }
+    virtual ~AaptAssets();
 
     const String8& getPackage() const { return mPackage; }
     void setPackage(const String8& package) {
@@ -549,6 +591,14 @@ public:
 
     status_t applyJavaSymbols();
 
+    // Whether the R symbols need to be built from the resource table:
+    // when this run writes R classes, or keeps them in its checkpoint, or
+    // has <java-symbol> declarations to check against them.
+    bool needsResourceSymbols(const Bundle* bundle) const;
+
+    // Puts every symbol in name order, for writing the R classes.
+    void sortSymbols();
+
     const DefaultKeyedVector<String8, sp<AaptSymbols> >& getSymbols() const { return mSymbols; }
 
     String8 getSymbolsPrivatePackage() const { return mSymbolsPrivatePackage; }
@@ -568,6 +618,21 @@ public:
 
     void print(const String8& prefix) const;
 
+    /*
+     * With --prune-configs, whether the -c configurations leave out files of
+     * "config", so that the build skips what work on them it can.  Like
+     * filter(), the callers leave mipmaps alone.
+     */
+    bool isPruned(const ResTable_config& config) const;
+
+    /*
+     * The declare-styleable tables the R class writers resolve once and then
+     * share between every class and R.txt they write.  Only Resource.cpp
+     * knows what they hold.
+     */
+    const sp<RefBase>& getStyleableTables() const { return mStyleableTables; }
+    void setStyleableTables(const sp<RefBase>& tables) { mStyleableTables = tables; }
+
     inline const Vector<sp<AaptDir> >& resDirs() const { return mResDirs; }
     sp<AaptDir> resDir(const String8& name) const;
 
@@ -618,6 +683,11 @@ private:
 
     sp<FilePathStore> mFullResPaths;
     sp<FilePathStore> mFullAssetPaths;
+
+    // Set by filter() with --prune-configs.
+    sp<WeakResourceFilter> mPruneFilter;
+
+    sp<RefBase> mStyleableTables;
 };
 
 #endif // __AAPT_ASSETS_H
@@ -15,7 +15,9 @@
  */
 
 #include <androidfw/ResourceTypes.h>
+#include <utils/Mutex.h>
 #include <ctype.h>
+#include <map>
 
 #include "AaptConfig.h"
 #include "AaptAssets.h"
@@ -23,6 +25,7 @@
 #include "ResourceFilter.h"
 #include "SdkConstants.h"
 
+using android::Mutex;
 using android::String8;
 using android::Vector;
 using android::ResTable_config;
@@ -31,7 +34,44 @@ namespace AaptConfig {
 
 static const char* kWildcardName = "any";
 
+struct ParsedConfig {
+    bool valid;
+    ConfigDescription config;
+};
+
+// Results of parse() by qualifier string.  The same few qualifiers come up
+// for every resource directory, -c item and split, so each distinct string
+// is taken apart only once.  Guarded by sParsedLock, since values files
+// are parsed on several threads.
+static std::map<String8, ParsedConfig> sParsedConfigs;
+static Mutex sParsedLock;
+
+static bool parseUncached(const String8& str, ConfigDescription* out);
+
 bool parse(const String8& str, ConfigDescription* out) {
+    {
+        Mutex::Autolock _l(sParsedLock);
+        std::map<String8, ParsedConfig>::const_iterator iter = sParsedConfigs.find(str);
+        if (iter != sParsedConfigs.end()) {
+            if (iter->second.valid && out != NULL) {
+                *out = iter->second.config;
+            }
+            return iter->second.valid;
+        }
+    }
+
+    ParsedConfig parsed;
+    parsed.valid = parseUncached(str, &parsed.config);
+
+    Mutex::Autolock _l(sParsedLock);
+    sParsedConfigs[str] = parsed;
+    if (parsed.valid && out != NULL) {
+        *out = parsed.config;
+    }
+    return parsed.valid;
+}
+
+static bool parseUncached(const String8& str, ConfigDescription* out) {
     Vector<String8> parts = AaptUtil::splitAndLowerCase(str, '-');
 
     ConfigDescription config;
@@ -0,0 +1,92 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// The state of one aapt run, so that several can share a process.
+
+#include "AaptContext.h"
+
+#include <cutils/threads.h>
+
+namespace android {
+
+// The context a Scope made current on the calling thread, if any.
+static thread_store_t gCurrent = THREAD_STORE_INITIALIZER;
+
+AaptContext::AaptContext()
+    : mHasIgnoreAssets(false), mFailFast(false), mCanceled(false)
+{
+    for (int i = 0; i < NUM_STATE_SLOTS; i++) {
+        mStates[i] = NULL;
+        mDestroy[i] = NULL;
+    }
+}
+
+AaptContext::~AaptContext()
+{
+    for (int i = 0; i < NUM_STATE_SLOTS; i++) {
+        if (mStates[i] != NULL) {
+            mDestroy[i](mStates[i]);
+        }
+    }
+}
+
+AaptContext* AaptContext::current()
+{
+    AaptContext* context = static_cast<AaptContext*>(thread_store_get(&gCurrent));
+    return context != NULL ? context : getDefault();
+}
+
+AaptContext* AaptContext::getDefault()
+{
+    // Never freed, since work may report into it while the process exits.
+    static AaptContext* sDefault = new AaptContext();
+    return sDefault;
+}
+
+AaptContext::Scope::Scope(AaptContext* context)
+    : mPrevious(static_cast<AaptContext*>(thread_store_get(&gCurrent)))
+{
+    thread_store_set(&gCurrent, context, NULL);
+}
+
+AaptContext::Scope::~Scope()
+{
+    thread_store_set(&gCurrent, mPrevious, NULL);
+}
+
+void* AaptContext::getState(StateSlot slot, void* (*create)(), void (*destroy)(void*))
+{
+    void* state = __atomic_load_n(&mStates[slot], __ATOMIC_ACQUIRE);
+    if (state != NULL) {
+        return state;
+    }
+    AutoMutex _l(mLock);
+    if (mStates[slot] == NULL) {
+        mDestroy[slot] = destroy;
+        __atomic_store_n(&mStates[slot], create(), __ATOMIC_RELEASE);
+    }
+    return mStates[slot];
+}
+
+const char* AaptContext::getIgnoreAssets() const
+{
+    return mHasIgnoreAssets ? mIgnoreAssets.string() : NULL;
+}
+
+void AaptContext::setIgnoreAssets(const char* pattern)
+{
+    mHasIgnoreAssets = pattern != NULL;
+    mIgnoreAssets.setTo(pattern != NULL ? pattern : "");
+}
+
+void AaptContext::cancel()
+{
+    __atomic_store_n(&mCanceled, true, __ATOMIC_RELAXED);
+}
+
+bool AaptContext::isCanceled() const
+{
+    return __atomic_load_n(&mCanceled, __ATOMIC_RELAXED);
+}
+
+} // namespace android
@@ -0,0 +1,95 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// The state of one aapt run, so that several can share a process.
+
+#ifndef AAPT_CONTEXT_H
+#define AAPT_CONTEXT_H
+
+#include <utils/Mutex.h>
+#include <utils/String8.h>
+
+namespace android {
+
+/*
+ * Holds what one run keeps between its stages and used to keep in
+ * globals: the diagnostics SourcePos reports, the ResourceIdCache, the
+ * keep rules gathered for --proguard, the outputs kept for --checkpoint,
+ * the --ignore-assets pattern and whether --fail-fast has canceled it.
+ *
+ * Each thread has a current context, set with a Scope.  Work units run in
+ * the context of the thread that scheduled them, so a run's work threads
+ * report into it too.  A thread that never set one uses the default
+ * context, which is what the aapt tool itself runs in.
+ *
+ * A context must outlive all the work scheduled in it.
+ */
+class AaptContext {
+public:
+    AaptContext();
+    ~AaptContext();
+
+    /* The calling thread's context. */
+    static AaptContext* current();
+
+    /* The context of threads that never set one. */
+    static AaptContext* getDefault();
+
+    /* Makes "context" current on the calling thread while it exists. */
+    class Scope {
+    public:
+        Scope(AaptContext* context);
+        ~Scope();
+
+    private:
+        Scope(const Scope&);
+        Scope& operator=(const Scope&);
+
+        AaptContext* const mPrevious;
+    };
+
+    /* The modules that keep their state here, one slot each. */
+    enum StateSlot {
+        STATE_DIAGNOSTICS,      // SourcePos
+        STATE_RESOURCE_IDS,     // ResourceIdCache
+        STATE_XML_KEEP_RULES,   // the --proguard rules from compiled XML
+        STATE_CHECKPOINT,       // Checkpoint
+        NUM_STATE_SLOTS
+    };
+
+    /*
+     * Returns the state of "slot", made by "create" when first asked for,
+     * from any thread of the run, and freed by "destroy" with the context.
+     */
+    void* getState(StateSlot slot, void* (*create)(), void (*destroy)(void*));
+
+    /* The --ignore-assets pattern, or NULL for the default one. */
+    const char* getIgnoreAssets() const;
+    void setIgnoreAssets(const char* pattern);
+
+    /*
+     * With --fail-fast the first error reported cancels the run: its
+     * stages stop scheduling work and the units already queued skip theirs,
+     * so the build ends with the errors of the files that were processed.
+     */
+    bool getFailFast() const { return mFailFast; }
+    void setFailFast(bool failFast) { mFailFast = failFast; }
+    void cancel();
+    bool isCanceled() const;
+
+private:
+    AaptContext(const AaptContext&);
+    AaptContext& operator=(const AaptContext&);
+
+    Mutex mLock;            // guards making the states
+    void* mStates[NUM_STATE_SLOTS];
+    void (*mDestroy[NUM_STATE_SLOTS])(void*);
+    bool mHasIgnoreAssets;
+    String8 mIgnoreAssets;
+    bool mFailFast;
+    bool mCanceled;         // read and set from any thread of the run
+};
+
+} // namespace android
+
+#endif // AAPT_CONTEXT_H
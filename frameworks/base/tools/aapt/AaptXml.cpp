@@ -67,13 +67,8 @@ static int32_t getIntegerAttributeAtIndex(const ResXMLTree& tree, ssize_t attrIn
 
 
 ssize_t indexOfAttribute(const ResXMLTree& tree, uint32_t attrRes) {
-    size_t attrCount = tree.getAttributeCount();
-    for (size_t i = 0; i < attrCount; i++) {
-        if (tree.getAttributeNameResID(i) == attrRes) {
-            return (ssize_t)i;
-        }
-    }
-    return -1;
+    ssize_t idx = tree.indexOfAttribute(attrRes);
+    return idx >= 0 ? idx : -1;
 }
 
 String8 getAttribute(const ResXMLTree& tree, const char* ns,
@@ -27,31 +27,76 @@ aaptMain := Main.cpp
 aaptSources := \
     AaptAssets.cpp \
     AaptConfig.cpp \
+    AaptContext.cpp \
     AaptUtil.cpp \
     AaptXml.cpp \
     ApkBuilder.cpp \
+    ApkDigests.cpp \
+    Checkpoint.cpp \
     Command.cpp \
+    CompileCache.cpp \
     CrunchCache.cpp \
+    CrunchWorkers.cpp \
+    DaemonStats.cpp \
+    FileCosts.cpp \
     FileFinder.cpp \
+    FileWatcher.cpp \
     Images.cpp \
+    ImageQuantizer.cpp \
+    ImageScan.cpp \
+    Invocation.cpp \
+    InvocationCapture.cpp \
+    MappedFile.cpp \
+    MemStats.cpp \
+    MemoryBudget.cpp \
+    OutputBuffer.cpp \
     Package.cpp \
+    PhaseTrace.cpp \
     pseudolocalize.cpp \
+    Readahead.cpp \
+    RemoteCache.cpp \
     Resource.cpp \
     ResourceFilter.cpp \
     ResourceIdCache.cpp \
     ResourceTable.cpp \
     SourcePos.cpp \
+    StartupProfile.cpp \
+    Statistics.cpp \
+    StringAtoms.cpp \
     StringPool.cpp \
+    TaskGraph.cpp \
+    Variants.cpp \
     WorkQueue.cpp \
     XMLNode.cpp \
+    XMLStream.cpp \
     ZipEntry.cpp \
     ZipFile.cpp
 
 aaptTests := \
     tests/AaptConfig_test.cpp \
+    tests/AaptContext_test.cpp \
     tests/AaptGroupEntry_test.cpp \
+    tests/AaptSymbols_test.cpp \
+    tests/Checkpoint_test.cpp \
+    tests/DaemonStats_test.cpp \
+    tests/FileCosts_test.cpp \
+    tests/FileWatcher_test.cpp \
+    tests/ImageQuantizer_test.cpp \
+    tests/ImageScan_test.cpp \
     tests/Pseudolocales_test.cpp \
-    tests/ResourceFilter_test.cpp
+    tests/ResourceFilter_test.cpp \
+    tests/SourcePos_test.cpp \
+    tests/StringAtoms_test.cpp \
+    tests/StringPool_test.cpp \
+    tests/TaskGraph_test.cpp \
+    tests/Variants_test.cpp \
+    tests/ZipFile_test.cpp
+
+aaptBenchmarks := \
+    tests/aapt_benchmark.cpp \
+    tests/androidfw_benchmark.cpp \
+    tests/benchmark_files.cpp \
+    tests/benchmark_main.cpp
 
 aaptHostLdLibs :=
 aaptHostStaticLibs := \
@@ -62,11 +107,18 @@ aaptHostStaticLibs := \
     libcutils \
     libexpat \
     libziparchive-host \
-    libbase
+    libbase \
+    libmincrypt
 
 aaptCFlags := -DAAPT_VERSION=\"$(BUILD_NUMBER_FROM_FILE)\"
 aaptCFlags += -Wall -Werror
 
+# --webp needs libwebp's encoder, which not every tree has.
+ifneq ($(wildcard external/webp/include/webp/encode.h),)
+    aaptCFlags += -DAAPT_HAVE_WEBP -Iexternal/webp/include
+    aaptHostStaticLibs += libwebp-encode
+endif
+
 ifeq ($(HOST_OS),linux)
     aaptHostLdLibs += -lrt -ldl -lpthread
 endif
@@ -127,5 +179,22 @@ LOCAL_STATIC_LIBRARIES += libaapt $(aaptHostStaticLibs)
 
 include $(BUILD_HOST_NATIVE_TEST)
 
+# ==========================================================
+# Build the host benchmarks: aapt-benchmarks
+# ==========================================================
+include $(CLEAR_VARS)
+LOCAL_ADDITIONAL_DEPENDENCIES := $(LOCAL_PATH)/Android.mk
+
+LOCAL_MODULE := aapt-benchmarks
+LOCAL_MODULE_TAGS := optional
+LOCAL_CFLAGS += $(aaptCFlags)
+LOCAL_CPPFLAGS += $(aaptCppFlags)
+LOCAL_LDLIBS += $(aaptHostLdLibs)
+LOCAL_SRC_FILES += $(aaptBenchmarks)
+LOCAL_C_INCLUDES += $(LOCAL_PATH)
+LOCAL_STATIC_LIBRARIES += libaapt $(aaptHostStaticLibs)
+
+include $(BUILD_HOST_EXECUTABLE)
+
 
 endif # No TARGET_BUILD_APPS or TARGET_BUILD_PDK
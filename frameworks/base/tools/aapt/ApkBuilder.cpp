@@ -17,6 +17,8 @@
 #include "AaptAssets.h"
 #include "ApkBuilder.h"
 
+#include <algorithm>
+
 using namespace android;
 
 ApkBuilder::ApkBuilder(const sp<WeakResourceFilter>& configFilter)
@@ -52,20 +54,33 @@ status_t ApkBuilder::createSplitForConfigs(const std::set<ConfigDescription>& co
     sp<AndResourceFilter> filter = new AndResourceFilter();
     filter->addFilter(splitFilter);
     filter->addFilter(mConfigFilter);
-    mSplits.add(new ApkSplit(configs, filter));
+    ssize_t index = mSplits.add(new ApkSplit(configs, filter));
+
+    std::set<ConfigDescription>::const_iterator iter = configs.begin();
+    for (; iter != configs.end(); iter++) {
+        mSplitConfigs.add(SplitConfig(*iter, index));
+    }
+    std::sort(mSplitConfigs.editArray(), mSplitConfigs.editArray() + mSplitConfigs.size());
     return NO_ERROR;
 }
 
 status_t ApkBuilder::addEntry(const String8& path, const sp<AaptFile>& file) {
-    const size_t N = mSplits.size();
-    for (size_t i = 0; i < N; i++) {
-        if (mSplits[i]->matches(file)) {
-            return mSplits.editItemAt(i)->addEntry(path, file);
-        }
+    // This is where trying each split's filter in turn would put the entry:
+    // the splits' configurations don't overlap, so it goes to the split that
+    // lists its configuration, or else to the base APK, if it gets past
+    // mConfigFilter at all.
+    const ResTable_config config = file->getGroupEntry().toParams();
+    if (!mConfigFilter->match(config)) {
+        // Entry can be dropped if it doesn't match any split.
+        return NO_ERROR;
     }
-    // Entry can be dropped if it doesn't match any split. This will only happen
-    // if the enry doesn't mConfigFilter.
-    return NO_ERROR;
+
+    const SplitConfig key(config, 0);
+    const SplitConfig* begin = mSplitConfigs.array();
+    const SplitConfig* end = begin + mSplitConfigs.size();
+    const SplitConfig* found = std::lower_bound(begin, end, key);
+    const size_t split = (found != end && found->packed == key.packed) ? found->split : 0;
+    return mSplits.editItemAt(split)->addEntry(path, file);
 }
 
 void ApkBuilder::print() const {
@@ -62,9 +62,25 @@ public:
     void print() const;
 
 private:
+    // One configuration of a split, and that split's index in mSplits.
+    struct SplitConfig {
+        SplitConfig() : split(0) {}
+        SplitConfig(const android::ResTable_config& config, size_t split)
+            : packed(config), split(split) {}
+
+        bool operator<(const SplitConfig& o) const {
+            return packed < o.packed;
+        }
+
+        PackedConfig packed;
+        size_t split;
+    };
+
     android::sp<ResourceFilter> mConfigFilter;
     android::sp<AndResourceFilter> mDefaultFilter;
     android::Vector<sp<ApkSplit> > mSplits;
+    // Every split's configurations, sorted so addEntry() can look one up.
+    android::Vector<SplitConfig> mSplitConfigs;
 };
 
 class ApkSplit : public OutputSet {
@@ -0,0 +1,329 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Digests of a finished APK that a signer would otherwise read it again for.
+
+#include "ApkDigests.h"
+#include "AaptAssets.h"
+#include "MappedFile.h"
+#include "PhaseTrace.h"
+#include "WorkQueue.h"
+#include "ZipFile.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace android {
+
+namespace {
+
+// APK Signature Scheme v2 digests its content in chunks of this many bytes.
+const size_t kChunkSize = 1024 * 1024;
+
+// Chunks digested by one work unit.
+const size_t kChunksPerUnit = 16;
+
+// The most bytes SHA256_update() takes at once.
+const size_t kMaxUpdate = 1 << 30;
+
+// MANIFEST.MF lines, not counting their "\r\n", are at most this long.
+const size_t kManifestLineLength = 72;
+
+const char kBase64[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+struct Chunk {
+    const uint8_t* data;
+    size_t size;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+};
+
+} // namespace
+
+static String8 toBase64(const uint8_t* data, size_t size)
+{
+    String8 out;
+    for (size_t i = 0; i < size; i += 3) {
+        const uint32_t n = (data[i] << 16) | (i + 1 < size ? data[i + 1] << 8 : 0)
+                | (i + 2 < size ? data[i + 2] : 0);
+        char quad[5] = {
+            kBase64[(n >> 18) & 63], kBase64[(n >> 12) & 63],
+            i + 1 < size ? kBase64[(n >> 6) & 63] : '=',
+            i + 2 < size ? kBase64[n & 63] : '=', 0
+        };
+        out.append(quad);
+    }
+    return out;
+}
+
+static String8 toHex(const uint8_t* data, size_t size)
+{
+    String8 out;
+    for (size_t i = 0; i < size; i++) {
+        out.appendFormat("%02x", data[i]);
+    }
+    return out;
+}
+
+/*
+ * Writes "line" to a manifest, continuing it on lines that start with a
+ * space once it reaches kManifestLineLength.
+ */
+static void writeManifestLine(FILE* fp, const String8& line)
+{
+    const char* p = line.string();
+    size_t left = line.length();
+    size_t room = kManifestLineLength;
+    while (left > room) {
+        fwrite(p, 1, room, fp);
+        fputs("\r\n ", fp);
+        p += room;
+        left -= room;
+        room = kManifestLineLength - 1;
+    }
+    fwrite(p, 1, left, fp);
+    fputs("\r\n", fp);
+}
+
+static void putLongLE(uint8_t* buf, uint32_t val)
+{
+    buf[0] = (uint8_t) val;
+    buf[1] = (uint8_t) (val >> 8);
+    buf[2] = (uint8_t) (val >> 16);
+    buf[3] = (uint8_t) (val >> 24);
+}
+
+static void hashChunk(Chunk* chunk)
+{
+    uint8_t prefix[5];
+    prefix[0] = 0xa5;
+    putLongLE(prefix + 1, (uint32_t) chunk->size);
+    SHA256_CTX ctx;
+    SHA256_init(&ctx);
+    SHA256_update(&ctx, prefix, sizeof(prefix));
+    SHA256_update(&ctx, chunk->data, (int) chunk->size);
+    memcpy(chunk->digest, SHA256_final(&ctx), SHA256_DIGEST_SIZE);
+}
+
+class HashChunksWorkUnit : public WorkQueue::WorkUnit {
+public:
+    HashChunksWorkUnit(Chunk* chunks, size_t count) : mChunks(chunks), mCount(count) { }
+
+    virtual bool run() {
+        for (size_t i = 0; i < mCount; i++) {
+            hashChunk(&mChunks[i]);
+        }
+        return true;
+    }
+
+private:
+    Chunk* mChunks;
+    size_t mCount;
+};
+
+/* Splits "size" bytes at "data" into the chunks v2 digests. */
+static void addChunks(const uint8_t* data, size_t size, Vector<Chunk>* chunks)
+{
+    for (size_t offset = 0; offset < size; offset += kChunkSize) {
+        Chunk chunk;
+        chunk.data = data + offset;
+        chunk.size = size - offset < kChunkSize ? size - offset : kChunkSize;
+        chunks->add(chunk);
+    }
+}
+
+/*
+ * Finds the end of central directory record of the archive in "data",
+ * and the central directory it gives.  Returns false if there is none,
+ * setting "outZip64" if that is because the archive is ZIP64.
+ */
+static bool findCentralDir(const uint8_t* data, size_t size, size_t* outCdOffset,
+                           size_t* outEocdOffset, bool* outZip64)
+{
+    *outZip64 = false;
+    const size_t kEOCDLen = 22;
+    if (size < kEOCDLen) {
+        return false;
+    }
+    // The record ends the file but for a comment of up to 64 KiB.
+    const size_t lowest = size > kEOCDLen + 0xffff ? size - kEOCDLen - 0xffff : 0;
+    for (size_t pos = size - kEOCDLen + 1; pos-- > lowest; ) {
+        const uint8_t* p = data + pos;
+        if (ZipEntry::getLongLE(p) != 0x06054b50
+                || pos + kEOCDLen + ZipEntry::getShortLE(p + 20) != size) {
+            continue;
+        }
+        const size_t cdSize = ZipEntry::getLongLE(p + 12);
+        const size_t cdOffset = ZipEntry::getLongLE(p + 16);
+        if (cdOffset == 0xffffffff) {
+            *outZip64 = true;
+            return false;
+        }
+        if (cdOffset > pos || pos - cdOffset != cdSize) {
+            return false;
+        }
+        *outCdOffset = cdOffset;
+        *outEocdOffset = pos;
+        return true;
+    }
+    return false;
+}
+
+namespace ApkDigests {
+
+void hashData(const void* data, size_t size, uint8_t* outDigest)
+{
+    SHA256_CTX ctx;
+    SHA256_init(&ctx);
+    const uint8_t* p = (const uint8_t*) data;
+    while (size > 0) {
+        const size_t n = size < kMaxUpdate ? size : kMaxUpdate;
+        SHA256_update(&ctx, p, (int) n);
+        p += n;
+        size -= n;
+    }
+    memcpy(outDigest, SHA256_final(&ctx), SHA256_DIGEST_SIZE);
+}
+
+bool hashFile(const sp<const AaptFile>& file, uint8_t* outDigest)
+{
+    if (file->hasData()) {
+        hashData(file->getData(), file->getSize(), outDigest);
+        return true;
+    }
+    MappedFile source;
+    if (source.open(file->getSourceFile().string()) != NO_ERROR) {
+        return false;
+    }
+    hashData(source.getData(), source.getSize(), outDigest);
+    return true;
+}
+
+status_t writeEntryDigests(ZipFile* zip, const String8& path)
+{
+    PhaseSpan span("writeEntryDigests", path);
+    FILE* fp = fopen(path.string(), "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: Unable to open entry digests file '%s': %s\n",
+                path.string(), strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+    fputs("Manifest-Version: 1.0\r\nCreated-By: aapt\r\n\r\n", fp);
+
+    status_t result = NO_ERROR;
+    const int N = zip->getNumEntries();
+    for (int i = 0; i < N; i++) {
+        const ZipEntry* entry = zip->getEntryByIndex(i);
+        if (entry->getDeleted()) {
+            continue;
+        }
+        uint8_t digest[SHA256_DIGEST_SIZE];
+        if (entry->getSha256() != NULL) {
+            memcpy(digest, entry->getSha256(), sizeof(digest));
+        } else if (entry->getUncompressedLen() == 0) {
+            hashData(NULL, 0, digest);
+        } else {
+            void* data = zip->uncompress(entry);
+            if (data == NULL) {
+                fprintf(stderr, "ERROR: Unable to read '%s' to digest it\n",
+                        entry->getFileName());
+                result = UNKNOWN_ERROR;
+                break;
+            }
+            hashData(data, entry->getUncompressedLen(), digest);
+            free(data);
+        }
+        writeManifestLine(fp, String8::format("Name: %s", entry->getFileName()));
+        writeManifestLine(fp, String8::format("SHA-256-Digest: %s",
+                toBase64(digest, sizeof(digest)).string()));
+        fputs("\r\n", fp);
+    }
+
+    if (fclose(fp) != 0 && result == NO_ERROR) {
+        fprintf(stderr, "ERROR: Unable to write entry digests file '%s'\n", path.string());
+        result = UNKNOWN_ERROR;
+    }
+    return result;
+}
+
+status_t writeV2Digests(const String8& apkPath, const String8& path)
+{
+    PhaseSpan span("writeV2Digests", apkPath);
+    MappedFile apk;
+    if (apk.open(apkPath.string()) != NO_ERROR) {
+        fprintf(stderr, "ERROR: Unable to read '%s' to digest it\n", apkPath.string());
+        return UNKNOWN_ERROR;
+    }
+    const uint8_t* data = (const uint8_t*) apk.getData();
+    const size_t size = apk.getSize();
+    span.setBytes(size);
+    size_t cdOffset, eocdOffset;
+    bool zip64;
+    if (!findCentralDir(data, size, &cdOffset, &eocdOffset, &zip64)) {
+        if (zip64) {
+            fprintf(stderr, "ERROR: '%s' is a ZIP64 archive, which v2 signing doesn't"
+                    " support\n", apkPath.string());
+        } else {
+            fprintf(stderr, "ERROR: '%s' has no central directory to digest\n",
+                    apkPath.string());
+        }
+        return UNKNOWN_ERROR;
+    }
+
+    // The entries, the central directory and its end record.  Without a
+    // signing block the end record already gives the offset that v2
+    // digests in its place, that of the central directory.
+    Vector<Chunk> chunks;
+    addChunks(data, cdOffset, &chunks);
+    addChunks(data + cdOffset, eocdOffset - cdOffset, &chunks);
+    addChunks(data + eocdOffset, size - eocdOffset, &chunks);
+
+    { // scope for the group; its units are done before the chunks are read
+        WorkQueue::Group group(WorkQueue::getShared());
+        for (size_t i = 0; i < chunks.size(); i += kChunksPerUnit) {
+            const size_t count = chunks.size() - i < kChunksPerUnit
+                    ? chunks.size() - i : kChunksPerUnit;
+            HashChunksWorkUnit* w = new HashChunksWorkUnit(&chunks.editItemAt(i), count);
+            if (group.schedule(w, 0) != NO_ERROR) {
+                w->run();
+                delete w;
+            }
+        }
+        group.wait();
+    }
+
+    uint8_t prefix[5];
+    prefix[0] = 0x5a;
+    putLongLE(prefix + 1, (uint32_t) chunks.size());
+    SHA256_CTX ctx;
+    SHA256_init(&ctx);
+    SHA256_update(&ctx, prefix, sizeof(prefix));
+    for (size_t i = 0; i < chunks.size(); i++) {
+        SHA256_update(&ctx, chunks[i].digest, SHA256_DIGEST_SIZE);
+    }
+    const uint8_t* content = SHA256_final(&ctx);
+
+    FILE* fp = fopen(path.string(), "w");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: Unable to open v2 digests file '%s': %s\n",
+                path.string(), strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+    fprintf(fp, "algorithm: SHA-256\nchunk-size: %zu\nchunks: %zu\n", kChunkSize,
+            chunks.size());
+    for (size_t i = 0; i < chunks.size(); i++) {
+        fprintf(fp, "%s\n", toHex(chunks[i].digest, SHA256_DIGEST_SIZE).string());
+    }
+    fprintf(fp, "content-digest: %s\n", toHex(content, SHA256_DIGEST_SIZE).string());
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "ERROR: Unable to write v2 digests file '%s'\n", path.string());
+        return UNKNOWN_ERROR;
+    }
+    return NO_ERROR;
+}
+
+} // namespace ApkDigests
+
+} // namespace android
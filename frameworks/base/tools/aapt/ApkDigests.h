@@ -0,0 +1,50 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Digests of a finished APK that a signer would otherwise read it again for.
+
+#ifndef APK_DIGESTS_H
+#define APK_DIGESTS_H
+
+#include <utils/Errors.h>
+#include <utils/RefBase.h>
+#include <utils/String8.h>
+
+#include <mincrypt/sha256.h>
+
+class AaptFile;
+
+namespace android {
+
+class ZipFile;
+
+/*
+ * The SHA-256 digests that jarsigner style (v1) signing puts in
+ * MANIFEST.MF, and those of APK Signature Scheme v2, written next to an APK
+ * by --entry-digests and --v2-digests.  The entry digests are noted while
+ * the writer has each file's bytes at hand, the v2 ones read the finished
+ * archive back while it is still in the page cache, a chunk per work unit.
+ */
+namespace ApkDigests {
+
+// Sets "outDigest", SHA256_DIGEST_SIZE bytes, to the SHA-256 of "data".
+void hashData(const void* data, size_t size, uint8_t* outDigest);
+
+// The same for the bytes "file" holds or names; false if they can't be read.
+bool hashFile(const sp<const AaptFile>& file, uint8_t* outDigest);
+
+// Writes "path" with a MANIFEST.MF section for each entry of "zip", in
+// the order of its central directory.  Entries whose digest the writer
+// didn't note, those copied from jar files or left alone by -u, are
+// expanded to be hashed.  "zip" must have been flushed.
+status_t writeEntryDigests(ZipFile* zip, const String8& path);
+
+// Writes "path" with the v2 digests of each 1 MiB chunk of the archive
+// in "apkPath" and the digest of its whole content.
+status_t writeV2Digests(const String8& apkPath, const String8& path);
+
+} // namespace ApkDigests
+
+} // namespace android
+
+#endif // APK_DIGESTS_H
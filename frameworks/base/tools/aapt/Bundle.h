@@ -11,6 +11,7 @@
 #include <utils/threads.h>
 #include <utils/List.h>
 #include <utils/Errors.h>
+#include <utils/KeyedVector.h>
 #include <utils/String8.h>
 #include <utils/Vector.h>
 
@@ -29,7 +30,9 @@ typedef enum Command {
     kCommandPackage,
     kCommandCrunch,
     kCommandSingleCrunch,
-    kCommandDaemon
+    kCommandDaemon,
+    kCommandVerify,
+    kCommandReplay
 } Command;
 
 /*
@@ -41,6 +44,17 @@ typedef enum PseudolocalizationMethod {
     PSEUDO_BIDI,
 } PseudolocalizationMethod;
 
+/*
+ * How hard to deflate APK entries and PNG image data.  These are zlib
+ * levels, except for COMPRESSION_MAX: level 9 with the largest amount of
+ * state zlib can use, which is slower again but finds more matches.
+ */
+typedef enum CompressionLevel {
+    COMPRESSION_FAST = 1,
+    COMPRESSION_DEFAULT = 9,
+    COMPRESSION_MAX = 10,
+} CompressionLevel;
+
 /*
  * Bundle of goodies, including everything specified on the command line.
  */
@@ -51,7 +65,7 @@ public:
           mForce(false), mGrayscaleTolerance(0), mMakePackageDirs(false),
           mUpdate(false), mExtending(false),
           mRequireLocalization(false), mPseudolocalize(NO_PSEUDOLOCALIZATION),
-          mWantUTF16(false), mValues(false), mIncludeMetaData(false),
+          mWantUTF16(false), mValues(false), mJson(false), mIncludeMetaData(false),
           mCompressionMethod(0), mJunkPath(false), mOutputAPKFile(NULL),
           mManifestPackageNameOverride(NULL), mInstrumentationPackageNameOverride(NULL),
           mAutoAddOverlay(false), mGenDependencies(false),
@@ -62,9 +76,24 @@ public:
           mVersionCode(NULL), mVersionName(NULL), mReplaceVersion(false), mCustomPackage(NULL),
           mExtraPackages(NULL), mMaxResVersion(NULL), mDebugMode(false), mNonConstantId(false),
           mProduct(NULL), mUseCrunchCache(false), mErrorOnFailedInsert(false),
-          mErrorOnMissingConfigEntry(false), mOutputTextSymbols(NULL),
+          mErrorOnMissingConfigEntry(false), mFailFast(false), mOutputTextSymbols(NULL),
           mSingleCrunchInputFile(NULL), mSingleCrunchOutputFile(NULL),
-          mBuildSharedLibrary(false),
+          mBuildSharedLibrary(false), mJobs(0), mPinThreads(false), mMaxMemory(0),
+          mResourceCacheDir(NULL),
+          mResourceCacheLimit(0), mResourceCacheRemote(NULL), mZipAlign(false),
+          mCompressionLevel(COMPRESSION_DEFAULT), mTraceOutput(NULL),
+          mDiagnosticsOutput(NULL), mCostReport(NULL), mCostReportTop(20),
+          mCaptureInvocation(NULL), mReplayRepeat(5), mMemStats(false),
+          mStartupProfile(false),
+          mKeepOptimizedPngs(false), mOptimizePngs(false), mQuantizeQuality(-1),
+          mQuantizePattern(NULL), mWebpImages(false), mWebpQuality(-1),
+          mSimilarImagesReport(NULL),
+          mSparseEncoding(false), mBatchList(NULL), mVariantsFile(NULL), mCheckpointFile(NULL),
+          mFromCheckpoint(NULL), mStableIdsFile(NULL),
+          mEmitIdsFile(NULL),
+          mFeatureIndexFile(NULL), mCompactXml(false), mCollapseKeyNamesFile(NULL),
+          mDependencyGraphFile(NULL), mSpoolDir(NULL), mIgnoreAssets(NULL), mPruneConfigs(false),
+          mCollapseInvariantValues(false), mEntryDigests(false), mV2Digests(false),
           mArgc(0), mArgv(NULL)
         {}
     ~Bundle(void) {}
@@ -100,6 +129,8 @@ public:
     void setWantUTF16(bool val) { mWantUTF16 = val; }
     bool getValues(void) const { return mValues; }
     void setValues(bool val) { mValues = val; }
+    bool getJson(void) const { return mJson; }
+    void setJson(bool val) { mJson = val; }
     bool getIncludeMetaData(void) const { return mIncludeMetaData; }
     void setIncludeMetaData(bool val) { mIncludeMetaData = val; }
     int getCompressionMethod(void) const { return mCompressionMethod; }
@@ -120,6 +151,9 @@ public:
     void setErrorOnFailedInsert(bool val) { mErrorOnFailedInsert = val; }
     bool getErrorOnMissingConfigEntry() { return mErrorOnMissingConfigEntry; }
     void setErrorOnMissingConfigEntry(bool val) { mErrorOnMissingConfigEntry = val; }
+    // Stop the build at the first error instead of reporting every one.
+    bool getFailFast() const { return mFailFast; }
+    void setFailFast(bool val) { mFailFast = val; }
     const android::String8& getPlatformBuildVersionCode() { return mPlatformVersionCode; }
     void setPlatformBuildVersionCode(const android::String8& code) { mPlatformVersionCode = code; }
     const android::String8& getPlatformBuildVersionName() { return mPlatformVersionName; }
@@ -150,6 +184,8 @@ public:
     void addConfigurations(const char* val) { if (mConfigurations.size() > 0) { mConfigurations.append(","); mConfigurations.append(val); } else { mConfigurations = val; } }
     const android::String8& getPreferredDensity() const { return mPreferredDensity; }
     void setPreferredDensity(const char* val) { mPreferredDensity = val; }
+    bool getPruneConfigs() const { return mPruneConfigs; }
+    void setPruneConfigs(bool val) { mPruneConfigs = val; }
     void addSplitConfigurations(const char* val) { mPartialConfigurations.add(android::String8(val)); }
     const android::Vector<android::String8>& getSplitConfigurations() const { return mPartialConfigurations; }
     const char* getResourceIntermediatesDir() const { return mResourceIntermediatesDir; }
@@ -160,6 +196,110 @@ public:
     void addJarFile(const char* file) { mJarFiles.add(file); }
     const android::Vector<const char*>& getNoCompressExtensions() const { return mNoCompressExtensions; }
     void addNoCompressExtension(const char* ext) { mNoCompressExtensions.add(ext); }
+    // The CompressionLevel for deflated entries and PNG images.
+    int getCompressionLevel() const { return mCompressionLevel; }
+    void setCompressionLevel(int val) { mCompressionLevel = val; }
+    // Levels for APK entries whose names end in particular suffixes.
+    const android::KeyedVector<android::String8, int>& getExtensionCompressionLevels() const
+        { return mExtensionCompressionLevels; }
+    void setExtensionCompressionLevel(const android::String8& ext, int val)
+        { mExtensionCompressionLevels.replaceValueFor(ext, val); }
+    // File to write a trace of the build's stages to; NULL if none.
+    const char* getTraceOutput() const { return mTraceOutput; }
+    void setTraceOutput(const char* val) { mTraceOutput = val; }
+    // File to write the build's errors, warnings and notes to as SARIF; NULL if none.
+    const char* getDiagnosticsOutput() const { return mDiagnosticsOutput; }
+    void setDiagnosticsOutput(const char* val) { mDiagnosticsOutput = val; }
+    // File to write the costliest inputs of each stage to as JSON; NULL if none.
+    const char* getCostReport() const { return mCostReport; }
+    void setCostReport(const char* val) { mCostReport = val; }
+    // How many files of each stage the cost report lists.
+    int getCostReportTop() const { return mCostReportTop; }
+    void setCostReportTop(int val) { mCostReportTop = val; }
+    // Directory to capture the inputs and command line of a package run to; NULL if none.
+    const char* getCaptureInvocation() const { return mCaptureInvocation; }
+    void setCaptureInvocation(const char* val) { mCaptureInvocation = val; }
+    // How many times "replay" runs a captured invocation.
+    int getReplayRepeat() const { return mReplayRepeat; }
+    void setReplayRepeat(int val) { mReplayRepeat = val; }
+    // Whether to report how much memory each stage of the build held.
+    bool getMemStats() const { return mMemStats; }
+    void setMemStats(bool val) { mMemStats = val; }
+    // Whether to report how long aapt took to start up, before the build got to work.
+    bool getStartupProfile() const { return mStartupProfile; }
+    void setStartupProfile(bool val) { mStartupProfile = val; }
+    // Whether to keep PNGs that re-encoding is not expected to shrink as they are.
+    bool getKeepOptimizedPngs() const { return mKeepOptimizedPngs; }
+    void setKeepOptimizedPngs(bool val) { mKeepOptimizedPngs = val; }
+    // Whether to encode each PNG image many ways and keep the smallest.
+    bool getOptimizePngs() const { return mOptimizePngs; }
+    void setOptimizePngs(bool val) { mOptimizePngs = val; }
+    // Least quality, 0 to 100, of PNGs reduced to a palette; -1 to keep them lossless.
+    int getQuantizeQuality() const { return mQuantizeQuality; }
+    void setQuantizeQuality(int val) { mQuantizeQuality = val; }
+    // The images --quantize-pngs applies to; NULL for all of them.
+    const char* getQuantizePattern() const { return mQuantizePattern; }
+    void setQuantizePattern(const char* val) { mQuantizePattern = val; }
+    // Whether to store PNG images, other than 9-patches, as WebP when smaller.
+    bool getWebpImages() const { return mWebpImages; }
+    void setWebpImages(bool val) { mWebpImages = val; }
+    // Quality of lossy WebP images, 0 to 100; -1 for lossless ones.
+    int getWebpQuality() const { return mWebpQuality; }
+    void setWebpQuality(int val) { mWebpQuality = val; }
+    // File to list images with the same or similar pixels in; NULL if none.
+    const char* getSimilarImagesReport() const { return mSimilarImagesReport; }
+    void setSimilarImagesReport(const char* val) { mSimilarImagesReport = val; }
+    // Whether to index configurations defining few of a type's entries sparsely.
+    bool getSparseEncoding() const { return mSparseEncoding; }
+    void setSparseEncoding(bool val) { mSparseEncoding = val; }
+    // File listing the files "dump", "add" or "remove" is to process, "-" for
+    // stdin; NULL if none.
+    const char* getBatchList() const { return mBatchList; }
+    void setBatchList(const char* val) { mBatchList = val; }
+    // File of the variants to package, one command line's worth of arguments each; NULL if none.
+    const char* getVariantsFile() const { return mVariantsFile; }
+    void setVariantsFile(const char* val) { mVariantsFile = val; }
+    // File to keep the outputs of the run in for --from-checkpoint; NULL if none.
+    const char* getCheckpointFile() const { return mCheckpointFile; }
+    void setCheckpointFile(const char* val) { mCheckpointFile = val; }
+    // Checkpoint to write the outputs from instead of packaging; NULL if none.
+    const char* getFromCheckpoint() const { return mFromCheckpoint; }
+    void setFromCheckpoint(const char* val) { mFromCheckpoint = val; }
+    // File of identifiers from a previous build to keep resources at; NULL if none.
+    const char* getStableIdsFile() const { return mStableIdsFile; }
+    void setStableIdsFile(const char* val) { mStableIdsFile = val; }
+    // File to write every resource's identifier to; NULL if none.
+    const char* getEmitIdsFile() const { return mEmitIdsFile; }
+    void setEmitIdsFile(const char* val) { mEmitIdsFile = val; }
+    // File to write the built table's largest type identifiers to; NULL if none.
+    const char* getFeatureIndexFile() const { return mFeatureIndexFile; }
+    void setFeatureIndexFile(const char* val) { mFeatureIndexFile = val; }
+    // Whether compiled XML files leave out line numbers, comments and raw values.
+    bool getCompactXml() const { return mCompactXml; }
+    void setCompactXml(bool val) { mCompactXml = val; }
+    // File to write the names --collapse-key-names removed to; NULL to keep them.
+    const char* getCollapseKeyNamesFile() const { return mCollapseKeyNamesFile; }
+    void setCollapseKeyNamesFile(const char* val) { mCollapseKeyNamesFile = val; }
+    // Lists of resources to keep; unreferenced resources are left out if any.
+    const android::Vector<android::String8>& getShrinkKeepFiles() const { return mShrinkKeepFiles; }
+    void addShrinkKeepFile(const char* file) { mShrinkKeepFiles.add(android::String8(file)); }
+    bool getCollapseInvariantValues() const { return mCollapseInvariantValues; }
+    void setCollapseInvariantValues(bool val) { mCollapseInvariantValues = val; }
+    // Whether to write the SHA-256 of each APK entry, and the APK's v2 signing
+    // chunk digests, next to each APK.
+    bool getEntryDigests() const { return mEntryDigests; }
+    void setEntryDigests(bool val) { mEntryDigests = val; }
+    bool getV2Digests() const { return mV2Digests; }
+    void setV2Digests(bool val) { mV2Digests = val; }
+    // File to write what each resource file defines, refers to and feeds; NULL if none.
+    const char* getDependencyGraphFile() const { return mDependencyGraphFile; }
+    void setDependencyGraphFile(const char* val) { mDependencyGraphFile = val; }
+    // Directory to move compiled file data out of memory to; NULL to keep it.
+    const char* getSpoolDir() const { return mSpoolDir; }
+    void setSpoolDir(const char* val) { mSpoolDir = val; }
+    // The --ignore-assets pattern; NULL for $ANDROID_AAPT_IGNORE or the default.
+    const char* getIgnoreAssets() const { return mIgnoreAssets; }
+    void setIgnoreAssets(const char* val) { mIgnoreAssets = val; }
     void setFeatureOfPackage(const char* str) { mFeatureOfPackage = str; }
     const android::String8& getFeatureOfPackage() const { return mFeatureOfPackage; }
     void setFeatureAfterPackage(const char* str) { mFeatureAfterPackage = str; }
@@ -203,6 +343,31 @@ public:
     void setSingleCrunchOutputFile(const char* val) { mSingleCrunchOutputFile = val; }
     bool getBuildSharedLibrary() const { return mBuildSharedLibrary; }
     void setBuildSharedLibrary(bool val) { mBuildSharedLibrary = val; }
+    // Number of work threads; 0 until main() picks the default.
+    int getJobs() const { return mJobs; }
+    void setJobs(int val) { mJobs = val; }
+    // Bind each work thread to one processor.
+    bool getPinThreads() const { return mPinThreads; }
+    void setPinThreads(bool val) { mPinThreads = val; }
+    // MB of memory the preprocessing and compiling may hold at once; 0 for
+    // no limit, -1 for half that of the cgroup.
+    int getMaxMemory() const { return mMaxMemory; }
+    void setMaxMemory(int val) { mMaxMemory = val; }
+    // Directory of preprocessed images kept between builds; NULL if none.
+    const char* getResourceCacheDir() const { return mResourceCacheDir; }
+    void setResourceCacheDir(const char* val) { mResourceCacheDir = val; }
+    // Size in MiB the resource cache is trimmed to after a build; 0 if unbounded.
+    int getResourceCacheLimit() const { return mResourceCacheLimit; }
+    void setResourceCacheLimit(int val) { mResourceCacheLimit = val; }
+    // URL of a server sharing the --resource-cache between machines; NULL if none.
+    const char* getResourceCacheRemote() const { return mResourceCacheRemote; }
+    void setResourceCacheRemote(const char* val) { mResourceCacheRemote = val; }
+    // Commands starting aapt daemons that crunch the images into the resource cache.
+    const android::Vector<android::String8>& getCrunchWorkers() const { return mCrunchWorkers; }
+    void addCrunchWorker(const char* command) { mCrunchWorkers.add(android::String8(command)); }
+    // Align uncompressed APK entries as zipalign would.
+    bool getZipAlign() const { return mZipAlign; }
+    void setZipAlign(bool val) { mZipAlign = val; }
 
     /*
      * Set and get the file specification.
@@ -235,7 +400,7 @@ public:
      * above. SDK levels that have a non-numeric identifier are assumed
      * to be newer than any SDK level that has a number designated.
      */
-    bool isMinSdkAtLeast(int desired) {
+    bool isMinSdkAtLeast(int desired) const {
         /* If the application specifies a minSdkVersion in the manifest
          * then use that. Otherwise, check what the user specified on
          * the command line. If neither, it's not available since
@@ -274,6 +439,7 @@ private:
     short       mPseudolocalize;
     bool        mWantUTF16;
     bool        mValues;
+    bool        mJson;
     bool        mIncludeMetaData;
     int         mCompressionMethod;
     bool        mJunkPath;
@@ -316,10 +482,54 @@ private:
     bool        mUseCrunchCache;
     bool        mErrorOnFailedInsert;
     bool        mErrorOnMissingConfigEntry;
+    bool        mFailFast;
     const char* mOutputTextSymbols;
     const char* mSingleCrunchInputFile;
     const char* mSingleCrunchOutputFile;
     bool        mBuildSharedLibrary;
+    int         mJobs;
+    bool        mPinThreads;
+    int         mMaxMemory;
+    const char* mResourceCacheDir;
+    int         mResourceCacheLimit;
+    const char* mResourceCacheRemote;
+    android::Vector<android::String8> mCrunchWorkers;
+    bool        mZipAlign;
+    int         mCompressionLevel;
+    android::KeyedVector<android::String8, int> mExtensionCompressionLevels;
+    const char* mTraceOutput;
+    const char* mDiagnosticsOutput;
+    const char* mCostReport;
+    int         mCostReportTop;
+    const char* mCaptureInvocation;
+    int         mReplayRepeat;
+    bool        mMemStats;
+    bool        mStartupProfile;
+    bool        mKeepOptimizedPngs;
+    bool        mOptimizePngs;
+    int         mQuantizeQuality;
+    const char* mQuantizePattern;
+    bool        mWebpImages;
+    int         mWebpQuality;
+    const char* mSimilarImagesReport;
+    bool        mSparseEncoding;
+    const char* mBatchList;
+    const char* mVariantsFile;
+    const char* mCheckpointFile;
+    const char* mFromCheckpoint;
+    const char* mStableIdsFile;
+    const char* mEmitIdsFile;
+    const char* mFeatureIndexFile;
+    bool        mCompactXml;
+    const char* mCollapseKeyNamesFile;
+    android::Vector<android::String8> mShrinkKeepFiles;
+    const char* mDependencyGraphFile;
+    const char* mSpoolDir;
+    const char* mIgnoreAssets;
+    bool mPruneConfigs;
+    bool mCollapseInvariantValues;
+    bool mEntryDigests;
+    bool mV2Digests;
     android::String8 mPlatformVersionCode;
     android::String8 mPlatformVersionName;
 
@@ -7,6 +7,7 @@
 #ifndef CACHE_UPDATER_H
 #define CACHE_UPDATER_H
 
+#include <utils/ContentHash.h>
 #include <utils/String8.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -27,6 +28,8 @@ using namespace android;
  *  Usage:
  *      To update/add a file to the cache, call processImage
  *      To remove a file from the cache, call deleteFile
+ *
+ *  processImage may be called from several threads at once.
  */
 class CacheUpdater {
 public:
@@ -38,8 +41,20 @@ public:
     // Delete a file
     virtual void deleteFile(String8 path) = 0;
 
-    // Process an image from source out to dest
-    virtual void processImage(String8 source, String8 dest) = 0;
+    // Process an image from source out to dest; returns false on failure
+    virtual bool processImage(String8 source, String8 dest) = 0;
+
+    // Put a hex digest of the file's contents into digest.
+    // Returns false if the file can't be read.
+    virtual bool hashFile(String8 path, String8* digest) = 0;
+
+    // Describe the settings that processImage crunches with, so that
+    // cached files can be redone when they change
+    virtual String8 getSettingsKey() = 0;
+
+    // Read or replace a whole (small) file, such as the cache manifest
+    virtual bool readFile(String8 path, String8* contents) = 0;
+    virtual bool writeFile(String8 path, const String8& contents) = 0;
 private:
 };
 
@@ -98,12 +113,81 @@ public:
     };
 
     // Process an image from source out to dest
-    virtual void processImage(String8 source, String8 dest)
+    virtual bool processImage(String8 source, String8 dest)
     {
         // Make sure we're trying to write to a directory that is extant
         ensureDirectoriesExist(dest.getPathDir());
 
-        preProcessImageToCache(bundle, source, dest);
+        return preProcessImageToCache(bundle, source, dest) == NO_ERROR;
+    };
+
+    // 128-bit content hash of the file, in hex
+    virtual bool hashFile(String8 path, String8* digest)
+    {
+        FILE* fp = fopen(path.string(), "rb");
+        if (fp == NULL)
+            return false;
+
+        ContentHasher hasher;
+        unsigned char buf[32768];
+        size_t count;
+        while ((count = fread(buf, 1, sizeof(buf), fp)) != 0)
+            hasher.update(buf, count);
+        bool ok = !ferror(fp);
+        fclose(fp);
+        if (!ok)
+            return false;
+
+        *digest = hasher.digest128().toString();
+        return true;
+    };
+
+    // Only the grayscale tolerance changes the output of the crunch;
+    // bump the version if preProcessImageToCache starts writing
+    // something different.
+    virtual String8 getSettingsKey()
+    {
+        return String8::format("v1,gray=%d", bundle->getGrayscaleTolerance());
+    };
+
+    virtual bool readFile(String8 path, String8* contents)
+    {
+        FILE* fp = fopen(path.string(), "rb");
+        if (fp == NULL)
+            return false;
+
+        contents->clear();
+        char buf[8192];
+        size_t count;
+        while ((count = fread(buf, 1, sizeof(buf), fp)) != 0)
+            contents->append(buf, count);
+        bool ok = !ferror(fp);
+        fclose(fp);
+        return ok;
+    };
+
+    // Written to a temporary file first, so an interrupted build never
+    // leaves a truncated file behind
+    virtual bool writeFile(String8 path, const String8& contents)
+    {
+        ensureDirectoriesExist(path.getPathDir());
+        String8 tmpPath(path);
+        tmpPath.append(".tmp");
+        FILE* fp = fopen(tmpPath.string(), "wb");
+        if (fp == NULL)
+            return false;
+
+        bool ok = fwrite(contents.string(), 1, contents.length(), fp) == contents.length();
+        ok = (fclose(fp) == 0) && ok;
+#ifdef _WIN32
+        // rename() won't replace an existing file here
+        ::remove(path.string());
+#endif
+        if (!ok || rename(tmpPath.string(), path.string()) != 0) {
+            ::remove(tmpPath.string());
+            return false;
+        }
+        return true;
     };
 private:
     Bundle* bundle;
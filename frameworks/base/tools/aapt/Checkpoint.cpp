@@ -0,0 +1,251 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// What a package run made, kept for later runs, for --checkpoint.
+//
+
+#include "Checkpoint.h"
+#include "AaptContext.h"
+#include "ZipEntry.h"
+#include "ZipFile.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+using namespace android;
+
+const char* const Checkpoint::kDir = "aapt-checkpoint/";
+
+namespace {
+
+// The entries under kDir are stored at this alignment, as zipalign would.
+const int kAlignment = 4;
+
+void* newCheckpoint()
+{
+    return new Checkpoint();
+}
+
+void deleteCheckpoint(void* checkpoint)
+{
+    delete static_cast<Checkpoint*>(checkpoint);
+}
+
+/*
+ * Makes the directories of "path" up to its last component, which is
+ * the file to be written.
+ */
+void makeParentDirs(const String8& path)
+{
+    const char* start = path.string();
+    for (const char* s = strchr(start + 1, '/'); s != NULL; s = strchr(s + 1, '/')) {
+        String8 dir(start, s - start);
+#ifdef _WIN32
+        _mkdir(dir.string());
+#else
+        mkdir(dir.string(), S_IRUSR|S_IWUSR|S_IXUSR|S_IRGRP|S_IXGRP);
+#endif
+    }
+}
+
+status_t writeFile(const String8& path, const void* data, size_t size)
+{
+    makeParentDirs(path);
+    FILE* fp = fopen(path.string(), "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: Unable to open %s: %s\n", path.string(), strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+    bool ok = fwrite(data, 1, size, fp) == size;
+    if (fclose(fp) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        fprintf(stderr, "ERROR: Unable to write %s: %s\n", path.string(), strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+    return NO_ERROR;
+}
+
+/*
+ * Writes the output "name" of the checkpoint "zip" to "path".  Fails if
+ * the checkpoint doesn't hold it, since the run that wrote it wasn't
+ * asked for it.
+ */
+status_t restoreOutput(ZipFile* zip, const char* checkpointPath, const char* name,
+        const String8& path)
+{
+    String8 entryName(Checkpoint::kDir);
+    entryName.append(name);
+    ZipEntry* entry = zip->getEntryByName(entryName.string());
+    if (entry == NULL) {
+        fprintf(stderr, "ERROR: checkpoint %s holds no %s\n", checkpointPath, name);
+        return NAME_NOT_FOUND;
+    }
+    void* data = zip->uncompress(entry);
+    if (data == NULL) {
+        fprintf(stderr, "ERROR: Unable to read %s from checkpoint %s\n", name, checkpointPath);
+        return UNKNOWN_ERROR;
+    }
+    status_t err = writeFile(path, data, entry->getUncompressedLen());
+    free(data);
+    return err;
+}
+
+} // namespace
+
+Checkpoint* Checkpoint::current(const Bundle* bundle)
+{
+    if (bundle->getCheckpointFile() == NULL) {
+        return NULL;
+    }
+    return static_cast<Checkpoint*>(AaptContext::current()->getState(
+            AaptContext::STATE_CHECKPOINT, newCheckpoint, deleteCheckpoint));
+}
+
+void Checkpoint::addOutput(const char* name, const void* data, size_t size)
+{
+    mOutputs.add(String8(name), String8(static_cast<const char*>(data), size));
+}
+
+status_t Checkpoint::write(const char* path, const char* apkPath) const
+{
+    ZipFile zip;
+    status_t err = zip.open(path, ZipFile::kOpenReadWrite | ZipFile::kOpenTruncate);
+    if (err != NO_ERROR) {
+        fprintf(stderr, "ERROR: Unable to open checkpoint %s\n", path);
+        return err;
+    }
+
+    String8 version = String8::format("%d\n", kVersion);
+    String8 name(kDir);
+    name.append("VERSION");
+    err = zip.add(version.string(), version.size(), name.string(), ZipEntry::kCompressStored,
+            ZipFile::kCompressLevelDefault, kAlignment, NULL);
+    for (size_t i = 0; err == NO_ERROR && i < mOutputs.size(); i++) {
+        const String8& data = mOutputs.valueAt(i);
+        name = kDir;
+        name.append(mOutputs.keyAt(i));
+        err = zip.add(data.string(), data.size(), name.string(), ZipEntry::kCompressStored,
+                ZipFile::kCompressLevelDefault, kAlignment, NULL);
+    }
+
+    if (err == NO_ERROR && apkPath != NULL) {
+        ZipFile apk;
+        err = apk.open(apkPath, ZipFile::kOpenReadOnly);
+        if (err != NO_ERROR) {
+            fprintf(stderr, "ERROR: Unable to open %s for checkpoint %s\n", apkPath, path);
+            return err;
+        }
+        const int N = apk.getNumEntries();
+        for (int i = 0; err == NO_ERROR && i < N; i++) {
+            err = zip.add(&apk, apk.getEntryByIndex(i), 0, NULL);
+        }
+    }
+
+    if (err == NO_ERROR) {
+        err = zip.flush();
+    }
+    if (err != NO_ERROR) {
+        fprintf(stderr, "ERROR: Unable to write checkpoint %s\n", path);
+    }
+    return err;
+}
+
+int Checkpoint::restore(const Bundle* bundle)
+{
+    const char* path = bundle->getFromCheckpoint();
+    ZipFile zip;
+    if (zip.open(path, ZipFile::kOpenReadOnly) != NO_ERROR) {
+        fprintf(stderr, "ERROR: Unable to open checkpoint %s\n", path);
+        return 1;
+    }
+
+    String8 versionName(kDir);
+    versionName.append("VERSION");
+    ZipEntry* versionEntry = zip.getEntryByName(versionName.string());
+    int version = -1;
+    if (versionEntry != NULL) {
+        char* data = static_cast<char*>(zip.uncompress(versionEntry));
+        if (data != NULL) {
+            version = atoi(String8(data, versionEntry->getUncompressedLen()).string());
+            free(data);
+        }
+    }
+    if (version != kVersion) {
+        fprintf(stderr, "ERROR: %s is not a version %d checkpoint\n", path, kVersion);
+        return 1;
+    }
+
+    if (bundle->getRClassDir() != NULL) {
+        String8 prefix(kDir);
+        prefix.append("java/");
+        const int N = zip.getNumEntries();
+        for (int i = 0; i < N; i++) {
+            const char* name = zip.getEntryByIndex(i)->getFileName();
+            if (strncmp(name, prefix.string(), prefix.size()) != 0) {
+                continue;
+            }
+            String8 dest(bundle->getRClassDir());
+            dest.appendPath(name + prefix.size());
+            if (bundle->getVerbose()) {
+                printf("  Writing %s from checkpoint.\n", dest.string());
+            }
+            if (restoreOutput(&zip, path, name + strlen(kDir), dest) != NO_ERROR) {
+                return 1;
+            }
+        }
+    }
+
+    if (bundle->getOutputTextSymbols() != NULL) {
+        String8 dest(bundle->getOutputTextSymbols());
+        dest.appendPath("R.txt");
+        if (restoreOutput(&zip, path, "R.txt", dest) != NO_ERROR) {
+            return 1;
+        }
+    }
+
+    if (bundle->getProguardFile() != NULL
+            && restoreOutput(&zip, path, "proguard.txt",
+                    String8(bundle->getProguardFile())) != NO_ERROR) {
+        return 1;
+    }
+
+    if (bundle->getOutputAPKFile() != NULL) {
+        // The checkpoint's own entries all come first.
+        const size_t dirLen = strlen(kDir);
+        const int N = zip.getNumEntries();
+        int first = 0;
+        while (first < N && strncmp(zip.getEntryByIndex(first)->getFileName(),
+                kDir, dirLen) == 0) {
+            first++;
+        }
+        if (first == N) {
+            fprintf(stderr, "ERROR: checkpoint %s holds no package\n", path);
+            return 1;
+        }
+
+        ZipFile apk;
+        status_t err = apk.open(bundle->getOutputAPKFile(),
+                ZipFile::kOpenReadWrite | ZipFile::kOpenTruncate);
+        for (int i = first; err == NO_ERROR && i < N; i++) {
+            err = apk.add(&zip, zip.getEntryByIndex(i), 0, NULL);
+        }
+        if (err == NO_ERROR) {
+            err = apk.flush();
+        }
+        if (err != NO_ERROR) {
+            fprintf(stderr, "ERROR: Unable to write %s from checkpoint %s\n",
+                    bundle->getOutputAPKFile(), path);
+            return 1;
+        }
+    }
+
+    return 0;
+}
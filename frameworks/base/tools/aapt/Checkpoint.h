@@ -0,0 +1,64 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// What a package run made, kept for later runs, for --checkpoint.
+//
+
+#ifndef AAPT_CHECKPOINT_H
+#define AAPT_CHECKPOINT_H
+
+#include "Bundle.h"
+
+#include <utils/Errors.h>
+#include <utils/KeyedVector.h>
+#include <utils/String8.h>
+
+/*
+ * A checkpoint holds what a package run has made once its resources have
+ * IDs and its files are compiled: the R classes, R.txt, the ProGuard keep
+ * rules and the entries of the APK.  A later run with --from-checkpoint
+ * writes any of those again without reading a single source, for tools
+ * that only need the symbols or the rules.
+ *
+ * It is a zip file.  The entries of the APK are copied into it as they
+ * are; the rest sit under kDir, stored and 4-byte aligned so that readers
+ * can map the file and use them in place, with a VERSION file first.
+ */
+class Checkpoint {
+public:
+    // Written into VERSION, and raised whenever the layout changes.
+    static const int kVersion = 1;
+
+    // The directory of the entries that aren't the APK's.
+    static const char* const kDir;
+
+    /*
+     * The checkpoint the current run gathers outputs in, or NULL if it
+     * isn't writing one.  Only the run's own thread adds to it.
+     */
+    static Checkpoint* current(const Bundle* bundle);
+
+    /*
+     * Keeps "size" bytes of "data" as the output "name": "R.txt",
+     * "proguard.txt" or the path of an R class under "java/".
+     */
+    void addOutput(const char* name, const void* data, size_t size);
+
+    /*
+     * Writes the checkpoint to "path", along with the entries of the APK
+     * at "apkPath" unless it is NULL.
+     */
+    android::status_t write(const char* path, const char* apkPath) const;
+
+    /*
+     * Writes what "bundle" asks for, -J, --output-text-symbols, -G and -F,
+     * from the checkpoint it names with --from-checkpoint.  Returns 0 on
+     * success, as the other commands do.
+     */
+    static int restore(const Bundle* bundle);
+
+private:
+    android::KeyedVector<android::String8, android::String8> mOutputs;
+};
+
+#endif // AAPT_CHECKPOINT_H
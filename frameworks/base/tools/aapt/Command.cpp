@@ -3,13 +3,26 @@
 //
 // Android Asset Packaging Tool main entry point.
 //
+#include "AaptContext.h"
 #include "AaptXml.h"
 #include "ApkBuilder.h"
 #include "Bundle.h"
+#include "Checkpoint.h"
+#include "CompileCache.h"
+#include "CrunchWorkers.h"
+#include "DaemonStats.h"
+#include "FileCosts.h"
+#include "FileWatcher.h"
 #include "Images.h"
 #include "Main.h"
+#include "MemStats.h"
+#include "PhaseTrace.h"
+#include "RemoteCache.h"
+#include "StartupProfile.h"
 #include "ResourceFilter.h"
 #include "ResourceTable.h"
+#include "Statistics.h"
+#include "WorkQueue.h"
 #include "XMLNode.h"
 
 #include <utils/Errors.h>
@@ -22,9 +35,16 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 #include <iostream>
 #include <string>
+#include <vector>
 #include <sstream>
 
 using namespace android;
@@ -223,7 +243,7 @@ int doList(Bundle* bundle)
         const ResTable& res = assets.getResources(false);
         if (!kHaveAndroidOs) {
             printf("\nResource table:\n");
-            res.print(false);
+            res.print(false, bundle->getJobs());
         }
 
         Asset* manifestAsset = assets.openNonAsset("AndroidManifest.xml",
@@ -247,6 +267,170 @@ bail:
     return result;
 }
 
+// The most uncompressed bytes "verify" holds at once; a larger entry is
+// checked on its own.
+static const size_t kVerifyBatchBytes = 64 * 1024 * 1024;
+
+/*
+ * Whether the entry "name" of an APK must be compiled XML: the manifest,
+ * and the XML resources other than raw ones.
+ */
+static bool isCompiledXmlEntry(const String8& name)
+{
+    if (name == "AndroidManifest.xml") {
+        return true;
+    }
+    return strncmp(name.string(), "res/", 4) == 0 && strncmp(name.string(), "res/raw", 7) != 0
+            && name.getPathExtension() == ".xml";
+}
+
+/*
+ * Check that the uncompressed entry "name" parses, if it is one of those
+ * aapt compiles.  Returns false, after saying why, if it doesn't.
+ */
+static bool verifyEntryStructure(const char* zipFileName, const String8& name,
+        const void* data, size_t size)
+{
+    if (name == "resources.arsc") {
+        ResTable table;
+        if (table.add(data, size) != NO_ERROR) {
+            fprintf(stderr, "ERROR: '%s' in '%s' is not a valid resource table\n",
+                    name.string(), zipFileName);
+            return false;
+        }
+    } else if (isCompiledXmlEntry(name)) {
+        ResXMLTree tree;
+        ResXMLParser::event_code_t code = ResXMLParser::BAD_DOCUMENT;
+        if (tree.setTo(data, size) == NO_ERROR) {
+            while ((code = tree.next()) != ResXMLParser::END_DOCUMENT
+                    && code != ResXMLParser::BAD_DOCUMENT) {
+            }
+        }
+        if (code != ResXMLParser::END_DOCUMENT) {
+            fprintf(stderr, "ERROR: '%s' in '%s' is not valid compiled XML\n",
+                    name.string(), zipFileName);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Uncompress every entry of "zipFileName" and check it against its CRC,
+ * the entries of a batch shared among --jobs threads, then check the
+ * structure of the resource table and the compiled XML.  Adds the bytes
+ * read and uncompressed to "*pCompBytes" and "*pUncompBytes".
+ */
+static bool verifyArchive(Bundle* bundle, const char* zipFileName,
+        uint64_t* pCompBytes, uint64_t* pUncompBytes)
+{
+    ZipFileRO* zip = ZipFileRO::open(zipFileName);
+    if (zip == NULL) {
+        fprintf(stderr, "ERROR: failed opening '%s' as Zip file\n", zipFileName);
+        return false;
+    }
+
+    // Iteration hands back the same entry each time, so the names are
+    // gathered first and looked up again for entries that stay valid.
+    Vector<String8> names;
+    void* cookie;
+    if (zip->startIteration(&cookie)) {
+        ZipEntryRO entry;
+        char name[PATH_MAX];
+        while ((entry = zip->nextEntry(cookie)) != NULL) {
+            if (zip->getEntryFileName(entry, name, sizeof(name)) == 0) {
+                names.add(String8(name));
+            }
+        }
+        zip->endIteration(cookie);
+    }
+    if ((int) names.size() != zip->getNumEntries()) {
+        fprintf(stderr, "ERROR: unable to list the entries of '%s'\n", zipFileName);
+        delete zip;
+        return false;
+    }
+
+    const size_t jobs = bundle->getJobs() > 0 ? bundle->getJobs() : 1;
+    bool ok = true;
+    size_t i = 0;
+    while (i < names.size()) {
+        Vector<ZipFileRO::Extraction> batch;
+        size_t batchBytes = 0;
+        for (; i < names.size() && (batch.isEmpty() || batchBytes < kVerifyBatchBytes); i++) {
+            ZipFileRO::Extraction e;
+            e.entry = zip->findEntryByName(names[i].string());
+            uint32_t uncompLen = 0, compLen = 0;
+            if (e.entry == NULL
+                    || !zip->getEntryInfo(e.entry, NULL, &uncompLen, &compLen, NULL, NULL, NULL)) {
+                fprintf(stderr, "ERROR: unable to find '%s' in '%s'\n", names[i].string(),
+                        zipFileName);
+                ok = false;
+            }
+            e.size = uncompLen;
+            e.buffer = malloc(uncompLen > 0 ? uncompLen : 1);
+            e.ok = false;
+            batch.add(e);
+            batchBytes += uncompLen;
+            *pCompBytes += compLen;
+            *pUncompBytes += uncompLen;
+        }
+
+        zip->uncompressEntries(batch.editArray(), batch.size(), jobs, true);
+
+        const size_t first = i - batch.size();
+        for (size_t j = 0; j < batch.size(); j++) {
+            const ZipFileRO::Extraction& e = batch[j];
+            const String8& name = names[first + j];
+            if (e.entry != NULL && !e.ok) {
+                fprintf(stderr, "ERROR: '%s' in '%s' failed to uncompress or its CRC"
+                        " doesn't match\n", name.string(), zipFileName);
+                ok = false;
+            } else if (e.ok && !verifyEntryStructure(zipFileName, name, e.buffer, e.size)) {
+                ok = false;
+            } else if (e.ok && bundle->getVerbose()) {
+                printf("  OK  %s\n", name.string());
+            }
+            if (e.entry != NULL) {
+                zip->releaseEntry(e.entry);
+            }
+            free(e.buffer);
+        }
+    }
+
+    delete zip;
+    return ok;
+}
+
+/*
+ * Handle the "verify" command, which uncompresses each entry of the
+ * archives it is given, and prints how fast they were read.
+ */
+int doVerify(Bundle* bundle)
+{
+    if (bundle->getFileSpecCount() < 1) {
+        fprintf(stderr, "ERROR: specify zip file name\n");
+        return 1;
+    }
+
+    int result = 0;
+    for (int i = 0; i < bundle->getFileSpecCount(); i++) {
+        const char* zipFileName = bundle->getFileSpecEntry(i);
+        uint64_t compBytes = 0, uncompBytes = 0;
+        const nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        const bool ok = verifyArchive(bundle, zipFileName, &compBytes, &uncompBytes);
+        const double secs = (systemTime(SYSTEM_TIME_MONOTONIC) - start) / 1e9;
+        const double mb = 1024.0 * 1024.0;
+        printf("%s: %s, %.1f MB read, %.1f MB uncompressed in %.3fs"
+                " (%.1f MB/s read, %.1f MB/s uncompressed)\n",
+                zipFileName, ok ? "OK" : "FAILED", compBytes / mb, uncompBytes / mb, secs,
+                secs > 0 ? compBytes / mb / secs : 0.0, secs > 0 ? uncompBytes / mb / secs : 0.0);
+        if (!ok) {
+            result = 1;
+        }
+    }
+    return result;
+}
+
 static void printResolvedResourceAttribute(const ResTable& resTable, const ResXMLTree& tree,
         uint32_t attrRes, String8 attrLabel, String8* outError)
 {
@@ -576,24 +760,47 @@ static void addParentFeatures(FeatureGroup* grp, const String8& name) {
  * Handle the "dump" command, to extract select data from an archive.
  */
 extern char CONSOLE_DATA[2925]; // see EOF
-int doDump(Bundle* bundle)
+/*
+ * Whether a dump option resolves references, and so loads the -I
+ * packages.  The others print the whole resource table, which would then
+ * include the packages.
+ */
+static bool dumpUsesIncludes(const char* option)
 {
-    status_t result = UNKNOWN_ERROR;
-
-    if (bundle->getFileSpecCount() < 1) {
-        fprintf(stderr, "ERROR: no dump option specified\n");
-        return 1;
-    }
+    return strcmp("resources", option) != 0 && strcmp("strings", option) != 0
+            && strcmp("configurations", option) != 0 && strcmp("permissions", option) != 0;
+}
 
-    if (bundle->getFileSpecCount() < 2) {
-        fprintf(stderr, "ERROR: no dump file specified\n");
-        return 1;
-    }
+/*
+ * Whether a dump option reads the resource table.  "permissions" prints
+ * manifest attributes without resolving them, so it skips parsing
+ * resources.arsc and the -I packages altogether.
+ */
+static bool dumpUsesResources(const char* option)
+{
+    return strcmp("permissions", option) != 0;
+}
 
-    const char* option = bundle->getFileSpecEntry(0);
-    const char* filename = bundle->getFileSpecEntry(1);
+/*
+ * Dump "option" of one file.  The resource names xmltree and xmlstrings
+ * take are the file specs from "firstResource" on.
+ */
+static int dumpFile(Bundle* bundle, const char* option, const char* filename,
+                    int firstResource)
+{
+    status_t result = UNKNOWN_ERROR;
 
     AssetManager assets;
+    if (dumpUsesIncludes(option)) {
+        const Vector<String8>& includes = bundle->getPackageIncludes();
+        for (size_t i = 0; i < includes.size(); i++) {
+            if (!assets.addAssetPath(includes[i], NULL)) {
+                fprintf(stderr, "ERROR: dump failed because %s could not be loaded\n",
+                        includes[i].string());
+                return 1;
+            }
+        }
+    }
     int32_t assetsCookie;
     if (!assets.addAssetPath(String8(filename), &assetsCookie)) {
         fprintf(stderr, "ERROR: dump failed because assets could not be loaded\n");
@@ -620,21 +827,25 @@ int doDump(Bundle* bundle)
     config.screenLayout |= ResTable_config::SCREENSIZE_NORMAL;
     assets.setConfiguration(config);
 
-    const ResTable& res = assets.getResources(false);
-    if (res.getError() != NO_ERROR) {
+    const bool usesResources = dumpUsesResources(option);
+    ResTable noResources;
+    const ResTable& res = usesResources ? assets.getResources(false) : noResources;
+    if (usesResources && res.getError() != NO_ERROR) {
         fprintf(stderr, "ERROR: dump failed because the resource table is invalid/corrupt.\n");
         return 1;
     }
 
     // The dynamicRefTable can be null if there are no resources for this asset cookie.
     // This fine.
-    const DynamicRefTable* dynamicRefTable = res.getDynamicRefTableForCookie(assetsCookie);
+    const DynamicRefTable* dynamicRefTable = usesResources
+            ? res.getDynamicRefTableForCookie(assetsCookie) : NULL;
 
     Asset* asset = NULL;
 
     if (strcmp("resources", option) == 0) {
 #ifndef __ANDROID__
-        res.print(bundle->getValues());
+        res.print(bundle->getValues(), bundle->getJobs(),
+                bundle->getJson() ? ResTable::PRINT_JSON_LINES : ResTable::PRINT_TEXT);
 #endif
 
     } else if (strcmp("strings", option) == 0) {
@@ -642,12 +853,12 @@ int doDump(Bundle* bundle)
         printStringPool(pool);
 
     } else if (strcmp("xmltree", option) == 0) {
-        if (bundle->getFileSpecCount() < 3) {
+        if (bundle->getFileSpecCount() <= firstResource) {
             fprintf(stderr, "ERROR: no dump xmltree resource file specified\n");
             goto bail;
         }
 
-        for (int i=2; i<bundle->getFileSpecCount(); i++) {
+        for (int i=firstResource; i<bundle->getFileSpecCount(); i++) {
             const char* resname = bundle->getFileSpecEntry(i);
             ResXMLTree tree(dynamicRefTable);
             asset = assets.openNonAsset(assetsCookie, resname, Asset::ACCESS_BUFFER);
@@ -669,12 +880,12 @@ int doDump(Bundle* bundle)
         }
 
     } else if (strcmp("xmlstrings", option) == 0) {
-        if (bundle->getFileSpecCount() < 3) {
+        if (bundle->getFileSpecCount() <= firstResource) {
             fprintf(stderr, "ERROR: no dump xmltree resource file specified\n");
             goto bail;
         }
 
-        for (int i=2; i<bundle->getFileSpecCount(); i++) {
+        for (int i=firstResource; i<bundle->getFileSpecCount(); i++) {
             const char* resname = bundle->getFileSpecEntry(i);
             asset = assets.openNonAsset(assetsCookie, resname, Asset::ACCESS_BUFFER);
             if (asset == NULL) {
@@ -2075,16 +2286,320 @@ bail:
     return (result != NO_ERROR);
 }
 
+/*
+ * Reads the files of a --batch list: one per line, from the named file or
+ * "-" for stdin.
+ */
+static status_t readBatchList(const char* listFile, Vector<String8>* outFiles)
+{
+    FILE* fp = strcmp(listFile, "-") == 0 ? stdin : fopen(listFile, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: Unable to open '%s': %s\n", listFile, strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+    char line[PATH_MAX + 2];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        size_t len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+        if (len > 0) {
+            outFiles->add(String8(line, len));
+        }
+    }
+    if (fp != stdin) {
+        fclose(fp);
+    }
+    return NO_ERROR;
+}
+
+static void printDumpRecordStart(const String8& file)
+{
+    printf("== begin %s\n", file.string());
+}
+
+static void printDumpRecordEnd(const String8& file, int result)
+{
+    printf("== end %d %s\n", result, file.string());
+}
+
+#if !defined(_WIN32)
+
+// What the workers of a batch dump share.  The results are -1 until their
+// file has been dumped.
+struct DumpBatchState {
+    size_t next;
+    int results[1];
+};
+
+/*
+ * Dumps the files of a batch until none are left, each claimed in turn,
+ * with its output and errors in "<dir>/<index>.out" and ".err".
+ */
+static void runDumpWorker(Bundle* bundle, const char* option, const Vector<String8>& files,
+                          const String8& dir, DumpBatchState* state)
+{
+    for (;;) {
+        const size_t i = __atomic_fetch_add(&state->next, 1, __ATOMIC_RELAXED);
+        if (i >= files.size()) {
+            break;
+        }
+        String8 outPath(dir);
+        outPath.appendPath(String8::format("%zu", i));
+        String8 errPath(outPath);
+        outPath.append(".out");
+        errPath.append(".err");
+
+        const int outFd = open(outPath.string(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        const int errFd = open(errPath.string(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (outFd < 0 || errFd < 0) {
+            continue;
+        }
+        dup2(outFd, STDOUT_FILENO);
+        dup2(errFd, STDERR_FILENO);
+        close(outFd);
+        close(errFd);
+
+        const int result = dumpFile(bundle, option, files[i].string(), 1);
+        fflush(stdout);
+        fflush(stderr);
+        __atomic_store_n(&state->results[i], result, __ATOMIC_RELAXED);
+    }
+}
+
+// Copies a dumped file's errors to stderr, each line after "prefix".
+static void copyDumpErrors(const String8& path, const String8& prefix)
+{
+    FILE* fp = fopen(path.string(), "r");
+    if (fp == NULL) {
+        return;
+    }
+    char line[1024];
+    bool lineStart = true;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (lineStart) {
+            fputs(prefix.string(), stderr);
+        }
+        fputs(line, stderr);
+        lineStart = line[strlen(line) - 1] == '\n';
+    }
+    if (!lineStart) {
+        fputc('\n', stderr);
+    }
+    fclose(fp);
+}
+
+// Copies a dumped file's output to stdout, ending it with a newline.
+static void copyDumpOutput(const String8& path)
+{
+    FILE* fp = fopen(path.string(), "rb");
+    if (fp == NULL) {
+        return;
+    }
+    char buf[8192];
+    size_t n;
+    char last = '\n';
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        fwrite(buf, 1, n, stdout);
+        last = buf[n - 1];
+    }
+    if (last != '\n') {
+        putchar('\n');
+    }
+    fclose(fp);
+}
+
+/*
+ * Dumps each of "files" in one of --jobs worker processes: the dump code
+ * prints to stdout, which threads would share.  The -I packages are
+ * loaded before the workers start, so the first one's resource table is
+ * parsed once and shared with every dump.  A worker that crashes is
+ * replaced, and its file reported as failed.
+ */
+static int runDumpBatch(Bundle* bundle, const char* option, const Vector<String8>& files)
+{
+    AssetManager includes;
+    if (dumpUsesIncludes(option)) {
+        const Vector<String8>& paths = bundle->getPackageIncludes();
+        for (size_t i = 0; i < paths.size(); i++) {
+            includes.addAssetPath(paths[i], NULL);
+        }
+        includes.getResources(false);
+    }
+
+    const char* tmp = getenv("TMPDIR");
+    String8 dir(tmp != NULL && tmp[0] != '\0' ? tmp : "/tmp");
+    dir.appendPath("aapt-dump-XXXXXX");
+    if (mkdtemp(dir.lockBuffer(dir.size())) == NULL) {
+        dir.unlockBuffer();
+        fprintf(stderr, "ERROR: Unable to create a temporary directory: %s\n",
+                strerror(errno));
+        return 1;
+    }
+    dir.unlockBuffer();
+
+    const size_t stateSize = sizeof(DumpBatchState) + sizeof(int) * files.size();
+    DumpBatchState* state = (DumpBatchState*) mmap(NULL, stateSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (state == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Unable to map the batch state: %s\n", strerror(errno));
+        rmdir(dir.string());
+        return 1;
+    }
+    state->next = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+        state->results[i] = -1;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    const size_t jobs = bundle->getJobs() > 0 ? bundle->getJobs() : 1;
+    size_t running = 0;
+    for (;;) {
+        // Workers only exit early by crashing, so this starts the first
+        // ones and then replaces those.
+        while (running < jobs
+                && __atomic_load_n(&state->next, __ATOMIC_RELAXED) < files.size()) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                runDumpWorker(bundle, option, files, dir, state);
+                fflush(stdout);
+                _exit(0);
+            } else if (pid < 0) {
+                fprintf(stderr, "ERROR: Unable to start a dump worker: %s\n", strerror(errno));
+                break;
+            }
+            running++;
+        }
+        if (running == 0 || wait(NULL) < 0) {
+            break;
+        }
+        running--;
+    }
+
+    int failures = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+        String8 path(dir);
+        path.appendPath(String8::format("%zu", i));
+        String8 outPath(path);
+        String8 errPath(path);
+        outPath.append(".out");
+        errPath.append(".err");
+
+        int result = state->results[i];
+        String8 prefix(files[i]);
+        prefix.append(": ");
+        copyDumpErrors(errPath, prefix);
+        if (result < 0) {
+            fprintf(stderr, "%sERROR: dump did not finish\n", prefix.string());
+            result = 1;
+        }
+        printDumpRecordStart(files[i]);
+        copyDumpOutput(outPath);
+        printDumpRecordEnd(files[i], result);
+        if (result != 0) {
+            failures++;
+        }
+        unlink(outPath.string());
+        unlink(errPath.string());
+    }
+    rmdir(dir.string());
+    munmap(state, stateSize);
+    return failures > 0;
+}
+
+#else
+
+// Without fork, the files are dumped one at a time, straight to stdout.
+static int runDumpBatch(Bundle* bundle, const char* option, const Vector<String8>& files)
+{
+    AssetManager includes;
+    if (dumpUsesIncludes(option)) {
+        const Vector<String8>& paths = bundle->getPackageIncludes();
+        for (size_t i = 0; i < paths.size(); i++) {
+            includes.addAssetPath(paths[i], NULL);
+        }
+        includes.getResources(false);
+    }
+
+    int failures = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+        printDumpRecordStart(files[i]);
+        fflush(stdout);
+        const int result = dumpFile(bundle, option, files[i].string(), 1);
+        fflush(stdout);
+        fflush(stderr);
+        printDumpRecordEnd(files[i], result);
+        if (result != 0) {
+            failures++;
+        }
+    }
+    return failures > 0;
+}
+
+#endif // !defined(_WIN32)
+
+/*
+ * Handle the "dump" command, for one file or, with --batch, for each of a
+ * list of files.  Each file of a batch is a record:
+ *   == begin <file>
+ *   <the dump of the file>
+ *   == end <exit status> <file>
+ * in the order of the list, with errors on stderr after "<file>: ".
+ */
+int doDump(Bundle* bundle)
+{
+    if (bundle->getFileSpecCount() < 1) {
+        fprintf(stderr, "ERROR: no dump option specified\n");
+        return 1;
+    }
+    const char* option = bundle->getFileSpecEntry(0);
+
+    if (bundle->getBatchList() != NULL) {
+        Vector<String8> files;
+        if (readBatchList(bundle->getBatchList(), &files) != NO_ERROR) {
+            return 1;
+        }
+        return runDumpBatch(bundle, option, files);
+    }
+
+    if (bundle->getFileSpecCount() < 2) {
+        fprintf(stderr, "ERROR: no dump file specified\n");
+        return 1;
+    }
+    return dumpFile(bundle, option, bundle->getFileSpecEntry(1), 2);
+}
+
+
+/*
+ * Gets the files "add" or "remove" works on: those after the archive on
+ * the command line, or with --batch, those listed.
+ */
+static status_t getArchiveMembers(const Bundle* bundle, Vector<String8>* outFiles)
+{
+    if (bundle->getBatchList() != NULL) {
+        return readBatchList(bundle->getBatchList(), outFiles);
+    }
+    for (int i = 1; i < bundle->getFileSpecCount(); i++) {
+        outFiles->add(String8(bundle->getFileSpecEntry(i)));
+    }
+    return NO_ERROR;
+}
 
 /*
  * Handle the "add" command, which wants to add files to a new or
  * pre-existing archive.
+ *
+ * With --batch, the files listed replace any entries of the same name,
+ * and the archive is written again once with all of them.
  */
 int doAdd(Bundle* bundle)
 {
     ZipFile* zip = NULL;
     status_t result = UNKNOWN_ERROR;
     const char* zipFileName;
+    Vector<String8> files;
+    ZipFile::Batch* batch = NULL;
 
     if (bundle->getUpdate()) {
         /* avoid confusion */
@@ -2098,7 +2613,10 @@ int doAdd(Bundle* bundle)
     }
     zipFileName = bundle->getFileSpecEntry(0);
 
-    if (bundle->getFileSpecCount() < 2) {
+    if (getArchiveMembers(bundle, &files) != NO_ERROR) {
+        goto bail;
+    }
+    if (files.isEmpty()) {
         fprintf(stderr, "NOTE: nothing to do\n");
         goto bail;
     }
@@ -2108,27 +2626,43 @@ int doAdd(Bundle* bundle)
         fprintf(stderr, "ERROR: failed opening/creating '%s' as Zip file\n", zipFileName);
         goto bail;
     }
+    if (bundle->getBatchList() != NULL) {
+        batch = new ZipFile::Batch(zip);
+    }
 
-    for (int i = 1; i < bundle->getFileSpecCount(); i++) {
-        const char* fileName = bundle->getFileSpecEntry(i);
+    for (size_t i = 0; i < files.size(); i++) {
+        const char* fileName = files[i].string();
 
-        if (strcasecmp(String8(fileName).getPathExtension().string(), ".gz") == 0) {
+        if (strcasecmp(files[i].getPathExtension().string(), ".gz") == 0) {
             printf(" '%s'... (from gzip)\n", fileName);
-            result = zip->addGzip(fileName, String8(fileName).getBasePath().string(), NULL);
+            String8 storageName = files[i].getBasePath();
+            if (batch != NULL) {
+                batch->addGzip(fileName, storageName.string());
+                result = NO_ERROR;
+            } else {
+                result = zip->addGzip(fileName, storageName.string(), NULL);
+            }
         } else {
+            String8 storageName(files[i]);
             if (bundle->getJunkPath()) {
-                String8 storageName = String8(fileName).getPathLeaf();
+                storageName = files[i].getPathLeaf();
                 printf(" '%s' as '%s'...\n", fileName,
                         ResTable::normalizeForOutput(storageName.string()).string());
-                result = zip->add(fileName, storageName.string(),
-                                  bundle->getCompressionMethod(), NULL);
             } else {
                 printf(" '%s'...\n", fileName);
-                result = zip->add(fileName, bundle->getCompressionMethod(), NULL);
+            }
+            if (batch != NULL) {
+                batch->add(fileName, storageName.string(), bundle->getCompressionMethod(),
+                           bundle->getCompressionLevel());
+                result = NO_ERROR;
+            } else {
+                result = zip->add(fileName, storageName.string(),
+                                  bundle->getCompressionMethod(),
+                                  bundle->getCompressionLevel(), 0, NULL);
             }
         }
         if (result != NO_ERROR) {
-            fprintf(stderr, "Unable to add '%s' to '%s'", bundle->getFileSpecEntry(i), zipFileName);
+            fprintf(stderr, "Unable to add '%s' to '%s'", fileName, zipFileName);
             if (result == NAME_NOT_FOUND) {
                 fprintf(stderr, ": file not found\n");
             } else if (result == ALREADY_EXISTS) {
@@ -2140,9 +2674,19 @@ int doAdd(Bundle* bundle)
         }
     }
 
+    if (batch != NULL) {
+        result = batch->commit();
+        if (result != NO_ERROR) {
+            fprintf(stderr, "ERROR: Unable to update '%s'%s\n", zipFileName,
+                    result == NAME_NOT_FOUND ? ": file not found" : "");
+            goto bail;
+        }
+    }
+
     result = NO_ERROR;
 
 bail:
+    delete batch;
     delete zip;
     return (result != NO_ERROR);
 }
@@ -2150,12 +2694,17 @@ bail:
 
 /*
  * Delete files from an existing archive.
+ *
+ * The archive is written again once, without them, rather than having
+ * the entries after each one moved down in place.
  */
 int doRemove(Bundle* bundle)
 {
     ZipFile* zip = NULL;
     status_t result = UNKNOWN_ERROR;
     const char* zipFileName;
+    Vector<String8> files;
+    bool removed = false;
 
     if (bundle->getFileSpecCount() < 1) {
         fprintf(stderr, "ERROR: must specify zip file name\n");
@@ -2163,7 +2712,10 @@ int doRemove(Bundle* bundle)
     }
     zipFileName = bundle->getFileSpecEntry(0);
 
-    if (bundle->getFileSpecCount() < 2) {
+    if (getArchiveMembers(bundle, &files) != NO_ERROR) {
+        goto bail;
+    }
+    if (files.isEmpty()) {
         fprintf(stderr, "NOTE: nothing to do\n");
         goto bail;
     }
@@ -2175,28 +2727,27 @@ int doRemove(Bundle* bundle)
         goto bail;
     }
 
-    for (int i = 1; i < bundle->getFileSpecCount(); i++) {
-        const char* fileName = bundle->getFileSpecEntry(i);
-        ZipEntry* entry;
-
-        entry = zip->getEntryByName(fileName);
-        if (entry == NULL) {
-            printf(" '%s' NOT FOUND\n", fileName);
-            continue;
+    {
+        ZipFile::Batch batch(zip);
+        for (size_t i = 0; i < files.size(); i++) {
+            const char* fileName = files[i].string();
+            if (zip->getEntryByName(fileName) == NULL) {
+                printf(" '%s' NOT FOUND\n", fileName);
+                continue;
+            }
+            batch.remove(fileName);
+            removed = true;
         }
 
-        result = zip->remove(entry);
-
-        if (result != NO_ERROR) {
-            fprintf(stderr, "Unable to delete '%s' from '%s'\n",
-                bundle->getFileSpecEntry(i), zipFileName);
-            goto bail;
+        /* update the archive */
+        if (removed) {
+            result = batch.commit();
+            if (result != NO_ERROR) {
+                fprintf(stderr, "Unable to delete files from '%s'\n", zipFileName);
+            }
         }
     }
 
-    /* update the archive */
-    zip->flush();
-
 bail:
     delete zip;
     return (result != NO_ERROR);
@@ -2269,6 +2820,18 @@ int doPackage(Bundle* bundle)
     String8 dependencyFile;
     sp<ApkBuilder> builder;
 
+    if (bundle->getTraceOutput() != NULL) {
+        PhaseTrace::enable();
+    }
+    if (bundle->getCostReport() != NULL) {
+        FileCosts::enable(bundle->getCostReportTop());
+    }
+    if (bundle->getMemStats()) {
+        MemStats::enable();
+        MemStats::checkpoint("start");
+    }
+    PhaseSpan packageSpan("package");
+
     // -c en_XA or/and ar_XB means do pseudolocalization
     sp<WeakResourceFilter> configFilter = new WeakResourceFilter();
     err = configFilter->parse(bundle->getConfigurations());
@@ -2295,16 +2858,56 @@ int doPackage(Bundle* bundle)
     if (outputAPKFile) {
         FileType type;
         type = getFileType(outputAPKFile);
-        if (type != kFileTypeNonexistent && type != kFileTypeRegular) {
+        if (type == kFileTypeFifo || type == kFileTypeCharDev) {
+            // Streamed front to back; nothing can be read back from it or
+            // written next to it.
+            if (bundle->getUpdate() || bundle->getEntryDigests() || bundle->getV2Digests()
+                    || bundle->getGenDependencies() || bundle->getCheckpointFile() != NULL
+                    || bundle->getSplitConfigurations().size() > 0) {
+                fprintf(stderr,
+                    "ERROR: output '%s' is a pipe or device; -u, --split,"
+                    " --generate-dependencies, --checkpoint, --entry-digests and"
+                    " --v2-digests need a regular file\n",
+                    outputAPKFile);
+                goto bail;
+            }
+        } else if (type != kFileTypeNonexistent && type != kFileTypeRegular) {
             fprintf(stderr,
                 "ERROR: output file '%s' exists but is not regular file\n",
                 outputAPKFile);
             goto bail;
         }
     }
+    if (bundle->getResourceCacheRemote() != NULL) {
+        if (bundle->getResourceCacheDir() == NULL) {
+            fprintf(stderr, "ERROR: --resource-cache-remote needs a --resource-cache\n");
+            goto bail;
+        }
+        err = RemoteCache::setUrl(bundle->getResourceCacheRemote());
+        if (err == INVALID_OPERATION) {
+            fprintf(stderr, "ERROR: --resource-cache-remote is not supported on this host\n");
+            goto bail;
+        } else if (err != NO_ERROR) {
+            fprintf(stderr, "ERROR: invalid resource cache URL '%s'\n",
+                    bundle->getResourceCacheRemote());
+            goto bail;
+        }
+    }
+    if (!bundle->getCrunchWorkers().isEmpty() && bundle->getResourceCacheDir() == NULL) {
+        fprintf(stderr, "ERROR: --crunch-worker needs a --resource-cache\n");
+        goto bail;
+    }
+    if (bundle->getSpoolDir() != NULL
+            && getFileType(bundle->getSpoolDir()) != kFileTypeDirectory) {
+        fprintf(stderr, "ERROR: spool directory '%s' does not exist\n",
+                bundle->getSpoolDir());
+        goto bail;
+    }
 
     // Load the assets.
+    StartupProfile::mark("checkOptions");
     assets = new AaptAssets();
+    StartupProfile::mark("createAssets");
 
     // Set up the resource gathering in assets if we're going to generate
     // dependency files. Every time we encounter a resource while slurping
@@ -2317,10 +2920,15 @@ int doPackage(Bundle* bundle)
         assets->setFullAssetPaths(assetPathStore);
     }
 
-    err = assets->slurpFromArgs(bundle);
+    {
+        PhaseSpan span("slurpFromArgs");
+        err = assets->slurpFromArgs(bundle);
+    }
+    StartupProfile::mark("slurpFromArgs");
     if (err < 0) {
         goto bail;
     }
+    MemStats::checkpoint("slurpFromArgs");
 
     if (bundle->getVerbose()) {
         assets->print(String8());
@@ -2368,6 +2976,7 @@ int doPackage(Bundle* bundle)
     if (SourcePos::hasErrors()) {
         goto bail;
     }
+    assets->sortSymbols();
 
     // If we've been asked to generate a dependency file, do that here
     if (bundle->getGenDependencies()) {
@@ -2443,21 +3052,34 @@ int doPackage(Bundle* bundle)
     if (outputAPKFile) {
         // Gather all resources and add them to the APK Builder. The builder will then
         // figure out which Split they belong in.
-        err = addResourcesToBuilder(assets, builder);
+        {
+            PhaseSpan span("addResourcesToBuilder");
+            err = addResourcesToBuilder(assets, builder);
+        }
         if (err != NO_ERROR) {
             goto bail;
         }
 
         const Vector<sp<ApkSplit> >& splits = builder->getSplits();
         const size_t numSplits = splits.size();
+        Vector<String8> outputPaths;
+        Vector<sp<OutputSet> > outputSets;
         for (size_t i = 0; i < numSplits; i++) {
-            const sp<ApkSplit>& split = splits[i];
-            String8 outputPath = buildApkName(String8(outputAPKFile), split);
-            err = writeAPK(bundle, outputPath, split);
-            if (err != NO_ERROR) {
-                fprintf(stderr, "ERROR: packaging of '%s' failed\n", outputPath.string());
-                goto bail;
-            }
+            outputPaths.add(buildApkName(String8(outputAPKFile), splits[i]));
+            outputSets.add(splits[i]);
+        }
+        err = writeAPKs(bundle, outputPaths, outputSets);
+        if (err != NO_ERROR) {
+            goto bail;
+        }
+        MemStats::checkpoint("writeAPKs");
+    }
+
+    if (bundle->getCheckpointFile() != NULL) {
+        PhaseSpan span("writeCheckpoint");
+        err = Checkpoint::current(bundle)->write(bundle->getCheckpointFile(), outputAPKFile);
+        if (err != NO_ERROR) {
+            goto bail;
         }
     }
 
@@ -2478,10 +3100,42 @@ int doPackage(Bundle* bundle)
         fclose(fp);
     }
 
+    // Entries are still being sent to the server.
+    RemoteCache::finish();
+
+    if (bundle->getResourceCacheDir() != NULL && bundle->getResourceCacheLimit() > 0) {
+        CompileCache cache(bundle->getResourceCacheDir());
+        cache.trim((off64_t)bundle->getResourceCacheLimit() * 1024 * 1024);
+    }
+
     retVal = 0;
 bail:
+    // Prefetches still hold on to the bundle and assets.
+    RemoteCache::finish();
     if (SourcePos::hasErrors()) {
         SourcePos::printErrors(stderr);
+        if (AaptContext::current()->isCanceled()) {
+            fprintf(stderr, "Stopped at the first error (--fail-fast).\n");
+        }
+    }
+    packageSpan.end();
+    if (bundle->getVerbose()) {
+        Statistics::print(stdout);
+    }
+    if (bundle->getMemStats()) {
+        MemStats::print(stdout);
+    }
+    if (bundle->getTraceOutput() != NULL
+            && PhaseTrace::write(bundle->getTraceOutput()) != NO_ERROR) {
+        retVal = 1;
+    }
+    if (bundle->getCostReport() != NULL
+            && FileCosts::write(bundle->getCostReport()) != NO_ERROR) {
+        retVal = 1;
+    }
+    if (bundle->getDiagnosticsOutput() != NULL
+            && SourcePos::writeDiagnostics(bundle->getDiagnosticsOutput()) != NO_ERROR) {
+        retVal = 1;
     }
     return retVal;
 }
@@ -2529,11 +3183,466 @@ int doSingleCrunch(Bundle* bundle)
     return NO_ERROR;
 }
 
+/*
+ * Dispatch the command.
+ */
+int handleCommand(Bundle* bundle)
+{
+    //printf("--- command %d (verbose=%d force=%d):\n",
+    //    bundle->getCommand(), bundle->getVerbose(), bundle->getForce());
+    //for (int i = 0; i < bundle->getFileSpecCount(); i++)
+    //    printf("  %d: '%s'\n", i, bundle->getFileSpecEntry(i));
+
+    AaptContext::current()->setIgnoreAssets(bundle->getIgnoreAssets());
+    AaptContext::current()->setFailFast(bundle->getFailFast());
+
+    switch (bundle->getCommand()) {
+    case kCommandVersion:      return doVersion(bundle);
+    case kCommandList:         return doList(bundle);
+    case kCommandDump:         return doDump(bundle);
+    case kCommandAdd:          return doAdd(bundle);
+    case kCommandRemove:       return doRemove(bundle);
+    case kCommandPackage:      return doPackage(bundle);
+    case kCommandCrunch:       return doCrunch(bundle);
+    case kCommandSingleCrunch: return doSingleCrunch(bundle);
+    case kCommandDaemon:       return runInDaemonMode(bundle);
+    case kCommandVerify:       return doVerify(bundle);
+    case kCommandReplay:       return doReplay(bundle);
+    default:
+        fprintf(stderr, "aapt: requested command not yet supported\n");
+        return 1;
+    }
+}
+
+/*
+ * Holds on to the packages included by the last daemon request.  The
+ * AssetManager keeps their zips and resources.arsc data open, and the
+ * parsed table of the first one, so the next request that includes the
+ * same unchanged packages (typically android.jar) doesn't load them again.
+ */
+class IncludedResourcesCache {
+public:
+    IncludedResourcesCache() : mAssets(NULL) {}
+    ~IncludedResourcesCache() { delete mAssets; }
+
+    // Returns whether "includes" were those already held, unchanged.
+    bool update(const Vector<String8>& includes) {
+        if (mAssets != NULL && sameIncludes(includes) && mAssets->isUpToDate()) {
+            return true;
+        }
+        delete mAssets;
+        mAssets = NULL;
+        mIncludes.clear();
+        if (includes.isEmpty()) {
+            return false;
+        }
+
+        mAssets = new AssetManager();
+        for (size_t i = 0; i < includes.size(); i++) {
+            if (!mAssets->addAssetPath(includes[i], NULL)) {
+                // The request has already reported this.
+                delete mAssets;
+                mAssets = NULL;
+                return false;
+            }
+        }
+        mAssets->getResources(true);
+        mIncludes = includes;
+        return false;
+    }
+
+private:
+    bool sameIncludes(const Vector<String8>& includes) const {
+        if (includes.size() != mIncludes.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < includes.size(); i++) {
+            if (includes[i] != mIncludes[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    AssetManager* mAssets;
+    Vector<String8> mIncludes;
+};
+
+/*
+ * Run one full aapt command line from the daemon, counted in "stats" as a
+ * request of "kind".  Each request has its own AaptContext, so requests
+ * don't see each other's errors or resource IDs.
+ */
+static int runDaemonRequest(std::vector<std::string>& args,
+                            IncludedResourcesCache* includedResources,
+                            DaemonStats* stats, DaemonStats::Kind kind,
+                            Bundle* requestBundle)
+{
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>("aapt"));
+    for (size_t i = 0; i < args.size(); i++) {
+        argv.push_back(&args[i][0]);
+    }
+    argv.push_back(NULL);
+
+    stats->beginRequest();
+    if (args.empty() || args[0][0] == 'm') {
+        std::cerr << "ERROR: Unsupported daemon request" << std::endl;
+        stats->endRequest(kind, true);
+        return 2;
+    }
+
+    AaptContext context;
+    AaptContext::Scope scope(&context);
+    int result = runCommandLine(*requestBundle, argv.size() - 1, &argv[0]);
+    fflush(stdout);
+    fflush(stderr);
+
+    const Vector<String8>& includes = requestBundle->getPackageIncludes();
+    const bool reused = includedResources->update(includes);
+    if (!includes.isEmpty()) {
+        stats->addSnapshotLookup(reused);
+    }
+    stats->endRequest(kind, result != 0);
+    return result;
+}
+
+// How long a watch request waits for more changes before rebuilding.
+static const int kWatchSettleMs = 50;
+
+static void printDaemonResult(int result)
+{
+    std::cout << "Result " << result << std::endl;
+    std::cout << "Done" << std::endl;
+}
+
+/*
+ * Builds a package command line, then again each time its sources change,
+ * until another request comes in.  A rebuild updates the APK in place (-u),
+ * which leaves the entries of unchanged files alone, and is given the IDs
+ * of the build before (--stable-ids), so that only new resources get new
+ * IDs.  With a --resource-cache, the files that didn't change are taken
+ * from it rather than compiled again.
+ */
+static void runWatchRequest(std::vector<std::string> args,
+                            IncludedResourcesCache* includedResources,
+                            DaemonStats* stats)
+{
+    if (args.empty() || args[0][0] != 'p') {
+        std::cerr << "ERROR: A watch request must be a package command" << std::endl;
+        printDaemonResult(2);
+        return;
+    }
+
+    // The IDs go where the request asked for them, else to a file of our own.
+    std::string idsFile;
+    for (size_t i = 1; i + 1 < args.size(); i++) {
+        if (args[i] == "--emit-ids") {
+            idsFile = args[i + 1];
+        }
+    }
+    bool ownIdsFile = false;
+    if (idsFile.empty()) {
+        const char* tmp = getenv("TMPDIR");
+        String8 path(tmp != NULL && tmp[0] != '\0' ? tmp : "/tmp");
+        path.appendPath("aapt-ids-XXXXXX");
+        int fd = mkstemp(path.lockBuffer(path.size()));
+        path.unlockBuffer();
+        if (fd < 0) {
+            std::cerr << "ERROR: Unable to create a temporary file: " << strerror(errno)
+                    << std::endl;
+            printDaemonResult(1);
+            return;
+        }
+        close(fd);
+        idsFile = path.string();
+        ownIdsFile = true;
+        // Ahead of any raw file directories at the end.
+        args.insert(args.begin() + 1, idsFile);
+        args.insert(args.begin() + 1, "--emit-ids");
+    }
+
+    Bundle firstBundle;
+    int result = runDaemonRequest(args, includedResources, stats, DaemonStats::WATCH,
+            &firstBundle);
+
+    FileWatcher watcher;
+    status_t err = NO_ERROR;
+    if (firstBundle.getAndroidManifestFile() != NULL) {
+        err = watcher.addPath(String8(firstBundle.getAndroidManifestFile()));
+    }
+    const Vector<const char*>& resDirs = firstBundle.getResourceSourceDirs();
+    for (size_t i = 0; i < resDirs.size() && err == NO_ERROR; i++) {
+        err = watcher.addPath(String8(resDirs[i]));
+    }
+    const Vector<const char*>& assetDirs = firstBundle.getAssetSourceDirs();
+    for (size_t i = 0; i < assetDirs.size() && err == NO_ERROR; i++) {
+        err = watcher.addPath(String8(assetDirs[i]));
+    }
+    if (err != NO_ERROR && result == 0) {
+        result = 1;
+    }
+    printDaemonResult(result);
+
+    std::vector<std::string> rebuild;
+    rebuild.push_back(args[0]);
+    rebuild.push_back("-u");
+    rebuild.push_back("--stable-ids");
+    rebuild.push_back(idsFile);
+    for (size_t i = 1; i < args.size(); i++) {
+        if (args[i] == "--stable-ids" && i + 1 < args.size()) {
+            i++;
+        } else {
+            rebuild.push_back(args[i]);
+        }
+    }
+
+    // A line on stdin, the next request, ends the watch; it is read by the
+    // caller as usual.
+    Vector<String8> changed;
+    while (err == NO_ERROR && watcher.wait(STDIN_FILENO, kWatchSettleMs, &changed)) {
+        for (size_t i = 0; i < changed.size(); i++) {
+            std::cout << "Changed " << changed[i].string() << std::endl;
+        }
+        changed.clear();
+        Bundle rebuildBundle;
+        printDaemonResult(runDaemonRequest(rebuild, includedResources, stats,
+                DaemonStats::WATCH, &rebuildBundle));
+    }
+
+    if (ownIdsFile) {
+        unlink(idsFile.c_str());
+    }
+}
+
+/*
+ * Crunches one PNG of a daemon "b" request, and reports it as soon as it
+ * is done.
+ */
+class BatchCrunchWorkUnit : public WorkQueue::WorkUnit {
+public:
+    BatchCrunchWorkUnit(const Bundle* bundle, const std::string& input,
+            const std::string& output, Mutex* outputLock)
+        : mBundle(bundle), mInput(input), mOutput(output), mOutputLock(outputLock) { }
+
+    virtual bool run() {
+        status_t err = preProcessImageToCache(mBundle, String8(mInput.c_str()),
+                String8(mOutput.c_str()));
+        AutoMutex _l(*mOutputLock);
+        std::cout << (err == NO_ERROR ? "Crunched " : "Error ") << mInput << std::endl;
+        return true;
+    }
+
+private:
+    const Bundle* mBundle;
+    std::string mInput;
+    std::string mOutput;
+    Mutex* mOutputLock;
+};
+
+static int runBatchCrunch(const Bundle* bundle, const std::vector<std::string>& files)
+{
+    // The shared queue outlives the request, so the daemon keeps its
+    // threads from one batch to the next.
+    WorkQueue::setShared(bundle->getJobs(), bundle->getPinThreads());
+    Mutex outputLock;
+    WorkQueue::Group group(WorkQueue::getShared());
+    for (size_t i = 0; i + 1 < files.size(); i += 2) {
+        BatchCrunchWorkUnit* w = new BatchCrunchWorkUnit(bundle, files[i], files[i + 1],
+                &outputLock);
+        if (group.schedule(w) != NO_ERROR) {
+            delete w;
+            group.wait();
+            return -1;
+        }
+    }
+    group.wait();
+    return 0;
+}
+
+/*
+ * Preprocesses one PNG of a daemon "p" request into the resource cache, as
+ * packaging it would, and reports it as soon as it is done.
+ */
+class BatchPreProcessWorkUnit : public WorkQueue::WorkUnit {
+public:
+    BatchPreProcessWorkUnit(const Bundle* bundle, const std::string& input, Mutex* outputLock)
+        : mBundle(bundle), mInput(input), mOutputLock(outputLock) { }
+
+    virtual bool run() {
+        // The digest depends on the leaf name, which says if it is a 9-patch.
+        String8 source(mInput.c_str());
+        sp<AaptFile> file = new AaptFile(source, AaptGroupEntry(), String8("drawable"));
+        sp<AaptGroup> group = new AaptGroup(source.getPathLeaf(), source.getPathLeaf());
+        status_t err = group->addFile(file);
+        if (err == NO_ERROR) {
+            err = preProcessImage(mBundle, NULL, file, NULL);
+        }
+        AutoMutex _l(*mOutputLock);
+        std::cout << (err == NO_ERROR ? "Crunched " : "Error ") << mInput << std::endl;
+        return true;
+    }
+
+private:
+    const Bundle* mBundle;
+    std::string mInput;
+    Mutex* mOutputLock;
+};
+
+static int runBatchPreProcess(Bundle* bundle, const std::string& options,
+        const std::vector<std::string>& files)
+{
+    if (CrunchWorkers::applyImageOptions(bundle, options.c_str()) != NO_ERROR) {
+        std::cerr << "Bad image options" << std::endl;
+        return -1;
+    }
+    if (bundle->getResourceCacheDir() == NULL) {
+        std::cerr << "A p request needs a --resource-cache" << std::endl;
+        return -1;
+    }
+    if (bundle->getResourceCacheRemote() != NULL && !RemoteCache::isEnabled()
+            && RemoteCache::setUrl(bundle->getResourceCacheRemote()) != NO_ERROR) {
+        std::cerr << "Invalid resource cache URL" << std::endl;
+        return -1;
+    }
+
+    WorkQueue::setShared(bundle->getJobs(), bundle->getPinThreads());
+    Mutex outputLock;
+    WorkQueue::Group group(WorkQueue::getShared());
+    for (size_t i = 0; i < files.size(); i++) {
+        BatchPreProcessWorkUnit* w = new BatchPreProcessWorkUnit(bundle, files[i], &outputLock);
+        if (group.schedule(w) != NO_ERROR) {
+            delete w;
+            group.wait();
+            return -1;
+        }
+    }
+    group.wait();
+    // The build reads the images as soon as this request is done, so
+    // they must have reached the server by then.
+    RemoteCache::finish();
+    return 0;
+}
+
+/*
+ * Reads commands from stdin, one per line:
+ *   s              followed by an input and an output line: crunch one PNG
+ *   b N            followed by N pairs of input and output lines: crunch N
+ *                  PNGs on --jobs threads.  A line "Crunched <input>" or
+ *                  "Error <input>" follows as each one finishes, in no
+ *                  particular order, then "Done".
+ *   p N            followed by a line of image options and N lines, each
+ *                  the path of a PNG: preprocess them into the
+ *                  --resource-cache, as packaging would, on --jobs
+ *                  threads.  The options are those of
+ *                  CrunchWorkers::imageOptions().  Answered like "b".
+ *   r N            followed by N lines, one argument each: run the aapt
+ *                  command line formed by them, e.g. "package" "-M" ...
+ *                  Any output of the command comes first, then
+ *                  "Result <exit status>" and "Done".
+ *   w N            followed by N lines, one argument each, of a package
+ *                  command line: build it and answer as "r" does, then
+ *                  watch its -M file and -S and -A directories.  Each time
+ *                  they change, a line "Changed <path>" follows for each
+ *                  path, and the package is built again, updating the APK
+ *                  and keeping the resource IDs, and answered as "r".  The
+ *                  next request ends the watch.  Linux only.
+ *   stats          report what the daemon did since it started, or since
+ *                  the last "stats reset", as the lines below, then "Done".
+ *                  Times are in ms.
+ *                    Uptime <time>
+ *                  then for each of the commands r, w (each build), b, p
+ *                  and s:
+ *                    Requests <command> <count> <failed> <total time> <max time>
+ *                    Latency <command> <16 counts>
+ *                  where count i is of the requests that took less than
+ *                  2^i ms and at least 2^(i-1), and the last of the rest;
+ *                  then for the compile, deflate and remote caches, the
+ *                  included packages kept from one request to the next
+ *                  ("framework") and the resource ID cache:
+ *                    Cache <name> <hits> <misses> <hit percentage>
+ *                    Memory <resident bytes> <peak resident bytes>
+ *                    Threads <threads> <units run> <units stolen>
+ *                            <time units waited> <time units ran> <busy percentage>
+ *                  for the threads of the shared --jobs queue.  The peak
+ *                  resident size is of the whole life of the process.
+ *   stats reset    answer as "stats", then start counting again
+ *   quit           exit
+ */
 int runInDaemonMode(Bundle* bundle) {
+    // Requests don't start up, so --startup-profile has nothing to show them.
+    StartupProfile::stop();
+    IncludedResourcesCache includedResources;
+    DaemonStats stats;
+
     std::cout << "Ready" << std::endl;
     for (std::string cmd; std::getline(std::cin, cmd);) {
         if (cmd == "quit") {
             return NO_ERROR;
+        } else if (cmd.compare(0, 2, "r ") == 0) {
+            int count = atoi(cmd.c_str() + 2);
+            std::vector<std::string> args;
+            for (std::string arg; count > 0 && std::getline(std::cin, arg); count--) {
+                args.push_back(arg);
+            }
+            if (count > 0) {
+                std::cerr << "Truncated request" << std::endl;
+                return -1;
+            }
+            Bundle requestBundle;
+            printDaemonResult(runDaemonRequest(args, &includedResources, &stats,
+                    DaemonStats::RUN, &requestBundle));
+        } else if (cmd.compare(0, 2, "w ") == 0) {
+            int count = atoi(cmd.c_str() + 2);
+            std::vector<std::string> args;
+            for (std::string arg; count > 0 && std::getline(std::cin, arg); count--) {
+                args.push_back(arg);
+            }
+            if (count > 0) {
+                std::cerr << "Truncated request" << std::endl;
+                return -1;
+            }
+            runWatchRequest(args, &includedResources, &stats);
+        } else if (cmd.compare(0, 2, "b ") == 0) {
+            int count = atoi(cmd.c_str() + 2) * 2;
+            std::vector<std::string> files;
+            for (std::string file; count > 0 && std::getline(std::cin, file); count--) {
+                files.push_back(file);
+            }
+            if (count > 0) {
+                std::cerr << "Truncated request" << std::endl;
+                return -1;
+            }
+            stats.beginRequest();
+            const int result = runBatchCrunch(bundle, files);
+            stats.endRequest(DaemonStats::BATCH_CRUNCH, result != 0);
+            if (result != 0) {
+                std::cerr << "Unable to crunch" << std::endl;
+                return -1;
+            }
+            std::cout << "Done" << std::endl;
+        } else if (cmd.compare(0, 2, "p ") == 0) {
+            int count = atoi(cmd.c_str() + 2);
+            std::string options;
+            std::vector<std::string> files;
+            if (!std::getline(std::cin, options)) {
+                count = 1;
+            }
+            for (std::string file; count > 0 && std::getline(std::cin, file); count--) {
+                files.push_back(file);
+            }
+            if (count > 0) {
+                std::cerr << "Truncated request" << std::endl;
+                return -1;
+            }
+            stats.beginRequest();
+            const int result = runBatchPreProcess(bundle, options, files);
+            stats.endRequest(DaemonStats::PREPROCESS, result != 0);
+            if (result != 0) {
+                std::cerr << "Unable to preprocess" << std::endl;
+                return -1;
+            }
+            std::cout << "Done" << std::endl;
         } else if (cmd == "s") {
             // Two argument crunch
             std::string inputFile, outputFile;
@@ -2542,10 +3651,20 @@ int runInDaemonMode(Bundle* bundle) {
             bundle->setSingleCrunchInputFile(inputFile.c_str());
             bundle->setSingleCrunchOutputFile(outputFile.c_str());
             std::cout << "Crunching " << inputFile << std::endl;
-            if (doSingleCrunch(bundle) != NO_ERROR) {
+            stats.beginRequest();
+            const bool failed = doSingleCrunch(bundle) != NO_ERROR;
+            stats.endRequest(DaemonStats::SINGLE_CRUNCH, failed);
+            if (failed) {
                 std::cout << "Error" << std::endl;
             }
             std::cout << "Done" << std::endl;
+        } else if (cmd == "stats" || cmd == "stats reset") {
+            std::cout.flush();
+            stats.print(stdout);
+            if (cmd == "stats reset") {
+                stats.reset();
+            }
+            std::cout << "Done" << std::endl;
         } else {
             // in case of invalid command, just bail out.
             std::cerr << "Unknown command" << std::endl;
@@ -0,0 +1,310 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Persistent cache of compiled resource files.
+
+#define LOG_TAG "CompileCache"
+
+#include "CompileCache.h"
+#include "AaptAssets.h"
+#include "RemoteCache.h"
+
+#include <cutils/atomic.h>
+#include <utils/Log.h>
+#include <utils/Vector.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#include <sys/utime.h>
+#else
+#include <sys/file.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+namespace android {
+
+// Distinguishes the temporary files of work threads writing the same entry.
+static volatile int32_t gTempCounter = 0;
+
+CompileCache::Key::Key(const char* kind)
+{
+    add(kind);
+}
+
+void CompileCache::Key::add(const void* data, size_t size)
+{
+    // Length first, so consecutive inputs can't run into each other.
+    uint32_t len = (uint32_t)size;
+    mHasher.update(&len, sizeof(len));
+    mHasher.update(data, size);
+}
+
+void CompileCache::Key::add(const char* str)
+{
+    if (str == NULL) {
+        add((int32_t)-1);
+        return;
+    }
+    add(str, strlen(str));
+}
+
+void CompileCache::Key::add(int32_t value)
+{
+    mHasher.update(&value, sizeof(value));
+}
+
+status_t CompileCache::Key::addFile(const String8& path)
+{
+    FILE* fp = fopen(path.string(), "rb");
+    if (fp == NULL) {
+        return UNKNOWN_ERROR;
+    }
+
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0) {
+        fclose(fp);
+        return UNKNOWN_ERROR;
+    }
+    uint32_t len = (uint32_t)st.st_size;
+    mHasher.update(&len, sizeof(len));
+
+    unsigned char buf[32768];
+    size_t count;
+    while ((count = fread(buf, 1, sizeof(buf), fp)) != 0) {
+        mHasher.update(buf, count);
+    }
+    bool ok = !ferror(fp);
+    fclose(fp);
+    return ok ? NO_ERROR : UNKNOWN_ERROR;
+}
+
+String8 CompileCache::Key::digest()
+{
+    return mHasher.digest128().toString();
+}
+
+CompileCache::CompileCache(const char* dir, bool shared)
+    : mDir(dir), mShared(shared)
+{
+}
+
+bool CompileCache::fetchShared(const String8& digest) const
+{
+    return mShared && RemoteCache::isEnabled() && RemoteCache::fetch(*this, digest);
+}
+
+String8 CompileCache::getEntryPath(const String8& digest) const
+{
+    // Spread the entries over 256 subdirectories to keep each one small.
+    String8 path(mDir);
+    path.appendPath(String8(digest.string(), 2));
+    path.appendPath(String8(digest.string() + 2));
+    return path;
+}
+
+bool CompileCache::get(const String8& digest, const sp<AaptFile>& file) const
+{
+    String8 path(getEntryPath(digest));
+    FILE* fp = fopen(path.string(), "rb");
+    if (fp == NULL && fetchShared(digest)) {
+        fp = fopen(path.string(), "rb");
+    }
+    if (fp == NULL) {
+        return false;
+    }
+
+    bool ok = false;
+    struct stat st;
+    if (fstat(fileno(fp), &st) == 0 && st.st_size > 0) {
+        size_t size = (size_t)st.st_size;
+        void* buf = malloc(size);
+        if (buf != NULL && fread(buf, 1, size, fp) == size) {
+            file->clearData();
+            ok = file->writeData(buf, size) == NO_ERROR;
+        }
+        free(buf);
+    }
+    fclose(fp);
+    if (ok) {
+        touch(path);
+    }
+    return ok;
+}
+
+String8 CompileCache::find(const String8& digest) const
+{
+    String8 path(getEntryPath(digest));
+    struct stat st;
+    if (stat(path.string(), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        if (!fetchShared(digest) || stat(path.string(), &st) != 0 || st.st_size == 0) {
+            return String8();
+        }
+    }
+    touch(path);
+    return path;
+}
+
+status_t CompileCache::put(const String8& digest, const void* data, size_t size) const
+{
+    status_t err = putLocal(digest, data, size);
+    if (err == NO_ERROR && mShared && RemoteCache::isEnabled()) {
+        RemoteCache::store(digest, getEntryPath(digest));
+    }
+    return err;
+}
+
+status_t CompileCache::putLocal(const String8& digest, const void* data, size_t size) const
+{
+    String8 path(getEntryPath(digest));
+    String8 dir(path.getPathDir());
+
+    // Either level may already exist, possibly created by another thread.
+    String8 parent(dir.getPathDir());
+#ifdef _WIN32
+    _mkdir(parent.string());
+    _mkdir(dir.string());
+#else
+    mkdir(parent.string(), S_IRWXU|S_IRGRP|S_IXGRP);
+    mkdir(dir.string(), S_IRWXU|S_IRGRP|S_IXGRP);
+#endif
+
+    String8 tmpPath(path);
+#ifdef _WIN32
+    tmpPath.appendFormat(".%d.%d.tmp", _getpid(), android_atomic_inc(&gTempCounter));
+#else
+    tmpPath.appendFormat(".%d.%d.tmp", getpid(), android_atomic_inc(&gTempCounter));
+#endif
+    FILE* fp = fopen(tmpPath.string(), "wb");
+    if (fp == NULL) {
+        ALOGD("Unable to write cache entry %s: %s", tmpPath.string(), strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+
+    bool ok = fwrite(data, 1, size, fp) == size;
+    ok = (fclose(fp) == 0) && ok;
+#ifdef _WIN32
+    // rename() won't replace an existing file here.  Whatever is there
+    // came from the same key, so keeping it is just as good.
+    struct stat st;
+    if (ok && stat(path.string(), &st) == 0) {
+        ::remove(tmpPath.string());
+        return NO_ERROR;
+    }
+#endif
+    if (!ok || rename(tmpPath.string(), path.string()) != 0) {
+        ::remove(tmpPath.string());
+        return UNKNOWN_ERROR;
+    }
+    return NO_ERROR;
+}
+
+void CompileCache::touch(const String8& path)
+{
+    // Best effort: a cache on a read-only file system still works, it
+    // just can't keep its recently used entries over the rest.
+#ifdef _WIN32
+    _utime(path.string(), NULL);
+#else
+    utime(path.string(), NULL);
+#endif
+}
+
+namespace {
+
+struct TrimEntry {
+    String8 path;
+    time_t mtime;
+    off64_t size;
+};
+
+}
+
+static int compareTrimEntries(const TrimEntry* lhs, const TrimEntry* rhs)
+{
+    if (lhs->mtime != rhs->mtime) {
+        return lhs->mtime < rhs->mtime ? -1 : 1;
+    }
+    return strcmp(lhs->path.string(), rhs->path.string());
+}
+
+static void collectTrimEntries(const String8& dir, Vector<TrimEntry>* entries, off64_t* total)
+{
+    DIR* d = opendir(dir.string());
+    if (d == NULL) {
+        return;
+    }
+    struct dirent* ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (ent->d_name[0] == '.') {
+            continue;
+        }
+        TrimEntry e;
+        e.path = dir;
+        e.path.appendPath(ent->d_name);
+        struct stat st;
+        if (stat(e.path.string(), &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        e.mtime = st.st_mtime;
+        e.size = st.st_size;
+        *total += e.size;
+        entries->add(e);
+    }
+    closedir(d);
+}
+
+status_t CompileCache::trim(off64_t maxSize) const
+{
+#ifndef _WIN32
+    // Serializes trimming between processes sharing the cache.  Readers
+    // and writers don't take the lock: an entry removed under a reader
+    // stays readable through its open descriptor or mapping, and one
+    // removed before it is read is just a miss.
+    String8 lockPath(mDir);
+    lockPath.appendPath(".lock");
+    int lockFd = open(lockPath.string(), O_RDWR|O_CREAT, S_IRUSR|S_IWUSR);
+    if (lockFd < 0) {
+        return UNKNOWN_ERROR;
+    }
+    if (flock(lockFd, LOCK_EX|LOCK_NB) != 0) {
+        close(lockFd);
+        return NO_ERROR;
+    }
+#endif
+
+    Vector<TrimEntry> entries;
+    off64_t total = 0;
+    static const char kHex[] = "0123456789abcdef";
+    for (int i = 0; i < 256; i++) {
+        char name[3] = { kHex[i >> 4], kHex[i & 0xf], 0 };
+        String8 dir(mDir);
+        dir.appendPath(name);
+        collectTrimEntries(dir, &entries, &total);
+    }
+
+    if (total > maxSize) {
+        // Going well under the limit leaves the next few runs nothing to remove.
+        const off64_t target = maxSize / 4 * 3;
+        entries.sort(compareTrimEntries);
+        for (size_t i = 0; i < entries.size() && total > target; i++) {
+            if (::remove(entries[i].path.string()) == 0) {
+                total -= entries[i].size;
+            }
+        }
+    }
+
+#ifndef _WIN32
+    close(lockFd);
+#endif
+    return NO_ERROR;
+}
+
+}
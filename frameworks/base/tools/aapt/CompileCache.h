@@ -0,0 +1,103 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Persistent cache of compiled resource files, keyed by a digest of
+// everything that went into producing them.
+
+#ifndef COMPILE_CACHE_H
+#define COMPILE_CACHE_H
+
+#include <utils/Compat.h>
+#include <utils/ContentHash.h>
+#include <utils/Errors.h>
+#include <utils/RefBase.h>
+#include <utils/String8.h>
+
+class AaptFile;
+
+namespace android {
+
+/*
+ * A directory of previously compiled outputs.  Each entry is stored in its
+ * own file, named after the hex digest of its key, so several aapt processes
+ * and work threads can share one cache without any locking: entries are
+ * written to a temporary file and renamed into place, and a key's output
+ * never changes once written.
+ *
+ * Callers are responsible for hashing every input that can change the
+ * output -- the source bytes, the relevant options and a version tag for
+ * the compiler itself.  Entries are only expired by trim(); without a
+ * limit, delete the directory to reclaim the space.
+ */
+class CompileCache {
+public:
+    /*
+     * Accumulates the inputs of one compile step.
+     */
+    class Key {
+    public:
+        Key(const char* kind);
+
+        void add(const void* data, size_t size);
+        void add(const char* str);
+        void add(const String8& str) { add(str.string()); }
+        void add(int32_t value);
+
+        /* Hashes the contents of a file; fails if it can't be read. */
+        status_t addFile(const String8& path);
+
+        /* Finishes the key; no more inputs may be added. */
+        String8 digest();
+
+    private:
+        ContentHasher mHasher;
+    };
+
+    /*
+     * With "shared" set, entries missing here are looked for in the
+     * RemoteCache, when there is one, and new ones are sent to it.
+     */
+    CompileCache(const char* dir, bool shared = true);
+
+    /*
+     * Replaces the contents of "file" with the output stored for
+     * "digest".  Returns false, leaving "file" alone, on a miss.
+     */
+    bool get(const String8& digest, const sp<AaptFile>& file) const;
+
+    /*
+     * Returns the path of the output stored for "digest", for callers
+     * that would rather map it than copy it, or an empty string on a
+     * miss.
+     */
+    String8 find(const String8& digest) const;
+
+    /* Stores the output for "digest". */
+    status_t put(const String8& digest, const void* data, size_t size) const;
+
+    /* Stores the output for "digest" here only, as fetched from elsewhere. */
+    status_t putLocal(const String8& digest, const void* data, size_t size) const;
+
+    /*
+     * Removes the least recently used entries until the cache holds no
+     * more than three quarters of "maxSize" bytes, if it holds more than
+     * "maxSize".  Does nothing if another process is already trimming.
+     */
+    status_t trim(off64_t maxSize) const;
+
+private:
+    String8 getEntryPath(const String8& digest) const;
+
+    /* Marks an entry as used, so trim() keeps it over older ones. */
+    static void touch(const String8& path);
+
+    /* Fetches a missing entry from the RemoteCache; true if it now exists. */
+    bool fetchShared(const String8& digest) const;
+
+    String8 mDir;
+    bool mShared;
+};
+
+}
+
+#endif
@@ -18,6 +18,110 @@
 #define __CONFIG_DESCRIPTION_H
 
 #include <androidfw/ResourceTypes.h>
+#include <utils/TypeHelpers.h>
+
+/**
+ * The fields of a ResTable_config that ResTable_config::compare() and
+ * diff() look at, which are all of it but the size, copied out as six
+ * 64-bit words with the size zeroed.  Checking two configurations for equality, or for equality on just some
+ * axes with an axisMask(), is then a few XORs with no early outs.
+ *
+ * compare()'s ordering is not kept: it orders most fields by the sign of
+ * their wrapped 32-bit difference, which no fixed encoding of the words
+ * reproduces, so sorting still goes through compare().
+ */
+struct PackedConfig {
+    enum { kWords = 6 };
+
+    PackedConfig() {
+        memset(words, 0, sizeof(words));
+    }
+
+    explicit PackedConfig(const android::ResTable_config& c) {
+        static_assert(sizeof(words) == sizeof(c), "ResTable_config is not six words");
+        memcpy(words, &c, sizeof(words));
+        memset(words, 0, sizeof(c.size));
+    }
+
+    /**
+     * The bits of the words that hold the given CONFIG_* axes, as diff()
+     * splits them up.
+     */
+    static PackedConfig axisMask(uint32_t axes) {
+        android::ResTable_config c;
+        memset(&c, 0, sizeof(c));
+        if (axes & android::ResTable_config::CONFIG_MCC) c.mcc = 0xffff;
+        if (axes & android::ResTable_config::CONFIG_MNC) c.mnc = 0xffff;
+        if (axes & android::ResTable_config::CONFIG_LOCALE) {
+            c.locale = 0xffffffff;
+            memset(c.localeScript, 0xff, sizeof(c.localeScript));
+            memset(c.localeVariant, 0xff, sizeof(c.localeVariant));
+        }
+        if (axes & android::ResTable_config::CONFIG_ORIENTATION) c.orientation = 0xff;
+        if (axes & android::ResTable_config::CONFIG_TOUCHSCREEN) c.touchscreen = 0xff;
+        if (axes & android::ResTable_config::CONFIG_DENSITY) c.density = 0xffff;
+        if (axes & android::ResTable_config::CONFIG_KEYBOARD) c.keyboard = 0xff;
+        if (axes & android::ResTable_config::CONFIG_NAVIGATION) c.navigation = 0xff;
+        if (axes & android::ResTable_config::CONFIG_KEYBOARD_HIDDEN) {
+            c.inputFlags = android::ResTable_config::MASK_KEYSHIDDEN
+                    | android::ResTable_config::MASK_NAVHIDDEN;
+        }
+        if (axes & android::ResTable_config::CONFIG_SCREEN_SIZE) {
+            c.screenSize = 0xffffffff;
+            c.screenSizeDp = 0xffffffff;
+        }
+        if (axes & android::ResTable_config::CONFIG_VERSION) c.version = 0xffffffff;
+        if (axes & android::ResTable_config::CONFIG_LAYOUTDIR) {
+            c.screenLayout |= android::ResTable_config::MASK_LAYOUTDIR;
+        }
+        if (axes & android::ResTable_config::CONFIG_SCREEN_LAYOUT) {
+            c.screenLayout |= (uint8_t)~android::ResTable_config::MASK_LAYOUTDIR;
+        }
+        if (axes & android::ResTable_config::CONFIG_UI_MODE) c.uiMode = 0xff;
+        if (axes & android::ResTable_config::CONFIG_SMALLEST_SCREEN_SIZE) {
+            c.smallestScreenWidthDp = 0xffff;
+        }
+        return PackedConfig(c);
+    }
+
+    /** Whether compare() of the two configurations would be 0. */
+    inline bool operator==(const PackedConfig& o) const {
+        uint64_t bits = 0;
+        for (int i = 0; i < kWords; i++) {
+            bits |= words[i] ^ o.words[i];
+        }
+        return bits == 0;
+    }
+
+    inline bool operator!=(const PackedConfig& o) const { return !(*this == o); }
+
+    /**
+     * An arbitrary but fixed order on the words, for sorting packed
+     * configurations to search them; it is not compare()'s order.
+     */
+    inline bool operator<(const PackedConfig& o) const {
+        for (int i = 0; i < kWords; i++) {
+            if (words[i] != o.words[i]) {
+                return words[i] < o.words[i];
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Whether the two configurations agree on every bit set in "mask",
+     * one of the axisMask()s.
+     */
+    inline bool equalsWhere(const PackedConfig& o, const PackedConfig& mask) const {
+        uint64_t bits = 0;
+        for (int i = 0; i < kWords; i++) {
+            bits |= (words[i] ^ o.words[i]) & mask.words[i];
+        }
+        return bits == 0;
+    }
+
+    uint64_t words[kWords];
+};
 
 /**
  * Subclass of ResTable_config that adds convenient
@@ -51,10 +155,31 @@ struct ConfigDescription : public android::ResTable_config {
 
     inline bool operator<(const ConfigDescription& o) const { return compare(o) < 0; }
     inline bool operator<=(const ConfigDescription& o) const { return compare(o) <= 0; }
-    inline bool operator==(const ConfigDescription& o) const { return compare(o) == 0; }
-    inline bool operator!=(const ConfigDescription& o) const { return compare(o) != 0; }
+    inline bool operator==(const ConfigDescription& o) const {
+        return PackedConfig(*this) == PackedConfig(o);
+    }
+    inline bool operator!=(const ConfigDescription& o) const {
+        return PackedConfig(*this) != PackedConfig(o);
+    }
     inline bool operator>=(const ConfigDescription& o) const { return compare(o) >= 0; }
     inline bool operator>(const ConfigDescription& o) const { return compare(o) > 0; }
 };
 
+namespace android {
+
+// SortedVector and KeyedVector order their items with compare_type(),
+// which by default calls operator< both ways round; a single compare()
+// gives the same answer.
+inline int compare_type(const ConfigDescription& lhs, const ConfigDescription& rhs) {
+    return lhs.compare(rhs);
+}
+
+template<typename VALUE> inline
+int compare_type(const key_value_pair_t<ConfigDescription, VALUE>& lhs,
+        const key_value_pair_t<ConfigDescription, VALUE>& rhs) {
+    return lhs.key.compare(rhs.key);
+}
+
+} // namespace android
+
 #endif // __CONFIG_DESCRIPTION_H
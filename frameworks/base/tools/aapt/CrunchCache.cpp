@@ -13,6 +13,10 @@
 #include "FileFinder.h"
 #include "CacheUpdater.h"
 #include "CrunchCache.h"
+#include "WorkQueue.h"
+
+#include <stdio.h>
+#include <string.h>
 
 using namespace android;
 
@@ -29,14 +33,84 @@ CrunchCache::CrunchCache(String8 sourcePath, String8 destPath, FileFinder* ff)
     loadFiles();
 }
 
-size_t CrunchCache::crunch(CacheUpdater* cu, bool forceOverwrite)
+const char* CrunchCache::kManifestName = "crunch-cache.manifest";
+
+// One source file considered by crunch()
+struct CrunchJob {
+    enum Action {
+        kUpdate,            // crunch it
+        kCheckStamp,        // crunch it unless its stamp matches oldStamp
+        kKeep,              // the cached copy is current; only take its stamp
+    };
+
+    CrunchJob(const String8& path) : relativePath(path), action(kUpdate),
+            processed(false), succeeded(false) { }
+
+    String8 relativePath;
+    Action action;
+    String8 oldStamp;       // manifest entry from the last crunch
+    String8 stamp;          // "digest settings", or empty if unreadable
+    bool processed;
+    bool succeeded;
+};
+
+// Works out whether one file must be crunched, and crunches it.
+class CrunchWorkUnit : public WorkQueue::WorkUnit {
+public:
+    CrunchWorkUnit(CacheUpdater* cu, const String8& sourcePath, const String8& destPath,
+            const String8& settings, CrunchJob* job)
+        : mCacheUpdater(cu), mSourcePath(sourcePath), mDestPath(destPath),
+          mSettings(settings), mJob(job) { }
+
+    virtual bool run() {
+        String8 source = mSourcePath.appendPathCopy(mJob->relativePath);
+        String8 digest;
+        if (mCacheUpdater->hashFile(source, &digest)) {
+            mJob->stamp = digest;
+            mJob->stamp.append(" ");
+            mJob->stamp.append(mSettings);
+        }
+        bool update;
+        switch (mJob->action) {
+        case CrunchJob::kCheckStamp:
+            update = mJob->stamp.isEmpty() || mJob->stamp != mJob->oldStamp;
+            break;
+        case CrunchJob::kKeep:
+            update = false;
+            break;
+        default:
+            update = true;
+            break;
+        }
+        if (update) {
+            mJob->processed = true;
+            mJob->succeeded = mCacheUpdater->processImage(source,
+                    mDestPath.appendPathCopy(mJob->relativePath));
+        }
+        return true;
+    }
+
+private:
+    CacheUpdater* mCacheUpdater;
+    String8 mSourcePath;
+    String8 mDestPath;
+    String8 mSettings;
+    CrunchJob* mJob;
+};
+
+size_t CrunchCache::crunch(CacheUpdater* cu, bool forceOverwrite, size_t jobs)
 {
     size_t numFilesUpdated = 0;
 
+    KeyedVector<String8,String8> manifest;
+    loadManifest(cu, manifest);
+    const String8 settings = cu->getSettingsKey();
+
     // Iterate through the source files and compare to cache.
-    // After processing a file, remove it from the source files and
+    // After looking at a file, remove it from the source files and
     // from the dest files.
     // We're done when we're out of files in source.
+    Vector<CrunchJob*> crunchJobs;
     String8 relativePath;
     while (mSourceFiles.size() > 0) {
         // Get the full path to the source file, then convert to a c-string
@@ -51,16 +125,63 @@ size_t CrunchCache::crunch(CacheUpdater* cu, bool forceOverwrite)
             offset = 1;
         relativePath = String8(rPathPtr + offset);
 
-        if (forceOverwrite || needsUpdating(relativePath)) {
-            cu->processImage(mSourcePath.appendPathCopy(relativePath),
-                             mDestPath.appendPathCopy(relativePath));
-            numFilesUpdated++;
-            // crunchFile(relativePath);
+        // A file that is in the manifest only needs crunching if its digest
+        // or settings changed, or its cached copy has gone missing.  Anything
+        // else goes by mod-time, as it always has.
+        CrunchJob* job = new CrunchJob(relativePath);
+        String8 destFile = mDestPath.appendPathCopy(relativePath);
+        ssize_t idx = manifest.indexOfKey(relativePath);
+        if (forceOverwrite || mDestFiles.indexOfKey(destFile) < 0) {
+            job->action = CrunchJob::kUpdate;
+        } else if (idx >= 0) {
+            job->action = CrunchJob::kCheckStamp;
+            job->oldStamp = manifest.valueAt(idx);
+        } else if (needsUpdating(relativePath)) {
+            job->action = CrunchJob::kUpdate;
+        } else {
+            // Nothing to compare the digest against, but the cached copy is
+            // up to date, so just take note of it for next time.
+            job->action = CrunchJob::kKeep;
         }
+        crunchJobs.add(job);
+
         // Delete this file from the source files and (if it exists) from the
         // dest files.
         mSourceFiles.removeItemsAt(0);
-        mDestFiles.removeItem(mDestPath.appendPathCopy(relativePath));
+        mDestFiles.removeItem(destFile);
+    }
+
+    // Hash and crunch.  The work units only touch their own job.
+    const size_t N = crunchJobs.size();
+    if (jobs > 1) {
+        WorkQueue wq(jobs, false);
+        for (size_t i = 0; i < N; i++) {
+            CrunchWorkUnit* w = new CrunchWorkUnit(cu, mSourcePath, mDestPath, settings,
+                    crunchJobs[i]);
+            if (wq.schedule(w) != NO_ERROR) {
+                delete w;
+                break;
+            }
+        }
+        wq.finish();
+    } else {
+        for (size_t i = 0; i < N; i++) {
+            CrunchWorkUnit(cu, mSourcePath, mDestPath, settings, crunchJobs[i]).run();
+        }
+    }
+
+    // A file goes in the new manifest if its cached copy is known to be
+    // good: it was crunched successfully, or it was skipped.
+    KeyedVector<String8,String8> newManifest;
+    for (size_t i = 0; i < N; i++) {
+        CrunchJob* job = crunchJobs[i];
+        if (job->processed) {
+            numFilesUpdated++;
+        }
+        if (!job->stamp.isEmpty() && (job->processed ? job->succeeded : true)) {
+            newManifest.add(job->relativePath, job->stamp);
+        }
+        delete job;
     }
 
     // Iterate through what's left of destFiles and delete leftovers
@@ -69,6 +190,8 @@ size_t CrunchCache::crunch(CacheUpdater* cu, bool forceOverwrite)
         mDestFiles.removeItemsAt(0);
     }
 
+    saveManifest(cu, newManifest);
+
     // Update our knowledge of the files cache
     // both source and dest should be empty by now.
     loadFiles();
@@ -103,3 +226,42 @@ bool CrunchCache::needsUpdating(String8 relativePath) const
     time_t destDate = mDestFiles.valueFor(mDestPath.appendPathCopy(relativePath));
     return sourceDate > destDate;
 }
+
+void CrunchCache::loadManifest(CacheUpdater* cu, KeyedVector<String8,String8>& manifest) const
+{
+    manifest.clear();
+    String8 contents;
+    if (!cu->readFile(mDestPath.appendPathCopy(kManifestName), &contents))
+        return;
+
+    // Each line is "<digest> <settings> <relative path>"; the path may
+    // contain spaces, so it takes the rest of the line.
+    const char* p = contents.string();
+    while (*p != '\0') {
+        const char* eol = strchr(p, '\n');
+        if (eol == NULL)
+            eol = p + strlen(p);
+        const char* sep1 = (const char*) memchr(p, ' ', eol - p);
+        const char* sep2 = sep1 ? (const char*) memchr(sep1 + 1, ' ', eol - sep1 - 1) : NULL;
+        if (sep2 != NULL && sep2 + 1 < eol) {
+            manifest.add(String8(sep2 + 1, eol - sep2 - 1), String8(p, sep2 - p));
+        }
+        p = (*eol == '\n') ? eol + 1 : eol;
+    }
+}
+
+void CrunchCache::saveManifest(CacheUpdater* cu,
+        const KeyedVector<String8,String8>& manifest) const
+{
+    String8 contents;
+    for (size_t i = 0; i < manifest.size(); i++) {
+        contents.append(manifest.valueAt(i));
+        contents.append(" ");
+        contents.append(manifest.keyAt(i));
+        contents.append("\n");
+    }
+    if (!cu->writeFile(mDestPath.appendPathCopy(kManifestName), contents)) {
+        fprintf(stderr, "warning: unable to write %s\n",
+                mDestPath.appendPathCopy(kManifestName).string());
+    }
+}
@@ -21,6 +21,12 @@ using namespace android;
  *  them in a mirror-cache. It's capable of doing incremental updates to its
  *  cache.
  *
+ *  A manifest in the cache directory records a digest of each source file
+ *  and the settings it was crunched with.  A file whose digest and settings
+ *  match its manifest entry is left alone whatever its modification time,
+ *  so a fresh checkout or a restored cache doesn't force a full recrunch.
+ *  Files without a manifest entry fall back to comparing mod-times.
+ *
  *  Usage:
  *      Create an instance initialized with the root of the source tree, the
  *      root location to store the cache files, and an instance of a file finder.
@@ -43,7 +49,9 @@ public:
      * re-crunched even if they have not been modified recently. Otherwise,
      * source files are only crunched when they needUpdating. Afterwards,
      * we delete any leftover files in the cache that are no longer present
-     * in source.
+     * in source, and rewrite the manifest.
+     *
+     * Source files are hashed and crunched on up to "jobs" threads.
      *
      * PRECONDITIONS:
      *      No setup besides construction is needed
@@ -52,7 +60,10 @@ public:
      *      The function then returns the number of files changed in cache
      *      (counting deletions).
      */
-    size_t crunch(CacheUpdater* cu, bool forceOverwrite=false);
+    size_t crunch(CacheUpdater* cu, bool forceOverwrite=false, size_t jobs=1);
+
+    // Name of the manifest file kept in the root of the cache
+    static const char* kManifestName;
 
 private:
     /** loadFiles is a wrapper to the FileFinder that places matching
@@ -83,6 +94,13 @@ private:
      */
     bool needsUpdating(String8 relativePath) const;
 
+    /** loadManifest and saveManifest read and write the manifest as
+     * relative path / "digest settings" pairs, one line per cached file.
+     * A missing or unreadable manifest loads as empty.
+     */
+    void loadManifest(CacheUpdater* cu, KeyedVector<String8,String8>& manifest) const;
+    void saveManifest(CacheUpdater* cu, const KeyedVector<String8,String8>& manifest) const;
+
     // DATA MEMBERS ====================================================
 
     String8 mSourcePath;
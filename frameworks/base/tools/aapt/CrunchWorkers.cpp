@@ -0,0 +1,310 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Crunching a build's images on aapt daemons running on other machines.
+
+#include "CrunchWorkers.h"
+#include "Bundle.h"
+#include "PhaseTrace.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace android {
+
+namespace {
+
+struct Worker {
+    Worker() : pid(-1), in(NULL), out(NULL), load(0) { }
+
+    String8 command;
+    pid_t pid;
+    FILE* in;                   // the daemon's stdin
+    FILE* out;                  // the daemon's stdout
+    off64_t load;               // bytes of images given to it
+    Vector<String8> images;
+};
+
+struct Image {
+    String8 path;
+    off64_t size;
+};
+
+} // namespace
+
+static int compareImagesBySize(const Image* lhs, const Image* rhs)
+{
+    if (lhs->size != rhs->size) {
+        return lhs->size > rhs->size ? -1 : 1;
+    }
+    return strcmp(lhs->path.string(), rhs->path.string());
+}
+
+#ifndef _WIN32
+
+/*
+ * Reads one line of the daemon's output into "line", without its newline.
+ * Returns false once the daemon has exited.
+ */
+static bool readLine(Worker* worker, String8* line)
+{
+    char buf[4096];
+    line->setTo("");
+    while (fgets(buf, sizeof(buf), worker->out) != NULL) {
+        line->append(buf);
+        const size_t len = line->length();
+        if (len > 0 && line->string()[len - 1] == '\n') {
+            line->setTo(line->string(), len - 1);
+            return true;
+        }
+    }
+    return line->length() > 0;
+}
+
+static bool startWorker(Worker* worker)
+{
+    int toChild[2];
+    int fromChild[2];
+    if (pipe(toChild) != 0) {
+        return false;
+    }
+    if (pipe(fromChild) != 0) {
+        close(toChild[0]);
+        close(toChild[1]);
+        return false;
+    }
+    // The other workers mustn't hold on to this one's pipes.
+    fcntl(toChild[1], F_SETFD, FD_CLOEXEC);
+    fcntl(fromChild[0], F_SETFD, FD_CLOEXEC);
+
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(toChild[0], STDIN_FILENO);
+        dup2(fromChild[1], STDOUT_FILENO);
+        close(toChild[0]);
+        close(toChild[1]);
+        close(fromChild[0]);
+        close(fromChild[1]);
+        execl("/bin/sh", "sh", "-c", worker->command.string(), (char*) NULL);
+        _exit(127);
+    }
+    close(toChild[0]);
+    close(fromChild[1]);
+    if (pid < 0) {
+        close(toChild[1]);
+        close(fromChild[0]);
+        return false;
+    }
+    worker->pid = pid;
+    worker->in = fdopen(toChild[1], "w");
+    worker->out = fdopen(fromChild[0], "r");
+
+    // Anything a login shell prints comes before the daemon's "Ready".
+    String8 line;
+    while (readLine(worker, &line)) {
+        if (line == "Ready") {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void stopWorker(Worker* worker)
+{
+    if (worker->in != NULL) {
+        fputs("quit\n", worker->in);
+        fclose(worker->in);
+        worker->in = NULL;
+    }
+    if (worker->out != NULL) {
+        fclose(worker->out);
+        worker->out = NULL;
+    }
+    if (worker->pid > 0) {
+        int status;
+        while (waitpid(worker->pid, &status, 0) < 0 && errno == EINTR) {
+        }
+        worker->pid = -1;
+    }
+}
+
+static bool sendRequest(const Bundle* bundle, Worker* worker)
+{
+    fprintf(worker->in, "p %zu\n%s\n", worker->images.size(),
+            CrunchWorkers::imageOptions(bundle).string());
+    for (size_t i = 0; i < worker->images.size(); i++) {
+        fprintf(worker->in, "%s\n", worker->images[i].string());
+    }
+    return fflush(worker->in) == 0 && !ferror(worker->in);
+}
+
+/*
+ * Reads the daemon's answer to a request up to its "Done".  Returns how
+ * many images it couldn't crunch, or -1 if it stopped answering.
+ */
+static ssize_t readResult(const Bundle* bundle, Worker* worker)
+{
+    ssize_t errors = 0;
+    String8 line;
+    while (readLine(worker, &line)) {
+        if (line == "Done") {
+            return errors;
+        }
+        if (strncmp(line.string(), "Error ", 6) == 0) {
+            errors++;
+            if (bundle->getVerbose()) {
+                printf("    (worker unable to crunch %s)\n", line.string() + 6);
+            }
+        }
+    }
+    return -1;
+}
+
+#endif // _WIN32
+
+namespace CrunchWorkers {
+
+void crunch(const Bundle* bundle, const Vector<String8>& images)
+{
+    const Vector<String8>& commands = bundle->getCrunchWorkers();
+    if (commands.isEmpty() || images.isEmpty()) {
+        return;
+    }
+#ifdef _WIN32
+    fprintf(stderr, "WARNING: --crunch-worker is not supported on this host;"
+            " crunching the images here.\n");
+#else
+    PhaseSpan span("crunchOnWorkers");
+
+    Vector<Image> sorted;
+    for (size_t i = 0; i < images.size(); i++) {
+        // A path the line based requests can't carry is crunched here.
+        if (strchr(images[i].string(), '\n') != NULL) {
+            continue;
+        }
+        struct stat st;
+        Image image;
+        image.path = images[i];
+        image.size = stat(images[i].string(), &st) == 0 ? st.st_size : 0;
+        sorted.add(image);
+    }
+    sorted.sort(compareImagesBySize);
+
+    // A broken pipe to a worker is seen as a write error, not a signal.
+    void (*previousHandler)(int) = signal(SIGPIPE, SIG_IGN);
+
+    Vector<Worker*> workers;
+    for (size_t i = 0; i < commands.size(); i++) {
+        Worker* worker = new Worker;
+        worker->command = commands[i];
+        if (!startWorker(worker)) {
+            fprintf(stderr, "WARNING: Unable to start crunch worker '%s'\n",
+                    commands[i].string());
+            stopWorker(worker);
+            delete worker;
+            continue;
+        }
+        workers.add(worker);
+    }
+
+    if (!workers.isEmpty()) {
+        // The largest images first, each to the worker given the least so far.
+        for (size_t i = 0; i < sorted.size(); i++) {
+            Worker* least = workers[0];
+            for (size_t j = 1; j < workers.size(); j++) {
+                if (workers[j]->load < least->load) {
+                    least = workers[j];
+                }
+            }
+            least->images.add(sorted[i].path);
+            least->load += sorted[i].size;
+        }
+        if (bundle->getVerbose()) {
+            printf("Crunching %zu images on %zu workers\n", sorted.size(), workers.size());
+        }
+
+        // Every worker is sent its request before any answer is waited
+        // for, so that they all crunch at once.
+        Vector<bool> sent;
+        for (size_t i = 0; i < workers.size(); i++) {
+            sent.add(workers[i]->images.isEmpty() || sendRequest(bundle, workers[i]));
+        }
+        for (size_t i = 0; i < workers.size(); i++) {
+            Worker* worker = workers[i];
+            ssize_t errors = 0;
+            if (!worker->images.isEmpty()) {
+                errors = sent[i] ? readResult(bundle, worker) : -1;
+            }
+            if (errors < 0) {
+                fprintf(stderr, "WARNING: Crunch worker '%s' stopped answering;"
+                        " crunching its images here.\n", worker->command.string());
+            } else if (bundle->getVerbose()) {
+                printf("  worker '%s' crunched %zu images\n", worker->command.string(),
+                        worker->images.size() - errors);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < workers.size(); i++) {
+        stopWorker(workers[i]);
+        delete workers[i];
+    }
+    signal(SIGPIPE, previousHandler);
+#endif
+}
+
+String8 imageOptions(const Bundle* bundle)
+{
+    const char* minSdk = bundle->getManifestMinSdkVersion();
+    if (minSdk == NULL) {
+        minSdk = bundle->getMinSdkVersion();
+    }
+    // Resource file names have no spaces, so neither do useful patterns.
+    const char* pattern = bundle->getQuantizePattern();
+    return String8::format("%d %d %d %d %d %d %s %d %s", bundle->getGrayscaleTolerance(),
+            bundle->getCompressionLevel(), bundle->getKeepOptimizedPngs() ? 1 : 0,
+            bundle->getOptimizePngs() ? 1 : 0, bundle->getWebpImages() ? 1 : 0,
+            bundle->getWebpQuality(), minSdk != NULL ? minSdk : "1",
+            bundle->getQuantizeQuality(), pattern != NULL && pattern[0] ? pattern : "-");
+}
+
+status_t applyImageOptions(Bundle* bundle, const char* line)
+{
+    int grayscaleTolerance, compressionLevel, keepOptimized, optimize, webp, webpQuality;
+    int quantizeQuality;
+    char minSdk[64];
+    char pattern[1024];
+    if (sscanf(line, "%d %d %d %d %d %d %63s %d %1023s", &grayscaleTolerance,
+            &compressionLevel, &keepOptimized, &optimize, &webp, &webpQuality, minSdk,
+            &quantizeQuality, pattern) != 9) {
+        return BAD_VALUE;
+    }
+    bundle->setGrayscaleTolerance(grayscaleTolerance);
+    bundle->setCompressionLevel(compressionLevel);
+    bundle->setKeepOptimizedPngs(keepOptimized != 0);
+    bundle->setOptimizePngs(optimize != 0);
+    bundle->setWebpImages(webp != 0);
+    bundle->setWebpQuality(webpQuality);
+    bundle->setQuantizeQuality(quantizeQuality);
+    // The bundle keeps the pointers, as it does for the manifest's value.
+    bundle->setManifestMinSdkVersion(strdup(minSdk));
+    bundle->setQuantizePattern(strcmp(pattern, "-") != 0 ? strdup(pattern) : NULL);
+    return NO_ERROR;
+}
+
+} // namespace CrunchWorkers
+
+} // namespace android
@@ -0,0 +1,45 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Crunching a build's images on aapt daemons running on other machines.
+
+#ifndef CRUNCH_WORKERS_H
+#define CRUNCH_WORKERS_H
+
+#include <utils/Errors.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+class Bundle;
+
+namespace android {
+
+/*
+ * The --crunch-worker daemons, each an "aapt m" started by a shell
+ * command, e.g. over ssh, that sees the same source paths and shares the
+ * --resource-cache.  They are sent the PNGs of a build with a "p" request,
+ * crunch them into the cache, and the build then reads every image from
+ * there as it would the cache left by an earlier build.  So the APK is the
+ * same as one built here alone: an image a worker didn't crunch, or
+ * crunched under another key, is simply crunched here.
+ */
+namespace CrunchWorkers {
+
+// Has the workers crunch "images", the source paths of PNGs, splitting
+// them by size.  Returns once all of them are done.  A worker that can't
+// be started, or stops answering, is warned about and left out.
+void crunch(const Bundle* bundle, const Vector<String8>& images);
+
+// The line following "p N" in a request: the options of "bundle" that
+// change how an image is encoded.
+String8 imageOptions(const Bundle* bundle);
+
+// Sets the options of a request's line on the daemon's "bundle", so that
+// it keeps the images under the same digests the build looks them up by.
+status_t applyImageOptions(Bundle* bundle, const char* line);
+
+} // namespace CrunchWorkers
+
+} // namespace android
+
+#endif // CRUNCH_WORKERS_H
@@ -0,0 +1,158 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// What a daemon has done since it started, for its "stats" command.
+//
+
+#include "DaemonStats.h"
+#include "MemStats.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+using android::WorkQueue;
+
+namespace {
+
+const char* const kKindNames[DaemonStats::NUM_KINDS] = {
+    "r", "w", "b", "p", "s"
+};
+
+double toMs(nsecs_t time)
+{
+    return time / 1000000.0;
+}
+
+// "part" as a percentage of "whole".
+double percent(double part, double whole)
+{
+    return whole > 0 ? part * 100.0 / whole : 0.0;
+}
+
+void printCache(FILE* fp, const char* name, uint64_t hits, uint64_t misses)
+{
+    fprintf(fp, "Cache %s %" PRIu64 " %" PRIu64 " %.1f\n", name, hits, misses,
+            percent(hits, hits + misses));
+}
+
+} // namespace
+
+DaemonStats::KindStats::KindStats()
+    : count(0), failed(0), totalTime(0), maxTime(0)
+{
+    memset(buckets, 0, sizeof(buckets));
+}
+
+DaemonStats::DaemonStats()
+    : mRequestStart(0), mQueue(NULL)
+{
+    reset();
+}
+
+void DaemonStats::beginRequest()
+{
+    Statistics::reset();
+    WorkQueue* queue = WorkQueue::getShared();
+    mQueue = queue;
+    mQueueBefore = queue->getStats();
+    mRequestStart = systemTime(SYSTEM_TIME_MONOTONIC);
+}
+
+void DaemonStats::endRequest(Kind kind, bool failed)
+{
+    const nsecs_t time = systemTime(SYSTEM_TIME_MONOTONIC) - mRequestStart;
+    KindStats& stats = mKinds[kind];
+    stats.count++;
+    if (failed) {
+        stats.failed++;
+    }
+    stats.totalTime += time;
+    if (time > stats.maxTime) {
+        stats.maxTime = time;
+    }
+    stats.buckets[latencyBucket(time)]++;
+
+    for (int i = 0; i < Statistics::NUM_COUNTERS; i++) {
+        mCounts[i] += Statistics::get((Statistics::Counter) i);
+    }
+
+    // A request that changes --jobs replaces the shared queue, and all the
+    // new one did was for this request.
+    WorkQueue* queue = WorkQueue::getShared();
+    const WorkQueue::Stats after = queue->getStats();
+    WorkQueue::Stats before;
+    if (queue == mQueue && after.executed >= mQueueBefore.executed) {
+        before = mQueueBefore;
+    }
+    mQueueTotal.scheduled += after.scheduled - before.scheduled;
+    mQueueTotal.executed += after.executed - before.executed;
+    mQueueTotal.steals += after.steals - before.steals;
+    mQueueTotal.queueWaitTime += after.queueWaitTime - before.queueWaitTime;
+    mQueueTotal.runTime += after.runTime - before.runTime;
+    mQueue = NULL;
+}
+
+void DaemonStats::addSnapshotLookup(bool hit)
+{
+    if (hit) {
+        mSnapshotHits++;
+    } else {
+        mSnapshotMisses++;
+    }
+}
+
+void DaemonStats::reset()
+{
+    mStart = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < NUM_KINDS; i++) {
+        mKinds[i] = KindStats();
+    }
+    memset(mCounts, 0, sizeof(mCounts));
+    mSnapshotHits = 0;
+    mSnapshotMisses = 0;
+    mQueueTotal = WorkQueue::Stats();
+}
+
+void DaemonStats::print(FILE* fp) const
+{
+    const nsecs_t uptime = systemTime(SYSTEM_TIME_MONOTONIC) - mStart;
+    fprintf(fp, "Uptime %.3f\n", toMs(uptime));
+
+    for (int i = 0; i < NUM_KINDS; i++) {
+        const KindStats& stats = mKinds[i];
+        fprintf(fp, "Requests %s %" PRIu64 " %" PRIu64 " %.3f %.3f\n", kKindNames[i],
+                stats.count, stats.failed, toMs(stats.totalTime), toMs(stats.maxTime));
+        fprintf(fp, "Latency %s", kKindNames[i]);
+        for (size_t j = 0; j < NUM_BUCKETS; j++) {
+            fprintf(fp, " %" PRIu64, stats.buckets[j]);
+        }
+        fprintf(fp, "\n");
+    }
+
+    printCache(fp, "compile", mCounts[Statistics::COMPILE_CACHE_HITS],
+            mCounts[Statistics::COMPILE_CACHE_MISSES]);
+    printCache(fp, "deflate", mCounts[Statistics::DEFLATE_CACHE_HITS],
+            mCounts[Statistics::DEFLATE_CACHE_MISSES]);
+    printCache(fp, "remote", mCounts[Statistics::REMOTE_CACHE_HITS],
+            mCounts[Statistics::REMOTE_CACHE_MISSES]);
+    printCache(fp, "framework", mSnapshotHits, mSnapshotMisses);
+    printCache(fp, "resource_id", mCounts[Statistics::ID_CACHE_HITS],
+            mCounts[Statistics::ID_CACHE_MISSES]);
+
+    fprintf(fp, "Memory %zu %zu\n", MemStats::residentSize(), MemStats::peakResidentSize());
+
+    // Busy is the share of the threads' time since the start spent running work.
+    const size_t threads = WorkQueue::getShared()->getMaxThreads();
+    fprintf(fp, "Threads %zu %zu %zu %.3f %.3f %.1f\n", threads, mQueueTotal.executed,
+            mQueueTotal.steals, toMs(mQueueTotal.queueWaitTime), toMs(mQueueTotal.runTime),
+            percent(mQueueTotal.runTime, (double) uptime * threads));
+}
+
+size_t DaemonStats::latencyBucket(nsecs_t time)
+{
+    size_t bucket = 0;
+    for (nsecs_t limit = 1000000; time >= limit && bucket + 1 < NUM_BUCKETS; limit *= 2) {
+        bucket++;
+    }
+    return bucket;
+}
@@ -0,0 +1,82 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// What a daemon has done since it started, for its "stats" command.
+//
+
+#ifndef AAPT_DAEMON_STATS_H
+#define AAPT_DAEMON_STATS_H
+
+#include "Statistics.h"
+#include "WorkQueue.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <utils/Timers.h>
+
+/*
+ * Counts the requests of a daemon by command, with a histogram of how long
+ * they took, and sums what the caches and the shared work queue did for
+ * them, so that whatever hands out the work can tell how each daemon is
+ * doing.  Everything is counted from the start or the last reset().
+ *
+ * The Statistics counts are zeroed at the start of each request and added
+ * up at its end.  Only the daemon's own thread uses this.
+ */
+class DaemonStats {
+public:
+    // The daemon commands, in their order in the report.
+    enum Kind {
+        RUN,                // r
+        WATCH,              // w, each build of it
+        BATCH_CRUNCH,       // b
+        PREPROCESS,         // p
+        SINGLE_CRUNCH,      // s
+        NUM_KINDS
+    };
+
+    // Bucket i of a histogram counts the requests that took less than
+    // 2^i ms but not less than 2^(i-1); the last one counts the rest.
+    static const size_t NUM_BUCKETS = 16;
+
+    DaemonStats();
+
+    void beginRequest();
+    void endRequest(Kind kind, bool failed);
+
+    // Whether the included packages a request asked for were already loaded.
+    void addSnapshotLookup(bool hit);
+
+    void reset();
+
+    // Writes the report as lines of space separated fields; see runInDaemonMode().
+    void print(FILE* fp) const;
+
+    static size_t latencyBucket(nsecs_t time);
+
+private:
+    struct KindStats {
+        KindStats();
+
+        uint64_t count;
+        uint64_t failed;
+        nsecs_t totalTime;
+        nsecs_t maxTime;
+        uint64_t buckets[NUM_BUCKETS];
+    };
+
+    nsecs_t mStart;
+    KindStats mKinds[NUM_KINDS];
+    uint64_t mCounts[Statistics::NUM_COUNTERS];
+    uint64_t mSnapshotHits;
+    uint64_t mSnapshotMisses;
+    android::WorkQueue::Stats mQueueTotal;
+
+    // The request being run, and the shared queue as it was when it began.
+    nsecs_t mRequestStart;
+    const android::WorkQueue* mQueue;
+    android::WorkQueue::Stats mQueueBefore;
+};
+
+#endif // AAPT_DAEMON_STATS_H
@@ -0,0 +1,260 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// What each input file of a build cost, for --cost-report.
+//
+
+#include "FileCosts.h"
+#include "AaptAssets.h"
+
+#include <androidfw/ResourceTypes.h>
+#include <utils/KeyedVector.h>
+#include <utils/Mutex.h>
+#include <utils/Vector.h>
+
+#include <algorithm>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+using android::AutoMutex;
+using android::KeyedVector;
+using android::Mutex;
+using android::String8;
+using android::Vector;
+using android::status_t;
+
+namespace {
+
+// The sums of the spans of one file in one stage; -1 for what none gave.
+struct Cost {
+    Cost() : time(0), runs(0), inputBytes(-1), outputBytes(-1), strings(-1), entries(-1),
+            bags(-1) { }
+
+    nsecs_t time;
+    size_t runs;
+    ssize_t inputBytes;
+    ssize_t outputBytes;
+    ssize_t strings;
+    ssize_t entries;
+    ssize_t bags;
+};
+
+const char* const kStageNames[FileCosts::NUM_STAGES] = {
+    "parse", "compile", "crunch", "compress"
+};
+
+// Set once by enable(), before any other thread looks at it.
+bool gEnabled = false;
+size_t gTop = 0;
+
+Mutex gLock;
+KeyedVector<String8, Cost>* gCosts[FileCosts::NUM_STAGES];
+
+void addTo(ssize_t* sum, ssize_t value)
+{
+    if (value >= 0) {
+        *sum = (*sum < 0 ? 0 : *sum) + value;
+    }
+}
+
+void writeJsonString(FILE* fp, const char* str)
+{
+    fputc('"', fp);
+    for (const unsigned char* p = (const unsigned char*) str; *p != 0; p++) {
+        if (*p == '"' || *p == '\\') {
+            fputc('\\', fp);
+            fputc(*p, fp);
+        } else if (*p < 0x20) {
+            fprintf(fp, "\\u%04x", *p);
+        } else {
+            fputc(*p, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+void writeCount(FILE* fp, const char* name, ssize_t value)
+{
+    if (value >= 0) {
+        fprintf(fp, ",\"%s\":%ld", name, (long) value);
+    }
+}
+
+// One row of the report: the index of a file in its stage's costs.
+struct Row {
+    const KeyedVector<String8, Cost>* costs;
+    size_t index;
+
+    const Cost& cost() const { return costs->valueAt(index); }
+};
+
+// Ties go to the file name, so the report doesn't depend on the threads.
+bool slowerThan(const Row& lhs, const Row& rhs)
+{
+    if (lhs.cost().time != rhs.cost().time) {
+        return lhs.cost().time > rhs.cost().time;
+    }
+    return lhs.index < rhs.index;
+}
+
+bool largerThan(const Row& lhs, const Row& rhs)
+{
+    if (lhs.cost().inputBytes != rhs.cost().inputBytes) {
+        return lhs.cost().inputBytes > rhs.cost().inputBytes;
+    }
+    return lhs.index < rhs.index;
+}
+
+void writeRows(FILE* fp, const char* name, Vector<Row>* rows,
+               bool (*compare)(const Row&, const Row&))
+{
+    std::sort(rows->editArray(), rows->editArray() + rows->size(), compare);
+    fprintf(fp, ",\n   \"%s\":[", name);
+    const size_t N = std::min(rows->size(), gTop);
+    for (size_t i = 0; i < N; i++) {
+        const Row& row = rows->itemAt(i);
+        const Cost& cost = row.cost();
+        fprintf(fp, "%s\n    {\"file\":", i == 0 ? "" : ",");
+        writeJsonString(fp, row.costs->keyAt(row.index).string());
+        fprintf(fp, ",\"ms\":%.3f,\"runs\":%zu", cost.time / 1000000.0, cost.runs);
+        writeCount(fp, "input_bytes", cost.inputBytes);
+        writeCount(fp, "output_bytes", cost.outputBytes);
+        writeCount(fp, "strings", cost.strings);
+        writeCount(fp, "entries", cost.entries);
+        writeCount(fp, "bags", cost.bags);
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "]");
+}
+
+void add(FileCosts::Stage stage, const String8& file, nsecs_t time, const Cost& span)
+{
+    AutoMutex _l(gLock);
+    KeyedVector<String8, Cost>* costs = gCosts[stage];
+    ssize_t index = costs->indexOfKey(file);
+    if (index < 0) {
+        index = costs->add(file, Cost());
+    }
+    Cost& cost = costs->editValueAt(index);
+    cost.time += time;
+    cost.runs++;
+    addTo(&cost.inputBytes, span.inputBytes);
+    addTo(&cost.outputBytes, span.outputBytes);
+    addTo(&cost.strings, span.strings);
+    addTo(&cost.entries, span.entries);
+    addTo(&cost.bags, span.bags);
+}
+
+} // namespace
+
+namespace FileCosts {
+
+void enable(size_t top)
+{
+    {
+        // A daemon may package more than once; each report starts over.
+        AutoMutex _l(gLock);
+        for (int i = 0; i < NUM_STAGES; i++) {
+            if (gCosts[i] == NULL) {
+                gCosts[i] = new KeyedVector<String8, Cost>();
+            }
+            gCosts[i]->clear();
+        }
+    }
+    gTop = top;
+    gEnabled = true;
+}
+
+bool isEnabled()
+{
+    return gEnabled;
+}
+
+status_t write(const char* path)
+{
+    FILE* fp = fopen(path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: Unable to open cost report file '%s': %s\n", path,
+                strerror(errno));
+        return android::UNKNOWN_ERROR;
+    }
+
+    AutoMutex _l(gLock);
+    fprintf(fp, "{\"top\":%zu,\"stages\":[", gTop);
+    for (int i = 0; i < NUM_STAGES; i++) {
+        const KeyedVector<String8, Cost>* costs = gCosts[i];
+        Vector<Row> rows;
+        rows.setCapacity(costs->size());
+        nsecs_t total = 0;
+        for (size_t j = 0; j < costs->size(); j++) {
+            Row row;
+            row.costs = costs;
+            row.index = j;
+            rows.add(row);
+            total += costs->valueAt(j).time;
+        }
+        fprintf(fp, "%s\n  {\"stage\":\"%s\",\"files\":%zu,\"total_ms\":%.3f",
+                i == 0 ? "" : ",", kStageNames[i], costs->size(), total / 1000000.0);
+        writeRows(fp, "slowest", &rows, slowerThan);
+        writeRows(fp, "largest", &rows, largerThan);
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "\n]}\n");
+
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "ERROR: Unable to write cost report file '%s': %s\n", path,
+                strerror(errno));
+        return android::UNKNOWN_ERROR;
+    }
+    return android::NO_ERROR;
+}
+
+ssize_t countXmlStrings(const void* data, size_t size)
+{
+    if (data == NULL || size < sizeof(android::ResXMLTree_header)) {
+        return -1;
+    }
+    const android::ResXMLTree_header* tree = (const android::ResXMLTree_header*) data;
+    const size_t headerSize = dtohs(tree->header.headerSize);
+    if (dtohs(tree->header.type) != android::RES_XML_TYPE
+            || headerSize + sizeof(android::ResStringPool_header) > size) {
+        return -1;
+    }
+    const android::ResStringPool_header* pool = (const android::ResStringPool_header*)
+            ((const uint8_t*) data + headerSize);
+    if (dtohs(pool->header.type) != android::RES_STRING_POOL_TYPE) {
+        return -1;
+    }
+    return dtohl(pool->stringCount);
+}
+
+} // namespace FileCosts
+
+FileCostSpan::FileCostSpan(FileCosts::Stage stage, const String8& file)
+    : mStage(stage), mStart(0), mOutputFile(NULL), mCountStrings(false), mInputBytes(-1),
+      mOutputBytes(-1), mStrings(-1), mEntries(-1), mBags(-1)
+{
+    if (FileCosts::isEnabled()) {
+        mFile = file;
+        mStart = systemTime(SYSTEM_TIME_MONOTONIC);
+    }
+}
+
+void FileCostSpan::end()
+{
+    if (mStart == 0) {
+        return;
+    }
+    const nsecs_t time = systemTime(SYSTEM_TIME_MONOTONIC) - mStart;
+    mStart = 0;
+    Cost span;
+    span.inputBytes = mInputBytes;
+    span.outputBytes = mOutputFile != NULL ? (ssize_t) mOutputFile->getSize() : mOutputBytes;
+    span.strings = mCountStrings && mOutputFile != NULL
+            ? FileCosts::countXmlStrings(mOutputFile->getData(), mOutputFile->getSize())
+            : mStrings;
+    span.entries = mEntries;
+    span.bags = mBags;
+    add(mStage, mFile, time, span);
+}
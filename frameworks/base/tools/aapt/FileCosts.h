@@ -0,0 +1,95 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// What each input file of a build cost, for --cost-report.
+//
+
+#ifndef AAPT_FILE_COSTS_H
+#define AAPT_FILE_COSTS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <utils/Errors.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
+class AaptFile;
+
+/*
+ * Records how long each file took to parse, compile, crunch and compress,
+ * with what it read and produced, so that the report can list the most
+ * expensive resources of a build.  Each file's costs are summed over a
+ * stage, as some are parsed more than once.
+ *
+ * Nothing is recorded until enable() is called, and until then a span
+ * costs one check.  Spans may be recorded from any thread.
+ */
+namespace FileCosts {
+
+enum Stage {
+    PARSE,          // values and XML files read into trees or events
+    COMPILE,        // values added to the table, XML files flattened
+    CRUNCH,         // PNG images preprocessed
+    COMPRESS,       // APK entries deflated
+    NUM_STAGES
+};
+
+// Starts recording; the report lists the "top" costliest files of each
+// stage.  Call before starting any threads that record.
+void enable(size_t top);
+bool isEnabled();
+
+// Writes what was recorded so far to "path" as JSON.
+android::status_t write(const char* path);
+
+// The number of strings in the pool of the compiled XML file "data", or
+// -1 if it isn't one.
+ssize_t countXmlStrings(const void* data, size_t size);
+
+} // namespace FileCosts
+
+/*
+ * The cost of one file in one stage, recorded from construction to
+ * destruction or end(), whichever is first.  The setters may be called
+ * whether or not anything is recorded.
+ */
+class FileCostSpan {
+public:
+    FileCostSpan(FileCosts::Stage stage, const android::String8& file);
+    ~FileCostSpan() { end(); }
+
+    bool isRecording() const { return mStart != 0; }
+
+    void setInputBytes(size_t bytes) { mInputBytes = bytes; }
+    void setOutputBytes(size_t bytes) { mOutputBytes = bytes; }
+    // The output is "file" as it is when the span ends; it must last as long.
+    void setOutputFile(const AaptFile* file) { mOutputFile = file; }
+    // As setOutputFile(), for a compiled XML file whose strings are counted.
+    void setCompiledXml(const AaptFile* file) { mOutputFile = file; mCountStrings = true; }
+    // Strings the file adds to a pool, and entries and bags to the table.
+    void setStrings(size_t count) { mStrings = count; }
+    void setEntries(size_t count) { mEntries = count; }
+    void setBags(size_t count) { mBags = count; }
+
+    void end();
+    // Records nothing, for work that turns out not to be of the stage.
+    void cancel() { mStart = 0; }
+
+private:
+    FileCostSpan(const FileCostSpan&);
+    FileCostSpan& operator=(const FileCostSpan&);
+
+    const FileCosts::Stage mStage;
+    android::String8 mFile;
+    nsecs_t mStart;         // 0 when not recording
+    const AaptFile* mOutputFile;
+    bool mCountStrings;
+    // -1 when not given
+    ssize_t mInputBytes;
+    ssize_t mOutputBytes;
+    ssize_t mStrings;
+    ssize_t mEntries;
+    ssize_t mBags;
+};
+
+#endif // AAPT_FILE_COSTS_H
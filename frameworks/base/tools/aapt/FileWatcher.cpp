@@ -0,0 +1,229 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Waiting for the sources of a build to change.
+
+#include "FileWatcher.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+namespace android {
+
+#if defined(__linux__)
+
+static bool isTemporaryName(const char* name)
+{
+    const size_t len = strlen(name);
+    return len == 0 || name[0] == '.' || name[len - 1] == '~';
+}
+
+// A file written in place is closed; one saved by renaming over it is moved.
+static const uint32_t kWatchEvents = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE
+        | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+
+FileWatcher::FileWatcher()
+    : mFd(inotify_init1(IN_CLOEXEC | IN_NONBLOCK))
+{
+}
+
+FileWatcher::~FileWatcher()
+{
+    if (mFd >= 0) {
+        close(mFd);
+    }
+}
+
+status_t FileWatcher::addPath(const String8& path)
+{
+    if (mFd < 0) {
+        fprintf(stderr, "ERROR: Unable to watch files: %s\n", strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+    struct stat st;
+    if (stat(path.string(), &st) != 0) {
+        fprintf(stderr, "ERROR: Unable to watch '%s': %s\n", path.string(), strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+    mRoots.add(path);
+    if (S_ISDIR(st.st_mode)) {
+        return watchDir(path, true, String8());
+    }
+    String8 dir = path.getPathDir();
+    return watchDir(dir.isEmpty() ? String8(".") : dir, false, path.getPathLeaf());
+}
+
+status_t FileWatcher::watchDir(const String8& dir, bool tree, const String8& name)
+{
+    const int wd = inotify_add_watch(mFd, dir.string(), kWatchEvents);
+    if (wd < 0) {
+        fprintf(stderr, "ERROR: Unable to watch '%s': %s\n", dir.string(), strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+
+    // Watching a directory again hands back its first descriptor.
+    ssize_t idx = mWatches.indexOfKey(wd);
+    if (idx < 0) {
+        Watch w;
+        w.dir = dir;
+        idx = mWatches.add(wd, w);
+    }
+    Watch& w = mWatches.editValueAt(idx);
+    const bool descend = tree && !w.tree;
+    w.tree = w.tree || tree;
+    if (name.isEmpty()) {
+        w.allNames = true;
+    } else {
+        w.names.add(name);
+    }
+    if (!descend) {
+        return NO_ERROR;
+    }
+
+    DIR* d = opendir(dir.string());
+    if (d == NULL) {
+        // It was removed again before it could be read.
+        return NO_ERROR;
+    }
+    status_t err = NO_ERROR;
+    for (struct dirent* e = readdir(d); e != NULL && err == NO_ERROR; e = readdir(d)) {
+        if (isTemporaryName(e->d_name)) {
+            continue;
+        }
+        String8 child = dir.appendPathCopy(e->d_name);
+        struct stat st;
+        if (stat(child.string(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            err = watchDir(child, true, String8());
+        }
+    }
+    closedir(d);
+    return err;
+}
+
+void FileWatcher::readEvents(SortedVector<String8>* changed)
+{
+    // Big enough for a burst of events, aligned as inotify_event needs.
+    union {
+        char data[16384];
+        struct inotify_event align;
+    } buf;
+    for (;;) {
+        const ssize_t n = read(mFd, buf.data, sizeof(buf.data));
+        if (n <= 0) {
+            return;
+        }
+        for (ssize_t pos = 0; pos < n;) {
+            const struct inotify_event* e =
+                    reinterpret_cast<const struct inotify_event*>(buf.data + pos);
+            pos += sizeof(struct inotify_event) + e->len;
+
+            if (e->mask & IN_Q_OVERFLOW) {
+                // Events were lost, so anything might have changed.
+                for (size_t i = 0; i < mRoots.size(); i++) {
+                    changed->add(mRoots[i]);
+                }
+                continue;
+            }
+            const ssize_t idx = mWatches.indexOfKey(e->wd);
+            if (idx < 0) {
+                continue;
+            }
+            if (e->mask & IN_IGNORED) {
+                mWatches.removeItemsAt(idx);
+                continue;
+            }
+            if (e->len == 0 || isTemporaryName(e->name)) {
+                continue;
+            }
+            const String8 name(e->name);
+            const Watch& w = mWatches.valueAt(idx);
+            if (!w.allNames && w.names.indexOf(name) < 0) {
+                continue;
+            }
+            const String8 path = w.dir.appendPathCopy(name);
+            if ((e->mask & IN_ISDIR) && (e->mask & (IN_CREATE | IN_MOVED_TO)) && w.tree) {
+                watchDir(path, true, String8());
+            }
+            changed->add(path);
+        }
+    }
+}
+
+bool FileWatcher::wait(int fd, int settleMs, Vector<String8>* changed)
+{
+    if (mFd < 0) {
+        return false;
+    }
+    SortedVector<String8> seen;
+    int timeout = -1;
+    for (;;) {
+        struct pollfd fds[2];
+        fds[0].fd = mFd;
+        fds[0].events = POLLIN;
+        fds[1].fd = fd;
+        fds[1].events = POLLIN;
+        // Once something changed, the change is reported whatever comes in.
+        const bool watchFd = fd >= 0 && seen.isEmpty();
+        const int r = poll(fds, watchFd ? 2 : 1, timeout);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "ERROR: Unable to wait for files to change: %s\n",
+                    strerror(errno));
+            return false;
+        }
+        if (r == 0) {
+            break;
+        }
+        if (watchFd && (fds[1].revents & (POLLIN | POLLHUP)) != 0) {
+            return false;
+        }
+        if (fds[0].revents & POLLIN) {
+            readEvents(&seen);
+        }
+        if (!seen.isEmpty()) {
+            timeout = settleMs;
+        }
+    }
+    for (size_t i = 0; i < seen.size(); i++) {
+        changed->add(seen[i]);
+    }
+    return true;
+}
+
+#else
+
+FileWatcher::FileWatcher()
+    : mFd(-1)
+{
+}
+
+FileWatcher::~FileWatcher()
+{
+}
+
+status_t FileWatcher::addPath(const String8& path)
+{
+    fprintf(stderr, "ERROR: Unable to watch '%s': not supported on this platform\n",
+            path.string());
+    return INVALID_OPERATION;
+}
+
+bool FileWatcher::wait(int fd, int settleMs, Vector<String8>* changed)
+{
+    return false;
+}
+
+#endif
+
+} // namespace android
@@ -0,0 +1,68 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Waiting for the sources of a build to change.
+
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <utils/Errors.h>
+#include <utils/KeyedVector.h>
+#include <utils/SortedVector.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+/*
+ * Watches source files and directory trees, for a daemon that rebuilds as
+ * they are edited.  Directories created under a watched tree are watched
+ * too.  Names starting with '.' or ending in '~', the temporary files of
+ * editors and version control, are not reported.  Only Linux (inotify) is
+ * supported; elsewhere every addPath() fails.
+ */
+class FileWatcher {
+public:
+    FileWatcher();
+    ~FileWatcher();
+
+    /*
+     * Watches "path": a file, or a directory and everything under it.
+     * Changes to only a file are seen by watching its directory, so that
+     * editors replacing it by renaming another over it are noticed.
+     */
+    status_t addPath(const String8& path);
+
+    /*
+     * Waits for something watched to change, then for "settleMs" to pass
+     * without another change, so that saving several files at once is
+     * reported once.  Adds the paths that changed to "changed", in order.
+     * Returns false, before anything changes, once "fd" is readable (-1
+     * for none), or if watching fails.
+     */
+    bool wait(int fd, int settleMs, Vector<String8>* changed);
+
+private:
+    FileWatcher(const FileWatcher&);
+    FileWatcher& operator=(const FileWatcher&);
+
+    struct Watch {
+        Watch() : tree(false), allNames(false) { }
+
+        String8 dir;
+        bool tree;                  // subdirectories are watched too
+        bool allNames;              // else only those in "names"
+        SortedVector<String8> names;
+    };
+
+    status_t watchDir(const String8& dir, bool tree, const String8& name);
+    void readEvents(SortedVector<String8>* changed);
+
+    int mFd;
+    KeyedVector<int, Watch> mWatches;   // by watch descriptor
+    Vector<String8> mRoots;             // as given to addPath()
+};
+
+} // namespace android
+
+#endif // FILE_WATCHER_H
@@ -0,0 +1,393 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Lossy reduction of RGBA images to a palette, for --quantize-pngs.
+//
+
+#include "ImageQuantizer.h"
+
+#include <algorithm>
+#include <string.h>
+#include <vector>
+
+namespace {
+
+// Rounds of k-means after the median cut.
+const int kRefineRounds = 3;
+
+// Colors are packed as 0xRRGGBBAA; channel 0 is red and 3 is alpha.
+inline int channelOf(uint32_t color, int channel)
+{
+    return (color >> (24 - 8 * channel)) & 0xff;
+}
+
+inline uint32_t packColor(const int rgba[4])
+{
+    return ((uint32_t) rgba[0] << 24) | ((uint32_t) rgba[1] << 16)
+            | ((uint32_t) rgba[2] << 8) | (uint32_t) rgba[3];
+}
+
+struct ColorCount {
+    uint32_t color;
+    uint32_t count;
+};
+
+// A color as distances are measured: premultiplied red, green and blue,
+// and alpha.
+struct Point {
+    float v[4];
+};
+
+Point toPoint(const float rgba[4])
+{
+    Point point;
+    const float scale = rgba[3] / 255.0f;
+    point.v[0] = rgba[0] * scale;
+    point.v[1] = rgba[1] * scale;
+    point.v[2] = rgba[2] * scale;
+    point.v[3] = rgba[3];
+    return point;
+}
+
+Point toPoint(uint32_t color)
+{
+    const float rgba[4] = {
+        (float) channelOf(color, 0), (float) channelOf(color, 1),
+        (float) channelOf(color, 2), (float) channelOf(color, 3)
+    };
+    return toPoint(rgba);
+}
+
+float distance(const Point& lhs, const Point& rhs)
+{
+    float sum = 0;
+    for (int c = 0; c < 4; c++) {
+        const float d = lhs.v[c] - rhs.v[c];
+        sum += d * d;
+    }
+    return sum;
+}
+
+size_t nearest(const std::vector<Point>& palette, const Point& point, float* outDistance)
+{
+    size_t best = 0;
+    float bestDistance = distance(palette[0], point);
+    for (size_t i = 1; i < palette.size(); i++) {
+        const float d = distance(palette[i], point);
+        if (d < bestDistance) {
+            best = i;
+            bestDistance = d;
+        }
+    }
+    if (outDistance != NULL) {
+        *outDistance = bestDistance;
+    }
+    return best;
+}
+
+// Orders colors by one channel, and the rest by the whole color so that
+// the result doesn't depend on the sort.
+struct ChannelLess {
+    int channel;
+
+    bool operator()(const ColorCount& lhs, const ColorCount& rhs) const {
+        const int l = channelOf(lhs.color, channel);
+        const int r = channelOf(rhs.color, channel);
+        return l != r ? l < r : lhs.color < rhs.color;
+    }
+};
+
+// A run of the distinct colors that median cut has put together.
+struct Box {
+    size_t begin;
+    size_t end;
+    uint64_t count;
+    double mean[4];
+    // The summed squared distance of the pixels from the mean, and the
+    // channel that adds the most to it.
+    double error;
+    int channel;
+};
+
+void measureBox(const std::vector<ColorCount>& colors, Box* box)
+{
+    double sum[4] = { 0, 0, 0, 0 };
+    double sumSquares[4] = { 0, 0, 0, 0 };
+    box->count = 0;
+    for (size_t i = box->begin; i < box->end; i++) {
+        const double weight = colors[i].count;
+        for (int c = 0; c < 4; c++) {
+            const double value = channelOf(colors[i].color, c);
+            sum[c] += weight * value;
+            sumSquares[c] += weight * value * value;
+        }
+        box->count += colors[i].count;
+    }
+    box->error = 0;
+    box->channel = 0;
+    double largest = -1;
+    for (int c = 0; c < 4; c++) {
+        box->mean[c] = sum[c] / box->count;
+        const double error = sumSquares[c] - sum[c] * box->mean[c];
+        box->error += error;
+        if (error > largest) {
+            largest = error;
+            box->channel = c;
+        }
+    }
+}
+
+// Splits the box at the weighted median of its widest channel.
+void splitBox(std::vector<ColorCount>& colors, Box* box, Box* outUpper)
+{
+    ChannelLess less;
+    less.channel = box->channel;
+    std::sort(colors.begin() + box->begin, colors.begin() + box->end, less);
+
+    uint64_t below = 0;
+    size_t split = box->begin + 1;
+    for (size_t i = box->begin; i + 1 < box->end; i++) {
+        below += colors[i].count;
+        split = i + 1;
+        if (2 * below >= box->count) {
+            break;
+        }
+    }
+
+    outUpper->begin = split;
+    outUpper->end = box->end;
+    box->end = split;
+    measureBox(colors, box);
+    measureBox(colors, outUpper);
+}
+
+void toRgba(const double mean[4], int outRgba[4])
+{
+    for (int c = 0; c < 4; c++) {
+        const int value = (int) (mean[c] + 0.5);
+        outRgba[c] = std::min(std::max(value, 0), 255);
+    }
+}
+
+/*
+ * Chooses up to "slots" colors for "colors" and returns the summed
+ * squared distance of the pixels from their nearest one.
+ */
+double choosePalette(std::vector<ColorCount>& colors, size_t slots,
+        std::vector<uint32_t>* outPalette)
+{
+    std::vector<Box> boxes(1);
+    boxes[0].begin = 0;
+    boxes[0].end = colors.size();
+    measureBox(colors, &boxes[0]);
+    while (boxes.size() < slots) {
+        size_t widest = boxes.size();
+        for (size_t i = 0; i < boxes.size(); i++) {
+            if (boxes[i].end - boxes[i].begin > 1 && boxes[i].error > 0
+                    && (widest == boxes.size() || boxes[i].error > boxes[widest].error)) {
+                widest = i;
+            }
+        }
+        if (widest == boxes.size()) {
+            break;
+        }
+        Box upper;
+        splitBox(colors, &boxes[widest], &upper);
+        boxes.push_back(upper);
+    }
+
+    std::vector<uint32_t>& palette = *outPalette;
+    palette.resize(boxes.size());
+    for (size_t i = 0; i < boxes.size(); i++) {
+        int rgba[4];
+        toRgba(boxes[i].mean, rgba);
+        palette[i] = packColor(rgba);
+    }
+
+    // Each round moves the colors to the mean of the pixels nearest them.
+    // The last one only measures how far the pixels are from them.
+    double error = 0;
+    std::vector<Point> points(palette.size());
+    std::vector<double> sums(4 * palette.size());
+    std::vector<uint64_t> counts(palette.size());
+    for (int round = 0; round <= kRefineRounds; round++) {
+        for (size_t i = 0; i < palette.size(); i++) {
+            points[i] = toPoint(palette[i]);
+        }
+        std::fill(sums.begin(), sums.end(), 0.0);
+        std::fill(counts.begin(), counts.end(), 0);
+        error = 0;
+        for (size_t i = 0; i < colors.size(); i++) {
+            float d;
+            const size_t index = nearest(points, toPoint(colors[i].color), &d);
+            error += (double) d * colors[i].count;
+            for (int c = 0; c < 4; c++) {
+                sums[4 * index + c] += (double) channelOf(colors[i].color, c) * colors[i].count;
+            }
+            counts[index] += colors[i].count;
+        }
+        if (round == kRefineRounds) {
+            break;
+        }
+        for (size_t i = 0; i < palette.size(); i++) {
+            if (counts[i] == 0) {
+                continue;
+            }
+            double mean[4];
+            for (int c = 0; c < 4; c++) {
+                mean[c] = sums[4 * i + c] / counts[i];
+            }
+            int rgba[4];
+            toRgba(mean, rgba);
+            palette[i] = packColor(rgba);
+        }
+    }
+    return error;
+}
+
+/*
+ * Remembers the palette color last chosen for a few dithered colors,
+ * since most of an image is near colors already seen.
+ */
+class NearestCache {
+public:
+    explicit NearestCache(const std::vector<Point>& palette) : mPalette(palette) {
+        memset(mEntries, 0, sizeof(mEntries));
+    }
+
+    size_t lookup(const float rgba[4]) {
+        int rounded[4];
+        for (int c = 0; c < 4; c++) {
+            rounded[c] = (int) (rgba[c] + 0.5f);
+        }
+        const uint32_t key = packColor(rounded);
+        Entry& entry = mEntries[(key * 2654435761u) >> (32 - kCacheBits)];
+        if (entry.index == 0 || entry.key != key) {
+            float exact[4];
+            for (int c = 0; c < 4; c++) {
+                exact[c] = (float) rounded[c];
+            }
+            entry.key = key;
+            entry.index = nearest(mPalette, toPoint(exact), NULL) + 1;
+        }
+        return entry.index - 1;
+    }
+
+private:
+    enum { kCacheBits = 12 };
+
+    struct Entry {
+        uint32_t key;
+        size_t index;       // plus 1; 0 for an empty entry
+    };
+
+    const std::vector<Point>& mPalette;
+    Entry mEntries[1 << kCacheBits];
+};
+
+void ditherToPalette(uint8_t* const* rows, size_t width, size_t height,
+        const std::vector<uint32_t>& palette)
+{
+    std::vector<Point> points(palette.size());
+    for (size_t i = 0; i < palette.size(); i++) {
+        points[i] = toPoint(palette[i]);
+    }
+    NearestCache* cache = new NearestCache(points);
+
+    // The error carried to each pixel of this row and the next, with a
+    // pixel of room on either side.
+    const size_t stride = 4 * (width + 2);
+    std::vector<float> errors(2 * stride, 0.0f);
+    float* thisRow = &errors[0];
+    float* nextRow = &errors[stride];
+    for (size_t y = 0; y < height; y++) {
+        std::fill(nextRow, nextRow + stride, 0.0f);
+        uint8_t* p = rows[y];
+        for (size_t x = 0; x < width; x++, p += 4) {
+            if (p[3] == 0) {
+                memset(p, 0, 4);
+                continue;
+            }
+            float value[4];
+            for (int c = 0; c < 4; c++) {
+                value[c] = std::min(std::max(p[c] + thisRow[4 * (x + 1) + c], 0.0f), 255.0f);
+            }
+            const uint32_t color = palette[cache->lookup(value)];
+            for (int c = 0; c < 4; c++) {
+                p[c] = (uint8_t) channelOf(color, c);
+                const float error = value[c] - p[c];
+                thisRow[4 * (x + 2) + c] += error * (7.0f / 16);
+                nextRow[4 * x + c] += error * (3.0f / 16);
+                nextRow[4 * (x + 1) + c] += error * (5.0f / 16);
+                nextRow[4 * (x + 2) + c] += error * (1.0f / 16);
+            }
+        }
+        std::swap(thisRow, nextRow);
+    }
+    delete cache;
+}
+
+} // namespace
+
+double quantizeQualityToMse(int quality)
+{
+    if (quality >= 100) {
+        return 0;
+    }
+    if (quality <= 0) {
+        return 255.0 * 255.0;
+    }
+    const double rms = (100 - quality) * 0.16;
+    return rms * rms;
+}
+
+bool quantizeRgbaImage(uint8_t* const* rows, size_t width, size_t height, size_t maxColors,
+        double maxMse, double* outMse)
+{
+    *outMse = 0;
+    maxColors = std::min(std::max(maxColors, (size_t) 2), (size_t) 256);
+
+    // Fully transparent pixels all get one palette entry of their own.
+    std::vector<uint32_t> pixels;
+    pixels.reserve(width * height);
+    bool hasTransparent = false;
+    for (size_t y = 0; y < height; y++) {
+        const uint8_t* p = rows[y];
+        for (size_t x = 0; x < width; x++, p += 4) {
+            if (p[3] == 0) {
+                hasTransparent = true;
+            } else {
+                pixels.push_back(((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16)
+                        | ((uint32_t) p[2] << 8) | p[3]);
+            }
+        }
+    }
+    std::sort(pixels.begin(), pixels.end());
+
+    std::vector<ColorCount> colors;
+    for (size_t i = 0; i < pixels.size(); ) {
+        size_t j = i + 1;
+        while (j < pixels.size() && pixels[j] == pixels[i]) {
+            j++;
+        }
+        ColorCount color;
+        color.color = pixels[i];
+        color.count = (uint32_t) (j - i);
+        colors.push_back(color);
+        i = j;
+    }
+    const size_t slots = maxColors - (hasTransparent ? 1 : 0);
+    if (colors.size() <= slots) {
+        return false;
+    }
+
+    const size_t counted = pixels.size();
+    std::vector<uint32_t>().swap(pixels);
+    std::vector<uint32_t> palette;
+    *outMse = choosePalette(colors, slots, &palette) / (4.0 * counted);
+    if (*outMse > maxMse) {
+        return false;
+    }
+    ditherToPalette(rows, width, height, palette);
+    return true;
+}
@@ -0,0 +1,42 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Lossy reduction of RGBA images to a palette, for --quantize-pngs.
+//
+
+#ifndef IMAGE_QUANTIZER_H
+#define IMAGE_QUANTIZER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The largest mean squared error quantizeRgbaImage() may leave for a
+ * --quantize-pngs quality from 0 to 100.  100 takes only an exact result,
+ * and each point below it allows a root mean squared error 0.16 of a
+ * level larger.
+ */
+double quantizeQualityToMse(int quality);
+
+/*
+ * Reduces the "width" x "height" RGBA pixels of "rows" to at most
+ * "maxColors" colors, from 2 to 256, in place, so that they can be
+ * written with a palette.
+ *
+ * The palette is chosen by median cut over the colors of the image,
+ * weighted by how many pixels have them, and refined by a few rounds of
+ * k-means; the pixels are then mapped to it with Floyd-Steinberg
+ * dithering.  Distances are measured on colors premultiplied by their
+ * alpha, so that errors weigh less where an image is more transparent.
+ * Fully transparent pixels stay fully transparent.
+ *
+ * *outMse is set to the mean squared error per channel of mapping each
+ * pixel that isn't fully transparent to its nearest palette color, before
+ * dithering.  Returns false, leaving "rows" as they are, if that is more
+ * than "maxMse", or if the image already has no more than "maxColors"
+ * colors, in which case *outMse is 0.
+ */
+bool quantizeRgbaImage(uint8_t* const* rows, size_t width, size_t height, size_t maxColors,
+        double maxMse, double* outMse);
+
+#endif // IMAGE_QUANTIZER_H
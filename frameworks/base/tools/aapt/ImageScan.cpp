@@ -0,0 +1,322 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// The per-pixel work of choosing how to encode a PNG.
+//
+
+#include "ImageScan.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2_SCAN 1
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+// Compiled for AVX2 on its own, and only called if the CPU has it.
+#include <immintrin.h>
+#define HAVE_AVX2_SCAN 1
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HAVE_NEON_SCAN 1
+#endif
+
+typedef void (*ScanFunc)(const uint8_t* pixels, size_t count, int* ioMaxGrayDeviation,
+        bool* ioIsOpaque);
+
+void scanRgbaPixelsScalar(const uint8_t* pixels, size_t count, int* ioMaxGrayDeviation,
+        bool* ioIsOpaque)
+{
+    int maxGrayDeviation = *ioMaxGrayDeviation;
+    uint8_t alpha = 0xff;
+
+    for (size_t i = 0; i < count; i++, pixels += 4) {
+        // The largest of |r-g|, |g-b| and |b-r| is just max - min.
+        int hi = pixels[0], lo = pixels[0];
+        if (pixels[1] > hi) hi = pixels[1];
+        if (pixels[1] < lo) lo = pixels[1];
+        if (pixels[2] > hi) hi = pixels[2];
+        if (pixels[2] < lo) lo = pixels[2];
+        if (hi - lo > maxGrayDeviation) {
+            maxGrayDeviation = hi - lo;
+        }
+        alpha &= pixels[3];
+    }
+
+    *ioMaxGrayDeviation = maxGrayDeviation;
+    if (alpha != 0xff) {
+        *ioIsOpaque = false;
+    }
+}
+
+/*
+ * Folds the lanes of a vector kernel into the running results.  "devs"
+ * holds channel differences in any bytes, and zeros elsewhere; "alphas"
+ * holds the AND of every pixel, so its alpha bytes are every fourth one.
+ */
+static void mergeLanes(const uint8_t* devs, const uint8_t* alphas, size_t bytes,
+        int* ioMaxGrayDeviation, bool* ioIsOpaque)
+{
+    uint8_t alpha = 0xff;
+    for (size_t i = 0; i < bytes; i++) {
+        if (devs[i] > *ioMaxGrayDeviation) {
+            *ioMaxGrayDeviation = devs[i];
+        }
+        if ((i & 3) == 3) {
+            alpha &= alphas[i];
+        }
+    }
+    if (alpha != 0xff) {
+        *ioIsOpaque = false;
+    }
+}
+
+#if HAVE_SSE2_SCAN
+static inline __m128i absDiffSse2(__m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+}
+
+static void scanRgbaPixelsSse2(const uint8_t* pixels, size_t count, int* ioMaxGrayDeviation,
+        bool* ioIsOpaque)
+{
+    // Within each 32-bit pixel, shifting right by one channel lines g up
+    // with r and b with g, and by two lines b up with r.
+    const __m128i rgGbMask = _mm_set1_epi32(0x0000ffff);
+    const __m128i rbMask = _mm_set1_epi32(0x000000ff);
+    __m128i devs = _mm_setzero_si128();
+    __m128i alphas = _mm_set1_epi8((char) 0xff);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4, pixels += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) pixels);
+        __m128i d1 = _mm_and_si128(absDiffSse2(v, _mm_srli_epi32(v, 8)), rgGbMask);
+        __m128i d2 = _mm_and_si128(absDiffSse2(v, _mm_srli_epi32(v, 16)), rbMask);
+        devs = _mm_max_epu8(devs, _mm_max_epu8(d1, d2));
+        alphas = _mm_and_si128(alphas, v);
+    }
+
+    uint8_t devBytes[16], alphaBytes[16];
+    _mm_storeu_si128((__m128i*) devBytes, devs);
+    _mm_storeu_si128((__m128i*) alphaBytes, alphas);
+    mergeLanes(devBytes, alphaBytes, sizeof(devBytes), ioMaxGrayDeviation, ioIsOpaque);
+    scanRgbaPixelsScalar(pixels, count - i, ioMaxGrayDeviation, ioIsOpaque);
+}
+#endif
+
+#if HAVE_AVX2_SCAN
+__attribute__((target("avx2")))
+static inline __m256i absDiffAvx2(__m256i a, __m256i b)
+{
+    return _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+}
+
+// The same as scanRgbaPixelsSse2(), eight pixels at a time.
+__attribute__((target("avx2")))
+static void scanRgbaPixelsAvx2(const uint8_t* pixels, size_t count, int* ioMaxGrayDeviation,
+        bool* ioIsOpaque)
+{
+    const __m256i rgGbMask = _mm256_set1_epi32(0x0000ffff);
+    const __m256i rbMask = _mm256_set1_epi32(0x000000ff);
+    __m256i devs = _mm256_setzero_si256();
+    __m256i alphas = _mm256_set1_epi8((char) 0xff);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8, pixels += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) pixels);
+        __m256i d1 = _mm256_and_si256(absDiffAvx2(v, _mm256_srli_epi32(v, 8)), rgGbMask);
+        __m256i d2 = _mm256_and_si256(absDiffAvx2(v, _mm256_srli_epi32(v, 16)), rbMask);
+        devs = _mm256_max_epu8(devs, _mm256_max_epu8(d1, d2));
+        alphas = _mm256_and_si256(alphas, v);
+    }
+
+    uint8_t devBytes[32], alphaBytes[32];
+    _mm256_storeu_si256((__m256i*) devBytes, devs);
+    _mm256_storeu_si256((__m256i*) alphaBytes, alphas);
+    mergeLanes(devBytes, alphaBytes, sizeof(devBytes), ioMaxGrayDeviation, ioIsOpaque);
+    scanRgbaPixelsScalar(pixels, count - i, ioMaxGrayDeviation, ioIsOpaque);
+}
+#endif
+
+#if HAVE_NEON_SCAN
+static void scanRgbaPixelsNeon(const uint8_t* pixels, size_t count, int* ioMaxGrayDeviation,
+        bool* ioIsOpaque)
+{
+    uint8x16_t devs = vdupq_n_u8(0);
+    uint8x16_t alphas = vdupq_n_u8(0xff);
+
+    // vld4 splits sixteen pixels into one vector per channel.
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16, pixels += 64) {
+        uint8x16x4_t v = vld4q_u8(pixels);
+        uint8x16_t hi = vmaxq_u8(v.val[0], vmaxq_u8(v.val[1], v.val[2]));
+        uint8x16_t lo = vminq_u8(v.val[0], vminq_u8(v.val[1], v.val[2]));
+        devs = vmaxq_u8(devs, vsubq_u8(hi, lo));
+        alphas = vandq_u8(alphas, v.val[3]);
+    }
+
+    uint8_t devBytes[16], alphaBytes[16];
+    vst1q_u8(devBytes, devs);
+    vst1q_u8(alphaBytes, alphas);
+    uint8_t alpha = 0xff;
+    for (size_t j = 0; j < sizeof(devBytes); j++) {
+        if (devBytes[j] > *ioMaxGrayDeviation) {
+            *ioMaxGrayDeviation = devBytes[j];
+        }
+        alpha &= alphaBytes[j];
+    }
+    if (alpha != 0xff) {
+        *ioIsOpaque = false;
+    }
+    scanRgbaPixelsScalar(pixels, count - i, ioMaxGrayDeviation, ioIsOpaque);
+}
+#endif
+
+static ScanFunc chooseScanFunc()
+{
+#if HAVE_AVX2_SCAN
+    // This runs from a static initializer, before libgcc has looked.
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return scanRgbaPixelsAvx2;
+    }
+#endif
+#if HAVE_SSE2_SCAN
+    return scanRgbaPixelsSse2;
+#elif HAVE_NEON_SCAN
+    return scanRgbaPixelsNeon;
+#else
+    return scanRgbaPixelsScalar;
+#endif
+}
+
+static const ScanFunc sScanFunc = chooseScanFunc();
+
+void scanRgbaPixels(const uint8_t* pixels, size_t count, int* ioMaxGrayDeviation,
+        bool* ioIsOpaque)
+{
+    sScanFunc(pixels, count, ioMaxGrayDeviation, ioIsOpaque);
+}
+
+// The frame colors, packed as a little-endian load of the pixel gives them.
+static const uint32_t kFrameWhite = 0xffffffff;
+static const uint32_t kFrameTick = 0xff000000;
+static const uint32_t kFrameLayoutBounds = 0xff0000ff;
+static const uint32_t kFrameAlpha = 0xff000000;
+
+static inline uint32_t packPixel(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+void classifyFramePixelsScalar(const uint8_t* pixels, size_t count, bool transparent,
+        uint8_t* outTypes)
+{
+    for (size_t i = 0; i < count; i++, pixels += 4) {
+        uint32_t color = packPixel(pixels);
+        if (transparent ? (color & kFrameAlpha) == 0 : color == kFrameWhite) {
+            outTypes[i] = kFramePixelNone;
+        } else if (color == kFrameTick) {
+            outTypes[i] = kFramePixelTick;
+        } else if (color == kFrameLayoutBounds) {
+            outTypes[i] = kFramePixelLayoutBounds;
+        } else {
+            outTypes[i] = kFramePixelOther;
+        }
+    }
+}
+
+size_t findUnmatchedPixelScalar(const uint8_t* pixels, size_t count, uint32_t color,
+        uint32_t mask)
+{
+    for (size_t i = 0; i < count; i++, pixels += 4) {
+        if ((packPixel(pixels) & mask) != color) {
+            return i;
+        }
+    }
+    return count;
+}
+
+#if HAVE_SSE2_SCAN
+void classifyFramePixels(const uint8_t* pixels, size_t count, bool transparent,
+        uint8_t* outTypes)
+{
+    // The masks are exclusive, so each one subtracts its distance from
+    // kFramePixelOther.
+    const __m128i none = _mm_set1_epi32(transparent ? 0 : (int) kFrameWhite);
+    const __m128i noneMask = _mm_set1_epi32(transparent ? (int) kFrameAlpha : -1);
+    const __m128i tick = _mm_set1_epi32((int) kFrameTick);
+    const __m128i layoutBounds = _mm_set1_epi32((int) kFrameLayoutBounds);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4, pixels += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) pixels);
+        __m128i types = _mm_set1_epi32(kFramePixelOther);
+        types = _mm_sub_epi32(types, _mm_and_si128(_mm_set1_epi32(kFramePixelOther),
+                _mm_cmpeq_epi32(_mm_and_si128(v, noneMask), none)));
+        types = _mm_sub_epi32(types, _mm_and_si128(_mm_set1_epi32(
+                kFramePixelOther - kFramePixelTick), _mm_cmpeq_epi32(v, tick)));
+        types = _mm_sub_epi32(types, _mm_and_si128(_mm_set1_epi32(
+                kFramePixelOther - kFramePixelLayoutBounds), _mm_cmpeq_epi32(v, layoutBounds)));
+        types = _mm_packus_epi16(_mm_packs_epi32(types, types), types);
+        uint32_t packed = (uint32_t) _mm_cvtsi128_si32(types);
+        memcpy(outTypes + i, &packed, 4);
+    }
+    classifyFramePixelsScalar(pixels, count - i, transparent, outTypes + i);
+}
+
+size_t findUnmatchedPixel(const uint8_t* pixels, size_t count, uint32_t color, uint32_t mask)
+{
+    const __m128i colors = _mm_set1_epi32((int) color);
+    const __m128i masks = _mm_set1_epi32((int) mask);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4, pixels += 16) {
+        __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i*) pixels), masks);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(v, colors)) != 0xffff) {
+            break;
+        }
+    }
+    return i + findUnmatchedPixelScalar(pixels, count - i, color, mask);
+}
+#else
+void classifyFramePixels(const uint8_t* pixels, size_t count, bool transparent,
+        uint8_t* outTypes)
+{
+    classifyFramePixelsScalar(pixels, count, transparent, outTypes);
+}
+
+size_t findUnmatchedPixel(const uint8_t* pixels, size_t count, uint32_t color, uint32_t mask)
+{
+    return findUnmatchedPixelScalar(pixels, count, color, mask);
+}
+#endif
+
+RgbaPalette::RgbaPalette()
+    : mSize(0)
+{
+    memset(mSlots, 0xff, sizeof(mSlots));
+}
+
+int RgbaPalette::indexOf(uint32_t color)
+{
+    // Fibonacci hashing, with linear probing in a table kept at most half
+    // full.
+    size_t slot = (color * 0x9e3779b1u) >> (32 - kSlotBits);
+    while (mSlots[slot] >= 0) {
+        if (mColors[mSlots[slot]] == color) {
+            return mSlots[slot];
+        }
+        slot = (slot + 1) & (kSlots - 1);
+    }
+
+    if (mSize == kMaxColors) {
+        return -1;
+    }
+    mColors[mSize] = color;
+    mSlots[slot] = (int16_t) mSize;
+    return (int) mSize++;
+}
@@ -0,0 +1,95 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// The per-pixel work of choosing how to encode a PNG.
+//
+
+#ifndef IMAGE_SCAN_H
+#define IMAGE_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Scans "count" RGBA pixels, 4 bytes each.  *ioMaxGrayDeviation is raised
+ * to the largest difference between two color channels of any of them,
+ * which is 0 only if every pixel is gray, and *ioIsOpaque is cleared if
+ * any of them has an alpha other than 0xff.
+ *
+ * Uses the widest vector instructions the CPU supports, chosen once at
+ * startup; the results are always exactly those of the scalar version.
+ */
+void scanRgbaPixels(const uint8_t* pixels, size_t count, int* ioMaxGrayDeviation,
+        bool* ioIsOpaque);
+
+/* The plain C version of scanRgbaPixels(). */
+void scanRgbaPixelsScalar(const uint8_t* pixels, size_t count, int* ioMaxGrayDeviation,
+        bool* ioIsOpaque);
+
+/*
+ * How classifyFramePixels() sorts the pixels of a 9-patch frame.  Only the
+ * exact frame colors are sorted; kFramePixelOther is anything else, which
+ * the caller has to look at itself to report what is wrong with it.
+ */
+enum {
+    kFramePixelNone,
+    kFramePixelTick,
+    kFramePixelLayoutBounds,
+    kFramePixelOther
+};
+
+/*
+ * Sorts "count" RGBA pixels of a frame into outTypes.  In a transparent
+ * frame any pixel with an alpha of 0 is kFramePixelNone, in a white one
+ * only opaque white is.  Opaque black is a tick and opaque red a layout
+ * bounds tick in either.
+ */
+void classifyFramePixels(const uint8_t* pixels, size_t count, bool transparent,
+        uint8_t* outTypes);
+
+/* The plain C version of classifyFramePixels(). */
+void classifyFramePixelsScalar(const uint8_t* pixels, size_t count, bool transparent,
+        uint8_t* outTypes);
+
+/*
+ * Returns the index of the first of "count" RGBA pixels whose bits under
+ * "mask" differ from those of "color", or count if there is none.  Both
+ * are packed with the first byte of a pixel lowest, as a little-endian
+ * load of the pixel would give.
+ */
+size_t findUnmatchedPixel(const uint8_t* pixels, size_t count, uint32_t color, uint32_t mask);
+
+/* The plain C version of findUnmatchedPixel(). */
+size_t findUnmatchedPixelScalar(const uint8_t* pixels, size_t count, uint32_t color,
+        uint32_t mask);
+
+/*
+ * The distinct colors of an image, up to the 256 a PNG palette can hold,
+ * in the order they were first seen.  Lookups are hashed rather than a
+ * search of the colors found so far.
+ */
+class RgbaPalette {
+public:
+    enum { kMaxColors = 256 };
+
+    RgbaPalette();
+
+    /*
+     * Returns the palette index of the color packed as 0xRRGGBBAA, adding
+     * it if it is new, or -1 if the palette is already full.
+     */
+    int indexOf(uint32_t color);
+
+    size_t size() const { return mSize; }
+    uint32_t colorAt(size_t index) const { return mColors[index]; }
+
+private:
+    enum { kSlotBits = 9, kSlots = 1 << kSlotBits };
+
+    // Indices into mColors, or -1 for an empty slot.
+    int16_t mSlots[kSlots];
+    uint32_t mColors[kMaxColors];
+    size_t mSize;
+};
+
+#endif // IMAGE_SCAN_H
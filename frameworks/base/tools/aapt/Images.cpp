@@ -7,13 +7,31 @@
 #define PNG_INTERNAL
 
 #include "Images.h"
+#include "CompileCache.h"
+#include "FileCosts.h"
+#include "ImageQuantizer.h"
+#include "ImageScan.h"
+#include "MappedFile.h"
+#include "PhaseTrace.h"
+#include "Statistics.h"
+#include "WorkQueue.h"
 
 #include <androidfw/ResourceTypes.h>
+#include <cutils/threads.h>
 #include <utils/ByteOrder.h>
+#include <utils/Mutex.h>
+#include <utils/misc.h>
 
+#include <algorithm>
+#include <ctype.h>
 #include <png.h>
+#include <stdint.h>
 #include <zlib.h>
 
+#ifdef AAPT_HAVE_WEBP
+#include <webp/encode.h>
+#endif
+
 // Change this to true for noisy debug output.
 static const bool kIsDebug = false;
 
@@ -33,27 +51,267 @@ png_flush_aapt_file(png_structp /* png_ptr */)
 {
 }
 
+// A PNG being read straight out of a MappedFile.
+struct png_memory_source {
+    const png_byte* data;
+    png_size_t size;
+    png_size_t offset;
+};
+
+static void
+png_read_memory(png_structp png_ptr, png_bytep data, png_size_t length)
+{
+    png_memory_source* source = (png_memory_source*) png_get_io_ptr(png_ptr);
+    if (length > source->size - source->offset) {
+        png_error(png_ptr, "Read Error");
+    }
+    memcpy(data, source->data + source->offset, length);
+    source->offset += length;
+}
+
+static void
+png_set_memory_source(png_structp png_ptr, png_memory_source* source,
+                      const MappedFile& input)
+{
+    source->data = (const png_byte*) input.getData();
+    source->size = input.getSize();
+    source->offset = 0;
+    png_set_read_fn(png_ptr, source, png_read_memory);
+}
+
+/*
+ * Keeps the pixel buffers of finished images for the next ones, since each
+ * thread crunching images reads one after another, rather than freeing
+ * them and allocating again.
+ */
+class PixelBufferPool {
+public:
+    // Returns a buffer of at least "size" bytes, with its actual size in
+    // "outCapacity".
+    static void* acquire(size_t size, size_t* outCapacity);
+
+    // Keeps the buffer, or frees it if the pool is full.
+    static void release(void* buffer, size_t capacity);
+
+private:
+    enum { kMaxBuffers = 8 };
+    static const size_t kMaxPooledBytes = 256 * 1024 * 1024;
+
+    struct Buffer {
+        void* data;
+        size_t capacity;
+    };
+
+    static Mutex sLock;
+    static Buffer sBuffers[kMaxBuffers];
+    static size_t sCount;
+    static size_t sPooledBytes;
+};
+
+Mutex PixelBufferPool::sLock;
+PixelBufferPool::Buffer PixelBufferPool::sBuffers[kMaxBuffers];
+size_t PixelBufferPool::sCount = 0;
+size_t PixelBufferPool::sPooledBytes = 0;
+
+void* PixelBufferPool::acquire(size_t size, size_t* outCapacity)
+{
+    {
+        AutoMutex _l(sLock);
+        // The smallest buffer that is big enough.
+        ssize_t best = -1;
+        for (size_t i = 0; i < sCount; i++) {
+            if (sBuffers[i].capacity >= size
+                    && (best < 0 || sBuffers[i].capacity < sBuffers[best].capacity)) {
+                best = i;
+            }
+        }
+        if (best >= 0) {
+            void* data = sBuffers[best].data;
+            *outCapacity = sBuffers[best].capacity;
+            sPooledBytes -= sBuffers[best].capacity;
+            sBuffers[best] = sBuffers[--sCount];
+            return data;
+        }
+    }
+    *outCapacity = size;
+    return malloc(size);
+}
+
+void PixelBufferPool::release(void* buffer, size_t capacity)
+{
+    {
+        AutoMutex _l(sLock);
+        if (sCount < kMaxBuffers && sPooledBytes + capacity <= kMaxPooledBytes) {
+            sBuffers[sCount].data = buffer;
+            sBuffers[sCount].capacity = capacity;
+            sCount++;
+            sPooledBytes += capacity;
+            return;
+        }
+    }
+    free(buffer);
+}
+
+/*
+ * Allocates for libpng, keeping the blocks it frees for the next image on
+ * the same thread.  libpng can't reset its structs for another image, but
+ * what it allocates for each one (the structs, zlib's state and window,
+ * the row buffers) comes in much the same sizes every time, so a new
+ * read or write struct is mostly put together from blocks already here.
+ */
+class PngBlockCache {
+public:
+    static png_structp createReadStruct(png_voidp errorPtr, png_error_ptr errorFn,
+            png_error_ptr warnFn) {
+        return png_create_read_struct_2(PNG_LIBPNG_VER_STRING, errorPtr, errorFn, warnFn,
+                NULL, allocate, release);
+    }
+
+    static png_structp createWriteStruct(png_voidp errorPtr, png_error_ptr errorFn,
+            png_error_ptr warnFn) {
+        return png_create_write_struct_2(PNG_LIBPNG_VER_STRING, errorPtr, errorFn, warnFn,
+                NULL, allocate, release);
+    }
+
+private:
+    enum { kMaxBlocks = 32 };
+    static const size_t kMaxCachedBytes = 4 * 1024 * 1024;
+
+    // In front of every block; the union keeps what follows aligned.
+    union Block {
+        struct {
+            size_t size;
+            Block* next;
+        } header;
+        long double align;
+    };
+
+    // The blocks one thread has kept.
+    struct Blocks {
+        Blocks() : first(NULL), count(0), bytes(0) { }
+
+        Block* first;
+        size_t count;
+        size_t bytes;
+    };
+
+    static Blocks* threadBlocks();
+    static void freeBlocks(void* blocks);
+    static png_voidp allocate(png_structp png_ptr, png_alloc_size_t size);
+    static void release(png_structp png_ptr, png_voidp ptr);
+
+    static thread_store_t sBlocks;
+};
+
+thread_store_t PngBlockCache::sBlocks = THREAD_STORE_INITIALIZER;
+
+PngBlockCache::Blocks* PngBlockCache::threadBlocks()
+{
+    Blocks* blocks = static_cast<Blocks*>(thread_store_get(&sBlocks));
+    if (blocks == NULL) {
+        blocks = new Blocks();
+        thread_store_set(&sBlocks, blocks, freeBlocks);
+    }
+    return blocks;
+}
+
+void PngBlockCache::freeBlocks(void* p)
+{
+    Blocks* blocks = static_cast<Blocks*>(p);
+    while (blocks->first != NULL) {
+        Block* block = blocks->first;
+        blocks->first = block->header.next;
+        free(block);
+    }
+    delete blocks;
+}
+
+png_voidp PngBlockCache::allocate(png_structp /* png_ptr */, png_alloc_size_t size)
+{
+    Blocks* blocks = threadBlocks();
+    for (Block** link = &blocks->first; *link != NULL; link = &(*link)->header.next) {
+        Block* block = *link;
+        if (block->header.size == size) {
+            *link = block->header.next;
+            blocks->count--;
+            blocks->bytes -= size;
+            return block + 1;
+        }
+    }
+
+    Block* block = (Block*) malloc(sizeof(Block) + size);
+    if (block == NULL) {
+        return NULL;
+    }
+    block->header.size = size;
+    return block + 1;
+}
+
+void PngBlockCache::release(png_structp /* png_ptr */, png_voidp ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    Block* block = static_cast<Block*>(ptr) - 1;
+    Blocks* blocks = threadBlocks();
+    if (blocks->count < kMaxBlocks && blocks->bytes + block->header.size <= kMaxCachedBytes) {
+        block->header.next = blocks->first;
+        blocks->first = block;
+        blocks->count++;
+        blocks->bytes += block->header.size;
+    } else {
+        free(block);
+    }
+}
+
+// Row starts are aligned to this many bytes.
+static const size_t kRowAlignment = 16;
+
+static inline size_t alignRow(size_t size)
+{
+    return (size + kRowAlignment - 1) & ~(kRowAlignment - 1);
+}
+
 // This holds an image as 8bpp RGBA.
 struct image_info
 {
     image_info() : rows(NULL), is9Patch(false),
-        xDivs(NULL), yDivs(NULL), colors(NULL), allocRows(NULL) { }
+        xDivs(NULL), yDivs(NULL), colors(NULL), allocRows(NULL), buffer(NULL) { }
 
     ~image_info() {
-        if (rows && rows != allocRows) {
-            free(rows);
-        }
-        if (allocRows) {
-            for (int i=0; i<(int)allocHeight; i++) {
-                free(allocRows[i]);
-            }
-            free(allocRows);
+        if (buffer) {
+            PixelBufferPool::release(buffer, bufferCapacity);
         }
         free(xDivs);
         free(yDivs);
         free(colors);
     }
 
+    /*
+     * Points allocRows and rows at "height" rows of "rowBytes" each, in one
+     * buffer that also holds the row pointers.  Returns false if out of
+     * memory.
+     */
+    bool allocPixels(png_uint_32 height, size_t rowBytes) {
+        const size_t stride = alignRow(rowBytes);
+        const size_t pointersSize = alignRow(height * sizeof(png_bytep));
+        if (height > 0 && stride > (SIZE_MAX - pointersSize) / height) {
+            return false;
+        }
+        buffer = PixelBufferPool::acquire(pointersSize + stride * height, &bufferCapacity);
+        if (buffer == NULL) {
+            return false;
+        }
+        allocRows = (png_bytepp) buffer;
+        png_bytep pixels = (png_bytep) buffer + pointersSize;
+        for (png_uint_32 i = 0; i < height; i++) {
+            allocRows[i] = pixels + i * stride;
+        }
+        allocHeight = height;
+        rows = allocRows;
+        return true;
+    }
+
     void* serialize9patch() {
         void* serialized = Res_png_9patch::serialize(info9Patch, xDivs, yDivs, colors);
         reinterpret_cast<Res_png_9patch*>(serialized)->deviceToFile();
@@ -86,8 +344,12 @@ struct image_info
     float outlineRadius;
     uint8_t outlineAlpha;
 
+    // The rows as read; "rows" skips the frame of a 9-patch.  Both point
+    // into "buffer".
     png_uint_32 allocHeight;
     png_bytepp allocRows;
+    void* buffer;
+    size_t bufferCapacity;
 };
 
 static void log_warning(png_structp png_ptr, png_const_charp warning_message)
@@ -102,7 +364,6 @@ static void read_png(const char* imageName,
 {
     int color_type;
     int bit_depth, interlace_type, compression_type;
-    int i;
 
     png_set_error_fn(read_ptr, const_cast<char*>(imageName),
             NULL /* use default errorfn */, log_warning);
@@ -140,19 +401,13 @@ static void read_png(const char* imageName,
 
     png_read_update_info(read_ptr, read_info);
 
-    outImageInfo->rows = (png_bytepp)malloc(
-        outImageInfo->height * sizeof(png_bytep));
-    outImageInfo->allocHeight = outImageInfo->height;
-    outImageInfo->allocRows = outImageInfo->rows;
+    if (!outImageInfo->allocPixels(outImageInfo->height,
+            png_get_rowbytes(read_ptr, read_info))) {
+        png_error(read_ptr, "Out of memory for image rows");
+    }
 
     png_set_rows(read_ptr, read_info, outImageInfo->rows);
 
-    for (i = 0; i < (int)outImageInfo->height; i++)
-    {
-        outImageInfo->rows[i] = (png_bytep)
-            malloc(png_get_rowbytes(read_ptr, read_info));
-    }
-
     png_read_image(read_ptr, outImageInfo->rows);
 
     png_read_end(read_ptr, read_info);
@@ -234,71 +489,53 @@ enum {
     TICK_OUTSIDE_1
 };
 
-static status_t get_horizontal_ticks(
-        png_bytep row, int width, bool transparent, bool required,
-        int32_t* outLeft, int32_t* outRight, const char** outError,
-        uint8_t* outDivs, bool multipleAllowed)
+/*
+ * The tick type of pixel i of an edge, whose pixels classifyFramePixels()
+ * has sorted into "types"; only the ones that are not a frame color need
+ * tick_type() to work out what is wrong with them.
+ */
+static int edge_tick_type(png_bytep pixels, const uint8_t* types, int i, bool transparent,
+        const char** outError)
 {
-    int i;
-    *outLeft = *outRight = -1;
-    int state = TICK_START;
-    bool found = false;
-
-    for (i=1; i<width-1; i++) {
-        if (TICK_TYPE_TICK == tick_type(row+i*4, transparent, outError)) {
-            if (state == TICK_START ||
-                (state == TICK_OUTSIDE_1 && multipleAllowed)) {
-                *outLeft = i-1;
-                *outRight = width-2;
-                found = true;
-                if (outDivs != NULL) {
-                    *outDivs += 2;
-                }
-                state = TICK_INSIDE_1;
-            } else if (state == TICK_OUTSIDE_1) {
-                *outError = "Can't have more than one marked region along edge";
-                *outLeft = i;
-                return UNKNOWN_ERROR;
-            }
-        } else if (*outError == NULL) {
-            if (state == TICK_INSIDE_1) {
-                // We're done with this div.  Move on to the next.
-                *outRight = i-1;
-                outRight += 2;
-                outLeft += 2;
-                state = TICK_OUTSIDE_1;
-            }
-        } else {
-            *outLeft = i;
-            return UNKNOWN_ERROR;
-        }
+    switch (types[i]) {
+    case kFramePixelNone:
+        return TICK_TYPE_NONE;
+    case kFramePixelTick:
+        return TICK_TYPE_TICK;
+    case kFramePixelLayoutBounds:
+        return TICK_TYPE_LAYOUT_BOUNDS;
     }
+    return tick_type(pixels + i * 4, transparent, outError);
+}
 
-    if (required && !found) {
-        *outError = "No marked region found along edge";
-        *outLeft = -1;
-        return UNKNOWN_ERROR;
+/*
+ * Copies the pixels "offset" bytes into each row out into a row of their
+ * own, so that the left and right edges are scanned like the top and
+ * bottom ones rather than a row pointer per pixel.
+ */
+static void copy_column(png_bytepp rows, int offset, int height, png_bytep outPixels)
+{
+    for (int i = 0; i < height; i++) {
+        memcpy(outPixels + i * 4, rows[i] + offset, 4);
     }
-
-    return NO_ERROR;
 }
 
-static status_t get_vertical_ticks(
-        png_bytepp rows, int offset, int height, bool transparent, bool required,
-        int32_t* outTop, int32_t* outBottom, const char** outError,
+static status_t get_edge_ticks(
+        png_bytep pixels, const uint8_t* types, int length, bool transparent,
+        bool required, int32_t* outStart, int32_t* outEnd, const char** outError,
         uint8_t* outDivs, bool multipleAllowed)
 {
     int i;
-    *outTop = *outBottom = -1;
+    *outStart = *outEnd = -1;
     int state = TICK_START;
     bool found = false;
 
-    for (i=1; i<height-1; i++) {
-        if (TICK_TYPE_TICK == tick_type(rows[i]+offset, transparent, outError)) {
+    for (i=1; i<length-1; i++) {
+        if (TICK_TYPE_TICK == edge_tick_type(pixels, types, i, transparent, outError)) {
             if (state == TICK_START ||
                 (state == TICK_OUTSIDE_1 && multipleAllowed)) {
-                *outTop = i-1;
-                *outBottom = height-2;
+                *outStart = i-1;
+                *outEnd = length-2;
                 found = true;
                 if (outDivs != NULL) {
                     *outDivs += 2;
@@ -306,99 +543,62 @@ static status_t get_vertical_ticks(
                 state = TICK_INSIDE_1;
             } else if (state == TICK_OUTSIDE_1) {
                 *outError = "Can't have more than one marked region along edge";
-                *outTop = i;
+                *outStart = i;
                 return UNKNOWN_ERROR;
             }
         } else if (*outError == NULL) {
             if (state == TICK_INSIDE_1) {
                 // We're done with this div.  Move on to the next.
-                *outBottom = i-1;
-                outTop += 2;
-                outBottom += 2;
+                *outEnd = i-1;
+                outEnd += 2;
+                outStart += 2;
                 state = TICK_OUTSIDE_1;
             }
         } else {
-            *outTop = i;
+            *outStart = i;
             return UNKNOWN_ERROR;
         }
     }
 
     if (required && !found) {
         *outError = "No marked region found along edge";
-        *outTop = -1;
+        *outStart = -1;
         return UNKNOWN_ERROR;
     }
 
     return NO_ERROR;
 }
 
-static status_t get_horizontal_layout_bounds_ticks(
-        png_bytep row, int width, bool transparent, bool /* required */,
-        int32_t* outLeft, int32_t* outRight, const char** outError)
+static status_t get_edge_layout_bounds_ticks(
+        png_bytep pixels, const uint8_t* types, int length, bool transparent,
+        bool /* required */, int32_t* outStart, int32_t* outEnd, const char** outError)
 {
     int i;
-    *outLeft = *outRight = 0;
+    *outStart = *outEnd = 0;
 
-    // Look for left tick
-    if (TICK_TYPE_LAYOUT_BOUNDS == tick_type(row + 4, transparent, outError)) {
+    // Look for start tick
+    if (TICK_TYPE_LAYOUT_BOUNDS == edge_tick_type(pixels, types, 1, transparent, outError)) {
         // Starting with a layout padding tick
         i = 1;
-        while (i < width - 1) {
-            (*outLeft)++;
+        while (i < length - 1) {
+            (*outStart)++;
             i++;
-            int tick = tick_type(row + i * 4, transparent, outError);
+            int tick = edge_tick_type(pixels, types, i, transparent, outError);
             if (tick != TICK_TYPE_LAYOUT_BOUNDS) {
                 break;
             }
         }
     }
 
-    // Look for right tick
-    if (TICK_TYPE_LAYOUT_BOUNDS == tick_type(row + (width - 2) * 4, transparent, outError)) {
+    // Look for end tick
+    if (TICK_TYPE_LAYOUT_BOUNDS == edge_tick_type(pixels, types, length - 2, transparent,
+            outError)) {
         // Ending with a layout padding tick
-        i = width - 2;
+        i = length - 2;
         while (i > 1) {
-            (*outRight)++;
+            (*outEnd)++;
             i--;
-            int tick = tick_type(row+i*4, transparent, outError);
-            if (tick != TICK_TYPE_LAYOUT_BOUNDS) {
-                break;
-            }
-        }
-    }
-
-    return NO_ERROR;
-}
-
-static status_t get_vertical_layout_bounds_ticks(
-        png_bytepp rows, int offset, int height, bool transparent, bool /* required */,
-        int32_t* outTop, int32_t* outBottom, const char** outError)
-{
-    int i;
-    *outTop = *outBottom = 0;
-
-    // Look for top tick
-    if (TICK_TYPE_LAYOUT_BOUNDS == tick_type(rows[1] + offset, transparent, outError)) {
-        // Starting with a layout padding tick
-        i = 1;
-        while (i < height - 1) {
-            (*outTop)++;
-            i++;
-            int tick = tick_type(rows[i] + offset, transparent, outError);
-            if (tick != TICK_TYPE_LAYOUT_BOUNDS) {
-                break;
-            }
-        }
-    }
-
-    // Look for bottom tick
-    if (TICK_TYPE_LAYOUT_BOUNDS == tick_type(rows[height - 2] + offset, transparent, outError)) {
-        // Ending with a layout padding tick
-        i = height - 2;
-        while (i > 1) {
-            (*outBottom)++;
-            i--;
-            int tick = tick_type(rows[i] + offset, transparent, outError);
+            int tick = edge_tick_type(pixels, types, i, transparent, outError);
             if (tick != TICK_TYPE_LAYOUT_BOUNDS) {
                 break;
             }
@@ -517,17 +717,14 @@ static uint32_t get_color(
         return Res_png_9patch::TRANSPARENT_COLOR;
     }
 
+    // Any transparent pixel matches a transparent first one.
+    uint32_t mask = color[3] == 0 ? 0xff000000 : 0xffffffff;
+    uint32_t match = (color[0] | (color[1] << 8) | (color[2] << 16) |
+            ((uint32_t) color[3] << 24)) & mask;
+    size_t count = right - left + 1;
     while (top <= bottom) {
-        for (int i = left; i <= right; i++) {
-            png_bytep p = rows[top]+i*4;
-            if (color[3] == 0) {
-                if (p[3] != 0) {
-                    return Res_png_9patch::NO_COLOR;
-                }
-            } else if (p[0] != color[0] || p[1] != color[1]
-                       || p[2] != color[2] || p[3] != color[3]) {
-                return Res_png_9patch::NO_COLOR;
-            }
+        if (findUnmatchedPixel(rows[top] + left*4, count, match, mask) != count) {
+            return Res_png_9patch::NO_COLOR;
         }
         top++;
     }
@@ -578,6 +775,14 @@ static status_t do_9patch(const char* imageName, image_info* image)
 
     int colorIndex = 0;
 
+    // The left and right edges, and the sorted pixels of all four.
+    png_bytep leftEdge = NULL;
+    png_bytep rightEdge = NULL;
+    uint8_t* topTypes = NULL;
+    uint8_t* leftTypes;
+    uint8_t* bottomTypes;
+    uint8_t* rightTypes;
+
     // Validate size...
     if (W < 3 || H < 3) {
         errorMsg = "Image must be at least 3x3 (1x1 without frame) pixels";
@@ -591,17 +796,31 @@ static status_t do_9patch(const char* imageName, image_info* image)
         goto getout;
     }
 
+    leftEdge = (png_bytep) malloc(H * 4 * 2);
+    rightEdge = leftEdge + H * 4;
+    copy_column(image->rows, 0, H, leftEdge);
+    copy_column(image->rows, (W-1)*4, H, rightEdge);
+
+    topTypes = (uint8_t*) malloc((W + H) * 2);
+    leftTypes = topTypes + W;
+    bottomTypes = leftTypes + H;
+    rightTypes = bottomTypes + W;
+    classifyFramePixels(p, W, transparent, topTypes);
+    classifyFramePixels(leftEdge, H, transparent, leftTypes);
+    classifyFramePixels(image->rows[H-1], W, transparent, bottomTypes);
+    classifyFramePixels(rightEdge, H, transparent, rightTypes);
+
     // Find left and right of sizing areas...
-    if (get_horizontal_ticks(p, W, transparent, true, &xDivs[0],
-                             &xDivs[1], &errorMsg, &numXDivs, true) != NO_ERROR) {
+    if (get_edge_ticks(p, topTypes, W, transparent, true, &xDivs[0],
+                       &xDivs[1], &errorMsg, &numXDivs, true) != NO_ERROR) {
         errorPixel = xDivs[0];
         errorEdge = "top";
         goto getout;
     }
 
     // Find top and bottom of sizing areas...
-    if (get_vertical_ticks(image->rows, 0, H, transparent, true, &yDivs[0],
-                           &yDivs[1], &errorMsg, &numYDivs, true) != NO_ERROR) {
+    if (get_edge_ticks(leftEdge, leftTypes, H, transparent, true, &yDivs[0],
+                       &yDivs[1], &errorMsg, &numYDivs, true) != NO_ERROR) {
         errorPixel = yDivs[0];
         errorEdge = "left";
         goto getout;
@@ -612,29 +831,31 @@ static status_t do_9patch(const char* imageName, image_info* image)
     image->info9Patch.numYDivs = numYDivs;
 
     // Find left and right of padding area...
-    if (get_horizontal_ticks(image->rows[H-1], W, transparent, false, &image->info9Patch.paddingLeft,
-                             &image->info9Patch.paddingRight, &errorMsg, NULL, false) != NO_ERROR) {
+    if (get_edge_ticks(image->rows[H-1], bottomTypes, W, transparent, false,
+                       &image->info9Patch.paddingLeft, &image->info9Patch.paddingRight,
+                       &errorMsg, NULL, false) != NO_ERROR) {
         errorPixel = image->info9Patch.paddingLeft;
         errorEdge = "bottom";
         goto getout;
     }
 
     // Find top and bottom of padding area...
-    if (get_vertical_ticks(image->rows, (W-1)*4, H, transparent, false, &image->info9Patch.paddingTop,
-                           &image->info9Patch.paddingBottom, &errorMsg, NULL, false) != NO_ERROR) {
+    if (get_edge_ticks(rightEdge, rightTypes, H, transparent, false,
+                       &image->info9Patch.paddingTop, &image->info9Patch.paddingBottom,
+                       &errorMsg, NULL, false) != NO_ERROR) {
         errorPixel = image->info9Patch.paddingTop;
         errorEdge = "right";
         goto getout;
     }
 
     // Find left and right of layout padding...
-    get_horizontal_layout_bounds_ticks(image->rows[H-1], W, transparent, false,
-                                        &image->layoutBoundsLeft,
-                                        &image->layoutBoundsRight, &errorMsg);
+    get_edge_layout_bounds_ticks(image->rows[H-1], bottomTypes, W, transparent, false,
+                                 &image->layoutBoundsLeft,
+                                 &image->layoutBoundsRight, &errorMsg);
 
-    get_vertical_layout_bounds_ticks(image->rows, (W-1)*4, H, transparent, false,
-                                        &image->layoutBoundsTop,
-                                        &image->layoutBoundsBottom, &errorMsg);
+    get_edge_layout_bounds_ticks(rightEdge, rightTypes, H, transparent, false,
+                                 &image->layoutBoundsTop,
+                                 &image->layoutBoundsBottom, &errorMsg);
 
     image->haveLayoutBounds = image->layoutBoundsLeft != 0
                                || image->layoutBoundsRight != 0
@@ -677,9 +898,8 @@ static status_t do_9patch(const char* imageName, image_info* image)
     }
 
     // Remove frame from image.
-    image->rows = (png_bytepp)malloc((H-2) * sizeof(png_bytep));
+    image->rows = image->allocRows + 1;
     for (i=0; i<(H-2); i++) {
-        image->rows[i] = image->allocRows[i+1];
         memmove(image->rows[i], image->rows[i]+4, (W-2)*4);
     }
     image->width -= 2;
@@ -775,6 +995,8 @@ static status_t do_9patch(const char* imageName, image_info* image)
         }
     }
 getout:
+    free(leftEdge);
+    free(topTypes);
     if (errorMsg) {
         fprintf(stderr,
             "ERROR: 9-patch image %s malformed.\n"
@@ -868,24 +1090,38 @@ static void dump_image(int w, int h, png_bytepp rows, int color_type)
     }
 }
 
-#define MAX(a,b) ((a)>(b)?(a):(b))
-#define ABS(a)   ((a)<0?-(a):(a))
+// How write_png() encodes an image, as chosen by analyze_image().
+struct png_encoding {
+    int colorType;
+    int paletteEntries;
+    bool hasTransparency;
+    png_color rgbPalette[256];
+    png_byte alphaPalette[256];
+};
 
+/*
+ * Chooses the smallest color type that holds the image, and for a palette
+ * or gray type rewrites imageInfo.rows in that type, in place.  A 9-patch
+ * stays RGBA unless it can be gray + alpha.
+ */
 static void analyze_image(const char *imageName, image_info &imageInfo, int grayscaleTolerance,
-                          png_colorp rgbPalette, png_bytep alphaPalette,
-                          int *paletteEntries, bool *hasTransparency, int *colorType,
-                          png_bytepp outRows)
+                          png_encoding* encoding)
 {
+    png_colorp rgbPalette = encoding->rgbPalette;
+    png_bytep alphaPalette = encoding->alphaPalette;
+    int* paletteEntries = &encoding->paletteEntries;
+    bool* hasTransparency = &encoding->hasTransparency;
+    int* colorType = &encoding->colorType;
+
     int w = imageInfo.width;
     int h = imageInfo.height;
-    int i, j, rr, gg, bb, aa, idx;
-    uint32_t colors[256], col;
-    int num_colors = 0;
+    int i, j, rr, gg, bb, aa;
+    uint32_t col;
+    RgbaPalette palette;
     int maxGrayDeviation = 0;
 
     bool isOpaque = true;
     bool isPalette = true;
-    bool isGrayscale = true;
 
     // Scan the entire image and determine if:
     // 1. Every pixel has R == G == B (grayscale)
@@ -899,75 +1135,34 @@ static void analyze_image(const char *imageName, image_info &imageInfo, int gray
 
     for (j = 0; j < h; j++) {
         png_bytep row = imageInfo.rows[j];
-        png_bytep out = outRows[j];
-        for (i = 0; i < w; i++) {
-            rr = *row++;
-            gg = *row++;
-            bb = *row++;
-            aa = *row++;
-
-            int odev = maxGrayDeviation;
-            maxGrayDeviation = MAX(ABS(rr - gg), maxGrayDeviation);
-            maxGrayDeviation = MAX(ABS(gg - bb), maxGrayDeviation);
-            maxGrayDeviation = MAX(ABS(bb - rr), maxGrayDeviation);
-            if (maxGrayDeviation > odev) {
-                if (kIsDebug) {
-                    printf("New max dev. = %d at pixel (%d, %d) = (%d %d %d %d)\n",
-                            maxGrayDeviation, i, j, rr, gg, bb, aa);
-                }
-            }
-
-            // Check if image is really grayscale
-            if (isGrayscale) {
-                if (rr != gg || rr != bb) {
-                    if (kIsDebug) {
-                        printf("Found a non-gray pixel at %d, %d = (%d %d %d %d)\n",
-                                i, j, rr, gg, bb, aa);
-                    }
-                    isGrayscale = false;
-                }
-            }
 
-            // Check if image is really opaque
-            if (isOpaque) {
-                if (aa != 0xff) {
+        // An image is gray exactly when no pixel deviates from gray at all.
+        scanRgbaPixels(row, w, &maxGrayDeviation, &isOpaque);
+
+        // Check if image is really <= 256 colors
+        if (isPalette) {
+            // Runs of one color are common, and need no lookup.
+            uint32_t lastCol = 0;
+            int lastIdx = -1;
+            for (i = 0; i < w; i++, row += 4) {
+                col = (uint32_t) ((row[0] << 24) | (row[1] << 16) | (row[2] << 8) | row[3]);
+                int idx = (col == lastCol && lastIdx >= 0) ? lastIdx : palette.indexOf(col);
+                if (idx < 0) {
                     if (kIsDebug) {
-                        printf("Found a non-opaque pixel at %d, %d = (%d %d %d %d)\n",
-                                i, j, rr, gg, bb, aa);
-                    }
-                    isOpaque = false;
-                }
-            }
-
-            // Check if image is really <= 256 colors
-            if (isPalette) {
-                col = (uint32_t) ((rr << 24) | (gg << 16) | (bb << 8) | aa);
-                bool match = false;
-                for (idx = 0; idx < num_colors; idx++) {
-                    if (colors[idx] == col) {
-                        match = true;
-                        break;
-                    }
-                }
-
-                // Write the palette index for the pixel to outRows optimistically
-                // We might overwrite it later if we decide to encode as gray or
-                // gray + alpha
-                *out++ = idx;
-                if (!match) {
-                    if (num_colors == 256) {
-                        if (kIsDebug) {
-                            printf("Found 257th color at %d, %d\n", i, j);
-                        }
-                        isPalette = false;
-                    } else {
-                        colors[num_colors++] = col;
+                        printf("Found 257th color at %d, %d\n", i, j);
                     }
+                    isPalette = false;
+                    break;
                 }
+                lastCol = col;
+                lastIdx = idx;
             }
         }
     }
 
+    const bool isGrayscale = maxGrayDeviation == 0;
+    const int num_colors = palette.size();
+
     *paletteEntries = 0;
     *hasTransparency = !isOpaque;
     int bpp = isOpaque ? 3 : 4;
@@ -1013,8 +1208,16 @@ static void analyze_image(const char *imageName, image_info &imageInfo, int gray
         }
     }
 
+    // If the image is a 9-patch, we need to preserve it as a ARGB file to make
+    // sure the pixels will not be pre-dithered/clamped until we decide they are
+    if (imageInfo.is9Patch && (*colorType == PNG_COLOR_TYPE_RGB ||
+            *colorType == PNG_COLOR_TYPE_GRAY || *colorType == PNG_COLOR_TYPE_PALETTE)) {
+        *colorType = PNG_COLOR_TYPE_RGB_ALPHA;
+    }
+
     // Perform postprocessing of the image or palette data based on the final
-    // color type chosen
+    // color type chosen.  Each output pixel is no bigger than the RGBA pixel
+    // it comes from, so it can be written over the row as it is read.
 
     if (*colorType == PNG_COLOR_TYPE_PALETTE) {
         // Create separate RGB and Alpha palettes and set the number of colors
@@ -1022,17 +1225,33 @@ static void analyze_image(const char *imageName, image_info &imageInfo, int gray
 
         // Create the RGB and alpha palettes
         for (int idx = 0; idx < num_colors; idx++) {
-            col = colors[idx];
+            col = palette.colorAt(idx);
             rgbPalette[idx].red   = (png_byte) ((col >> 24) & 0xff);
             rgbPalette[idx].green = (png_byte) ((col >> 16) & 0xff);
             rgbPalette[idx].blue  = (png_byte) ((col >>  8) & 0xff);
             alphaPalette[idx]     = (png_byte)  (col        & 0xff);
         }
+
+        // Replace the pixels with their palette indices.  Every color is in
+        // the palette already, so indexOf() only looks them up.
+        for (j = 0; j < h; j++) {
+            png_bytep row = imageInfo.rows[j];
+            png_bytep out = row;
+            uint32_t lastCol = 0;
+            int lastIdx = -1;
+            for (i = 0; i < w; i++, row += 4) {
+                col = (uint32_t) ((row[0] << 24) | (row[1] << 16) | (row[2] << 8) | row[3]);
+                int idx = (col == lastCol && lastIdx >= 0) ? lastIdx : palette.indexOf(col);
+                *out++ = idx;
+                lastCol = col;
+                lastIdx = idx;
+            }
+        }
     } else if (*colorType == PNG_COLOR_TYPE_GRAY || *colorType == PNG_COLOR_TYPE_GRAY_ALPHA) {
-        // If the image is gray or gray + alpha, compact the pixels into outRows
+        // If the image is gray or gray + alpha, compact the pixels
         for (j = 0; j < h; j++) {
             png_bytep row = imageInfo.rows[j];
-            png_bytep out = outRows[j];
+            png_bytep out = row;
             for (i = 0; i < w; i++) {
                 rr = *row++;
                 gg = *row++;
@@ -1053,61 +1272,56 @@ static void analyze_image(const char *imageName, image_info &imageInfo, int gray
 }
 
 
+/*
+ * One of the encodings --optimize-pngs tries, in place of the filters,
+ * compression and rows write_png() would otherwise use.
+ */
+struct png_candidate {
+    int filters;            // PNG_ALL_FILTERS, PNG_NO_FILTERS or one PNG_FILTER_*
+    int strategy;           // a zlib strategy
+    int memLevel;
+    int bitDepth;           // less than 8 to pack palette indices or gray values
+    png_bytepp rows;        // NULL for those of the image
+    int alphaEntries;       // how many palette entries the tRNS chunk gives
+};
+
 static void write_png(const char* imageName,
                       png_structp write_ptr, png_infop write_info,
-                      image_info& imageInfo, int grayscaleTolerance)
+                      image_info& imageInfo, const png_encoding& encoding,
+                      int compressionLevel, const png_candidate* candidate = NULL)
 {
     png_uint_32 width, height;
-    int color_type;
+    int color_type = encoding.colorType;
     int bit_depth, interlace_type, compression_type;
-    int i;
 
     png_unknown_chunk unknowns[3];
     unknowns[0].data = NULL;
     unknowns[1].data = NULL;
     unknowns[2].data = NULL;
 
-    png_bytepp outRows = (png_bytepp) malloc((int) imageInfo.height * sizeof(png_bytep));
-    if (outRows == (png_bytepp) 0) {
-        printf("Can't allocate output buffer!\n");
-        exit(1);
-    }
-    for (i = 0; i < (int) imageInfo.height; i++) {
-        outRows[i] = (png_bytep) malloc(2 * (int) imageInfo.width);
-        if (outRows[i] == (png_bytep) 0) {
-            printf("Can't allocate output buffer!\n");
-            exit(1);
-        }
+    // A level past zlib's best is a CompressionLevel asking for more memory.
+    if (candidate != NULL) {
+        png_set_compression_level(write_ptr, Z_BEST_COMPRESSION);
+        png_set_compression_mem_level(write_ptr, candidate->memLevel);
+        png_set_compression_strategy(write_ptr, candidate->strategy);
+    } else if (compressionLevel > Z_BEST_COMPRESSION) {
+        png_set_compression_level(write_ptr, Z_BEST_COMPRESSION);
+        png_set_compression_mem_level(write_ptr, MAX_MEM_LEVEL);
+    } else {
+        png_set_compression_level(write_ptr, compressionLevel);
     }
 
-    png_set_compression_level(write_ptr, Z_BEST_COMPRESSION);
-
     if (kIsDebug) {
         printf("Writing image %s: w = %d, h = %d\n", imageName,
                 (int) imageInfo.width, (int) imageInfo.height);
     }
 
-    png_color rgbPalette[256];
-    png_byte alphaPalette[256];
-    bool hasTransparency;
-    int paletteEntries;
-
-    analyze_image(imageName, imageInfo, grayscaleTolerance, rgbPalette, alphaPalette,
-                  &paletteEntries, &hasTransparency, &color_type, outRows);
-
-    // If the image is a 9-patch, we need to preserve it as a ARGB file to make
-    // sure the pixels will not be pre-dithered/clamped until we decide they are
-    if (imageInfo.is9Patch && (color_type == PNG_COLOR_TYPE_RGB ||
-            color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_PALETTE)) {
-        color_type = PNG_COLOR_TYPE_RGB_ALPHA;
-    }
-
     if (kIsDebug) {
         switch (color_type) {
         case PNG_COLOR_TYPE_PALETTE:
             printf("Image %s has %d colors%s, using PNG_COLOR_TYPE_PALETTE\n",
-                    imageName, paletteEntries,
-                    hasTransparency ? " (with alpha)" : "");
+                    imageName, encoding.paletteEntries,
+                    encoding.hasTransparency ? " (with alpha)" : "");
             break;
         case PNG_COLOR_TYPE_GRAY:
             printf("Image %s is opaque gray, using PNG_COLOR_TYPE_GRAY\n", imageName);
@@ -1125,18 +1339,24 @@ static void write_png(const char* imageName,
     }
 
     png_set_IHDR(write_ptr, write_info, imageInfo.width, imageInfo.height,
-                 8, color_type, PNG_INTERLACE_NONE,
+                 candidate != NULL ? candidate->bitDepth : 8, color_type, PNG_INTERLACE_NONE,
                  PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
 
     if (color_type == PNG_COLOR_TYPE_PALETTE) {
-        png_set_PLTE(write_ptr, write_info, rgbPalette, paletteEntries);
-        if (hasTransparency) {
-            png_set_tRNS(write_ptr, write_info, alphaPalette, paletteEntries, (png_color_16p) 0);
+        png_set_PLTE(write_ptr, write_info, encoding.rgbPalette, encoding.paletteEntries);
+        const int alphaEntries = candidate != NULL ? candidate->alphaEntries
+                : encoding.hasTransparency ? encoding.paletteEntries : 0;
+        if (alphaEntries > 0) {
+            png_set_tRNS(write_ptr, write_info, encoding.alphaPalette, alphaEntries,
+                         (png_color_16p) 0);
         }
        png_set_filter(write_ptr, 0, PNG_NO_FILTERS);
     } else {
        png_set_filter(write_ptr, 0, PNG_ALL_FILTERS);
     }
+    if (candidate != NULL) {
+        png_set_filter(write_ptr, 0, candidate->filters);
+    }
 
     if (imageInfo.is9Patch) {
         int chunk_count = 2 + (imageInfo.haveLayoutBounds ? 1 : 0);
@@ -1197,14 +1417,17 @@ static void write_png(const char* imageName,
 
     png_write_info(write_ptr, write_info);
 
-    png_bytepp rows;
-    if (color_type == PNG_COLOR_TYPE_RGB || color_type == PNG_COLOR_TYPE_RGB_ALPHA) {
-        if (color_type == PNG_COLOR_TYPE_RGB) {
-            png_set_filler(write_ptr, 0, PNG_FILLER_AFTER);
+    if (color_type == PNG_COLOR_TYPE_RGB) {
+        png_set_filler(write_ptr, 0, PNG_FILLER_AFTER);
+    }
+    png_bytepp rows = imageInfo.rows;
+    if (candidate != NULL) {
+        if (candidate->bitDepth < 8) {
+            png_set_packing(write_ptr);
+        }
+        if (candidate->rows != NULL) {
+            rows = candidate->rows;
         }
-        rows = imageInfo.rows;
-    } else {
-        rows = outRows;
     }
     png_write_image(write_ptr, rows);
 
@@ -1215,10 +1438,6 @@ static void write_png(const char* imageName,
 
     png_write_end(write_ptr, write_info);
 
-    for (i = 0; i < (int) imageInfo.height; i++) {
-        free(outRows[i]);
-    }
-    free(outRows);
     free(unknowns[0].data);
     free(unknowns[1].data);
     free(unknowns[2].data);
@@ -1234,13 +1453,170 @@ static void write_png(const char* imageName,
     }
 }
 
+// The channels of a pixel of a PNG color type; a palette index is one.
+static int png_channels(int colorType)
+{
+    switch (colorType) {
+    case PNG_COLOR_TYPE_GRAY_ALPHA:
+        return 2;
+    case PNG_COLOR_TYPE_RGB:
+        return 3;
+    case PNG_COLOR_TYPE_RGB_ALPHA:
+        return 4;
+    default:
+        return 1;
+    }
+}
+
+/*
+ * The header of a PNG, read straight from its bytes: libpng reports the
+ * header as it is after read_png()'s transformations.
+ */
+struct png_source_header {
+    int bitDepth;
+    int colorType;
+    int interlaceType;
+    int paletteEntries;     // 0 without a PLTE chunk
+};
+
+static const png_byte kPngSignature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+
+static bool read_source_header(const MappedFile& input, png_source_header* outHeader)
+{
+    const png_byte* data = (const png_byte*) input.getData();
+    const size_t size = input.getSize();
+    if (size < 33 || memcmp(data, kPngSignature, sizeof(kPngSignature)) != 0
+            || memcmp(data + 12, "IHDR", 4) != 0) {
+        return false;
+    }
+    outHeader->bitDepth = data[24];
+    outHeader->colorType = data[25];
+    outHeader->interlaceType = data[28];
+    outHeader->paletteEntries = 0;
+
+    // The palette comes before the image data.
+    size_t offset = 8;
+    while (offset + 8 <= size) {
+        const png_byte* chunk = data + offset;
+        const size_t length = ((size_t) chunk[0] << 24) | (chunk[1] << 16)
+                | (chunk[2] << 8) | chunk[3];
+        if (memcmp(chunk + 4, "PLTE", 4) == 0) {
+            outHeader->paletteEntries = length / 3;
+            break;
+        }
+        if (memcmp(chunk + 4, "IDAT", 4) == 0 || length > size - offset - 8) {
+            break;
+        }
+        offset += length + 12;
+    }
+    return true;
+}
+
+size_t estimateImageMemory(const String8& path)
+{
+    // Read with stdio rather than mapped, which would move the Readahead
+    // on as if the image were being crunched.
+    png_byte data[24];
+    FILE* fp = fopen(path.string(), "rb");
+    if (fp == NULL) {
+        return 0;
+    }
+    const bool isPng = fread(data, 1, sizeof(data), fp) == sizeof(data)
+            && memcmp(data, kPngSignature, sizeof(kPngSignature)) == 0
+            && memcmp(data + 12, "IHDR", 4) == 0;
+    fclose(fp);
+    if (!isPng) {
+        return 0;
+    }
+    const uint64_t width = ((uint32_t) data[16] << 24) | (data[17] << 16)
+            | (data[18] << 8) | data[19];
+    const uint64_t height = ((uint32_t) data[20] << 24) | (data[21] << 16)
+            | (data[22] << 8) | data[23];
+
+    // The decoded RGBA rows, and about as much again for the rows of the
+    // output and the encoded image.
+    const uint64_t bytes = width * height * 4 * 2;
+    return bytes < SIZE_MAX ? (size_t) bytes : SIZE_MAX;
+}
+
+static void png_count_bytes(png_structp png_ptr, png_bytep /* data */, png_size_t length)
+{
+    *(size_t*) png_get_io_ptr(png_ptr) += length;
+}
+
+static void png_flush_nothing(png_structp /* png_ptr */)
+{
+}
+
+static bool trial_write_png(const char* imageName, image_info& imageInfo,
+                            const png_encoding& encoding, size_t* outSize)
+{
+    png_structp write_ptr = PngBlockCache::createWriteStruct(NULL, NULL, NULL);
+    if (!write_ptr) {
+        return false;
+    }
+    png_infop write_info = png_create_info_struct(write_ptr);
+    bool written = false;
+    *outSize = 0;
+    if (write_info && !setjmp(png_jmpbuf(write_ptr))) {
+        png_set_write_fn(write_ptr, outSize, png_count_bytes, png_flush_nothing);
+        write_png(imageName, write_ptr, write_info, imageInfo, encoding, Z_DEFAULT_COMPRESSION);
+        written = true;
+    }
+    png_destroy_write_struct(&write_ptr, &write_info);
+    return written;
+}
+
+/*
+ * Whether, for --keep-optimized-pngs, an image is better left as its
+ * source bytes than re-encoded.  The source must already be as narrow as
+ * what analyze_image() chose, so keeping it loses nothing, and no bigger
+ * than a trial encode at zlib's default level, which is much faster than
+ * the real one and rarely more than 1% bigger.  9-patches are always
+ * re-encoded, for their frame and chunks.
+ */
+static bool keep_source_png(const char* imageName, const MappedFile& input,
+                            image_info& imageInfo, const png_encoding& encoding)
+{
+    png_source_header header;
+    if (imageInfo.is9Patch || !read_source_header(input, &header)) {
+        return false;
+    }
+    if (header.bitDepth > 8 || header.interlaceType != PNG_INTERLACE_NONE) {
+        return false;
+    }
+    // A narrower choice means the source has a wasted channel, or a
+    // --grayscale-tolerance that changes its pixels.
+    if (header.bitDepth * png_channels(header.colorType)
+            > 8 * png_channels(encoding.colorType)) {
+        return false;
+    }
+    if (header.colorType == PNG_COLOR_TYPE_PALETTE
+            && encoding.colorType == PNG_COLOR_TYPE_PALETTE
+            && header.paletteEntries > encoding.paletteEntries) {
+        return false;
+    }
+
+    size_t trialSize;
+    if (!trial_write_png(imageName, imageInfo, encoding, &trialSize)) {
+        return false;
+    }
+    if (kIsDebug) {
+        printf("Image %s: %d bytes, trial encode %d bytes\n", imageName,
+                (int) input.getSize(), (int) trialSize);
+    }
+    return input.getSize() <= trialSize;
+}
+
 static bool read_png_protected(png_structp read_ptr, String8& printableName, png_infop read_info,
-                               const sp<AaptFile>& file, FILE* fp, image_info* imageInfo) {
+                               const sp<AaptFile>& file, const MappedFile& input,
+                               image_info* imageInfo) {
+    png_memory_source source;
     if (setjmp(png_jmpbuf(read_ptr))) {
         return false;
     }
 
-    png_init_io(read_ptr, fp);
+    png_set_memory_source(read_ptr, &source, input);
 
     read_png(printableName.string(), read_ptr, read_info, imageInfo);
 
@@ -1258,17 +1634,812 @@ static bool read_png_protected(png_structp read_ptr, String8& printableName, png
 }
 
 static bool write_png_protected(png_structp write_ptr, String8& printableName, png_infop write_info,
-                                image_info* imageInfo, const Bundle* bundle) {
+                                image_info* imageInfo, const png_encoding& encoding,
+                                const Bundle* bundle) {
     if (setjmp(png_jmpbuf(write_ptr))) {
         return false;
     }
 
-    write_png(printableName.string(), write_ptr, write_info, *imageInfo,
-              bundle->getGrayscaleTolerance());
+    write_png(printableName.string(), write_ptr, write_info, *imageInfo, encoding,
+              bundle->getCompressionLevel());
 
     return true;
 }
 
+/*
+ * An image as one --optimize-pngs encoding writes it: the palette, in some
+ * order, and the rows, with the pixels in the order's indices or reduced
+ * to a smaller bit depth.
+ */
+struct png_variant {
+    png_variant() : rows(NULL), bitDepth(8), alphaEntries(0) { }
+    ~png_variant() { free(rows); }
+
+    png_encoding encoding;
+    png_bytepp rows;        // and the pixels after them; NULL for the image's
+    int bitDepth;
+    int alphaEntries;
+
+private:
+    png_variant(const png_variant&);
+    png_variant& operator=(const png_variant&);
+};
+
+// Rows of one byte per pixel, in one malloc()ed block after their pointers.
+static png_bytepp alloc_byte_rows(const image_info& imageInfo)
+{
+    const size_t pointers = imageInfo.height * sizeof(png_bytep);
+    png_bytepp rows = (png_bytepp) malloc(pointers + (size_t) imageInfo.width * imageInfo.height);
+    if (rows != NULL) {
+        png_bytep pixels = (png_bytep) rows + pointers;
+        for (png_uint_32 y = 0; y < imageInfo.height; y++) {
+            rows[y] = pixels + (size_t) y * imageInfo.width;
+        }
+    }
+    return rows;
+}
+
+// The fewest bits a pixel of a palette of "entries" colors can be packed in.
+static int palette_bit_depth(int entries)
+{
+    return entries <= 2 ? 1 : entries <= 4 ? 2 : entries <= 16 ? 4 : 8;
+}
+
+// The fewest bits that hold every value of a gray image exactly.
+static int gray_bit_depth(const image_info& imageInfo)
+{
+    // Values 255 / (2^depth - 1) apart fit in depth bits.
+    bool fits1 = true, fits2 = true;
+    for (png_uint_32 y = 0; y < imageInfo.height; y++) {
+        const png_bytep row = imageInfo.rows[y];
+        for (png_uint_32 x = 0; x < imageInfo.width; x++) {
+            if (row[x] % 17 != 0) {
+                return 8;
+            }
+            fits1 = fits1 && row[x] % 255 == 0;
+            fits2 = fits2 && row[x] % 85 == 0;
+        }
+    }
+    return fits1 ? 1 : fits2 ? 2 : 4;
+}
+
+enum palette_order {
+    PALETTE_TRANSLUCENT_FIRST,      // as analyze_image() found them otherwise
+    PALETTE_BY_FREQUENCY,
+    PALETTE_BY_LUMA
+};
+
+/*
+ * Orders palette entries for an order.  Translucent entries always come
+ * first, so that the tRNS chunk can leave out the opaque ones after them.
+ */
+struct palette_order_less {
+    palette_order order;
+    const png_encoding* encoding;
+    const uint32_t* counts;
+
+    int luma(int i) const {
+        const png_color& c = encoding->rgbPalette[i];
+        return c.red * 77 + c.green * 150 + c.blue * 29;
+    }
+
+    bool operator()(int lhs, int rhs) const {
+        const bool lhsOpaque = encoding->alphaPalette[lhs] == 255;
+        const bool rhsOpaque = encoding->alphaPalette[rhs] == 255;
+        if (lhsOpaque != rhsOpaque) {
+            return rhsOpaque;
+        }
+        if (order == PALETTE_BY_FREQUENCY && counts[lhs] != counts[rhs]) {
+            return counts[lhs] > counts[rhs];
+        }
+        if (order == PALETTE_BY_LUMA && luma(lhs) != luma(rhs)) {
+            return luma(lhs) < luma(rhs);
+        }
+        return lhs < rhs;
+    }
+};
+
+// The image with its palette in "order", its pixels packed in "bitDepth" bits.
+static png_variant* palette_variant(const image_info& imageInfo, const png_encoding& encoding,
+                                    palette_order order, const uint32_t* counts, int bitDepth)
+{
+    png_variant* variant = new png_variant();
+    variant->rows = alloc_byte_rows(imageInfo);
+    if (variant->rows == NULL) {
+        delete variant;
+        return NULL;
+    }
+    variant->bitDepth = bitDepth;
+    variant->encoding = encoding;
+
+    const int entries = encoding.paletteEntries;
+    int sorted[256];
+    for (int i = 0; i < entries; i++) {
+        sorted[i] = i;
+    }
+    palette_order_less less = { order, &encoding, counts };
+    std::sort(sorted, sorted + entries, less);
+
+    png_byte remap[256];
+    for (int i = 0; i < entries; i++) {
+        remap[sorted[i]] = (png_byte) i;
+        variant->encoding.rgbPalette[i] = encoding.rgbPalette[sorted[i]];
+        variant->encoding.alphaPalette[i] = encoding.alphaPalette[sorted[i]];
+        if (encoding.hasTransparency && encoding.alphaPalette[sorted[i]] != 255) {
+            variant->alphaEntries = i + 1;
+        }
+    }
+    for (png_uint_32 y = 0; y < imageInfo.height; y++) {
+        for (png_uint_32 x = 0; x < imageInfo.width; x++) {
+            variant->rows[y][x] = remap[imageInfo.rows[y][x]];
+        }
+    }
+    return variant;
+}
+
+// The gray image with its values scaled down to "bitDepth" bits.
+static png_variant* gray_variant(const image_info& imageInfo, const png_encoding& encoding,
+                                 int bitDepth)
+{
+    png_variant* variant = new png_variant();
+    variant->rows = alloc_byte_rows(imageInfo);
+    if (variant->rows == NULL) {
+        delete variant;
+        return NULL;
+    }
+    variant->bitDepth = bitDepth;
+    variant->encoding = encoding;
+    const int step = 255 / ((1 << bitDepth) - 1);
+    for (png_uint_32 y = 0; y < imageInfo.height; y++) {
+        for (png_uint_32 x = 0; x < imageInfo.width; x++) {
+            variant->rows[y][x] = imageInfo.rows[y][x] / step;
+        }
+    }
+    return variant;
+}
+
+/*
+ * The variants of an image --optimize-pngs tries, after the image as
+ * analyze_image() left it: for a palette, each order at 8 bits and, if
+ * fewer fit, packed; for gray, its values packed if they fit fewer bits.
+ */
+static void collect_png_variants(const image_info& imageInfo, const png_encoding& encoding,
+                                 Vector<png_variant*>* outVariants)
+{
+    if (encoding.colorType == PNG_COLOR_TYPE_PALETTE) {
+        uint32_t counts[256];
+        memset(counts, 0, sizeof(counts));
+        for (png_uint_32 y = 0; y < imageInfo.height; y++) {
+            for (png_uint_32 x = 0; x < imageInfo.width; x++) {
+                counts[imageInfo.rows[y][x]]++;
+            }
+        }
+        const palette_order orders[] = {
+            PALETTE_TRANSLUCENT_FIRST, PALETTE_BY_FREQUENCY, PALETTE_BY_LUMA
+        };
+        const int packedDepth = palette_bit_depth(encoding.paletteEntries);
+        for (int i = 0; i < NELEM(orders); i++) {
+            png_variant* variant = palette_variant(imageInfo, encoding, orders[i], counts, 8);
+            if (variant != NULL) {
+                outVariants->add(variant);
+            }
+            if (packedDepth < 8) {
+                variant = palette_variant(imageInfo, encoding, orders[i], counts, packedDepth);
+                if (variant != NULL) {
+                    outVariants->add(variant);
+                }
+            }
+        }
+    } else if (encoding.colorType == PNG_COLOR_TYPE_GRAY) {
+        const int bitDepth = gray_bit_depth(imageInfo);
+        if (bitDepth < 8) {
+            png_variant* variant = gray_variant(imageInfo, encoding, bitDepth);
+            if (variant != NULL) {
+                outVariants->add(variant);
+            }
+        }
+    }
+}
+
+/*
+ * The smallest encoding of an image found so far by --optimize-pngs.  A
+ * tie goes to the encoding tried first, so that the result doesn't depend
+ * on which thread finished first.
+ */
+struct png_best {
+    png_best() : index(SIZE_MAX) { }
+
+    void offer(size_t candidateIndex, const sp<AaptFile>& candidateFile) {
+        AutoMutex _l(lock);
+        if (file == NULL || candidateFile->getSize() < file->getSize()
+                || (candidateFile->getSize() == file->getSize() && candidateIndex < index)) {
+            index = candidateIndex;
+            file = candidateFile;
+        }
+    }
+
+    Mutex lock;
+    size_t index;
+    sp<AaptFile> file;
+};
+
+/*
+ * Encodes the image one way into memory and offers the result.  A NULL
+ * candidate is the encoding write_png() would choose by itself.
+ */
+class PngCandidateWorkUnit : public WorkQueue::WorkUnit {
+public:
+    PngCandidateWorkUnit(const char* imageName, image_info* imageInfo,
+            const png_encoding* encoding, int compressionLevel,
+            const png_candidate& candidate, bool useCandidate, size_t index, png_best* best)
+        : mImageName(imageName), mImageInfo(imageInfo), mEncoding(encoding),
+          mCompressionLevel(compressionLevel), mCandidate(candidate),
+          mUseCandidate(useCandidate), mIndex(index), mBest(best) { }
+
+    virtual bool run() {
+        png_structp write_ptr = PngBlockCache::createWriteStruct(NULL, NULL, NULL);
+        if (!write_ptr) {
+            return true;
+        }
+        png_infop write_info = png_create_info_struct(write_ptr);
+        sp<AaptFile> out = new AaptFile(String8(), AaptGroupEntry(), String8());
+        bool written = false;
+        if (write_info && !setjmp(png_jmpbuf(write_ptr))) {
+            png_set_write_fn(write_ptr, (void*) out.get(), png_write_aapt_file,
+                             png_flush_aapt_file);
+            write_png(mImageName, write_ptr, write_info, *mImageInfo, *mEncoding,
+                      mCompressionLevel, mUseCandidate ? &mCandidate : NULL);
+            written = true;
+        }
+        png_destroy_write_struct(&write_ptr, &write_info);
+        if (written) {
+            mBest->offer(mIndex, out);
+        }
+        return true;
+    }
+
+private:
+    const char* mImageName;
+    image_info* mImageInfo;
+    const png_encoding* mEncoding;
+    int mCompressionLevel;
+    png_candidate mCandidate;
+    bool mUseCandidate;
+    size_t mIndex;
+    png_best* mBest;
+};
+
+/*
+ * The threads --optimize-pngs encodes on.  They are apart from those of
+ * the shared queue, whose units crunching the images wait for the
+ * encodings: were those on the same threads, every thread could end up
+ * waiting, with none left to encode.
+ */
+class PngCandidateQueue {
+public:
+    static WorkQueue* get(const Bundle* bundle) {
+        AutoMutex _l(sLock);
+        if (sQueue == NULL) {
+            sQueue = new WorkQueue(bundle->getJobs(), false);
+        }
+        return sQueue;
+    }
+
+private:
+    static Mutex sLock;
+    static WorkQueue* sQueue;
+};
+
+Mutex PngCandidateQueue::sLock;
+WorkQueue* PngCandidateQueue::sQueue = NULL;
+
+/*
+ * For --optimize-pngs: encodes the image, as analyze_image() left it, each
+ * way that might make it smaller, on several threads, and puts the
+ * smallest in *outFile.  Besides the usual encoding, each variant of the
+ * palette order and bit depth is tried with each filter choice, zlib
+ * strategy and memory level, at zlib's best compression.  Returns how
+ * many encodings were tried, or 0 if none could be written.
+ */
+static size_t optimize_png(const Bundle* bundle, const char* imageName, image_info& imageInfo,
+                           const png_encoding& encoding, sp<AaptFile>* outFile)
+{
+    Vector<png_variant*> variants;
+    collect_png_variants(imageInfo, encoding, &variants);
+
+    static const int kAllFilters[] = {
+        PNG_ALL_FILTERS, PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVG,
+        PNG_FILTER_PAETH
+    };
+    static const int kPackedFilters[] = { PNG_NO_FILTERS, PNG_ALL_FILTERS };
+    static const int kStrategies[] = { Z_DEFAULT_STRATEGY, Z_FILTERED, Z_RLE };
+    static const int kMemLevels[] = { 8, MAX_MEM_LEVEL };
+
+    png_best best;
+    WorkQueue::Group group(PngCandidateQueue::get(bundle));
+    size_t count = 0;
+    png_candidate candidate;
+    memset(&candidate, 0, sizeof(candidate));
+    // The usual encoding, the NULL candidate, then the image as it is
+    // with each setting, then each variant.
+    for (ssize_t v = -2; v < (ssize_t) variants.size(); v++) {
+        const png_variant* variant = v >= 0 ? variants[v] : NULL;
+        const png_encoding& variantEncoding = variant != NULL ? variant->encoding : encoding;
+        candidate.rows = variant != NULL ? variant->rows : NULL;
+        candidate.bitDepth = variant != NULL ? variant->bitDepth : 8;
+        candidate.alphaEntries = variant != NULL ? variant->alphaEntries
+                : encoding.hasTransparency ? encoding.paletteEntries : 0;
+        const bool packed = encoding.colorType == PNG_COLOR_TYPE_PALETTE
+                || candidate.bitDepth < 8;
+        const int* filters = packed ? kPackedFilters : kAllFilters;
+        const int filterCount = packed ? NELEM(kPackedFilters) : NELEM(kAllFilters);
+        for (int f = 0; f < filterCount && (v != -2 || f == 0); f++) {
+            for (int s = 0; s < NELEM(kStrategies) && (v != -2 || s == 0); s++) {
+                for (int m = 0; m < NELEM(kMemLevels) && (v != -2 || m == 0); m++) {
+                    candidate.filters = filters[f];
+                    candidate.strategy = kStrategies[s];
+                    candidate.memLevel = kMemLevels[m];
+                    PngCandidateWorkUnit* w = new PngCandidateWorkUnit(imageName, &imageInfo,
+                            &variantEncoding, bundle->getCompressionLevel(), candidate, v != -2,
+                            count++, &best);
+                    if (group.schedule(w) != NO_ERROR) {
+                        w->run();
+                        delete w;
+                    }
+                }
+            }
+        }
+    }
+    group.wait();
+
+    for (size_t i = 0; i < variants.size(); i++) {
+        delete variants[i];
+    }
+    if (best.file == NULL) {
+        return 0;
+    }
+    *outFile = best.file;
+    return count;
+}
+
+// WebP images can be at most this many pixels wide and high.
+static const png_uint_32 kMaxWebpDimension = 16383;
+
+/*
+ * Whether --webp applies to an image.  9-patches stay PNGs, since their
+ * patch data lives in PNG chunks, and devices before API 18 cannot decode
+ * lossless or translucent WebP images.
+ */
+static bool wants_webp(const Bundle* bundle, const image_info& imageInfo)
+{
+    return bundle->getWebpImages() && !imageInfo.is9Patch
+            && bundle->isMinSdkAtLeast(SDK_JELLY_BEAN_MR2);
+}
+
+/*
+ * Encodes the image as WebP at the given quality, or losslessly if it is
+ * negative.  Returns the size of the malloc()ed image put in *outData, or
+ * 0 if the image could not be encoded.
+ */
+static size_t encode_webp(const image_info& imageInfo, int quality, uint8_t** outData)
+{
+#ifdef AAPT_HAVE_WEBP
+    if (imageInfo.width > kMaxWebpDimension || imageInfo.height > kMaxWebpDimension) {
+        return 0;
+    }
+    const int stride = imageInfo.height > 1 ? (int)(imageInfo.rows[1] - imageInfo.rows[0])
+            : (int)(imageInfo.width * 4);
+    if (quality < 0) {
+        return WebPEncodeLosslessRGBA(imageInfo.rows[0], imageInfo.width, imageInfo.height,
+                stride, outData);
+    }
+    return WebPEncodeRGBA(imageInfo.rows[0], imageInfo.width, imageInfo.height, stride,
+            (float)quality, outData);
+#else
+    (void)imageInfo;
+    (void)quality;
+    (void)outData;
+    return 0;
+#endif
+}
+
+// Whether the data is a WebP image, such as one "crunch" stored.
+static bool is_webp(const void* data, size_t size)
+{
+    return size >= 12 && memcmp(data, "RIFF", 4) == 0
+            && memcmp((const char*)data + 8, "WEBP", 4) == 0;
+}
+
+/*
+ * Replaces the "pngSize" byte image written to "dest" with its WebP
+ * encoding if --webp applies and that is smaller.  BitmapFactory tells the
+ * formats apart by their contents, so the file keeps its name.
+ */
+static status_t store_webp_file(const Bundle* bundle, const image_info& imageInfo,
+                                const String8& dest, size_t pngSize)
+{
+    if (!wants_webp(bundle, imageInfo)) {
+        return NO_ERROR;
+    }
+
+    uint8_t* webpData = NULL;
+    size_t webpSize = encode_webp(imageInfo, bundle->getWebpQuality(), &webpData);
+    status_t error = NO_ERROR;
+    if (webpSize > 0 && webpSize < pngSize) {
+        FILE* fp = fopen(dest.string(), "wb");
+        bool written = fp != NULL && fwrite(webpData, 1, webpSize, fp) == webpSize;
+        if (fp == NULL || fclose(fp) != 0 || !written) {
+            fprintf(stderr, "%s ERROR: Unable to write WebP file\n", dest.string());
+            error = UNKNOWN_ERROR;
+        } else if (bundle->getVerbose()) {
+            printf("  (stored cache entry %s as WebP: %d%% size of PNG)\n", dest.string(),
+                   (int)(webpSize * 100 / pngSize));
+        }
+    }
+    free(webpData);
+    return error;
+}
+
+// Whether "text" matches "pattern", where '*' matches any characters; case is ignored.
+static bool glob_matches(const char* pattern, size_t patternLength, const char* text)
+{
+    size_t p = 0;
+    const char* star = NULL;
+    size_t starPattern = 0;
+    while (*text != '\0') {
+        if (p < patternLength && pattern[p] == '*') {
+            star = text;
+            starPattern = ++p;
+        } else if (p < patternLength && tolower((unsigned char) pattern[p])
+                == tolower((unsigned char) *text)) {
+            p++;
+            text++;
+        } else if (star != NULL) {
+            text = ++star;
+            p = starPattern;
+        } else {
+            return false;
+        }
+    }
+    while (p < patternLength && pattern[p] == '*') {
+        p++;
+    }
+    return p == patternLength;
+}
+
+/*
+ * The --quantize-pngs quality for the image at "sourcePath", or -1 if it
+ * is to stay lossless: a 9-patch, or one whose directory and file name
+ * match none of the --quantize-pattern patterns.
+ */
+static int quantize_quality(const Bundle* bundle, const String8& sourcePath)
+{
+    if (bundle->getQuantizeQuality() < 0
+            || sourcePath.getBasePath().getPathExtension() == ".9") {
+        return -1;
+    }
+    const char* patterns = bundle->getQuantizePattern();
+    if (patterns == NULL || patterns[0] == '\0') {
+        return bundle->getQuantizeQuality();
+    }
+    String8 name(sourcePath.getPathDir().getPathLeaf());
+    name.appendPath(sourcePath.getPathLeaf());
+    for (const char* p = patterns; *p != '\0'; ) {
+        const char* end = strchr(p, ':');
+        const size_t length = end != NULL ? (size_t) (end - p) : strlen(p);
+        if (length > 0 && glob_matches(p, length, name.string())) {
+            return bundle->getQuantizeQuality();
+        }
+        p += length;
+        if (*p == ':') {
+            p++;
+        }
+    }
+    return -1;
+}
+
+// Reduces imageInfo to a palette for --quantize-pngs, if it is good enough.
+static void quantize_image(const Bundle* bundle, const char* imageName, image_info& imageInfo,
+                           int quality)
+{
+    double mse;
+    const bool quantized = quantizeRgbaImage(imageInfo.rows, imageInfo.width, imageInfo.height,
+                                             256, quantizeQualityToMse(quality), &mse);
+    if (bundle->getVerbose()) {
+        if (quantized) {
+            printf("    (quantized image %s to 256 colors, mean squared error %.2f)\n",
+                   imageName, mse);
+        } else if (mse > 0) {
+            printf("    (kept image %s lossless, since quantizing it would leave a mean "
+                   "squared error of %.2f)\n", imageName, mse);
+        }
+    }
+}
+
+// Adds the options that change how an image is encoded to "key".
+static void add_image_options(const Bundle* bundle, CompileCache::Key* key)
+{
+    key->add((int32_t)bundle->getGrayscaleTolerance());
+    key->add((int32_t)bundle->getCompressionLevel());
+    key->add((int32_t)bundle->getKeepOptimizedPngs());
+    key->add((int32_t)(bundle->getWebpImages()
+            && bundle->isMinSdkAtLeast(SDK_JELLY_BEAN_MR2)));
+    key->add((int32_t)bundle->getWebpQuality());
+    key->add((int32_t)bundle->getOptimizePngs());
+}
+
+/*
+ * The digest preProcessImage() keeps the output for "input" under.  The
+ * output only depends on the source bytes, whether it is a 9-patch, the
+ * grayscale tolerance, the compression level, whether optimized images
+ * are kept, whether encodings are searched, the quality it is quantized
+ * to and the WebP settings, so it can be reused by any later build with
+ * the same inputs.
+ */
+static String8 image_cache_digest(const Bundle* bundle, const sp<AaptFile>& file,
+                                  const MappedFile& input)
+{
+    CompileCache::Key key("png-v2");
+#ifdef AAPT_VERSION
+    key.add(AAPT_VERSION);
+#endif
+    add_image_options(bundle, &key);
+    key.add((int32_t)(file->getPath().getBasePath().getPathExtension() == ".9"));
+    key.add((int32_t)quantize_quality(bundle, file->getSourceFile()));
+    key.add(input.getData(), input.getSize());
+    return key.digest();
+}
+
+status_t imageCacheDigest(const Bundle* bundle, const sp<AaptFile>& file, String8* outDigest)
+{
+    outDigest->setTo("");
+    if (strcmp(file->getPath().getPathExtension().string(), ".png") != 0) {
+        return NO_ERROR;
+    }
+    MappedFile input;
+    status_t err = input.open(file->getSourceFile().string());
+    if (err != NO_ERROR) {
+        return err;
+    }
+    if (!is_webp(input.getData(), input.getSize())) {
+        *outDigest = image_cache_digest(bundle, file, input);
+    }
+    return NO_ERROR;
+}
+
+/*
+ * The digest of everything the encoded image is made from: the options,
+ * the quality it is quantized to, the decoded pixels and, for a 9-patch,
+ * the chunks derived from its frame.
+ */
+static String8 decoded_image_digest(const Bundle* bundle, const image_info& imageInfo,
+                                    int quantizeQuality)
+{
+    CompileCache::Key key("decoded-image");
+    add_image_options(bundle, &key);
+    key.add((int32_t)quantizeQuality);
+    key.add((int32_t)imageInfo.width);
+    key.add((int32_t)imageInfo.height);
+    for (png_uint_32 y = 0; y < imageInfo.height; y++) {
+        key.add(imageInfo.rows[y], imageInfo.width * 4);
+    }
+    key.add((int32_t)imageInfo.is9Patch);
+    if (imageInfo.is9Patch) {
+        image_info& info = const_cast<image_info&>(imageInfo);
+        void* patch = info.serialize9patch();
+        key.add(patch, imageInfo.info9Patch.serializedSize());
+        free(patch);
+        key.add((int32_t)imageInfo.haveLayoutBounds);
+        key.add(&imageInfo.layoutBoundsLeft, 4 * sizeof(int32_t));
+        key.add(&imageInfo.outlineInsetsLeft, 4 * sizeof(int32_t));
+        key.add(&imageInfo.outlineRadius, sizeof(imageInfo.outlineRadius));
+        key.add((int32_t)imageInfo.outlineAlpha);
+    }
+    return key.digest();
+}
+
+/*
+ * A 64-bit "average hash" of the image: a bit per cell of an 8x8 grid,
+ * set if the cell is brighter than the image as a whole.  Images that
+ * look alike have hashes that differ in few bits, whatever their size.
+ */
+static uint64_t similarity_hash(const image_info& imageInfo)
+{
+    uint64_t sums[64];
+    uint32_t counts[64];
+    memset(sums, 0, sizeof(sums));
+    memset(counts, 0, sizeof(counts));
+    for (png_uint_32 y = 0; y < imageInfo.height; y++) {
+        const png_bytep row = imageInfo.rows[y];
+        const int cellY = y * 8 / imageInfo.height;
+        for (png_uint_32 x = 0; x < imageInfo.width; x++) {
+            const png_bytep p = row + x * 4;
+            // Luma of the pixel composited over black.
+            const uint32_t luma = (p[0] * 77 + p[1] * 150 + p[2] * 29) * p[3] / (255 * 256);
+            const int cell = cellY * 8 + x * 8 / imageInfo.width;
+            sums[cell] += luma;
+            counts[cell]++;
+        }
+    }
+
+    uint64_t total = 0;
+    uint32_t cells = 0;
+    for (int i = 0; i < 64; i++) {
+        if (counts[i] > 0) {
+            sums[i] /= counts[i];
+            total += sums[i];
+            cells++;
+        }
+    }
+    const uint64_t mean = cells > 0 ? total / cells : 0;
+    uint64_t hash = 0;
+    for (int i = 0; i < 64; i++) {
+        if (counts[i] > 0 && sums[i] > mean) {
+            hash |= (uint64_t)1 << i;
+        }
+    }
+    return hash;
+}
+
+/*
+ * The images preprocessed so far, by decoded_image_digest().  An image
+ * that is pixel for pixel the same as an earlier one, such as a density's
+ * copy exported again with other metadata, gets the earlier one's output
+ * rather than being encoded again, so dedupeFileResources() can store it
+ * once.  With --similar-images-report each image's similarity_hash() is
+ * kept too.
+ */
+class DecodedImageIndex {
+public:
+    /*
+     * Replaces the contents of "file" with the output of an earlier image
+     * with this digest, returning its name, or NULL if there is none.
+     */
+    static const char* copyOutput(const String8& digest, const sp<AaptFile>& file);
+
+    // Records the output of an image.
+    static void add(const String8& digest, const sp<AaptFile>& file, const String8& name,
+                    const image_info& imageInfo, bool wantSimilarityHash);
+
+    // Writes the same and similar images to "fp".
+    static void writeReport(FILE* fp);
+
+private:
+    struct Image {
+        String8 name;
+        String8 digest;
+        png_uint_32 width;
+        png_uint_32 height;
+        uint64_t similarityHash;
+    };
+
+    struct Output {
+        sp<AaptFile> file;
+        String8 name;
+    };
+
+    static int compareImages(const Image* a, const Image* b);
+
+    static Mutex sLock;
+    static KeyedVector<String8, Output> sOutputs;
+    static Vector<Image> sImages;
+};
+
+Mutex DecodedImageIndex::sLock;
+KeyedVector<String8, DecodedImageIndex::Output> DecodedImageIndex::sOutputs;
+Vector<DecodedImageIndex::Image> DecodedImageIndex::sImages;
+
+const char* DecodedImageIndex::copyOutput(const String8& digest, const sp<AaptFile>& file)
+{
+    AutoMutex _l(sLock);
+    ssize_t index = sOutputs.indexOfKey(digest);
+    if (index < 0) {
+        return NULL;
+    }
+    const Output& output = sOutputs.valueAt(index);
+    file->clearData();
+    if (file->writeData(output.file->getData(), output.file->getSize()) != NO_ERROR) {
+        return NULL;
+    }
+    return output.name.string();
+}
+
+void DecodedImageIndex::add(const String8& digest, const sp<AaptFile>& file,
+                            const String8& name, const image_info& imageInfo,
+                            bool wantSimilarityHash)
+{
+    Image image;
+    if (wantSimilarityHash) {
+        image.name = name;
+        image.digest = digest;
+        image.width = imageInfo.width;
+        image.height = imageInfo.height;
+        image.similarityHash = similarity_hash(imageInfo);
+    }
+
+    AutoMutex _l(sLock);
+    if (sOutputs.indexOfKey(digest) < 0) {
+        Output output;
+        output.file = file;
+        output.name = name;
+        sOutputs.add(digest, output);
+    }
+    if (wantSimilarityHash) {
+        sImages.add(image);
+    }
+}
+
+// Images whose similarity hashes differ in at most this many bits are similar.
+static const int kMaxSimilarBits = 3;
+
+static int bits_set(uint64_t value)
+{
+    int count = 0;
+    for (; value != 0; value &= value - 1) {
+        count++;
+    }
+    return count;
+}
+
+// Orders images by size, then by name, so the report is in a stable order.
+int DecodedImageIndex::compareImages(const Image* a, const Image* b)
+{
+    if (a->width != b->width) {
+        return a->width < b->width ? -1 : 1;
+    }
+    if (a->height != b->height) {
+        return a->height < b->height ? -1 : 1;
+    }
+    return strcmp(a->name.string(), b->name.string());
+}
+
+void DecodedImageIndex::writeReport(FILE* fp)
+{
+    AutoMutex _l(sLock);
+    sImages.sort(compareImages);
+
+    // Only images of the same size are compared.
+    const size_t N = sImages.size();
+    size_t start = 0;
+    while (start < N) {
+        size_t end = start + 1;
+        while (end < N && sImages[end].width == sImages[start].width
+                && sImages[end].height == sImages[start].height) {
+            end++;
+        }
+        for (size_t i = start; i < end; i++) {
+            for (size_t j = i + 1; j < end; j++) {
+                const Image& a = sImages[i];
+                const Image& b = sImages[j];
+                if (a.digest == b.digest) {
+                    fprintf(fp, "same %s %s\n", a.name.string(), b.name.string());
+                    continue;
+                }
+                const int bits = bits_set(a.similarityHash ^ b.similarityHash);
+                if (bits <= kMaxSimilarBits) {
+                    fprintf(fp, "similar %s %s %d\n", a.name.string(), b.name.string(), bits);
+                }
+            }
+        }
+        start = end;
+    }
+}
+
+status_t writeSimilarImagesReport(const char* path)
+{
+    FILE* fp = fopen(path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: Unable to open similar images report %s\n", path);
+        return UNKNOWN_ERROR;
+    }
+    DecodedImageIndex::writeReport(fp);
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "ERROR: Unable to write similar images report %s\n", path);
+        return UNKNOWN_ERROR;
+    }
+    return NO_ERROR;
+}
+
 status_t preProcessImage(const Bundle* bundle, const sp<AaptAssets>& /* assets */,
                          const sp<AaptFile>& file, String8* /* outNewLeafName */)
 {
@@ -1284,30 +2455,60 @@ status_t preProcessImage(const Bundle* bundle, const sp<AaptAssets>& /* assets *
     //outNewLeafName->append(".nupng");
 
     String8 printableName(file->getPrintableSource());
+    PhaseSpan span("preProcessImage", printableName);
+    FileCostSpan cost(FileCosts::CRUNCH, printableName);
+    cost.setOutputFile(file.get());
 
     if (bundle->getVerbose()) {
         printf("Processing image: %s\n", printableName.string());
     }
 
+    MappedFile input;
+    if (input.open(file->getSourceFile().string()) != NO_ERROR) {
+        fprintf(stderr, "%s: ERROR: Unable to open PNG file\n", printableName.string());
+        fprintf(stderr, "ERROR: Failure processing PNG image %s\n",
+                file->getPrintableSource().string());
+        return UNKNOWN_ERROR;
+    }
+    span.setBytes(input.getSize());
+    cost.setInputBytes(input.getSize());
+
+    // An image "crunch" already stored as WebP is used as it is.
+    if (is_webp(input.getData(), input.getSize())) {
+        return file->writeData(input.getData(), input.getSize());
+    }
+
+    String8 cacheDigest;
+    if (bundle->getResourceCacheDir() != NULL) {
+        cacheDigest = image_cache_digest(bundle, file, input);
+        CompileCache cache(bundle->getResourceCacheDir());
+        if (cache.get(cacheDigest, file)) {
+            Statistics::add(Statistics::COMPILE_CACHE_HITS);
+            if (bundle->getVerbose()) {
+                printf("    (reused cached image %s)\n", printableName.string());
+            }
+            return NO_ERROR;
+        }
+        Statistics::add(Statistics::COMPILE_CACHE_MISSES);
+    }
+
     png_structp read_ptr = NULL;
     png_infop read_info = NULL;
-    FILE* fp;
 
     image_info imageInfo;
+    png_encoding encoding;
 
     png_structp write_ptr = NULL;
     png_infop write_info = NULL;
 
-    status_t error = UNKNOWN_ERROR;
+    String8 decodedDigest;
+    const char* sameImageName;
+    const bool wantSimilarityHash = bundle->getSimilarImagesReport() != NULL;
+    const int quantizeQuality = quantize_quality(bundle, file->getSourceFile());
 
-    fp = fopen(file->getSourceFile().string(), "rb");
-    if (fp == NULL) {
-        fprintf(stderr, "%s: ERROR: Unable to open PNG file\n", printableName.string());
-        goto bail;
-    }
+    status_t error = UNKNOWN_ERROR;
 
-    read_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, 0, (png_error_ptr)NULL,
-                                        (png_error_ptr)NULL);
+    read_ptr = PngBlockCache::createReadStruct(NULL, NULL, NULL);
     if (!read_ptr) {
         goto bail;
     }
@@ -1317,12 +2518,57 @@ status_t preProcessImage(const Bundle* bundle, const sp<AaptAssets>& /* assets *
         goto bail;
     }
 
-    if (!read_png_protected(read_ptr, printableName, read_info, file, fp, &imageInfo)) {
+    if (!read_png_protected(read_ptr, printableName, read_info, file, input, &imageInfo)) {
         goto bail;
     }
 
-    write_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, 0, (png_error_ptr)NULL,
-                                        (png_error_ptr)NULL);
+    decodedDigest = decoded_image_digest(bundle, imageInfo, quantizeQuality);
+    sameImageName = DecodedImageIndex::copyOutput(decodedDigest, file);
+    if (sameImageName != NULL) {
+        if (bundle->getVerbose()) {
+            printf("    (reused output of %s, which has the same pixels)\n", sameImageName);
+        }
+        DecodedImageIndex::add(decodedDigest, file, printableName, imageInfo,
+                               wantSimilarityHash);
+        error = NO_ERROR;
+        goto cache;
+    }
+
+    if (quantizeQuality >= 0) {
+        quantize_image(bundle, printableName.string(), imageInfo, quantizeQuality);
+    }
+    analyze_image(printableName.string(), imageInfo, bundle->getGrayscaleTolerance(), &encoding);
+
+    if (bundle->getKeepOptimizedPngs()
+            && keep_source_png(printableName.string(), input, imageInfo, encoding)) {
+        if (file->writeData(input.getData(), input.getSize()) != NO_ERROR) {
+            goto bail;
+        }
+        if (bundle->getVerbose()) {
+            printf("    (kept already optimized image %s)\n", printableName.string());
+        }
+        error = NO_ERROR;
+        goto webp;
+    }
+
+    if (bundle->getOptimizePngs()) {
+        sp<AaptFile> optimized;
+        const size_t tried = optimize_png(bundle, printableName.string(), imageInfo, encoding,
+                                          &optimized);
+        if (tried == 0 || file->writeData(optimized->getData(), optimized->getSize())
+                != NO_ERROR) {
+            goto bail;
+        }
+        if (bundle->getVerbose()) {
+            printf("    (optimized image %s: %d%% size of source, smallest of %d encodings)\n",
+                   printableName.string(), (int) (file->getSize() * 100 / input.getSize()),
+                   (int) tried);
+        }
+        error = NO_ERROR;
+        goto webp;
+    }
+
+    write_ptr = PngBlockCache::createWriteStruct(NULL, NULL, NULL);
     if (!write_ptr)
     {
         goto bail;
@@ -1337,28 +2583,54 @@ status_t preProcessImage(const Bundle* bundle, const sp<AaptAssets>& /* assets *
     png_set_write_fn(write_ptr, (void*)file.get(),
                      png_write_aapt_file, png_flush_aapt_file);
 
-    if (!write_png_protected(write_ptr, printableName, write_info, &imageInfo, bundle)) {
+    if (!write_png_protected(write_ptr, printableName, write_info, &imageInfo, encoding,
+                             bundle)) {
         goto bail;
     }
 
     error = NO_ERROR;
 
     if (bundle->getVerbose()) {
-        fseek(fp, 0, SEEK_END);
-        size_t oldSize = (size_t)ftell(fp);
+        size_t oldSize = input.getSize();
         size_t newSize = file->getSize();
         float factor = ((float)newSize)/oldSize;
         int percent = (int)(factor*100);
         printf("    (processed image %s: %d%% size of source)\n", printableName.string(), percent);
     }
 
+webp:
+    if (wants_webp(bundle, imageInfo)) {
+        uint8_t* webpData = NULL;
+        size_t webpSize = encode_webp(imageInfo, bundle->getWebpQuality(), &webpData);
+        if (webpSize > 0 && webpSize < file->getSize()) {
+            if (bundle->getVerbose()) {
+                printf("    (stored image %s as WebP: %d%% size of PNG)\n", printableName.string(),
+                       (int)(webpSize * 100 / file->getSize()));
+            }
+            file->clearData();
+            error = file->writeData(webpData, webpSize);
+        }
+        free(webpData);
+        if (error != NO_ERROR) {
+            goto bail;
+        }
+    }
+
+    DecodedImageIndex::add(decodedDigest, file, printableName, imageInfo, wantSimilarityHash);
+
+cache:
+    if (cacheDigest.length() > 0) {
+        CompileCache cache(bundle->getResourceCacheDir());
+        if (cache.put(cacheDigest, file->getData(), file->getSize()) != NO_ERROR
+                && bundle->getVerbose()) {
+            printf("    (unable to cache image %s)\n", printableName.string());
+        }
+    }
+
 bail:
     if (read_ptr) {
         png_destroy_read_struct(&read_ptr, &read_info, (png_infopp)NULL);
     }
-    if (fp) {
-        fclose(fp);
-    }
     if (write_ptr) {
         png_destroy_write_struct(&write_ptr, &write_info);
     }
@@ -1375,7 +2647,8 @@ status_t preProcessImageToCache(const Bundle* bundle, const String8& source, con
     png_structp read_ptr = NULL;
     png_infop read_info = NULL;
 
-    FILE* fp;
+    MappedFile input;
+    png_memory_source memorySource;
 
     image_info imageInfo;
 
@@ -1388,17 +2661,15 @@ status_t preProcessImageToCache(const Bundle* bundle, const String8& source, con
         printf("Processing image to cache: %s => %s\n", source.string(), dest.string());
     }
 
-    // Get a file handler to read from
-    fp = fopen(source.string(),"rb");
-    if (fp == NULL) {
+    // Map the file to read from
+    if (input.open(source.string()) != NO_ERROR) {
         fprintf(stderr, "%s ERROR: Unable to open PNG file\n", source.string());
         return error;
     }
 
     // Call libpng to get a struct to read image data into
-    read_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    read_ptr = PngBlockCache::createReadStruct(NULL, NULL, NULL);
     if (!read_ptr) {
-        fclose(fp);
         png_destroy_read_struct(&read_ptr, &read_info,NULL);
         return error;
     }
@@ -1406,29 +2677,24 @@ status_t preProcessImageToCache(const Bundle* bundle, const String8& source, con
     // Call libpng to get a struct to read image info into
     read_info = png_create_info_struct(read_ptr);
     if (!read_info) {
-        fclose(fp);
         png_destroy_read_struct(&read_ptr, &read_info,NULL);
         return error;
     }
 
     // Set a jump point for libpng to long jump back to on error
     if (setjmp(png_jmpbuf(read_ptr))) {
-        fclose(fp);
         png_destroy_read_struct(&read_ptr, &read_info,NULL);
         return error;
     }
 
-    // Set up libpng to read from our file.
-    png_init_io(read_ptr,fp);
+    // Set up libpng to read from the mapped file.
+    png_set_memory_source(read_ptr, &memorySource, input);
 
     // Actually read data from the file
     read_png(source.string(), read_ptr, read_info, &imageInfo);
 
     // We're done reading so we can clean up
-    // Find old file size before releasing handle
-    fseek(fp, 0, SEEK_END);
-    size_t oldSize = (size_t)ftell(fp);
-    fclose(fp);
+    size_t oldSize = input.getSize();
     png_destroy_read_struct(&read_ptr, &read_info,NULL);
 
     // Check to see if we're dealing with a 9-patch
@@ -1439,9 +2705,59 @@ status_t preProcessImageToCache(const Bundle* bundle, const String8& source, con
         }
     }
 
+    const int quantizeQuality = quantize_quality(bundle, source);
+    if (quantizeQuality >= 0) {
+        quantize_image(bundle, source.string(), imageInfo, quantizeQuality);
+    }
+
+    png_encoding encoding;
+    analyze_image(source.string(), imageInfo, bundle->getGrayscaleTolerance(), &encoding);
+
+    // An already optimized image is copied as it is
+    if (bundle->getKeepOptimizedPngs()
+            && keep_source_png(source.string(), input, imageInfo, encoding)) {
+        FILE* fp = fopen(dest.string(), "wb");
+        if (!fp) {
+            fprintf(stderr, "%s ERROR: Unable to open PNG file\n", dest.string());
+            return error;
+        }
+        bool written = fwrite(input.getData(), 1, oldSize, fp) == oldSize;
+        if (fclose(fp) != 0 || !written) {
+            fprintf(stderr, "%s ERROR: Unable to write PNG file\n", dest.string());
+            return error;
+        }
+        if (bundle->getVerbose()) {
+            printf("  (kept already optimized image as cache entry %s)\n", dest.string());
+        }
+        return store_webp_file(bundle, imageInfo, dest, oldSize);
+    }
+
+    if (bundle->getOptimizePngs()) {
+        sp<AaptFile> optimized;
+        if (optimize_png(bundle, source.string(), imageInfo, encoding, &optimized) == 0) {
+            return error;
+        }
+        FILE* fp = fopen(dest.string(), "wb");
+        if (!fp) {
+            fprintf(stderr, "%s ERROR: Unable to open PNG file\n", dest.string());
+            return error;
+        }
+        const size_t newSize = optimized->getSize();
+        bool written = fwrite(optimized->getData(), 1, newSize, fp) == newSize;
+        if (fclose(fp) != 0 || !written) {
+            fprintf(stderr, "%s ERROR: Unable to write PNG file\n", dest.string());
+            return error;
+        }
+        if (bundle->getVerbose()) {
+            printf("  (optimized image to cache entry %s: %d%% size of source)\n",
+                   dest.string(), (int) (newSize * 100 / oldSize));
+        }
+        return store_webp_file(bundle, imageInfo, dest, newSize);
+    }
+
     // Call libpng to create a structure to hold the processed image data
     // that can be written to disk
-    write_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    write_ptr = PngBlockCache::createWriteStruct(NULL, NULL, NULL);
     if (!write_ptr) {
         png_destroy_write_struct(&write_ptr, &write_info);
         return error;
@@ -1456,7 +2772,7 @@ status_t preProcessImageToCache(const Bundle* bundle, const String8& source, con
     }
 
     // Open up our destination file for writing
-    fp = fopen(dest.string(), "wb");
+    FILE* fp = fopen(dest.string(), "wb");
     if (!fp) {
         fprintf(stderr, "%s ERROR: Unable to open PNG file\n", dest.string());
         png_destroy_write_struct(&write_ptr, &write_info);
@@ -1474,16 +2790,13 @@ status_t preProcessImageToCache(const Bundle* bundle, const String8& source, con
     }
 
     // Actually write out to the new png
-    write_png(dest.string(), write_ptr, write_info, imageInfo,
-              bundle->getGrayscaleTolerance());
+    write_png(dest.string(), write_ptr, write_info, imageInfo, encoding,
+              bundle->getCompressionLevel());
 
-    if (bundle->getVerbose()) {
-        // Find the size of our new file
-        FILE* reader = fopen(dest.string(), "rb");
-        fseek(reader, 0, SEEK_END);
-        size_t newSize = (size_t)ftell(reader);
-        fclose(reader);
+    // Find the size of our new file
+    size_t newSize = (size_t)ftell(fp);
 
+    if (bundle->getVerbose()) {
         float factor = ((float)newSize)/oldSize;
         int percent = (int)(factor*100);
         printf("  (processed image to cache entry %s: %d%% size of source)\n",
@@ -1494,7 +2807,7 @@ status_t preProcessImageToCache(const Bundle* bundle, const String8& source, con
     fclose(fp);
     png_destroy_write_struct(&write_ptr, &write_info);
 
-    return NO_ERROR;
+    return store_webp_file(bundle, imageInfo, dest, newSize);
 }
 
 status_t postProcessImage(const Bundle* bundle, const sp<AaptAssets>& assets,
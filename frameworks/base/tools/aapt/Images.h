@@ -20,6 +20,25 @@ status_t preProcessImage(const Bundle* bundle, const sp<AaptAssets>& assets,
 
 status_t preProcessImageToCache(const Bundle* bundle, const String8& source, const String8& dest);
 
+/*
+ * The digest preProcessImage() keeps "file" under in the --resource-cache,
+ * or an empty string for a file it doesn't keep there.
+ */
+status_t imageCacheDigest(const Bundle* bundle, const sp<AaptFile>& file, String8* outDigest);
+
+/*
+ * Writes the images preprocessed so far that have the same pixels, or are
+ * the same size and look alike, to "path" for --similar-images-report.
+ */
+status_t writeSimilarImagesReport(const char* path);
+
+/*
+ * Estimates the memory preProcessImage() holds while it crunches the PNG at
+ * "path", from the size its header gives, besides the file itself.  Returns
+ * 0 if it isn't a PNG.
+ */
+size_t estimateImageMemory(const String8& path);
+
 status_t postProcessImage(const Bundle* bundle, const sp<AaptAssets>& assets,
                           ResourceTable* table, const sp<AaptFile>& file);
 
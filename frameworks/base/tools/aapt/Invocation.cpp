@@ -0,0 +1,147 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Runs aapt commands inside another program.
+
+#include "Invocation.h"
+#include "Main.h"
+#include "SourcePos.h"
+#include "WorkQueue.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+namespace android {
+
+Invocation::Invocation()
+    : mCaptureApk(false)
+{
+}
+
+Invocation::~Invocation()
+{
+}
+
+int Invocation::run(Bundle* bundle)
+{
+    if (bundle->getCommand() == kCommandDaemon) {
+        fprintf(stderr, "ERROR: The daemon can't run in an Invocation\n");
+        return 1;
+    }
+
+    // The same defaults as the command line's.
+    if (bundle->getCompressionMethod() == 0) {
+        bundle->setCompressionMethod(ZipEntry::kCompressDeflated);
+    }
+    if (bundle->getJobs() == 0) {
+        bundle->setJobs(WorkQueue::getDefaultThreadCount());
+    }
+
+    AaptContext::Scope scope(&mContext);
+    mApk.clear();
+    if (mCaptureApk && bundle->getCommand() == kCommandPackage) {
+        return runCapturingApk(bundle);
+    }
+    return handleCommand(bundle);
+}
+
+#if !defined(_WIN32)
+
+struct PipeReader {
+    int fd;
+    Vector<uint8_t>* data;
+};
+
+// Appends everything read from the pipe to the buffer, until it is closed.
+static void* readPipe(void* arg)
+{
+    PipeReader* reader = static_cast<PipeReader*>(arg);
+    uint8_t buf[65536];
+    for (;;) {
+        ssize_t n = read(reader->fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        reader->data->appendArray(buf, n);
+    }
+    close(reader->fd);
+    return NULL;
+}
+
+/*
+ * Packages into a pipe, which ZipFile writes in one pass as it does for
+ * any other, while a thread collects the archive from the other end.
+ */
+int Invocation::runCapturingApk(Bundle* bundle)
+{
+    if (!bundle->getSplitConfigurations().isEmpty()) {
+        fprintf(stderr, "ERROR: Can't capture the APKs of splits\n");
+        return 1;
+    }
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+        fprintf(stderr, "ERROR: Unable to make a pipe for the APK: %s\n", strerror(errno));
+        return 1;
+    }
+    // Nothing aapt starts may hold the pipe open past the run.
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    PipeReader reader;
+    reader.fd = fds[0];
+    reader.data = &mApk;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, readPipe, &reader) != 0) {
+        fprintf(stderr, "ERROR: Unable to start reading the APK\n");
+        close(fds[0]);
+        close(fds[1]);
+        return 1;
+    }
+
+    const char* outputFile = bundle->getOutputAPKFile();
+    const String8 pipePath = String8::format("/dev/fd/%d", fds[1]);
+    bundle->setOutputAPKFile(pipePath.string());
+    int result = handleCommand(bundle);
+    bundle->setOutputAPKFile(outputFile);
+
+    // ZipFile wrote through a descriptor of its own; this is the last one.
+    close(fds[1]);
+    pthread_join(thread, NULL);
+    if (result != 0) {
+        mApk.clear();
+    }
+    return result;
+}
+
+#else
+
+int Invocation::runCapturingApk(Bundle* bundle)
+{
+    fprintf(stderr, "ERROR: Can't capture the APK on this platform\n");
+    return 1;
+}
+
+#endif
+
+bool Invocation::hasErrors()
+{
+    AaptContext::Scope scope(&mContext);
+    return SourcePos::hasErrors();
+}
+
+String8 Invocation::getDiagnostics()
+{
+    AaptContext::Scope scope(&mContext);
+    return SourcePos::getDiagnostics();
+}
+
+} // namespace android
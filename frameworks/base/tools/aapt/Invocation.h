@@ -0,0 +1,81 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Runs aapt commands inside another program.
+
+#ifndef AAPT_INVOCATION_H
+#define AAPT_INVOCATION_H
+
+#include "AaptContext.h"
+#include "Bundle.h"
+
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+/*
+ * Runs aapt commands in the calling process, for build systems that would
+ * otherwise start aapt for every module and load android.jar each time.
+ * Set up a Bundle as the command line would, then run() it:
+ *
+ *     Bundle bundle;
+ *     bundle.setCommand(kCommandPackage);
+ *     bundle.setAndroidManifestFile("AndroidManifest.xml");
+ *     bundle.addPackageInclude("android.jar");
+ *     bundle.addResourceSourceDir("res");
+ *     Invocation invocation;
+ *     invocation.setCaptureApk(true);
+ *     if (invocation.run(&bundle) == 0) {
+ *         const Vector<uint8_t>& apk = invocation.getApk();
+ *         ...
+ *
+ * Each Invocation has its own AaptContext, so several can run on their
+ * own threads at once.  They share the work threads of
+ * WorkQueue::getShared() and ZipFile's deflate threads, which the program
+ * sets up once for the whole process.  Errors that aapt doesn't report
+ * through SourcePos still go to stderr.
+ */
+class Invocation {
+public:
+    Invocation();
+    ~Invocation();
+
+    /*
+     * Runs the command "bundle" is set up for and returns the exit status
+     * the aapt tool would.  The daemon command is not supported.
+     */
+    int run(Bundle* bundle);
+
+    /*
+     * With "capture" set, the APK that the next package command writes is
+     * kept in memory for getApk() in place of the bundle's output file.
+     * Not supported with splits, or on Windows.
+     */
+    void setCaptureApk(bool capture) { mCaptureApk = capture; }
+
+    /* The APK of the last run, if it was captured. */
+    const Vector<uint8_t>& getApk() const { return mApk; }
+
+    /* Whether the runs so far reported an error through SourcePos. */
+    bool hasErrors();
+
+    /* The errors, warnings and notes of the runs so far, one per line. */
+    String8 getDiagnostics();
+
+    AaptContext* getContext() { return &mContext; }
+
+private:
+    Invocation(const Invocation&);
+    Invocation& operator=(const Invocation&);
+
+    int runCapturingApk(Bundle* bundle);
+
+    AaptContext mContext;
+    bool mCaptureApk;
+    Vector<uint8_t> mApk;
+};
+
+} // namespace android
+
+#endif // AAPT_INVOCATION_H
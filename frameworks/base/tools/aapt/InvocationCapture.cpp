@@ -0,0 +1,468 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Capturing a package command with its inputs, for "aapt replay".
+//
+
+#include "InvocationCapture.h"
+#include "AaptContext.h"
+#include "Bundle.h"
+#include "Main.h"
+#include "PhaseTrace.h"
+#include "Statistics.h"
+
+#include <androidfw/misc.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <string>
+#include <vector>
+
+using namespace android;
+
+// Prefixes of the captured arguments that name inputs and outputs, which
+// replay makes relative to the capture directory.
+static const char kInputPrefix[] = "@CAPTURE@/";
+static const char kOutputFilePrefix[] = "@OUT@/";
+static const char kOutputDirPrefix[] = "@OUTDIR@/";
+
+enum ArgRole {
+    ROLE_KEEP,
+    ROLE_INPUT,
+    ROLE_OUTPUT_FILE,
+    ROLE_OUTPUT_DIR,
+    ROLE_DROP           // the value of an option that isn't captured
+};
+
+static bool contains(const Vector<const char*>& values, const char* arg)
+{
+    for (size_t i = 0; i < values.size(); i++) {
+        if (values[i] == arg) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool contains(const Vector<String8>& values, const char* arg)
+{
+    for (size_t i = 0; i < values.size(); i++) {
+        if (values[i] == arg) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * What the argument "arg" of the command line is to the build.  Bundle
+ * keeps most paths as the pointers into argv it was given, so those are
+ * matched by pointer, which no flag or other value can be mistaken for;
+ * the ones it copies are matched by their text.
+ */
+static ArgRole getArgRole(const Bundle* bundle, const char* arg)
+{
+    if (arg == bundle->getAndroidManifestFile()
+            || arg == bundle->getStableIdsFile()
+            || arg == bundle->getCollapseKeyNamesFile()
+            || contains(bundle->getResourceSourceDirs(), arg)
+            || contains(bundle->getAssetSourceDirs(), arg)
+            || contains(bundle->getJarFiles(), arg)
+            || contains(bundle->getPackageIncludes(), arg)
+            || contains(bundle->getShrinkKeepFiles(), arg)
+            || bundle->getFeatureOfPackage() == arg) {
+        return ROLE_INPUT;
+    }
+    for (int i = 0; i < bundle->getFileSpecCount(); i++) {
+        if (arg == bundle->getFileSpecEntry(i)) {
+            return ROLE_INPUT;
+        }
+    }
+    if (arg == bundle->getOutputAPKFile()
+            || arg == bundle->getProguardFile()
+            || arg == bundle->getPublicOutputFile()
+            || arg == bundle->getEmitIdsFile()
+            || arg == bundle->getFeatureIndexFile()
+            || arg == bundle->getDependencyGraphFile()
+            || arg == bundle->getDiagnosticsOutput()
+            || arg == bundle->getCostReport()
+            || arg == bundle->getSimilarImagesReport()
+            || arg == bundle->getCheckpointFile()) {
+        return ROLE_OUTPUT_FILE;
+    }
+    if (arg == bundle->getRClassDir()
+            || arg == bundle->getCrunchedOutputDir()
+            || arg == bundle->getOutputTextSymbols()) {
+        return ROLE_OUTPUT_DIR;
+    }
+    if (arg == bundle->getCaptureInvocation()
+            || arg == bundle->getResourceCacheDir()
+            || arg == bundle->getResourceCacheRemote()
+            || arg == bundle->getSpoolDir()
+            || arg == bundle->getTraceOutput()
+            || contains(bundle->getCrunchWorkers(), arg)) {
+        return ROLE_DROP;
+    }
+    return ROLE_KEEP;
+}
+
+static status_t makeDir(const String8& path)
+{
+#ifdef _WIN32
+    const int result = _mkdir(path.string());
+#else
+    const int result = mkdir(path.string(), S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH);
+#endif
+    if (result != 0 && errno != EEXIST) {
+        fprintf(stderr, "ERROR: Unable to create directory '%s': %s\n", path.string(),
+                strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+    return NO_ERROR;
+}
+
+static status_t copyFile(const String8& from, const String8& to)
+{
+    FILE* in = fopen(from.string(), "rb");
+    if (in == NULL) {
+        fprintf(stderr, "ERROR: Unable to open '%s': %s\n", from.string(), strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+    FILE* out = fopen(to.string(), "wb");
+    if (out == NULL) {
+        fprintf(stderr, "ERROR: Unable to create '%s': %s\n", to.string(), strerror(errno));
+        fclose(in);
+        return UNKNOWN_ERROR;
+    }
+
+    bool written = true;
+    char buf[64 * 1024];
+    size_t count;
+    while (written && (count = fread(buf, 1, sizeof(buf), in)) > 0) {
+        written = fwrite(buf, 1, count, out) == count;
+    }
+    const bool read = !ferror(in);
+    fclose(in);
+    written = fclose(out) == 0 && written;
+    if (!read) {
+        fprintf(stderr, "ERROR: Unable to read '%s'\n", from.string());
+        return UNKNOWN_ERROR;
+    }
+    if (!written) {
+        fprintf(stderr, "ERROR: Unable to write '%s'\n", to.string());
+        return UNKNOWN_ERROR;
+    }
+    return NO_ERROR;
+}
+
+// Copies the file or directory "from" to "to", following symlinks as the
+// build does.
+static status_t copyTree(const String8& from, const String8& to)
+{
+    const FileType type = getFileType(from.string());
+    if (type == kFileTypeNonexistent) {
+        // Whatever the build makes of a missing input, the replay makes too.
+        return NO_ERROR;
+    }
+    if (type != kFileTypeDirectory) {
+        return copyFile(from, to);
+    }
+
+    status_t err = makeDir(to);
+    if (err != NO_ERROR) {
+        return err;
+    }
+    DIR* dir = opendir(from.string());
+    if (dir == NULL) {
+        fprintf(stderr, "ERROR: opendir(%s): %s\n", from.string(), strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+    struct dirent* entry;
+    while (err == NO_ERROR && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        String8 fromChild(from);
+        fromChild.appendPath(entry->d_name);
+        String8 toChild(to);
+        toChild.appendPath(entry->d_name);
+        err = copyTree(fromChild, toChild);
+    }
+    closedir(dir);
+    return err;
+}
+
+// The name a path is captured as: its position on the command line, which
+// keeps inputs of the same name apart, and its last component.
+static String8 getCapturedName(int index, const char* arg)
+{
+    String8 path(arg);
+    while (path.length() > 1 && path.string()[path.length() - 1] == '/') {
+        path.setTo(path.string(), path.length() - 1);
+    }
+    String8 leaf(path.getPathLeaf());
+    if (leaf.length() == 0 || leaf == "." || leaf == "..") {
+        leaf = "input";
+    }
+    return String8::format("%d-%s", index, leaf.string());
+}
+
+static status_t writeLines(const String8& path, const Vector<String8>& lines)
+{
+    FILE* fp = fopen(path.string(), "w");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: Unable to create '%s': %s\n", path.string(), strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+    for (size_t i = 0; i < lines.size(); i++) {
+        fprintf(fp, "%s\n", lines[i].string());
+    }
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "ERROR: Unable to write '%s': %s\n", path.string(), strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+    return NO_ERROR;
+}
+
+status_t captureInvocation(const Bundle* bundle, int argc, char* const argv[])
+{
+    if (bundle->getCommand() != kCommandPackage) {
+        fprintf(stderr, "ERROR: --capture-invocation only captures the package command\n");
+        return UNKNOWN_ERROR;
+    }
+
+    const String8 root(bundle->getCaptureInvocation());
+    String8 inputs(root);
+    inputs.appendPath("inputs");
+    status_t err = makeDir(root);
+    if (err == NO_ERROR) {
+        err = makeDir(inputs);
+    }
+    if (err != NO_ERROR) {
+        return err;
+    }
+
+    Vector<String8> args;
+    String8 commandLine(argv[0]);
+    for (int i = 1; i < argc && err == NO_ERROR; i++) {
+        const char* arg = argv[i];
+        commandLine.appendFormat(" %s", arg);
+        if (strchr(arg, '\n') != NULL) {
+            fprintf(stderr, "ERROR: --capture-invocation can't capture an argument"
+                    " with a newline: '%s'\n", arg);
+            return UNKNOWN_ERROR;
+        }
+        const String8 name(getCapturedName(i, arg));
+        switch (getArgRole(bundle, arg)) {
+        case ROLE_INPUT: {
+            String8 dest(inputs);
+            dest.appendPath(name);
+            err = copyTree(String8(arg), dest);
+            args.add(String8::format("%sinputs/%s", kInputPrefix, name.string()));
+            break;
+        }
+        case ROLE_OUTPUT_FILE:
+            args.add(String8::format("%s%s", kOutputFilePrefix, name.string()));
+            break;
+        case ROLE_OUTPUT_DIR:
+            args.add(String8::format("%s%s", kOutputDirPrefix, name.string()));
+            break;
+        case ROLE_DROP:
+            // The option that took the value goes too.
+            if (args.size() > 0 && strncmp(args.top().string(), "--", 2) == 0) {
+                args.pop();
+            }
+            break;
+        default:
+            args.add(String8(arg));
+            break;
+        }
+    }
+    if (err != NO_ERROR) {
+        return err;
+    }
+
+    String8 invocationPath(root);
+    invocationPath.appendPath("invocation");
+    err = writeLines(invocationPath, args);
+    if (err != NO_ERROR) {
+        return err;
+    }
+
+    Vector<String8> settings;
+    settings.add(String8("# Captured with --capture-invocation; run again with"
+            " \"aapt replay DIR\"."));
+#ifdef AAPT_VERSION
+    settings.add(String8("version " AAPT_VERSION));
+#endif
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) != NULL) {
+        settings.add(String8::format("directory %s", cwd));
+    }
+    settings.add(String8::format("command %s", commandLine.string()));
+    settings.add(String8::format("jobs %d", bundle->getJobs()));
+    settings.add(String8::format("max-memory %d", bundle->getMaxMemory()));
+    String8 settingsPath(root);
+    settingsPath.appendPath("settings");
+    return writeLines(settingsPath, settings);
+}
+
+// The timings of one phase over the runs of a replay.
+struct PhaseTimes {
+    String8 name;
+    std::vector<nsecs_t> times;
+};
+
+static void printTimes(const char* name, std::vector<nsecs_t> times)
+{
+    std::sort(times.begin(), times.end());
+    nsecs_t sum = 0;
+    for (size_t i = 0; i < times.size(); i++) {
+        sum += times[i];
+    }
+    const size_t n = times.size();
+    const nsecs_t median = n % 2 == 1 ? times[n / 2] : (times[n / 2 - 1] + times[n / 2]) / 2;
+    printf("%-32s %4zu %10.1f %10.1f %10.1f\n", name, n, times[0] / 1e6, median / 1e6,
+            sum / 1e6 / n);
+}
+
+/*
+ * Runs the command captured into the directory named on the command line,
+ * each time in a fresh Bundle and AaptContext as the daemon does, and
+ * prints how long the runs and the phases of PhaseTrace took.
+ */
+int doReplay(Bundle* bundle)
+{
+    if (bundle->getFileSpecCount() != 1) {
+        fprintf(stderr, "ERROR: specify the directory of one captured invocation\n");
+        return 1;
+    }
+    const String8 root(bundle->getFileSpecEntry(0));
+    String8 invocationPath(root);
+    invocationPath.appendPath("invocation");
+    FILE* fp = fopen(invocationPath.string(), "r");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: Unable to open '%s': %s\n", invocationPath.string(),
+                strerror(errno));
+        return 1;
+    }
+    std::vector<std::string> captured;
+    char line[PATH_MAX + 64];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        captured.push_back(std::string(line, strcspn(line, "\n")));
+    }
+    fclose(fp);
+    if (captured.empty()) {
+        fprintf(stderr, "ERROR: '%s' holds no command\n", invocationPath.string());
+        return 1;
+    }
+
+    String8 out(root);
+    out.appendPath("out");
+    String8 trace(out);
+    trace.appendPath("trace.json");
+
+    // The trace is enabled as the first option, since the rest may end
+    // with the raw-files directories.
+    std::vector<std::string> args;
+    std::vector<String8> outputDirs;
+    args.push_back("aapt");
+    args.push_back(captured[0]);
+    args.push_back("--trace-output");
+    args.push_back(trace.string());
+    for (size_t i = 1; i < captured.size(); i++) {
+        const std::string& arg = captured[i];
+        String8 path;
+        if (arg.compare(0, strlen(kInputPrefix), kInputPrefix) == 0) {
+            path = root;
+            path.appendPath(arg.c_str() + strlen(kInputPrefix));
+        } else if (arg.compare(0, strlen(kOutputFilePrefix), kOutputFilePrefix) == 0) {
+            path = out;
+            path.appendPath(arg.c_str() + strlen(kOutputFilePrefix));
+        } else if (arg.compare(0, strlen(kOutputDirPrefix), kOutputDirPrefix) == 0) {
+            path = out;
+            path.appendPath(arg.c_str() + strlen(kOutputDirPrefix));
+            outputDirs.push_back(path);
+        } else {
+            args.push_back(arg);
+            continue;
+        }
+        args.push_back(path.string());
+    }
+
+    std::vector<nsecs_t> runTimes;
+    std::vector<PhaseTimes> phases;
+    for (int run = 0; run < bundle->getReplayRepeat(); run++) {
+        if (makeDir(out) != NO_ERROR) {
+            return 1;
+        }
+        for (size_t i = 0; i < outputDirs.size(); i++) {
+            if (makeDir(outputDirs[i]) != NO_ERROR) {
+                return 1;
+            }
+        }
+
+        // runCommandLine() may rewrite the arguments in place.
+        std::vector<std::string> runArgs(args);
+        std::vector<char*> argv;
+        for (size_t i = 0; i < runArgs.size(); i++) {
+            argv.push_back(&runArgs[i][0]);
+        }
+        argv.push_back(NULL);
+
+        Statistics::reset();
+        const nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        int result;
+        {
+            AaptContext context;
+            AaptContext::Scope scope(&context);
+            Bundle runBundle;
+            result = runCommandLine(runBundle, argv.size() - 1, &argv[0]);
+        }
+        runTimes.push_back(systemTime(SYSTEM_TIME_MONOTONIC) - start);
+        fflush(stdout);
+        fflush(stderr);
+        if (result != 0) {
+            fprintf(stderr, "ERROR: Run %d of '%s' failed\n", run + 1, root.string());
+            return result;
+        }
+
+        Vector<String8> names;
+        Vector<nsecs_t> totals;
+        PhaseTrace::getPhaseTotals(&names, &totals);
+        for (size_t i = 0; i < names.size(); i++) {
+            size_t j = 0;
+            while (j < phases.size() && phases[j].name != names[i]) {
+                j++;
+            }
+            if (j == phases.size()) {
+                phases.push_back(PhaseTimes());
+                phases[j].name = names[i];
+            }
+            phases[j].times.push_back(totals[i]);
+        }
+    }
+
+    printf("Replayed %s %d times\n", root.string(), bundle->getReplayRepeat());
+    printf("%-32s %4s %10s %10s %10s\n", "phase (ms)", "runs", "min", "median", "mean");
+    printTimes("total", runTimes);
+    for (size_t i = 0; i < phases.size(); i++) {
+        printTimes(phases[i].name.string(), phases[i].times);
+    }
+    return 0;
+}
@@ -0,0 +1,33 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Capturing a package command with its inputs, for "aapt replay".
+//
+
+#ifndef AAPT_INVOCATION_CAPTURE_H
+#define AAPT_INVOCATION_CAPTURE_H
+
+#include <utils/Errors.h>
+
+class Bundle;
+
+/*
+ * Copies the inputs of the package command "bundle" was parsed from into
+ * its --capture-invocation directory, so that a slow build can be run
+ * again on another machine without the build system that started it:
+ *
+ *     DIR/inputs/     the manifest, -S and -A directories, -I includes,
+ *                     jars, raw-files directories and other input files,
+ *                     each named after its position on the command line
+ *     DIR/invocation  the command line, one argument per line, with the
+ *                     inputs and outputs made relative to DIR
+ *     DIR/settings    what the command ran with, for reference
+ *
+ * "argc" and "argv" are the whole command line, as given to main().  The
+ * options that connect the build to its host, the resource cache, crunch
+ * workers, spool directory and trace output, are left out, so that a
+ * replay only measures the work of the build.
+ */
+android::status_t captureInvocation(const Bundle* bundle, int argc, char* const argv[]);
+
+#endif // AAPT_INVOCATION_CAPTURE_H
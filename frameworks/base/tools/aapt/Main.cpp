@@ -5,12 +5,19 @@
 //
 #include "Main.h"
 #include "Bundle.h"
+#include "Checkpoint.h"
+#include "InvocationCapture.h"
+#include "MemoryBudget.h"
+#include "StartupProfile.h"
+#include "Variants.h"
+#include "WorkQueue.h"
 
 #include <utils/Compat.h>
 #include <utils/Log.h>
 #include <utils/threads.h>
 #include <utils/List.h>
 #include <utils/Errors.h>
+#include <utils/SharedBuffer.h>
 
 #include <cstdlib>
 #include <getopt.h>
@@ -48,14 +55,31 @@ void usage(void)
         " %s l[ist] [-v] [-a] file.{zip,jar,apk}\n"
         "   List contents of Zip-compatible archive.\n\n", gProgName);
     fprintf(stderr,
-        " %s d[ump] [--values] [--include-meta-data] WHAT file.{apk} [asset [asset ...]]\n"
+        " %s verify [-v] [--jobs N] file.{zip,jar,apk} [file ...]\n"
+        "   Uncompress every entry and check its CRC, several entries at a time\n"
+        "   with --jobs, check that resources.arsc and the compiled XML files\n"
+        "   parse, and print how fast each archive was read.\n\n", gProgName);
+    fprintf(stderr,
+        " %s replay [--repeat N] DIR\n"
+        "   Run the package command captured into DIR with --capture-invocation N\n"
+        "   times, 5 by default, and print how long the runs and each of their\n"
+        "   phases took: the fastest, the median and the mean.  The outputs go to\n"
+        "   DIR/out.\n\n", gProgName);
+    fprintf(stderr,
+        " %s d[ump] [--values] [--json] [--include-meta-data] WHAT file.{apk} [asset [asset ...]]\n"
+        " %s d[ump] [--values] [--json] [--include-meta-data] [-I base-package [-I ...]]\n"
+        "        [--jobs N] --batch LISTFILE WHAT\n"
         "   strings          Print the contents of the resource table string pool in the APK.\n"
         "   badging          Print the label and icon for the app declared in APK.\n"
         "   permissions      Print the permissions from the APK.\n"
         "   resources        Print the resource table from the APK.\n"
         "   configurations   Print the configurations in the APK.\n"
         "   xmltree          Print the compiled xmls in the given assets.\n"
-        "   xmlstrings       Print the strings of the given compiled xml assets.\n\n", gProgName);
+        "   xmlstrings       Print the strings of the given compiled xml assets.\n\n"
+        "   With --batch, dumps each APK listed in LISTFILE, one per line, or on stdin\n"
+        "   if it is \"-\".  Each dump is printed between \"== begin <apk>\" and\n"
+        "   \"== end <status> <apk>\" lines, in the order of the list.\n\n",
+        gProgName, gProgName);
     fprintf(stderr,
         " %s p[ackage] [-d][-f][-m][-u][-v][-x][-z][-M AndroidManifest.xml] \\\n"
         "        [-0 extension [-0 extension ...]] [-g tolerance] [-j jarfile] \\\n"
@@ -70,11 +94,29 @@ void usage(void)
         "        [-S resource-sources [-S resource-sources ...]] \\\n"
         "        [-F apk-file] [-J R-file-dir] \\\n"
         "        [--product product1,product2,...] \\\n"
-        "        [-c CONFIGS] [--preferred-density DENSITY] \\\n"
+        "        [-c CONFIGS] [--preferred-density DENSITY] [--prune-configs] \\\n"
         "        [--split CONFIGS [--split CONFIGS]] \\\n"
         "        [--feature-of package [--feature-after package]] \\\n"
+        "        [--emit-feature-index FILE] \\\n"
         "        [raw-files-dir [raw-files-dir] ...] \\\n"
-        "        [--output-text-symbols DIR]\n"
+        "        [--output-text-symbols DIR] [--jobs N] [--pin-threads] \\\n"
+        "        [--max-memory MB|auto] [--fail-fast] \\\n"
+        "        [--resource-cache DIR] [--resource-cache-limit MB] \\\n"
+        "        [--resource-cache-remote URL] [--crunch-worker COMMAND ...] \\\n"
+        "        [--zip-align] [--compression LEVEL] [--compression-ext EXT:LEVEL] \\\n"
+        "        [--compression-ext EXT:LEVEL ...] [--trace-output FILE] [--mem-stats] \\\n"
+        "        [--startup-profile] \\\n"
+        "        [--diagnostics-output FILE] [--cost-report FILE] [--cost-report-top N] \\\n"
+        "        [--capture-invocation DIR] \\\n"
+        "        [--keep-optimized-pngs] [--optimize-pngs] \\\n"
+        "        [--quantize-pngs QUALITY] [--quantize-pattern PATTERNS] \\\n"
+        "        [--webp] [--webp-quality QUALITY] \\\n"
+        "        [--similar-images-report FILE] [--enable-sparse-encoding] \\\n"
+        "        [--stable-ids FILE] [--emit-ids FILE] [--compact-xml] \\\n"
+        "        [--collapse-key-names FILE] [--shrink-resources FILE ...] \\\n"
+        "        [--collapse-invariant-values] [--entry-digests] [--v2-digests] \\\n"
+        "        [--dependency-graph FILE] [--spool-dir DIR] [--variants FILE] \\\n"
+        "        [--checkpoint FILE] [--from-checkpoint FILE]\n"
         "\n"
         "   Package the android resources.  It will read assets and resources that are\n"
         "   supplied with the -M -A -S or raw-files-dir arguments.  The -J -P -F and -R\n"
@@ -82,11 +124,17 @@ void usage(void)
         , gProgName);
     fprintf(stderr,
         " %s r[emove] [-v] file.{zip,jar,apk} file1 [file2 ...]\n"
+        " %s r[emove] [-v] --batch LISTFILE file.{zip,jar,apk}\n"
         "   Delete specified files from Zip-compatible archive.\n\n",
-        gProgName);
+        gProgName, gProgName);
     fprintf(stderr,
         " %s a[dd] [-v] file.{zip,jar,apk} file1 [file2 ...]\n"
-        "   Add specified files to Zip-compatible archive.\n\n", gProgName);
+        " %s a[dd] [-v] --batch LISTFILE file.{zip,jar,apk}\n"
+        "   Add specified files to Zip-compatible archive.\n\n"
+        "   With --batch, the files are those listed in LISTFILE, one per line, or on\n"
+        "   stdin if it is \"-\".  Files added replace entries of the same name, and\n"
+        "   the archive is written again once with all of the changes.\n\n",
+        gProgName, gProgName);
     fprintf(stderr,
         " %s c[runch] [-v] -S resource-sources ... -C output-folder ...\n"
         "   Do PNG preprocessing on one or several resource folders\n"
@@ -120,7 +168,8 @@ void usage(void)
         "       localization=\"suggested\"\n"
         "   -A  additional directory in which to find raw asset files\n"
         "   -G  A file to output proguard options into.\n"
-        "   -F  specify the apk file to output\n"
+        "   -F  specify the apk file to output; a FIFO or device, such as an\n"
+        "       uploader's pipe, is written front to back with no seeking\n"
         "   -I  add an existing package to base include set\n"
         "   -J  specify where to output R.java resource constant definitions\n"
         "   -M  specify full path to AndroidManifest.xml to include in zip\n"
@@ -146,6 +195,9 @@ void usage(void)
         "       ignores versioned resource directories above the given value.\n"
         "   --values\n"
         "       when used with \"dump resources\" also includes resource values.\n"
+        "   --json\n"
+        "       when used with \"dump resources\" prints a JSON object a line for each\n"
+        "       resource in each configuration, instead of the text.\n"
         "   --version-code\n"
         "       inserts android:versionCode in to manifest.\n"
         "   --version-name\n"
@@ -166,6 +218,12 @@ void usage(void)
         "   --preferred-density\n"
         "       Specifies a preference for a particular density. Resources that do not\n"
         "       match this density and have variants that are a closer match are removed.\n"
+        "   --prune-configs\n"
+        "       Skips the work on resources that the -c configurations leave out: their\n"
+        "       images are not crunched and, of their values files, only the names are\n"
+        "       read, so that the resources keep their identifiers and the missing\n"
+        "       default translations are still reported.  Errors in those values are\n"
+        "       not reported.  Meant for development builds.\n"
         "   --split\n"
         "       Builds a separate split APK for the configurations listed. This can\n"
         "       be loaded alongside the base APK at runtime.\n"
@@ -176,7 +234,12 @@ void usage(void)
         "       An app can have multiple Feature Split APKs which must be totally ordered.\n"
         "       If --feature-of is specified, this flag specifies which Feature Split APK\n"
         "       comes before this one. The first Feature Split APK should not define\n"
-        "       anything here.\n"
+        "       anything here.  The package may also be given as the file it was built\n"
+        "       with --emit-feature-index, which is quicker to read.\n"
+        "   --emit-feature-index\n"
+        "       Writes the largest resource type ID of each package built to the\n"
+        "       specified file, so that the next feature can be built --feature-after\n"
+        "       that file rather than loading this APK's resource table.\n"
         "   --rename-manifest-package\n"
         "       Rewrite the manifest so that its package name is the package name\n"
         "       given here.  Relative class names (for example .Foo) will be\n"
@@ -207,9 +270,202 @@ void usage(void)
         "       Insertion typically fails if the manifest already defines the attribute.\n"
         "   --error-on-missing-config-entry\n"
         "       Forces aapt to return an error if it fails to find an entry for a configuration.\n"
+        "   --fail-fast\n"
+        "       Stops at the first error: work not yet started is dropped and the\n"
+        "       remaining stages are skipped.  The errors of the files already\n"
+        "       processed are still listed, ordered by file and line.\n"
         "   --output-text-symbols\n"
         "       Generates a text file containing the resource symbols of the R class in the\n"
         "       specified folder.\n"
+        "   --jobs\n"
+        "       Number of threads used to preprocess images, parse values files,\n"
+        "       compile XML resource files and compress APK entries.  The default is\n"
+        "       the number of processors; 1 handles them one at a time.\n"
+        "   --pin-threads\n"
+        "       Binds each work thread to one of the processors aapt may run on, so\n"
+        "       that on multi-socket hosts its allocations stay on the local node.\n"
+        "   --max-memory\n"
+        "       Limits the memory that images being preprocessed and XML files being\n"
+        "       compiled may hold at once to the specified number of megabytes, by\n"
+        "       starting fewer of them at a time; 'auto' uses half the memory limit\n"
+        "       of the container aapt runs in, if it has one.\n"
+        "   --resource-cache\n"
+        "       Keeps preprocessed PNG images in the specified folder, keyed by their\n"
+        "       contents and the options that affect them, and reuses them on later runs.\n"
+        "       Compressed resource tables of -I packages are also kept there, inflated,\n"
+        "       so that later runs can map them, as are values files once parsed, so\n"
+        "       that those of libraries shared by many apps aren't parsed again.  Files\n"
+        "       deflated into the APK are kept there too, so that a build only deflates\n"
+        "       the ones that changed.  The folder may be shared by several builds.\n"
+        "   --resource-cache-limit\n"
+        "       Bounds the --resource-cache folder to the given number of MiB.  After\n"
+        "       each build the least recently used entries are removed until it holds\n"
+        "       three quarters of that.\n"
+        "   --resource-cache-remote\n"
+        "       Shares the --resource-cache with other machines through the HTTP server\n"
+        "       at the specified http://host[:port][/path] URL.  Entries missing locally\n"
+        "       are fetched with GET URL/DIGEST, mostly ahead of time while the build\n"
+        "       runs, and new ones are stored with PUT URL/DIGEST.  If the server can't\n"
+        "       be reached the build goes on with the local cache.\n"
+        "   --crunch-worker\n"
+        "       Crunches the images on other machines.  The specified shell command\n"
+        "       starts an aapt daemon there, e.g. \"ssh host aapt m --resource-cache\n"
+        "       DIR\", which must see the same source paths and share the resource\n"
+        "       cache, through the same folder or --resource-cache-remote, and be\n"
+        "       given the same image options.  The images are split between the\n"
+        "       workers by size and the build then reads them from the cache; any a\n"
+        "       worker couldn't crunch the same way are crunched here.  May be given\n"
+        "       more than once.\n"
+        "   --zip-align\n"
+        "       Writes uncompressed entries at 4-byte boundaries, and .so files at 4 KiB\n"
+        "       page boundaries, so the APK needs no separate zipalign pass.  With -u,\n"
+        "       entries moved into the space of replaced ones may lose their alignment.\n"
+        "   --compression\n"
+        "       How hard to compress APK entries and PNG image data: fast, default or\n"
+        "       max, or a zlib level from 1 to 9.  fast suits iterative builds; max is\n"
+        "       slower than the default and produces slightly smaller output.\n"
+        "   --compression-ext\n"
+        "       Compress APK entries whose names end in EXT at LEVEL instead, like -0\n"
+        "       does for files that are not to be compressed at all.\n"
+        "   --trace-output\n"
+        "       Writes how long each stage of packaging took, on each thread and for\n"
+        "       each file, to the specified file in the Chrome trace event format, to\n"
+        "       be loaded into chrome://tracing.\n"
+        "   --diagnostics-output\n"
+        "       Writes the errors, warnings and notes about the resources to the\n"
+        "       specified file as a SARIF 2.1.0 log, ordered by file and line, for\n"
+        "       editors and code review tools to show next to the sources.\n"
+        "   --cost-report\n"
+        "       Writes the files that took longest to parse, compile, crunch and\n"
+        "       compress, and the largest of each, to the specified file as JSON,\n"
+        "       with their input and output sizes, the strings of compiled XML files\n"
+        "       and the entries and bags of values files.\n"
+        "   --cost-report-top\n"
+        "       Number of files of each stage the cost report lists; 20 by default.\n"
+        "   --capture-invocation\n"
+        "       Copies the manifest, resource and asset directories, includes, jars\n"
+        "       and other inputs of the command to the specified directory, along\n"
+        "       with the command line rewritten to use the copies, then runs it as\n"
+        "       usual.  \"aapt replay\" runs the capture again on any machine.  The\n"
+        "       resource cache, crunch workers and spool directory aren't captured.\n"
+        "   --variants\n"
+        "       Packages one variant of the app for each line of the specified file,\n"
+        "       in one process.  A line holds the arguments of one variant, such as\n"
+        "       its overlay -S directories, -M, -c and -F, which go ahead of those on\n"
+        "       the command line, so its -S directories take precedence; the command\n"
+        "       line holds what the variants share.  Lines starting with '#' are\n"
+        "       skipped.  The -I packages are loaded once and images with the same\n"
+        "       pixels encoded once for all of them, and with --resource-cache the\n"
+        "       values files and images the first variant compiles are reused by the\n"
+        "       others, which then run at once.  Output files must be given per\n"
+        "       variant; --jobs, --pin-threads and --max-memory only on the command\n"
+        "       line.\n"
+        "   --checkpoint\n"
+        "       Keeps what the run made in the specified file once its resources\n"
+        "       have IDs and its files are compiled: the R classes and R.txt, even\n"
+        "       without -J, the ProGuard rules, even without -G, and the entries of\n"
+        "       the -F package.\n"
+        "   --from-checkpoint\n"
+        "       Writes the outputs asked for with -J, --output-text-symbols, -G and\n"
+        "       -F from the specified checkpoint, made with --checkpoint, instead of\n"
+        "       reading any sources.\n"
+        "   --mem-stats\n"
+        "       Prints how much memory file data, string pools, the resource table,\n"
+        "       XML trees and utils buffers held after each stage of packaging,\n"
+        "       along with the process's resident and peak resident size.\n"
+        "   --startup-profile\n"
+        "       Prints how long aapt took to start up: loading and static\n"
+        "       initialization, parsing the options, setting up, checking them and\n"
+        "       reading the inputs, the manifest and the included packages, up to\n"
+        "       when the build gets to work.\n"
+        "   --keep-optimized-pngs\n"
+        "       Keeps PNG images that are already as compact as they would be\n"
+        "       preprocessed, judged from their headers and a fast trial encoding,\n"
+        "       instead of encoding them again.  9-patch images are always processed.\n"
+        "   --optimize-pngs\n"
+        "       Encodes each PNG image with every PNG filter choice, zlib strategy and\n"
+        "       memory level, and each palette order and smaller bit depth the image\n"
+        "       allows, on --jobs threads, and keeps the smallest.  Much slower; meant\n"
+        "       for release builds, with a --resource-cache so each image is only\n"
+        "       optimized once.\n"
+        "   --quantize-pngs\n"
+        "       Reduces PNG images other than 9-patches that have more than 256 colors\n"
+        "       to a dithered palette of 256 colors with alpha, when the result is of\n"
+        "       at least this quality, from 0 to 100.  Lossy; at 100 nothing is\n"
+        "       reduced, and each point below it allows a root mean squared error\n"
+        "       0.16 of a level larger.\n"
+        "   --quantize-pattern\n"
+        "       With --quantize-pngs, only reduces the images whose resource directory\n"
+        "       and file name, as in drawable-xxhdpi/hero.png, match one of these\n"
+        "       patterns.  Patterns are separated by ':', '*' matches any characters\n"
+        "       and case is ignored, as in \"drawable-xxhdpi/*:*/illustration_*\".\n"
+        "   --webp\n"
+        "       Stores each PNG image other than 9-patches as a lossless WebP image\n"
+        "       when that is smaller, under the same name.  Needs a minSdkVersion of\n"
+        "       18 or higher; ignored otherwise.\n"
+        "   --webp-quality\n"
+        "       With --webp, uses lossy WebP images of this quality, from 0 to 100,\n"
+        "       instead of lossless ones.\n"
+        "   --similar-images-report\n"
+        "       Lists images with the same pixels, and images of the same size that\n"
+        "       look alike, in the specified file.  Images with the same pixels are\n"
+        "       always only encoded once; images reused from --resource-cache are not\n"
+        "       decoded, so they are not listed.\n"
+        "   --enable-sparse-encoding\n"
+        "       Lists only the defined entries of configurations that define few of\n"
+        "       a type's resources, such as most translations, to make the resource\n"
+        "       table smaller.  Only readers that support sparse types can load it;\n"
+        "       devices running this version of Android and earlier cannot.\n"
+        "   --stable-ids\n"
+        "       Gives resources that are still defined the identifiers listed in the\n"
+        "       specified file, as written by --emit-ids, so that adding a resource\n"
+        "       doesn't renumber the others.  New resources take the free identifiers.\n"
+        "       Identifiers declared in public.xml take precedence.\n"
+        "   --emit-ids\n"
+        "       Writes the identifier of every resource to the specified file, one\n"
+        "       \"package:type/name = 0xPPTTEEEE\" line each, for use with --stable-ids.\n"
+        "   --compact-xml\n"
+        "       Leaves source line numbers, comments and the raw text of attributes\n"
+        "       that have a typed value out of every compiled XML file, including\n"
+        "       the manifest.  Tools that report XML errors by line lose them.\n"
+        "   --collapse-key-names\n"
+        "       Gives every resource of the package one placeholder name in the\n"
+        "       resource table, and writes the real names to the specified file in\n"
+        "       the --emit-ids format.  Resources can then no longer be looked up by\n"
+        "       name, so this suits only final apps: not shared libraries, packages\n"
+        "       that others are built against with -I, or targets of overlays.\n"
+        "   --shrink-resources\n"
+        "       Leaves out the resources, and their files, that nothing refers to.\n"
+        "       The manifest, public resources and the resources listed in the\n"
+        "       specified file, one \"type/name\" per line, are kept along with\n"
+        "       everything they refer to in values and compiled XML.  List what code\n"
+        "       uses, such as from a code shrinker's report, and what is looked up\n"
+        "       by name.  May be given more than once.  Identifiers don't change.\n"
+        "   --collapse-invariant-values\n"
+        "       Leaves only the default configuration's copy of a resource whose value\n"
+        "       is the same in every configuration it has, such as a string copied\n"
+        "       untranslated into each locale, since devices of every configuration\n"
+        "       then find the default's.  Files are left alone.  Meant for release\n"
+        "       builds.\n"
+        "   --entry-digests\n"
+        "       Writes the SHA-256 of each entry of each APK to the APK's path plus\n"
+        "       \".digests\", as the entry sections of a MANIFEST.MF, so that a signer\n"
+        "       needn't read the entries again.\n"
+        "   --v2-digests\n"
+        "       Writes the APK Signature Scheme v2 digests of each APK, that of every\n"
+        "       1 MiB chunk and the whole content's, to the APK's path plus\n"
+        "       \".v2digests\".  They hold for the APK as written, so only for signing\n"
+        "       that adds no entries to it.\n"
+        "   --dependency-graph\n"
+        "       Writes which source file defines each resource, which resources each\n"
+        "       file refers to, and which outputs (compiled files, resources.arsc\n"
+        "       types, R classes) each file goes into, one tab-separated edge per\n"
+        "       line, so that a build system can work out what a change affects.\n"
+        "   --spool-dir\n"
+        "       Moves each compiled XML file and processed image out of memory into\n"
+        "       a temporary file in the specified directory as soon as it is made,\n"
+        "       and reads it back from there, so that memory use doesn't grow with\n"
+        "       the size of the output.  The files are removed when aapt exits.\n"
         "   --ignore-assets\n"
         "       Assets to be ignored. Default pattern is:\n"
         "       %s\n",
@@ -217,38 +473,34 @@ void usage(void)
 }
 
 /*
- * Dispatch the command.
+ * Parse a --compression level: a profile name, or a zlib level.
  */
-int handleCommand(Bundle* bundle)
+static bool parseCompressionLevel(const char* str, int* outLevel)
 {
-    //printf("--- command %d (verbose=%d force=%d):\n",
-    //    bundle->getCommand(), bundle->getVerbose(), bundle->getForce());
-    //for (int i = 0; i < bundle->getFileSpecCount(); i++)
-    //    printf("  %d: '%s'\n", i, bundle->getFileSpecEntry(i));
-
-    switch (bundle->getCommand()) {
-    case kCommandVersion:      return doVersion(bundle);
-    case kCommandList:         return doList(bundle);
-    case kCommandDump:         return doDump(bundle);
-    case kCommandAdd:          return doAdd(bundle);
-    case kCommandRemove:       return doRemove(bundle);
-    case kCommandPackage:      return doPackage(bundle);
-    case kCommandCrunch:       return doCrunch(bundle);
-    case kCommandSingleCrunch: return doSingleCrunch(bundle);
-    case kCommandDaemon:       return runInDaemonMode(bundle);
-    default:
-        fprintf(stderr, "%s: requested command not yet supported\n", gProgName);
-        return 1;
+    if (strcmp(str, "fast") == 0) {
+        *outLevel = COMPRESSION_FAST;
+    } else if (strcmp(str, "default") == 0) {
+        *outLevel = COMPRESSION_DEFAULT;
+    } else if (strcmp(str, "max") == 0) {
+        *outLevel = COMPRESSION_MAX;
+    } else if (str[0] >= '1' && str[0] <= '9' && str[1] == 0) {
+        *outLevel = str[0] - '0';
+    } else {
+        return false;
     }
+    return true;
 }
 
 /*
- * Parse args.
+ * Parse args into "bundle", which must be freshly constructed, and run the
+ * command.  argv[0] is the program name, as it is for main().
  */
-int main(int argc, char* const argv[])
+int runCommandLine(Bundle& bundle, int argc, char* const argv[])
 {
     char *prog = argv[0];
-    Bundle bundle;
+    // The whole command line, for --capture-invocation.
+    const int commandArgc = argc;
+    char* const* commandArgv = argv;
     bool wantUsage = false;
     int result = 1;    // pessimistically assume an error.
     int tolerance = 0;
@@ -261,7 +513,11 @@ int main(int argc, char* const argv[])
         goto bail;
     }
 
-    if (argv[1][0] == 'v')
+    if (strcmp(argv[1], "verify") == 0)     // spelled out, since 'v' is version
+        bundle.setCommand(kCommandVerify);
+    else if (strcmp(argv[1], "replay") == 0)    // spelled out, since 'r' is remove
+        bundle.setCommand(kCommandReplay);
+    else if (argv[1][0] == 'v')
         bundle.setCommand(kCommandVersion);
     else if (argv[1][0] == 'd')
         bundle.setCommand(kCommandDump);
@@ -554,6 +810,8 @@ int main(int argc, char* const argv[])
                     bundle.setReplaceVersion(true);
                 } else if (strcmp(cp, "-values") == 0) {
                     bundle.setValues(true);
+                } else if (strcmp(cp, "-json") == 0) {
+                    bundle.setJson(true);
                 } else if (strcmp(cp, "-include-meta-data") == 0) {
                     bundle.setIncludeMetaData(true);
                 } else if (strcmp(cp, "-custom-package") == 0) {
@@ -587,6 +845,8 @@ int main(int argc, char* const argv[])
                         goto bail;
                     }
                     bundle.setPreferredDensity(argv[0]);
+                } else if (strcmp(cp, "-prune-configs") == 0) {
+                    bundle.setPruneConfigs(true);
                 } else if (strcmp(cp, "-split") == 0) {
                     argc--;
                     argv++;
@@ -638,6 +898,8 @@ int main(int argc, char* const argv[])
                     bundle.setErrorOnFailedInsert(true);
                 } else if (strcmp(cp, "-error-on-missing-config-entry") == 0) {
                     bundle.setErrorOnMissingConfigEntry(true);
+                } else if (strcmp(cp, "-fail-fast") == 0) {
+                    bundle.setFailFast(true);
                 } else if (strcmp(cp, "-output-text-symbols") == 0) {
                     argc--;
                     argv++;
@@ -671,7 +933,359 @@ int main(int argc, char* const argv[])
                         wantUsage = true;
                         goto bail;
                     }
-                    gUserIgnoreAssets = argv[0];
+                    bundle.setIgnoreAssets(argv[0]);
+                } else if (strcmp(cp, "-jobs") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--jobs' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setJobs(atoi(argv[0]));
+                    if (bundle.getJobs() < 1) {
+                        fprintf(stderr, "ERROR: Invalid value for '--jobs' option: %s\n", argv[0]);
+                        wantUsage = true;
+                        goto bail;
+                    }
+                } else if (strcmp(cp, "-pin-threads") == 0) {
+                    bundle.setPinThreads(true);
+                } else if (strcmp(cp, "-max-memory") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--max-memory' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    if (strcmp(argv[0], "auto") == 0) {
+                        bundle.setMaxMemory(-1);
+                    } else {
+                        bundle.setMaxMemory(atoi(argv[0]));
+                        if (bundle.getMaxMemory() < 1) {
+                            fprintf(stderr, "ERROR: Invalid value for '--max-memory' option: %s\n",
+                                    argv[0]);
+                            wantUsage = true;
+                            goto bail;
+                        }
+                    }
+                } else if (strcmp(cp, "-resource-cache") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--resource-cache' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setResourceCacheDir(argv[0]);
+                } else if (strcmp(cp, "-resource-cache-remote") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--resource-cache-remote' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setResourceCacheRemote(argv[0]);
+                } else if (strcmp(cp, "-crunch-worker") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--crunch-worker' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.addCrunchWorker(argv[0]);
+                } else if (strcmp(cp, "-resource-cache-limit") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--resource-cache-limit' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setResourceCacheLimit(atoi(argv[0]));
+                    if (bundle.getResourceCacheLimit() < 1) {
+                        fprintf(stderr, "ERROR: Invalid value for '--resource-cache-limit' option: %s\n", argv[0]);
+                        wantUsage = true;
+                        goto bail;
+                    }
+                } else if (strcmp(cp, "-zip-align") == 0) {
+                    bundle.setZipAlign(true);
+                } else if (strcmp(cp, "-compression") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--compression' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    int level;
+                    if (!parseCompressionLevel(argv[0], &level)) {
+                        fprintf(stderr, "ERROR: Invalid value for '--compression' option: %s\n",
+                                argv[0]);
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setCompressionLevel(level);
+                } else if (strcmp(cp, "-compression-ext") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--compression-ext' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    const char* colon = strrchr(argv[0], ':');
+                    int level;
+                    if (colon == NULL || colon == argv[0]
+                            || !parseCompressionLevel(colon + 1, &level)) {
+                        fprintf(stderr, "ERROR: Invalid value for '--compression-ext' option: %s\n",
+                                argv[0]);
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setExtensionCompressionLevel(String8(argv[0], colon - argv[0]),
+                            level);
+                } else if (strcmp(cp, "-trace-output") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--trace-output' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setTraceOutput(argv[0]);
+                } else if (strcmp(cp, "-cost-report") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--cost-report' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setCostReport(argv[0]);
+                } else if (strcmp(cp, "-cost-report-top") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--cost-report-top' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setCostReportTop(atoi(argv[0]));
+                    if (bundle.getCostReportTop() < 1) {
+                        fprintf(stderr, "ERROR: Invalid value for '--cost-report-top' option: %s\n",
+                                argv[0]);
+                        wantUsage = true;
+                        goto bail;
+                    }
+                } else if (strcmp(cp, "-capture-invocation") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--capture-invocation' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setCaptureInvocation(argv[0]);
+                } else if (strcmp(cp, "-repeat") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--repeat' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setReplayRepeat(atoi(argv[0]));
+                    if (bundle.getReplayRepeat() < 1) {
+                        fprintf(stderr, "ERROR: Invalid value for '--repeat' option: %s\n",
+                                argv[0]);
+                        wantUsage = true;
+                        goto bail;
+                    }
+                } else if (strcmp(cp, "-diagnostics-output") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--diagnostics-output' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setDiagnosticsOutput(argv[0]);
+                } else if (strcmp(cp, "-mem-stats") == 0) {
+                    bundle.setMemStats(true);
+                } else if (strcmp(cp, "-startup-profile") == 0) {
+                    bundle.setStartupProfile(true);
+                } else if (strcmp(cp, "-keep-optimized-pngs") == 0) {
+                    bundle.setKeepOptimizedPngs(true);
+                } else if (strcmp(cp, "-optimize-pngs") == 0) {
+                    bundle.setOptimizePngs(true);
+                } else if (strcmp(cp, "-quantize-pngs") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--quantize-pngs' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    char* end;
+                    long quality = strtol(argv[0], &end, 10);
+                    if (*end != '\0' || quality < 0 || quality > 100) {
+                        fprintf(stderr, "ERROR: Invalid value for '--quantize-pngs' option: %s\n", argv[0]);
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setQuantizeQuality((int)quality);
+                } else if (strcmp(cp, "-quantize-pattern") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--quantize-pattern' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setQuantizePattern(argv[0]);
+                } else if (strcmp(cp, "-webp") == 0) {
+#ifndef AAPT_HAVE_WEBP
+                    fprintf(stderr, "ERROR: '--webp' is not supported by this build of aapt\n");
+                    goto bail;
+#endif
+                    bundle.setWebpImages(true);
+                } else if (strcmp(cp, "-webp-quality") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--webp-quality' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    char* end;
+                    long quality = strtol(argv[0], &end, 10);
+                    if (*end != '\0' || quality < 0 || quality > 100) {
+                        fprintf(stderr, "ERROR: Invalid value for '--webp-quality' option: %s\n", argv[0]);
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setWebpQuality((int)quality);
+                } else if (strcmp(cp, "-similar-images-report") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--similar-images-report' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setSimilarImagesReport(argv[0]);
+                } else if (strcmp(cp, "-enable-sparse-encoding") == 0) {
+                    bundle.setSparseEncoding(true);
+                } else if (strcmp(cp, "-batch") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--batch' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setBatchList(argv[0]);
+                } else if (strcmp(cp, "-variants") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--variants' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setVariantsFile(argv[0]);
+                } else if (strcmp(cp, "-checkpoint") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--checkpoint' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setCheckpointFile(argv[0]);
+                } else if (strcmp(cp, "-from-checkpoint") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--from-checkpoint' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setFromCheckpoint(argv[0]);
+                } else if (strcmp(cp, "-stable-ids") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--stable-ids' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setStableIdsFile(argv[0]);
+                } else if (strcmp(cp, "-emit-ids") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--emit-ids' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setEmitIdsFile(argv[0]);
+                } else if (strcmp(cp, "-emit-feature-index") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--emit-feature-index' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setFeatureIndexFile(argv[0]);
+                } else if (strcmp(cp, "-collapse-key-names") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--collapse-key-names' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setCollapseKeyNamesFile(argv[0]);
+                } else if (strcmp(cp, "-shrink-resources") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--shrink-resources' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.addShrinkKeepFile(argv[0]);
+                } else if (strcmp(cp, "-collapse-invariant-values") == 0) {
+                    bundle.setCollapseInvariantValues(true);
+                } else if (strcmp(cp, "-entry-digests") == 0) {
+                    bundle.setEntryDigests(true);
+                } else if (strcmp(cp, "-v2-digests") == 0) {
+                    bundle.setV2Digests(true);
+                } else if (strcmp(cp, "-dependency-graph") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--dependency-graph' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setDependencyGraphFile(argv[0]);
+                } else if (strcmp(cp, "-spool-dir") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--spool-dir' option\n");
+                        wantUsage = true;
+                        goto bail;
+                    }
+                    bundle.setSpoolDir(argv[0]);
+                } else if (strcmp(cp, "-compact-xml") == 0) {
+                    bundle.setCompactXml(true);
                 } else if (strcmp(cp, "-pseudo-localize") == 0) {
                     bundle.setPseudolocalize(PSEUDO_ACCENTED | PSEUDO_BIDI);
                 } else {
@@ -697,10 +1311,53 @@ int main(int argc, char* const argv[])
      * We're past the flags.  The rest all goes straight in.
      */
     bundle.setFileSpec(argv, argc);
+    StartupProfile::mark("parseOptions");
+    if (bundle.getStartupProfile()) {
+        StartupProfile::enable();
+    }
+
+    if (bundle.getJobs() == 0) {
+        bundle.setJobs(WorkQueue::getDefaultThreadCount());
+    }
+    ZipFile::setDeflateThreads(bundle.getJobs());
+    WorkQueue::setShared(bundle.getJobs(), bundle.getPinThreads());
+    if (bundle.getMaxMemory() > 0) {
+        MemoryBudget::setLimit((size_t) bundle.getMaxMemory() * 1024 * 1024);
+    } else if (bundle.getMaxMemory() < 0) {
+        MemoryBudget::setLimit(MemoryBudget::cgroupLimit() / 2);
+    }
+
+    if (bundle.getFromCheckpoint() != NULL) {
+        if (bundle.getCommand() != kCommandPackage) {
+            fprintf(stderr, "ERROR: --from-checkpoint is only supported by the package command\n");
+            goto bail;
+        }
+        StartupProfile::stop();
+        result = Checkpoint::restore(&bundle);
+        goto bail;
+    }
 
+    if (bundle.getVariantsFile() != NULL) {
+        if (bundle.getCommand() != kCommandPackage) {
+            fprintf(stderr, "ERROR: --variants is only supported by the package command\n");
+            goto bail;
+        }
+        StartupProfile::stop();
+        result = Variants::run(&bundle, commandArgc, commandArgv);
+        goto bail;
+    }
+
+    if (bundle.getCaptureInvocation() != NULL
+            && captureInvocation(&bundle, commandArgc, commandArgv) != NO_ERROR) {
+        goto bail;
+    }
+
+    StartupProfile::mark("setup");
     result = handleCommand(&bundle);
 
 bail:
+    // For commands that never got as far as the included packages.
+    StartupProfile::report(stdout);
     if (wantUsage) {
         usage();
         result = 2;
@@ -709,3 +1366,15 @@ bail:
     //printf("--> returning %d\n", result);
     return result;
 }
+
+int main(int argc, char* const argv[])
+{
+    StartupProfile::mark("staticInit");
+
+    // aapt makes and drops small strings by the hundred million; the
+    // pooled memory is only ever reused, never returned.
+    SharedBuffer::enablePooling();
+
+    Bundle bundle;
+    return runCommandLine(bundle, argc, argv);
+}
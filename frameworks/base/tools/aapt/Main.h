@@ -37,6 +37,14 @@ extern int doPackage(Bundle* bundle);
 extern int doCrunch(Bundle* bundle);
 extern int doSingleCrunch(Bundle* bundle);
 extern int runInDaemonMode(Bundle* bundle);
+extern int doVerify(Bundle* bundle);
+extern int doReplay(Bundle* bundle);
+
+/* Runs the command "bundle" is set up for, in the calling thread's AaptContext. */
+extern int handleCommand(Bundle* bundle);
+
+/* Parses a full aapt command line into "bundle" and runs it. */
+extern int runCommandLine(Bundle& bundle, int argc, char* const argv[]);
 
 extern int calcPercent(long uncompressedLen, long compressedLen);
 
@@ -44,6 +52,15 @@ extern android::status_t writeAPK(Bundle* bundle,
     const android::String8& outputFile,
     const android::sp<OutputSet>& outputSet);
 
+/*
+ * Writes each of "outputSets" to the path at the same index of
+ * "outputFiles", several at a time with --jobs.  A file that goes into
+ * more than one of them is compressed only once.
+ */
+extern android::status_t writeAPKs(Bundle* bundle,
+    const android::Vector<android::String8>& outputFiles,
+    const android::Vector<android::sp<OutputSet> >& outputSets);
+
 extern android::status_t updatePreProcessedCache(Bundle* bundle);
 
 extern android::status_t buildResources(Bundle* bundle,
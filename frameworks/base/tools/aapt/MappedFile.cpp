@@ -0,0 +1,104 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Read-only access to the whole of a source file.
+//
+
+#define LOG_TAG "MappedFile"
+
+#include "MappedFile.h"
+#include "Readahead.h"
+
+#include <utils/Log.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+// What getData() points at for an empty file; nothing is mapped for one.
+static const char kEmpty[1] = { 0 };
+
+static status_t errnoToStatus(int err)
+{
+    if (err == ENOENT) {
+        return NAME_NOT_FOUND;
+    } else if (err == EACCES) {
+        return PERMISSION_DENIED;
+    }
+    return UNKNOWN_ERROR;
+}
+
+MappedFile::MappedFile()
+    : mMap(NULL), mHeapData(NULL), mData(NULL), mSize(0), mModTime(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    delete mMap;
+    free(mHeapData);
+}
+
+status_t MappedFile::open(const char* path)
+{
+    LOG_ALWAYS_FATAL_IF(mData != NULL, "MappedFile opened twice");
+    Readahead::opened(path);
+
+    int fd = ::open(path, O_RDONLY | O_BINARY);
+    if (fd < 0) {
+        return errnoToStatus(errno);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        status_t err = errnoToStatus(errno);
+        close(fd);
+        return err;
+    }
+    mModTime = st.st_mtime;
+    mSize = (size_t)st.st_size;
+
+    if (mSize == 0) {
+        mData = kEmpty;
+        close(fd);
+        return NO_ERROR;
+    }
+
+    mMap = new FileMap();
+    if (mMap->create(path, fd, 0, mSize, true)) {
+        mData = mMap->getDataPtr();
+        mMap->advise(FileMap::SEQUENTIAL);
+        close(fd);
+        return NO_ERROR;
+    }
+    delete mMap;
+    mMap = NULL;
+
+    // Some file systems can't be mapped; read it the old way.
+    mHeapData = malloc(mSize);
+    if (mHeapData == NULL) {
+        close(fd);
+        return NO_MEMORY;
+    }
+    size_t done = 0;
+    while (done < mSize) {
+        ssize_t count = read(fd, (char*)mHeapData + done, mSize - done);
+        if (count <= 0) {
+            status_t err = count < 0 ? errnoToStatus(errno) : UNKNOWN_ERROR;
+            close(fd);
+            free(mHeapData);
+            mHeapData = NULL;
+            return err;
+        }
+        done += count;
+    }
+    close(fd);
+    mData = mHeapData;
+    return NO_ERROR;
+}
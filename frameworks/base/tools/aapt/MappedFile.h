@@ -0,0 +1,50 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Read-only access to the whole of a source file.
+//
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <utils/Errors.h>
+#include <utils/FileMap.h>
+#include <time.h>
+
+using namespace android;
+
+/*
+ * A source file mapped into memory, read-only, for as long as the object
+ * lives, so that it can be handed to expat, libpng or the zip writer as a
+ * single span without being copied.  If the file can't be mapped it is read
+ * into the heap instead; callers can't tell the difference.
+ *
+ * The file must not be modified while it is open.
+ */
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+
+    /* Returns the errno-derived status if the file can't be opened or read. */
+    status_t open(const char* path);
+
+    /* Never NULL once open() succeeded, even for an empty file. */
+    const void* getData() const { return mData; }
+    size_t getSize() const { return mSize; }
+
+    /* The file's modification time, as stat() reported it. */
+    time_t getModTime() const { return mModTime; }
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    FileMap* mMap;
+    void* mHeapData;
+    const void* mData;
+    size_t mSize;
+    time_t mModTime;
+};
+
+#endif // MAPPED_FILE_H
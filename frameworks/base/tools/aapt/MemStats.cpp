@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MemStats.h"
+
+#include <utils/Mutex.h>
+#include <utils/SharedBuffer.h>
+#include <utils/Vector.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+using android::AutoMutex;
+using android::Mutex;
+using android::SharedBuffer;
+using android::Vector;
+
+namespace {
+
+struct Checkpoint {
+    const char* name;
+    ssize_t held[MemStats::NUM_CATEGORIES];
+    size_t sharedBuffers;
+    size_t rss;         // 0 if unknown
+    size_t peakRss;     // 0 if unknown
+};
+
+// Set once by enable(), before any other thread looks at it.
+bool gEnabled = false;
+
+ssize_t gHeld[MemStats::NUM_CATEGORIES];
+ssize_t gPeak[MemStats::NUM_CATEGORIES];
+
+Mutex gLock;
+Vector<Checkpoint> gCheckpoints;
+
+const char* const kCategoryNames[MemStats::NUM_CATEGORIES] = {
+    "files", "pools", "table", "xml"
+};
+
+#if defined(__linux__)
+// Reads a "Vm...:  1234 kB" line of /proc/self/status.
+size_t readProcStatus(const char* field)
+{
+    FILE* fp = fopen("/proc/self/status", "r");
+    if (fp == NULL) {
+        return 0;
+    }
+    const size_t len = strlen(field);
+    char line[256];
+    unsigned long kb = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strncmp(line, field, len) == 0 && line[len] == ':') {
+            kb = strtoul(line + len + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(fp);
+    return kb * 1024;
+}
+#endif
+
+size_t getRss()
+{
+#if defined(__linux__)
+    return readProcStatus("VmRSS");
+#else
+    return 0;
+#endif
+}
+
+size_t getPeakRss()
+{
+#if defined(__linux__)
+    return readProcStatus("VmHWM");
+#elif defined(_WIN32)
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return usage.ru_maxrss;     // bytes on Mac OS
+#endif
+}
+
+void printMegabytes(FILE* fp, ssize_t bytes)
+{
+    fprintf(fp, " %9.1f", bytes / (1024.0 * 1024.0));
+}
+
+} // namespace
+
+namespace MemStats {
+
+void enable()
+{
+    SharedBuffer::enableAccounting();
+    {
+        // A daemon may package more than once; each report starts over.
+        AutoMutex _l(gLock);
+        gCheckpoints.clear();
+    }
+    for (int i = 0; i < NUM_CATEGORIES; i++) {
+        gPeak[i] = __atomic_load_n(&gHeld[i], __ATOMIC_RELAXED);
+    }
+    gEnabled = true;
+}
+
+bool isEnabled()
+{
+    return gEnabled;
+}
+
+void add(Category category, ssize_t bytes)
+{
+    if (!gEnabled) {
+        return;
+    }
+    const ssize_t held = __atomic_add_fetch(&gHeld[category], bytes, __ATOMIC_RELAXED);
+    ssize_t peak = __atomic_load_n(&gPeak[category], __ATOMIC_RELAXED);
+    while (held > peak && !__atomic_compare_exchange_n(&gPeak[category], &peak, held,
+            true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void checkpoint(const char* name)
+{
+    if (!gEnabled) {
+        return;
+    }
+    Checkpoint cp;
+    cp.name = name;
+    for (int i = 0; i < NUM_CATEGORIES; i++) {
+        cp.held[i] = __atomic_load_n(&gHeld[i], __ATOMIC_RELAXED);
+    }
+    cp.sharedBuffers = SharedBuffer::getAccountedBytes();
+    cp.rss = getRss();
+    cp.peakRss = getPeakRss();
+
+    AutoMutex _l(gLock);
+    gCheckpoints.push(cp);
+}
+
+void print(FILE* fp)
+{
+    AutoMutex _l(gLock);
+
+    // The utils buffers are the storage of every String8, String16 and
+    // Vector, so they include part of what the other columns count.
+    fprintf(fp, "Memory held after each stage, in MB (\"buffers\" are utils strings and vectors):\n");
+    fprintf(fp, "%-24s", "stage");
+    for (int i = 0; i < NUM_CATEGORIES; i++) {
+        fprintf(fp, " %9s", kCategoryNames[i]);
+    }
+    fprintf(fp, " %9s %9s %9s\n", "buffers", "rss", "peak rss");
+
+    for (size_t i = 0; i < gCheckpoints.size(); i++) {
+        const Checkpoint& cp = gCheckpoints[i];
+        fprintf(fp, "%-24s", cp.name);
+        for (int c = 0; c < NUM_CATEGORIES; c++) {
+            printMegabytes(fp, cp.held[c]);
+        }
+        printMegabytes(fp, cp.sharedBuffers);
+        printMegabytes(fp, cp.rss);
+        printMegabytes(fp, cp.peakRss);
+        fprintf(fp, "\n");
+    }
+
+    fprintf(fp, "%-24s", "(most held at once)");
+    for (int c = 0; c < NUM_CATEGORIES; c++) {
+        printMegabytes(fp, __atomic_load_n(&gPeak[c], __ATOMIC_RELAXED));
+    }
+    fprintf(fp, "\n");
+
+    SharedBuffer::PoolStats pool;
+    SharedBuffer::getPoolStats(&pool);
+    if (pool.allocs > 0) {
+        fprintf(fp, "Small buffer pool: %llu allocs, %llu frees, %llu refills, %.1f MB reserved\n",
+                (unsigned long long) pool.allocs, (unsigned long long) pool.frees,
+                (unsigned long long) pool.refills, pool.reservedBytes / (1024.0 * 1024.0));
+    }
+}
+
+size_t residentSize()
+{
+    return getRss();
+}
+
+size_t peakResidentSize()
+{
+    return getPeakRss();
+}
+
+} // namespace MemStats
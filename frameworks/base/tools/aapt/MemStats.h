@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef H_AAPT_MEM_STATS
+#define H_AAPT_MEM_STATS
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/*
+ * Counts the bytes held by aapt's largest structures, for --mem-stats.
+ * checkpoint() notes what each one holds at the end of a stage of the
+ * build, along with the process's resident size, and print() reports it.
+ *
+ * Nothing is counted until enable() is called, and until then add() costs
+ * one check.  Counts may be added from any thread.
+ */
+namespace MemStats {
+
+enum Category {
+    FILE_DATA,          // AaptFile contents
+    STRING_POOLS,       // StringPool entries and their characters
+    RESOURCE_TABLE,     // ResourceTable entries and bag items
+    XML_TREES,          // XMLNode nodes
+    NUM_CATEGORIES
+};
+
+// Starts counting.  Call before any of the structures are created, since
+// anything freed afterwards is taken off its count.
+void enable();
+bool isEnabled();
+
+void add(Category category, ssize_t bytes);
+
+// Notes the current counts, after the stage called "name".  "name" must be
+// a string literal.
+void checkpoint(const char* name);
+
+void print(FILE* fp);
+
+// The process's resident size now, and the most it has been, in bytes; 0
+// where they can't be read.  These work whether or not counting is enabled.
+size_t residentSize();
+size_t peakResidentSize();
+
+} // namespace MemStats
+
+/*
+ * The bytes one object holds in a category, taken off the count when the
+ * object is destroyed.  A copy holds (and counts) the same again.
+ */
+class MemAccount {
+public:
+    explicit MemAccount(MemStats::Category category) : mCategory(category), mBytes(0) { }
+    MemAccount(const MemAccount& o) : mCategory(o.mCategory), mBytes(0) { set(o.mBytes); }
+    ~MemAccount() { set(0); }
+
+    MemAccount& operator=(const MemAccount& o) {
+        set(o.mBytes);
+        return *this;
+    }
+
+    void add(ssize_t bytes) { set(mBytes + bytes); }
+
+    void set(size_t bytes) {
+        if (bytes != mBytes) {
+            MemStats::add(mCategory, (ssize_t)bytes - (ssize_t)mBytes);
+            mBytes = bytes;
+        }
+    }
+
+private:
+    MemStats::Category mCategory;
+    size_t mBytes;
+};
+
+#endif // H_AAPT_MEM_STATS
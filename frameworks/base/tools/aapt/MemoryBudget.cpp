@@ -0,0 +1,128 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Bounding the memory the work of a build holds at once.
+//
+
+#include "MemoryBudget.h"
+#include "Statistics.h"
+
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+#include <utils/String8.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+using namespace android;
+
+// Set before any thread reserves, so it is read without the lock.
+static size_t gLimit = 0;
+
+static Mutex gLock;
+static Condition gReleased;
+static size_t gReserved = 0;
+
+// Reads the number that makes up a cgroup control file, or 0 if it holds
+// "max" or can't be read.
+static size_t readLimitFile(const char* path)
+{
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+    unsigned long long value = 0;
+    if (fscanf(fp, "%llu", &value) != 1) {
+        value = 0;
+    }
+    fclose(fp);
+    // cgroup v1 reports no limit as the largest page-aligned value.
+    if (value >= (1ULL << 60) || value > SIZE_MAX) {
+        return 0;
+    }
+    return (size_t) value;
+}
+
+// Whether "bytes" more may be reserved.  Work larger than the whole limit
+// still runs, once nothing else is reserved.
+static bool fitsLocked(size_t bytes)
+{
+    return gReserved == 0 || (bytes <= gLimit && gReserved <= gLimit - bytes);
+}
+
+namespace MemoryBudget {
+
+void setLimit(size_t bytes)
+{
+    gLimit = bytes;
+}
+
+size_t getLimit()
+{
+    return gLimit;
+}
+
+size_t cgroupLimit()
+{
+#if defined(__linux__)
+    // cgroup v2: the "0::PATH" line names the group, which in a container
+    // is usually the root of what it sees.
+    FILE* fp = fopen("/proc/self/cgroup", "r");
+    if (fp != NULL) {
+        char line[1024];
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            if (strncmp(line, "0::", 3) != 0) {
+                continue;
+            }
+            String8 dir(line + 3);
+            dir.setTo(dir.string(), strcspn(dir.string(), "\n"));
+            String8 path("/sys/fs/cgroup");
+            path.appendPath(dir);
+            path.appendPath("memory.max");
+            const size_t limit = readLimitFile(path.string());
+            if (limit != 0) {
+                fclose(fp);
+                return limit;
+            }
+        }
+        fclose(fp);
+    }
+    size_t limit = readLimitFile("/sys/fs/cgroup/memory.max");
+    if (limit == 0) {
+        // cgroup v1
+        limit = readLimitFile("/sys/fs/cgroup/memory/memory.limit_in_bytes");
+    }
+    return limit;
+#else
+    return 0;
+#endif
+}
+
+void reserve(size_t bytes)
+{
+    if (gLimit == 0) {
+        return;
+    }
+    Statistics::add(Statistics::MEMORY_RESERVATIONS);
+    AutoMutex _l(gLock);
+    if (!fitsLocked(bytes)) {
+        Statistics::add(Statistics::MEMORY_WAITS);
+        do {
+            gReleased.wait(gLock);
+        } while (!fitsLocked(bytes));
+    }
+    gReserved += bytes;
+}
+
+void release(size_t bytes)
+{
+    if (gLimit == 0) {
+        return;
+    }
+    AutoMutex _l(gLock);
+    gReserved -= bytes;
+    gReleased.broadcast();
+}
+
+} // namespace MemoryBudget
@@ -0,0 +1,44 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Bounding the memory the work of a build holds at once.
+//
+
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <stddef.h>
+
+/*
+ * The budget of --max-memory.  Work estimated to need much memory, such
+ * as crunching an image or compiling an XML file, reserves it before it
+ * is scheduled and releases it when it is done, so that the threads are
+ * kept busy with as much work as fits in the budget rather than a fixed
+ * number of jobs.  The estimates only cover what the work holds while it
+ * runs, not what the build keeps, such as the resource table.
+ *
+ * Only the threads that schedule work wait in reserve(), never the work
+ * units themselves, so what is reserved is always held by work that can
+ * finish without waiting for more.
+ *
+ * Without a limit, reserve() and release() cost one check.
+ */
+namespace MemoryBudget {
+
+// Sets the bytes the reservations may add up to; 0 for no limit.  Call
+// before starting any threads that reserve.
+void setLimit(size_t bytes);
+size_t getLimit();
+
+// The memory limit of the cgroup aapt runs in, or 0 if it has none or the
+// host has no cgroups.
+size_t cgroupLimit();
+
+// Waits until "bytes" more fit in the limit, or until nothing else is
+// reserved, then reserves them.
+void reserve(size_t bytes);
+void release(size_t bytes);
+
+} // namespace MemoryBudget
+
+#endif // MEMORY_BUDGET_H
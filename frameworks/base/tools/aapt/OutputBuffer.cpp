@@ -0,0 +1,125 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Text generated into memory, a piece at a time.
+//
+
+#include "OutputBuffer.h"
+
+#include <stdlib.h>
+
+// Most pieces fit in this much room, so it is always there to format into.
+static const size_t kMinFree = 256;
+
+OutputBuffer::OutputBuffer()
+    : mData(NULL), mSize(0), mCapacity(0), mError(false)
+{
+}
+
+OutputBuffer::~OutputBuffer()
+{
+    free(mData);
+}
+
+bool OutputBuffer::reserve(size_t len)
+{
+    if (mCapacity - mSize > len) {
+        return true;
+    }
+    size_t capacity = mCapacity > 0 ? mCapacity : 4096;
+    while (capacity - mSize <= len) {
+        capacity *= 2;
+    }
+    char* data = (char*) realloc(mData, capacity);
+    if (data == NULL) {
+        mError = true;
+        return false;
+    }
+    mData = data;
+    mCapacity = capacity;
+    return true;
+}
+
+void OutputBuffer::append(const char* str, size_t len)
+{
+    if (!reserve(len)) {
+        return;
+    }
+    memcpy(mData + mSize, str, len);
+    mSize += len;
+    mData[mSize] = '\0';
+}
+
+void OutputBuffer::appendFormat(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    appendFormatV(fmt, args);
+    va_end(args);
+}
+
+void OutputBuffer::appendFormatV(const char* fmt, va_list args)
+{
+    if (!reserve(kMinFree)) {
+        return;
+    }
+    // Only a piece that didn't fit is formatted a second time.
+    va_list retryArgs;
+    va_copy(retryArgs, args);
+    const size_t room = mCapacity - mSize;
+    int n = vsnprintf(mData + mSize, room, fmt, args);
+    if (n >= 0 && (size_t) n >= room) {
+        if (reserve(n)) {
+            n = vsnprintf(mData + mSize, mCapacity - mSize, fmt, retryArgs);
+        } else {
+            n = -1;
+        }
+    }
+    va_end(retryArgs);
+    if (n < 0) {
+        mError = true;
+        mData[mSize] = '\0';
+        return;
+    }
+    mSize += n;
+}
+
+void OutputBuffer::appendDecimal(int32_t value)
+{
+    char buf[12];
+    char* p = buf + sizeof(buf);
+    // Negated as unsigned, so that INT32_MIN comes out right.
+    uint32_t magnitude = value < 0 ? 0u - (uint32_t) value : (uint32_t) value;
+    do {
+        *--p = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0) {
+        *--p = '-';
+    }
+    append(p, buf + sizeof(buf) - p);
+}
+
+void OutputBuffer::appendHex32(uint32_t value)
+{
+    static const char kDigits[] = "0123456789abcdef";
+    char buf[10];
+    buf[0] = '0';
+    buf[1] = 'x';
+    for (int i = 9; i >= 2; i--) {
+        buf[i] = kDigits[value & 0xf];
+        value >>= 4;
+    }
+    append(buf, sizeof(buf));
+}
+
+status_t OutputBuffer::writeTo(FILE* fp) const
+{
+    if (mError) {
+        return NO_MEMORY;
+    }
+    if (mSize > 0 && fwrite(mData, 1, mSize, fp) != mSize) {
+        return UNKNOWN_ERROR;
+    }
+    return NO_ERROR;
+}
@@ -0,0 +1,66 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Text generated into memory, a piece at a time.
+//
+
+#ifndef OUTPUT_BUFFER_H
+#define OUTPUT_BUFFER_H
+
+#include <utils/Errors.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+using namespace android;
+
+/*
+ * A growable buffer for the generated sources -- R.java, R.txt -- that are
+ * written as many small formatted pieces.  The buffer doubles as it fills,
+ * so appending rarely reallocates; a piece is formatted straight into the
+ * free space with a single vsnprintf() whenever it fits, and the integers
+ * the symbol writers emit by the thousand skip printf altogether.
+ *
+ * clear() keeps the memory, so one buffer can be reused for file after file.
+ * If memory runs out the buffer keeps what it has and reports the failure
+ * from hasError().
+ */
+class OutputBuffer {
+public:
+    OutputBuffer();
+    ~OutputBuffer();
+
+    void append(const char* str) { append(str, strlen(str)); }
+    void append(const char* str, size_t len);
+    void appendFormat(const char* fmt, ...) __attribute__((format (printf, 2, 3)));
+    void appendFormatV(const char* fmt, va_list args);
+
+    // The same as appendFormat("%d") and appendFormat("0x%08x").
+    void appendDecimal(int32_t value);
+    void appendHex32(uint32_t value);
+
+    const char* data() const { return mData; }
+    size_t size() const { return mSize; }
+    bool hasError() const { return mError; }
+
+    // Empties the buffer, but keeps its memory for what is appended next.
+    void clear() { mSize = 0; mError = false; }
+
+    // Writes everything appended so far to "fp".
+    status_t writeTo(FILE* fp) const;
+
+private:
+    OutputBuffer(const OutputBuffer&);
+    OutputBuffer& operator=(const OutputBuffer&);
+
+    // Makes room for "len" more bytes and a terminating NUL.
+    bool reserve(size_t len);
+
+    char* mData;
+    size_t mSize;
+    size_t mCapacity;
+    bool mError;
+};
+
+#endif // OUTPUT_BUFFER_H
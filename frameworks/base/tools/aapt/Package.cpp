@@ -5,12 +5,21 @@
 //
 #include "Main.h"
 #include "AaptAssets.h"
+#include "ApkDigests.h"
+#include "CompileCache.h"
+#include "FileCosts.h"
+#include "MappedFile.h"
 #include "OutputSet.h"
+#include "PhaseTrace.h"
 #include "ResourceTable.h"
 #include "ResourceFilter.h"
+#include "Statistics.h"
+#include "WorkQueue.h"
 
 #include <androidfw/misc.h>
 
+#include <utils/BasicHashtable.h>
+#include <utils/JenkinsHash.h>
 #include <utils/Log.h>
 #include <utils/threads.h>
 #include <utils/List.h>
@@ -18,14 +27,26 @@
 #include <utils/misc.h>
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <dirent.h>
 #include <ctype.h>
 #include <errno.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <vector>
 
 using namespace android;
 
 static const char* kExcludeExtension = ".EXCLUDE";
 
+/*
+ * With -u, entries that are replaced or removed leave their space unused
+ * until it adds up to this much of the archive; only then is the archive
+ * crunched, which moves every entry after the first hole.
+ */
+static const int kUpdateCrunchPercent = 25;
+
 /* these formats are already compressed, or don't compress well */
 static const char* kNoCompressExt[] = {
     ".jpg", ".jpeg", ".png", ".gif",
@@ -36,10 +57,32 @@ static const char* kNoCompressExt[] = {
     ".amr", ".awb", ".wma", ".wmv"
 };
 
+/*
+ * Source files larger than this, in bytes, have their first
+ * kCompressSampleSize bytes deflated before the whole file is, and are
+ * stored if that sample doesn't deflate enough to be worth it.  Smaller
+ * files are simply deflated, which costs little more than the sample.
+ */
+static const off_t kCompressSampleMinSize = 64 * 1024;
+static const size_t kCompressSampleSize = 16 * 1024;
+
+/*
+ * Files smaller than this, in bytes, are not kept deflated in the
+ * --resource-cache.
+ */
+static const size_t kDeflateCacheMinSize = 4 * 1024;
+
+class DeflateCache;
+
 /* fwd decls, so I can write this downward */
-ssize_t processAssets(Bundle* bundle, ZipFile* zip, const sp<const OutputSet>& outputSet);
-bool processFile(Bundle* bundle, ZipFile* zip, String8 storageName, const sp<const AaptFile>& file);
+static status_t writeAPK(Bundle* bundle, const String8& outputFile,
+                         const sp<OutputSet>& outputSet, DeflateCache* cache);
+ssize_t processAssets(Bundle* bundle, ZipFile* zip, const sp<const OutputSet>& outputSet,
+                      DeflateCache* cache);
+bool processFile(Bundle* bundle, ZipFile* zip, String8 storageName, const sp<const AaptFile>& file,
+                 DeflateCache* cache);
 bool okayToCompress(Bundle* bundle, const String8& pathName);
+int getCompressionLevel(Bundle* bundle, const String8& pathName);
 ssize_t processJarFiles(Bundle* bundle, ZipFile* zip);
 
 /*
@@ -51,6 +94,18 @@ ssize_t processJarFiles(Bundle* bundle, ZipFile* zip);
  */
 status_t writeAPK(Bundle* bundle, const String8& outputFile, const sp<OutputSet>& outputSet)
 {
+    return writeAPK(bundle, outputFile, outputSet, NULL);
+}
+
+/*
+ * Like writeAPK() above.  If "cache" is non-NULL, it holds the files other
+ * archives share.
+ */
+static status_t writeAPK(Bundle* bundle, const String8& outputFile,
+                         const sp<OutputSet>& outputSet, DeflateCache* cache)
+{
+    PhaseSpan span("writeAPK", outputFile);
+
     #if BENCHMARK
     fprintf(stdout, "BENCHMARK: Starting APK Bundling \n");
     long startAPKTime = clock();
@@ -70,8 +125,9 @@ status_t writeAPK(Bundle* bundle, const String8& outputFile, const sp<OutputSet>
      * Else, if "force" is set, remove the existing archive.
      */
     FileType fileType = getFileType(outputFile.string());
-    if (fileType == kFileTypeNonexistent) {
-        // okay, create it below
+    const bool toPipe = fileType == kFileTypeFifo || fileType == kFileTypeCharDev;
+    if (fileType == kFileTypeNonexistent || toPipe) {
+        // okay, create it below, or stream it to the pipe
     } else if (fileType == kFileTypeRegular) {
         if (bundle->getUpdate()) {
             // okay, open it below
@@ -97,19 +153,35 @@ status_t writeAPK(Bundle* bundle, const String8& outputFile, const sp<OutputSet>
     }
 
     status_t status;
+    int openFlags;
+    openFlags = ZipFile::kOpenReadWrite | ZipFile::kOpenCreate;
+    if (fileType == kFileTypeNonexistent || !bundle->getUpdate()) {
+        // Nothing to update, so write the archive front to back in one pass.
+        openFlags |= ZipFile::kOpenTruncate | ZipFile::kOpenStreaming;
+    }
+    if (toPipe) {
+        openFlags |= ZipFile::kOpenPipe;
+    } else if ((openFlags & ZipFile::kOpenStreaming) && bundle->getJobs() > 1) {
+        // Large stored files, the media of big APKs, are copied in by the
+        // shared queue while the next entries are prepared.
+        openFlags |= ZipFile::kOpenParallel;
+    }
     zip = new ZipFile;
-    status = zip->open(outputFile.string(), ZipFile::kOpenReadWrite | ZipFile::kOpenCreate);
+    status = zip->open(outputFile.string(), openFlags);
     if (status != NO_ERROR) {
         fprintf(stderr, "ERROR: unable to open '%s' as Zip file for writing\n",
                 outputFile.string());
         goto bail;
     }
+    if (bundle->getUpdate()) {
+        zip->setCrunchThreshold(kUpdateCrunchPercent);
+    }
 
     if (bundle->getVerbose()) {
         printf("Writing all files...\n");
     }
 
-    count = processAssets(bundle, zip, outputSet);
+    count = processAssets(bundle, zip, outputSet, cache);
     if (count < 0) {
         fprintf(stderr, "ERROR: unable to process assets while packaging '%s'\n",
                 outputFile.string());
@@ -167,7 +239,7 @@ status_t writeAPK(Bundle* bundle, const String8& outputFile, const sp<OutputSet>
     }
 
     /* anything here? */
-    if (zip->getNumEntries() == 0) {
+    if (zip->getNumEntries() == 0 && !toPipe) {
         if (bundle->getVerbose()) {
             printf("Archive is empty -- removing %s\n", outputFile.getPathLeaf().string());
         }
@@ -178,6 +250,23 @@ status_t writeAPK(Bundle* bundle, const String8& outputFile, const sp<OutputSet>
         }
     }
 
+    // Digests for the signer, written next to the archive, e.g.
+    // bin/resources.ap_.digests.
+    if (zip != NULL && bundle->getEntryDigests()) {
+        result = ApkDigests::writeEntryDigests(zip, outputFile + ".digests");
+        if (result != NO_ERROR) {
+            goto bail;
+        }
+    }
+    if (zip != NULL && bundle->getV2Digests()) {
+        delete zip;        // the file is read back once it's complete
+        zip = NULL;
+        result = ApkDigests::writeV2Digests(outputFile, outputFile + ".v2digests");
+        if (result != NO_ERROR) {
+            goto bail;
+        }
+    }
+
     // If we've been asked to generate a dependency file for the .ap_ package,
     // do so here
     if (bundle->getGenDependencies()) {
@@ -215,8 +304,294 @@ bail:
     return result;
 }
 
-ssize_t processAssets(Bundle* bundle, ZipFile* zip, const sp<const OutputSet>& outputSet)
+/*
+ * What prepareFile() decided to do with a file.
+ */
+enum {
+    kAddFile,       // add it to the archive
+    kSkipFile,      // leave it out, or keep the copy already in the archive
+    kFileError,     // fail the package
+};
+
+/*
+ * A file's data, compressed ahead of time by deflateFile().
+ */
+struct DeflatedData : public RefBase {
+    DeflatedData() : status(NO_ERROR), uncompressedLen(0), crc(0), hasSha256(false) { }
+
+    status_t status;
+    Vector<unsigned char> compressed;
+    long uncompressedLen;
+    unsigned long crc;
+
+    // With --entry-digests, the SHA-256 of the file.
+    bool hasSha256;
+    uint8_t sha256[SHA256_DIGEST_SIZE];
+};
+
+static void compressFile(const sp<const AaptFile>& file, int level, DeflatedData* out)
+{
+    FileCostSpan cost(FileCosts::COMPRESS, file->getPrintableSource());
+    if (file->hasData()) {
+        out->status = ZipFile::compressData(NULL, file->getData(), file->getSize(),
+                level, &out->compressed, &out->uncompressedLen, &out->crc);
+    } else {
+        out->status = ZipFile::compressData(file->getSourceFile().string(), NULL, 0,
+                level, &out->compressed, &out->uncompressedLen, &out->crc);
+    }
+    cost.setInputBytes(out->uncompressedLen);
+    cost.setOutputBytes(out->compressed.size());
+}
+
+/*
+ * What the --resource-cache keeps of a deflated file, ahead of the
+ * compressed bytes.  The cache is local, so this is in host order.
+ */
+struct CachedDeflateHeader {
+    uint32_t crc;
+    uint32_t uncompressedLen;
+};
+
+/*
+ * Sets "outDigest" to the --resource-cache key of "file" deflated at
+ * "level".  Returns false for small files, which are deflated about as
+ * quickly as their entry can be read back, and files that can't be read.
+ */
+static bool deflatedDigest(const sp<const AaptFile>& file, int level, String8* outDigest)
+{
+    CompileCache::Key key("deflate-v1");
+    key.add(ZLIB_VERSION);
+    key.add((int32_t) level);
+    if (file->hasData()) {
+        if (file->getSize() < kDeflateCacheMinSize) {
+            return false;
+        }
+        key.add(file->getData(), file->getSize());
+    } else {
+        struct stat st;
+        if (stat(file->getSourceFile().string(), &st) != 0
+                || st.st_size < (off_t) kDeflateCacheMinSize
+                || key.addFile(file->getSourceFile()) != NO_ERROR) {
+            return false;
+        }
+    }
+    *outDigest = key.digest();
+    return true;
+}
+
+static bool getCachedDeflate(const CompileCache& cache, const String8& digest,
+                             DeflatedData* out)
+{
+    const String8 path(cache.find(digest));
+    MappedFile entry;
+    if (path.isEmpty() || entry.open(path.string()) != NO_ERROR
+            || entry.getSize() < sizeof(CachedDeflateHeader)) {
+        return false;
+    }
+    CachedDeflateHeader header;
+    memcpy(&header, entry.getData(), sizeof(header));
+    out->status = NO_ERROR;
+    out->crc = header.crc;
+    out->uncompressedLen = header.uncompressedLen;
+    out->compressed.clear();
+    out->compressed.appendArray((const unsigned char*) entry.getData() + sizeof(header),
+            entry.getSize() - sizeof(header));
+    return true;
+}
+
+static void putCachedDeflate(const CompileCache& cache, const String8& digest,
+                             const DeflatedData& data)
+{
+    CachedDeflateHeader header;
+    header.crc = (uint32_t) data.crc;
+    header.uncompressedLen = (uint32_t) data.uncompressedLen;
+    Vector<unsigned char> entry;
+    entry.setCapacity(sizeof(header) + data.compressed.size());
+    entry.appendArray((const unsigned char*) &header, sizeof(header));
+    entry.appendVector(data.compressed);
+    // A failure to store it only costs the next build a deflate.
+    cache.put(digest, entry.array(), entry.size());
+}
+
+/*
+ * Deflates "file" at "level" into "out", or with --resource-cache, reads
+ * back what an earlier build stored for the same bytes, so that an
+ * incremental build only deflates the files that changed.
+ */
+static void deflateFile(Bundle* bundle, const sp<const AaptFile>& file, int level,
+                        DeflatedData* out)
+{
+    // Hashed here, on the work thread, rather than by the writer.
+    if (bundle->getEntryDigests()) {
+        out->hasSha256 = ApkDigests::hashFile(file, out->sha256);
+    }
+
+    String8 digest;
+    if (bundle->getResourceCacheDir() == NULL || !deflatedDigest(file, level, &digest)) {
+        compressFile(file, level, out);
+        return;
+    }
+
+    // Deflating is quicker than fetching the result from a server.
+    const CompileCache cache(bundle->getResourceCacheDir(), false);
+    if (getCachedDeflate(cache, digest, out)) {
+        Statistics::add(Statistics::DEFLATE_CACHE_HITS);
+        return;
+    }
+    Statistics::add(Statistics::DEFLATE_CACHE_MISSES);
+    compressFile(file, level, out);
+    if (out->status == NO_ERROR) {
+        putCachedDeflate(cache, digest, *out);
+    }
+}
+
+/*
+ * Compressed copies of the files that go into more than one of the
+ * archives written by writeAPKs(), so that each is deflated only once.
+ * Every archive that will ask for a file is counted up front by
+ * addUsers(), and a copy is dropped once the last of them has taken it.
+ */
+class DeflateCache {
+public:
+    /* Counts the files that "outputSet" will ask for. */
+    void addUsers(Bundle* bundle, const sp<const OutputSet>& outputSet);
+
+    /*
+     * Returns "file" deflated at "level", compressing it on this thread
+     * unless another archive already has, or is waiting for the thread
+     * that is.  Returns NULL for a file that no other archive wants; the
+     * caller compresses that itself.
+     */
+    sp<DeflatedData> take(Bundle* bundle, const sp<const AaptFile>& file, int level);
+
+private:
+    struct Key {
+        Key() : file(NULL), level(0) { }
+        Key(const AaptFile* f, int l) : file(f), level(l) { }
+
+        bool operator<(const Key& o) const {
+            return file != o.file ? file < o.file : level < o.level;
+        }
+
+        const AaptFile* file;
+        int level;
+    };
+
+    struct Slot {
+        Slot() : users(0), busy(false) { }
+
+        size_t users;   // archives that have yet to take the data
+        bool busy;      // a thread is compressing the file
+        sp<DeflatedData> data;
+    };
+
+    sp<DeflatedData> takeLocked(const Key& key);
+
+    Mutex mLock;
+    Condition mCondition;
+    KeyedVector<Key, Slot> mSlots;
+};
+
+/*
+ * A file that has been checked by prepareFile() and is waiting to be added
+ * to the archive.  If "deflate" is set, its data is compressed by a work
+ * thread before the writer gets to it.
+ */
+struct AddFileJob {
+    AddFileJob(const String8& name, const sp<const AaptFile>& f, bool gzip, bool deflate,
+               int level)
+        : storageName(name), file(f), fromGzip(gzip), deflate(deflate), level(level),
+          scheduled(false), done(false) { }
+
+    String8 storageName;
+    sp<const AaptFile> file;
+    bool fromGzip;
+    bool deflate;
+    int level;
+    bool scheduled;
+
+    // Filled in by CompressFileWorkUnit.
+    bool done;
+    sp<DeflatedData> deflated;
+};
+
+/*
+ * Lets the writer wait for the compression of one particular file.
+ */
+class AddFileTracker {
+public:
+    AddFileTracker() : mAbandoned(false) { }
+
+    /* Tells the units not yet started that the writer gave up. */
+    void abandon() { mAbandoned = true; }
+    bool isAbandoned() const { return mAbandoned; }
+
+    void markDone(AddFileJob* job) {
+        AutoMutex _l(mLock);
+        job->done = true;
+        mCondition.broadcast();
+    }
+
+    void waitFor(AddFileJob* job) {
+        AutoMutex _l(mLock);
+        while (!job->done) {
+            mCondition.wait(mLock);
+        }
+    }
+
+private:
+    Mutex mLock;
+    Condition mCondition;
+    volatile bool mAbandoned;
+};
+
+class CompressFileWorkUnit : public WorkQueue::WorkUnit {
+public:
+    CompressFileWorkUnit(Bundle* bundle, AddFileJob* job, AddFileTracker* tracker,
+                         DeflateCache* cache) :
+            mBundle(bundle), mJob(job), mTracker(tracker), mCache(cache) {
+    }
+
+    virtual bool run() {
+        if (mTracker->isAbandoned()) {
+            mTracker->markDone(mJob);
+            return true;
+        }
+        PhaseSpan span("deflate", mJob->storageName);
+        if (mJob->file->hasData()) {
+            span.setBytes(mJob->file->getSize());
+        }
+        sp<DeflatedData> deflated;
+        if (mCache != NULL) {
+            deflated = mCache->take(mBundle, mJob->file, mJob->level);
+        }
+        if (deflated == NULL) {
+            deflated = new DeflatedData();
+            deflateFile(mBundle, mJob->file, mJob->level, deflated.get());
+        }
+        mJob->deflated = deflated;
+        mTracker->markDone(mJob);
+        return true; // the writer reports errors in order
+    }
+
+private:
+    Bundle* mBundle;
+    AddFileJob* mJob;
+    AddFileTracker* mTracker;
+    DeflateCache* mCache;
+};
+
+static ssize_t processAssetsParallel(Bundle* bundle, ZipFile* zip,
+                                     const sp<const OutputSet>& outputSet,
+                                     DeflateCache* cache);
+
+ssize_t processAssets(Bundle* bundle, ZipFile* zip, const sp<const OutputSet>& outputSet,
+                      DeflateCache* cache)
 {
+    if (bundle->getJobs() > 1) {
+        return processAssetsParallel(bundle, zip, outputSet, cache);
+    }
+
     ssize_t count = 0;
     const std::set<OutputEntry>& entries = outputSet->getEntries();
     std::set<OutputEntry>::const_iterator iter = entries.begin();
@@ -227,7 +602,7 @@ ssize_t processAssets(Bundle* bundle, ZipFile* zip, const sp<const OutputSet>& o
         } else {
             String8 storagePath(entry.getPath());
             storagePath.convertToResPath();
-            if (!processFile(bundle, zip, storagePath, entry.getFile())) {
+            if (!processFile(bundle, zip, storagePath, entry.getFile(), cache)) {
                 return UNKNOWN_ERROR;
             }
             count++;
@@ -236,20 +611,219 @@ ssize_t processAssets(Bundle* bundle, ZipFile* zip, const sp<const OutputSet>& o
     return count;
 }
 
+// Guards gSampled.
+static Mutex gSampleLock;
+
+// The outcome of sampleCompresses() for each source file it has looked at,
+// since every archive of a build asks about the same files, often twice.
+// A daemon keeps it between builds, so it notes which version of the file
+// it is for.
+struct SampledFile {
+    SampledFile() : size(0), modWhen(0), compresses(true) { }
+
+    off_t size;
+    time_t modWhen;
+    bool compresses;
+};
+static KeyedVector<String8, SampledFile>* gSampled = NULL;
+
 /*
- * Process a regular file, adding it to the archive if appropriate.
+ * Returns false if "path" is a large file whose kCompressSampleSize first
+ * bytes don't deflate enough at "level" for the file to be stored
+ * deflated, typically media or archives whose extension isn't one of
+ * kNoCompressExt.  Such a file would almost always be deflated in full
+ * only for add() to throw the result away.  The answer depends only on
+ * the file's contents, so the archive doesn't depend on what else is in
+ * it or in which order the files are added.
+ */
+static bool sampleCompresses(const String8& path, int level)
+{
+    struct stat st;
+    if (stat(path.string(), &st) != 0 || st.st_size <= kCompressSampleMinSize) {
+        return true;
+    }
+
+    {
+        AutoMutex _l(gSampleLock);
+        if (gSampled == NULL) {
+            gSampled = new KeyedVector<String8, SampledFile>();
+        }
+        ssize_t index = gSampled->indexOfKey(path);
+        if (index >= 0 && gSampled->valueAt(index).size == st.st_size
+                && gSampled->valueAt(index).modWhen == st.st_mtime) {
+            return gSampled->valueAt(index).compresses;
+        }
+    }
+
+    // A file that can't be read leaves it to add() to report.
+    SampledFile sampled;
+    sampled.size = st.st_size;
+    sampled.modWhen = st.st_mtime;
+    FILE* fp = fopen(path.string(), "rb");
+    if (fp != NULL) {
+        unsigned char buf[kCompressSampleSize];
+        const size_t count = fread(buf, 1, sizeof(buf), fp);
+        fclose(fp);
+        Vector<unsigned char> compressed;
+        long uncompressedLen;
+        unsigned long crc;
+        if (count == sizeof(buf)
+                && ZipFile::compressData(NULL, buf, count, level, &compressed,
+                        &uncompressedLen, &crc) == NO_ERROR) {
+            sampled.compresses = ZipFile::isCompressedEnough(uncompressedLen,
+                    compressed.size());
+        }
+    }
+    if (!sampled.compresses) {
+        Statistics::add(Statistics::ZIP_SAMPLED_STORED);
+    }
+
+    AutoMutex _l(gSampleLock);
+    gSampled->replaceValueFor(path, sampled);
+    return sampled.compresses;
+}
+
+/*
+ * Returns the compression method to add a file with, unless it comes from
+ * a .gz file.
+ */
+static int getFileCompressionMethod(Bundle* bundle, const String8& storageName,
+                                    const sp<const AaptFile>& file)
+{
+    if (file->hasData()) {
+        return file->getCompressionMethod();
+    }
+    /* don't compress certain files, e.g. PNGs */
+    if (!okayToCompress(bundle, storageName)) {
+        return ZipEntry::kCompressStored;
+    }
+    const int method = bundle->getCompressionMethod();
+    if (method == ZipEntry::kCompressDeflated
+            && !sampleCompresses(file->getSourceFile(),
+                    getCompressionLevel(bundle, storageName))) {
+        return ZipEntry::kCompressStored;
+    }
+    return method;
+}
+
+/*
+ * Returns true if addFile() is to deflate a file that prepareFile() has
+ * accepted.
+ */
+static bool isDeflatedFile(Bundle* bundle, const String8& storageName,
+                           const sp<const AaptFile>& file, bool fromGzip)
+{
+    return !fromGzip && getFileCompressionMethod(bundle, storageName, file)
+            == ZipEntry::kCompressDeflated;
+}
+
+/*
+ * Returns the boundary the data of "storageName" should start on if it is
+ * stored uncompressed: zipalign's 4 bytes, or a page for shared libraries
+ * so that they can be mapped straight out of the APK.
+ */
+static int getFileAlignment(Bundle* bundle, const String8& storageName)
+{
+    if (!bundle->getZipAlign()) {
+        return 0;
+    }
+    if (strcasecmp(storageName.getPathExtension().string(), ".so") == 0) {
+        return 4096;
+    }
+    return 4;
+}
+
+/*
+ * Returns true if "entry" already holds exactly the generated data in
+ * "file", stored the way add() would store it now, at "alignment".
+ */
+static bool isUnchangedEntry(ZipFile* zip, ZipEntry* entry, const sp<const AaptFile>& file,
+                             int alignment)
+{
+    if ((size_t) entry->getUncompressedLen() != file->getSize()) {
+        return false;
+    }
+    if (entry->getCompressionMethod() == ZipEntry::kCompressStored && alignment > 0
+            && entry->getFileOffset() % alignment != 0) {
+        return false;
+    }
+    // add() falls back to storing data that doesn't compress, so a stored
+    // entry is also what a deflated request would produce.
+    if (entry->getCompressionMethod() != file->getCompressionMethod()
+            && entry->getCompressionMethod() != ZipEntry::kCompressStored) {
+        return false;
+    }
+    unsigned long crc = crc32(0L, Z_NULL, 0);
+    if (file->getSize() > 0) {
+        crc = crc32(crc, (const Bytef*) file->getData(), file->getSize());
+    }
+    if (crc != entry->getCRC32()) {
+        return false;
+    }
+
+    // The CRC matched, so this is almost certainly the same data, and
+    // expanding it is still far cheaper than compressing it again.
+    void* data = zip->uncompress(entry);
+    if (data == NULL) {
+        return false;
+    }
+    bool same = memcmp(data, file->getData(), file->getSize()) == 0;
+    free(data);
+    return same;
+}
+
+/*
+ * Like isUnchangedEntry(), for a file that is read from disk when it is
+ * added.  The file is compared by size and CRC-32, which the archive
+ * records for its entries, so the entry's data is not read at all.
+ */
+static bool isUnchangedSourceEntry(Bundle* bundle, ZipEntry* entry, const String8& storageName,
+                                   const sp<const AaptFile>& file)
+{
+    struct stat st;
+    if (stat(file->getSourceFile().string(), &st) != 0
+            || st.st_size != entry->getUncompressedLen()) {
+        return false;
+    }
+    const int alignment = getFileAlignment(bundle, storageName);
+    if (entry->getCompressionMethod() == ZipEntry::kCompressStored && alignment > 0
+            && entry->getFileOffset() % alignment != 0) {
+        return false;
+    }
+    if (entry->getCompressionMethod() != getFileCompressionMethod(bundle, storageName, file)
+            && entry->getCompressionMethod() != ZipEntry::kCompressStored) {
+        return false;
+    }
+
+    FILE* fp = fopen(file->getSourceFile().string(), "rb");
+    if (fp == NULL) {
+        return false;
+    }
+    unsigned char buf[32768];
+    unsigned long crc = crc32(0L, Z_NULL, 0);
+    size_t count;
+    while ((count = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        crc = crc32(crc, buf, count);
+    }
+    const bool readAll = !ferror(fp);
+    fclose(fp);
+    return readAll && crc == entry->getCRC32();
+}
+
+/*
+ * Decide whether a regular file should be added to the archive.  On return
+ * "storageName" and "fromGzip" describe how to add it.
  *
  * If we're in "update" mode, and the file already exists in the archive,
- * delete the existing entry before adding the new one.
+ * delete the existing entry so the new one can be added.
  */
-bool processFile(Bundle* bundle, ZipFile* zip,
-                 String8 storageName, const sp<const AaptFile>& file)
+static int prepareFile(Bundle* bundle, ZipFile* zip, String8* storageName,
+                       const sp<const AaptFile>& file, bool* fromGzip)
 {
     const bool hasData = file->hasData();
 
     ZipEntry* entry;
-    bool fromGzip = false;
-    status_t result;
+    *fromGzip = false;
 
     /*
      * See if the filename ends in ".EXCLUDE".  We can't use
@@ -264,77 +838,146 @@ bool processFile(Bundle* bundle, ZipFile* zip,
      * should clean this up, but I'm in here getting rid of Path Name, and I
      * don't want to make other potentially breaking changes --joeo
      */
-    int fileNameLen = storageName.length();
+    int fileNameLen = storageName->length();
     int excludeExtensionLen = strlen(kExcludeExtension);
     if (fileNameLen > excludeExtensionLen
-            && (0 == strcmp(storageName.string() + (fileNameLen - excludeExtensionLen),
+            && (0 == strcmp(storageName->string() + (fileNameLen - excludeExtensionLen),
                             kExcludeExtension))) {
-        fprintf(stderr, "warning: '%s' not added to Zip\n", storageName.string());
-        return true;
+        fprintf(stderr, "warning: '%s' not added to Zip\n", storageName->string());
+        return kSkipFile;
     }
 
-    if (strcasecmp(storageName.getPathExtension().string(), ".gz") == 0) {
-        fromGzip = true;
-        storageName = storageName.getBasePath();
+    if (strcasecmp(storageName->getPathExtension().string(), ".gz") == 0) {
+        *fromGzip = true;
+        *storageName = storageName->getBasePath();
     }
 
     if (bundle->getUpdate()) {
-        entry = zip->getEntryByName(storageName.string());
+        entry = zip->getEntryByName(storageName->string());
         if (entry != NULL) {
             /* file already exists in archive; there can be only one */
             if (entry->getMarked()) {
                 fprintf(stderr,
                         "ERROR: '%s' exists twice (check for with & w/o '.gz'?)\n",
                         file->getPrintableSource().string());
-                return false;
+                return kFileError;
             }
             if (!hasData) {
                 const String8& srcName = file->getSourceFile();
                 time_t fileModWhen;
                 fileModWhen = getFileModDate(srcName.string());
                 if (fileModWhen == (time_t) -1) { // file existence tested earlier,
-                    return false;                 //  not expecting an error here
+                    return kFileError;            //  not expecting an error here
                 }
     
-                if (fileModWhen > entry->getModWhen()) {
+                // A newer file, or one whose size changed, usually has new
+                // contents, but one that was only touched or rewritten as
+                // it was (a checkout, a clean build) is left alone.
+                struct stat st;
+                const bool resized = !*fromGzip && stat(srcName.string(), &st) == 0
+                        && st.st_size != entry->getUncompressedLen();
+                if (fileModWhen > entry->getModWhen() || resized) {
+                    if (!*fromGzip && !resized
+                            && isUnchangedSourceEntry(bundle, entry, *storageName, file)) {
+                        if (bundle->getVerbose()) {
+                            printf("      (not updating unchanged '%s')\n",
+                                    storageName->string());
+                        }
+                        entry->setMarked(true);
+                        return kSkipFile;
+                    }
+
                     // mark as deleted so add() will succeed
                     if (bundle->getVerbose()) {
-                        printf("      (removing old '%s')\n", storageName.string());
+                        printf("      (removing old '%s')\n", storageName->string());
                     }
-    
+
                     zip->remove(entry);
                 } else {
                     // version in archive is newer
                     if (bundle->getVerbose()) {
-                        printf("      (not updating '%s')\n", storageName.string());
+                        printf("      (not updating '%s')\n", storageName->string());
                     }
                     entry->setMarked(true);
-                    return true;
+                    return kSkipFile;
                 }
+            } else if (isUnchangedEntry(zip, entry, file,
+                    getFileAlignment(bundle, *storageName))) {
+                // Leave the existing copy alone rather than compressing
+                // the same bytes again.
+                if (bundle->getVerbose()) {
+                    printf("      (not updating unchanged '%s')\n", storageName->string());
+                }
+                entry->setMarked(true);
+                return kSkipFile;
             } else {
-                // Generated files are always replaced.
+                // Generated files are otherwise always replaced.
                 zip->remove(entry);
             }
         }
     }
 
+    return kAddFile;
+}
+
+/*
+ * Add a file accepted by prepareFile() to the archive.  If "deflated" is
+ * non-NULL, it holds the file's data compressed ahead of time, which is
+ * written instead of compressing the file here.
+ */
+static bool addFile(Bundle* bundle, ZipFile* zip, const String8& storageName,
+                    const sp<const AaptFile>& file, bool fromGzip,
+                    const DeflatedData* deflated)
+{
+    const bool hasData = file->hasData();
+
+    ZipEntry* entry;
+    status_t result;
+
     //android_setMinPriority(NULL, ANDROID_LOG_VERBOSE);
 
-    if (fromGzip) {
+    // With --resource-cache, files are deflated through it here too, so
+    // that what an earlier build deflated is simply copied in.
+    sp<DeflatedData> local;
+    if (deflated == NULL && bundle->getResourceCacheDir() != NULL
+            && isDeflatedFile(bundle, storageName, file, fromGzip)) {
+        local = new DeflatedData();
+        deflateFile(bundle, file, getCompressionLevel(bundle, storageName), local.get());
+        deflated = local.get();
+    }
+
+    // Data that failed to compress, or did not compress enough, is stored,
+    // just as add() would have done.
+    bool useDeflated = deflated != NULL && deflated->status == NO_ERROR
+            && ZipFile::isCompressedEnough(deflated->uncompressedLen,
+                    deflated->compressed.size());
+    int compressionMethod = (deflated != NULL) ? (int) ZipEntry::kCompressStored
+            : getFileCompressionMethod(bundle, storageName, file);
+
+    if (useDeflated) {
+        result = zip->addCompressed(hasData ? NULL : file->getSourceFile().string(),
+                deflated->compressed.array(), deflated->compressed.size(),
+                deflated->uncompressedLen, deflated->crc, storageName.string(), &entry);
+    } else if (fromGzip) {
         result = zip->addGzip(file->getSourceFile().string(), storageName.string(), &entry);
     } else if (!hasData) {
-        /* don't compress certain files, e.g. PNGs */
-        int compressionMethod = bundle->getCompressionMethod();
-        if (!okayToCompress(bundle, storageName)) {
-            compressionMethod = ZipEntry::kCompressStored;
-        }
         result = zip->add(file->getSourceFile().string(), storageName.string(), compressionMethod,
-                            &entry);
+                            getCompressionLevel(bundle, storageName),
+                            getFileAlignment(bundle, storageName), &entry);
     } else {
         result = zip->add(file->getData(), file->getSize(), storageName.string(),
-                           file->getCompressionMethod(), &entry);
+                           compressionMethod, getCompressionLevel(bundle, storageName),
+                           getFileAlignment(bundle, storageName), &entry);
     }
     if (result == NO_ERROR) {
+        if (entry->getCompressionMethod() == ZipEntry::kCompressStored) {
+            Statistics::add(Statistics::ZIP_STORED_ENTRIES);
+            Statistics::add(Statistics::ZIP_STORED_BYTES, entry->getUncompressedLen());
+        } else {
+            Statistics::add(Statistics::ZIP_DEFLATED_ENTRIES);
+            Statistics::add(Statistics::ZIP_DEFLATED_BYTES_IN, entry->getUncompressedLen());
+            Statistics::add(Statistics::ZIP_DEFLATED_BYTES_OUT, entry->getCompressedLen());
+        }
         if (bundle->getVerbose()) {
             printf("      '%s'%s", storageName.string(), fromGzip ? " (from .gz)" : "");
             if (entry->getCompressionMethod() == ZipEntry::kCompressStored) {
@@ -344,6 +987,15 @@ bool processFile(Bundle* bundle, ZipFile* zip,
                             entry->getCompressedLen()));
             }
         }
+        if (bundle->getEntryDigests()) {
+            // Files from .gz are left to writeEntryDigests() to expand.
+            uint8_t sha256[SHA256_DIGEST_SIZE];
+            if (deflated != NULL && deflated->hasSha256) {
+                entry->setSha256(deflated->sha256);
+            } else if (!fromGzip && ApkDigests::hashFile(file, sha256)) {
+                entry->setSha256(sha256);
+            }
+        }
         entry->setMarked(true);
     } else {
         if (result == ALREADY_EXISTS) {
@@ -359,6 +1011,268 @@ bool processFile(Bundle* bundle, ZipFile* zip,
     return true;
 }
 
+/*
+ * Process a regular file, adding it to the archive if appropriate.
+ *
+ * If we're in "update" mode, and the file already exists in the archive,
+ * delete the existing entry before adding the new one.
+ */
+bool processFile(Bundle* bundle, ZipFile* zip,
+                 String8 storageName, const sp<const AaptFile>& file, DeflateCache* cache)
+{
+    bool fromGzip;
+    int action = prepareFile(bundle, zip, &storageName, file, &fromGzip);
+    if (action != kAddFile) {
+        return action == kSkipFile;
+    }
+    sp<DeflatedData> deflated;
+    if (cache != NULL && isDeflatedFile(bundle, storageName, file, fromGzip)) {
+        deflated = cache->take(bundle, file, getCompressionLevel(bundle, storageName));
+    }
+    return addFile(bundle, zip, storageName, file, fromGzip, deflated.get());
+}
+
+/*
+ * Like the serial loop in processAssets(), but entries that need deflating
+ * are compressed into memory on the shared WorkQueue, which several archives
+ * being written at once use together, while this thread appends the
+ * finished entries to the archive in their original order.  Only a window
+ * of entries ahead of the writer is in flight, which bounds the memory
+ * held by compressed data.
+ */
+static ssize_t processAssetsParallel(Bundle* bundle, ZipFile* zip,
+                                     const sp<const OutputSet>& outputSet,
+                                     DeflateCache* cache)
+{
+    Vector<AddFileJob*> jobs;
+    const std::set<OutputEntry>& entries = outputSet->getEntries();
+    std::set<OutputEntry>::const_iterator iter = entries.begin();
+    for (; iter != entries.end(); iter++) {
+        const OutputEntry& entry = *iter;
+        if (entry.getFile() == NULL) {
+            fprintf(stderr, "warning: null file being processed.\n");
+            continue;
+        }
+        String8 storagePath(entry.getPath());
+        storagePath.convertToResPath();
+        bool fromGzip;
+        int action = prepareFile(bundle, zip, &storagePath, entry.getFile(), &fromGzip);
+        if (action == kFileError) {
+            for (size_t i = 0; i < jobs.size(); i++) {
+                delete jobs[i];
+            }
+            return UNKNOWN_ERROR;
+        }
+        // Skipped files still count, as they do in the serial loop.
+        AddFileJob* job = NULL;
+        if (action == kAddFile) {
+            bool deflate = isDeflatedFile(bundle, storagePath, entry.getFile(), fromGzip);
+            job = new AddFileJob(storagePath, entry.getFile(), fromGzip, deflate,
+                    getCompressionLevel(bundle, storagePath));
+        }
+        jobs.add(job);       // skipped files still count, as in the serial loop
+    }
+
+    ssize_t count = 0;
+    bool hasErrors = false;
+    AddFileTracker tracker;
+    const size_t N = jobs.size();
+    const size_t window = bundle->getJobs() * 4;
+    { // scope for the group; its units are done before the jobs are deleted
+        WorkQueue::Group group(WorkQueue::getShared());
+        size_t scheduled = 0;
+        for (size_t i = 0; i < N; i++) {
+            for (; scheduled < N && scheduled < i + window; scheduled++) {
+                AddFileJob* job = jobs[scheduled];
+                if (job == NULL || !job->deflate) {
+                    continue;
+                }
+                CompressFileWorkUnit* w = new CompressFileWorkUnit(bundle, job, &tracker, cache);
+                if (group.schedule(w, 0) == NO_ERROR) {
+                    job->scheduled = true;
+                } else {
+                    delete w;       // the writer compresses it instead
+                }
+            }
+
+            AddFileJob* job = jobs[i];
+            if (job != NULL) {
+                if (job->scheduled) {
+                    tracker.waitFor(job);
+                }
+                if (!addFile(bundle, zip, job->storageName, job->file, job->fromGzip,
+                        job->scheduled ? job->deflated.get() : NULL)) {
+                    hasErrors = true;
+                    break;
+                }
+                job->deflated.clear();
+            }
+            count++;
+        }
+        // The queue is shared, so rather than cancel it, let the units this
+        // archive still has pending skip their work.
+        if (hasErrors) {
+            tracker.abandon();
+        }
+        group.wait();
+    }
+
+    for (size_t i = 0; i < N; i++) {
+        delete jobs[i];
+    }
+    return hasErrors ? UNKNOWN_ERROR : count;
+}
+
+void DeflateCache::addUsers(Bundle* bundle, const sp<const OutputSet>& outputSet)
+{
+    // A file that prepareFile() then skips just keeps its copy until the
+    // cache goes away.
+    const std::set<OutputEntry>& entries = outputSet->getEntries();
+    std::set<OutputEntry>::const_iterator iter = entries.begin();
+    for (; iter != entries.end(); iter++) {
+        const sp<const AaptFile>& file = iter->getFile();
+        if (file == NULL) {
+            continue;
+        }
+        String8 storagePath(iter->getPath());
+        storagePath.convertToResPath();
+        bool fromGzip = strcasecmp(storagePath.getPathExtension().string(), ".gz") == 0;
+        if (!isDeflatedFile(bundle, storagePath, file, fromGzip)) {
+            continue;
+        }
+        Key key(file.get(), getCompressionLevel(bundle, storagePath));
+        ssize_t index = mSlots.indexOfKey(key);
+        if (index < 0) {
+            index = mSlots.add(key, Slot());
+        }
+        mSlots.editValueAt(index).users++;
+    }
+}
+
+sp<DeflatedData> DeflateCache::take(Bundle* bundle, const sp<const AaptFile>& file,
+                                    int level)
+{
+    const Key key(file.get(), level);
+    sp<DeflatedData> data;
+    { // acquire lock
+        AutoMutex _l(mLock);
+        ssize_t index = mSlots.indexOfKey(key);
+        if (index < 0) {
+            return NULL;
+        }
+        Slot& slot = mSlots.editValueAt(index);
+        if (slot.data != NULL || slot.busy) {
+            return takeLocked(key);
+        }
+        if (slot.users <= 1) {
+            mSlots.removeItemsAt(index);
+            return NULL;
+        }
+        slot.busy = true;
+    } // release lock
+
+    data = new DeflatedData();
+    deflateFile(bundle, file, level, data.get());
+
+    AutoMutex _l(mLock);
+    Slot& slot = mSlots.editValueFor(key);
+    slot.busy = false;
+    slot.data = data;
+    mCondition.broadcast();
+    return takeLocked(key);
+}
+
+sp<DeflatedData> DeflateCache::takeLocked(const Key& key)
+{
+    while (mSlots.valueFor(key).busy) {
+        mCondition.wait(mLock);
+    }
+    // Other slots come and go while this thread waits.
+    ssize_t index = mSlots.indexOfKey(key);
+    Slot& slot = mSlots.editValueAt(index);
+    sp<DeflatedData> data = slot.data;
+    if (--slot.users == 0) {
+        mSlots.removeItemsAt(index);
+    }
+    return data;
+}
+
+/*
+ * Writes one of the archives of writeAPKs().
+ */
+class WriteAPKWorkUnit : public WorkQueue::WorkUnit {
+public:
+    WriteAPKWorkUnit(Bundle* bundle, const String8& outputFile, const sp<OutputSet>& outputSet,
+                     DeflateCache* cache, status_t* outResult) :
+            mBundle(bundle), mOutputFile(outputFile), mOutputSet(outputSet),
+            mCache(cache), mResult(outResult) {
+    }
+
+    virtual bool run() {
+        *mResult = writeAPK(mBundle, mOutputFile, mOutputSet, mCache);
+        return *mResult == NO_ERROR; // don't start any more archives after a failure
+    }
+
+private:
+    Bundle* mBundle;
+    String8 mOutputFile;
+    sp<OutputSet> mOutputSet;
+    DeflateCache* mCache;
+    status_t* mResult;
+};
+
+status_t writeAPKs(Bundle* bundle, const Vector<String8>& outputFiles,
+                   const Vector<sp<OutputSet> >& outputSets)
+{
+    const size_t N = outputSets.size();
+    DeflateCache cache;
+    DeflateCache* sharedCache = NULL;
+    if (N > 1) {
+        for (size_t i = 0; i < N; i++) {
+            cache.addUsers(bundle, outputSets[i]);
+        }
+        sharedCache = &cache;
+    }
+
+    Vector<status_t> results;
+    results.insertAt(NO_ERROR, 0, N);
+    const int jobs = bundle->getJobs();
+    if (jobs <= 1 || N <= 1 || bundle->getVerbose()) {
+        // One at a time without --jobs, and when verbose, so that the
+        // output of the archives doesn't interleave.
+        for (size_t i = 0; i < N; i++) {
+            results.editItemAt(i) = writeAPK(bundle, outputFiles[i], outputSets[i],
+                    sharedCache);
+            if (results[i] != NO_ERROR) {
+                break;
+            }
+        }
+    } else {
+        // The writers spend most of their time waiting for their entries,
+        // which all go to the shared queue, so --jobs still bounds the
+        // threads that compress however many archives there are.  The
+        // writers can't run on it themselves, since they wait for it.
+        WorkQueue writeQueue(N < (size_t) jobs ? N : jobs, false);
+        for (size_t i = 0; i < N; i++) {
+            WriteAPKWorkUnit* w = new WriteAPKWorkUnit(bundle, outputFiles[i], outputSets[i],
+                    sharedCache, &results.editItemAt(i));
+            if (writeQueue.schedule(w, 0) != NO_ERROR) {
+                delete w;   // canceled by an archive that failed
+                break;
+            }
+        }
+        writeQueue.finish();
+    }
+
+    for (size_t i = 0; i < N; i++) {
+        if (results[i] != NO_ERROR) {
+            fprintf(stderr, "ERROR: packaging of '%s' failed\n", outputFiles[i].string());
+            return results[i];
+        }
+    }
+    return NO_ERROR;
+}
+
 /*
  * Determine whether or not we want to try to compress this file based
  * on the file extension.
@@ -392,6 +1306,31 @@ bool okayToCompress(Bundle* bundle, const String8& pathName)
     return true;
 }
 
+/*
+ * Determine how hard to compress this file: the level given for the
+ * longest matching extension, if any, or else the overall one.
+ */
+int getCompressionLevel(Bundle* bundle, const String8& pathName)
+{
+    const KeyedVector<String8, int>& levels(bundle->getExtensionCompressionLevels());
+    int level = bundle->getCompressionLevel();
+    size_t matched = 0;
+
+    for (size_t i = 0; i < levels.size(); i++) {
+        const String8& ext = levels.keyAt(i);
+        if (ext.length() <= matched || ext.length() > pathName.length()) {
+            continue;
+        }
+        const char* path = pathName.string() + pathName.length() - ext.length();
+        if (strcasecmp(path, ext.string()) == 0) {
+            level = levels.valueAt(i);
+            matched = ext.length();
+        }
+    }
+
+    return level;
+}
+
 bool endsWith(const char* haystack, const char* needle)
 {
     size_t a = strlen(haystack);
@@ -400,52 +1339,142 @@ bool endsWith(const char* haystack, const char* needle)
     return strcasecmp(haystack+(a-b), needle) == 0;
 }
 
-ssize_t processJarFile(ZipFile* jar, ZipFile* out)
+/*
+ * One of the -j jars, opened and scanned for its classes on a thread of
+ * the shared queue.
+ */
+struct JarInput {
+    JarInput() : path(NULL), result(NO_ERROR) { }
+
+    const char* path;
+    ZipFile zip;
+    status_t result;
+    // In the order of their data in the jar, so that it is read straight through.
+    std::vector<ZipEntry*> classes;
+};
+
+static bool lfhOffsetLess(const ZipEntry* lhs, const ZipEntry* rhs)
 {
-    size_t N = jar->getNumEntries();
-    size_t count = 0;
-    for (size_t i=0; i<N; i++) {
-        ZipEntry* entry = jar->getEntryByIndex(i);
-        const char* storageName = entry->getFileName();
-        if (endsWith(storageName, ".class")) {
-            int compressionMethod = entry->getCompressionMethod();
-            size_t size = entry->getUncompressedLen();
-            const void* data = jar->uncompress(entry);
-            if (data == NULL) {
-                fprintf(stderr, "ERROR: unable to uncompress entry '%s'\n",
-                    storageName);
-                return -1;
+    return lhs->getLFHOffset() < rhs->getLFHOffset();
+}
+
+class ScanJarWorkUnit : public WorkQueue::WorkUnit {
+public:
+    explicit ScanJarWorkUnit(JarInput* jar) : mJar(jar) { }
+
+    virtual bool run() {
+        mJar->result = mJar->zip.open(mJar->path, ZipFile::kOpenReadOnly);
+        if (mJar->result != NO_ERROR) {
+            return true;
+        }
+        const size_t N = mJar->zip.getNumEntries();
+        for (size_t i = 0; i < N; i++) {
+            ZipEntry* entry = mJar->zip.getEntryByIndex(i);
+            if (endsWith(entry->getFileName(), ".class")) {
+                mJar->classes.push_back(entry);
             }
-            out->add(data, size, storageName, compressionMethod, NULL);
-            free((void*)data);
         }
-        count++;
+        std::sort(mJar->classes.begin(), mJar->classes.end(), lfhOffsetLess);
+        return true;
     }
-    return count;
-}
 
+private:
+    JarInput* mJar;
+};
+
+// The jar each class is taken from, by the class's name.
+struct JarClassKey {
+    explicit JarClassKey(const char* _name) : name(_name) { }
+
+    bool operator==(const JarClassKey& o) const {
+        return strcmp(name, o.name) == 0;
+    }
+
+    const char* name;
+};
+
+struct JarClassEntry {
+    JarClassEntry(const ZipEntry* _entry, size_t _jar) : entry(_entry), jar(_jar) { }
+    JarClassKey getKey() const { return JarClassKey(entry->getFileName()); }
+
+    const ZipEntry* entry;
+    size_t jar;
+};
+
+/*
+ * Copies the classes of the -j jars into "zip", with their compressed data
+ * as it is.  A class keeps the first of its definitions: one already in
+ * the archive, or else that of the first jar on the command line to have
+ * it.  Returns how many classes were copied.
+ */
 ssize_t processJarFiles(Bundle* bundle, ZipFile* zip)
 {
-    status_t err;
-    ssize_t count = 0;
     const android::Vector<const char*>& jars = bundle->getJarFiles();
+    const size_t N = jars.size();
+    if (N == 0) {
+        return 0;
+    }
 
-    size_t N = jars.size();
-    for (size_t i=0; i<N; i++) {
-        ZipFile jar;
-        err = jar.open(jars[i], ZipFile::kOpenReadOnly);
-        if (err != 0) {
+    // Reading the central directories is most of the work for a jar that
+    // has few classes, so the jars are all opened at once.
+    JarInput* inputs = new JarInput[N];
+    { // scope for the group; its units are done before the jars are copied
+        WorkQueue::Group group(WorkQueue::getShared());
+        for (size_t i = 0; i < N; i++) {
+            inputs[i].path = jars[i];
+            ScanJarWorkUnit* w = new ScanJarWorkUnit(&inputs[i]);
+            if (group.schedule(w, 0) != NO_ERROR) {
+                w->run();
+                delete w;
+            }
+        }
+        group.wait();
+    }
+
+    ssize_t count = 0;
+    BasicHashtable<JarClassKey, JarClassEntry> chosen;
+    for (size_t i = 0; i < N && count >= 0; i++) {
+        if (inputs[i].result != NO_ERROR) {
             fprintf(stderr, "ERROR: unable to open '%s' as a zip file: %d\n",
-                jars[i], err);
-            return err;
+                jars[i], inputs[i].result);
+            count = inputs[i].result;
+            break;
         }
-        err += processJarFile(&jar, zip);
-        if (err < 0) {
-            fprintf(stderr, "ERROR: unable to process '%s'\n", jars[i]);
-            return err;
+        const std::vector<ZipEntry*>& classes = inputs[i].classes;
+        for (size_t j = 0; j < classes.size(); j++) {
+            const char* storageName = classes[j]->getFileName();
+            const JarClassKey key(storageName);
+            const hash_t hash = JenkinsHashWhiten(JenkinsHashMixBytes(0,
+                    (const uint8_t*) storageName, strlen(storageName)));
+            const ssize_t idx = chosen.find(-1, hash, key);
+            if (idx >= 0) {
+                const JarClassEntry& first = chosen.entryAt(idx);
+                if (bundle->getVerbose()) {
+                    printf("    (skipping %s of '%s', which has it from '%s'%s)\n",
+                           storageName, jars[i], jars[first.jar],
+                           first.entry->getCRC32() != classes[j]->getCRC32()
+                                   ? " with other contents" : "");
+                }
+                continue;
+            }
+            chosen.add(hash, JarClassEntry(classes[j], i));
+
+            // As before, a class that is already in the archive is quietly
+            // left alone.
+            status_t err = zip->add(&inputs[i].zip, classes[j], 0, NULL);
+            if (err == ALREADY_EXISTS) {
+                continue;
+            }
+            if (err != NO_ERROR) {
+                fprintf(stderr, "ERROR: unable to copy entry '%s'\n", storageName);
+                fprintf(stderr, "ERROR: unable to process '%s'\n", jars[i]);
+                count = -1;
+                break;
+            }
+            count++;
         }
-        count += err;
     }
 
+    delete[] inputs;
     return count;
 }
@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PhaseTrace.h"
+#include "Statistics.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <utils/AndroidThreads.h>
+#include <utils/KeyedVector.h>
+#include <utils/Mutex.h>
+#include <utils/Vector.h>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+using android::AutoMutex;
+using android::KeyedVector;
+using android::Mutex;
+using android::String8;
+using android::Vector;
+using android::status_t;
+
+namespace {
+
+struct Span {
+    const char* name;
+    String8 file;
+    android_thread_id_t thread;
+    nsecs_t start;
+    nsecs_t end;
+    ssize_t bytes;
+    nsecs_t cpu;
+};
+
+// Set once by enable(), before any other thread looks at it.
+bool gEnabled = false;
+nsecs_t gEpoch = 0;
+android_thread_id_t gMainThread = NULL;
+
+Mutex gLock;
+Vector<Span> gSpans;
+
+void writeJsonString(FILE* fp, const char* str)
+{
+    fputc('"', fp);
+    for (const unsigned char* p = (const unsigned char*) str; *p != 0; p++) {
+        if (*p == '"' || *p == '\\') {
+            fputc('\\', fp);
+            fputc(*p, fp);
+        } else if (*p < 0x20) {
+            fprintf(fp, "\\u%04x", *p);
+        } else {
+            fputc(*p, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+// Chrome wants microseconds.
+double toMicros(nsecs_t time)
+{
+    return time / 1000.0;
+}
+
+} // namespace
+
+namespace PhaseTrace {
+
+void enable()
+{
+    {
+        // A daemon may package more than once; each trace starts over.
+        AutoMutex _l(gLock);
+        gSpans.clear();
+    }
+    gEpoch = systemTime(SYSTEM_TIME_MONOTONIC);
+    gMainThread = androidGetThreadId();
+    gEnabled = true;
+}
+
+bool isEnabled()
+{
+    return gEnabled;
+}
+
+void add(const char* name, const String8& file, nsecs_t start, nsecs_t end, ssize_t bytes,
+         nsecs_t cpu)
+{
+    Span span;
+    span.name = name;
+    span.file = file;
+    span.thread = androidGetThreadId();
+    span.start = start;
+    span.end = end;
+    span.bytes = bytes;
+    span.cpu = cpu;
+
+    AutoMutex _l(gLock);
+    gSpans.push(span);
+}
+
+nsecs_t processCpuTime()
+{
+#if defined(_WIN32)
+    return -1;
+#else
+    if (androidGetThreadId() != gMainThread) {
+        return -1;
+    }
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+    return (nsecs_t(usage.ru_utime.tv_sec) + usage.ru_stime.tv_sec) * 1000000000LL
+            + (nsecs_t(usage.ru_utime.tv_usec) + usage.ru_stime.tv_usec) * 1000LL;
+#endif
+}
+
+status_t write(const char* path)
+{
+    FILE* fp = fopen(path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: Unable to open trace output file '%s': %s\n", path,
+                strerror(errno));
+        return android::UNKNOWN_ERROR;
+    }
+
+    AutoMutex _l(gLock);
+
+    // Threads are numbered in the order they first finished a span, after
+    // the one that enabled tracing.
+    KeyedVector<android_thread_id_t, int> threads;
+    threads.add(gMainThread, 0);
+    for (size_t i = 0; i < gSpans.size(); i++) {
+        if (threads.indexOfKey(gSpans[i].thread) < 0) {
+            threads.add(gSpans[i].thread, threads.size());
+        }
+    }
+
+    fprintf(fp, "{\"traceEvents\":[\n");
+    fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+            "\"args\":{\"name\":\"aapt\"}}");
+    for (size_t i = 0; i < threads.size(); i++) {
+        const int tid = threads.valueAt(i);
+        fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,", tid);
+        if (tid == 0) {
+            fprintf(fp, "\"args\":{\"name\":\"main\"}}");
+        } else {
+            fprintf(fp, "\"args\":{\"name\":\"worker %d\"}}", tid);
+        }
+    }
+
+    for (size_t i = 0; i < gSpans.size(); i++) {
+        const Span& span = gSpans[i];
+        fprintf(fp, ",\n{\"name\":");
+        writeJsonString(fp, span.name);
+        fprintf(fp, ",\"cat\":\"aapt\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                threads.valueFor(span.thread), toMicros(span.start - gEpoch),
+                toMicros(span.end - span.start));
+        if (span.file.length() > 0 || span.bytes >= 0 || span.cpu >= 0) {
+            const char* sep = "";
+            fprintf(fp, ",\"args\":{");
+            if (span.file.length() > 0) {
+                fprintf(fp, "\"file\":");
+                writeJsonString(fp, span.file.string());
+                sep = ",";
+            }
+            if (span.bytes >= 0) {
+                fprintf(fp, "%s\"bytes\":%ld", sep, (long) span.bytes);
+                sep = ",";
+            }
+            if (span.cpu >= 0) {
+                fprintf(fp, "%s\"process_cpu_us\":%.0f", sep, toMicros(span.cpu));
+            }
+            fprintf(fp, "}");
+        }
+        fprintf(fp, "}");
+    }
+    // The statistics, as one counter event per group at the end.
+    const nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < Statistics::NUM_COUNTERS; i++) {
+        const Statistics::Counter counter = (Statistics::Counter) i;
+        const bool first = i == 0 || strcmp(Statistics::groupName(counter),
+                Statistics::groupName((Statistics::Counter) (i - 1))) != 0;
+        if (first) {
+            fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"statistics\",\"ph\":\"C\",\"pid\":1,"
+                    "\"tid\":0,\"ts\":%.3f,\"args\":{", Statistics::groupName(counter),
+                    toMicros(now - gEpoch));
+        } else {
+            fprintf(fp, ",");
+        }
+        fprintf(fp, "\"%s\":%llu", Statistics::name(counter),
+                (unsigned long long) Statistics::get(counter));
+        const bool last = i + 1 == Statistics::NUM_COUNTERS
+                || strcmp(Statistics::groupName(counter),
+                        Statistics::groupName((Statistics::Counter) (i + 1))) != 0;
+        if (last) {
+            fprintf(fp, "}}");
+        }
+    }
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "ERROR: Unable to write trace output file '%s': %s\n", path,
+                strerror(errno));
+        return android::UNKNOWN_ERROR;
+    }
+    return android::NO_ERROR;
+}
+
+void getPhaseTotals(Vector<String8>* names, Vector<nsecs_t>* totals)
+{
+    names->clear();
+    totals->clear();
+    AutoMutex _l(gLock);
+    for (size_t i = 0; i < gSpans.size(); i++) {
+        const Span& span = gSpans[i];
+        if (span.thread != gMainThread || span.file.length() > 0) {
+            continue;
+        }
+        size_t j = 0;
+        while (j < names->size() && strcmp(names->itemAt(j).string(), span.name) != 0) {
+            j++;
+        }
+        if (j == names->size()) {
+            names->add(String8(span.name));
+            totals->add(0);
+        }
+        totals->editItemAt(j) += span.end - span.start;
+    }
+}
+
+} // namespace PhaseTrace
+
+PhaseSpan::PhaseSpan(const char* name)
+    : mName(name), mStart(0), mCpuStart(-1), mBytes(-1)
+{
+    if (PhaseTrace::isEnabled()) {
+        mCpuStart = PhaseTrace::processCpuTime();
+        mStart = systemTime(SYSTEM_TIME_MONOTONIC);
+    }
+}
+
+PhaseSpan::PhaseSpan(const char* name, const String8& file)
+    : mName(name), mStart(0), mCpuStart(-1), mBytes(-1)
+{
+    if (PhaseTrace::isEnabled()) {
+        mFile = file;
+        mCpuStart = PhaseTrace::processCpuTime();
+        mStart = systemTime(SYSTEM_TIME_MONOTONIC);
+    }
+}
+
+void PhaseSpan::end()
+{
+    if (mStart != 0) {
+        const nsecs_t end = systemTime(SYSTEM_TIME_MONOTONIC);
+        nsecs_t cpu = -1;
+        if (mCpuStart >= 0) {
+            const nsecs_t cpuEnd = PhaseTrace::processCpuTime();
+            if (cpuEnd >= 0) {
+                cpu = cpuEnd - mCpuStart;
+            }
+        }
+        PhaseTrace::add(mName, mFile, mStart, end, mBytes, cpu);
+        mStart = 0;
+    }
+}
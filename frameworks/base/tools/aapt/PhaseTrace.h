@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef H_AAPT_PHASE_TRACE
+#define H_AAPT_PHASE_TRACE
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <utils/Errors.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+
+/*
+ * Records how long the stages of a build take, on each thread and for
+ * each file, for --trace-output.  The spans are written in the Chrome
+ * trace event format, which chrome://tracing and Perfetto load.
+ *
+ * Nothing is recorded until enable() is called, and until then a span
+ * costs one check.  Spans may be recorded from any thread.
+ */
+namespace PhaseTrace {
+
+// Starts recording.  Call before starting any threads that trace.
+void enable();
+bool isEnabled();
+
+// Records a span of the calling thread from "start" to "end".  "cpu" is
+// the CPU time the whole process used meanwhile, or -1 if not known.
+void add(const char* name, const android::String8& file, nsecs_t start, nsecs_t end,
+         ssize_t bytes, nsecs_t cpu);
+
+// The CPU time the process has used, on all threads, for spans of the
+// thread that enabled tracing; -1 on other threads, whose spans overlap
+// each other, and on hosts that cannot tell.
+nsecs_t processCpuTime();
+
+// Writes everything recorded so far to "path".
+android::status_t write(const char* path);
+
+// The total time of the spans of the thread that enabled tracing that
+// aren't of one file, by name, in the order they first ended.
+void getPhaseTotals(android::Vector<android::String8>* names,
+                    android::Vector<nsecs_t>* totals);
+
+} // namespace PhaseTrace
+
+/*
+ * A span recorded from construction to destruction or end(), whichever
+ * is first.  "name" must be a string literal.
+ */
+class PhaseSpan {
+public:
+    explicit PhaseSpan(const char* name);
+    PhaseSpan(const char* name, const android::String8& file);
+    ~PhaseSpan() { end(); }
+
+    // The size of the data the span read or produced.
+    void setBytes(size_t bytes) { mBytes = bytes; }
+
+    void end();
+
+private:
+    PhaseSpan(const PhaseSpan&);
+    PhaseSpan& operator=(const PhaseSpan&);
+
+    const char* mName;
+    android::String8 mFile;
+    nsecs_t mStart;         // 0 when not recording
+    nsecs_t mCpuStart;      // -1 when not known
+    ssize_t mBytes;         // -1 when not given
+};
+
+#endif // H_AAPT_PHASE_TRACE
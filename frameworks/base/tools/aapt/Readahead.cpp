@@ -0,0 +1,234 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Reading a build's source files from disk before the compile stages get
+// to them.
+//
+
+#include "Readahead.h"
+#include "Statistics.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) || defined(__APPLE__)
+static const bool kCanAdvise = true;
+#else
+static const bool kCanAdvise = false;
+#endif
+
+namespace {
+
+struct PathIndex {
+    String8 path;
+    size_t index;
+};
+
+} // namespace
+
+static int comparePathIndex(const PathIndex* lhs, const PathIndex* rhs)
+{
+    return strcmp(lhs->path.string(), rhs->path.string());
+}
+
+/*
+ * Asks the kernel to read all of "path" in the background.  Returns how
+ * many bytes that is, or 0 if the file can't be opened.
+ */
+static size_t adviseWillNeed(const char* path)
+{
+#if defined(__linux__) || defined(__APPLE__)
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    size_t size = 0;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        size = (size_t) st.st_size;
+#if defined(__linux__)
+        posix_fadvise(fd, 0, st.st_size, POSIX_FADV_WILLNEED);
+#else
+        struct radvisory ra;
+        ra.ra_offset = 0;
+        ra.ra_count = st.st_size < INT_MAX ? (int) st.st_size : INT_MAX;
+        fcntl(fd, F_RDADVISE, &ra);
+#endif
+    }
+    close(fd);
+    return size;
+#else
+    (void) path;
+    return 0;
+#endif
+}
+
+/*
+ * The files to read ahead and how far the build has got through them.
+ * Files [0, consumed) have been opened, or passed over by one opened
+ * later; [consumed, next) have been asked for, "ahead" bytes in all.
+ */
+struct Readahead::State {
+    State() : next(0), consumed(0), ahead(0), windowBytes(0), stopping(false) { }
+
+    Mutex lock;
+    Condition changed;
+    Vector<String8> paths;
+    Vector<size_t> sizes;           // bytes asked for, for each of "paths"
+    Vector<PathIndex> byPath;       // sorted by path
+    size_t next;
+    size_t consumed;
+    size_t ahead;
+    size_t windowBytes;
+    bool stopping;
+};
+
+class Readahead::ReadaheadThread : public Thread {
+public:
+    ReadaheadThread(State* state) : Thread(false), mState(state) { }
+
+private:
+    virtual bool threadLoop() {
+        size_t index;
+        String8 path;
+        {
+            AutoMutex _l(mState->lock);
+            // One file is always allowed ahead, however big it is.
+            while (!mState->stopping && mState->next < mState->paths.size()
+                    && mState->next > mState->consumed
+                    && mState->ahead >= mState->windowBytes) {
+                mState->changed.wait(mState->lock);
+            }
+            if (mState->stopping || mState->next >= mState->paths.size()) {
+                return false;
+            }
+            index = mState->next++;
+            path = mState->paths[index];
+        }
+
+        const size_t size = adviseWillNeed(path.string());
+
+        AutoMutex _l(mState->lock);
+        if (index >= mState->consumed) {
+            mState->sizes.editItemAt(index) = size;
+            mState->ahead += size;
+            Statistics::add(Statistics::READAHEAD_FILES);
+            Statistics::add(Statistics::READAHEAD_BYTES, size);
+        }
+        return true;
+    }
+
+    State* const mState;
+};
+
+// Guards Readahead::sCurrent.
+static Mutex gLock;
+
+Readahead::State* Readahead::sCurrent = NULL;
+
+Readahead::Readahead(const Vector<String8>& paths, size_t windowBytes)
+    : mState(NULL)
+{
+    if (!kCanAdvise || paths.isEmpty()) {
+        return;
+    }
+
+    mState = new State();
+    mState->paths = paths;
+    mState->sizes.insertAt((size_t) 0, 0, paths.size());
+    mState->byPath.setCapacity(paths.size());
+    for (size_t i = 0; i < paths.size(); i++) {
+        PathIndex entry;
+        entry.path = paths[i];
+        entry.index = i;
+        mState->byPath.add(entry);
+    }
+    mState->byPath.sort(comparePathIndex);
+    mState->windowBytes = windowBytes;
+
+    {
+        AutoMutex _l(gLock);
+        sCurrent = mState;
+    }
+    mThread = new ReadaheadThread(mState);
+    if (mThread->run("aapt readahead", PRIORITY_BACKGROUND) != NO_ERROR) {
+        mThread.clear();
+    }
+}
+
+Readahead::~Readahead()
+{
+    if (mState == NULL) {
+        return;
+    }
+    {
+        AutoMutex _l(gLock);
+        if (sCurrent == mState) {
+            sCurrent = NULL;
+        }
+    }
+    {
+        AutoMutex _l(mState->lock);
+        mState->stopping = true;
+        mState->changed.broadcast();
+    }
+    if (mThread != NULL) {
+        mThread->join();
+    }
+    delete mState;
+}
+
+void Readahead::opened(const char* path)
+{
+    AutoMutex _g(gLock);
+    State* state = sCurrent;
+    if (state == NULL) {
+        return;
+    }
+
+    // The list is fixed once the thread runs, so it can be searched
+    // without the state's lock.
+    const Vector<PathIndex>& byPath = state->byPath;
+    size_t lo = 0;
+    size_t hi = byPath.size();
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        const int cmp = strcmp(byPath[mid].path.string(), path);
+        if (cmp == 0) {
+            lo = mid;
+            break;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo >= hi) {
+        return;
+    }
+    const size_t index = byPath[lo].index;
+
+    AutoMutex _l(state->lock);
+    if (index < state->consumed) {
+        return;
+    }
+    if (index >= state->next) {
+        // The build has overtaken the readahead; there's no point asking
+        // for what it has already passed.
+        Statistics::add(Statistics::READAHEAD_LATE);
+        state->next = index + 1;
+    }
+    while (state->consumed <= index) {
+        state->ahead -= state->sizes[state->consumed];
+        state->consumed++;
+    }
+    state->changed.broadcast();
+}
@@ -0,0 +1,54 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Reading a build's source files from disk before the compile stages get
+// to them.
+//
+
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <utils/String8.h>
+#include <utils/threads.h>
+#include <utils/Vector.h>
+
+using namespace android;
+
+/*
+ * Asks the kernel, from a thread of its own, to start reading the source
+ * files a build is about to compile, in the order they will be opened, so
+ * that the work threads mapping them with MappedFile rarely wait on the
+ * disk or the network.  Only a window of files is asked for ahead of the
+ * last one opened, so that the page cache isn't filled with files that
+ * would be evicted again before their turn.
+ *
+ * Nothing is read into aapt's own memory: on hosts with no way to advise
+ * the kernel the files are simply read when they are opened, as before.
+ */
+class Readahead {
+public:
+    // "windowBytes" is how far ahead of the last file opened to read.
+    Readahead(const Vector<String8>& paths, size_t windowBytes);
+
+    // Stops reading ahead; files already asked for are still read.
+    ~Readahead();
+
+    // Called by MappedFile for each file it opens, so that the window
+    // moves on.  Does nothing unless a Readahead is running.
+    static void opened(const char* path);
+
+private:
+    Readahead(const Readahead&);
+    Readahead& operator=(const Readahead&);
+
+    class ReadaheadThread;
+    struct State;
+
+    // The one that opened() moves on, if any; guarded by a lock of its own.
+    static State* sCurrent;
+
+    State* mState;
+    sp<ReadaheadThread> mThread;
+};
+
+#endif // READAHEAD_H
@@ -0,0 +1,356 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// A compile cache shared by build machines over HTTP.
+
+#define LOG_TAG "RemoteCache"
+
+#include "RemoteCache.h"
+#include "CompileCache.h"
+#include "MappedFile.h"
+#include "Statistics.h"
+
+#include <cutils/atomic.h>
+#include <utils/KeyedVector.h>
+#include <utils/Log.h>
+#include <utils/threads.h>
+#include <utils/Vector.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+namespace android {
+
+namespace {
+
+// Requests to the server are mostly waiting, so there can be more of
+// them at once than there are processors.
+const size_t kThreads = 8;
+
+// A server that doesn't answer within this many seconds is given up on.
+const int kTimeoutSeconds = 10;
+
+enum FetchState {
+    kFetching,
+    kFetched,
+    kMissing,
+};
+
+// Made by setUrl(), since the strings can't be constructed before
+// libutils is.
+struct Server {
+    String8 host;
+    String8 port;
+    String8 path;                       // with no trailing '/'
+    KeyedVector<String8, int> fetches;  // by digest, guarded by gLock
+};
+
+Mutex gLock;
+Condition gFetchDone;
+Server* gServer = NULL;
+volatile int32_t gEnabled = 0;
+WorkQueue* gQueue = NULL;
+WorkQueue::Group* gGroup = NULL;
+
+} // namespace
+
+#ifndef _WIN32
+
+static int connectToServer()
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addrs;
+    if (getaddrinfo(gServer->host.string(), gServer->port.string(), &hints, &addrs) != 0) {
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo* ai = addrs; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        struct timeval tv;
+        tv.tv_sec = kTimeoutSeconds;
+        tv.tv_usec = 0;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+#ifdef SO_NOSIGPIPE
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addrs);
+    return fd;
+}
+
+static bool sendAll(int fd, const void* data, size_t size)
+{
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+    const char* p = (const char*) data;
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, flags);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+/*
+ * Sends one request for the entry "digest" and reads the whole response,
+ * putting its body in outBody.  Returns the HTTP status, or -1 if the
+ * server couldn't be reached or didn't answer in HTTP.
+ */
+static int request(const char* method, const String8& digest,
+                   const void* body, size_t bodySize, Vector<uint8_t>* outBody)
+{
+    int fd = connectToServer();
+    if (fd < 0) {
+        return -1;
+    }
+
+    String8 head = String8::format("%s %s/%s HTTP/1.0\r\nHost: %s:%s\r\n",
+            method, gServer->path.string(), digest.string(), gServer->host.string(),
+            gServer->port.string());
+    if (body != NULL) {
+        head.appendFormat("Content-Type: application/octet-stream\r\n"
+                "Content-Length: %zu\r\n", bodySize);
+    }
+    head.append("\r\n");
+    if (!sendAll(fd, head.string(), head.length())
+            || (body != NULL && !sendAll(fd, body, bodySize))) {
+        close(fd);
+        return -1;
+    }
+
+    // HTTP/1.0 responses end when the server closes the connection.
+    Vector<uint8_t> response;
+    uint8_t buf[32768];
+    for (;;) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            close(fd);
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        response.appendArray(buf, n);
+    }
+    close(fd);
+
+    const char* data = (const char*) response.array();
+    const size_t size = response.size();
+    int status;
+    if (size < 12 || strncmp(data, "HTTP/", 5) != 0
+            || sscanf(data, "HTTP/%*d.%*d %d", &status) != 1) {
+        return -1;
+    }
+    size_t bodyStart = 0;
+    for (size_t i = 0; i + 4 <= size; i++) {
+        if (memcmp(data + i, "\r\n\r\n", 4) == 0) {
+            bodyStart = i + 4;
+            break;
+        }
+    }
+    if (bodyStart == 0) {
+        return -1;
+    }
+    if (outBody != NULL) {
+        outBody->clear();
+        if (size > bodyStart) {
+            outBody->appendArray(response.array() + bodyStart, size - bodyStart);
+        }
+    }
+    return status;
+}
+
+#else
+
+static int request(const char*, const String8&, const void*, size_t, Vector<uint8_t>*)
+{
+    return -1;
+}
+
+#endif // _WIN32
+
+/*
+ * Stops using a server that didn't answer, saying so once.
+ */
+static void disable()
+{
+    if (android_atomic_cmpxchg(1, 0, &gEnabled) == 0) {
+        fprintf(stderr, "WARNING: Resource cache server %s:%s%s is unreachable;"
+                " using the local cache only.\n",
+                gServer->host.string(), gServer->port.string(), gServer->path.string());
+    }
+}
+
+class StoreWorkUnit : public WorkQueue::WorkUnit {
+public:
+    StoreWorkUnit(const String8& digest, const String8& path)
+        : mDigest(digest), mPath(path) { }
+
+    virtual bool run() {
+        if (!RemoteCache::isEnabled()) {
+            return true;
+        }
+        MappedFile entry;
+        if (entry.open(mPath.string()) != NO_ERROR) {
+            return true;
+        }
+        int status = request("PUT", mDigest, entry.getData(), entry.getSize(), NULL);
+        if (status < 0) {
+            disable();
+        } else if (status / 100 == 2) {
+            Statistics::add(Statistics::REMOTE_CACHE_STORES);
+        }
+        return true;
+    }
+
+private:
+    String8 mDigest;
+    String8 mPath;
+};
+
+namespace RemoteCache {
+
+status_t setUrl(const char* url)
+{
+#ifdef _WIN32
+    (void) url;
+    return INVALID_OPERATION;
+#else
+    static const char kScheme[] = "http://";
+    if (strncmp(url, kScheme, sizeof(kScheme) - 1) != 0) {
+        return BAD_VALUE;
+    }
+    const char* host = url + sizeof(kScheme) - 1;
+    const char* path = strchr(host, '/');
+    if (path == NULL) {
+        path = host + strlen(host);
+    }
+    const char* port = (const char*) memchr(host, ':', path - host);
+    const char* hostEnd = port != NULL ? port : path;
+    if (hostEnd == host || (port != NULL && port + 1 == path)) {
+        return BAD_VALUE;
+    }
+
+    finish();
+    AutoMutex _l(gLock);
+    if (gServer == NULL) {
+        gServer = new Server;
+    }
+    gServer->host.setTo(host, hostEnd - host);
+    gServer->port = port != NULL ? String8(port + 1, path - port - 1) : String8("80");
+    gServer->path.setTo(path);
+    while (gServer->path.length() > 0
+            && gServer->path.string()[gServer->path.length() - 1] == '/') {
+        gServer->path.setTo(gServer->path.string(), gServer->path.length() - 1);
+    }
+    gServer->fetches.clear();
+    if (gQueue == NULL) {
+        gQueue = new WorkQueue(kThreads, false);
+        gGroup = new WorkQueue::Group(gQueue);
+    }
+    android_atomic_release_store(1, &gEnabled);
+    return NO_ERROR;
+#endif
+}
+
+bool isEnabled()
+{
+    return android_atomic_acquire_load(&gEnabled) != 0;
+}
+
+status_t schedule(WorkQueue::WorkUnit* unit)
+{
+    if (!isEnabled()) {
+        return INVALID_OPERATION;
+    }
+    return gGroup->schedule(unit, 0);
+}
+
+bool fetch(const CompileCache& local, const String8& digest)
+{
+    if (!isEnabled()) {
+        return false;
+    }
+    {
+        AutoMutex _l(gLock);
+        for (;;) {
+            ssize_t i = gServer->fetches.indexOfKey(digest);
+            if (i < 0) {
+                break;
+            }
+            if (gServer->fetches.valueAt(i) != kFetching) {
+                return gServer->fetches.valueAt(i) == kFetched;
+            }
+            gFetchDone.wait(gLock);
+        }
+        gServer->fetches.add(digest, kFetching);
+    }
+
+    Vector<uint8_t> body;
+    const int status = request("GET", digest, NULL, 0, &body);
+    if (status < 0) {
+        disable();
+    }
+    const bool found = status == 200 && body.size() > 0
+            && local.putLocal(digest, body.array(), body.size()) == NO_ERROR;
+    Statistics::add(found ? Statistics::REMOTE_CACHE_HITS : Statistics::REMOTE_CACHE_MISSES);
+
+    AutoMutex _l(gLock);
+    gServer->fetches.replaceValueFor(digest, found ? kFetched : kMissing);
+    gFetchDone.broadcast();
+    return found;
+}
+
+void store(const String8& digest, const String8& path)
+{
+    StoreWorkUnit* unit = new StoreWorkUnit(digest, path);
+    if (schedule(unit) != NO_ERROR) {
+        delete unit;
+    }
+}
+
+void finish()
+{
+    if (gGroup != NULL) {
+        gGroup->wait();
+    }
+}
+
+} // namespace RemoteCache
+
+} // namespace android
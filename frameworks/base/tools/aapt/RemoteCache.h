@@ -0,0 +1,59 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// A compile cache shared by build machines over HTTP, behind the local one.
+
+#ifndef REMOTE_CACHE_H
+#define REMOTE_CACHE_H
+
+#include <utils/Errors.h>
+#include <utils/String8.h>
+
+#include "WorkQueue.h"
+
+namespace android {
+
+class CompileCache;
+
+/*
+ * The entries of a CompileCache, kept on a server that answers
+ * "GET <url>/<digest>" with the entry or 404 and stores the body of
+ * "PUT <url>/<digest>".  Entries are only ever fetched into the local
+ * cache, which the compile stages keep reading as before, so the server
+ * holds nothing the local cache couldn't make again.
+ *
+ * All the talking to the server is done on threads of its own, so that
+ * waiting on the network doesn't hold up the build's work threads.  If
+ * the server can't be reached it is not asked again for the rest of the
+ * run, and the build goes on with the local cache alone.
+ */
+namespace RemoteCache {
+
+// Uses the server at "url", "http://host[:port][/path]".  Returns
+// BAD_VALUE if the URL can't be used, INVALID_OPERATION if this host
+// has no support for it.
+status_t setUrl(const char* url);
+
+bool isEnabled();
+
+// Runs "unit" on the threads that talk to the server, taking ownership of
+// it.  Returns at once.
+status_t schedule(WorkQueue::WorkUnit* unit);
+
+// Copies the entry for "digest" from the server into "local".  If the
+// entry is already being fetched, waits for that instead of asking
+// again.  Returns true if "local" now has it.
+bool fetch(const CompileCache& local, const String8& digest);
+
+// Sends the entry for "digest", stored in "local" at "path", to the
+// server later on.
+void store(const String8& digest, const String8& path);
+
+// Waits for everything scheduled so far, such as the entries being sent.
+void finish();
+
+} // namespace RemoteCache
+
+} // namespace android
+
+#endif // REMOTE_CACHE_H
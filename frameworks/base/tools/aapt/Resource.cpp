@@ -4,21 +4,38 @@
 // Build resource files from raw assets.
 //
 #include "AaptAssets.h"
+#include "AaptContext.h"
 #include "AaptUtil.h"
 #include "AaptXml.h"
 #include "CacheUpdater.h"
+#include "Checkpoint.h"
+#include "CompileCache.h"
 #include "CrunchCache.h"
+#include "CrunchWorkers.h"
+#include "FileCosts.h"
 #include "FileFinder.h"
 #include "Images.h"
 #include "IndentPrinter.h"
 #include "Main.h"
+#include "MemStats.h"
+#include "MemoryBudget.h"
+#include "OutputBuffer.h"
+#include "PhaseTrace.h"
+#include "Readahead.h"
+#include "RemoteCache.h"
+#include "StartupProfile.h"
 #include "ResourceTable.h"
 #include "StringPool.h"
 #include "Symbol.h"
+#include "TaskGraph.h"
 #include "WorkQueue.h"
 #include "XMLNode.h"
+#include "XMLStream.h"
 
 #include <algorithm>
+#include <cutils/atomic.h>
+#include <sys/stat.h>
+#include <utils/ContentHash.h>
 
 // STATUST: mingw does seem to redefine UNKNOWN_ERROR from our enum value, so a cast is necessary.
 
@@ -35,9 +52,6 @@
 // Set to true for noisy debug output.
 static const bool kIsDebug = false;
 
-// Number of threads to use for preprocessing images.
-static const size_t MAX_THREADS = 4;
-
 // ==========================================================================
 // ==========================================================================
 // ==========================================================================
@@ -194,12 +208,12 @@ public:
         }
     }
 
-    void printAnnotations(FILE* fp, const char* indentStr) {
+    void printAnnotations(OutputBuffer* out, const char* indentStr) {
         if (mDeprecated) {
-            fprintf(fp, "%s@Deprecated\n", indentStr);
+            out->appendFormat("%s@Deprecated\n", indentStr);
         }
         if (mSystemApi) {
-            fprintf(fp, "%s@android.annotation.SystemApi\n", indentStr);
+            out->appendFormat("%s@android.annotation.SystemApi\n", indentStr);
         }
     }
 
@@ -299,6 +313,7 @@ static status_t makeFileResources(Bundle* bundle, const sp<AaptAssets>& assets,
                                   const sp<ResourceTypeSet>& set,
                                   const char* resType)
 {
+    PhaseSpan span("makeFileResources", String8(resType));
     String8 type8(resType);
     String16 type16(resType);
 
@@ -338,54 +353,606 @@ static status_t makeFileResources(Bundle* bundle, const sp<AaptAssets>& assets,
     return hasErrors ? STATUST(UNKNOWN_ERROR) : NO_ERROR;
 }
 
-class PreProcessImageWorkUnit : public WorkQueue::WorkUnit {
+/*
+ * With --spool-dir, moves a compiled file's data out of memory.  A file
+ * that can't be spooled just stays where it is.
+ */
+static void spoolCompiledFile(const Bundle* bundle, const sp<AaptFile>& file)
+{
+    if (bundle->getSpoolDir() != NULL && file->spoolData(bundle->getSpoolDir()) != NO_ERROR
+            && bundle->getVerbose()) {
+        printf("    (unable to spool %s)\n", file->getPrintableSource().string());
+    }
+}
+
+static off64_t sourceSize(const sp<AaptFile>& file)
+{
+    struct stat st;
+    return stat(file->getSourceFile().string(), &st) == 0 ? st.st_size : 0;
+}
+
+// What parsing and compiling an XML file holds for each byte of its
+// source, for the MemoryBudget: its strings as UTF-16, the nodes or events
+// they are kept in, and the flattened tree.
+static const size_t kXmlMemoryPerSourceByte = 8;
+
+static size_t xmlMemory(const sp<AaptFile>& file)
+{
+    return MemoryBudget::getLimit() != 0 ? sourceSize(file) * kXmlMemoryPerSourceByte : 0;
+}
+
+// Whether --fail-fast has stopped the build; work not started yet is skipped.
+static bool buildCanceled()
+{
+    return AaptContext::current()->isCanceled();
+}
+
+struct SizedFile {
+    size_t index;       // in the caller's list
+    off64_t size;
+};
+
+static int compareLargestFirst(const SizedFile* lhs, const SizedFile* rhs)
+{
+    if (lhs->size != rhs->size) {
+        return lhs->size > rhs->size ? -1 : 1;
+    }
+    return lhs->index < rhs->index ? -1 : (lhs->index > rhs->index ? 1 : 0);
+}
+
+/*
+ * Returns the order to work on "files" in on a WorkQueue: the largest
+ * first, so that the last to finish are small ones rather than one large
+ * file left to a single thread while the others are idle.  The size of a
+ * source is only a rough measure of its cost, but one known before any of
+ * the work.  Files of the same size keep their order.
+ */
+static Vector<size_t> largestFirst(const Vector<sp<AaptFile> >& files)
+{
+    Vector<SizedFile> sized;
+    sized.setCapacity(files.size());
+    for (size_t i = 0; i < files.size(); i++) {
+        SizedFile file;
+        file.index = i;
+        file.size = sourceSize(files[i]);
+        sized.add(file);
+    }
+    sized.sort(compareLargestFirst);
+
+    Vector<size_t> order;
+    order.setCapacity(sized.size());
+    for (size_t i = 0; i < sized.size(); i++) {
+        order.add(sized[i].index);
+    }
+    return order;
+}
+
+/*
+ * Crunches the images of the drawable and mipmap sets on the shared
+ * WorkQueue while buildResources() goes on with the stages that don't need
+ * them, until wait().  The images are scheduled, the largest first, from a
+ * thread of their own that waits for them: only as many at a time as there
+ * are threads, so that the units those stages schedule meanwhile aren't
+ * held up behind every image of the build, and only as many as fit in the
+ * MemoryBudget.
+ */
+class ImagePreprocessor {
+public:
+    ImagePreprocessor(const Bundle* bundle, const sp<AaptAssets>& assets) :
+            mBundle(bundle), mAssets(assets), mInFlight(0), mStopping(false),
+            mHasErrors(false), mGroup(WorkQueue::getShared()) {
+    }
+
+    // Stops scheduling images; those already scheduled are waited for.
+    ~ImagePreprocessor() {
+        {
+            AutoMutex _l(mLock);
+            mStopping = true;
+            mUnitDone.broadcast();
+        }
+        if (mFeeder != NULL) {
+            mFeeder->join();
+        }
+    }
+
+    // Adds the images of "set" to those start() crunches, leaving out
+    // those of configurations --prune-configs drops if "prune" is set.
+    void add(const sp<ResourceTypeSet>& set, const char* type, bool prune) {
+        if (set == NULL) {
+            return;
+        }
+        ResourceDirIterator it(set, String8(type));
+        ssize_t res;
+        while ((res=it.next()) == NO_ERROR) {
+            if (prune && mAssets->isPruned(it.getParams())) {
+                if (mBundle->getVerbose()) {
+                    printf("    (not crunching pruned %s)\n",
+                            it.getFile()->getPrintableSource().string());
+                }
+                continue;
+            }
+            mFiles.add(it.getFile());
+        }
+        if (res < NO_ERROR) {
+            mHasErrors = true;
+        }
+    }
+
+    void start() {
+        const Vector<size_t> order = largestFirst(mFiles);
+        Vector<sp<AaptFile> > sorted;
+        sorted.setCapacity(order.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            sorted.add(mFiles[order[i]]);
+        }
+        mFiles = sorted;
+
+        if (mFiles.isEmpty()) {
+            return;
+        }
+        mFeeder = new FeedThread(this, AaptContext::current());
+        if (mFeeder->run("ImagePreprocessor", PRIORITY_NORMAL) != NO_ERROR) {
+            mFeeder.clear();
+            feed();
+        }
+    }
+
+    // Waits for every image to be crunched.
+    status_t wait() {
+        PhaseSpan span("waitForImages");
+        if (mFeeder != NULL) {
+            mFeeder->join();
+            mFeeder.clear();
+        }
+        mGroup.wait();
+        return mHasErrors ? STATUST(UNKNOWN_ERROR) : NO_ERROR;
+    }
+
+private:
+    class FeedThread : public Thread {
+    public:
+        FeedThread(ImagePreprocessor* images, AaptContext* context) :
+                Thread(false), mImages(images), mContext(context) { }
+
+    private:
+        virtual bool threadLoop() {
+            // So that the units run in the build's context.
+            AaptContext::Scope scope(mContext);
+            mImages->feed();
+            return false;
+        }
+
+        ImagePreprocessor* const mImages;
+        AaptContext* const mContext;
+    };
+
+    class PreProcessImageWorkUnit : public WorkQueue::WorkUnit {
+    public:
+        PreProcessImageWorkUnit(ImagePreprocessor* images, size_t index, size_t memory) :
+                mImages(images), mIndex(index), mMemory(memory) { }
+
+        virtual bool run() {
+            const sp<AaptFile>& file = mImages->mFiles[mIndex];
+            if (buildCanceled()) {
+                mImages->mHasErrors = true;
+            } else if (preProcessImage(mImages->mBundle, mImages->mAssets, file, NULL) != NO_ERROR) {
+                mImages->mHasErrors = true;
+            } else {
+                spoolCompiledFile(mImages->mBundle, file);
+            }
+            MemoryBudget::release(mMemory);
+            mImages->unitDone();
+            return true; // continue even if there are errors
+        }
+
+    private:
+        ImagePreprocessor* const mImages;
+        const size_t mIndex;
+        const size_t mMemory;
+    };
+
+    void feed() {
+        const size_t maxInFlight = WorkQueue::getShared()->getMaxThreads();
+        const bool budgeted = MemoryBudget::getLimit() != 0;
+        for (size_t i = 0; i < mFiles.size(); i++) {
+            {
+                AutoMutex _l(mLock);
+                while (!mStopping && mInFlight >= maxInFlight) {
+                    mUnitDone.wait(mLock);
+                }
+                if (mStopping || buildCanceled()) {
+                    return;
+                }
+                mInFlight++;
+            }
+            const size_t memory = budgeted
+                    ? sourceSize(mFiles[i]) + estimateImageMemory(mFiles[i]->getSourceFile())
+                    : 0;
+            MemoryBudget::reserve(memory);
+
+            // The units are already few; they needn't wait for a backlog to drain.
+            PreProcessImageWorkUnit* w = new PreProcessImageWorkUnit(this, i, memory);
+            status_t status = mGroup.schedule(w, 0);
+            if (status) {
+                fprintf(stderr, "preProcessImages failed: schedule() returned %d\n", status);
+                mHasErrors = true;
+                delete w;
+                MemoryBudget::release(memory);
+                unitDone();
+                return;
+            }
+        }
+    }
+
+    void unitDone() {
+        AutoMutex _l(mLock);
+        mInFlight--;
+        mUnitDone.broadcast();
+    }
+
+    const Bundle* const mBundle;
+    const sp<AaptAssets> mAssets;
+    Vector<sp<AaptFile> > mFiles;
+    sp<FeedThread> mFeeder;
+    Mutex mLock;
+    Condition mUnitDone;
+    size_t mInFlight;       // scheduled and not done yet
+    bool mStopping;
+    volatile bool mHasErrors;
+    // Last, so that its destructor waits for the units before the rest goes.
+    WorkQueue::Group mGroup;
+};
+
+/*
+ * Works out the digest a file's output is kept under in the
+ * --resource-cache and looks it up, which fetches it from the
+ * RemoteCache if only that has it.
+ */
+class PrefetchWorkUnit : public WorkQueue::WorkUnit {
 public:
-    PreProcessImageWorkUnit(const Bundle* bundle, const sp<AaptAssets>& assets,
-            const sp<AaptFile>& file, volatile bool* hasErrors) :
-            mBundle(bundle), mAssets(assets), mFile(file), mHasErrors(hasErrors) {
+    PrefetchWorkUnit(const Bundle* bundle, const sp<AaptFile>& file, bool isImage) :
+            mBundle(bundle), mFile(file), mIsImage(isImage) {
     }
 
     virtual bool run() {
-        status_t status = preProcessImage(mBundle, mAssets, mFile, NULL);
-        if (status) {
-            *mHasErrors = true;
+        String8 digest;
+        status_t err = mIsImage ? imageCacheDigest(mBundle, mFile, &digest)
+                : valuesTreeDigest(mFile, &digest);
+        if (err == NO_ERROR && !digest.isEmpty()) {
+            CompileCache(mBundle->getResourceCacheDir()).find(digest);
         }
-        return true; // continue even if there are errors
+        return true;
     }
 
 private:
     const Bundle* mBundle;
-    sp<AaptAssets> mAssets;
     sp<AaptFile> mFile;
-    volatile bool* mHasErrors;
+    bool mIsImage;
 };
 
-static status_t preProcessImages(const Bundle* bundle, const sp<AaptAssets>& assets,
-                          const sp<ResourceTypeSet>& set, const char* type)
+static void prefetchCachedFiles(const Bundle* bundle, const sp<ResourceTypeSet>& set,
+                                const char* type, bool isImage)
 {
-    volatile bool hasErrors = false;
-    ssize_t res = NO_ERROR;
-    if (bundle->getUseCrunchCache() == false) {
-        WorkQueue wq(MAX_THREADS, false);
-        ResourceDirIterator it(set, String8(type));
-        while ((res=it.next()) == NO_ERROR) {
-            PreProcessImageWorkUnit* w = new PreProcessImageWorkUnit(
-                    bundle, assets, it.getFile(), &hasErrors);
-            status_t status = wq.schedule(w);
+    ResourceDirIterator it(set, String8(type));
+    while (it.next() == NO_ERROR) {
+        PrefetchWorkUnit* w = new PrefetchWorkUnit(bundle, it.getFile(), isImage);
+        if (RemoteCache::schedule(w) != NO_ERROR) {
+            delete w;
+            return;
+        }
+    }
+}
+
+/*
+ * Starts fetching what the RemoteCache has for the images and values
+ * files about to be compiled, on its own threads, so that the waiting
+ * overlaps with the build.  Whatever hasn't arrived when a file is
+ * compiled is waited for then, or compiled locally.
+ */
+static void prefetchCachedOutputs(const Bundle* bundle, const sp<AaptAssets>& assets,
+                                  const sp<ResourceTypeSet>& drawables,
+                                  const sp<ResourceTypeSet>& mipmaps)
+{
+    if (bundle->getOutputAPKFile() != NULL) {
+        if (drawables != NULL) {
+            prefetchCachedFiles(bundle, drawables, "drawable", true);
+        }
+        if (mipmaps != NULL) {
+            prefetchCachedFiles(bundle, mipmaps, "mipmap", true);
+        }
+    }
+    for (sp<AaptAssets> current = assets; current != NULL; current = current->getOverlay()) {
+        KeyedVector<String8, sp<ResourceTypeSet> >* resources = current->getResources();
+        ssize_t index = resources->indexOfKey(String8("values"));
+        if (index >= 0) {
+            prefetchCachedFiles(bundle, resources->valueAt(index), "values", false);
+        }
+    }
+}
+
+static void collectImageSources(const sp<ResourceTypeSet>& set, const char* type,
+                                Vector<String8>* outImages)
+{
+    ResourceDirIterator it(set, String8(type));
+    while (it.next() == NO_ERROR) {
+        const sp<AaptFile>& file = it.getFile();
+        if (strcmp(file->getPath().getPathExtension().string(), ".png") == 0) {
+            outImages->add(file->getSourceFile());
+        }
+    }
+}
+
+// How much of the sources the Readahead reads ahead of the compile stages.
+static const size_t kReadaheadWindowBytes = 64 * 1024 * 1024;
+
+static void collectFilesWithExtension(const sp<ResourceTypeSet>& set, const char* type,
+                                      const char* ext, Vector<sp<AaptFile> >* outFiles)
+{
+    if (set == NULL) {
+        return;
+    }
+    ResourceDirIterator it(set, String8(type));
+    while (it.next() == NO_ERROR) {
+        const sp<AaptFile>& file = it.getFile();
+        if (ext == NULL || strcmp(file->getPath().getPathExtension().string(), ext) == 0) {
+            outFiles->add(file);
+        }
+    }
+}
+
+static void collectSourcesWithExtension(const sp<ResourceTypeSet>& set, const char* type,
+                                        const char* ext, Vector<String8>* outPaths)
+{
+    Vector<sp<AaptFile> > files;
+    collectFilesWithExtension(set, type, ext, &files);
+    for (size_t i = 0; i < files.size(); i++) {
+        outPaths->add(files[i]->getSourceFile());
+    }
+}
+
+/*
+ * The source files the compile stages of buildResources() read, in the
+ * order they read them: the PNGs, the values files, then the XML files.
+ */
+static Vector<String8> collectReadaheadSources(const Bundle* bundle,
+        const sp<AaptAssets>& assets, const sp<ResourceTypeSet>& drawables,
+        const sp<ResourceTypeSet>& mipmaps, const sp<ResourceTypeSet>& layouts,
+        const sp<ResourceTypeSet>& anims, const sp<ResourceTypeSet>& animators,
+        const sp<ResourceTypeSet>& interpolators, const sp<ResourceTypeSet>& transitions,
+        const sp<ResourceTypeSet>& xmls, const sp<ResourceTypeSet>& colors,
+        const sp<ResourceTypeSet>& menus)
+{
+    Vector<String8> paths;
+    if (bundle->getOutputAPKFile() != NULL) {
+        // Largest first, as the ImagePreprocessor crunches them.
+        Vector<sp<AaptFile> > images;
+        collectFilesWithExtension(drawables, "drawable", ".png", &images);
+        collectFilesWithExtension(mipmaps, "mipmap", ".png", &images);
+        const Vector<size_t> order = largestFirst(images);
+        for (size_t i = 0; i < order.size(); i++) {
+            paths.add(images[order[i]]->getSourceFile());
+        }
+    }
+    for (sp<AaptAssets> current = assets; current != NULL; current = current->getOverlay()) {
+        KeyedVector<String8, sp<ResourceTypeSet> >* resources = current->getResources();
+        ssize_t index = resources->indexOfKey(String8("values"));
+        if (index >= 0) {
+            collectSourcesWithExtension(resources->valueAt(index), "values", NULL, &paths);
+        }
+    }
+    collectSourcesWithExtension(layouts, "layout", ".xml", &paths);
+    collectSourcesWithExtension(anims, "anim", ".xml", &paths);
+    collectSourcesWithExtension(animators, "animator", ".xml", &paths);
+    collectSourcesWithExtension(interpolators, "interpolator", ".xml", &paths);
+    collectSourcesWithExtension(transitions, "transition", ".xml", &paths);
+    collectSourcesWithExtension(xmls, "xml", ".xml", &paths);
+    collectSourcesWithExtension(drawables, "drawable", ".xml", &paths);
+    collectSourcesWithExtension(colors, "color", ".xml", &paths);
+    collectSourcesWithExtension(menus, "menu", ".xml", &paths);
+    return paths;
+}
+
+/*
+ * Has the --crunch-worker daemons crunch the images into the resource
+ * cache, where the ImagePreprocessor then finds them.
+ */
+static void crunchImagesOnWorkers(const Bundle* bundle, const sp<ResourceTypeSet>& drawables,
+                                  const sp<ResourceTypeSet>& mipmaps)
+{
+    Vector<String8> images;
+    if (drawables != NULL) {
+        collectImageSources(drawables, "drawable", &images);
+    }
+    if (mipmaps != NULL) {
+        collectImageSources(mipmaps, "mipmap", &images);
+    }
+    CrunchWorkers::crunch(bundle, images);
+}
+
+struct ParseValuesJob {
+    ParseValuesJob(const sp<AaptFile>& f, const ResTable_config& params, bool isOverlay)
+        : file(f), params(params), overlay(isOverlay), streamed(false), memory(xmlMemory(f)),
+          status(NO_ERROR) { }
+
+    sp<AaptFile> file;
+    ResTable_config params;
+    bool overlay;
+    // Without a --resource-cache to keep the tree in, the file is compiled
+    // from the stream rather than flattened into the block.
+    bool streamed;
+    ResXMLTree block;
+    XMLStream stream;
+    size_t memory;          // what the parsed file holds, for the MemoryBudget
+    status_t status;
+    SourcePos::ErrorBuffer errors;
+};
+
+class ParseValuesWorkUnit : public WorkQueue::WorkUnit {
+public:
+    ParseValuesWorkUnit(const Bundle* bundle, ParseValuesJob* job)
+        : mBundle(bundle), mJob(job) { }
+
+    virtual bool run() {
+        PhaseSpan span("parseValuesFile", mJob->file->getPrintableSource());
+        span.setBytes(mJob->file->getSize());
+        if (buildCanceled()) {
+            mJob->status = UNKNOWN_ERROR;
+            return true;
+        }
+        mJob->errors.begin();
+        mJob->streamed = mBundle->getResourceCacheDir() == NULL;
+        mJob->status = mJob->streamed
+                ? parseValuesStream(mJob->file, &mJob->stream)
+                : parseValuesFile(mBundle, mJob->file, &mJob->block);
+        mJob->errors.end();
+        return true; // continue even if there are errors
+    }
+
+private:
+    const Bundle* mBundle;
+    ParseValuesJob* mJob;
+};
+
+// Adds the contents of a parsed values file to the table.
+template <class Parser>
+static status_t compileParsedValues(Bundle* bundle, const sp<AaptAssets>& assets,
+                                    ResourceTable* table, ParseValuesJob* job, Parser& block)
+{
+    if (assets->isPruned(job->params)) {
+        return declareResourceFile(bundle, assets, job->file, block, job->params,
+                job->overlay, table);
+    }
+    return compileResourceFile(bundle, assets, job->file, block, job->params,
+            job->overlay, table);
+}
+
+/*
+ * Parses a batch of values files on a WorkQueue, the largest first, then
+ * adds their contents to the table one file at a time, in the order they
+ * were given.  Only the parsing is done in parallel, so the table is built
+ * exactly as it would be by a serial build.
+ */
+static bool compileValuesBatch(Bundle* bundle, const sp<AaptAssets>& assets,
+                               ResourceTable* table, Vector<ParseValuesJob*>* batch)
+{
+    bool hasErrors = false;
+    // The parsed files are all kept until they have been added, so the
+    // batch reserves them all at once.
+    size_t memory = 0;
+    for (size_t i = 0; i < batch->size(); i++) {
+        memory += batch->itemAt(i)->memory;
+    }
+    MemoryBudget::reserve(memory);
+
+    { // scope for the group; its units are done before the jobs are read
+        Vector<sp<AaptFile> > files;
+        files.setCapacity(batch->size());
+        for (size_t i = 0; i < batch->size(); i++) {
+            files.add(batch->itemAt(i)->file);
+        }
+        const Vector<size_t> order = largestFirst(files);
+
+        WorkQueue::Group group(WorkQueue::getShared());
+        const size_t N = order.size();
+        for (size_t i = 0; i < N; i++) {
+            ParseValuesJob* job = batch->itemAt(order[i]);
+            ParseValuesWorkUnit* w = new ParseValuesWorkUnit(bundle, job);
+            status_t status = group.schedule(w);
             if (status) {
-                fprintf(stderr, "preProcessImages failed: schedule() returned %d\n", status);
-                hasErrors = true;
+                fprintf(stderr, "compileValuesFiles failed: schedule() returned %d\n", status);
+                job->status = status;
                 delete w;
-                break;
             }
         }
-        status_t status = wq.finish();
-        if (status) {
-            fprintf(stderr, "preProcessImages failed: finish() returned %d\n", status);
+    }
+
+    const size_t N = batch->size();
+    for (size_t i = 0; i < N; i++) {
+        ParseValuesJob* job = batch->itemAt(i);
+        job->errors.flush();
+        if (job->status == NO_ERROR) {
+            job->status = job->streamed
+                    ? compileParsedValues(bundle, assets, table, job, job->stream)
+                    : compileParsedValues(bundle, assets, table, job, job->block);
+        }
+        if (job->status != NO_ERROR) {
             hasErrors = true;
         }
+        delete job;
+    }
+    batch->clear();
+    MemoryBudget::release(memory);
+    return hasErrors;
+}
+
+/*
+ * Compiles the values files of the base assets and then of each overlay.
+ * With --jobs greater than 1 the files are parsed in parallel, a bounded
+ * batch at a time to keep the parsed trees from piling up in memory.  With
+ * a MemoryBudget a batch is also cut short once its files would fill it.
+ */
+static status_t compileValuesFiles(Bundle* bundle, const sp<AaptAssets>& assets,
+                                   ResourceTable* table)
+{
+    PhaseSpan span("compileValuesFiles");
+    const size_t batchSize = bundle->getJobs() * 4;
+    const size_t batchMemory = MemoryBudget::getLimit();
+    bool hasErrors = false;
+    Vector<ParseValuesJob*> batch;
+    size_t memory = 0;
+
+    sp<AaptAssets> current = assets;
+    while(current.get()) {
+        KeyedVector<String8, sp<ResourceTypeSet> > *resources = 
+                current->getResources();
+
+        ssize_t index = resources->indexOfKey(String8("values"));
+        if (index >= 0) {
+            ResourceDirIterator it(resources->valueAt(index), String8("values"));
+            ssize_t res;
+            while ((res=it.next()) == NO_ERROR && !buildCanceled()) {
+                sp<AaptFile> file = it.getFile();
+                if (bundle->getJobs() <= 1) {
+                    // Values --prune-configs drops only have their names read.
+                    res = assets->isPruned(it.getParams())
+                            ? declareResourceFile(bundle, assets, file, it.getParams(),
+                                                  (current!=assets), table)
+                            : compileResourceFile(bundle, assets, file, it.getParams(),
+                                                  (current!=assets), table);
+                    if (res != NO_ERROR) {
+                        hasErrors = true;
+                    }
+                    continue;
+                }
+                ParseValuesJob* job = new ParseValuesJob(file, it.getParams(),
+                        current != assets);
+                if (batchMemory != 0 && !batch.isEmpty()
+                        && memory + job->memory > batchMemory) {
+                    if (compileValuesBatch(bundle, assets, table, &batch)) {
+                        hasErrors = true;
+                    }
+                    memory = 0;
+                }
+                batch.add(job);
+                memory += job->memory;
+                if (batch.size() >= batchSize) {
+                    if (compileValuesBatch(bundle, assets, table, &batch)) {
+                        hasErrors = true;
+                    }
+                    memory = 0;
+                }
+            }
+        }
+        current = current->getOverlay();
+    }
+
+    if (!batch.isEmpty() && compileValuesBatch(bundle, assets, table, &batch)) {
+        hasErrors = true;
     }
-    return (hasErrors || (res < NO_ERROR)) ? STATUST(UNKNOWN_ERROR) : NO_ERROR;
+    if (buildCanceled()) {
+        hasErrors = true;
+    }
+    return hasErrors ? STATUST(UNKNOWN_ERROR) : NO_ERROR;
 }
 
 static void collect_files(const sp<AaptDir>& dir,
@@ -467,13 +1034,50 @@ static void collect_files(const sp<AaptAssets>& ass,
     }
 }
 
+/*
+ * The base split's flattened resources.arsc, loaded into a ResTable only
+ * when something asks for it.  Parsing a large table again takes seconds,
+ * and validating the manifest only needs it for the rare attribute that is
+ * a reference; the density split checks and the feature index need it too.
+ */
+class LazyResTable {
+public:
+    LazyResTable() : mLoaded(false), mCorrupt(false) { }
+
+    void setFile(const sp<AaptFile>& file) { mFile = file; mLoaded = false; }
+
+    /*
+     * The table, loaded the first time.  Empty if there is no file, or if
+     * the file is corrupt, which is reported once.
+     */
+    ResTable& get() {
+        if (!mLoaded) {
+            mLoaded = true;
+            if (mFile != NULL
+                    && mTable.add(mFile->getData(), mFile->getSize()) != NO_ERROR) {
+                fprintf(stderr, "Generated resource table is corrupt.\n");
+                mCorrupt = true;
+            }
+        }
+        return mTable;
+    }
+
+    bool isCorrupt() const { return mCorrupt; }
+
+private:
+    sp<AaptFile> mFile;
+    ResTable mTable;
+    bool mLoaded;
+    bool mCorrupt;
+};
+
 enum {
     ATTR_OKAY = -1,
     ATTR_NOT_FOUND = -2,
     ATTR_LEADING_SPACES = -3,
     ATTR_TRAILING_SPACES = -4
 };
-static int validateAttr(const String8& path, const ResTable& table,
+static int validateAttr(const String8& path, LazyResTable& table,
         const ResXMLParser& parser,
         const char* ns, const char* attr, const char* validChars, bool required)
 {
@@ -487,7 +1091,7 @@ static int validateAttr(const String8& path, const ResTable& table,
         if (value.dataType == Res_value::TYPE_REFERENCE) {
             uint32_t specFlags = 0;
             int strIdx;
-            if ((strIdx=table.resolveReference(&value, 0x10000000, NULL, &specFlags)) < 0) {
+            if ((strIdx=table.get().resolveReference(&value, 0x10000000, NULL, &specFlags)) < 0) {
                 fprintf(stderr, "%s:%d: Tag <%s> attribute %s references unknown resid 0x%08x.\n",
                         path.string(), parser.getLineNumber(),
                         String8(parser.getElementName(&len)).string(), attr,
@@ -495,7 +1099,7 @@ static int validateAttr(const String8& path, const ResTable& table,
                 return ATTR_NOT_FOUND;
             }
             
-            pool = table.getTableStringBlock(strIdx);
+            pool = table.get().getTableStringBlock(strIdx);
             #if 0
             if (pool != NULL) {
                 str = pool->stringAt(value.data, &len);
@@ -574,124 +1178,411 @@ static int validateAttr(const String8& path, const ResTable& table,
     return ATTR_OKAY;
 }
 
-static void checkForIds(const String8& path, ResXMLParser& parser)
-{
-    ResXMLTree::event_code_t code;
-    while ((code=parser.next()) != ResXMLTree::END_DOCUMENT
-           && code > ResXMLTree::BAD_DOCUMENT) {
-        if (code == ResXMLTree::START_TAG) {
-            ssize_t index = parser.indexOfAttribute(NULL, "id");
-            if (index >= 0) {
-                fprintf(stderr, "%s:%d: warning: found plain 'id' attribute; did you mean the new 'android:id' name?\n",
-                        path.string(), parser.getLineNumber());
-            }
+/*
+ * Lets parallel compile work units enter the resolve stage one at a time,
+ * in the order they were scheduled, so that the ResourceTable sees exactly
+ * the same sequence of lookups and modifications as a serial build.
+ */
+class CompileXmlTurnstile {
+public:
+    CompileXmlTurnstile() : mNext(0) { }
+
+    void wait(size_t ticket) {
+        AutoMutex _l(mLock);
+        while (mNext != ticket) {
+            mCondition.wait(mLock);
         }
     }
-}
 
-static bool applyFileOverlay(Bundle *bundle,
-                             const sp<AaptAssets>& assets,
-                             sp<ResourceTypeSet> *baseSet,
-                             const char *resType)
-{
-    if (bundle->getVerbose()) {
-        printf("applyFileOverlay for %s\n", resType);
+    void advance() {
+        AutoMutex _l(mLock);
+        mNext++;
+        mCondition.broadcast();
     }
 
-    // Replace any base level files in this category with any found from the overlay
-    // Also add any found only in the overlay.
-    sp<AaptAssets> overlay = assets->getOverlay();
-    String8 resTypeString(resType);
+private:
+    Mutex mLock;
+    Condition mCondition;
+    size_t mNext;
+};
 
-    // work through the linked list of overlays
-    while (overlay.get()) {
-        KeyedVector<String8, sp<ResourceTypeSet> >* overlayRes = overlay->getResources();
+class ProguardKeepSet
+{
+public:
+    // { rule --> { file locations } }
+    KeyedVector<String8, SortedVector<String8> > rules;
 
-        // get the overlay resources of the requested type
-        ssize_t index = overlayRes->indexOfKey(resTypeString);
-        if (index >= 0) {
-            sp<ResourceTypeSet> overlaySet = overlayRes->valueAt(index);
+    void add(const String8& rule, const String8& where);
+    void add(const ProguardKeepSet& other);
+};
 
-            // for each of the resources, check for a match in the previously built
-            // non-overlay "baseset".
-            size_t overlayCount = overlaySet->size();
-            for (size_t overlayIndex=0; overlayIndex<overlayCount; overlayIndex++) {
-                if (bundle->getVerbose()) {
-                    printf("trying overlaySet Key=%s\n",overlaySet->keyAt(overlayIndex).string());
-                }
-                ssize_t baseIndex = -1;
-                if (baseSet->get() != NULL) {
-                    baseIndex = (*baseSet)->indexOfKey(overlaySet->keyAt(overlayIndex));
-                }
-                if (baseIndex >= 0) {
-                    // look for same flavor.  For a given file (strings.xml, for example)
-                    // there may be a locale specific or other flavors - we want to match
-                    // the same flavor.
-                    sp<AaptGroup> overlayGroup = overlaySet->valueAt(overlayIndex);
-                    sp<AaptGroup> baseGroup = (*baseSet)->valueAt(baseIndex);
-
-                    DefaultKeyedVector<AaptGroupEntry, sp<AaptFile> > overlayFiles =
-                            overlayGroup->getFiles();
-                    if (bundle->getVerbose()) {
-                        DefaultKeyedVector<AaptGroupEntry, sp<AaptFile> > baseFiles =
-                                baseGroup->getFiles();
-                        for (size_t i=0; i < baseFiles.size(); i++) {
-                            printf("baseFile " ZD " has flavor %s\n", (ZD_TYPE) i,
-                                    baseFiles.keyAt(i).toString().string());
-                        }
-                        for (size_t i=0; i < overlayFiles.size(); i++) {
-                            printf("overlayFile " ZD " has flavor %s\n", (ZD_TYPE) i,
-                                    overlayFiles.keyAt(i).toString().string());
-                        }
-                    }
+void ProguardKeepSet::add(const String8& rule, const String8& where)
+{
+    ssize_t index = rules.indexOfKey(rule);
+    if (index < 0) {
+        index = rules.add(rule, SortedVector<String8>());
+    }
+    rules.editValueAt(index).add(where);
+}
 
-                    size_t overlayGroupSize = overlayFiles.size();
-                    for (size_t overlayGroupIndex = 0;
-                            overlayGroupIndex<overlayGroupSize;
-                            overlayGroupIndex++) {
-                        ssize_t baseFileIndex =
-                                baseGroup->getFiles().indexOfKey(overlayFiles.
-                                keyAt(overlayGroupIndex));
-                        if (baseFileIndex >= 0) {
-                            if (bundle->getVerbose()) {
-                                printf("found a match (" ZD ") for overlay file %s, for flavor %s\n",
-                                        (ZD_TYPE) baseFileIndex,
-                                        overlayGroup->getLeaf().string(),
-                                        overlayFiles.keyAt(overlayGroupIndex).toString().string());
-                            }
-                            baseGroup->removeFile(baseFileIndex);
-                        } else {
-                            // didn't find a match fall through and add it..
-                            if (true || bundle->getVerbose()) {
-                                printf("nothing matches overlay file %s, for flavor %s\n",
-                                        overlayGroup->getLeaf().string(),
-                                        overlayFiles.keyAt(overlayGroupIndex).toString().string());
-                            }
-                        }
-                        baseGroup->addFile(overlayFiles.valueAt(overlayGroupIndex));
-                        assets->addGroupEntry(overlayFiles.keyAt(overlayGroupIndex));
-                    }
+void ProguardKeepSet::add(const ProguardKeepSet& other)
+{
+    const size_t N = other.rules.size();
+    for (size_t i = 0; i < N; i++) {
+        const SortedVector<String8>& locations = other.rules.valueAt(i);
+        const size_t M = locations.size();
+        for (size_t j = 0; j < M; j++) {
+            add(other.rules.keyAt(i), locations.itemAt(j));
+        }
+    }
+}
+
+static void* newKeepSet()
+{
+    return new ProguardKeepSet;
+}
+
+static void deleteKeepSet(void* keep)
+{
+    delete static_cast<ProguardKeepSet*>(keep);
+}
+
+// Keep rules for the classes named in layouts and other XML.  They are
+// gathered from each file's compiled tree as compileXmlFiles() produces it,
+// so writeProguardFile() never has to read those files again.  Each run
+// has its own, in its AaptContext.
+static ProguardKeepSet* xmlKeepRules()
+{
+    return static_cast<ProguardKeepSet*>(AaptContext::current()->getState(
+            AaptContext::STATE_XML_KEEP_RULES, newKeepSet, deleteKeepSet));
+}
+
+static void collectProguardRules(ProguardKeepSet* keep, const char* resType,
+        const sp<AaptFile>& file);
+
+struct CompileXmlJob {
+    CompileXmlJob(const String16& name, const sp<AaptFile>& f)
+        : resourceName(name), file(f), memory(0), status(NO_ERROR) { }
+
+    String16 resourceName;
+    sp<AaptFile> file;
+    size_t memory;          // reserved in the MemoryBudget until compiled
+    status_t status;
+    SourcePos::ErrorBuffer errors;
+    // Filled on the worker thread; merged in order once the queue is done.
+    ProguardKeepSet keep;
+};
+
+class CompileXmlWorkUnit : public WorkQueue::WorkUnit {
+public:
+    CompileXmlWorkUnit(const Bundle* bundle, const sp<AaptAssets>& assets,
+            ResourceTable* table, const char* resType, int xmlFlags, CompileXmlJob* job,
+            size_t ticket, CompileXmlTurnstile* turnstile) :
+            mBundle(bundle), mAssets(assets), mTable(table), mResType(resType),
+            mXmlFlags(xmlFlags), mJob(job), mTicket(ticket), mTurnstile(turnstile) {
+    }
+
+    virtual bool run() {
+        PhaseSpan span("compileXmlFile", mJob->file->getPrintableSource());
+        span.setBytes(mJob->file->getSize());
+        mJob->errors.begin();
+
+        // Parsing only needs the source file, so it runs unordered.
+        FileCostSpan parseCost(FileCosts::PARSE, mJob->file->getPrintableSource());
+        parseCost.setInputBytes(mJob->file->getSize());
+        XMLStream stream;
+        const bool parsed = !buildCanceled() && stream.parse(mJob->file) == NO_ERROR;
+        if (parsed) {
+            stream.prepare(mXmlFlags);
+        }
+        parseCost.end();
+
+        // Every unit must pass the turnstile, even if parsing failed,
+        // or the units after it would wait forever.
+        XMLNode::Arena arena;
+        sp<XMLNode> root;
+        {
+            PhaseSpan waitSpan("waitForTurn");
+            mTurnstile->wait(mTicket);
+        }
+        // The compile starts once it is this unit's turn.
+        FileCostSpan cost(FileCosts::COMPILE, mJob->file->getPrintableSource());
+        cost.setInputBytes(mJob->file->getSize());
+        cost.setCompiledXml(mJob->file.get());
+        if (parsed) {
+            bool needsTree;
+            mJob->status = stream.resolve(mBundle, mAssets, mJob->file, mTable,
+                    mXmlFlags, &needsTree);
+            if (mJob->status == NO_ERROR && needsTree) {
+                // Rare enough to just do all of it here.
+                root = XMLNode::parse(mJob->file, &arena);
+                if (root != NULL) {
+                    prepareXmlFile(root, mXmlFlags);
+                    mJob->status = resolveXmlFile(mBundle, mAssets, mJob->resourceName,
+                            root, mJob->file, mTable, mXmlFlags);
+                } else {
+                    mJob->status = UNKNOWN_ERROR;
+                }
+            }
+        } else {
+            mJob->status = UNKNOWN_ERROR;
+        }
+        mTurnstile->advance();
+
+        if (mJob->status == NO_ERROR) {
+            mJob->status = root != NULL
+                    ? flattenXmlFile(root, mJob->file, mXmlFlags)
+                    : flattenXmlFile(stream, mJob->file, mXmlFlags);
+        }
+        cost.end();
+        if (mJob->status == NO_ERROR
+                && (mBundle->getProguardFile() || mBundle->getCheckpointFile())) {
+            collectProguardRules(&mJob->keep, mResType, mJob->file);
+        }
+        if (mJob->status == NO_ERROR) {
+            spoolCompiledFile(mBundle, mJob->file);
+        }
+
+        MemoryBudget::release(mJob->memory);
+        mJob->errors.end();
+        return true; // continue even if there are errors
+    }
+
+private:
+    const Bundle* mBundle;
+    sp<AaptAssets> mAssets;
+    ResourceTable* mTable;
+    const char* mResType;
+    int mXmlFlags;
+    CompileXmlJob* mJob;
+    size_t mTicket;
+    CompileXmlTurnstile* mTurnstile;
+};
+
+/*
+ * Adds what --compact-xml strips to the XML compile options.
+ */
+static int compactXmlFlags(const Bundle* bundle, int xmlFlags)
+{
+    if (bundle->getCompactXml()) {
+        xmlFlags |= XML_COMPILE_STRIP_COMMENTS | XML_COMPILE_STRIP_RAW_VALUES
+                | XML_COMPILE_STRIP_LINE_NUMBERS;
+    }
+    return xmlFlags;
+}
+
+/*
+ * Compiles every XML file of the given resource type.  If xmlOnly is set,
+ * files that are not XML (such as images in drawable/) are skipped.
+ *
+ * With --jobs greater than 1 the files are compiled on a WorkQueue; errors
+ * are still reported in the same order as a serial build.
+ */
+static status_t compileXmlFiles(const Bundle* bundle, const sp<AaptAssets>& assets,
+                                ResourceTable* table, const sp<ResourceTypeSet>& set,
+                                const char* resType, int xmlFlags, bool xmlOnly,
+                                bool checkIds)
+{
+    PhaseSpan span("compileXmlFiles", String8(resType));
+    if (checkIds) {
+        // Found while the files are compiled, rather than by parsing
+        // their output again.
+        xmlFlags |= XML_COMPILE_WARN_PLAIN_IDS;
+    }
+    bool hasErrors = false;
+    ResourceDirIterator it(set, String8(resType));
+    status_t err;
+
+    if (bundle->getJobs() <= 1) {
+        while ((err=it.next()) == NO_ERROR && !buildCanceled()) {
+            if (xmlOnly && strcmp(it.getFile()->getPath().getPathExtension().string(),
+                    ".xml") != 0) {
+                continue;
+            }
+            err = compileXmlFile(bundle, assets, String16(it.getBaseName()),
+                    it.getFile(), table, xmlFlags);
+            if (err == NO_ERROR) {
+                if (bundle->getProguardFile() || bundle->getCheckpointFile()) {
+                    collectProguardRules(xmlKeepRules(), resType, it.getFile());
+                }
+                spoolCompiledFile(bundle, it.getFile());
+            } else {
+                hasErrors = true;
+            }
+        }
+        if (err < NO_ERROR || buildCanceled()) {
+            hasErrors = true;
+        }
+        return hasErrors ? STATUST(UNKNOWN_ERROR) : NO_ERROR;
+    }
+
+    Vector<CompileXmlJob*> jobs;
+    CompileXmlTurnstile turnstile;
+    { // scope for the group; its units are done before the jobs are read
+        WorkQueue::Group group(WorkQueue::getShared());
+        while ((err=it.next()) == NO_ERROR && !buildCanceled()) {
+            if (xmlOnly && strcmp(it.getFile()->getPath().getPathExtension().string(),
+                    ".xml") != 0) {
+                continue;
+            }
+            CompileXmlJob* job = new CompileXmlJob(String16(it.getBaseName()), it.getFile());
+            // Reserved in the order of the tickets, so that a unit only ever
+            // waits at the turnstile for one that already has its memory.
+            job->memory = xmlMemory(job->file);
+            MemoryBudget::reserve(job->memory);
+            CompileXmlWorkUnit* w = new CompileXmlWorkUnit(bundle, assets, table, resType,
+                    xmlFlags, job, jobs.size(), &turnstile);
+            status_t status = group.schedule(w);
+            if (status) {
+                fprintf(stderr, "compileXmlFiles failed: schedule() returned %d\n", status);
+                hasErrors = true;
+                MemoryBudget::release(job->memory);
+                delete w;
+                delete job;
+                break;
+            }
+            jobs.add(job);
+        }
+    }
+    if (err < NO_ERROR || buildCanceled()) {
+        hasErrors = true;
+    }
+
+    const size_t N = jobs.size();
+    for (size_t i = 0; i < N; i++) {
+        CompileXmlJob* job = jobs[i];
+        job->errors.flush();
+        if (job->status == NO_ERROR) {
+            xmlKeepRules()->add(job->keep);
+        } else {
+            hasErrors = true;
+        }
+        delete job;
+    }
+    return hasErrors ? STATUST(UNKNOWN_ERROR) : NO_ERROR;
+}
+
+/*
+ * Replace the files of "baseGroup" with those of "overlayGroup" that have
+ * the same flavor, and add the rest.
+ */
+static void mergeOverlayGroup(Bundle *bundle, const sp<AaptAssets>& assets,
+                              const sp<AaptGroup>& baseGroup,
+                              const sp<AaptGroup>& overlayGroup)
+{
+    // look for same flavor.  For a given file (strings.xml, for example)
+    // there may be a locale specific or other flavors - we want to match
+    // the same flavor.
+    DefaultKeyedVector<AaptGroupEntry, sp<AaptFile> > overlayFiles =
+            overlayGroup->getFiles();
+    if (bundle->getVerbose()) {
+        DefaultKeyedVector<AaptGroupEntry, sp<AaptFile> > baseFiles =
+                baseGroup->getFiles();
+        for (size_t i=0; i < baseFiles.size(); i++) {
+            printf("baseFile " ZD " has flavor %s\n", (ZD_TYPE) i,
+                    baseFiles.keyAt(i).toString().string());
+        }
+        for (size_t i=0; i < overlayFiles.size(); i++) {
+            printf("overlayFile " ZD " has flavor %s\n", (ZD_TYPE) i,
+                    overlayFiles.keyAt(i).toString().string());
+        }
+    }
+
+    size_t overlayGroupSize = overlayFiles.size();
+    for (size_t overlayGroupIndex = 0;
+            overlayGroupIndex<overlayGroupSize;
+            overlayGroupIndex++) {
+        ssize_t baseFileIndex =
+                baseGroup->getFiles().indexOfKey(overlayFiles.
+                keyAt(overlayGroupIndex));
+        if (baseFileIndex >= 0) {
+            if (bundle->getVerbose()) {
+                printf("found a match (" ZD ") for overlay file %s, for flavor %s\n",
+                        (ZD_TYPE) baseFileIndex,
+                        overlayGroup->getLeaf().string(),
+                        overlayFiles.keyAt(overlayGroupIndex).toString().string());
+            }
+            baseGroup->removeFile(baseFileIndex);
+        } else {
+            // didn't find a match fall through and add it..
+            if (true || bundle->getVerbose()) {
+                printf("nothing matches overlay file %s, for flavor %s\n",
+                        overlayGroup->getLeaf().string(),
+                        overlayFiles.keyAt(overlayGroupIndex).toString().string());
+            }
+        }
+        baseGroup->addFile(overlayFiles.valueAt(overlayGroupIndex));
+        assets->addGroupEntry(overlayFiles.keyAt(overlayGroupIndex));
+    }
+}
+
+static bool applyFileOverlay(Bundle *bundle,
+                             const sp<AaptAssets>& assets,
+                             sp<ResourceTypeSet> *baseSet,
+                             const char *resType)
+{
+    if (bundle->getVerbose()) {
+        printf("applyFileOverlay for %s\n", resType);
+    }
+
+    // Replace any base level files in this category with any found from the overlay
+    // Also add any found only in the overlay.
+    sp<AaptAssets> overlay = assets->getOverlay();
+    String8 resTypeString(resType);
+
+    // work through the linked list of overlays
+    while (overlay.get()) {
+        KeyedVector<String8, sp<ResourceTypeSet> >* overlayRes = overlay->getResources();
+
+        // get the overlay resources of the requested type
+        ssize_t index = overlayRes->indexOfKey(resTypeString);
+        if (index >= 0 && overlayRes->valueAt(index)->size() > 0) {
+            sp<ResourceTypeSet> overlaySet = overlayRes->valueAt(index);
+            if (baseSet->get() == NULL) {
+                *baseSet = new ResourceTypeSet();
+                assets->getResources()->add(String8(resType), *baseSet);
+            }
+
+            // Both sets are sorted by name, so they are merged in one pass
+            // into a new set, in order, rather than inserting each group
+            // that is only in the overlay into the middle of the base set.
+            const ResourceTypeSet& base = **baseSet;
+            const size_t baseCount = base.size();
+            const size_t overlayCount = overlaySet->size();
+            KeyedVector<String8, sp<AaptGroup> > merged;
+            merged.setCapacity(baseCount + overlayCount);
+
+            size_t baseIndex = 0;
+            for (size_t overlayIndex=0; overlayIndex<overlayCount; overlayIndex++) {
+                const String8& name = overlaySet->keyAt(overlayIndex);
+                if (bundle->getVerbose()) {
+                    printf("trying overlaySet Key=%s\n", name.string());
+                }
+                for (; baseIndex < baseCount && base.keyAt(baseIndex) < name; baseIndex++) {
+                    merged.add(base.keyAt(baseIndex), base.valueAt(baseIndex));
+                }
+
+                sp<AaptGroup> overlayGroup = overlaySet->valueAt(overlayIndex);
+                if (baseIndex < baseCount && base.keyAt(baseIndex) == name) {
+                    sp<AaptGroup> baseGroup = base.valueAt(baseIndex++);
+                    mergeOverlayGroup(bundle, assets, baseGroup, overlayGroup);
+                    merged.add(name, baseGroup);
                 } else {
-                    if (baseSet->get() == NULL) {
-                        *baseSet = new ResourceTypeSet();
-                        assets->getResources()->add(String8(resType), *baseSet);
-                    }
                     // this group doesn't exist (a file that's only in the overlay)
-                    (*baseSet)->add(overlaySet->keyAt(overlayIndex),
-                            overlaySet->valueAt(overlayIndex));
+                    merged.add(name, overlayGroup);
                     // make sure all flavors are defined in the resources.
-                    sp<AaptGroup> overlayGroup = overlaySet->valueAt(overlayIndex);
-                    DefaultKeyedVector<AaptGroupEntry, sp<AaptFile> > overlayFiles =
+                    const DefaultKeyedVector<AaptGroupEntry, sp<AaptFile> >& overlayFiles =
                             overlayGroup->getFiles();
-                    size_t overlayGroupSize = overlayFiles.size();
-                    for (size_t overlayGroupIndex = 0;
-                            overlayGroupIndex<overlayGroupSize;
-                            overlayGroupIndex++) {
-                        assets->addGroupEntry(overlayFiles.keyAt(overlayGroupIndex));
+                    for (size_t i = 0; i < overlayFiles.size(); i++) {
+                        assets->addGroupEntry(overlayFiles.keyAt(i));
                     }
                 }
             }
-            // this overlay didn't have resources for this type
+            for (; baseIndex < baseCount; baseIndex++) {
+                merged.add(base.keyAt(baseIndex), base.valueAt(baseIndex));
+            }
+
+            static_cast<KeyedVector<String8, sp<AaptGroup> >&>(**baseSet) = merged;
         }
         // try next overlay
         overlay = overlay->getOverlay();
@@ -1069,7 +1960,7 @@ status_t updatePreProcessedCache(Bundle* bundle)
     CrunchCache cc(source,dest,ff);
 
     CacheUpdater* cu = new SystemCacheUpdater(bundle);
-    size_t numFiles = cc.crunch(cu);
+    size_t numFiles = cc.crunch(cu, false, bundle->getJobs());
 
     if (bundle->getVerbose())
         fprintf(stdout, "Crunched %d PNG files to update cache\n", (int)numFiles);
@@ -1133,7 +2024,8 @@ status_t generateAndroidManifestForSplit(Bundle* bundle, const sp<AaptAssets>& a
     manifest->addChild(app);
     root->addChild(manifest);
 
-    int err = compileXmlFile(bundle, assets, String16(), root, outFile, table);
+    int err = compileXmlFile(bundle, assets, String16(), root, outFile, table,
+            compactXmlFlags(bundle, XML_COMPILE_STANDARD_RESOURCE));
     if (err < NO_ERROR) {
         return err;
     }
@@ -1141,64 +2033,269 @@ status_t generateAndroidManifestForSplit(Bundle* bundle, const sp<AaptAssets>& a
     return NO_ERROR;
 }
 
-status_t buildResources(Bundle* bundle, const sp<AaptAssets>& assets, sp<ApkBuilder>& builder)
+/*
+ * Returns the index of the split that addResourcesToBuilder() will put
+ * "file" in, or -1 if no split wants it.  Files of mipmap directories
+ * always go in the base split.
+ */
+static ssize_t getSplitIndexFor(const sp<ApkBuilder>& builder, const sp<AaptFile>& file,
+                                bool inBase)
 {
-    // First, look for a package file to parse.  This is required to
-    // be able to generate the resource information.
-    sp<AaptGroup> androidManifestFile =
-            assets->getFiles().valueFor(String8("AndroidManifest.xml"));
-    if (androidManifestFile == NULL) {
-        fprintf(stderr, "ERROR: No AndroidManifest.xml file found.\n");
-        return UNKNOWN_ERROR;
+    const Vector<sp<ApkSplit> >& splits = builder->getSplits();
+    const size_t numSplits = splits.size();
+    for (size_t i = 0; i < numSplits; i++) {
+        if (inBase ? splits[i]->isBase() : splits[i]->matches(file)) {
+            return i;
+        }
     }
+    return -1;
+}
 
-    status_t err = parsePackage(bundle, assets, androidManifestFile);
-    if (err != NO_ERROR) {
-        return err;
+/*
+ * A compiled file resource that dedupeFileResources() keeps.
+ */
+struct StoredFile {
+    sp<AaptFile> file;
+    String8 path;
+    ssize_t split;
+};
+
+/*
+ * Stores file resources that compiled to the same bytes only once, such
+ * as an image copied into several density directories.  The table entries
+ * of the copies are pointed at the first of them, which must go in the same
+ * split and have the same extension and compression, and the copies are
+ * left out of the archive.  Files that are only read when they are
+ * packaged, which have no data yet, are left alone.
+ */
+static void dedupeFileResources(Bundle* bundle, const sp<AaptAssets>& assets,
+                                ResourceTable* table, const sp<ApkBuilder>& builder)
+{
+    PhaseSpan span("dedupeFileResources");
+    const sp<AaptDir> res = assets->getDirs().valueFor(String8("res"));
+    if (res == NULL) {
+        return;
+    }
+
+    KeyedVector<uint64_t, Vector<StoredFile> > stored;
+    KeyedVector<String16, String16> remapped;
+    const DefaultKeyedVector<String8, sp<AaptDir> >& dirs = res->getDirs();
+    const size_t numDirs = dirs.size();
+    for (size_t i = 0; i < numDirs; i++) {
+        const sp<AaptDir>& dir = dirs.valueAt(i);
+        const char* dirStr = dir->getLeaf().string();
+        const bool inBase = strstr(dirStr, "mipmap") == dirStr;
+
+        Vector<String8> copies;
+        const DefaultKeyedVector<String8, sp<AaptGroup> >& groups = dir->getFiles();
+        const size_t numGroups = groups.size();
+        for (size_t j = 0; j < numGroups; j++) {
+            const sp<AaptGroup>& group = groups.valueAt(j);
+            if (group->getFiles().size() != 1) {
+                continue;
+            }
+            StoredFile f;
+            f.file = group->getFiles().valueAt(0);
+            f.path = group->getPath();
+            f.split = getSplitIndexFor(builder, f.file, inBase);
+            if (!f.file->hasData() || f.file->getSize() == 0 || f.split < 0) {
+                continue;
+            }
+
+            const uint64_t hash = ContentHasher::hash64(f.file->getData(), f.file->getSize());
+            ssize_t index = stored.indexOfKey(hash);
+            if (index < 0) {
+                index = stored.add(hash, Vector<StoredFile>());
+            }
+            Vector<StoredFile>& candidates = stored.editValueAt(index);
+            const StoredFile* original = NULL;
+            for (size_t k = 0; k < candidates.size(); k++) {
+                const StoredFile& c = candidates[k];
+                if (c.split == f.split
+                        && c.file->getSize() == f.file->getSize()
+                        && c.file->getCompressionMethod() == f.file->getCompressionMethod()
+                        && c.path.getPathExtension() == f.path.getPathExtension()
+                        && memcmp(c.file->getData(), f.file->getData(), f.file->getSize()) == 0) {
+                    original = &c;
+                    break;
+                }
+            }
+            if (original == NULL) {
+                candidates.add(f);
+                continue;
+            }
+
+            if (bundle->getVerbose()) {
+                printf("    (storing %s once, as %s)\n", f.path.string(),
+                        original->path.string());
+            }
+            remapped.add(String16(f.path), String16(original->path));
+            copies.add(groups.keyAt(j));
+        }
+
+        for (size_t j = 0; j < copies.size(); j++) {
+            dir->removeFile(copies[j]);
+        }
     }
 
-    if (kIsDebug) {
-        printf("Creating resources for package %s\n", assets->getPackage().string());
+    if (remapped.size() > 0) {
+        table->remapFilePaths(remapped);
     }
+}
 
-    ResourceTable::PackageType packageType = ResourceTable::App;
-    if (bundle->getBuildSharedLibrary()) {
-        packageType = ResourceTable::SharedLibrary;
-    } else if (bundle->getExtending()) {
-        packageType = ResourceTable::System;
-    } else if (!bundle->getFeatureOfPackage().isEmpty()) {
-        packageType = ResourceTable::AppFeature;
+/*
+ * Adds what a compiled XML file refers to, in attribute names and values,
+ * to "refs".  Does nothing for other files.
+ */
+static void collectXmlReferences(const sp<AaptFile>& file, Vector<uint32_t>* refs)
+{
+    if (!file->hasData() || file->getSize() < sizeof(ResXMLTree_header)
+            || dtohs(((const ResChunk_header*) file->getData())->type) != RES_XML_TYPE) {
+        return;
+    }
+    ResXMLTree tree;
+    if (tree.setToTrusted(file->getData(), file->getSize()) != NO_ERROR) {
+        return;
     }
 
-    ResourceTable table(bundle, String16(assets->getPackage()), packageType);
-    err = table.addIncludedResources(bundle, assets);
-    if (err != NO_ERROR) {
-        return err;
+    ResXMLParser::event_code_t code;
+    while ((code = tree.next()) != ResXMLParser::END_DOCUMENT
+            && code != ResXMLParser::BAD_DOCUMENT) {
+        if (code != ResXMLParser::START_TAG) {
+            continue;
+        }
+        const size_t N = tree.getAttributeCount();
+        for (size_t i = 0; i < N; i++) {
+            const uint32_t nameId = tree.getAttributeNameResID(i);
+            if (nameId != 0) {
+                refs->add(nameId);
+            }
+            Res_value value;
+            if (tree.getAttributeValue(i, &value) < 0 || value.data == 0) {
+                continue;
+            }
+            if (value.dataType == Res_value::TYPE_REFERENCE
+                    || value.dataType == Res_value::TYPE_ATTRIBUTE
+                    || value.dataType == Res_value::TYPE_DYNAMIC_REFERENCE) {
+                refs->add(value.data);
+            }
+        }
     }
+}
 
-    if (kIsDebug) {
-        printf("Found %d included resource packages\n", (int)table.size());
+/*
+ * Adds what each compiled XML file under res/ refers to to "fileRefs", by
+ * its path in the package.
+ */
+static void collectFileReferences(const sp<AaptAssets>& assets,
+                                  KeyedVector<String16, Vector<uint32_t> >* fileRefs)
+{
+    const sp<AaptDir> res = assets->getDirs().valueFor(String8("res"));
+    const size_t numDirs = res != NULL ? res->getDirs().size() : 0;
+    for (size_t i = 0; i < numDirs; i++) {
+        const DefaultKeyedVector<String8, sp<AaptGroup> >& groups =
+                res->getDirs().valueAt(i)->getFiles();
+        for (size_t j = 0; j < groups.size(); j++) {
+            const sp<AaptGroup>& group = groups.valueAt(j);
+            Vector<uint32_t> refs;
+            for (size_t k = 0; k < group->getFiles().size(); k++) {
+                collectXmlReferences(group->getFiles().valueAt(k), &refs);
+            }
+            if (refs.size() > 0) {
+                fileRefs->add(String16(group->getPath()), refs);
+            }
+        }
     }
+}
 
-    // Standard flags for compiled XML and optional UTF-8 encoding
-    int xmlFlags = XML_COMPILE_STANDARD_RESOURCE;
+/*
+ * Leaves out the resources that neither the manifest, public resources,
+ * the lists of --shrink-resources nor anything they refer to refers to,
+ * along with the files only those resources used.  Identifiers are not
+ * reassigned, so R classes stay valid.
+ */
+static status_t shrinkResources(Bundle* bundle, const sp<AaptAssets>& assets,
+                                ResourceTable* table, const sp<AaptFile>& manifestFile)
+{
+    PhaseSpan span("shrinkResources");
+    SortedVector<uint32_t> roots;
+    const Vector<String8>& keepFiles = bundle->getShrinkKeepFiles();
+    for (size_t i = 0; i < keepFiles.size(); i++) {
+        status_t err = table->loadKeptResources(keepFiles[i].string(), &roots);
+        if (err != NO_ERROR) {
+            return err;
+        }
+    }
+    Vector<uint32_t> manifestRefs;
+    collectXmlReferences(manifestFile, &manifestRefs);
+    for (size_t i = 0; i < manifestRefs.size(); i++) {
+        roots.add(manifestRefs[i]);
+    }
 
-    /* Only enable UTF-8 if the caller of aapt didn't specifically
-     * request UTF-16 encoding and the parameters of this package
-     * allow UTF-8 to be used.
-     */
-    if (!bundle->getUTF16StringsOption()) {
-        xmlFlags |= XML_COMPILE_UTF8;
+    const sp<AaptDir> res = assets->getDirs().valueFor(String8("res"));
+    const size_t numDirs = res != NULL ? res->getDirs().size() : 0;
+    KeyedVector<String16, Vector<uint32_t> > fileRefs;
+    collectFileReferences(assets, &fileRefs);
+
+    SortedVector<String16> unusedFiles;
+    const size_t removed = table->removeUnreachable(roots, fileRefs, &unusedFiles);
+
+    for (size_t i = 0; i < numDirs && unusedFiles.size() > 0; i++) {
+        const sp<AaptDir>& dir = res->getDirs().valueAt(i);
+        Vector<String8> unused;
+        const DefaultKeyedVector<String8, sp<AaptGroup> >& groups = dir->getFiles();
+        for (size_t j = 0; j < groups.size(); j++) {
+            if (unusedFiles.indexOf(String16(groups.valueAt(j)->getPath())) >= 0) {
+                unused.add(groups.keyAt(j));
+            }
+        }
+        for (size_t j = 0; j < unused.size(); j++) {
+            dir->removeFile(unused[j]);
+        }
     }
 
-    // --------------------------------------------------------------
-    // First, gather all resource information.
-    // --------------------------------------------------------------
+    if (bundle->getVerbose()) {
+        printf("  Left out %zu unreferenced resources and %zu files.\n",
+                removed, unusedFiles.size());
+    }
+    return NO_ERROR;
+}
 
-    // resType -> leafName -> group
-    KeyedVector<String8, sp<ResourceTypeSet> > *resources = 
-            new KeyedVector<String8, sp<ResourceTypeSet> >;
-    collect_files(assets, resources);
+/*
+ * What the steps of buildResources() share: the table they fill in, the
+ * resource type sets collectFiles() finds, and whether any of them has
+ * failed.  A step's errors that still let the others report theirs are
+ * noted here rather than stopping the build.
+ */
+struct BuildState {
+    BuildState(Bundle* bundle, const sp<AaptAssets>& assets, ResourceTable* table,
+            int xmlFlags, const sp<AaptFile>& manifestFile) :
+            bundle(bundle), assets(assets), table(table), xmlFlags(xmlFlags),
+            manifestFile(manifestFile), images(bundle, assets), readahead(NULL),
+            errors(0), platformVersionStatus(NO_ERROR) { }
+
+    // Stops reading ahead; by then it has long run out of files, or is
+    // waiting for the build to open the next ones.
+    ~BuildState() { delete readahead; }
+
+    void noteError() { android_atomic_inc(&errors); }
+    bool hasErrors() { return android_atomic_acquire_load(&errors) != 0; }
+
+    status_t addIncludedResources();
+    status_t collectFiles();
+    status_t prepareFiles();
+    status_t compileValues();
+    status_t assignResourceIds();
+    status_t waitForImages();
+    status_t compileGeneratedFiles();
+    status_t readPlatformBuildVersion();
+    status_t parseManifest();
+
+    Bundle* const bundle;
+    const sp<AaptAssets> assets;
+    ResourceTable* const table;
+    const int xmlFlags;
+    const sp<AaptFile> manifestFile;
 
     sp<ResourceTypeSet> drawables;
     sp<ResourceTypeSet> layouts;
@@ -1212,6 +2309,41 @@ status_t buildResources(Bundle* bundle, const sp<AaptAssets>& assets, sp<ApkBuil
     sp<ResourceTypeSet> menus;
     sp<ResourceTypeSet> mipmaps;
 
+    ImagePreprocessor images;
+    Readahead* readahead;
+    volatile int32_t errors;
+
+    status_t platformVersionStatus;
+    sp<XMLNode> manifestTree;
+};
+
+status_t BuildState::addIncludedResources()
+{
+    PhaseSpan span("addIncludedResources");
+    status_t err = table->addIncludedResources(bundle, assets);
+    if (err != NO_ERROR) {
+        return err;
+    }
+    span.end();
+    MemStats::checkpoint("addIncludedResources");
+    // What comes next is the build itself.
+    StartupProfile::mark("addIncludedResources");
+    StartupProfile::report(stdout);
+
+    if (kIsDebug) {
+        printf("Found %d included resource packages\n", (int)table->size());
+    }
+    return NO_ERROR;
+}
+
+status_t BuildState::collectFiles()
+{
+    // resType -> leafName -> group
+    PhaseSpan span("collectFiles");
+    KeyedVector<String8, sp<ResourceTypeSet> > *resources = 
+            new KeyedVector<String8, sp<ResourceTypeSet> >;
+    collect_files(assets, resources);
+
     ASSIGN_IT(drawable);
     ASSIGN_IT(layout);
     ASSIGN_IT(anim);
@@ -1248,332 +2380,368 @@ status_t buildResources(Bundle* bundle, const sp<AaptAssets>& assets, sp<ApkBuil
             !applyFileOverlay(bundle, assets, &mipmaps, "mipmap")) {
         return UNKNOWN_ERROR;
     }
+    span.end();
+    MemStats::checkpoint("collectFiles");
+    return NO_ERROR;
+}
 
-    bool hasErrors = false;
-
-    if (drawables != NULL) {
-        if (bundle->getOutputAPKFile() != NULL) {
-            err = preProcessImages(bundle, assets, drawables, "drawable");
-        }
-        if (err == NO_ERROR) {
-            err = makeFileResources(bundle, assets, &table, drawables, "drawable");
-            if (err != NO_ERROR) {
-                hasErrors = true;
-            }
-        } else {
-            hasErrors = true;
-        }
+/*
+ * Starts what runs alongside the compile steps: reading the sources ahead,
+ * fetching cached outputs and crunching the images.
+ */
+status_t BuildState::prepareFiles()
+{
+    // Before the prefetching, which would otherwise look for the images
+    // on the server before the workers have put them there.
+    if (!bundle->getCrunchWorkers().isEmpty() && bundle->getOutputAPKFile() != NULL) {
+        crunchImagesOnWorkers(bundle, drawables, mipmaps);
+        MemStats::checkpoint("crunchOnWorkers");
     }
 
-    if (mipmaps != NULL) {
-        if (bundle->getOutputAPKFile() != NULL) {
-            err = preProcessImages(bundle, assets, mipmaps, "mipmap");
-        }
-        if (err == NO_ERROR) {
-            err = makeFileResources(bundle, assets, &table, mipmaps, "mipmap");
-            if (err != NO_ERROR) {
-                hasErrors = true;
-            }
-        } else {
-            hasErrors = true;
-        }
-    }
+    readahead = new Readahead(collectReadaheadSources(bundle, assets, drawables, mipmaps,
+            layouts, anims, animators, interpolators, transitions, xmls, colors, menus),
+            kReadaheadWindowBytes);
 
-    if (layouts != NULL) {
-        err = makeFileResources(bundle, assets, &table, layouts, "layout");
-        if (err != NO_ERROR) {
-            hasErrors = true;
-        }
+    if (RemoteCache::isEnabled()) {
+        prefetchCachedOutputs(bundle, assets, drawables, mipmaps);
     }
 
-    if (anims != NULL) {
-        err = makeFileResources(bundle, assets, &table, anims, "anim");
-        if (err != NO_ERROR) {
-            hasErrors = true;
-        }
+    if (bundle->getWebpImages() && !bundle->isMinSdkAtLeast(SDK_JELLY_BEAN_MR2)) {
+        fprintf(stderr, "WARNING: --webp needs a minSdkVersion of at least 18;"
+                " keeping PNG images.\n");
     }
 
-    if (animators != NULL) {
-        err = makeFileResources(bundle, assets, &table, animators, "animator");
-        if (err != NO_ERROR) {
-            hasErrors = true;
-        }
-    }
-
-    if (transitions != NULL) {
-        err = makeFileResources(bundle, assets, &table, transitions, "transition");
-        if (err != NO_ERROR) {
-            hasErrors = true;
-        }
-    }
-
-    if (interpolators != NULL) {
-        err = makeFileResources(bundle, assets, &table, interpolators, "interpolator");
-        if (err != NO_ERROR) {
-            hasErrors = true;
-        }
+    // The images are crunched while the other resources are collected and
+    // the values compiled, and waited for before the drawable XML is compiled.
+    if (bundle->getOutputAPKFile() != NULL && !bundle->getUseCrunchCache()) {
+        PhaseSpan span("preProcessImages");
+        images.add(drawables, "drawable", true);
+        images.add(mipmaps, "mipmap", false);
+        images.start();
     }
+    return NO_ERROR;
+}
 
-    if (xmls != NULL) {
-        err = makeFileResources(bundle, assets, &table, xmls, "xml");
-        if (err != NO_ERROR) {
-            hasErrors = true;
-        }
-    }
+status_t BuildState::compileValues()
+{
+    // After the file resources that come before the values.
+    MemStats::checkpoint("makeFileResources");
 
-    if (raws != NULL) {
-        err = makeFileResources(bundle, assets, &table, raws, "raw");
-        if (err != NO_ERROR) {
-            hasErrors = true;
-        }
+    if (compileValuesFiles(bundle, assets, table) != NO_ERROR) {
+        noteError();
     }
+    return NO_ERROR;
+}
 
-    // compile resources
-    current = assets;
-    while(current.get()) {
-        KeyedVector<String8, sp<ResourceTypeSet> > *resources = 
-                current->getResources();
-
-        ssize_t index = resources->indexOfKey(String8("values"));
-        if (index >= 0) {
-            ResourceDirIterator it(resources->valueAt(index), String8("values"));
-            ssize_t res;
-            while ((res=it.next()) == NO_ERROR) {
-                sp<AaptFile> file = it.getFile();
-                res = compileResourceFile(bundle, assets, file, it.getParams(), 
-                                          (current!=assets), &table);
-                if (res != NO_ERROR) {
-                    hasErrors = true;
-                }
+status_t BuildState::assignResourceIds()
+{
+    MemStats::checkpoint("compileValuesFiles");
+
+    if (table->hasResources()) {
+        PhaseSpan span("assignResourceIds");
+        status_t err;
+        if (bundle->getStableIdsFile()) {
+            err = table->loadStableIds(bundle->getStableIdsFile());
+            if (err < NO_ERROR) {
+                return err;
             }
         }
-        current = current->getOverlay();
-    }
-
-    if (colors != NULL) {
-        err = makeFileResources(bundle, assets, &table, colors, "color");
-        if (err != NO_ERROR) {
-            hasErrors = true;
-        }
-    }
-
-    if (menus != NULL) {
-        err = makeFileResources(bundle, assets, &table, menus, "menu");
-        if (err != NO_ERROR) {
-            hasErrors = true;
-        }
-    }
-
-    // --------------------------------------------------------------------
-    // Assignment of resource IDs and initial generation of resource table.
-    // --------------------------------------------------------------------
-
-    if (table.hasResources()) {
-        err = table.assignResourceIds();
+        err = table->assignResourceIds();
         if (err < NO_ERROR) {
             return err;
         }
     }
+    MemStats::checkpoint("assignResourceIds");
+    return NO_ERROR;
+}
 
-    // --------------------------------------------------------------
-    // Finally, we can now we can compile XML files, which may reference
-    // resources.
-    // --------------------------------------------------------------
-
-    if (layouts != NULL) {
-        ResourceDirIterator it(layouts, String8("layout"));
-        while ((err=it.next()) == NO_ERROR) {
-            String8 src = it.getFile()->getPrintableSource();
-            err = compileXmlFile(bundle, assets, String16(it.getBaseName()),
-                    it.getFile(), &table, xmlFlags);
-            if (err == NO_ERROR) {
-                ResXMLTree block;
-                block.setTo(it.getFile()->getData(), it.getFile()->getSize(), true);
-                checkForIds(src, block);
-            } else {
-                hasErrors = true;
-            }
-        }
-
-        if (err < NO_ERROR) {
-            hasErrors = true;
-        }
-        err = NO_ERROR;
+status_t BuildState::waitForImages()
+{
+    if (images.wait() != NO_ERROR) {
+        noteError();
+    }
+    if (bundle->getSimilarImagesReport() != NULL && bundle->getOutputAPKFile() != NULL
+            && writeSimilarImagesReport(bundle->getSimilarImagesReport()) != NO_ERROR) {
+        noteError();
     }
+    MemStats::checkpoint("preProcessImages");
+    return NO_ERROR;
+}
 
-    if (anims != NULL) {
-        ResourceDirIterator it(anims, String8("anim"));
-        while ((err=it.next()) == NO_ERROR) {
-            err = compileXmlFile(bundle, assets, String16(it.getBaseName()),
-                    it.getFile(), &table, xmlFlags);
-            if (err != NO_ERROR) {
-                hasErrors = true;
-            }
-        }
+status_t BuildState::compileGeneratedFiles()
+{
+    MemStats::checkpoint("compileXmlFiles");
 
-        if (err < NO_ERROR) {
-            hasErrors = true;
+    PhaseSpan span("compileGeneratedFiles");
+    std::queue<CompileResourceWorkItem>& workQueue = table->getWorkQueue();
+    while (!workQueue.empty()) {
+        CompileResourceWorkItem& workItem = workQueue.front();
+        status_t err = compileXmlFile(bundle, assets, workItem.resourceName, workItem.file,
+                table, xmlFlags);
+        if (err == NO_ERROR) {
+            assets->addResource(workItem.resPath.getPathLeaf(),
+                    workItem.resPath,
+                    workItem.file,
+                    workItem.file->getResourceType());
+        } else {
+            noteError();
         }
-        err = NO_ERROR;
+        workQueue.pop();
     }
+    span.end();
+    MemStats::checkpoint("compileGeneratedFiles");
+    return NO_ERROR;
+}
 
-    if (animators != NULL) {
-        ResourceDirIterator it(animators, String8("animator"));
-        while ((err=it.next()) == NO_ERROR) {
-            err = compileXmlFile(bundle, assets, String16(it.getBaseName()),
-                    it.getFile(), &table, xmlFlags);
-            if (err != NO_ERROR) {
-                hasErrors = true;
-            }
-        }
+/*
+ * The two steps the manifest needs before it is compiled.  A serial build
+ * only gets to them without errors, and then doesn't report any more.
+ */
+status_t BuildState::readPlatformBuildVersion()
+{
+    if (!hasErrors()) {
+        platformVersionStatus = extractPlatformBuildVersion(assets->getAssetManager(), bundle);
+    }
+    return NO_ERROR;
+}
 
-        if (err < NO_ERROR) {
-            hasErrors = true;
-        }
-        err = NO_ERROR;
+status_t BuildState::parseManifest()
+{
+    if (!hasErrors()) {
+        PhaseSpan span("parseManifest", manifestFile->getPrintableSource());
+        manifestFile->clearData();
+        manifestTree = XMLNode::parse(manifestFile);
     }
+    return NO_ERROR;
+}
 
-    if (interpolators != NULL) {
-        ResourceDirIterator it(interpolators, String8("interpolator"));
-        while ((err=it.next()) == NO_ERROR) {
-            err = compileXmlFile(bundle, assets, String16(it.getBaseName()),
-                    it.getFile(), &table, xmlFlags);
-            if (err != NO_ERROR) {
-                hasErrors = true;
-            }
-        }
+/* Runs one of the steps of a BuildState. */
+class BuildStep : public TaskGraph::Task {
+public:
+    BuildStep(BuildState* state, status_t (BuildState::*step)()) :
+            mState(state), mStep(step) { }
 
-        if (err < NO_ERROR) {
-            hasErrors = true;
-        }
-        err = NO_ERROR;
+    virtual status_t run() {
+        return (mState->*mStep)();
     }
 
-    if (transitions != NULL) {
-        ResourceDirIterator it(transitions, String8("transition"));
-        while ((err=it.next()) == NO_ERROR) {
-            err = compileXmlFile(bundle, assets, String16(it.getBaseName()),
-                    it.getFile(), &table, xmlFlags);
-            if (err != NO_ERROR) {
-                hasErrors = true;
-            }
-        }
+private:
+    BuildState* const mState;
+    status_t (BuildState::* const mStep)();
+};
 
-        if (err < NO_ERROR) {
-            hasErrors = true;
+/* Adds the files of a resource type set to the table, if there are any. */
+class MakeFileResourcesStep : public TaskGraph::Task {
+public:
+    MakeFileResourcesStep(BuildState* state, const sp<ResourceTypeSet>* set,
+            const char* resType) :
+            mState(state), mSet(set), mResType(resType) { }
+
+    virtual status_t run() {
+        if (*mSet != NULL && makeFileResources(mState->bundle, mState->assets, mState->table,
+                *mSet, mResType) != NO_ERROR) {
+            mState->noteError();
         }
-        err = NO_ERROR;
+        return NO_ERROR;
     }
 
-    if (xmls != NULL) {
-        ResourceDirIterator it(xmls, String8("xml"));
-        while ((err=it.next()) == NO_ERROR) {
-            err = compileXmlFile(bundle, assets, String16(it.getBaseName()),
-                    it.getFile(), &table, xmlFlags);
-            if (err != NO_ERROR) {
-                hasErrors = true;
-            }
-        }
+private:
+    BuildState* const mState;
+    const sp<ResourceTypeSet>* const mSet;     // filled in by collectFiles()
+    const char* const mResType;
+};
 
-        if (err < NO_ERROR) {
-            hasErrors = true;
+/* Compiles the XML files of a resource type set, if there are any. */
+class CompileXmlStep : public TaskGraph::Task {
+public:
+    CompileXmlStep(BuildState* state, const sp<ResourceTypeSet>* set, const char* resType,
+            int xmlFlags, bool xmlOnly, bool checkIds) :
+            mState(state), mSet(set), mResType(resType), mXmlFlags(xmlFlags),
+            mXmlOnly(xmlOnly), mCheckIds(checkIds) { }
+
+    virtual status_t run() {
+        if (*mSet != NULL && compileXmlFiles(mState->bundle, mState->assets, mState->table,
+                *mSet, mResType, mXmlFlags, mXmlOnly, mCheckIds) != NO_ERROR) {
+            mState->noteError();
         }
-        err = NO_ERROR;
+        return NO_ERROR;
     }
 
-    if (drawables != NULL) {
-        ResourceDirIterator it(drawables, String8("drawable"));
-        while ((err=it.next()) == NO_ERROR) {
-            err = postProcessImage(bundle, assets, &table, it.getFile());
-            if (err != NO_ERROR) {
-                hasErrors = true;
-            }
-        }
+private:
+    BuildState* const mState;
+    const sp<ResourceTypeSet>* const mSet;     // filled in by collectFiles()
+    const char* const mResType;
+    const int mXmlFlags;
+    const bool mXmlOnly;
+    const bool mCheckIds;
+};
 
-        if (err < NO_ERROR) {
-            hasErrors = true;
-        }
-        err = NO_ERROR;
-    }
+/* Adds "task" to "graph" after step "before".  Returns its index. */
+static size_t addAfter(TaskGraph* graph, size_t before, TaskGraph::Task* task)
+{
+    const size_t index = graph->add(task);
+    graph->addDependency(index, before);
+    return index;
+}
 
-    if (colors != NULL) {
-        ResourceDirIterator it(colors, String8("color"));
-        while ((err=it.next()) == NO_ERROR) {
-            err = compileXmlFile(bundle, assets, String16(it.getBaseName()),
-                    it.getFile(), &table, xmlFlags);
-            if (err != NO_ERROR) {
-                hasErrors = true;
-            }
-        }
+status_t buildResources(Bundle* bundle, const sp<AaptAssets>& assets, sp<ApkBuilder>& builder)
+{
+    PhaseSpan buildSpan("buildResources");
 
-        if (err < NO_ERROR) {
-            hasErrors = true;
-        }
-        err = NO_ERROR;
+    // First, look for a package file to parse.  This is required to
+    // be able to generate the resource information.
+    sp<AaptGroup> androidManifestFile =
+            assets->getFiles().valueFor(String8("AndroidManifest.xml"));
+    if (androidManifestFile == NULL) {
+        fprintf(stderr, "ERROR: No AndroidManifest.xml file found.\n");
+        return UNKNOWN_ERROR;
     }
 
-    if (menus != NULL) {
-        ResourceDirIterator it(menus, String8("menu"));
-        while ((err=it.next()) == NO_ERROR) {
-            String8 src = it.getFile()->getPrintableSource();
-            err = compileXmlFile(bundle, assets, String16(it.getBaseName()),
-                    it.getFile(), &table, xmlFlags);
-            if (err == NO_ERROR) {
-                ResXMLTree block;
-                block.setTo(it.getFile()->getData(), it.getFile()->getSize(), true);
-                checkForIds(src, block);
-            } else {
-                hasErrors = true;
-            }
-        }
-
-        if (err < NO_ERROR) {
-            hasErrors = true;
-        }
-        err = NO_ERROR;
+    status_t err = parsePackage(bundle, assets, androidManifestFile);
+    if (err != NO_ERROR) {
+        return err;
     }
+    StartupProfile::mark("parseManifest");
 
-    // Now compile any generated resources.
-    std::queue<CompileResourceWorkItem>& workQueue = table.getWorkQueue();
-    while (!workQueue.empty()) {
-        CompileResourceWorkItem& workItem = workQueue.front();
-        err = compileXmlFile(bundle, assets, workItem.resourceName, workItem.file, &table, xmlFlags);
-        if (err == NO_ERROR) {
-            assets->addResource(workItem.resPath.getPathLeaf(),
-                    workItem.resPath,
-                    workItem.file,
-                    workItem.file->getResourceType());
-        } else {
-            hasErrors = true;
-        }
-        workQueue.pop();
+    if (kIsDebug) {
+        printf("Creating resources for package %s\n", assets->getPackage().string());
     }
 
-    if (table.validateLocalizations()) {
-        hasErrors = true;
+    ResourceTable::PackageType packageType = ResourceTable::App;
+    if (bundle->getBuildSharedLibrary()) {
+        packageType = ResourceTable::SharedLibrary;
+    } else if (bundle->getExtending()) {
+        packageType = ResourceTable::System;
+    } else if (!bundle->getFeatureOfPackage().isEmpty()) {
+        packageType = ResourceTable::AppFeature;
     }
-    
-    if (hasErrors) {
+
+    if ((bundle->getCollapseKeyNamesFile() != NULL || !bundle->getShrinkKeepFiles().isEmpty())
+            && (packageType == ResourceTable::SharedLibrary
+                || packageType == ResourceTable::System)) {
+        fprintf(stderr, "ERROR: --collapse-key-names and --shrink-resources can't be used "
+                "for a shared library or a system package, whose resources are looked up "
+                "by name\n");
         return UNKNOWN_ERROR;
     }
 
+    ResourceTable table(bundle, String16(assets->getPackage()), packageType);
+
+    // Standard flags for compiled XML and optional UTF-8 encoding
+    int xmlFlags = XML_COMPILE_STANDARD_RESOURCE;
+
+    /* Only enable UTF-8 if the caller of aapt didn't specifically
+     * request UTF-16 encoding and the parameters of this package
+     * allow UTF-8 to be used.
+     */
+    if (!bundle->getUTF16StringsOption()) {
+        xmlFlags |= XML_COMPILE_UTF8;
+    }
+    xmlFlags = compactXmlFlags(bundle, xmlFlags);
+
+    // --------------------------------------------------------------
+    // Gather all resource information, assign the resource IDs, then
+    // compile the XML files, which may reference resources.
+    //
+    // Steps that don't depend on each other overlap with --jobs: the
+    // included packages load while the files are collected and the images
+    // crunched, and the manifest is read meanwhile.  The steps that add to
+    // the table or report per-file errors still follow one another in the
+    // order of a serial build, so that the IDs and the diagnostics come out
+    // the same.
+    // --------------------------------------------------------------
+
+    BuildState state(bundle, assets, &table, xmlFlags,
+            androidManifestFile->getFiles().valueAt(0));
+    TaskGraph graph;
+
+    const size_t includes = graph.add(new BuildStep(&state, &BuildState::addIncludedResources));
+    const size_t collect = graph.add(new BuildStep(&state, &BuildState::collectFiles));
+    const size_t prepare = addAfter(&graph, collect,
+            new BuildStep(&state, &BuildState::prepareFiles));
+
+    size_t last = graph.add(new MakeFileResourcesStep(&state, &state.drawables, "drawable"));
+    graph.addDependency(last, includes);
+    graph.addDependency(last, collect);
+    last = addAfter(&graph, last, new MakeFileResourcesStep(&state, &state.mipmaps, "mipmap"));
+    last = addAfter(&graph, last, new MakeFileResourcesStep(&state, &state.layouts, "layout"));
+    last = addAfter(&graph, last, new MakeFileResourcesStep(&state, &state.anims, "anim"));
+    last = addAfter(&graph, last,
+            new MakeFileResourcesStep(&state, &state.animators, "animator"));
+    last = addAfter(&graph, last,
+            new MakeFileResourcesStep(&state, &state.transitions, "transition"));
+    last = addAfter(&graph, last,
+            new MakeFileResourcesStep(&state, &state.interpolators, "interpolator"));
+    last = addAfter(&graph, last, new MakeFileResourcesStep(&state, &state.xmls, "xml"));
+    last = addAfter(&graph, last, new MakeFileResourcesStep(&state, &state.raws, "raw"));
+
+    // After the prefetching has started, so that the values files find
+    // what the RemoteCache has for them.
+    last = addAfter(&graph, last, new BuildStep(&state, &BuildState::compileValues));
+    graph.addDependency(last, prepare);
+    last = addAfter(&graph, last, new MakeFileResourcesStep(&state, &state.colors, "color"));
+    last = addAfter(&graph, last, new MakeFileResourcesStep(&state, &state.menus, "menu"));
+
+    const size_t ids = addAfter(&graph, last,
+            new BuildStep(&state, &BuildState::assignResourceIds));
+    // Only the drawable XML needs the images; the other types are compiled
+    // while the last of them are crunched.
+    const size_t crunched = addAfter(&graph, ids,
+            new BuildStep(&state, &BuildState::waitForImages));
+    graph.addDependency(crunched, prepare);
+
+    last = addAfter(&graph, ids, new CompileXmlStep(&state, &state.layouts, "layout", xmlFlags,
+            false, true));
+    last = addAfter(&graph, last, new CompileXmlStep(&state, &state.anims, "anim", xmlFlags,
+            false, false));
+    last = addAfter(&graph, last, new CompileXmlStep(&state, &state.animators, "animator",
+            xmlFlags, false, false));
+    last = addAfter(&graph, last, new CompileXmlStep(&state, &state.interpolators,
+            "interpolator", xmlFlags, false, false));
+    last = addAfter(&graph, last, new CompileXmlStep(&state, &state.transitions, "transition",
+            xmlFlags, false, false));
+    last = addAfter(&graph, last, new CompileXmlStep(&state, &state.xmls, "xml", xmlFlags,
+            false, false));
+    // Images were already processed; only drawable XML is left to compile.
+    last = addAfter(&graph, last, new CompileXmlStep(&state, &state.drawables, "drawable",
+            compactXmlFlags(bundle, XML_COMPILE_STANDARD_RESOURCE), true, false));
+    graph.addDependency(last, crunched);
+    last = addAfter(&graph, last, new CompileXmlStep(&state, &state.colors, "color", xmlFlags,
+            false, false));
+    last = addAfter(&graph, last, new CompileXmlStep(&state, &state.menus, "menu", xmlFlags,
+            false, true));
+
+    // Now compile any generated resources.
+    addAfter(&graph, last, new BuildStep(&state, &BuildState::compileGeneratedFiles));
+
     // If we're not overriding the platform build versions,
     // extract them from the platform APK.
     if (packageType != ResourceTable::System &&
             (bundle->getPlatformBuildVersionCode() == "" ||
             bundle->getPlatformBuildVersionName() == "")) {
-        err = extractPlatformBuildVersion(assets->getAssetManager(), bundle);
-        if (err != NO_ERROR) {
-            return UNKNOWN_ERROR;
-        }
+        addAfter(&graph, includes, new BuildStep(&state, &BuildState::readPlatformBuildVersion));
+    }
+    graph.add(new BuildStep(&state, &BuildState::parseManifest));
+
+    err = graph.run(bundle->getJobs() > 0 ? bundle->getJobs() : 1);
+    if (err != NO_ERROR) {
+        return err;
+    }
+
+    if (table.validateLocalizations()) {
+        state.noteError();
+    }
+    
+    if (state.hasErrors() || state.platformVersionStatus != NO_ERROR) {
+        return UNKNOWN_ERROR;
     }
 
-    const sp<AaptFile> manifestFile(androidManifestFile->getFiles().valueAt(0));
+    const sp<AaptFile>& manifestFile = state.manifestFile;
     String8 manifestPath(manifestFile->getPrintableSource());
 
     // Generate final compiled manifest file.
-    manifestFile->clearData();
-    sp<XMLNode> manifestTree = XMLNode::parse(manifestFile);
+    PhaseSpan manifestSpan("compileManifest", manifestPath);
+    sp<XMLNode> manifestTree = state.manifestTree;
     if (manifestTree == NULL) {
         return UNKNOWN_ERROR;
     }
@@ -1581,14 +2749,31 @@ status_t buildResources(Bundle* bundle, const sp<AaptAssets>& assets, sp<ApkBuil
     if (err < NO_ERROR) {
         return err;
     }
-    err = compileXmlFile(bundle, assets, String16(), manifestTree, manifestFile, &table);
+    err = compileXmlFile(bundle, assets, String16(), manifestTree, manifestFile, &table,
+            compactXmlFlags(bundle, XML_COMPILE_STANDARD_RESOURCE));
     if (err < NO_ERROR) {
         return err;
     }
+    manifestSpan.end();
+    MemStats::checkpoint("compileManifest");
 
+    PhaseSpan compatSpan("modifyForCompat");
     if (table.modifyForCompat(bundle) != NO_ERROR) {
         return UNKNOWN_ERROR;
     }
+    compatSpan.end();
+    MemStats::checkpoint("modifyForCompat");
+
+    dedupeFileResources(bundle, assets, &table, builder);
+    MemStats::checkpoint("dedupeFileResources");
+
+    if (bundle->getCollapseInvariantValues()) {
+        PhaseSpan collapseSpan("collapseInvariantValues");
+        const size_t collapsed = table.collapseInvariantValues();
+        if (bundle->getVerbose()) {
+            printf("  Collapsed %zu values that are the same as the default's.\n", collapsed);
+        }
+    }
 
     //block.restart();
     //printXMLBlock(&block);
@@ -1599,17 +2784,29 @@ status_t buildResources(Bundle* bundle, const sp<AaptAssets>& assets, sp<ApkBuil
     // --------------------------------------------------------------
 
 
-    ResTable finalResTable;
+    LazyResTable finalResTable;
     sp<AaptFile> resFile;
     
     if (table.hasResources()) {
-        sp<AaptSymbols> symbols = assets->getSymbolsFor(String8("R"));
-        err = table.addSymbols(symbols);
-        if (err < NO_ERROR) {
-            return err;
+        // A symbol for every resource, which only the R classes use.
+        if (assets->needsResourceSymbols(bundle)) {
+            sp<AaptSymbols> symbols = assets->getSymbolsFor(String8("R"));
+            err = table.addSymbols(symbols);
+            if (err < NO_ERROR) {
+                return err;
+            }
         }
 
-        KeyedVector<Symbol, Vector<SymbolDefinition> > densityVaryingResources;
+        // The R classes keep every symbol; what is left out is unused.
+        if (!bundle->getShrinkKeepFiles().isEmpty()) {
+            err = shrinkResources(bundle, assets, &table, manifestFile);
+            if (err != NO_ERROR) {
+                return err;
+            }
+            MemStats::checkpoint("shrinkResources");
+        }
+
+        Vector<SymbolDefinitions> densityVaryingResources;
         if (builder->getSplits().size() > 1) {
             // Only look for density varying resources if we're generating
             // splits.
@@ -1618,26 +2815,26 @@ status_t buildResources(Bundle* bundle, const sp<AaptAssets>& assets, sp<ApkBuil
 
         Vector<sp<ApkSplit> >& splits = builder->getSplits();
         const size_t numSplits = splits.size();
+        const ResourceTable::FlattenIndex flattenIndex(table);
         for (size_t i = 0; i < numSplits; i++) {
             sp<ApkSplit>& split = splits.editItemAt(i);
             sp<AaptFile> flattenedTable = new AaptFile(String8("resources.arsc"),
                     AaptGroupEntry(), String8());
+            PhaseSpan flattenSpan("flatten", split->getPrintableName());
             err = table.flatten(bundle, split->getResourceFilter(),
-                    flattenedTable, split->isBase());
+                    flattenedTable, split->isBase(), &flattenIndex);
             if (err != NO_ERROR) {
                 fprintf(stderr, "Failed to generate resource table for split '%s'\n",
                         split->getPrintableName().string());
                 return err;
             }
+            flattenSpan.setBytes(flattenedTable->getSize());
+            flattenSpan.end();
             split->addEntry(String8("resources.arsc"), flattenedTable);
 
             if (split->isBase()) {
                 resFile = flattenedTable;
-                err = finalResTable.add(flattenedTable->getData(), flattenedTable->getSize());
-                if (err != NO_ERROR) {
-                    fprintf(stderr, "Generated resource table is corrupt.\n");
-                    return err;
-                }
+                finalResTable.setFile(flattenedTable);
             } else {
                 ResTable resTable;
                 err = resTable.add(flattenedTable->getData(), flattenedTable->getSize());
@@ -1660,12 +2857,12 @@ status_t buildResources(Bundle* bundle, const sp<AaptAssets>& assets, sp<ApkBuil
                         resTable.setParameters(&config);
                         const size_t densityVaryingResourceCount = densityVaryingResources.size();
                         for (size_t k = 0; k < densityVaryingResourceCount; k++) {
-                            const Symbol& symbol = densityVaryingResources.keyAt(k);
+                            const Symbol& symbol = densityVaryingResources[k].symbol;
                             ssize_t block = resTable.getResource(symbol.id, &val, true);
                             if (block < 0) {
                                 // Maybe it's in the base?
-                                finalResTable.setParameters(&config);
-                                block = finalResTable.getResource(symbol.id, &val, true);
+                                finalResTable.get().setParameters(&config);
+                                block = finalResTable.get().getResource(symbol.id, &val, true);
                             }
 
                             if (block < 0) {
@@ -1674,7 +2871,8 @@ status_t buildResources(Bundle* bundle, const sp<AaptAssets>& assets, sp<ApkBuil
                                         symbol.toString().string(), config.toString().string());
 
                                 if (bundle->getVerbose()) {
-                                    const Vector<SymbolDefinition>& defs = densityVaryingResources[k];
+                                    const Vector<SymbolDefinition>& defs =
+                                            densityVaryingResources[k].definitions;
                                     const size_t defCount = std::min(size_t(5), defs.size());
                                     for (size_t d = 0; d < defCount; d++) {
                                         const SymbolDefinition& def = defs[d];
@@ -1723,10 +2921,69 @@ status_t buildResources(Bundle* bundle, const sp<AaptAssets>& assets, sp<ApkBuil
             fclose(fp);
         }
 
-        if (finalResTable.getTableCount() == 0 || resFile == NULL) {
+        if (bundle->getEmitIdsFile()) {
+            FILE* fp = fopen(bundle->getEmitIdsFile(), "w+");
+            if (fp == NULL) {
+                fprintf(stderr, "ERROR: Unable to open resource IDs output file %s: %s\n",
+                        bundle->getEmitIdsFile(), strerror(errno));
+                return UNKNOWN_ERROR;
+            }
+            if (bundle->getVerbose()) {
+                printf("  Writing resource IDs to %s.\n", bundle->getEmitIdsFile());
+            }
+            table.writeStableIds(fp);
+            fclose(fp);
+        }
+
+        if (bundle->getCollapseKeyNamesFile()) {
+            FILE* fp = fopen(bundle->getCollapseKeyNamesFile(), "w+");
+            if (fp == NULL) {
+                fprintf(stderr, "ERROR: Unable to open resource names output file %s: %s\n",
+                        bundle->getCollapseKeyNamesFile(), strerror(errno));
+                return UNKNOWN_ERROR;
+            }
+            if (bundle->getVerbose()) {
+                printf("  Writing resource names to %s.\n", bundle->getCollapseKeyNamesFile());
+            }
+            table.writeStableIds(fp);
+            fclose(fp);
+        }
+
+        if (bundle->getDependencyGraphFile()) {
+            FILE* fp = fopen(bundle->getDependencyGraphFile(), "w+");
+            if (fp == NULL) {
+                fprintf(stderr, "ERROR: Unable to open dependency graph output file %s: %s\n",
+                        bundle->getDependencyGraphFile(), strerror(errno));
+                return UNKNOWN_ERROR;
+            }
+            if (bundle->getVerbose()) {
+                printf("  Writing dependency graph to %s.\n", bundle->getDependencyGraphFile());
+            }
+            KeyedVector<String16, Vector<uint32_t> > fileRefs;
+            collectFileReferences(assets, &fileRefs);
+            table.writeDependencyGraph(fp, fileRefs);
+            fclose(fp);
+        }
+
+        if (resFile == NULL) {
             fprintf(stderr, "No resource table was generated.\n");
             return UNKNOWN_ERROR;
         }
+
+        if (bundle->getFeatureIndexFile()) {
+            if (bundle->getVerbose()) {
+                printf("  Writing feature index to %s.\n", bundle->getFeatureIndexFile());
+            }
+            if (finalResTable.get().getTableCount() == 0) {
+                return UNKNOWN_ERROR;
+            }
+            err = ResourceTable::writeFeatureIndex(finalResTable.get(),
+                    bundle->getFeatureIndexFile());
+            if (err != NO_ERROR) {
+                return err;
+            }
+        }
+        MemStats::checkpoint("flatten");
     }
 
     // Perform a basic validation of the manifest file.  This time we
@@ -1744,7 +3001,8 @@ status_t buildResources(Bundle* bundle, const sp<AaptAssets>& assets, sp<ApkBuil
         return err;
     }
     ResXMLTree block;
-    block.setTo(outManifestFile->getData(), outManifestFile->getSize(), true);
+    block.setToTrusted(outManifestFile->getData(), outManifestFile->getSize());
+    bool hasErrors = false;
     String16 manifest16("manifest");
     String16 permission16("permission");
     String16 permission_group16("permission-group");
@@ -2003,7 +3261,7 @@ status_t buildResources(Bundle* bundle, const sp<AaptAssets>& assets, sp<ApkBuil
         }
     }
 
-    if (hasErrors) {
+    if (hasErrors || finalResTable.isCorrupt()) {
         return UNKNOWN_ERROR;
     }
 
@@ -2053,36 +3311,162 @@ static String8 getSymbolPackage(const String8& symbol, const sp<AaptAssets>& ass
     return pub ? assets->getPackage() : assets->getSymbolsPrivatePackage();
 }
 
-static String8 getSymbolName(const String8& symbol) {
-    ssize_t colon = symbol.find(":", 0);
-    if (colon >= 0) {
-        return String8(symbol.string() + colon + 1);
+static String8 getSymbolName(const String8& symbol) {
+    ssize_t colon = symbol.find(":", 0);
+    if (colon >= 0) {
+        return String8(symbol.string() + colon + 1);
+    }
+    return symbol;
+}
+
+static String16 getAttributeComment(const sp<AaptAssets>& assets,
+                                    const String8& name,
+                                    String16* outTypeComment = NULL)
+{
+    sp<AaptSymbols> asym = assets->getSymbolsFor(String8("R"));
+    if (asym != NULL) {
+        //printf("Got R symbols!\n");
+        asym = asym->getNestedSymbols().valueFor(String8("attr"));
+        if (asym != NULL) {
+            //printf("Got attrs symbols! comment %s=%s\n",
+            //     name.string(), String8(asym->getComment(name)).string());
+            if (outTypeComment != NULL) {
+                *outTypeComment = asym->getTypeComment(name);
+            }
+            return asym->getComment(name);
+        }
+    }
+    return String16();
+}
+
+/*
+ * What the R class writers need of each <declare-styleable>, worked out
+ * once for a build: the attributes' resolved identifiers in the order the
+ * int[] lists them, and for each attribute its index in that list and its
+ * comments.  Looking an attribute up in the included resources and in the
+ * attr symbols is by far the most of what the writers did, and they did it
+ * again for every R class and R.txt.
+ */
+class StyleableTables : public RefBase {
+public:
+    struct Attr {
+        ssize_t index;          // into the styleable's "idents"
+        bool listed;            // false for private attributes of other packages
+        bool isPublic;          // whether the attribute is public
+        String16 comment;
+        String16 typeComment;
+    };
+
+    struct Styleable {
+        SortedVector<uint32_t> idents;
+        // The styleable's symbols that have an entry of "idents", in their
+        // own order.
+        Vector<Attr> attrs;
+    };
+
+    StyleableTables(const sp<AaptAssets>& assets, const sp<AaptSymbols>& symbols);
+
+    bool isFor(const sp<AaptSymbols>& symbols) const { return symbols == mSymbols; }
+
+    const Styleable& styleableAt(size_t index) const { return mStyleables[index]; }
+    bool hasErrors() const { return mHasErrors; }
+
+private:
+    sp<AaptSymbols> mSymbols;
+    Vector<Styleable> mStyleables;      // as symbols->getNestedSymbols()
+    bool mHasErrors;
+};
+
+StyleableTables::StyleableTables(const sp<AaptAssets>& assets,
+                                 const sp<AaptSymbols>& symbols)
+    : mSymbols(symbols), mHasErrors(false)
+{
+    String16 attr16("attr");
+    String16 package16(assets->getPackage());
+    const ResTable& included = assets->getIncludedResources();
+
+    const size_t N = symbols->getNestedSymbols().size();
+    mStyleables.insertAt(Styleable(), 0, N);
+    for (size_t i=0; i<N; i++) {
+        sp<AaptSymbols> nsymbols = symbols->getNestedSymbols().valueAt(i);
+        String8 nclassName(flattenSymbol(symbols->getNestedSymbols().keyAt(i)));
+        Styleable& styleable = mStyleables.editItemAt(i);
+
+        Vector<uint32_t> origOrder;
+        Vector<bool> listed;
+        size_t a;
+        size_t NA = nsymbols->getSymbols().size();
+        for (a=0; a<NA; a++) {
+            const AaptSymbolEntry& sym(nsymbols->getSymbols().valueAt(a));
+            int32_t code = sym.typeCode == AaptSymbolEntry::TYPE_INT32
+                    ? sym.int32Val : 0;
+            bool isListed = true;
+            if (code == 0) {
+                String16 name16(sym.name);
+                uint32_t typeSpecFlags = 0;
+                code = included.identifierForName(
+                    name16.string(), name16.size(),
+                    attr16.string(), attr16.size(),
+                    package16.string(), package16.size(), &typeSpecFlags);
+                if (code == 0) {
+                    fprintf(stderr, "ERROR: In <declare-styleable> %s, unable to find attribute %s\n",
+                            nclassName.string(), sym.name.string());
+                    mHasErrors = true;
+                }
+                isListed = (typeSpecFlags&ResTable_typeSpec::SPEC_PUBLIC) != 0;
+            }
+            styleable.idents.add(code);
+            origOrder.add(code);
+            listed.add(isListed);
+        }
+
+        // Only as many symbols as there are distinct identifiers are
+        // written, as they always have been.
+        NA = styleable.idents.size();
+        styleable.attrs.setCapacity(NA);
+        for (a=0; a<NA; a++) {
+            const AaptSymbolEntry& sym(nsymbols->getSymbols().valueAt(a));
+            Attr attr;
+            attr.index = styleable.idents.indexOf(origOrder[a]);
+            attr.listed = listed[a];
+
+            uint32_t typeSpecFlags = 0;
+            String16 name16(sym.name);
+            included.identifierForName(
+                name16.string(), name16.size(),
+                attr16.string(), attr16.size(),
+                package16.string(), package16.size(), &typeSpecFlags);
+            attr.isPublic = (typeSpecFlags&ResTable_typeSpec::SPEC_PUBLIC) != 0;
+
+            attr.comment = sym.comment;
+            if (attr.comment.size() <= 0) {
+                attr.comment = getAttributeComment(assets, sym.name, &attr.typeComment);
+            } else {
+                getAttributeComment(assets, sym.name, &attr.typeComment);
+            }
+            styleable.attrs.add(attr);
+        }
     }
-    return symbol;
 }
 
-static String16 getAttributeComment(const sp<AaptAssets>& assets,
-                                    const String8& name,
-                                    String16* outTypeComment = NULL)
+/*
+ * Returns the tables of the styleable class "symbols", made the first time
+ * any writer asks for them.
+ */
+static const StyleableTables* getStyleableTables(const sp<AaptAssets>& assets,
+                                                 const sp<AaptSymbols>& symbols)
 {
-    sp<AaptSymbols> asym = assets->getSymbolsFor(String8("R"));
-    if (asym != NULL) {
-        //printf("Got R symbols!\n");
-        asym = asym->getNestedSymbols().valueFor(String8("attr"));
-        if (asym != NULL) {
-            //printf("Got attrs symbols! comment %s=%s\n",
-            //     name.string(), String8(asym->getComment(name)).string());
-            if (outTypeComment != NULL) {
-                *outTypeComment = asym->getTypeComment(name);
-            }
-            return asym->getComment(name);
-        }
+    StyleableTables* tables = static_cast<StyleableTables*>(
+            assets->getStyleableTables().get());
+    if (tables == NULL || !tables->isFor(symbols)) {
+        tables = new StyleableTables(assets, symbols);
+        assets->setStyleableTables(tables);
     }
-    return String16();
+    return tables;
 }
 
 static status_t writeResourceLoadedCallbackForLayoutClasses(
-    FILE* fp, const sp<AaptAssets>& assets,
+    OutputBuffer* out, const sp<AaptAssets>& assets,
     const sp<AaptSymbols>& symbols, int indent, bool /* includePrivate */)
 {
     String16 attr16("attr");
@@ -2098,7 +3482,7 @@ static status_t writeResourceLoadedCallbackForLayoutClasses(
         String8 realClassName(symbols->getNestedSymbols().keyAt(i));
         String8 nclassName(flattenSymbol(realClassName));
 
-        fprintf(fp,
+        out->appendFormat(
                 "%sfor(int i = 0; i < styleable.%s.length; ++i) {\n"
                 "%sstyleable.%s[i] = (styleable.%s[i] & 0x00ffffff) | (packageId << 24);\n"
                 "%s}\n",
@@ -2111,7 +3495,7 @@ static status_t writeResourceLoadedCallbackForLayoutClasses(
 }
 
 static status_t writeResourceLoadedCallback(
-    FILE* fp, const sp<AaptAssets>& assets, bool includePrivate,
+    OutputBuffer* out, const sp<AaptAssets>& assets, bool includePrivate,
     const sp<AaptSymbols>& symbols, const String8& className, int indent)
 {
     size_t i;
@@ -2127,7 +3511,7 @@ static status_t writeResourceLoadedCallback(
             continue;
         }
         String8 flat_name(flattenSymbol(sym.name));
-        fprintf(fp,
+        out->appendFormat(
                 "%s%s.%s = (%s.%s & 0x00ffffff) | (packageId << 24);\n",
                 getIndentSpace(indent), className.string(), flat_name.string(),
                 className.string(), flat_name.string());
@@ -2139,9 +3523,9 @@ static status_t writeResourceLoadedCallback(
         String8 nclassName(symbols->getNestedSymbols().keyAt(i));
         if (nclassName == "styleable") {
             err = writeResourceLoadedCallbackForLayoutClasses(
-                    fp, assets, nsymbols, indent, includePrivate);
+                    out, assets, nsymbols, indent, includePrivate);
         } else {
-            err = writeResourceLoadedCallback(fp, assets, includePrivate, nsymbols,
+            err = writeResourceLoadedCallback(out, assets, includePrivate, nsymbols,
                     nclassName, indent);
         }
         if (err != NO_ERROR) {
@@ -2153,21 +3537,19 @@ static status_t writeResourceLoadedCallback(
 }
 
 static status_t writeLayoutClasses(
-    FILE* fp, const sp<AaptAssets>& assets,
+    OutputBuffer* out, const sp<AaptAssets>& assets,
     const sp<AaptSymbols>& symbols, int indent, bool includePrivate, bool nonConstantId)
 {
     const char* indentStr = getIndentSpace(indent);
     if (!includePrivate) {
-        fprintf(fp, "%s/** @doconly */\n", indentStr);
+        out->appendFormat("%s/** @doconly */\n", indentStr);
     }
-    fprintf(fp, "%spublic static final class styleable {\n", indentStr);
+    out->appendFormat("%spublic static final class styleable {\n", indentStr);
     indent++;
 
-    String16 attr16("attr");
-    String16 package16(assets->getPackage());
+    const StyleableTables* tables = getStyleableTables(assets, symbols);
 
     indentStr = getIndentSpace(indent);
-    bool hasErrors = false;
 
     size_t i;
     size_t N = symbols->getNestedSymbols().size();
@@ -2176,119 +3558,85 @@ static status_t writeLayoutClasses(
         String8 realClassName(symbols->getNestedSymbols().keyAt(i));
         String8 nclassName(flattenSymbol(realClassName));
 
-        SortedVector<uint32_t> idents;
-        Vector<uint32_t> origOrder;
-        Vector<bool> publicFlags;
+        const StyleableTables::Styleable& styleable = tables->styleableAt(i);
+        const SortedVector<uint32_t>& idents = styleable.idents;
 
         size_t a;
-        size_t NA = nsymbols->getSymbols().size();
-        for (a=0; a<NA; a++) {
-            const AaptSymbolEntry& sym(nsymbols->getSymbols().valueAt(a));
-            int32_t code = sym.typeCode == AaptSymbolEntry::TYPE_INT32
-                    ? sym.int32Val : 0;
-            bool isPublic = true;
-            if (code == 0) {
-                String16 name16(sym.name);
-                uint32_t typeSpecFlags;
-                code = assets->getIncludedResources().identifierForName(
-                    name16.string(), name16.size(),
-                    attr16.string(), attr16.size(),
-                    package16.string(), package16.size(), &typeSpecFlags);
-                if (code == 0) {
-                    fprintf(stderr, "ERROR: In <declare-styleable> %s, unable to find attribute %s\n",
-                            nclassName.string(), sym.name.string());
-                    hasErrors = true;
-                }
-                isPublic = (typeSpecFlags&ResTable_typeSpec::SPEC_PUBLIC) != 0;
-            }
-            idents.add(code);
-            origOrder.add(code);
-            publicFlags.add(isPublic);
-        }
-
-        NA = idents.size();
+        size_t NA = idents.size();
 
         String16 comment = symbols->getComment(realClassName);
         AnnotationProcessor ann;
-        fprintf(fp, "%s/** ", indentStr);
+        out->appendFormat("%s/** ", indentStr);
         if (comment.size() > 0) {
             String8 cmt(comment);
             ann.preprocessComment(cmt);
-            fprintf(fp, "%s\n", cmt.string());
+            out->appendFormat("%s\n", cmt.string());
         } else {
-            fprintf(fp, "Attributes that can be used with a %s.\n", nclassName.string());
+            out->appendFormat("Attributes that can be used with a %s.\n", nclassName.string());
         }
         bool hasTable = false;
         for (a=0; a<NA; a++) {
-            ssize_t pos = idents.indexOf(origOrder.itemAt(a));
-            if (pos >= 0) {
-                if (!hasTable) {
-                    hasTable = true;
-                    fprintf(fp,
-                            "%s   <p>Includes the following attributes:</p>\n"
-                            "%s   <table>\n"
-                            "%s   <colgroup align=\"left\" />\n"
-                            "%s   <colgroup align=\"left\" />\n"
-                            "%s   <tr><th>Attribute</th><th>Description</th></tr>\n",
-                            indentStr,
-                            indentStr,
-                            indentStr,
-                            indentStr,
-                            indentStr);
-                }
-                const AaptSymbolEntry& sym = nsymbols->getSymbols().valueAt(a);
-                if (!publicFlags.itemAt(a) && !includePrivate) {
-                    continue;
-                }
-                String8 name8(sym.name);
-                String16 comment(sym.comment);
-                if (comment.size() <= 0) {
-                    comment = getAttributeComment(assets, name8);
-                }
-                if (comment.size() > 0) {
-                    const char16_t* p = comment.string();
-                    while (*p != 0 && *p != '.') {
-                        if (*p == '{') {
-                            while (*p != 0 && *p != '}') {
-                                p++;
-                            }
-                        } else {
+            const StyleableTables::Attr& attr = styleable.attrs[a];
+            if (!hasTable) {
+                hasTable = true;
+                out->appendFormat(
+                        "%s   <p>Includes the following attributes:</p>\n"
+                        "%s   <table>\n"
+                        "%s   <colgroup align=\"left\" />\n"
+                        "%s   <colgroup align=\"left\" />\n"
+                        "%s   <tr><th>Attribute</th><th>Description</th></tr>\n",
+                        indentStr,
+                        indentStr,
+                        indentStr,
+                        indentStr,
+                        indentStr);
+            }
+            if (!attr.listed && !includePrivate) {
+                continue;
+            }
+            const AaptSymbolEntry& sym = nsymbols->getSymbols().valueAt(a);
+            String8 name8(sym.name);
+            String16 comment(attr.comment);
+            if (comment.size() > 0) {
+                const char16_t* p = comment.string();
+                while (*p != 0 && *p != '.') {
+                    if (*p == '{') {
+                        while (*p != 0 && *p != '}') {
                             p++;
                         }
-                    }
-                    if (*p == '.') {
+                    } else {
                         p++;
                     }
-                    comment = String16(comment.string(), p-comment.string());
                 }
-                fprintf(fp, "%s   <tr><td><code>{@link #%s_%s %s:%s}</code></td><td>%s</td></tr>\n",
-                        indentStr, nclassName.string(),
-                        flattenSymbol(name8).string(),
-                        getSymbolPackage(name8, assets, true).string(),
-                        getSymbolName(name8).string(),
-                        String8(comment).string());
+                if (*p == '.') {
+                    p++;
+                }
+                comment = String16(comment.string(), p-comment.string());
             }
+            out->appendFormat("%s   <tr><td><code>{@link #%s_%s %s:%s}</code></td><td>%s</td></tr>\n",
+                    indentStr, nclassName.string(),
+                    flattenSymbol(name8).string(),
+                    getSymbolPackage(name8, assets, true).string(),
+                    getSymbolName(name8).string(),
+                    String8(comment).string());
         }
         if (hasTable) {
-            fprintf(fp, "%s   </table>\n", indentStr);
+            out->appendFormat("%s   </table>\n", indentStr);
         }
         for (a=0; a<NA; a++) {
-            ssize_t pos = idents.indexOf(origOrder.itemAt(a));
-            if (pos >= 0) {
-                const AaptSymbolEntry& sym = nsymbols->getSymbols().valueAt(a);
-                if (!publicFlags.itemAt(a) && !includePrivate) {
-                    continue;
-                }
-                fprintf(fp, "%s   @see #%s_%s\n",
-                        indentStr, nclassName.string(),
-                        flattenSymbol(sym.name).string());
+            if (!styleable.attrs[a].listed && !includePrivate) {
+                continue;
             }
+            const AaptSymbolEntry& sym = nsymbols->getSymbols().valueAt(a);
+            out->appendFormat("%s   @see #%s_%s\n",
+                    indentStr, nclassName.string(),
+                    flattenSymbol(sym.name).string());
         }
-        fprintf(fp, "%s */\n", getIndentSpace(indent));
+        out->appendFormat("%s */\n", getIndentSpace(indent));
 
-        ann.printAnnotations(fp, indentStr);
+        ann.printAnnotations(out, indentStr);
         
-        fprintf(fp,
+        out->appendFormat(
                 "%spublic static final int[] %s = {\n"
                 "%s",
                 indentStr, nclassName.string(),
@@ -2297,107 +3645,88 @@ static status_t writeLayoutClasses(
         for (a=0; a<NA; a++) {
             if (a != 0) {
                 if ((a&3) == 0) {
-                    fprintf(fp, ",\n%s", getIndentSpace(indent+1));
+                    out->appendFormat(",\n%s", getIndentSpace(indent+1));
                 } else {
-                    fprintf(fp, ", ");
+                    out->appendFormat(", ");
                 }
             }
-            fprintf(fp, "0x%08x", idents[a]);
+            out->appendHex32(idents[a]);
         }
 
-        fprintf(fp, "\n%s};\n", indentStr);
+        out->appendFormat("\n%s};\n", indentStr);
 
         for (a=0; a<NA; a++) {
-            ssize_t pos = idents.indexOf(origOrder.itemAt(a));
-            if (pos >= 0) {
-                const AaptSymbolEntry& sym = nsymbols->getSymbols().valueAt(a);
-                if (!publicFlags.itemAt(a) && !includePrivate) {
-                    continue;
-                }
-                String8 name8(sym.name);
-                String16 comment(sym.comment);
-                String16 typeComment;
-                if (comment.size() <= 0) {
-                    comment = getAttributeComment(assets, name8, &typeComment);
-                } else {
-                    getAttributeComment(assets, name8, &typeComment);
-                }
-
-                uint32_t typeSpecFlags = 0;
-                String16 name16(sym.name);
-                assets->getIncludedResources().identifierForName(
-                    name16.string(), name16.size(),
-                    attr16.string(), attr16.size(),
-                    package16.string(), package16.size(), &typeSpecFlags);
-                //printf("%s:%s/%s: 0x%08x\n", String8(package16).string(),
-                //    String8(attr16).string(), String8(name16).string(), typeSpecFlags);
-                const bool pub = (typeSpecFlags&ResTable_typeSpec::SPEC_PUBLIC) != 0;
-
-                AnnotationProcessor ann;
-                fprintf(fp, "%s/**\n", indentStr);
-                if (comment.size() > 0) {
-                    String8 cmt(comment);
-                    ann.preprocessComment(cmt);
-                    fprintf(fp, "%s  <p>\n%s  @attr description\n", indentStr, indentStr);
-                    fprintf(fp, "%s  %s\n", indentStr, cmt.string());
+            const StyleableTables::Attr& attr = styleable.attrs[a];
+            if (!attr.listed && !includePrivate) {
+                continue;
+            }
+            const AaptSymbolEntry& sym = nsymbols->getSymbols().valueAt(a);
+            String8 name8(sym.name);
+            const String16& comment = attr.comment;
+            const String16& typeComment = attr.typeComment;
+            const bool pub = attr.isPublic;
+
+            AnnotationProcessor ann;
+            out->appendFormat("%s/**\n", indentStr);
+            if (comment.size() > 0) {
+                String8 cmt(comment);
+                ann.preprocessComment(cmt);
+                out->appendFormat("%s  <p>\n%s  @attr description\n", indentStr, indentStr);
+                out->appendFormat("%s  %s\n", indentStr, cmt.string());
+            } else {
+                out->appendFormat(
+                        "%s  <p>This symbol is the offset where the {@link %s.R.attr#%s}\n"
+                        "%s  attribute's value can be found in the {@link #%s} array.\n",
+                        indentStr,
+                        getSymbolPackage(name8, assets, pub).string(),
+                        getSymbolName(name8).string(),
+                        indentStr, nclassName.string());
+            }
+            if (typeComment.size() > 0) {
+                String8 cmt(typeComment);
+                ann.preprocessComment(cmt);
+                out->appendFormat("\n\n%s  %s\n", indentStr, cmt.string());
+            }
+            if (comment.size() > 0) {
+                if (pub) {
+                    out->appendFormat(
+                            "%s  <p>This corresponds to the global attribute\n"
+                            "%s  resource symbol {@link %s.R.attr#%s}.\n",
+                            indentStr, indentStr,
+                            getSymbolPackage(name8, assets, true).string(),
+                            getSymbolName(name8).string());
                 } else {
-                    fprintf(fp,
-                            "%s  <p>This symbol is the offset where the {@link %s.R.attr#%s}\n"
-                            "%s  attribute's value can be found in the {@link #%s} array.\n",
-                            indentStr,
-                            getSymbolPackage(name8, assets, pub).string(),
-                            getSymbolName(name8).string(),
-                            indentStr, nclassName.string());
-                }
-                if (typeComment.size() > 0) {
-                    String8 cmt(typeComment);
-                    ann.preprocessComment(cmt);
-                    fprintf(fp, "\n\n%s  %s\n", indentStr, cmt.string());
-                }
-                if (comment.size() > 0) {
-                    if (pub) {
-                        fprintf(fp,
-                                "%s  <p>This corresponds to the global attribute\n"
-                                "%s  resource symbol {@link %s.R.attr#%s}.\n",
-                                indentStr, indentStr,
-                                getSymbolPackage(name8, assets, true).string(),
-                                getSymbolName(name8).string());
-                    } else {
-                        fprintf(fp,
-                                "%s  <p>This is a private symbol.\n", indentStr);
-                    }
+                    out->appendFormat(
+                            "%s  <p>This is a private symbol.\n", indentStr);
                 }
-                fprintf(fp, "%s  @attr name %s:%s\n", indentStr,
-                        getSymbolPackage(name8, assets, pub).string(),
-                        getSymbolName(name8).string());
-                fprintf(fp, "%s*/\n", indentStr);
-                ann.printAnnotations(fp, indentStr);
+            }
+            out->appendFormat("%s  @attr name %s:%s\n", indentStr,
+                    getSymbolPackage(name8, assets, pub).string(),
+                    getSymbolName(name8).string());
+            out->appendFormat("%s*/\n", indentStr);
+            ann.printAnnotations(out, indentStr);
 
-                const char * id_format = nonConstantId ?
-                        "%spublic static int %s_%s = %d;\n" :
-                        "%spublic static final int %s_%s = %d;\n";
+            const char * id_format = nonConstantId ?
+                    "%spublic static int %s_%s = %d;\n" :
+                    "%spublic static final int %s_%s = %d;\n";
 
-                fprintf(fp,
-                        id_format,
-                        indentStr, nclassName.string(),
-                        flattenSymbol(name8).string(), (int)pos);
-            }
+            out->appendFormat(
+                    id_format,
+                    indentStr, nclassName.string(),
+                    flattenSymbol(name8).string(), (int)attr.index);
         }
     }
 
     indent--;
-    fprintf(fp, "%s};\n", getIndentSpace(indent));
-    return hasErrors ? STATUST(UNKNOWN_ERROR) : NO_ERROR;
+    out->appendFormat("%s};\n", getIndentSpace(indent));
+    return tables->hasErrors() ? STATUST(UNKNOWN_ERROR) : NO_ERROR;
 }
 
 static status_t writeTextLayoutClasses(
-    FILE* fp, const sp<AaptAssets>& assets,
+    OutputBuffer* out, const sp<AaptAssets>& assets,
     const sp<AaptSymbols>& symbols, bool includePrivate)
 {
-    String16 attr16("attr");
-    String16 package16(assets->getPackage());
-
-    bool hasErrors = false;
+    const StyleableTables* tables = getStyleableTables(assets, symbols);
 
     size_t i;
     size_t N = symbols->getNestedSymbols().size();
@@ -2406,92 +3735,46 @@ static status_t writeTextLayoutClasses(
         String8 realClassName(symbols->getNestedSymbols().keyAt(i));
         String8 nclassName(flattenSymbol(realClassName));
 
-        SortedVector<uint32_t> idents;
-        Vector<uint32_t> origOrder;
-        Vector<bool> publicFlags;
+        const StyleableTables::Styleable& styleable = tables->styleableAt(i);
+        const SortedVector<uint32_t>& idents = styleable.idents;
 
         size_t a;
-        size_t NA = nsymbols->getSymbols().size();
-        for (a=0; a<NA; a++) {
-            const AaptSymbolEntry& sym(nsymbols->getSymbols().valueAt(a));
-            int32_t code = sym.typeCode == AaptSymbolEntry::TYPE_INT32
-                    ? sym.int32Val : 0;
-            bool isPublic = true;
-            if (code == 0) {
-                String16 name16(sym.name);
-                uint32_t typeSpecFlags;
-                code = assets->getIncludedResources().identifierForName(
-                    name16.string(), name16.size(),
-                    attr16.string(), attr16.size(),
-                    package16.string(), package16.size(), &typeSpecFlags);
-                if (code == 0) {
-                    fprintf(stderr, "ERROR: In <declare-styleable> %s, unable to find attribute %s\n",
-                            nclassName.string(), sym.name.string());
-                    hasErrors = true;
-                }
-                isPublic = (typeSpecFlags&ResTable_typeSpec::SPEC_PUBLIC) != 0;
-            }
-            idents.add(code);
-            origOrder.add(code);
-            publicFlags.add(isPublic);
-        }
-
-        NA = idents.size();
+        size_t NA = idents.size();
 
-        fprintf(fp, "int[] styleable %s {", nclassName.string());
+        out->appendFormat("int[] styleable %s {", nclassName.string());
 
         for (a=0; a<NA; a++) {
             if (a != 0) {
-                fprintf(fp, ",");
+                out->appendFormat(",");
             }
-            fprintf(fp, " 0x%08x", idents[a]);
+            out->append(" ");
+            out->appendHex32(idents[a]);
         }
 
-        fprintf(fp, " }\n");
+        out->appendFormat(" }\n");
 
         for (a=0; a<NA; a++) {
-            ssize_t pos = idents.indexOf(origOrder.itemAt(a));
-            if (pos >= 0) {
-                const AaptSymbolEntry& sym = nsymbols->getSymbols().valueAt(a);
-                if (!publicFlags.itemAt(a) && !includePrivate) {
-                    continue;
-                }
-                String8 name8(sym.name);
-                String16 comment(sym.comment);
-                String16 typeComment;
-                if (comment.size() <= 0) {
-                    comment = getAttributeComment(assets, name8, &typeComment);
-                } else {
-                    getAttributeComment(assets, name8, &typeComment);
-                }
-
-                uint32_t typeSpecFlags = 0;
-                String16 name16(sym.name);
-                assets->getIncludedResources().identifierForName(
-                    name16.string(), name16.size(),
-                    attr16.string(), attr16.size(),
-                    package16.string(), package16.size(), &typeSpecFlags);
-                //printf("%s:%s/%s: 0x%08x\n", String8(package16).string(),
-                //    String8(attr16).string(), String8(name16).string(), typeSpecFlags);
-                //const bool pub = (typeSpecFlags&ResTable_typeSpec::SPEC_PUBLIC) != 0;
-
-                fprintf(fp,
-                        "int styleable %s_%s %d\n",
-                        nclassName.string(),
-                        flattenSymbol(name8).string(), (int)pos);
+            const StyleableTables::Attr& attr = styleable.attrs[a];
+            if (!attr.listed && !includePrivate) {
+                continue;
             }
+            const AaptSymbolEntry& sym = nsymbols->getSymbols().valueAt(a);
+            out->appendFormat(
+                    "int styleable %s_%s %d\n",
+                    nclassName.string(),
+                    flattenSymbol(sym.name).string(), (int)attr.index);
         }
     }
 
-    return hasErrors ? STATUST(UNKNOWN_ERROR) : NO_ERROR;
+    return tables->hasErrors() ? STATUST(UNKNOWN_ERROR) : NO_ERROR;
 }
 
 static status_t writeSymbolClass(
-    FILE* fp, const sp<AaptAssets>& assets, bool includePrivate,
+    OutputBuffer* out, const sp<AaptAssets>& assets, bool includePrivate,
     const sp<AaptSymbols>& symbols, const String8& className, int indent,
     bool nonConstantId, bool emitCallback)
 {
-    fprintf(fp, "%spublic %sfinal class %s {\n",
+    out->appendFormat("%spublic %sfinal class %s {\n",
             getIndentSpace(indent),
             indent != 0 ? "static " : "", className.string());
     indent++;
@@ -2499,9 +3782,9 @@ static status_t writeSymbolClass(
     size_t i;
     status_t err = NO_ERROR;
 
-    const char * id_format = nonConstantId ?
-            "%spublic static int %s=0x%08x;\n" :
-            "%spublic static final int %s=0x%08x;\n";
+    // Written by hand rather than with a format: there is one of these
+    // lines for every resource.
+    const char* id_prefix = nonConstantId ? "public static int " : "public static final int ";
 
     size_t N = symbols->getSymbols().size();
     for (i=0; i<N; i++) {
@@ -2520,7 +3803,7 @@ static status_t writeSymbolClass(
             haveComment = true;
             String8 cmt(comment);
             ann.preprocessComment(cmt);
-            fprintf(fp,
+            out->appendFormat(
                     "%s/** %s\n",
                     getIndentSpace(indent), cmt.string());
         } else if (sym.isPublic && !includePrivate) {
@@ -2534,20 +3817,23 @@ static status_t writeSymbolClass(
             ann.preprocessComment(cmt);
             if (!haveComment) {
                 haveComment = true;
-                fprintf(fp,
+                out->appendFormat(
                         "%s/** %s\n", getIndentSpace(indent), cmt.string());
             } else {
-                fprintf(fp,
+                out->appendFormat(
                         "%s %s\n", getIndentSpace(indent), cmt.string());
             }
         }
         if (haveComment) {
-            fprintf(fp,"%s */\n", getIndentSpace(indent));
+            out->appendFormat("%s */\n", getIndentSpace(indent));
         }
-        ann.printAnnotations(fp, getIndentSpace(indent));
-        fprintf(fp, id_format,
-                getIndentSpace(indent),
-                flattenSymbol(name8).string(), (int)sym.int32Val);
+        ann.printAnnotations(out, getIndentSpace(indent));
+        out->append(getIndentSpace(indent));
+        out->append(id_prefix);
+        out->append(flattenSymbol(name8).string());
+        out->append("=");
+        out->appendHex32((uint32_t)sym.int32Val);
+        out->append(";\n");
     }
 
     for (i=0; i<N; i++) {
@@ -2564,7 +3850,7 @@ static status_t writeSymbolClass(
         if (comment.size() > 0) {
             String8 cmt(comment);
             ann.preprocessComment(cmt);
-            fprintf(fp,
+            out->appendFormat(
                     "%s/** %s\n"
                      "%s */\n",
                     getIndentSpace(indent), cmt.string(),
@@ -2574,8 +3860,8 @@ static status_t writeSymbolClass(
                 assets->getPackage().string(), className.string(),
                 String8(sym.name).string());
         }
-        ann.printAnnotations(fp, getIndentSpace(indent));
-        fprintf(fp, "%spublic static final String %s=\"%s\";\n",
+        ann.printAnnotations(out, getIndentSpace(indent));
+        out->appendFormat("%spublic static final String %s=\"%s\";\n",
                 getIndentSpace(indent),
                 flattenSymbol(name8).string(), sym.stringVal.string());
     }
@@ -2589,7 +3875,7 @@ static status_t writeSymbolClass(
         if (nclassName == "styleable") {
             styleableSymbols = nsymbols;
         } else {
-            err = writeSymbolClass(fp, assets, includePrivate, nsymbols, nclassName,
+            err = writeSymbolClass(out, assets, includePrivate, nsymbols, nclassName,
                     indent, nonConstantId, false);
         }
         if (err != NO_ERROR) {
@@ -2598,26 +3884,26 @@ static status_t writeSymbolClass(
     }
 
     if (styleableSymbols != NULL) {
-        err = writeLayoutClasses(fp, assets, styleableSymbols, indent, includePrivate, nonConstantId);
+        err = writeLayoutClasses(out, assets, styleableSymbols, indent, includePrivate, nonConstantId);
         if (err != NO_ERROR) {
             return err;
         }
     }
 
     if (emitCallback) {
-        fprintf(fp, "%spublic static void onResourcesLoaded(int packageId) {\n",
+        out->appendFormat("%spublic static void onResourcesLoaded(int packageId) {\n",
                 getIndentSpace(indent));
-        writeResourceLoadedCallback(fp, assets, includePrivate, symbols, className, indent + 1);
-        fprintf(fp, "%s}\n", getIndentSpace(indent));
+        writeResourceLoadedCallback(out, assets, includePrivate, symbols, className, indent + 1);
+        out->appendFormat("%s}\n", getIndentSpace(indent));
     }
 
     indent--;
-    fprintf(fp, "%s}\n", getIndentSpace(indent));
+    out->appendFormat("%s}\n", getIndentSpace(indent));
     return NO_ERROR;
 }
 
 static status_t writeTextSymbolClass(
-    FILE* fp, const sp<AaptAssets>& assets, bool includePrivate,
+    OutputBuffer* out, const sp<AaptAssets>& assets, bool includePrivate,
     const sp<AaptSymbols>& symbols, const String8& className)
 {
     size_t i;
@@ -2635,9 +3921,13 @@ static status_t writeTextSymbolClass(
         }
 
         String8 name8(sym.name);
-        fprintf(fp, "int %s %s 0x%08x\n",
-                className.string(),
-                flattenSymbol(name8).string(), (int)sym.int32Val);
+        out->append("int ");
+        out->append(className.string(), className.length());
+        out->append(" ");
+        out->append(flattenSymbol(name8).string());
+        out->append(" ");
+        out->appendHex32((uint32_t)sym.int32Val);
+        out->append("\n");
     }
 
     N = symbols->getNestedSymbols().size();
@@ -2645,9 +3935,9 @@ static status_t writeTextSymbolClass(
         sp<AaptSymbols> nsymbols = symbols->getNestedSymbols().valueAt(i);
         String8 nclassName(symbols->getNestedSymbols().keyAt(i));
         if (nclassName == "styleable") {
-            err = writeTextLayoutClasses(fp, assets, nsymbols, includePrivate);
+            err = writeTextLayoutClasses(out, assets, nsymbols, includePrivate);
         } else {
-            err = writeTextSymbolClass(fp, assets, includePrivate, nsymbols, nclassName);
+            err = writeTextSymbolClass(out, assets, includePrivate, nsymbols, nclassName);
         }
         if (err != NO_ERROR) {
             return err;
@@ -2657,21 +3947,91 @@ static status_t writeTextSymbolClass(
     return NO_ERROR;
 }
 
+/*
+ * Returns true if the file at path holds exactly the given bytes.
+ */
+static bool fileContentsEqual(const String8& path, const char* data, size_t size)
+{
+    FILE* fp = fopen(path.string(), "r");
+    if (fp == NULL) {
+        return false;
+    }
+    char buf[32768];
+    size_t offset = 0;
+    bool same = true;
+    while (same) {
+        const size_t amt = fread(buf, 1, sizeof(buf), fp);
+        if (amt == 0) {
+            same = offset == size && !ferror(fp);
+            break;
+        }
+        same = amt <= size - offset && memcmp(buf, data + offset, amt) == 0;
+        offset += amt;
+    }
+    fclose(fp);
+    return same;
+}
+
+/*
+ * Gives dest what was generated into out.  A dest that already holds
+ * exactly that is not rewritten, so its mtime survives and the Java build
+ * doesn't recompile everything that uses an R class that is the same as
+ * last time.
+ */
+static status_t writeFileIfChanged(const Bundle* bundle, const OutputBuffer& out,
+        const String8& dest, const char* what)
+{
+    if (out.hasError()) {
+        fprintf(stderr, "ERROR: Unable to buffer %s %s\n", what, dest.string());
+        return NO_MEMORY;
+    }
+
+    if (fileContentsEqual(dest, out.data(), out.size())) {
+        if (bundle->getVerbose()) {
+            printf("  (not updating unchanged %s)\n", dest.string());
+        }
+        return NO_ERROR;
+    }
+
+    FILE* fp = fopen(dest.string(), "w");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: Unable to open %s %s: %s\n",
+                what, dest.string(), strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+    status_t err = out.writeTo(fp);
+    if (fclose(fp) != 0) {
+        err = UNKNOWN_ERROR;
+    }
+    if (err != NO_ERROR) {
+        fprintf(stderr, "ERROR: Unable to write %s %s: %s\n",
+                what, dest.string(), strerror(errno));
+    }
+    return err;
+}
+
 status_t writeResourceSymbols(Bundle* bundle, const sp<AaptAssets>& assets,
     const String8& package, bool includePrivate, bool emitCallback)
 {
-    if (!bundle->getRClassDir()) {
+    // A checkpoint keeps the R classes even when this run doesn't write them.
+    Checkpoint* checkpoint = Checkpoint::current(bundle);
+    const char* rClassDir = bundle->getRClassDir();
+    if (!rClassDir && checkpoint == NULL) {
         return NO_ERROR;
     }
 
+    PhaseSpan span("writeResourceSymbols", package);
     const char* textSymbolsDest = bundle->getOutputTextSymbols();
 
+    // One buffer for every file, so that each starts out big enough.
+    OutputBuffer out;
     String8 R("R");
     const size_t N = assets->getSymbols().size();
     for (size_t i=0; i<N; i++) {
         sp<AaptSymbols> symbols = assets->getSymbols().valueAt(i);
         String8 className(assets->getSymbols().keyAt(i));
-        String8 dest(bundle->getRClassDir());
+        String8 dest(rClassDir != NULL ? rClassDir : "");
+        String8 checkpointName("java");
 
         if (bundle->getMakePackageDirs()) {
             String8 pkg(package);
@@ -2681,29 +4041,29 @@ status_t writeResourceSymbols(Bundle* bundle, const sp<AaptAssets>& assets,
                 s++;
                 if (s > last && (*s == '.' || *s == 0)) {
                     String8 part(last, s-last);
-                    dest.appendPath(part);
+                    checkpointName.appendPath(part);
+                    if (rClassDir != NULL) {
+                        dest.appendPath(part);
 #ifdef _WIN32
-                    _mkdir(dest.string());
+                        _mkdir(dest.string());
 #else
-                    mkdir(dest.string(), S_IRUSR|S_IWUSR|S_IXUSR|S_IRGRP|S_IXGRP);
+                        mkdir(dest.string(), S_IRUSR|S_IWUSR|S_IXUSR|S_IRGRP|S_IXGRP);
 #endif
+                    }
                     last = s+1;
                 }
             } while (*s);
         }
         dest.appendPath(className);
         dest.append(".java");
-        FILE* fp = fopen(dest.string(), "w+");
-        if (fp == NULL) {
-            fprintf(stderr, "ERROR: Unable to open class file %s: %s\n",
-                    dest.string(), strerror(errno));
-            return UNKNOWN_ERROR;
-        }
+        checkpointName.appendPath(className);
+        checkpointName.append(".java");
         if (bundle->getVerbose()) {
             printf("  Writing symbols for class %s.\n", className.string());
         }
 
-        fprintf(fp,
+        out.clear();
+        out.appendFormat(
             "/* AUTO-GENERATED FILE.  DO NOT MODIFY.\n"
             " *\n"
             " * This class was automatically generated by the\n"
@@ -2713,39 +4073,49 @@ status_t writeResourceSymbols(Bundle* bundle, const sp<AaptAssets>& assets,
             "\n"
             "package %s;\n\n", package.string());
 
-        status_t err = writeSymbolClass(fp, assets, includePrivate, symbols,
+        status_t err = writeSymbolClass(&out, assets, includePrivate, symbols,
                 className, 0, bundle->getNonConstantId(), emitCallback);
-        fclose(fp);
         if (err != NO_ERROR) {
             return err;
         }
-
-        if (textSymbolsDest != NULL && R == className) {
-            String8 textDest(textSymbolsDest);
-            textDest.appendPath(className);
-            textDest.append(".txt");
-
-            FILE* fp = fopen(textDest.string(), "w+");
-            if (fp == NULL) {
-                fprintf(stderr, "ERROR: Unable to open text symbol file %s: %s\n",
-                        textDest.string(), strerror(errno));
-                return UNKNOWN_ERROR;
+        if (checkpoint != NULL) {
+            checkpoint->addOutput(checkpointName.string(), out.data(), out.size());
+        }
+        if (rClassDir != NULL) {
+            err = writeFileIfChanged(bundle, out, dest, "class file");
+            if (err != NO_ERROR) {
+                return err;
             }
+        }
+
+        if ((textSymbolsDest != NULL || checkpoint != NULL) && R == className) {
             if (bundle->getVerbose()) {
                 printf("  Writing text symbols for class %s.\n", className.string());
             }
 
-            status_t err = writeTextSymbolClass(fp, assets, includePrivate, symbols,
+            out.clear();
+            status_t err = writeTextSymbolClass(&out, assets, includePrivate, symbols,
                     className);
-            fclose(fp);
             if (err != NO_ERROR) {
                 return err;
             }
+            if (checkpoint != NULL) {
+                checkpoint->addOutput("R.txt", out.data(), out.size());
+            }
+            if (textSymbolsDest != NULL) {
+                String8 textDest(textSymbolsDest);
+                textDest.appendPath(className);
+                textDest.append(".txt");
+                err = writeFileIfChanged(bundle, out, textDest, "text symbol file");
+                if (err != NO_ERROR) {
+                    return err;
+                }
+            }
         }
 
         // If we were asked to generate a dependency file, we'll go ahead and add this R.java
         // as a target in the dependency file right next to it.
-        if (bundle->getGenDependencies() && R == className) {
+        if (bundle->getGenDependencies() && rClassDir != NULL && R == className) {
             // Add this R.java to the dependency file
             String8 dependencyFile(bundle->getRClassDir());
             dependencyFile.appendPath("R.java.d");
@@ -2760,24 +4130,6 @@ status_t writeResourceSymbols(Bundle* bundle, const sp<AaptAssets>& assets,
 }
 
 
-class ProguardKeepSet
-{
-public:
-    // { rule --> { file locations } }
-    KeyedVector<String8, SortedVector<String8> > rules;
-
-    void add(const String8& rule, const String8& where);
-};
-
-void ProguardKeepSet::add(const String8& rule, const String8& where)
-{
-    ssize_t index = rules.indexOfKey(rule);
-    if (index < 0) {
-        index = rules.add(rule, SortedVector<String8>());
-    }
-    rules.editValueAt(index).add(where);
-}
-
 void
 addProguardKeepRule(ProguardKeepSet* keep, const String8& inClassName,
         const char* pkg, const String8& srcName, int line)
@@ -2932,20 +4284,13 @@ struct NamespaceAttributePair {
     NamespaceAttributePair() : ns(NULL), attr(NULL) {}
 };
 
-status_t
-writeProguardForXml(ProguardKeepSet* keep, const sp<AaptFile>& layoutFile,
+static void
+writeProguardForXml(ProguardKeepSet* keep, const String8& source, ResXMLTree& tree,
         const Vector<String8>& startTags, const KeyedVector<String8, Vector<NamespaceAttributePair> >* tagAttrPairs)
 {
-    status_t err;
-    ResXMLTree tree;
     size_t len;
     ResXMLTree::event_code_t code;
 
-    err = parseXMLResource(layoutFile, &tree);
-    if (err != NO_ERROR) {
-        return err;
-    }
-
     tree.restart();
 
     if (!startTags.isEmpty()) {
@@ -2964,7 +4309,7 @@ writeProguardForXml(ProguardKeepSet* keep, const sp<AaptFile>& layoutFile,
             break;
         }
         if (!haveStart) {
-            return NO_ERROR;
+            return;
         }
     }
 
@@ -2977,7 +4322,7 @@ writeProguardForXml(ProguardKeepSet* keep, const sp<AaptFile>& layoutFile,
         // If there is no '.', we'll assume that it's one of the built in names.
         if (strchr(tag.string(), '.')) {
             addProguardKeepRule(keep, tag, NULL,
-                    layoutFile->getPrintableSource(), tree.getLineNumber());
+                    source, tree.getLineNumber());
         } else if (tagAttrPairs != NULL) {
             ssize_t tagIndex = tagAttrPairs->indexOfKey(tag);
             if (tagIndex >= 0) {
@@ -2988,27 +4333,27 @@ writeProguardForXml(ProguardKeepSet* keep, const sp<AaptFile>& layoutFile,
                     ssize_t attrIndex = tree.indexOfAttribute(nsAttr.ns, nsAttr.attr);
                     if (attrIndex < 0) {
                         // fprintf(stderr, "%s:%d: <%s> does not have attribute %s:%s.\n",
-                        //        layoutFile->getPrintableSource().string(), tree.getLineNumber(),
+                        //        source.string(), tree.getLineNumber(),
                         //        tag.string(), nsAttr.ns, nsAttr.attr);
                     } else {
-                        size_t len;
-                        addProguardKeepRule(keep,
-                                            String8(tree.getAttributeStringValue(attrIndex, &len)), NULL,
-                                            layoutFile->getPrintableSource(), tree.getLineNumber());
+                        // A reference has no string left once compiled.
+                        const char16_t* value = tree.getAttributeStringValue(attrIndex, &len);
+                        if (value != NULL) {
+                            addProguardKeepRule(keep, String8(value, len), NULL,
+                                    source, tree.getLineNumber());
+                        }
                     }
                 }
             }
         }
         ssize_t attrIndex = tree.indexOfAttribute(RESOURCES_ANDROID_NAMESPACE, "onClick");
-        if (attrIndex >= 0) {
-            size_t len;
-            addProguardKeepMethodRule(keep,
-                                String8(tree.getAttributeStringValue(attrIndex, &len)), NULL,
-                                layoutFile->getPrintableSource(), tree.getLineNumber());
+        const char16_t* value = attrIndex >= 0
+                ? tree.getAttributeStringValue(attrIndex, &len) : NULL;
+        if (value != NULL) {
+            addProguardKeepMethodRule(keep, String8(value, len), NULL,
+                    source, tree.getLineNumber());
         }
     }
-
-    return NO_ERROR;
 }
 
 static void addTagAttrPair(KeyedVector<String8, Vector<NamespaceAttributePair> >* dest,
@@ -3025,75 +4370,70 @@ static void addTagAttrPair(KeyedVector<String8, Vector<NamespaceAttributePair> >
     }
 }
 
-status_t
-writeProguardForLayouts(ProguardKeepSet* keep, const sp<AaptAssets>& assets)
-{
-    status_t err;
-    const char* kClass = "class";
-    const char* kFragment = "fragment";
-    const String8 kTransition("transition");
-    const String8 kTransitionPrefix("transition-");
-
-    // tag:attribute pairs that should be checked in layout files.
-    KeyedVector<String8, Vector<NamespaceAttributePair> > kLayoutTagAttrPairs;
-    addTagAttrPair(&kLayoutTagAttrPairs, "view", NULL, kClass);
-    addTagAttrPair(&kLayoutTagAttrPairs, kFragment, NULL, kClass);
-    addTagAttrPair(&kLayoutTagAttrPairs, kFragment, RESOURCES_ANDROID_NAMESPACE, "name");
-
-    // tag:attribute pairs that should be checked in xml files.
-    KeyedVector<String8, Vector<NamespaceAttributePair> > kXmlTagAttrPairs;
-    addTagAttrPair(&kXmlTagAttrPairs, "PreferenceScreen", RESOURCES_ANDROID_NAMESPACE, kFragment);
-    addTagAttrPair(&kXmlTagAttrPairs, "header", RESOURCES_ANDROID_NAMESPACE, kFragment);
-
-    // tag:attribute pairs that should be checked in transition files.
-    KeyedVector<String8, Vector<NamespaceAttributePair> > kTransitionTagAttrPairs;
-    addTagAttrPair(&kTransitionTagAttrPairs, kTransition.string(), NULL, kClass);
-    addTagAttrPair(&kTransitionTagAttrPairs, "pathMotion", NULL, kClass);
-
-    const Vector<sp<AaptDir> >& dirs = assets->resDirs();
-    const size_t K = dirs.size();
-    for (size_t k=0; k<K; k++) {
-        const sp<AaptDir>& d = dirs.itemAt(k);
-        const String8& dirName = d->getLeaf();
-        Vector<String8> startTags;
-        const KeyedVector<String8, Vector<NamespaceAttributePair> >* tagAttrPairs = NULL;
-        if ((dirName == String8("layout")) || (strncmp(dirName.string(), "layout-", 7) == 0)) {
-            tagAttrPairs = &kLayoutTagAttrPairs;
-        } else if ((dirName == String8("xml")) || (strncmp(dirName.string(), "xml-", 4) == 0)) {
-            startTags.add(String8("PreferenceScreen"));
-            startTags.add(String8("preference-headers"));
-            tagAttrPairs = &kXmlTagAttrPairs;
-        } else if ((dirName == String8("menu")) || (strncmp(dirName.string(), "menu-", 5) == 0)) {
-            startTags.add(String8("menu"));
-            tagAttrPairs = NULL;
-        } else if (dirName == kTransition || (strncmp(dirName.string(), kTransitionPrefix.string(),
-                        kTransitionPrefix.size()) == 0)) {
-            tagAttrPairs = &kTransitionTagAttrPairs;
-        } else {
-            continue;
-        }
+/*
+ * The tags and attributes that name classes in each type of resource XML.
+ */
+struct ProguardXmlRules {
+    ProguardXmlRules() {
+        const char* kClass = "class";
+        const char* kFragment = "fragment";
+
+        // tag:attribute pairs that should be checked in layout files.
+        addTagAttrPair(&layoutTagAttrPairs, "view", NULL, kClass);
+        addTagAttrPair(&layoutTagAttrPairs, kFragment, NULL, kClass);
+        addTagAttrPair(&layoutTagAttrPairs, kFragment, RESOURCES_ANDROID_NAMESPACE, "name");
+
+        // tag:attribute pairs that should be checked in xml files.
+        xmlStartTags.add(String8("PreferenceScreen"));
+        xmlStartTags.add(String8("preference-headers"));
+        addTagAttrPair(&xmlTagAttrPairs, "PreferenceScreen", RESOURCES_ANDROID_NAMESPACE, kFragment);
+        addTagAttrPair(&xmlTagAttrPairs, "header", RESOURCES_ANDROID_NAMESPACE, kFragment);
+
+        menuStartTags.add(String8("menu"));
+
+        // tag:attribute pairs that should be checked in transition files.
+        addTagAttrPair(&transitionTagAttrPairs, "transition", NULL, kClass);
+        addTagAttrPair(&transitionTagAttrPairs, "pathMotion", NULL, kClass);
+    }
+
+    KeyedVector<String8, Vector<NamespaceAttributePair> > layoutTagAttrPairs;
+    KeyedVector<String8, Vector<NamespaceAttributePair> > xmlTagAttrPairs;
+    KeyedVector<String8, Vector<NamespaceAttributePair> > transitionTagAttrPairs;
+    Vector<String8> xmlStartTags;
+    Vector<String8> menuStartTags;
+    Vector<String8> noStartTags;
+};
 
-        const KeyedVector<String8,sp<AaptGroup> > groups = d->getFiles();
-        const size_t N = groups.size();
-        for (size_t i=0; i<N; i++) {
-            const sp<AaptGroup>& group = groups.valueAt(i);
-            const DefaultKeyedVector<AaptGroupEntry, sp<AaptFile> >& files = group->getFiles();
-            const size_t M = files.size();
-            for (size_t j=0; j<M; j++) {
-                err = writeProguardForXml(keep, files.valueAt(j), startTags, tagAttrPairs);
-                if (err < 0) {
-                    return err;
-                }
-            }
-        }
-    }
-    // Handle the overlays
-    sp<AaptAssets> overlay = assets->getOverlay();
-    if (overlay.get()) {
-        return writeProguardForLayouts(keep, overlay);
+/*
+ * Adds the keep rules for one just-compiled file of the given resource
+ * type, reading them from its binary tree.  Called from the compile
+ * workers, so it only touches the given set.
+ */
+static void
+collectProguardRules(ProguardKeepSet* keep, const char* resType, const sp<AaptFile>& file)
+{
+    static const ProguardXmlRules sRules;
+
+    const Vector<String8>* startTags = &sRules.noStartTags;
+    const KeyedVector<String8, Vector<NamespaceAttributePair> >* tagAttrPairs = NULL;
+    if (strcmp(resType, "layout") == 0) {
+        tagAttrPairs = &sRules.layoutTagAttrPairs;
+    } else if (strcmp(resType, "xml") == 0) {
+        startTags = &sRules.xmlStartTags;
+        tagAttrPairs = &sRules.xmlTagAttrPairs;
+    } else if (strcmp(resType, "menu") == 0) {
+        startTags = &sRules.menuStartTags;
+    } else if (strcmp(resType, "transition") == 0) {
+        tagAttrPairs = &sRules.transitionTagAttrPairs;
+    } else {
+        return;
     }
 
-    return NO_ERROR;
+    ResXMLTree tree;
+    if (tree.setToTrusted(file->getData(), file->getSize()) != NO_ERROR) {
+        return;
+    }
+    writeProguardForXml(keep, file->getPrintableSource(), tree, *startTags, tagAttrPairs);
 }
 
 status_t
@@ -3101,9 +4441,11 @@ writeProguardFile(Bundle* bundle, const sp<AaptAssets>& assets)
 {
     status_t err = -1;
 
-    if (!bundle->getProguardFile()) {
+    Checkpoint* checkpoint = Checkpoint::current(bundle);
+    if (!bundle->getProguardFile() && checkpoint == NULL) {
         return NO_ERROR;
     }
+    PhaseSpan span("writeProguardFile");
 
     ProguardKeepSet keep;
 
@@ -3112,8 +4454,27 @@ writeProguardFile(Bundle* bundle, const sp<AaptAssets>& assets)
         return err;
     }
 
-    err = writeProguardForLayouts(&keep, assets);
-    if (err < 0) {
+    keep.add(*xmlKeepRules());
+
+    OutputBuffer out;
+    const KeyedVector<String8, SortedVector<String8> >& rules = keep.rules;
+    const size_t N = rules.size();
+    for (size_t i=0; i<N; i++) {
+        const SortedVector<String8>& locations = rules.valueAt(i);
+        const size_t M = locations.size();
+        for (size_t j=0; j<M; j++) {
+            out.appendFormat("# %s\n", locations.itemAt(j).string());
+        }
+        out.appendFormat("%s\n\n", rules.keyAt(i).string());
+    }
+    if (out.hasError()) {
+        fprintf(stderr, "ERROR: Unable to buffer ProGuard rules\n");
+        return NO_MEMORY;
+    }
+    if (checkpoint != NULL) {
+        checkpoint->addOutput("proguard.txt", out.data(), out.size());
+    }
+    if (!bundle->getProguardFile()) {
         return err;
     }
 
@@ -3123,18 +4484,12 @@ writeProguardFile(Bundle* bundle, const sp<AaptAssets>& assets)
                 bundle->getProguardFile(), strerror(errno));
         return UNKNOWN_ERROR;
     }
-
-    const KeyedVector<String8, SortedVector<String8> >& rules = keep.rules;
-    const size_t N = rules.size();
-    for (size_t i=0; i<N; i++) {
-        const SortedVector<String8>& locations = rules.valueAt(i);
-        const size_t M = locations.size();
-        for (size_t j=0; j<M; j++) {
-            fprintf(fp, "# %s\n", locations.itemAt(j).string());
-        }
-        fprintf(fp, "%s\n\n", rules.keyAt(i).string());
+    status_t writeErr = out.writeTo(fp);
+    if (fclose(fp) != 0 || writeErr != NO_ERROR) {
+        fprintf(stderr, "ERROR: Unable to write %s: %s\n",
+                bundle->getProguardFile(), strerror(errno));
+        return UNKNOWN_ERROR;
     }
-    fclose(fp);
 
     return err;
 }
@@ -24,31 +24,38 @@ WeakResourceFilter::parse(const String8& str)
             mContainsPseudoBidi = true;
         }
 
-        std::pair<ConfigDescription, uint32_t>& entry = mConfigs.editItemAt(i);
+        FilterConfig& entry = mConfigs.editItemAt(i);
 
         AaptLocaleValue val;
         if (val.initFromFilterString(part)) {
             // For backwards compatibility, we accept configurations that
             // only specify locale in the standard 'en_US' format.
-            val.writeTo(&entry.first);
-        } else if (!AaptConfig::parse(part, &entry.first)) {
+            val.writeTo(&entry.config);
+        } else if (!AaptConfig::parse(part, &entry.config)) {
             fprintf(stderr, "Invalid configuration: %s\n", part.string());
             return UNKNOWN_ERROR;
         }
 
-        entry.second = mDefault.diff(entry.first);
+        entry.axes = mDefault.diff(entry.config);
 
         // Ignore the version
-        entry.second &= ~ResTable_config::CONFIG_VERSION;
+        entry.axes &= ~ResTable_config::CONFIG_VERSION;
 
         // Ignore any densities. Those are best handled in --preferred-density
-        if ((entry.second & ResTable_config::CONFIG_DENSITY) != 0) {
-            fprintf(stderr, "warning: ignoring flag -c %s. Use --preferred-density instead.\n", entry.first.toString().string());
-            entry.first.density = 0;
-            entry.second &= ~ResTable_config::CONFIG_DENSITY;
+        if ((entry.axes & ResTable_config::CONFIG_DENSITY) != 0) {
+            fprintf(stderr, "warning: ignoring flag -c %s. Use --preferred-density instead.\n", entry.config.toString().string());
+            entry.config.density = 0;
+            entry.axes &= ~ResTable_config::CONFIG_DENSITY;
         }
 
-        mConfigMask |= entry.second;
+        entry.packed = PackedConfig(entry.config);
+        entry.axesMask = PackedConfig::axisMask(entry.axes);
+        entry.nonLocaleMask = PackedConfig::axisMask(
+                entry.axes & ~ResTable_config::CONFIG_LOCALE);
+        entry.nonSmallestWidthMask = PackedConfig::axisMask(
+                entry.axes & ~ResTable_config::CONFIG_SMALLEST_SCREEN_SIZE);
+
+        mConfigMask |= entry.axes;
     }
 
     return NO_ERROR;
@@ -63,29 +70,35 @@ WeakResourceFilter::match(const ResTable_config& config) const
         return true;
     }
 
+    // Each entry below checks whether the config differs from it on none
+    // of its axes, on just the locale or on just the smallest width; with
+    // the entries' masks worked out up front, these are masked compares of
+    // the packed words rather than a diff() per entry.
+    const PackedConfig packed(config);
     uint32_t matchedAxis = 0x0;
     const size_t N = mConfigs.size();
     for (size_t i = 0; i < N; i++) {
-        const std::pair<ConfigDescription, uint32_t>& entry = mConfigs[i];
-        uint32_t diff = entry.first.diff(config);
-        if ((diff & entry.second) == 0) {
+        const FilterConfig& entry = mConfigs[i];
+        if (packed.equalsWhere(entry.packed, entry.axesMask)) {
             // Mark the axis that was matched.
-            matchedAxis |= entry.second;
-        } else if ((diff & entry.second) == ResTable_config::CONFIG_LOCALE) {
+            matchedAxis |= entry.axes;
+        } else if ((entry.axes & ResTable_config::CONFIG_LOCALE) != 0 &&
+                packed.equalsWhere(entry.packed, entry.nonLocaleMask)) {
             // If the locales differ, but the languages are the same and
             // the locale we are matching only has a language specified,
             // we match.
             if (config.language[0] &&
-                    memcmp(config.language, entry.first.language, sizeof(config.language)) == 0) {
+                    memcmp(config.language, entry.config.language, sizeof(config.language)) == 0) {
                 if (config.country[0] == 0) {
                     matchedAxis |= ResTable_config::CONFIG_LOCALE;
                 }
             }
-        } else if ((diff & entry.second) == ResTable_config::CONFIG_SMALLEST_SCREEN_SIZE) {
+        } else if ((entry.axes & ResTable_config::CONFIG_SMALLEST_SCREEN_SIZE) != 0 &&
+                packed.equalsWhere(entry.packed, entry.nonSmallestWidthMask)) {
             // Special case if the smallest screen width doesn't match. We check that the
             // config being matched has a smaller screen width than the filter specified.
             if (config.smallestScreenWidthDp != 0 &&
-                    config.smallestScreenWidthDp < entry.first.smallestScreenWidthDp) {
+                    config.smallestScreenWidthDp < entry.config.smallestScreenWidthDp) {
                 matchedAxis |= ResTable_config::CONFIG_SMALLEST_SCREEN_SIZE;
             }
         }
@@ -105,5 +118,6 @@ StrongResourceFilter::parse(const String8& str) {
         }
         mConfigs.insert(config);
     }
+    packConfigs();
     return NO_ERROR;
 }
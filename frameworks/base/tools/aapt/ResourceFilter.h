@@ -7,6 +7,7 @@
 #ifndef RESOURCE_FILTER_H
 #define RESOURCE_FILTER_H
 
+#include <algorithm>
 #include <androidfw/ResourceTypes.h>
 #include <set>
 #include <utility>
@@ -49,9 +50,21 @@ public:
     }
 
 private:
+    // One "-c" configuration, with the axes it specifies and where those
+    // axes sit in its packed form.
+    struct FilterConfig {
+        ConfigDescription config;
+        uint32_t axes;
+        PackedConfig packed;
+        PackedConfig axesMask;
+        // axesMask without the locale, and without the smallest width.
+        PackedConfig nonLocaleMask;
+        PackedConfig nonSmallestWidthMask;
+    };
+
     ConfigDescription mDefault;
     uint32_t mConfigMask;
-    android::Vector<std::pair<ConfigDescription, uint32_t> > mConfigs;
+    android::Vector<FilterConfig> mConfigs;
 
     bool mContainsPseudoAccented;
     bool mContainsPseudoBidi;
@@ -79,18 +92,18 @@ class StrongResourceFilter : public ResourceFilter {
 public:
     StrongResourceFilter() {}
     StrongResourceFilter(const std::set<ConfigDescription>& configs)
-        : mConfigs(configs) {}
+        : mConfigs(configs) {
+        packConfigs();
+    }
 
     android::status_t parse(const android::String8& str);
 
     bool match(const android::ResTable_config& config) const {
-        std::set<ConfigDescription>::const_iterator iter = mConfigs.begin();
-        for (; iter != mConfigs.end(); iter++) {
-            if (iter->compare(config) == 0) {
-                return true;
-            }
-        }
-        return false;
+        const PackedConfig packed(config);
+        const PackedConfig* begin = mPackedConfigs.array();
+        const PackedConfig* end = begin + mPackedConfigs.size();
+        const PackedConfig* found = std::lower_bound(begin, end, packed);
+        return found != end && *found == packed;
     }
 
     inline const std::set<ConfigDescription>& getConfigs() const {
@@ -98,7 +111,19 @@ public:
     }
 
 private:
+    void packConfigs() {
+        mPackedConfigs.clear();
+        std::set<ConfigDescription>::const_iterator iter = mConfigs.begin();
+        for (; iter != mConfigs.end(); iter++) {
+            mPackedConfigs.add(PackedConfig(*iter));
+        }
+        std::sort(mPackedConfigs.editArray(),
+                mPackedConfigs.editArray() + mPackedConfigs.size());
+    }
+
     std::set<ConfigDescription> mConfigs;
+    // mConfigs packed, in PackedConfig order for binary search.
+    android::Vector<PackedConfig> mPackedConfigs;
 };
 
 /**
@@ -5,101 +5,193 @@
 
 #define LOG_TAG "ResourceIdCache"
 
+#include <utils/JenkinsHash.h>
 #include <utils/String16.h>
 #include <utils/Log.h>
+#include <utils/Mutex.h>
+#include "AaptContext.h"
 #include "ResourceIdCache.h"
-#include <map>
+#include "Statistics.h"
 
-static size_t mHits = 0;
-static size_t mMisses = 0;
-static size_t mCollisions = 0;
+namespace android {
 
-static const size_t MAX_CACHE_ENTRIES = 2048;
-static const android::String16 TRUE16("1");
-static const android::String16 FALSE16("0");
+static const size_t INITIAL_CAPACITY = 1024;   // must be a power of two
 
 struct CacheEntry {
-    // concatenation of the relevant strings into a single instance
-    android::String16 hashedName;
-    uint32_t id;
+    String16 package;
+    String16 type;
+    String16 name;
+    uint32_t hash;
+    uint32_t id;        // 0 if the slot is empty
+    bool onlyPublic;
+};
+
+// Open addressing with linear probing.  Entries are never removed one at
+// a time, so there are no tombstones; the table doubles once it is 3/4 full.
+// Each run has its own, in its AaptContext.
+struct IdTable {
+    CacheEntry* entries;
+    size_t capacity;
+    size_t size;
+
+    // Guards the table; lookups may come from several compile
+    // threads.  Keys are hashed before taking it.
+    Mutex lock;
 
-    CacheEntry() {}
-    CacheEntry(const android::String16& name, uint32_t resId) : hashedName(name), id(resId) { }
+    IdTable() : entries(NULL), capacity(0), size(0) { }
+    ~IdTable() { delete[] entries; }
 };
 
-static std::map< uint32_t, CacheEntry > mIdMap;
+static void* newIdTable() {
+    return new IdTable;
+}
 
+static void deleteIdTable(void* table) {
+    delete static_cast<IdTable*>(table);
+}
 
-// djb2; reasonable choice for strings when collisions aren't particularly important
-static inline uint32_t hashround(uint32_t hash, int c) {
-    return ((hash << 5) + hash) + c;    /* hash * 33 + c */
+// The table of the calling thread's run.
+static IdTable* idTable() {
+    return static_cast<IdTable*>(AaptContext::current()->getState(
+            AaptContext::STATE_RESOURCE_IDS, newIdTable, deleteIdTable));
 }
 
-static uint32_t hash(const android::String16& hashableString) {
-    uint32_t hash = 5381;
-    const char16_t* str = hashableString.string();
-    while (int c = *str++) hash = hashround(hash, c);
-    return hash;
+static inline uint32_t mixString(uint32_t hash, const StringPiece16& str) {
+    hash = JenkinsHashMixShorts(hash, (const uint16_t*)str.data(), str.size());
+    // Keep ("ab", "c") and ("a", "bc") apart.
+    return JenkinsHashMix(hash, str.size());
 }
 
-namespace android {
+static uint32_t hashKey(const StringPiece16& package, const StringPiece16& type,
+        const StringPiece16& name, bool onlyPublic) {
+    uint32_t hash = mixString(0, name);
+    hash = mixString(hash, type);
+    hash = mixString(hash, package);
+    hash = JenkinsHashMix(hash, onlyPublic ? 1 : 0);
+    return JenkinsHashWhiten(hash);
+}
 
-static inline String16 makeHashableName(const android::String16& package,
-        const android::String16& type,
-        const android::String16& name,
-        bool onlyPublic) {
-    String16 hashable = String16(name);
-    hashable += type;
-    hashable += package;
-    hashable += (onlyPublic ? TRUE16 : FALSE16);
-    return hashable;
+static inline bool matches(const CacheEntry& entry, uint32_t hash,
+        const StringPiece16& package, const StringPiece16& type,
+        const StringPiece16& name, bool onlyPublic) {
+    return entry.hash == hash && entry.onlyPublic == onlyPublic
+            && name == entry.name && type == entry.type && package == entry.package;
 }
 
-uint32_t ResourceIdCache::lookup(const android::String16& package,
-        const android::String16& type,
-        const android::String16& name,
-        bool onlyPublic) {
-    const String16 hashedName = makeHashableName(package, type, name, onlyPublic);
-    const uint32_t hashcode = hash(hashedName);
-    std::map<uint32_t, CacheEntry>::iterator item = mIdMap.find(hashcode);
-    if (item == mIdMap.end()) {
-        // cache miss
-        mMisses++;
-        return 0;
+// Returns the slot holding the key, or the empty slot where it belongs.
+// Must be called with the table's lock held and a non-empty table.
+static CacheEntry* findSlotLocked(IdTable* t, uint32_t hash, const StringPiece16& package,
+        const StringPiece16& type, const StringPiece16& name, bool onlyPublic) {
+    CacheEntry* const entries = t->entries;
+    const size_t mask = t->capacity - 1;
+    size_t index = hash & mask;
+    size_t collisions = 0;
+    while (entries[index].id != 0) {
+        if (matches(entries[index], hash, package, type, name, onlyPublic)) {
+            break;
+        }
+        collisions++;
+        index = (index + 1) & mask;
+    }
+    if (collisions > 0) {
+        Statistics::add(Statistics::ID_CACHE_COLLISIONS, collisions);
     }
+    return &entries[index];
+}
 
-    // legit match?
-    if (hashedName == (*item).second.hashedName) {
-        mHits++;
-        return (*item).second.id;
+static void growLocked(IdTable* t) {
+    CacheEntry* oldEntries = t->entries;
+    const size_t oldCapacity = t->capacity;
+
+    const size_t newCapacity = oldCapacity ? oldCapacity * 2 : INITIAL_CAPACITY;
+    CacheEntry* const entries = new CacheEntry[newCapacity];
+    for (size_t i = 0; i < newCapacity; i++) {
+        entries[i].id = 0;
+    }
+    t->entries = entries;
+    t->capacity = newCapacity;
+
+    const size_t mask = newCapacity - 1;
+    for (size_t i = 0; i < oldCapacity; i++) {
+        const CacheEntry& entry = oldEntries[i];
+        if (entry.id == 0) {
+            continue;
+        }
+        size_t index = entry.hash & mask;
+        while (entries[index].id != 0) {
+            index = (index + 1) & mask;
+        }
+        entries[index] = entry;
     }
+    delete[] oldEntries;
+}
 
-    // collision
-    mCollisions++;
-    mIdMap.erase(hashcode);
-    return 0;
+uint32_t ResourceIdCache::lookup(const StringPiece16& package,
+        const StringPiece16& type,
+        const StringPiece16& name,
+        bool onlyPublic) {
+    const uint32_t hash = hashKey(package, type, name, onlyPublic);
+    IdTable* t = idTable();
+    AutoMutex _l(t->lock);
+    if (t->size == 0) {
+        Statistics::add(Statistics::ID_CACHE_MISSES);
+        return 0;
+    }
+    const CacheEntry* entry = findSlotLocked(t, hash, package, type, name, onlyPublic);
+    if (entry->id == 0) {
+        Statistics::add(Statistics::ID_CACHE_MISSES);
+        return 0;
+    }
+    Statistics::add(Statistics::ID_CACHE_HITS);
+    return entry->id;
 }
 
 // returns the resource ID being stored, for callsite convenience
-uint32_t ResourceIdCache::store(const android::String16& package,
-        const android::String16& type,
-        const android::String16& name,
+uint32_t ResourceIdCache::store(const StringPiece16& package,
+        const StringPiece16& type,
+        const StringPiece16& name,
         bool onlyPublic,
         uint32_t resId) {
-    if (mIdMap.size() < MAX_CACHE_ENTRIES) {
-        const String16 hashedName = makeHashableName(package, type, name, onlyPublic);
-        const uint32_t hashcode = hash(hashedName);
-        mIdMap[hashcode] = CacheEntry(hashedName, resId);
+    if (resId == 0) {
+        return resId;
+    }
+    const uint32_t hash = hashKey(package, type, name, onlyPublic);
+    IdTable* t = idTable();
+    AutoMutex _l(t->lock);
+    if ((t->size + 1) * 4 > t->capacity * 3) {
+        growLocked(t);
     }
+    CacheEntry* entry = findSlotLocked(t, hash, package, type, name, onlyPublic);
+    if (entry->id == 0) {
+        entry->package = package.toString16();
+        entry->type = type.toString16();
+        entry->name = name.toString16();
+        entry->hash = hash;
+        entry->onlyPublic = onlyPublic;
+        t->size++;
+        Statistics::add(Statistics::ID_CACHE_ENTRIES);
+    }
+    entry->id = resId;
     return resId;
 }
 
+void ResourceIdCache::clear() {
+    IdTable* t = idTable();
+    AutoMutex _l(t->lock);
+    delete[] t->entries;
+    t->entries = NULL;
+    t->capacity = 0;
+    t->size = 0;
+}
+
 void ResourceIdCache::dump() {
+    IdTable* t = idTable();
+    AutoMutex _l(t->lock);
     printf("ResourceIdCache dump:\n");
-    printf("Size: %zd\n", mIdMap.size());
-    printf("Hits:   %zd\n", mHits);
-    printf("Misses: %zd\n", mMisses);
-    printf("(Collisions: %zd)\n", mCollisions);
+    printf("Size: %zd\n", t->size);
+    printf("Hits:   %zd\n", (size_t) Statistics::get(Statistics::ID_CACHE_HITS));
+    printf("Misses: %zd\n", (size_t) Statistics::get(Statistics::ID_CACHE_MISSES));
+    printf("(Collisions: %zd)\n", (size_t) Statistics::get(Statistics::ID_CACHE_COLLISIONS));
 }
 
 }
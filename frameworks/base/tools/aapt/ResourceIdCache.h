@@ -8,22 +8,29 @@
 
 #include <utils/String16.h>
 
+#include "StringPiece.h"
+
 namespace android {
 
+// The IDs are those of the calling thread's run; see AaptContext.  Lookups
+// take pieces of other strings and copy nothing; only storing a new ID does.
 class ResourceIdCache {
 public:
-    static uint32_t lookup(const String16& package,
-            const String16& type,
-            const String16& name,
+    static uint32_t lookup(const StringPiece16& package,
+            const StringPiece16& type,
+            const StringPiece16& name,
             bool onlyPublic);
 
-    static uint32_t store(const String16& package,
-            const String16& type,
-            const String16& name,
+    static uint32_t store(const StringPiece16& package,
+            const StringPiece16& type,
+            const StringPiece16& name,
             bool onlyPublic,
             uint32_t resId);
 
     static void dump(void);
+
+    // Drops all cached IDs, for when a new table is built in this process.
+    static void clear(void);
 };
 
 }
@@ -7,10 +7,18 @@
 #include "ResourceTable.h"
 
 #include "AaptUtil.h"
+#include "CompileCache.h"
+#include "FileCosts.h"
+#include "MappedFile.h"
+#include "PhaseTrace.h"
 #include "XMLNode.h"
+#include "XMLStream.h"
 #include "ResourceFilter.h"
 #include "ResourceIdCache.h"
 #include "SdkConstants.h"
+#include "Statistics.h"
+#include "StringAtoms.h"
+#include "WorkQueue.h"
 
 #include <algorithm>
 #include <androidfw/ResourceTypes.h>
@@ -39,6 +47,19 @@ static const bool kPrintStringMetrics = false;
 
 static const char* kAttrPrivateType = "^attr-private";
 
+// The interned type names getResId() and getCustomResource() fall back on.
+static const String16& attrType16()
+{
+    static const String16& type = StringAtoms::intern("attr");
+    return type;
+}
+
+static const String16& attrPrivateType16()
+{
+    static const String16& type = StringAtoms::intern(kAttrPrivateType);
+    return type;
+}
+
 status_t compileXmlFile(const Bundle* bundle,
                         const sp<AaptAssets>& assets,
                         const String16& resourceName,
@@ -46,7 +67,31 @@ status_t compileXmlFile(const Bundle* bundle,
                         ResourceTable* table,
                         int options)
 {
-    sp<XMLNode> root = XMLNode::parse(target);
+    PhaseSpan span("compileXmlFile", target->getPrintableSource());
+    span.setBytes(target->getSize());
+    FileCostSpan parseCost(FileCosts::PARSE, target->getPrintableSource());
+    parseCost.setInputBytes(target->getSize());
+    XMLStream stream;
+    if (stream.parse(target) != NO_ERROR) {
+        return UNKNOWN_ERROR;
+    }
+    stream.prepare(options);
+    parseCost.end();
+
+    FileCostSpan cost(FileCosts::COMPILE, target->getPrintableSource());
+    cost.setInputBytes(target->getSize());
+    cost.setCompiledXml(target.get());
+    bool needsTree;
+    status_t err = stream.resolve(bundle, assets, target, table, options, &needsTree);
+    if (err != NO_ERROR) {
+        return err;
+    }
+    if (!needsTree) {
+        return flattenXmlFile(stream, target, options);
+    }
+
+    XMLNode::Arena arena;
+    sp<XMLNode> root = XMLNode::parse(target, &arena);
     if (root == NULL) {
         return UNKNOWN_ERROR;
     }
@@ -62,7 +107,10 @@ status_t compileXmlFile(const Bundle* bundle,
                         ResourceTable* table,
                         int options)
 {
-    sp<XMLNode> root = XMLNode::parse(target);
+    PhaseSpan span("compileXmlFile", target->getPrintableSource());
+    span.setBytes(target->getSize());
+    XMLNode::Arena arena;
+    sp<XMLNode> root = XMLNode::parse(target, &arena);
     if (root == NULL) {
         return UNKNOWN_ERROR;
     }
@@ -77,6 +125,18 @@ status_t compileXmlFile(const Bundle* bundle,
                         const sp<AaptFile>& target,
                         ResourceTable* table,
                         int options)
+{
+    prepareXmlFile(root, options);
+
+    status_t err = resolveXmlFile(bundle, assets, resourceName, root, target, table, options);
+    if (err != NO_ERROR) {
+        return err;
+    }
+
+    return flattenXmlFile(root, target, options);
+}
+
+void prepareXmlFile(const sp<XMLNode>& root, int options)
 {
     if ((options&XML_COMPILE_STRIP_WHITESPACE) != 0) {
         root->removeWhitespace(true, NULL);
@@ -87,7 +147,16 @@ status_t compileXmlFile(const Bundle* bundle,
     if ((options&XML_COMPILE_UTF8) != 0) {
         root->setUTF8(true);
     }
+}
 
+status_t resolveXmlFile(const Bundle* bundle,
+                        const sp<AaptAssets>& assets,
+                        const String16& resourceName,
+                        const sp<XMLNode>& root,
+                        const sp<AaptFile>& target,
+                        ResourceTable* table,
+                        int options)
+{
     bool hasErrors = false;
     
     if ((options&XML_COMPILE_ASSIGN_ATTRIBUTE_IDS) != 0) {
@@ -110,16 +179,46 @@ status_t compileXmlFile(const Bundle* bundle,
         return UNKNOWN_ERROR;
     }
 
+    return NO_ERROR;
+}
+
+static void warnPlainIds(const sp<XMLNode>& node, const String8& path)
+{
+    if (node->getType() != XMLNode::TYPE_ELEMENT) {
+        return;
+    }
+    const Vector<XMLNode::attribute_entry>& attrs = node->getAttributes();
+    for (size_t i = 0; i < attrs.size(); i++) {
+        if (attrs[i].ns.size() == 0 && attrs[i].name == String16("id")) {
+            SourcePos(path, node->getStartLineNumber()).warning(
+                    "found plain 'id' attribute; did you mean the new 'android:id' name?");
+            break;
+        }
+    }
+    const Vector<sp<XMLNode> >& children = node->getChildren();
+    for (size_t i = 0; i < children.size(); i++) {
+        warnPlainIds(children[i], path);
+    }
+}
+
+status_t flattenXmlFile(const sp<XMLNode>& root,
+                        const sp<AaptFile>& target,
+                        int options)
+{
     if (kIsDebug) {
         printf("Input XML Resource:\n");
         root->print();
     }
-    err = root->flatten(target,
+    status_t err = root->flatten(target,
             (options&XML_COMPILE_STRIP_COMMENTS) != 0,
-            (options&XML_COMPILE_STRIP_RAW_VALUES) != 0);
+            (options&XML_COMPILE_STRIP_RAW_VALUES) != 0,
+            (options&XML_COMPILE_STRIP_LINE_NUMBERS) != 0);
     if (err != NO_ERROR) {
         return err;
     }
+    if ((options&XML_COMPILE_WARN_PLAIN_IDS) != 0) {
+        warnPlainIds(root, target->getPrintableSource());
+    }
 
     if (kIsDebug) {
         printf("Output XML Resource:\n");
@@ -133,6 +232,33 @@ status_t compileXmlFile(const Bundle* bundle,
     return err;
 }
 
+status_t flattenXmlFile(const XMLStream& stream,
+                        const sp<AaptFile>& target,
+                        int options)
+{
+    status_t err = stream.flatten(target,
+            (options&XML_COMPILE_STRIP_COMMENTS) != 0,
+            (options&XML_COMPILE_STRIP_RAW_VALUES) != 0,
+            (options&XML_COMPILE_STRIP_LINE_NUMBERS) != 0);
+    if (err != NO_ERROR) {
+        return err;
+    }
+    if ((options&XML_COMPILE_WARN_PLAIN_IDS) != 0) {
+        stream.warnPlainIds(target->getPrintableSource());
+    }
+
+    if (kIsDebug) {
+        printf("Output XML Resource:\n");
+        ResXMLTree tree;
+        tree.setTo(target->getData(), target->getSize());
+        printXMLBlock(&tree);
+    }
+
+    target->setCompressionMethod(ZipEntry::kCompressDeflated);
+
+    return err;
+}
+
 struct flag_entry
 {
     const char16_t* name;
@@ -285,8 +411,9 @@ struct PendingAttribute
     bool hasErrors;
     bool added;
     
+    template <class Parser>
     PendingAttribute(String16 _package, const sp<AaptFile>& in,
-            ResXMLTree& block, bool _appendComment)
+            Parser& block, bool _appendComment)
         : myPackage(_package)
         , sourcePos(in->getPrintableSource(), block.getLineNumber())
         , appendComment(_appendComment)
@@ -329,8 +456,9 @@ struct PendingAttribute
     }
 };
 
+template <class Parser>
 static status_t compileAttribute(const sp<AaptFile>& in,
-                                 ResXMLTree& block,
+                                 Parser& block,
                                  const String16& myPackage,
                                  ResourceTable* outTable,
                                  String16* outIdent = NULL,
@@ -338,12 +466,12 @@ static status_t compileAttribute(const sp<AaptFile>& in,
 {
     PendingAttribute attr(myPackage, in, block, inStyleable);
     
-    const String16 attr16("attr");
-    const String16 id16("id");
+    const String16& attr16 = StringAtoms::intern("attr");
+    const String16& id16 = StringAtoms::intern("id");
 
     // Attribute type constants.
-    const String16 enum16("enum");
-    const String16 flag16("flag");
+    const String16& enum16 = StringAtoms::intern("enum");
+    const String16& flag16 = StringAtoms::intern("flag");
 
     ResXMLTree::event_code_t code;
     size_t len;
@@ -590,9 +718,10 @@ bool localeIsDefined(const ResTable_config& config)
     return config.locale == 0;
 }
 
-status_t parseAndAddBag(Bundle* bundle,
+template <class Parser>
+static status_t parseAndAddBag(Bundle* bundle,
                         const sp<AaptFile>& in,
-                        ResXMLTree* block,
+                        Parser* block,
                         const ResTable_config& config,
                         const String16& myPackage,
                         const String16& curType,
@@ -687,9 +816,10 @@ struct type_ident_pair_t {
 };
 
 
-status_t parseAndAddEntry(Bundle* bundle,
+template <class Parser>
+static status_t parseAndAddEntry(Bundle* bundle,
                         const sp<AaptFile>& in,
-                        ResXMLTree* block,
+                        Parser* block,
                         const ResTable_config& config,
                         const String16& myPackage,
                         const String16& curType,
@@ -779,6 +909,98 @@ status_t parseAndAddEntry(Bundle* bundle,
     return err;
 }
 
+status_t valuesTreeDigest(const sp<AaptFile>& in, String8* outDigest)
+{
+    // The tree holds line numbers but not the file's name, so copies of
+    // a file in different libraries share an entry.
+    CompileCache::Key key("values-tree-v1");
+    if (in->hasData()) {
+        key.add(in->getData(), in->getSize());
+    } else {
+        status_t err = key.addFile(in->getSourceFile());
+        if (err != NO_ERROR) {
+            return err;
+        }
+    }
+    *outDigest = key.digest();
+    return NO_ERROR;
+}
+
+/*
+ * The cost of adding a values file to the table, with the entries and bags
+ * it added, for --cost-report.
+ */
+class TableCostSpan {
+public:
+    TableCostSpan(const sp<AaptFile>& in, const ResourceTable* table)
+        : mSpan(FileCosts::COMPILE, in->getPrintableSource()), mTable(table),
+          mEntries(table->numLocalResources()), mBags(table->numLocalBags()) {
+        mSpan.setInputBytes(in->getSize());
+    }
+
+    ~TableCostSpan() {
+        mSpan.setEntries(mTable->numLocalResources() - mEntries);
+        mSpan.setBags(mTable->numLocalBags() - mBags);
+    }
+
+private:
+    FileCostSpan mSpan;
+    const ResourceTable* const mTable;
+    const size_t mEntries;
+    const size_t mBags;
+};
+
+status_t parseValuesFile(const Bundle* bundle, const sp<AaptFile>& in, ResXMLTree* outTree)
+{
+    FileCostSpan cost(FileCosts::PARSE, in->getPrintableSource());
+    cost.setInputBytes(in->getSize());
+    if (bundle->getResourceCacheDir() == NULL) {
+        return parseXMLResource(in, outTree, false, true);
+    }
+
+    String8 digest;
+    status_t err = valuesTreeDigest(in, &digest);
+    if (err != NO_ERROR) {
+        return parseXMLResource(in, outTree, false, true);
+    }
+    const CompileCache cache(bundle->getResourceCacheDir());
+
+    sp<AaptFile> flat = new AaptFile(String8(), AaptGroupEntry(), String8());
+    if (cache.get(digest, flat)
+            && outTree->setTo(flat->getData(), flat->getSize(), true) == NO_ERROR) {
+        Statistics::add(Statistics::COMPILE_CACHE_HITS);
+        return NO_ERROR;
+    }
+    Statistics::add(Statistics::COMPILE_CACHE_MISSES);
+    flat->clearData();
+    err = flattenXMLResource(in, flat, false, true);
+    if (err != NO_ERROR) {
+        return err;
+    }
+    // Only a tree read back from the cache, a file, needs checking.
+    const size_t size = flat->getSize();
+    void* data = flat->releaseData();
+    err = outTree->adoptTrusted(data, size);
+    if (err == NO_ERROR) {
+        // A failure to store the tree only costs the next build a parse.
+        cache.put(digest, data, size);
+    }
+    return err;
+}
+
+status_t parseValuesStream(const sp<AaptFile>& in, XMLStream* outStream)
+{
+    FileCostSpan cost(FileCosts::PARSE, in->getPrintableSource());
+    cost.setInputBytes(in->getSize());
+    status_t err = outStream->parse(in);
+    if (err != NO_ERROR) {
+        return err;
+    }
+    // The whitespace parseXMLResource(in, outTree, false, true) leaves.
+    outStream->prepare(XML_COMPILE_COMPACT_WHITESPACE);
+    return NO_ERROR;
+}
+
 status_t compileResourceFile(Bundle* bundle,
                              const sp<AaptAssets>& assets,
                              const sp<AaptFile>& in,
@@ -786,68 +1008,100 @@ status_t compileResourceFile(Bundle* bundle,
                              const bool overwrite,
                              ResourceTable* outTable)
 {
+    PhaseSpan span("parseValuesFile", in->getPrintableSource());
+    span.setBytes(in->getSize());
+    if (bundle->getResourceCacheDir() == NULL) {
+        XMLStream stream;
+        status_t err = parseValuesStream(in, &stream);
+        if (err != NO_ERROR) {
+            return err;
+        }
+        span.end();
+        return compileResourceFile(bundle, assets, in, stream, defParams, overwrite, outTable);
+    }
+
     ResXMLTree block;
-    status_t err = parseXMLResource(in, &block, false, true);
+    status_t err = parseValuesFile(bundle, in, &block);
     if (err != NO_ERROR) {
         return err;
     }
+    span.end();
+
+    return compileResourceFile(bundle, assets, in, block, defParams, overwrite, outTable);
+}
+
+template <class Parser>
+status_t compileResourceFile(Bundle* bundle,
+                             const sp<AaptAssets>& assets,
+                             const sp<AaptFile>& in,
+                             Parser& block,
+                             const ResTable_config& defParams,
+                             const bool overwrite,
+                             ResourceTable* outTable)
+{
+    PhaseSpan span("compileResourceFile", in->getPrintableSource());
+    TableCostSpan cost(in, outTable);
+    status_t err = NO_ERROR;
 
+    // The tag, type and attribute names are interned, so the table's type
+    // names share one buffer and compare by pointer.
     // Top-level tag.
-    const String16 resources16("resources");
+    const String16& resources16 = StringAtoms::intern("resources");
 
     // Identifier declaration tags.
-    const String16 declare_styleable16("declare-styleable");
-    const String16 attr16("attr");
+    const String16& declare_styleable16 = StringAtoms::intern("declare-styleable");
+    const String16& attr16 = StringAtoms::intern("attr");
 
     // Data creation organizational tags.
-    const String16 string16("string");
-    const String16 drawable16("drawable");
-    const String16 color16("color");
-    const String16 bool16("bool");
-    const String16 integer16("integer");
-    const String16 dimen16("dimen");
-    const String16 fraction16("fraction");
-    const String16 style16("style");
-    const String16 plurals16("plurals");
-    const String16 array16("array");
-    const String16 string_array16("string-array");
-    const String16 integer_array16("integer-array");
-    const String16 public16("public");
-    const String16 public_padding16("public-padding");
-    const String16 private_symbols16("private-symbols");
-    const String16 java_symbol16("java-symbol");
-    const String16 add_resource16("add-resource");
-    const String16 skip16("skip");
-    const String16 eat_comment16("eat-comment");
+    const String16& string16 = StringAtoms::intern("string");
+    const String16& drawable16 = StringAtoms::intern("drawable");
+    const String16& color16 = StringAtoms::intern("color");
+    const String16& bool16 = StringAtoms::intern("bool");
+    const String16& integer16 = StringAtoms::intern("integer");
+    const String16& dimen16 = StringAtoms::intern("dimen");
+    const String16& fraction16 = StringAtoms::intern("fraction");
+    const String16& style16 = StringAtoms::intern("style");
+    const String16& plurals16 = StringAtoms::intern("plurals");
+    const String16& array16 = StringAtoms::intern("array");
+    const String16& string_array16 = StringAtoms::intern("string-array");
+    const String16& integer_array16 = StringAtoms::intern("integer-array");
+    const String16& public16 = StringAtoms::intern("public");
+    const String16& public_padding16 = StringAtoms::intern("public-padding");
+    const String16& private_symbols16 = StringAtoms::intern("private-symbols");
+    const String16& java_symbol16 = StringAtoms::intern("java-symbol");
+    const String16& add_resource16 = StringAtoms::intern("add-resource");
+    const String16& skip16 = StringAtoms::intern("skip");
+    const String16& eat_comment16 = StringAtoms::intern("eat-comment");
 
     // Data creation tags.
-    const String16 bag16("bag");
-    const String16 item16("item");
+    const String16& bag16 = StringAtoms::intern("bag");
+    const String16& item16 = StringAtoms::intern("item");
 
     // Attribute type constants.
-    const String16 enum16("enum");
+    const String16& enum16 = StringAtoms::intern("enum");
 
     // plural values
-    const String16 other16("other");
-    const String16 quantityOther16("^other");
-    const String16 zero16("zero");
-    const String16 quantityZero16("^zero");
-    const String16 one16("one");
-    const String16 quantityOne16("^one");
-    const String16 two16("two");
-    const String16 quantityTwo16("^two");
-    const String16 few16("few");
-    const String16 quantityFew16("^few");
-    const String16 many16("many");
-    const String16 quantityMany16("^many");
+    const String16& other16 = StringAtoms::intern("other");
+    const String16& quantityOther16 = StringAtoms::intern("^other");
+    const String16& zero16 = StringAtoms::intern("zero");
+    const String16& quantityZero16 = StringAtoms::intern("^zero");
+    const String16& one16 = StringAtoms::intern("one");
+    const String16& quantityOne16 = StringAtoms::intern("^one");
+    const String16& two16 = StringAtoms::intern("two");
+    const String16& quantityTwo16 = StringAtoms::intern("^two");
+    const String16& few16 = StringAtoms::intern("few");
+    const String16& quantityFew16 = StringAtoms::intern("^few");
+    const String16& many16 = StringAtoms::intern("many");
+    const String16& quantityMany16 = StringAtoms::intern("^many");
 
     // useful attribute names and special values
-    const String16 name16("name");
-    const String16 translatable16("translatable");
-    const String16 formatted16("formatted");
-    const String16 false16("false");
+    const String16& name16 = StringAtoms::intern("name");
+    const String16& translatable16 = StringAtoms::intern("translatable");
+    const String16& formatted16 = StringAtoms::intern("formatted");
+    const String16& false16 = StringAtoms::intern("false");
 
-    const String16 myPackage(assets->getPackage());
+    const String16& myPackage = StringAtoms::intern(assets->getPackage().string(),
+            assets->getPackage().size());
 
     bool hasErrors = false;
 
@@ -1604,7 +1858,7 @@ status_t compileResourceFile(Bundle* bundle,
                             }
                         }
 
-                        ResXMLParser::ResXMLPosition parserPosition;
+                        typename Parser::ResXMLPosition parserPosition;
                         block.getPosition(&parserPosition);
 
                         err = parseAndAddBag(bundle, in, &block, curParams, myPackage, curType,
@@ -1647,7 +1901,7 @@ status_t compileResourceFile(Bundle* bundle,
                     }
                 }
             } else {
-                ResXMLParser::ResXMLPosition parserPosition;
+                typename Parser::ResXMLPosition parserPosition;
                 block.getPosition(&parserPosition);
 
                 err = parseAndAddEntry(bundle, in, &block, curParams, myPackage, curType, ident,
@@ -1742,11 +1996,200 @@ status_t compileResourceFile(Bundle* bundle,
     return hasErrors ? STATUST(UNKNOWN_ERROR) : NO_ERROR;
 }
 
+template status_t compileResourceFile(Bundle*, const sp<AaptAssets>&, const sp<AaptFile>&,
+        ResXMLTree&, const ResTable_config&, const bool, ResourceTable*);
+template status_t compileResourceFile(Bundle*, const sp<AaptAssets>&, const sp<AaptFile>&,
+        XMLStream&, const ResTable_config&, const bool, ResourceTable*);
+
+/*
+ * Whether --product keeps a resource with the given product attribute, as
+ * parseAndAddEntry() decides, leaving out that "default" only counts if
+ * nothing else matched: either way the resource has a name.
+ */
+static bool productMatches(const Bundle* bundle, const String16& product)
+{
+    if (product.size() == 0 || product == String16("default")) {
+        return true;
+    }
+    const char* bundleProduct = bundle->getProduct();
+    return bundleProduct != NULL && bundleProduct[0] != '\0'
+            && isInProductList(product, String16(bundleProduct));
+}
+
+// Tells the tags declareResourceFile() can name a resource from, and of
+// which type, apart from <item> whose type is an attribute.
+static const String16* declaredType(const char16_t* tag)
+{
+    static const struct {
+        const char* tag;
+        const char* type;
+    } kTypes[] = {
+        { "string", "string" },
+        { "plurals", "plurals" },
+        { "array", "array" },
+        { "string-array", "array" },
+        { "integer-array", "array" },
+        { "color", "color" },
+        { "dimen", "dimen" },
+        { "bool", "bool" },
+        { "integer", "integer" },
+        { "fraction", "fraction" },
+        { "drawable", "drawable" },
+    };
+    for (size_t i = 0; i < sizeof(kTypes) / sizeof(kTypes[0]); i++) {
+        if (strcmp16(tag, StringAtoms::intern(kTypes[i].tag).string()) == 0) {
+            return &StringAtoms::intern(kTypes[i].type);
+        }
+    }
+    return NULL;
+}
+
+status_t declareResourceFile(Bundle* bundle,
+                             const sp<AaptAssets>& assets,
+                             const sp<AaptFile>& in,
+                             const ResTable_config& defParams,
+                             const bool overwrite,
+                             ResourceTable* outTable)
+{
+    PhaseSpan span("parseValuesFile", in->getPrintableSource());
+    span.setBytes(in->getSize());
+    if (bundle->getResourceCacheDir() == NULL) {
+        XMLStream stream;
+        status_t err = parseValuesStream(in, &stream);
+        if (err != NO_ERROR) {
+            return err;
+        }
+        span.end();
+        return declareResourceFile(bundle, assets, in, stream, defParams, overwrite, outTable);
+    }
+
+    ResXMLTree block;
+    status_t err = parseValuesFile(bundle, in, &block);
+    if (err != NO_ERROR) {
+        return err;
+    }
+    span.end();
+
+    return declareResourceFile(bundle, assets, in, block, defParams, overwrite, outTable);
+}
+
+template <class Parser>
+status_t declareResourceFile(Bundle* bundle,
+                             const sp<AaptAssets>& assets,
+                             const sp<AaptFile>& in,
+                             Parser& block,
+                             const ResTable_config& defParams,
+                             const bool overwrite,
+                             ResourceTable* outTable)
+{
+    const String16& resources16 = StringAtoms::intern("resources");
+    const String16& item16 = StringAtoms::intern("item");
+    const String16& string16 = StringAtoms::intern("string");
+    const String16& skip16 = StringAtoms::intern("skip");
+    const String16& eat_comment16 = StringAtoms::intern("eat-comment");
+    const String16& false16 = StringAtoms::intern("false");
+
+    // Anything but plain values below <resources> is compiled in full.
+    ResXMLTree::event_code_t code = ResXMLTree::START_DOCUMENT;
+    int depth = 0;
+    bool plain = true;
+    size_t len;
+    while (plain && (code = block.next()) != ResXMLTree::END_DOCUMENT
+            && code != ResXMLTree::BAD_DOCUMENT) {
+        if (code == ResXMLTree::END_TAG) {
+            depth--;
+            continue;
+        }
+        if (code != ResXMLTree::START_TAG) {
+            continue;
+        }
+        depth++;
+        const char16_t* tag = block.getElementName(&len);
+        if (depth == 1) {
+            plain = strcmp16(tag, resources16.string()) == 0;
+        } else if (depth == 2) {
+            plain = declaredType(tag) != NULL
+                    || (strcmp16(tag, item16.string()) == 0
+                            && block.indexOfAttribute(NULL, "type") >= 0)
+                    || strcmp16(tag, skip16.string()) == 0
+                    || strcmp16(tag, eat_comment16.string()) == 0;
+        }
+    }
+    block.restart();
+    if (!plain || code == ResXMLTree::BAD_DOCUMENT) {
+        return compileResourceFile(bundle, assets, in, block, defParams, overwrite, outTable);
+    }
+
+    PhaseSpan span("declareResourceFile", in->getPrintableSource());
+    const String16& myPackage = StringAtoms::intern(assets->getPackage().string(),
+            assets->getPackage().size());
+    char rawLocale[RESTABLE_MAX_LOCALE_LEN];
+    defParams.getBcp47Locale(rawLocale);
+    const String8 locale(rawLocale);
+
+    bool hasErrors = false;
+    depth = 0;
+    while ((code = block.next()) != ResXMLTree::END_DOCUMENT) {
+        if (code == ResXMLTree::END_TAG) {
+            depth--;
+            continue;
+        }
+        if (code != ResXMLTree::START_TAG || ++depth != 2) {
+            continue;
+        }
+        const char16_t* tag = block.getElementName(&len);
+        String16 type;
+        const String16* known = declaredType(tag);
+        if (known != NULL) {
+            type = *known;
+        } else if (strcmp16(tag, item16.string()) == 0) {
+            type = String16(block.getAttributeStringValue(
+                    block.indexOfAttribute(NULL, "type"), &len));
+        } else {
+            continue;
+        }
+
+        const ssize_t nameIdx = block.indexOfAttribute(NULL, "name");
+        const ssize_t productIdx = block.indexOfAttribute(NULL, "product");
+        if (nameIdx < 0 || (productIdx >= 0 && !productMatches(bundle,
+                String16(block.getAttributeStringValue(productIdx, &len))))) {
+            continue;
+        }
+        const String16 name(block.getAttributeStringValue(nameIdx, &len));
+        const SourcePos pos(in->getPrintableSource(), block.getLineNumber());
+
+        if (type == string16) {
+            const ssize_t translatableIdx = block.indexOfAttribute(NULL, "translatable");
+            if (translatableIdx >= 0 && false16 == String16(
+                    block.getAttributeStringValue(translatableIdx, &len))) {
+                if (locale.size() > 0) {
+                    pos.warning("string '%s' marked untranslatable but exists in locale '%s'\n",
+                            String8(name).string(), locale.string());
+                }
+            } else {
+                outTable->addLocalization(name, locale, pos);
+            }
+        }
+
+        if (outTable->declareEntry(pos, myPackage, type, name, overwrite) != NO_ERROR) {
+            hasErrors = true;
+        }
+    }
+
+    return hasErrors ? STATUST(UNKNOWN_ERROR) : NO_ERROR;
+}
+
+template status_t declareResourceFile(Bundle*, const sp<AaptAssets>&, const sp<AaptFile>&,
+        ResXMLTree&, const ResTable_config&, const bool, ResourceTable*);
+template status_t declareResourceFile(Bundle*, const sp<AaptAssets>&, const sp<AaptFile>&,
+        XMLStream&, const ResTable_config&, const bool, ResourceTable*);
+
 ResourceTable::ResourceTable(Bundle* bundle, const String16& assetsPackage, ResourceTable::PackageType type)
     : mAssetsPackage(assetsPackage)
     , mPackageType(type)
     , mTypeIdOffset(0)
     , mNumLocal(0)
+    , mNumBags(0)
     , mBundle(bundle)
 {
     ssize_t packageId = -1;
@@ -1787,6 +2230,66 @@ static uint32_t findLargestTypeIdForPackage(const ResTable& table, const String1
     return 0;
 }
 
+static const char kFeatureIndexHeader[] = "aapt-feature-index 1\n";
+
+status_t ResourceTable::writeFeatureIndex(const ResTable& table, const char* path)
+{
+    FILE* fp = fopen(path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: Unable to open feature index %s: %s\n", path, strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+    fputs(kFeatureIndexHeader, fp);
+    const size_t basePackageCount = table.getBasePackageCount();
+    for (size_t i = 0; i < basePackageCount; i++) {
+        fprintf(fp, "%s %u\n", String8(table.getBasePackageName(i)).string(),
+                table.getLastTypeIdForPackage(i));
+    }
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "ERROR: Unable to write feature index %s\n", path);
+        return UNKNOWN_ERROR;
+    }
+    return NO_ERROR;
+}
+
+/*
+ * Looks "packageName" up in a file written by writeFeatureIndex().  Returns
+ * NAME_NOT_FOUND if "path" isn't one, so that it is loaded as an APK.
+ */
+static status_t findLargestTypeIdInFeatureIndex(const char* path, const String16& packageName,
+                                                uint32_t* outTypeId)
+{
+    MappedFile index;
+    if (index.open(path) != NO_ERROR || index.getSize() < sizeof(kFeatureIndexHeader) - 1
+            || memcmp(index.getData(), kFeatureIndexHeader,
+                    sizeof(kFeatureIndexHeader) - 1) != 0) {
+        return NAME_NOT_FOUND;
+    }
+
+    const String8 package(packageName);
+    const char* p = (const char*) index.getData() + sizeof(kFeatureIndexHeader) - 1;
+    const char* end = (const char*) index.getData() + index.getSize();
+    *outTypeId = 0;
+    while (p < end) {
+        const char* eol = (const char*) memchr(p, '\n', end - p);
+        if (eol == NULL) {
+            eol = end;
+        }
+        const char* space = (const char*) memchr(p, ' ', eol - p);
+        if (space == NULL) {
+            fprintf(stderr, "ERROR: Feature index %s is corrupt.\n", path);
+            return UNKNOWN_ERROR;
+        }
+        if ((size_t)(space - p) == package.length()
+                && memcmp(p, package.string(), package.length()) == 0) {
+            *outTypeId = (uint32_t) strtoul(String8(space + 1, eol - space - 1).string(),
+                    NULL, 10);
+        }
+        p = eol + 1;
+    }
+    return NO_ERROR;
+}
+
 status_t ResourceTable::addIncludedResources(Bundle* bundle, const sp<AaptAssets>& assets)
 {
     status_t err = assets->buildIncludedResources(bundle);
@@ -1799,6 +2302,17 @@ status_t ResourceTable::addIncludedResources(Bundle* bundle, const sp<AaptAssets
 
     const String8& featureAfter = bundle->getFeatureAfterPackage();
     if (!featureAfter.isEmpty()) {
+        // A feature index holds all that is needed from the earlier feature.
+        uint32_t indexedTypeId;
+        err = findLargestTypeIdInFeatureIndex(featureAfter.string(), mAssetsPackage,
+                &indexedTypeId);
+        if (err == NO_ERROR) {
+            mTypeIdOffset = std::max(mTypeIdOffset, indexedTypeId);
+            return NO_ERROR;
+        } else if (err != NAME_NOT_FOUND) {
+            return err;
+        }
+
         AssetManager featureAssetManager;
         if (!featureAssetManager.addAssetPath(featureAfter, NULL)) {
             fprintf(stderr, "ERROR: Feature package '%s' not found.\n",
@@ -1871,6 +2385,20 @@ status_t ResourceTable::addEntry(const SourcePos& sourcePos,
     return err;
 }
 
+status_t ResourceTable::declareEntry(const SourcePos& sourcePos,
+                                     const String16& package,
+                                     const String16& type,
+                                     const String16& name,
+                                     const bool overlay)
+{
+    sp<Type> t = getType(package, type, sourcePos);
+    if (t == NULL) {
+        return UNKNOWN_ERROR;
+    }
+    return t->declareEntry(name, sourcePos, false, overlay, mBundle->getAutoAddOverlay()) != NULL
+            ? NO_ERROR : UNKNOWN_ERROR;
+}
+
 status_t ResourceTable::startBag(const SourcePos& sourcePos,
                                  const String16& package,
                                  const String16& type,
@@ -1915,15 +2443,20 @@ status_t ResourceTable::startBag(const SourcePos& sourcePos,
     if (e == NULL) {
         return UNKNOWN_ERROR;
     }
+    clearAttributeInfo();
     
     // If a parent is explicitly specified, set it.
     if (bagParent.size() > 0) {
         e->setParent(bagParent);
     }
 
+    const bool wasBag = e->getType() == Entry::TYPE_BAG;
     if ((result = e->makeItABag(sourcePos)) != NO_ERROR) {
         return result;
     }
+    if (!wasBag) {
+        mNumBags++;
+    }
 
     if (overlay && replace) { 
         return e->emptyBag(sourcePos);
@@ -1962,17 +2495,22 @@ status_t ResourceTable::addBag(const SourcePos& sourcePos,
     if (e == NULL) {
         return UNKNOWN_ERROR;
     }
+    clearAttributeInfo();
 
     // If a parent is explicitly specified, set it.
     if (bagParent.size() > 0) {
         e->setParent(bagParent);
     }
 
+    const bool wasBag = e->getType() == Entry::TYPE_BAG;
     const bool first = e->getBag().indexOfKey(bagKey) < 0;
     status_t err = e->addToBag(sourcePos, bagKey, value, style, replace, isId, format);
     if (err == NO_ERROR && first) {
         mNumLocal++;
     }
+    if (err == NO_ERROR && !wasBag) {
+        mNumBags++;
+    }
     return err;
 }
 
@@ -2127,9 +2665,9 @@ inline uint32_t ResourceTable::getResId(const sp<Package>& p,
     return makeResId(p->getAssignedId(), t->getIndex(), nameId);
 }
 
-uint32_t ResourceTable::getResId(const String16& package,
-                                 const String16& type,
-                                 const String16& name,
+uint32_t ResourceTable::getResId(const StringPiece16& package,
+                                 const StringPiece16& type,
+                                 const StringPiece16& name,
                                  bool onlyPublic) const
 {
     uint32_t id = ResourceIdCache::lookup(package, type, name, onlyPublic);
@@ -2138,37 +2676,38 @@ uint32_t ResourceTable::getResId(const String16& package,
     // First look for this in the included resources...
     uint32_t specFlags = 0;
     uint32_t rid = mAssets->getIncludedResources()
-        .identifierForName(name.string(), name.size(),
-                           type.string(), type.size(),
-                           package.string(), package.size(),
+        .identifierForName(name.data(), name.size(),
+                           type.data(), type.size(),
+                           package.data(), package.size(),
                            &specFlags);
     if (rid != 0) {
         if (onlyPublic) {
             if ((specFlags & ResTable_typeSpec::SPEC_PUBLIC) == 0) {
+                Statistics::add(Statistics::ID_LOOKUP_NOT_PUBLIC);
                 return 0;
             }
         }
         
+        Statistics::add(Statistics::ID_LOOKUP_INCLUDED);
         return ResourceIdCache::store(package, type, name, onlyPublic, rid);
     }
 
-    sp<Package> p = mPackages.valueFor(package);
-    if (p == NULL) return 0;
-    sp<Type> t = p->getTypes().valueFor(type);
-    if (t == NULL) return 0;
-    sp<ConfigList> c = t->getConfigs().valueFor(name);
-    if (c == NULL) {
-        if (type != String16("attr")) {
-            return 0;
-        }
-        t = p->getTypes().valueFor(String16(kAttrPrivateType));
-        if (t == NULL) return 0;
-        c = t->getConfigs().valueFor(name);
-        if (c == NULL) return 0;
+    Statistics::Counter found = Statistics::ID_LOOKUP_LOCAL;
+    sp<Package> p = mPackages.valueFor(package.toString16());
+    sp<Type> t = p != NULL ? p->getTypes().valueFor(type.toString16()) : NULL;
+    sp<ConfigList> c = t != NULL ? t->getConfigs().valueFor(name.toString16()) : NULL;
+    if (c == NULL && t != NULL && type == attrType16()) {
+        t = p->getTypes().valueFor(attrPrivateType16());
+        c = t != NULL ? t->getConfigs().valueFor(name.toString16()) : NULL;
+        found = Statistics::ID_LOOKUP_ATTR_PRIVATE;
+    }
+    int32_t ei = c != NULL ? c->getEntryIndex() : -1;
+    if (ei < 0) {
+        Statistics::add(Statistics::ID_LOOKUP_NOT_FOUND);
+        return 0;
     }
-    int32_t ei = c->getEntryIndex();
-    if (ei < 0) return 0;
 
+    Statistics::add(found);
     return ResourceIdCache::store(package, type, name, onlyPublic,
             getResId(p, t, ei));
 }
@@ -2179,10 +2718,11 @@ uint32_t ResourceTable::getResId(const String16& ref,
                                  const char** outErrorMsg,
                                  bool onlyPublic) const
 {
-    String16 package, type, name;
+    // The parts point into "ref" or the defaults; nothing is copied.
+    ResTable::resource_name rname;
     bool refOnlyPublic = true;
     if (!ResTable::expandResourceRef(
-        ref.string(), ref.size(), &package, &type, &name,
+        ref.string(), ref.size(), &rname,
         defType, defPackage ? defPackage:&mAssetsPackage,
         outErrorMsg, &refOnlyPublic)) {
         if (kIsDebug) {
@@ -2191,18 +2731,18 @@ uint32_t ResourceTable::getResId(const String16& ref,
                     defType ? String8(*defType).string() : "NULL");
             printf("Expanding resource: defPackage=%s\n",
                     defPackage ? String8(*defPackage).string() : "NULL");
-            printf("Expanding resource: ref=%s\n", String8(ref).string());
-            printf("Expanded resource: p=%s, t=%s, n=%s, res=0\n",
-                    String8(package).string(), String8(type).string(),
-                    String8(name).string());
+            printf("Expanded resource: res=0\n");
         }
         return 0;
     }
+    const StringPiece16 package(rname.package, rname.packageLen);
+    const StringPiece16 type(rname.type, rname.typeLen);
+    const StringPiece16 name(rname.name, rname.nameLen);
     uint32_t res = getResId(package, type, name, onlyPublic && refOnlyPublic);
     if (kIsDebug) {
         printf("Expanded resource: p=%s, t=%s, n=%s, res=%d\n",
-                String8(package).string(), String8(type).string(),
-                String8(name).string(), res);
+                package.toString8().string(), type.toString8().string(),
+                name.toString8().string(), res);
     }
     if (res == 0) {
         if (outErrorMsg)
@@ -2305,10 +2845,10 @@ uint32_t ResourceTable::getCustomResource(
     if (t == NULL) return 0;
     sp<ConfigList> c =  t->getConfigs().valueFor(name);
     if (c == NULL) {
-        if (type != String16("attr")) {
+        if (type != attrType16()) {
             return 0;
         }
-        t = p->getTypes().valueFor(String16(kAttrPrivateType));
+        t = p->getTypes().valueFor(attrPrivateType16());
         if (t == NULL) return 0;
         c = t->getConfigs().valueFor(name);
         if (c == NULL) return 0;
@@ -2350,14 +2890,62 @@ uint32_t ResourceTable::getRemappedPackage(uint32_t origPackage) const
     return origPackage;
 }
 
+const ResourceTable::AttributeInfo& ResourceTable::getAttributeInfo(uint32_t attrID)
+{
+    ssize_t index = mAttributeInfo.indexOfKey(attrID);
+    if (index >= 0) {
+        return mAttributeInfo.valueAt(index);
+    }
+
+    // Evaluating a value can ask about another attribute, so the record
+    // is only added once it is complete.
+    AttributeInfo info;
+    Res_value value;
+    sp<const Entry> e = getEntry(attrID);
+    if (e != NULL) {
+        info.exists = true;
+        if (getItemValue(attrID, ResTable_map::ATTR_TYPE, &value)) {
+            info.hasType = true;
+            info.type = value.data;
+        }
+        if (getItemValue(attrID, ResTable_map::ATTR_MIN, &value)) {
+            info.hasMin = true;
+            info.min = value.data;
+        }
+        if (getItemValue(attrID, ResTable_map::ATTR_MAX, &value)) {
+            info.hasMax = true;
+            info.max = value.data;
+        }
+        if (getItemValue(attrID, ResTable_map::ATTR_L10N, &value)) {
+            info.l10n = value.data;
+        }
+
+        const KeyedVector<String16, Item>& bag = e->getBag();
+        const size_t N = bag.size();
+        for (size_t i=0; i<N; i++) {
+            AttributeInfo::Symbol symbol;
+            symbol.parsed = getItemValue(attrID, bag.valueAt(i).bagKeyId, &symbol.value);
+            info.symbols.add(bag.keyAt(i), symbol);
+        }
+    }
+
+    index = mAttributeInfo.add(attrID, info);
+    return mAttributeInfo.valueAt(index);
+}
+
+void ResourceTable::clearAttributeInfo()
+{
+    if (!mAttributeInfo.isEmpty()) {
+        mAttributeInfo.clear();
+    }
+}
+
 bool ResourceTable::getAttributeType(uint32_t attrID, uint32_t* outType)
 {
     //printf("getAttributeType #%08x\n", attrID);
-    Res_value value;
-    if (getItemValue(attrID, ResTable_map::ATTR_TYPE, &value)) {
-        //printf("getAttributeType #%08x (%s): #%08x\n", attrID,
-        //       String8(getEntry(attrID)->getName()).string(), value.data);
-        *outType = value.data;
+    const AttributeInfo& info = getAttributeInfo(attrID);
+    if (info.hasType) {
+        *outType = info.type;
         return true;
     }
     return false;
@@ -2366,9 +2954,9 @@ bool ResourceTable::getAttributeType(uint32_t attrID, uint32_t* outType)
 bool ResourceTable::getAttributeMin(uint32_t attrID, uint32_t* outMin)
 {
     //printf("getAttributeMin #%08x\n", attrID);
-    Res_value value;
-    if (getItemValue(attrID, ResTable_map::ATTR_MIN, &value)) {
-        *outMin = value.data;
+    const AttributeInfo& info = getAttributeInfo(attrID);
+    if (info.hasMin) {
+        *outMin = info.min;
         return true;
     }
     return false;
@@ -2377,9 +2965,9 @@ bool ResourceTable::getAttributeMin(uint32_t attrID, uint32_t* outMin)
 bool ResourceTable::getAttributeMax(uint32_t attrID, uint32_t* outMax)
 {
     //printf("getAttributeMax #%08x\n", attrID);
-    Res_value value;
-    if (getItemValue(attrID, ResTable_map::ATTR_MAX, &value)) {
-        *outMax = value.data;
+    const AttributeInfo& info = getAttributeInfo(attrID);
+    if (info.hasMax) {
+        *outMax = info.max;
         return true;
     }
     return false;
@@ -2388,11 +2976,7 @@ bool ResourceTable::getAttributeMax(uint32_t attrID, uint32_t* outMax)
 uint32_t ResourceTable::getAttributeL10N(uint32_t attrID)
 {
     //printf("getAttributeL10N #%08x\n", attrID);
-    Res_value value;
-    if (getItemValue(attrID, ResTable_map::ATTR_L10N, &value)) {
-        return value.data;
-    }
-    return ResTable_map::L10N_NOT_REQUIRED;
+    return getAttributeInfo(attrID).l10n;
 }
 
 bool ResourceTable::getLocalizationSetting()
@@ -2411,18 +2995,19 @@ void ResourceTable::reportError(void* accessorCookie, const char* fmt, ...)
         retval = vsnprintf(buf, sizeof(buf), fmt, ap);
         va_end(ap);
         ac->sourcePos.error("Error: %s (at '%s' with value '%s').\n",
-                            buf, ac->attr.string(), ac->value.string());
+                            buf, ac->attr.toString8().string(),
+                            ac->value.toString8().string());
     }
 }
 
 bool ResourceTable::getAttributeKeys(
     uint32_t attrID, Vector<String16>* outKeys)
 {
-    sp<const Entry> e = getEntry(attrID);
-    if (e != NULL) {
-        const size_t N = e->getBag().size();
+    const AttributeInfo& info = getAttributeInfo(attrID);
+    if (info.exists) {
+        const size_t N = info.symbols.size();
         for (size_t i=0; i<N; i++) {
-            const String16& key = e->getBag().keyAt(i);
+            const String16& key = info.symbols.keyAt(i);
             if (key.size() > 0 && key.string()[0] != '^') {
                 outKeys->add(key);
             }
@@ -2437,17 +3022,11 @@ bool ResourceTable::getAttributeEnum(
     Res_value* outValue)
 {
     //printf("getAttributeEnum #%08x %s\n", attrID, String8(name, nameLen).string());
-    String16 nameStr(name, nameLen);
-    sp<const Entry> e = getEntry(attrID);
-    if (e != NULL) {
-        const size_t N = e->getBag().size();
-        for (size_t i=0; i<N; i++) {
-            //printf("Comparing %s to %s\n", String8(name, nameLen).string(),
-            //       String8(e->getBag().keyAt(i)).string());
-            if (e->getBag().keyAt(i) == nameStr) {
-                return getItemValue(attrID, e->getBag().valueAt(i).bagKeyId, outValue);
-            }
-        }
+    const AttributeInfo& info = getAttributeInfo(attrID);
+    const ssize_t i = info.symbols.indexOfKey(String16(name, nameLen));
+    if (i >= 0 && info.symbols.valueAt(i).parsed) {
+        *outValue = info.symbols.valueAt(i).value;
+        return true;
     }
     return false;
 }
@@ -2460,11 +3039,8 @@ bool ResourceTable::getAttributeFlags(
     outValue->data = 0;
 
     //printf("getAttributeFlags #%08x %s\n", attrID, String8(name, nameLen).string());
-    String16 nameStr(name, nameLen);
-    sp<const Entry> e = getEntry(attrID);
-    if (e != NULL) {
-        const size_t N = e->getBag().size();
-
+    const AttributeInfo& info = getAttributeInfo(attrID);
+    if (info.exists) {
         const char16_t* end = name + nameLen;
         const char16_t* pos = name;
         while (pos < end) {
@@ -2473,27 +3049,16 @@ bool ResourceTable::getAttributeFlags(
                 pos++;
             }
 
-            String16 nameStr(start, pos-start);
-            size_t i;
-            for (i=0; i<N; i++) {
-                //printf("Comparing \"%s\" to \"%s\"\n", String8(nameStr).string(),
-                //       String8(e->getBag().keyAt(i)).string());
-                if (e->getBag().keyAt(i) == nameStr) {
-                    Res_value val;
-                    bool got = getItemValue(attrID, e->getBag().valueAt(i).bagKeyId, &val);
-                    if (!got) {
-                        return false;
-                    }
-                    //printf("Got value: 0x%08x\n", val.data);
-                    outValue->data |= val.data;
-                    break;
-                }
-            }
-
-            if (i >= N) {
+            const ssize_t i = info.symbols.indexOfKey(String16(start, pos-start));
+            if (i < 0) {
                 // Didn't find this flag identifier.
                 return false;
             }
+            if (!info.symbols.valueAt(i).parsed) {
+                return false;
+            }
+            //printf("Got value: 0x%08x\n", info.symbols.valueAt(i).value.data);
+            outValue->data |= info.symbols.valueAt(i).value.data;
             pos++;
         }
 
@@ -2502,8 +3067,70 @@ bool ResourceTable::getAttributeFlags(
     return false;
 }
 
+status_t ResourceTable::loadStableIds(const char* path)
+{
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: Unable to open stable IDs file %s: %s\n",
+                path, strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+
+    bool hasErrors = false;
+    char line[1024];
+    int lineNumber = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineNumber++;
+        const char* p = line;
+        while (isspace(*p)) {
+            p++;
+        }
+        if (*p == 0 || *p == '#') {
+            continue;
+        }
+
+        // package:type/name = 0xPPTTEEEE
+        const char* colon = strchr(p, ':');
+        const char* slash = colon != NULL ? strchr(colon, '/') : NULL;
+        const char* equals = slash != NULL ? strchr(slash, '=') : NULL;
+        char* end = NULL;
+        const unsigned long ident = equals != NULL ? strtoul(equals + 1, &end, 0) : 0;
+        if (equals == NULL || end == equals + 1 || Res_GETTYPE(ident) < 0
+                || Res_GETTYPE(ident) >= 0xff) {
+            SourcePos(String8(path), lineNumber).error(
+                    "Expected \"package:type/name = 0xPPTTEEEE\".");
+            hasErrors = true;
+            continue;
+        }
+        const char* nameEnd = equals;
+        while (nameEnd > slash + 1 && isspace(nameEnd[-1])) {
+            nameEnd--;
+        }
+
+        // Entries for types or packages that are gone no longer matter.
+        sp<Package> pkg = mPackages.valueFor(String16(p, colon - p));
+        if (pkg == NULL) {
+            continue;
+        }
+        sp<Type> t = pkg->getTypes().valueFor(String16(colon + 1, slash - colon - 1));
+        if (t == NULL) {
+            continue;
+        }
+        uint32_t typeIdOffset = 0;
+        if (mPackageType == AppFeature && pkg->getName() == mAssetsPackage) {
+            typeIdOffset = mTypeIdOffset;
+        }
+        t->setStableId(String16(slash + 1, nameEnd - slash - 1), ident, typeIdOffset);
+    }
+    fclose(fp);
+    return hasErrors ? STATUST(UNKNOWN_ERROR) : NO_ERROR;
+}
+
 status_t ResourceTable::assignResourceIds()
 {
+    // The bag keys are about to get their IDs.
+    clearAttributeInfo();
+
     const size_t N = mOrderedPackages.size();
     size_t pi;
     status_t firstError = NO_ERROR;
@@ -2619,9 +3246,449 @@ status_t ResourceTable::assignResourceIds()
             }
         }
     }
+
+    // Bag keys picked up their IDs above.
+    clearAttributeInfo();
     return firstError;
 }
 
+void ResourceTable::writeStableIds(FILE* fp)
+{
+    const size_t N = mOrderedPackages.size();
+    for (size_t pi = 0; pi < N; pi++) {
+        sp<Package> p = mOrderedPackages.itemAt(pi);
+        if (p == NULL || p->getTypes().size() == 0) {
+            continue;
+        }
+        const String8 packageName(p->getName());
+        const size_t NT = p->getOrderedTypes().size();
+        for (size_t ti = 0; ti < NT; ti++) {
+            sp<Type> t = p->getOrderedTypes().itemAt(ti);
+            if (t == NULL) {
+                continue;
+            }
+            const String8 typeName(t->getName());
+            const size_t NC = t->getOrderedConfigs().size();
+            for (size_t ci = 0; ci < NC; ci++) {
+                sp<ConfigList> c = t->getOrderedConfigs().itemAt(ci);
+                if (c == NULL) {
+                    continue;
+                }
+                fprintf(fp, "%s:%s/%s = 0x%08x\n", packageName.string(), typeName.string(),
+                        String8(c->getName()).string(), getResId(p, t, ci));
+            }
+        }
+    }
+}
+
+status_t ResourceTable::loadKeptResources(const char* path,
+                                         SortedVector<uint32_t>* roots) const
+{
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: Unable to open resources to keep file %s: %s\n",
+                path, strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+
+    char line[1024];
+    int lineNumber = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        lineNumber++;
+        char* p = line;
+        while (isspace(*p)) {
+            p++;
+        }
+        if (*p == 0 || *p == '#') {
+            continue;
+        }
+
+        // Whatever follows the name, such as the identifier on a line
+        // written by writeStableIds(), is ignored.
+        char* end = p;
+        while (*end != 0 && !isspace(*end)) {
+            end++;
+        }
+        *end = 0;
+        const uint32_t resId = getResId(String16(p), NULL, NULL, NULL, false);
+        if (resId == 0) {
+            SourcePos(String8(path), lineNumber).warning("No resource named %s to keep.", p);
+            continue;
+        }
+        roots->add(resId);
+    }
+    fclose(fp);
+    return NO_ERROR;
+}
+
+uint32_t ResourceTable::getReferencedResId(const String16& value) const
+{
+    const char16_t* p = value.string();
+    const char16_t* end = p + value.size();
+    while (p < end && *p < 0x80 && isspace(*p)) {
+        p++;
+    }
+    while (end > p && end[-1] < 0x80 && isspace(end[-1])) {
+        end--;
+    }
+    if (p == end) {
+        return 0;
+    }
+    if (*p == '@') {
+        p++;
+        if (p < end && *p == '+') {
+            p++;
+        }
+        return getResId(String16(p, end - p), NULL, NULL, NULL, false);
+    }
+    if (*p == '?') {
+        p++;
+        return getResId(String16(p, end - p), &attrType16(), NULL, NULL, false);
+    }
+    return 0;
+}
+
+/*
+ * Marks the resource "resId" of "nodes" as reached, if it is one and wasn't
+ * already, and queues it so that what it refers to is reached too.
+ */
+static void reachResource(const KeyedVector<uint32_t, size_t>& nodes, uint32_t resId,
+                          Vector<bool>* reached, Vector<size_t>* pending)
+{
+    const ssize_t index = nodes.indexOfKey(resId);
+    if (index < 0) {
+        return;
+    }
+    const size_t node = nodes.valueAt(index);
+    if (!reached->itemAt(node)) {
+        reached->editItemAt(node) = true;
+        pending->push(node);
+    }
+}
+
+size_t ResourceTable::removeUnreachable(const SortedVector<uint32_t>& roots,
+        const KeyedVector<String16, Vector<uint32_t> >& fileRefs,
+        SortedVector<String16>* outUnusedFiles)
+{
+    static const String16 resPrefix("res/");
+    static const String16& style16 = StringAtoms::intern("style");
+
+    // Every resource being built, as a node numbered by its place in types
+    // and entryIndices.
+    KeyedVector<uint32_t, size_t> nodes;
+    Vector<sp<Type> > types;
+    Vector<size_t> entryIndices;
+    Vector<bool> reached;
+    Vector<size_t> pending;
+    const size_t NP = mOrderedPackages.size();
+    for (size_t pi = 0; pi < NP; pi++) {
+        const sp<Package>& p = mOrderedPackages[pi];
+        const size_t NT = p->getOrderedTypes().size();
+        for (size_t ti = 0; ti < NT; ti++) {
+            const sp<Type>& t = p->getOrderedTypes()[ti];
+            if (t == NULL) {
+                continue;
+            }
+            const size_t NC = t->getOrderedConfigs().size();
+            for (size_t ei = 0; ei < NC; ei++) {
+                const sp<ConfigList>& c = t->getOrderedConfigs()[ei];
+                if (c == NULL) {
+                    continue;
+                }
+                nodes.add(getResId(p, t, ei), types.size());
+                types.add(t);
+                entryIndices.add(ei);
+                // Public resources are there for others to use.
+                reached.add(c->getPublic());
+                if (c->getPublic()) {
+                    pending.push(types.size() - 1);
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < roots.size(); i++) {
+        reachResource(nodes, roots[i], &reached, &pending);
+    }
+
+    while (!pending.isEmpty()) {
+        const size_t node = pending.top();
+        pending.pop();
+        const sp<ConfigList>& c = types[node]->getOrderedConfigs()[entryIndices[node]];
+        const size_t NE = c->getEntries().size();
+        for (size_t ce = 0; ce < NE; ce++) {
+            const sp<Entry>& e = c->getEntries().valueAt(ce);
+            const Item* item = e->getItem();
+            if (item != NULL) {
+                reachResource(nodes, getReferencedResId(item->value), &reached, &pending);
+                if (item->value.startsWith(resPrefix)) {
+                    const ssize_t fi = fileRefs.indexOfKey(item->value);
+                    if (fi >= 0) {
+                        const Vector<uint32_t>& refs = fileRefs.valueAt(fi);
+                        for (size_t i = 0; i < refs.size(); i++) {
+                            reachResource(nodes, refs[i], &reached, &pending);
+                        }
+                    }
+                }
+                continue;
+            }
+            if (e->getParent().size() > 0) {
+                reachResource(nodes, getResId(e->getParent(), &style16, NULL, NULL, false),
+                        &reached, &pending);
+            }
+            const KeyedVector<String16, Item>& bag = e->getBag();
+            const size_t NB = bag.size();
+            for (size_t bi = 0; bi < NB; bi++) {
+                const Item& it = bag.valueAt(bi);
+                reachResource(nodes, it.bagKeyId, &reached, &pending);
+                reachResource(nodes, getReferencedResId(it.value), &reached, &pending);
+            }
+        }
+    }
+
+    // A file stays as long as any remaining entry points at it, as copies
+    // that dedupeFileResources() merged do.
+    SortedVector<String16> keptFiles;
+    SortedVector<String16> removedFiles;
+    size_t removed = 0;
+    for (size_t node = 0; node < types.size(); node++) {
+        const sp<Type>& t = types[node];
+        const sp<ConfigList> c = t->getOrderedConfigs()[entryIndices[node]];
+        const size_t NE = c->getEntries().size();
+        for (size_t ce = 0; ce < NE; ce++) {
+            const Item* item = c->getEntries().valueAt(ce)->getItem();
+            if (item == NULL || !item->value.startsWith(resPrefix)) {
+                continue;
+            }
+            if (reached[node]) {
+                keptFiles.add(item->value);
+            } else {
+                removedFiles.add(item->value);
+            }
+        }
+        if (!reached[node]) {
+            if (mBundle->getVerbose()) {
+                printf("    (leaving out unreferenced %s/%s)\n",
+                        String8(t->getName()).string(), String8(c->getName()).string());
+            }
+            t->removeEntryAt(entryIndices[node]);
+            removed++;
+        }
+    }
+    for (size_t i = 0; i < removedFiles.size(); i++) {
+        if (keptFiles.indexOf(removedFiles[i]) < 0) {
+            outUnusedFiles->add(removedFiles[i]);
+        }
+    }
+
+    if (removed > 0) {
+        clearAttributeInfo();
+    }
+    return removed;
+}
+
+size_t ResourceTable::collapseInvariantValues()
+{
+    static const String16 resPrefix("res/");
+    const ConfigDescription defaultConfig;
+
+    // A density's copy of an image is drawn at that density, and the
+    // default's scaled, so only values are collapsed.
+    size_t removed = 0;
+    const size_t NP = mOrderedPackages.size();
+    for (size_t pi = 0; pi < NP; pi++) {
+        const sp<Package>& p = mOrderedPackages[pi];
+        const size_t NT = p->getOrderedTypes().size();
+        for (size_t ti = 0; ti < NT; ti++) {
+            const sp<Type>& t = p->getOrderedTypes()[ti];
+            if (t == NULL) {
+                continue;
+            }
+            const size_t NC = t->getOrderedConfigs().size();
+            for (size_t ci = 0; ci < NC; ci++) {
+                const sp<ConfigList>& c = t->getOrderedConfigs()[ci];
+                if (c == NULL || c->getEntries().size() < 2) {
+                    continue;
+                }
+                const DefaultKeyedVector<ConfigDescription, sp<Entry> >& entries =
+                        c->getEntries();
+                const ssize_t di = entries.indexOfKey(defaultConfig);
+                if (di < 0) {
+                    continue;
+                }
+                const sp<Entry>& def = entries.valueAt(di);
+                const Item* item = def->getItem();
+                if (item != NULL && item->value.startsWith(resPrefix)) {
+                    continue;
+                }
+                bool invariant = true;
+                for (size_t ei = 0; invariant && ei < entries.size(); ei++) {
+                    invariant = ei == (size_t) di || entries.valueAt(ei)->hasSameValue(*def);
+                }
+                if (!invariant) {
+                    continue;
+                }
+                if (mBundle->getVerbose()) {
+                    printf("    (keeping only the default of %s/%s, the same in %zu"
+                            " configurations)\n", String8(t->getName()).string(),
+                            String8(c->getName()).string(), entries.size());
+                }
+                removed += entries.size() - 1;
+                c->keepOnlyEntry(defaultConfig);
+            }
+        }
+    }
+
+    if (removed > 0) {
+        clearAttributeInfo();
+    }
+    return removed;
+}
+
+/*
+ * The "type/name" of resource "resId", from this table when it is one of
+ * "names" and otherwise, as "package:type/name", from the included
+ * packages.  Empty when it is neither.
+ */
+static String8 dependencyResourceName(const KeyedVector<uint32_t, String8>& names,
+                                      const ResTable& included, uint32_t resId)
+{
+    const ssize_t i = names.indexOfKey(resId);
+    if (i >= 0) {
+        return names.valueAt(i);
+    }
+    ResTable::resource_name name;
+    if (resId == 0 || !included.getResourceName(resId, false, &name)) {
+        return String8();
+    }
+    String8 result;
+    if (name.package != NULL) {
+        result.append(String8(name.package, name.packageLen));
+        result.append(":");
+    }
+    result.append(String8(name.type, name.typeLen));
+    result.append("/");
+    result.append(String8(name.name, name.nameLen));
+    return result;
+}
+
+static void addDependencyEdge(Vector<String8>* edges, const char* kind,
+                              const String8& from, const String8& to)
+{
+    if (from.isEmpty() || to.isEmpty()) {
+        return;
+    }
+    edges->add(String8::format("%s\t%s\t%s", kind, from.string(), to.string()));
+}
+
+static int compareDependencyEdges(const String8* a, const String8* b)
+{
+    return strcmp(a->string(), b->string());
+}
+
+void ResourceTable::writeDependencyGraph(FILE* fp,
+        const KeyedVector<String16, Vector<uint32_t> >& fileRefs)
+{
+    static const String16 resPrefix("res/");
+    static const String16& style16 = StringAtoms::intern("style");
+    static const String8 arscPrefix("resources.arsc/");
+    static const String8 rPrefix("R.");
+
+    KeyedVector<uint32_t, String8> names;
+    const size_t NP = mOrderedPackages.size();
+    for (size_t pi = 0; pi < NP; pi++) {
+        const sp<Package>& p = mOrderedPackages[pi];
+        const size_t NT = p->getOrderedTypes().size();
+        for (size_t ti = 0; ti < NT; ti++) {
+            const sp<Type>& t = p->getOrderedTypes()[ti];
+            if (t == NULL) {
+                continue;
+            }
+            const String8 typeName(t->getName());
+            const size_t NC = t->getOrderedConfigs().size();
+            for (size_t ei = 0; ei < NC; ei++) {
+                const sp<ConfigList>& c = t->getOrderedConfigs()[ei];
+                if (c != NULL) {
+                    names.add(getResId(p, t, ei),
+                            typeName + String8("/") + String8(c->getName()));
+                }
+            }
+        }
+    }
+
+    // Sources are the files as given on the command line; compiled files
+    // are named by their path in the package.
+    const ResTable& included = mAssets->getIncludedResources();
+    Vector<String8> edges;
+    for (size_t pi = 0; pi < NP; pi++) {
+        const sp<Package>& p = mOrderedPackages[pi];
+        const size_t NT = p->getOrderedTypes().size();
+        for (size_t ti = 0; ti < NT; ti++) {
+            const sp<Type>& t = p->getOrderedTypes()[ti];
+            if (t == NULL) {
+                continue;
+            }
+            const String8 typeName(t->getName());
+            const size_t NC = t->getOrderedConfigs().size();
+            for (size_t ei = 0; ei < NC; ei++) {
+                const sp<ConfigList>& c = t->getOrderedConfigs()[ei];
+                if (c == NULL) {
+                    continue;
+                }
+                const String8& name = names.valueFor(getResId(p, t, ei));
+                const size_t NE = c->getEntries().size();
+                for (size_t ce = 0; ce < NE; ce++) {
+                    const sp<Entry>& e = c->getEntries().valueAt(ce);
+                    const String8 source = e->getPos().file;
+                    addDependencyEdge(&edges, "defines", source, name);
+                    addDependencyEdge(&edges, "output", arscPrefix + typeName, source);
+                    addDependencyEdge(&edges, "output", rPrefix + typeName, source);
+
+                    const Item* item = e->getItem();
+                    if (item != NULL) {
+                        addDependencyEdge(&edges, "refers", source, dependencyResourceName(
+                                names, included, getReferencedResId(item->value)));
+                        if (!item->value.startsWith(resPrefix)) {
+                            continue;
+                        }
+                        addDependencyEdge(&edges, "output", String8(item->value), source);
+                        const ssize_t fi = fileRefs.indexOfKey(item->value);
+                        if (fi >= 0) {
+                            const Vector<uint32_t>& refs = fileRefs.valueAt(fi);
+                            for (size_t i = 0; i < refs.size(); i++) {
+                                addDependencyEdge(&edges, "refers", source,
+                                        dependencyResourceName(names, included, refs[i]));
+                            }
+                        }
+                        continue;
+                    }
+                    if (e->getParent().size() > 0) {
+                        addDependencyEdge(&edges, "refers", source, dependencyResourceName(
+                                names, included,
+                                getResId(e->getParent(), &style16, NULL, NULL, false)));
+                    }
+                    const KeyedVector<String16, Item>& bag = e->getBag();
+                    const size_t NB = bag.size();
+                    for (size_t bi = 0; bi < NB; bi++) {
+                        const Item& it = bag.valueAt(bi);
+                        addDependencyEdge(&edges, "refers", source,
+                                dependencyResourceName(names, included, it.bagKeyId));
+                        addDependencyEdge(&edges, "refers", source, dependencyResourceName(
+                                names, included, getReferencedResId(it.value)));
+                    }
+                }
+            }
+        }
+    }
+
+    edges.sort(compareDependencyEdges);
+    for (size_t i = 0; i < edges.size(); i++) {
+        if (i == 0 || edges[i] != edges[i - 1]) {
+            fprintf(fp, "%s\n", edges[i].string());
+        }
+    }
+}
+
 status_t ResourceTable::addSymbols(const sp<AaptSymbols>& outSymbols) {
     const size_t N = mOrderedPackages.size();
     size_t pi;
@@ -2683,9 +3750,54 @@ status_t ResourceTable::addSymbols(const sp<AaptSymbols>& outSymbols) {
 void
 ResourceTable::addLocalization(const String16& name, const String8& locale, const SourcePos& src)
 {
-    mLocalizations[name][locale] = src;
+    ssize_t localeIndex = mLocalizationLocales.indexOfKey(locale);
+    if (localeIndex < 0) {
+        localeIndex = mLocalizationLocales.add(locale, mLocalizationLocales.size());
+    }
+    const uint32_t bit = mLocalizationLocales.valueAt(localeIndex);
+
+    ssize_t nameIndex = mLocalizationIndex.indexOfKey(name);
+    if (nameIndex < 0) {
+        nameIndex = mLocalizationIndex.add(name, mLocalizations.size());
+        mLocalizations.push_back(Localization());
+    }
+    Localization& l = mLocalizations[mLocalizationIndex.valueAt(nameIndex)];
+
+    if (l.locales.size() <= bit / 64) {
+        l.locales.resize(bit / 64 + 1);
+    }
+    l.locales[bit / 64] |= uint64_t(1) << (bit % 64);
+    if (locale.isEmpty()) {
+        l.hasDefault = true;
+        l.sources.clear();
+    } else if (!l.hasDefault && mBundle->getVerbose()) {
+        l.sources.push_back(LocalizationSource(bit, src));
+    }
 }
 
+// Orders the strings validateLocalizations() reports on by name.
+struct LocalizationNameOrder {
+    explicit LocalizationNameOrder(const HashedKeyedVector<String16, size_t>& n) : names(n) { }
+
+    bool operator()(size_t l, size_t r) const {
+        return names.keyAt(l) < names.keyAt(r);
+    }
+
+    const HashedKeyedVector<String16, size_t>& names;
+};
+
+// Orders where a string was defined by locale, keeping the order within one.
+struct LocalizationSourceOrder {
+    explicit LocalizationSourceOrder(const Vector<String8>& l) : locales(l) { }
+
+    template <typename T>
+    bool operator()(const T& l, const T& r) const {
+        return locales[l.locale] < locales[r.locale];
+    }
+
+    const Vector<String8>& locales;
+};
+
 
 /*!
  * Flag various sorts of localization problems.  '+' indicates checks already implemented;
@@ -2700,61 +3812,101 @@ status_t
 ResourceTable::validateLocalizations(void)
 {
     status_t err = NO_ERROR;
-    const String8 defaultLocale;
 
-    // For all strings...
-    for (const auto& nameIter : mLocalizations) {
-        const std::map<String8, SourcePos>& configSrcMap = nameIter.second;
+    // Locales by bit, for reporting.
+    Vector<String8> localeNames;
+    localeNames.insertAt(0, mLocalizationLocales.size());
+    for (size_t i = 0; i < mLocalizationLocales.size(); i++) {
+        localeNames.editItemAt(mLocalizationLocales.valueAt(i)) = mLocalizationLocales.keyAt(i);
+    }
+
+    // The explicitly requested localizations, each with the bits of the
+    // locale itself and of its language alone, which fulfills it too.
+    struct RequiredLocale {
+        String8 config;
+        ssize_t bit;
+        ssize_t languageBit;
+    };
+    std::vector<RequiredLocale> requiredLocales;
+    if (mBundle->getConfigurations().size() > 0 && mBundle->getRequireLocalization()) {
+        const char* allConfigs = mBundle->getConfigurations().string();
+        const char* start = allConfigs;
+        const char* comma;
+
+        AaptLocaleValue locale;
+        do {
+            String8 config;
+            comma = strchr(start, ',');
+            if (comma != NULL) {
+                config.setTo(start, comma - start);
+                start = comma + 1;
+            } else {
+                config.setTo(start);
+            }
+
+            if (!locale.initFromFilterString(config)) {
+                continue;
+            }
+
+            // don't bother with the pseudolocale "en_XA" or "ar_XB"
+            if (config != "en_XA" && config != "ar_XB") {
+                RequiredLocale required;
+                required.config = config;
+                ssize_t index = mLocalizationLocales.indexOfKey(config);
+                required.bit = index >= 0 ? mLocalizationLocales.valueAt(index) : -1;
+                index = mLocalizationLocales.indexOfKey(String8(config.string(), 2));
+                required.languageBit = index >= 0 ? mLocalizationLocales.valueAt(index) : -1;
+                requiredLocales.push_back(required);
+            }
+        } while (comma != NULL);
+    }
+
+    // For all strings, by name...
+    const size_t N = mLocalizationIndex.size();
+    Vector<size_t> byName;
+    byName.setCapacity(N);
+    for (size_t i = 0; i < N; i++) {
+        byName.add(i);
+    }
+    std::sort(byName.begin(), byName.end(), LocalizationNameOrder(mLocalizationIndex));
+
+    for (size_t i = 0; i < N; i++) {
+        const String16& name = mLocalizationIndex.keyAt(byName[i]);
+        Localization& l = mLocalizations[mLocalizationIndex.valueAt(byName[i])];
 
         // Look for strings with no default localization
-        if (configSrcMap.count(defaultLocale) == 0) {
+        if (!l.hasDefault) {
             SourcePos().warning("string '%s' has no default translation.",
-                    String8(nameIter.first).string());
+                    String8(name).string());
             if (mBundle->getVerbose()) {
-                for (const auto& locale : configSrcMap) {
-                    locale.second.printf("locale %s found", locale.first.string());
+                // Only the last definition in each locale counts.
+                std::stable_sort(l.sources.begin(), l.sources.end(),
+                        LocalizationSourceOrder(localeNames));
+                const size_t M = l.sources.size();
+                for (size_t j = 0; j < M; j++) {
+                    if (j + 1 < M && l.sources[j + 1].locale == l.sources[j].locale) {
+                        continue;
+                    }
+                    l.sources[j].pos.printf("locale %s found",
+                            localeNames[l.sources[j].locale].string());
                 }
             }
             // !!! TODO: throw an error here in some circumstances
         }
 
         // Check that all requested localizations are present for this string
-        if (mBundle->getConfigurations().size() > 0 && mBundle->getRequireLocalization()) {
-            const char* allConfigs = mBundle->getConfigurations().string();
-            const char* start = allConfigs;
-            const char* comma;
-
+        if (!requiredLocales.empty()) {
             std::set<String8> missingConfigs;
-            AaptLocaleValue locale;
-            do {
-                String8 config;
-                comma = strchr(start, ',');
-                if (comma != NULL) {
-                    config.setTo(start, comma - start);
-                    start = comma + 1;
-                } else {
-                    config.setTo(start);
+            for (const RequiredLocale& required : requiredLocales) {
+                // okay, no specific localization found.  it's possible that we are
+                // requiring a specific regional localization [e.g. de_DE] but there is an
+                // available string in the generic language localization [e.g. de];
+                // consider that string to have fulfilled the localization requirement.
+                if (!l.hasLocale(required.bit) && !l.hasLocale(required.languageBit)
+                        && !l.hasDefault) {
+                    missingConfigs.insert(required.config);
                 }
-
-                if (!locale.initFromFilterString(config)) {
-                    continue;
-                }
-
-                // don't bother with the pseudolocale "en_XA" or "ar_XB"
-                if (config != "en_XA" && config != "ar_XB") {
-                    if (configSrcMap.find(config) == configSrcMap.end()) {
-                        // okay, no specific localization found.  it's possible that we are
-                        // requiring a specific regional localization [e.g. de_DE] but there is an
-                        // available string in the generic language localization [e.g. de];
-                        // consider that string to have fulfilled the localization requirement.
-                        String8 region(config.string(), 2);
-                        if (configSrcMap.find(region) == configSrcMap.end() &&
-                                configSrcMap.count(defaultLocale) == 0) {
-                            missingConfigs.insert(config);
-                        }
-                    }
-                }
-            } while (comma != NULL);
+            }
 
             if (!missingConfigs.empty()) {
                 String8 configStr;
@@ -2762,7 +3914,7 @@ ResourceTable::validateLocalizations(void)
                     configStr.appendFormat(" %s", iter.string());
                 }
                 SourcePos().warning("string '%s' is missing %u required localizations:%s",
-                        String8(nameIter.first).string(),
+                        String8(name).string(),
                         (unsigned int)missingConfigs.size(),
                         configStr.string());
             }
@@ -2772,11 +3924,276 @@ ResourceTable::validateLocalizations(void)
     return err;
 }
 
+// The share of a type's entries, in percent, below which a configuration
+// defining them is written sparsely.  Above it the sparse index saves
+// little, and the dense one is faster to look up.
+static const size_t kSparseEncodingThreshold = 60;
+
+/*
+ * Rewrites the type chunk at "typeStart", ending "data" and indexing "N"
+ * entries densely, as a sparse one if few enough of the entries are
+ * defined and all their offsets fit a ResTable_sparseTypeEntry.
+ */
+static void makeTypeSparse(const sp<AaptFile>& data, size_t typeStart, size_t N)
+{
+    uint8_t* const type = ((uint8_t*)data->editData()) + typeStart;
+    uint32_t* const index = (uint32_t*)(type + sizeof(ResTable_type));
+
+    size_t count = 0;
+    for (size_t ei=0; ei<N; ei++) {
+        const uint32_t offset = dtohl(index[ei]);
+        if (offset != ResTable_type::NO_ENTRY) {
+            if ((offset & 0x3) != 0 || offset / 4 > 0xffff) {
+                return;
+            }
+            count++;
+        }
+    }
+    if (count * 100 >= N * kSparseEncodingThreshold) {
+        return;
+    }
+
+    // Each sparse entry is written no later than the dense one it replaces.
+    ResTable_sparseTypeEntry* const entries = (ResTable_sparseTypeEntry*)index;
+    size_t si = 0;
+    for (size_t ei=0; ei<N; ei++) {
+        const uint32_t offset = dtohl(index[ei]);
+        if (offset != ResTable_type::NO_ENTRY) {
+            ResTable_sparseTypeEntry entry;
+            entry.idx = htods(ei);
+            entry.offset = htods(offset / 4);
+            entries[si++] = entry;
+        }
+    }
+
+    const size_t denseSize = sizeof(ResTable_type) + sizeof(uint32_t)*N;
+    const size_t sparseSize = sizeof(ResTable_type) + sizeof(ResTable_sparseTypeEntry)*count;
+    const size_t entriesSize = data->getSize() - typeStart - denseSize;
+    memmove(type + sparseSize, type + denseSize, entriesSize);
+    data->editData(typeStart + sparseSize + entriesSize);
+
+    ResTable_type* const tHeader = (ResTable_type*)type;
+    tHeader->flags |= ResTable_type::FLAG_SPARSE;
+    tHeader->entryCount = htodl(count);
+    tHeader->entriesStart = htodl(sparseSize);
+}
+
+/*
+ * The ResTable_type chunk of one type in one configuration.  Once the
+ * string pools are built the entries are only read, so the chunks of a
+ * package are written into their own buffers on a WorkQueue and then
+ * appended to it in order.
+ */
+struct TypeChunkJob {
+    TypeChunkJob() : typeId(0), err(NO_ERROR) { }
+
+    sp<ResourceTable::Type> type;
+    uint8_t typeId;
+    ConfigDescription config;
+    sp<AaptFile> data;
+    // Which of the type's entries have a value in this configuration.
+    Vector<bool> written;
+    status_t err;
+};
+
+static status_t flattenTypeChunk(Bundle* bundle, TypeChunkJob* job)
+{
+    const sp<ResourceTable::Type>& t = job->type;
+    const sp<AaptFile>& data = job->data;
+    const size_t N = t->getOrderedConfigs().size();
+    const size_t typeSize = sizeof(ResTable_type) + sizeof(uint32_t)*N;
+
+    ResTable_type* tHeader = (ResTable_type*)data->editData(typeSize);
+    if (tHeader == NULL) {
+        fprintf(stderr, "ERROR: out of memory creating ResTable_type\n");
+        return NO_MEMORY;
+    }
+
+    memset(tHeader, 0, sizeof(*tHeader));
+    tHeader->header.type = htods(RES_TABLE_TYPE_TYPE);
+    tHeader->header.headerSize = htods(sizeof(*tHeader));
+    tHeader->id = job->typeId;
+    tHeader->entryCount = htodl(N);
+    tHeader->entriesStart = htodl(typeSize);
+    tHeader->config = job->config;
+    if (kIsDebug) {
+        printf("Writing type %d config: imsi:%d/%d lang:%c%c cnt:%c%c "
+            "orien:%d ui:%d touch:%d density:%d key:%d inp:%d nav:%d sz:%dx%d "
+            "sw%ddp w%ddp h%ddp layout:%d\n",
+            job->typeId,
+            tHeader->config.mcc, tHeader->config.mnc,
+            tHeader->config.language[0] ? tHeader->config.language[0] : '-',
+            tHeader->config.language[1] ? tHeader->config.language[1] : '-',
+            tHeader->config.country[0] ? tHeader->config.country[0] : '-',
+            tHeader->config.country[1] ? tHeader->config.country[1] : '-',
+            tHeader->config.orientation,
+            tHeader->config.uiMode,
+            tHeader->config.touchscreen,
+            tHeader->config.density,
+            tHeader->config.keyboard,
+            tHeader->config.inputFlags,
+            tHeader->config.navigation,
+            tHeader->config.screenWidth,
+            tHeader->config.screenHeight,
+            tHeader->config.smallestScreenWidthDp,
+            tHeader->config.screenWidthDp,
+            tHeader->config.screenHeightDp,
+            tHeader->config.screenLayout);
+    }
+    tHeader->config.swapHtoD();
+
+    // Build the entries inside of this type.
+    job->written.insertAt(false, 0, N);
+    for (size_t ei=0; ei<N; ei++) {
+        sp<ResourceTable::ConfigList> cl = t->getOrderedConfigs().itemAt(ei);
+        sp<ResourceTable::Entry> e = NULL;
+        if (cl != NULL) {
+            e = cl->getEntries().valueFor(job->config);
+        }
+
+        // Set the offset for this entry in its type.
+        uint32_t* index = (uint32_t*)
+            (((uint8_t*)data->editData()) + sizeof(ResTable_type));
+        if (e != NULL) {
+            index[ei] = htodl(data->getSize()-typeSize);
+
+            // Create the entry.
+            ssize_t amt = e->flatten(bundle, data, cl->getPublic());
+            if (amt < 0) {
+                return amt;
+            }
+            job->written.editItemAt(ei) = true;
+        } else {
+            index[ei] = htodl(ResTable_type::NO_ENTRY);
+        }
+    }
+
+    if (bundle->getSparseEncoding()) {
+        makeTypeSparse(data, 0, N);
+    }
+
+    // Fill in the rest of the type information.
+    tHeader = (ResTable_type*)data->editData();
+    tHeader->header.size = htodl(data->getSize());
+    return NO_ERROR;
+}
+
+class TypeChunkWorkUnit : public WorkQueue::WorkUnit {
+public:
+    TypeChunkWorkUnit(Bundle* bundle, TypeChunkJob* job) : mBundle(bundle), mJob(job) { }
+
+    virtual bool run() {
+        mJob->err = flattenTypeChunk(mBundle, mJob);
+        return true;
+    }
+
+private:
+    Bundle* mBundle;
+    TypeChunkJob* mJob;
+};
+
+// An entry of a type: the index of its ConfigList and of the entry in it.
+struct FlattenPosition {
+    uint32_t configList;
+    uint32_t entry;
+};
+
+static int compareFlattenPositions(const FlattenPosition* lhs, const FlattenPosition* rhs)
+{
+    if (lhs->configList != rhs->configList) {
+        return lhs->configList < rhs->configList ? -1 : 1;
+    }
+    return lhs->entry < rhs->entry ? -1 : (lhs->entry > rhs->entry ? 1 : 0);
+}
+
+struct ResourceTable::FlattenIndex::TypeIndex {
+    SortedVector<ConfigDescription> configs;
+    // For each of "configs", its entries in ConfigList order.
+    Vector<Vector<FlattenPosition> > positions;
+
+    /*
+     * Marks which of "configs" the filter takes and gathers their entries
+     * in the order the type's ConfigLists hold them.
+     */
+    void match(const sp<const ResourceFilter>& filter, bool filterable,
+               Vector<bool>* outMatched, Vector<FlattenPosition>* outPositions) const {
+        outMatched->clear();
+        outPositions->clear();
+        for (size_t i = 0; i < configs.size(); i++) {
+            const bool matched = !filterable || filter->match(configs[i]);
+            outMatched->add(matched);
+            if (matched) {
+                outPositions->appendVector(positions[i]);
+            }
+        }
+        outPositions->sort(compareFlattenPositions);
+    }
+};
+
+ResourceTable::FlattenIndex::FlattenIndex(const ResourceTable& table)
+{
+    for (size_t pi = 0; pi < table.mOrderedPackages.size(); pi++) {
+        const Vector<sp<Type> >& types = table.mOrderedPackages[pi]->getOrderedTypes();
+        for (size_t ti = 0; ti < types.size(); ti++) {
+            const sp<Type>& t = types[ti];
+            if (t == NULL) {
+                continue;
+            }
+            TypeIndex* index = new TypeIndex;
+            index->configs = t->getUniqueConfigs();
+            index->positions.insertAt(Vector<FlattenPosition>(), 0, index->configs.size());
+            const Vector<sp<ConfigList> >& configLists = t->getOrderedConfigs();
+            for (size_t ci = 0; ci < configLists.size(); ci++) {
+                const sp<ConfigList>& c = configLists[ci];
+                if (c == NULL) {
+                    continue;
+                }
+                for (size_t ei = 0; ei < c->getEntries().size(); ei++) {
+                    FlattenPosition position;
+                    position.configList = ci;
+                    position.entry = ei;
+                    index->positions.editItemAt(
+                            index->configs.indexOf(c->getEntries().keyAt(ei))).add(position);
+                }
+            }
+            mTypes.add(t.get(), index);
+        }
+    }
+}
+
+ResourceTable::FlattenIndex::~FlattenIndex()
+{
+    for (size_t i = 0; i < mTypes.size(); i++) {
+        delete mTypes.valueAt(i);
+    }
+}
+
+const ResourceTable::FlattenIndex::TypeIndex* ResourceTable::FlattenIndex::getType(
+        const Type* type) const
+{
+    const ssize_t i = mTypes.indexOfKey(type);
+    return i >= 0 ? mTypes.valueAt(i) : NULL;
+}
+
 status_t ResourceTable::flatten(Bundle* bundle, const sp<const ResourceFilter>& filter,
         const sp<AaptFile>& dest,
-        const bool isBase)
+        const bool isBase,
+        const FlattenIndex* index)
+{
+    // A table flattened just once indexes itself.
+    FlattenIndex* ownIndex = NULL;
+    if (index == NULL) {
+        ownIndex = new FlattenIndex(*this);
+        index = ownIndex;
+    }
+    status_t err = flattenIndexed(bundle, filter, dest, isBase, *index);
+    delete ownIndex;
+    return err;
+}
+
+status_t ResourceTable::flattenIndexed(Bundle* bundle, const sp<const ResourceFilter>& filter,
+        const sp<AaptFile>& dest, const bool isBase, const FlattenIndex& index)
 {
-    const ConfigDescription nullConfig;
 
     const size_t N = mOrderedPackages.size();
     size_t pi;
@@ -2798,10 +4215,17 @@ status_t ResourceTable::flatten(Bundle* bundle, const sp<const ResourceFilter>&
         }
     }
 
+    // With --collapse-key-names every entry shares one key string; the real
+    // names go to the file instead.
+    const bool collapseKeyNames = bundle->getCollapseKeyNamesFile() != NULL;
+    static const String16& collapsedKeyName = StringAtoms::intern("_");
+
     // Iterate through all data, collecting all values (strings,
     // references, etc).
     StringPool valueStrings(useUTF8);
     Vector<sp<Entry> > allEntries;
+    Vector<bool> matchedConfigs;
+    Vector<FlattenPosition> positions;
     for (pi=0; pi<N; pi++) {
         sp<Package> p = mOrderedPackages.itemAt(pi);
         if (p->getTypes().size() == 0) {
@@ -2852,39 +4276,23 @@ status_t ResourceTable::flatten(Bundle* bundle, const sp<const ResourceFilter>&
 
             const bool filterable = (typeName != mipmap16);
 
-            const size_t N = t->getOrderedConfigs().size();
-            for (size_t ci=0; ci<N; ci++) {
-                sp<ConfigList> c = t->getOrderedConfigs().itemAt(ci);
-                if (c == NULL) {
+            index.getType(t.get())->match(filter, filterable, &matchedConfigs, &positions);
+            for (size_t i=0; i<positions.size(); i++) {
+                sp<ConfigList> c = t->getOrderedConfigs().itemAt(positions[i].configList);
+                ConfigDescription config = c->getEntries().keyAt(positions[i].entry);
+                sp<Entry> e = c->getEntries().valueAt(positions[i].entry);
+                if (e == NULL) {
                     continue;
                 }
-                const size_t N = c->getEntries().size();
-                for (size_t ei=0; ei<N; ei++) {
-                    ConfigDescription config = c->getEntries().keyAt(ei);
-                    if (filterable && !filter->match(config)) {
-                        continue;
-                    }
-                    sp<Entry> e = c->getEntries().valueAt(ei);
-                    if (e == NULL) {
-                        continue;
-                    }
-                    e->setNameIndex(keyStrings.add(e->getName(), true));
-
-                    // If this entry has no values for other configs,
-                    // and is the default config, then it is special.  Otherwise
-                    // we want to add it with the config info.
-                    ConfigDescription* valueConfig = NULL;
-                    if (N != 1 || config == nullConfig) {
-                        valueConfig = &config;
-                    }
+                e->setNameIndex(keyStrings.add(
+                        collapseKeyNames ? collapsedKeyName : e->getName(), true));
 
-                    status_t err = e->prepareFlatten(&valueStrings, this,
-                            &configTypeName, &config);
-                    if (err != NO_ERROR) {
-                        return err;
-                    }
-                    allEntries.add(e);
+                status_t err = e->prepareFlatten(&valueStrings, this,
+                        &configTypeName, &config);
+                if (err != NO_ERROR) {
+                    return err;
                 }
+                allEntries.add(e);
             }
         }
 
@@ -2961,7 +4369,12 @@ status_t ResourceTable::flatten(Bundle* bundle, const sp<const ResourceFilter>&
             }
         }
 
-        // Build the type chunks inside of this package.
+        // Build the type chunks inside of this package.  The typeSpec
+        // chunks are written here and the type chunks queued in "typeJobs";
+        // "chunks" holds both in the order they are appended to the package.
+        Vector<sp<AaptFile> > chunks;
+        Vector<TypeChunkJob> typeJobs;
+        KeyedVector<size_t, sp<Type> > flattenedTypes;
         for (size_t ti=0; ti<N; ti++) {
             // Retrieve them in the same order as the type string block.
             size_t len;
@@ -2978,19 +4391,12 @@ status_t ResourceTable::flatten(Bundle* bundle, const sp<const ResourceFilter>&
 
             const size_t N = t != NULL ? t->getOrderedConfigs().size() : 0;
 
-            // Until a non-NO_ENTRY value has been written for a resource,
-            // that resource is invalid; validResources[i] represents
-            // the item at t->getOrderedConfigs().itemAt(i).
-            Vector<bool> validResources;
-            validResources.insertAt(false, 0, N);
-            
             // First write the typeSpec chunk, containing information about
             // each resource entry in this type.
             {
                 const size_t typeSpecSize = sizeof(ResTable_typeSpec) + sizeof(uint32_t)*N;
-                const size_t typeSpecStart = data->getSize();
-                ResTable_typeSpec* tsHeader = (ResTable_typeSpec*)
-                    (((uint8_t*)data->editData(typeSpecStart+typeSpecSize)) + typeSpecStart);
+                sp<AaptFile> spec = new AaptFile(String8(), AaptGroupEntry(), String8());
+                ResTable_typeSpec* tsHeader = (ResTable_typeSpec*)spec->editData(typeSpecSize);
                 if (tsHeader == NULL) {
                     fprintf(stderr, "ERROR: out of memory creating ResTable_typeSpec\n");
                     return NO_MEMORY;
@@ -3003,38 +4409,40 @@ status_t ResourceTable::flatten(Bundle* bundle, const sp<const ResourceFilter>&
                 tsHeader->entryCount = htodl(N);
                 
                 uint32_t* typeSpecFlags = (uint32_t*)
-                    (((uint8_t*)data->editData())
-                        + typeSpecStart + sizeof(ResTable_typeSpec));
+                    (((uint8_t*)spec->editData()) + sizeof(ResTable_typeSpec));
                 memset(typeSpecFlags, 0, sizeof(uint32_t)*N);
 
                 for (size_t ei=0; ei<N; ei++) {
                     sp<ConfigList> cl = t->getOrderedConfigs().itemAt(ei);
-                    if (cl == NULL) {
-                        continue;
-                    }
-
-                    if (cl->getPublic()) {
+                    if (cl != NULL && cl->getPublic()) {
                         typeSpecFlags[ei] |= htodl(ResTable_typeSpec::SPEC_PUBLIC);
                     }
+                }
 
-                    if (skipEntireType) {
-                        continue;
-                    }
-
-                    const size_t CN = cl->getEntries().size();
-                    for (size_t ci=0; ci<CN; ci++) {
-                        if (filterable && !filter->match(cl->getEntries().keyAt(ci))) {
-                            continue;
+                // A resource's flags are what those of its configurations
+                // the filter takes differ in.
+                if (!skipEntireType) {
+                    index.getType(t.get())->match(filter, filterable,
+                            &matchedConfigs, &positions);
+                    for (size_t i=0; i<positions.size(); ) {
+                        const size_t ei = positions[i].configList;
+                        size_t end = i + 1;
+                        while (end < positions.size() && positions[end].configList == ei) {
+                            end++;
                         }
-                        for (size_t cj=ci+1; cj<CN; cj++) {
-                            if (filterable && !filter->match(cl->getEntries().keyAt(cj))) {
-                                continue;
+                        const DefaultKeyedVector<ConfigDescription, sp<Entry> >& entries =
+                                t->getOrderedConfigs().itemAt(ei)->getEntries();
+                        for (size_t ci=i; ci<end; ci++) {
+                            for (size_t cj=ci+1; cj<end; cj++) {
+                                typeSpecFlags[ei] |= htodl(
+                                    entries.keyAt(positions[ci].entry).diff(
+                                            entries.keyAt(positions[cj].entry)));
                             }
-                            typeSpecFlags[ei] |= htodl(
-                                cl->getEntries().keyAt(ci).diff(cl->getEntries().keyAt(cj)));
                         }
+                        i = end;
                     }
                 }
+                chunks.add(spec);
             }
             
             if (skipEntireType) {
@@ -3043,13 +4451,9 @@ status_t ResourceTable::flatten(Bundle* bundle, const sp<const ResourceFilter>&
 
             // We need to write one type chunk for each configuration for
             // which we have entries in this type.
-            SortedVector<ConfigDescription> uniqueConfigs;
-            if (t != NULL) {
-                uniqueConfigs = t->getUniqueConfigs();
-            }
-            
-            const size_t typeSize = sizeof(ResTable_type) + sizeof(uint32_t)*N;
-            
+            const SortedVector<ConfigDescription>& uniqueConfigs =
+                    index.getType(t.get())->configs;
+
             const size_t NC = uniqueConfigs.size();
             for (size_t ci=0; ci<NC; ci++) {
                 const ConfigDescription& config = uniqueConfigs[ci];
@@ -3079,82 +4483,61 @@ status_t ResourceTable::flatten(Bundle* bundle, const sp<const ResourceFilter>&
                         config.screenLayout);
                 }
                       
-                if (filterable && !filter->match(config)) {
+                if (!matchedConfigs[ci]) {
                     continue;
                 }
-                
-                const size_t typeStart = data->getSize();
 
-                ResTable_type* tHeader = (ResTable_type*)
-                    (((uint8_t*)data->editData(typeStart+typeSize)) + typeStart);
-                if (tHeader == NULL) {
-                    fprintf(stderr, "ERROR: out of memory creating ResTable_type\n");
-                    return NO_MEMORY;
-                }
+                TypeChunkJob job;
+                job.type = t;
+                job.typeId = ti+1;
+                job.config = config;
+                job.data = new AaptFile(String8(), AaptGroupEntry(), String8());
+                typeJobs.add(job);
+                chunks.add(job.data);
+            }
+            flattenedTypes.add(ti, t);
+        }
 
-                memset(tHeader, 0, sizeof(*tHeader));
-                tHeader->header.type = htods(RES_TABLE_TYPE_TYPE);
-                tHeader->header.headerSize = htods(sizeof(*tHeader));
-                tHeader->id = ti+1;
-                tHeader->entryCount = htodl(N);
-                tHeader->entriesStart = htodl(typeSize);
-                tHeader->config = config;
-                if (kIsDebug) {
-                    printf("Writing type %zu config: imsi:%d/%d lang:%c%c cnt:%c%c "
-                        "orien:%d ui:%d touch:%d density:%d key:%d inp:%d nav:%d sz:%dx%d "
-                        "sw%ddp w%ddp h%ddp layout:%d\n",
-                        ti + 1,
-                        tHeader->config.mcc, tHeader->config.mnc,
-                        tHeader->config.language[0] ? tHeader->config.language[0] : '-',
-                        tHeader->config.language[1] ? tHeader->config.language[1] : '-',
-                        tHeader->config.country[0] ? tHeader->config.country[0] : '-',
-                        tHeader->config.country[1] ? tHeader->config.country[1] : '-',
-                        tHeader->config.orientation,
-                        tHeader->config.uiMode,
-                        tHeader->config.touchscreen,
-                        tHeader->config.density,
-                        tHeader->config.keyboard,
-                        tHeader->config.inputFlags,
-                        tHeader->config.navigation,
-                        tHeader->config.screenWidth,
-                        tHeader->config.screenHeight,
-                        tHeader->config.smallestScreenWidthDp,
-                        tHeader->config.screenWidthDp,
-                        tHeader->config.screenHeightDp,
-                        tHeader->config.screenLayout);
+        const int jobs = bundle->getJobs();
+        if (typeJobs.size() > 1 && jobs > 1) {
+            WorkQueue workQueue(typeJobs.size() < (size_t) jobs ? typeJobs.size() : jobs, false);
+            WorkQueue::Group group(&workQueue);
+            for (size_t i = 0; i < typeJobs.size(); i++) {
+                TypeChunkWorkUnit* w = new TypeChunkWorkUnit(bundle, &typeJobs.editItemAt(i));
+                if (group.schedule(w, 0) != NO_ERROR) {
+                    w->run();
+                    delete w;
                 }
-                tHeader->config.swapHtoD();
+            }
+            group.wait();
+        } else {
+            for (size_t i = 0; i < typeJobs.size(); i++) {
+                typeJobs.editItemAt(i).err = flattenTypeChunk(bundle, &typeJobs.editItemAt(i));
+            }
+        }
 
-                // Build the entries inside of this type.
-                for (size_t ei=0; ei<N; ei++) {
-                    sp<ConfigList> cl = t->getOrderedConfigs().itemAt(ei);
-                    sp<Entry> e = NULL;
-                    if (cl != NULL) {
-                        e = cl->getEntries().valueFor(config);
-                    }
+        size_t ji = 0;
+        for (size_t fi=0; fi<flattenedTypes.size(); fi++) {
+            const size_t ti = flattenedTypes.keyAt(fi);
+            const sp<Type>& t = flattenedTypes.valueAt(fi);
+            const String16& typeName = t->getName();
+            const size_t N = t->getOrderedConfigs().size();
 
-                    // Set the offset for this entry in its type.
-                    uint32_t* index = (uint32_t*)
-                        (((uint8_t*)data->editData())
-                            + typeStart + sizeof(ResTable_type));
-                    if (e != NULL) {
-                        index[ei] = htodl(data->getSize()-typeStart-typeSize);
-
-                        // Create the entry.
-                        ssize_t amt = e->flatten(bundle, data, cl->getPublic());
-                        if (amt < 0) {
-                            return amt;
-                        }
-                        validResources.editItemAt(ei) = true;
-                    } else {
-                        index[ei] = htodl(ResTable_type::NO_ENTRY);
+            // Until a non-NO_ENTRY value has been written for a resource,
+            // that resource is invalid; validResources[i] represents
+            // the item at t->getOrderedConfigs().itemAt(i).
+            Vector<bool> validResources;
+            validResources.insertAt(false, 0, N);
+            for (; ji < typeJobs.size() && typeJobs[ji].typeId == ti+1; ji++) {
+                const TypeChunkJob& job = typeJobs[ji];
+                if (job.err != NO_ERROR) {
+                    return job.err;
+                }
+                for (size_t i = 0; i < N; i++) {
+                    if (job.written[i]) {
+                        validResources.editItemAt(i) = true;
                     }
                 }
-
-                // Fill in the rest of the type information.
-                tHeader = (ResTable_type*)
-                    (((uint8_t*)data->editData()) + typeStart);
-                tHeader->header.size = htodl(data->getSize()-typeStart);
             }
 
             // If we're building splits, then each invocation of the flattening
@@ -3181,6 +4564,24 @@ status_t ResourceTable::flatten(Bundle* bundle, const sp<const ResourceFilter>&
             }
         }
 
+        // Append the typeSpec and type chunks with a single allocation.
+        const size_t chunksStart = data->getSize();
+        size_t packageSize = chunksStart;
+        for (size_t i = 0; i < chunks.size(); i++) {
+            packageSize += chunks[i]->getSize();
+        }
+        uint8_t* chunkData = data->reserveData(packageSize) == NO_ERROR
+                ? (uint8_t*)data->editData(packageSize) : NULL;
+        if (chunkData == NULL) {
+            fprintf(stderr, "ERROR: out of memory creating ResTable_package\n");
+            return NO_MEMORY;
+        }
+        chunkData += chunksStart;
+        for (size_t i = 0; i < chunks.size(); i++) {
+            memcpy(chunkData, chunks[i]->getData(), chunks[i]->getSize());
+            chunkData += chunks[i]->getSize();
+        }
+
         // Fill in the rest of the package information.
         header = (ResTable_package*)data->editData();
         header->header.size = htodl(data->getSize());
@@ -3192,8 +4593,21 @@ status_t ResourceTable::flatten(Bundle* bundle, const sp<const ResourceFilter>&
         flatPackages.add(data);
     }
 
-    // And now write out the final chunks.
+    // And now write out the final chunks, into a table allocated once
+    // at its full size.
+    sp<AaptFile> valueStringsData = valueStrings.createStringBlock();
+    if (valueStringsData == NULL) {
+        return UNKNOWN_ERROR;
+    }
     const size_t dataStart = dest->getSize();
+    size_t tableSize = sizeof(ResTable_header) + valueStringsData->getSize();
+    for (pi=0; pi<flatPackages.size(); pi++) {
+        tableSize += flatPackages[pi]->getSize();
+    }
+    if (dest->reserveData(dataStart + tableSize) != NO_ERROR) {
+        fprintf(stderr, "ERROR: out of memory creating ResTable_header\n");
+        return NO_MEMORY;
+    }
 
     {
         // blah
@@ -3210,8 +4624,9 @@ status_t ResourceTable::flatten(Bundle* bundle, const sp<const ResourceFilter>&
     }
     
     ssize_t strStart = dest->getSize();
-    status_t err = valueStrings.writeStringBlock(dest);
+    status_t err = dest->writeData(valueStringsData->getData(), valueStringsData->getSize());
     if (err != NO_ERROR) {
+        fprintf(stderr, "ERROR: out of memory creating value string pool\n");
         return err;
     }
 
@@ -3368,22 +4783,49 @@ ResourceTable::Item::Item(const SourcePos& _sourcePos,
     , bagKeyId(0)
     , evaluating(false)
 {
-    if (_style) {
-        style = *_style;
+    if (_style != NULL && _style->size() > 0) {
+        Style* spans = new Style;
+        spans->spans = *_style;
+        style = spans;
+    }
+}
+
+bool ResourceTable::Item::hasSameValue(const Item& o) const
+{
+    if (isId != o.isId || format != o.format || value != o.value) {
+        return false;
+    }
+    const Vector<StringPool::entry_style_span>* spans = getStyle();
+    const Vector<StringPool::entry_style_span>* otherSpans = o.getStyle();
+    const size_t N = spans != NULL ? spans->size() : 0;
+    if (N != (otherSpans != NULL ? otherSpans->size() : 0)) {
+        return false;
+    }
+    for (size_t i=0; i<N; i++) {
+        const StringPool::entry_style_span& a = spans->itemAt(i);
+        const StringPool::entry_style_span& b = otherSpans->itemAt(i);
+        if (a.name != b.name || a.span.firstChar != b.span.firstChar
+                || a.span.lastChar != b.span.lastChar) {
+            return false;
+        }
     }
+    return true;
 }
 
 ResourceTable::Entry::Entry(const Entry& entry)
-    : RefBase()
+    : LightRefBase<Entry>()
     , mName(entry.mName)
     , mParent(entry.mParent)
     , mType(entry.mType)
     , mItem(entry.mItem)
     , mItemFormat(entry.mItemFormat)
     , mBag(entry.mBag)
+    , mBagOrder(entry.mBagOrder)
+    , mBagOrdered(entry.mBagOrdered)
     , mNameIndex(entry.mNameIndex)
     , mParentId(entry.mParentId)
-    , mPos(entry.mPos) {}
+    , mPos(entry.mPos)
+    , mAccount(entry.mAccount) {}
 
 ResourceTable::Entry& ResourceTable::Entry::operator=(const Entry& entry) {
     mName = entry.mName;
@@ -3392,9 +4834,12 @@ ResourceTable::Entry& ResourceTable::Entry::operator=(const Entry& entry) {
     mItem = entry.mItem;
     mItemFormat = entry.mItemFormat;
     mBag = entry.mBag;
+    mBagOrder = entry.mBagOrder;
+    mBagOrdered = entry.mBagOrdered;
     mNameIndex = entry.mNameIndex;
     mParentId = entry.mParentId;
     mPos = entry.mPos;
+    mAccount = entry.mAccount;
     return *this;
 }
 
@@ -3410,7 +4855,7 @@ status_t ResourceTable::Entry::makeItABag(const SourcePos& sourcePos)
     sourcePos.error("Resource entry %s is already defined as a single item.\n"
                     "%s:%d: Originally defined here.\n",
                     String8(mName).string(),
-                    mItem.sourcePos.file.string(), mItem.sourcePos.line);
+                    mItem.sourcePos.file().string(), mItem.sourcePos.line());
     return UNKNOWN_ERROR;
 }
 
@@ -3431,7 +4876,7 @@ status_t ResourceTable::Entry::setItem(const SourcePos& sourcePos,
             sourcePos.error("Resource entry %s is already defined as a bag.\n"
                             "%s:%d: Originally defined here.\n",
                             String8(mName).string(),
-                            item.sourcePos.file.string(), item.sourcePos.line);
+                            item.sourcePos.file().string(), item.sourcePos.line());
         }
         return UNKNOWN_ERROR;
     }
@@ -3439,7 +4884,7 @@ status_t ResourceTable::Entry::setItem(const SourcePos& sourcePos,
         sourcePos.error("Resource entry %s is already defined.\n"
                         "%s:%d: Originally defined here.\n",
                         String8(mName).string(),
-                        mItem.sourcePos.file.string(), mItem.sourcePos.line);
+                        mItem.sourcePos.file().string(), mItem.sourcePos.line());
         return UNKNOWN_ERROR;
     }
 
@@ -3471,15 +4916,18 @@ status_t ResourceTable::Entry::addToBag(const SourcePos& sourcePos,
             sourcePos.error("Resource entry %s already has bag item %s.\n"
                     "%s:%d: Originally defined here.\n",
                     String8(mName).string(), String8(key).string(),
-                    item.sourcePos.file.string(), item.sourcePos.line);
+                    item.sourcePos.file().string(), item.sourcePos.line());
             return UNKNOWN_ERROR;
         }
         //printf("Replacing %s with %s\n",
         //       String8(mBag.valueFor(key).value).string(), String8(value).string());
-        mBag.replaceValueFor(key, item);
+        // add() below replaces the item already under this key.
     }
 
-    mBag.add(key, item);
+    mBag.add(key, std::move(item));
+    mBagOrder.clear();
+    mBagOrdered = false;
+    accountBag();
     return NO_ERROR;
 }
 
@@ -3489,6 +4937,10 @@ status_t ResourceTable::Entry::removeFromBag(const String16& key) {
     }
 
     if (mBag.removeItem(key) >= 0) {
+        if (mBagOrdered) {
+            orderBag(&mBagOrder);
+        }
+        accountBag();
         return NO_ERROR;
     }
     return UNKNOWN_ERROR;
@@ -3502,6 +4954,9 @@ status_t ResourceTable::Entry::emptyBag(const SourcePos& sourcePos)
     }
 
     mBag.clear();
+    mBagOrder.clear();
+    mBagOrdered = false;
+    accountBag();
     return NO_ERROR;
 }
 
@@ -3535,7 +4990,7 @@ status_t ResourceTable::Entry::generateAttributes(ResourceTable* table,
 //                     String8(key).string());
 //             const Item& item(mBag.valueAt(i));
 //             fprintf(stderr, "Referenced from file %s line %d\n",
-//                     item.sourcePos.file.string(), item.sourcePos.line);
+//                     item.sourcePos.file().string(), item.sourcePos.line());
 //             return UNKNOWN_ERROR;
 #else
             char numberStr[16];
@@ -3564,7 +5019,9 @@ status_t ResourceTable::Entry::assignResourceIds(ResourceTable* table,
         const String16 attr16("attr");
         const String16 id16("id");
         mParentId = 0;
+        Statistics::add(Statistics::BAGS_RESOLVED);
         if (mParent.size() > 0) {
+            Statistics::add(Statistics::BAG_PARENTS);
             mParentId = table->getResId(mParent, &style16, NULL, &errorMsg);
             if (mParentId == 0) {
                 mPos.error("Error retrieving parent for item: %s '%s'.\n",
@@ -3573,6 +5030,7 @@ status_t ResourceTable::Entry::assignResourceIds(ResourceTable* table,
             }
         }
         const size_t N = mBag.size();
+        Statistics::add(Statistics::BAG_KEYS, N);
         for (size_t i=0; i<N; i++) {
             const String16& key = mBag.keyAt(i);
             Item& it = mBag.editValueAt(i);
@@ -3586,19 +5044,110 @@ status_t ResourceTable::Entry::assignResourceIds(ResourceTable* table,
                 hasErrors = true;
             }
         }
+        if (!hasErrors) {
+            orderBag(&mBagOrder);
+            mBagOrdered = true;
+            accountBag();
+        }
     }
     return hasErrors ? STATUST(UNKNOWN_ERROR) : NO_ERROR;
 }
 
+namespace {
+
+// Orders the indices of a bag's items by their IDs, and then by name.
+struct BagIdOrder {
+    explicit BagIdOrder(const KeyedVector<String16, ResourceTable::Item>& b) : bag(b) { }
+
+    bool operator()(uint32_t l, uint32_t r) const {
+        const uint32_t lid = bag.valueAt(l).bagKeyId;
+        const uint32_t rid = bag.valueAt(r).bagKeyId;
+        return lid != rid ? lid < rid : l < r;
+    }
+
+    const KeyedVector<String16, ResourceTable::Item>& bag;
+};
+
+} // namespace
+
+void ResourceTable::Entry::orderBag(Vector<uint32_t>* outOrder) const
+{
+    const size_t N = mBag.size();
+    outOrder->clear();
+    outOrder->setCapacity(N);
+    for (size_t i=0; i<N; i++) {
+        outOrder->add(i);
+    }
+    std::sort(outOrder->editArray(), outOrder->editArray() + N, BagIdOrder(mBag));
+
+    // Of the items given the same ID, the last by name is the one flattened.
+    size_t kept = 0;
+    for (size_t i=0; i<N; i++) {
+        const uint32_t index = outOrder->itemAt(i);
+        if (i + 1 < N && mBag.valueAt(outOrder->itemAt(i + 1)).bagKeyId
+                == mBag.valueAt(index).bagKeyId) {
+            continue;
+        }
+        outOrder->editItemAt(kept++) = index;
+    }
+    if (kept < N) {
+        outOrder->removeItemsAt(kept, N - kept);
+    }
+}
+
+void ResourceTable::Entry::getBagOrder(Vector<uint32_t>* outOrder) const
+{
+    if (mBagOrdered) {
+        *outOrder = mBagOrder;
+    } else {
+        orderBag(outOrder);
+    }
+}
+
+const ResourceTable::Item* ResourceTable::Entry::getBagItem(uint32_t attrID) const
+{
+    if (!mBagOrdered) {
+        const size_t N = mBag.size();
+        for (size_t i=0; i<N; i++) {
+            const Item& it = mBag.valueAt(i);
+            if (it.bagKeyId == 0) {
+                fprintf(stderr, "warning: ID not yet assigned to '%s' in bag '%s'\n",
+                        String8(mName).string(),
+                        String8(mBag.keyAt(i)).string());
+            }
+            if (it.bagKeyId == attrID) {
+                return &it;
+            }
+        }
+        return NULL;
+    }
+
+    size_t lo = 0;
+    size_t hi = mBagOrder.size();
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        const Item& it = mBag.valueAt(mBagOrder[mid]);
+        if (it.bagKeyId == attrID) {
+            return &it;
+        }
+        if (it.bagKeyId < attrID) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
 status_t ResourceTable::Entry::prepareFlatten(StringPool* strings, ResourceTable* table,
         const String8* configTypeName, const ConfigDescription* config)
 {
     if (mType == TYPE_ITEM) {
         Item& it = mItem;
-        AccessorCookie ac(it.sourcePos, String8(mName), String8(it.value));
+        AccessorCookie ac(it.sourcePos, mName, it.value);
         if (!table->stringToValue(&it.parsedValue, strings,
                                   it.value, false, true, 0,
-                                  &it.style, NULL, &ac, mItemFormat,
+                                  it.getStyle(), NULL, &ac, mItemFormat,
                                   configTypeName, config)) {
             return UNKNOWN_ERROR;
         }
@@ -3607,10 +5156,10 @@ status_t ResourceTable::Entry::prepareFlatten(StringPool* strings, ResourceTable
         for (size_t i=0; i<N; i++) {
             const String16& key = mBag.keyAt(i);
             Item& it = mBag.editValueAt(i);
-            AccessorCookie ac(it.sourcePos, String8(key), String8(it.value));
+            AccessorCookie ac(it.sourcePos, key, it.value);
             if (!table->stringToValue(&it.parsedValue, strings,
                                       it.value, false, true, it.bagKeyId,
-                                      &it.style, NULL, &ac, it.format,
+                                      it.getStyle(), NULL, &ac, it.format,
                                       configTypeName, config)) {
                 return UNKNOWN_ERROR;
             }
@@ -3686,15 +5235,10 @@ ssize_t ResourceTable::Entry::flatten(Bundle* /* bundle */, const sp<AaptFile>&
         }
         amt += it.parsedValue.size;
     } else {
-        size_t N = mBag.size();
+        Vector<uint32_t> items;
+        getBagOrder(&items);
+        const size_t N = items.size();
         size_t i;
-        // Create correct ordering of items.
-        KeyedVector<uint32_t, const Item*> items;
-        for (i=0; i<N; i++) {
-            const Item& it = mBag.valueAt(i);
-            items.add(it.bagKeyId, &it);
-        }
-        N = items.size();
         
         ResTable_map_entry mapHeader;
         memcpy(&mapHeader, &header, sizeof(header));
@@ -3708,7 +5252,7 @@ ssize_t ResourceTable::Entry::flatten(Bundle* /* bundle */, const sp<AaptFile>&
         }
 
         for (i=0; i<N; i++) {
-            const Item& it = *items.valueAt(i);
+            const Item& it = mBag.valueAt(items[i]);
             ResTable_map map;
             map.name.ident = htodl(it.bagKeyId);
             map.value.size = htods(it.parsedValue.size);
@@ -3726,6 +5270,27 @@ ssize_t ResourceTable::Entry::flatten(Bundle* /* bundle */, const sp<AaptFile>&
     return amt;
 }
 
+bool ResourceTable::Entry::hasSameValue(const Entry& other) const
+{
+    if (mType != other.mType) {
+        return false;
+    }
+    if (mType == TYPE_ITEM) {
+        return mItemFormat == other.mItemFormat && mItem.hasSameValue(other.mItem);
+    }
+    if (mType != TYPE_BAG || mParent != other.mParent || mBag.size() != other.mBag.size()) {
+        return false;
+    }
+    const size_t N = mBag.size();
+    for (size_t i=0; i<N; i++) {
+        if (mBag.keyAt(i) != other.mBag.keyAt(i)
+                || !mBag.valueAt(i).hasSameValue(other.mBag.valueAt(i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
 void ResourceTable::ConfigList::appendComment(const String16& comment,
                                               bool onlyIfEmpty)
 {
@@ -3811,24 +5376,11 @@ sp<ResourceTable::Entry> ResourceTable::Type::getEntry(const String16& entry,
                                                        bool overlay,
                                                        bool autoAddOverlay)
 {
-    int pos = -1;
-    sp<ConfigList> c = mConfigs.valueFor(entry);
+    sp<ConfigList> c = declareEntry(entry, sourcePos, doSetIndex, overlay, autoAddOverlay);
     if (c == NULL) {
-        if (overlay && !autoAddOverlay && mCanAddEntries.indexOf(entry) < 0) {
-            sourcePos.error("Resource at %s appears in overlay but not"
-                            " in the base package; use <add-resource> to add.\n",
-                            String8(entry).string());
-            return NULL;
-        }
-        c = new ConfigList(entry, sourcePos);
-        mConfigs.add(entry, c);
-        pos = (int)mOrderedConfigs.size();
-        mOrderedConfigs.add(c);
-        if (doSetIndex) {
-            c->setEntryIndex(pos);
-        }
+        return NULL;
     }
-    
+
     ConfigDescription cdesc;
     if (config) cdesc = *config;
     
@@ -3864,6 +5416,10 @@ sp<ResourceTable::Entry> ResourceTable::Type::getEntry(const String16& entry,
         }
         e = new Entry(entry, sourcePos);
         c->addEntry(cdesc, e);
+        if (!c->isDensityVarying() && AaptConfig::isDensityOnly(cdesc)) {
+            c->setDensityVarying();
+            mDensityVaryingConfigs.add(c);
+        }
         /*
         if (doSetIndex) {
             if (pos < 0) {
@@ -3904,6 +5460,41 @@ sp<ResourceTable::ConfigList> ResourceTable::Type::removeEntry(const String16& e
     return removed;
 }
 
+void ResourceTable::Type::removeEntryAt(size_t index) {
+    const sp<ConfigList> removed = mOrderedConfigs[index];
+    if (removed == NULL) {
+        return;
+    }
+    mConfigs.removeItem(removed->getName());
+    mPublic.removeItem(removed->getName());
+    mOrderedConfigs.editItemAt(index) = NULL;
+}
+
+sp<ResourceTable::ConfigList> ResourceTable::Type::declareEntry(const String16& entry,
+                                                               const SourcePos& sourcePos,
+                                                               bool doSetIndex,
+                                                               bool overlay,
+                                                               bool autoAddOverlay)
+{
+    sp<ConfigList> c = mConfigs.valueFor(entry);
+    if (c == NULL) {
+        if (overlay && !autoAddOverlay && mCanAddEntries.indexOf(entry) < 0) {
+            sourcePos.error("Resource at %s appears in overlay but not"
+                            " in the base package; use <add-resource> to add.\n",
+                            String8(entry).string());
+            return NULL;
+        }
+        c = new ConfigList(entry, sourcePos);
+        mConfigs.add(entry, c);
+        const int pos = (int)mOrderedConfigs.size();
+        mOrderedConfigs.add(c);
+        if (doSetIndex) {
+            c->setEntryIndex(pos);
+        }
+    }
+    return c;
+}
+
 SortedVector<ConfigDescription> ResourceTable::Type::getUniqueConfigs() const {
     SortedVector<ConfigDescription> unique;
     const size_t entryCount = mOrderedConfigs.size();
@@ -3921,6 +5512,28 @@ SortedVector<ConfigDescription> ResourceTable::Type::getUniqueConfigs() const {
     return unique;
 }
 
+// Orders positions in a type's public symbols by the symbols' names.
+struct PublicNameOrder {
+    explicit PublicNameOrder(const DefaultHashedKeyedVector<String16, ResourceTable::Public>& p)
+        : publics(p) { }
+
+    bool operator()(size_t l, size_t r) const {
+        return publics.keyAt(l) < publics.keyAt(r);
+    }
+
+    const DefaultHashedKeyedVector<String16, ResourceTable::Public>& publics;
+};
+
+void ResourceTable::Type::setStableId(const String16& name, uint32_t ident,
+        uint32_t typeIdOffset)
+{
+    const int32_t typeIndex = Res_GETTYPE(ident) + 1 - (int32_t) typeIdOffset;
+    if (mStableIndex < 0 && typeIndex > 0) {
+        mStableIndex = typeIndex;
+    }
+    mStableIds.replaceValueFor(name, ident);
+}
+
 status_t ResourceTable::Type::applyPublicEntryOrder()
 {
     size_t N = mOrderedConfigs.size();
@@ -3932,12 +5545,22 @@ status_t ResourceTable::Type::applyPublicEntryOrder()
         mOrderedConfigs.replaceAt(NULL, i);
     }
 
+    // mPublic keeps the order the symbols were declared in; go through
+    // them by name, which decides which of two symbols given the same
+    // identifier gets it.
     const size_t NP = mPublic.size();
+    Vector<size_t> publicByName;
+    publicByName.setCapacity(NP);
+    for (size_t j=0; j<NP; j++) {
+        publicByName.add(j);
+    }
+    std::sort(publicByName.begin(), publicByName.end(), PublicNameOrder(mPublic));
+
     //printf("Ordering %d configs from %d public defs\n", N, NP);
     size_t j;
     for (j=0; j<NP; j++) {
-        const String16& name = mPublic.keyAt(j);
-        const Public& p = mPublic.valueAt(j);
+        const String16& name = mPublic.keyAt(publicByName[j]);
+        const Public& p = mPublic.valueAt(publicByName[j]);
         int32_t idx = Res_GETENTRY(p.ident);
         //printf("Looking for entry \"%s\"/\"%s\" (0x%08x) in %d...\n",
         //       String8(mName).string(), String8(name).string(), p.ident, N);
@@ -3981,6 +5604,28 @@ status_t ResourceTable::Type::applyPublicEntryOrder()
         }
     }
 
+    // Entries that had an identifier in the previous build (--stable-ids)
+    // keep it if nothing public took it; the rest fill the gaps below.
+    if (mStableIds.size() > 0) {
+        for (i=0; i<N; ) {
+            sp<ConfigList> e = origOrder.itemAt(i);
+            ssize_t si = mStableIds.indexOfKey(e->getName());
+            if (si >= 0) {
+                int32_t idx = Res_GETENTRY(mStableIds.valueAt(si));
+                if (idx >= (int32_t)mOrderedConfigs.size()) {
+                    mOrderedConfigs.resize(idx + 1);
+                }
+                if (mOrderedConfigs.itemAt(idx) == NULL) {
+                    mOrderedConfigs.replaceAt(e, idx);
+                    origOrder.removeAt(i);
+                    N--;
+                    continue;
+                }
+            }
+            i++;
+        }
+    }
+
     //printf("Copying back in %d non-public configs, have %d\n", N, origOrder.size());
     
     if (N != origOrder.size()) {
@@ -4110,6 +5755,25 @@ status_t ResourceTable::Package::applyPublicTypeOrder()
         }
     }
 
+    // Then types that had an identifier in the previous build (--stable-ids),
+    // where nothing public took it.  attr has to stay first.
+    for (i=0; i<N; i++) {
+        sp<Type> t = origOrder.itemAt(i);
+        int32_t idx = t->getStableIndex() - 1;
+        if (idx < 0 || (idx == 0 && t->getName() != String16("attr"))) {
+            continue;
+        }
+        while (idx >= (int32_t)mOrderedTypes.size()) {
+            mOrderedTypes.add();
+        }
+        if (mOrderedTypes.itemAt(idx) == NULL) {
+            mOrderedTypes.replaceAt(t, idx);
+            origOrder.removeAt(i);
+            i--;
+            N--;
+        }
+    }
+
     size_t j=0;
     for (i=0; i<N; i++) {
         sp<Type> t = origOrder.itemAt(i);
@@ -4302,20 +5966,7 @@ const ResourceTable::Item* ResourceTable::getItem(uint32_t resID, uint32_t attrI
         return NULL;
     }
 
-    const size_t N = e->getBag().size();
-    for (size_t i=0; i<N; i++) {
-        const Item& it = e->getBag().valueAt(i);
-        if (it.bagKeyId == 0) {
-            fprintf(stderr, "warning: ID not yet assigned to '%s' in bag '%s'\n",
-                    String8(e->getName()).string(),
-                    String8(e->getBag().keyAt(i)).string());
-        }
-        if (it.bagKeyId == attrID) {
-            return &it;
-        }
-    }
-
-    return NULL;
+    return e->getBagItem(attrID);
 }
 
 bool ResourceTable::getItemValue(
@@ -4356,6 +6007,49 @@ bool ResourceTable::getItemValue(
     return res;
 }
 
+// The last android:attr entry made public in each release before
+// SDK_LOLLIPOP_MR1, in order; later entries are all marked as made
+// public in SDK_LOLLIPOP_MR1.
+static const struct {
+    size_t lastEntryId;
+    int sdkLevel;
+} kPublicAttributeLevels[] = {
+    { 0x021c, 1 },
+    { 0x021d, 2 },
+    { 0x0269, SDK_CUPCAKE },
+    { 0x028d, SDK_DONUT },
+    { 0x02ad, SDK_ECLAIR },
+    { 0x02b3, SDK_ECLAIR_0_1 },
+    { 0x02b5, SDK_ECLAIR_MR1 },
+    { 0x02bd, SDK_FROYO },
+    { 0x02cb, SDK_GINGERBREAD },
+    { 0x0361, SDK_HONEYCOMB },
+    { 0x0366, SDK_HONEYCOMB_MR1 },
+    { 0x03a6, SDK_HONEYCOMB_MR2 },
+    { 0x03ae, SDK_JELLY_BEAN },
+    { 0x03cc, SDK_JELLY_BEAN_MR1 },
+    { 0x03da, SDK_JELLY_BEAN_MR2 },
+    { 0x03f1, SDK_KITKAT },
+    { 0x03f6, SDK_KITKAT_WATCH },
+    { 0x04ce, SDK_LOLLIPOP },
+};
+
+/**
+ * Returns whether attrId could be an attribute made public after
+ * sdkLevel.  Only the entry ID is looked at, so this rejects most
+ * attributes without the table lookup getPublicAttributeSdkLevel() makes.
+ */
+static bool mayBePublicAfter(uint32_t attrId, int sdkLevel) {
+    const size_t entryId = Res_GETENTRY(attrId);
+    const size_t N = sizeof(kPublicAttributeLevels) / sizeof(kPublicAttributeLevels[0]);
+    for (size_t i = 0; i < N && kPublicAttributeLevels[i].sdkLevel <= sdkLevel; i++) {
+        if (entryId <= kPublicAttributeLevels[i].lastEntryId) {
+            return false;
+        }
+    }
+    return true;
+}
+
 /**
  * Returns the SDK version at which the attribute was
  * made public, or -1 if the resource ID is not an attribute
@@ -4376,49 +6070,26 @@ int ResourceTable::getPublicAttributeSdkLevel(uint32_t attrId) const {
     }
 
     const size_t entryId = Res_GETENTRY(attrId);
-    if (entryId <= 0x021c) {
-        return 1;
-    } else if (entryId <= 0x021d) {
-        return 2;
-    } else if (entryId <= 0x0269) {
-        return SDK_CUPCAKE;
-    } else if (entryId <= 0x028d) {
-        return SDK_DONUT;
-    } else if (entryId <= 0x02ad) {
-        return SDK_ECLAIR;
-    } else if (entryId <= 0x02b3) {
-        return SDK_ECLAIR_0_1;
-    } else if (entryId <= 0x02b5) {
-        return SDK_ECLAIR_MR1;
-    } else if (entryId <= 0x02bd) {
-        return SDK_FROYO;
-    } else if (entryId <= 0x02cb) {
-        return SDK_GINGERBREAD;
-    } else if (entryId <= 0x0361) {
-        return SDK_HONEYCOMB;
-    } else if (entryId <= 0x0366) {
-        return SDK_HONEYCOMB_MR1;
-    } else if (entryId <= 0x03a6) {
-        return SDK_HONEYCOMB_MR2;
-    } else if (entryId <= 0x03ae) {
-        return SDK_JELLY_BEAN;
-    } else if (entryId <= 0x03cc) {
-        return SDK_JELLY_BEAN_MR1;
-    } else if (entryId <= 0x03da) {
-        return SDK_JELLY_BEAN_MR2;
-    } else if (entryId <= 0x03f1) {
-        return SDK_KITKAT;
-    } else if (entryId <= 0x03f6) {
-        return SDK_KITKAT_WATCH;
-    } else if (entryId <= 0x04ce) {
-        return SDK_LOLLIPOP;
-    } else {
-        // Anything else is marked as defined in
-        // SDK_LOLLIPOP_MR1 since after this
-        // version no attribute compat work
-        // needs to be done.
-        return SDK_LOLLIPOP_MR1;
+    const size_t N = sizeof(kPublicAttributeLevels) / sizeof(kPublicAttributeLevels[0]);
+    for (size_t i = 0; i < N; i++) {
+        if (entryId <= kPublicAttributeLevels[i].lastEntryId) {
+            return kPublicAttributeLevels[i].sdkLevel;
+        }
     }
+
+    // Anything else is marked as defined in
+    // SDK_LOLLIPOP_MR1 since after this
+    // version no attribute compat work
+    // needs to be done.
+    return SDK_LOLLIPOP_MR1;
+}
+
+/**
+ * Whether an attribute made public at sdkLevel has to be moved out of a
+ * file used from configSdk (and minSdk) up, by modifyForCompat().
+ */
+static inline bool isCompatAttributeLevel(int sdkLevel, int configSdk, int minSdk) {
+    return sdkLevel > 1 && sdkLevel > configSdk && sdkLevel > minSdk;
 }
 
 /**
@@ -4485,6 +6156,10 @@ status_t ResourceTable::modifyForCompat(const Bundle* bundle) {
 
     const String16 attr16("attr");
 
+    // Bags share most of their attributes, so each one's level is found once.
+    DefaultHashedKeyedVector<uint32_t, int> sdkLevels(-1);
+    Vector<uint32_t> bagOrder;
+
     const size_t packageCount = mOrderedPackages.size();
     for (size_t pi = 0; pi < packageCount; pi++) {
         sp<Package> p = mOrderedPackages.itemAt(pi);
@@ -4524,12 +6199,23 @@ status_t ResourceTable::modifyForCompat(const Bundle* bundle) {
 
                     KeyedVector<int, Vector<String16> > attributesToRemove;
                     const KeyedVector<String16, Item>& bag = e->getBag();
-                    const size_t bagCount = bag.size();
+                    e->getBagOrder(&bagOrder);
+                    const size_t bagCount = bagOrder.size();
                     for (size_t bi = 0; bi < bagCount; bi++) {
-                        const uint32_t attrId = getResId(bag.keyAt(bi), &attr16);
-                        const int sdkLevel = getPublicAttributeSdkLevel(attrId);
-                        if (sdkLevel > 1 && sdkLevel > config.sdkVersion && sdkLevel > minSdk) {
-                            AaptUtil::appendValue(attributesToRemove, sdkLevel, bag.keyAt(bi));
+                        const String16& key = bag.keyAt(bagOrder[bi]);
+                        const Item& it = bag.valueAt(bagOrder[bi]);
+                        // An attribute's ID is already the item's; an id's
+                        // name is looked up as an attribute, as it always was.
+                        const uint32_t attrId = it.isId ? getResId(key, &attr16) : it.bagKeyId;
+                        ssize_t li = sdkLevels.indexOfKey(attrId);
+                        if (li < 0) {
+                            const int sdkLevel = mayBePublicAfter(attrId, std::max(minSdk, 1))
+                                    ? getPublicAttributeSdkLevel(attrId) : -1;
+                            li = sdkLevels.add(attrId, sdkLevel);
+                        }
+                        const int sdkLevel = sdkLevels.valueAt(li);
+                        if (isCompatAttributeLevel(sdkLevel, config.sdkVersion, minSdk)) {
+                            AaptUtil::appendValue(attributesToRemove, sdkLevel, key);
                         }
                     }
 
@@ -4604,9 +6290,40 @@ status_t ResourceTable::modifyForCompat(const Bundle* bundle) {
             }
         }
     }
+
+    // Bag items were rewritten above.
+    clearAttributeInfo();
     return NO_ERROR;
 }
 
+bool ResourceTable::needsCompatModification(const Bundle* bundle,
+                                            const sp<AaptFile>& target,
+                                            const Vector<uint32_t>& attrIds) const {
+    // Mirrors the checks made by modifyForCompat() below.
+    const int minSdk = getMinSdkVersion(bundle);
+    if (minSdk >= SDK_LOLLIPOP_MR1 || attrIds.isEmpty()) {
+        return false;
+    }
+
+    const ConfigDescription config(target->getGroupEntry().toParams());
+    if (target->getResourceType() == "" || config.sdkVersion >= SDK_LOLLIPOP_MR1) {
+        return false;
+    }
+
+    const size_t attrCount = attrIds.size();
+    const int newerThan = std::max<int>(std::max<int>(config.sdkVersion, minSdk), 1);
+    for (size_t i = 0; i < attrCount; i++) {
+        if (!mayBePublicAfter(attrIds[i], newerThan)) {
+            continue;
+        }
+        const int sdkLevel = getPublicAttributeSdkLevel(attrIds[i]);
+        if (isCompatAttributeLevel(sdkLevel, config.sdkVersion, minSdk)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 status_t ResourceTable::modifyForCompat(const Bundle* bundle,
                                         const String16& resourceName,
                                         const sp<AaptFile>& target,
@@ -4625,9 +6342,12 @@ status_t ResourceTable::modifyForCompat(const Bundle* bundle,
         return NO_ERROR;
     }
 
-    sp<XMLNode> newRoot = NULL;
+    // The versioned copy is compiled again from the source file, so the
+    // tree only loses the attributes here and is never copied.
+    bool modified = false;
     ConfigDescription newConfig(target->getGroupEntry().toParams());
     newConfig.sdkVersion = SDK_LOLLIPOP_MR1;
+    const int newerThan = std::max<int>(std::max<int>(config.sdkVersion, minSdk), 1);
 
     Vector<sp<XMLNode> > nodesToVisit;
     nodesToVisit.push(root);
@@ -4638,11 +6358,12 @@ status_t ResourceTable::modifyForCompat(const Bundle* bundle,
         const Vector<XMLNode::attribute_entry>& attrs = node->getAttributes();
         for (size_t i = 0; i < attrs.size(); i++) {
             const XMLNode::attribute_entry& attr = attrs[i];
+            if (!mayBePublicAfter(attr.nameResId, newerThan)) {
+                continue;
+            }
             const int sdkLevel = getPublicAttributeSdkLevel(attr.nameResId);
-            if (sdkLevel > 1 && sdkLevel > config.sdkVersion && sdkLevel > minSdk) {
-                if (newRoot == NULL) {
-                    newRoot = root->clone();
-                }
+            if (isCompatAttributeLevel(sdkLevel, config.sdkVersion, minSdk)) {
+                modified = true;
 
                 // Find the smallest sdk version that we need to synthesize for
                 // and do that one. Subsequent versions will be processed on
@@ -4672,7 +6393,7 @@ status_t ResourceTable::modifyForCompat(const Bundle* bundle,
         }
     }
 
-    if (newRoot == NULL) {
+    if (!modified) {
         return NO_ERROR;
     }
 
@@ -4718,31 +6439,74 @@ status_t ResourceTable::modifyForCompat(const Bundle* bundle,
     return NO_ERROR;
 }
 
-void ResourceTable::getDensityVaryingResources(KeyedVector<Symbol, Vector<SymbolDefinition> >& resources) {
-    const ConfigDescription nullConfig;
+void ResourceTable::remapFilePaths(const KeyedVector<String16, String16>& paths) {
+    static const String16 resPrefix("res/");
 
     const size_t packageCount = mOrderedPackages.size();
     for (size_t p = 0; p < packageCount; p++) {
         const Vector<sp<Type> >& types = mOrderedPackages[p]->getOrderedTypes();
         const size_t typeCount = types.size();
         for (size_t t = 0; t < typeCount; t++) {
+            if (types[t] == NULL) {
+                continue;
+            }
             const Vector<sp<ConfigList> >& configs = types[t]->getOrderedConfigs();
             const size_t configCount = configs.size();
             for (size_t c = 0; c < configCount; c++) {
+                if (configs[c] == NULL) {
+                    continue;
+                }
                 const DefaultKeyedVector<ConfigDescription, sp<Entry> >& configEntries = configs[c]->getEntries();
                 const size_t configEntryCount = configEntries.size();
+                for (size_t ce = 0; ce < configEntryCount; ce++) {
+                    const sp<Entry>& entry = configEntries.valueAt(ce);
+                    const Item* item = entry->getItem();
+                    if (item == NULL || !item->value.startsWith(resPrefix)) {
+                        continue;
+                    }
+                    ssize_t index = paths.indexOfKey(item->value);
+                    if (index >= 0) {
+                        entry->setItemValue(paths.valueAt(index));
+                    }
+                }
+            }
+        }
+    }
+}
+
+void ResourceTable::getDensityVaryingResources(Vector<SymbolDefinitions>& resources) {
+    const size_t packageCount = mOrderedPackages.size();
+    for (size_t p = 0; p < packageCount; p++) {
+        const Vector<sp<Type> >& types = mOrderedPackages[p]->getOrderedTypes();
+        const size_t typeCount = types.size();
+        for (size_t t = 0; t < typeCount; t++) {
+            const DefaultHashedKeyedVector<String16, sp<ConfigList> >& current =
+                    types[t]->getConfigs();
+            const Vector<sp<ConfigList> >& configs = types[t]->getDensityVaryingConfigs();
+            const size_t configCount = configs.size();
+            for (size_t c = 0; c < configCount; c++) {
+                const sp<ConfigList>& cl = configs[c];
+                if (current.valueFor(cl->getName()) != cl) {
+                    // Removed from the type since.
+                    continue;
+                }
+
+                SymbolDefinitions* resource = NULL;
+                const DefaultKeyedVector<ConfigDescription, sp<Entry> >& configEntries = cl->getEntries();
+                const size_t configEntryCount = configEntries.size();
                 for (size_t ce = 0; ce < configEntryCount; ce++) {
                     const ConfigDescription& config = configEntries.keyAt(ce);
-                    if (AaptConfig::isDensityOnly(config)) {
-                        // This configuration only varies with regards to density.
-                        const Symbol symbol(mOrderedPackages[p]->getName(),
-                                types[t]->getName(),
-                                configs[c]->getName(),
-                                getResId(mOrderedPackages[p], types[t], configs[c]->getEntryIndex()));
-
-                        const sp<Entry>& entry = configEntries.valueAt(ce);
-                        AaptUtil::appendValue(resources, symbol, SymbolDefinition(symbol, config, entry->getPos()));
+                    if (!AaptConfig::isDensityOnly(config)) {
+                        continue;
+                    }
+                    if (resource == NULL) {
+                        resource = &resources.editItemAt(resources.add());
+                        resource->symbol = Symbol(mOrderedPackages[p]->getName(),
+                                types[t]->getName(), cl->getName(),
+                                getResId(mOrderedPackages[p], types[t], cl->getEntryIndex()));
                     }
+                    resource->definitions.add(SymbolDefinition(resource->symbol, config,
+                            configEntries.valueAt(ce)->getPos()));
                 }
             }
         }
@@ -10,14 +10,20 @@
 #include <map>
 #include <queue>
 #include <set>
+#include <vector>
+
+#include <utils/HashedKeyedVector.h>
 
 #include "ConfigDescription.h"
+#include "MemStats.h"
 #include "ResourceFilter.h"
 #include "SourcePos.h"
+#include "StringPiece.h"
 #include "StringPool.h"
 #include "Symbol.h"
 
 class XMLNode;
+class XMLStream;
 class ResourceTable;
 
 enum {
@@ -27,6 +33,9 @@ enum {
     XML_COMPILE_STRIP_WHITESPACE = 1<<3,
     XML_COMPILE_STRIP_RAW_VALUES = 1<<4,
     XML_COMPILE_UTF8 = 1<<5,
+    XML_COMPILE_STRIP_LINE_NUMBERS = 1<<6,
+    // Warn about plain 'id' attributes, which layouts mean as 'android:id'.
+    XML_COMPILE_WARN_PLAIN_IDS = 1<<7,
 
     XML_COMPILE_STANDARD_RESOURCE =
             XML_COMPILE_STRIP_COMMENTS | XML_COMPILE_ASSIGN_ATTRIBUTE_IDS
@@ -56,20 +65,110 @@ status_t compileXmlFile(const Bundle* bundle,
                         ResourceTable* table,
                         int options = XML_COMPILE_STANDARD_RESOURCE);
 
+/*
+ * The three stages of compileXmlFile(), exposed separately so that the
+ * stages which do not touch the ResourceTable (preparing and flattening the
+ * tree) can run in parallel with other files.  resolveXmlFile() assigns
+ * attribute IDs, parses values and applies compat versioning; it reads and
+ * may modify the table, so callers running in parallel must serialize it.
+ */
+void prepareXmlFile(const sp<XMLNode>& root, int options = XML_COMPILE_STANDARD_RESOURCE);
+
+status_t resolveXmlFile(const Bundle* bundle,
+                        const sp<AaptAssets>& assets,
+                        const String16& resourceName,
+                        const sp<XMLNode>& root,
+                        const sp<AaptFile>& target,
+                        ResourceTable* table,
+                        int options = XML_COMPILE_STANDARD_RESOURCE);
+
+status_t flattenXmlFile(const sp<XMLNode>& root,
+                        const sp<AaptFile>& target,
+                        int options = XML_COMPILE_STANDARD_RESOURCE);
+
+/*
+ * Flattens a file compiled as an XMLStream, the way most files are.  The
+ * other stages are XMLStream's own prepare() and resolve().
+ */
+status_t flattenXmlFile(const XMLStream& stream,
+                        const sp<AaptFile>& target,
+                        int options = XML_COMPILE_STANDARD_RESOURCE);
+
+status_t compileResourceFile(Bundle* bundle,
+                             const sp<AaptAssets>& assets,
+                             const sp<AaptFile>& in,
+                             const ResTable_config& defParams,
+                             const bool overwrite,
+                             ResourceTable* outTable);
+
+/*
+ * Parses a values file for compileResourceFile(), as
+ * parseXMLResource(in, outTree, false, true) does.  With --resource-cache
+ * the parsed tree is kept there by the file's contents, so the values of
+ * libraries that many apps are built with are only parsed once.
+ */
+status_t parseValuesFile(const Bundle* bundle, const sp<AaptFile>& in, ResXMLTree* outTree);
+
+// The digest parseValuesFile() keeps the tree of "in" under.
+status_t valuesTreeDigest(const sp<AaptFile>& in, String8* outDigest);
+
+/*
+ * Parses a values file for compileResourceFile() without flattening it,
+ * for builds with no --resource-cache to keep the flattened tree in.  The
+ * values compiled from it are the same as from parseValuesFile()'s tree.
+ */
+status_t parseValuesStream(const sp<AaptFile>& in, XMLStream* outStream);
+
+/*
+ * Same as above, for a values file that has already been parsed into block,
+ * a ResXMLTree from parseValuesFile() or an XMLStream from
+ * parseValuesStream().  Parsing does not touch the table, so it can be
+ * done ahead of time on another thread.
+ */
+template <class Parser>
 status_t compileResourceFile(Bundle* bundle,
                              const sp<AaptAssets>& assets,
                              const sp<AaptFile>& in,
+                             Parser& block,
                              const ResTable_config& defParams,
                              const bool overwrite,
                              ResourceTable* outTable);
 
+/*
+ * For a values file whose configuration --prune-configs leaves out, as
+ * AaptAssets::isPruned() says: declares the resources it defines, in the
+ * order compileResourceFile() would, so that they keep their identifiers
+ * and symbols, and notes its strings for validateLocalizations(), without
+ * compiling any of the values.  A file holding anything but plain values --
+ * styles, attributes, public declarations -- is compiled in full.
+ */
+status_t declareResourceFile(Bundle* bundle,
+                             const sp<AaptAssets>& assets,
+                             const sp<AaptFile>& in,
+                             const ResTable_config& defParams,
+                             const bool overwrite,
+                             ResourceTable* outTable);
+
+// Same as above, for a values file already parsed with parseValuesFile()
+// or parseValuesStream().
+template <class Parser>
+status_t declareResourceFile(Bundle* bundle,
+                             const sp<AaptAssets>& assets,
+                             const sp<AaptFile>& in,
+                             Parser& block,
+                             const ResTable_config& defParams,
+                             const bool overwrite,
+                             ResourceTable* outTable);
+
+// Where a value being parsed came from, for reportError().  The attribute
+// name and value are only converted to UTF-8 if an error is reported.
 struct AccessorCookie
 {
     SourcePos sourcePos;
-    String8 attr;
-    String8 value;
+    StringPiece16 attr;
+    StringPiece16 value;
 
-    AccessorCookie(const SourcePos&p, const String8& a, const String8& v)
+    AccessorCookie(const SourcePos&p, const StringPiece16& a, const StringPiece16& v)
         :sourcePos(p),
          attr(a),
          value(v)
@@ -99,6 +198,7 @@ public:
     class Package;
     class Type;
     class Entry;
+    class FlattenIndex;
 
     ResourceTable(Bundle* bundle, const String16& assetsPackage, PackageType type);
 
@@ -137,6 +237,14 @@ public:
                       const int32_t format = ResTable_map::TYPE_ANY,
                       const bool overwrite = false);
 
+    // Gives a resource a name, and so an identifier, without adding a
+    // value for any configuration.
+    status_t declareEntry(const SourcePos& pos,
+                          const String16& package,
+                          const String16& type,
+                          const String16& name,
+                          const bool overlay = false);
+
     status_t startBag(const SourcePos& pos,
                     const String16& package,
                     const String16& type,
@@ -189,6 +297,8 @@ public:
         
     size_t size() const;
     size_t numLocalResources() const;
+    // Entries that became bags, such as styles and arrays.
+    size_t numLocalBags() const { return mNumBags; }
     bool hasResources() const;
 
     status_t modifyForCompat(const Bundle* bundle);
@@ -197,9 +307,23 @@ public:
                              const sp<AaptFile>& file,
                              const sp<XMLNode>& root);
 
+    /*
+     * Returns true if modifyForCompat() would edit an XML file using the
+     * attributes "attrIds", so it has to be compiled as an XMLNode tree.
+     */
+    bool needsCompatModification(const Bundle* bundle,
+                                 const sp<AaptFile>& file,
+                                 const Vector<uint32_t>& attrIds) const;
+
     sp<AaptFile> flatten(Bundle* bundle, const sp<const ResourceFilter>& filter,
             const bool isBase);
 
+    /*
+     * Points every item whose value is a key of "paths", the archive path
+     * of a file resource, at the path it maps to instead.
+     */
+    void remapFilePaths(const KeyedVector<String16, String16>& paths);
+
     static inline uint32_t makeResId(uint32_t packageId,
                                      uint32_t typeId,
                                      uint32_t nameId)
@@ -211,9 +335,10 @@ public:
                                     const sp<Type>& t,
                                     uint32_t nameId);
 
-    uint32_t getResId(const String16& package,
-                      const String16& type,
-                      const String16& name,
+    // Copies nothing when the ID is already cached.
+    uint32_t getResId(const StringPiece16& package,
+                      const StringPiece16& type,
+                      const StringPiece16& name,
                       bool onlyPublic = true) const;
 
     uint32_t getResId(const String16& ref,
@@ -234,13 +359,46 @@ public:
                        const String8* configTypeName = NULL,
                        const ConfigDescription* config = NULL);
 
+    // Reads a file written by writeStableIds() and has assignResourceIds()
+    // give the resources in it that still exist the same identifiers.
+    status_t loadStableIds(const char* path);
     status_t assignResourceIds();
+    void writeStableIds(FILE* fp);
+    // Reads a list of resources to keep, one "[package:]type/name" per line,
+    // and adds their identifiers to "roots" for removeUnreachable().
+    status_t loadKeptResources(const char* path, SortedVector<uint32_t>* roots) const;
+    // Removes the resources that no public resource, nothing in "roots" and
+    // nothing those reach refers to.  "fileRefs" has what each compiled file
+    // refers to, by archive path.  The paths of the files no remaining entry
+    // points at are put in outUnusedFiles.  Returns the number removed.
+    size_t removeUnreachable(const SortedVector<uint32_t>& roots,
+            const KeyedVector<String16, Vector<uint32_t> >& fileRefs,
+            SortedVector<String16>* outUnusedFiles);
+    // Removes every configuration's entry but the default's from resources
+    // whose value is the same in every configuration they have, other than
+    // files.  Returns the number removed.
+    size_t collapseInvariantValues();
+    // Writes, one tab-separated "kind from to" line each and sorted, which
+    // resources each source file defines ("defines file type/name"), which
+    // resources it and the files it compiles to refer to ("refers"), and
+    // which outputs it goes into ("output path file").  "fileRefs" is as
+    // for removeUnreachable().
+    void writeDependencyGraph(FILE* fp,
+            const KeyedVector<String16, Vector<uint32_t> >& fileRefs);
+    // Writes the largest type identifier of each package in "table", the
+    // flattened base table, to "path", for a later feature to be built
+    // --feature-after it without loading the APK.
+    static status_t writeFeatureIndex(const ResTable& table, const char* path);
     status_t addSymbols(const sp<AaptSymbols>& outSymbols = NULL);
     void addLocalization(const String16& name, const String8& locale, const SourcePos& src);
     status_t validateLocalizations(void);
 
+    // "index", if given, must have been made from this table as it is now;
+    // building it once lets the table be flattened for each split without
+    // looking at every entry each time.
     status_t flatten(Bundle* bundle, const sp<const ResourceFilter>& filter,
-            const sp<AaptFile>& dest, const bool isBase);
+            const sp<AaptFile>& dest, const bool isBase,
+            const FlattenIndex* index = NULL);
     status_t flattenLibraryTable(const sp<AaptFile>& dest, const Vector<sp<Package> >& libs);
 
     void writePublicDefinitions(const String16& package, FILE* fp);
@@ -272,6 +430,11 @@ public:
 
     class Item {
     public:
+        // An item's style spans, kept apart from it since few items have any.
+        struct Style : public LightRefBase<Style> {
+            Vector<StringPool::entry_style_span> spans;
+        };
+
         Item() : isId(false), format(ResTable_map::TYPE_ANY), bagKeyId(0), evaluating(false)
             { memset(&parsedValue, 0, sizeof(parsedValue)); }
         Item(const SourcePos& pos,
@@ -284,6 +447,11 @@ public:
             format(o.format), bagKeyId(o.bagKeyId), evaluating(false) {
             memset(&parsedValue, 0, sizeof(parsedValue));
         }
+        Item(Item&& o) : sourcePos(o.sourcePos),
+            isId(o.isId), value(std::move(o.value)), style(std::move(o.style)),
+            format(o.format), bagKeyId(o.bagKeyId), evaluating(false) {
+            memset(&parsedValue, 0, sizeof(parsedValue));
+        }
         ~Item() { }
 
         Item& operator=(const Item& o) {
@@ -297,22 +465,41 @@ public:
             return *this;
         }
 
-        SourcePos                               sourcePos;
+        Item& operator=(Item&& o) {
+            sourcePos = o.sourcePos;
+            isId = o.isId;
+            value = std::move(o.value);
+            style = std::move(o.style);
+            format = o.format;
+            bagKeyId = o.bagKeyId;
+            parsedValue = o.parsedValue;
+            return *this;
+        }
+
+        // NULL if the item has no style spans.
+        const Vector<StringPool::entry_style_span>* getStyle() const
+            { return style != NULL ? &style->spans : NULL; }
+
+        // Whether "o" flattens to the same value, wherever it came from.
+        bool hasSameValue(const Item& o) const;
+
+        FilePos                                 sourcePos;
         mutable bool                            isId;
         String16                                value;
-        Vector<StringPool::entry_style_span>    style;
+        sp<const Style>                         style;
         int32_t                                 format;
         uint32_t                                bagKeyId;
         mutable bool                            evaluating;
         Res_value                               parsedValue;
     };
 
-    class Entry : public RefBase {
+    class Entry : public LightRefBase<Entry> {
     public:
         Entry(const String16& name, const SourcePos& pos)
             : mName(name), mType(TYPE_UNKNOWN),
-              mItemFormat(ResTable_map::TYPE_ANY), mNameIndex(-1), mPos(pos)
-        { }
+              mItemFormat(ResTable_map::TYPE_ANY), mBagOrdered(false), mNameIndex(-1),
+              mPos(pos), mAccount(MemStats::RESOURCE_TABLE)
+        { accountBag(); }
 
         Entry(const Entry& entry);
         Entry& operator=(const Entry& entry);
@@ -354,8 +541,20 @@ public:
         void setNameIndex(int32_t index) { mNameIndex = index; }
 
         const Item* getItem() const { return mType == TYPE_ITEM ? &mItem : NULL; }
+        void setItemValue(const String16& value) { mItem.value = value; }
         const KeyedVector<String16, Item>& getBag() const { return mBag; }
 
+        /*
+         * The indices into getBag() of its items in the order of their
+         * IDs, with one for each ID, as the bag is flattened.  Kept from
+         * assignResourceIds() on, and worked out again for a bag that has
+         * since been added to.
+         */
+        void getBagOrder(Vector<uint32_t>* outOrder) const;
+
+        // The bag's item for "attrID", or NULL.
+        const Item* getBagItem(uint32_t attrID) const;
+
         status_t generateAttributes(ResourceTable* table,
                                     const String16& package);
 
@@ -369,7 +568,10 @@ public:
 
         ssize_t flatten(Bundle*, const sp<AaptFile>& data, bool isPublic);
 
-        const SourcePos& getPos() const { return mPos; }
+        // Whether "other" flattens to the same item or bag.
+        bool hasSameValue(const Entry& other) const;
+
+        SourcePos getPos() const { return mPos; }
 
     private:
         String16 mName;
@@ -378,15 +580,26 @@ public:
         Item mItem;
         int32_t mItemFormat;
         KeyedVector<String16, Item> mBag;
+        Vector<uint32_t> mBagOrder;
+        bool mBagOrdered;
         int32_t mNameIndex;
         uint32_t mParentId;
-        SourcePos mPos;
+        FilePos mPos;
+        MemAccount mAccount;
+
+        void accountBag() {
+            mAccount.set(sizeof(Entry) + mBag.size() * (sizeof(String16) + sizeof(Item))
+                    + mBagOrder.size() * sizeof(uint32_t));
+        }
+
+        void orderBag(Vector<uint32_t>* outOrder) const;
     };
     
-    class ConfigList : public RefBase {
+    class ConfigList : public LightRefBase<ConfigList> {
     public:
         ConfigList(const String16& name, const SourcePos& pos)
-            : mName(name), mPos(pos), mPublic(false), mEntryIndex(-1) { }
+            : mName(name), mPos(pos), mPublic(false), mEntryIndex(-1),
+              mDensityVarying(false) { }
         virtual ~ConfigList() { }
         
         String16 getName() const { return mName; }
@@ -410,8 +623,20 @@ public:
         void addEntry(const ResTable_config& config, const sp<Entry>& entry) {
             mEntries.add(config, entry);
         }
+
+        // Whether an entry was ever added for a configuration that only
+        // differs from the default in density.
+        bool isDensityVarying() const { return mDensityVarying; }
+        void setDensityVarying() { mDensityVarying = true; }
         
         const DefaultKeyedVector<ConfigDescription, sp<Entry> >& getEntries() const { return mEntries; }
+
+        // Removes every entry but the one for "config".
+        void keepOnlyEntry(const ConfigDescription& config) {
+            const sp<Entry> entry = mEntries.valueFor(config);
+            mEntries.clear();
+            mEntries.add(config, entry);
+        }
     private:
         const String16 mName;
         const SourcePos mPos;
@@ -420,6 +645,7 @@ public:
         bool mPublic;
         SourcePos mPublicSourcePos;
         int32_t mEntryIndex;
+        bool mDensityVarying;
         DefaultKeyedVector<ConfigDescription, sp<Entry> > mEntries;
     };
     
@@ -447,10 +673,11 @@ public:
         uint32_t    ident;
     };
     
-    class Type : public RefBase {
+    class Type : public LightRefBase<Type> {
     public:
         Type(const String16& name, const SourcePos& pos)
-                : mName(name), mFirstPublicSourcePos(NULL), mPublicIndex(-1), mIndex(-1), mPos(pos)
+                : mName(name), mFirstPublicSourcePos(NULL), mPublicIndex(-1), mStableIndex(-1),
+                  mIndex(-1), mPos(pos)
         { }
         virtual ~Type() { delete mFirstPublicSourcePos; }
 
@@ -472,38 +699,64 @@ public:
             return mPublic.indexOfKey(entry) >= 0;
         }
 
+        // The ConfigList of "entry", made if it has none yet, as for getEntry().
+        sp<ConfigList> declareEntry(const String16& entry,
+                                    const SourcePos& pos,
+                                    bool doSetIndex = false,
+                                    bool overlay = false,
+                                    bool autoAddOverlay = false);
+
         sp<ConfigList> removeEntry(const String16& entry);
 
+        // Unlike removeEntry(), leaves a hole so that later entries keep
+        // their identifiers.
+        void removeEntryAt(size_t index);
+
         SortedVector<ConfigDescription> getUniqueConfigs() const;
 
         const SourcePos& getFirstPublicSourcePos() const { return *mFirstPublicSourcePos; }
 
         int32_t getPublicIndex() const { return mPublicIndex; }
 
+        // The identifier a previous build gave an entry, which it keeps
+        // unless a public declaration wants the same one.
+        void setStableId(const String16& name, uint32_t ident, uint32_t typeIdOffset);
+        int32_t getStableIndex() const { return mStableIndex; }
+
         int32_t getIndex() const { return mIndex; }
         void setIndex(int32_t index) { mIndex = index; }
 
         status_t applyPublicEntryOrder();
 
-        const DefaultKeyedVector<String16, sp<ConfigList> >& getConfigs() const { return mConfigs; }
+        const DefaultHashedKeyedVector<String16, sp<ConfigList> >& getConfigs() const { return mConfigs; }
         const Vector<sp<ConfigList> >& getOrderedConfigs() const { return mOrderedConfigs; }
         const SortedVector<String16>& getCanAddEntries() const { return mCanAddEntries; }
+
+        // The entries that were given a density-only configuration, in the
+        // order they got their first one.  Entries removed since are still
+        // listed.
+        const Vector<sp<ConfigList> >& getDensityVaryingConfigs() const {
+            return mDensityVaryingConfigs;
+        }
         
         const SourcePos& getPos() const { return mPos; }
 
     private:
         String16 mName;
         SourcePos* mFirstPublicSourcePos;
-        DefaultKeyedVector<String16, Public> mPublic;
-        DefaultKeyedVector<String16, sp<ConfigList> > mConfigs;
+        DefaultHashedKeyedVector<String16, Public> mPublic;
+        DefaultHashedKeyedVector<String16, sp<ConfigList> > mConfigs;
         Vector<sp<ConfigList> > mOrderedConfigs;
+        Vector<sp<ConfigList> > mDensityVaryingConfigs;
         SortedVector<String16> mCanAddEntries;
+        DefaultHashedKeyedVector<String16, uint32_t> mStableIds;
         int32_t mPublicIndex;
+        int32_t mStableIndex;
         int32_t mIndex;
         SourcePos mPos;
     };
 
-    class Package : public RefBase {
+    class Package : public LightRefBase<Package> {
     public:
         Package(const String16& name, size_t packageId);
         virtual ~Package() { }
@@ -527,7 +780,7 @@ public:
 
         status_t applyPublicTypeOrder();
 
-        const DefaultKeyedVector<String16, sp<Type> >& getTypes() const { return mTypes; }
+        const DefaultHashedKeyedVector<String16, sp<Type> >& getTypes() const { return mTypes; }
         const Vector<sp<Type> >& getOrderedTypes() const { return mOrderedTypes; }
 
         void movePrivateAttrs();
@@ -539,7 +792,7 @@ public:
 
         const String16 mName;
         const size_t mPackageId;
-        DefaultKeyedVector<String16, sp<Type> > mTypes;
+        DefaultHashedKeyedVector<String16, sp<Type> > mTypes;
         Vector<sp<Type> > mOrderedTypes;
         sp<AaptFile> mTypeStringsData;
         sp<AaptFile> mKeyStringsData;
@@ -549,9 +802,35 @@ public:
         DefaultKeyedVector<String16, uint32_t> mKeyStringsMapping;
     };
 
-    void getDensityVaryingResources(KeyedVector<Symbol, Vector<SymbolDefinition> >& resources);
+    /*
+     * The configurations each type of the table has entries for, with
+     * where those entries are, so that flatten() can go straight to the
+     * entries a filter takes instead of matching every entry against it.
+     */
+    class FlattenIndex {
+    public:
+        explicit FlattenIndex(const ResourceTable& table);
+        ~FlattenIndex();
+
+    private:
+        FlattenIndex(const FlattenIndex&);
+        FlattenIndex& operator=(const FlattenIndex&);
+
+        friend class ResourceTable;
+        struct TypeIndex;
+
+        const TypeIndex* getType(const Type* type) const;
+
+        KeyedVector<const Type*, TypeIndex*> mTypes;
+    };
+
+    // The resources with definitions for density-only configurations,
+    // found from the entries each type listed as they were added.
+    void getDensityVaryingResources(Vector<SymbolDefinitions>& resources);
 
 private:
+    status_t flattenIndexed(Bundle* bundle, const sp<const ResourceFilter>& filter,
+            const sp<AaptFile>& dest, const bool isBase, const FlattenIndex& index);
     void writePublicDefinitions(const String16& package, FILE* fp, bool pub);
     sp<Package> getPackage(const String16& package);
     sp<Type> getType(const String16& package,
@@ -574,6 +853,40 @@ private:
     bool getItemValue(uint32_t resID, uint32_t attrID,
                       Res_value* outValue);
     int getPublicAttributeSdkLevel(uint32_t attrId) const;
+    // The identifier an "@..." or "?..." value refers to, or 0.
+    uint32_t getReferencedResId(const String16& value) const;
+
+    // What the Accessor callbacks report about one of this table's
+    // attributes, read from its bag the first time one of them asks.
+    struct AttributeInfo {
+        AttributeInfo()
+            : exists(false), hasType(false), type(0), hasMin(false), min(0)
+            , hasMax(false), max(0), l10n(ResTable_map::L10N_NOT_REQUIRED) { }
+
+        // A bag key's value, if it parses.
+        struct Symbol {
+            Symbol() : parsed(false) { memset(&value, 0, sizeof(value)); }
+
+            bool parsed;
+            Res_value value;
+        };
+
+        bool exists;
+        bool hasType;
+        uint32_t type;
+        bool hasMin;
+        uint32_t min;
+        bool hasMax;
+        uint32_t max;
+        uint32_t l10n;
+        // key = bag key, such as an enum or flag name
+        KeyedVector<String16, Symbol> symbols;
+    };
+
+    // The returned record is only valid until the next call.
+    const AttributeInfo& getAttributeInfo(uint32_t attrID);
+    // Called whenever a bag or its keys' IDs may have changed.
+    void clearAttributeInfo();
 
 
     String16 mAssetsPackage;
@@ -583,12 +896,43 @@ private:
     DefaultKeyedVector<String16, sp<Package> > mPackages;
     Vector<sp<Package> > mOrderedPackages;
     size_t mNumLocal;
+    size_t mNumBags;
     SourcePos mCurrentXmlPos;
     Bundle* mBundle;
 
-    // key = string resource name, value = set of locales in which that name is defined
-    std::map<String16, std::map<String8, SourcePos>> mLocalizations;
+    // Where a translatable string was defined in one locale.
+    struct LocalizationSource {
+        LocalizationSource(uint32_t l, const SourcePos& p) : locale(l), pos(p) { }
+
+        uint32_t locale;
+        SourcePos pos;
+    };
+
+    // The locales one translatable string is defined in, as bits numbered
+    // like mLocalizationLocales.  Where each definition was is only kept
+    // with -v, and only until a default one turns up, since it is listed
+    // just for strings that have none.
+    struct Localization {
+        Localization() : hasDefault(false) { }
+
+        bool hasLocale(ssize_t bit) const {
+            return bit >= 0 && (size_t) bit / 64 < locales.size()
+                    && (locales[bit / 64] & (uint64_t(1) << (bit % 64))) != 0;
+        }
+
+        bool hasDefault;
+        std::vector<uint64_t> locales;
+        std::vector<LocalizationSource> sources;
+    };
+
+    // key = string resource name, value = index into mLocalizations
+    HashedKeyedVector<String16, size_t> mLocalizationIndex;
+    std::vector<Localization> mLocalizations;
+    // key = locale, value = its bit in Localization::locales
+    KeyedVector<String8, uint32_t> mLocalizationLocales;
     std::queue<CompileResourceWorkItem> mWorkQueue;
+    // key = attribute ID
+    HashedKeyedVector<uint32_t, AttributeInfo> mAttributeInfo;
 };
 
 #endif
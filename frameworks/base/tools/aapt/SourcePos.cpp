@@ -1,5 +1,12 @@
 #include "SourcePos.h"
+#include "AaptContext.h"
 
+#include <cutils/threads.h>
+#include <utils/KeyedVector.h>
+#include <utils/Mutex.h>
+#include <utils/Vector.h>
+
+#include <algorithm>
 #include <stdarg.h>
 #include <vector>
 
@@ -26,10 +33,22 @@ struct ErrorPos
     ErrorPos(const String8& file, int line, const String8& error, Level level);
     ErrorPos& operator=(const ErrorPos& rhs);
 
+    String8 format() const;
     void print(FILE* to) const;
 };
 
-static vector<ErrorPos> g_errors;
+// Everything a run reported, with the errors among it counted.
+struct ErrorLog
+{
+    vector<ErrorPos> errors;
+    size_t errorCount;
+    Mutex lock;
+
+    ErrorLog() : errorCount(0) { }
+};
+
+// The ErrorBuffer currently collecting errors for the calling thread, if any.
+static thread_store_t g_errorBuffer = THREAD_STORE_INITIALIZER;
 
 ErrorPos::ErrorPos()
     :line(-1), level(NOTE)
@@ -62,8 +81,8 @@ ErrorPos::operator=(const ErrorPos& rhs)
     return *this;
 }
 
-void
-ErrorPos::print(FILE* to) const
+String8
+ErrorPos::format() const
 {
     const char* type = "";
     switch (level) {
@@ -80,12 +99,66 @@ ErrorPos::print(FILE* to) const
     
     if (!this->file.isEmpty()) {
         if (this->line >= 0) {
-            fprintf(to, "%s:%d: %s%s\n", this->file.string(), this->line, type, this->error.string());
-        } else {
-            fprintf(to, "%s: %s%s\n", this->file.string(), type, this->error.string());
+            return String8::format("%s:%d: %s%s\n", this->file.string(), this->line, type,
+                    this->error.string());
         }
+        return String8::format("%s: %s%s\n", this->file.string(), type, this->error.string());
+    }
+    return String8::format("%s%s\n", type, this->error.string());
+}
+
+void
+ErrorPos::print(FILE* to) const
+{
+    fputs(format().string(), to);
+}
+
+static void*
+newErrorLog()
+{
+    return new ErrorLog;
+}
+
+static void
+deleteErrorLog(void* log)
+{
+    delete static_cast<ErrorLog*>(log);
+}
+
+// The log of the calling thread's run.
+static ErrorLog*
+errorLog()
+{
+    return static_cast<ErrorLog*>(AaptContext::current()->getState(
+            AaptContext::STATE_DIAGNOSTICS, newErrorLog, deleteErrorLog));
+}
+
+/*
+ * Adds "pos" to the calling thread's ErrorBuffer if it has one, or else to
+ * the run's log, printing it at once unless it's an error.  An error
+ * cancels a --fail-fast run at once, even if it is only buffered.
+ */
+static void
+report(const ErrorPos& pos)
+{
+    if (pos.level == ErrorPos::ERROR) {
+        AaptContext* context = AaptContext::current();
+        if (context->getFailFast()) {
+            context->cancel();
+        }
+    }
+    vector<ErrorPos>* buffer = static_cast<vector<ErrorPos>*>(thread_store_get(&g_errorBuffer));
+    if (buffer != NULL) {
+        buffer->push_back(pos);
+        return;
+    }
+    ErrorLog* log = errorLog();
+    AutoMutex _l(log->lock);
+    log->errors.push_back(pos);
+    if (pos.level == ErrorPos::ERROR) {
+        log->errorCount++;
     } else {
-        fprintf(to, "%s%s\n", type, this->error.string());
+        pos.print(stderr);
     }
 }
 
@@ -117,7 +190,7 @@ SourcePos::error(const char* fmt, ...) const
     va_start(ap, fmt);
     String8 msg = String8::formatV(fmt, ap);
     va_end(ap);
-    g_errors.push_back(ErrorPos(this->file, this->line, msg, ErrorPos::ERROR));
+    report(ErrorPos(this->file, this->line, msg, ErrorPos::ERROR));
 }
 
 void
@@ -127,7 +200,7 @@ SourcePos::warning(const char* fmt, ...) const
     va_start(ap, fmt);
     String8 msg = String8::formatV(fmt, ap);
     va_end(ap);
-    ErrorPos(this->file, this->line, msg, ErrorPos::WARNING).print(stderr);
+    report(ErrorPos(this->file, this->line, msg, ErrorPos::WARNING));
 }
 
 void
@@ -137,7 +210,7 @@ SourcePos::printf(const char* fmt, ...) const
     va_start(ap, fmt);
     String8 msg = String8::formatV(fmt, ap);
     va_end(ap);
-    ErrorPos(this->file, this->line, msg, ErrorPos::NOTE).print(stderr);
+    report(ErrorPos(this->file, this->line, msg, ErrorPos::NOTE));
 }
 
 bool
@@ -149,17 +222,281 @@ SourcePos::operator<(const SourcePos& rhs) const
 bool
 SourcePos::hasErrors()
 {
-    return g_errors.size() > 0;
+    ErrorLog* log = errorLog();
+    AutoMutex _l(log->lock);
+    return log->errorCount > 0;
+}
+
+static bool
+compareByPosition(const ErrorPos& lhs, const ErrorPos& rhs)
+{
+    if (lhs.file != rhs.file) {
+        return lhs.file < rhs.file;
+    }
+    return lhs.line < rhs.line;
 }
 
 void
 SourcePos::printErrors(FILE* to)
 {
+    ErrorLog* log = errorLog();
+    AutoMutex _l(log->lock);
+    vector<ErrorPos> errors;
     vector<ErrorPos>::const_iterator it;
-    for (it=g_errors.begin(); it!=g_errors.end(); it++) {
+    for (it=log->errors.begin(); it!=log->errors.end(); it++) {
+        if (it->level == ErrorPos::ERROR) {
+            errors.push_back(*it);
+        }
+    }
+    // Which files a --fail-fast run got to before it stopped depends on
+    // the threads, so their errors are listed by position instead.
+    if (AaptContext::current()->getFailFast()) {
+        stable_sort(errors.begin(), errors.end(), compareByPosition);
+    }
+    for (it=errors.begin(); it!=errors.end(); it++) {
         it->print(to);
     }
 }
 
+void
+SourcePos::clearErrors()
+{
+    ErrorLog* log = errorLog();
+    AutoMutex _l(log->lock);
+    log->errors.clear();
+    log->errorCount = 0;
+}
+
+String8
+SourcePos::getDiagnostics()
+{
+    ErrorLog* log = errorLog();
+    AutoMutex _l(log->lock);
+    String8 text;
+    for (vector<ErrorPos>::const_iterator it = log->errors.begin(); it != log->errors.end();
+            it++) {
+        text.append(it->format());
+    }
+    return text;
+}
+
+static void
+writeJsonString(FILE* fp, const String8& str)
+{
+    fputc('"', fp);
+    for (const char* p = str.string(); *p; p++) {
+        const unsigned char c = *p;
+        if (c == '"' || c == '\\') {
+            fprintf(fp, "\\%c", c);
+        } else if (c == '\n') {
+            fputs("\\n", fp);
+        } else if (c < 0x20) {
+            fprintf(fp, "\\u%04x", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+status_t
+SourcePos::writeDiagnostics(const char* path)
+{
+    vector<ErrorPos> diagnostics;
+    {
+        ErrorLog* log = errorLog();
+        AutoMutex _l(log->lock);
+        diagnostics = log->errors;
+    }
+    // Stable, so that the notes on one line stay in the order they were made.
+    stable_sort(diagnostics.begin(), diagnostics.end(), compareByPosition);
+
+    FILE* fp = fopen(path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: Unable to open diagnostics output %s\n", path);
+        return UNKNOWN_ERROR;
+    }
+    fputs("{\n  \"$schema\": \"https://json.schemastore.org/sarif-2.1.0.json\",\n"
+            "  \"version\": \"2.1.0\",\n"
+            "  \"runs\": [{\n"
+            "    \"tool\": {\"driver\": {\"name\": \"aapt\"}},\n"
+            "    \"results\": [", fp);
+    for (size_t i = 0; i < diagnostics.size(); i++) {
+        const ErrorPos& pos = diagnostics[i];
+        const char* level = pos.level == ErrorPos::ERROR ? "error"
+                : pos.level == ErrorPos::WARNING ? "warning" : "note";
+        fprintf(fp, "%s\n      {\"level\": \"%s\", \"message\": {\"text\": ",
+                i == 0 ? "" : ",", level);
+        writeJsonString(fp, pos.error);
+        fputc('}', fp);
+        // SourcePos() leaves "???" for a file it doesn't know.
+        if (!pos.file.isEmpty() && pos.file != "???") {
+            fputs(", \"locations\": [{\"physicalLocation\": {\"artifactLocation\": {\"uri\": ",
+                    fp);
+            writeJsonString(fp, pos.file);
+            fputc('}', fp);
+            if (pos.line > 0) {
+                fprintf(fp, ", \"region\": {\"startLine\": %d}", pos.line);
+            }
+            fputs("}}]", fp);
+        }
+        fputc('}', fp);
+    }
+    fputs("\n    ]\n  }]\n}\n", fp);
+
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "ERROR: Unable to write diagnostics output %s\n", path);
+        return UNKNOWN_ERROR;
+    }
+    return NO_ERROR;
+}
+
+
+
+
+// SourcePos::ErrorBuffer
+// =============================================================================
+SourcePos::ErrorBuffer::ErrorBuffer()
+    : mErrors(new vector<ErrorPos>())
+{
+}
+
+SourcePos::ErrorBuffer::~ErrorBuffer()
+{
+    delete static_cast<vector<ErrorPos>*>(mErrors);
+}
+
+void
+SourcePos::ErrorBuffer::begin()
+{
+    thread_store_set(&g_errorBuffer, mErrors, NULL);
+}
+
+void
+SourcePos::ErrorBuffer::end()
+{
+    thread_store_set(&g_errorBuffer, NULL, NULL);
+}
+
+void
+SourcePos::ErrorBuffer::flush()
+{
+    vector<ErrorPos>* errors = static_cast<vector<ErrorPos>*>(mErrors);
+    if (errors->empty()) {
+        return;
+    }
+    // The warnings and notes go out in one write rather than one each.
+    String8 text;
+    ErrorLog* log = errorLog();
+    AutoMutex _l(log->lock);
+    for (vector<ErrorPos>::const_iterator it = errors->begin(); it != errors->end(); it++) {
+        if (it->level == ErrorPos::ERROR) {
+            log->errorCount++;
+        } else {
+            text.append(it->format());
+        }
+    }
+    log->errors.insert(log->errors.end(), errors->begin(), errors->end());
+    errors->clear();
+    if (!text.isEmpty()) {
+        fwrite(text.string(), 1, text.length(), stderr);
+    }
+}
+
+// FilePos
+// =============================================================================
+namespace {
+
+// Made on first use, since the strings can't be constructed before
+// libutils is.  Path 0 is the empty one of a SourcePos that has none.
+struct FileTable
+{
+    Vector<String8> paths;                  // by FilePos file index
+    KeyedVector<String8, uint32_t> indices;
+};
+
+// The path a thread last made a FilePos of, as it makes most of them one
+// file after another.
+struct LastFile
+{
+    String8 path;
+    uint32_t index;
+};
+
+} // namespace
+
+static FileTable* g_files = NULL;
+static Mutex g_filesLock;
+static thread_store_t g_lastFile = THREAD_STORE_INITIALIZER;
 
+static void
+deleteLastFile(void* last)
+{
+    delete static_cast<LastFile*>(last);
+}
 
+static uint32_t
+fileIndex(const String8& path)
+{
+    LastFile* last = static_cast<LastFile*>(thread_store_get(&g_lastFile));
+    if (last != NULL && (last->path.string() == path.string() || last->path == path)) {
+        return last->index;
+    }
+
+    uint32_t index;
+    {
+        AutoMutex _l(g_filesLock);
+        if (g_files == NULL) {
+            g_files = new FileTable;
+            g_files->paths.add(String8());
+            g_files->indices.add(g_files->paths[0], 0);
+        }
+        ssize_t i = g_files->indices.indexOfKey(path);
+        if (i >= 0) {
+            index = g_files->indices.valueAt(i);
+        } else {
+            index = g_files->paths.add(path);
+            g_files->indices.add(path, index);
+        }
+    }
+
+    if (last == NULL) {
+        last = new LastFile;
+        thread_store_set(&g_lastFile, last, deleteLastFile);
+    }
+    last->path = path;
+    last->index = index;
+    return index;
+}
+
+FilePos::FilePos(const SourcePos& pos)
+    : mFile(fileIndex(pos.file)), mLine(pos.line)
+{
+}
+
+String8
+FilePos::file() const
+{
+    AutoMutex _l(g_filesLock);
+    return g_files != NULL ? g_files->paths[mFile] : String8();
+}
+
+void
+FilePos::error(const char* fmt, ...) const
+{
+    va_list ap;
+    va_start(ap, fmt);
+    String8 msg = String8::formatV(fmt, ap);
+    va_end(ap);
+    report(ErrorPos(file(), mLine, msg, ErrorPos::ERROR));
+}
+
+void
+FilePos::warning(const char* fmt, ...) const
+{
+    va_list ap;
+    va_start(ap, fmt);
+    String8 msg = String8::formatV(fmt, ap);
+    va_end(ap);
+    report(ErrorPos(file(), mLine, msg, ErrorPos::WARNING));
+}
@@ -1,7 +1,9 @@
 #ifndef SOURCEPOS_H
 #define SOURCEPOS_H
 
+#include <utils/Errors.h>
 #include <utils/String8.h>
+#include <stdint.h>
 #include <stdio.h>
 
 using namespace android;
@@ -23,8 +25,68 @@ public:
 
     bool operator<(const SourcePos& rhs) const;
 
+    // These are of the calling thread's run; see AaptContext.
     static bool hasErrors();
     static void printErrors(FILE* to);
+    // Forgets all errors, warnings and notes reported so far.
+    static void clearErrors();
+    // Everything reported so far, one per line, as it is printed.
+    static String8 getDiagnostics();
+    // Writes everything reported so far to "path" as a SARIF log, ordered by
+    // file and line, for --diagnostics-output.
+    static status_t writeDiagnostics(const char* path);
+
+    /*
+     * Collects the errors, warnings and notes raised on one thread so they
+     * can be added to the run's list later, in an order chosen by the
+     * caller.  This lets work that runs in parallel report them
+     * deterministically; the warnings and notes are printed on flush().
+     */
+    class ErrorBuffer
+    {
+    public:
+        ErrorBuffer();
+        ~ErrorBuffer();
+
+        // Starts/stops redirecting error() calls made on the calling thread.
+        void begin();
+        void end();
+
+        // Moves the collected diagnostics to the calling thread's run.
+        void flush();
+
+    private:
+        ErrorBuffer(const ErrorBuffer&);
+        ErrorBuffer& operator=(const ErrorBuffer&);
+
+        void* mErrors;
+    };
+};
+
+/*
+ * A SourcePos in eight bytes, for the records a resource table keeps
+ * millions of.  The file is the index of its path in a table of every path
+ * seen, so each path is stored once however many records point into it.
+ */
+class FilePos
+{
+public:
+    FilePos() : mFile(0), mLine(-1) { }
+    FilePos(const SourcePos& pos);
+
+    // The path is copied out of the table, which other threads may grow.
+    String8 file() const;
+    int line() const { return mLine; }
+
+    SourcePos pos() const { return SourcePos(file(), mLine); }
+    operator SourcePos() const { return pos(); }
+
+    void error(const char* fmt, ...) const;
+    void warning(const char* fmt, ...) const;
+
+private:
+    uint32_t mFile;
+    int32_t mLine;
 };
 
 
@@ -0,0 +1,160 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Where the time goes before a build gets to work, for --startup-profile.
+//
+
+#include "StartupProfile.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <utils/Timers.h>
+
+namespace {
+
+struct Mark {
+    const char* name;
+    nsecs_t time;       // 0 until set
+};
+
+const int kMaxMarks = 32;
+
+Mark gMarks[kMaxMarks];
+int gMarkCount = 0;
+bool gStopped = false;
+bool gEnabled = false;
+
+// When the first of aapt's static initializers ran, on both clocks.
+nsecs_t gInitTime = 0;
+nsecs_t gInitBootTime = 0;
+
+// Ahead of the static initializers of the C++ code, which run at the
+// default priority.
+__attribute__((constructor(101))) void markInit()
+{
+    gInitTime = systemTime(SYSTEM_TIME_MONOTONIC);
+#if defined(__linux__)
+    // The clock the kernel times the start of processes on, which utils
+    // only reads where it has POSIX clocks.
+    struct timespec t;
+    if (clock_gettime(CLOCK_BOOTTIME, &t) == 0) {
+        gInitBootTime = (nsecs_t) t.tv_sec * 1000000000LL + t.tv_nsec;
+    }
+#endif
+}
+
+// The time from the start of the process to markInit(), or -1 where it
+// can't be told.  The kernel keeps the start in clock ticks, so this is
+// only good to a tick.
+nsecs_t getExecTime()
+{
+#if defined(__linux__)
+    FILE* fp = fopen("/proc/self/stat", "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    char line[1024];
+    const bool read = fgets(line, sizeof(line), fp) != NULL;
+    fclose(fp);
+    // The command name in parentheses may hold spaces; the fields after
+    // it don't.  The start time is the 22nd field, the 20th after it.
+    const char* p = read ? strrchr(line, ')') : NULL;
+    if (p == NULL) {
+        return -1;
+    }
+    for (int field = 0; field < 20 && p != NULL; field++) {
+        p = strchr(p + 1, ' ');
+    }
+    const long ticksPerSecond = sysconf(_SC_CLK_TCK);
+    if (p == NULL || ticksPerSecond <= 0 || gInitBootTime == 0) {
+        return -1;
+    }
+    const unsigned long long ticks = strtoull(p + 1, NULL, 10);
+    const nsecs_t start = (nsecs_t) (ticks * (1000000000ULL / ticksPerSecond));
+    return gInitBootTime > start ? gInitBootTime - start : 0;
+#else
+    return -1;
+#endif
+}
+
+bool earlierThan(const Mark& lhs, const Mark& rhs)
+{
+    return lhs.time < rhs.time;
+}
+
+void printStep(FILE* fp, const char* name, nsecs_t time, nsecs_t total)
+{
+    fprintf(fp, "    %-24s %9.3f %9.3f\n", name, time / 1000000.0, total / 1000000.0);
+}
+
+} // namespace
+
+namespace StartupProfile {
+
+void mark(const char* name)
+{
+    if (__atomic_load_n(&gStopped, __ATOMIC_RELAXED)) {
+        return;
+    }
+    const nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    const int index = __atomic_fetch_add(&gMarkCount, 1, __ATOMIC_RELAXED);
+    if (index < kMaxMarks) {
+        gMarks[index].name = name;
+        __atomic_store_n(&gMarks[index].time, now, __ATOMIC_RELEASE);
+    }
+}
+
+void stop()
+{
+    __atomic_store_n(&gStopped, true, __ATOMIC_RELAXED);
+}
+
+void enable()
+{
+    if (!__atomic_load_n(&gStopped, __ATOMIC_RELAXED)) {
+        gEnabled = true;
+    }
+}
+
+void report(FILE* fp)
+{
+    if (!__atomic_exchange_n(&gEnabled, false, __ATOMIC_RELAXED)) {
+        return;
+    }
+    stop();
+
+    fprintf(fp, "Startup, in ms:\n");
+    fprintf(fp, "    %-24s %9s %9s\n", "step", "time", "total");
+    nsecs_t total = 0;
+    const nsecs_t exec = getExecTime();
+    if (exec >= 0) {
+        total = exec;
+        printStep(fp, "exec", exec, total);
+    }
+
+    // Steps of other threads may have been marked out of order.
+    Mark marks[kMaxMarks];
+    int count = 0;
+    const int marked = std::min(__atomic_load_n(&gMarkCount, __ATOMIC_RELAXED), kMaxMarks);
+    for (int i = 0; i < marked; i++) {
+        const nsecs_t time = __atomic_load_n(&gMarks[i].time, __ATOMIC_ACQUIRE);
+        if (time != 0) {
+            marks[count].name = gMarks[i].name;
+            marks[count].time = time;
+            count++;
+        }
+    }
+    std::sort(marks, marks + count, earlierThan);
+
+    nsecs_t last = gInitTime;
+    for (int i = 0; i < count; i++) {
+        total += marks[i].time - last;
+        printStep(fp, marks[i].name, marks[i].time - last, total);
+        last = marks[i].time;
+    }
+}
+
+} // namespace StartupProfile
@@ -0,0 +1,39 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Where the time goes before a build gets to work, for --startup-profile.
+//
+
+#ifndef AAPT_STARTUP_PROFILE_H
+#define AAPT_STARTUP_PROFILE_H
+
+#include <stdio.h>
+
+/*
+ * Times the steps aapt takes from the start of the process up to the
+ * first real work of a build: loading and static initialization, option
+ * parsing, setting up, and opening the inputs and included packages.
+ * For a small library these can cost more than compiling it.
+ *
+ * Steps are always marked, since most happen before the options are
+ * parsed; a mark is a clock read and an atomic add.  Only the first
+ * steps of the process are kept, so a daemon stops marking once it is
+ * ready for requests.
+ */
+namespace StartupProfile {
+
+// Notes that the step "name" ended now.  "name" must be a string literal.
+void mark(const char* name);
+
+// Stops marking, when what comes next isn't startup.  Nothing is
+// reported after that.
+void stop();
+
+// Prints the steps marked so far to "fp", the first time it is called
+// after enable(), and stops marking.
+void enable();
+void report(FILE* fp);
+
+} // namespace StartupProfile
+
+#endif // AAPT_STARTUP_PROFILE_H
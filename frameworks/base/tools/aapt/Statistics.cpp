@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Statistics.h"
+
+#include <inttypes.h>
+
+namespace {
+
+struct CounterInfo {
+    const char* group;
+    const char* name;
+};
+
+// In the order of Statistics::Counter.
+const CounterInfo kCounters[Statistics::NUM_COUNTERS] = {
+    { "resource_id_cache", "hits" },
+    { "resource_id_cache", "misses" },
+    { "resource_id_cache", "collisions" },
+    { "resource_id_cache", "entries" },
+    { "resource_id_lookups", "included" },
+    { "resource_id_lookups", "local" },
+    { "resource_id_lookups", "attr_private" },
+    { "resource_id_lookups", "not_public" },
+    { "resource_id_lookups", "not_found" },
+    { "string_pools", "added" },
+    { "string_pools", "unique" },
+    { "strings", "parsed" },
+    { "strings", "plain" },
+    { "bags", "resolved" },
+    { "bags", "parents" },
+    { "bags", "keys" },
+    { "zip_entries", "deflated" },
+    { "zip_entries", "deflated_bytes_in" },
+    { "zip_entries", "deflated_bytes_out" },
+    { "zip_entries", "stored" },
+    { "zip_entries", "stored_bytes" },
+    { "zip_entries", "sampled_stored" },
+    { "compile_cache", "hits" },
+    { "compile_cache", "misses" },
+    { "deflate_cache", "hits" },
+    { "deflate_cache", "misses" },
+    { "remote_cache", "hits" },
+    { "remote_cache", "misses" },
+    { "remote_cache", "stores" },
+    { "readahead", "files" },
+    { "readahead", "bytes" },
+    { "readahead", "late" },
+    { "memory_budget", "reservations" },
+    { "memory_budget", "waits" },
+};
+
+// "part" as a percentage of "whole".
+double percent(uint64_t part, uint64_t whole)
+{
+    return whole != 0 ? part * 100.0 / whole : 0.0;
+}
+
+} // namespace
+
+namespace Statistics {
+
+uint64_t gCounts[NUM_COUNTERS];
+
+uint64_t get(Counter counter)
+{
+    return __atomic_load_n(&gCounts[counter], __ATOMIC_RELAXED);
+}
+
+const char* name(Counter counter)
+{
+    return kCounters[counter].name;
+}
+
+const char* groupName(Counter counter)
+{
+    return kCounters[counter].group;
+}
+
+void reset()
+{
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        __atomic_store_n(&gCounts[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+void print(FILE* fp)
+{
+    const uint64_t hits = get(ID_CACHE_HITS);
+    const uint64_t misses = get(ID_CACHE_MISSES);
+    fprintf(fp, "Statistics:\n");
+    fprintf(fp, "    Resource ID cache: %" PRIu64 " hits, %" PRIu64 " misses (%.1f%% hits), "
+            "%" PRIu64 " collisions, %" PRIu64 " entries\n",
+            hits, misses, percent(hits, hits + misses), get(ID_CACHE_COLLISIONS),
+            get(ID_CACHE_ENTRIES));
+    fprintf(fp, "    Resource IDs looked up: %" PRIu64 " included, %" PRIu64 " local "
+            "(%" PRIu64 " as ^attr-private), %" PRIu64 " not public, %" PRIu64 " not found\n",
+            get(ID_LOOKUP_INCLUDED), get(ID_LOOKUP_LOCAL) + get(ID_LOOKUP_ATTR_PRIVATE),
+            get(ID_LOOKUP_ATTR_PRIVATE), get(ID_LOOKUP_NOT_PUBLIC), get(ID_LOOKUP_NOT_FOUND));
+
+    const uint64_t added = get(POOL_STRINGS_ADDED);
+    const uint64_t unique = get(POOL_STRINGS_UNIQUE);
+    fprintf(fp, "    String pools: %" PRIu64 " strings added, %" PRIu64 " unique "
+            "(%.1f%% duplicates)\n",
+            added, unique, percent(added - unique, added));
+
+    const uint64_t parsed = get(STRINGS_PARSED);
+    const uint64_t plain = get(STRINGS_PLAIN);
+    fprintf(fp, "    Strings parsed: %" PRIu64 ", %" PRIu64 " plain (%.1f%%)\n",
+            parsed, plain, percent(plain, parsed));
+
+    fprintf(fp, "    Bags resolved: %" PRIu64 ", with %" PRIu64 " parents and %" PRIu64 " keys\n",
+            get(BAGS_RESOLVED), get(BAG_PARENTS), get(BAG_KEYS));
+
+    const uint64_t bytesIn = get(ZIP_DEFLATED_BYTES_IN);
+    const uint64_t bytesOut = get(ZIP_DEFLATED_BYTES_OUT);
+    fprintf(fp, "    Zip entries: %" PRIu64 " deflated, %" PRIu64 " to %" PRIu64 " bytes "
+            "(%.1f%%); %" PRIu64 " stored, %" PRIu64 " bytes, %" PRIu64 " of them "
+            "by sampling\n",
+            get(ZIP_DEFLATED_ENTRIES), bytesIn, bytesOut, percent(bytesOut, bytesIn),
+            get(ZIP_STORED_ENTRIES), get(ZIP_STORED_BYTES), get(ZIP_SAMPLED_STORED));
+
+    const uint64_t compileHits = get(COMPILE_CACHE_HITS);
+    const uint64_t compileMisses = get(COMPILE_CACHE_MISSES);
+    if (compileHits + compileMisses > 0) {
+        fprintf(fp, "    Compile cache: %" PRIu64 " hits, %" PRIu64 " misses (%.1f%% hits)\n",
+                compileHits, compileMisses, percent(compileHits, compileHits + compileMisses));
+    }
+
+    const uint64_t deflateHits = get(DEFLATE_CACHE_HITS);
+    const uint64_t deflateMisses = get(DEFLATE_CACHE_MISSES);
+    if (deflateHits + deflateMisses > 0) {
+        fprintf(fp, "    Deflate cache: %" PRIu64 " hits, %" PRIu64 " misses (%.1f%% hits)\n",
+                deflateHits, deflateMisses, percent(deflateHits, deflateHits + deflateMisses));
+    }
+
+    const uint64_t remoteHits = get(REMOTE_CACHE_HITS);
+    const uint64_t remoteMisses = get(REMOTE_CACHE_MISSES);
+    if (remoteHits + remoteMisses + get(REMOTE_CACHE_STORES) > 0) {
+        fprintf(fp, "    Remote cache: %" PRIu64 " hits, %" PRIu64 " misses (%.1f%% hits), "
+                "%" PRIu64 " stored\n",
+                remoteHits, remoteMisses, percent(remoteHits, remoteHits + remoteMisses),
+                get(REMOTE_CACHE_STORES));
+    }
+
+    if (get(READAHEAD_FILES) + get(READAHEAD_LATE) > 0) {
+        fprintf(fp, "    Readahead: %" PRIu64 " files, %" PRIu64 " bytes; %" PRIu64 " files "
+                "opened before it got to them\n",
+                get(READAHEAD_FILES), get(READAHEAD_BYTES), get(READAHEAD_LATE));
+    }
+
+    if (get(MEMORY_RESERVATIONS) > 0) {
+        fprintf(fp, "    Memory budget: %" PRIu64 " reservations, %" PRIu64 " of them "
+                "waited for memory\n",
+                get(MEMORY_RESERVATIONS), get(MEMORY_WAITS));
+    }
+}
+
+} // namespace Statistics
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef H_AAPT_STATISTICS
+#define H_AAPT_STATISTICS
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Counts of what the caches and lookups of a build did, for tuning them.
+ * They are printed at the end of "aapt package -v" and written to the
+ * --trace-output file.
+ *
+ * Counting is always on; add() is one relaxed atomic add, from any thread.
+ */
+namespace Statistics {
+
+// Counters of one group are consecutive and share a group name.
+enum Counter {
+    // ResourceIdCache
+    ID_CACHE_HITS,
+    ID_CACHE_MISSES,
+    ID_CACHE_COLLISIONS,
+    ID_CACHE_ENTRIES,
+
+    // How ResourceTable::getResId() found the IDs the cache did not have
+    ID_LOOKUP_INCLUDED,         // in the included resources
+    ID_LOOKUP_LOCAL,            // in the table being built
+    ID_LOOKUP_ATTR_PRIVATE,     // in the table, after retrying as ^attr-private
+    ID_LOOKUP_NOT_PUBLIC,       // included, but not public when that was asked for
+    ID_LOOKUP_NOT_FOUND,
+
+    // StringPool::add()
+    POOL_STRINGS_ADDED,
+    POOL_STRINGS_UNIQUE,
+
+    // parseStyledString()
+    STRINGS_PARSED,
+    STRINGS_PLAIN,              // taken as they were, with nothing to parse
+
+    // Bags whose parent and keys were resolved
+    BAGS_RESOLVED,
+    BAG_PARENTS,
+    BAG_KEYS,
+
+    // Zip entries written
+    ZIP_DEFLATED_ENTRIES,
+    ZIP_DEFLATED_BYTES_IN,
+    ZIP_DEFLATED_BYTES_OUT,
+    ZIP_STORED_ENTRIES,
+    ZIP_STORED_BYTES,
+    ZIP_SAMPLED_STORED,         // stored because a sample didn't deflate
+
+    // Crunched images and parsed values files kept in the --resource-cache
+    COMPILE_CACHE_HITS,
+    COMPILE_CACHE_MISSES,
+
+    // Deflated files kept in the --resource-cache
+    DEFLATE_CACHE_HITS,
+    DEFLATE_CACHE_MISSES,
+
+    // RemoteCache
+    REMOTE_CACHE_HITS,
+    REMOTE_CACHE_MISSES,
+    REMOTE_CACHE_STORES,
+
+    // Readahead of source files
+    READAHEAD_FILES,            // asked for ahead of their turn
+    READAHEAD_BYTES,
+    READAHEAD_LATE,             // opened before the readahead got to them
+
+    // MemoryBudget
+    MEMORY_RESERVATIONS,
+    MEMORY_WAITS,               // reservations that waited for memory to be released
+
+    NUM_COUNTERS
+};
+
+// Storage for add(), which is inline since it is called on hot paths.
+extern uint64_t gCounts[NUM_COUNTERS];
+
+inline void add(Counter counter, uint64_t n = 1)
+{
+    __atomic_add_fetch(&gCounts[counter], n, __ATOMIC_RELAXED);
+}
+
+uint64_t get(Counter counter);
+
+// The name of the counter, and of its group, as written to the trace.
+const char* name(Counter counter);
+const char* groupName(Counter counter);
+
+// Zeroes every count, when a daemon starts another build.
+void reset();
+
+void print(FILE* fp);
+
+} // namespace Statistics
+
+#endif // H_AAPT_STATISTICS
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "StringAtoms.h"
+
+#include <string.h>
+
+#include <utils/BasicHashtable.h>
+#include <utils/JenkinsHash.h>
+#include <utils/Mutex.h>
+#include <utils/Unicode.h>
+
+using android::AutoMutex;
+using android::BasicHashtable;
+using android::Mutex;
+using android::String16;
+
+namespace {
+
+// The characters of a string being looked up, which need not be in a
+// String16 yet.
+struct AtomKey {
+    AtomKey(const char16_t* _str, size_t _len) : str(_str), len(_len) { }
+
+    bool operator==(const AtomKey& o) const {
+        return len == o.len && memcmp(str, o.str, len * sizeof(char16_t)) == 0;
+    }
+
+    const char16_t* str;
+    size_t len;
+};
+
+struct AtomEntry {
+    explicit AtomEntry(const String16* _atom) : atom(_atom) { }
+    AtomKey getKey() const { return AtomKey(atom->string(), atom->size()); }
+
+    // Never freed, so that references to it stay good.
+    const String16* atom;
+};
+
+// Strings up to this long are converted from UTF-8 on the stack.
+const size_t kMaxStackChars = 128;
+
+Mutex gAtomsLock;
+BasicHashtable<AtomKey, AtomEntry>* gAtoms = NULL;
+
+} // namespace
+
+namespace StringAtoms {
+
+const String16& intern(const char16_t* str, size_t len)
+{
+    // Same as hash_type(String16).
+    const AtomKey key(str, len);
+    const android::hash_t hash = android::JenkinsHashWhiten(
+            android::JenkinsHashMixShorts(0, (const uint16_t*) str, len));
+
+    AutoMutex _l(gAtomsLock);
+    if (gAtoms == NULL) {
+        gAtoms = new BasicHashtable<AtomKey, AtomEntry>();
+    }
+    ssize_t idx = gAtoms->find(-1, hash, key);
+    if (idx >= 0) {
+        return *gAtoms->entryAt(idx).atom;
+    }
+    const String16* atom = new String16(str, len);
+    gAtoms->add(hash, AtomEntry(atom));
+    return *atom;
+}
+
+const String16& intern(const String16& str)
+{
+    return intern(str.string(), str.size());
+}
+
+const String16& intern(const char* str, size_t len)
+{
+    const ssize_t len16 = utf8_to_utf16_length((const uint8_t*) str, len);
+    if (len16 < 0 || (size_t) len16 > kMaxStackChars) {
+        return intern(String16(str, len));
+    }
+    char16_t buf[kMaxStackChars];
+    utf8_to_utf16_no_null_terminator((const uint8_t*) str, len, buf);
+    return intern(buf, len16);
+}
+
+const String16& intern(const char* str)
+{
+    return intern(str, strlen(str));
+}
+
+} // namespace StringAtoms
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef H_AAPT_STRING_ATOMS
+#define H_AAPT_STRING_ATOMS
+
+#include <stddef.h>
+#include <utils/String16.h>
+
+/*
+ * One shared String16 for each distinct name aapt keeps seeing: element
+ * and attribute names, namespace URIs, resource types and packages.
+ *
+ * intern() returns the same String16 for equal strings, for the life of
+ * the process.  Copies of it share its buffer instead of allocating, and
+ * two interned strings compare equal by String16's pointer check without
+ * looking at their characters.  Only intern names, not values: nothing
+ * is ever freed.  Safe to call from any thread.
+ */
+namespace StringAtoms {
+
+const android::String16& intern(const char16_t* str, size_t len);
+const android::String16& intern(const android::String16& str);
+
+// Converts from UTF-8 only when the string is not already interned.
+const android::String16& intern(const char* str, size_t len);
+const android::String16& intern(const char* str);
+
+} // namespace StringAtoms
+
+#endif // H_AAPT_STRING_ATOMS
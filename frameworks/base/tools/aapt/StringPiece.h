@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef H_AAPT_STRING_PIECE
+#define H_AAPT_STRING_PIECE
+
+#include <stddef.h>
+#include <string.h>
+#include <utils/String8.h>
+#include <utils/String16.h>
+
+/*
+ * UTF-16 characters that belong to someone else: all or part of a
+ * String16, handed to code that only reads it, without making a new
+ * String16.  The characters must outlive the piece.
+ */
+class StringPiece16 {
+public:
+    StringPiece16() : mData(NULL), mSize(0) { }
+    StringPiece16(const android::String16& str) : mData(str.string()), mSize(str.size()) { }
+    StringPiece16(const char16_t* data, size_t size) : mData(data), mSize(size) { }
+
+    const char16_t* data() const { return mData; }
+    size_t size() const { return mSize; }
+    bool empty() const { return mSize == 0; }
+
+    // The characters from 'start' to the end.
+    StringPiece16 substr(size_t start) const {
+        return start < mSize ? StringPiece16(mData + start, mSize - start) : StringPiece16();
+    }
+
+    bool startsWith(const StringPiece16& prefix) const {
+        return prefix.mSize <= mSize
+                && memcmp(mData, prefix.mData, prefix.mSize * sizeof(char16_t)) == 0;
+    }
+
+    bool operator==(const StringPiece16& o) const {
+        return mSize == o.mSize && memcmp(mData, o.mData, mSize * sizeof(char16_t)) == 0;
+    }
+    bool operator!=(const StringPiece16& o) const { return !(*this == o); }
+
+    android::String16 toString16() const {
+        return mSize > 0 ? android::String16(mData, mSize) : android::String16();
+    }
+    android::String8 toString8() const {
+        return mSize > 0 ? android::String8(mData, mSize) : android::String8();
+    }
+
+private:
+    const char16_t* mData;
+    size_t mSize;
+};
+
+#endif // H_AAPT_STRING_PIECE
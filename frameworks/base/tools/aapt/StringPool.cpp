@@ -6,11 +6,14 @@
 #include "StringPool.h"
 
 #include <utils/ByteOrder.h>
+#include <utils/JenkinsHash.h>
 #include <utils/SortedVector.h>
 
 #include <algorithm>
+#include <vector>
 
 #include "ResourceTable.h"
+#include "Statistics.h"
 
 // SSIZE: mingw does not have signed size_t == ssize_t.
 #if !defined(_WIN32)
@@ -127,10 +130,40 @@ int StringPool::entry::compare(const entry& o) const {
 }
 
 StringPool::StringPool(bool utf8) :
-        mUTF8(utf8), mValues(-1)
+        mUTF8(utf8), mAccount(MemStats::STRING_POOLS)
 {
 }
 
+hash_t StringPool::hashValue(const String16& value)
+{
+    return JenkinsHashWhiten(JenkinsHashMixShorts(0,
+            (const uint16_t*) value.string(), value.size()));
+}
+
+hash_t StringPool::hashValue(const String8& value)
+{
+    return JenkinsHashWhiten(JenkinsHashMixBytes(0,
+            (const uint8_t*) value.string(), value.size()));
+}
+
+ssize_t StringPool::findValue(const String16& value, hash_t hash) const
+{
+    ssize_t idx = mValues.find(-1, hash, value);
+    return idx >= 0 ? mValues.entryAt(idx).pos : -1;
+}
+
+ssize_t StringPool::findValue(const String8& value, hash_t hash) const
+{
+    ssize_t idx = mValues8.find(-1, hash, UTF8Key(value));
+    return idx >= 0 ? mValues8.entryAt(idx).pos : -1;
+}
+
+// The string of "ent", in UTF-8, for messages.
+static String8 entryString(const StringPool::entry& ent)
+{
+    return ent.value.size() > 0 ? String8(ent.value) : ent.value8;
+}
+
 ssize_t StringPool::add(const String16& value, const Vector<entry_style_span>& spans,
         const String8* configTypeName, const ResTable_config* config)
 {
@@ -144,17 +177,75 @@ ssize_t StringPool::add(const String16& value, const Vector<entry_style_span>& s
 ssize_t StringPool::add(const String16& value,
         bool mergeDuplicates, const String8* configTypeName, const ResTable_config* config)
 {
-    ssize_t vidx = mValues.indexOfKey(value);
-    ssize_t pos = vidx >= 0 ? mValues.valueAt(vidx) : -1;
+    if (mUTF8) {
+        return addUTF8(String8(value), value.size(), mergeDuplicates, configTypeName, config);
+    }
+
+    const hash_t hash = hashValue(value);
+    ssize_t pos = findValue(value, hash);
     ssize_t eidx = pos >= 0 ? mEntryArray.itemAt(pos) : -1;
+    Statistics::add(Statistics::POOL_STRINGS_ADDED);
     if (eidx < 0) {
         eidx = mEntries.add(entry(value));
         if (eidx < 0) {
             fprintf(stderr, "Failure adding string %s\n", String8(value).string());
             return eidx;
         }
+        mAccount.add(sizeof(entry) + value.size() * sizeof(char16_t));
+        Statistics::add(Statistics::POOL_STRINGS_UNIQUE);
+    }
+
+    const bool first = pos < 0;
+    pos = addUse(pos, eidx, mergeDuplicates, configTypeName, config);
+    if (first) {
+        mValues.add(hash, ValueIndexEntry<String16>(value, pos));
+    }
+    return pos;
+}
+
+ssize_t StringPool::add(const String8& value,
+        bool mergeDuplicates, const String8* configTypeName, const ResTable_config* config)
+{
+    if (!mUTF8) {
+        return add(String16(value), mergeDuplicates, configTypeName, config);
+    }
+    return addUTF8(value, utf8_to_utf16_length((const uint8_t*) value.string(), value.size()),
+            mergeDuplicates, configTypeName, config);
+}
+
+ssize_t StringPool::addUTF8(const String8& value, ssize_t length16,
+        bool mergeDuplicates, const String8* configTypeName, const ResTable_config* config)
+{
+    if (length16 < 0) {
+        // Not valid UTF-8.
+        return addUTF8(String8(), 0, mergeDuplicates, configTypeName, config);
+    }
+
+    const hash_t hash = hashValue(value);
+    ssize_t pos = findValue(value, hash);
+    ssize_t eidx = pos >= 0 ? mEntryArray.itemAt(pos) : -1;
+    Statistics::add(Statistics::POOL_STRINGS_ADDED);
+    if (eidx < 0) {
+        eidx = mEntries.add(entry(value, length16));
+        if (eidx < 0) {
+            fprintf(stderr, "Failure adding string %s\n", value.string());
+            return eidx;
+        }
+        mAccount.add(sizeof(entry) + value.size());
+        Statistics::add(Statistics::POOL_STRINGS_UNIQUE);
     }
 
+    const bool first = pos < 0;
+    pos = addUse(pos, eidx, mergeDuplicates, configTypeName, config);
+    if (first) {
+        mValues8.add(hash, ValueIndexEntry<UTF8Key>(UTF8Key(value), pos));
+    }
+    return pos;
+}
+
+ssize_t StringPool::addUse(ssize_t pos, size_t eidx,
+        bool mergeDuplicates, const String8* configTypeName, const ResTable_config* config)
+{
     if (configTypeName != NULL) {
         entry& ent = mEntries.editItemAt(eidx);
         if (kIsDebug) {
@@ -192,21 +283,18 @@ ssize_t StringPool::add(const String16& value,
         }
     }
 
-    const bool first = vidx < 0;
+    const bool first = pos < 0;
     const bool styled = (pos >= 0 && (size_t)pos < mEntryStyleArray.size()) ?
         mEntryStyleArray[pos].spans.size() : 0;
     if (first || styled || !mergeDuplicates) {
         pos = mEntryArray.add(eidx);
-        if (first) {
-            vidx = mValues.add(value, pos);
-        }
         entry& ent = mEntries.editItemAt(eidx);
         ent.indices.add(pos);
     }
 
     if (kIsDebug) {
-        printf("Adding string %s to pool: pos=%zd eidx=%zd vidx=%zd\n",
-                String8(value).string(), SSIZE(pos), SSIZE(eidx), SSIZE(vidx));
+        printf("Adding string %s to pool: pos=%zd eidx=%zd first=%d\n",
+                entryString(mEntries[eidx]).string(), SSIZE(pos), SSIZE(eidx), first);
     }
 
     return pos;
@@ -247,15 +335,115 @@ status_t StringPool::addStyleSpan(size_t idx, const entry_style_span& span)
     return NO_ERROR;
 }
 
-StringPool::ConfigSorter::ConfigSorter(const StringPool& pool) : pool(pool)
+namespace {
+
+// The type and configurations of an unstyled entry, compared byte for byte.
+struct ConfigKey {
+    explicit ConfigKey(const StringPool::entry& e) : ent(&e) { }
+
+    bool operator==(const ConfigKey& o) const {
+        return ent->configTypeName == o.ent->configTypeName
+                && ent->configs.size() == o.ent->configs.size()
+                && memcmp(ent->configs.array(), o.ent->configs.array(),
+                        ent->configs.size() * sizeof(ResTable_config)) == 0;
+    }
+
+    hash_t hash() const {
+        uint32_t h = JenkinsHashMixBytes(0, (const uint8_t*) ent->configTypeName.string(),
+                ent->configTypeName.size());
+        h = JenkinsHashMixBytes(h, (const uint8_t*) ent->configs.array(),
+                ent->configs.size() * sizeof(ResTable_config));
+        return JenkinsHashWhiten(h);
+    }
+
+    const StringPool::entry* ent;
+};
+
+struct ConfigGroup {
+    ConfigGroup(const ConfigKey& _key, size_t _group) : key(_key), group(_group) { }
+    const ConfigKey& getKey() const { return key; }
+
+    ConfigKey key;
+    size_t group;
+};
+
+struct GroupSorter {
+    GroupSorter(const Vector<StringPool::entry>& _entries, const Vector<size_t>& _firsts)
+        : entries(_entries), firsts(_firsts) { }
+    bool operator()(size_t l, size_t r) const {
+        return entries[firsts[l]].compare(entries[firsts[r]]) < 0;
+    }
+
+    const Vector<StringPool::entry>& entries;
+    const Vector<size_t>& firsts;
+};
+
+} // namespace
+
+void StringPool::rankEntries(Vector<uint32_t>* outRanks) const
+{
+    // Entries with the same type and configurations compare equal, and
+    // there are few such groups however large the pool is, so entry::compare()
+    // is only needed to order one entry of each.
+    const size_t N = mEntries.size();
+    Vector<size_t> groupOf;
+    groupOf.setCapacity(N);
+    Vector<size_t> firsts;
+    BasicHashtable<ConfigKey, ConfigGroup> groups;
+    for (size_t i=0; i<N; i++) {
+        const entry& ent = mEntries[i];
+        if (ent.hasStyles) {
+            // Styled strings go first, all alike.
+            groupOf.add(-1);
+            continue;
+        }
+        const ConfigKey key(ent);
+        const hash_t hash = key.hash();
+        const ssize_t idx = groups.find(-1, hash, key);
+        if (idx >= 0) {
+            groupOf.add(groups.entryAt(idx).group);
+            continue;
+        }
+        groupOf.add(firsts.size());
+        groups.add(hash, ConfigGroup(key, firsts.size()));
+        firsts.add(i);
+    }
+
+    // Different bytes can still be the same logical configurations, so
+    // neighbours that compare equal share a rank.
+    const size_t G = firsts.size();
+    Vector<size_t> order;
+    order.setCapacity(G);
+    for (size_t g=0; g<G; g++) {
+        order.add(g);
+    }
+    GroupSorter sorter(mEntries, firsts);
+    std::sort(order.editArray(), order.editArray() + G, sorter);
+    Vector<uint32_t> groupRanks;
+    groupRanks.insertAt(0, 0, G);
+    uint32_t rank = 0;
+    for (size_t i=0; i<G; i++) {
+        if (i == 0 || sorter(order[i-1], order[i])) {
+            rank++;
+        }
+        groupRanks.editItemAt(order[i]) = rank;
+    }
+
+    outRanks->clear();
+    outRanks->setCapacity(N);
+    for (size_t i=0; i<N; i++) {
+        outRanks->add(groupOf[i] == (size_t) -1 ? 0 : groupRanks[groupOf[i]]);
+    }
+}
+
+StringPool::ConfigSorter::ConfigSorter(const StringPool& pool, const Vector<uint32_t>& ranks)
+    : pool(pool), ranks(ranks)
 {
 }
 
 bool StringPool::ConfigSorter::operator()(size_t l, size_t r)
 {
-    const StringPool::entry& lhe = pool.mEntries[pool.mEntryArray[l]];
-    const StringPool::entry& rhe = pool.mEntries[pool.mEntryArray[r]];
-    return lhe.compare(rhe) < 0;
+    return ranks[pool.mEntryArray[l]] < ranks[pool.mEntryArray[r]];
 }
 
 void StringPool::sortByConfig()
@@ -278,7 +466,9 @@ void StringPool::sortByConfig()
     if (kIsDebug) {
         printf("SORTING STRINGS BY CONFIGURATION...\n");
     }
-    ConfigSorter sorter(*this);
+    Vector<uint32_t> ranks;
+    rankEntries(&ranks);
+    ConfigSorter sorter(*this, ranks);
     std::sort(newPosToOriginalPos.begin(), newPosToOriginalPos.end(), sorter);
     if (kIsDebug) {
         printf("DONE SORTING STRINGS BY CONFIGURATION.\n");
@@ -365,9 +555,16 @@ void StringPool::sortByConfig()
     mEntryArray = newEntryArray;
     mEntryStyleArray = newEntryStyleArray;
     mValues.clear();
+    mValues8.clear();
     for (size_t i=0; i<mEntries.size(); i++) {
         const entry& ent = mEntries[i];
-        mValues.add(ent.value, ent.indices[0]);
+        if (mUTF8) {
+            mValues8.add(hashValue(ent.value8),
+                    ValueIndexEntry<UTF8Key>(UTF8Key(ent.value8), ent.indices[0]));
+        } else {
+            mValues.add(hashValue(ent.value),
+                    ValueIndexEntry<String16>(ent.value, ent.indices[0]));
+        }
     }
 
 #if 0
@@ -375,7 +572,7 @@ void StringPool::sortByConfig()
     for (size_t i=0; i<mEntries.size(); i++) {
         const entry& ent = mEntries[i];
         printf("#" ZD " %s: %s\n", (ZD_TYPE)i, ent.makeConfigsString().string(),
-                String8(ent.value).string());
+                entryString(ent).string());
     }
 #endif
 }
@@ -435,95 +632,92 @@ status_t StringPool::writeStringBlock(const sp<AaptFile>& pool)
 
     const size_t ENTRIES = mEntryArray.size();
 
-    // Now build the pool of unique strings.
+    // Lay out the pool of unique strings and the style spans first, so the
+    // block is allocated once and everything is written straight into place.
 
     const size_t STRINGS = mEntries.size();
     const size_t preSize = sizeof(ResStringPool_header)
                          + (sizeof(uint32_t)*ENTRIES)
                          + (sizeof(uint32_t)*STYLES);
-    if (pool->editData(preSize) == NULL) {
-        fprintf(stderr, "ERROR: Out of memory for string pool\n");
-        return NO_MEMORY;
-    }
 
     const size_t charSize = mUTF8 ? sizeof(uint8_t) : sizeof(uint16_t);
+    const size_t maxShortLength = (size_t)(1<<((charSize*8)-1))-1;
 
     size_t strPos = 0;
     for (i=0; i<STRINGS; i++) {
         entry& ent = mEntries.editItemAt(i);
-        const size_t strSize = (ent.value.size());
-        const size_t lenSize = strSize > (size_t)(1<<((charSize*8)-1))-1 ?
-            charSize*2 : charSize;
+        const size_t strSize = ent.length16;
+        const size_t lenSize = strSize > maxShortLength ? charSize*2 : charSize;
 
-        String8 encStr;
+        size_t encSize = 0;
+        size_t encLenSize = 0;
         if (mUTF8) {
-            encStr = String8(ent.value);
+            encSize = ent.value8.size();
+            encLenSize = encSize > maxShortLength ? charSize*2 : charSize;
         }
 
-        const size_t encSize = mUTF8 ? encStr.size() : 0;
-        const size_t encLenSize = mUTF8 ?
-            (encSize > (size_t)(1<<((charSize*8)-1))-1 ?
-                charSize*2 : charSize) : 0;
-
         ent.offset = strPos;
+        strPos += lenSize + encLenSize + ((mUTF8 ? encSize : strSize)+1)*charSize;
+    }
+    const size_t strEnd = strPos;
 
-        const size_t totalSize = lenSize + encLenSize +
-            ((mUTF8 ? encSize : strSize)+1)*charSize;
+    // Pad ending string position up to a uint32_t boundary.
+    strPos = (strPos+3)&~0x3;
 
-        void* dat = (void*)pool->editData(preSize + strPos + totalSize);
-        if (dat == NULL) {
-            fprintf(stderr, "ERROR: Out of memory for string pool\n");
-            return NO_MEMORY;
-        }
-        dat = (uint8_t*)dat + preSize + strPos;
+    size_t styPos = strPos;
+    for (i=0; i<STYLES; i++) {
+        entry_style& ent = mEntryStyleArray.editItemAt(i);
+        ent.offset = styPos-strPos;
+        styPos += (ent.spans.size()*sizeof(ResStringPool_span)) + sizeof(ResStringPool_ref);
+    }
+    // Room for a full terminator at the end (when reading we validate that
+    // the end of the pool is fully terminated to simplify error checking).
+    const size_t extra = STYLES > 0
+            ? sizeof(ResStringPool_span)-sizeof(ResStringPool_ref) : 0;
+
+    const size_t poolSize = preSize + styPos + extra;
+    uint8_t* const base = pool->reserveData(poolSize) == NO_ERROR
+            ? (uint8_t*)pool->editData(poolSize) : NULL;
+    if (base == NULL) {
+        fprintf(stderr, "ERROR: Out of memory for string pool\n");
+        return NO_MEMORY;
+    }
+
+    // Now build the pool of unique strings.
+
+    for (i=0; i<STRINGS; i++) {
+        const entry& ent = mEntries[i];
+        const size_t strSize = ent.length16;
+        void* dat = base + preSize + ent.offset;
         if (mUTF8) {
             uint8_t* strings = (uint8_t*)dat;
+            const size_t encSize = ent.value8.size();
 
             ENCODE_LENGTH(strings, sizeof(uint8_t), strSize)
 
             ENCODE_LENGTH(strings, sizeof(uint8_t), encSize)
 
-            strncpy((char*)strings, encStr, encSize+1);
+            memcpy(strings, ent.value8.string(), encSize + 1);
         } else {
             char16_t* strings = (char16_t*)dat;
 
             ENCODE_LENGTH(strings, sizeof(char16_t), strSize)
 
-            strcpy16_htod(strings, ent.value);
-        }
-
-        strPos += totalSize;
-    }
-
-    // Pad ending string position up to a uint32_t boundary.
-
-    if (strPos&0x3) {
-        size_t padPos = ((strPos+3)&~0x3);
-        uint8_t* dat = (uint8_t*)pool->editData(preSize + padPos);
-        if (dat == NULL) {
-            fprintf(stderr, "ERROR: Out of memory padding string pool\n");
-            return NO_MEMORY;
+            const char16_t* src = ent.value.string();
+            for (size_t j=0; j<strSize; j++) {
+                *strings++ = htods(src[j]);
+            }
+            *strings = 0;
         }
-        memset(dat+preSize+strPos, 0, padPos-strPos);
-        strPos = padPos;
     }
+    memset(base + preSize + strEnd, 0, strPos - strEnd);
 
     // Build the pool of style spans.
 
-    size_t styPos = strPos;
     for (i=0; i<STYLES; i++) {
-        entry_style& ent = mEntryStyleArray.editItemAt(i);
+        const entry_style& ent = mEntryStyleArray[i];
         const size_t N = ent.spans.size();
-        const size_t totalSize = (N*sizeof(ResStringPool_span))
-                               + sizeof(ResStringPool_ref);
-
-        ent.offset = styPos-strPos;
-        uint8_t* dat = (uint8_t*)pool->editData(preSize + styPos + totalSize);
-        if (dat == NULL) {
-            fprintf(stderr, "ERROR: Out of memory for string styles\n");
-            return NO_MEMORY;
-        }
-        ResStringPool_span* span = (ResStringPool_span*)(dat+preSize+styPos);
+        ResStringPool_span* span = (ResStringPool_span*)(base + preSize + strPos + ent.offset);
         for (size_t i=0; i<N; i++) {
             span->name.index = htodl(ent.spans[i].span.name.index);
             span->firstChar = htodl(ent.spans[i].span.firstChar);
@@ -531,26 +725,11 @@ status_t StringPool::writeStringBlock(const sp<AaptFile>& pool)
             span++;
         }
         span->name.index = htodl(ResStringPool_span::END);
-
-        styPos += totalSize;
     }
 
-    if (STYLES > 0) {
-        // Add full terminator at the end (when reading we validate that
-        // the end of the pool is fully terminated to simplify error
-        // checking).
-        size_t extra = sizeof(ResStringPool_span)-sizeof(ResStringPool_ref);
-        uint8_t* dat = (uint8_t*)pool->editData(preSize + styPos + extra);
-        if (dat == NULL) {
-            fprintf(stderr, "ERROR: Out of memory for string styles\n");
-            return NO_MEMORY;
-        }
-        uint32_t* p = (uint32_t*)(dat+preSize+styPos);
-        while (extra > 0) {
-            *p++ = htodl(ResStringPool_span::END);
-            extra -= sizeof(uint32_t);
-        }
-        styPos += extra;
+    uint32_t* p = (uint32_t*)(base + preSize + styPos);
+    for (size_t left = extra; left > 0; left -= sizeof(uint32_t)) {
+        *p++ = htodl(ResStringPool_span::END);
     }
 
     // Write header.
@@ -582,7 +761,7 @@ status_t StringPool::writeStringBlock(const sp<AaptFile>& pool)
         if (kIsDebug) {
             printf("Writing entry #%zu: \"%s\" ent=%zu off=%zu\n",
                     i,
-                    String8(ent.value).string(),
+                    entryString(ent).string(),
                     mEntryArray[i],
                     ent.offset);
         }
@@ -603,14 +782,29 @@ ssize_t StringPool::offsetForString(const String16& val) const
     ssize_t res = indices != NULL && indices->size() > 0 ? indices->itemAt(0) : -1;
     if (kIsDebug) {
         printf("Offset for string %s: %zd (%s)\n", String8(val).string(), SSIZE(res),
-                res >= 0 ? String8(mEntries[mEntryArray[res]].value).string() : String8());
+                res >= 0 ? entryString(mEntries[mEntryArray[res]]).string() : "");
     }
     return res;
 }
 
 const Vector<size_t>* StringPool::offsetsForString(const String16& val) const
 {
-    ssize_t pos = mValues.valueFor(val);
+    if (mUTF8) {
+        return offsetsForString(String8(val));
+    }
+    ssize_t pos = findValue(val, hashValue(val));
+    if (pos < 0) {
+        return NULL;
+    }
+    return &mEntries[mEntryArray[pos]].indices;
+}
+
+const Vector<size_t>* StringPool::offsetsForString(const String8& val) const
+{
+    if (!mUTF8) {
+        return offsetsForString(String16(val));
+    }
+    ssize_t pos = findValue(val, hashValue(val));
     if (pos < 0) {
         return NULL;
     }
@@ -9,9 +9,12 @@
 
 #include "Main.h"
 #include "AaptAssets.h"
+#include "MemStats.h"
 
 #include <androidfw/ResourceTypes.h>
+#include <utils/BasicHashtable.h>
 #include <utils/String16.h>
+#include <utils/String8.h>
 #include <utils/TypeHelpers.h>
 
 #include <sys/types.h>
@@ -19,6 +22,7 @@
 #include <fcntl.h>
 #include <ctype.h>
 #include <errno.h>
+#include <string.h>
 
 using namespace android;
 
@@ -40,13 +44,28 @@ class StringPool
 {
 public:
     struct entry {
-        entry() : offset(0) { }
-        entry(const String16& _value) : value(_value), offset(0), hasStyles(false) { }
-        entry(const entry& o) : value(o.value), offset(o.offset),
-                hasStyles(o.hasStyles), indices(o.indices),
+        entry() : length16(0), offset(0) { }
+        entry(const String16& _value) : value(_value), length16(_value.size()), offset(0),
+                hasStyles(false) { }
+        entry(const String8& _value8, size_t _length16) : value8(_value8),
+                length16(_length16), offset(0), hasStyles(false) { }
+        entry(const entry& o) : value(o.value), value8(o.value8), length16(o.length16),
+                offset(o.offset), hasStyles(o.hasStyles), indices(o.indices),
                 configTypeName(o.configTypeName), configs(o.configs) { }
+        entry(entry&& o) : value(std::move(o.value)), value8(std::move(o.value8)),
+                length16(o.length16), offset(o.offset),
+                hasStyles(o.hasStyles), indices(std::move(o.indices)),
+                configTypeName(std::move(o.configTypeName)), configs(std::move(o.configs)) { }
 
+        entry& operator=(const entry& o) = default;
+        entry& operator=(entry&& o) = default;
+
+        // The string is kept in the encoding of the pool: "value" for a
+        // UTF-16 pool, "value8" for a UTF-8 one.  "length16" is its length
+        // in UTF-16 units either way.
         String16 value;
+        String8 value8;
+        size_t length16;
         size_t offset;
         bool hasStyles;
         Vector<size_t> indices;
@@ -81,7 +100,9 @@ public:
 
     /**
      * If 'utf8' is true, strings will be encoded with UTF-8 instead of
-     * left in Java's native UTF-16.
+     * left in Java's native UTF-16.  They are then held in UTF-8 from the
+     * time they are added, and matched, deduplicated and written out
+     * without going back to UTF-16.
      */
     explicit StringPool(bool utf8 = false);
 
@@ -99,6 +120,13 @@ public:
     ssize_t add(const String16& value, const Vector<entry_style_span>& spans,
             const String8* configTypeName = NULL, const ResTable_config* config = NULL);
 
+    /**
+     * Add a string already in UTF-8, as above.  A UTF-8 pool keeps it
+     * as it is.
+     */
+    ssize_t add(const String8& value, bool mergeDuplicates = false,
+            const String8* configTypeName = NULL, const ResTable_config* config = NULL);
+
     status_t addStyleSpan(size_t idx, const String16& name,
                           uint32_t start, uint32_t end);
     status_t addStyleSpans(size_t idx, const Vector<entry_style_span>& spans);
@@ -137,15 +165,38 @@ public:
      * (which determines the offsets).  Returns NULL if the string does not exist.
      */
     const Vector<size_t>* offsetsForString(const String16& val) const;
+    const Vector<size_t>* offsetsForString(const String8& val) const;
 
 private:
+    static hash_t hashValue(const String16& value);
+    static hash_t hashValue(const String8& value);
+    // Returns the mValues or mValues8 position of "value", or -1.
+    ssize_t findValue(const String16& value, hash_t hash) const;
+    ssize_t findValue(const String8& value, hash_t hash) const;
+
+    // Adds "value", "length16" UTF-16 units long, to a UTF-8 pool.  A
+    // string that isn't valid UTF-8 ("length16" < 0) is added as an empty
+    // one.
+    ssize_t addUTF8(const String8& value, ssize_t length16, bool mergeDuplicates,
+            const String8* configTypeName, const ResTable_config* config);
+
+    // Records another use of the entry "eidx", which was found at "pos" or
+    // just added if "pos" < 0, and returns the position of this use.
+    ssize_t addUse(ssize_t pos, size_t eidx, bool mergeDuplicates,
+            const String8* configTypeName, const ResTable_config* config);
+
+    // Ranks each entry of mEntries, so that comparing the ranks of two
+    // entries orders them as entry::compare() does.
+    void rankEntries(Vector<uint32_t>* outRanks) const;
+
     class ConfigSorter
     {
     public:
-        explicit ConfigSorter(const StringPool&);
+        ConfigSorter(const StringPool&, const Vector<uint32_t>& ranks);
         bool operator()(size_t l, size_t r);
     private:
         const StringPool& pool;
+        const Vector<uint32_t>& ranks;
     };
 
     const bool                              mUTF8;
@@ -173,10 +224,32 @@ private:
 
     // Unique set of all the strings added to the pool, mapped to
     // the first index of mEntryArray where the value was added.
-    DefaultKeyedVector<String16, ssize_t>   mValues;
+    // mValues holds them for a UTF-16 pool, mValues8 for a UTF-8 one.
+    template <typename STRING>
+    struct ValueIndexEntry {
+        ValueIndexEntry(const STRING& _value, ssize_t _pos) : value(_value), pos(_pos) { }
+        const STRING& getKey() const { return value; }
+
+        STRING value;
+        ssize_t pos;
+    };
+    BasicHashtable<String16, ValueIndexEntry<String16> > mValues;
+    // The key of mValues8: unlike String8's operator==, it compares the
+    // bytes after a NUL, as String16's does for mValues.
+    struct UTF8Key {
+        explicit UTF8Key(const String8& _value) : value(_value) { }
+        bool operator==(const UTF8Key& o) const {
+            return value.size() == o.value.size()
+                    && memcmp(value.string(), o.value.string(), value.size()) == 0;
+        }
+
+        String8 value;
+    };
+    BasicHashtable<UTF8Key, ValueIndexEntry<UTF8Key> > mValues8;
     // This array maps from the original position a string was placed at
     // in mEntryArray to its new position after being sorted with sortByConfig().
     Vector<size_t>                          mOriginalPosToNewPos;
+    MemAccount                              mAccount;
 };
 
 // The entry types are trivially movable because all fields they contain, including
@@ -19,6 +19,7 @@
 
 #include <utils/String8.h>
 #include <utils/String16.h>
+#include <utils/Vector.h>
 
 #include "ConfigDescription.h"
 #include "SourcePos.h"
@@ -52,6 +53,14 @@ struct SymbolDefinition {
     SourcePos source;
 };
 
+/**
+ * A symbol with all of its definitions.
+ */
+struct SymbolDefinitions {
+    Symbol symbol;
+    android::Vector<SymbolDefinition> definitions;
+};
+
 //
 // Implementations
 //
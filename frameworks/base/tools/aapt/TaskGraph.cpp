@@ -0,0 +1,137 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Running the steps of a build in the order their dependencies allow.
+//
+
+#define LOG_TAG "TaskGraph"
+
+#include <utils/Log.h>
+#include "AaptContext.h"
+#include "TaskGraph.h"
+
+namespace android {
+
+class TaskGraph::RunnerThread : public Thread {
+public:
+    RunnerThread(TaskGraph* graph, AaptContext* context) :
+            Thread(false), mGraph(graph), mContext(context) { }
+
+private:
+    virtual bool threadLoop() {
+        AaptContext::Scope scope(mContext);
+        while (mGraph->runNext()) {
+        }
+        return false;
+    }
+
+    TaskGraph* const mGraph;
+    AaptContext* const mContext;
+};
+
+TaskGraph::TaskGraph() : mRunning(0), mDone(0), mError(NO_ERROR) {
+}
+
+TaskGraph::~TaskGraph() {
+    for (size_t i = 0; i < mNodes.size(); i++) {
+        delete mNodes[i].task;
+    }
+}
+
+size_t TaskGraph::add(Task* task) {
+    Node node;
+    node.task = task;
+    node.waitingFor = 0;
+    return mNodes.add(node);
+}
+
+void TaskGraph::addDependency(size_t task, size_t before) {
+    LOG_ALWAYS_FATAL_IF(before >= task || task >= mNodes.size(),
+            "step %zu can't depend on step %zu", task, before);
+    Node& node = mNodes.editItemAt(task);
+    node.waitingFor++;
+    mNodes.editItemAt(before).dependents.add(task);
+}
+
+status_t TaskGraph::run(size_t maxThreads) {
+    const size_t N = mNodes.size();
+    for (size_t i = 0; i < N; i++) {
+        if (mNodes[i].waitingFor == 0) {
+            mReady.add(i);
+        }
+    }
+    if (maxThreads > N) {
+        maxThreads = N;
+    }
+
+    AaptContext* const context = AaptContext::current();
+    Vector<sp<RunnerThread> > threads;
+    for (size_t i = 1; i < maxThreads; i++) {
+        sp<RunnerThread> thread = new RunnerThread(this, context);
+        if (thread->run("TaskGraph", PRIORITY_NORMAL) == NO_ERROR) {
+            threads.add(thread);
+        }
+    }
+    while (runNext()) {
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i]->join();
+    }
+    return mError;
+}
+
+bool TaskGraph::runNext() {
+    size_t index;
+    Task* task;
+    {
+        AutoMutex _l(mLock);
+        for (;;) {
+            if (mError == NO_ERROR && AaptContext::current()->isCanceled()) {
+                mError = UNKNOWN_ERROR;
+            }
+            if (mError != NO_ERROR || mDone == mNodes.size()) {
+                return false;
+            }
+            if (!mReady.isEmpty()) {
+                break;
+            }
+            if (mRunning == 0) {
+                return false;
+            }
+            mChanged.wait(mLock);
+        }
+        index = mReady[0];
+        mReady.removeAt(0);
+        task = mNodes[index].task;
+        mRunning++;
+    }
+
+    const status_t err = task->run();
+
+    AutoMutex _l(mLock);
+    mRunning--;
+    mDone++;
+    if (err != NO_ERROR) {
+        if (mError == NO_ERROR) {
+            mError = err;
+        }
+    } else {
+        const Vector<size_t>& dependents = mNodes[index].dependents;
+        for (size_t i = 0; i < dependents.size(); i++) {
+            const size_t dependent = dependents[i];
+            if (--mNodes.editItemAt(dependent).waitingFor != 0) {
+                continue;
+            }
+            // Kept in the order added, which a single thread runs them in.
+            size_t pos = mReady.size();
+            while (pos > 0 && mReady[pos - 1] > dependent) {
+                pos--;
+            }
+            mReady.insertAt(dependent, pos, 1);
+        }
+    }
+    mChanged.broadcast();
+    return true;
+}
+
+} // namespace android
@@ -0,0 +1,93 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Running the steps of a build in the order their dependencies allow.
+//
+
+#ifndef TASK_GRAPH_H
+#define TASK_GRAPH_H
+
+#include <utils/Errors.h>
+#include <utils/threads.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+/*
+ * The steps of a build and what each must wait for.  run() starts every
+ * step as soon as the steps it depends on are done, so that steps that
+ * don't depend on each other overlap: the images are crunched while the
+ * included packages load, and the manifest is read while the values are
+ * compiled.
+ *
+ * Each step runs on a thread of its own rather than as a WorkQueue unit,
+ * since the steps schedule their files on the shared work queue and wait
+ * for them, which its units may not do.  Steps run in the AaptContext of
+ * the thread that calls run(), and no more steps are started once it is
+ * canceled.
+ *
+ * A step may only depend on steps added before it, so the order they are
+ * added in is one they can run in; with a single thread they run in just
+ * that order, as a serial build always has.
+ */
+class TaskGraph {
+public:
+    class Task {
+    public:
+        Task() { }
+        virtual ~Task() { }
+
+        /*
+         * Runs the step.  An error stops the build: no more steps are
+         * started, and run() returns it once those running are done.  A step
+         * whose errors should not keep the others from reporting theirs
+         * notes them elsewhere and returns NO_ERROR.
+         */
+        virtual status_t run() = 0;
+    };
+
+    TaskGraph();
+
+    /* Deletes the tasks. */
+    ~TaskGraph();
+
+    /* Adds a step, taking ownership of "task".  Returns its index. */
+    size_t add(Task* task);
+
+    /* Makes step "task" wait for step "before", which was added earlier. */
+    void addDependency(size_t task, size_t before);
+
+    /*
+     * Runs all the steps, up to "maxThreads" of them at once, the calling
+     * thread being one.  Returns the error of the first step that failed,
+     * or NO_ERROR.  May only be called once.
+     */
+    status_t run(size_t maxThreads);
+
+private:
+    TaskGraph(const TaskGraph&);
+    TaskGraph& operator=(const TaskGraph&);
+
+    class RunnerThread;
+
+    struct Node {
+        Task* task;
+        size_t waitingFor;          // steps it depends on not done yet
+        Vector<size_t> dependents;
+    };
+
+    bool runNext();     // called from each runner thread
+
+    Vector<Node> mNodes;
+
+    Mutex mLock;
+    Condition mChanged;
+    Vector<size_t> mReady;      // steps that may start, in the order added
+    size_t mRunning;
+    size_t mDone;
+    status_t mError;
+};
+
+} // namespace android
+
+#endif // TASK_GRAPH_H
@@ -0,0 +1,224 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Packaging several variants of an app in one run, for --variants.
+//
+
+#include "Variants.h"
+#include "AaptContext.h"
+#include "Main.h"
+#include "WorkQueue.h"
+
+#include <androidfw/AssetManager.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+using android::AaptContext;
+using android::AssetManager;
+using android::String8;
+using android::Vector;
+using android::WorkQueue;
+
+namespace {
+
+// One variant's build: its command line, and how it went.
+struct VariantRun {
+    VariantRun() : result(1) { }
+
+    Variants::Args args;
+    int result;
+};
+
+void runVariant(VariantRun* run)
+{
+    std::vector<char*> argv;
+    for (size_t i = 0; i < run->args.size(); i++) {
+        argv.push_back(&run->args[i][0]);
+    }
+    argv.push_back(NULL);
+
+    AaptContext context;
+    AaptContext::Scope scope(&context);
+    Bundle bundle;
+    run->result = runCommandLine(bundle, argv.size() - 1, &argv[0]);
+    fflush(stdout);
+    fflush(stderr);
+}
+
+class VariantWorkUnit : public WorkQueue::WorkUnit {
+public:
+    explicit VariantWorkUnit(VariantRun* run) : mRun(run) { }
+
+    virtual bool run() {
+        runVariant(mRun);
+        return true;
+    }
+
+private:
+    VariantRun* mRun;
+};
+
+// The options every variant must share, since they set up the process.
+bool isProcessOption(const std::string& arg)
+{
+    return arg == "--jobs" || arg == "--pin-threads" || arg == "--max-memory"
+            || arg == "--capture-invocation" || arg == "--variants";
+}
+
+std::string describe(const Variants::Args& variant)
+{
+    std::string text;
+    for (size_t i = 0; i < variant.size(); i++) {
+        if (i > 0) {
+            text += ' ';
+        }
+        text += variant[i];
+    }
+    return text;
+}
+
+} // namespace
+
+namespace Variants {
+
+android::status_t read(const char* path, std::vector<Args>* outVariants)
+{
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: Unable to open variants file '%s': %s\n", path,
+                strerror(errno));
+        return android::UNKNOWN_ERROR;
+    }
+    // Lines may be longer than the buffer; a variant only ends at a newline.
+    char buf[4096];
+    Args args;
+    bool inComment = false;
+    bool atLineStart = true;
+    std::string word;
+    while (fgets(buf, sizeof(buf), fp) != NULL) {
+        for (const char* p = buf; *p != '\0'; p++) {
+            const char c = *p;
+            if (c == '\n') {
+                if (!word.empty()) {
+                    args.push_back(word);
+                    word.clear();
+                }
+                if (!args.empty()) {
+                    outVariants->push_back(args);
+                    args.clear();
+                }
+                inComment = false;
+                atLineStart = true;
+                continue;
+            }
+            if (atLineStart && c == '#') {
+                inComment = true;
+            }
+            atLineStart = false;
+            if (inComment) {
+                continue;
+            }
+            if (c == ' ' || c == '\t' || c == '\r') {
+                if (!word.empty()) {
+                    args.push_back(word);
+                    word.clear();
+                }
+            } else {
+                word += c;
+            }
+        }
+    }
+    if (!word.empty()) {
+        args.push_back(word);
+    }
+    if (!args.empty()) {
+        outVariants->push_back(args);
+    }
+    fclose(fp);
+    return android::NO_ERROR;
+}
+
+Args commandLine(int argc, char* const argv[], const Args& variant)
+{
+    Args args;
+    for (int i = 0; i < argc && i < 2; i++) {
+        args.push_back(argv[i]);
+    }
+    args.insert(args.end(), variant.begin(), variant.end());
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--variants") == 0) {
+            i++;
+            continue;
+        }
+        args.push_back(argv[i]);
+    }
+    return args;
+}
+
+int run(const Bundle* bundle, int argc, char* const argv[])
+{
+    std::vector<Args> variants;
+    if (read(bundle->getVariantsFile(), &variants) != android::NO_ERROR) {
+        return 1;
+    }
+    if (variants.empty()) {
+        fprintf(stderr, "ERROR: No variants in '%s'\n", bundle->getVariantsFile());
+        return 1;
+    }
+    if (bundle->getCaptureInvocation() != NULL) {
+        fprintf(stderr, "ERROR: --capture-invocation can't be used with --variants\n");
+        return 1;
+    }
+    for (size_t i = 0; i < variants.size(); i++) {
+        for (size_t j = 0; j < variants[i].size(); j++) {
+            if (isProcessOption(variants[i][j])) {
+                fprintf(stderr, "ERROR: variant %zu: '%s' is shared by all variants\n",
+                        i + 1, variants[i][j].c_str());
+                return 1;
+            }
+        }
+    }
+
+    // Held open for the whole run, so that the variants share their
+    // zips and the table parsed from the first.
+    AssetManager includes;
+    const Vector<String8>& paths = bundle->getPackageIncludes();
+    for (size_t i = 0; i < paths.size(); i++) {
+        includes.addAssetPath(paths[i], NULL);
+    }
+    includes.getResources(true);
+
+    std::vector<VariantRun> runs(variants.size());
+    for (size_t i = 0; i < variants.size(); i++) {
+        runs[i].args = commandLine(argc, argv, variants[i]);
+    }
+
+    // The variants wait on the shared queue's groups, which must not be
+    // done from its own threads, so they get threads of their own.
+    runVariant(&runs[0]);
+    if (runs.size() > 1) {
+        WorkQueue queue(runs.size() - 1, false);
+        for (size_t i = 1; i < runs.size(); i++) {
+            VariantWorkUnit* w = new VariantWorkUnit(&runs[i]);
+            if (queue.schedule(w, 0) != android::NO_ERROR) {
+                delete w;
+                runVariant(&runs[i]);
+            }
+        }
+        queue.finish();
+    }
+
+    int failed = 0;
+    for (size_t i = 0; i < runs.size(); i++) {
+        if (runs[i].result != 0) {
+            fprintf(stderr, "ERROR: variant %zu (%s) failed\n", i + 1,
+                    describe(variants[i]).c_str());
+            failed++;
+        }
+    }
+    return failed > 0 ? 1 : 0;
+}
+
+} // namespace Variants
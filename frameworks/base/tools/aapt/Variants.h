@@ -0,0 +1,56 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Packaging several variants of an app in one run, for --variants.
+//
+
+#ifndef AAPT_VARIANTS_H
+#define AAPT_VARIANTS_H
+
+#include "Bundle.h"
+
+#include <string>
+#include <utils/Errors.h>
+#include <vector>
+
+/*
+ * The variants of an app, such as its flavors, usually differ in a few
+ * overlay directories, the manifest and the -c filters, and share all
+ * the rest: the library resources, the images and the included packages.
+ * Packaging them in one process, rather than one process each, lets them
+ * share what each build would otherwise load or make again.  The -I
+ * packages are loaded once, images with the same pixels are encoded once,
+ * and with a --resource-cache the compiled values files and images of one
+ * variant are there for the rest.
+ */
+namespace Variants {
+
+typedef std::vector<std::string> Args;
+
+/*
+ * Reads a --variants file: the arguments of one variant per line,
+ * separated by spaces or tabs.  Blank lines and lines starting with '#'
+ * are skipped.
+ */
+android::status_t read(const char* path, std::vector<Args>* outVariants);
+
+/*
+ * The command line of "variant": "argv" up to and including the command,
+ * then the arguments of the variant, then the rest of "argv" without its
+ * --variants option.  The variant's options come first so that its -S
+ * directories take precedence over the shared ones.
+ */
+Args commandLine(int argc, char* const argv[], const Args& variant);
+
+/*
+ * Packages each variant of bundle->getVariantsFile() with the shared
+ * arguments of "argv", the command line "bundle" was parsed from.  The
+ * first variant is packaged on its own, so that it fills the caches, and
+ * then the rest all at once, each in its own AaptContext, sharing the
+ * work threads.  Returns 0 if every variant was packaged.
+ */
+int run(const Bundle* bundle, int argc, char* const argv[]);
+
+} // namespace Variants
+
+#endif // AAPT_VARIANTS_H
@@ -19,20 +19,74 @@
 
 #include <utils/Log.h>
 #include "WorkQueue.h"
+#include "AaptContext.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sched.h>
+#endif
 
 namespace android {
 
 // --- WorkQueue ---
 
-WorkQueue::WorkQueue(size_t maxThreads, bool canCallJava) :
-        mMaxThreads(maxThreads), mCanCallJava(canCallJava),
-        mCanceled(false), mFinished(false), mIdleThreads(0) {
+// The queue shared by the stages of a run; made on first use.
+static Mutex gSharedLock;
+static WorkQueue* gShared = NULL;
+static size_t gSharedThreads = 0;
+static bool gSharedPinThreads = false;
+
+WorkQueue::WorkQueue(size_t maxThreads, bool canCallJava, bool pinThreads) :
+        mMaxThreads(maxThreads ? maxThreads : getDefaultThreadCount()),
+        mCanCallJava(canCallJava), mPinThreads(pinThreads), mWorkers(new Worker[mMaxThreads]),
+        mCanceled(false), mFinished(false), mIdleThreads(0),
+        mPendingCount(0), mNextWorker(0) {
 }
 
 WorkQueue::~WorkQueue() {
     if (!cancel()) {
         finish();
     }
+    delete[] mWorkers;
+}
+
+size_t WorkQueue::getDefaultThreadCount() {
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    long count = info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return count > 0 ? size_t(count) : 1;
+}
+
+WorkQueue* WorkQueue::getShared() {
+    AutoMutex _l(gSharedLock);
+
+    if (gShared == NULL) {
+        gShared = new WorkQueue(gSharedThreads, false, gSharedPinThreads);
+    }
+    return gShared;
+}
+
+void WorkQueue::setShared(size_t maxThreads, bool pinThreads) {
+    AutoMutex _l(gSharedLock);
+
+    if (gShared != NULL
+            && gShared->mMaxThreads == (maxThreads ? maxThreads : getDefaultThreadCount())
+            && gShared->mPinThreads == pinThreads) {
+        return;
+    }
+    // Its threads are idle, so this only joins them.
+    delete gShared;
+    gShared = NULL;
+    gSharedThreads = maxThreads;
+    gSharedPinThreads = pinThreads;
 }
 
 status_t WorkQueue::schedule(WorkUnit* workUnit, size_t backlog) {
@@ -43,8 +97,8 @@ status_t WorkQueue::schedule(WorkUnit* workUnit, size_t backlog) {
     }
 
     if (mWorkThreads.size() < mMaxThreads
-            && mIdleThreads < mWorkUnits.size() + 1) {
-        sp<WorkThread> workThread = new WorkThread(this, mCanCallJava);
+            && mIdleThreads < mPendingCount + 1) {
+        sp<WorkThread> workThread = new WorkThread(this, mWorkThreads.size(), mCanCallJava);
         status_t status = workThread->run("WorkQueue::WorkThread");
         if (status) {
             return status;
@@ -52,7 +106,7 @@ status_t WorkQueue::schedule(WorkUnit* workUnit, size_t backlog) {
         mWorkThreads.add(workThread);
         mIdleThreads += 1;
     } else if (backlog) {
-        while (mWorkUnits.size() >= mMaxThreads * backlog) {
+        while (mPendingCount >= mMaxThreads * backlog) {
             mWorkDequeuedCondition.wait(mLock);
             if (mFinished || mCanceled) {
                 return INVALID_OPERATION;
@@ -60,7 +114,23 @@ status_t WorkQueue::schedule(WorkUnit* workUnit, size_t backlog) {
         }
     }
 
-    mWorkUnits.add(workUnit);
+    // Hand the unit to the running threads in turn.  Units are never given
+    // to a thread that has not been started, where they could only be
+    // reached by stealing.
+    Worker& worker = mWorkers[mNextWorker % mWorkThreads.size()];
+    mNextWorker += 1;
+
+    PendingUnit pending;
+    pending.workUnit = workUnit;
+    pending.scheduleTime = systemTime();
+    pending.context = AaptContext::current();
+    { // acquire worker lock
+        AutoMutex _wl(worker.lock);
+        worker.pending.add(pending);
+    } // release worker lock
+
+    mPendingCount += 1;
+    mStats.scheduled += 1;
     mWorkChangedCondition.broadcast();
     return OK;
 }
@@ -79,11 +149,16 @@ status_t WorkQueue::cancelLocked() {
     if (!mCanceled) {
         mCanceled = true;
 
-        size_t count = mWorkUnits.size();
-        for (size_t i = 0; i < count; i++) {
-            delete mWorkUnits.itemAt(i);
+        for (size_t i = 0; i < mMaxThreads; i++) {
+            Worker& worker = mWorkers[i];
+            AutoMutex _wl(worker.lock);
+            size_t count = worker.pending.size();
+            for (size_t j = 0; j < count; j++) {
+                delete worker.pending.itemAt(j).workUnit;
+            }
+            worker.pending.clear();
         }
-        mWorkUnits.clear();
+        mPendingCount = 0;
         mWorkChangedCondition.broadcast();
         mWorkDequeuedCondition.broadcast();
     }
@@ -112,39 +187,85 @@ status_t WorkQueue::finish() {
     return OK;
 }
 
-bool WorkQueue::threadLoop() {
-    WorkUnit* workUnit;
-    { // acquire lock
-        AutoMutex _l(mLock);
+WorkQueue::Stats WorkQueue::getStats() {
+    AutoMutex _l(mLock);
 
-        for (;;) {
+    return mStats;
+}
+
+bool WorkQueue::dequeue(size_t index, PendingUnit* outUnit, bool* outStolen) {
+    // Our own work first, then everyone else's, starting with our neighbour.
+    for (size_t i = 0; i < mMaxThreads; i++) {
+        Worker& worker = mWorkers[(index + i) % mMaxThreads];
+        AutoMutex _wl(worker.lock);
+        if (!worker.pending.isEmpty()) {
+            *outUnit = worker.pending.itemAt(0);
+            worker.pending.removeAt(0);
+            *outStolen = i != 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool WorkQueue::threadLoop(size_t index) {
+    PendingUnit pending;
+    for (;;) {
+        bool stolen;
+        if (dequeue(index, &pending, &stolen)) {
+            AutoMutex _l(mLock);
+
+            // A unit can be taken by cancelLocked() between dequeue() and here,
+            // in which case mPendingCount was already reset.
             if (mCanceled) {
+                delete pending.workUnit;
                 return false;
             }
-
-            if (!mWorkUnits.isEmpty()) {
-                workUnit = mWorkUnits.itemAt(0);
-                mWorkUnits.removeAt(0);
-                mIdleThreads -= 1;
-                mWorkDequeuedCondition.broadcast();
-                break;
+            mPendingCount -= 1;
+            mIdleThreads -= 1;
+            mStats.executed += 1;
+            if (stolen) {
+                mStats.steals += 1;
             }
+            mStats.queueWaitTime += systemTime() - pending.scheduleTime;
+            mWorkDequeuedCondition.broadcast();
+            break;
+        }
 
-            if (mFinished) {
-                return false;
-            }
+        AutoMutex _l(mLock);
 
-            mWorkChangedCondition.wait(mLock);
+        if (mCanceled) {
+            return false;
         }
-    } // release lock
 
-    bool shouldContinue = workUnit->run();
-    delete workUnit;
+        // Units are added to a worker before mPendingCount is incremented,
+        // so a non-zero count means one is about to be taken by some thread
+        // or is still waiting for us; look again rather than sleeping.
+        if (mPendingCount != 0) {
+            continue;
+        }
+
+        if (mFinished) {
+            return false;
+        }
+
+        mWorkChangedCondition.wait(mLock);
+    }
+
+    bool shouldContinue;
+    const nsecs_t runStart = systemTime();
+    {
+        AaptContext::Scope scope(pending.context);
+        shouldContinue = pending.workUnit->run();
+        delete pending.workUnit;
+    }
+    const nsecs_t runTime = systemTime() - runStart;
 
     { // acquire lock
         AutoMutex _l(mLock);
 
         mIdleThreads += 1;
+        mStats.runTime += runTime;
 
         if (!shouldContinue) {
             cancelLocked();
@@ -155,17 +276,114 @@ bool WorkQueue::threadLoop() {
     return true;
 }
 
+// --- WorkQueue::Group ---
+
+class WorkQueue::Group::GroupWorkUnit : public WorkQueue::WorkUnit {
+public:
+    GroupWorkUnit(Group* group, WorkUnit* workUnit) :
+            mGroup(group), mWorkUnit(workUnit) {
+    }
+
+    // Also runs when the queue is canceled before the unit got to run.
+    virtual ~GroupWorkUnit() {
+        delete mWorkUnit;
+        if (mGroup != NULL) {
+            mGroup->unitDone();
+        }
+    }
+
+    virtual bool run() {
+        return mWorkUnit->run();
+    }
+
+    // Called when the queue refused the unit; ownership returns to the caller.
+    void release() {
+        mWorkUnit = NULL;
+        mGroup = NULL;
+    }
+
+private:
+    Group* mGroup;
+    WorkUnit* mWorkUnit;
+};
+
+WorkQueue::Group::Group(WorkQueue* workQueue) :
+        mWorkQueue(workQueue), mPending(0) {
+}
+
+WorkQueue::Group::~Group() {
+    wait();
+}
+
+status_t WorkQueue::Group::schedule(WorkUnit* workUnit, size_t backlog) {
+    { // acquire lock
+        AutoMutex _l(mLock);
+        mPending += 1;
+    } // release lock
+
+    GroupWorkUnit* groupWorkUnit = new GroupWorkUnit(this, workUnit);
+    status_t status = mWorkQueue->schedule(groupWorkUnit, backlog);
+    if (status) {
+        groupWorkUnit->release();
+        delete groupWorkUnit;
+
+        AutoMutex _l(mLock);
+        mPending -= 1;
+        mDoneCondition.broadcast();
+    }
+    return status;
+}
+
+void WorkQueue::Group::wait() {
+    AutoMutex _l(mLock);
+
+    while (mPending != 0) {
+        mDoneCondition.wait(mLock);
+    }
+}
+
+void WorkQueue::Group::unitDone() {
+    AutoMutex _l(mLock);
+
+    mPending -= 1;
+    mDoneCondition.broadcast();
+}
+
 // --- WorkQueue::WorkThread ---
 
-WorkQueue::WorkThread::WorkThread(WorkQueue* workQueue, bool canCallJava) :
-        Thread(canCallJava), mWorkQueue(workQueue) {
+WorkQueue::WorkThread::WorkThread(WorkQueue* workQueue, size_t index, bool canCallJava) :
+        Thread(canCallJava), mWorkQueue(workQueue), mIndex(index) {
 }
 
 WorkQueue::WorkThread::~WorkThread() {
 }
 
+status_t WorkQueue::WorkThread::readyToRun() {
+#if defined(__linux__)
+    if (mWorkQueue->mPinThreads) {
+        // Take the index-th of the processors we may use, wrapping around.
+        cpu_set_t allowed;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0 && CPU_COUNT(&allowed) > 1) {
+            int n = int(mIndex % CPU_COUNT(&allowed));
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &allowed) && n-- == 0) {
+                    cpu_set_t set;
+                    CPU_ZERO(&set);
+                    CPU_SET(cpu, &set);
+                    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+                        ALOGD("Unable to pin work thread %zu to cpu %d", mIndex, cpu);
+                    }
+                    break;
+                }
+            }
+        }
+    }
+#endif
+    return OK;
+}
+
 bool WorkQueue::WorkThread::threadLoop() {
-    return mWorkQueue->threadLoop();
+    return mWorkQueue->threadLoop(mIndex);
 }
 
 };  // namespace android
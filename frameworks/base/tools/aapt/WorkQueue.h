@@ -18,11 +18,14 @@
 #define AAPT_WORK_QUEUE_H
 
 #include <utils/Errors.h>
+#include <utils/Timers.h>
 #include <utils/Vector.h>
 #include <utils/threads.h>
 
 namespace android {
 
+class AaptContext;
+
 /*
  * A threaded work queue.
  *
@@ -30,6 +33,12 @@ namespace android {
  * units in parallel, using up to the specified number of threads.
  * To use it, write a loop to post work units to the work queue, then synchronize
  * on the queue at the end.
+ *
+ * Each work thread has its own queue of pending work units.  Units are handed
+ * out to the threads in turn, and a thread that runs out of work steals from
+ * the others.  Both a thread's own queue and the queues it steals from are
+ * drained oldest first, so units start in the order they were scheduled.
+ * Each unit runs in the AaptContext of the thread that scheduled it.
  */
 class WorkQueue {
 public:
@@ -46,14 +55,78 @@ public:
         virtual bool run() = 0;
     };
 
-    /* Creates a work queue with the specified maximum number of work threads. */
-    WorkQueue(size_t maxThreads, bool canCallJava = true);
+    /*
+     * A set of work units scheduled on a work queue that can be waited for
+     * on their own, without finishing the whole queue.  This lets a single
+     * queue be shared by several build stages.
+     *
+     * wait() must not be called from a work unit of the same queue.
+     */
+    class Group {
+    public:
+        Group(WorkQueue* workQueue);
+
+        /* Waits for all work units of the group to complete. */
+        ~Group();
+
+        /* Posts a work unit to run later, as WorkQueue::schedule() does. */
+        status_t schedule(WorkUnit* workUnit, size_t backlog = 2);
+
+        /* Waits for all work units scheduled so far to complete or be canceled. */
+        void wait();
+
+    private:
+        class GroupWorkUnit;
+        friend class GroupWorkUnit;
+
+        void unitDone();
+
+        WorkQueue* const mWorkQueue;
+        Mutex mLock;
+        Condition mDoneCondition;
+        size_t mPending;
+    };
+
+    /* Counters describing how the work queue was used. */
+    struct Stats {
+        Stats() : scheduled(0), executed(0), steals(0), queueWaitTime(0), runTime(0) { }
+
+        size_t scheduled;        // work units accepted by schedule()
+        size_t executed;         // work units that were run
+        size_t steals;           // work units run by a thread they were not handed to
+        nsecs_t queueWaitTime;   // total time units spent waiting to be run
+        nsecs_t runTime;         // total time units spent running
+    };
+
+    /* Creates a work queue with the specified maximum number of work threads.
+     * If maxThreads is 0, getDefaultThreadCount() threads are used.
+     * If pinThreads is true, each work thread is bound to one of the processors
+     * the process may run on, so that the memory it allocates stays local to it.
+     */
+    WorkQueue(size_t maxThreads = 0, bool canCallJava = true, bool pinThreads = false);
 
     /* Destroys the work queue.
      * Cancels pending work and waits for all remaining threads to complete.
      */
     ~WorkQueue();
 
+    /* Returns the number of processors available, which is the default
+     * number of work threads.
+     */
+    static size_t getDefaultThreadCount();
+
+    /* Returns the work queue shared by the build stages of one aapt run, so
+     * that they reuse the same threads instead of starting their own.  Stages
+     * schedule their units through a Group and wait for just those.  Units run
+     * on it must not return false, which would cancel it for everyone.
+     */
+    static WorkQueue* getShared();
+
+    /* Sets the threads of the shared work queue, replacing it if it was made
+     * with different ones.  Must not be called while any of its work is pending.
+     */
+    static void setShared(size_t maxThreads, bool pinThreads);
+
     /* Posts a work unit to run later.
      * If the work queue has been canceled or is already finished, returns INVALID_OPERATION
      * and does not take ownership of the work unit (caller must destroy it itself).
@@ -85,23 +158,48 @@ public:
      */
     status_t finish();
 
+    /* Returns the maximum number of work threads. */
+    size_t getMaxThreads() const { return mMaxThreads; }
+
+    /* Returns a snapshot of the usage counters. */
+    Stats getStats();
+
 private:
     class WorkThread : public Thread {
     public:
-        WorkThread(WorkQueue* workQueue, bool canCallJava);
+        WorkThread(WorkQueue* workQueue, size_t index, bool canCallJava);
         virtual ~WorkThread();
 
     private:
+        virtual status_t readyToRun();
         virtual bool threadLoop();
 
         WorkQueue* const mWorkQueue;
+        const size_t mIndex;
+    };
+
+    struct PendingUnit {
+        WorkUnit* workUnit;
+        nsecs_t scheduleTime;
+        AaptContext* context;   // of the thread that scheduled it
+    };
+
+    // The pending work handed to one work thread.
+    struct Worker {
+        Mutex lock;
+        Vector<PendingUnit> pending;
     };
 
     status_t cancelLocked();
-    bool threadLoop(); // called from each work thread
+    bool dequeue(size_t index, PendingUnit* outUnit, bool* outStolen);
+    bool threadLoop(size_t index); // called from each work thread
 
     const size_t mMaxThreads;
     const bool mCanCallJava;
+    const bool mPinThreads;
+
+    // Allocated up front so that threads can steal without holding mLock.
+    Worker* const mWorkers;
 
     Mutex mLock;
     Condition mWorkChangedCondition;
@@ -110,8 +208,10 @@ private:
     bool mCanceled;
     bool mFinished;
     size_t mIdleThreads;
+    size_t mPendingCount;
+    size_t mNextWorker;
     Vector<sp<WorkThread> > mWorkThreads;
-    Vector<WorkUnit*> mWorkUnits;
+    Stats mStats;
 };
 
 }; // namespace android
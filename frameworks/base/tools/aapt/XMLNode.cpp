@@ -5,17 +5,20 @@
 //
 
 #include "XMLNode.h"
+#include "MappedFile.h"
 #include "ResourceTable.h"
+#include "Statistics.h"
+#include "StringAtoms.h"
+#include "XMLStream.h"
 #include "pseudolocalize.h"
 
+#include <cutils/atomic.h>
+#include <cutils/threads.h>
 #include <utils/ByteOrder.h>
+#include <utils/JenkinsHash.h>
 #include <errno.h>
 #include <string.h>
 
-#ifndef _WIN32
-#define O_BINARY 0
-#endif
-
 // SSIZE: mingw does not have signed size_t == ssize_t.
 // STATUST: mingw does seem to redefine UNKNOWN_ERROR from our enum value, so a cast is necessary.
 #if !defined(_WIN32)
@@ -62,29 +65,51 @@ bool isWhitespace(const char16_t* str)
     return *str == 0;
 }
 
-static const String16 RESOURCES_PREFIX(RESOURCES_ROOT_NAMESPACE);
-static const String16 RESOURCES_PREFIX_AUTO_PACKAGE(RESOURCES_AUTO_PACKAGE_NAMESPACE);
-static const String16 RESOURCES_PRV_PREFIX(RESOURCES_ROOT_PRV_NAMESPACE);
-static const String16 RESOURCES_TOOLS_NAMESPACE("http://schemas.android.com/tools");
+// Made on first use rather than at startup, which a small package would
+// mostly spend building strings it never looks at.
+static const String16& resourcesPrefix()
+{
+    static const String16& prefix = StringAtoms::intern(RESOURCES_ROOT_NAMESPACE);
+    return prefix;
+}
+
+static const String16& resourcesPrefixAutoPackage()
+{
+    static const String16& prefix = StringAtoms::intern(RESOURCES_AUTO_PACKAGE_NAMESPACE);
+    return prefix;
+}
 
-String16 getNamespaceResourcePackage(String16 appPackage, String16 namespaceUri, bool* outIsPublic)
+static const String16& resourcesPrvPrefix()
+{
+    static const String16& prefix = StringAtoms::intern(RESOURCES_ROOT_PRV_NAMESPACE);
+    return prefix;
+}
+
+static const String16& toolsNamespace()
+{
+    static const String16& ns = StringAtoms::intern("http://schemas.android.com/tools");
+    return ns;
+}
+
+String16 getNamespaceResourcePackage(const String8& appPackage, const String16& namespaceUri,
+        bool* outIsPublic)
 {
     //printf("%s starts with %s?\n", String8(namespaceUri).string(),
-    //       String8(RESOURCES_PREFIX).string());
+    //       String8(resourcesPrefix()).string());
     size_t prefixSize;
     bool isPublic = true;
-    if(namespaceUri.startsWith(RESOURCES_PREFIX_AUTO_PACKAGE)) {
+    if(namespaceUri.startsWith(resourcesPrefixAutoPackage())) {
         if (kIsDebug) {
             printf("Using default application package: %s -> %s\n", String8(namespaceUri).string(),
-                   String8(appPackage).string());
+                   appPackage.string());
         }
         isPublic = true;
-        return appPackage;
-    } else if (namespaceUri.startsWith(RESOURCES_PREFIX)) {
-        prefixSize = RESOURCES_PREFIX.size();
-    } else if (namespaceUri.startsWith(RESOURCES_PRV_PREFIX)) {
+        return StringAtoms::intern(appPackage.string(), appPackage.size());
+    } else if (namespaceUri.startsWith(resourcesPrefix())) {
+        prefixSize = resourcesPrefix().size();
+    } else if (namespaceUri.startsWith(resourcesPrvPrefix())) {
         isPublic = false;
-        prefixSize = RESOURCES_PRV_PREFIX.size();
+        prefixSize = resourcesPrvPrefix().size();
     } else {
         if (outIsPublic) *outIsPublic = isPublic; // = true
         return String16();
@@ -93,12 +118,15 @@ String16 getNamespaceResourcePackage(String16 appPackage, String16 namespaceUri,
     //printf("YES!\n");
     //printf("namespace: %s\n", String8(String16(namespaceUri, namespaceUri.size()-prefixSize, prefixSize)).string());
     if (outIsPublic) *outIsPublic = isPublic;
-    return String16(namespaceUri, namespaceUri.size()-prefixSize, prefixSize);
+    // Every attribute in the namespace asks for the same package name.
+    return StringAtoms::intern(namespaceUri.string() + prefixSize,
+                               namespaceUri.size() - prefixSize);
 }
 
-status_t hasSubstitutionErrors(const char* fileName,
-                               ResXMLTree* inXml,
-                               String16 str16)
+template <class Parser>
+static status_t hasSubstitutionErrors(const char* fileName,
+                                      Parser* inXml,
+                                      String16 str16)
 {
     const char16_t* str = str16.string();
     const char16_t* p = str;
@@ -201,15 +229,72 @@ status_t hasSubstitutionErrors(const char* fileName,
     return NO_ERROR;
 }
 
+/*
+ * If the element being parsed holds nothing but text, with no escape or
+ * apostrophe that ResTable::collectString() could reject and no '%' for
+ * hasSubstitutionErrors() to look at when it is formatted, moves past its
+ * end tag and puts the text in outString, as parseStyledString() would.
+ * Otherwise leaves inXml where it was and returns false.
+ */
+template <class Parser>
+static bool parsePlainString(Parser* inXml, const String16& endTag,
+                             bool isFormatted, String16* outString)
+{
+    typename Parser::ResXMLPosition start;
+    inXml->getPosition(&start);
+
+    size_t len = 0;
+    const char16_t* text = NULL;
+    ResXMLTree::event_code_t code = inXml->next();
+    if (code == ResXMLTree::TEXT) {
+        text = inXml->getText(&len);
+        code = inXml->next();
+    }
+
+    bool plain = code == ResXMLTree::END_TAG;
+    if (plain) {
+        size_t nslen = 0;
+        const char16_t* ns = inXml->getElementNamespace(&nslen);
+        size_t namelen;
+        const char16_t* name = inXml->getElementName(&namelen);
+        plain = (ns == NULL || nslen == 0) && name != NULL
+                && strzcmp16(name, namelen, endTag.string(), endTag.size()) == 0;
+    }
+    for (size_t i = 0; plain && i < len; i++) {
+        const char16_t c = text[i];
+        plain = c != '\\' && c != '\'' && (c != '%' || !isFormatted);
+    }
+    if (!plain) {
+        inXml->setPosition(start);
+        return false;
+    }
+
+    if (text != NULL) {
+        outString->setTo(text, len);
+    } else {
+        outString->setTo(String16());
+    }
+    return true;
+}
+
+template <class Parser>
 status_t parseStyledString(Bundle* /* bundle */,
                            const char* fileName,
-                           ResXMLTree* inXml,
+                           Parser* inXml,
                            const String16& endTag,
                            String16* outString,
                            Vector<StringPool::entry_style_span>* outSpans,
                            bool isFormatted,
                            PseudolocalizationMethod pseudolocalize)
 {
+    Statistics::add(Statistics::STRINGS_PARSED);
+    // Most strings are a single run of text, which is returned as it is.
+    if (pseudolocalize == NO_PSEUDOLOCALIZATION
+            && parsePlainString(inXml, endTag, isFormatted, outString)) {
+        Statistics::add(Statistics::STRINGS_PLAIN);
+        return NO_ERROR;
+    }
+
     Vector<StringPool::entry_style_span> spanStack;
     String16 curString;
     String16 rawString;
@@ -436,6 +521,11 @@ static String8 build_namespace(const Vector<namespace_entry>& namespaces,
     return str;
 }
 
+template status_t parseStyledString(Bundle*, const char*, ResXMLTree*, const String16&,
+        String16*, Vector<StringPool::entry_style_span>*, bool, PseudolocalizationMethod);
+template status_t parseStyledString(Bundle*, const char*, XMLStream*, const String16&,
+        String16*, Vector<StringPool::entry_style_span>*, bool, PseudolocalizationMethod);
+
 void printXMLBlock(ResXMLTree* block)
 {
     block->restart();
@@ -543,11 +633,12 @@ void printXMLBlock(ResXMLTree* block)
     block->restart();
 }
 
-status_t parseXMLResource(const sp<AaptFile>& file, ResXMLTree* outTree,
-                          bool stripAll, bool keepComments,
-                          const char** cDataTags)
+status_t flattenXMLResource(const sp<AaptFile>& file, const sp<AaptFile>& outData,
+                            bool stripAll, bool keepComments,
+                            const char** cDataTags)
 {
-    sp<XMLNode> root = XMLNode::parse(file);
+    XMLNode::Arena arena;
+    sp<XMLNode> root = XMLNode::parse(file, &arena);
     if (root == NULL) {
         return UNKNOWN_ERROR;
     }
@@ -557,12 +648,20 @@ status_t parseXMLResource(const sp<AaptFile>& file, ResXMLTree* outTree,
         printf("Input XML from %s:\n", (const char*)file->getPrintableSource());
         root->print();
     }
+    return root->flatten(outData, !keepComments, false, false);
+}
+
+status_t parseXMLResource(const sp<AaptFile>& file, ResXMLTree* outTree,
+                          bool stripAll, bool keepComments,
+                          const char** cDataTags)
+{
     sp<AaptFile> rsc = new AaptFile(String8(), AaptGroupEntry(), String8());
-    status_t err = root->flatten(rsc, !keepComments, false);
+    status_t err = flattenXMLResource(file, rsc, stripAll, keepComments, cDataTags);
     if (err != NO_ERROR) {
         return err;
     }
-    err = outTree->setTo(rsc->getData(), rsc->getSize(), true);
+    const size_t size = rsc->getSize();
+    err = outTree->adoptTrusted(rsc->releaseData(), size);
     if (err != NO_ERROR) {
         return err;
     }
@@ -575,17 +674,114 @@ status_t parseXMLResource(const sp<AaptFile>& file, ResXMLTree* outTree,
     return NO_ERROR;
 }
 
-sp<XMLNode> XMLNode::parse(const sp<AaptFile>& file)
+// The arena that XMLNode::operator new() allocates from on this thread,
+// set while parse() runs with one.
+static thread_store_t gParseArena = THREAD_STORE_INITIALIZER;
+
+// Every node is preceded by the arena it came from, or NULL if it was
+// malloc()ed.  This keeps the node itself suitably aligned.
+static const size_t kNodeHeaderSize = 16;
+
+XMLNode::Arena::~Arena()
+{
+    LOG_ALWAYS_FATAL_IF(mLiveNodes != 0,
+            "XMLNode::Arena destroyed with %d nodes still alive", mLiveNodes);
+}
+
+void* XMLNode::operator new(size_t size)
 {
-    char buf[16384];
-    int fd = open(file->getSourceFile().string(), O_RDONLY | O_BINARY);
-    if (fd < 0) {
+    Arena* arena = static_cast<Arena*>(thread_store_get(&gParseArena));
+    void* block;
+    if (arena != NULL) {
+        // LinearAllocator only aligns to an int.
+        uintptr_t addr = (uintptr_t)arena->mAllocator.alloc(kNodeHeaderSize + size + 7);
+        block = (void*)((addr + 7) & ~(uintptr_t)7);
+        android_atomic_inc(&arena->mLiveNodes);
+        arena->mAccount.add(kNodeHeaderSize + size + 7);
+    } else {
+        block = malloc(kNodeHeaderSize + size);
+        LOG_ALWAYS_FATAL_IF(block == NULL, "Out of memory allocating an XMLNode");
+        MemStats::add(MemStats::XML_TREES, kNodeHeaderSize + size);
+    }
+    *static_cast<Arena**>(block) = arena;
+    return static_cast<uint8_t*>(block) + kNodeHeaderSize;
+}
+
+void XMLNode::operator delete(void* ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    void* block = static_cast<uint8_t*>(ptr) - kNodeHeaderSize;
+    Arena* arena = *static_cast<Arena**>(block);
+    if (arena != NULL) {
+        // The memory goes back when the arena is destroyed.
+        android_atomic_dec(&arena->mLiveNodes);
+    } else {
+        MemStats::add(MemStats::XML_TREES, -(ssize_t)(kNodeHeaderSize + sizeof(XMLNode)));
+        free(block);
+    }
+}
+
+/*
+ * Makes the nodes created on this thread come from "arena" for as long as
+ * it is in scope.
+ */
+class ParseArenaScope {
+public:
+    ParseArenaScope(XMLNode::Arena* arena) {
+        thread_store_set(&gParseArena, arena, NULL);
+    }
+    ~ParseArenaScope() {
+        thread_store_set(&gParseArena, NULL, NULL);
+    }
+};
+
+// The parser a ThreadXmlParser left for the next one on this thread.
+static thread_store_t gIdleParser = THREAD_STORE_INITIALIZER;
+
+static void freeIdleParser(void* parser)
+{
+    XML_ParserFree(static_cast<XML_Parser>(parser));
+}
+
+ThreadXmlParser::ThreadXmlParser()
+{
+    mParser = static_cast<XML_Parser>(thread_store_get(&gIdleParser));
+    if (mParser != NULL) {
+        thread_store_set(&gIdleParser, NULL, freeIdleParser);
+    } else {
+        mParser = XML_ParserCreateNS(NULL, 1);
+    }
+}
+
+ThreadXmlParser::~ThreadXmlParser()
+{
+    if (mParser == NULL) {
+        return;
+    }
+    // Resetting also drops the handlers and user data of the last file.
+    if (thread_store_get(&gIdleParser) == NULL && XML_ParserReset(mParser, NULL)) {
+        thread_store_set(&gIdleParser, mParser, freeIdleParser);
+    } else {
+        XML_ParserFree(mParser);
+    }
+}
+
+sp<XMLNode> XMLNode::parse(const sp<AaptFile>& file, Arena* arena)
+{
+    ParseArenaScope arenaScope(arena);
+
+    MappedFile input;
+    status_t err = input.open(file->getSourceFile().string());
+    if (err != NO_ERROR) {
         SourcePos(file->getSourceFile(), -1).error("Unable to open file for read: %s",
                 strerror(errno));
         return NULL;
     }
 
-    XML_Parser parser = XML_ParserCreateNS(NULL, 1);
+    ThreadXmlParser threadParser;
+    XML_Parser parser = threadParser.get();
     ParseState state;
     state.filename = file->getPrintableSource();
     state.parser = parser;
@@ -595,29 +791,17 @@ sp<XMLNode> XMLNode::parse(const sp<AaptFile>& file)
     XML_SetCharacterDataHandler(parser, characterData);
     XML_SetCommentHandler(parser, commentData);
 
-    ssize_t len;
-    bool done;
-    do {
-        len = read(fd, buf, sizeof(buf));
-        done = len < (ssize_t)sizeof(buf);
-        if (len < 0) {
-            SourcePos(file->getSourceFile(), -1).error("Error reading file: %s\n", strerror(errno));
-            close(fd);
-            return NULL;
-        }
-        if (XML_Parse(parser, buf, len, done) == XML_STATUS_ERROR) {
-            SourcePos(file->getSourceFile(), (int)XML_GetCurrentLineNumber(parser)).error(
-                    "Error parsing XML: %s\n", XML_ErrorString(XML_GetErrorCode(parser)));
-            close(fd);
-            return NULL;
-        }
-    } while (!done);
+    // The whole file goes to expat at once.
+    if (XML_Parse(parser, (const char*)input.getData(), input.getSize(), true)
+            == XML_STATUS_ERROR) {
+        SourcePos(file->getSourceFile(), (int)XML_GetCurrentLineNumber(parser)).error(
+                "Error parsing XML: %s\n", XML_ErrorString(XML_GetErrorCode(parser)));
+        return NULL;
+    }
 
-    XML_ParserFree(parser);
     if (state.root == NULL) {
         SourcePos(file->getSourceFile(), -1).error("No XML data generated when parsing");
     }
-    close(fd);
     return state.root;
 }
 
@@ -804,14 +988,15 @@ status_t XMLNode::addAttribute(const String16& ns, const String16& name,
         return UNKNOWN_ERROR;
     }
 
-    if (ns != RESOURCES_TOOLS_NAMESPACE) {
+    if (ns != toolsNamespace()) {
         attribute_entry e;
         e.index = mNextAttributeIndex++;
         e.ns = ns;
         e.name = name;
         e.string = value;
-        mAttributes.add(e);
-        mAttributeOrder.add(e.index, mAttributes.size()-1);
+        const uint32_t index = e.index;
+        mAttributes.add(std::move(e));
+        mAttributeOrder.add(index, mAttributes.size()-1);
     }
     return NO_ERROR;
 }
@@ -948,6 +1133,95 @@ void XMLNode::removeWhitespace(bool stripAll, const char** cDataTags)
     }
 }
 
+status_t parseAttributeValue(const sp<AaptAssets>& assets, ResourceTable* table,
+        const String16& defPackage, const String8& filename, int32_t lineNumber,
+        XMLNode::attribute_entry* attr)
+{
+    AccessorCookie ac(SourcePos(filename, lineNumber), attr->name, attr->string);
+    table->setCurrentXmlPos(SourcePos(filename, lineNumber));
+    if (!assets->getIncludedResources()
+            .stringToValue(&attr->value, &attr->string,
+                          attr->string.string(), attr->string.size(), true, true,
+                          attr->nameResId, NULL, &defPackage, table, &ac)) {
+        return UNKNOWN_ERROR;
+    }
+    if (kIsDebug) {
+        printf("Attr %s: type=0x%x, str=%s\n",
+                String8(attr->name).string(), attr->value.dataType,
+                String8(attr->string).string());
+    }
+    return NO_ERROR;
+}
+
+status_t getAttributeResId(const sp<AaptAssets>& assets, const ResourceTable* table,
+        const String8& filename, int32_t lineNumber, const String16& ns,
+        const String16& name, uint32_t* outResId)
+{
+    *outResId = 0;
+    if (ns.size() <= 0) {
+        return NO_ERROR;
+    }
+    bool nsIsPublic = true;
+    String16 pkg(getNamespaceResourcePackage(assets->getPackage(), ns, &nsIsPublic));
+    if (kIsDebug) {
+        printf("Attr %s: namespace(%s) %s ===> %s\n",
+                String8(name).string(),
+                String8(ns).string(),
+                (nsIsPublic) ? "public" : "private",
+                String8(pkg).string());
+    }
+    if (pkg.size() <= 0) {
+        return NO_ERROR;
+    }
+    static const String16& attr = StringAtoms::intern("attr");
+    const char* errorMsg;
+    uint32_t res = table != NULL
+        ? table->getResId(name, &attr, &pkg, &errorMsg, nsIsPublic)
+        : assets->getIncludedResources().
+            identifierForName(name.string(), name.size(),
+                              attr.string(), attr.size(),
+                              pkg.string(), pkg.size());
+    if (res == 0) {
+        SourcePos(filename, lineNumber).error(
+                "No resource identifier found for attribute '%s' in package '%s'\n",
+                String8(name).string(), String8(pkg).string());
+        return UNKNOWN_ERROR;
+    }
+    if (kIsDebug) {
+        printf("XML attribute name %s: resid=0x%08x\n",
+                String8(name).string(), res);
+    }
+    *outResId = res;
+    return NO_ERROR;
+}
+
+AttributeResIds::AttributeResIds(const sp<AaptAssets>& assets, const ResourceTable* table)
+    : mAssets(assets), mTable(table)
+{
+}
+
+status_t AttributeResIds::get(const String8& filename, int32_t lineNumber,
+        const String16& ns, const String16& name, uint32_t* outResId)
+{
+    if (ns.size() <= 0) {
+        *outResId = 0;
+        return NO_ERROR;
+    }
+    const hash_t hash = JenkinsHashWhiten(JenkinsHashMixShorts(
+            JenkinsHashMixShorts(0, (const uint16_t*) ns.string(), ns.size()),
+            (const uint16_t*) name.string(), name.size()));
+    const ssize_t idx = mIds.find(-1, hash, Key(&ns, &name));
+    if (idx >= 0) {
+        *outResId = mIds.entryAt(idx).resId;
+        return NO_ERROR;
+    }
+    status_t err = getAttributeResId(mAssets, mTable, filename, lineNumber, ns, name, outResId);
+    if (err == NO_ERROR) {
+        mIds.add(hash, Entry(ns, name, *outResId));
+    }
+    return err;
+}
+
 status_t XMLNode::parseValues(const sp<AaptAssets>& assets,
                               ResourceTable* table)
 {
@@ -957,21 +1231,10 @@ status_t XMLNode::parseValues(const sp<AaptAssets>& assets,
         const size_t N = mAttributes.size();
         String16 defPackage(assets->getPackage());
         for (size_t i=0; i<N; i++) {
-            attribute_entry& e = mAttributes.editItemAt(i);
-            AccessorCookie ac(SourcePos(mFilename, getStartLineNumber()), String8(e.name),
-                    String8(e.string));
-            table->setCurrentXmlPos(SourcePos(mFilename, getStartLineNumber()));
-            if (!assets->getIncludedResources()
-                    .stringToValue(&e.value, &e.string,
-                                  e.string.string(), e.string.size(), true, true,
-                                  e.nameResId, NULL, &defPackage, table, &ac)) {
+            if (parseAttributeValue(assets, table, defPackage, mFilename,
+                    getStartLineNumber(), &mAttributes.editItemAt(i)) != NO_ERROR) {
                 hasErrors = true;
             }
-            if (kIsDebug) {
-                printf("Attr %s: type=0x%x, str=%s\n",
-                        String8(e.name).string(), e.value.dataType,
-                        String8(e.string).string());
-            }
         }
     }
     const size_t N = mChildren.size();
@@ -986,51 +1249,30 @@ status_t XMLNode::parseValues(const sp<AaptAssets>& assets,
 
 status_t XMLNode::assignResourceIds(const sp<AaptAssets>& assets,
                                     const ResourceTable* table)
+{
+    AttributeResIds ids(assets, table);
+    return assignResourceIds(&ids);
+}
+
+status_t XMLNode::assignResourceIds(AttributeResIds* ids)
 {
     bool hasErrors = false;
     
     if (getType() == TYPE_ELEMENT) {
-        String16 attr("attr");
-        const char* errorMsg;
         const size_t N = mAttributes.size();
         for (size_t i=0; i<N; i++) {
             const attribute_entry& e = mAttributes.itemAt(i);
-            if (e.ns.size() <= 0) continue;
-            bool nsIsPublic = true;
-            String16 pkg(getNamespaceResourcePackage(String16(assets->getPackage()), e.ns, &nsIsPublic));
-            if (kIsDebug) {
-                printf("Elem %s %s=\"%s\": namespace(%s) %s ===> %s\n",
-                        String8(getElementName()).string(),
-                        String8(e.name).string(),
-                        String8(e.string).string(),
-                        String8(e.ns).string(),
-                        (nsIsPublic) ? "public" : "private",
-                        String8(pkg).string());
-            }
-            if (pkg.size() <= 0) continue;
-            uint32_t res = table != NULL
-                ? table->getResId(e.name, &attr, &pkg, &errorMsg, nsIsPublic)
-                : assets->getIncludedResources().
-                    identifierForName(e.name.string(), e.name.size(),
-                                      attr.string(), attr.size(),
-                                      pkg.string(), pkg.size());
-            if (res != 0) {
-                if (kIsDebug) {
-                    printf("XML attribute name %s: resid=0x%08x\n",
-                            String8(e.name).string(), res);
-                }
-                setAttributeResID(i, res);
-            } else {
-                SourcePos(mFilename, getStartLineNumber()).error(
-                        "No resource identifier found for attribute '%s' in package '%s'\n",
-                        String8(e.name).string(), String8(pkg).string());
+            uint32_t res;
+            if (ids->get(mFilename, getStartLineNumber(), e.ns, e.name, &res) != NO_ERROR) {
                 hasErrors = true;
+            } else if (res != 0) {
+                setAttributeResID(i, res);
             }
         }
     }
     const size_t N = mChildren.size();
     for (size_t i=0; i<N; i++) {
-        status_t err = mChildren.itemAt(i)->assignResourceIds(assets, table);
+        status_t err = mChildren.itemAt(i)->assignResourceIds(ids);
         if (err < NO_ERROR) {
             hasErrors = true;
         }
@@ -1064,7 +1306,7 @@ sp<XMLNode> XMLNode::clone() const {
 }
 
 status_t XMLNode::flatten(const sp<AaptFile>& dest,
-        bool stripComments, bool stripRawValues) const
+        bool stripComments, bool stripRawValues, bool stripLineNumbers) const
 {
     StringPool strings(mUTF8);
     Vector<uint32_t> resids;
@@ -1105,7 +1347,7 @@ status_t XMLNode::flatten(const sp<AaptFile>& dest,
         }
     }
 
-    flatten_node(strings, dest, stripComments, stripRawValues);
+    flatten_node(strings, dest, stripComments, stripRawValues, stripLineNumbers);
 
     void* data = dest->editData();
     ResXMLTree_header* hd = (ResXMLTree_header*)(((uint8_t*)data)+basePos);
@@ -1176,12 +1418,13 @@ static void splitName(const char* name, String16* outNs, String16* outName)
     while (*p != 0 && *p != 1) {
         p++;
     }
+    // Names and namespaces repeat across every file, so they are interned.
     if (*p == 0) {
         *outNs = String16();
-        *outName = String16(name);
+        *outName = StringAtoms::intern(name);
     } else {
-        *outNs = String16(name, (p-name));
-        *outName = String16(p+1);
+        *outNs = StringAtoms::intern(name, (p-name));
+        *outName = StringAtoms::intern(p+1);
     }
 }
 
@@ -1193,7 +1436,7 @@ XMLNode::startNamespace(void *userData, const char *prefix, const char *uri)
     }
     ParseState* st = (ParseState*)userData;
     sp<XMLNode> node = XMLNode::newNamespace(st->filename, 
-            String16(prefix != NULL ? prefix : ""), String16(uri));
+            StringAtoms::intern(prefix != NULL ? prefix : ""), StringAtoms::intern(uri));
     node->setStartLineNumber(XML_GetCurrentLineNumber(st->parser));
     if (st->stack.size() > 0) {
         st->stack.itemAt(st->stack.size()-1)->addChild(node);
@@ -1315,7 +1558,7 @@ status_t XMLNode::collect_strings(StringPool* dest, Vector<uint32_t>* outResIds,
     collect_attr_strings(dest, outResIds, true);
     
     int i;
-    if (RESOURCES_TOOLS_NAMESPACE != mNamespaceUri) {
+    if (toolsNamespace() != mNamespaceUri) {
         if (mNamespacePrefix.size() > 0) {
             dest->add(mNamespacePrefix, true);
         }
@@ -1364,57 +1607,62 @@ status_t XMLNode::collect_strings(StringPool* dest, Vector<uint32_t>* outResIds,
     return NO_ERROR;
 }
 
-status_t XMLNode::collect_attr_strings(StringPool* outPool,
-        Vector<uint32_t>* outResIds, bool allAttrs) const {
-    const int NA = mAttributes.size();
-
-    for (int i=0; i<NA; i++) {
-        const attribute_entry& attr = mAttributes.itemAt(i);
-        uint32_t id = attr.nameResId;
-        if (id || allAttrs) {
-            // See if we have already assigned this resource ID to a pooled
-            // string...
-            const Vector<size_t>* indices = outPool->offsetsForString(attr.name);
-            ssize_t idx = -1;
-            if (indices != NULL) {
-                const int NJ = indices->size();
-                const size_t NR = outResIds->size();
-                for (int j=0; j<NJ; j++) {
-                    size_t strIdx = indices->itemAt(j);
-                    if (strIdx >= NR) {
-                        if (id == 0) {
-                            // We don't need to assign a resource ID for this one.
-                            idx = strIdx;
-                            break;
-                        }
-                        // Just ignore strings that are out of range of
-                        // the currently assigned resource IDs...  we add
-                        // strings as we assign the first ID.
-                    } else if (outResIds->itemAt(strIdx) == id) {
+void collectAttributeName(const XMLNode::attribute_entry& attr, StringPool* outPool,
+        Vector<uint32_t>* outResIds, bool allAttrs)
+{
+    uint32_t id = attr.nameResId;
+    if (id || allAttrs) {
+        // See if we have already assigned this resource ID to a pooled
+        // string...
+        const Vector<size_t>* indices = outPool->offsetsForString(attr.name);
+        ssize_t idx = -1;
+        if (indices != NULL) {
+            const int NJ = indices->size();
+            const size_t NR = outResIds->size();
+            for (int j=0; j<NJ; j++) {
+                size_t strIdx = indices->itemAt(j);
+                if (strIdx >= NR) {
+                    if (id == 0) {
+                        // We don't need to assign a resource ID for this one.
                         idx = strIdx;
                         break;
                     }
+                    // Just ignore strings that are out of range of
+                    // the currently assigned resource IDs...  we add
+                    // strings as we assign the first ID.
+                } else if (outResIds->itemAt(strIdx) == id) {
+                    idx = strIdx;
+                    break;
                 }
             }
-            if (idx < 0) {
-                idx = outPool->add(attr.name);
-                if (kIsDebug) {
-                    printf("Adding attr %s (resid 0x%08x) to pool: idx=%zd\n",
-                            String8(attr.name).string(), id, SSIZE(idx));
-                }
-                if (id != 0) {
-                    while ((ssize_t)outResIds->size() <= idx) {
-                        outResIds->add(0);
-                    }
-                    outResIds->replaceAt(id, idx);
-                }
-            }
-            attr.namePoolIdx = idx;
+        }
+        if (idx < 0) {
+            idx = outPool->add(attr.name);
             if (kIsDebug) {
-                printf("String %s offset=0x%08zd\n", String8(attr.name).string(), SSIZE(idx));
+                printf("Adding attr %s (resid 0x%08x) to pool: idx=%zd\n",
+                        String8(attr.name).string(), id, SSIZE(idx));
             }
+            if (id != 0) {
+                while ((ssize_t)outResIds->size() <= idx) {
+                    outResIds->add(0);
+                }
+                outResIds->replaceAt(id, idx);
+            }
+        }
+        attr.namePoolIdx = idx;
+        if (kIsDebug) {
+            printf("String %s offset=0x%08zd\n", String8(attr.name).string(), SSIZE(idx));
         }
     }
+}
+
+status_t XMLNode::collect_attr_strings(StringPool* outPool,
+        Vector<uint32_t>* outResIds, bool allAttrs) const {
+    const int NA = mAttributes.size();
+
+    for (int i=0; i<NA; i++) {
+        collectAttributeName(mAttributes.itemAt(i), outPool, outResIds, allAttrs);
+    }
 
     return NO_ERROR;
 }
@@ -1434,7 +1682,7 @@ status_t XMLNode::collect_resid_strings(StringPool* outPool,
 }
 
 status_t XMLNode::flatten_node(const StringPool& strings, const sp<AaptFile>& dest,
-        bool stripComments, bool stripRawValues) const
+        bool stripComments, bool stripRawValues, bool stripLineNumbers) const
 {
     ResXMLTree_node node;
     ResXMLTree_cdataExt cdataExt;
@@ -1451,16 +1699,16 @@ status_t XMLNode::flatten_node(const StringPool& strings, const sp<AaptFile>& de
 
     LOG_ALWAYS_FATAL_IF(NA != mAttributeOrder.size(), "Attributes messed up!");
 
-    const String16 id16("id");
-    const String16 class16("class");
-    const String16 style16("style");
+    static const String16& id16 = StringAtoms::intern("id");
+    static const String16& class16 = StringAtoms::intern("class");
+    static const String16& style16 = StringAtoms::intern("style");
 
     const type type = getType();
 
     memset(&node, 0, sizeof(node));
     memset(&attr, 0, sizeof(attr));
     node.header.headerSize = htods(sizeof(node));
-    node.lineNumber = htodl(getStartLineNumber());
+    node.lineNumber = htodl(stripLineNumbers ? 0 : getStartLineNumber());
     if (!stripComments) {
         node.comment.index = htodl(
             mComment.size() > 0 ? strings.offsetForString(mComment) : -1);
@@ -1501,7 +1749,7 @@ status_t XMLNode::flatten_node(const StringPool& strings, const sp<AaptFile>& de
             }
         }
     } else if (type == TYPE_NAMESPACE) {
-        if (mNamespaceUri == RESOURCES_TOOLS_NAMESPACE) {
+        if (mNamespaceUri == toolsNamespace()) {
             writeCurrentNode = false;
         } else {
             node.header.type = htods(RES_XML_START_NAMESPACE_TYPE);
@@ -1570,7 +1818,7 @@ status_t XMLNode::flatten_node(const StringPool& strings, const sp<AaptFile>& de
 
     for (i=0; i<NC; i++) {
         status_t err = mChildren.itemAt(i)->flatten_node(strings, dest,
-                stripComments, stripRawValues);
+                stripComments, stripRawValues, stripLineNumbers);
         if (err != NO_ERROR) {
             return err;
         }
@@ -1581,7 +1829,7 @@ status_t XMLNode::flatten_node(const StringPool& strings, const sp<AaptFile>& de
         memset(&endElementExt, 0, sizeof(endElementExt));
         node.header.type = htods(RES_XML_END_ELEMENT_TYPE);
         node.header.size = htodl(sizeof(node)+sizeof(endElementExt));
-        node.lineNumber = htodl(getEndLineNumber());
+        node.lineNumber = htodl(stripLineNumbers ? 0 : getEndLineNumber());
         node.comment.index = htodl((uint32_t)-1);
         endElementExt.ns.index = attrExt.ns.index;
         endElementExt.name.index = attrExt.name.index;
@@ -1590,7 +1838,7 @@ status_t XMLNode::flatten_node(const StringPool& strings, const sp<AaptFile>& de
     } else if (type == TYPE_NAMESPACE) {
         if (writeCurrentNode) {
             node.header.type = htods(RES_XML_END_NAMESPACE_TYPE);
-            node.lineNumber = htodl(getEndLineNumber());
+            node.lineNumber = htodl(stripLineNumbers ? 0 : getEndLineNumber());
             node.comment.index = htodl((uint32_t)-1);
             node.header.size = htodl(sizeof(node)+extSize);
             dest->writeData(&node, sizeof(node));
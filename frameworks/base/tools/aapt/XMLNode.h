@@ -7,11 +7,16 @@
 #ifndef XML_NODE_H
 #define XML_NODE_H
 
+#include "MemStats.h"
 #include "StringPool.h"
 #include "ResourceTable.h"
 
+#include <utils/BasicHashtable.h>
+#include <utils/LinearAllocator.h>
+
 #include <expat.h>
 
+class AttributeResIds;
 class XMLNode;
 
 extern const char* const RESOURCES_ROOT_NAMESPACE;
@@ -21,9 +26,12 @@ bool isWhitespace(const char16_t* str);
 
 String16 getNamespaceResourcePackage(String16 namespaceUri, bool* outIsPublic = NULL);
 
+// Reads the string that ends at endTag from inXml, a ResXMLTree or, for a
+// values file compiled from its source, an XMLStream.
+template <class Parser>
 status_t parseStyledString(Bundle* bundle,
                            const char* fileName,
-                           ResXMLTree* inXml,
+                           Parser* inXml,
                            const String16& endTag,
                            String16* outString,
                            Vector<StringPool::entry_style_span>* outSpans,
@@ -36,10 +44,63 @@ status_t parseXMLResource(const sp<AaptFile>& file, ResXMLTree* outTree,
                           bool stripAll=true, bool keepComments=false,
                           const char** cDataTags=NULL);
 
-class XMLNode : public RefBase
+// Parses "file" as parseXMLResource() does, leaving the flattened tree in
+// "outData" rather than a ResXMLTree.
+status_t flattenXMLResource(const sp<AaptFile>& file, const sp<AaptFile>& outData,
+                            bool stripAll=true, bool keepComments=false,
+                            const char** cDataTags=NULL);
+
+/*
+ * This thread's namespace-aware expat parser, held while in scope.  The
+ * parser is reset and kept for the thread's next file instead of being
+ * created and freed for every one.
+ */
+class ThreadXmlParser {
+public:
+    ThreadXmlParser();
+    ~ThreadXmlParser();
+
+    XML_Parser get() const { return mParser; }
+
+private:
+    ThreadXmlParser(const ThreadXmlParser&);
+    ThreadXmlParser& operator=(const ThreadXmlParser&);
+
+    XML_Parser mParser;
+};
+
+class XMLNode : public LightRefBase<XMLNode>
 {
 public:
-    static sp<XMLNode> parse(const sp<AaptFile>& file);
+    /*
+     * A bump allocator for the nodes of one parsed file.  Passed to parse(),
+     * the nodes it creates are carved out of the arena instead of being
+     * allocated one by one, and their memory is given back all at once when
+     * the arena is destroyed.  The nodes are still reference counted as
+     * usual and must all have been released by then.  Nodes made outside
+     * parse(), such as by clone(), always come from the heap.
+     *
+     * An arena must only be parsed into by one thread at a time.
+     */
+    class Arena {
+    public:
+        Arena() : mLiveNodes(0), mAccount(MemStats::XML_TREES) { }
+        ~Arena();
+
+    private:
+        Arena(const Arena&);
+        Arena& operator=(const Arena&);
+
+        friend class XMLNode;
+        LinearAllocator mAllocator;
+        volatile int32_t mLiveNodes;
+        MemAccount mAccount;
+    };
+
+    static sp<XMLNode> parse(const sp<AaptFile>& file, Arena* arena = NULL);
+
+    static void* operator new(size_t size);
+    static void operator delete(void* ptr);
 
     static inline
     sp<XMLNode> newNamespace(const String8& filename, const String16& prefix, const String16& uri) {
@@ -139,7 +200,7 @@ public:
                                const ResourceTable* table = NULL);
 
     status_t flatten(const sp<AaptFile>& dest, bool stripComments,
-            bool stripRawValues) const;
+            bool stripRawValues, bool stripLineNumbers) const;
 
     sp<XMLNode> clone() const;
 
@@ -178,6 +239,8 @@ private:
     // Creating a CDATA node.
     XMLNode(const String8& filename);
     
+    status_t assignResourceIds(AttributeResIds* ids);
+
     status_t collect_strings(StringPool* dest, Vector<uint32_t>* outResIds,
             bool stripComments, bool stripRawValues) const;
 
@@ -188,7 +251,7 @@ private:
             Vector<uint32_t>* outResIds) const;
 
     status_t flatten_node(const StringPool& strings, const sp<AaptFile>& dest,
-            bool stripComments, bool stripRawValues) const;
+            bool stripComments, bool stripRawValues, bool stripLineNumbers) const;
 
     String16 mNamespacePrefix;
     String16 mNamespaceUri;
@@ -208,4 +271,71 @@ private:
     bool mUTF8;
 };
 
+/*
+ * The per-attribute work of XMLNode::assignResourceIds() and parseValues(),
+ * shared with XMLStream.  Errors are reported at the given file and line.
+ *
+ * getAttributeResId() sets *outResId to 0, without an error, for attributes
+ * that are not in a resource namespace.
+ */
+status_t getAttributeResId(const sp<AaptAssets>& assets, const ResourceTable* table,
+        const String8& filename, int32_t lineNumber, const String16& ns,
+        const String16& name, uint32_t* outResId);
+
+status_t parseAttributeValue(const sp<AaptAssets>& assets, ResourceTable* table,
+        const String16& defPackage, const String8& filename, int32_t lineNumber,
+        XMLNode::attribute_entry* attr);
+
+/*
+ * The resource IDs of the attribute names of one file.  A layout uses the
+ * same few dozen names on each of its elements, so each namespace and name
+ * is looked up once and its ID reused for the rest of the file.
+ */
+class AttributeResIds {
+public:
+    AttributeResIds(const sp<AaptAssets>& assets, const ResourceTable* table);
+
+    // As getAttributeResId().  A name that isn't found is looked up again
+    // each time, so that every use of it is reported.
+    status_t get(const String8& filename, int32_t lineNumber, const String16& ns,
+            const String16& name, uint32_t* outResId);
+
+private:
+    struct Key {
+        Key(const String16* _ns, const String16* _name) : ns(_ns), name(_name) { }
+        bool operator==(const Key& o) const {
+            // The names are interned, so equal ones are almost always the same.
+            return (ns->string() == o.ns->string() || *ns == *o.ns)
+                    && (name->string() == o.name->string() || *name == *o.name);
+        }
+
+        const String16* ns;
+        const String16* name;
+    };
+
+    struct Entry {
+        Entry(const String16& _ns, const String16& _name, uint32_t _resId)
+            : ns(_ns), name(_name), resId(_resId) { }
+        Key getKey() const { return Key(&ns, &name); }
+
+        String16 ns;
+        String16 name;
+        uint32_t resId;
+    };
+
+    const sp<AaptAssets> mAssets;
+    const ResourceTable* mTable;
+    BasicHashtable<Key, Entry> mIds;
+};
+
+/*
+ * Adds the name of "attr" to the string pool being built for a flattened
+ * file, sharing an entry with earlier attributes of the same name and
+ * resource ID.  Names with an ID come first in the pool, so that the
+ * resource map is compact: they are collected with allAttrs false in a
+ * first pass over the file, then everything else with allAttrs true.
+ */
+void collectAttributeName(const XMLNode::attribute_entry& attr, StringPool* outPool,
+        Vector<uint32_t>* outResIds, bool allAttrs);
+
 #endif
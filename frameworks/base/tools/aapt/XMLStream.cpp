@@ -0,0 +1,911 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Compile XML resource files without building an XMLNode tree.
+//
+
+#include "XMLStream.h"
+#include "MappedFile.h"
+#include "ResourceTable.h"
+#include "StringAtoms.h"
+
+#include <utils/ByteOrder.h>
+#include <errno.h>
+#include <string.h>
+
+#if PRINT_STRING_METRICS
+static const bool kPrintStringMetrics = true;
+#else
+static const bool kPrintStringMetrics = false;
+#endif
+
+// Made on first use, as in XMLNode.cpp, rather than at startup.
+static const String16& toolsNamespace()
+{
+    static const String16& ns = StringAtoms::intern("http://schemas.android.com/tools");
+    return ns;
+}
+
+// Attributes without a resource ID are ordered after those with one, in
+// the order they appear in.  Same as XMLNode::mNextAttributeIndex.
+static const uint32_t kFirstAttributeIndex = 0x80000000;
+
+static void splitName(const char* name, String16* outNs, String16* outName)
+{
+    const char* p = name;
+    while (*p != 0 && *p != 1) {
+        p++;
+    }
+    // Names and namespaces repeat across every file, so they are interned.
+    if (*p == 0) {
+        *outNs = String16();
+        *outName = StringAtoms::intern(name);
+    } else {
+        *outNs = StringAtoms::intern(name, (p-name));
+        *outName = StringAtoms::intern(p+1);
+    }
+}
+
+XMLStream::XMLStream()
+    : mUTF8(false)
+    , mEventCode(ResXMLParser::START_DOCUMENT)
+    , mEvent(0)
+{
+}
+
+status_t XMLStream::parse(const sp<AaptFile>& file)
+{
+    MappedFile input;
+    if (input.open(file->getSourceFile().string()) != NO_ERROR) {
+        SourcePos(file->getSourceFile(), -1).error("Unable to open file for read: %s",
+                strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+
+    mFilename = file->getPrintableSource();
+
+    ThreadXmlParser threadParser;
+    XML_Parser parser = threadParser.get();
+    ParseState state;
+    state.stream = this;
+    state.parser = parser;
+    XML_SetUserData(parser, &state);
+    XML_SetElementHandler(parser, startElement, endElement);
+    XML_SetNamespaceDeclHandler(parser, startNamespace, endNamespace);
+    XML_SetCharacterDataHandler(parser, characterData);
+    XML_SetCommentHandler(parser, commentData);
+
+    status_t result = NO_ERROR;
+    if (XML_Parse(parser, (const char*)input.getData(), input.getSize(), true)
+            == XML_STATUS_ERROR) {
+        SourcePos(file->getSourceFile(), (int)XML_GetCurrentLineNumber(parser)).error(
+                "Error parsing XML: %s\n", XML_ErrorString(XML_GetErrorCode(parser)));
+        result = UNKNOWN_ERROR;
+    }
+
+    if (result == NO_ERROR && mNodes.isEmpty()) {
+        SourcePos(file->getSourceFile(), -1).error("No XML data generated when parsing");
+        result = UNKNOWN_ERROR;
+    }
+    return result;
+}
+
+size_t XMLStream::addNode(ParseState* st, XMLNode::type type)
+{
+    node_entry node;
+    node.type = type;
+    node.startLineNumber = XML_GetCurrentLineNumber(st->parser);
+    node.endLineNumber = 0;
+    node.firstAttribute = mAttributes.size();
+    node.attributeCount = 0;
+    node.parent = st->stack.isEmpty() ? -1 : (ssize_t)st->stack.top();
+    node.end = mNodes.size() + 1;
+    node.removed = false;
+    return mNodes.add(node);
+}
+
+void XMLCALL
+XMLStream::startNamespace(void *userData, const char *prefix, const char *uri)
+{
+    ParseState* st = (ParseState*)userData;
+    XMLStream* stream = st->stream;
+    size_t index = stream->addNode(st, XMLNode::TYPE_NAMESPACE);
+    node_entry& node = stream->mNodes.editItemAt(index);
+    node.name = StringAtoms::intern(prefix != NULL ? prefix : "");
+    node.uri = StringAtoms::intern(uri);
+    st->stack.push(index);
+}
+
+void XMLCALL
+XMLStream::startElement(void *userData, const char *name, const char **atts)
+{
+    ParseState* st = (ParseState*)userData;
+    XMLStream* stream = st->stream;
+    size_t index = stream->addNode(st, XMLNode::TYPE_ELEMENT);
+    st->stack.push(index);
+
+    size_t attributeCount = 0;
+    for (int i = 0; atts[i]; i += 2) {
+        XMLNode::attribute_entry e;
+        splitName(atts[i], &e.ns, &e.name);
+        if (e.ns == toolsNamespace()) {
+            continue;
+        }
+        e.index = kFirstAttributeIndex + attributeCount++;
+        e.string = String16(atts[i+1]);
+        stream->mAttributes.add(e);
+    }
+
+    node_entry& node = stream->mNodes.editItemAt(index);
+    splitName(name, &node.uri, &node.name);
+    node.attributeCount = attributeCount;
+    if (st->pendingComment.size() > 0) {
+        node.comment = st->pendingComment;
+        st->pendingComment = String16();
+    }
+}
+
+void XMLCALL
+XMLStream::characterData(void *userData, const XML_Char *s, int len)
+{
+    ParseState* st = (ParseState*)userData;
+    XMLStream* stream = st->stream;
+    if (st->stack.isEmpty()) {
+        return;
+    }
+
+    // Consecutive runs of text, even with comments between them, make up
+    // one CDATA node.  A CDATA node has no children, so if the parent's
+    // last child is one it is also the last node so far.
+    const size_t last = stream->mNodes.size() - 1;
+    const node_entry& lastNode = stream->mNodes[last];
+    if (lastNode.type == XMLNode::TYPE_CDATA
+            && lastNode.parent == (ssize_t)st->stack.top()) {
+        stream->mNodes.editItemAt(last).name.append(String16(s, len));
+        return;
+    }
+
+    size_t index = stream->addNode(st, XMLNode::TYPE_CDATA);
+    stream->mNodes.editItemAt(index).name = String16(s, len);
+}
+
+void XMLCALL
+XMLStream::endElement(void *userData, const char * /* name */)
+{
+    ParseState* st = (ParseState*)userData;
+    XMLStream* stream = st->stream;
+    node_entry& node = stream->mNodes.editItemAt(st->stack.top());
+    node.endLineNumber = XML_GetCurrentLineNumber(st->parser);
+    node.end = stream->mNodes.size();
+    if (st->pendingComment.size() > 0) {
+        if (node.comment.size() > 0) {
+            node.comment.append(String16("\n"));
+        }
+        node.comment.append(st->pendingComment);
+        st->pendingComment = String16();
+    }
+    st->stack.pop();
+}
+
+void XMLCALL
+XMLStream::endNamespace(void *userData, const char * /* prefix */)
+{
+    ParseState* st = (ParseState*)userData;
+    XMLStream* stream = st->stream;
+    node_entry& node = stream->mNodes.editItemAt(st->stack.top());
+    node.endLineNumber = XML_GetCurrentLineNumber(st->parser);
+    node.end = stream->mNodes.size();
+    st->stack.pop();
+}
+
+void XMLCALL
+XMLStream::commentData(void *userData, const char *comment)
+{
+    ParseState* st = (ParseState*)userData;
+    if (st->pendingComment.size() > 0) {
+        st->pendingComment.append(String16("\n"));
+    }
+    st->pendingComment.append(String16(comment));
+}
+
+void XMLStream::prepare(int options)
+{
+    const bool stripAll = (options&XML_COMPILE_STRIP_WHITESPACE) != 0;
+    if (stripAll || (options&XML_COMPILE_COMPACT_WHITESPACE) != 0) {
+        // As XMLNode::removeWhitespace().
+        const size_t N = mNodes.size();
+        for (size_t i = 0; i < N; i++) {
+            if (mNodes[i].type != XMLNode::TYPE_CDATA) {
+                continue;
+            }
+            node_entry& node = mNodes.editItemAt(i);
+            const char16_t* p = node.name.string();
+            while (*p != 0 && *p < 128 && isspace(*p)) {
+                p++;
+            }
+            if (*p == 0) {
+                if (stripAll) {
+                    node.removed = true;
+                } else {
+                    node.name = String16(" ");
+                }
+                continue;
+            }
+
+            // Compact leading/trailing whitespace.
+            const char16_t* e = node.name.string()+node.name.size()-1;
+            while (e > p && *e < 128 && isspace(*e)) {
+                e--;
+            }
+            if (p > node.name.string()) {
+                p--;
+            }
+            if (e < (node.name.string()+node.name.size()-1)) {
+                e++;
+            }
+            if (p > node.name.string() ||
+                e < (node.name.string()+node.name.size()-1)) {
+                String16 tmp(p, e-p+1);
+                node.name = tmp;
+            }
+        }
+    }
+
+    if ((options&XML_COMPILE_UTF8) != 0) {
+        mUTF8 = true;
+    }
+}
+
+/*
+ * Fills in mAttributeOrder from the attributes' resource IDs.  Returns
+ * false if two attributes of an element ended up with the same ID.
+ */
+bool XMLStream::sortAttributes()
+{
+    mAttributeOrder.clear();
+    mAttributeOrder.setCapacity(mAttributes.size());
+
+    const size_t N = mNodes.size();
+    for (size_t i = 0; i < N; i++) {
+        const node_entry& node = mNodes[i];
+        // Insertion sort; elements seldom have more than a dozen attributes.
+        const size_t start = mAttributeOrder.size();
+        for (size_t j = 0; j < node.attributeCount; j++) {
+            const size_t attrIdx = node.firstAttribute + j;
+            const XMLNode::attribute_entry& ae = mAttributes[attrIdx];
+            const uint32_t key = ae.nameResId ? ae.nameResId : ae.index;
+            size_t pos = mAttributeOrder.size();
+            while (pos > start) {
+                const XMLNode::attribute_entry& prev = mAttributes[mAttributeOrder[pos-1]];
+                const uint32_t prevKey = prev.nameResId ? prev.nameResId : prev.index;
+                if (prevKey == key) {
+                    return false;
+                }
+                if (prevKey < key) {
+                    break;
+                }
+                pos--;
+            }
+            mAttributeOrder.insertAt(attrIdx, pos, 1);
+        }
+    }
+    return true;
+}
+
+status_t XMLStream::resolve(const Bundle* bundle,
+                            const sp<AaptAssets>& assets,
+                            const sp<AaptFile>& target,
+                            ResourceTable* table,
+                            int options,
+                            bool* outNeedsTree)
+{
+    *outNeedsTree = false;
+    bool hasErrors = false;
+
+    // Nodes are in document order, so the table sees the same lookups in
+    // the same order as with XMLNode::assignResourceIds() and parseValues().
+    // Both look each attribute name up once per file.
+    const size_t N = mNodes.size();
+    if ((options&XML_COMPILE_ASSIGN_ATTRIBUTE_IDS) != 0) {
+        AttributeResIds ids(assets, table);
+        for (size_t i = 0; i < N; i++) {
+            const node_entry& node = mNodes[i];
+            for (size_t j = 0; j < node.attributeCount; j++) {
+                XMLNode::attribute_entry& ae = mAttributes.editItemAt(node.firstAttribute + j);
+                if (ids.get(mFilename, node.startLineNumber, ae.ns, ae.name,
+                        &ae.nameResId) != NO_ERROR) {
+                    hasErrors = true;
+                }
+            }
+        }
+    }
+
+    // A failed file is never flattened or versioned, so it needn't be
+    // handed back; that would only report its errors twice.
+    if (!hasErrors) {
+        if (!sortAttributes()) {
+            *outNeedsTree = true;
+            return NO_ERROR;
+        }
+
+        Vector<uint32_t> attrIds;
+        const size_t NA = mAttributes.size();
+        for (size_t i = 0; i < NA; i++) {
+            if (mAttributes[i].nameResId != 0) {
+                attrIds.add(mAttributes[i].nameResId);
+            }
+        }
+        if (table->needsCompatModification(bundle, target, attrIds)) {
+            *outNeedsTree = true;
+            return NO_ERROR;
+        }
+    }
+
+    String16 defPackage(assets->getPackage());
+    for (size_t i = 0; i < N; i++) {
+        const node_entry& node = mNodes[i];
+        for (size_t j = 0; j < node.attributeCount; j++) {
+            if (parseAttributeValue(assets, table, defPackage, mFilename, node.startLineNumber,
+                    &mAttributes.editItemAt(node.firstAttribute + j)) != NO_ERROR) {
+                hasErrors = true;
+            }
+        }
+    }
+
+    return hasErrors ? UNKNOWN_ERROR : NO_ERROR;
+}
+
+void XMLStream::warnPlainIds(const String8& path) const
+{
+    const String16 id("id");
+    const size_t N = mNodes.size();
+    for (size_t i = 0; i < N; i++) {
+        const node_entry& node = mNodes[i];
+        if (node.type != XMLNode::TYPE_ELEMENT) {
+            continue;
+        }
+        for (size_t j = 0; j < node.attributeCount; j++) {
+            const XMLNode::attribute_entry& attr = mAttributes[node.firstAttribute + j];
+            if (attr.ns.size() == 0 && attr.name == id) {
+                SourcePos(path, node.startLineNumber).warning(
+                        "found plain 'id' attribute; did you mean the new 'android:id' name?");
+                break;
+            }
+        }
+    }
+}
+
+status_t XMLStream::flatten(const sp<AaptFile>& dest,
+        bool stripComments, bool stripRawValues, bool stripLineNumbers) const
+{
+    LOG_ALWAYS_FATAL_IF(mAttributeOrder.size() != mAttributes.size(),
+            "XMLStream flattened before being resolved");
+
+    StringPool strings(mUTF8);
+    Vector<uint32_t> resids;
+
+    // The strings are pooled in exactly the order XMLNode::flatten() pools
+    // them, starting with the attribute names that have a resource ID.
+    const size_t N = mNodes.size();
+    for (size_t i = 0; i < N; i++) {
+        const node_entry& node = mNodes[i];
+        for (size_t j = 0; j < node.attributeCount; j++) {
+            collectAttributeName(mAttributes[node.firstAttribute + j], &strings, &resids, false);
+        }
+    }
+
+    for (size_t i = 0; i < N; i++) {
+        const node_entry& node = mNodes[i];
+        if (node.removed) {
+            continue;
+        }
+        for (size_t j = 0; j < node.attributeCount; j++) {
+            collectAttributeName(mAttributes[node.firstAttribute + j], &strings, &resids, true);
+        }
+        if (toolsNamespace() != node.uri) {
+            if (node.type == XMLNode::TYPE_NAMESPACE && node.name.size() > 0) {
+                strings.add(node.name, true);
+            }
+            if (node.uri.size() > 0) {
+                strings.add(node.uri, true);
+            }
+        }
+        if (node.type == XMLNode::TYPE_ELEMENT) {
+            strings.add(node.name, true);
+        }
+        if (!stripComments && node.comment.size() > 0) {
+            strings.add(node.comment, true);
+        }
+        for (size_t j = 0; j < node.attributeCount; j++) {
+            const XMLNode::attribute_entry& ae = mAttributes[node.firstAttribute + j];
+            if (ae.ns.size() > 0) {
+                strings.add(ae.ns, true);
+            }
+            if (!stripRawValues || ae.needStringValue()) {
+                strings.add(ae.string, true);
+            }
+        }
+        if (node.type == XMLNode::TYPE_CDATA) {
+            strings.add(node.name, true);
+        } else if (node.type == XMLNode::TYPE_NAMESPACE) {
+            // XMLNode pools the (empty) text of namespace nodes too.
+            strings.add(String16(), true);
+        }
+    }
+
+    sp<AaptFile> stringPool = strings.createStringBlock();
+
+    ResXMLTree_header header;
+    memset(&header, 0, sizeof(header));
+    header.header.type = htods(RES_XML_TYPE);
+    header.header.headerSize = htods(sizeof(header));
+
+    const size_t basePos = dest->getSize();
+    dest->writeData(&header, sizeof(header));
+    dest->writeData(stringPool->getData(), stringPool->getSize());
+
+    if (resids.size() > 0) {
+        const size_t resIdsPos = dest->getSize();
+        const size_t resIdsSize =
+            sizeof(ResChunk_header)+(sizeof(uint32_t)*resids.size());
+        ResChunk_header* idsHeader = (ResChunk_header*)
+            (((const uint8_t*)dest->editData(resIdsPos+resIdsSize))+resIdsPos);
+        idsHeader->type = htods(RES_XML_RESOURCE_MAP_TYPE);
+        idsHeader->headerSize = htods(sizeof(*idsHeader));
+        idsHeader->size = htodl(resIdsSize);
+        uint32_t* ids = (uint32_t*)(idsHeader+1);
+        for (size_t i=0; i<resids.size(); i++) {
+            *ids++ = htodl(resids[i]);
+        }
+    }
+
+    // Elements and namespaces are closed once the nodes inside them have
+    // been written.
+    Vector<size_t> open;
+    for (size_t i = 0; i < N; i++) {
+        while (!open.isEmpty() && mNodes[open.top()].end <= i) {
+            writeEndNode(strings, dest, mNodes[open.top()], stripLineNumbers);
+            open.pop();
+        }
+        const node_entry& node = mNodes[i];
+        if (node.removed) {
+            continue;
+        }
+        writeNode(strings, dest, node, stripComments, stripRawValues, stripLineNumbers);
+        if (node.type != XMLNode::TYPE_CDATA) {
+            open.push(i);
+        }
+    }
+    while (!open.isEmpty()) {
+        writeEndNode(strings, dest, mNodes[open.top()], stripLineNumbers);
+        open.pop();
+    }
+
+    void* data = dest->editData();
+    ResXMLTree_header* hd = (ResXMLTree_header*)(((uint8_t*)data)+basePos);
+    hd->header.size = htodl(dest->getSize()-basePos);
+
+    if (kPrintStringMetrics) {
+        fprintf(stderr, "**** total xml size: %zu / %zu%% strings (in %s)\n",
+                dest->getSize(), (stringPool->getSize()*100)/dest->getSize(),
+                dest->getPath().string());
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ * Writes the start of a node, as XMLNode::flatten_node() does.
+ */
+void XMLStream::writeNode(const StringPool& strings, const sp<AaptFile>& dest,
+        const node_entry& node, bool stripComments, bool stripRawValues,
+        bool stripLineNumbers) const
+{
+    ResXMLTree_node header;
+    memset(&header, 0, sizeof(header));
+    header.header.headerSize = htods(sizeof(header));
+    header.lineNumber = htodl(stripLineNumbers ? 0 : node.startLineNumber);
+    if (!stripComments && node.comment.size() > 0) {
+        header.comment.index = htodl(strings.offsetForString(node.comment));
+    } else {
+        header.comment.index = htodl((uint32_t)-1);
+    }
+
+    if (node.type == XMLNode::TYPE_NAMESPACE) {
+        if (node.uri == toolsNamespace()) {
+            return;
+        }
+        ResXMLTree_namespaceExt namespaceExt;
+        memset(&namespaceExt, 0, sizeof(namespaceExt));
+        namespaceExt.prefix.index = htodl(strings.offsetForString(node.name));
+        namespaceExt.uri.index = htodl(strings.offsetForString(node.uri));
+        header.header.type = htods(RES_XML_START_NAMESPACE_TYPE);
+        header.header.size = htodl(sizeof(header) + sizeof(namespaceExt));
+        dest->writeData(&header, sizeof(header));
+        dest->writeData(&namespaceExt, sizeof(namespaceExt));
+        return;
+    }
+
+    if (node.type == XMLNode::TYPE_CDATA) {
+        ResXMLTree_cdataExt cdataExt;
+        memset(&cdataExt, 0, sizeof(cdataExt));
+        cdataExt.data.index = htodl(strings.offsetForString(node.name));
+        cdataExt.typedData.size = htods(sizeof(cdataExt.typedData));
+        header.header.type = htods(RES_XML_CDATA_TYPE);
+        header.header.size = htodl(sizeof(header) + sizeof(cdataExt));
+        dest->writeData(&header, sizeof(header));
+        dest->writeData(&cdataExt, sizeof(cdataExt));
+        return;
+    }
+
+    const size_t NA = node.attributeCount;
+    const size_t* order = mAttributeOrder.array() + node.firstAttribute;
+
+    ResXMLTree_attrExt attrExt;
+    memset(&attrExt, 0, sizeof(attrExt));
+    if (node.uri.size() > 0) {
+        attrExt.ns.index = htodl(strings.offsetForString(node.uri));
+    } else {
+        attrExt.ns.index = htodl((uint32_t)-1);
+    }
+    attrExt.name.index = htodl(strings.offsetForString(node.name));
+    attrExt.attributeStart = htods(sizeof(attrExt));
+    attrExt.attributeSize = htods(sizeof(ResXMLTree_attribute));
+    attrExt.attributeCount = htods(NA);
+
+    static const String16& id16 = StringAtoms::intern("id");
+    static const String16& class16 = StringAtoms::intern("class");
+    static const String16& style16 = StringAtoms::intern("style");
+    for (size_t i = 0; i < NA; i++) {
+        const XMLNode::attribute_entry& ae = mAttributes[order[i]];
+        if (ae.ns.size() == 0) {
+            if (ae.name == id16) {
+                attrExt.idIndex = htods(i+1);
+            } else if (ae.name == class16) {
+                attrExt.classIndex = htods(i+1);
+            } else if (ae.name == style16) {
+                attrExt.styleIndex = htods(i+1);
+            }
+        }
+    }
+
+    header.header.type = htods(RES_XML_START_ELEMENT_TYPE);
+    header.header.size = htodl(sizeof(header) + sizeof(attrExt)
+            + (sizeof(ResXMLTree_attribute)*NA));
+    dest->writeData(&header, sizeof(header));
+    dest->writeData(&attrExt, sizeof(attrExt));
+
+    ResXMLTree_attribute attr;
+    memset(&attr, 0, sizeof(attr));
+    for (size_t i = 0; i < NA; i++) {
+        const XMLNode::attribute_entry& ae = mAttributes[order[i]];
+        if (ae.ns.size() > 0) {
+            attr.ns.index = htodl(strings.offsetForString(ae.ns));
+        } else {
+            attr.ns.index = htodl((uint32_t)-1);
+        }
+        attr.name.index = htodl(ae.namePoolIdx);
+
+        if (!stripRawValues || ae.needStringValue()) {
+            attr.rawValue.index = htodl(strings.offsetForString(ae.string));
+        } else {
+            attr.rawValue.index = htodl((uint32_t)-1);
+        }
+        attr.typedValue.size = htods(sizeof(attr.typedValue));
+        attr.typedValue.res0 = 0;
+        if (ae.value.dataType == Res_value::TYPE_NULL
+                || ae.value.dataType == Res_value::TYPE_STRING) {
+            attr.typedValue.dataType = Res_value::TYPE_STRING;
+            attr.typedValue.data = htodl(strings.offsetForString(ae.string));
+        } else {
+            attr.typedValue.dataType = ae.value.dataType;
+            attr.typedValue.data = htodl(ae.value.data);
+        }
+        dest->writeData(&attr, sizeof(attr));
+    }
+}
+
+/*
+ * Writes the end of an element or namespace.
+ */
+void XMLStream::writeEndNode(const StringPool& strings, const sp<AaptFile>& dest,
+        const node_entry& node, bool stripLineNumbers) const
+{
+    ResXMLTree_node header;
+    memset(&header, 0, sizeof(header));
+    header.header.headerSize = htods(sizeof(header));
+    header.lineNumber = htodl(stripLineNumbers ? 0 : node.endLineNumber);
+    header.comment.index = htodl((uint32_t)-1);
+
+    if (node.type == XMLNode::TYPE_ELEMENT) {
+        ResXMLTree_endElementExt endElementExt;
+        memset(&endElementExt, 0, sizeof(endElementExt));
+        if (node.uri.size() > 0) {
+            endElementExt.ns.index = htodl(strings.offsetForString(node.uri));
+        } else {
+            endElementExt.ns.index = htodl((uint32_t)-1);
+        }
+        endElementExt.name.index = htodl(strings.offsetForString(node.name));
+        header.header.type = htods(RES_XML_END_ELEMENT_TYPE);
+        header.header.size = htodl(sizeof(header) + sizeof(endElementExt));
+        dest->writeData(&header, sizeof(header));
+        dest->writeData(&endElementExt, sizeof(endElementExt));
+    } else if (node.type == XMLNode::TYPE_NAMESPACE) {
+        if (node.uri == toolsNamespace()) {
+            return;
+        }
+        ResXMLTree_namespaceExt namespaceExt;
+        memset(&namespaceExt, 0, sizeof(namespaceExt));
+        namespaceExt.prefix.index = htodl(strings.offsetForString(node.name));
+        namespaceExt.uri.index = htodl(strings.offsetForString(node.uri));
+        header.header.type = htods(RES_XML_END_NAMESPACE_TYPE);
+        header.header.size = htodl(sizeof(header) + sizeof(namespaceExt));
+        dest->writeData(&header, sizeof(header));
+        dest->writeData(&namespaceExt, sizeof(namespaceExt));
+    }
+}
+
+void XMLStream::addEvent(event_code_t code, size_t node)
+{
+    event_entry e;
+    e.code = code;
+    e.node = node;
+    mEvents.add(e);
+}
+
+/*
+ * Lists the events a flattened copy of the file is read as: the start and
+ * end of each element and namespace declaration, less those of the tools
+ * namespace that flatten() leaves out, and the text of each CDATA node
+ * that wasn't removed.
+ */
+void XMLStream::addEvents()
+{
+    const size_t N = mNodes.size();
+    mEvents.setCapacity(N * 2);
+    Vector<size_t> open;
+    for (size_t i = 0; i <= N; i++) {
+        while (!open.isEmpty() && (i == N || mNodes[open.top()].end <= i)) {
+            const node_entry& node = mNodes[open.top()];
+            if (node.type == XMLNode::TYPE_ELEMENT) {
+                addEvent(ResXMLParser::END_TAG, open.top());
+            } else if (node.uri != toolsNamespace()) {
+                addEvent(ResXMLParser::END_NAMESPACE, open.top());
+            }
+            open.pop();
+        }
+        if (i == N) {
+            break;
+        }
+
+        const node_entry& node = mNodes[i];
+        if (node.type == XMLNode::TYPE_CDATA) {
+            if (!node.removed) {
+                addEvent(ResXMLParser::TEXT, i);
+            }
+            continue;
+        }
+        if (node.type == XMLNode::TYPE_ELEMENT) {
+            addEvent(ResXMLParser::START_TAG, i);
+        } else if (node.uri != toolsNamespace()) {
+            addEvent(ResXMLParser::START_NAMESPACE, i);
+        }
+        open.push(i);
+    }
+}
+
+void XMLStream::restart()
+{
+    mEventCode = ResXMLParser::START_DOCUMENT;
+    mEvent = 0;
+}
+
+XMLStream::event_code_t XMLStream::next()
+{
+    if (mEventCode == ResXMLParser::START_DOCUMENT) {
+        if (mEvents.isEmpty()) {
+            addEvents();
+        }
+        mEvent = 0;
+    } else if (mEventCode == ResXMLParser::END_DOCUMENT
+            || mEventCode == ResXMLParser::BAD_DOCUMENT) {
+        return mEventCode;
+    } else {
+        mEvent++;
+    }
+    mEventCode = mEvent < mEvents.size() ? mEvents[mEvent].code : ResXMLParser::END_DOCUMENT;
+    return mEventCode;
+}
+
+void XMLStream::getPosition(ResXMLPosition* pos) const
+{
+    pos->eventCode = mEventCode;
+    pos->event = mEvent;
+}
+
+void XMLStream::setPosition(const ResXMLPosition& pos)
+{
+    mEventCode = pos.eventCode;
+    mEvent = pos.event;
+}
+
+// The strings of a ResXMLParser: NULL for those a flattened file leaves
+// out, such as empty comments and namespaces.
+static const char16_t* stringOrNull(const String16& str, size_t* outLen)
+{
+    if (str.size() == 0) {
+        return NULL;
+    }
+    *outLen = str.size();
+    return str.string();
+}
+
+uint32_t XMLStream::getLineNumber() const
+{
+    switch (mEventCode) {
+    case ResXMLParser::START_TAG:
+    case ResXMLParser::START_NAMESPACE:
+    case ResXMLParser::TEXT:
+        return mNodes[mEvents[mEvent].node].startLineNumber;
+    case ResXMLParser::END_TAG:
+    case ResXMLParser::END_NAMESPACE:
+        return mNodes[mEvents[mEvent].node].endLineNumber;
+    default:
+        return (uint32_t)-1;
+    }
+}
+
+const char16_t* XMLStream::getComment(size_t* outLen) const
+{
+    // Only the start of an element carries a comment.
+    if (mEventCode != ResXMLParser::START_TAG) {
+        return NULL;
+    }
+    return stringOrNull(mNodes[mEvents[mEvent].node].comment, outLen);
+}
+
+const char16_t* XMLStream::getText(size_t* outLen) const
+{
+    if (mEventCode != ResXMLParser::TEXT) {
+        return NULL;
+    }
+    // Text is kept even when it is empty.
+    const String16& text = mNodes[mEvents[mEvent].node].name;
+    *outLen = text.size();
+    return text.string();
+}
+
+const char16_t* XMLStream::getElementNamespace(size_t* outLen) const
+{
+    if (mEventCode != ResXMLParser::START_TAG && mEventCode != ResXMLParser::END_TAG) {
+        return NULL;
+    }
+    return stringOrNull(mNodes[mEvents[mEvent].node].uri, outLen);
+}
+
+const char16_t* XMLStream::getElementName(size_t* outLen) const
+{
+    if (mEventCode != ResXMLParser::START_TAG && mEventCode != ResXMLParser::END_TAG) {
+        return NULL;
+    }
+    const String16& name = mNodes[mEvents[mEvent].node].name;
+    *outLen = name.size();
+    return name.string();
+}
+
+size_t XMLStream::getAttributeCount() const
+{
+    if (mEventCode != ResXMLParser::START_TAG) {
+        return 0;
+    }
+    return mNodes[mEvents[mEvent].node].attributeCount;
+}
+
+/*
+ * Attributes are in the order they appear in, as flatten() writes them
+ * when none has a resource ID, which is the case for values files.
+ */
+const XMLNode::attribute_entry* XMLStream::attributeAt(size_t idx) const
+{
+    if (idx >= getAttributeCount()) {
+        return NULL;
+    }
+    return &mAttributes[mNodes[mEvents[mEvent].node].firstAttribute + idx];
+}
+
+const char16_t* XMLStream::getAttributeNamespace(size_t idx, size_t* outLen) const
+{
+    const XMLNode::attribute_entry* ae = attributeAt(idx);
+    return ae != NULL ? stringOrNull(ae->ns, outLen) : NULL;
+}
+
+const char16_t* XMLStream::getAttributeName(size_t idx, size_t* outLen) const
+{
+    const XMLNode::attribute_entry* ae = attributeAt(idx);
+    if (ae == NULL) {
+        return NULL;
+    }
+    *outLen = ae->name.size();
+    return ae->name.string();
+}
+
+const char16_t* XMLStream::getAttributeStringValue(size_t idx, size_t* outLen) const
+{
+    const XMLNode::attribute_entry* ae = attributeAt(idx);
+    if (ae == NULL) {
+        return NULL;
+    }
+    *outLen = ae->string.size();
+    return ae->string.string();
+}
+
+ssize_t XMLStream::indexOfAttribute(const char16_t* ns, size_t nsLen,
+                                    const char16_t* attr, size_t attrLen) const
+{
+    if (attr == NULL) {
+        return NAME_NOT_FOUND;
+    }
+    const size_t N = getAttributeCount();
+    for (size_t i = 0; i < N; i++) {
+        const XMLNode::attribute_entry* ae = attributeAt(i);
+        if (strzcmp16(ae->name.string(), ae->name.size(), attr, attrLen) != 0) {
+            continue;
+        }
+        // As in a flattened file, an attribute without a namespace matches
+        // only a NULL one.
+        if (ns == NULL ? ae->ns.size() == 0
+                : ae->ns.size() > 0
+                        && strzcmp16(ae->ns.string(), ae->ns.size(), ns, nsLen) == 0) {
+            return i;
+        }
+    }
+    return NAME_NOT_FOUND;
+}
+
+// Whether "str" is the same as "ascii", which holds only ASCII characters.
+static bool equalsAscii(const String16& str, const char* ascii)
+{
+    const char16_t* p = str.string();
+    const char16_t* end = p + str.size();
+    for (; p < end; p++, ascii++) {
+        if (*ascii == 0 || *p != (char16_t)*ascii) {
+            return false;
+        }
+    }
+    return *ascii == 0;
+}
+
+static bool isAscii(const char* str)
+{
+    for (; *str != 0; str++) {
+        if ((unsigned char)*str >= 0x80) {
+            return false;
+        }
+    }
+    return true;
+}
+
+ssize_t XMLStream::indexOfAttribute(const char* ns, const char* attr) const
+{
+    if (attr == NULL) {
+        return NAME_NOT_FOUND;
+    }
+    if ((ns != NULL && !isAscii(ns)) || !isAscii(attr)) {
+        const String16 ns16(ns != NULL ? ns : "");
+        const String16 attr16(attr);
+        return indexOfAttribute(ns != NULL ? ns16.string() : NULL, ns16.size(),
+                attr16.string(), attr16.size());
+    }
+
+    // The names are compared as they are, without converting them.
+    const size_t N = getAttributeCount();
+    for (size_t i = 0; i < N; i++) {
+        const XMLNode::attribute_entry* ae = attributeAt(i);
+        if (equalsAscii(ae->name, attr)
+                && (ns == NULL ? ae->ns.size() == 0
+                        : ae->ns.size() > 0 && equalsAscii(ae->ns, ns))) {
+            return i;
+        }
+    }
+    return NAME_NOT_FOUND;
+}
@@ -0,0 +1,160 @@
+//
+// Copyright 2014 The Android Open Source Project
+//
+// Compile XML resource files without building an XMLNode tree.
+//
+
+#ifndef XML_STREAM_H
+#define XML_STREAM_H
+
+#include "XMLNode.h"
+
+/*
+ * An XML file parsed into a flat list of nodes, in document order, instead
+ * of a tree of XMLNodes.  It supports only what compiling an ordinary
+ * resource file needs -- whitespace handling, attribute resource IDs, value
+ * parsing and flattening -- and produces exactly the same output as XMLNode
+ * does for it, with far fewer allocations and no reference counting.
+ *
+ * Files that have to be edited as a tree can't be compiled this way.
+ * resolve() reports them, before it has touched the ResourceTable, so that
+ * the caller can compile them with XMLNode instead.
+ */
+class XMLStream
+{
+public:
+    XMLStream();
+
+    status_t parse(const sp<AaptFile>& file);
+
+    /* The counterpart of prepareXmlFile(). */
+    void prepare(int options);
+
+    /*
+     * The counterpart of resolveXmlFile().  Sets *outNeedsTree, and returns
+     * NO_ERROR without having parsed any values, if the file has to be
+     * compiled as an XMLNode tree.
+     */
+    status_t resolve(const Bundle* bundle,
+                     const sp<AaptAssets>& assets,
+                     const sp<AaptFile>& target,
+                     ResourceTable* table,
+                     int options,
+                     bool* outNeedsTree);
+
+    status_t flatten(const sp<AaptFile>& dest, bool stripComments,
+            bool stripRawValues, bool stripLineNumbers) const;
+
+    /*
+     * Warns, as from "path", about each element with a plain 'id'
+     * attribute, for XML_COMPILE_WARN_PLAIN_IDS.
+     */
+    void warnPlainIds(const String8& path) const;
+
+    /*
+     * Reads the file the way a ResXMLParser reads it once it is flattened,
+     * so that values files can be compiled straight from the source: the
+     * same events in the same order, with the same names, text, comments
+     * and line numbers.  Whitespace is as prepare() left it.  Only what
+     * compileResourceFile() asks of a ResXMLParser is provided.
+     */
+    typedef ResXMLParser::event_code_t event_code_t;
+    struct ResXMLPosition {
+        event_code_t eventCode;
+        size_t event;
+    };
+
+    void restart();
+    event_code_t next();
+    void getPosition(ResXMLPosition* pos) const;
+    void setPosition(const ResXMLPosition& pos);
+
+    uint32_t getLineNumber() const;
+    const char16_t* getComment(size_t* outLen) const;
+    const char16_t* getText(size_t* outLen) const;
+    const char16_t* getElementNamespace(size_t* outLen) const;
+    const char16_t* getElementName(size_t* outLen) const;
+
+    size_t getAttributeCount() const;
+    const char16_t* getAttributeNamespace(size_t idx, size_t* outLen) const;
+    const char16_t* getAttributeName(size_t idx, size_t* outLen) const;
+    const char16_t* getAttributeStringValue(size_t idx, size_t* outLen) const;
+    ssize_t indexOfAttribute(const char* ns, const char* attr) const;
+    ssize_t indexOfAttribute(const char16_t* ns, size_t nsLen,
+                             const char16_t* attr, size_t attrLen) const;
+
+private:
+    struct node_entry {
+        XMLNode::type type;
+        // The namespace URI of an element or a namespace declaration.
+        String16 uri;
+        // The name of an element, the prefix of a namespace declaration or
+        // the text of a CDATA node.
+        String16 name;
+        String16 comment;
+        int32_t startLineNumber;
+        int32_t endLineNumber;
+        // The attributes of an element are mAttributes[firstAttribute] on.
+        size_t firstAttribute;
+        size_t attributeCount;
+        // The node containing this one, or -1 for the root.
+        ssize_t parent;
+        // One past the last node inside this one.
+        size_t end;
+        // Set for CDATA nodes removed as whitespace.
+        bool removed;
+    };
+
+    struct ParseState
+    {
+        XMLStream* stream;
+        XML_Parser parser;
+        Vector<size_t> stack;
+        String16 pendingComment;
+    };
+
+    static void XMLCALL
+    startNamespace(void *userData, const char *prefix, const char *uri);
+    static void XMLCALL
+    startElement(void *userData, const char *name, const char **atts);
+    static void XMLCALL
+    characterData(void *userData, const XML_Char *s, int len);
+    static void XMLCALL
+    endElement(void *userData, const char *name);
+    static void XMLCALL
+    endNamespace(void *userData, const char *prefix);
+    static void XMLCALL
+    commentData(void *userData, const char *comment);
+
+    // One event of the walk, and the node it is the start or end of.
+    struct event_entry {
+        event_code_t code;
+        size_t node;
+    };
+
+    size_t addNode(ParseState* st, XMLNode::type type);
+    void addEvent(event_code_t code, size_t node);
+    void addEvents();
+    const XMLNode::attribute_entry* attributeAt(size_t idx) const;
+    bool sortAttributes();
+    void writeNode(const StringPool& strings, const sp<AaptFile>& dest,
+            const node_entry& node, bool stripComments, bool stripRawValues,
+            bool stripLineNumbers) const;
+    void writeEndNode(const StringPool& strings, const sp<AaptFile>& dest,
+            const node_entry& node, bool stripLineNumbers) const;
+
+    String8 mFilename;
+    Vector<node_entry> mNodes;
+    Vector<XMLNode::attribute_entry> mAttributes;
+    // The order attributes are written in, by resource ID and then source
+    // order, as indices into mAttributes.  Filled in by resolve().
+    Vector<size_t> mAttributeOrder;
+    bool mUTF8;
+
+    // The walk, made by the first next().
+    Vector<event_entry> mEvents;
+    event_code_t mEventCode;
+    size_t mEvent;
+};
+
+#endif
@@ -29,6 +29,9 @@
 
 using namespace android;
 
+const uint64_t ZipEntry::kZip64Marker;
+const uint64_t ZipEntry::kZip64LocalThreshold;
+
 /*
  * Initialize a new ZipEntry structure from a FILE* positioned at a
  * CentralDirectoryEntry.
@@ -40,7 +43,6 @@ status_t ZipEntry::initFromCDE(FILE* fp)
 {
     status_t result;
     long posn;
-    bool hasDD;
 
     //ALOGV("initFromCDE ---\n");
 
@@ -55,9 +57,9 @@ status_t ZipEntry::initFromCDE(FILE* fp)
 
     /* using the info in the CDE, go load up the LFH */
     posn = ftell(fp);
-    if (fseek(fp, mCDE.mLocalHeaderRelOffset, SEEK_SET) != 0) {
-        ALOGD("local header seek failed (%ld)\n",
-            mCDE.mLocalHeaderRelOffset);
+    if (fseek(fp, (long) mCDE.mLocalHeaderRelOffset, SEEK_SET) != 0) {
+        ALOGD("local header seek failed (%llu)\n",
+            (unsigned long long) mCDE.mLocalHeaderRelOffset);
         return UNKNOWN_ERROR;
     }
 
@@ -72,6 +74,52 @@ status_t ZipEntry::initFromCDE(FILE* fp)
 
     //mLFH.dump();
 
+    checkLocalHeader();
+    return NO_ERROR;
+}
+
+/*
+ * Initialize a new ZipEntry structure from the archive mapped at "base".
+ *
+ * This is the same as the FILE* version, but the CDE and the LFH are
+ * parsed from memory, so opening a large archive takes no reads or seeks.
+ */
+status_t ZipEntry::initFromCDE(const unsigned char* base, size_t length, size_t* pOffset)
+{
+    status_t result;
+
+    if (*pOffset > length)
+        return UNKNOWN_ERROR;
+    result = mCDE.readBuf(base + *pOffset, length - *pOffset);
+    if (result != NO_ERROR) {
+        ALOGD("mCDE.readBuf failed\n");
+        return result;
+    }
+    /* the record's own lengths, since readBuf() drops any ZIP64 field */
+    const unsigned char* cde = base + *pOffset;
+    *pOffset += CentralDirEntry::kCDELen + getShortLE(&cde[0x1c]) +
+        getShortLE(&cde[0x1e]) + getShortLE(&cde[0x20]);
+
+    if (mCDE.mLocalHeaderRelOffset > length) {
+        ALOGD("local header offset %llu is past the end\n",
+            (unsigned long long) mCDE.mLocalHeaderRelOffset);
+        return UNKNOWN_ERROR;
+    }
+    result = mLFH.readBuf(base + mCDE.mLocalHeaderRelOffset,
+        length - mCDE.mLocalHeaderRelOffset);
+    if (result != NO_ERROR) {
+        ALOGD("mLFH.readBuf failed\n");
+        return result;
+    }
+
+    checkLocalHeader();
+    return NO_ERROR;
+}
+
+void ZipEntry::checkLocalHeader(void) const
+{
+    bool hasDD;
+
     /*
      * We *might* need to read the Data Descriptor at this point and
      * integrate it into the LFH.  If this bit is set, the CRC-32,
@@ -100,8 +148,6 @@ status_t ZipEntry::initFromCDE(FILE* fp)
      * with something we don't support, or use Zip64 extensions.  We
      * can defer worrying about that to when we're extracting data.
      */
-
-    return NO_ERROR;
 }
 
 /*
@@ -208,6 +254,66 @@ status_t ZipEntry::addPadding(int padding)
     return NO_ERROR;
 }
 
+/*
+ * Put an empty ZIP64 field at the front of the LFH "extra" field, for
+ * LocalFileHeader::write() to fill in.
+ */
+void ZipEntry::reserveZip64(void)
+{
+    if (mLFH.hasZip64())
+        return;
+
+    unsigned char* newExtra = new unsigned char[kZip64LocalLen + mLFH.mExtraFieldLength + 1];
+    memset(newExtra, 0, kZip64LocalLen);
+    putShortLE(&newExtra[0], kZip64ExtraTag);
+    putShortLE(&newExtra[2], kZip64LocalLen - 4);
+    if (mLFH.mExtraFieldLength > 0)
+        memcpy(newExtra + kZip64LocalLen, mLFH.mExtraField, mLFH.mExtraFieldLength);
+    newExtra[kZip64LocalLen + mLFH.mExtraFieldLength] = '\0';
+
+    delete[] mLFH.mExtraField;
+    mLFH.mExtraField = newExtra;
+    mLFH.mExtraFieldLength += kZip64LocalLen;
+}
+
+/*
+ * Flag the entry as having a data descriptor.  The CRC and sizes are
+ * zeroed, so that's what the LFH holds.
+ */
+void ZipEntry::initDataDescriptor(int compressionMethod)
+{
+    mCDE.mGPBitFlag |= kUsesDataDescr;
+    setDataInfo(0, 0, 0, compressionMethod);
+}
+
+/*
+ * Write the data descriptor, with its optional signature, and with 64-bit
+ * sizes if the LFH has a ZIP64 field.
+ */
+status_t ZipEntry::writeDataDescriptor(FILE* fp)
+{
+    unsigned char buf[kZip64DataDescriptorLen];
+    size_t len = getDataDescriptorLen();
+
+    assert(len != 0);
+    putLongLE(&buf[0x00], kDataDescriptorSignature);
+    putLongLE(&buf[0x04], mCDE.mCRC32);
+    if (len == kZip64DataDescriptorLen) {
+        putLongLongLE(&buf[0x08], mCDE.mCompressedSize);
+        putLongLongLE(&buf[0x10], mCDE.mUncompressedSize);
+    } else if (mCDE.mCompressedSize >= kZip64Marker || mCDE.mUncompressedSize >= kZip64Marker) {
+        ALOGW("no room for the ZIP64 sizes of '%s'\n", mCDE.mFileName);
+        return UNKNOWN_ERROR;
+    } else {
+        putLongLE(&buf[0x08], mCDE.mCompressedSize);
+        putLongLE(&buf[0x0c], mCDE.mUncompressedSize);
+    }
+
+    if (fwrite(buf, 1, len, fp) != len)
+        return UNKNOWN_ERROR;
+    return NO_ERROR;
+}
+
 /*
  * Set the fields in the LFH equal to the corresponding fields in the CDE.
  *
@@ -383,21 +489,78 @@ void ZipEntry::setModWhen(time_t when)
  */
 status_t ZipEntry::LocalFileHeader::read(FILE* fp)
 {
-    status_t result = NO_ERROR;
-    unsigned char buf[kLFHLen];
+    unsigned char fixed[kLFHLen];
+    if (fread(fixed, 1, kLFHLen, fp) != kLFHLen)
+        return UNKNOWN_ERROR;
+
+    /* read the variable-length fields after it, then parse the lot */
+    size_t len = kLFHLen + ZipEntry::getShortLE(&fixed[0x1a]) +
+        ZipEntry::getShortLE(&fixed[0x1c]);
+    unsigned char* buf = new unsigned char[len];
+    memcpy(buf, fixed, kLFHLen);
+    status_t result = UNKNOWN_ERROR;
+    if (fread(buf + kLFHLen, 1, len - kLFHLen, fp) == len - kLFHLen)
+        result = readBuf(buf, len);
+    delete[] buf;
+    return result;
+}
+
+/*
+ * Copy a variable-length field out of a header, NUL-terminated.
+ */
+static unsigned char* copyField(const unsigned char* src, size_t len)
+{
+    unsigned char* field = new unsigned char[len+1];
+    memcpy(field, src, len);
+    field[len] = '\0';
+    return field;
+}
+
+/*
+ * Find the field tagged "tag" in the "extra" field at "extra".  Returns
+ * the start of the field, at its tag, and sets "pLen" to the length of
+ * its data, or returns NULL if there is no such field.  Padding that
+ * doesn't parse as fields ends the search.
+ */
+static unsigned char* findExtraField(unsigned char* extra, size_t extraLen,
+    unsigned short tag, size_t* pLen)
+{
+    size_t pos = 0;
+    while (extra != NULL && extraLen - pos >= 4) {
+        size_t len = ZipEntry::getShortLE(&extra[pos + 2]);
+        if (len > extraLen - pos - 4)
+            break;
+        if (ZipEntry::getShortLE(&extra[pos]) == tag) {
+            *pLen = len;
+            return extra + pos;
+        }
+        pos += 4 + len;
+    }
+    return NULL;
+}
 
+bool ZipEntry::LocalFileHeader::hasZip64(void) const
+{
+    size_t len;
+    return findExtraField(mExtraField, mExtraFieldLength, kZip64ExtraTag, &len) != NULL
+        && len >= kZip64LocalLen - 4;
+}
+
+/*
+ * Parse a local file header out of "buf", which holds "len" bytes from
+ * its start on.
+ */
+status_t ZipEntry::LocalFileHeader::readBuf(const unsigned char* buf, size_t len)
+{
     assert(mFileName == NULL);
     assert(mExtraField == NULL);
 
-    if (fread(buf, 1, kLFHLen, fp) != kLFHLen) {
-        result = UNKNOWN_ERROR;
-        goto bail;
-    }
+    if (len < kLFHLen)
+        return UNKNOWN_ERROR;
 
     if (ZipEntry::getLongLE(&buf[0x00]) != kSignature) {
         ALOGD("whoops: didn't find expected signature\n");
-        result = UNKNOWN_ERROR;
-        goto bail;
+        return UNKNOWN_ERROR;
     }
 
     mVersionToExtract = ZipEntry::getShortLE(&buf[0x04]);
@@ -413,36 +576,31 @@ status_t ZipEntry::LocalFileHeader::read(FILE* fp)
 
     // TODO: validate sizes
 
+    if (len - kLFHLen < (size_t) mFileNameLength + mExtraFieldLength)
+        return UNKNOWN_ERROR;
+
     /* grab filename */
-    if (mFileNameLength != 0) {
-        mFileName = new unsigned char[mFileNameLength+1];
-        if (mFileName == NULL) {
-            result = NO_MEMORY;
-            goto bail;
-        }
-        if (fread(mFileName, 1, mFileNameLength, fp) != mFileNameLength) {
-            result = UNKNOWN_ERROR;
-            goto bail;
-        }
-        mFileName[mFileNameLength] = '\0';
-    }
+    const unsigned char* ptr = buf + kLFHLen;
+    if (mFileNameLength != 0)
+        mFileName = copyField(ptr, mFileNameLength);
+    ptr += mFileNameLength;
 
     /* grab extra field */
-    if (mExtraFieldLength != 0) {
-        mExtraField = new unsigned char[mExtraFieldLength+1];
-        if (mExtraField == NULL) {
-            result = NO_MEMORY;
-            goto bail;
+    if (mExtraFieldLength != 0)
+        mExtraField = copyField(ptr, mExtraFieldLength);
+
+    /* the LFH's ZIP64 field always holds both sizes */
+    if (mUncompressedSize == kZip64Marker || mCompressedSize == kZip64Marker) {
+        size_t zip64Len;
+        const unsigned char* zip64 = findExtraField(mExtraField, mExtraFieldLength,
+            kZip64ExtraTag, &zip64Len);
+        if (zip64 != NULL && zip64Len >= 16) {
+            mUncompressedSize = ZipEntry::getLongLongLE(&zip64[4]);
+            mCompressedSize = ZipEntry::getLongLongLE(&zip64[12]);
         }
-        if (fread(mExtraField, 1, mExtraFieldLength, fp) != mExtraFieldLength) {
-            result = UNKNOWN_ERROR;
-            goto bail;
-        }
-        mExtraField[mExtraFieldLength] = '\0';
     }
 
-bail:
-    return result;
+    return NO_ERROR;
 }
 
 /*
@@ -452,15 +610,30 @@ status_t ZipEntry::LocalFileHeader::write(FILE* fp)
 {
     unsigned char buf[kLFHLen];
 
+    /* the sizes go in the ZIP64 field, if room was made for one */
+    size_t zip64Len;
+    unsigned char* zip64 = findExtraField(mExtraField, mExtraFieldLength,
+        kZip64ExtraTag, &zip64Len);
+    if (zip64 != NULL && zip64Len >= 16) {
+        ZipEntry::putLongLongLE(&zip64[4], mUncompressedSize);
+        ZipEntry::putLongLongLE(&zip64[12], mCompressedSize);
+    } else if (mUncompressedSize >= kZip64Marker || mCompressedSize >= kZip64Marker) {
+        ALOGW("no room for the ZIP64 sizes of '%s'\n", mFileName);
+        return UNKNOWN_ERROR;
+    } else {
+        zip64 = NULL;
+    }
+
     ZipEntry::putLongLE(&buf[0x00], kSignature);
-    ZipEntry::putShortLE(&buf[0x04], mVersionToExtract);
+    ZipEntry::putShortLE(&buf[0x04], zip64 != NULL && mVersionToExtract < kZip64Version ?
+        kZip64Version : mVersionToExtract);
     ZipEntry::putShortLE(&buf[0x06], mGPBitFlag);
     ZipEntry::putShortLE(&buf[0x08], mCompressionMethod);
     ZipEntry::putShortLE(&buf[0x0a], mLastModFileTime);
     ZipEntry::putShortLE(&buf[0x0c], mLastModFileDate);
     ZipEntry::putLongLE(&buf[0x0e], mCRC32);
-    ZipEntry::putLongLE(&buf[0x12], mCompressedSize);
-    ZipEntry::putLongLE(&buf[0x16], mUncompressedSize);
+    ZipEntry::putLongLE(&buf[0x12], zip64 != NULL ? kZip64Marker : mCompressedSize);
+    ZipEntry::putLongLE(&buf[0x16], zip64 != NULL ? kZip64Marker : mUncompressedSize);
     ZipEntry::putShortLE(&buf[0x1a], mFileNameLength);
     ZipEntry::putShortLE(&buf[0x1c], mExtraFieldLength);
 
@@ -493,8 +666,8 @@ void ZipEntry::LocalFileHeader::dump(void) const
         mVersionToExtract, mGPBitFlag, mCompressionMethod);
     ALOGD("  modTime=0x%04x modDate=0x%04x crc32=0x%08lx\n",
         mLastModFileTime, mLastModFileDate, mCRC32);
-    ALOGD("  compressedSize=%lu uncompressedSize=%lu\n",
-        mCompressedSize, mUncompressedSize);
+    ALOGD("  compressedSize=%llu uncompressedSize=%llu\n",
+        (unsigned long long) mCompressedSize, (unsigned long long) mUncompressedSize);
     ALOGD("  filenameLen=%u extraLen=%u\n",
         mFileNameLength, mExtraFieldLength);
     if (mFileName != NULL)
@@ -517,23 +690,39 @@ void ZipEntry::LocalFileHeader::dump(void) const
  */
 status_t ZipEntry::CentralDirEntry::read(FILE* fp)
 {
-    status_t result = NO_ERROR;
-    unsigned char buf[kCDELen];
+    unsigned char fixed[kCDELen];
+    if (fread(fixed, 1, kCDELen, fp) != kCDELen)
+        return UNKNOWN_ERROR;
+
+    /* read the variable-length fields after it, then parse the lot */
+    size_t len = kCDELen + ZipEntry::getShortLE(&fixed[0x1c]) +
+        ZipEntry::getShortLE(&fixed[0x1e]) + ZipEntry::getShortLE(&fixed[0x20]);
+    unsigned char* buf = new unsigned char[len];
+    memcpy(buf, fixed, kCDELen);
+    status_t result = UNKNOWN_ERROR;
+    if (fread(buf + kCDELen, 1, len - kCDELen, fp) == len - kCDELen)
+        result = readBuf(buf, len);
+    delete[] buf;
+    return result;
+}
 
+/*
+ * Parse a central dir entry out of "buf", which holds "len" bytes from
+ * its start on.
+ */
+status_t ZipEntry::CentralDirEntry::readBuf(const unsigned char* buf, size_t len)
+{
     /* no re-use */
     assert(mFileName == NULL);
     assert(mExtraField == NULL);
     assert(mFileComment == NULL);
 
-    if (fread(buf, 1, kCDELen, fp) != kCDELen) {
-        result = UNKNOWN_ERROR;
-        goto bail;
-    }
+    if (len < kCDELen)
+        return UNKNOWN_ERROR;
 
     if (ZipEntry::getLongLE(&buf[0x00]) != kSignature) {
         ALOGD("Whoops: didn't find expected signature\n");
-        result = UNKNOWN_ERROR;
-        goto bail;
+        return UNKNOWN_ERROR;
     }
 
     mVersionMadeBy = ZipEntry::getShortLE(&buf[0x04]);
@@ -555,78 +744,109 @@ status_t ZipEntry::CentralDirEntry::read(FILE* fp)
 
     // TODO: validate sizes and offsets
 
-    /* grab filename */
-    if (mFileNameLength != 0) {
-        mFileName = new unsigned char[mFileNameLength+1];
-        if (mFileName == NULL) {
-            result = NO_MEMORY;
-            goto bail;
-        }
-        if (fread(mFileName, 1, mFileNameLength, fp) != mFileNameLength) {
-            result = UNKNOWN_ERROR;
-            goto bail;
-        }
-        mFileName[mFileNameLength] = '\0';
-    }
+    if (len - kCDELen <
+        (size_t) mFileNameLength + mExtraFieldLength + mFileCommentLength)
+        return UNKNOWN_ERROR;
 
-    /* read "extra field" */
-    if (mExtraFieldLength != 0) {
-        mExtraField = new unsigned char[mExtraFieldLength+1];
-        if (mExtraField == NULL) {
-            result = NO_MEMORY;
-            goto bail;
-        }
-        if (fread(mExtraField, 1, mExtraFieldLength, fp) != mExtraFieldLength) {
-            result = UNKNOWN_ERROR;
-            goto bail;
-        }
-        mExtraField[mExtraFieldLength] = '\0';
-    }
+    /* grab filename */
+    const unsigned char* ptr = buf + kCDELen;
+    if (mFileNameLength != 0)
+        mFileName = copyField(ptr, mFileNameLength);
+    ptr += mFileNameLength;
 
+    /* grab "extra field" */
+    if (mExtraFieldLength != 0)
+        mExtraField = copyField(ptr, mExtraFieldLength);
+    ptr += mExtraFieldLength;
 
     /* grab comment, if any */
-    if (mFileCommentLength != 0) {
-        mFileComment = new unsigned char[mFileCommentLength+1];
-        if (mFileComment == NULL) {
-            result = NO_MEMORY;
-            goto bail;
+    if (mFileCommentLength != 0)
+        mFileComment = copyField(ptr, mFileCommentLength);
+
+    /*
+     * The ZIP64 field holds, in this order, whichever of the sizes and
+     * the offset are given as kZip64Marker.  It is taken out of the
+     * "extra" field; write() puts back what is needed then.
+     */
+    size_t zip64Len;
+    unsigned char* zip64 = findExtraField(mExtraField, mExtraFieldLength,
+        kZip64ExtraTag, &zip64Len);
+    if (zip64 != NULL) {
+        const unsigned char* value = zip64 + 4;
+        const unsigned char* end = value + zip64Len;
+        if (mUncompressedSize == kZip64Marker && end - value >= 8) {
+            mUncompressedSize = ZipEntry::getLongLongLE(value);
+            value += 8;
+        }
+        if (mCompressedSize == kZip64Marker && end - value >= 8) {
+            mCompressedSize = ZipEntry::getLongLongLE(value);
+            value += 8;
         }
-        if (fread(mFileComment, 1, mFileCommentLength, fp) != mFileCommentLength)
-        {
-            result = UNKNOWN_ERROR;
-            goto bail;
+        if (mLocalHeaderRelOffset == kZip64Marker && end - value >= 8) {
+            mLocalHeaderRelOffset = ZipEntry::getLongLongLE(value);
+        }
+
+        size_t before = zip64 - mExtraField;
+        size_t after = mExtraFieldLength - before - 4 - zip64Len;
+        memmove(zip64, zip64 + 4 + zip64Len, after + 1);   // with the NUL
+        mExtraFieldLength = before + after;
+        if (mExtraFieldLength == 0) {
+            delete[] mExtraField;
+            mExtraField = NULL;
         }
-        mFileComment[mFileCommentLength] = '\0';
     }
 
-bail:
-    return result;
+    return NO_ERROR;
 }
 
 /*
  * Write a central dir entry.
  */
-status_t ZipEntry::CentralDirEntry::write(FILE* fp)
+status_t ZipEntry::CentralDirEntry::write(FILE* fp, bool zip64Sizes)
 {
     unsigned char buf[kCDELen];
 
+    zip64Sizes = zip64Sizes || mUncompressedSize >= kZip64Marker ||
+        mCompressedSize >= kZip64Marker;
+    bool zip64Offset = mLocalHeaderRelOffset >= kZip64Marker;
+
+    unsigned char zip64[4 + 3 * 8];
+    size_t zip64Len = 0;
+    if (zip64Sizes || zip64Offset) {
+        zip64Len = 4;
+        if (zip64Sizes) {
+            ZipEntry::putLongLongLE(&zip64[zip64Len], mUncompressedSize);
+            ZipEntry::putLongLongLE(&zip64[zip64Len + 8], mCompressedSize);
+            zip64Len += 16;
+        }
+        if (zip64Offset) {
+            ZipEntry::putLongLongLE(&zip64[zip64Len], mLocalHeaderRelOffset);
+            zip64Len += 8;
+        }
+        ZipEntry::putShortLE(&zip64[0], kZip64ExtraTag);
+        ZipEntry::putShortLE(&zip64[2], zip64Len - 4);
+        if (mExtraFieldLength + zip64Len > 0xffff)
+            return UNKNOWN_ERROR;
+    }
+
     ZipEntry::putLongLE(&buf[0x00], kSignature);
     ZipEntry::putShortLE(&buf[0x04], mVersionMadeBy);
-    ZipEntry::putShortLE(&buf[0x06], mVersionToExtract);
+    ZipEntry::putShortLE(&buf[0x06], zip64Len > 0 && mVersionToExtract < kZip64Version ?
+        kZip64Version : mVersionToExtract);
     ZipEntry::putShortLE(&buf[0x08], mGPBitFlag);
     ZipEntry::putShortLE(&buf[0x0a], mCompressionMethod);
     ZipEntry::putShortLE(&buf[0x0c], mLastModFileTime);
     ZipEntry::putShortLE(&buf[0x0e], mLastModFileDate);
     ZipEntry::putLongLE(&buf[0x10], mCRC32);
-    ZipEntry::putLongLE(&buf[0x14], mCompressedSize);
-    ZipEntry::putLongLE(&buf[0x18], mUncompressedSize);
+    ZipEntry::putLongLE(&buf[0x14], zip64Sizes ? kZip64Marker : mCompressedSize);
+    ZipEntry::putLongLE(&buf[0x18], zip64Sizes ? kZip64Marker : mUncompressedSize);
     ZipEntry::putShortLE(&buf[0x1c], mFileNameLength);
-    ZipEntry::putShortLE(&buf[0x1e], mExtraFieldLength);
+    ZipEntry::putShortLE(&buf[0x1e], mExtraFieldLength + zip64Len);
     ZipEntry::putShortLE(&buf[0x20], mFileCommentLength);
     ZipEntry::putShortLE(&buf[0x22], mDiskNumberStart);
     ZipEntry::putShortLE(&buf[0x24], mInternalAttrs);
     ZipEntry::putLongLE(&buf[0x26], mExternalAttrs);
-    ZipEntry::putLongLE(&buf[0x2a], mLocalHeaderRelOffset);
+    ZipEntry::putLongLE(&buf[0x2a], zip64Offset ? kZip64Marker : mLocalHeaderRelOffset);
 
     if (fwrite(buf, 1, kCDELen, fp) != kCDELen)
         return UNKNOWN_ERROR;
@@ -637,7 +857,11 @@ status_t ZipEntry::CentralDirEntry::write(FILE* fp)
             return UNKNOWN_ERROR;
     }
 
-    /* write "extra field" */
+    /* write the ZIP64 field, then the rest of the "extra field" */
+    if (zip64Len != 0) {
+        if (fwrite(zip64, 1, zip64Len, fp) != zip64Len)
+            return UNKNOWN_ERROR;
+    }
     if (mExtraFieldLength != 0) {
         if (fwrite(mExtraField, 1, mExtraFieldLength, fp) != mExtraFieldLength)
             return UNKNOWN_ERROR;
@@ -662,13 +886,13 @@ void ZipEntry::CentralDirEntry::dump(void) const
         mVersionMadeBy, mVersionToExtract, mGPBitFlag, mCompressionMethod);
     ALOGD("  modTime=0x%04x modDate=0x%04x crc32=0x%08lx\n",
         mLastModFileTime, mLastModFileDate, mCRC32);
-    ALOGD("  compressedSize=%lu uncompressedSize=%lu\n",
-        mCompressedSize, mUncompressedSize);
+    ALOGD("  compressedSize=%llu uncompressedSize=%llu\n",
+        (unsigned long long) mCompressedSize, (unsigned long long) mUncompressedSize);
     ALOGD("  filenameLen=%u extraLen=%u commentLen=%u\n",
         mFileNameLength, mExtraFieldLength, mFileCommentLength);
-    ALOGD("  diskNumStart=%u intAttr=0x%04x extAttr=0x%08lx relOffset=%lu\n",
+    ALOGD("  diskNumStart=%u intAttr=0x%04x extAttr=0x%08lx relOffset=%llu\n",
         mDiskNumberStart, mInternalAttrs, mExternalAttrs,
-        mLocalHeaderRelOffset);
+        (unsigned long long) mLocalHeaderRelOffset);
 
     if (mFileName != NULL)
         ALOGD("  filename: '%s'\n", mFileName);
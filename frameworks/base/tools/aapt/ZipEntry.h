@@ -24,8 +24,10 @@
 
 #include <utils/Errors.h>
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 namespace android {
 
@@ -42,13 +44,20 @@ class ZipFile;
  * File information is stored in two places: next to the file data (the Local
  * File Header, and possibly a Data Descriptor), and at the end of the file
  * (the Central Directory Entry).  The two must be kept in sync.
+ *
+ * Sizes and offsets are kept in 64 bits.  Those that don't fit the 32-bit
+ * header fields are written to a ZIP64 "extra" field instead.  In the
+ * central directory that field is made up afresh each time it is written,
+ * but the local header's is written over in place, so an entry's data
+ * doesn't move.  Room for it has to be made with reserveZip64() before
+ * the local header is first written.
  */
 class ZipEntry {
 public:
     friend class ZipFile;
 
     ZipEntry(void)
-        : mDeleted(false), mMarked(false)
+        : mDeleted(false), mMarked(false), mHasSha256(false)
         {}
     ~ZipEntry(void) {}
 
@@ -109,6 +118,16 @@ public:
     bool getMarked(void) const { return mMarked; }
     void setMarked(bool val) { mMarked = val; }
 
+    /*
+     * The SHA-256 of the uncompressed data, if whoever added the entry
+     * noted it, or NULL.
+     */
+    const unsigned char* getSha256(void) const { return mHasSha256 ? mSha256 : NULL; }
+    void setSha256(const unsigned char* digest) {
+        memcpy(mSha256, digest, sizeof(mSha256));
+        mHasSha256 = true;
+    }
+
     /*
      * Some basic functions for raw data manipulation.  "LE" means
      * Little Endian.
@@ -117,7 +136,8 @@ public:
         return buf[0] | (buf[1] << 8);
     }
     static inline unsigned long getLongLE(const unsigned char* buf) {
-        return buf[0] | (buf[1] << 8) | (buf[2] << 16) | (buf[3] << 24);
+        /* unsigned, or a high bit set would be sign-extended on LP64 hosts */
+        return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((unsigned long) buf[3] << 24);
     }
     static inline void putShortLE(unsigned char* buf, short val) {
         buf[0] = (unsigned char) val;
@@ -129,6 +149,13 @@ public:
         buf[2] = (unsigned char) (val >> 16);
         buf[3] = (unsigned char) (val >> 24);
     }
+    static inline uint64_t getLongLongLE(const unsigned char* buf) {
+        return (uint64_t) getLongLE(buf) | ((uint64_t) getLongLE(buf + 4) << 32);
+    }
+    static inline void putLongLongLE(unsigned char* buf, uint64_t val) {
+        putLongLE(buf, (long) (val & 0xffffffff));
+        putLongLE(buf + 4, (long) (val >> 32));
+    }
 
     /* defined for Zip archives */
     enum {
@@ -160,6 +187,13 @@ protected:
      */
     status_t initFromCDE(FILE* fp);
 
+    /*
+     * Initialize the structure from the whole archive mapped at "base",
+     * with our Central Directory entry at "*pOffset", which is advanced
+     * past it.
+     */
+    status_t initFromCDE(const unsigned char* base, size_t length, size_t* pOffset);
+
     /*
      * Initialize the structure for a new file.  We need the filename
      * and comment so that we can properly size the LFH area.  The
@@ -179,12 +213,58 @@ protected:
      */
     status_t addPadding(int padding);
 
+    /*
+     * Make room in the LFH for the ZIP64 sizes, if it has none yet, for an
+     * entry that is or may grow to 4GB.  Call it before the LFH is first
+     * written and before any padding is added.
+     */
+    void reserveZip64(void);
+
+    /*
+     * Returns true if an entry whose data is "size" bytes, compressed or
+     * not, needs reserveZip64().  Deflating can grow data a little, so
+     * this is true somewhat short of 4GB.
+     */
+    static bool needsZip64(uint64_t size) { return size >= kZip64LocalThreshold; }
+
+    /* Write the CDE, agreeing with the LFH about the ZIP64 sizes. */
+    status_t writeCDE(FILE* fp) { return mCDE.write(fp, mLFH.hasZip64()); }
+
     /*
      * Set information about the data for this entry.
      */
     void setDataInfo(long uncompLen, long compLen, unsigned long crc32,
         int compressionMethod);
 
+    /*
+     * Set just the CRC, in both headers, for data whose sizes were given
+     * to setDataInfo() before it was read.  It is kLFHCRCOffset bytes
+     * into the LFH, for writers that patch it in place.
+     */
+    void setCRC32(unsigned long crc32) {
+        mCDE.mCRC32 = crc32;
+        mLFH.mCRC32 = crc32;
+    }
+    enum { kLFHCRCOffset = 0x0e };
+
+    /*
+     * Set up an entry whose CRC and sizes follow its data in a data
+     * descriptor, for output that can't go back to the LFH.  The LFH
+     * gets the kUsesDataDescr flag and zeroes; setDataInfo() fills in the
+     * real values once the data is written.
+     */
+    void initDataDescriptor(int compressionMethod);
+
+    /* Write the data descriptor of such an entry, after its data. */
+    status_t writeDataDescriptor(FILE* fp);
+
+    /* The length of the data descriptor, if the entry has one. */
+    size_t getDataDescriptorLen(void) const {
+        if ((mLFH.mGPBitFlag & kUsesDataDescr) == 0)
+            return 0;
+        return mLFH.hasZip64() ? kZip64DataDescriptorLen : kDataDescriptorLen;
+    }
+
     /*
      * Set the modification date.
      */
@@ -195,7 +275,7 @@ protected:
      * the current file.
      */
     void setLFHOffset(off_t offset) {
-        mCDE.mLocalHeaderRelOffset = (long) offset;
+        mCDE.mLocalHeaderRelOffset = (uint64_t) offset;
     }
 
     /* mark for deletion; used by ZipFile::remove() */
@@ -208,10 +288,14 @@ private:
 
     /* returns "true" if the CDE and the LFH agree */
     bool compareHeaders(void) const;
+    /* checks the LFH once both headers have been read */
+    void checkLocalHeader(void) const;
     void copyCDEtoLFH(void);
 
     bool        mDeleted;       // set if entry is pending deletion
     bool        mMarked;        // app-defined marker
+    bool        mHasSha256;
+    unsigned char mSha256[32];
 
     /*
      * Every entry in the Zip archive starts off with one of these.
@@ -238,8 +322,12 @@ private:
         }
 
         status_t read(FILE* fp);
+        status_t readBuf(const unsigned char* buf, size_t len);
         status_t write(FILE* fp);
 
+        /* true if the "extra" field has room for the ZIP64 sizes */
+        bool hasZip64(void) const;
+
         // unsigned long mSignature;
         unsigned short  mVersionToExtract;
         unsigned short  mGPBitFlag;
@@ -247,12 +335,12 @@ private:
         unsigned short  mLastModFileTime;
         unsigned short  mLastModFileDate;
         unsigned long   mCRC32;
-        unsigned long   mCompressedSize;
-        unsigned long   mUncompressedSize;
+        uint64_t        mCompressedSize;
+        uint64_t        mUncompressedSize;
         unsigned short  mFileNameLength;
         unsigned short  mExtraFieldLength;
         unsigned char*  mFileName;
-        unsigned char*  mExtraField;
+        unsigned char*  mExtraField;    // with the ZIP64 field, if any
 
         enum {
             kSignature      = 0x04034b50,
@@ -296,7 +384,13 @@ private:
         }
 
         status_t read(FILE* fp);
-        status_t write(FILE* fp);
+        status_t readBuf(const unsigned char* buf, size_t len);
+
+        /*
+         * Write the CDE, with a ZIP64 field for whatever doesn't fit in
+         * 32 bits, and for the sizes anyway if "zip64Sizes" is set.
+         */
+        status_t write(FILE* fp, bool zip64Sizes);
 
         CentralDirEntry& operator=(const CentralDirEntry& src);
 
@@ -308,17 +402,17 @@ private:
         unsigned short  mLastModFileTime;
         unsigned short  mLastModFileDate;
         unsigned long   mCRC32;
-        unsigned long   mCompressedSize;
-        unsigned long   mUncompressedSize;
+        uint64_t        mCompressedSize;
+        uint64_t        mUncompressedSize;
         unsigned short  mFileNameLength;
         unsigned short  mExtraFieldLength;
         unsigned short  mFileCommentLength;
         unsigned short  mDiskNumberStart;
         unsigned short  mInternalAttrs;
         unsigned long   mExternalAttrs;
-        unsigned long   mLocalHeaderRelOffset;
+        uint64_t        mLocalHeaderRelOffset;
         unsigned char*  mFileName;
-        unsigned char*  mExtraField;
+        unsigned char*  mExtraField;    // without the ZIP64 field
         unsigned char*  mFileComment;
 
         void dump(void) const;
@@ -330,14 +424,24 @@ private:
     };
 
     enum {
-        //kDataDescriptorSignature  = 0x08074b50,   // currently unused
+        kDataDescriptorSignature  = 0x08074b50,
         kDataDescriptorLen  = 16,           // four 32-bit fields
+        kZip64DataDescriptorLen = 24,       // with 64-bit sizes
 
         kDefaultVersion     = 20,           // need deflate, nothing much else
         kDefaultMadeBy      = 0x0317,       // 03=UNIX, 17=spec v2.3
         kUsesDataDescr      = 0x0008,       // GPBitFlag bit 3
+
+        kZip64Version       = 45,           // needed to read ZIP64 fields
+        kZip64ExtraTag      = 0x0001,       // "extra" field holding them
+        kZip64LocalLen      = 20,           // the LFH's: tag, size, 2 sizes
     };
 
+    /* a 32-bit size or offset of this value is given in the ZIP64 field */
+    static const uint64_t kZip64Marker = 0xffffffff;
+    /* see needsZip64() */
+    static const uint64_t kZip64LocalThreshold = 0xff000000;
+
     LocalFileHeader     mLFH;
     CentralDirEntry     mCDE;
 };
@@ -21,9 +21,15 @@
 #define LOG_TAG "zip"
 
 #include <androidfw/ZipUtils.h>
+#include <cutils/threads.h>
+#include <utils/FileMap.h>
+#include <utils/JenkinsHash.h>
 #include <utils/Log.h>
 
 #include "ZipFile.h"
+#include "FileCosts.h"
+#include "MappedFile.h"
+#include "WorkQueue.h"
 
 #include <zlib.h>
 #define DEF_MEM_LEVEL 8                // normally in zutil.h?
@@ -32,6 +38,10 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <assert.h>
+#include <fcntl.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 using namespace android;
 
@@ -53,6 +63,206 @@ static status_t errnoToStatus(int err)
         return UNKNOWN_ERROR;
 }
 
+size_t ZipFile::sDeflateThreads = 1;
+
+/*
+ * The other end of mZipFp for a kOpenPipe archive, counting what it is
+ * given since a pipe can't say where it is.
+ */
+struct android::ZipPipeSink {
+    int fd;
+    long written;
+};
+
+#if defined(__linux__) || defined(__APPLE__)
+static bool writeFully(int fd, const char* buf, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = write(fd, buf, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        buf += n;
+        size -= n;
+    }
+    return true;
+}
+#endif
+
+#if defined(__linux__)
+static ssize_t pipeSinkWrite(void* cookie, const char* buf, size_t size)
+{
+    ZipPipeSink* sink = (ZipPipeSink*) cookie;
+    if (!writeFully(sink->fd, buf, size))
+        return -1;
+    sink->written += size;
+    return size;
+}
+
+static int pipeSinkClose(void* cookie)
+{
+    ZipPipeSink* sink = (ZipPipeSink*) cookie;
+    int result = close(sink->fd);
+    delete sink;
+    return result;
+}
+#elif defined(__APPLE__)
+static int pipeSinkWrite(void* cookie, const char* buf, int size)
+{
+    ZipPipeSink* sink = (ZipPipeSink*) cookie;
+    if (!writeFully(sink->fd, buf, size))
+        return -1;
+    sink->written += size;
+    return size;
+}
+
+static int pipeSinkClose(void* cookie)
+{
+    ZipPipeSink* sink = (ZipPipeSink*) cookie;
+    int result = close(sink->fd);
+    delete sink;
+    return result;
+}
+#endif
+
+/*
+ * Open "zipFileName", a FIFO or a device, for a kOpenPipe archive.
+ */
+status_t ZipFile::openPipe(const char* zipFileName)
+{
+#if defined(__linux__) || defined(__APPLE__)
+    int fd = ::open(zipFileName, O_WRONLY);
+    if (fd < 0) {
+        int err = errno;
+        ALOGD("open failed: %d\n", err);
+        return errnoToStatus(err);
+    }
+
+    ZipPipeSink* sink = new ZipPipeSink;
+    sink->fd = fd;
+    sink->written = 0;
+#if defined(__linux__)
+    cookie_io_functions_t functions;
+    memset(&functions, 0, sizeof(functions));
+    functions.write = pipeSinkWrite;
+    functions.close = pipeSinkClose;
+    mZipFp = fopencookie(sink, "w", functions);
+#else
+    mZipFp = funopen(sink, NULL, pipeSinkWrite, NULL, pipeSinkClose);
+#endif
+    if (mZipFp == NULL) {
+        close(fd);
+        delete sink;
+        return NO_MEMORY;
+    }
+    mPipe = sink;
+    return NO_ERROR;
+#else
+    (void) zipFileName;
+    return INVALID_OPERATION;
+#endif
+}
+
+/*
+ * Files smaller than this are copied by the thread adding them even in a
+ * kOpenParallel archive; handing them to a worker would cost more than the
+ * copy.
+ */
+static const off_t kParallelMinSize = 64 * 1024;
+
+/*
+ * The work units still copying files into a kOpenParallel archive, the
+ * CRCs of the copies they have made, which ZipFile::waitForWriters() gives
+ * to the entries, and how the first one to fail did.
+ */
+struct android::ZipParallelWriter {
+    ZipParallelWriter() : group(WorkQueue::getShared()), result(NO_ERROR) { }
+
+    struct Copied {
+        ZipEntry* entry;
+        unsigned long crc;
+    };
+
+    WorkQueue::Group group;
+    Mutex lock;
+    Vector<Copied> copied;
+    status_t result;
+};
+
+#ifndef _WIN32
+static bool pwriteFully(int fd, const void* buf, size_t size, off_t offset)
+{
+    const char* p = (const char*) buf;
+    while (size > 0) {
+        ssize_t n = pwrite(fd, p, size, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        offset += n;
+        size -= n;
+    }
+    return true;
+}
+
+/*
+ * Copies a mapped file to the space ZipFile::addParallel() left for it,
+ * and patches its CRC into the LFH written there before.
+ */
+class StoreEntryWorkUnit : public WorkQueue::WorkUnit {
+public:
+    StoreEntryWorkUnit(ZipParallelWriter* writer, int fd, ZipEntry* pEntry,
+                       MappedFile* map, off_t dataPosn, off_t crcPosn)
+        : mWriter(writer), mFd(fd), mEntry(pEntry), mMap(map), mDataPosn(dataPosn),
+          mCRCPosn(crcPosn) { }
+
+    virtual ~StoreEntryWorkUnit() {
+        delete mMap;
+    }
+
+    virtual bool run() {
+        const unsigned char* data = (const unsigned char*) mMap->getData();
+        size_t left = mMap->getSize();
+        unsigned long crc = crc32(0L, Z_NULL, 0);
+        while (left > 0) {
+            /* crc32() takes a uInt */
+            const size_t n = left < (1U << 30) ? left : (1U << 30);
+            crc = crc32(crc, data, n);
+            data += n;
+            left -= n;
+        }
+
+        unsigned char crcBuf[4];
+        ZipEntry::putLongLE(crcBuf, crc);
+        const bool ok = pwriteFully(mFd, mMap->getData(), mMap->getSize(), mDataPosn)
+                && pwriteFully(mFd, crcBuf, sizeof(crcBuf), mCRCPosn);
+        if (!ok)
+            ALOGW("unable to write '%s': %s\n", mEntry->getFileName(), strerror(errno));
+
+        AutoMutex _l(mWriter->lock);
+        if (ok) {
+            ZipParallelWriter::Copied copied;
+            copied.entry = mEntry;
+            copied.crc = crc;
+            mWriter->copied.add(copied);
+        } else if (mWriter->result == NO_ERROR) {
+            mWriter->result = UNKNOWN_ERROR;
+        }
+        return true;    // the shared queue must not be canceled
+    }
+
+private:
+    ZipParallelWriter* const mWriter;
+    const int mFd;
+    ZipEntry* const mEntry;
+    MappedFile* const mMap;
+    const off_t mDataPosn;
+    const off_t mCRCPosn;
+};
+#endif
+
 /*
  * Open a file and parse its guts.
  */
@@ -71,6 +281,12 @@ status_t ZipFile::open(const char* zipFileName, int flags)
         return INVALID_OPERATION;       // not neither
     if ((flags & kOpenCreate) && !(flags & kOpenReadWrite))
         return INVALID_OPERATION;       // create requires write
+    if ((flags & kOpenStreaming) && !(flags & kOpenTruncate))
+        return INVALID_OPERATION;       // streaming starts from scratch
+    if ((flags & kOpenPipe) && !(flags & kOpenStreaming))
+        return INVALID_OPERATION;       // a pipe only goes forward
+    if ((flags & kOpenParallel) && (!(flags & kOpenStreaming) || (flags & kOpenPipe)))
+        return INVALID_OPERATION;       // workers write at known offsets
 
     if (flags & kOpenTruncate) {
         newArchive = true;
@@ -93,12 +309,19 @@ status_t ZipFile::open(const char* zipFileName, int flags)
     } else {
         openflags = FILE_OPEN_RO;
     }
-    mZipFp = fopen(zipFileName, openflags);
-    if (mZipFp == NULL) {
-        int err = errno;
-        ALOGD("fopen failed: %d\n", err);
-        return errnoToStatus(err);
+    if (flags & kOpenPipe) {
+        status_t result = openPipe(zipFileName);
+        if (result != NO_ERROR)
+            return result;
+    } else {
+        mZipFp = fopen(zipFileName, openflags);
+        if (mZipFp == NULL) {
+            int err = errno;
+            ALOGD("fopen failed: %d\n", err);
+            return errnoToStatus(err);
+        }
     }
+    mFileName.setTo(zipFileName);
 
     status_t result;
     if (!newArchive) {
@@ -125,6 +348,11 @@ status_t ZipFile::open(const char* zipFileName, int flags)
         mReadOnly = true;
     else
         assert(!mReadOnly);
+    mStreaming = (flags & kOpenStreaming) != 0;
+#ifndef _WIN32
+    if (flags & kOpenParallel)
+        mWriters = new ZipParallelWriter;
+#endif
 
     return result;
 }
@@ -146,27 +374,68 @@ ZipEntry* ZipFile::getEntryByIndex(int idx) const
 ZipEntry* ZipFile::getEntryByName(const char* fileName) const
 {
     /*
-     * Do a stupid linear string-compare search.
-     *
-     * There are various ways to speed this up, especially since it's rare
-     * to intermingle changes to the archive with "get by name" calls.  We
-     * don't want to sort the mEntries vector itself, however, because
-     * it's used to recreate the Central Directory.
-     *
-     * (Hash table works, parallel list of pointers in sorted order is good.)
+     * We don't want to sort the mEntries vector itself, because it's used
+     * to recreate the Central Directory, so a hash index is kept alongside.
      */
-    int idx;
+    EntryName key(fileName);
+    ssize_t idx = mNameIndex.find(-1, key.hash(), key);
+    if (idx < 0)
+        return NULL;
+
+    return mNameIndex.entryAt(idx).mEntry;
+}
+
+hash_t ZipFile::EntryName::hash(void) const
+{
+    return JenkinsHashWhiten(JenkinsHashMixBytes(0,
+        (const uint8_t*) mName, strlen(mName)));
+}
 
-    for (idx = mEntries.size()-1; idx >= 0; idx--) {
-        ZipEntry* pEntry = mEntries[idx];
-        if (!pEntry->getDeleted() &&
-            strcmp(fileName, pEntry->getFileName()) == 0)
+/*
+ * Make "pEntry" the entry returned for its name.
+ *
+ * The old linear search returned the last matching entry in mEntries, so
+ * a newer entry with the same name replaces the one in the index.
+ */
+void ZipFile::indexEntry(ZipEntry* pEntry)
+{
+    EntryName key(pEntry->getFileName());
+    hash_t hash = key.hash();
+    ssize_t idx = mNameIndex.find(-1, hash, key);
+    if (idx >= 0) {
+        mNameIndex.editEntryAt(idx).mEntry = pEntry;
+        mNameIndexHasDuplicates = true;
+    } else {
+        mNameIndex.add(hash, NameIndexEntry(pEntry));
+    }
+}
+
+/*
+ * Drop "pEntry" from the index because it is being deleted.
+ *
+ * If some other live entry has the same name (only possible in archives
+ * that we didn't write), the latest such entry takes its place.
+ */
+void ZipFile::unindexEntry(ZipEntry* pEntry)
+{
+    EntryName key(pEntry->getFileName());
+    hash_t hash = key.hash();
+    ssize_t idx = mNameIndex.find(-1, hash, key);
+    if (idx < 0 || mNameIndex.entryAt(idx).mEntry != pEntry)
+        return;
+    mNameIndex.removeAt(idx);
+
+    if (!mNameIndexHasDuplicates)
+        return;
+    for (int i = mEntries.size()-1; i >= 0; i--) {
+        ZipEntry* pOther = mEntries[i];
+        if (pOther != pEntry && !pOther->getDeleted() &&
+            strcmp(pOther->getFileName(), pEntry->getFileName()) == 0)
         {
-            return pEntry;
+            mNameIndex.add(hash, NameIndexEntry(pOther));
+            break;
         }
     }
-
-    return NULL;
 }
 
 /*
@@ -210,7 +479,7 @@ status_t ZipFile::readCentralDir(void)
     int i;
 
     fseek(mZipFp, 0, SEEK_END);
-    fileLength = ftell(mZipFp);
+    fileLength = tell();
     rewind(mZipFp);
 
     /* too small to be a ZIP archive? */
@@ -269,6 +538,16 @@ status_t ZipFile::readCentralDir(void)
         ALOGD("Failure reading %ld bytes of EOCD values", readAmount - i);
         goto bail;
     }
+
+    /*
+     * A ZIP64 archive has a locator just before the EOCD, pointing at a
+     * second EOCD with 64-bit counts and offsets.
+     */
+    if (seekStart + i >= EndOfCentralDir::kZip64LocatorLen) {
+        result = readZip64EndOfCentralDir(seekStart + i);
+        if (result != NO_ERROR)
+            goto bail;
+    }
     //mEOCD.dump();
 
     if (mEOCD.mDiskNumber != 0 || mEOCD.mDiskWithCentralDir != 0 ||
@@ -292,10 +571,23 @@ status_t ZipFile::readCentralDir(void)
      *
      * The only thing we really need right now is the file comment, which
      * we're hoping to preserve.
+     *
+     * Each entry's LFH is read as well, which at one seek per entry made
+     * opening a large archive slow.  So the archive is mapped, if it can
+     * be, and the entries parsed from memory.
      */
-    if (fseek(mZipFp, mEOCD.mCentralDirOffset, SEEK_SET) != 0) {
-        ALOGD("Failure seeking to central dir offset %ld\n",
-             mEOCD.mCentralDirOffset);
+    {
+        FileMap map;
+        if (map.create(NULL, fileno(mZipFp), 0, fileLength, true)) {
+            result = readCentralDirEntries((const unsigned char*) map.getDataPtr(),
+                fileLength);
+            goto bail;
+        }
+    }
+
+    if (fseek(mZipFp, (long) mEOCD.mCentralDirOffset, SEEK_SET) != 0) {
+        ALOGD("Failure seeking to central dir offset %llu\n",
+             (unsigned long long) mEOCD.mCentralDirOffset);
         result = UNKNOWN_ERROR;
         goto bail;
     }
@@ -303,8 +595,8 @@ status_t ZipFile::readCentralDir(void)
     /*
      * Loop through and read the central dir entries.
      */
-    ALOGV("Scanning %d entries...\n", mEOCD.mTotalNumEntries);
-    int entry;
+    ALOGV("Scanning %llu entries...\n", (unsigned long long) mEOCD.mTotalNumEntries);
+    uint64_t entry;
     for (entry = 0; entry < mEOCD.mTotalNumEntries; entry++) {
         ZipEntry* pEntry = new ZipEntry;
 
@@ -316,11 +608,13 @@ status_t ZipFile::readCentralDir(void)
         }
 
         mEntries.add(pEntry);
+        indexEntry(pEntry);
     }
 
 
     /*
-     * If all went well, we should now be back at the EOCD.
+     * If all went well, we should now be back at the EOCD, or the ZIP64
+     * one in front of it.
      */
     {
         unsigned char checkBuf[4];
@@ -329,7 +623,8 @@ status_t ZipFile::readCentralDir(void)
             result = INVALID_OPERATION;
             goto bail;
         }
-        if (ZipEntry::getLongLE(checkBuf) != EndOfCentralDir::kSignature) {
+        if (ZipEntry::getLongLE(checkBuf) != EndOfCentralDir::kSignature &&
+            ZipEntry::getLongLE(checkBuf) != EndOfCentralDir::kZip64Signature) {
             ALOGD("EOCD read check failed\n");
             result = UNKNOWN_ERROR;
             goto bail;
@@ -342,6 +637,80 @@ bail:
     return result;
 }
 
+/*
+ * Look for a ZIP64 locator in front of the EOCD at "eocdPosn", and take
+ * the values of the ZIP64 EOCD it points at if there is one.
+ */
+status_t ZipFile::readZip64EndOfCentralDir(off_t eocdPosn)
+{
+    unsigned char locator[EndOfCentralDir::kZip64LocatorLen];
+    unsigned char record[EndOfCentralDir::kZip64EOCDLen];
+
+    if (fseek(mZipFp, eocdPosn - EndOfCentralDir::kZip64LocatorLen, SEEK_SET) != 0 ||
+        fread(locator, 1, sizeof(locator), mZipFp) != sizeof(locator))
+    {
+        ALOGD("Failure reading ZIP64 locator\n");
+        return UNKNOWN_ERROR;
+    }
+    if (ZipEntry::getLongLE(&locator[0x00]) != EndOfCentralDir::kZip64LocatorSignature)
+        return NO_ERROR;
+
+    uint64_t recordPosn = ZipEntry::getLongLongLE(&locator[0x08]);
+    if (ZipEntry::getLongLE(&locator[0x04]) != 0 || ZipEntry::getLongLE(&locator[0x10]) != 1) {
+        ALOGD("Archive spanning not supported\n");
+        return INVALID_OPERATION;
+    }
+    if (recordPosn + EndOfCentralDir::kZip64EOCDLen > (uint64_t) eocdPosn ||
+        fseek(mZipFp, (long) recordPosn, SEEK_SET) != 0 ||
+        fread(record, 1, sizeof(record), mZipFp) != sizeof(record))
+    {
+        ALOGD("Failure reading ZIP64 EOCD at %llu\n", (unsigned long long) recordPosn);
+        return UNKNOWN_ERROR;
+    }
+
+    return mEOCD.readZip64(record, sizeof(record));
+}
+
+/*
+ * Load the central directory entries out of the archive mapped at "base".
+ */
+status_t ZipFile::readCentralDirEntries(const unsigned char* base, size_t length)
+{
+    status_t result;
+    size_t offset = mEOCD.mCentralDirOffset;
+
+    mEntries.setCapacity(mEOCD.mTotalNumEntries);
+    ALOGV("Scanning %llu mapped entries...\n", (unsigned long long) mEOCD.mTotalNumEntries);
+    for (uint64_t entry = 0; entry < mEOCD.mTotalNumEntries; entry++) {
+        ZipEntry* pEntry = new ZipEntry;
+
+        result = pEntry->initFromCDE(base, length, &offset);
+        if (result != NO_ERROR) {
+            ALOGD("initFromCDE failed\n");
+            delete pEntry;
+            return result;
+        }
+
+        mEntries.add(pEntry);
+        indexEntry(pEntry);
+    }
+
+    /*
+     * If all went well, we should now be at the EOCD, or the ZIP64 one.
+     */
+    if (offset > length || length - offset < 4) {
+        ALOGD("EOCD check read failed\n");
+        return INVALID_OPERATION;
+    }
+    if (ZipEntry::getLongLE(base + offset) != EndOfCentralDir::kSignature &&
+        ZipEntry::getLongLE(base + offset) != EndOfCentralDir::kZip64Signature) {
+        ALOGD("EOCD read check failed\n");
+        return UNKNOWN_ERROR;
+    }
+    ALOGV("+++ EOCD read check passed\n");
+    return NO_ERROR;
+}
+
 
 /*
  * Add a new file to the archive.
@@ -357,14 +726,16 @@ bail:
  */
 status_t ZipFile::addCommon(const char* fileName, const void* data, size_t size,
     const char* storageName, int sourceType, int compressionMethod,
-    ZipEntry** ppEntry)
+    int compressionLevel, int alignment, ZipEntry** ppEntry)
 {
     ZipEntry* pEntry = NULL;
     status_t result = NO_ERROR;
     long lfhPosn, startPosn, endPosn, uncompressedLen;
     FILE* inputFp = NULL;
+    MappedFile inputMap;
     unsigned long crc;
     time_t modWhen;
+    bool parallel = false;
 
     if (mReadOnly)
         return INVALID_OPERATION;
@@ -380,13 +751,35 @@ status_t ZipFile::addCommon(const char* fileName, const void* data, size_t size,
     if (getEntryByName(storageName) != NULL)
         return ALREADY_EXISTS;
 
-    if (!data) {
+    if (mWriters != NULL && !data && sourceType == ZipEntry::kCompressStored &&
+        compressionMethod == ZipEntry::kCompressStored) {
+        /* large files are mapped by addParallel(), for its worker to keep */
+        struct stat sb;
+        parallel = stat(fileName, &sb) == 0 && sb.st_size >= kParallelMinSize;
+    }
+
+    /* what deflating it here costs, for --cost-report */
+    FileCostSpan cost(FileCosts::COMPRESS, String8(fileName != NULL ? fileName : storageName));
+    if (parallel || sourceType != ZipEntry::kCompressStored ||
+        compressionMethod != ZipEntry::kCompressDeflated)
+        cost.cancel();
+
+    if (parallel) {
+        /* handled below */
+    } else if (!data && sourceType == ZipEntry::kCompressStored) {
+        /* map plain files, and add them as if they were in memory */
+        result = inputMap.open(fileName);
+        if (result != NO_ERROR)
+            return result;
+        data = inputMap.getData();
+        size = inputMap.getSize();
+    } else if (!data) {
         inputFp = fopen(fileName, FILE_OPEN_RO);
         if (inputFp == NULL)
             return errnoToStatus(errno);
     }
 
-    if (fseek(mZipFp, mEOCD.mCentralDirOffset, SEEK_SET) != 0) {
+    if (seekToCentralDir() != NO_ERROR) {
         result = UNKNOWN_ERROR;
         goto bail;
     }
@@ -394,19 +787,56 @@ status_t ZipFile::addCommon(const char* fileName, const void* data, size_t size,
     pEntry = new ZipEntry;
     pEntry->initNew(storageName, NULL);
 
+    if (parallel) {
+        result = addParallel(fileName, pEntry, alignment);
+        if (result != NO_ERROR)
+            goto bail;
+        goto added;
+    }
+
+    if (mStreaming) {
+        if (inputMap.getData() != NULL)
+            modWhen = inputMap.getModTime();
+        else
+            modWhen = (inputFp ? getModTime(fileno(inputFp)) : getArchiveModTime());
+        result = addStreaming(inputFp, data, size, pEntry, sourceType,
+                    compressionMethod, compressionLevel, alignment, modWhen);
+        if (result != NO_ERROR)
+            goto bail;
+        goto added;
+    }
+
     /*
      * From here on out, failures are more interesting.
      */
     mNeedCDRewrite = true;
 
+    /*
+     * The final sizes aren't known yet, so make room for ZIP64 ones in
+     * the LFH of anything close to 4GB; growing it later would mean
+     * moving the data.
+     */
+    if (inputFp != NULL) {
+        struct stat sb;
+        if (fstat(fileno(inputFp), &sb) == 0 && ZipEntry::needsZip64(sb.st_size))
+            pEntry->reserveZip64();
+    } else if (ZipEntry::needsZip64(size)) {
+        pEntry->reserveZip64();
+    }
+
     /*
      * Write the LFH, even though it's still mostly blank.  We need it
      * as a place-holder.  In theory the LFH isn't necessary, but in
      * practice some utilities demand it.
      */
-    lfhPosn = ftell(mZipFp);
+    lfhPosn = tell();
+    if (compressionMethod == ZipEntry::kCompressStored) {
+        result = alignEntry(pEntry, lfhPosn, alignment);
+        if (result != NO_ERROR)
+            goto bail;
+    }
     pEntry->mLFH.write(mZipFp);
-    startPosn = ftell(mZipFp);
+    startPosn = tell();
 
     /*
      * Copy the data in, possibly compressing it as we go.
@@ -414,7 +844,7 @@ status_t ZipFile::addCommon(const char* fileName, const void* data, size_t size,
     if (sourceType == ZipEntry::kCompressStored) {
         if (compressionMethod == ZipEntry::kCompressDeflated) {
             bool failed = false;
-            result = compressFpToFp(mZipFp, inputFp, data, size, &crc);
+            result = compressFpToFp(mZipFp, inputFp, data, size, compressionLevel, &crc);
             if (result != NO_ERROR) {
                 ALOGD("compression failed, storing\n");
                 failed = true;
@@ -425,8 +855,8 @@ status_t ZipFile::addCommon(const char* fileName, const void* data, size_t size,
                  * criteria to change over time.
                  */
                 long src = inputFp ? ftell(inputFp) : size;
-                long dst = ftell(mZipFp) - startPosn;
-                if (dst + (dst / 10) > src) {
+                long dst = tell() - startPosn;
+                if (!isCompressedEnough(src, dst)) {
                     ALOGD("insufficient compression (src=%ld dst=%ld), storing\n",
                         src, dst);
                     failed = true;
@@ -436,7 +866,17 @@ status_t ZipFile::addCommon(const char* fileName, const void* data, size_t size,
             if (failed) {
                 compressionMethod = ZipEntry::kCompressStored;
                 if (inputFp) rewind(inputFp);
-                fseek(mZipFp, startPosn, SEEK_SET);
+                if (alignment > 0) {
+                    /* the data moves to the aligned position, after more padding */
+                    result = alignEntry(pEntry, lfhPosn, alignment);
+                    if (result != NO_ERROR)
+                        goto bail;
+                    fseek(mZipFp, lfhPosn, SEEK_SET);
+                    pEntry->mLFH.write(mZipFp);
+                    startPosn = tell();
+                } else {
+                    fseek(mZipFp, startPosn, SEEK_SET);
+                }
                 /* fall through to kCompressStored case */
             }
         }
@@ -490,14 +930,17 @@ status_t ZipFile::addCommon(const char* fileName, const void* data, size_t size,
      *
      * Update file offsets.
      */
-    endPosn = ftell(mZipFp);            // seeked to end of compressed data
+    endPosn = tell();            // seeked to end of compressed data
 
     /*
      * Success!  Fill out new values.
      */
     pEntry->setDataInfo(uncompressedLen, endPosn - startPosn, crc,
         compressionMethod);
-    modWhen = getModTime(inputFp ? fileno(inputFp) : fileno(mZipFp));
+    if (inputMap.getData() != NULL)
+        modWhen = inputMap.getModTime();
+    else
+        modWhen = (inputFp ? getModTime(fileno(inputFp)) : getArchiveModTime());
     pEntry->setModWhen(modWhen);
     pEntry->setLFHOffset(lfhPosn);
     mEOCD.mNumEntries++;
@@ -512,12 +955,19 @@ status_t ZipFile::addCommon(const char* fileName, const void* data, size_t size,
         result = UNKNOWN_ERROR;
         goto bail;
     }
-    pEntry->mLFH.write(mZipFp);
+    result = pEntry->mLFH.write(mZipFp);
+    if (result != NO_ERROR)
+        goto bail;
+
+added:
+    cost.setInputBytes(pEntry->getUncompressedLen());
+    cost.setOutputBytes(pEntry->getCompressedLen());
 
     /*
      * Add pEntry to the list.
      */
     mEntries.add(pEntry);
+    indexEntry(pEntry);
     if (ppEntry != NULL)
         *ppEntry = pEntry;
     pEntry = NULL;
@@ -529,6 +979,460 @@ bail:
     return result;
 }
 
+/*
+ * Pad the "extra" field of pEntry's LFH, which is about to be written at
+ * "lfhPosn", so that the data following it starts on a multiple of
+ * "alignment".  Alignments of 0 and 1 leave the entry alone.
+ */
+status_t ZipFile::alignEntry(ZipEntry* pEntry, long lfhPosn, int alignment)
+{
+    if (alignment <= 1)
+        return NO_ERROR;
+
+    long dataPosn = lfhPosn + ZipEntry::LocalFileHeader::kLFHLen +
+        pEntry->mLFH.mFileNameLength + pEntry->mLFH.mExtraFieldLength;
+    int padding = (alignment - (int) (dataPosn % alignment)) % alignment;
+    if (padding == 0)
+        return NO_ERROR;
+    return pEntry->addPadding(padding);
+}
+
+/*
+ * Position mZipFp where the next entry goes.
+ *
+ * In streaming mode we're normally there already, and skipping the fseek()
+ * keeps stdio from throwing away its write buffer.
+ */
+status_t ZipFile::seekToCentralDir(void)
+{
+    if (mStreaming && tell() == (long) mEOCD.mCentralDirOffset)
+        return NO_ERROR;
+    if (fseek(mZipFp, mEOCD.mCentralDirOffset, SEEK_SET) != 0)
+        return UNKNOWN_ERROR;
+    return NO_ERROR;
+}
+
+/*
+ * Where the next byte written to mZipFp goes.  ftell() doesn't work on a
+ * pipe, so for one the bytes that have left stdio's buffer are counted.
+ */
+long ZipFile::tell(void)
+{
+    if (mPipe == NULL)
+        return ftell(mZipFp);
+    if (fflush(mZipFp) != 0)
+        return -1;
+    return mPipe->written;
+}
+
+/*
+ * The body of addCommon() for streaming archives.
+ *
+ * Everything the LFH needs is worked out before anything is written, so
+ * the header and data go out in a single sequential pass.  Deflated data
+ * is staged in memory, which also means output that doesn't compress
+ * well enough is never written only to be thrown away.  Stored data is
+ * scanned twice instead: once for the CRC, then again to copy it; plain
+ * files arrive here mapped, so neither pass goes back to the disk.
+ *
+ * On success, the entry's data info, mod time ("modWhen") and LFH offset
+ * are set and mZipFp is positioned just past the data.
+ */
+status_t ZipFile::addStreaming(FILE* inputFp, const void* data, size_t size,
+    ZipEntry* pEntry, int sourceType, int compressionMethod, int compressionLevel,
+    int alignment, time_t modWhen)
+{
+    Vector<unsigned char> deflated;
+    status_t result = NO_ERROR;
+    long lfhPosn, uncompressedLen, compressedLen;
+    unsigned long crc;
+
+    if (mPipe != NULL && sourceType == ZipEntry::kCompressStored &&
+        compressionMethod == ZipEntry::kCompressDeflated) {
+        return addWithDataDescriptor(inputFp, data, size, pEntry, compressionLevel,
+                    modWhen);
+    }
+
+    if (sourceType == ZipEntry::kCompressStored) {
+        if (compressionMethod == ZipEntry::kCompressDeflated) {
+            result = deflateToSink(NULL, &deflated, inputFp, data, size, compressionLevel,
+                    &crc);
+            uncompressedLen = inputFp ? ftell(inputFp) : size;
+            if (result != NO_ERROR) {
+                ALOGD("compression failed, storing\n");
+                compressionMethod = ZipEntry::kCompressStored;
+            } else if (!isCompressedEnough(uncompressedLen, deflated.size())) {
+                ALOGD("insufficient compression (src=%ld dst=%ld), storing\n",
+                    uncompressedLen, (long) deflated.size());
+                compressionMethod = ZipEntry::kCompressStored;
+            }
+        }
+        if (compressionMethod == ZipEntry::kCompressStored) {
+            deflated.clear();
+            crc = crc32(0L, Z_NULL, 0);
+            if (inputFp) {
+                unsigned char tmpBuf[32768];
+                size_t count;
+
+                rewind(inputFp);
+                while ((count = fread(tmpBuf, 1, sizeof(tmpBuf), inputFp)) != 0)
+                    crc = crc32(crc, tmpBuf, count);
+                if (ferror(inputFp))
+                    return errnoToStatus(errno);
+                uncompressedLen = ftell(inputFp);
+                rewind(inputFp);
+            } else {
+                if (size > 0)
+                    crc = crc32(crc, (const unsigned char*) data, size);
+                uncompressedLen = size;
+            }
+            compressedLen = uncompressedLen;
+        } else {
+            compressedLen = deflated.size();
+        }
+    } else if (sourceType == ZipEntry::kCompressDeflated) {
+        int method;
+
+        assert(compressionMethod == ZipEntry::kCompressDeflated);
+        if (!ZipUtils::examineGzip(inputFp, &method, &uncompressedLen,
+                &compressedLen, &crc) || method != ZipEntry::kCompressDeflated)
+        {
+            ALOGD("this isn't a deflated gzip file?");
+            return UNKNOWN_ERROR;
+        }
+    } else {
+        assert(false);
+        return UNKNOWN_ERROR;
+    }
+
+    pEntry->setDataInfo(uncompressedLen, compressedLen, crc, compressionMethod);
+    pEntry->setModWhen(modWhen);
+
+    /*
+     * From here on out, failures are more interesting.
+     */
+    mNeedCDRewrite = true;
+
+    /* the sizes are exact here, so the ZIP64 field is only added if needed */
+    if ((uint64_t) uncompressedLen >= ZipEntry::kZip64Marker ||
+        (uint64_t) compressedLen >= ZipEntry::kZip64Marker)
+        pEntry->reserveZip64();
+
+    lfhPosn = tell();
+    if (compressionMethod == ZipEntry::kCompressStored) {
+        result = alignEntry(pEntry, lfhPosn, alignment);
+        if (result != NO_ERROR)
+            return result;
+    }
+    pEntry->setLFHOffset(lfhPosn);
+    result = pEntry->mLFH.write(mZipFp);
+    if (result != NO_ERROR)
+        return result;
+
+    if (sourceType == ZipEntry::kCompressDeflated) {
+        result = copyPartialFpToFp(mZipFp, inputFp, compressedLen, NULL);
+    } else if (compressionMethod == ZipEntry::kCompressDeflated) {
+        if (fwrite(deflated.array(), 1, compressedLen, mZipFp) != (size_t) compressedLen)
+            result = UNKNOWN_ERROR;
+    } else if (inputFp) {
+        unsigned long storedCRC;
+        result = copyFpToFp(mZipFp, inputFp, &storedCRC);
+        if (result == NO_ERROR && storedCRC != crc) {
+            ALOGD("file changed while it was being stored\n");
+            result = UNKNOWN_ERROR;
+        }
+    } else if (size > 0) {
+        if (fwrite(data, 1, size, mZipFp) != size)
+            result = UNKNOWN_ERROR;
+    }
+    if (result != NO_ERROR) {
+        ALOGD("failed writing data for streamed entry\n");
+        return result;
+    }
+
+    mEOCD.mNumEntries++;
+    mEOCD.mTotalNumEntries++;
+    mEOCD.mCentralDirSize = 0;      // mark invalid; set by flush()
+    mEOCD.mCentralDirOffset = tell();
+    return NO_ERROR;
+}
+
+/*
+ * The body of addCommon() for large files stored in a kOpenParallel
+ * archive.
+ *
+ * The entry's place is known from its size alone, so its LFH is written
+ * now, with a CRC of 0, and mZipFp moves on past the space its data will
+ * take.  A work unit, which owns the mapping from then on, fills that
+ * space and the CRC in with pwrite().  The space is allocated up front,
+ * where the host allows, so that copies finishing out of order don't
+ * leave the file fragmented.
+ */
+status_t ZipFile::addParallel(const char* fileName, ZipEntry* pEntry, int alignment)
+{
+#ifndef _WIN32
+    MappedFile* map = new MappedFile;
+    status_t result = map->open(fileName);
+    if (result != NO_ERROR) {
+        delete map;
+        return result;
+    }
+    const long size = map->getSize();
+    pEntry->setDataInfo(size, size, 0, ZipEntry::kCompressStored);
+    pEntry->setModWhen(map->getModTime());
+
+    /*
+     * From here on out, failures are more interesting.
+     */
+    mNeedCDRewrite = true;
+
+    if ((uint64_t) size >= ZipEntry::kZip64Marker)
+        pEntry->reserveZip64();
+
+    long lfhPosn = tell();
+    result = alignEntry(pEntry, lfhPosn, alignment);
+    if (result == NO_ERROR) {
+        pEntry->setLFHOffset(lfhPosn);
+        result = pEntry->mLFH.write(mZipFp);
+    }
+    /* the worker patches the LFH, so it mustn't be left in stdio's buffer */
+    const long dataPosn = tell();
+    if (result == NO_ERROR && (fflush(mZipFp) != 0 ||
+            fseek(mZipFp, dataPosn + size, SEEK_SET) != 0)) {
+        result = UNKNOWN_ERROR;
+    }
+    if (result != NO_ERROR) {
+        delete map;
+        return result;
+    }
+#if defined(__linux__)
+    if (size > 0)
+        fallocate(fileno(mZipFp), 0, dataPosn, size);   // just a hint
+#endif
+
+    mEOCD.mNumEntries++;
+    mEOCD.mTotalNumEntries++;
+    mEOCD.mCentralDirSize = 0;      // mark invalid; set by flush()
+    mEOCD.mCentralDirOffset = dataPosn + size;
+
+    StoreEntryWorkUnit* w = new StoreEntryWorkUnit(mWriters, fileno(mZipFp), pEntry,
+            map, dataPosn, lfhPosn + ZipEntry::kLFHCRCOffset);
+    if (mWriters->group.schedule(w) != NO_ERROR) {
+        w->run();
+        delete w;
+    }
+    return NO_ERROR;
+#else
+    (void) fileName;
+    (void) pEntry;
+    (void) alignment;
+    return INVALID_OPERATION;
+#endif
+}
+
+/*
+ * Wait for the work units of a kOpenParallel archive.
+ */
+status_t ZipFile::waitForWriters(void)
+{
+    if (mWriters == NULL)
+        return NO_ERROR;
+    mWriters->group.wait();
+    AutoMutex _l(mWriters->lock);
+    for (size_t i = 0; i < mWriters->copied.size(); i++) {
+        const ZipParallelWriter::Copied& copied = mWriters->copied[i];
+        copied.entry->setCRC32(copied.crc);
+    }
+    mWriters->copied.clear();
+    return mWriters->result;
+}
+
+void ZipFile::finishWriters(void)
+{
+    waitForWriters();
+    delete mWriters;
+    mWriters = NULL;
+}
+
+/*
+ * The body of addStreaming() for deflating into a kOpenPipe archive.
+ *
+ * Staging the deflated data would cost as much memory as the entry, and
+ * a pipe can't go back to the LFH, so the LFH goes out flagged with
+ * kUsesDataDescr and without the CRC and sizes, the data is deflated
+ * straight into the pipe, and a data descriptor follows it.  An entry
+ * that doesn't deflate well stays deflated, since it is already written.
+ */
+status_t ZipFile::addWithDataDescriptor(FILE* inputFp, const void* data, size_t size,
+    ZipEntry* pEntry, int compressionLevel, time_t modWhen)
+{
+    status_t result;
+    long lfhPosn, startPosn, endPosn, uncompressedLen;
+    unsigned long crc;
+
+    if (inputFp != NULL) {
+        struct stat sb;
+        if (fstat(fileno(inputFp), &sb) == 0 && ZipEntry::needsZip64(sb.st_size))
+            pEntry->reserveZip64();
+    } else if (ZipEntry::needsZip64(size)) {
+        pEntry->reserveZip64();
+    }
+    pEntry->initDataDescriptor(ZipEntry::kCompressDeflated);
+    pEntry->setModWhen(modWhen);
+
+    /*
+     * From here on out, failures are more interesting.
+     */
+    mNeedCDRewrite = true;
+
+    lfhPosn = tell();
+    pEntry->setLFHOffset(lfhPosn);
+    result = pEntry->mLFH.write(mZipFp);
+    if (result != NO_ERROR)
+        return result;
+
+    startPosn = tell();
+    result = deflateToSink(mZipFp, NULL, inputFp, data, size, compressionLevel, &crc);
+    if (result != NO_ERROR) {
+        ALOGD("failed deflating streamed entry\n");
+        return result;
+    }
+    uncompressedLen = inputFp ? ftell(inputFp) : size;
+    endPosn = tell();
+    if (startPosn < 0 || endPosn < 0)
+        return UNKNOWN_ERROR;
+
+    pEntry->setDataInfo(uncompressedLen, endPosn - startPosn, crc,
+        ZipEntry::kCompressDeflated);
+    result = pEntry->writeDataDescriptor(mZipFp);
+    if (result != NO_ERROR)
+        return result;
+
+    mEOCD.mNumEntries++;
+    mEOCD.mTotalNumEntries++;
+    mEOCD.mCentralDirSize = 0;      // mark invalid; set by flush()
+    mEOCD.mCentralDirOffset = tell();
+    return NO_ERROR;
+}
+
+/*
+ * Add an entry whose data has already been deflated.
+ *
+ * This is the tail end of addCommon() for the kCompressDeflated case, with
+ * the compression itself hoisted out so callers can run it elsewhere.
+ */
+status_t ZipFile::addCompressed(const char* fileName, const void* compressedData,
+    size_t compressedLen, long uncompressedLen, unsigned long crc32,
+    const char* storageName, ZipEntry** ppEntry)
+{
+    ZipEntry* pEntry = NULL;
+    status_t result = NO_ERROR;
+    long lfhPosn, endPosn;
+    time_t modWhen;
+
+    if (mReadOnly)
+        return INVALID_OPERATION;
+
+    /* make sure we're in a reasonable state */
+    assert(mZipFp != NULL);
+    assert(mEntries.size() == mEOCD.mTotalNumEntries);
+
+    /* make sure it doesn't already exist */
+    if (getEntryByName(storageName) != NULL)
+        return ALREADY_EXISTS;
+
+    if (seekToCentralDir() != NO_ERROR)
+        return UNKNOWN_ERROR;
+
+    pEntry = new ZipEntry;
+    pEntry->initNew(storageName, NULL);
+    pEntry->setDataInfo(uncompressedLen, compressedLen, crc32,
+        ZipEntry::kCompressDeflated);
+
+    /*
+     * Match addCommon(): the date comes from the source file, or from the
+     * archive itself for in-memory data.
+     */
+    if (fileName != NULL) {
+        struct stat sb;
+        modWhen = (stat(fileName, &sb) == 0) ? sb.st_mtime : (time_t) -1;
+    } else {
+        modWhen = getArchiveModTime();
+    }
+    pEntry->setModWhen(modWhen);
+
+    /*
+     * From here on out, failures are more interesting.
+     */
+    mNeedCDRewrite = true;
+
+    /*
+     * Every field is known up front, so the LFH only needs writing once.
+     */
+    if ((uint64_t) uncompressedLen >= ZipEntry::kZip64Marker ||
+        compressedLen >= ZipEntry::kZip64Marker)
+        pEntry->reserveZip64();
+    lfhPosn = tell();
+    pEntry->setLFHOffset(lfhPosn);
+    result = pEntry->mLFH.write(mZipFp);
+    if (result != NO_ERROR)
+        goto bail;
+    if (compressedLen > 0 &&
+        fwrite(compressedData, 1, compressedLen, mZipFp) != compressedLen)
+    {
+        ALOGD("fwrite %d bytes failed\n", (int) compressedLen);
+        result = UNKNOWN_ERROR;
+        goto bail;
+    }
+    endPosn = tell();
+
+    mEOCD.mNumEntries++;
+    mEOCD.mTotalNumEntries++;
+    mEOCD.mCentralDirSize = 0;      // mark invalid; set by flush()
+    mEOCD.mCentralDirOffset = endPosn;
+
+    /*
+     * Add pEntry to the list.
+     */
+    mEntries.add(pEntry);
+    indexEntry(pEntry);
+    if (ppEntry != NULL)
+        *ppEntry = pEntry;
+    pEntry = NULL;
+
+bail:
+    delete pEntry;
+    return result;
+}
+
+/*
+ * Deflate a file or buffer into memory.
+ *
+ * On success "pOut" holds the raw deflate stream, and "pUncompressedLen"
+ * and "pCRC32" describe the original data.
+ */
+status_t ZipFile::compressData(const char* fileName, const void* data, size_t size,
+    int compressionLevel, Vector<unsigned char>* pOut, long* pUncompressedLen,
+    unsigned long* pCRC32)
+{
+    MappedFile inputMap;
+    status_t result;
+
+    if (!data) {
+        result = inputMap.open(fileName);
+        if (result != NO_ERROR)
+            return result;
+        data = inputMap.getData();
+        size = inputMap.getSize();
+    }
+
+    pOut->clear();
+    result = deflateToSink(NULL, pOut, NULL, data, size, compressionLevel, pCRC32);
+    if (result == NO_ERROR)
+        *pUncompressedLen = size;
+    return result;
+}
+
 /*
  * Add an entry by copying it from another zip file.  If "padding" is
  * nonzero, the specified number of bytes will be added to the "extra"
@@ -550,7 +1454,11 @@ status_t ZipFile::add(const ZipFile* pSourceZip, const ZipEntry* pSourceEntry,
     assert(mZipFp != NULL);
     assert(mEntries.size() == mEOCD.mTotalNumEntries);
 
-    if (fseek(mZipFp, mEOCD.mCentralDirOffset, SEEK_SET) != 0) {
+    /* make sure it doesn't already exist */
+    if (getEntryByName(pSourceEntry->getFileName()) != NULL)
+        return ALREADY_EXISTS;
+
+    if (seekToCentralDir() != NO_ERROR) {
         result = UNKNOWN_ERROR;
         goto bail;
     }
@@ -564,6 +1472,10 @@ status_t ZipFile::add(const ZipFile* pSourceZip, const ZipEntry* pSourceEntry,
     result = pEntry->initFromExternal(pSourceZip, pSourceEntry);
     if (result != NO_ERROR)
         goto bail;
+    /* a writer may have left the ZIP64 field out of an LFH that needs it */
+    if ((uint64_t) pEntry->getUncompressedLen() >= ZipEntry::kZip64Marker ||
+        (uint64_t) pEntry->getCompressedLen() >= ZipEntry::kZip64Marker)
+        pEntry->reserveZip64();
     if (padding != 0) {
         result = pEntry->addPadding(padding);
         if (result != NO_ERROR)
@@ -579,8 +1491,10 @@ status_t ZipFile::add(const ZipFile* pSourceZip, const ZipEntry* pSourceEntry,
      * Write the LFH.  Since we're not recompressing the data, we already
      * have all of the fields filled out.
      */
-    lfhPosn = ftell(mZipFp);
-    pEntry->mLFH.write(mZipFp);
+    lfhPosn = tell();
+    result = pEntry->mLFH.write(mZipFp);
+    if (result != NO_ERROR)
+        goto bail;
 
     /*
      * Copy the data over.
@@ -596,9 +1510,7 @@ status_t ZipFile::add(const ZipFile* pSourceZip, const ZipEntry* pSourceEntry,
     }
 
     off_t copyLen;
-    copyLen = pSourceEntry->getCompressedLen();
-    if ((pSourceEntry->mLFH.mGPBitFlag & ZipEntry::kUsesDataDescr) != 0)
-        copyLen += ZipEntry::kDataDescriptorLen;
+    copyLen = pSourceEntry->getCompressedLen() + pSourceEntry->getDataDescriptorLen();
 
     if (copyPartialFpToFp(mZipFp, pSourceZip->mZipFp, copyLen, NULL)
         != NO_ERROR)
@@ -611,7 +1523,7 @@ status_t ZipFile::add(const ZipFile* pSourceZip, const ZipEntry* pSourceEntry,
     /*
      * Update file offsets.
      */
-    endPosn = ftell(mZipFp);
+    endPosn = tell();
 
     /*
      * Success!  Fill out new values.
@@ -626,6 +1538,7 @@ status_t ZipFile::add(const ZipFile* pSourceZip, const ZipEntry* pSourceEntry,
      * Add pEntry to the list.
      */
     mEntries.add(pEntry);
+    indexEntry(pEntry);
     if (ppEntry != NULL)
         *ppEntry = pEntry;
     pEntry = NULL;
@@ -637,6 +1550,57 @@ bail:
     return result;
 }
 
+/*
+ * Add "count" entries, starting at "first", by copying them from another
+ * zip file.  The entries' headers and data must follow each other in that
+ * file with nothing between them, so that they all take a single copy.
+ */
+status_t ZipFile::addRun(const ZipFile* pSourceZip, size_t first, size_t count)
+{
+    const ZipEntry* pFirst = pSourceZip->mEntries[first];
+    const ZipEntry* pLast = pSourceZip->mEntries[first + count - 1];
+    const long srcStart = pFirst->getLFHOffset();
+    const long srcEnd = pLast->getLFHOffset() + getEntryLength(pLast);
+    long dstStart;
+
+    if (mReadOnly)
+        return INVALID_OPERATION;
+
+    if (seekToCentralDir() != NO_ERROR)
+        return UNKNOWN_ERROR;
+
+    mNeedCDRewrite = true;
+    dstStart = tell();
+    if (fseek(pSourceZip->mZipFp, srcStart, SEEK_SET) != 0)
+        return UNKNOWN_ERROR;
+    if (copyPartialFpToFp(mZipFp, pSourceZip->mZipFp, srcEnd - srcStart, NULL)
+        != NO_ERROR)
+    {
+        ALOGW("copy of '%s' and the %zu entries after it failed\n",
+            pFirst->getFileName(), count - 1);
+        return UNKNOWN_ERROR;
+    }
+
+    for (size_t i = first; i < first + count; i++) {
+        const ZipEntry* pSourceEntry = pSourceZip->mEntries[i];
+        ZipEntry* pEntry = new ZipEntry;
+        status_t result = pEntry->initFromExternal(pSourceZip, pSourceEntry);
+        if (result != NO_ERROR) {
+            delete pEntry;
+            return result;
+        }
+        pEntry->setLFHOffset(dstStart + pSourceEntry->getLFHOffset() - srcStart);
+        mEntries.add(pEntry);
+        indexEntry(pEntry);
+        mEOCD.mNumEntries++;
+        mEOCD.mTotalNumEntries++;
+    }
+
+    mEOCD.mCentralDirSize = 0;      // mark invalid; set by flush()
+    mEOCD.mCentralDirOffset = tell();
+    return NO_ERROR;
+}
+
 /*
  * Copy all of the bytes in "src" to "dst".
  *
@@ -671,18 +1635,27 @@ status_t ZipFile::copyFpToFp(FILE* dstFp, FILE* srcFp, unsigned long* pCRC32)
 /*
  * Copy all of the bytes in "src" to "dst".
  *
+ * The CRC is computed a chunk at a time, just before the chunk is written,
+ * so each byte is brought into the cache once.
+ *
  * On exit, "dstFp" will be seeked immediately past the data.
  */
 status_t ZipFile::copyDataToFp(FILE* dstFp,
     const void* data, size_t size, unsigned long* pCRC32)
 {
+    const unsigned char* ptr = (const unsigned char*) data;
+
     *pCRC32 = crc32(0L, Z_NULL, 0);
-    if (size > 0) {
-        *pCRC32 = crc32(*pCRC32, (const unsigned char*)data, size);
-        if (fwrite(data, 1, size, dstFp) != size) {
-            ALOGD("fwrite %d bytes failed\n", (int) size);
+    while (size > 0) {
+        size_t count = size < 32768 ? size : 32768;
+
+        *pCRC32 = crc32(*pCRC32, ptr, count);
+        if (fwrite(ptr, 1, count, dstFp) != count) {
+            ALOGD("fwrite %d bytes failed\n", (int) count);
             return UNKNOWN_ERROR;
         }
+        ptr += count;
+        size -= count;
     }
 
     return NO_ERROR;
@@ -732,6 +1705,178 @@ status_t ZipFile::copyPartialFpToFp(FILE* dstFp, FILE* srcFp, long length,
     return NO_ERROR;
 }
 
+/*
+ * In-memory data of at least kDeflateBlocksMin bytes is deflated by
+ * deflateBlocks(), in blocks of kDeflateBlockSize.
+ */
+static const size_t kDeflateBlockSize = 128 * 1024;
+static const size_t kDeflateBlocksMin = 4 * 1024 * 1024;
+static const size_t kDeflateWindowSize = 32768;
+
+/*
+ * Start a raw deflate stream at "level"; see ZipFile::kCompressLevelMax.
+ */
+static int initDeflate(z_stream* zstream, int level)
+{
+    if (level > Z_BEST_COMPRESSION) {
+        return deflateInit2(zstream, Z_BEST_COMPRESSION,
+            Z_DEFLATED, -MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+    }
+    return deflateInit2(zstream, level,
+        Z_DEFLATED, -MAX_WBITS, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+}
+
+/*
+ * A raw deflate stream at one level, with the buffers deflateToSink()
+ * streams through.  Setting up zlib's state costs more than compressing
+ * most small entries, so each thread keeps its last one and resets it
+ * with deflateReset() for the next stream at the same level.
+ */
+struct DeflateContext {
+    static const size_t kBufSize = 32768;
+
+    z_stream zstream;
+    int level;
+    unsigned char inBuf[kBufSize];
+    unsigned char outBuf[kBufSize];
+};
+
+// The DeflateContext the last stream on this thread left for the next.
+static thread_store_t gIdleDeflater = THREAD_STORE_INITIALIZER;
+
+static void freeDeflateContext(void* p)
+{
+    DeflateContext* context = static_cast<DeflateContext*>(p);
+    deflateEnd(&context->zstream);
+    delete context;
+}
+
+/*
+ * Take this thread's idle DeflateContext, reset for a new stream at
+ * "level", or set up a new one.  Returns NULL, with the zlib error in
+ * "outErr", if that fails.
+ */
+static DeflateContext* acquireDeflater(int level, int* outErr)
+{
+    *outErr = Z_OK;
+    DeflateContext* context = static_cast<DeflateContext*>(thread_store_get(&gIdleDeflater));
+    if (context != NULL) {
+        thread_store_set(&gIdleDeflater, NULL, freeDeflateContext);
+        if (context->level == level && deflateReset(&context->zstream) == Z_OK) {
+            return context;
+        }
+        freeDeflateContext(context);
+    }
+
+    context = new DeflateContext;
+    memset(&context->zstream, 0, sizeof(context->zstream));
+    context->level = level;
+    *outErr = initDeflate(&context->zstream, level);
+    if (*outErr != Z_OK) {
+        delete context;
+        return NULL;
+    }
+    return context;
+}
+
+/*
+ * Leave "context" for the next stream on this thread, whatever state its
+ * last one ended in; acquireDeflater() resets it.
+ */
+static void releaseDeflater(DeflateContext* context)
+{
+    if (thread_store_get(&gIdleDeflater) == NULL) {
+        thread_store_set(&gIdleDeflater, context, freeDeflateContext);
+    } else {
+        freeDeflateContext(context);
+    }
+}
+
+/*
+ * One block of deflateBlocks(), deflated and checksummed on its own.
+ */
+struct DeflatedBlock {
+    DeflatedBlock() : status(NO_ERROR), crc(0) { }
+
+    status_t status;
+    Vector<unsigned char> compressed;
+    unsigned long crc;
+};
+
+/*
+ * Deflate the "len" bytes at "offset" in "data" into "out".  The stream is
+ * primed with the window of data before the block, so matches can reach
+ * back into it as they would in a single stream.  A block that is not
+ * "last" ends with a sync flush, which leaves it on a byte boundary, so
+ * the blocks' output can simply be concatenated.
+ */
+static void deflateBlock(const unsigned char* data, size_t offset, size_t len,
+    bool last, int level, DeflatedBlock* out)
+{
+    const int expected = last ? Z_STREAM_END : Z_OK;
+    int zerr;
+
+    out->status = NO_ERROR;
+    out->crc = crc32(crc32(0L, Z_NULL, 0), data + offset, len);
+
+    DeflateContext* context = acquireDeflater(level, &zerr);
+    if (context == NULL) {
+        ALOGD("Call to deflateInit2 failed (zerr=%d)\n", zerr);
+        out->status = UNKNOWN_ERROR;
+        return;
+    }
+    z_stream& zstream = context->zstream;
+
+    if (offset > 0) {
+        size_t dictLen = offset < kDeflateWindowSize ? offset : kDeflateWindowSize;
+        zerr = deflateSetDictionary(&zstream, data + offset - dictLen, dictLen);
+    }
+    if (zerr == Z_OK) {
+        // deflateBound() leaves out the empty stored block of a sync flush.
+        out->compressed.resize(deflateBound(&zstream, len) + 16);
+        zstream.next_in = (Bytef*) (data + offset);
+        zstream.avail_in = len;
+        zstream.next_out = out->compressed.editArray();
+        zstream.avail_out = out->compressed.size();
+        zerr = deflate(&zstream, last ? Z_FINISH : Z_SYNC_FLUSH);
+        if (zerr == expected && (last || zstream.avail_out != 0)) {
+            zerr = Z_OK;
+        } else if (zerr == Z_OK || zerr == Z_STREAM_END) {
+            zerr = Z_BUF_ERROR;     // ran out of room
+        }
+    }
+    if (zerr != Z_OK) {
+        ALOGD("zlib deflate call failed (zerr=%d)\n", zerr);
+        out->status = UNKNOWN_ERROR;
+        out->compressed.clear();
+    } else {
+        out->compressed.resize(zstream.total_out);
+    }
+
+    releaseDeflater(context);
+}
+
+class DeflateBlockWorkUnit : public WorkQueue::WorkUnit {
+public:
+    DeflateBlockWorkUnit(const unsigned char* data, size_t offset, size_t len,
+            bool last, int level, DeflatedBlock* out) :
+            mData(data), mOffset(offset), mLen(len), mLast(last), mLevel(level),
+            mOut(out) { }
+
+    virtual bool run() {
+        deflateBlock(mData, mOffset, mLen, mLast, mLevel, mOut);
+        return true;
+    }
+
+private:
+    const unsigned char* mData;
+    size_t mOffset;
+    size_t mLen;
+    bool mLast;
+    int mLevel;
+    DeflatedBlock* mOut;
+};
+
 /*
  * Compress all of the data in "srcFp" and write it to "dstFp".
  *
@@ -739,43 +1884,36 @@ status_t ZipFile::copyPartialFpToFp(FILE* dstFp, FILE* srcFp, long length,
  * will be seeked immediately past the compressed data.
  */
 status_t ZipFile::compressFpToFp(FILE* dstFp, FILE* srcFp,
-    const void* data, size_t size, unsigned long* pCRC32)
+    const void* data, size_t size, int level, unsigned long* pCRC32)
+{
+    return deflateToSink(dstFp, NULL, srcFp, data, size, level, pCRC32);
+}
+
+/*
+ * Compress all of the data in "srcFp" (or "data") and write it to "dstFp",
+ * or append it to "dstBuf" if "dstFp" is NULL.  "level" is one of the
+ * kCompressLevel values, or any other zlib level.
+ */
+status_t ZipFile::deflateToSink(FILE* dstFp, Vector<unsigned char>* dstBuf,
+    FILE* srcFp, const void* data, size_t size, int level, unsigned long* pCRC32)
 {
+    if (data != NULL && size >= kDeflateBlocksMin)
+        return deflateBlocks(dstFp, dstBuf, data, size, level, pCRC32);
+
     status_t result = NO_ERROR;
-    const size_t kBufSize = 32768;
-    unsigned char* inBuf = NULL;
-    unsigned char* outBuf = NULL;
-    z_stream zstream;
+    const size_t kBufSize = DeflateContext::kBufSize;
+    DeflateContext* context;
+    unsigned char* inBuf;
+    unsigned char* outBuf;
     bool atEof = false;     // no feof() aviailable yet
     unsigned long crc;
     int zerr;
 
     /*
-     * Create an input buffer and an output buffer.
+     * Get this thread's zlib stream and buffers.
      */
-    inBuf = new unsigned char[kBufSize];
-    outBuf = new unsigned char[kBufSize];
-    if (inBuf == NULL || outBuf == NULL) {
-        result = NO_MEMORY;
-        goto bail;
-    }
-
-    /*
-     * Initialize the zlib stream.
-     */
-    memset(&zstream, 0, sizeof(zstream));
-    zstream.zalloc = Z_NULL;
-    zstream.zfree = Z_NULL;
-    zstream.opaque = Z_NULL;
-    zstream.next_in = NULL;
-    zstream.avail_in = 0;
-    zstream.next_out = outBuf;
-    zstream.avail_out = kBufSize;
-    zstream.data_type = Z_UNKNOWN;
-
-    zerr = deflateInit2(&zstream, Z_BEST_COMPRESSION,
-        Z_DEFLATED, -MAX_WBITS, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY);
-    if (zerr != Z_OK) {
+    context = acquireDeflater(level, &zerr);
+    if (context == NULL) {
         result = UNKNOWN_ERROR;
         if (zerr == Z_VERSION_ERROR) {
             ALOGE("Installed zlib is not compatible with linked version (%s)\n",
@@ -783,8 +1921,15 @@ status_t ZipFile::compressFpToFp(FILE* dstFp, FILE* srcFp,
         } else {
             ALOGD("Call to deflateInit2 failed (zerr=%d)\n", zerr);
         }
-        goto bail;
+        return result;
     }
+    z_stream& zstream = context->zstream;
+    inBuf = context->inBuf;
+    outBuf = context->outBuf;
+    zstream.next_in = NULL;
+    zstream.avail_in = 0;
+    zstream.next_out = outBuf;
+    zstream.avail_out = kBufSize;
 
     crc = crc32(0L, Z_NULL, 0);
 
@@ -839,7 +1984,9 @@ status_t ZipFile::compressFpToFp(FILE* dstFp, FILE* srcFp,
             (zerr == Z_STREAM_END && zstream.avail_out != (uInt) kBufSize))
         {
             ALOGV("+++ writing %d bytes\n", (int) (zstream.next_out - outBuf));
-            if (fwrite(outBuf, 1, zstream.next_out - outBuf, dstFp) !=
+            if (dstFp == NULL) {
+                dstBuf->appendArray(outBuf, zstream.next_out - outBuf);
+            } else if (fwrite(outBuf, 1, zstream.next_out - outBuf, dstFp) !=
                 (size_t)(zstream.next_out - outBuf))
             {
                 ALOGD("write %d failed in deflate\n",
@@ -857,12 +2004,86 @@ status_t ZipFile::compressFpToFp(FILE* dstFp, FILE* srcFp,
     *pCRC32 = crc;
 
 z_bail:
-    deflateEnd(&zstream);        /* free up any allocated structures */
+    releaseDeflater(context);   /* kept for the next stream */
 
-bail:
-    delete[] inBuf;
-    delete[] outBuf;
+    return result;
+}
+
+/*
+ * Deflate the in-memory "data" as deflateToSink() does, but in blocks of
+ * kDeflateBlockSize that are compressed on up to sDeflateThreads threads,
+ * pigz-style, then written out in order as one deflate stream.  The CRC is
+ * pieced together from the blocks' with crc32_combine().  Only a few
+ * blocks per thread are held compressed at a time.
+ */
+status_t ZipFile::deflateBlocks(FILE* dstFp, Vector<unsigned char>* dstBuf,
+    const void* data, size_t size, int level, unsigned long* pCRC32)
+{
+    const unsigned char* bytes = (const unsigned char*) data;
+    const size_t numBlocks = (size + kDeflateBlockSize - 1) / kDeflateBlockSize;
+    const size_t threads = sDeflateThreads;
+    const size_t window = threads * 4;
+    DeflatedBlock* blocks = new DeflatedBlock[window];
+    WorkQueue* workQueue = threads > 1 ? new WorkQueue(threads, false) : NULL;
+    unsigned long crc = crc32(0L, Z_NULL, 0);
+    status_t result = NO_ERROR;
+
+    for (size_t first = 0; first < numBlocks && result == NO_ERROR; first += window) {
+        const size_t count = numBlocks - first < window ? numBlocks - first : window;
+
+        if (workQueue != NULL) {
+            WorkQueue::Group group(workQueue);
+            for (size_t i = 0; i < count; i++) {
+                const size_t offset = (first + i) * kDeflateBlockSize;
+                const size_t len = size - offset < kDeflateBlockSize ?
+                        size - offset : kDeflateBlockSize;
+                DeflateBlockWorkUnit* w = new DeflateBlockWorkUnit(bytes, offset, len,
+                        first + i == numBlocks - 1, level, &blocks[i]);
+                if (group.schedule(w, 0) != NO_ERROR) {
+                    w->run();       // the queue is gone; do it here
+                    delete w;
+                }
+            }
+            group.wait();
+        } else {
+            for (size_t i = 0; i < count; i++) {
+                const size_t offset = (first + i) * kDeflateBlockSize;
+                const size_t len = size - offset < kDeflateBlockSize ?
+                        size - offset : kDeflateBlockSize;
+                deflateBlock(bytes, offset, len, first + i == numBlocks - 1, level,
+                        &blocks[i]);
+            }
+        }
+
+        for (size_t i = 0; i < count && result == NO_ERROR; i++) {
+            const size_t offset = (first + i) * kDeflateBlockSize;
+            const size_t len = size - offset < kDeflateBlockSize ?
+                    size - offset : kDeflateBlockSize;
+            DeflatedBlock& block = blocks[i];
+
+            result = block.status;
+            if (result != NO_ERROR)
+                break;
+            crc = crc32_combine(crc, block.crc, len);
+            if (dstFp == NULL) {
+                dstBuf->appendVector(block.compressed);
+            } else if (fwrite(block.compressed.array(), 1, block.compressed.size(), dstFp)
+                    != block.compressed.size()) {
+                ALOGD("write %d failed in deflate\n", (int) block.compressed.size());
+                result = UNKNOWN_ERROR;
+            }
+            block.compressed.clear();
+        }
+    }
+
+    if (workQueue != NULL) {
+        workQueue->finish();
+        delete workQueue;
+    }
+    delete[] blocks;
 
+    if (result == NO_ERROR)
+        *pCRC32 = crc;
     return result;
 }
 
@@ -880,7 +2101,15 @@ status_t ZipFile::remove(ZipEntry* pEntry)
      * not some stray ZipEntry from a different file.
      */
 
+    /* deleting would leave a hole, and streaming never goes back */
+    if (mStreaming) {
+        ALOGW("can't remove '%s' from a streaming archive\n",
+            pEntry->getFileName());
+        return INVALID_OPERATION;
+    }
+
     /* mark entry as deleted, and mark archive as dirty */
+    unindexEntry(pEntry);
     pEntry->setDeleted();
     mNeedCDRewrite = true;
     return NO_ERROR;
@@ -900,25 +2129,39 @@ status_t ZipFile::flush(void)
 
     if (mReadOnly)
         return INVALID_OPERATION;
+
+    /* the central directory has the CRCs the workers work out */
+    result = waitForWriters();
+    if (result != NO_ERROR)
+        return result;
+
     if (!mNeedCDRewrite)
         return NO_ERROR;
 
     assert(mZipFp != NULL);
 
-    result = crunchArchive();
-    if (result != NO_ERROR)
-        return result;
+    /* a streaming archive never has anything to crunch out */
+    if (!mStreaming) {
+        if (mCrunchPercent > 0
+                && getDeadSpace() * 100 <= (long) mEOCD.mCentralDirOffset * mCrunchPercent) {
+            dropDeletedEntries();
+        } else {
+            result = crunchArchive();
+            if (result != NO_ERROR)
+                return result;
+        }
+    }
 
-    if (fseek(mZipFp, mEOCD.mCentralDirOffset, SEEK_SET) != 0)
+    if (seekToCentralDir() != NO_ERROR)
         return UNKNOWN_ERROR;
 
     count = mEntries.size();
     for (i = 0; i < count; i++) {
         ZipEntry* pEntry = mEntries[i];
-        pEntry->mCDE.write(mZipFp);
+        pEntry->writeCDE(mZipFp);
     }
 
-    eocdPosn = ftell(mZipFp);
+    eocdPosn = tell();
     mEOCD.mCentralDirSize = eocdPosn - mEOCD.mCentralDirOffset;
 
     mEOCD.write(mZipFp);
@@ -926,19 +2169,258 @@ status_t ZipFile::flush(void)
     /*
      * If we had some stuff bloat up during compression and get replaced
      * with plain files, or if we deleted some entries, there's a lot
-     * of wasted space at the end of the file.  Remove it now.
+     * of wasted space at the end of the file.  Remove it now.  A streaming
+     * archive only ever grows, so the file already ends here.
      */
-    if (ftruncate(fileno(mZipFp), ftell(mZipFp)) != 0) {
-        ALOGW("ftruncate failed %ld: %s\n", ftell(mZipFp), strerror(errno));
+    if (!mStreaming && ftruncate(fileno(mZipFp), tell()) != 0) {
+        ALOGW("ftruncate failed %ld: %s\n", tell(), strerror(errno));
         // not fatal
     }
 
+    /* a pipe's reader only sees the archive once it is all sent */
+    if (mPipe != NULL && fflush(mZipFp) != 0) {
+        ALOGW("unable to write '%s': %s\n", mFileName.string(), strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+
     /* should we clear the "newly added" flag in all entries now? */
 
     mNeedCDRewrite = false;
     return NO_ERROR;
 }
 
+/*
+ * Open the archive again, forgetting everything read from it before.
+ */
+status_t ZipFile::reopen(void)
+{
+    if (mZipFp != NULL) {
+        fclose(mZipFp);
+        mZipFp = NULL;
+    }
+    discardEntries();
+    mNameIndex.clear();
+    mNameIndexHasDuplicates = false;
+    delete[] mEOCD.mComment;
+    mEOCD.mComment = NULL;
+    mEOCD.mCommentLen = 0;
+    mNeedCDRewrite = false;
+
+    String8 fileName(mFileName);
+    return open(fileName.string(), kOpenReadWrite);
+}
+
+void ZipFile::Batch::remove(const char* storageName)
+{
+    mRemoved.add(String8(storageName));
+}
+
+void ZipFile::Batch::add(const char* fileName, const char* storageName,
+    int compressionMethod, int compressionLevel)
+{
+    Addition addition;
+    addition.mFileName.setTo(fileName);
+    addition.mStorageName.setTo(storageName);
+    addition.mCompressionMethod = compressionMethod;
+    addition.mCompressionLevel = compressionLevel;
+    addition.mGzip = false;
+    mAdditions.add(addition);
+    mRemoved.add(addition.mStorageName);
+}
+
+void ZipFile::Batch::addGzip(const char* fileName, const char* storageName)
+{
+    add(fileName, storageName, ZipEntry::kCompressDeflated, kCompressLevelDefault);
+    mAdditions.editTop().mGzip = true;
+}
+
+/*
+ * Write the new archive as "<name>.batch", streaming it front to back,
+ * then rename it over the old one.
+ */
+status_t ZipFile::Batch::commit(void)
+{
+    ZipFile* pZip = mZipFile;
+    status_t result;
+
+    if (pZip->mReadOnly || pZip->mStreaming)
+        return INVALID_OPERATION;
+
+    String8 newName(pZip->mFileName);
+    newName.append(".batch");
+    {
+        ZipFile newZip;
+        result = newZip.open(newName.string(),
+            kOpenReadWrite | kOpenTruncate | kOpenStreaming);
+        if (result != NO_ERROR) {
+            ALOGW("unable to create '%s'\n", newName.string());
+            goto bail;
+        }
+
+        /*
+         * The entries kept, in their order.  Those that follow each other
+         * in the archive are copied as they are with a single read.
+         */
+        size_t runStart = 0;
+        size_t runLength = 0;
+        for (size_t i = 0; i <= pZip->mEntries.size(); i++) {
+            const ZipEntry* pEntry = NULL;
+            if (i < pZip->mEntries.size()) {
+                pEntry = pZip->mEntries[i];
+                if (pEntry->getDeleted() ||
+                    mRemoved.indexOf(String8(pEntry->getFileName())) >= 0)
+                    pEntry = NULL;
+            }
+            if (pEntry != NULL && runLength > 0) {
+                const ZipEntry* pLast = pZip->mEntries[runStart + runLength - 1];
+                if (pEntry->getLFHOffset() ==
+                    (long) pLast->getLFHOffset() + getEntryLength(pLast)) {
+                    runLength++;
+                    continue;
+                }
+            }
+            if (runLength > 0) {
+                result = newZip.addRun(pZip, runStart, runLength);
+                if (result != NO_ERROR)
+                    goto bail;
+            }
+            runStart = i;
+            runLength = pEntry != NULL ? 1 : 0;
+        }
+
+        for (size_t i = 0; i < mAdditions.size(); i++) {
+            const Addition& addition = mAdditions[i];
+            if (addition.mGzip) {
+                result = newZip.addGzip(addition.mFileName.string(),
+                    addition.mStorageName.string(), NULL);
+            } else {
+                result = newZip.add(addition.mFileName.string(),
+                    addition.mStorageName.string(), addition.mCompressionMethod,
+                    addition.mCompressionLevel, 0, NULL);
+            }
+            if (result != NO_ERROR) {
+                ALOGW("unable to add '%s'\n", addition.mFileName.string());
+                goto bail;
+            }
+        }
+
+        /* keep the archive comment */
+        if (pZip->mEOCD.mCommentLen > 0) {
+            newZip.mEOCD.mCommentLen = pZip->mEOCD.mCommentLen;
+            newZip.mEOCD.mComment = new unsigned char[pZip->mEOCD.mCommentLen];
+            memcpy(newZip.mEOCD.mComment, pZip->mEOCD.mComment, pZip->mEOCD.mCommentLen);
+        }
+
+        result = newZip.flush();
+        if (result != NO_ERROR)
+            goto bail;
+    }
+
+    /* the old file must be closed before it can be replaced on Windows */
+    fclose(pZip->mZipFp);
+    pZip->mZipFp = NULL;
+#ifdef _WIN32
+    unlink(pZip->mFileName.string());
+#endif
+    if (rename(newName.string(), pZip->mFileName.string()) != 0) {
+        ALOGW("unable to rename '%s': %s\n", newName.string(), strerror(errno));
+        result = errnoToStatus(errno);
+        unlink(newName.string());
+        pZip->reopen();
+    } else {
+        result = pZip->reopen();
+    }
+    mRemoved.clear();
+    mAdditions.clear();
+    return result;
+
+bail:
+    unlink(newName.string());
+    mRemoved.clear();
+    mAdditions.clear();
+    return result;
+}
+
+/*
+ * Get the number of bytes from the start of entry "idx" to the next entry
+ * or the central directory.  Directory entries, which have no file
+ * offset, take up none; the first entry of the archive is at offset 0.
+ */
+long ZipFile::getEntrySpan(int idx) const
+{
+    const ZipEntry* pEntry = mEntries[idx];
+    if (pEntry->getLFHOffset() == 0 && idx != 0)
+        return 0;
+
+    /* Directory entries don't have file offsets, so find the next
+     * non-directory entry.
+     */
+    long nextOffset = 0;
+    const int count = mEntries.size();
+    for (int ii = idx+1; nextOffset == 0 && ii < count; ii++)
+        nextOffset = mEntries[ii]->getLFHOffset();
+    if (nextOffset == 0)
+        nextOffset = mEOCD.mCentralDirOffset;
+
+    long span = nextOffset - pEntry->getLFHOffset();
+    assert(span >= ZipEntry::LocalFileHeader::kLFHLen);
+    return span;
+}
+
+/*
+ * Get the number of bytes the local header, data and data descriptor of
+ * an entry take up.
+ */
+long ZipFile::getEntryLength(const ZipEntry* pEntry)
+{
+    return pEntry->getFileOffset() + pEntry->getCompressedLen()
+            + pEntry->getDataDescriptorLen() - pEntry->getLFHOffset();
+}
+
+/*
+ * Get the number of bytes before the central directory that no live
+ * entry uses: those of deleted entries and any left unused earlier.
+ */
+long ZipFile::getDeadSpace(void) const
+{
+    long dead = 0;
+    const int count = mEntries.size();
+    for (int i = 0; i < count; i++) {
+        long span = getEntrySpan(i);
+        if (mEntries[i]->getDeleted()) {
+            dead += span;
+        } else if (span != 0) {
+            long length = getEntryLength(mEntries[i]);
+            if (length < span)
+                dead += span - length;
+        }
+    }
+    return dead;
+}
+
+/*
+ * Forget deleted entries without moving anything, leaving their space in
+ * the archive unused.
+ */
+void ZipFile::dropDeletedEntries(void)
+{
+    int count = mEntries.size();
+    long delCount = 0;
+    for (int i = 0; i < count; i++) {
+        if (mEntries[i]->getDeleted()) {
+            delete mEntries[i];
+            mEntries.removeAt(i);
+            delCount++;
+            count--;
+            i--;
+        }
+    }
+
+    mEOCD.mNumEntries -= delCount;
+    mEOCD.mTotalNumEntries -= delCount;
+    mEOCD.mCentralDirSize = 0;  // mark invalid; set by flush()
+}
+
 /*
  * Crunch deleted files out of an archive by shifting the later files down.
  *
@@ -970,31 +2452,7 @@ status_t ZipFile::crunchArchive(void)
     delCount = adjust = 0;
     for (i = 0; i < count; i++) {
         ZipEntry* pEntry = mEntries[i];
-        long span;
-
-        if (pEntry->getLFHOffset() != 0) {
-            long nextOffset;
-
-            /* Get the length of this entry by finding the offset
-             * of the next entry.  Directory entries don't have
-             * file offsets, so we need to find the next non-directory
-             * entry.
-             */
-            nextOffset = 0;
-            for (int ii = i+1; nextOffset == 0 && ii < count; ii++)
-                nextOffset = mEntries[ii]->getLFHOffset();
-            if (nextOffset == 0)
-                nextOffset = mEOCD.mCentralDirOffset;
-            span = nextOffset - pEntry->getLFHOffset();
-
-            assert(span >= ZipEntry::LocalFileHeader::kLFHLen);
-        } else {
-            /* This is a directory entry.  It doesn't have
-             * any actual file contents, so there's no need to
-             * move anything.
-             */
-            span = 0;
-        }
+        long span = getEntrySpan(i);
 
         //printf("+++ %d: off=%ld span=%ld del=%d [count=%d]\n",
         //    i, pEntry->getLFHOffset(), span, pEntry->getDeleted(), count);
@@ -1009,19 +2467,29 @@ status_t ZipFile::crunchArchive(void)
             /* adjust loop control */
             count--;
             i--;
-        } else if (span != 0 && adjust > 0) {
-            /* shuffle this entry back */
-            //printf("+++ Shuffling '%s' back %ld\n",
-            //    pEntry->getFileName(), adjust);
-            result = filemove(mZipFp, pEntry->getLFHOffset() - adjust,
-                        pEntry->getLFHOffset(), span);
-            if (result != NO_ERROR) {
-                /* this is why you use a temp file */
-                ALOGE("error during crunch - archive is toast\n");
-                return result;
-            }
+        } else if (span != 0) {
+            /*
+             * Space left unused after the entry by an earlier flush(),
+             * see setCrunchThreshold(), is crunched out along with it.
+             */
+            long length = getEntryLength(pEntry);
+            if (length > span)
+                length = span;
+            if (adjust > 0) {
+                /* shuffle this entry back */
+                //printf("+++ Shuffling '%s' back %ld\n",
+                //    pEntry->getFileName(), adjust);
+                result = filemove(mZipFp, pEntry->getLFHOffset() - adjust,
+                            pEntry->getLFHOffset(), length);
+                if (result != NO_ERROR) {
+                    /* this is why you use a temp file */
+                    ALOGE("error during crunch - archive is toast\n");
+                    return result;
+                }
 
-            pEntry->setLFHOffset(pEntry->getLFHOffset() - adjust);
+                pEntry->setLFHOffset(pEntry->getLFHOffset() - adjust);
+            }
+            adjust += span - length;
         }
     }
 
@@ -1036,7 +2504,7 @@ status_t ZipFile::crunchArchive(void)
     mEOCD.mCentralDirSize = 0;  // mark invalid; set by flush()
 
     assert(mEOCD.mNumEntries == mEOCD.mTotalNumEntries);
-    assert(mEOCD.mNumEntries == count);
+    assert(mEOCD.mNumEntries == (uint64_t) count);
 
     return result;
 }
@@ -1109,6 +2577,15 @@ time_t ZipFile::getModTime(int fd)
     return sb.st_mtime;
 }
 
+/*
+ * Get the archive's modification date.  A pipe's stdio stream has no file
+ * descriptor of its own, so its sink's is used.
+ */
+time_t ZipFile::getArchiveModTime(void)
+{
+    return getModTime(mPipe != NULL ? mPipe->fd : fileno(mZipFp));
+}
+
 
 #if 0       /* this is a bad idea */
 /*
@@ -1255,19 +2732,71 @@ status_t ZipFile::EndOfCentralDir::readBuf(const unsigned char* buf, int len)
 }
 
 /*
- * Write an end-of-central-directory section.
+ * Take the counts and offsets from the ZIP64 EOCD in "buf".
+ */
+status_t ZipFile::EndOfCentralDir::readZip64(const unsigned char* buf, int len)
+{
+    if (len < kZip64EOCDLen || ZipEntry::getLongLE(&buf[0x00]) != kZip64Signature) {
+        ALOGD(" Zip64 EOCD: bad record\n");
+        return UNKNOWN_ERROR;
+    }
+
+    if (ZipEntry::getLongLE(&buf[0x10]) != 0 || ZipEntry::getLongLE(&buf[0x14]) != 0) {
+        ALOGD("Archive spanning not supported\n");
+        return INVALID_OPERATION;
+    }
+    mNumEntries = ZipEntry::getLongLongLE(&buf[0x18]);
+    mTotalNumEntries = ZipEntry::getLongLongLE(&buf[0x20]);
+    mCentralDirSize = ZipEntry::getLongLongLE(&buf[0x28]);
+    mCentralDirOffset = ZipEntry::getLongLongLE(&buf[0x30]);
+
+    return NO_ERROR;
+}
+
+/*
+ * Write an end-of-central-directory section.  When the counts or offsets
+ * don't fit, the ZIP64 EOCD and its locator are written first, and the
+ * EOCD holds the largest value of each field in their place.
  */
 status_t ZipFile::EndOfCentralDir::write(FILE* fp)
 {
     unsigned char buf[kEOCDLen];
 
+    if (mTotalNumEntries >= 0xffff || mCentralDirSize >= 0xffffffff ||
+        mCentralDirOffset >= 0xffffffff)
+    {
+        unsigned char record[kZip64EOCDLen + kZip64LocatorLen];
+        uint64_t recordPosn = mCentralDirOffset + mCentralDirSize;
+
+        ZipEntry::putLongLE(&record[0x00], kZip64Signature);
+        ZipEntry::putLongLongLE(&record[0x04], kZip64EOCDLen - 12);
+        ZipEntry::putShortLE(&record[0x0c], ZipEntry::kZip64Version);
+        ZipEntry::putShortLE(&record[0x0e], ZipEntry::kZip64Version);
+        ZipEntry::putLongLE(&record[0x10], mDiskNumber);
+        ZipEntry::putLongLE(&record[0x14], mDiskWithCentralDir);
+        ZipEntry::putLongLongLE(&record[0x18], mNumEntries);
+        ZipEntry::putLongLongLE(&record[0x20], mTotalNumEntries);
+        ZipEntry::putLongLongLE(&record[0x28], mCentralDirSize);
+        ZipEntry::putLongLongLE(&record[0x30], mCentralDirOffset);
+
+        unsigned char* locator = record + kZip64EOCDLen;
+        ZipEntry::putLongLE(&locator[0x00], kZip64LocatorSignature);
+        ZipEntry::putLongLE(&locator[0x04], mDiskWithCentralDir);
+        ZipEntry::putLongLongLE(&locator[0x08], recordPosn);
+        ZipEntry::putLongLE(&locator[0x10], 1);
+
+        if (fwrite(record, 1, sizeof(record), fp) != sizeof(record))
+            return UNKNOWN_ERROR;
+    }
+
     ZipEntry::putLongLE(&buf[0x00], kSignature);
     ZipEntry::putShortLE(&buf[0x04], mDiskNumber);
     ZipEntry::putShortLE(&buf[0x06], mDiskWithCentralDir);
-    ZipEntry::putShortLE(&buf[0x08], mNumEntries);
-    ZipEntry::putShortLE(&buf[0x0a], mTotalNumEntries);
-    ZipEntry::putLongLE(&buf[0x0c], mCentralDirSize);
-    ZipEntry::putLongLE(&buf[0x10], mCentralDirOffset);
+    ZipEntry::putShortLE(&buf[0x08], mNumEntries < 0xffff ? mNumEntries : 0xffff);
+    ZipEntry::putShortLE(&buf[0x0a], mTotalNumEntries < 0xffff ? mTotalNumEntries : 0xffff);
+    ZipEntry::putLongLE(&buf[0x0c], mCentralDirSize < 0xffffffff ? mCentralDirSize : 0xffffffff);
+    ZipEntry::putLongLE(&buf[0x10],
+        mCentralDirOffset < 0xffffffff ? mCentralDirOffset : 0xffffffff);
     ZipEntry::putShortLE(&buf[0x14], mCommentLen);
 
     if (fwrite(buf, 1, kEOCDLen, fp) != kEOCDLen)
@@ -1287,9 +2816,11 @@ status_t ZipFile::EndOfCentralDir::write(FILE* fp)
 void ZipFile::EndOfCentralDir::dump(void) const
 {
     ALOGD(" EndOfCentralDir contents:\n");
-    ALOGD("  diskNum=%u diskWCD=%u numEnt=%u totalNumEnt=%u\n",
-        mDiskNumber, mDiskWithCentralDir, mNumEntries, mTotalNumEntries);
-    ALOGD("  centDirSize=%lu centDirOff=%lu commentLen=%u\n",
-        mCentralDirSize, mCentralDirOffset, mCommentLen);
+    ALOGD("  diskNum=%u diskWCD=%u numEnt=%llu totalNumEnt=%llu\n",
+        mDiskNumber, mDiskWithCentralDir, (unsigned long long) mNumEntries,
+        (unsigned long long) mTotalNumEntries);
+    ALOGD("  centDirSize=%llu centDirOff=%llu commentLen=%u\n",
+        (unsigned long long) mCentralDirSize, (unsigned long long) mCentralDirOffset,
+        mCommentLen);
 }
 
@@ -21,9 +21,13 @@
 #ifndef __LIBS_ZIPFILE_H
 #define __LIBS_ZIPFILE_H
 
+#include <utils/BasicHashtable.h>
+#include <utils/SortedVector.h>
+#include <utils/String8.h>
 #include <utils/Vector.h>
 #include <utils/Errors.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "ZipEntry.h"
 
@@ -41,14 +45,19 @@ namespace android {
  * after making changes and before flush() completes could leave us with
  * an unusable Zip archive.
  */
+struct ZipPipeSink;
+struct ZipParallelWriter;
+
 class ZipFile {
 public:
     ZipFile(void)
-      : mZipFp(NULL), mReadOnly(false), mNeedCDRewrite(false)
+      : mZipFp(NULL), mPipe(NULL), mWriters(NULL), mReadOnly(false), mStreaming(false),
+        mNeedCDRewrite(false), mCrunchPercent(0), mNameIndexHasDuplicates(false)
       {}
     ~ZipFile(void) {
         if (!mReadOnly)
             flush();
+        finishWriters();
         if (mZipFp != NULL)
             fclose(mZipFp);
         discardEntries();
@@ -62,9 +71,40 @@ public:
         kOpenReadWrite  = 0x02,
         kOpenCreate     = 0x04,     // create if it doesn't exist
         kOpenTruncate   = 0x08,     // if it exists, empty it
+        kOpenStreaming  = 0x10,     // new archive, written front to back
+        kOpenPipe       = 0x20,     // streaming, to a pipe; see below
+        kOpenParallel   = 0x40,     // streaming, stored files copied by workers
     };
+
+    /*
+     * A kOpenPipe archive is written to a FIFO or device that can't seek
+     * or be read back, such as an uploader's pipe.  It must be opened with
+     * kOpenStreaming.  The position is counted instead of asked for, and
+     * entries deflated as they are added get a data descriptor instead of
+     * a second pass over the LFH.  Not supported on Windows.
+     *
+     * A kOpenParallel archive, also opened with kOpenStreaming but not
+     * kOpenPipe, places each large file added uncompressed from disk as
+     * it is added, LFH and all, and leaves its data and CRC to be written
+     * in place by a work unit on the shared WorkQueue, so that the caller
+     * goes on to the next entry while the copy is made.  The archive is
+     * byte for byte what it would be otherwise.  flush() waits for the
+     * copies and reports any that failed; until then such an entry's
+     * getCRC32() is 0.  The flag is ignored on Windows.
+     */
     status_t open(const char* zipFileName, int flags);
 
+    /*
+     * Deflate compression levels.  Levels 1 through 9 are zlib's own;
+     * kCompressLevelMax is level 9 with zlib's largest memory level, which
+     * is slower again but can find more matches.
+     */
+    enum {
+        kCompressLevelFast      = 1,
+        kCompressLevelDefault   = 9,
+        kCompressLevelMax       = 10,
+    };
+
     /*
      * Add a file to the end of the archive.  Specify whether you want the
      * library to try to store it compressed.
@@ -84,10 +124,25 @@ public:
     }
     status_t add(const char* fileName, const char* storageName,
         int compressionMethod, ZipEntry** ppEntry)
+    {
+        return add(fileName, storageName, compressionMethod,
+                   kCompressLevelDefault, 0, ppEntry);
+    }
+
+    /*
+     * Add a file, as above.  If it is deflated, "compressionLevel" is
+     * passed to zlib; see kCompressLevelDefault.  If it ends up stored
+     * uncompressed, its data will start at a multiple of "alignment" bytes
+     * from the start of the archive, the way zipalign would place it; pass
+     * 0 for no alignment.  The LFH "extra" field is padded to get there.
+     */
+    status_t add(const char* fileName, const char* storageName,
+        int compressionMethod, int compressionLevel, int alignment,
+        ZipEntry** ppEntry)
     {
         return addCommon(fileName, NULL, 0, storageName,
                          ZipEntry::kCompressStored,
-                         compressionMethod, ppEntry);
+                         compressionMethod, compressionLevel, alignment, ppEntry);
     }
 
     /*
@@ -100,7 +155,7 @@ public:
     {
         return addCommon(fileName, NULL, 0, storageName,
                          ZipEntry::kCompressDeflated,
-                         ZipEntry::kCompressDeflated, ppEntry);
+                         ZipEntry::kCompressDeflated, kCompressLevelDefault, 0, ppEntry);
     }
 
     /*
@@ -110,10 +165,61 @@ public:
      */
     status_t add(const void* data, size_t size, const char* storageName,
         int compressionMethod, ZipEntry** ppEntry)
+    {
+        return add(data, size, storageName, compressionMethod,
+                   kCompressLevelDefault, 0, ppEntry);
+    }
+
+    /*
+     * Add an in-memory data buffer, deflated at "compressionLevel" or
+     * aligned if it is stored, as above.
+     */
+    status_t add(const void* data, size_t size, const char* storageName,
+        int compressionMethod, int compressionLevel, int alignment,
+        ZipEntry** ppEntry)
     {
         return addCommon(NULL, data, size, storageName,
                          ZipEntry::kCompressStored,
-                         compressionMethod, ppEntry);
+                         compressionMethod, compressionLevel, alignment, ppEntry);
+    }
+
+    /*
+     * Add an entry whose data was deflated ahead of time by compressData(),
+     * typically on another thread.  "fileName" names the source file and
+     * is only used for the modification date; pass NULL for data that came
+     * from memory.
+     *
+     * If "ppEntry" is non-NULL, a pointer to the new entry will be returned.
+     */
+    status_t addCompressed(const char* fileName, const void* compressedData,
+        size_t compressedLen, long uncompressedLen, unsigned long crc32,
+        const char* storageName, ZipEntry** ppEntry);
+
+    /*
+     * Deflate a file, or an in-memory buffer if "data" is non-NULL, into
+     * "pOut" the same way add() would at "compressionLevel".  This does not
+     * touch any archive, so it may be called from several threads at once.
+     */
+    static status_t compressData(const char* fileName, const void* data, size_t size,
+        int compressionLevel, Vector<unsigned char>* pOut, long* pUncompressedLen,
+        unsigned long* pCRC32);
+
+    /*
+     * Sets how many threads may deflate a single large in-memory entry,
+     * which is done in independent blocks; see deflateBlocks().  Entries
+     * are split the same way whatever this is set to, so the archive does
+     * not depend on it.  Set it before anything is added; the default is 1.
+     */
+    static void setDeflateThreads(size_t threads) {
+        sDeflateThreads = threads > 0 ? threads : 1;
+    }
+
+    /*
+     * Returns true if the compressed data saves enough space to be worth
+     * storing deflated; add() stores other entries uncompressed.
+     */
+    static bool isCompressedEnough(long uncompressedLen, long compressedLen) {
+        return compressedLen + (compressedLen / 10) <= uncompressedLen;
     }
 
     /*
@@ -121,6 +227,10 @@ public:
      * nonzero, the specified number of bytes will be added to the "extra"
      * field in the header.
      *
+     * The data is copied as-is, without being expanded and compressed
+     * again.  As with the other add() calls, this fails with ALREADY_EXISTS
+     * if there is already an entry with the same name.
+     *
      * If "ppEntry" is non-NULL, a pointer to the new entry will be returned.
      */
     status_t add(const ZipFile* pSourceZip, const ZipEntry* pSourceEntry,
@@ -130,6 +240,8 @@ public:
      * Mark an entry as having been removed.  It is not actually deleted
      * from the archive or our internal data structures until flush() is
      * called.
+     *
+     * Not allowed on archives opened with kOpenStreaming.
      */
     status_t remove(ZipEntry* pEntry);
 
@@ -138,6 +250,59 @@ public:
      */
     status_t flush(void);
 
+    /*
+     * A set of removals and additions made to an archive together.  When
+     * committed, the archive is written again next to itself in a single
+     * sequential pass -- the entries kept, copied as they are, then the
+     * files added -- and renamed over the original, which the ZipFile then
+     * has open instead.  Nothing is moved around inside the old file, so
+     * however many entries are removed the work is one copy of the
+     * archive, and if anything fails the original is left as it was.
+     *
+     * An added file replaces any entry of the same name.
+     */
+    class Batch {
+    public:
+        Batch(ZipFile* pZipFile) : mZipFile(pZipFile) {}
+
+        /* remove the entry "storageName", if there is one */
+        void remove(const char* storageName);
+
+        /* add "fileName" as "storageName", as ZipFile::add() would */
+        void add(const char* fileName, const char* storageName,
+            int compressionMethod, int compressionLevel);
+
+        /* add a file already compressed with gzip, as addGzip() would */
+        void addGzip(const char* fileName, const char* storageName);
+
+        /*
+         * Write the archive with the changes.  The batch is empty again
+         * afterwards, whether or not this succeeded.
+         */
+        status_t commit(void);
+
+    private:
+        struct Addition {
+            String8     mFileName;
+            String8     mStorageName;
+            int         mCompressionMethod;
+            int         mCompressionLevel;
+            bool        mGzip;
+        };
+
+        ZipFile*            mZipFile;
+        SortedVector<String8> mRemoved;     // including names replaced
+        Vector<Addition>    mAdditions;
+    };
+
+    /*
+     * Have flush() crunch deleted entries out only once unused space makes
+     * up more than "percent" of the archive, and otherwise leave it unused
+     * so that the entries after it needn't be moved.  Zip readers skip such
+     * space.  The default, 0, always crunches.
+     */
+    void setCrunchThreshold(int percent) { mCrunchPercent = percent; }
+
     /*
      * Expand the data into the buffer provided.  The buffer must hold
      * at least <uncompressed len> bytes.  Variation expands directly
@@ -186,15 +351,18 @@ private:
         }
 
         status_t readBuf(const unsigned char* buf, int len);
+        /* take the counts and offsets from a ZIP64 end of central dir */
+        status_t readZip64(const unsigned char* buf, int len);
+        /* writes the ZIP64 record and its locator first, if needed */
         status_t write(FILE* fp);
 
         //unsigned long   mSignature;
         unsigned short  mDiskNumber;
         unsigned short  mDiskWithCentralDir;
-        unsigned short  mNumEntries;
-        unsigned short  mTotalNumEntries;
-        unsigned long   mCentralDirSize;
-        unsigned long   mCentralDirOffset;      // offset from first disk
+        uint64_t        mNumEntries;
+        uint64_t        mTotalNumEntries;
+        uint64_t        mCentralDirSize;
+        uint64_t        mCentralDirOffset;      // offset from first disk
         unsigned short  mCommentLen;
         unsigned char*  mComment;
 
@@ -202,6 +370,11 @@ private:
             kSignature      = 0x06054b50,
             kEOCDLen        = 22,       // EndOfCentralDir len, excl. comment
 
+            kZip64Signature = 0x06064b50,
+            kZip64EOCDLen   = 56,       // ZIP64 EOCD len, excl. extensible data
+            kZip64LocatorSignature = 0x07064b50,
+            kZip64LocatorLen = 20,
+
             kMaxCommentLen  = 65535,    // longest possible in ushort
             kMaxEOCDSearch  = kMaxCommentLen + EndOfCentralDir::kEOCDLen,
 
@@ -213,17 +386,62 @@ private:
 
     /* read all entries in the central dir */
     status_t readCentralDir(void);
+    /* the same, from the whole archive mapped into memory */
+    status_t readCentralDirEntries(const unsigned char* base, size_t length);
+    /* apply the ZIP64 EOCD, if the EOCD at "eocdPosn" has a locator */
+    status_t readZip64EndOfCentralDir(off_t eocdPosn);
 
     /* crunch deleted entries out */
     status_t crunchArchive(void);
+    /* forget deleted entries, leaving their space unused */
+    void dropDeletedEntries(void);
+
+    /* bytes from an entry to the next one, and those the entry itself uses */
+    long getEntrySpan(int idx) const;
+    static long getEntryLength(const ZipEntry* pEntry);
+    /* bytes no live entry uses */
+    long getDeadSpace(void) const;
 
     /* clean up mEntries */
     void discardEntries(void);
 
+    /* open mFileName again, after Batch::commit() replaced it */
+    status_t reopen(void);
+
+    /* keep mNameIndex in step with the live entries of mEntries */
+    void indexEntry(ZipEntry* pEntry);
+    void unindexEntry(ZipEntry* pEntry);
+
+    /* add entries that follow each other in another archive, in one copy */
+    status_t addRun(const ZipFile* pSourceZip, size_t first, size_t count);
+
     /* common handler for all "add" functions */
     status_t addCommon(const char* fileName, const void* data, size_t size,
         const char* storageName, int sourceType, int compressionMethod,
-        ZipEntry** ppEntry);
+        int compressionLevel, int alignment, ZipEntry** ppEntry);
+    /* addCommon() for kOpenStreaming archives */
+    status_t addStreaming(FILE* inputFp, const void* data, size_t size,
+        ZipEntry* pEntry, int sourceType, int compressionMethod,
+        int compressionLevel, int alignment, time_t modWhen);
+    /* addStreaming() for entries deflated straight into a kOpenPipe archive */
+    status_t addWithDataDescriptor(FILE* inputFp, const void* data, size_t size,
+        ZipEntry* pEntry, int compressionLevel, time_t modWhen);
+
+    /* addStreaming() for a file stored by a kOpenParallel archive's workers */
+    status_t addParallel(const char* fileName, ZipEntry* pEntry, int alignment);
+    /* wait for those workers; the first error any of them had, if one did */
+    status_t waitForWriters(void);
+    /* the same, then free mWriters */
+    void finishWriters(void);
+
+    /* where the next byte written to mZipFp goes, even on a pipe */
+    long tell(void);
+
+    /* pad the LFH so that the entry's data, written after it, is aligned */
+    static status_t alignEntry(ZipEntry* pEntry, long lfhPosn, int alignment);
+
+    /* seek to the end of the entries, where the next one goes */
+    status_t seekToCentralDir(void);
 
     /* copy all of "srcFp" into "dstFp" */
     status_t copyFpToFp(FILE* dstFp, FILE* srcFp, unsigned long* pCRC32);
@@ -236,17 +454,35 @@ private:
     /* like memmove(), but on parts of a single file */
     status_t filemove(FILE* fp, off_t dest, off_t src, size_t n);
     /* compress all of "srcFp" into "dstFp", using Deflate */
-    status_t compressFpToFp(FILE* dstFp, FILE* srcFp,
-        const void* data, size_t size, unsigned long* pCRC32);
+    static status_t compressFpToFp(FILE* dstFp, FILE* srcFp,
+        const void* data, size_t size, int level, unsigned long* pCRC32);
+    /* compress all of "srcFp" into "dstFp" or, if that is NULL, "dstBuf" */
+    static status_t deflateToSink(FILE* dstFp, Vector<unsigned char>* dstBuf,
+        FILE* srcFp, const void* data, size_t size, int level, unsigned long* pCRC32);
+    /* deflateToSink() for large in-memory data, a block per work unit */
+    static status_t deflateBlocks(FILE* dstFp, Vector<unsigned char>* dstBuf,
+        const void* data, size_t size, int level, unsigned long* pCRC32);
 
     /* get modification date from a file descriptor */
     time_t getModTime(int fd);
+    /* the same for the archive itself, for entries added from memory */
+    time_t getArchiveModTime(void);
+
+    /* open mZipFp on a kOpenPipe archive */
+    status_t openPipe(const char* zipFileName);
 
     /*
      * We use stdio FILE*, which gives us buffering but makes dealing
-     * with files >2GB awkward.  Until we support Zip64, we're fine.
+     * with files >2GB awkward on hosts where a long is 32 bits.
      */
     FILE*           mZipFp;             // Zip file pointer
+    String8         mFileName;          // as passed to open()
+
+    /* what mZipFp writes to, for kOpenPipe; owned by mZipFp */
+    ZipPipeSink*    mPipe;
+
+    /* the copies still being made, for kOpenParallel; NULL otherwise */
+    ZipParallelWriter* mWriters;
 
     /* one of these per file */
     EndOfCentralDir mEOCD;
@@ -254,15 +490,53 @@ private:
     /* did we open this read-only? */
     bool            mReadOnly;
 
+    /*
+     * Was this opened with kOpenStreaming?  If so every entry is written
+     * once, in order, right after the previous one, so there is never
+     * anything to crunch or seek back to.
+     */
+    bool            mStreaming;
+
     /* set this when we trash the central dir */
     bool            mNeedCDRewrite;
 
+    /* see setCrunchThreshold() */
+    int             mCrunchPercent;
+
     /*
      * One ZipEntry per entry in the zip file.  I'm using pointers instead
      * of objects because it's easier than making operator= work for the
      * classes and sub-classes.
      */
     Vector<ZipEntry*>   mEntries;
+
+    /*
+     * Index of the entries that are not pending deletion, by file name, so
+     * getEntryByName() doesn't have to search mEntries.  The names belong
+     * to the ZipEntry objects, which outlive their place in the index.
+     */
+    struct EntryName {
+        EntryName(const char* name) : mName(name) {}
+        bool operator==(const EntryName& other) const {
+            return strcmp(mName, other.mName) == 0;
+        }
+        hash_t hash(void) const;
+
+        const char*     mName;
+    };
+    struct NameIndexEntry {
+        NameIndexEntry(ZipEntry* pEntry) : mEntry(pEntry) {}
+        EntryName getKey(void) const { return EntryName(mEntry->getFileName()); }
+
+        ZipEntry*       mEntry;
+    };
+    BasicHashtable<EntryName, NameIndexEntry> mNameIndex;
+
+    /* set once two live entries have shared a name; see unindexEntry() */
+    bool            mNameIndexHasDuplicates;
+
+    /* see setDeflateThreads() */
+    static size_t   sDeflateThreads;
 };
 
 }; // namespace android
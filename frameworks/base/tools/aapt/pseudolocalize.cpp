@@ -3,18 +3,20 @@
 using namespace std;
 
 // String basis to generate expansion
-static const String16 k_expansion_string = String16("one two three "
-    "four five six seven eight nine ten eleven twelve thirteen "
-    "fourteen fiveteen sixteen seventeen nineteen twenty");
+static const char16_t k_expansion_string[] = u"one two three "
+    u"four five six seven eight nine ten eleven twelve thirteen "
+    u"fourteen fiveteen sixteen seventeen nineteen twenty";
+static const size_t k_expansion_length =
+    sizeof(k_expansion_string) / sizeof(k_expansion_string[0]) - 1;
 
 // Special unicode characters to override directionality of the words
-static const String16 k_rlm = String16("\xe2\x80\x8f");
-static const String16 k_rlo = String16("\xE2\x80\xae");
-static const String16 k_pdf = String16("\xE2\x80\xac");
+static const char16_t k_rlm = 0x200f;
+static const char16_t k_rlo = 0x202e;
+static const char16_t k_pdf = 0x202c;
 
 // Placeholder marks
-static const String16 k_placeholder_open = String16("\xc2\xbb");
-static const String16 k_placeholder_close = String16("\xc2\xab");
+static const char16_t k_placeholder_open = 0x00bb;
+static const char16_t k_placeholder_close = 0x00ab;
 
 static const char16_t k_arg_start = '{';
 static const char16_t k_arg_end = '}';
@@ -37,8 +39,23 @@ void Pseudolocalizer::setMethod(PseudolocalizationMethod m) {
   }
 }
 
+String16 Pseudolocalizer::takeBuffer() {
+  String16 out(mBuffer.data(), mBuffer.size());
+  mBuffer.clear();
+  return out;
+}
+
+String16 Pseudolocalizer::start() {
+  mImpl->start(&mBuffer);
+  return takeBuffer();
+}
+
+String16 Pseudolocalizer::end() {
+  mImpl->end(&mBuffer);
+  return takeBuffer();
+}
+
 String16 Pseudolocalizer::text(const String16& text) {
-  String16 out;
   size_t depth = mLastDepth;
   size_t lastpos, pos;
   const size_t length= text.size();
@@ -69,25 +86,25 @@ String16 Pseudolocalizer::text(const String16& text) {
       }
       size_t size = nextpos - lastpos;
       if (size) {
-        String16 chunk = String16(text, size, lastpos);
         if (pseudo) {
-          chunk = mImpl->text(chunk);
+          mImpl->text(str + lastpos, size, &mBuffer);
         } else if (str[lastpos] == k_arg_start &&
                    str[nextpos - 1] == k_arg_end) {
-          chunk = mImpl->placeholder(chunk);
+          mImpl->placeholder(str + lastpos, size, &mBuffer);
+        } else {
+          mBuffer.append(str + lastpos, size);
         }
-        out.append(chunk);
       }
       if (pseudo && depth < mLastDepth) { // End of message
-        out.append(mImpl->end());
+        mImpl->end(&mBuffer);
       } else if (!pseudo && depth > mLastDepth) { // Start of message
-        out.append(mImpl->start());
+        mImpl->start(&mBuffer);
       }
       lastpos = nextpos;
       mLastDepth = depth;
     }
   }
-  return out;
+  return takeBuffer();
 }
 
 static const char*
@@ -152,6 +169,24 @@ pseudolocalize_char(const char16_t c)
     }
 }
 
+/**
+ * Returns the single UTF-16 unit that pseudolocalize_char() maps c to,
+ * or 0 if c is left alone.
+ */
+static char16_t pseudolocalize_char16(const char16_t c)
+{
+    static char16_t sMap[128];
+    static bool sMapped = []() {
+        for (char16_t i = 0; i < 128; i++) {
+            const char* p = pseudolocalize_char(i);
+            sMap[i] = p != NULL ? String16(p)[0] : 0;
+        }
+        return true;
+    }();
+    (void) sMapped;
+    return c < 128 ? sMap[c] : 0;
+}
+
 static bool is_possible_normal_placeholder_end(const char16_t c) {
     switch (c) {
         case 's': return true;
@@ -179,53 +214,46 @@ static bool is_possible_normal_placeholder_end(const char16_t c) {
     }
 }
 
-static String16 pseudo_generate_expansion(const unsigned int length) {
-    String16 result = k_expansion_string;
-    const char16_t* s = result.string();
-    if (result.size() < length) {
-        result += String16(" ");
-        result += pseudo_generate_expansion(length - result.size());
+static void pseudo_generate_expansion(const unsigned int length, PseudoBuffer* out) {
+    if (k_expansion_length < length) {
+        out->append(k_expansion_string, k_expansion_length);
+        out->push_back(' ');
+        pseudo_generate_expansion(length - (k_expansion_length + 1), out);
     } else {
-        int ext = 0;
+        unsigned int ext = 0;
         // Should contain only whole words, so looking for a space
-        for (unsigned int i = length + 1; i < result.size(); ++i) {
+        for (unsigned int i = length + 1; i < k_expansion_length; ++i) {
           ++ext;
-          if (s[i] == ' ') {
+          if (k_expansion_string[i] == ' ') {
             break;
           }
         }
-        result.remove(length + ext, 0);
+        out->append(k_expansion_string, min<size_t>(length + ext, k_expansion_length));
     }
-    return result;
 }
 
 static bool is_space(const char16_t c) {
   return (c == ' ' || c == '\t' || c == '\n');
 }
 
-String16 PseudoMethodAccent::start() {
-  String16 result;
+void PseudoMethodAccent::start(PseudoBuffer* out) {
   if (mDepth == 0) {
-    result = String16(String8("["));
+    out->push_back('[');
   }
   mWordCount = mLength = 0;
   mDepth++;
-  return result;
 }
 
-String16 PseudoMethodAccent::end() {
-  String16 result;
+void PseudoMethodAccent::end(PseudoBuffer* out) {
   if (mLength) {
-    result.append(String16(String8(" ")));
-    result.append(pseudo_generate_expansion(
-        mWordCount > 3 ? mLength : mLength / 2));
+    out->push_back(' ');
+    pseudo_generate_expansion(mWordCount > 3 ? mLength : mLength / 2, out);
   }
   mWordCount = mLength = 0;
   mDepth--;
   if (mDepth == 0) {
-    result.append(String16(String8("]")));
+    out->push_back(']');
   }
-  return result;
 }
 
 /**
@@ -234,24 +262,24 @@ String16 PseudoMethodAccent::end() {
  * Note: This leaves escape sequences untouched so they can later be
  * processed by ResTable::collectString in the normal way.
  */
-String16 PseudoMethodAccent::text(const String16& source)
+void PseudoMethodAccent::text(const char16_t* s, size_t I, PseudoBuffer* out)
 {
-    const char16_t* s = source.string();
-    String16 result;
-    const size_t I = source.size();
+    // Scanning for the end of a placeholder or tag can look one past the
+    // text, which reads as the terminator it used to be copied with.
+    auto at = [s, I](size_t i) -> char16_t { return i < I ? s[i] : 0; };
     bool lastspace = true;
     for (size_t i=0; i<I; i++) {
         char16_t c = s[i];
         if (c == '\\') {
             // Escape syntax, no need to pseudolocalize
             if (i<I-1) {
-                result += String16("\\");
+                out->push_back('\\');
                 i++;
                 c = s[i];
                 switch (c) {
                     case 'u':
                         // this one takes up 5 chars
-                        result += String16(s+i, 5);
+                        out->append(s+i, min<size_t>(5, I-i));
                         i += 4;
                         break;
                     case 't':
@@ -263,45 +291,54 @@ String16 PseudoMethodAccent::text(const String16& source)
                     case '\'':
                     case '\\':
                     default:
-                        result.append(&c, 1);
+                        out->push_back(c);
                         break;
                 }
             } else {
-                result.append(&c, 1);
+                out->push_back(c);
             }
         } else if (c == '%') {
             // Placeholder syntax, no need to pseudolocalize
-            String16 chunk;
+            const size_t start = i;
             bool end = false;
-            chunk.append(&c, 1);
             while (!end && i < I) {
                 ++i;
-                c = s[i];
-                chunk.append(&c, 1);
+                c = at(i);
                 if (is_possible_normal_placeholder_end(c)) {
                     end = true;
                 } else if (c == 't') {
                     ++i;
-                    c = s[i];
-                    chunk.append(&c, 1);
+                    c = at(i);
                     end = true;
                 }
             }
+            // A chunk cut short by the end of the text takes the
+            // terminator along.
+            PseudoBuffer cutShort;
+            const char16_t* chunk = s + start;
+            size_t chunkLen = i + 1 - start;
+            if (i >= I) {
+                cutShort.assign(chunk, chunkLen - 1);
+                cutShort.push_back(0);
+                chunk = cutShort.data();
+            }
             // Treat chunk as a placeholder unless it ends with %.
-            result += ((c == '%') ? chunk : placeholder(chunk));
+            if (c == '%') {
+                out->append(chunk, chunkLen);
+            } else {
+                placeholder(chunk, chunkLen, out);
+            }
         } else if (c == '<' || c == '&') {
             // html syntax, no need to pseudolocalize
             bool tag_closed = false;
             while (!tag_closed && i < I) {
                 if (c == '&') {
-                    String16 escape_text;
-                    escape_text.append(&c, 1);
+                    const size_t escapeStart = i;
                     bool end = false;
                     size_t htmlCodePos = i;
                     while (!end && htmlCodePos < I) {
                         ++htmlCodePos;
-                        c = s[htmlCodePos];
-                        escape_text.append(&c, 1);
+                        c = at(htmlCodePos);
                         // Valid html code
                         if (c == ';') {
                             end = true;
@@ -315,73 +352,84 @@ String16 PseudoMethodAccent::text(const String16& source)
                             end = true;
                         }
                     }
-                    result += escape_text;
-                    if (escape_text != String16("&lt;")) {
+                    const size_t escapeEnd = min(htmlCodePos + 1, I);
+                    out->append(s + escapeStart, escapeEnd - escapeStart);
+                    if (htmlCodePos >= I) {
+                        out->push_back(0);
+                    }
+                    static const char16_t kLt[] = u"&lt;";
+                    if (htmlCodePos >= I || htmlCodePos + 1 - escapeStart != 4
+                            || memcmp(s + escapeStart, kLt, 4 * sizeof(char16_t)) != 0) {
                         tag_closed = true;
                     }
                     continue;
                 }
                 if (c == '>') {
                     tag_closed = true;
-                    result.append(&c, 1);
+                    out->push_back(c);
                     continue;
                 }
-                result.append(&c, 1);
+                out->push_back(c);
                 i++;
-                c = s[i];
+                c = at(i);
             }
         } else {
             // This is a pure text that should be pseudolocalized
-            const char* p = pseudolocalize_char(c);
-            if (p != NULL) {
-                result += String16(p);
+            const char16_t p = pseudolocalize_char16(c);
+            if (p != 0) {
+                out->push_back(p);
             } else {
                 bool space = is_space(c);
                 if (lastspace && !space) {
                   mWordCount++;
                 }
                 lastspace = space;
-                result.append(&c, 1);
+                out->push_back(c);
             }
             // Count only pseudolocalizable chars and delimiters
             mLength++;
         }
     }
-    return result;
 }
-String16 PseudoMethodAccent::placeholder(const String16& source) {
+
+void PseudoMethodAccent::placeholder(const char16_t* source, size_t len, PseudoBuffer* out) {
   // Surround a placeholder with brackets
-  return k_placeholder_open + source + k_placeholder_close;
+  out->push_back(k_placeholder_open);
+  out->append(source, len);
+  out->push_back(k_placeholder_close);
 }
 
-String16 PseudoMethodBidi::text(const String16& source)
+void PseudoMethodBidi::text(const char16_t* s, size_t len, PseudoBuffer* out)
 {
-    const char16_t* s = source.string();
-    String16 result;
     bool lastspace = true;
     bool space = true;
-    for (size_t i=0; i<source.size(); i++) {
+    for (size_t i=0; i<len; i++) {
         char16_t c = s[i];
         space = is_space(c);
         if (lastspace && !space) {
           // Word start
-          result += k_rlm + k_rlo;
+          out->push_back(k_rlm);
+          out->push_back(k_rlo);
         } else if (!lastspace && space) {
           // Word end
-          result += k_pdf + k_rlm;
+          out->push_back(k_pdf);
+          out->push_back(k_rlm);
         }
         lastspace = space;
-        result.append(&c, 1);
+        out->push_back(c);
     }
     if (!lastspace) {
       // End of last word
-      result += k_pdf + k_rlm;
+      out->push_back(k_pdf);
+      out->push_back(k_rlm);
     }
-    return result;
 }
 
-String16 PseudoMethodBidi::placeholder(const String16& source) {
+void PseudoMethodBidi::placeholder(const char16_t* source, size_t len, PseudoBuffer* out) {
   // Surround a placeholder with directionality change sequence
-  return k_rlm + k_rlo + source + k_pdf + k_rlm;
+  out->push_back(k_rlm);
+  out->push_back(k_rlo);
+  out->append(source, len);
+  out->push_back(k_pdf);
+  out->push_back(k_rlm);
 }
-
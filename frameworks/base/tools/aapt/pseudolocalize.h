@@ -2,39 +2,47 @@
 #define HOST_PSEUDOLOCALIZE_H
 
 #include <base/macros.h>
+#include <string>
 #include "StringPool.h"
 
+// The buffer pseudolocalized text is built up in.  Pseudolocalizer keeps
+// one for all the strings it handles, instead of allocating a String16 for
+// every piece.
+typedef std::u16string PseudoBuffer;
+
 class PseudoMethodImpl {
  public:
   virtual ~PseudoMethodImpl() {}
-  virtual String16 start() { return String16(); }
-  virtual String16 end() { return String16(); }
-  virtual String16 text(const String16& text) = 0;
-  virtual String16 placeholder(const String16& text) = 0;
+  virtual void start(PseudoBuffer* /* out */) { }
+  virtual void end(PseudoBuffer* /* out */) { }
+  virtual void text(const char16_t* text, size_t len, PseudoBuffer* out) = 0;
+  virtual void placeholder(const char16_t* text, size_t len, PseudoBuffer* out) = 0;
 };
 
 class PseudoMethodNone : public PseudoMethodImpl {
  public:
   PseudoMethodNone() {}
-  String16 text(const String16& text) { return text; }
-  String16 placeholder(const String16& text) { return text; }
+  void text(const char16_t* text, size_t len, PseudoBuffer* out) { out->append(text, len); }
+  void placeholder(const char16_t* text, size_t len, PseudoBuffer* out) {
+    out->append(text, len);
+  }
  private:
   DISALLOW_COPY_AND_ASSIGN(PseudoMethodNone);
 };
 
 class PseudoMethodBidi : public PseudoMethodImpl {
  public:
-  String16 text(const String16& text);
-  String16 placeholder(const String16& text);
+  void text(const char16_t* text, size_t len, PseudoBuffer* out);
+  void placeholder(const char16_t* text, size_t len, PseudoBuffer* out);
 };
 
 class PseudoMethodAccent : public PseudoMethodImpl {
  public:
   PseudoMethodAccent() : mDepth(0), mWordCount(0), mLength(0) {}
-  String16 start();
-  String16 end();
-  String16 text(const String16& text);
-  String16 placeholder(const String16& text);
+  void start(PseudoBuffer* out);
+  void end(PseudoBuffer* out);
+  void text(const char16_t* text, size_t len, PseudoBuffer* out);
+  void placeholder(const char16_t* text, size_t len, PseudoBuffer* out);
  private:
   size_t mDepth;
   size_t mWordCount;
@@ -46,12 +54,16 @@ class Pseudolocalizer {
   Pseudolocalizer(PseudolocalizationMethod m);
   ~Pseudolocalizer() { if (mImpl) delete mImpl; }
   void setMethod(PseudolocalizationMethod m);
-  String16 start() { return mImpl->start(); }
-  String16 end() { return mImpl->end(); }
+  String16 start();
+  String16 end();
   String16 text(const String16& text);
  private:
+  // Returns what is in mBuffer, and empties it for the next call.
+  String16 takeBuffer();
+
   PseudoMethodImpl *mImpl;
   size_t mLastDepth;
+  PseudoBuffer mBuffer;
 };
 
 #endif // HOST_PSEUDOLOCALIZE_H
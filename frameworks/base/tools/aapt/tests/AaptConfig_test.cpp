@@ -76,3 +76,51 @@ TEST(AaptConfigTest, ParseQualifierAddedInApi13) {
     EXPECT_TRUE(TestParse("sw600dp-v8", &config));
     EXPECT_EQ(String8("sw600dp-v13"), config.toString());
 }
+
+TEST(AaptConfigTest, RepeatedParsesGiveTheSameResult) {
+    ConfigDescription first, second;
+    EXPECT_TRUE(TestParse("de-rAT-sw600dp-land", &first));
+    EXPECT_TRUE(TestParse("de-rAT-sw600dp-land", &second));
+    EXPECT_EQ(first, second);
+    EXPECT_EQ(String8("de-AT-sw600dp-land-v13"), second.toString());
+
+    // A remembered failure leaves the output alone.
+    ConfigDescription untouched(first);
+    EXPECT_FALSE(TestParse("land-de", &untouched));
+    EXPECT_FALSE(TestParse("land-de", &untouched));
+    EXPECT_EQ(first, untouched);
+}
+
+TEST(AaptConfigTest, PackedConfigEqualsLikeCompare) {
+    const char* qualifiers[] = {
+        "", "en", "en-rUS", "b+es+419", "b+sr+Latn", "b+de+POSIX", "fil", "mcc310",
+        "mcc310-mnc004", "ldrtl", "sw600dp", "w720dp", "land", "night",
+        "anydpi", "nodpi", "xxhdpi", "v21", "keyshidden", "large-long",
+    };
+    const size_t N = sizeof(qualifiers) / sizeof(qualifiers[0]);
+    ConfigDescription configs[N];
+    for (size_t i = 0; i < N; i++) {
+        ASSERT_TRUE(TestParse(qualifiers[i], &configs[i]));
+    }
+
+    for (size_t i = 0; i < N; i++) {
+        for (size_t j = 0; j < N; j++) {
+            EXPECT_EQ(configs[i].compare(configs[j]) == 0, configs[i] == configs[j])
+                    << qualifiers[i] << " vs " << qualifiers[j];
+        }
+    }
+}
+
+TEST(AaptConfigTest, PackedConfigComparesOnlyMaskedAxes) {
+    ConfigDescription frLand, frRcaLand;
+    ASSERT_TRUE(TestParse("fr-land", &frLand));
+    ASSERT_TRUE(TestParse("fr-rCA-land", &frRcaLand));
+
+    const PackedConfig a(frLand), b(frRcaLand);
+    EXPECT_FALSE(a.equalsWhere(b, PackedConfig::axisMask(
+            android::ResTable_config::CONFIG_LOCALE)));
+    EXPECT_TRUE(a.equalsWhere(b, PackedConfig::axisMask(
+            android::ResTable_config::CONFIG_ORIENTATION
+            | android::ResTable_config::CONFIG_VERSION)));
+    EXPECT_EQ((uint32_t) frLand.diff(frRcaLand), (uint32_t) android::ResTable_config::CONFIG_LOCALE);
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <utils/String16.h>
+#include <utils/String8.h>
+
+#include "AaptContext.h"
+#include "ResourceIdCache.h"
+#include "SourcePos.h"
+#include "WorkQueue.h"
+
+using android::AaptContext;
+using android::ResourceIdCache;
+using android::String16;
+using android::String8;
+using android::WorkQueue;
+
+TEST(AaptContextTest, KeepsRunsApart) {
+    AaptContext one;
+    AaptContext two;
+    {
+        AaptContext::Scope scope(&one);
+        SourcePos(String8("res/values/strings.xml"), 3).error("bad string");
+        ResourceIdCache::store(String16("app"), String16("string"), String16("name"), false,
+                0x7f010000);
+        EXPECT_EQ(AaptContext::current(), &one);
+        {
+            AaptContext::Scope inner(&two);
+            EXPECT_FALSE(SourcePos::hasErrors());
+            EXPECT_EQ(0u, ResourceIdCache::lookup(String16("app"), String16("string"),
+                    String16("name"), false));
+        }
+        EXPECT_TRUE(SourcePos::hasErrors());
+        EXPECT_EQ(0x7f010000u, ResourceIdCache::lookup(String16("app"), String16("string"),
+                String16("name"), false));
+        EXPECT_STREQ("res/values/strings.xml:3: error: bad string\n",
+                SourcePos::getDiagnostics().string());
+    }
+    EXPECT_EQ(AaptContext::current(), AaptContext::getDefault());
+}
+
+class ReportError : public WorkQueue::WorkUnit {
+public:
+    virtual bool run() {
+        SourcePos(String8("AndroidManifest.xml"), 1).error("from a work thread");
+        return true;
+    }
+};
+
+TEST(AaptContextTest, WorkRunsInSchedulersContext) {
+    WorkQueue queue(2);
+    AaptContext context;
+    {
+        AaptContext::Scope scope(&context);
+        WorkQueue::Group group(&queue);
+        for (int i = 0; i < 4; i++) {
+            ASSERT_EQ(android::OK, group.schedule(new ReportError()));
+        }
+        group.wait();
+        EXPECT_TRUE(SourcePos::hasErrors());
+    }
+
+    AaptContext other;
+    AaptContext::Scope scope(&other);
+    EXPECT_FALSE(SourcePos::hasErrors());
+}
+
+TEST(AaptContextTest, KeepsIgnorePattern) {
+    AaptContext context;
+    EXPECT_TRUE(context.getIgnoreAssets() == NULL);
+    context.setIgnoreAssets("!*.bak");
+    EXPECT_STREQ("!*.bak", context.getIgnoreAssets());
+    context.setIgnoreAssets(NULL);
+    EXPECT_TRUE(context.getIgnoreAssets() == NULL);
+}
+
+TEST(AaptContextTest, FailFastErrorCancelsRun) {
+    AaptContext context;
+    AaptContext::Scope scope(&context);
+    SourcePos(String8("res/values/strings.xml"), 3).warning("odd string");
+    EXPECT_FALSE(context.isCanceled());
+    SourcePos(String8("res/values/strings.xml"), 4).error("bad string");
+    EXPECT_FALSE(context.isCanceled());
+
+    context.setFailFast(true);
+    SourcePos::ErrorBuffer buffer;
+    buffer.begin();
+    SourcePos(String8("res/layout/main.xml"), 1).error("bad layout");
+    buffer.end();
+    EXPECT_TRUE(context.isCanceled());
+}
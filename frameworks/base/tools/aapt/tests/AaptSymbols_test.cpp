@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <utils/String8.h>
+#include <gtest/gtest.h>
+
+#include "AaptAssets.h"
+
+using android::sp;
+using android::String8;
+using android::String16;
+
+TEST(AaptSymbolsTest, KeepsTheOrderSymbolsWereAddedIn) {
+    sp<AaptSymbols> symbols = new AaptSymbols();
+    SourcePos pos;
+    symbols->addSymbol(String8("zebra"), 1, pos);
+    symbols->addSymbol(String8("apple"), 2, pos);
+    symbols->makeSymbolPublic(String8("zebra"), pos);
+
+    ASSERT_EQ(2u, symbols->getSymbols().size());
+    EXPECT_EQ(String8("zebra"), symbols->getSymbols().keyAt(0));
+    EXPECT_EQ(String8("apple"), symbols->getSymbols().keyAt(1));
+    EXPECT_TRUE(symbols->getSymbols().valueAt(0).isPublic);
+}
+
+TEST(AaptSymbolsTest, SortsNestedSymbolsByName) {
+    sp<AaptSymbols> symbols = new AaptSymbols();
+    SourcePos pos;
+    sp<AaptSymbols> strings = symbols->addNestedSymbol(String8("string"), pos);
+    sp<AaptSymbols> attrs = symbols->addNestedSymbol(String8("attr"), pos);
+    strings->addSymbol(String8("title"), 0x7f020001, pos);
+    strings->addSymbol(String8("app_name"), 0x7f020000, pos);
+    strings->appendComment(String8("title"), String16("The title."), pos);
+    attrs->addSymbol(String8("color"), 0x7f010000, pos);
+
+    symbols->sortByName();
+
+    const DefaultHashedKeyedVector<String8, sp<AaptSymbols> >& nested =
+            symbols->getNestedSymbols();
+    ASSERT_EQ(2u, nested.size());
+    EXPECT_EQ(String8("attr"), nested.keyAt(0));
+    EXPECT_EQ(String8("string"), nested.keyAt(1));
+    EXPECT_EQ(strings, nested.valueFor(String8("string")));
+
+    ASSERT_EQ(2u, strings->getSymbols().size());
+    EXPECT_EQ(String8("app_name"), strings->getSymbols().keyAt(0));
+    EXPECT_EQ(0x7f020000, strings->getSymbols().valueAt(0).int32Val);
+    EXPECT_EQ(String8("title"), strings->getSymbols().keyAt(1));
+    EXPECT_EQ(String16("The title."), strings->getComment(String8("title")));
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Bundle.h"
+#include "Checkpoint.h"
+#include "ZipFile.h"
+
+using android::ZipEntry;
+using android::ZipFile;
+
+static std::string makeTempDir() {
+    char path[] = "/tmp/aapt-checkpoint-XXXXXX";
+    return mkdtemp(path) != NULL ? std::string(path) : std::string();
+}
+
+static std::string readFile(const std::string& path) {
+    std::string contents;
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp == NULL) {
+        return contents;
+    }
+    char buf[256];
+    size_t amt;
+    while ((amt = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        contents.append(buf, amt);
+    }
+    fclose(fp);
+    return contents;
+}
+
+TEST(CheckpointTest, RestoresTheOutputsAskedFor) {
+    const std::string dir = makeTempDir();
+    ASSERT_FALSE(dir.empty());
+    const std::string path = dir + "/run.checkpoint";
+
+    Checkpoint checkpoint;
+    checkpoint.addOutput("java/com/example/R.java", "class R {}\n", 11);
+    checkpoint.addOutput("R.txt", "int id a 0x7f010000\n", 20);
+    checkpoint.addOutput("proguard.txt", "-keep class A\n\n", 15);
+    ASSERT_EQ(android::NO_ERROR, checkpoint.write(path.c_str(), NULL));
+
+    const std::string gen = dir + "/gen";
+    const std::string symbols = dir + "/symbols";
+    const std::string rules = dir + "/rules.txt";
+    ASSERT_EQ(0, mkdir(symbols.c_str(), 0700));
+
+    Bundle bundle;
+    bundle.setFromCheckpoint(path.c_str());
+    bundle.setRClassDir(gen.c_str());
+    bundle.setOutputTextSymbols(symbols.c_str());
+    bundle.setProguardFile(rules.c_str());
+    ASSERT_EQ(0, Checkpoint::restore(&bundle));
+
+    EXPECT_EQ("class R {}\n", readFile(gen + "/com/example/R.java"));
+    EXPECT_EQ("int id a 0x7f010000\n", readFile(symbols + "/R.txt"));
+    EXPECT_EQ("-keep class A\n\n", readFile(rules));
+}
+
+TEST(CheckpointTest, KeepsTheEntriesOfThePackage) {
+    const std::string dir = makeTempDir();
+    ASSERT_FALSE(dir.empty());
+    const std::string apk = dir + "/app.apk";
+    const std::string path = dir + "/run.checkpoint";
+    const std::string restored = dir + "/restored.apk";
+
+    {
+        ZipFile zip;
+        ASSERT_EQ(android::NO_ERROR, zip.open(apk.c_str(),
+                ZipFile::kOpenReadWrite | ZipFile::kOpenTruncate));
+        ASSERT_EQ(android::NO_ERROR, zip.add("manifest", 8, "AndroidManifest.xml",
+                ZipEntry::kCompressStored, NULL));
+        ASSERT_EQ(android::NO_ERROR, zip.flush());
+    }
+
+    Checkpoint checkpoint;
+    ASSERT_EQ(android::NO_ERROR, checkpoint.write(path.c_str(), apk.c_str()));
+
+    Bundle bundle;
+    bundle.setFromCheckpoint(path.c_str());
+    bundle.setOutputAPKFile(restored.c_str());
+    ASSERT_EQ(0, Checkpoint::restore(&bundle));
+
+    ZipFile zip;
+    ASSERT_EQ(android::NO_ERROR, zip.open(restored.c_str(), ZipFile::kOpenReadOnly));
+    ASSERT_EQ(1, zip.getNumEntries());
+    EXPECT_STREQ("AndroidManifest.xml", zip.getEntryByIndex(0)->getFileName());
+}
+
+TEST(CheckpointTest, FailsForOutputsTheRunDidNotKeep) {
+    const std::string dir = makeTempDir();
+    ASSERT_FALSE(dir.empty());
+    const std::string path = dir + "/run.checkpoint";
+
+    Checkpoint checkpoint;
+    ASSERT_EQ(android::NO_ERROR, checkpoint.write(path.c_str(), NULL));
+
+    const std::string rules = dir + "/rules.txt";
+    Bundle bundle;
+    bundle.setFromCheckpoint(path.c_str());
+    bundle.setProguardFile(rules.c_str());
+    EXPECT_NE(0, Checkpoint::restore(&bundle));
+
+    Bundle apkBundle;
+    const std::string restored = dir + "/restored.apk";
+    apkBundle.setFromCheckpoint(path.c_str());
+    apkBundle.setOutputAPKFile(restored.c_str());
+    EXPECT_NE(0, Checkpoint::restore(&apkBundle));
+}
+
+TEST(CheckpointTest, RejectsFilesThatAreNotCheckpoints) {
+    const std::string dir = makeTempDir();
+    ASSERT_FALSE(dir.empty());
+    const std::string path = dir + "/other.zip";
+    {
+        ZipFile zip;
+        ASSERT_EQ(android::NO_ERROR, zip.open(path.c_str(),
+                ZipFile::kOpenReadWrite | ZipFile::kOpenTruncate));
+        ASSERT_EQ(android::NO_ERROR, zip.add("x", 1, "x", ZipEntry::kCompressStored, NULL));
+        ASSERT_EQ(android::NO_ERROR, zip.flush());
+    }
+
+    Bundle bundle;
+    bundle.setFromCheckpoint(path.c_str());
+    EXPECT_NE(0, Checkpoint::restore(&bundle));
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <string.h>
+#include <utils/String8.h>
+
+#include "DaemonStats.h"
+#include "Statistics.h"
+
+using android::String8;
+
+static String8 printed(const DaemonStats& stats) {
+    String8 text;
+    FILE* fp = tmpfile();
+    if (fp == NULL) {
+        return text;
+    }
+    stats.print(fp);
+    rewind(fp);
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        text.append(buf, n);
+    }
+    fclose(fp);
+    return text;
+}
+
+TEST(DaemonStatsTest, BucketsLatenciesByPowersOfTwoMs) {
+    const nsecs_t ms = 1000000;
+    EXPECT_EQ(0U, DaemonStats::latencyBucket(0));
+    EXPECT_EQ(0U, DaemonStats::latencyBucket(ms - 1));
+    EXPECT_EQ(1U, DaemonStats::latencyBucket(ms));
+    EXPECT_EQ(2U, DaemonStats::latencyBucket(2 * ms));
+    EXPECT_EQ(2U, DaemonStats::latencyBucket(3 * ms));
+    EXPECT_EQ(11U, DaemonStats::latencyBucket(1500 * ms));
+    EXPECT_EQ(DaemonStats::NUM_BUCKETS - 1, DaemonStats::latencyBucket(3600 * 1000 * ms));
+}
+
+TEST(DaemonStatsTest, CountsRequestsAndCachesUntilReset) {
+    DaemonStats stats;
+    stats.beginRequest();
+    Statistics::add(Statistics::COMPILE_CACHE_HITS, 3);
+    Statistics::add(Statistics::COMPILE_CACHE_MISSES);
+    stats.addSnapshotLookup(false);
+    stats.endRequest(DaemonStats::RUN, false);
+
+    stats.beginRequest();
+    // Counted again from zero for each request.
+    Statistics::add(Statistics::COMPILE_CACHE_HITS);
+    stats.addSnapshotLookup(true);
+    stats.endRequest(DaemonStats::RUN, true);
+
+    stats.beginRequest();
+    stats.endRequest(DaemonStats::SINGLE_CRUNCH, false);
+
+    String8 report = printed(stats);
+    EXPECT_TRUE(strstr(report.string(), "Requests r 2 1 ") != NULL) << report.string();
+    EXPECT_TRUE(strstr(report.string(), "Requests s 1 0 ") != NULL) << report.string();
+    EXPECT_TRUE(strstr(report.string(), "Requests b 0 0 ") != NULL) << report.string();
+    EXPECT_TRUE(strstr(report.string(), "Cache compile 4 1 80.0\n") != NULL)
+            << report.string();
+    EXPECT_TRUE(strstr(report.string(), "Cache framework 1 1 50.0\n") != NULL)
+            << report.string();
+    EXPECT_TRUE(strstr(report.string(), "\nMemory ") != NULL);
+    EXPECT_TRUE(strstr(report.string(), "\nThreads ") != NULL);
+
+    stats.reset();
+    report = printed(stats);
+    EXPECT_TRUE(strstr(report.string(), "Requests r 0 0 ") != NULL) << report.string();
+    EXPECT_TRUE(strstr(report.string(), "Cache compile 0 0 0.0\n") != NULL)
+            << report.string();
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <androidfw/ResourceTypes.h>
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <utils/String8.h>
+
+#include "FileCosts.h"
+
+using android::String8;
+
+static String8 readFile(const char* path) {
+    String8 text;
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        return text;
+    }
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        text.append(buf, n);
+    }
+    fclose(fp);
+    return text;
+}
+
+TEST(FileCostsTest, CountsStringsOfCompiledXml) {
+    struct {
+        android::ResXMLTree_header tree;
+        android::ResStringPool_header pool;
+    } xml;
+    memset(&xml, 0, sizeof(xml));
+    xml.tree.header.type = htods(android::RES_XML_TYPE);
+    xml.tree.header.headerSize = htods(sizeof(xml.tree));
+    xml.tree.header.size = htodl(sizeof(xml));
+    xml.pool.header.type = htods(android::RES_STRING_POOL_TYPE);
+    xml.pool.stringCount = htodl(7);
+
+    EXPECT_EQ(7, FileCosts::countXmlStrings(&xml, sizeof(xml)));
+    EXPECT_EQ(-1, FileCosts::countXmlStrings(&xml, sizeof(xml.tree)));
+    xml.tree.header.type = htods(android::RES_TABLE_TYPE);
+    EXPECT_EQ(-1, FileCosts::countXmlStrings(&xml, sizeof(xml)));
+}
+
+TEST(FileCostsTest, ListsLargestFilesOfEachStage) {
+    FileCosts::enable(2);
+    const char* const files[] = { "res/values/a.xml", "res/values/b.xml", "res/values/c.xml" };
+    const size_t sizes[] = { 100, 300, 200 };
+    for (int i = 0; i < 3; i++) {
+        FileCostSpan span(FileCosts::PARSE, String8(files[i]));
+        span.setInputBytes(sizes[i]);
+    }
+    {
+        // Summed with the first span of the file.
+        FileCostSpan span(FileCosts::PARSE, String8(files[0]));
+        span.setInputBytes(250);
+    }
+    {
+        FileCostSpan span(FileCosts::CRUNCH, String8("res/drawable/icon.png"));
+        span.cancel();
+    }
+
+    char path[] = "/tmp/aapt_filecosts_test_XXXXXX";
+    const int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    ASSERT_EQ(android::NO_ERROR, FileCosts::write(path));
+    const String8 report = readFile(path);
+    unlink(path);
+
+    const char* parse = strstr(report.string(), "\"stage\":\"parse\",\"files\":3");
+    ASSERT_TRUE(parse != NULL) << report.string();
+    const char* largest = strstr(parse, "\"largest\"");
+    ASSERT_TRUE(largest != NULL);
+    const char* a = strstr(largest, files[0]);
+    const char* b = strstr(largest, files[1]);
+    ASSERT_TRUE(a != NULL && b != NULL);
+    EXPECT_LT(a, b);
+    EXPECT_TRUE(strstr(a, "\"runs\":2,\"input_bytes\":350") != NULL);
+    // Only the top two are listed, and canceled spans aren't.
+    const char* next = strstr(largest, "\"stage\"");
+    ASSERT_TRUE(next != NULL);
+    const char* c = strstr(largest, files[2]);
+    EXPECT_TRUE(c == NULL || c > next);
+    EXPECT_TRUE(strstr(report.string(), "\"stage\":\"crunch\",\"files\":0") != NULL);
+}
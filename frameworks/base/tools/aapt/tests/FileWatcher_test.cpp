@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ftw.h>
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+#include "FileWatcher.h"
+
+using android::FileWatcher;
+using android::String8;
+using android::Vector;
+
+#if defined(__linux__)
+
+static String8 makeTempDir() {
+    const char* dir = getenv("TMPDIR");
+    String8 path(dir != NULL ? dir : "/tmp");
+    path.appendPath("aapt_filewatcher_test_XXXXXX");
+    char* made = mkdtemp(path.lockBuffer(path.size()));
+    path.unlockBuffer();
+    return made != NULL ? path : String8();
+}
+
+static void writeFile(const String8& path, const char* contents) {
+    FILE* fp = fopen(path.string(), "w");
+    ASSERT_TRUE(fp != NULL);
+    fputs(contents, fp);
+    fclose(fp);
+}
+
+static int removeEntry(const char* path, const struct stat*, int, struct FTW*) {
+    return remove(path);
+}
+
+static void removeTree(const String8& path) {
+    nftw(path.string(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+TEST(FileWatcherTest, ReportsChangedFilesOnce) {
+    const String8 root = makeTempDir();
+    ASSERT_FALSE(root.isEmpty());
+    const String8 values = root.appendPathCopy("values");
+    ASSERT_EQ(0, mkdir(values.string(), 0755));
+
+    FileWatcher watcher;
+    ASSERT_EQ(android::NO_ERROR, watcher.addPath(root));
+    writeFile(values.appendPathCopy("strings.xml"), "<resources/>");
+    writeFile(values.appendPathCopy("strings.xml"), "<resources></resources>");
+    writeFile(values.appendPathCopy(".strings.xml.swp"), "x");
+
+    Vector<String8> changed;
+    ASSERT_TRUE(watcher.wait(-1, 10, &changed));
+    ASSERT_EQ(1u, changed.size());
+    EXPECT_EQ(values.appendPathCopy("strings.xml"), changed[0]);
+    removeTree(root);
+}
+
+TEST(FileWatcherTest, WatchesNewDirectories) {
+    const String8 root = makeTempDir();
+    ASSERT_FALSE(root.isEmpty());
+    FileWatcher watcher;
+    ASSERT_EQ(android::NO_ERROR, watcher.addPath(root));
+
+    const String8 layout = root.appendPathCopy("layout");
+    ASSERT_EQ(0, mkdir(layout.string(), 0755));
+    Vector<String8> changed;
+    ASSERT_TRUE(watcher.wait(-1, 10, &changed));
+    ASSERT_EQ(1u, changed.size());
+    EXPECT_EQ(layout, changed[0]);
+
+    changed.clear();
+    writeFile(layout.appendPathCopy("main.xml"), "<LinearLayout/>");
+    ASSERT_TRUE(watcher.wait(-1, 10, &changed));
+    ASSERT_EQ(1u, changed.size());
+    EXPECT_EQ(layout.appendPathCopy("main.xml"), changed[0]);
+    removeTree(root);
+}
+
+TEST(FileWatcherTest, WatchesOnlyTheGivenFile) {
+    const String8 root = makeTempDir();
+    ASSERT_FALSE(root.isEmpty());
+    const String8 manifest = root.appendPathCopy("AndroidManifest.xml");
+    writeFile(manifest, "<manifest/>");
+    FileWatcher watcher;
+    ASSERT_EQ(android::NO_ERROR, watcher.addPath(manifest));
+
+    writeFile(root.appendPathCopy("build.xml"), "<project/>");
+    writeFile(manifest, "<manifest></manifest>");
+    Vector<String8> changed;
+    ASSERT_TRUE(watcher.wait(-1, 10, &changed));
+    ASSERT_EQ(1u, changed.size());
+    EXPECT_EQ(manifest, changed[0]);
+    removeTree(root);
+}
+
+TEST(FileWatcherTest, StopsWhenTheFdIsReadable) {
+    const String8 root = makeTempDir();
+    ASSERT_FALSE(root.isEmpty());
+    FileWatcher watcher;
+    ASSERT_EQ(android::NO_ERROR, watcher.addPath(root));
+
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    ASSERT_EQ(1, write(fds[1], "\n", 1));
+    Vector<String8> changed;
+    EXPECT_FALSE(watcher.wait(fds[0], 10, &changed));
+    EXPECT_TRUE(changed.isEmpty());
+    close(fds[0]);
+    close(fds[1]);
+    removeTree(root);
+}
+
+#endif
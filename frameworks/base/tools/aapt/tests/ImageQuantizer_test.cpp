@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <set>
+#include <string.h>
+#include <vector>
+
+#include "ImageQuantizer.h"
+
+// A width x height RGBA image with its rows.
+struct TestImage {
+    TestImage(size_t width, size_t height)
+        : width(width), height(height), pixels(4 * width * height), rows(height) {
+        for (size_t y = 0; y < height; y++) {
+            rows[y] = &pixels[4 * width * y];
+        }
+    }
+
+    uint8_t* at(size_t x, size_t y) { return rows[y] + 4 * x; }
+
+    size_t countColors() const {
+        std::set<uint32_t> colors;
+        for (size_t i = 0; i < pixels.size(); i += 4) {
+            uint32_t color;
+            memcpy(&color, &pixels[i], 4);
+            colors.insert(color);
+        }
+        return colors.size();
+    }
+
+    size_t width;
+    size_t height;
+    std::vector<uint8_t> pixels;
+    std::vector<uint8_t*> rows;
+};
+
+// A smooth gradient: far more than 256 colors, each close to the next.
+static void fillGradient(TestImage* image) {
+    for (size_t y = 0; y < image->height; y++) {
+        for (size_t x = 0; x < image->width; x++) {
+            uint8_t* p = image->at(x, y);
+            p[0] = (uint8_t) (x * 255 / (image->width - 1));
+            p[1] = (uint8_t) (y * 255 / (image->height - 1));
+            p[2] = (uint8_t) ((x + y) * 127 / (image->width + image->height - 2));
+            p[3] = 0xff;
+        }
+    }
+}
+
+TEST(ImageQuantizerTest, QualityMapsToAllowedError) {
+    EXPECT_EQ(0.0, quantizeQualityToMse(100));
+    EXPECT_DOUBLE_EQ(1.6 * 1.6, quantizeQualityToMse(90));
+    EXPECT_LT(quantizeQualityToMse(80), quantizeQualityToMse(50));
+    EXPECT_EQ(255.0 * 255.0, quantizeQualityToMse(0));
+}
+
+TEST(ImageQuantizerTest, LeavesImagesWithFewColorsAlone) {
+    TestImage image(16, 16);
+    for (size_t i = 0; i < image.pixels.size(); i += 4) {
+        image.pixels[i] = (uint8_t) (i / 4);
+        image.pixels[i + 3] = 0xff;
+    }
+    const std::vector<uint8_t> before = image.pixels;
+
+    double mse = -1;
+    EXPECT_FALSE(quantizeRgbaImage(&image.rows[0], image.width, image.height, 256, 1e9, &mse));
+    EXPECT_EQ(0.0, mse);
+    EXPECT_TRUE(before == image.pixels);
+}
+
+TEST(ImageQuantizerTest, ReducesGradientToPalette) {
+    TestImage image(64, 64);
+    fillGradient(&image);
+    ASSERT_GT(image.countColors(), 256U);
+
+    double mse = -1;
+    ASSERT_TRUE(quantizeRgbaImage(&image.rows[0], image.width, image.height, 256,
+                                  quantizeQualityToMse(70), &mse));
+    EXPECT_GT(mse, 0.0);
+    EXPECT_LE(mse, quantizeQualityToMse(70));
+    EXPECT_LE(image.countColors(), 256U);
+
+    // Dithering keeps each neighbourhood near the color it had.
+    TestImage original(64, 64);
+    fillGradient(&original);
+    for (size_t y = 0; y + 4 <= image.height; y += 4) {
+        for (size_t x = 0; x + 4 <= image.width; x += 4) {
+            for (int c = 0; c < 3; c++) {
+                int sum = 0, originalSum = 0;
+                for (size_t dy = 0; dy < 4; dy++) {
+                    for (size_t dx = 0; dx < 4; dx++) {
+                        sum += image.at(x + dx, y + dy)[c];
+                        originalSum += original.at(x + dx, y + dy)[c];
+                    }
+                }
+                EXPECT_NEAR(originalSum / 16.0, sum / 16.0, 8.0) << x << "," << y;
+            }
+        }
+    }
+}
+
+TEST(ImageQuantizerTest, RefusesWhenErrorIsTooLarge) {
+    TestImage image(64, 64);
+    fillGradient(&image);
+    const std::vector<uint8_t> before = image.pixels;
+
+    double mse = -1;
+    EXPECT_FALSE(quantizeRgbaImage(&image.rows[0], image.width, image.height, 4,
+                                   quantizeQualityToMse(95), &mse));
+    EXPECT_GT(mse, quantizeQualityToMse(95));
+    EXPECT_TRUE(before == image.pixels);
+}
+
+TEST(ImageQuantizerTest, KeepsTransparentPixelsTransparent) {
+    TestImage image(64, 64);
+    fillGradient(&image);
+    for (size_t y = 0; y < image.height; y++) {
+        for (size_t x = 0; x < image.width / 2; x++) {
+            image.at(x, y)[3] = 0;
+        }
+        image.at(image.width - 1, y)[3] = 0x80;
+    }
+
+    double mse;
+    ASSERT_TRUE(quantizeRgbaImage(&image.rows[0], image.width, image.height, 16,
+                                  quantizeQualityToMse(0), &mse));
+    EXPECT_LE(image.countColors(), 16U);
+    for (size_t y = 0; y < image.height; y++) {
+        for (size_t x = 0; x < image.width; x++) {
+            const uint8_t* p = image.at(x, y);
+            if (x < image.width / 2) {
+                EXPECT_EQ(0, p[0] | p[1] | p[2] | p[3]) << x << "," << y;
+            } else {
+                EXPECT_NE(0, p[3]) << x << "," << y;
+            }
+        }
+    }
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ImageScan.h"
+
+static void expectSameScan(const uint8_t* pixels, size_t count) {
+    int scalarDeviation = 0, deviation = 0;
+    bool scalarOpaque = true, opaque = true;
+    scanRgbaPixelsScalar(pixels, count, &scalarDeviation, &scalarOpaque);
+    scanRgbaPixels(pixels, count, &deviation, &opaque);
+    EXPECT_EQ(scalarDeviation, deviation) << count << " pixels";
+    EXPECT_EQ(scalarOpaque, opaque) << count << " pixels";
+}
+
+TEST(ImageScanTest, GrayOpaquePixels) {
+    uint8_t pixels[4 * 37];
+    for (size_t i = 0; i < sizeof(pixels); i += 4) {
+        pixels[i] = pixels[i + 1] = pixels[i + 2] = (uint8_t) i;
+        pixels[i + 3] = 0xff;
+    }
+
+    int deviation = 0;
+    bool opaque = true;
+    scanRgbaPixels(pixels, 37, &deviation, &opaque);
+    EXPECT_EQ(0, deviation);
+    EXPECT_TRUE(opaque);
+}
+
+TEST(ImageScanTest, FindsLargestDeviationAndAlphaAnywhere) {
+    // A single odd pixel at every position, including the scalar tails
+    // left over after each vector width.
+    const size_t kCount = 67;
+    uint8_t pixels[4 * kCount];
+    for (size_t odd = 0; odd < kCount; odd++) {
+        memset(pixels, 0xff, sizeof(pixels));
+        uint8_t* p = pixels + 4 * odd;
+        p[0] = 10;
+        p[1] = 200;
+        p[2] = 90;
+        p[3] = 0xfe;
+
+        int deviation = 3;
+        bool opaque = true;
+        scanRgbaPixels(pixels, kCount, &deviation, &opaque);
+        EXPECT_EQ(190, deviation) << "odd pixel " << odd;
+        EXPECT_FALSE(opaque) << "odd pixel " << odd;
+    }
+}
+
+TEST(ImageScanTest, MatchesScalarVersion) {
+    srand(1);
+    uint8_t pixels[4 * 100];
+    for (int round = 0; round < 200; round++) {
+        // Mostly nearly gray, so that the deviations stay small.
+        for (size_t i = 0; i < sizeof(pixels); i += 4) {
+            uint8_t base = rand();
+            pixels[i] = base + rand() % 3;
+            pixels[i + 1] = base + rand() % 5;
+            pixels[i + 2] = base;
+            pixels[i + 3] = (rand() % 50 == 0) ? rand() : 0xff;
+        }
+        for (size_t count = 0; count <= 100; count += 1 + round % 7) {
+            expectSameScan(pixels, count);
+        }
+    }
+}
+
+TEST(ImageScanTest, ClassifiesFramePixels) {
+    // none/other pairs for each kind of frame, then a tick, a layout
+    // bounds tick and their translucent versions.
+    const uint8_t pixels[] = {
+        0xff, 0xff, 0xff, 0xff,   0x12, 0x34, 0x56, 0x00,
+        0x00, 0x00, 0x00, 0xff,   0xff, 0x00, 0x00, 0xff,
+        0x00, 0x00, 0x00, 0x80,   0xff, 0x00, 0x00, 0x80,
+        0x00, 0x00, 0xff, 0xff,
+    };
+    const size_t kCount = sizeof(pixels) / 4;
+    const uint8_t kTransparent[kCount] = { kFramePixelOther, kFramePixelNone,
+            kFramePixelTick, kFramePixelLayoutBounds, kFramePixelOther, kFramePixelOther,
+            kFramePixelOther };
+    const uint8_t kWhite[kCount] = { kFramePixelNone, kFramePixelOther,
+            kFramePixelTick, kFramePixelLayoutBounds, kFramePixelOther, kFramePixelOther,
+            kFramePixelOther };
+
+    uint8_t types[kCount];
+    classifyFramePixels(pixels, kCount, true, types);
+    EXPECT_EQ(0, memcmp(kTransparent, types, kCount));
+    classifyFramePixels(pixels, kCount, false, types);
+    EXPECT_EQ(0, memcmp(kWhite, types, kCount));
+}
+
+TEST(ImageScanTest, ClassifyFramePixelsMatchesScalarVersion) {
+    srand(2);
+    const uint32_t kColors[] = { 0xffffffff, 0xff000000, 0xff0000ff, 0x00000000,
+            0x00123456, 0x80000000 };
+    uint8_t pixels[4 * 50];
+    for (int round = 0; round < 100; round++) {
+        for (size_t i = 0; i < sizeof(pixels); i += 4) {
+            uint32_t color = kColors[rand() % 6];
+            memcpy(pixels + i, &color, 4);
+        }
+        for (size_t count = 0; count <= 50; count++) {
+            uint8_t scalarTypes[50], types[50];
+            classifyFramePixelsScalar(pixels, count, round & 1, scalarTypes);
+            classifyFramePixels(pixels, count, round & 1, types);
+            EXPECT_EQ(0, memcmp(scalarTypes, types, count)) << count << " pixels";
+        }
+    }
+}
+
+TEST(ImageScanTest, FindsFirstUnmatchedPixelAnywhere) {
+    const size_t kCount = 37;
+    uint8_t pixels[4 * kCount];
+    memset(pixels, 0x40, sizeof(pixels));
+    EXPECT_EQ(kCount, findUnmatchedPixel(pixels, kCount, 0x40404040, 0xffffffff));
+
+    for (size_t odd = 0; odd < kCount; odd++) {
+        memset(pixels, 0x40, sizeof(pixels));
+        pixels[4 * odd + 1] = 0x41;
+        EXPECT_EQ(odd, findUnmatchedPixel(pixels, kCount, 0x40404040, 0xffffffff));
+        // Only the alpha is compared under an alpha mask.
+        EXPECT_EQ(kCount, findUnmatchedPixel(pixels, kCount, 0x40000000, 0xff000000));
+        pixels[4 * kCount - 1] = 0;
+        EXPECT_EQ(odd, findUnmatchedPixel(pixels, kCount, 0x40404040, 0xffffffff));
+        EXPECT_EQ(kCount - 1, findUnmatchedPixel(pixels, kCount, 0x40000000, 0xff000000));
+    }
+}
+
+TEST(ImageScanTest, PaletteKeepsFirstSeenOrder) {
+    RgbaPalette palette;
+    EXPECT_EQ(0, palette.indexOf(0x000000ff));
+    EXPECT_EQ(1, palette.indexOf(0x00000000));
+    EXPECT_EQ(0, palette.indexOf(0x000000ff));
+    EXPECT_EQ(2, palette.indexOf(0x12345678));
+    EXPECT_EQ(1, palette.indexOf(0x00000000));
+    ASSERT_EQ(3u, palette.size());
+    EXPECT_EQ(0x12345678u, palette.colorAt(2));
+}
+
+TEST(ImageScanTest, PaletteHoldsAtMost256Colors) {
+    RgbaPalette palette;
+    for (uint32_t i = 0; i < 256; i++) {
+        ASSERT_EQ((int) i, palette.indexOf(i << 8));
+    }
+    EXPECT_EQ(-1, palette.indexOf(0xffffffff));
+    EXPECT_EQ(255, palette.indexOf(255 << 8));
+    EXPECT_EQ(256u, palette.size());
+}
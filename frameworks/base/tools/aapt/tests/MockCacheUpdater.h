@@ -27,8 +27,27 @@ public:
     };
 
     // Process an image from source out to dest
-    virtual void processImage(String8 source, String8 dest) {
+    virtual bool processImage(String8 source, String8 dest) {
         processCount++;
+        return true;
+    };
+
+    // No contents to hash, so the cache falls back to mod-times
+    virtual bool hashFile(String8 path, String8* digest) {
+        return false;
+    };
+
+    virtual String8 getSettingsKey() {
+        return String8("mock");
+    };
+
+    // The manifest never exists
+    virtual bool readFile(String8 path, String8* contents) {
+        return false;
+    };
+
+    virtual bool writeFile(String8 path, const String8& contents) {
+        return true;
     };
 
     // DATA MEMBERS
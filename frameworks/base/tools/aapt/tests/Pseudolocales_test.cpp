@@ -130,6 +130,9 @@ TEST(Pseudolocales, Escaping) {
   // Multi-fragment messages
   compound_helper("'{USER}", " ", "''is offline",
                   "['{ÛŠÉŔ} ''îš öƒƒļîñé one two three]", PSEUDO_ACCENTED);
+
+  // A unicode escape cut short by the end of the text stops there.
+  simple_helper("\\u12", "[\\u12]", PSEUDO_ACCENTED);
 }
 
 TEST(Pseudolocales, PluralsAndSelects) {
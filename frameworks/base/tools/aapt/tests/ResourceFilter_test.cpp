@@ -198,3 +198,20 @@ TEST(StrongResourceFilterTest, MatchOnlyMdpiAndExcludeAllOthers) {
     expectedConfig.version = 4;
     ASSERT_TRUE(filter.match(expectedConfig));
 }
+
+TEST(StrongResourceFilterTest, MatchesEachOfManyConfigs) {
+    std::set<ConfigDescription> configs;
+    ConfigDescription config;
+    for (int density = 100; density < 700; density += 20) {
+        config.density = density;
+        configs.insert(config);
+    }
+
+    StrongResourceFilter filter(configs);
+
+    for (int density = 90; density < 710; density += 10) {
+        config.density = density;
+        EXPECT_EQ(density % 20 == 0 && density >= 100 && density < 700, filter.match(config))
+                << "density " << density;
+    }
+}
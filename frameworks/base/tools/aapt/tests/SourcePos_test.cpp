@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <utils/String8.h>
+
+#include "SourcePos.h"
+
+using android::String8;
+
+TEST(FilePosTest, KeepsFileAndLine) {
+    FilePos a(SourcePos(String8("res/values/strings.xml"), 12));
+    FilePos b(SourcePos(String8("res/values/colors.xml"), 3));
+    FilePos c(SourcePos(String8("res/values/strings.xml"), 40));
+
+    EXPECT_EQ(String8("res/values/strings.xml"), a.file());
+    EXPECT_EQ(12, a.line());
+    EXPECT_EQ(String8("res/values/colors.xml"), b.file());
+    EXPECT_EQ(3, b.line());
+    EXPECT_EQ(String8("res/values/strings.xml"), c.file());
+    EXPECT_EQ(40, c.line());
+
+    const SourcePos pos(c);
+    EXPECT_EQ(String8("res/values/strings.xml"), pos.file);
+    EXPECT_EQ(40, pos.line);
+}
+
+TEST(FilePosTest, DefaultMatchesSourcePos) {
+    FilePos none;
+    const SourcePos pos;
+    EXPECT_EQ(pos.file, none.file());
+    EXPECT_EQ(pos.line, none.line());
+    EXPECT_EQ(pos.file, FilePos(pos).file());
+}
+
+TEST(FilePosTest, IsSmall) {
+    EXPECT_EQ(8u, sizeof(FilePos));
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <string.h>
+#include <utils/String16.h>
+#include <utils/String8.h>
+
+#include "StringAtoms.h"
+
+using android::String16;
+using android::String8;
+
+TEST(StringAtomsTest, EqualStringsShareOneAtom) {
+    const String16& a = StringAtoms::intern("layout_width");
+    const String16& b = StringAtoms::intern(String16("layout_width"));
+    const String16 str("layout_width");
+    const String16& c = StringAtoms::intern(str.string(), str.size());
+
+    EXPECT_EQ(&a, &b);
+    EXPECT_EQ(&a, &c);
+    EXPECT_EQ(a.string(), String16(b).string());
+    EXPECT_EQ(String16("layout_width"), a);
+}
+
+TEST(StringAtomsTest, DifferentStringsGetDifferentAtoms) {
+    const String16& a = StringAtoms::intern("drawable");
+    const String16& b = StringAtoms::intern("drawables");
+    const String16& c = StringAtoms::intern("drawable", 4);
+
+    EXPECT_NE(&a, &b);
+    EXPECT_NE(&a, &c);
+    EXPECT_EQ(String16("draw"), c);
+    EXPECT_EQ(String16(), StringAtoms::intern(""));
+}
+
+TEST(StringAtomsTest, ConvertsLongAndNonAsciiNames) {
+    String8 longName;
+    for (int i = 0; i < 50; i++) {
+        longName.append("abcde");
+    }
+    const String16& a = StringAtoms::intern(longName.string());
+    EXPECT_EQ(String16(longName), a);
+    EXPECT_EQ(&a, &StringAtoms::intern(String16(longName)));
+
+    const char* accented = "caf\xc3\xa9";
+    const String16& b = StringAtoms::intern(accented);
+    EXPECT_EQ(String16(accented), b);
+    EXPECT_EQ(4u, b.size());
+    EXPECT_EQ(&b, &StringAtoms::intern(accented, strlen(accented)));
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <androidfw/ResourceTypes.h>
+#include <gtest/gtest.h>
+#include <utils/String16.h>
+#include <utils/String8.h>
+
+#include "AaptConfig.h"
+#include "StringPool.h"
+
+using android::ResTable_config;
+using android::String16;
+using android::String8;
+
+static ResTable_config makeConfig(const char* str) {
+    ConfigDescription config;
+    EXPECT_TRUE(AaptConfig::parse(String8(str), &config));
+    return config;
+}
+
+TEST(StringPoolTest, SortsByTypeThenConfig) {
+    const String8 array("array");
+    const String8 string("string");
+    const ResTable_config en = makeConfig("en");
+    const ResTable_config fr = makeConfig("fr");
+
+    StringPool pool;
+    const size_t zulu = pool.add(String16("zulu"), false, &string, &fr);
+    Vector<StringPool::entry_style_span> spans;
+    StringPool::entry_style_span span;
+    span.name = String16("b");
+    span.span.firstChar = 0;
+    span.span.lastChar = 2;
+    spans.add(span);
+    const size_t styled = pool.add(String16("styled"), spans, &string, &fr);
+    const size_t yankee = pool.add(String16("yankee"), false, &string, &en);
+    const size_t xray = pool.add(String16("xray"), false, &array, &fr);
+    pool.sortByConfig();
+
+    EXPECT_EQ(0u, pool.mapOriginalPosToNewPos(styled));
+    EXPECT_EQ(1u, pool.mapOriginalPosToNewPos(xray));
+    EXPECT_EQ(2u, pool.mapOriginalPosToNewPos(yankee));
+    EXPECT_EQ(3u, pool.mapOriginalPosToNewPos(zulu));
+}
+
+TEST(StringPoolTest, LogicallyEqualConfigsSortTogether) {
+    const String8 string("string");
+    const ResTable_config qwerty = makeConfig("en-qwerty");
+    const ResTable_config en = makeConfig("en");
+    const ResTable_config de = makeConfig("de");
+
+    // The keyboard isn't part of the logical order, so "one" and "three"
+    // compare equal although their configurations differ.
+    StringPool pool;
+    const size_t one = pool.add(String16("one"), false, &string, &qwerty);
+    const size_t two = pool.add(String16("two"), false, &string, &de);
+    const size_t three = pool.add(String16("three"), false, &string, &en);
+    pool.sortByConfig();
+
+    EXPECT_EQ(0u, pool.mapOriginalPosToNewPos(two));
+    EXPECT_NE(0u, pool.mapOriginalPosToNewPos(one));
+    EXPECT_NE(0u, pool.mapOriginalPosToNewPos(three));
+}
+
+TEST(StringPoolTest, UTF8PoolKeepsStringsInUTF8) {
+    const char16_t kSmiley[] = { 'h', 'i', ' ', 0xD83D, 0xDE00, 0 };
+    const char16_t kNul[] = { 'a', 0, 'b' };
+
+    StringPool pool(true);
+    const size_t smiley = pool.add(String16(kSmiley), true);
+    EXPECT_EQ(smiley, (size_t) pool.add(String8("hi \xF0\x9F\x98\x80"), true));
+    const size_t a = pool.add(String16(kNul, 1), true);
+    const size_t nul = pool.add(String16(kNul, 3), true);
+    EXPECT_NE(a, nul);
+    ASSERT_TRUE(pool.offsetsForString(String8("hi \xF0\x9F\x98\x80")) != NULL);
+
+    sp<AaptFile> block = pool.createStringBlock();
+    ASSERT_TRUE(block != NULL);
+    android::ResStringPool strings(block->getData(), block->getSize());
+    ASSERT_EQ(android::NO_ERROR, strings.getError());
+    ASSERT_TRUE(strings.isUTF8());
+    ASSERT_EQ(3u, strings.size());
+
+    size_t len;
+    // Both report the length in UTF-16 units.
+    EXPECT_STREQ("hi \xF0\x9F\x98\x80", strings.string8At(smiley, &len));
+    EXPECT_EQ(5u, len);
+    EXPECT_EQ(String16(kSmiley), String16(strings.stringAt(smiley, &len)));
+    EXPECT_EQ(5u, len);
+    strings.stringAt(nul, &len);
+    EXPECT_EQ(3u, len);
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <utils/Mutex.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+#include "AaptContext.h"
+#include "SourcePos.h"
+#include "TaskGraph.h"
+
+using android::AaptContext;
+using android::AutoMutex;
+using android::Mutex;
+using android::String8;
+using android::TaskGraph;
+using android::Vector;
+
+namespace {
+
+// The steps of one graph, in the order they ran.
+struct Log {
+    Mutex lock;
+    Vector<int> ran;
+
+    bool hasRun(int id) {
+        AutoMutex _l(lock);
+        for (size_t i = 0; i < ran.size(); i++) {
+            if (ran[i] == id) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+class LogStep : public TaskGraph::Task {
+public:
+    LogStep(Log* log, int id, android::status_t result = android::NO_ERROR,
+            int needs1 = -1, int needs2 = -1) :
+            mLog(log), mId(id), mResult(result), mNeeds1(needs1), mNeeds2(needs2) { }
+
+    virtual android::status_t run() {
+        if ((mNeeds1 >= 0 && !mLog->hasRun(mNeeds1))
+                || (mNeeds2 >= 0 && !mLog->hasRun(mNeeds2))) {
+            return android::UNKNOWN_ERROR;
+        }
+        AutoMutex _l(mLog->lock);
+        mLog->ran.add(mId);
+        return mResult;
+    }
+
+private:
+    Log* const mLog;
+    const int mId;
+    const android::status_t mResult;
+    const int mNeeds1;
+    const int mNeeds2;
+};
+
+class ReportStep : public TaskGraph::Task {
+public:
+    virtual android::status_t run() {
+        SourcePos(String8("AndroidManifest.xml"), 1).error("from a step");
+        return android::NO_ERROR;
+    }
+};
+
+} // namespace
+
+TEST(TaskGraphTest, RunsStepsInOrderAddedOnOneThread) {
+    Log log;
+    TaskGraph graph;
+    const size_t a = graph.add(new LogStep(&log, 0));
+    const size_t b = graph.add(new LogStep(&log, 1));
+    const size_t c = graph.add(new LogStep(&log, 2));
+    graph.add(new LogStep(&log, 3));
+    graph.addDependency(c, a);
+    graph.addDependency(c, b);
+
+    EXPECT_EQ(android::NO_ERROR, graph.run(1));
+    ASSERT_EQ(4u, log.ran.size());
+    for (size_t i = 0; i < log.ran.size(); i++) {
+        EXPECT_EQ((int) i, log.ran[i]);
+    }
+}
+
+TEST(TaskGraphTest, RunsStepsAfterWhatTheyNeed) {
+    Log log;
+    TaskGraph graph;
+    const size_t a = graph.add(new LogStep(&log, 0));
+    const size_t b = graph.add(new LogStep(&log, 1));
+    size_t last = graph.add(new LogStep(&log, 2, android::NO_ERROR, 0, 1));
+    graph.addDependency(last, a);
+    graph.addDependency(last, b);
+    for (int i = 3; i < 8; i++) {
+        const size_t next = graph.add(new LogStep(&log, i, android::NO_ERROR, i - 1));
+        graph.addDependency(next, last);
+        last = next;
+    }
+    graph.add(new LogStep(&log, 8));
+
+    EXPECT_EQ(android::NO_ERROR, graph.run(4));
+    EXPECT_EQ(9u, log.ran.size());
+}
+
+TEST(TaskGraphTest, StopsAtAnError) {
+    Log log;
+    TaskGraph graph;
+    const size_t a = graph.add(new LogStep(&log, 0, android::BAD_VALUE));
+    const size_t b = graph.add(new LogStep(&log, 1));
+    graph.addDependency(b, a);
+
+    EXPECT_EQ(android::BAD_VALUE, graph.run(2));
+    ASSERT_EQ(1u, log.ran.size());
+    EXPECT_EQ(0, log.ran[0]);
+}
+
+TEST(TaskGraphTest, RunsStepsInCallersContext) {
+    AaptContext context;
+    AaptContext::Scope scope(&context);
+    TaskGraph graph;
+    for (int i = 0; i < 3; i++) {
+        graph.add(new ReportStep());
+    }
+    EXPECT_EQ(android::NO_ERROR, graph.run(3));
+    EXPECT_TRUE(SourcePos::hasErrors());
+}
+
+TEST(TaskGraphTest, StopsWhenCanceled) {
+    AaptContext context;
+    AaptContext::Scope scope(&context);
+    context.cancel();
+    Log log;
+    TaskGraph graph;
+    graph.add(new LogStep(&log, 0));
+
+    EXPECT_NE(android::NO_ERROR, graph.run(1));
+    EXPECT_EQ(0u, log.ran.size());
+}
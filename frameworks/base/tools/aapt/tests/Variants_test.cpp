@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "Variants.h"
+
+using Variants::Args;
+
+static std::string writeTempFile(const char* contents) {
+    char path[] = "/tmp/aapt-variants-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return std::string();
+    }
+    FILE* fp = fdopen(fd, "w");
+    fputs(contents, fp);
+    fclose(fp);
+    return path;
+}
+
+static Args args(const char* a, const char* b = NULL, const char* c = NULL,
+        const char* d = NULL) {
+    Args result;
+    const char* all[] = { a, b, c, d };
+    for (size_t i = 0; i < 4 && all[i] != NULL; i++) {
+        result.push_back(all[i]);
+    }
+    return result;
+}
+
+TEST(VariantsTest, ReadsOneVariantPerLine) {
+    const std::string path = writeTempFile(
+            "# flavors\n"
+            "-S free/res  -F free.apk\n"
+            "\n"
+            "\t-c en,fr -F paid.apk\r\n"
+            "-F last.apk");
+    ASSERT_FALSE(path.empty());
+
+    std::vector<Args> variants;
+    ASSERT_EQ(android::NO_ERROR, Variants::read(path.c_str(), &variants));
+    unlink(path.c_str());
+
+    ASSERT_EQ(3U, variants.size());
+    EXPECT_EQ(args("-S", "free/res", "-F", "free.apk"), variants[0]);
+    EXPECT_EQ(args("-c", "en,fr", "-F", "paid.apk"), variants[1]);
+    EXPECT_EQ(args("-F", "last.apk"), variants[2]);
+}
+
+TEST(VariantsTest, ReportsMissingFile) {
+    std::vector<Args> variants;
+    EXPECT_NE(android::NO_ERROR, Variants::read("/nonexistent/variants", &variants));
+    EXPECT_TRUE(variants.empty());
+}
+
+TEST(VariantsTest, PutsVariantArgumentsAheadOfSharedOnes) {
+    char* const argv[] = {
+        const_cast<char*>("aapt"), const_cast<char*>("package"),
+        const_cast<char*>("--variants"), const_cast<char*>("flavors.txt"),
+        const_cast<char*>("-S"), const_cast<char*>("main/res"),
+        const_cast<char*>("-I"), const_cast<char*>("android.jar"),
+    };
+    const Args line = Variants::commandLine(8, argv, args("-S", "free/res"));
+
+    Args expected = args("aapt", "package", "-S", "free/res");
+    expected.push_back("-S");
+    expected.push_back("main/res");
+    expected.push_back("-I");
+    expected.push_back("android.jar");
+    EXPECT_EQ(expected, line);
+}
@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+#include "ZipFile.h"
+
+using android::String8;
+using android::Vector;
+using android::ZipEntry;
+using android::ZipFile;
+
+static String8 tempArchivePath() {
+    const char* dir = getenv("TMPDIR");
+    String8 path(dir != NULL ? dir : "/tmp");
+    path.appendFormat("/aapt_zipfile_test_%d.zip", (int) getpid());
+    return path;
+}
+
+static bool fileContainsSignature(const String8& path, uint32_t signature) {
+    FILE* fp = fopen(path.string(), "rb");
+    if (fp == NULL) {
+        return false;
+    }
+    unsigned char window[4] = { 0, 0, 0, 0 };
+    bool found = false;
+    int c;
+    while (!found && (c = fgetc(fp)) != EOF) {
+        window[0] = window[1];
+        window[1] = window[2];
+        window[2] = window[3];
+        window[3] = (unsigned char) c;
+        found = ZipEntry::getLongLE(window) == (long) signature;
+    }
+    fclose(fp);
+    return found;
+}
+
+TEST(ZipFileTest, SmallArchiveHasNoZip64Records) {
+    const String8 path = tempArchivePath();
+    {
+        ZipFile zip;
+        ASSERT_EQ(android::NO_ERROR, zip.open(path.string(),
+                ZipFile::kOpenReadWrite | ZipFile::kOpenCreate | ZipFile::kOpenTruncate));
+        ASSERT_EQ(android::NO_ERROR, zip.add("hello", 5, "a.txt",
+                ZipEntry::kCompressStored, NULL));
+    }
+    EXPECT_FALSE(fileContainsSignature(path, 0x06064b50));
+    EXPECT_FALSE(fileContainsSignature(path, 0x07064b50));
+    unlink(path.string());
+}
+
+TEST(ZipFileTest, MoreThan65535EntriesRoundTrip) {
+    const String8 path = tempArchivePath();
+    const int kEntries = 70000;
+    {
+        ZipFile zip;
+        ASSERT_EQ(android::NO_ERROR, zip.open(path.string(),
+                ZipFile::kOpenReadWrite | ZipFile::kOpenCreate | ZipFile::kOpenTruncate));
+        for (int i = 0; i < kEntries; i++) {
+            String8 name = String8::format("e/%d", i);
+            ASSERT_EQ(android::NO_ERROR, zip.add("x", 1, name.string(),
+                    ZipEntry::kCompressStored, NULL));
+        }
+    }
+    EXPECT_TRUE(fileContainsSignature(path, 0x06064b50));
+
+    ZipFile zip;
+    ASSERT_EQ(android::NO_ERROR, zip.open(path.string(), ZipFile::kOpenReadOnly));
+    ASSERT_EQ(kEntries, zip.getNumEntries());
+    ZipEntry* last = zip.getEntryByName("e/69999");
+    ASSERT_TRUE(last != NULL);
+    EXPECT_EQ(1, (int) last->getUncompressedLen());
+    unlink(path.string());
+}
+
+TEST(ZipFileTest, SizesPastFourGigabytesRoundTrip) {
+    const String8 path = tempArchivePath();
+    const long kClaimedLen = 5L * 1024 * 1024 * 1024;
+    const unsigned char deflated[] = { 0x03, 0x00 };   // an empty deflate stream
+    {
+        ZipFile zip;
+        ASSERT_EQ(android::NO_ERROR, zip.open(path.string(),
+                ZipFile::kOpenReadWrite | ZipFile::kOpenCreate | ZipFile::kOpenTruncate));
+        ASSERT_EQ(android::NO_ERROR, zip.addCompressed(NULL, deflated, sizeof(deflated),
+                kClaimedLen, 0, "big.obb", NULL));
+        ASSERT_EQ(android::NO_ERROR, zip.add("hello", 5, "after.txt",
+                ZipEntry::kCompressStored, NULL));
+    }
+
+    ZipFile zip;
+    ASSERT_EQ(android::NO_ERROR, zip.open(path.string(), ZipFile::kOpenReadOnly));
+    ASSERT_EQ(2, zip.getNumEntries());
+    ZipEntry* big = zip.getEntryByName("big.obb");
+    ASSERT_TRUE(big != NULL);
+    EXPECT_EQ((off_t) kClaimedLen, big->getUncompressedLen());
+    EXPECT_EQ((off_t) sizeof(deflated), big->getCompressedLen());
+
+    ZipEntry* after = zip.getEntryByName("after.txt");
+    ASSERT_TRUE(after != NULL);
+    EXPECT_EQ(5, (int) after->getUncompressedLen());
+    EXPECT_EQ(big->getFileOffset() + (off_t) sizeof(deflated), after->getLFHOffset());
+    unlink(path.string());
+}
+
+struct FifoCopy {
+    String8 fifo;
+    String8 copy;
+};
+
+// Copies everything written to the FIFO into a regular file.
+static void* copyFifo(void* arg) {
+    FifoCopy* job = (FifoCopy*) arg;
+    FILE* in = fopen(job->fifo.string(), "rb");
+    FILE* out = fopen(job->copy.string(), "wb");
+    char buf[4096];
+    size_t n;
+    while (in != NULL && out != NULL && (n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        fwrite(buf, 1, n, out);
+    }
+    if (in != NULL) fclose(in);
+    if (out != NULL) fclose(out);
+    return NULL;
+}
+
+TEST(ZipFileTest, PipeOutputUsesDataDescriptors) {
+    const String8 copy = tempArchivePath();
+    FifoCopy job;
+    job.fifo = copy + ".fifo";
+    job.copy = copy;
+    ASSERT_EQ(0, mkfifo(job.fifo.string(), 0600));
+    pthread_t reader;
+    ASSERT_EQ(0, pthread_create(&reader, NULL, copyFifo, &job));
+
+    String8 text;
+    for (int i = 0; i < 1000; i++) {
+        text.appendFormat("line %d of some text that deflates\n", i);
+    }
+    {
+        ZipFile zip;
+        ASSERT_EQ(android::NO_ERROR, zip.open(job.fifo.string(), ZipFile::kOpenReadWrite
+                | ZipFile::kOpenTruncate | ZipFile::kOpenStreaming | ZipFile::kOpenPipe));
+        ASSERT_EQ(android::NO_ERROR, zip.add("hello", 5, "stored.txt",
+                ZipEntry::kCompressStored, NULL));
+        ASSERT_EQ(android::NO_ERROR, zip.add(text.string(), text.length(), "text.txt",
+                ZipEntry::kCompressDeflated, NULL));
+        ASSERT_EQ(android::NO_ERROR, zip.add("x", 1, "aligned.bin",
+                ZipEntry::kCompressStored, ZipFile::kCompressLevelDefault, 4, NULL));
+        ASSERT_EQ(android::NO_ERROR, zip.flush());
+    }
+    pthread_join(reader, NULL);
+    unlink(job.fifo.string());
+
+    ZipFile zip;
+    ASSERT_EQ(android::NO_ERROR, zip.open(copy.string(), ZipFile::kOpenReadOnly));
+    ASSERT_EQ(3, zip.getNumEntries());
+    ZipEntry* deflated = zip.getEntryByName("text.txt");
+    ASSERT_TRUE(deflated != NULL);
+    EXPECT_EQ(ZipEntry::kCompressDeflated, deflated->getCompressionMethod());
+    EXPECT_EQ((off_t) text.length(), deflated->getUncompressedLen());
+    void* data = zip.uncompress(deflated);
+    ASSERT_TRUE(data != NULL);
+    EXPECT_EQ(0, memcmp(data, text.string(), text.length()));
+    free(data);
+
+    ZipEntry* aligned = zip.getEntryByName("aligned.bin");
+    ASSERT_TRUE(aligned != NULL);
+    EXPECT_EQ(0, (int) (aligned->getFileOffset() % 4));
+    unlink(copy.string());
+}
+
+static String8 readWholeFile(const String8& path) {
+    String8 contents;
+    FILE* fp = fopen(path.string(), "rb");
+    if (fp == NULL) {
+        return contents;
+    }
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        contents.append(buf, n);
+    }
+    fclose(fp);
+    return contents;
+}
+
+static void writeStoredFiles(const String8& path, const Vector<String8>& files, int flags) {
+    ZipFile zip;
+    ASSERT_EQ(android::NO_ERROR, zip.open(path.string(), ZipFile::kOpenReadWrite
+            | ZipFile::kOpenTruncate | ZipFile::kOpenStreaming | flags));
+    for (size_t i = 0; i < files.size(); i++) {
+        ASSERT_EQ(android::NO_ERROR, zip.add(files[i].string(), files[i].getPathLeaf().string(),
+                ZipEntry::kCompressStored, ZipFile::kCompressLevelDefault, 4, NULL));
+    }
+    ASSERT_EQ(android::NO_ERROR, zip.flush());
+}
+
+TEST(ZipFileTest, ParallelStoredFilesMatchSequentialOutput) {
+    const String8 base = tempArchivePath();
+    Vector<String8> files;
+    for (int i = 0; i < 6; i++) {
+        // Sizes either side of the smallest file handed to a worker.
+        String8 file = String8::format("%s.%d.bin", base.string(), i);
+        FILE* fp = fopen(file.string(), "wb");
+        ASSERT_TRUE(fp != NULL);
+        const int size = (i % 2 == 0) ? 300 * 1024 + i : 1000 + i;
+        for (int j = 0; j < size; j++) {
+            fputc((j * 7 + i) & 0xff, fp);
+        }
+        fclose(fp);
+        files.add(file);
+    }
+
+    const String8 sequential = base + ".seq";
+    const String8 parallel = base + ".par";
+    writeStoredFiles(sequential, files, 0);
+    writeStoredFiles(parallel, files, ZipFile::kOpenParallel);
+    const String8 expected = readWholeFile(sequential);
+    EXPECT_GT(expected.length(), (size_t) 900 * 1024);
+    EXPECT_TRUE(expected == readWholeFile(parallel));
+
+    ZipFile zip;
+    ASSERT_EQ(android::NO_ERROR, zip.open(parallel.string(), ZipFile::kOpenReadOnly));
+    ASSERT_EQ((int) files.size(), zip.getNumEntries());
+    ZipEntry* first = zip.getEntryByName(files[0].getPathLeaf().string());
+    ASSERT_TRUE(first != NULL);
+    EXPECT_NE(0UL, first->getCRC32());
+    EXPECT_EQ(0, (int) (first->getFileOffset() % 4));
+
+    for (size_t i = 0; i < files.size(); i++) {
+        unlink(files[i].string());
+    }
+    unlink(sequential.string());
+    unlink(parallel.string());
+}
+
+TEST(ZipFileTest, DeflatedEntriesAtMixedLevelsRoundTrip) {
+    // Each thread's deflate stream is reset between entries, and set up
+    // again when the level changes.
+    const String8 path = tempArchivePath();
+    const int kLevels[] = { ZipFile::kCompressLevelDefault, ZipFile::kCompressLevelDefault,
+            ZipFile::kCompressLevelFast, ZipFile::kCompressLevelMax,
+            ZipFile::kCompressLevelMax };
+    const int kEntries = sizeof(kLevels) / sizeof(kLevels[0]);
+    Vector<String8> contents;
+    for (int i = 0; i < kEntries; i++) {
+        String8 data;
+        for (int j = 0; j < 200 * (i + 1); j++) {
+            data.appendFormat("entry %d line %d\n", i, j % 17);
+        }
+        contents.add(data);
+    }
+    {
+        ZipFile zip;
+        ASSERT_EQ(android::NO_ERROR, zip.open(path.string(),
+                ZipFile::kOpenReadWrite | ZipFile::kOpenCreate | ZipFile::kOpenTruncate));
+        for (int i = 0; i < kEntries; i++) {
+            String8 name = String8::format("e/%d", i);
+            ASSERT_EQ(android::NO_ERROR, zip.add(contents[i].string(), contents[i].length(),
+                    name.string(), ZipEntry::kCompressDeflated, kLevels[i], 0, NULL));
+        }
+    }
+
+    ZipFile zip;
+    ASSERT_EQ(android::NO_ERROR, zip.open(path.string(), ZipFile::kOpenReadOnly));
+    ASSERT_EQ(kEntries, zip.getNumEntries());
+    for (int i = 0; i < kEntries; i++) {
+        ZipEntry* entry = zip.getEntryByName(String8::format("e/%d", i).string());
+        ASSERT_TRUE(entry != NULL);
+        EXPECT_EQ(ZipEntry::kCompressDeflated, entry->getCompressionMethod());
+        char* data = static_cast<char*>(zip.uncompress(entry));
+        ASSERT_TRUE(data != NULL);
+        EXPECT_TRUE(contents[i] == String8(data, entry->getUncompressedLen()));
+        free(data);
+    }
+    unlink(path.string());
+}
@@ -0,0 +1,437 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Benchmarks of the work aapt spends most of its time on.  Every input is
+ * generated here from fixed parameters, so the numbers can be compared
+ * between commits and between hosts.  Run with a regular expression to
+ * pick benchmarks:
+ *   aapt-benchmarks BM_ResTable BM_StringPool
+ */
+
+#include "AaptAssets.h"
+#include "Bundle.h"
+#include "Images.h"
+#include "ResourceFilter.h"
+#include "ResourceIdCache.h"
+#include "ResourceTable.h"
+#include "StringPool.h"
+#include "XMLNode.h"
+#include "ZipFile.h"
+
+#include <androidfw/ResourceTypes.h>
+#include <utils/String16.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+#include <png.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "benchmark.h"
+#include "benchmark_files.h"
+
+using namespace android;
+
+namespace {
+
+const char* const kPackage = "com.example.benchmark";
+
+// How many strings, resources of each type and XML elements the inputs have.
+const int kNumStrings = 1000;
+const int kNumEntries = 1000;
+const int kNumElements = 200;
+
+// The strings of a typical values file: names, short labels and longer
+// sentences, with some repeats.
+const Vector<String16>& strings()
+{
+    static Vector<String16> strings;
+    if (strings.isEmpty()) {
+        for (int i = 0; i < kNumStrings; i++) {
+            char buf[128];
+            switch (i % 4) {
+                case 0: snprintf(buf, sizeof(buf), "string_name_%04d", i); break;
+                case 1: snprintf(buf, sizeof(buf), "Label %d", i); break;
+                case 2: snprintf(buf, sizeof(buf),
+                        "A longer sentence, number %d, like a message shown to the user.", i);
+                        break;
+                default: snprintf(buf, sizeof(buf), "Label %d", i - 3); break;
+            }
+            strings.add(String16(buf));
+        }
+    }
+    return strings;
+}
+
+const char* resourceType(int t)
+{
+    static const char* const types[] = { "string", "dimen", "integer" };
+    return types[t];
+}
+
+String16 resourceName(int t, int i)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%s_%04d", resourceType(t), i);
+    return String16(buf);
+}
+
+// A compiled resource table with kNumEntries strings, dimensions and
+// integers, built the way "aapt package" builds one.
+const sp<AaptFile>& resourceTable()
+{
+    static sp<AaptFile> arsc;
+    if (arsc == NULL) {
+        Bundle bundle;
+        sp<AaptAssets> assets = new AaptAssets();
+        const String16 package(kPackage);
+        ResourceTable table(&bundle, package, ResourceTable::App);
+        if (table.addIncludedResources(&bundle, assets) != NO_ERROR) {
+            fail("unable to set up the resource table");
+        }
+        for (int t = 0; t < 3; t++) {
+            for (int i = 0; i < kNumEntries; i++) {
+                char value[32];
+                switch (t) {
+                    case 0: snprintf(value, sizeof(value), "Value %d", i); break;
+                    case 1: snprintf(value, sizeof(value), "%ddp", i); break;
+                    default: snprintf(value, sizeof(value), "%d", i); break;
+                }
+                if (table.addEntry(SourcePos(String8("values.xml"), i + 1), package,
+                        String16(resourceType(t)), resourceName(t, i),
+                        String16(value)) != NO_ERROR) {
+                    fail("unable to add a resource");
+                }
+            }
+        }
+        arsc = new AaptFile(String8("resources.arsc"), AaptGroupEntry(), String8());
+        if (table.assignResourceIds() != NO_ERROR
+                || table.flatten(&bundle, new WeakResourceFilter(), arsc, true) != NO_ERROR) {
+            fail("unable to flatten the resource table");
+        }
+    }
+    return arsc;
+}
+
+const ResTable& resTable()
+{
+    static ResTable* table;
+    if (table == NULL) {
+        table = new ResTable();
+        const sp<AaptFile>& arsc = resourceTable();
+        if (table->add(arsc->getData(), arsc->getSize()) != NO_ERROR) {
+            fail("unable to load the resource table");
+        }
+    }
+    return *table;
+}
+
+// A layout with kNumElements views, each with a few attributes.
+const String8& layoutFile()
+{
+    static String8 path;
+    if (path.isEmpty()) {
+        String8 xml("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+                "<LinearLayout xmlns:android=\"http://schemas.android.com/apk/res/android\"\n"
+                "    android:orientation=\"vertical\">\n");
+        for (int i = 0; i < kNumElements; i++) {
+            xml.appendFormat("    <!-- Row %d -->\n"
+                    "    <TextView android:id=\"@+id/text_%d\"\n"
+                    "        android:layout_width=\"match_parent\"\n"
+                    "        android:layout_height=\"wrap_content\"\n"
+                    "        android:text=\"Row number %d\" />\n", i, i, i);
+        }
+        xml.append("</LinearLayout>\n");
+        path = writeTempFile("layout.xml", xml.string(), xml.length());
+    }
+    return path;
+}
+
+// A 256x256 image.  Style 0 is an RGBA gradient, which cannot use a
+// palette; style 1 uses a handful of opaque colors, which can.
+const String8& pngFile(int style)
+{
+    static String8 paths[2];
+    String8& path = paths[style];
+    if (!path.isEmpty()) {
+        return path;
+    }
+
+    const int size = 256;
+    path = tempFilePath(style == 0 ? "gradient.png" : "palette.png");
+    FILE* fp = fopen(path.string(), "wb");
+    if (fp == NULL) {
+        fail("unable to write an input image");
+    }
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png != NULL ? png_create_info_struct(png) : NULL;
+    if (info == NULL || setjmp(png_jmpbuf(png))) {
+        fail("unable to encode an input image");
+    }
+    png_init_io(png, fp);
+    png_set_IHDR(png, info, size, size, 8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE,
+            PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+    png_byte row[size * 4];
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            png_byte* p = row + x * 4;
+            if (style == 0) {
+                p[0] = x;
+                p[1] = y;
+                p[2] = (x + y) / 2;
+                p[3] = 255 - x;
+            } else {
+                const int color = ((x / 32) + (y / 32)) % 4;
+                p[0] = color * 60;
+                p[1] = 255 - color * 60;
+                p[2] = 128;
+                p[3] = 255;
+            }
+        }
+        png_write_row(png, row);
+    }
+    png_write_end(png, info);
+    png_destroy_write_struct(&png, &info);
+    fclose(fp);
+    return path;
+}
+
+} // namespace
+
+/*
+ * Adding the strings of a values file to a new pool, as the table does
+ * when it is flattened.
+ */
+static void BM_StringPool_add(int iters) {
+    const Vector<String16>& values = strings();
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        StringPool pool;
+        for (size_t j = 0; j < values.size(); j++) {
+            pool.add(values[j], true);
+        }
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_StringPool_add);
+
+/*
+ * Writing a pool out, in UTF-16 (0) or UTF-8 (1).
+ */
+static void BM_StringPool_writeStringBlock(int iters, int utf8) {
+    const Vector<String16>& values = strings();
+    StringPool pool(utf8);
+    for (size_t j = 0; j < values.size(); j++) {
+        pool.add(values[j], true);
+    }
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        sp<AaptFile> block = new AaptFile(String8(), AaptGroupEntry(), String8());
+        if (pool.writeStringBlock(block) != NO_ERROR) {
+            fail("writeStringBlock failed");
+        }
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_StringPool_writeStringBlock)->Arg(0)->Arg(1);
+
+/*
+ * Looking up IDs that are already in the cache.
+ */
+static void BM_ResourceIdCache_lookup(int iters) {
+    const String16 package(kPackage);
+    const String16 type("string");
+    Vector<String16> names;
+    ResourceIdCache::clear();
+    for (int i = 0; i < kNumEntries; i++) {
+        names.add(resourceName(0, i));
+        ResourceIdCache::store(package, type, names[i], false, 0x7f020000 | i);
+    }
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        if (ResourceIdCache::lookup(package, type, names[i % kNumEntries], false) == 0) {
+            fail("lookup missed");
+        }
+    }
+    StopBenchmarkTiming();
+    ResourceIdCache::clear();
+}
+BENCHMARK(BM_ResourceIdCache_lookup);
+
+/*
+ * Finding resources by name in a loaded table, as aapt does for every
+ * reference it compiles.
+ */
+static void BM_ResTable_identifierForName(int iters) {
+    const ResTable& table = resTable();
+    const String16 package(kPackage);
+    const String16 type("dimen");
+    Vector<String16> names;
+    for (int i = 0; i < kNumEntries; i++) {
+        names.add(resourceName(1, i));
+    }
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        const String16& name = names[i % kNumEntries];
+        if (table.identifierForName(name.string(), name.size(), type.string(), type.size(),
+                package.string(), package.size()) == 0) {
+            fail("identifierForName missed");
+        }
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_ResTable_identifierForName);
+
+static void BM_ResTable_getResource(int iters) {
+    const ResTable& table = resTable();
+    const String16 package(kPackage);
+    const String16 type("integer");
+    Vector<uint32_t> ids;
+    for (int i = 0; i < kNumEntries; i++) {
+        const String16 name(resourceName(2, i));
+        ids.add(table.identifierForName(name.string(), name.size(), type.string(),
+                type.size(), package.string(), package.size()));
+    }
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        Res_value value;
+        if (table.getResource(ids[i % kNumEntries], &value) < 0) {
+            fail("getResource missed");
+        }
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_ResTable_getResource);
+
+/*
+ * Finding strings in a compiled pool, in UTF-16 (0) or UTF-8 (1).
+ */
+static void BM_ResStringPool_indexOfString(int iters, int utf8) {
+    const Vector<String16>& values = strings();
+    StringPool pool(utf8);
+    for (size_t j = 0; j < values.size(); j++) {
+        pool.add(values[j], true);
+    }
+    sp<AaptFile> block = new AaptFile(String8(), AaptGroupEntry(), String8());
+    if (pool.writeStringBlock(block) != NO_ERROR) {
+        fail("writeStringBlock failed");
+    }
+    ResStringPool compiled(block->getData(), block->getSize(), false);
+    if (compiled.getError() != NO_ERROR) {
+        fail("unable to load the string pool");
+    }
+
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        const String16& value = values[i % values.size()];
+        if (compiled.indexOfString(value.string(), value.size()) < 0) {
+            fail("indexOfString missed");
+        }
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_ResStringPool_indexOfString)->Arg(0)->Arg(1);
+
+/*
+ * Parsing a layout into a tree and flattening it to binary XML.
+ */
+static void BM_XMLNode_parse_flatten(int iters) {
+    sp<AaptFile> source = new AaptFile(layoutFile(), AaptGroupEntry(), String8("layout"));
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        XMLNode::Arena arena;
+        sp<XMLNode> root = XMLNode::parse(source, &arena);
+        if (root == NULL) {
+            fail("parse failed");
+        }
+        sp<AaptFile> out = new AaptFile(String8(), AaptGroupEntry(), String8());
+        if (root->flatten(out, true, true, false) != NO_ERROR) {
+            fail("flatten failed");
+        }
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_XMLNode_parse_flatten);
+
+/*
+ * Writing an archive of compiled files, deflated; the files are the
+ * flattened resource table and copies of the layout.
+ */
+static void BM_ZipFile_add(int iters) {
+    const sp<AaptFile>& arsc = resourceTable();
+    String8 xml;
+    {
+        FILE* fp = fopen(layoutFile().string(), "rb");
+        char buf[4096];
+        size_t n;
+        while (fp != NULL && (n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+            xml.append(buf, n);
+        }
+        if (fp != NULL) {
+            fclose(fp);
+        }
+    }
+    const String8 path(tempFilePath("out.apk"));
+    const int numFiles = 50;
+
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        ZipFile zip;
+        if (zip.open(path.string(), ZipFile::kOpenReadWrite | ZipFile::kOpenCreate
+                | ZipFile::kOpenTruncate) != NO_ERROR) {
+            fail("unable to create the archive");
+        }
+        zip.add(arsc->getData(), arsc->getSize(), "resources.arsc",
+                ZipEntry::kCompressDeflated, NULL);
+        for (int j = 0; j < numFiles; j++) {
+            char name[64];
+            snprintf(name, sizeof(name), "res/layout/layout_%d.xml", j);
+            zip.add(xml.string(), xml.length(), name, ZipEntry::kCompressDeflated, NULL);
+        }
+        if (zip.flush() != NO_ERROR) {
+            fail("unable to write the archive");
+        }
+    }
+    StopBenchmarkTiming();
+    SetBenchmarkBytesProcessed((uint64_t) iters * (arsc->getSize() + numFiles * xml.length()));
+}
+BENCHMARK(BM_ZipFile_add);
+
+/*
+ * Crunching a PNG: reading it, analyze_image() choosing the smallest color
+ * type, and write_png() encoding it.  Style 0 is an RGBA gradient; style 1
+ * can be written with a palette.
+ */
+static void BM_preProcessImage(int iters, int style) {
+    Bundle bundle;
+    sp<AaptAssets> assets = new AaptAssets();
+    const String8 source(pngFile(style));
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        sp<AaptGroup> group = new AaptGroup(String8("image.png"),
+                String8("res/drawable/image.png"));
+        sp<AaptFile> file = new AaptFile(source, AaptGroupEntry(), String8("drawable"));
+        group->addFile(file);
+        if (preProcessImage(&bundle, assets, file, NULL) != NO_ERROR) {
+            fail("preProcessImage failed");
+        }
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_preProcessImage)->Arg(0)->Arg(1);
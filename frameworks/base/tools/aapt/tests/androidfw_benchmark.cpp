@@ -0,0 +1,594 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Benchmarks of what the programs that load APKs with libandroidfw spend
+ * their time on: opening an APK's table, finding values for a device
+ * configuration, resolving styles and themes, walking compiled XML and
+ * reading files out of the archive.
+ *
+ * By default they run on an APK generated here with aapt's own classes,
+ * from fixed parameters that these environment variables change:
+ *   AAPT_BENCHMARK_CONFIGS      configurations each integer has (1-8, 6)
+ *   AAPT_BENCHMARK_STYLE_DEPTH  length of the chain of styles (32)
+ * Set AAPT_BENCHMARK_APK to run them on a real APK instead, such as
+ * framework-res.apk, and AAPT_BENCHMARK_THEME to the name of the style
+ * to apply from it (Theme.Material.Light by default):
+ *   AAPT_BENCHMARK_APK=framework-res.apk aapt-benchmarks BM_Theme
+ * The style chain benchmarks always use the generated chain.
+ */
+
+#include "AaptAssets.h"
+#include "AaptConfig.h"
+#include "Bundle.h"
+#include "ResourceFilter.h"
+#include "ResourceTable.h"
+#include "XMLNode.h"
+#include "ZipFile.h"
+
+#include <androidfw/Asset.h>
+#include <androidfw/AssetManager.h>
+#include <androidfw/ResourceTypes.h>
+#include <androidfw/ZipFileRO.h>
+#include <utils/String16.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "benchmark.h"
+#include "benchmark_files.h"
+
+using namespace android;
+
+namespace {
+
+const char* const kPackage = "com.example.runtime";
+
+// The configurations the integers of the generated table are given, the
+// first AAPT_BENCHMARK_CONFIGS of them.
+const char* const kConfigs[] = {
+    "", "hdpi", "xhdpi", "xxhdpi", "fr", "de-rDE", "land", "sw600dp-v13"
+};
+const int kMaxConfigs = sizeof(kConfigs) / sizeof(kConfigs[0]);
+
+// How many integers and attributes the generated table has, how many
+// attributes each style of its chain sets, and how many views its layout
+// has.
+const int kNumIntegers = 1000;
+const int kNumAttrs = 128;
+const int kAttrsPerStyle = 4;
+const int kNumViews = 1000;
+
+int envInt(const char* name, int def, int min, int max)
+{
+    const char* value = getenv(name);
+    if (value == NULL) {
+        return def;
+    }
+    const int n = atoi(value);
+    if (n < min || n > max) {
+        fprintf(stderr, "aapt-benchmarks: %s must be from %d to %d\n", name, min, max);
+        exit(EXIT_FAILURE);
+    }
+    return n;
+}
+
+int numConfigs()
+{
+    return envInt("AAPT_BENCHMARK_CONFIGS", 6, 1, kMaxConfigs);
+}
+
+int styleDepth()
+{
+    return envInt("AAPT_BENCHMARK_STYLE_DEPTH", 32, 1, 1000);
+}
+
+String16 styleName(int depth)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "Style_%d", depth);
+    return String16(buf);
+}
+
+// Integers in each configuration, attributes, a chain of styles each of
+// which sets its own attributes on top of its parent's, and a layout of
+// nested views, compiled the way "aapt package" compiles them.
+const String8& syntheticApk()
+{
+    static String8 path;
+    if (!path.isEmpty()) {
+        return path;
+    }
+
+    Bundle bundle;
+    sp<AaptAssets> assets = new AaptAssets();
+    const String16 package(kPackage);
+    ResourceTable table(&bundle, package, ResourceTable::App);
+    if (table.addIncludedResources(&bundle, assets) != NO_ERROR) {
+        fail("unable to set up the resource table");
+    }
+    const SourcePos pos(String8("values.xml"), 1);
+    const String16 integer16("integer");
+    const String16 attr16("attr");
+    const String16 style16("style");
+
+    for (int c = 0; c < numConfigs(); c++) {
+        ConfigDescription config;
+        if (!AaptConfig::parse(String8(kConfigs[c]), &config)) {
+            fail("unable to parse a configuration");
+        }
+        for (int i = 0; i < kNumIntegers; i++) {
+            char name[32];
+            char value[32];
+            snprintf(name, sizeof(name), "integer_%04d", i);
+            snprintf(value, sizeof(value), "%d", i * kMaxConfigs + c);
+            if (table.addEntry(pos, package, integer16, String16(name), String16(value),
+                    NULL, &config) != NO_ERROR) {
+                fail("unable to add an integer");
+            }
+        }
+    }
+
+    char format[16];
+    snprintf(format, sizeof(format), "%d", ResTable_map::TYPE_ANY);
+    for (int i = 0; i < kNumAttrs; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "attr_%03d", i);
+        if (table.addBag(pos, package, attr16, String16(name), String16(""),
+                String16("^type"), String16(format)) != NO_ERROR) {
+            fail("unable to add an attribute");
+        }
+    }
+
+    for (int d = 0; d < styleDepth(); d++) {
+        const String16 name(styleName(d));
+        const String16 parent(d > 0 ? styleName(d - 1) : String16());
+        if (table.startBag(pos, package, style16, name, parent) != NO_ERROR) {
+            fail("unable to add a style");
+        }
+        for (int i = 0; i < kAttrsPerStyle; i++) {
+            char attr[32];
+            char value[32];
+            snprintf(attr, sizeof(attr), "attr_%03d", (d * kAttrsPerStyle + i) % kNumAttrs);
+            snprintf(value, sizeof(value), "%d", d);
+            if (table.addBag(pos, package, style16, name, parent, String16(attr),
+                    String16(value)) != NO_ERROR) {
+                fail("unable to add a style item");
+            }
+        }
+    }
+
+    sp<AaptFile> arsc = new AaptFile(String8("resources.arsc"), AaptGroupEntry(), String8());
+    if (table.assignResourceIds() != NO_ERROR
+            || table.flatten(&bundle, new WeakResourceFilter(), arsc, true) != NO_ERROR) {
+        fail("unable to flatten the resource table");
+    }
+
+    // Rows of a label, an image and a button, each row in a layout of its own.
+    String8 xml("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+            "<LinearLayout xmlns:android=\"http://schemas.android.com/apk/res/android\"\n"
+            "    android:orientation=\"vertical\">\n");
+    for (int i = 0; i < kNumViews / 3; i++) {
+        xml.appendFormat("  <LinearLayout android:orientation=\"horizontal\"\n"
+                "      android:layout_width=\"match_parent\"\n"
+                "      android:layout_height=\"wrap_content\">\n"
+                "    <TextView android:id=\"@+id/text_%d\" android:text=\"Row %d\"\n"
+                "        android:layout_width=\"0dp\" android:layout_weight=\"1\"\n"
+                "        android:layout_height=\"wrap_content\" />\n"
+                "    <ImageView android:id=\"@+id/image_%d\"\n"
+                "        android:layout_width=\"48dp\" android:layout_height=\"48dp\" />\n"
+                "    <Button android:id=\"@+id/button_%d\" android:text=\"Open %d\"\n"
+                "        android:layout_width=\"wrap_content\"\n"
+                "        android:layout_height=\"wrap_content\" />\n"
+                "  </LinearLayout>\n", i, i, i, i, i);
+    }
+    xml.append("</LinearLayout>\n");
+    const String8 source(writeTempFile("runtime_layout.xml", xml.string(), xml.length()));
+    sp<AaptFile> layoutSource = new AaptFile(source, AaptGroupEntry(), String8("layout"));
+    XMLNode::Arena arena;
+    sp<XMLNode> root = XMLNode::parse(layoutSource, &arena);
+    sp<AaptFile> layout = new AaptFile(String8(), AaptGroupEntry(), String8());
+    if (root == NULL || root->flatten(layout, true, true, false) != NO_ERROR) {
+        fail("unable to compile the layout");
+    }
+
+    path = tempFilePath("runtime.apk");
+    ZipFile zip;
+    if (zip.open(path.string(), ZipFile::kOpenReadWrite | ZipFile::kOpenCreate
+            | ZipFile::kOpenTruncate) != NO_ERROR
+            || zip.add(arsc->getData(), arsc->getSize(), "resources.arsc",
+                    ZipEntry::kCompressDeflated, NULL) != NO_ERROR
+            || zip.add(layout->getData(), layout->getSize(), "res/layout/main.xml",
+                    ZipEntry::kCompressDeflated, NULL) != NO_ERROR
+            || zip.flush() != NO_ERROR) {
+        fail("unable to write the APK");
+    }
+    return path;
+}
+
+bool usingRealApk()
+{
+    return getenv("AAPT_BENCHMARK_APK") != NULL;
+}
+
+const String8& inputApk()
+{
+    static String8 path;
+    if (path.isEmpty()) {
+        path = usingRealApk() ? String8(getenv("AAPT_BENCHMARK_APK")) : syntheticApk();
+    }
+    return path;
+}
+
+// The whole of the file "name" in the APK "apk".
+const Vector<uint8_t>& readEntry(const String8& apk, const char* name, Vector<uint8_t>* data)
+{
+    AssetManager assets;
+    if (!assets.addAssetPath(apk, NULL)) {
+        fail("unable to open the APK");
+    }
+    Asset* asset = assets.openNonAsset(name, Asset::ACCESS_BUFFER);
+    if (asset == NULL) {
+        fail("unable to open a file of the APK");
+    }
+    data->resize(asset->getLength());
+    if (!asset->copyTo(data->editArray())) {
+        fail("unable to read a file of the APK");
+    }
+    delete asset;
+    return *data;
+}
+
+// A table of its own, rather than the one AssetManager shares between
+// managers, so that the benchmarks may set its configuration.
+ResTable* loadTable(const String8& apk)
+{
+    Vector<uint8_t> data;
+    readEntry(apk, "resources.arsc", &data);
+    ResTable* table = new ResTable();
+    if (table->add(data.array(), data.size(), -1, true) != NO_ERROR) {
+        fail("unable to load the resource table");
+    }
+    return table;
+}
+
+ResTable& inputTable()
+{
+    static ResTable* table;
+    if (table == NULL) {
+        table = loadTable(inputApk());
+    }
+    return *table;
+}
+
+ResTable& syntheticTable()
+{
+    static ResTable* table;
+    if (table == NULL) {
+        table = usingRealApk() ? loadTable(syntheticApk()) : &inputTable();
+    }
+    return *table;
+}
+
+// The resources of the first package of "table" that have a single value
+// rather than a bag.  The entries of each type are numbered from 0, and
+// the types from 1.
+const Vector<uint32_t>& valueIds(const ResTable& table)
+{
+    static Vector<uint32_t> ids;
+    if (ids.isEmpty()) {
+        const uint32_t packageId = table.getBasePackageId(0);
+        for (uint32_t t = 1; t <= 0xff; t++) {
+            uint32_t e = 0;
+            for (;; e++) {
+                const uint32_t id = (packageId << 24) | (t << 16) | e;
+                ResTable::resource_name name;
+                if (!table.getResourceName(id, false, &name)) {
+                    break;
+                }
+                Res_value value;
+                if (table.getResource(id, &value, false) >= 0) {
+                    ids.add(id);
+                }
+            }
+            if (e == 0) {
+                break;
+            }
+        }
+        if (ids.isEmpty()) {
+            fail("the table has no values");
+        }
+    }
+    return ids;
+}
+
+uint32_t styleId(const ResTable& table, const String16& name)
+{
+    const String16 type("style");
+    const String16 package(table.getBasePackageName(0));
+    const uint32_t id = table.identifierForName(name.string(), name.size(), type.string(),
+            type.size(), package.string(), package.size());
+    if (id == 0) {
+        fprintf(stderr, "aapt-benchmarks: no style %s\n", String8(name).string());
+        exit(EXIT_FAILURE);
+    }
+    return id;
+}
+
+// The style the theme benchmarks apply: the named one of a real APK, or
+// the end of the generated chain.
+uint32_t themeId()
+{
+    if (!usingRealApk()) {
+        return styleId(inputTable(), styleName(styleDepth() - 1));
+    }
+    const char* name = getenv("AAPT_BENCHMARK_THEME");
+    return styleId(inputTable(), String16(name != NULL ? name : "Theme.Material.Light"));
+}
+
+// The attributes the theme sets, itself or through its parents.
+const Vector<uint32_t>& themeAttrs()
+{
+    static Vector<uint32_t> attrs;
+    if (attrs.isEmpty()) {
+        const ResTable& table = inputTable();
+        table.lock();
+        const ResTable::bag_entry* bag;
+        const ssize_t count = table.getBagLocked(themeId(), &bag);
+        for (ssize_t i = 0; i < count; i++) {
+            attrs.add(bag[i].map.name.ident);
+        }
+        table.unlock();
+        if (attrs.isEmpty()) {
+            fail("the theme sets no attributes");
+        }
+    }
+    return attrs;
+}
+
+// The name of the largest layout of the input APK.
+const String8& largestLayout()
+{
+    static String8 name;
+    if (name.isEmpty()) {
+        ZipFileRO* zip = ZipFileRO::open(inputApk().string());
+        void* cookie;
+        if (zip == NULL || !zip->startIteration(&cookie, "res/layout", ".xml")) {
+            fail("unable to read the entries of the APK");
+        }
+        uint32_t largest = 0;
+        ZipEntryRO entry;
+        while ((entry = zip->nextEntry(cookie)) != NULL) {
+            char entryName[PATH_MAX];
+            uint32_t size;
+            if (zip->getEntryFileName(entry, entryName, sizeof(entryName)) == 0
+                    && zip->getEntryInfo(entry, NULL, &size, NULL, NULL, NULL, NULL)
+                    && size > largest) {
+                largest = size;
+                name = entryName;
+            }
+        }
+        zip->endIteration(cookie);
+        delete zip;
+        if (name.isEmpty()) {
+            fail("the APK has no layouts");
+        }
+    }
+    return name;
+}
+
+} // namespace
+
+/*
+ * Opening an APK and loading its table, as a program that reads the
+ * resources of an APK starts.  The table's zip stays open between
+ * AssetManagers, as it does in an app's process.
+ */
+static void BM_AssetManager_addAssetPath_getResources(int iters) {
+    const String8& apk = inputApk();
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        AssetManager assets;
+        if (!assets.addAssetPath(apk, NULL)) {
+            fail("addAssetPath failed");
+        }
+        if (assets.getResources().getError() != NO_ERROR) {
+            fail("getResources failed");
+        }
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_AssetManager_addAssetPath_getResources);
+
+/*
+ * Finding the value of every resource that has one for a device of the
+ * given configuration, which picks among more candidates the more
+ * qualifiers it has.
+ */
+static void BM_ResTable_getResource(int iters, const char* device) {
+    ResTable& table = inputTable();
+    const Vector<uint32_t>& ids = valueIds(table);
+    ConfigDescription config;
+    if (!AaptConfig::parse(String8(device), &config)) {
+        fail("unable to parse the device configuration");
+    }
+    table.setParameters(&config);
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        Res_value value;
+        if (table.getResource(ids[i % ids.size()], &value) < 0) {
+            fail("getResource missed");
+        }
+    }
+    StopBenchmarkTiming();
+    ResTable_config none;
+    memset(&none, 0, sizeof(none));
+    table.setParameters(&none);
+}
+BENCHMARK(BM_ResTable_getResource)
+        ->Arg("default", "")
+        ->Arg("xhdpi", "xhdpi-v21")
+        ->Arg("fr-land", "fr-rFR-land-xxhdpi-v21")
+        ->Arg("tablet", "sw600dp-w960dp-h600dp-land-hdpi-v21");
+
+/*
+ * Resolving the bag of a style at the given depth of a chain, each of
+ * whose styles sets attributes on top of its parent's.  Setting the
+ * configuration empties the table's cache of bags, so every lookup merges
+ * the whole chain again; that costs little next to the merging.
+ */
+static void BM_ResTable_getBagLocked(int iters, int depth) {
+    if (depth > styleDepth()) {
+        fail("the style chain is shorter than the benchmark wants");
+    }
+    ResTable& table = syntheticTable();
+    const uint32_t id = styleId(table, styleName(depth - 1));
+    ResTable_config config;
+    memset(&config, 0, sizeof(config));
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        table.setParameters(&config);
+        table.lock();
+        const ResTable::bag_entry* bag;
+        if (table.getBagLocked(id, &bag) < 0) {
+            fail("getBagLocked missed");
+        }
+        table.unlock();
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_ResTable_getBagLocked)->Arg(1)->Arg(8)->Arg(32);
+
+static void BM_Theme_applyStyle(int iters) {
+    const ResTable& table = inputTable();
+    const uint32_t id = themeId();
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        ResTable::Theme theme(table);
+        if (theme.applyStyle(id) != NO_ERROR) {
+            fail("applyStyle failed");
+        }
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_Theme_applyStyle);
+
+/*
+ * Looking up every attribute the theme sets, as inflating views does.
+ */
+static void BM_Theme_getAttribute(int iters) {
+    const ResTable& table = inputTable();
+    const Vector<uint32_t>& attrs = themeAttrs();
+    ResTable::Theme theme(table);
+    if (theme.applyStyle(themeId()) != NO_ERROR) {
+        fail("applyStyle failed");
+    }
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        Res_value value;
+        if (theme.getAttribute(attrs[i % attrs.size()], &value) < 0) {
+            fail("getAttribute missed");
+        }
+    }
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_Theme_getAttribute);
+
+/*
+ * Walking the largest layout of the APK and reading every attribute of
+ * every element, as an inflater does.
+ */
+static void BM_ResXMLParser_next(int iters) {
+    Vector<uint8_t> data;
+    readEntry(inputApk(), largestLayout().string(), &data);
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        ResXMLTree tree;
+        if (tree.setTo(data.array(), data.size()) != NO_ERROR) {
+            fail("unable to parse the layout");
+        }
+        ResXMLParser::event_code_t code;
+        while ((code = tree.next()) != ResXMLParser::END_DOCUMENT
+                && code != ResXMLParser::BAD_DOCUMENT) {
+            if (code != ResXMLParser::START_TAG) {
+                continue;
+            }
+            const size_t N = tree.getAttributeCount();
+            for (size_t j = 0; j < N; j++) {
+                Res_value value;
+                tree.getAttributeNameResID(j);
+                tree.getAttributeValue(j, &value);
+            }
+        }
+        if (code == ResXMLParser::BAD_DOCUMENT) {
+            fail("the layout is malformed");
+        }
+    }
+    StopBenchmarkTiming();
+    SetBenchmarkBytesProcessed((uint64_t) iters * data.size());
+}
+BENCHMARK(BM_ResXMLParser_next);
+
+/*
+ * Reading the largest layout out of the APK, inflated in pieces as it is
+ * read (streaming) or into a buffer of its own when it is opened.
+ */
+static void openNonAsset(int iters, Asset::AccessMode mode) {
+    AssetManager assets;
+    if (!assets.addAssetPath(inputApk(), NULL)) {
+        fail("addAssetPath failed");
+    }
+    const String8& name = largestLayout();
+    off64_t length = 0;
+    StartBenchmarkTiming();
+    for (int i = 0; i < iters; i++) {
+        Asset* asset = assets.openNonAsset(name.string(), mode);
+        if (asset == NULL) {
+            fail("openNonAsset failed");
+        }
+        length = asset->getLength();
+        if (mode == Asset::ACCESS_BUFFER) {
+            if (asset->getBuffer(false) == NULL) {
+                fail("getBuffer failed");
+            }
+        } else {
+            char buf[4096];
+            ssize_t count;
+            while ((count = asset->read(buf, sizeof(buf))) > 0) {
+            }
+            if (count < 0) {
+                fail("read failed");
+            }
+        }
+        delete asset;
+    }
+    StopBenchmarkTiming();
+    SetBenchmarkBytesProcessed((uint64_t) iters * length);
+}
+
+static void BM_AssetManager_openNonAsset_streaming(int iters) {
+    openNonAsset(iters, Asset::ACCESS_STREAMING);
+}
+BENCHMARK(BM_AssetManager_openNonAsset_streaming);
+
+static void BM_AssetManager_openNonAsset_buffer(int iters) {
+    openNonAsset(iters, Asset::ACCESS_BUFFER);
+}
+BENCHMARK(BM_AssetManager_openNonAsset_buffer);
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "benchmark_files.h"
+
+#include <utils/Vector.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using android::String8;
+using android::Vector;
+
+// The files are removed when the run ends.  (These are not globals since
+// the utils strings cannot be used before main().)
+static Vector<String8>& tempFiles()
+{
+    static Vector<String8> files;
+    return files;
+}
+
+static void removeTempFiles()
+{
+    for (size_t i = 0; i < tempFiles().size(); i++) {
+        unlink(tempFiles()[i].string());
+    }
+    rmdir(tempDir().string());
+}
+
+void fail(const char* what)
+{
+    fprintf(stderr, "aapt-benchmarks: %s\n", what);
+    exit(EXIT_FAILURE);
+}
+
+const String8& tempDir()
+{
+    static String8 dir;
+    if (dir.isEmpty()) {
+        const char* tmp = getenv("TMPDIR");
+        String8 templ(tmp != NULL ? tmp : "/tmp");
+        templ.appendPath("aapt-benchmarks-XXXXXX");
+        if (mkdtemp(templ.lockBuffer(templ.length())) == NULL) {
+            fail("unable to create a temporary directory");
+        }
+        templ.unlockBuffer();
+        dir = templ;
+        tempFiles();
+        atexit(removeTempFiles);
+    }
+    return dir;
+}
+
+String8 tempFilePath(const char* name)
+{
+    String8 path(tempDir());
+    path.appendPath(name);
+    tempFiles().add(path);
+    return path;
+}
+
+String8 writeTempFile(const char* name, const void* data, size_t size)
+{
+    String8 path(tempFilePath(name));
+    FILE* fp = fopen(path.string(), "wb");
+    if (fp == NULL || fwrite(data, 1, size, fp) != size || fclose(fp) != 0) {
+        fail("unable to write an input file");
+    }
+    return path;
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef AAPT_BENCHMARK_FILES_H
+#define AAPT_BENCHMARK_FILES_H
+
+#include <utils/String8.h>
+
+#include <stddef.h>
+
+/*
+ * The inputs of the benchmarks that are read from files are written to
+ * one temporary directory, removed when the run ends.
+ */
+
+// Prints what went wrong and exits; a benchmark that can't set up its
+// input has nothing to measure.
+void fail(const char* what);
+
+const android::String8& tempDir();
+
+// The path of a file named "name" in tempDir(), removed at the end.
+android::String8 tempFilePath(const char* name);
+
+android::String8 writeTempFile(const char* name, const void* data, size_t size);
+
+#endif // AAPT_BENCHMARK_FILES_H
@@ -0,0 +1,336 @@
+#!/usr/bin/env python
+# Copyright (C) 2014 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""Generate a synthetic app project for benchmarking aapt.
+
+The project has layouts of nested views, strings translated into several
+locales, styles with long parent chains, 9-patch images, raw assets and
+overlay resource directories, in whatever amounts are asked for.  The same
+parameters always generate the same files.
+
+The resources only use attributes the project declares itself, so it can
+be packaged without an android.jar:
+
+$ ./generate_project.py --layouts=500 --strings=5000 /tmp/project
+$ aapt package -f -M /tmp/project/AndroidManifest.xml \\
+      -S /tmp/project/overlay1/res -S /tmp/project/res \\
+      -A /tmp/project/assets -F /tmp/project.apk
+"""
+
+from __future__ import print_function
+
+import argparse
+import os
+import random
+import struct
+import sys
+import zlib
+
+PACKAGE = 'com.example.generated'
+
+# Locales are taken from the front of this list.
+LOCALES = [
+    'fr', 'de', 'es', 'it', 'ja', 'ko', 'pt-rBR', 'ru', 'zh-rCN', 'zh-rTW',
+    'ar', 'hi', 'nl', 'sv', 'pl', 'tr', 'da', 'fi', 'nb', 'cs', 'el', 'hu',
+    'iw', 'in', 'th', 'uk', 'vi', 'ro', 'sk', 'bg', 'hr', 'ca',
+]
+
+WORDS = [
+    'account', 'add', 'cancel', 'choose', 'connect', 'delete', 'done',
+    'download', 'edit', 'error', 'file', 'folder', 'help', 'message', 'more',
+    'name', 'network', 'next', 'open', 'photo', 'please', 'retry', 'save',
+    'search', 'send', 'settings', 'share', 'sign', 'try', 'update', 'wait',
+]
+
+# How many children each view below the root has.
+FANOUT = 3
+
+
+def parse_args(argv=None):
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('output', help='directory to write the project to')
+    add_size_args(parser)
+    return parser.parse_args(argv)
+
+
+def add_size_args(parser):
+    """Adds the options that set the size of the project."""
+    parser.add_argument('--layouts', type=int, default=100,
+                        help='number of layouts (default: %(default)s)')
+    parser.add_argument('--layout-depth', type=int, default=4,
+                        help='depth of the views in each layout '
+                        '(default: %(default)s)')
+    parser.add_argument('--strings', type=int, default=1000,
+                        help='number of strings (default: %(default)s)')
+    parser.add_argument('--locales', type=int, default=10,
+                        help='number of locales the strings are translated '
+                        'into, at most %d (default: %%(default)s)' %
+                        len(LOCALES))
+    parser.add_argument('--styles', type=int, default=20,
+                        help='number of style chains (default: %(default)s)')
+    parser.add_argument('--style-depth', type=int, default=8,
+                        help='number of styles in each chain '
+                        '(default: %(default)s)')
+    parser.add_argument('--nine-patches', type=int, default=20,
+                        help='number of 9-patch images (default: %(default)s)')
+    parser.add_argument('--assets', type=int, default=50,
+                        help='number of raw assets (default: %(default)s)')
+    parser.add_argument('--asset-size', type=int, default=16384,
+                        help='size of each raw asset in bytes '
+                        '(default: %(default)s)')
+    parser.add_argument('--overlays', type=int, default=2,
+                        help='number of overlay directories '
+                        '(default: %(default)s)')
+    parser.add_argument('--seed', type=int, default=1,
+                        help='seed for the generated content '
+                        '(default: %(default)s)')
+
+
+def write_file(path, data):
+    directory = os.path.dirname(path)
+    if not os.path.isdir(directory):
+        os.makedirs(directory)
+    mode = 'wb' if isinstance(data, bytes) else 'w'
+    with open(path, mode) as f:
+        f.write(data)
+
+
+def xml_escape(text):
+    return (text.replace('&', '&amp;').replace('<', '&lt;')
+            .replace('>', '&gt;').replace('"', '&quot;'))
+
+
+def values_file(items):
+    return ('<?xml version="1.0" encoding="utf-8"?>\n<resources>\n' +
+            ''.join('    %s\n' % item for item in items) +
+            '</resources>\n')
+
+
+def string_name(i):
+    return 's_%05d' % i
+
+
+def sentence(rnd, num_words):
+    text = ' '.join(rnd.choice(WORDS) for _ in range(num_words))
+    return text[0].upper() + text[1:]
+
+
+def string_values(rnd, count, prefix):
+    """Strings of a few lengths; some have format arguments or quotes."""
+    items = []
+    for i in range(count):
+        text = prefix + sentence(rnd, 1 + i % 12)
+        if i % 7 == 0:
+            text += ' (%1$d)'
+        if i % 11 == 0:
+            text += " \\'%2$s\\'"
+        items.append('<string name="%s">%s</string>' %
+                     (string_name(i), xml_escape(text)))
+    return items
+
+
+def attrs_values():
+    return [
+        '<declare-styleable name="Row">',
+        '    <attr name="rowId" format="reference" />',
+        '    <attr name="rowLabel" format="string|reference" />',
+        '    <attr name="rowSize" format="dimension" />',
+        '    <attr name="rowColor" format="color|reference" />',
+        '    <attr name="rowStyle" format="reference" />',
+        '    <attr name="rowWeight" format="integer" />',
+        '</declare-styleable>',
+    ]
+
+
+def style_name(chain, level):
+    return 'Chain%d' % chain + ''.join('.Level%d' % l
+                                       for l in range(1, level + 1))
+
+
+def style_values(args):
+    """Chains of styles, each one naming the previous one as its parent."""
+    items = []
+    for chain in range(args.styles):
+        for level in range(args.style_depth):
+            name = style_name(chain, level)
+            parent = ' parent="%s"' % style_name(chain, level - 1) if level else ''
+            items.append('<style name="%s"%s>' % (name, parent))
+            items.append('    <item name="rowSize">%ddp</item>' % (level + 1))
+            items.append('    <item name="rowWeight">%d</item>' % level)
+            if level % 2 == 0:
+                items.append('    <item name="rowColor">@color/c_%d</item>' %
+                             (level % 8))
+            items.append('</style>')
+    return items
+
+
+def misc_values():
+    items = ['<color name="c_%d">#ff%02x%02x%02x</color>' %
+             (i, i * 30, 255 - i * 30, 128) for i in range(8)]
+    items += ['<dimen name="d_%d">%ddp</dimen>' % (i, i * 4) for i in range(16)]
+    return items
+
+
+def view(args, rnd, depth, counter):
+    """The XML of a view and its children, "depth" levels deep."""
+    indent = '    ' * (args.layout_depth - depth)
+    counter[0] += 1
+    n = counter[0]
+    tag = 'com.example.generated.Row' if depth == 1 else 'com.example.generated.Column'
+    attrs = ['app:rowId="@+id/v_%d"' % n]
+    if args.strings:
+        attrs.append('app:rowLabel="@string/%s"' %
+                     string_name(rnd.randrange(args.strings)))
+    attrs.append('app:rowSize="@dimen/d_%d"' % (n % 16))
+    if args.styles and n % 3 == 0:
+        attrs.append('app:rowStyle="@style/%s"' %
+                     style_name(rnd.randrange(args.styles),
+                                rnd.randrange(args.style_depth)))
+    if args.nine_patches and n % 5 == 0:
+        attrs.append('app:rowColor="@drawable/np_%03d"' %
+                     rnd.randrange(args.nine_patches))
+    open_tag = '%s<%s %s' % (indent, tag, ('\n%s        ' % indent).join(attrs))
+    if depth == 1:
+        return open_tag + ' />\n'
+    children = ''.join(view(args, rnd, depth - 1, counter) for _ in range(FANOUT))
+    return '%s>\n%s%s</%s>\n' % (open_tag, children, indent, tag)
+
+
+def layout(args, rnd):
+    counter = [0]
+    body = view(args, rnd, max(args.layout_depth, 1), counter)
+    # The namespaces go on the root element.
+    first = body.index(' ')
+    return ('<?xml version="1.0" encoding="utf-8"?>\n' + body[:first] +
+            ' xmlns:app="http://schemas.android.com/apk/res-auto"' +
+            body[first:])
+
+
+def png_chunk(kind, data):
+    chunk = kind + data
+    return (struct.pack('>I', len(data)) + chunk +
+            struct.pack('>I', zlib.crc32(chunk) & 0xffffffff))
+
+
+def nine_patch(rnd, width, height):
+    """An RGBA 9-patch with stretch and padding marks on its border."""
+    black = b'\x00\x00\x00\xff'
+    clear = b'\x00\x00\x00\x00'
+    stretch_x = (width // 3, 2 * width // 3)
+    stretch_y = (height // 3, 2 * height // 3)
+    color = bytearray(rnd.randrange(256) for _ in range(3))
+    rows = []
+    for y in range(height + 2):
+        row = bytearray(b'\x00')    # filter type
+        for x in range(width + 2):
+            inside_x = 0 < x <= width
+            inside_y = 0 < y <= height
+            if inside_x and inside_y:
+                shade = (x * 255 // width) & 0xff
+                row += bytearray([color[0], color[1], shade, 255])
+            elif y == 0 and inside_x:
+                row += black if stretch_x[0] <= x <= stretch_x[1] else clear
+            elif x == 0 and inside_y:
+                row += black if stretch_y[0] <= y <= stretch_y[1] else clear
+            elif y == height + 1 and inside_x:
+                row += black if 2 < x < width - 1 else clear
+            elif x == width + 1 and inside_y:
+                row += black if 2 < y < height - 1 else clear
+            else:
+                row += clear
+        rows.append(bytes(row))
+    header = struct.pack('>IIBBBBB', width + 2, height + 2, 8, 6, 0, 0, 0)
+    return (b'\x89PNG\r\n\x1a\n' + png_chunk(b'IHDR', header) +
+            png_chunk(b'IDAT', zlib.compress(b''.join(rows))) +
+            png_chunk(b'IEND', b''))
+
+
+def asset(rnd, size):
+    """Half random bytes and half text, so that it deflates somewhat."""
+    half = size // 2
+    data = bytearray(rnd.randrange(256) for _ in range(half))
+    text = ' '.join(rnd.choice(WORDS) for _ in range(size // 4)).encode('ascii')
+    return bytes(data) + text[:size - half]
+
+
+def manifest():
+    return ('<?xml version="1.0" encoding="utf-8"?>\n'
+            '<manifest xmlns:android="http://schemas.android.com/apk/res/android"\n'
+            '        package="%s">\n'
+            '    <application />\n'
+            '</manifest>\n' % PACKAGE)
+
+
+def generate(args, output):
+    """Writes the project to "output", which must not exist yet.
+
+    Returns the resource directories, highest priority first, as aapt's -S
+    options want them.
+    """
+    rnd = random.Random(args.seed)
+    res = os.path.join(output, 'res')
+    write_file(os.path.join(output, 'AndroidManifest.xml'), manifest())
+
+    write_file(os.path.join(res, 'values', 'attrs.xml'),
+               values_file(attrs_values()))
+    write_file(os.path.join(res, 'values', 'values.xml'),
+               values_file(misc_values()))
+    write_file(os.path.join(res, 'values', 'styles.xml'),
+               values_file(style_values(args)))
+    write_file(os.path.join(res, 'values', 'strings.xml'),
+               values_file(string_values(rnd, args.strings, '')))
+    for locale in LOCALES[:args.locales]:
+        write_file(os.path.join(res, 'values-' + locale, 'strings.xml'),
+                   values_file(string_values(rnd, args.strings,
+                                             '[%s] ' % locale)))
+
+    for i in range(args.layouts):
+        write_file(os.path.join(res, 'layout', 'layout_%04d.xml' % i),
+                   layout(args, rnd))
+    for i in range(args.nine_patches):
+        write_file(os.path.join(res, 'drawable', 'np_%03d.9.png' % i),
+                   nine_patch(rnd, 16 + 8 * (i % 8), 16 + 4 * (i % 6)))
+    for i in range(args.assets):
+        write_file(os.path.join(output, 'assets', 'data', 'file_%04d.bin' % i),
+                   asset(rnd, args.asset_size))
+
+    # Each overlay replaces every tenth string and layout, offset so that
+    # the overlays replace different ones.
+    res_dirs = [res]
+    for overlay in range(1, args.overlays + 1):
+        overlay_res = os.path.join(output, 'overlay%d' % overlay, 'res')
+        strings = string_values(rnd, args.strings, '[overlay%d] ' % overlay)
+        write_file(os.path.join(overlay_res, 'values', 'strings.xml'),
+                   values_file(strings[overlay % 10::10]))
+        for i in range(overlay % 10, args.layouts, 10):
+            write_file(os.path.join(overlay_res, 'layout', 'layout_%04d.xml' % i),
+                       layout(args, rnd))
+        res_dirs.insert(0, overlay_res)
+    return res_dirs
+
+
+def main():
+    args = parse_args()
+    if args.locales > len(LOCALES):
+        sys.exit('At most %d locales are available.' % len(LOCALES))
+    if os.path.exists(args.output):
+        sys.exit('%s already exists.' % args.output)
+    res_dirs = generate(args, args.output)
+    print(' '.join('-S %s' % d for d in res_dirs))
+
+
+if __name__ == '__main__':
+    main()
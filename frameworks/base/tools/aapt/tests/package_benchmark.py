@@ -0,0 +1,233 @@
+#!/usr/bin/env python
+# Copyright (C) 2014 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""Time "aapt package" on generated projects of several sizes.
+
+For each scale, a project is generated with generate_project.py, with every
+count in its size options multiplied by the scale.  It is then packaged with
+each number of jobs, with --trace-output and --mem-stats, and the best of
+the repeats is reported:  the wall time, CPU time and peak RSS of the whole
+run, and for each stage on the main thread its wall time, the CPU time all
+threads used meanwhile and the peak RSS when it ended.
+
+Examples:
+
+Package the default project and 4 and 16 times larger ones, with 1 and 8
+jobs, three times each.
+
+$ ./package_benchmark.py --aapt=out/host/linux-x86/bin/aapt \\
+      --scales=1,4,16 --jobs=1,8
+
+Stages can also be written as tab-separated values.
+
+$ ./package_benchmark.py --aapt=aapt --scales=8 --output=stages.tsv
+"""
+
+from __future__ import print_function
+
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import generate_project
+
+# The generator's options that are counts of things, which --scales
+# multiplies.  Depths, sizes and locales stay as given.
+_SCALED_OPTIONS = ['layouts', 'strings', 'styles', 'nine_patches', 'assets']
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--aapt', default='aapt',
+                        help='aapt binary to run (default: %(default)s)')
+    parser.add_argument('--include', action='append', default=[],
+                        help='passed to aapt as -I')
+    parser.add_argument('--scales', default='1,4',
+                        help='comma-separated project sizes, as multiples of '
+                        'the size options (default: %(default)s)')
+    parser.add_argument('--jobs', default='1,4',
+                        help='comma-separated numbers of jobs '
+                        '(default: %(default)s)')
+    parser.add_argument('--repeat', type=int, default=3,
+                        help='runs of each configuration (default: %(default)s)')
+    parser.add_argument('--output', help='write the stages of every '
+                        'configuration to this file, as tab-separated values')
+    parser.add_argument('--keep', action='store_true',
+                        help='keep the generated projects')
+    parser.add_argument('-v', '--verbose', action='store_true',
+                        help='show every run')
+    generate_project.add_size_args(parser)
+    return parser.parse_args()
+
+
+def parse_list(text):
+    return [int(x) for x in text.split(',') if x]
+
+
+def run_aapt(args, project, res_dirs, jobs, workdir):
+    """Packages the project once.
+
+    Returns the wall and CPU seconds and peak RSS in bytes of the run, and
+    the stages as a list of
+    [name, count, wall seconds, CPU seconds or None, peak RSS or None].
+    """
+    trace = os.path.join(workdir, 'trace.json')
+    command = [args.aapt, 'package', '-f',
+               '-M', os.path.join(project, 'AndroidManifest.xml'),
+               '-A', os.path.join(project, 'assets'),
+               '-F', os.path.join(workdir, 'out.apk'),
+               '--jobs', str(jobs), '--trace-output', trace, '--mem-stats']
+    for res in res_dirs:
+        command += ['-S', res]
+    for include in args.include:
+        command += ['-I', include]
+
+    # The child is reaped here rather than by subprocess, for its rusage.
+    errors = os.path.join(workdir, 'stderr.txt')
+    with open(errors, 'w') as stderr:
+        start = time.time()
+        process = subprocess.Popen(command, stdout=subprocess.PIPE,
+                                   stderr=stderr, universal_newlines=True)
+        stdout = process.stdout.read()
+        _, status, usage = os.wait4(process.pid, 0)
+        wall = time.time() - start
+    if status != 0:
+        with open(errors) as f:
+            sys.exit('aapt failed:\n%s\n%s' % (' '.join(command), f.read()))
+
+    # ru_maxrss is in kilobytes on Linux and bytes on Mac OS.
+    peak_rss = usage.ru_maxrss * (1 if sys.platform == 'darwin' else 1024)
+    return (wall, usage.ru_utime + usage.ru_stime, peak_rss,
+            parse_stages(trace, parse_mem_stats(stdout)))
+
+
+def parse_mem_stats(stdout):
+    """Returns the peak RSS in bytes after each stage --mem-stats printed."""
+    peaks = {}
+    in_table = False
+    for line in stdout.splitlines():
+        if line.startswith('Memory held after each stage'):
+            in_table = True
+        elif in_table:
+            fields = line.split()
+            if len(fields) >= 2 and fields[0] not in ('stage', '(most'):
+                try:
+                    peaks[fields[0]] = float(fields[-1]) * 1024 * 1024
+                except ValueError:
+                    pass
+    return peaks
+
+
+def parse_stages(trace, peaks):
+    """Sums the main thread's spans by name, in the order they started.
+
+    The spans of other threads overlap the main thread's, and each other's,
+    so they are left out; their CPU time is in the main thread spans'.
+    """
+    with open(trace) as f:
+        events = json.load(f)['traceEvents']
+    spans = sorted((e for e in events if e['ph'] == 'X' and e['tid'] == 0),
+                   key=lambda e: e['ts'])
+    stages = []
+    by_name = {}
+    for span in spans:
+        name = span['name']
+        stage = by_name.get(name)
+        if stage is None:
+            stage = [name, 0, 0.0, None, peaks.get(name)]
+            by_name[name] = stage
+            stages.append(stage)
+        stage[1] += 1
+        stage[2] += span['dur'] / 1e6
+        cpu = span.get('args', {}).get('process_cpu_us')
+        if cpu is not None:
+            stage[3] = (stage[3] or 0.0) + cpu / 1e6
+    return stages
+
+
+def format_mb(value):
+    return '%.1f' % (value / (1024.0 * 1024.0)) if value is not None else '-'
+
+
+def format_ms(value):
+    return '%.1f' % (value * 1000) if value is not None else '-'
+
+
+def print_stages(stages):
+    print('  %-28s %6s %10s %10s %10s' %
+          ('stage', 'count', 'wall ms', 'cpu ms', 'peak MB'))
+    for name, count, wall, cpu, peak in stages:
+        print('  %-28s %6d %10s %10s %10s' %
+              (name, count, format_ms(wall), format_ms(cpu), format_mb(peak)))
+
+
+def main():
+    args = parse_args()
+    scales = parse_list(args.scales)
+    jobs_list = parse_list(args.jobs)
+    workdir = tempfile.mkdtemp(prefix='aapt-package-benchmark-')
+    tsv = open(args.output, 'w') if args.output else None
+    if tsv:
+        tsv.write('scale\tjobs\tstage\tcount\twall_ms\tcpu_ms\tpeak_rss_mb\n')
+    try:
+        for scale in scales:
+            size = argparse.Namespace(**vars(args))
+            for option in _SCALED_OPTIONS:
+                setattr(size, option, getattr(args, option) * scale)
+            project = os.path.join(workdir, 'scale%d' % scale)
+            res_dirs = generate_project.generate(size, project)
+            print('Scale %d: %d layouts, %d strings in %d locales, '
+                  '%d styles, %d 9-patches, %d assets, %d overlays' %
+                  (scale, size.layouts, size.strings, size.locales + 1,
+                   size.styles * size.style_depth, size.nine_patches,
+                   size.assets, size.overlays))
+
+            for jobs in jobs_list:
+                best = None
+                for i in range(args.repeat):
+                    result = run_aapt(args, project, res_dirs, jobs, workdir)
+                    if args.verbose:
+                        print('  run %d: %.3fs wall, %.3fs cpu, %s MB' %
+                              (i + 1, result[0], result[1], format_mb(result[2])))
+                    if best is None or result[0] < best[0]:
+                        best = result
+                wall, cpu, peak_rss, stages = best
+                print('jobs %d: %.3fs wall, %.3fs cpu, %s MB peak RSS' %
+                      (jobs, wall, cpu, format_mb(peak_rss)))
+                print_stages(stages)
+                if tsv:
+                    for name, count, stage_wall, stage_cpu, peak in stages:
+                        tsv.write('%d\t%d\t%s\t%d\t%s\t%s\t%s\n' %
+                                  (scale, jobs, name, count, format_ms(stage_wall),
+                                   format_ms(stage_cpu), format_mb(peak)))
+            print()
+    finally:
+        if tsv:
+            tsv.close()
+        if args.keep:
+            print('Projects kept in %s' % workdir)
+        else:
+            shutil.rmtree(workdir)
+
+
+if __name__ == '__main__':
+    main()
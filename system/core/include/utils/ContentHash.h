@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* A fast hash of file contents and other large buffers, for naming cache
+ * entries and finding duplicates.  It is XXH3 (64- and 128-bit, no seed),
+ * so the values match those of xxhsum -H3 and xxh128sum.  It is not a
+ * cryptographic hash: don't use it where someone might pick the input to
+ * collide with another.
+ **/
+
+#ifndef ANDROID_CONTENT_HASH_H
+#define ANDROID_CONTENT_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utils/String8.h>
+
+namespace android {
+
+struct ContentHash128 {
+    uint64_t low;
+    uint64_t high;
+
+    bool operator==(const ContentHash128& other) const {
+        return low == other.low && high == other.high;
+    }
+    bool operator!=(const ContentHash128& other) const { return !(*this == other); }
+
+    /* 32 lowercase hex digits, most significant first, as xxh128sum prints. */
+    String8 toString() const;
+};
+
+/*
+ * Hashes data given in any number of pieces; the result is the same as
+ * for the concatenation hashed at once.  Bulk input goes through SSE2,
+ * AVX2 or NEON kernels when the compiler and CPU have them.
+ */
+class ContentHasher {
+public:
+    ContentHasher() { reset(); }
+
+    /* Starts over with no input. */
+    void reset();
+
+    void update(const void* data, size_t size);
+
+    /* The hash of everything given so far; update() may go on after. */
+    uint64_t digest64() const;
+    ContentHash128 digest128() const;
+
+    static uint64_t hash64(const void* data, size_t size);
+    static ContentHash128 hash128(const void* data, size_t size);
+
+private:
+    enum {
+        kBufferSize = 256,      // whole stripes, held back until there are more
+    };
+
+    uint64_t mAcc[8];
+    uint8_t mBuffer[kBufferSize];
+    size_t mBufferedSize;
+    size_t mStripesSoFar;       // of the current block
+    uint64_t mTotalLen;
+
+    void digestLong(uint64_t* acc) const;
+};
+
+}
+
+#endif // ANDROID_CONTENT_HASH_H
@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HASHED_KEYED_VECTOR_H
+#define ANDROID_HASHED_KEYED_VECTOR_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <cutils/log.h>
+
+#include <utils/BasicHashtable.h>
+#include <utils/Errors.h>
+#include <utils/TypeHelpers.h>
+#include <utils/Vector.h>
+
+// ---------------------------------------------------------------------------
+
+namespace android {
+
+/*
+ * A map with the same interface as KeyedVector, but whose items stay in
+ * the order they were added, with a hash table on the side to find them.
+ * Adding a key and looking one up take constant time, where KeyedVector
+ * shifts its sorted array on every insert.
+ *
+ * Keys need hash_type() and operator==.  keyAt() and valueAt() index the
+ * items in insertion order; removing items renumbers the ones after them,
+ * which costs time linear in the size of the map.
+ */
+template <typename KEY, typename VALUE>
+class HashedKeyedVector
+{
+public:
+    typedef KEY    key_type;
+    typedef VALUE  value_type;
+
+    inline                  HashedKeyedVector();
+
+    /*
+     * empty the vector
+     */
+
+    inline  void            clear()                     { mVector.clear(); mIndex.clear(); }
+
+    /*!
+     * vector stats
+     */
+
+    //! returns number of items in the vector
+    inline  size_t          size() const                { return mVector.size(); }
+    //! returns whether or not the vector is empty
+    inline  bool            isEmpty() const             { return mVector.isEmpty(); }
+    //! returns how many items can be stored without reallocating the backing store
+    inline  size_t          capacity() const            { return mVector.capacity(); }
+    //! sets the capacity. capacity can never be reduced less than size()
+    inline ssize_t          setCapacity(size_t size)    { return mVector.setCapacity(size); }
+
+    /*!
+     * accessors
+     */
+            const VALUE&    valueFor(const KEY& key) const;
+            const VALUE&    valueAt(size_t index) const;
+            const KEY&      keyAt(size_t index) const;
+            ssize_t         indexOfKey(const KEY& key) const;
+            const VALUE&    operator[] (size_t index) const;
+
+    /*!
+     * modifying the array
+     */
+
+            VALUE&          editValueFor(const KEY& key);
+            VALUE&          editValueAt(size_t index);
+
+            /*!
+             * add/insert/replace items
+             */
+
+            //! adds the item at the end, or replaces the value of an existing key
+            ssize_t         add(const KEY& key, const VALUE& item);
+            ssize_t         add(const KEY& key, VALUE&& item);
+            ssize_t         replaceValueFor(const KEY& key, const VALUE& item);
+            ssize_t         replaceValueAt(size_t index, const VALUE& item);
+
+    /*!
+     * remove items
+     */
+
+            ssize_t         removeItem(const KEY& key);
+            ssize_t         removeItemsAt(size_t index, size_t count = 1);
+
+private:
+    // Where each key sits in mVector.
+    struct IndexEntry {
+        IndexEntry(const KEY& _key, size_t _index) : key(_key), index(_index) { }
+        const KEY& getKey() const { return key; }
+
+        KEY key;
+        size_t index;
+    };
+
+            ssize_t         findKey(const KEY& key, hash_t hash) const;
+            void            reindex();
+
+            Vector< key_value_pair_t<KEY, VALUE> >          mVector;
+            BasicHashtable<KEY, IndexEntry>                 mIndex;
+};
+
+// ---------------------------------------------------------------------------
+
+/**
+ * Variation of HashedKeyedVector that holds a default value to return when
+ * valueFor() is called with a key that doesn't exist.
+ */
+template <typename KEY, typename VALUE>
+class DefaultHashedKeyedVector : public HashedKeyedVector<KEY, VALUE>
+{
+public:
+    inline                  DefaultHashedKeyedVector(const VALUE& defValue = VALUE());
+            const VALUE&    valueFor(const KEY& key) const;
+
+private:
+            VALUE                                           mDefault;
+};
+
+// ---------------------------------------------------------------------------
+
+template<typename KEY, typename VALUE> inline
+HashedKeyedVector<KEY,VALUE>::HashedKeyedVector()
+{
+}
+
+template<typename KEY, typename VALUE> inline
+ssize_t HashedKeyedVector<KEY,VALUE>::findKey(const KEY& key, hash_t hash) const {
+    ssize_t idx = mIndex.find(-1, hash, key);
+    return idx >= 0 ? (ssize_t) mIndex.entryAt(idx).index : NAME_NOT_FOUND;
+}
+
+template<typename KEY, typename VALUE> inline
+ssize_t HashedKeyedVector<KEY,VALUE>::indexOfKey(const KEY& key) const {
+    return findKey(key, hash_type(key));
+}
+
+template<typename KEY, typename VALUE> inline
+const VALUE& HashedKeyedVector<KEY,VALUE>::valueFor(const KEY& key) const {
+    ssize_t i = this->indexOfKey(key);
+    LOG_ALWAYS_FATAL_IF(i<0, "%s: key not found", __PRETTY_FUNCTION__);
+    return mVector.itemAt(i).value;
+}
+
+template<typename KEY, typename VALUE> inline
+const VALUE& HashedKeyedVector<KEY,VALUE>::valueAt(size_t index) const {
+    return mVector.itemAt(index).value;
+}
+
+template<typename KEY, typename VALUE> inline
+const VALUE& HashedKeyedVector<KEY,VALUE>::operator[] (size_t index) const {
+    return valueAt(index);
+}
+
+template<typename KEY, typename VALUE> inline
+const KEY& HashedKeyedVector<KEY,VALUE>::keyAt(size_t index) const {
+    return mVector.itemAt(index).key;
+}
+
+template<typename KEY, typename VALUE> inline
+VALUE& HashedKeyedVector<KEY,VALUE>::editValueFor(const KEY& key) {
+    ssize_t i = this->indexOfKey(key);
+    LOG_ALWAYS_FATAL_IF(i<0, "%s: key not found", __PRETTY_FUNCTION__);
+    return mVector.editItemAt(i).value;
+}
+
+template<typename KEY, typename VALUE> inline
+VALUE& HashedKeyedVector<KEY,VALUE>::editValueAt(size_t index) {
+    return mVector.editItemAt(index).value;
+}
+
+template<typename KEY, typename VALUE> inline
+ssize_t HashedKeyedVector<KEY,VALUE>::add(const KEY& key, const VALUE& value) {
+    const hash_t hash = hash_type(key);
+    ssize_t i = findKey(key, hash);
+    if (i >= 0) {
+        mVector.editItemAt(i).value = value;
+        return i;
+    }
+    i = mVector.add(key_value_pair_t<KEY,VALUE>(key, value));
+    if (i >= 0) {
+        mIndex.add(hash, IndexEntry(key, i));
+    }
+    return i;
+}
+
+template<typename KEY, typename VALUE> inline
+ssize_t HashedKeyedVector<KEY,VALUE>::add(const KEY& key, VALUE&& value) {
+    const hash_t hash = hash_type(key);
+    ssize_t i = findKey(key, hash);
+    if (i >= 0) {
+        mVector.editItemAt(i).value = std::move(value);
+        return i;
+    }
+    i = mVector.add(key_value_pair_t<KEY,VALUE>(key, std::move(value)));
+    if (i >= 0) {
+        mIndex.add(hash, IndexEntry(key, i));
+    }
+    return i;
+}
+
+template<typename KEY, typename VALUE> inline
+ssize_t HashedKeyedVector<KEY,VALUE>::replaceValueFor(const KEY& key, const VALUE& value) {
+    return add(key, value);
+}
+
+template<typename KEY, typename VALUE> inline
+ssize_t HashedKeyedVector<KEY,VALUE>::replaceValueAt(size_t index, const VALUE& item) {
+    if (index<size()) {
+        mVector.editItemAt(index).value = item;
+        return index;
+    }
+    return BAD_INDEX;
+}
+
+template<typename KEY, typename VALUE> inline
+ssize_t HashedKeyedVector<KEY,VALUE>::removeItem(const KEY& key) {
+    ssize_t i = this->indexOfKey(key);
+    return i >= 0 ? removeItemsAt(i) : i;
+}
+
+template<typename KEY, typename VALUE> inline
+ssize_t HashedKeyedVector<KEY, VALUE>::removeItemsAt(size_t index, size_t count) {
+    ssize_t result = mVector.removeItemsAt(index, count);
+    if (result >= 0) {
+        reindex();
+    }
+    return result;
+}
+
+template<typename KEY, typename VALUE> inline
+void HashedKeyedVector<KEY, VALUE>::reindex() {
+    mIndex.clear();
+    const size_t N = mVector.size();
+    for (size_t i = 0; i < N; i++) {
+        const KEY& key = mVector.itemAt(i).key;
+        mIndex.add(hash_type(key), IndexEntry(key, i));
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+template<typename KEY, typename VALUE> inline
+DefaultHashedKeyedVector<KEY,VALUE>::DefaultHashedKeyedVector(const VALUE& defValue)
+    : mDefault(defValue)
+{
+}
+
+template<typename KEY, typename VALUE> inline
+const VALUE& DefaultHashedKeyedVector<KEY,VALUE>::valueFor(const KEY& key) const {
+    ssize_t i = this->indexOfKey(key);
+    return i >= 0 ? HashedKeyedVector<KEY,VALUE>::valueAt(i) : mDefault;
+}
+
+}; // namespace android
+
+// ---------------------------------------------------------------------------
+
+#endif // ANDROID_HASHED_KEYED_VECTOR_H
@@ -83,6 +83,7 @@ public:
              */
              
             ssize_t         add(const KEY& key, const VALUE& item);
+            ssize_t         add(const KEY& key, VALUE&& item);
             ssize_t         replaceValueFor(const KEY& key, const VALUE& item);
             ssize_t         replaceValueAt(size_t index, const VALUE& item);
 
@@ -177,6 +178,11 @@ ssize_t KeyedVector<KEY,VALUE>::add(const KEY& key, const VALUE& value) {
     return mVector.add( key_value_pair_t<KEY,VALUE>(key, value) );
 }
 
+template<typename KEY, typename VALUE> inline
+ssize_t KeyedVector<KEY,VALUE>::add(const KEY& key, VALUE&& value) {
+    return mVector.add( key_value_pair_t<KEY,VALUE>(key, std::move(value)) );
+}
+
 template<typename KEY, typename VALUE> inline
 ssize_t KeyedVector<KEY,VALUE>::replaceValueFor(const KEY& key, const VALUE& value) {
     key_value_pair_t<KEY,VALUE> pair(key, value);
@@ -86,6 +86,36 @@ public:
     
     //! returns wether or not we're the only owner
     inline          bool                    onlyOwner() const;
+
+    /*! count the bytes held by buffers allocated from now on, for memory
+     * reports.  buffers allocated before this are never counted.
+     */
+    static          void                    enableAccounting();
+
+    //! bytes held by counted buffers that have not been freed yet
+    static          size_t                  getAccountedBytes();
+
+    /*! keep buffers of up to kMaxPooledSize bytes in per-thread free
+     * lists by size, instead of going to malloc for each one.  the pooled
+     * memory is never given back, so this is for short-lived tools that
+     * make a great many small strings.  buffers allocated before this
+     * are freed as usual.  a no-op without pthreads.
+     */
+    static          void                    enablePooling();
+
+    enum {
+        kMaxPooledSize = 256
+    };
+
+    struct PoolStats {
+        uint64_t    allocs;         // buffers taken from the pool
+        uint64_t    frees;          // buffers put back
+        uint64_t    refills;        // times a thread's list of one size ran dry
+        size_t      reservedBytes;  // memory ever taken from malloc for the pool
+    };
+
+    //! totals over all threads, so far
+    static          void                    getPoolStats(PoolStats* outStats);
     
 
 private:
@@ -97,7 +127,8 @@ private:
         // 16 bytes. must be sized to preserve correct alignment.
         mutable int32_t        mRefs;
                 size_t         mSize;
-                uint32_t       mReserved[2];
+                uint32_t       mReserved[2];    // [0] is 1 if counted,
+                                                // [1] the pool size class + 1
 };
 
 // ---------------------------------------------------------------------------
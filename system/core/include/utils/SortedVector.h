@@ -45,11 +45,13 @@ public:
     
                             SortedVector();
                             SortedVector(const SortedVector<TYPE>& rhs);
+                            SortedVector(SortedVector<TYPE>&& rhs);
     virtual                 ~SortedVector();
 
     /*! copy operator */
     const SortedVector<TYPE>&   operator = (const SortedVector<TYPE>& rhs) const;    
     SortedVector<TYPE>&         operator = (const SortedVector<TYPE>& rhs);    
+    SortedVector<TYPE>&         operator = (SortedVector<TYPE>&& rhs);
 
     /*
      * empty the vector
@@ -105,6 +107,8 @@ public:
 
             //! add an item in the right place (and replace the one that is there)
             ssize_t         add(const TYPE& item);
+            //! same as add(), but moves the item into place
+            ssize_t         add(TYPE&& item);
             
             //! editItemAt() MUST NOT change the order of this item
             TYPE&           editItemAt(size_t index) {
@@ -146,7 +150,8 @@ SortedVector<TYPE>::SortedVector()
     : SortedVectorImpl(sizeof(TYPE),
                 ((traits<TYPE>::has_trivial_ctor   ? HAS_TRIVIAL_CTOR   : 0)
                 |(traits<TYPE>::has_trivial_dtor   ? HAS_TRIVIAL_DTOR   : 0)
-                |(traits<TYPE>::has_trivial_copy   ? HAS_TRIVIAL_COPY   : 0))
+                |(traits<TYPE>::has_trivial_copy   ? HAS_TRIVIAL_COPY   : 0)
+                |(traits<TYPE>::has_trivial_move   ? HAS_TRIVIAL_MOVE   : 0))
                 )
 {
 }
@@ -156,6 +161,11 @@ SortedVector<TYPE>::SortedVector(const SortedVector<TYPE>& rhs)
     : SortedVectorImpl(rhs) {
 }
 
+template<class TYPE> inline
+SortedVector<TYPE>::SortedVector(SortedVector<TYPE>&& rhs)
+    : SortedVectorImpl(std::move(rhs)) {
+}
+
 template<class TYPE> inline
 SortedVector<TYPE>::~SortedVector() {
     finish_vector();
@@ -167,6 +177,12 @@ SortedVector<TYPE>& SortedVector<TYPE>::operator = (const SortedVector<TYPE>& rh
     return *this; 
 }
 
+template<class TYPE> inline
+SortedVector<TYPE>& SortedVector<TYPE>::operator = (SortedVector<TYPE>&& rhs) {
+    SortedVectorImpl::operator = (std::move(rhs));
+    return *this;
+}
+
 template<class TYPE> inline
 const SortedVector<TYPE>& SortedVector<TYPE>::operator = (const SortedVector<TYPE>& rhs) const {
     SortedVectorImpl::operator = (rhs);
@@ -207,6 +223,25 @@ ssize_t SortedVector<TYPE>::add(const TYPE& item) {
     return SortedVectorImpl::add(&item);
 }
 
+template<class TYPE> inline
+ssize_t SortedVector<TYPE>::add(TYPE&& item) {
+    size_t order;
+    ssize_t index = _indexOrderOf(&item, &order);
+    if (index >= 0) {
+        // Replaced the way SortedVectorImpl::add() does, by reconstructing.
+        TYPE* existing = &editItemAt(index);
+        existing->~TYPE();
+        new(existing) TYPE(std::move(item));
+        return index;
+    }
+    void* where = VectorImpl::insertUninitializedAt(order, 1);
+    if (!where) {
+        return NO_MEMORY;
+    }
+    new(where) TYPE(std::move(item));
+    return order;
+}
+
 template<class TYPE> inline
 ssize_t SortedVector<TYPE>::indexOf(const TYPE& item) const {
     return SortedVectorImpl::indexOf(&item);
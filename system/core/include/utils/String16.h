@@ -17,6 +17,8 @@
 #ifndef ANDROID_STRING16_H
 #define ANDROID_STRING16_H
 
+#include <string.h>
+
 #include <utils/Errors.h>
 #include <utils/SharedBuffer.h>
 #include <utils/Unicode.h>
@@ -52,6 +54,7 @@ public:
                                 String16();
     explicit                    String16(StaticLinkage);
                                 String16(const String16& o);
+                                String16(String16&& o);
                                 String16(const String16& o,
                                          size_t len,
                                          size_t begin=0);
@@ -79,6 +82,7 @@ public:
             status_t            append(const char16_t* other, size_t len);
             
     inline  String16&           operator=(const String16& other);
+    inline  String16&           operator=(String16&& other);
     
     inline  String16&           operator+=(const String16& other);
     inline  String16            operator+(const String16& other) const;
@@ -126,6 +130,9 @@ private:
 // require any change to the underlying SharedBuffer contents or reference count.
 ANDROID_TRIVIAL_MOVE_TRAIT(String16)
 
+// Hashes the characters, for String16 keys in hashed containers.
+template <> hash_t hash_type(const String16& value);
+
 // ---------------------------------------------------------------------------
 // No user servicable parts below.
 
@@ -160,6 +167,15 @@ inline String16& String16::operator=(const String16& other)
     return *this;
 }
 
+// Swaps buffers, so neither string's reference count changes.
+inline String16& String16::operator=(String16&& other)
+{
+    const char16_t* str = mString;
+    mString = other.mString;
+    other.mString = str;
+    return *this;
+}
+
 inline String16& String16::operator+=(const String16& other)
 {
     append(other);
@@ -175,6 +191,9 @@ inline String16 String16::operator+(const String16& other) const
 
 inline int String16::compare(const String16& other) const
 {
+    if (mString == other.mString) {
+        return 0;
+    }
     return strzcmp16(mString, size(), other.mString, other.size());
 }
 
@@ -190,12 +209,18 @@ inline bool String16::operator<=(const String16& other) const
 
 inline bool String16::operator==(const String16& other) const
 {
-    return strzcmp16(mString, size(), other.mString, other.size()) == 0;
+    // Copies of one string share its buffer, and so are equal without
+    // looking at the characters; strings of different lengths never are.
+    if (mString == other.mString) {
+        return true;
+    }
+    const size_t len = size();
+    return len == other.size() && memcmp(mString, other.mString, len * sizeof(char16_t)) == 0;
 }
 
 inline bool String16::operator!=(const String16& other) const
 {
-    return strzcmp16(mString, size(), other.mString, other.size()) != 0;
+    return !(*this == other);
 }
 
 inline bool String16::operator>=(const String16& other) const
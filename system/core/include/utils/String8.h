@@ -48,6 +48,7 @@ public:
                                 String8();
     explicit                    String8(StaticLinkage);
                                 String8(const String8& o);
+                                String8(String8&& o);
     explicit                    String8(const char* o);
     explicit                    String8(const char* o, size_t numChars);
     
@@ -96,6 +97,7 @@ public:
             void                getUtf32(char32_t* dst) const;
 
     inline  String8&            operator=(const String8& other);
+    inline  String8&            operator=(String8&& other);
     inline  String8&            operator=(const char* other);
     
     inline  String8&            operator+=(const String8& other);
@@ -241,6 +243,9 @@ private:
 // require any change to the underlying SharedBuffer contents or reference count.
 ANDROID_TRIVIAL_MOVE_TRAIT(String8)
 
+// Hashes the characters, for String8 keys in hashed containers.
+template <> hash_t hash_type(const String8& value);
+
 // ---------------------------------------------------------------------------
 // No user servicable parts below.
 
@@ -299,6 +304,15 @@ inline String8& String8::operator=(const String8& other)
     return *this;
 }
 
+// Swaps buffers, so neither string's reference count changes.
+inline String8& String8::operator=(String8&& other)
+{
+    const char* str = mString;
+    mString = other.mString;
+    other.mString = str;
+    return *this;
+}
+
 inline String8& String8::operator=(const char* other)
 {
     setTo(other);
@@ -62,8 +62,10 @@ public:
 
     sp(T* other);
     sp(const sp<T>& other);
+    sp(sp<T>&& other);
     template<typename U> sp(U* other);
     template<typename U> sp(const sp<U>& other);
+    template<typename U> sp(sp<U>&& other);
 
     ~sp();
 
@@ -71,8 +73,10 @@ public:
 
     sp& operator = (T* other);
     sp& operator = (const sp<T>& other);
+    sp& operator = (sp<T>&& other);
 
     template<typename U> sp& operator = (const sp<U>& other);
+    template<typename U> sp& operator = (sp<U>&& other);
     template<typename U> sp& operator = (U* other);
 
     //! Special optimization for use by ProcessState (and nobody else).
@@ -123,6 +127,14 @@ sp<T>::sp(const sp<T>& other)
         m_ptr->incStrong(this);
 }
 
+// Moving takes over the other pointer's reference, without touching the
+// object's reference counts.
+template<typename T>
+sp<T>::sp(sp<T>&& other)
+        : m_ptr(other.m_ptr) {
+    other.m_ptr = 0;
+}
+
 template<typename T> template<typename U>
 sp<T>::sp(U* other)
         : m_ptr(other) {
@@ -137,6 +149,12 @@ sp<T>::sp(const sp<U>& other)
         m_ptr->incStrong(this);
 }
 
+template<typename T> template<typename U>
+sp<T>::sp(sp<U>&& other)
+        : m_ptr(other.m_ptr) {
+    other.m_ptr = 0;
+}
+
 template<typename T>
 sp<T>::~sp() {
     if (m_ptr)
@@ -154,6 +172,18 @@ sp<T>& sp<T>::operator =(const sp<T>& other) {
     return *this;
 }
 
+template<typename T>
+sp<T>& sp<T>::operator =(sp<T>&& other) {
+    if (this != &other) {
+        T* oldPtr(m_ptr);
+        m_ptr = other.m_ptr;
+        other.m_ptr = 0;
+        if (oldPtr)
+            oldPtr->decStrong(this);
+    }
+    return *this;
+}
+
 template<typename T>
 sp<T>& sp<T>::operator =(T* other) {
     if (other)
@@ -175,6 +205,16 @@ sp<T>& sp<T>::operator =(const sp<U>& other) {
     return *this;
 }
 
+template<typename T> template<typename U>
+sp<T>& sp<T>::operator =(sp<U>&& other) {
+    T* oldPtr(m_ptr);
+    m_ptr = other.m_ptr;
+    other.m_ptr = 0;
+    if (oldPtr)
+        oldPtr->decStrong(this);
+    return *this;
+}
+
 template<typename T> template<typename U>
 sp<T>& sp<T>::operator =(U* other) {
     if (other)
@@ -21,6 +21,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <sys/types.h>
+#include <utility>
 
 // ---------------------------------------------------------------------------
 
@@ -191,7 +192,8 @@ void move_forward_type(TYPE* d, const TYPE* s, size_t n = 1) {
             n--;
             --d, --s;
             if (!traits<TYPE>::has_trivial_copy) {
-                new(d) TYPE(*s);
+                // The source is destroyed right after, so it can be moved from.
+                new(d) TYPE(std::move(*const_cast<TYPE*>(s)));
             } else {
                 *d = *s;   
             }
@@ -212,7 +214,8 @@ void move_backward_type(TYPE* d, const TYPE* s, size_t n = 1) {
         while (n > 0) {
             n--;
             if (!traits<TYPE>::has_trivial_copy) {
-                new(d) TYPE(*s);
+                // The source is destroyed right after, so it can be moved from.
+                new(d) TYPE(std::move(*const_cast<TYPE*>(s)));
             } else {
                 *d = *s;   
             }
@@ -239,8 +242,13 @@ struct key_value_pair_t {
     VALUE   value;
     key_value_pair_t() { }
     key_value_pair_t(const key_value_pair_t& o) : key(o.key), value(o.value) { }
+    key_value_pair_t(key_value_pair_t&& o)
+        : key(std::move(o.key)), value(std::move(o.value)) { }
     key_value_pair_t(const KEY& k, const VALUE& v) : key(k), value(v)  { }
+    key_value_pair_t(const KEY& k, VALUE&& v) : key(k), value(std::move(v))  { }
     key_value_pair_t(const KEY& k) : key(k) { }
+    key_value_pair_t& operator = (const key_value_pair_t& o) = default;
+    key_value_pair_t& operator = (key_value_pair_t&& o) = default;
     inline bool operator < (const key_value_pair_t& o) const {
         return strictly_order_type(key, o.key);
     }
@@ -51,12 +51,14 @@ public:
     
                             Vector();
                             Vector(const Vector<TYPE>& rhs);
+                            Vector(Vector<TYPE>&& rhs);
     explicit                Vector(const SortedVector<TYPE>& rhs);
     virtual                 ~Vector();
 
     /*! copy operator */
             const Vector<TYPE>&     operator = (const Vector<TYPE>& rhs) const;
             Vector<TYPE>&           operator = (const Vector<TYPE>& rhs);    
+            Vector<TYPE>&           operator = (Vector<TYPE>&& rhs);
 
             const Vector<TYPE>&     operator = (const SortedVector<TYPE>& rhs) const;
             Vector<TYPE>&           operator = (const SortedVector<TYPE>& rhs);
@@ -146,10 +148,20 @@ public:
     inline  void            push();
     //! pushes an item on the top of the stack
             void            push(const TYPE& item);
+    //! pushes an item on the top of the stack, moving it there
+            void            push(TYPE&& item);
     //! same as push() but returns the index the item was added at (or an error)
     inline  ssize_t         add();
     //! same as push() but returns the index the item was added at (or an error)
             ssize_t         add(const TYPE& item);            
+    //! same as push() but returns the index the item was added at (or an error)
+            ssize_t         add(TYPE&& item);
+    //! adds an item constructed in place from the given arguments
+    template<typename... Args>
+            ssize_t         emplace(Args&&... args);
+    //! inserts an item constructed in place from the given arguments
+    template<typename... Args>
+            ssize_t         emplaceAt(size_t index, Args&&... args);
     //! replace an item with a new one initialized with its default constructor
     inline  ssize_t         replaceAt(size_t index);
     //! replace an item with a new one
@@ -192,6 +204,7 @@ public:
      inline void reserve(size_t n) { setCapacity(n); }
      inline bool empty() const{ return isEmpty(); }
      inline void push_back(const TYPE& item)  { insertAt(item, size(), 1); }
+     inline void push_back(TYPE&& item)       { add(std::move(item)); }
      inline void push_front(const TYPE& item) { insertAt(item, 0, 1); }
      inline iterator erase(iterator pos) {
          ssize_t index = removeItemsAt(pos-array());
@@ -220,7 +233,8 @@ Vector<TYPE>::Vector()
     : VectorImpl(sizeof(TYPE),
                 ((traits<TYPE>::has_trivial_ctor   ? HAS_TRIVIAL_CTOR   : 0)
                 |(traits<TYPE>::has_trivial_dtor   ? HAS_TRIVIAL_DTOR   : 0)
-                |(traits<TYPE>::has_trivial_copy   ? HAS_TRIVIAL_COPY   : 0))
+                |(traits<TYPE>::has_trivial_copy   ? HAS_TRIVIAL_COPY   : 0)
+                |(traits<TYPE>::has_trivial_move   ? HAS_TRIVIAL_MOVE   : 0))
                 )
 {
 }
@@ -230,6 +244,11 @@ Vector<TYPE>::Vector(const Vector<TYPE>& rhs)
     : VectorImpl(rhs) {
 }
 
+template<class TYPE> inline
+Vector<TYPE>::Vector(Vector<TYPE>&& rhs)
+    : VectorImpl(std::move(rhs)) {
+}
+
 template<class TYPE> inline
 Vector<TYPE>::Vector(const SortedVector<TYPE>& rhs)
     : VectorImpl(static_cast<const VectorImpl&>(rhs)) {
@@ -246,6 +265,12 @@ Vector<TYPE>& Vector<TYPE>::operator = (const Vector<TYPE>& rhs) {
     return *this; 
 }
 
+template<class TYPE> inline
+Vector<TYPE>& Vector<TYPE>::operator = (Vector<TYPE>&& rhs) {
+    VectorImpl::operator = (std::move(rhs));
+    return *this;
+}
+
 template<class TYPE> inline
 const Vector<TYPE>& Vector<TYPE>::operator = (const Vector<TYPE>& rhs) const {
     VectorImpl::operator = (static_cast<const VectorImpl&>(rhs));
@@ -338,6 +363,32 @@ ssize_t Vector<TYPE>::add(const TYPE& item) {
     return VectorImpl::add(&item);
 }
 
+template<class TYPE> inline
+void Vector<TYPE>::push(TYPE&& item) {
+    emplaceAt(size(), std::move(item));
+}
+
+template<class TYPE> inline
+ssize_t Vector<TYPE>::add(TYPE&& item) {
+    return emplaceAt(size(), std::move(item));
+}
+
+template<class TYPE> template<typename... Args> inline
+ssize_t Vector<TYPE>::emplace(Args&&... args) {
+    return emplaceAt(size(), std::forward<Args>(args)...);
+}
+
+template<class TYPE> template<typename... Args> inline
+ssize_t Vector<TYPE>::emplaceAt(size_t index, Args&&... args) {
+    if (index > size())
+        return BAD_INDEX;
+    void* where = VectorImpl::insertUninitializedAt(index, 1);
+    if (!where)
+        return NO_MEMORY;
+    new(where) TYPE(std::forward<Args>(args)...);
+    return index;
+}
+
 template<class TYPE> inline
 ssize_t Vector<TYPE>::replaceAt(const TYPE& item, size_t index) {
     return VectorImpl::replaceAt(&item, index);
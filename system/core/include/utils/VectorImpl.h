@@ -44,16 +44,19 @@ public:
         HAS_TRIVIAL_CTOR    = 0x00000001,
         HAS_TRIVIAL_DTOR    = 0x00000002,
         HAS_TRIVIAL_COPY    = 0x00000004,
+        HAS_TRIVIAL_MOVE    = 0x00000008,
     };
 
                             VectorImpl(size_t itemSize, uint32_t flags);
                             VectorImpl(const VectorImpl& rhs);
+                            VectorImpl(VectorImpl&& rhs);
     virtual                 ~VectorImpl();
 
     /*! must be called from subclasses destructor */
             void            finish_vector();
 
             VectorImpl&     operator = (const VectorImpl& rhs);    
+            VectorImpl&     operator = (VectorImpl&& rhs);
             
     /*! C-style array access */
     inline  const void*     arrayImpl() const       { return mStorage; }
@@ -99,6 +102,10 @@ protected:
             size_t          itemSize() const;
             void            release_storage();
 
+    /*! makes room for numItems at 'where', and returns their storage for
+     *  the caller to construct them in; NULL if out of memory */
+            void*           insertUninitializedAt(size_t where, size_t numItems = 1);
+
     virtual void            do_construct(void* storage, size_t num) const = 0;
     virtual void            do_destroy(void* storage, size_t num) const = 0;
     virtual void            do_copy(void* dest, const void* from, size_t num) const = 0;
@@ -107,6 +114,7 @@ protected:
     virtual void            do_move_backward(void* dest, const void* from, size_t num) const = 0;
     
 private:
+        bool  canResizeInPlace(size_t where) const;
         void* _grow(size_t where, size_t amount);
         void  _shrink(size_t where, size_t amount);
 
@@ -133,9 +141,12 @@ class SortedVectorImpl : public VectorImpl
 public:
                             SortedVectorImpl(size_t itemSize, uint32_t flags);
                             SortedVectorImpl(const VectorImpl& rhs);
+                            SortedVectorImpl(const SortedVectorImpl& rhs);
+                            SortedVectorImpl(SortedVectorImpl&& rhs);
     virtual                 ~SortedVectorImpl();
     
     SortedVectorImpl&     operator = (const SortedVectorImpl& rhs);    
+    SortedVectorImpl&     operator = (SortedVectorImpl&& rhs);
 
     //! finds the index of an item
             ssize_t         indexOf(const void* item) const;
@@ -146,7 +157,8 @@ public:
     //! add an item in the right place (or replaces it if there is one)
             ssize_t         add(const void* item);
 
-    //! merges a vector into this one
+    //! merges a vector into this one, sorting it rather than adding
+    //! its items one at a time; of equal items, the last one wins
             ssize_t         merge(const VectorImpl& vector);
             ssize_t         merge(const SortedVectorImpl& vector);
              
@@ -156,9 +168,11 @@ public:
 protected:
     virtual int             do_compare(const void* lhs, const void* rhs) const = 0;
 
-private:
             ssize_t         _indexOrderOf(const void* item, size_t* order = 0) const;
 
+private:
+            void            _sortItems(const void** items, const void** scratch, size_t count) const;
+
             // these are made private, because they can't be used on a SortedVector
             // (they don't have an implementation either)
             ssize_t         add();
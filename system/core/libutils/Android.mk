@@ -18,6 +18,7 @@ commonSources:= \
 	BasicHashtable.cpp \
 	BlobCache.cpp \
 	CallStack.cpp \
+	ContentHash.cpp \
 	FileMap.cpp \
 	JenkinsHash.cpp \
 	LinearAllocator.cpp \
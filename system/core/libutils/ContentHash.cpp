@@ -0,0 +1,699 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* XXH3, after the reference implementation by Yann Collet, limited to the
+ * default secret and no seed.
+ **/
+
+#include <utils/ContentHash.h>
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2_HASH 1
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+// Compiled for AVX2 on its own, and only called if the CPU has it.
+#include <immintrin.h>
+#define HAVE_AVX2_HASH 1
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HAVE_NEON_HASH 1
+#endif
+
+namespace android {
+
+static const uint32_t kPrime32_1 = 0x9E3779B1U;
+static const uint32_t kPrime32_2 = 0x85EBCA77U;
+static const uint32_t kPrime32_3 = 0xC2B2AE3DU;
+static const uint64_t kPrime64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t kPrime64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t kPrime64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t kPrime64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t kPrime64_5 = 0x27D4EB2F165667C5ULL;
+static const uint64_t kPrimeMx1 = 0x165667919E3779F9ULL;
+static const uint64_t kPrimeMx2 = 0x9FB21C651E98DF25ULL;
+
+static const size_t kStripeLen = 64;
+static const size_t kSecretConsumeRate = 8;    // secret bytes each stripe moves on
+static const size_t kMidSizeMax = 240;         // longer input goes through the stripes
+static const size_t kSecretSizeMin = 136;
+static const size_t kMidSizeStartOffset = 3;
+static const size_t kMidSizeLastOffset = 17;
+static const size_t kSecretLastAccStart = 7;
+static const size_t kSecretMergeAccsStart = 11;
+
+static const uint8_t kSecret[192] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+// The secret minus the last stripe, whose bytes scramble the accumulators.
+static const size_t kSecretLimit = sizeof(kSecret) - kStripeLen;
+static const size_t kStripesPerBlock = kSecretLimit / kSecretConsumeRate;
+
+static inline uint32_t readLE32(const uint8_t* p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16)
+            | ((uint32_t) p[3] << 24);
+}
+
+static inline uint64_t readLE64(const uint8_t* p)
+{
+    return (uint64_t) readLE32(p) | ((uint64_t) readLE32(p + 4) << 32);
+}
+
+static inline uint32_t swap32(uint32_t x)
+{
+    return ((x << 24) & 0xff000000) | ((x << 8) & 0x00ff0000)
+            | ((x >> 8) & 0x0000ff00) | ((x >> 24) & 0x000000ff);
+}
+
+static inline uint64_t swap64(uint64_t x)
+{
+    return ((uint64_t) swap32((uint32_t) x) << 32) | swap32((uint32_t) (x >> 32));
+}
+
+static inline uint32_t rotl32(uint32_t x, int r)
+{
+    return (x << r) | (x >> (32 - r));
+}
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xorshift64(uint64_t v, int shift)
+{
+    return v ^ (v >> shift);
+}
+
+static inline ContentHash128 mult64to128(uint64_t lhs, uint64_t rhs)
+{
+    ContentHash128 r;
+#if defined(__SIZEOF_INT128__)
+    const unsigned __int128 product = (unsigned __int128) lhs * rhs;
+    r.low = (uint64_t) product;
+    r.high = (uint64_t) (product >> 64);
+#else
+    const uint64_t loLo = (lhs & 0xffffffff) * (rhs & 0xffffffff);
+    const uint64_t hiLo = (lhs >> 32) * (rhs & 0xffffffff);
+    const uint64_t loHi = (lhs & 0xffffffff) * (rhs >> 32);
+    const uint64_t hiHi = (lhs >> 32) * (rhs >> 32);
+    const uint64_t cross = (loLo >> 32) + (hiLo & 0xffffffff) + loHi;
+    r.high = (hiLo >> 32) + (cross >> 32) + hiHi;
+    r.low = (cross << 32) | (loLo & 0xffffffff);
+#endif
+    return r;
+}
+
+static inline uint64_t mul128Fold64(uint64_t lhs, uint64_t rhs)
+{
+    const ContentHash128 product = mult64to128(lhs, rhs);
+    return product.low ^ product.high;
+}
+
+static uint64_t xxh64Avalanche(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= kPrime64_2;
+    h ^= h >> 29;
+    h *= kPrime64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static uint64_t avalanche(uint64_t h)
+{
+    h = xorshift64(h, 37);
+    h *= kPrimeMx1;
+    return xorshift64(h, 32);
+}
+
+static uint64_t rrmxmx(uint64_t h, uint64_t len)
+{
+    h ^= rotl64(h, 49) ^ rotl64(h, 24);
+    h *= kPrimeMx2;
+    h ^= (h >> 35) + len;
+    h *= kPrimeMx2;
+    return xorshift64(h, 28);
+}
+
+static inline uint64_t mix16B(const uint8_t* input, const uint8_t* secret)
+{
+    return mul128Fold64(readLE64(input) ^ readLE64(secret),
+            readLE64(input + 8) ^ readLE64(secret + 8));
+}
+
+// ---------------------------------------------------------------------------
+// Up to kMidSizeMax bytes, hashed whole.
+
+static uint64_t hashShort64(const uint8_t* input, size_t len)
+{
+    const uint8_t* secret = kSecret;
+    if (len > 8) {
+        const uint64_t lo = readLE64(input) ^ (readLE64(secret + 24) ^ readLE64(secret + 32));
+        const uint64_t hi = readLE64(input + len - 8)
+                ^ (readLE64(secret + 40) ^ readLE64(secret + 48));
+        return avalanche(len + swap64(lo) + hi + mul128Fold64(lo, hi));
+    }
+    if (len >= 4) {
+        const uint64_t input64 = readLE32(input + len - 4)
+                + ((uint64_t) readLE32(input) << 32);
+        return rrmxmx(input64 ^ (readLE64(secret + 8) ^ readLE64(secret + 16)), len);
+    }
+    if (len > 0) {
+        const uint32_t combined = ((uint32_t) input[0] << 16) | ((uint32_t) input[len >> 1] << 24)
+                | (uint32_t) input[len - 1] | ((uint32_t) len << 8);
+        return xxh64Avalanche(combined ^ (uint64_t) (readLE32(secret) ^ readLE32(secret + 4)));
+    }
+    return xxh64Avalanche(readLE64(secret + 56) ^ readLE64(secret + 64));
+}
+
+static uint64_t hashMid64(const uint8_t* input, size_t len)
+{
+    const uint8_t* secret = kSecret;
+    uint64_t acc = len * kPrime64_1;
+    if (len <= 128) {
+        if (len > 32) {
+            if (len > 64) {
+                if (len > 96) {
+                    acc += mix16B(input + 48, secret + 96);
+                    acc += mix16B(input + len - 64, secret + 112);
+                }
+                acc += mix16B(input + 32, secret + 64);
+                acc += mix16B(input + len - 48, secret + 80);
+            }
+            acc += mix16B(input + 16, secret + 32);
+            acc += mix16B(input + len - 32, secret + 48);
+        }
+        acc += mix16B(input, secret);
+        acc += mix16B(input + len - 16, secret + 16);
+        return avalanche(acc);
+    }
+
+    for (size_t i = 0; i < 8; i++) {
+        acc += mix16B(input + 16 * i, secret + 16 * i);
+    }
+    uint64_t accEnd = mix16B(input + len - 16, secret + kSecretSizeMin - kMidSizeLastOffset);
+    acc = avalanche(acc);
+    for (size_t i = 8; i < len / 16; i++) {
+        accEnd += mix16B(input + 16 * i, secret + 16 * (i - 8) + kMidSizeStartOffset);
+    }
+    return avalanche(acc + accEnd);
+}
+
+static inline ContentHash128 mix32B(ContentHash128 acc, const uint8_t* input1,
+        const uint8_t* input2, const uint8_t* secret)
+{
+    acc.low += mix16B(input1, secret);
+    acc.low ^= readLE64(input2) + readLE64(input2 + 8);
+    acc.high += mix16B(input2, secret + 16);
+    acc.high ^= readLE64(input1) + readLE64(input1 + 8);
+    return acc;
+}
+
+static ContentHash128 hashShort128(const uint8_t* input, size_t len)
+{
+    const uint8_t* secret = kSecret;
+    ContentHash128 h;
+    if (len > 8) {
+        const uint64_t flipLo = readLE64(secret + 32) ^ readLE64(secret + 40);
+        const uint64_t flipHi = readLE64(secret + 48) ^ readLE64(secret + 56);
+        const uint64_t inputLo = readLE64(input);
+        uint64_t inputHi = readLE64(input + len - 8);
+        ContentHash128 m = mult64to128(inputLo ^ inputHi ^ flipLo, kPrime64_1);
+        m.low += (uint64_t) (len - 1) << 54;
+        inputHi ^= flipHi;
+        m.high += inputHi + (uint64_t) (uint32_t) inputHi * (kPrime32_2 - 1);
+        m.low ^= swap64(m.high);
+        h = mult64to128(m.low, kPrime64_2);
+        h.high += m.high * kPrime64_2;
+        h.low = avalanche(h.low);
+        h.high = avalanche(h.high);
+        return h;
+    }
+    if (len >= 4) {
+        const uint64_t input64 = readLE32(input) + ((uint64_t) readLE32(input + len - 4) << 32);
+        const uint64_t keyed = input64 ^ (readLE64(secret + 16) ^ readLE64(secret + 24));
+        h = mult64to128(keyed, kPrime64_1 + (len << 2));
+        h.high += h.low << 1;
+        h.low ^= h.high >> 3;
+        h.low = xorshift64(h.low, 35);
+        h.low *= kPrimeMx2;
+        h.low = xorshift64(h.low, 28);
+        h.high = avalanche(h.high);
+        return h;
+    }
+    if (len > 0) {
+        const uint32_t combinedLo = ((uint32_t) input[0] << 16)
+                | ((uint32_t) input[len >> 1] << 24) | (uint32_t) input[len - 1]
+                | ((uint32_t) len << 8);
+        const uint32_t combinedHi = rotl32(swap32(combinedLo), 13);
+        h.low = xxh64Avalanche(combinedLo ^ (uint64_t) (readLE32(secret) ^ readLE32(secret + 4)));
+        h.high = xxh64Avalanche(combinedHi
+                ^ (uint64_t) (readLE32(secret + 8) ^ readLE32(secret + 12)));
+        return h;
+    }
+    h.low = xxh64Avalanche(readLE64(secret + 64) ^ readLE64(secret + 72));
+    h.high = xxh64Avalanche(readLE64(secret + 80) ^ readLE64(secret + 88));
+    return h;
+}
+
+static ContentHash128 hashMid128(const uint8_t* input, size_t len)
+{
+    const uint8_t* secret = kSecret;
+    ContentHash128 acc;
+    acc.low = len * kPrime64_1;
+    acc.high = 0;
+    if (len <= 128) {
+        if (len > 32) {
+            if (len > 64) {
+                if (len > 96) {
+                    acc = mix32B(acc, input + 48, input + len - 64, secret + 96);
+                }
+                acc = mix32B(acc, input + 32, input + len - 48, secret + 64);
+            }
+            acc = mix32B(acc, input + 16, input + len - 32, secret + 32);
+        }
+        acc = mix32B(acc, input, input + len - 16, secret);
+    } else {
+        for (size_t i = 32; i < 160; i += 32) {
+            acc = mix32B(acc, input + i - 32, input + i - 16, secret + i - 32);
+        }
+        acc.low = avalanche(acc.low);
+        acc.high = avalanche(acc.high);
+        for (size_t i = 160; i <= len; i += 32) {
+            acc = mix32B(acc, input + i - 32, input + i - 16,
+                    secret + kMidSizeStartOffset + i - 160);
+        }
+        acc = mix32B(acc, input + len - 16, input + len - 32,
+                secret + kSecretSizeMin - kMidSizeLastOffset - 16);
+    }
+
+    ContentHash128 h;
+    h.low = avalanche(acc.low + acc.high);
+    h.high = (uint64_t) 0 - avalanche(acc.low * kPrime64_1 + acc.high * kPrime64_4
+            + len * kPrime64_2);
+    return h;
+}
+
+// ---------------------------------------------------------------------------
+// Longer input, in 64-byte stripes through eight accumulators.
+
+typedef void (*AccumulateFunc)(uint64_t* acc, const uint8_t* input, const uint8_t* secret,
+        size_t stripes);
+typedef void (*ScrambleFunc)(uint64_t* acc, const uint8_t* secret);
+
+#if !HAVE_SSE2_HASH && !HAVE_NEON_HASH
+static void accumulateScalar(uint64_t* acc, const uint8_t* input, const uint8_t* secret,
+        size_t stripes)
+{
+    for (size_t n = 0; n < stripes; n++) {
+        const uint8_t* in = input + n * kStripeLen;
+        const uint8_t* key = secret + n * kSecretConsumeRate;
+        for (size_t i = 0; i < 8; i++) {
+            const uint64_t data = readLE64(in + 8 * i);
+            const uint64_t dataKey = data ^ readLE64(key + 8 * i);
+            acc[i ^ 1] += data;
+            acc[i] += (dataKey & 0xffffffff) * (dataKey >> 32);
+        }
+    }
+}
+
+static void scrambleScalar(uint64_t* acc, const uint8_t* secret)
+{
+    for (size_t i = 0; i < 8; i++) {
+        uint64_t a = xorshift64(acc[i], 47);
+        a ^= readLE64(secret + 8 * i);
+        acc[i] = a * kPrime32_1;
+    }
+}
+#endif
+
+#if HAVE_SSE2_HASH
+static void accumulateSse2(uint64_t* acc, const uint8_t* input, const uint8_t* secret,
+        size_t stripes)
+{
+    __m128i a[4];
+    for (size_t i = 0; i < 4; i++) {
+        a[i] = _mm_loadu_si128((const __m128i*) acc + i);
+    }
+    for (size_t n = 0; n < stripes; n++) {
+        const __m128i* in = (const __m128i*) (input + n * kStripeLen);
+        const __m128i* key = (const __m128i*) (secret + n * kSecretConsumeRate);
+        for (size_t i = 0; i < 4; i++) {
+            const __m128i data = _mm_loadu_si128(in + i);
+            const __m128i dataKey = _mm_xor_si128(data, _mm_loadu_si128(key + i));
+            // The high half of each lane times its low half.
+            const __m128i product = _mm_mul_epu32(dataKey,
+                    _mm_shuffle_epi32(dataKey, _MM_SHUFFLE(0, 3, 0, 1)));
+            const __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+            a[i] = _mm_add_epi64(a[i], _mm_add_epi64(product, swapped));
+        }
+    }
+    for (size_t i = 0; i < 4; i++) {
+        _mm_storeu_si128((__m128i*) acc + i, a[i]);
+    }
+}
+
+static void scrambleSse2(uint64_t* acc, const uint8_t* secret)
+{
+    const __m128i prime = _mm_set1_epi32((int) kPrime32_1);
+    for (size_t i = 0; i < 4; i++) {
+        __m128i a = _mm_loadu_si128((const __m128i*) acc + i);
+        a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+        a = _mm_xor_si128(a, _mm_loadu_si128((const __m128i*) secret + i));
+        const __m128i lo = _mm_mul_epu32(a, prime);
+        const __m128i hi = _mm_mul_epu32(_mm_shuffle_epi32(a, _MM_SHUFFLE(0, 3, 0, 1)), prime);
+        _mm_storeu_si128((__m128i*) acc + i, _mm_add_epi64(lo, _mm_slli_epi64(hi, 32)));
+    }
+}
+#endif
+
+#if HAVE_AVX2_HASH
+// The same as the SSE2 kernels, a half stripe at a time.
+__attribute__((target("avx2")))
+static void accumulateAvx2(uint64_t* acc, const uint8_t* input, const uint8_t* secret,
+        size_t stripes)
+{
+    __m256i a0 = _mm256_loadu_si256((const __m256i*) acc);
+    __m256i a1 = _mm256_loadu_si256((const __m256i*) acc + 1);
+    for (size_t n = 0; n < stripes; n++) {
+        const __m256i* in = (const __m256i*) (input + n * kStripeLen);
+        const __m256i* key = (const __m256i*) (secret + n * kSecretConsumeRate);
+        const __m256i d0 = _mm256_loadu_si256(in);
+        const __m256i d1 = _mm256_loadu_si256(in + 1);
+        const __m256i k0 = _mm256_xor_si256(d0, _mm256_loadu_si256(key));
+        const __m256i k1 = _mm256_xor_si256(d1, _mm256_loadu_si256(key + 1));
+        a0 = _mm256_add_epi64(a0, _mm256_add_epi64(
+                _mm256_mul_epu32(k0, _mm256_srli_epi64(k0, 32)),
+                _mm256_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2))));
+        a1 = _mm256_add_epi64(a1, _mm256_add_epi64(
+                _mm256_mul_epu32(k1, _mm256_srli_epi64(k1, 32)),
+                _mm256_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2))));
+    }
+    _mm256_storeu_si256((__m256i*) acc, a0);
+    _mm256_storeu_si256((__m256i*) acc + 1, a1);
+}
+
+__attribute__((target("avx2")))
+static void scrambleAvx2(uint64_t* acc, const uint8_t* secret)
+{
+    const __m256i prime = _mm256_set1_epi32((int) kPrime32_1);
+    for (size_t i = 0; i < 2; i++) {
+        __m256i a = _mm256_loadu_si256((const __m256i*) acc + i);
+        a = _mm256_xor_si256(a, _mm256_srli_epi64(a, 47));
+        a = _mm256_xor_si256(a, _mm256_loadu_si256((const __m256i*) secret + i));
+        const __m256i lo = _mm256_mul_epu32(a, prime);
+        const __m256i hi = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), prime);
+        _mm256_storeu_si256((__m256i*) acc + i, _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32)));
+    }
+}
+#endif
+
+#if HAVE_NEON_HASH
+static void accumulateNeon(uint64_t* acc, const uint8_t* input, const uint8_t* secret,
+        size_t stripes)
+{
+    uint64x2_t a[4];
+    for (size_t i = 0; i < 4; i++) {
+        a[i] = vld1q_u64(acc + 2 * i);
+    }
+    for (size_t n = 0; n < stripes; n++) {
+        const uint8_t* in = input + n * kStripeLen;
+        const uint8_t* key = secret + n * kSecretConsumeRate;
+        for (size_t i = 0; i < 4; i++) {
+            const uint64x2_t data = vreinterpretq_u64_u8(vld1q_u8(in + 16 * i));
+            const uint64x2_t dataKey = veorq_u64(data,
+                    vreinterpretq_u64_u8(vld1q_u8(key + 16 * i)));
+            const uint64x2_t product = vmull_u32(vmovn_u64(dataKey), vshrn_n_u64(dataKey, 32));
+            a[i] = vaddq_u64(a[i], vaddq_u64(product, vextq_u64(data, data, 1)));
+        }
+    }
+    for (size_t i = 0; i < 4; i++) {
+        vst1q_u64(acc + 2 * i, a[i]);
+    }
+}
+
+static void scrambleNeon(uint64_t* acc, const uint8_t* secret)
+{
+    const uint32x2_t prime = vdup_n_u32(kPrime32_1);
+    for (size_t i = 0; i < 4; i++) {
+        uint64x2_t a = vld1q_u64(acc + 2 * i);
+        a = veorq_u64(a, vshrq_n_u64(a, 47));
+        a = veorq_u64(a, vreinterpretq_u64_u8(vld1q_u8(secret + 16 * i)));
+        const uint64x2_t lo = vmull_u32(vmovn_u64(a), prime);
+        const uint64x2_t hi = vmull_u32(vshrn_n_u64(a, 32), prime);
+        vst1q_u64(acc + 2 * i, vaddq_u64(lo, vshlq_n_u64(hi, 32)));
+    }
+}
+#endif
+
+struct Kernels {
+    AccumulateFunc accumulate;
+    ScrambleFunc scramble;
+};
+
+static Kernels chooseKernels()
+{
+    Kernels k;
+#if HAVE_AVX2_HASH
+    // This runs from a static initializer, before libgcc has looked.
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        k.accumulate = accumulateAvx2;
+        k.scramble = scrambleAvx2;
+        return k;
+    }
+#endif
+#if HAVE_SSE2_HASH
+    k.accumulate = accumulateSse2;
+    k.scramble = scrambleSse2;
+#elif HAVE_NEON_HASH
+    k.accumulate = accumulateNeon;
+    k.scramble = scrambleNeon;
+#else
+    k.accumulate = accumulateScalar;
+    k.scramble = scrambleScalar;
+#endif
+    return k;
+}
+
+static const Kernels sKernels = chooseKernels();
+
+static void initAcc(uint64_t* acc)
+{
+    acc[0] = kPrime32_3;
+    acc[1] = kPrime64_1;
+    acc[2] = kPrime64_2;
+    acc[3] = kPrime64_3;
+    acc[4] = kPrime64_4;
+    acc[5] = kPrime32_2;
+    acc[6] = kPrime64_5;
+    acc[7] = kPrime32_1;
+}
+
+/*
+ * Accumulates "stripes" stripes of "input", scrambling after each block,
+ * where "*ioStripesSoFar" are already in the current block.  Returns the
+ * end of what was consumed.
+ */
+static const uint8_t* consumeStripes(uint64_t* acc, size_t* ioStripesSoFar,
+        const uint8_t* input, size_t stripes)
+{
+    while (stripes >= kStripesPerBlock - *ioStripesSoFar) {
+        const size_t n = kStripesPerBlock - *ioStripesSoFar;
+        sKernels.accumulate(acc, input, kSecret + *ioStripesSoFar * kSecretConsumeRate, n);
+        sKernels.scramble(acc, kSecret + kSecretLimit);
+        input += n * kStripeLen;
+        stripes -= n;
+        *ioStripesSoFar = 0;
+    }
+    if (stripes > 0) {
+        sKernels.accumulate(acc, input, kSecret + *ioStripesSoFar * kSecretConsumeRate, stripes);
+        input += stripes * kStripeLen;
+        *ioStripesSoFar += stripes;
+    }
+    return input;
+}
+
+static uint64_t mergeAccs(const uint64_t* acc, const uint8_t* secret, uint64_t start)
+{
+    uint64_t result = start;
+    for (size_t i = 0; i < 4; i++) {
+        result += mul128Fold64(acc[2 * i] ^ readLE64(secret + 16 * i),
+                acc[2 * i + 1] ^ readLE64(secret + 16 * i + 8));
+    }
+    return avalanche(result);
+}
+
+static uint64_t merge64(const uint64_t* acc, uint64_t len)
+{
+    return mergeAccs(acc, kSecret + kSecretMergeAccsStart, len * kPrime64_1);
+}
+
+static ContentHash128 merge128(const uint64_t* acc, uint64_t len)
+{
+    ContentHash128 h;
+    h.low = mergeAccs(acc, kSecret + kSecretMergeAccsStart, len * kPrime64_1);
+    h.high = mergeAccs(acc, kSecret + sizeof(kSecret) - kStripeLen - kSecretMergeAccsStart,
+            ~(len * kPrime64_2));
+    return h;
+}
+
+/* Runs all of "input", more than kMidSizeMax bytes, through "acc". */
+static void hashLong(uint64_t* acc, const uint8_t* input, size_t len)
+{
+    initAcc(acc);
+    size_t stripesSoFar = 0;
+    // The last stripe always goes in on its own, below.
+    consumeStripes(acc, &stripesSoFar, input, (len - 1) / kStripeLen);
+    sKernels.accumulate(acc, input + len - kStripeLen,
+            kSecret + kSecretLimit - kSecretLastAccStart, 1);
+}
+
+// ---------------------------------------------------------------------------
+
+String8 ContentHash128::toString() const
+{
+    return String8::format("%016llx%016llx", (unsigned long long) high,
+            (unsigned long long) low);
+}
+
+void ContentHasher::reset()
+{
+    initAcc(mAcc);
+    mBufferedSize = 0;
+    mStripesSoFar = 0;
+    mTotalLen = 0;
+}
+
+void ContentHasher::update(const void* data, size_t size)
+{
+    const uint8_t* input = (const uint8_t*) data;
+    const uint8_t* const end = input + size;
+    mTotalLen += size;
+
+    if (size <= kBufferSize - mBufferedSize) {
+        memcpy(mBuffer + mBufferedSize, input, size);
+        mBufferedSize += size;
+        return;
+    }
+
+    // Some input always stays buffered, so that digesting knows the last
+    // stripe.  A full buffer is consumed only once there is more.
+    const size_t kBufferStripes = kBufferSize / kStripeLen;
+    if (mBufferedSize > 0) {
+        const size_t fill = kBufferSize - mBufferedSize;
+        memcpy(mBuffer + mBufferedSize, input, fill);
+        input += fill;
+        consumeStripes(mAcc, &mStripesSoFar, mBuffer, kBufferStripes);
+        mBufferedSize = 0;
+    }
+    if ((size_t) (end - input) > kBufferSize) {
+        input = consumeStripes(mAcc, &mStripesSoFar, input,
+                (size_t) (end - 1 - input) / kStripeLen);
+        // The stripe before what is buffered, in case the rest is short.
+        memcpy(mBuffer + kBufferSize - kStripeLen, input - kStripeLen, kStripeLen);
+    }
+    memcpy(mBuffer, input, end - input);
+    mBufferedSize = end - input;
+}
+
+void ContentHasher::digestLong(uint64_t* acc) const
+{
+    memcpy(acc, mAcc, sizeof(mAcc));
+    uint8_t lastStripe[kStripeLen];
+    const uint8_t* last;
+    if (mBufferedSize >= kStripeLen) {
+        size_t stripesSoFar = mStripesSoFar;
+        consumeStripes(acc, &stripesSoFar, mBuffer, (mBufferedSize - 1) / kStripeLen);
+        last = mBuffer + mBufferedSize - kStripeLen;
+    } else {
+        // The end of the stripe before this input is still in the buffer.
+        const size_t catchUp = kStripeLen - mBufferedSize;
+        memcpy(lastStripe, mBuffer + kBufferSize - catchUp, catchUp);
+        memcpy(lastStripe + catchUp, mBuffer, mBufferedSize);
+        last = lastStripe;
+    }
+    sKernels.accumulate(acc, last, kSecret + kSecretLimit - kSecretLastAccStart, 1);
+}
+
+uint64_t ContentHasher::digest64() const
+{
+    if (mTotalLen > kMidSizeMax) {
+        uint64_t acc[8];
+        digestLong(acc);
+        return merge64(acc, mTotalLen);
+    }
+    return hash64(mBuffer, mBufferedSize);
+}
+
+ContentHash128 ContentHasher::digest128() const
+{
+    if (mTotalLen > kMidSizeMax) {
+        uint64_t acc[8];
+        digestLong(acc);
+        return merge128(acc, mTotalLen);
+    }
+    return hash128(mBuffer, mBufferedSize);
+}
+
+uint64_t ContentHasher::hash64(const void* data, size_t size)
+{
+    const uint8_t* input = (const uint8_t*) data;
+    if (size <= 16) {
+        return hashShort64(input, size);
+    }
+    if (size <= kMidSizeMax) {
+        return hashMid64(input, size);
+    }
+    uint64_t acc[8];
+    hashLong(acc, input, size);
+    return merge64(acc, size);
+}
+
+ContentHash128 ContentHasher::hash128(const void* data, size_t size)
+{
+    const uint8_t* input = (const uint8_t*) data;
+    if (size <= 16) {
+        return hashShort128(input, size);
+    }
+    if (size <= kMidSizeMax) {
+        return hashMid128(input, size);
+    }
+    uint64_t acc[8];
+    hashLong(acc, input, size);
+    return merge128(acc, size);
+}
+
+}; // namespace android
@@ -20,28 +20,291 @@
 #include <utils/SharedBuffer.h>
 #include <utils/Atomic.h>
 
+#if defined(HAVE_PTHREADS)
+#include <pthread.h>
+#endif
+
 // ---------------------------------------------------------------------------
 
 namespace android {
 
+static bool gAccounting = false;
+static size_t gAccountedBytes = 0;
+
+static inline void account(ssize_t delta, uint32_t counted)
+{
+    if (counted) {
+        __atomic_fetch_add(&gAccountedBytes, delta, __ATOMIC_RELAXED);
+    }
+}
+
+// The pool: whole buffers, header included, in size classes 16 bytes apart.
+// Each thread keeps a short free list per class and trades batches with
+// a shared depot, so most allocations take no lock.
+
+static bool gPooling = false;
+
+static const size_t kPoolGranule = 16;
+static const size_t kPoolClasses = SharedBuffer::kMaxPooledSize / kPoolGranule;
+static const uint32_t kPoolBatch = 32;              // blocks moved at once
+static const uint32_t kPoolThreadMax = 2 * kPoolBatch;
+
+static inline size_t poolClassFor(size_t size)
+{
+    return size == 0 ? 0 : (size - 1) / kPoolGranule;
+}
+
+#if defined(HAVE_PTHREADS)
+
+static inline size_t poolBlockSize(size_t cls)
+{
+    return sizeof(SharedBuffer) + (cls + 1) * kPoolGranule;
+}
+
+struct PoolBlock {
+    PoolBlock* next;
+};
+
+struct PoolThreadCache {
+    PoolBlock* lists[kPoolClasses];
+    uint32_t counts[kPoolClasses];
+    // Written only by the owning thread; read by getPoolStats().
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t refills;
+    PoolThreadCache* prev;
+    PoolThreadCache* next;
+};
+
+static pthread_mutex_t gPoolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t gPoolOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t gPoolKey;
+static PoolBlock* gDepot[kPoolClasses];
+static uint32_t gDepotCounts[kPoolClasses];
+static PoolThreadCache* gPoolThreads = NULL;
+static SharedBuffer::PoolStats gRetiredStats;       // of threads that have exited
+
+static inline void bump(uint64_t* counter)
+{
+    __atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
+}
+
+// Moves up to "max" blocks from the front of "*from" to "*to".
+static uint32_t moveBlocks(PoolBlock** from, PoolBlock** to, uint32_t max)
+{
+    uint32_t moved = 0;
+    while (moved < max && *from != NULL) {
+        PoolBlock* b = *from;
+        *from = b->next;
+        b->next = *to;
+        *to = b;
+        moved++;
+    }
+    return moved;
+}
+
+static void poolThreadExit(void* arg)
+{
+    PoolThreadCache* cache = static_cast<PoolThreadCache*>(arg);
+    pthread_mutex_lock(&gPoolLock);
+    for (size_t i = 0; i < kPoolClasses; i++) {
+        gDepotCounts[i] += moveBlocks(&cache->lists[i], &gDepot[i], cache->counts[i]);
+    }
+    gRetiredStats.allocs += cache->allocs;
+    gRetiredStats.frees += cache->frees;
+    gRetiredStats.refills += cache->refills;
+    if (cache->prev != NULL) {
+        cache->prev->next = cache->next;
+    } else {
+        gPoolThreads = cache->next;
+    }
+    if (cache->next != NULL) {
+        cache->next->prev = cache->prev;
+    }
+    pthread_mutex_unlock(&gPoolLock);
+    free(cache);
+}
+
+static void initPoolKey()
+{
+    pthread_key_create(&gPoolKey, poolThreadExit);
+}
+
+static PoolThreadCache* getPoolThreadCache()
+{
+    PoolThreadCache* cache = static_cast<PoolThreadCache*>(pthread_getspecific(gPoolKey));
+    if (cache != NULL) {
+        return cache;
+    }
+    cache = static_cast<PoolThreadCache*>(calloc(1, sizeof(PoolThreadCache)));
+    if (cache == NULL) {
+        return NULL;
+    }
+    pthread_mutex_lock(&gPoolLock);
+    cache->next = gPoolThreads;
+    if (gPoolThreads != NULL) {
+        gPoolThreads->prev = cache;
+    }
+    gPoolThreads = cache;
+    pthread_mutex_unlock(&gPoolLock);
+    pthread_setspecific(gPoolKey, cache);
+    return cache;
+}
+
+// Refills an empty thread list from the depot, or else from a new chunk.
+static bool refillPoolList(PoolThreadCache* cache, size_t cls)
+{
+    bump(&cache->refills);
+    pthread_mutex_lock(&gPoolLock);
+    uint32_t moved = moveBlocks(&gDepot[cls], &cache->lists[cls], kPoolBatch);
+    gDepotCounts[cls] -= moved;
+    if (moved == 0) {
+        const size_t blockSize = poolBlockSize(cls);
+        uint8_t* chunk = static_cast<uint8_t*>(malloc(blockSize * kPoolBatch));
+        if (chunk != NULL) {
+            gRetiredStats.reservedBytes += blockSize * kPoolBatch;
+            for (uint32_t i = 0; i < kPoolBatch; i++) {
+                PoolBlock* b = reinterpret_cast<PoolBlock*>(chunk + i * blockSize);
+                b->next = cache->lists[cls];
+                cache->lists[cls] = b;
+            }
+            moved = kPoolBatch;
+        }
+    }
+    pthread_mutex_unlock(&gPoolLock);
+    cache->counts[cls] += moved;
+    return moved > 0;
+}
+
+static void* poolAlloc(size_t cls)
+{
+    PoolThreadCache* cache = getPoolThreadCache();
+    if (cache == NULL || (cache->lists[cls] == NULL && !refillPoolList(cache, cls))) {
+        return NULL;
+    }
+    PoolBlock* b = cache->lists[cls];
+    cache->lists[cls] = b->next;
+    cache->counts[cls]--;
+    bump(&cache->allocs);
+    return b;
+}
+
+static void poolFree(void* block, size_t cls)
+{
+    PoolBlock* b = static_cast<PoolBlock*>(block);
+    PoolThreadCache* cache = getPoolThreadCache();
+    if (cache == NULL) {
+        pthread_mutex_lock(&gPoolLock);
+        b->next = gDepot[cls];
+        gDepot[cls] = b;
+        gDepotCounts[cls]++;
+        pthread_mutex_unlock(&gPoolLock);
+        return;
+    }
+    b->next = cache->lists[cls];
+    cache->lists[cls] = b;
+    bump(&cache->frees);
+    if (++cache->counts[cls] > kPoolThreadMax) {
+        // Hand a batch back, so a thread that only frees can't hoard them.
+        pthread_mutex_lock(&gPoolLock);
+        gDepotCounts[cls] += moveBlocks(&cache->lists[cls], &gDepot[cls], kPoolBatch);
+        pthread_mutex_unlock(&gPoolLock);
+        cache->counts[cls] -= kPoolBatch;
+    }
+}
+
+void SharedBuffer::enablePooling()
+{
+    pthread_once(&gPoolOnce, initPoolKey);
+    gPooling = true;
+}
+
+void SharedBuffer::getPoolStats(PoolStats* outStats)
+{
+    pthread_mutex_lock(&gPoolLock);
+    *outStats = gRetiredStats;
+    for (PoolThreadCache* c = gPoolThreads; c != NULL; c = c->next) {
+        outStats->allocs += __atomic_load_n(&c->allocs, __ATOMIC_RELAXED);
+        outStats->frees += __atomic_load_n(&c->frees, __ATOMIC_RELAXED);
+        outStats->refills += __atomic_load_n(&c->refills, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&gPoolLock);
+}
+
+#else
+
+static void* poolAlloc(size_t)
+{
+    return NULL;
+}
+
+static void poolFree(void* block, size_t)
+{
+    free(block);
+}
+
+void SharedBuffer::enablePooling()
+{
+}
+
+void SharedBuffer::getPoolStats(PoolStats* outStats)
+{
+    memset(outStats, 0, sizeof(*outStats));
+}
+
+#endif
+
+// Frees the storage of a counted-down buffer, to wherever it came from.
+static void freeStorage(SharedBuffer* sb, uint32_t poolTag)
+{
+    if (poolTag != 0) {
+        poolFree(sb, poolTag - 1);
+    } else {
+        free(sb);
+    }
+}
+
 SharedBuffer* SharedBuffer::alloc(size_t size)
 {
-    SharedBuffer* sb = static_cast<SharedBuffer *>(malloc(sizeof(SharedBuffer) + size));
+    SharedBuffer* sb = NULL;
+    uint32_t poolTag = 0;
+    if (gPooling && size <= kMaxPooledSize) {
+        const size_t cls = poolClassFor(size);
+        sb = static_cast<SharedBuffer *>(poolAlloc(cls));
+        poolTag = sb != NULL ? cls + 1 : 0;
+    }
+    if (sb == NULL) {
+        sb = static_cast<SharedBuffer *>(malloc(sizeof(SharedBuffer) + size));
+    }
     if (sb) {
         sb->mRefs = 1;
         sb->mSize = size;
+        sb->mReserved[0] = gAccounting ? 1 : 0;
+        sb->mReserved[1] = poolTag;
+        account(sizeof(SharedBuffer) + size, sb->mReserved[0]);
     }
     return sb;
 }
 
-
 ssize_t SharedBuffer::dealloc(const SharedBuffer* released)
 {
     if (released->mRefs != 0) return -1; // XXX: invalid operation
-    free(const_cast<SharedBuffer*>(released));
+    account(-(ssize_t)(sizeof(SharedBuffer) + released->mSize),
+            released->mReserved[0]);
+    freeStorage(const_cast<SharedBuffer*>(released), released->mReserved[1]);
     return 0;
 }
 
+void SharedBuffer::enableAccounting()
+{
+    gAccounting = true;
+}
+
+size_t SharedBuffer::getAccountedBytes()
+{
+    return __atomic_load_n(&gAccountedBytes, __ATOMIC_RELAXED);
+}
+
 SharedBuffer* SharedBuffer::edit() const
 {
     if (onlyOwner()) {
@@ -60,10 +323,21 @@ SharedBuffer* SharedBuffer::editResize(size_t newSize) const
     if (onlyOwner()) {
         SharedBuffer* buf = const_cast<SharedBuffer*>(this);
         if (buf->mSize == newSize) return buf;
-        buf = (SharedBuffer*)realloc(buf, sizeof(SharedBuffer) + newSize);
-        if (buf != NULL) {
-            buf->mSize = newSize;
-            return buf;
+        const size_t oldSize = buf->mSize;
+        if (buf->mReserved[1] != 0) {
+            // Pooled: grow or shrink in place within the block's class.
+            if (newSize <= kMaxPooledSize && poolClassFor(newSize) + 1 == buf->mReserved[1]) {
+                buf->mSize = newSize;
+                account((ssize_t)newSize - (ssize_t)oldSize, buf->mReserved[0]);
+                return buf;
+            }
+        } else {
+            buf = (SharedBuffer*)realloc(buf, sizeof(SharedBuffer) + newSize);
+            if (buf != NULL) {
+                buf->mSize = newSize;
+                account((ssize_t)newSize - (ssize_t)oldSize, buf->mReserved[0]);
+                return buf;
+            }
         }
     }
     SharedBuffer* sb = alloc(newSize);
@@ -103,7 +377,8 @@ int32_t SharedBuffer::release(uint32_t flags) const
     if (onlyOwner() || ((prev = android_atomic_dec(&mRefs)) == 1)) {
         mRefs = 0;
         if ((flags & eKeepStorage) == 0) {
-            free(const_cast<SharedBuffer*>(this));
+            account(-(ssize_t)(sizeof(SharedBuffer) + mSize), mReserved[0]);
+            freeStorage(const_cast<SharedBuffer*>(this), mReserved[1]);
         }
     }
     return prev;
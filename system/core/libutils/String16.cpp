@@ -16,6 +16,7 @@
 
 #include <utils/String16.h>
 
+#include <utils/JenkinsHash.h>
 #include <utils/Log.h>
 #include <utils/Unicode.h>
 #include <utils/String8.h>
@@ -109,6 +110,12 @@ String16::String16(const String16& o)
     SharedBuffer::bufferFromData(mString)->acquire();
 }
 
+String16::String16(String16&& o)
+    : mString(o.mString)
+{
+    o.mString = getEmptyString();
+}
+
 String16::String16(const String16& o, size_t len, size_t begin)
     : mString(getEmptyString())
 {
@@ -416,4 +423,10 @@ status_t String16::remove(size_t len, size_t begin)
     return NO_MEMORY;
 }
 
+template <> hash_t hash_type(const String16& value)
+{
+    return JenkinsHashWhiten(JenkinsHashMixShorts(0,
+            (const uint16_t*) value.string(), value.size()));
+}
+
 }; // namespace android
@@ -17,6 +17,7 @@
 #include <utils/String8.h>
 
 #include <utils/Compat.h>
+#include <utils/JenkinsHash.h>
 #include <utils/Log.h>
 #include <utils/Unicode.h>
 #include <utils/SharedBuffer.h>
@@ -165,6 +166,12 @@ String8::String8(const String8& o)
     SharedBuffer::bufferFromData(mString)->acquire();
 }
 
+String8::String8(String8&& o)
+    : mString(o.mString)
+{
+    o.mString = getEmptyString();
+}
+
 String8::String8(const char* o)
     : mString(allocFromUTF8(o, strlen(o)))
 {
@@ -329,23 +336,33 @@ status_t String8::appendFormatV(const char* fmt, va_list args)
 {
     int n, result = NO_ERROR;
     va_list tmp_args;
+    char small[256];
 
     /* args is undefined after vsnprintf.
      * So we need a copy here to avoid the
      * second vsnprintf access undefined args.
+     *
+     * Most pieces are short, so they are formatted only once, into
+     * a buffer on the stack; only a longer one is formatted again
+     * into the string itself once its length is known.
      */
     va_copy(tmp_args, args);
-    n = vsnprintf(NULL, 0, fmt, tmp_args);
+    n = vsnprintf(small, sizeof(small), fmt, tmp_args);
     va_end(tmp_args);
 
-    if (n != 0) {
-        size_t oldLength = length();
-        char* buf = lockBuffer(oldLength + n);
-        if (buf) {
-            vsnprintf(buf + oldLength, n + 1, fmt, args);
-        } else {
-            result = NO_MEMORY;
-        }
+    if (n < 0) {
+        return UNKNOWN_ERROR;
+    }
+    if ((size_t) n < sizeof(small)) {
+        return n != 0 ? real_append(small, n) : NO_ERROR;
+    }
+
+    size_t oldLength = length();
+    char* buf = lockBuffer(oldLength + n);
+    if (buf) {
+        vsnprintf(buf + oldLength, n + 1, fmt, args);
+    } else {
+        result = NO_MEMORY;
     }
     return result;
 }
@@ -673,4 +690,10 @@ String8& String8::convertToResPath()
     return *this;
 }
 
+template <> hash_t hash_type(const String8& value)
+{
+    return JenkinsHashWhiten(JenkinsHashMixBytes(0,
+            (const uint8_t*) value.string(), value.length()));
+}
+
 }; // namespace android
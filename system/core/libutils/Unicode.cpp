@@ -17,6 +17,16 @@
 #include <utils/Unicode.h>
 
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2_UTF 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON_UTF 1
+#endif
 
 #if defined(_WIN32)
 # undef  nhtol
@@ -62,6 +72,131 @@ static const char32_t kFirstByteMark[] = {
     0x00000000, 0x00000000, 0x000000C0, 0x000000E0, 0x000000F0
 };
 
+// --------------------------------------------------------------------------
+// ASCII runs
+// --------------------------------------------------------------------------
+
+/*
+ * Almost all the text we convert is ASCII, which is the same in UTF-8 and
+ * UTF-16 but for its width.  These find and copy the runs of it sixteen
+ * characters at a time, and leave everything else to the per-character
+ * loops.  SSE2 and the NEON of AArch64 are always there when compiling
+ * for them; other targets test eight bytes at a time in a plain word.
+ */
+
+static const uint64_t kAsciiMask8  = 0x8080808080808080ULL;
+static const uint64_t kAsciiMask16 = 0xFF80FF80FF80FF80ULL;
+
+// Returns how many of the len bytes at src are ASCII before the first one that isn't.
+static inline size_t utf8_ascii_run(const uint8_t* src, size_t len)
+{
+    size_t i = 0;
+#if HAVE_SSE2_UTF
+    for (; i + 16 <= len; i += 16) {
+        const int high = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) (src + i)));
+        if (high != 0) {
+            return i + __builtin_ctz(high);
+        }
+    }
+#elif HAVE_NEON_UTF
+    for (; i + 16 <= len; i += 16) {
+        if (vmaxvq_u8(vld1q_u8(src + i)) >= 0x80) {
+            break;
+        }
+    }
+#endif
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, src + i, sizeof(word));
+        if ((word & kAsciiMask8) != 0) {
+            break;
+        }
+    }
+    while (i < len && src[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
+
+// Returns how many of the len characters at src are ASCII before the first one that isn't.
+static inline size_t utf16_ascii_run(const char16_t* src, size_t len)
+{
+    size_t i = 0;
+#if HAVE_SSE2_UTF
+    const __m128i nonAscii = _mm_set1_epi16((short) 0xFF80);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= len; i += 8) {
+        const __m128i v = _mm_loadu_si128((const __m128i*) (src + i));
+        const int ascii = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, nonAscii), zero));
+        if (ascii != 0xFFFF) {
+            return i + __builtin_ctz(~ascii) / 2;
+        }
+    }
+#elif HAVE_NEON_UTF
+    for (; i + 8 <= len; i += 8) {
+        if (vmaxvq_u16(vld1q_u16((const uint16_t*) (src + i))) >= 0x80) {
+            break;
+        }
+    }
+#endif
+    for (; i + 4 <= len; i += 4) {
+        uint64_t word;
+        memcpy(&word, src + i, sizeof(word));
+        if ((word & kAsciiMask16) != 0) {
+            break;
+        }
+    }
+    while (i < len && src[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
+
+// Copies len ASCII bytes to as many UTF-16 characters.
+static inline void widen_ascii(const uint8_t* src, size_t len, char16_t* dst)
+{
+    size_t i = 0;
+#if HAVE_SSE2_UTF
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= len; i += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i*) (src + i));
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_unpacklo_epi8(v, zero));
+        _mm_storeu_si128((__m128i*) (dst + i + 8), _mm_unpackhi_epi8(v, zero));
+    }
+#elif HAVE_NEON_UTF
+    for (; i + 16 <= len; i += 16) {
+        const uint8x16_t v = vld1q_u8(src + i);
+        vst1q_u16((uint16_t*) (dst + i), vmovl_u8(vget_low_u8(v)));
+        vst1q_u16((uint16_t*) (dst + i + 8), vmovl_high_u8(v));
+    }
+#endif
+    for (; i < len; i++) {
+        dst[i] = src[i];
+    }
+}
+
+// Copies len ASCII UTF-16 characters to as many bytes.
+static inline void narrow_ascii(const char16_t* src, size_t len, uint8_t* dst)
+{
+    size_t i = 0;
+#if HAVE_SSE2_UTF
+    for (; i + 16 <= len; i += 16) {
+        const __m128i lo = _mm_loadu_si128((const __m128i*) (src + i));
+        const __m128i hi = _mm_loadu_si128((const __m128i*) (src + i + 8));
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_packus_epi16(lo, hi));
+    }
+#elif HAVE_NEON_UTF
+    for (; i + 16 <= len; i += 16) {
+        const uint16x8_t lo = vld1q_u16((const uint16_t*) (src + i));
+        const uint16x8_t hi = vld1q_u16((const uint16_t*) (src + i + 8));
+        vst1q_u8(dst + i, vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+    }
+#endif
+    for (; i < len; i++) {
+        dst[i] = (uint8_t) src[i];
+    }
+}
+
 // --------------------------------------------------------------------------
 // UTF-32
 // --------------------------------------------------------------------------
@@ -334,6 +469,14 @@ void utf16_to_utf8(const char16_t* src, size_t src_len, char* dst)
     const char16_t* const end_utf16 = src + src_len;
     char *cur = dst;
     while (cur_utf16 < end_utf16) {
+        const size_t ascii = utf16_ascii_run(cur_utf16, end_utf16 - cur_utf16);
+        narrow_ascii(cur_utf16, ascii, (uint8_t*) cur);
+        cur_utf16 += ascii;
+        cur += ascii;
+        if (cur_utf16 == end_utf16) {
+            break;
+        }
+
         char32_t utf32;
         // surrogate pairs
         if((*cur_utf16 & 0xFC00) == 0xD800 && (cur_utf16 + 1) < end_utf16
@@ -407,6 +550,12 @@ ssize_t utf16_to_utf8_length(const char16_t *src, size_t src_len)
     size_t ret = 0;
     const char16_t* const end = src + src_len;
     while (src < end) {
+        const size_t ascii = utf16_ascii_run(src, end - src);
+        ret += ascii;
+        src += ascii;
+        if (src == end) {
+            break;
+        }
         if ((*src & 0xFC00) == 0xD800 && (src + 1) < end
                 && (*++src & 0xFC00) == 0xDC00) {
             // surrogate pairs are always 4 bytes.
@@ -519,6 +668,12 @@ ssize_t utf8_to_utf16_length(const uint8_t* u8str, size_t u8len)
     /* Validate that the UTF-8 is the correct len */
     size_t u16measuredLen = 0;
     while (u8cur < u8end) {
+        const size_t ascii = utf8_ascii_run(u8cur, u8end - u8cur);
+        u16measuredLen += ascii;
+        u8cur += ascii;
+        if (u8cur == u8end) {
+            break;
+        }
         u16measuredLen++;
         int u8charLen = utf8_codepoint_len(*u8cur);
         uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8charLen);
@@ -544,6 +699,14 @@ char16_t* utf8_to_utf16_no_null_terminator(const uint8_t* u8str, size_t u8len, c
     char16_t* u16cur = u16str;
 
     while (u8cur < u8end) {
+        const size_t ascii = utf8_ascii_run(u8cur, u8end - u8cur);
+        widen_ascii(u8cur, ascii, u16cur);
+        u8cur += ascii;
+        u16cur += ascii;
+        if (u8cur == u8end) {
+            break;
+        }
+
         size_t u8len = utf8_codepoint_len(*u8cur);
         uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8len);
 
@@ -575,6 +738,17 @@ char16_t* utf8_to_utf16_n(const uint8_t* src, size_t srcLen, char16_t* dst, size
     char16_t* u16cur = dst;
 
     while (u8cur < u8end && u16cur < u16end) {
+        size_t ascii = utf8_ascii_run(u8cur, u8end - u8cur);
+        if (ascii > (size_t) (u16end - u16cur)) {
+            ascii = u16end - u16cur;
+        }
+        widen_ascii(u8cur, ascii, u16cur);
+        u8cur += ascii;
+        u16cur += ascii;
+        if (u8cur == u8end || u16cur == u16end) {
+            break;
+        }
+
         size_t u8len = utf8_codepoint_len(*u8cur);
         uint32_t codepoint = utf8_to_utf32_codepoint(u8cur, u8len);
 
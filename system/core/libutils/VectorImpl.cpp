@@ -20,6 +20,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#include <utility>
+
 #include <cutils/log.h>
 
 #include <utils/Errors.h>
@@ -55,6 +57,14 @@ VectorImpl::VectorImpl(const VectorImpl& rhs)
     }
 }
 
+VectorImpl::VectorImpl(VectorImpl&& rhs)
+    :   mStorage(rhs.mStorage), mCount(rhs.mCount),
+        mFlags(rhs.mFlags), mItemSize(rhs.mItemSize)
+{
+    rhs.mStorage = 0;
+    rhs.mCount = 0;
+}
+
 VectorImpl::~VectorImpl()
 {
     ALOGW_IF(mCount,
@@ -82,6 +92,20 @@ VectorImpl& VectorImpl::operator = (const VectorImpl& rhs)
     return *this;
 }
 
+VectorImpl& VectorImpl::operator = (VectorImpl&& rhs)
+{
+    LOG_ALWAYS_FATAL_IF(mItemSize != rhs.mItemSize,
+        "Vector<> have different types (this=%p, rhs=%p)", this, &rhs);
+    if (this != &rhs) {
+        release_storage();
+        mStorage = rhs.mStorage;
+        mCount = rhs.mCount;
+        rhs.mStorage = 0;
+        rhs.mCount = 0;
+    }
+    return *this;
+}
+
 void* VectorImpl::editArrayImpl()
 {
     if (mStorage) {
@@ -152,6 +176,13 @@ ssize_t VectorImpl::insertAt(const void* item, size_t index, size_t numItems)
     return where ? index : (ssize_t)NO_MEMORY;
 }
 
+void* VectorImpl::insertUninitializedAt(size_t index, size_t numItems)
+{
+    if (index > size())
+        return NULL;
+    return _grow(index, numItems);
+}
+
 static int sortProxy(const void* lhs, const void* rhs, void* func)
 {
     return (*(VectorImpl::compar_t)func)(lhs, rhs);
@@ -326,16 +357,31 @@ const void* VectorImpl::itemLocation(size_t index) const
 ssize_t VectorImpl::setCapacity(size_t new_capacity)
 {
     size_t current_capacity = capacity();
-    ssize_t amount = new_capacity - size();
-    if (amount <= 0) {
+    if (new_capacity <= current_capacity || new_capacity <= size()) {
         // we can't reduce the capacity
         return current_capacity;
-    } 
+    }
+    if (canResizeInPlace(size())) {
+        const SharedBuffer* cur_sb = SharedBuffer::bufferFromData(mStorage);
+        SharedBuffer* sb = cur_sb->editResize(new_capacity * mItemSize);
+        if (!sb) {
+            return NO_MEMORY;
+        }
+        mStorage = sb->data();
+        return new_capacity;
+    }
     SharedBuffer* sb = SharedBuffer::alloc(new_capacity * mItemSize);
     if (sb) {
         void* array = sb->data();
-        _do_copy(array, mStorage, size());
-        release_storage();
+        const SharedBuffer* cur_sb = mStorage ? SharedBuffer::bufferFromData(mStorage) : NULL;
+        if (cur_sb && cur_sb->onlyOwner()) {
+            _do_move_backward(array, mStorage, size());
+            cur_sb->release(SharedBuffer::eKeepStorage);
+            SharedBuffer::dealloc(cur_sb);
+        } else {
+            _do_copy(array, mStorage, size());
+            release_storage();
+        }
         mStorage = const_cast<void*>(array);
     } else {
         return NO_MEMORY;
@@ -364,6 +410,23 @@ void VectorImpl::release_storage()
     }
 }
 
+bool VectorImpl::canResizeInPlace(size_t where) const
+{
+    if (!mStorage) {
+        return false;
+    }
+    const bool trivialCopy = (mFlags & HAS_TRIVIAL_COPY) && (mFlags & HAS_TRIVIAL_DTOR);
+    if (trivialCopy && where == mCount) {
+        // editResize() copies the bytes if the buffer is shared, which
+        // is fine for these.
+        return true;
+    }
+    // Otherwise realloc() may only move the bytes of items nobody else
+    // sees, and only if moving them that way is allowed.
+    return (trivialCopy || (mFlags & HAS_TRIVIAL_MOVE))
+            && SharedBuffer::bufferFromData(mStorage)->onlyOwner();
+}
+
 void* VectorImpl::_grow(size_t where, size_t amount)
 {
 //    ALOGV("_grow(this=%p, where=%d, amount=%d) count=%d, capacity=%d",
@@ -377,11 +440,7 @@ void* VectorImpl::_grow(size_t where, size_t amount)
     if (capacity() < new_size) {
         const size_t new_capacity = max(kMinVectorCapacity, ((new_size*3)+1)/2);
 //        ALOGV("grow vector %p, new_capacity=%d", this, (int)new_capacity);
-        if ((mStorage) &&
-            (mCount==where) &&
-            (mFlags & HAS_TRIVIAL_COPY) &&
-            (mFlags & HAS_TRIVIAL_DTOR))
-        {
+        if (canResizeInPlace(where)) {
             const SharedBuffer* cur_sb = SharedBuffer::bufferFromData(mStorage);
             SharedBuffer* sb = cur_sb->editResize(new_capacity * mItemSize);
             if (sb) {
@@ -389,19 +448,38 @@ void* VectorImpl::_grow(size_t where, size_t amount)
             } else {
                 return NULL;
             }
+            if (where != mCount) {
+                uint8_t* array = reinterpret_cast<uint8_t *>(mStorage);
+                _do_move_forward(array + (where+amount)*mItemSize,
+                        array + where*mItemSize, mCount - where);
+            }
         } else {
             SharedBuffer* sb = SharedBuffer::alloc(new_capacity * mItemSize);
             if (sb) {
                 void* array = sb->data();
-                if (where != 0) {
-                    _do_copy(array, mStorage, where);
-                }
-                if (where != mCount) {
-                    const void* from = reinterpret_cast<const uint8_t *>(mStorage) + where*mItemSize;
-                    void* dest = reinterpret_cast<uint8_t *>(array) + (where+amount)*mItemSize;
-                    _do_copy(dest, from, mCount-where);
+                const void* from = reinterpret_cast<const uint8_t *>(mStorage) + where*mItemSize;
+                void* dest = reinterpret_cast<uint8_t *>(array) + (where+amount)*mItemSize;
+                const SharedBuffer* cur_sb = mStorage ? SharedBuffer::bufferFromData(mStorage) : NULL;
+                if (cur_sb && cur_sb->onlyOwner()) {
+                    // Nobody else sees the old items, so move them over
+                    // instead of copying them and destroying the originals.
+                    if (where != 0) {
+                        _do_move_backward(array, mStorage, where);
+                    }
+                    if (where != mCount) {
+                        _do_move_backward(dest, from, mCount-where);
+                    }
+                    cur_sb->release(SharedBuffer::eKeepStorage);
+                    SharedBuffer::dealloc(cur_sb);
+                } else {
+                    if (where != 0) {
+                        _do_copy(array, mStorage, where);
+                    }
+                    if (where != mCount) {
+                        _do_copy(dest, from, mCount-where);
+                    }
+                    release_storage();
                 }
-                release_storage();
                 mStorage = const_cast<void*>(array);
             } else {
                 return NULL;
@@ -528,6 +606,16 @@ SortedVectorImpl::SortedVectorImpl(const VectorImpl& rhs)
 {
 }
 
+SortedVectorImpl::SortedVectorImpl(const SortedVectorImpl& rhs)
+: VectorImpl(rhs)
+{
+}
+
+SortedVectorImpl::SortedVectorImpl(SortedVectorImpl&& rhs)
+: VectorImpl(std::move(rhs))
+{
+}
+
 SortedVectorImpl::~SortedVectorImpl()
 {
 }
@@ -537,6 +625,11 @@ SortedVectorImpl& SortedVectorImpl::operator = (const SortedVectorImpl& rhs)
     return static_cast<SortedVectorImpl&>( VectorImpl::operator = (static_cast<const VectorImpl&>(rhs)) );
 }
 
+SortedVectorImpl& SortedVectorImpl::operator = (SortedVectorImpl&& rhs)
+{
+    return static_cast<SortedVectorImpl&>( VectorImpl::operator = (static_cast<VectorImpl&&>(rhs)) );
+}
+
 ssize_t SortedVectorImpl::indexOf(const void* item) const
 {
     return _indexOrderOf(item);
@@ -593,21 +686,106 @@ ssize_t SortedVectorImpl::add(const void* item)
 
 ssize_t SortedVectorImpl::merge(const VectorImpl& vector)
 {
-    // naive merge...
-    if (!vector.isEmpty()) {
-        const void* buffer = vector.arrayImpl();
-        const size_t is = itemSize();
-        size_t s = vector.size();
-        for (size_t i=0 ; i<s ; i++) {
-            ssize_t err = add( reinterpret_cast<const char*>(buffer) + i*is );
-            if (err<0) {
+    const size_t count = vector.size();
+    if (count == 0) {
+        return NO_ERROR;
+    }
+
+    // Sort (pointers to) the new items, unless they already are.
+    const void** items = static_cast<const void**>(malloc(count * 2 * sizeof(void*)));
+    if (!items) {
+        return NO_MEMORY;
+    }
+    const void** scratch = items + count;
+    const char* buffer = reinterpret_cast<const char*>(vector.arrayImpl());
+    const size_t is = itemSize();
+    bool sorted = true;
+    for (size_t i=0 ; i<count ; i++) {
+        items[i] = buffer + i*is;
+        if (i > 0 && sorted && do_compare(items[i-1], items[i]) > 0) {
+            sorted = false;
+        }
+    }
+    if (!sorted) {
+        _sortItems(items, scratch, count);
+    }
+
+    // Of equal items, keep the last one, as add() would.
+    size_t unique = 0;
+    for (size_t i=0 ; i<count ; i++) {
+        if (unique > 0 && do_compare(items[unique-1], items[i]) == 0) {
+            items[unique-1] = items[i];
+        } else {
+            items[unique++] = items[i];
+        }
+    }
+
+    // Replace the items we already have and set the others aside.
+    size_t added = 0;
+    for (size_t i=0 ; i<unique ; i++) {
+        ssize_t index = _indexOrderOf(items[i]);
+        if (index >= 0) {
+            ssize_t err = VectorImpl::replaceAt(items[i], index);
+            if (err < 0) {
+                free(items);
                 return err;
             }
+        } else {
+            scratch[added++] = items[i];
+        }
+    }
+
+    // Then make room for those at the end and merge from the back, so
+    // that each item moves at most once.
+    if (added) {
+        const size_t oldCount = size();
+        if (!insertUninitializedAt(oldCount, added)) {
+            free(items);
+            return NO_MEMORY;
+        }
+        char* array = reinterpret_cast<char*>(editArrayImpl());
+        ssize_t i = oldCount - 1;
+        ssize_t j = added - 1;
+        size_t dest = oldCount + added;
+        while (j >= 0) {
+            dest--;
+            if (i >= 0 && do_compare(array + i*is, scratch[j]) > 0) {
+                do_move_backward(array + dest*is, array + i*is, 1);
+                i--;
+            } else {
+                do_copy(array + dest*is, scratch[j], 1);
+                j--;
+            }
         }
     }
+
+    free(items);
     return NO_ERROR;
 }
 
+void SortedVectorImpl::_sortItems(const void** items, const void** scratch, size_t count) const
+{
+    // A stable merge sort, so that the last of equal items stays last.
+    if (count < 2) {
+        return;
+    }
+    const size_t half = count / 2;
+    _sortItems(items, scratch, half);
+    _sortItems(items + half, scratch, count - half);
+    memcpy(scratch, items, half * sizeof(void*));
+    size_t i = 0, j = half, k = 0;
+    while (i < half && j < count) {
+        if (do_compare(items[j], scratch[i]) < 0) {
+            items[k++] = items[j++];
+        } else {
+            items[k++] = scratch[i++];
+        }
+    }
+    while (i < half) {
+        items[k++] = scratch[i++];
+    }
+}
+
 ssize_t SortedVectorImpl::merge(const SortedVectorImpl& vector)
 {
     // we've merging a sorted vector... nice!
@@ -619,7 +797,6 @@ ssize_t SortedVectorImpl::merge(const SortedVectorImpl& vector)
         } else if (do_compare(vector.arrayImpl(), itemLocation(size()-1)) >= 0) {
             err = VectorImpl::appendVector(static_cast<const VectorImpl&>(vector));
         } else {
-            // this could be made a little better
             err = merge(static_cast<const VectorImpl&>(vector));
         }
     }
@@ -25,8 +25,11 @@ LOCAL_SRC_FILES := \
     BasicHashtable_test.cpp \
     BlobCache_test.cpp \
     BitSet_test.cpp \
+    ContentHash_test.cpp \
+    HashedKeyedVector_test.cpp \
     Looper_test.cpp \
     LruCache_test.cpp \
+    SharedBuffer_test.cpp \
     String8_test.cpp \
     Unicode_test.cpp \
     Vector_test.cpp \
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ContentHash_test"
+
+#include <utils/ContentHash.h>
+#include <gtest/gtest.h>
+
+namespace android {
+
+static const size_t kDataSize = 200000;
+
+// XXH3_64bits() and XXH3_128bits() of the first "size" bytes of the data
+// below, from the reference implementation.  The sizes straddle each of
+// its cases.
+static const struct {
+    size_t size;
+    uint64_t hash64;
+    uint64_t low;
+    uint64_t high;
+} kVectors[] = {
+    { 0, 0x2d06800538d394c2ULL, 0x6001c324468d497fULL, 0x99aa06d3014798d8ULL },
+    { 1, 0xe5e62017e96f839cULL, 0xe5e62017e96f839cULL, 0x9a0f174ae92e6df2ULL },
+    { 3, 0xd3bcc83c6f14e70fULL, 0xd3bcc83c6f14e70fULL, 0xda47c2149249db69ULL },
+    { 4, 0xc7f159f34b126cb4ULL, 0xe267cf807951fe26ULL, 0x504303785d7b5ac9ULL },
+    { 8, 0x0f25a2a1cc43dda2ULL, 0xec0b5b60d4670d0eULL, 0xe4f1bc54c38ed231ULL },
+    { 9, 0x1e3be9699baa50cfULL, 0x3b1764b161f03ecdULL, 0x046e647369565965ULL },
+    { 16, 0x9ec324145cea1dcbULL, 0x0c85c3b7b344cfafULL, 0x82d56864b86d4655ULL },
+    { 17, 0x48f3651d7436310aULL, 0xee80c12e2eaa110dULL, 0xe07226299d418421ULL },
+    { 97, 0x7b0a9dae42e89ff6ULL, 0xb0673de5ad089029ULL, 0x98434fe44be46805ULL },
+    { 128, 0x5d813d42c0005ea8ULL, 0x08d61631b87e5395ULL, 0x4a4e39fcfa4515aaULL },
+    { 129, 0xc61639b552225575ULL, 0x11b15591bb767e79ULL, 0x5d41bb88ee7f7e45ULL },
+    { 191, 0xb6831cf51f4f16f2ULL, 0x0b2f739b4c4fdeb9ULL, 0x5444c0f2889d3deaULL },
+    { 240, 0x7d85b8d4f8b10c82ULL, 0x4627a2b0d94e7351ULL, 0xf92b835add69c25dULL },
+    { 241, 0x5c56141c894cd97eULL, 0x5c56141c894cd97eULL, 0x80610486edf872dfULL },
+    { 256, 0xcdb34974678d6687ULL, 0xcdb34974678d6687ULL, 0x242daf7771ae05e6ULL },
+    { 257, 0xb5c3cd9c180a14b7ULL, 0xb5c3cd9c180a14b7ULL, 0xb6ad0f63ee2254b8ULL },
+    { 1024, 0x0551dea22e104ea8ULL, 0x0551dea22e104ea8ULL, 0xdcc4b2941cb5e5e4ULL },
+    { 1025, 0xdbe2ed3c377d9922ULL, 0xdbe2ed3c377d9922ULL, 0x2e457d89ed1973d3ULL },
+    { 4096, 0x869423345af97371ULL, 0x869423345af97371ULL, 0xdb9050e2feb61a33ULL },
+    { 100000, 0xa17aee0fec64d284ULL, 0xa17aee0fec64d284ULL, 0x074cd6f4fc8fa18eULL },
+    { 199999, 0x42a3dc8c14741f17ULL, 0x42a3dc8c14741f17ULL, 0xa38182603fd1f415ULL },
+};
+
+class ContentHashTest : public testing::Test {
+protected:
+    virtual void SetUp() {
+        uint32_t seed = 1;
+        for (size_t i = 0; i < kDataSize; i++) {
+            seed = seed * 1103515245 + 12345;
+            mData[i] = (uint8_t) (seed >> 16);
+        }
+    }
+
+    uint8_t mData[kDataSize];
+};
+
+TEST_F(ContentHashTest, MatchesReferenceValues) {
+    for (size_t i = 0; i < sizeof(kVectors) / sizeof(kVectors[0]); i++) {
+        const size_t size = kVectors[i].size;
+        EXPECT_EQ(kVectors[i].hash64, ContentHasher::hash64(mData, size)) << "size " << size;
+        const ContentHash128 h = ContentHasher::hash128(mData, size);
+        EXPECT_EQ(kVectors[i].low, h.low) << "size " << size;
+        EXPECT_EQ(kVectors[i].high, h.high) << "size " << size;
+    }
+}
+
+TEST_F(ContentHashTest, StreamingMatchesOneShot) {
+    // Piece sizes that leave the buffer partly full, exactly full and
+    // overrun, against each of the totals.
+    const size_t pieces[] = { 1, 7, 63, 64, 65, 255, 256, 257, 1000, 5000 };
+    for (size_t p = 0; p < sizeof(pieces) / sizeof(pieces[0]); p++) {
+        for (size_t i = 0; i < sizeof(kVectors) / sizeof(kVectors[0]); i++) {
+            const size_t size = kVectors[i].size;
+            ContentHasher hasher;
+            for (size_t pos = 0; pos < size; pos += pieces[p]) {
+                hasher.update(mData + pos, size - pos < pieces[p] ? size - pos : pieces[p]);
+            }
+            EXPECT_EQ(kVectors[i].hash64, hasher.digest64())
+                    << "size " << size << " in pieces of " << pieces[p];
+            EXPECT_EQ(kVectors[i].low, hasher.digest128().low)
+                    << "size " << size << " in pieces of " << pieces[p];
+            EXPECT_EQ(kVectors[i].high, hasher.digest128().high)
+                    << "size " << size << " in pieces of " << pieces[p];
+        }
+    }
+}
+
+TEST_F(ContentHashTest, DigestDoesNotEndInput) {
+    ContentHasher hasher;
+    hasher.update(mData, 1000);
+    hasher.digest64();
+    hasher.update(mData + 1000, 24);
+    EXPECT_EQ(ContentHasher::hash64(mData, 1024), hasher.digest64());
+
+    hasher.reset();
+    EXPECT_EQ(ContentHasher::hash64(mData, 0), hasher.digest64());
+}
+
+TEST_F(ContentHashTest, FormatsHighWordFirst) {
+    ContentHash128 h;
+    h.low = 0x0123456789abcdefULL;
+    h.high = 0xfedcba9876543210ULL;
+    EXPECT_STREQ("fedcba98765432100123456789abcdef", h.toString().string());
+}
+
+} // namespace android
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "HashedKeyedVector_test"
+
+#include <utils/HashedKeyedVector.h>
+#include <utils/String16.h>
+#include <gtest/gtest.h>
+
+namespace android {
+
+class HashedKeyedVectorTest : public testing::Test {
+};
+
+TEST_F(HashedKeyedVectorTest, KeepsInsertionOrder) {
+    DefaultHashedKeyedVector<String16, int> map(-1);
+    map.add(String16("zebra"), 1);
+    map.add(String16("apple"), 2);
+    map.add(String16("mango"), 3);
+
+    ASSERT_EQ(3U, map.size());
+    EXPECT_EQ(String16("zebra"), map.keyAt(0));
+    EXPECT_EQ(String16("apple"), map.keyAt(1));
+    EXPECT_EQ(String16("mango"), map.keyAt(2));
+    EXPECT_EQ(2, map.valueFor(String16("apple")));
+    EXPECT_EQ(1, map.indexOfKey(String16("apple")));
+    EXPECT_EQ(-1, map.valueFor(String16("pear")));
+    EXPECT_GT(0, map.indexOfKey(String16("pear")));
+}
+
+TEST_F(HashedKeyedVectorTest, AddingAnExistingKeyReplacesItsValue) {
+    HashedKeyedVector<String16, int> map;
+    map.add(String16("a"), 1);
+    map.add(String16("b"), 2);
+    EXPECT_EQ(0, map.add(String16("a"), 3));
+
+    ASSERT_EQ(2U, map.size());
+    EXPECT_EQ(3, map.valueAt(0));
+    map.editValueFor(String16("b")) = 4;
+    EXPECT_EQ(4, map.valueFor(String16("b")));
+}
+
+TEST_F(HashedKeyedVectorTest, RemovingRenumbersLaterItems) {
+    HashedKeyedVector<String16, int> map;
+    for (int i = 0; i < 100; i++) {
+        char name[8];
+        snprintf(name, sizeof(name), "k%d", i);
+        map.add(String16(name), i);
+    }
+
+    ASSERT_LE(0, map.removeItem(String16("k10")));
+    ASSERT_LE(0, map.removeItemsAt(0));
+
+    ASSERT_EQ(98U, map.size());
+    EXPECT_GT(0, map.indexOfKey(String16("k10")));
+    EXPECT_GT(0, map.indexOfKey(String16("k0")));
+    for (int i = 1; i < 100; i++) {
+        if (i == 10) continue;
+        char name[8];
+        snprintf(name, sizeof(name), "k%d", i);
+        ssize_t index = map.indexOfKey(String16(name));
+        ASSERT_EQ(i < 10 ? i - 1 : i - 2, index) << name;
+        EXPECT_EQ(i, map.valueAt(index));
+    }
+}
+
+} // namespace android
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "SharedBuffer_test"
+#include <utils/Log.h>
+#include <utils/SharedBuffer.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+#include <gtest/gtest.h>
+
+#include <pthread.h>
+#include <string.h>
+
+namespace android {
+
+TEST(SharedBufferTest, AccountsForBuffersUntilFreed) {
+    SharedBuffer::enableAccounting();
+    const size_t before = SharedBuffer::getAccountedBytes();
+
+    SharedBuffer* sb = SharedBuffer::alloc(100);
+    ASSERT_TRUE(sb != NULL);
+    EXPECT_EQ(before + sizeof(SharedBuffer) + 100, SharedBuffer::getAccountedBytes());
+
+    sb = sb->editResize(300);
+    ASSERT_TRUE(sb != NULL);
+    EXPECT_EQ(before + sizeof(SharedBuffer) + 300, SharedBuffer::getAccountedBytes());
+
+    // A second reference holds no more memory.
+    sb->acquire();
+    sb->release();
+    EXPECT_EQ(before + sizeof(SharedBuffer) + 300, SharedBuffer::getAccountedBytes());
+
+    sb->release();
+    EXPECT_EQ(before, SharedBuffer::getAccountedBytes());
+}
+
+TEST(SharedBufferTest, AccountsForKeptStorage) {
+    SharedBuffer::enableAccounting();
+    const size_t before = SharedBuffer::getAccountedBytes();
+
+    SharedBuffer* sb = SharedBuffer::alloc(64);
+    ASSERT_TRUE(sb != NULL);
+    EXPECT_EQ(1, sb->release(SharedBuffer::eKeepStorage));
+    EXPECT_EQ(before + sizeof(SharedBuffer) + 64, SharedBuffer::getAccountedBytes());
+
+    SharedBuffer::dealloc(sb);
+    EXPECT_EQ(before, SharedBuffer::getAccountedBytes());
+}
+
+TEST(SharedBufferTest, AccountsForStrings) {
+    SharedBuffer::enableAccounting();
+    const size_t before = SharedBuffer::getAccountedBytes();
+    {
+        String8 str("Hello, world!");
+        EXPECT_LT(before, SharedBuffer::getAccountedBytes());
+    }
+    EXPECT_EQ(before, SharedBuffer::getAccountedBytes());
+}
+
+TEST(SharedBufferTest, ReusesPooledBuffers) {
+    SharedBuffer::enablePooling();
+    SharedBuffer::PoolStats before;
+    SharedBuffer::getPoolStats(&before);
+
+    SharedBuffer* sb = SharedBuffer::alloc(100);
+    ASSERT_TRUE(sb != NULL);
+    sb->release();
+    SharedBuffer* again = SharedBuffer::alloc(97);
+    EXPECT_EQ(sb, again);
+    again->release();
+
+    // Too big to pool.
+    SharedBuffer::alloc(SharedBuffer::kMaxPooledSize + 1)->release();
+
+    SharedBuffer::PoolStats after;
+    SharedBuffer::getPoolStats(&after);
+    EXPECT_EQ(before.allocs + 2, after.allocs);
+    EXPECT_EQ(before.frees + 2, after.frees);
+    EXPECT_LT(0U, after.reservedBytes);
+}
+
+TEST(SharedBufferTest, ResizesPooledBuffers) {
+    SharedBuffer::enablePooling();
+    SharedBuffer* sb = SharedBuffer::alloc(20);
+    ASSERT_TRUE(sb != NULL);
+    memcpy(sb->data(), "0123456789abcdefghi", 20);
+
+    // The same 32-byte class.
+    SharedBuffer* resized = sb->editResize(30);
+    EXPECT_EQ(sb, resized);
+    EXPECT_EQ(30U, resized->size());
+
+    resized = resized->editResize(200);
+    ASSERT_TRUE(resized != NULL);
+    EXPECT_STREQ("0123456789abcdefghi", (const char*) resized->data());
+    resized = resized->editResize(1000);
+    ASSERT_TRUE(resized != NULL);
+    EXPECT_STREQ("0123456789abcdefghi", (const char*) resized->data());
+    resized->release();
+}
+
+static void* releaseBuffers(void* arg) {
+    Vector<SharedBuffer*>* buffers = static_cast<Vector<SharedBuffer*>*>(arg);
+    for (size_t i = 0; i < buffers->size(); i++) {
+        buffers->itemAt(i)->release();
+    }
+    // And some of its own, left in its cache when it exits.
+    for (int i = 0; i < 100; i++) {
+        SharedBuffer::alloc(i)->release();
+    }
+    return NULL;
+}
+
+TEST(SharedBufferTest, PoolsAcrossThreads) {
+    SharedBuffer::enablePooling();
+    SharedBuffer::PoolStats before;
+    SharedBuffer::getPoolStats(&before);
+
+    Vector<SharedBuffer*> buffers;
+    for (int i = 0; i < 500; i++) {
+        buffers.add(SharedBuffer::alloc(i % 200));
+    }
+    pthread_t thread;
+    ASSERT_EQ(0, pthread_create(&thread, NULL, releaseBuffers, &buffers));
+    pthread_join(thread, NULL);
+
+    SharedBuffer::PoolStats after;
+    SharedBuffer::getPoolStats(&after);
+    EXPECT_LE(before.allocs + 600, after.allocs);
+    EXPECT_LE(before.frees + 600, after.frees);
+}
+
+} // namespace android
@@ -72,4 +72,18 @@ TEST_F(String8Test, OperatorPlusEquals) {
     EXPECT_STREQ(src3, " Verify me.");
 }
 
+TEST_F(String8Test, Move) {
+    String8 src("Moved");
+    const char* buffer = src.string();
+
+    String8 dst(std::move(src));
+    EXPECT_EQ(buffer, dst.string());
+    EXPECT_STREQ("", src.string());
+
+    String8 other("Other");
+    other = std::move(dst);
+    EXPECT_EQ(buffer, other.string());
+    EXPECT_STREQ("Moved", other.string());
+}
+
 }
@@ -112,4 +112,52 @@ TEST_F(UnicodeTest, UTF8toUTF16Normal) {
             << "should be NULL terminated";
 }
 
+TEST_F(UnicodeTest, ASCIIRunsAroundOtherCharacters) {
+    // ASCII of every length up to a few vectors, with U+00E9 and U+2323
+    // at every position, so that each run ends inside and outside the
+    // vector loops.
+    for (size_t len = 1; len < 40; len++) {
+        for (size_t odd = 0; odd <= len; odd++) {
+            uint8_t u8[64];
+            char16_t expected[64];
+            size_t u8len = 0, u16len = 0;
+            for (size_t i = 0; i < len; i++) {
+                if (i == odd) {
+                    u8[u8len++] = 0xC3;
+                    u8[u8len++] = 0xA9;
+                    expected[u16len++] = 0x00E9;
+                    u8[u8len++] = 0xE2;
+                    u8[u8len++] = 0x8C;
+                    u8[u8len++] = 0xA3;
+                    expected[u16len++] = 0x2323;
+                }
+                u8[u8len++] = 'a' + i % 26;
+                expected[u16len++] = 'a' + i % 26;
+            }
+
+            EXPECT_EQ((ssize_t) u16len, utf8_to_utf16_length(u8, u8len));
+
+            char16_t u16[64];
+            utf8_to_utf16(u8, u8len, u16);
+            EXPECT_EQ(0, memcmp(expected, u16, u16len * sizeof(char16_t)))
+                    << "length " << len << ", other characters at " << odd;
+            EXPECT_EQ(0, u16[u16len]);
+
+            char16_t truncated[64];
+            const size_t room = u16len / 2;
+            char16_t* end = utf8_to_utf16_n(u8, u8len, truncated, room);
+            EXPECT_EQ(truncated + room, end);
+            EXPECT_EQ(0, memcmp(expected, truncated, room * sizeof(char16_t)));
+
+            EXPECT_EQ((ssize_t) u8len, utf16_to_utf8_length(expected, u16len));
+
+            char back[64];
+            utf16_to_utf8(expected, u16len, back);
+            EXPECT_EQ(0, memcmp(u8, back, u8len))
+                    << "length " << len << ", other characters at " << odd;
+            EXPECT_EQ(0, back[u8len]);
+        }
+    }
+}
+
 }
@@ -16,6 +16,8 @@
 
 #define LOG_TAG "Vector_test"
 
+#include <utils/SortedVector.h>
+#include <utils/String8.h>
 #include <utils/Vector.h>
 #include <cutils/log.h>
 #include <gtest/gtest.h>
@@ -71,5 +73,160 @@ TEST_F(VectorTest, CopyOnWrite_CopyAndAddElements) {
     EXPECT_EQ(other[3], 5);
 }
 
+// Counts how often it is copied and moved.
+struct Counted {
+    static int copies;
+    static int moves;
+
+    Counted() : value(0) { }
+    explicit Counted(int v) : value(v) { }
+    Counted(const Counted& o) : value(o.value) { copies++; }
+    Counted(Counted&& o) : value(o.value) { o.value = -1; moves++; }
+    Counted& operator=(const Counted& o) { value = o.value; copies++; return *this; }
+    Counted& operator=(Counted&& o) { value = o.value; o.value = -1; moves++; return *this; }
+
+    int value;
+};
+
+int Counted::copies = 0;
+int Counted::moves = 0;
+
+TEST_F(VectorTest, MoveTakesStorage) {
+    Vector<int> vector;
+    vector.add(1);
+    vector.add(2);
+    const int* storage = vector.array();
+
+    Vector<int> other(std::move(vector));
+    EXPECT_EQ(0U, vector.size());
+    EXPECT_EQ(2U, other.size());
+    EXPECT_EQ(storage, other.array());
+
+    vector = std::move(other);
+    EXPECT_EQ(0U, other.size());
+    EXPECT_EQ(2U, vector.size());
+    EXPECT_EQ(storage, vector.array());
+}
+
+TEST_F(VectorTest, AddAndEmplaceDoNotCopy) {
+    Vector<Counted> vector;
+    Counted::copies = Counted::moves = 0;
+
+    vector.add(Counted(1));
+    vector.emplace(3);
+    vector.emplaceAt(1, 2);
+    Counted four(4);
+    vector.push(std::move(four));
+
+    ASSERT_EQ(4U, vector.size());
+    for (size_t i = 0; i < vector.size(); i++) {
+        EXPECT_EQ(int(i) + 1, vector[i].value);
+    }
+    EXPECT_EQ(-1, four.value);
+    EXPECT_EQ(0, Counted::copies);
+}
+
+TEST_F(VectorTest, GrowingMovesItemsItOwns) {
+    Vector<Counted> vector;
+    for (int i = 0; i < 4; i++) {
+        vector.emplace(i);
+    }
+    Counted::copies = Counted::moves = 0;
+
+    // Past the initial capacity, the items move to the new storage.
+    vector.emplace(4);
+    EXPECT_EQ(0, Counted::copies);
+    EXPECT_EQ(4, Counted::moves);
+
+    // A shared buffer is still copied, and its items left alone.
+    Vector<Counted> other(vector);
+    for (int i = 5; i < 10; i++) {
+        vector.emplace(i);
+    }
+    EXPECT_LT(0, Counted::copies);
+    ASSERT_EQ(5U, other.size());
+    ASSERT_EQ(10U, vector.size());
+    for (size_t i = 0; i < vector.size(); i++) {
+        EXPECT_EQ(int(i), vector[i].value);
+    }
+    for (size_t i = 0; i < other.size(); i++) {
+        EXPECT_EQ(int(i), other[i].value);
+    }
+}
+
+TEST_F(VectorTest, SetCapacityMovesItemsItOwns) {
+    Vector<Counted> vector;
+    for (int i = 0; i < 3; i++) {
+        vector.emplace(i);
+    }
+    Counted::copies = Counted::moves = 0;
+
+    EXPECT_EQ(100, vector.setCapacity(100));
+    EXPECT_EQ(100U, vector.capacity());
+    EXPECT_EQ(0, Counted::copies);
+    EXPECT_EQ(3, Counted::moves);
+
+    // Asking for less than there is already is a no-op.
+    EXPECT_EQ(100, vector.setCapacity(10));
+    EXPECT_EQ(3, Counted::moves);
+    ASSERT_EQ(3U, vector.size());
+    for (size_t i = 0; i < vector.size(); i++) {
+        EXPECT_EQ(int(i), vector[i].value);
+    }
+}
+
+TEST_F(VectorTest, GrowingTriviallyMovableItems) {
+    // String8 may be moved with realloc(), but only while the buffer
+    // isn't shared.
+    Vector<String8> vector;
+    vector.add(String8("first"));
+    vector.add(String8("last"));
+    Vector<String8> other(vector);
+    for (int i = 0; i < 20; i++) {
+        vector.insertAt(String8::format("%d", i), 1 + i);
+    }
+
+    ASSERT_EQ(2U, other.size());
+    EXPECT_STREQ("first", other[0].string());
+    EXPECT_STREQ("last", other[1].string());
+    other.clear();
+
+    for (int i = 20; i < 40; i++) {
+        vector.insertAt(String8::format("%d", i), 1 + i);
+    }
+    ASSERT_EQ(42U, vector.size());
+    EXPECT_STREQ("first", vector[0].string());
+    for (int i = 0; i < 40; i++) {
+        EXPECT_EQ(String8::format("%d", i), vector[1 + i]);
+    }
+    EXPECT_STREQ("last", vector[41].string());
+}
+
+TEST_F(VectorTest, SortedMergeOfUnsortedItems) {
+    typedef key_value_pair_t<int, int> Pair;
+    SortedVector<Pair> sorted;
+    sorted.add(Pair(10, 0));
+    sorted.add(Pair(30, 0));
+    sorted.add(Pair(50, 0));
+
+    Vector<Pair> items;
+    items.add(Pair(40, 1));
+    items.add(Pair(30, 1));
+    items.add(Pair(5, 1));
+    items.add(Pair(40, 2));
+    items.add(Pair(60, 1));
+    items.add(Pair(20, 1));
+
+    EXPECT_EQ(NO_ERROR, sorted.merge(items));
+
+    // Of equal keys, the last one added wins.
+    const int keys[] = { 5, 10, 20, 30, 40, 50, 60 };
+    const int values[] = { 1, 0, 1, 1, 2, 0, 1 };
+    ASSERT_EQ(7U, sorted.size());
+    for (size_t i = 0; i < sorted.size(); i++) {
+        EXPECT_EQ(keys[i], sorted[i].key);
+        EXPECT_EQ(values[i], sorted[i].value);
+    }
+}
 
 } // namespace android
@@ -27,6 +27,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <memory>
 #include <vector>
 
@@ -309,13 +310,21 @@ struct ZipArchive {
   uint32_t hash_table_size;
   ZipString* hash_table;
 
+  /*
+   * The hash table indices of the num_entries entries, sorted by name, so
+   * that the entries with a given prefix are a contiguous run.  Built on
+   * the first iteration with a prefix; read and set with GetSortedEntries().
+   */
+  uint32_t* sorted_entries;
+
   ZipArchive(const int fd, bool assume_ownership) :
       fd(fd),
       close_file(assume_ownership),
       directory_offset(0),
       num_entries(0),
       hash_table_size(0),
-      hash_table(NULL) {}
+      hash_table(NULL),
+      sorted_entries(NULL) {}
 
   ~ZipArchive() {
     if (close_file && fd >= 0) {
@@ -323,6 +332,7 @@ struct ZipArchive {
     }
 
     free(hash_table);
+    free(sorted_entries);
   }
 };
 
@@ -847,6 +857,11 @@ static int32_t FindEntry(const ZipArchive* archive, const int ent,
 
 struct IterationHandle {
   uint32_t position;
+  // With a prefix, the hash table indices of the entries that have it, in
+  // hash table order, and how many there are.  Next() walks these instead
+  // of the whole hash table.
+  uint32_t* matches;
+  uint32_t match_count;
   // We're not using vector here because this code is used in the Windows SDK
   // where the STL is not available.
   ZipString prefix;
@@ -854,7 +869,7 @@ struct IterationHandle {
   ZipArchive* archive;
 
   IterationHandle(const ZipString* in_prefix,
-                  const ZipString* in_suffix) {
+                  const ZipString* in_suffix) : matches(NULL), match_count(0) {
     if (in_prefix) {
       uint8_t* name_copy = new uint8_t[in_prefix->name_length];
       memcpy(name_copy, in_prefix->name, in_prefix->name_length);
@@ -878,9 +893,64 @@ struct IterationHandle {
   ~IterationHandle() {
     delete[] prefix.name;
     delete[] suffix.name;
+    delete[] matches;
+  }
+};
+
+// Orders hash table indices by the names of their entries, as raw bytes.
+struct EntryNameLess {
+  const ZipString* hash_table;
+
+  bool operator()(uint32_t lhs, uint32_t rhs) const {
+    return Less(hash_table[lhs], hash_table[rhs]);
+  }
+
+  // Comparisons with a prefix put it before every name it starts, so a
+  // lower bound for it is the first entry that could have it.
+  bool operator()(uint32_t lhs, const ZipString& prefix) const {
+    return Less(hash_table[lhs], prefix);
+  }
+
+  static bool Less(const ZipString& lhs, const ZipString& rhs) {
+    const uint16_t length = std::min(lhs.name_length, rhs.name_length);
+    const int cmp = memcmp(lhs.name, rhs.name, length);
+    return cmp < 0 || (cmp == 0 && lhs.name_length < rhs.name_length);
   }
 };
 
+/*
+ * Returns the archive's sorted_entries, building them the first time.
+ * Handles may be shared between threads, so the array is published with a
+ * compare-and-swap and a thread that loses the race frees its own copy.
+ */
+static const uint32_t* GetSortedEntries(ZipArchive* archive) {
+  uint32_t* sorted = __atomic_load_n(&archive->sorted_entries, __ATOMIC_ACQUIRE);
+  if (sorted != NULL) {
+    return sorted;
+  }
+
+  sorted = reinterpret_cast<uint32_t*>(malloc(archive->num_entries * sizeof(uint32_t)));
+  if (sorted == NULL) {
+    return NULL;
+  }
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < archive->hash_table_size; ++i) {
+    if (archive->hash_table[i].name != NULL) {
+      sorted[count++] = i;
+    }
+  }
+  EntryNameLess less = { archive->hash_table };
+  std::sort(sorted, sorted + count, less);
+
+  uint32_t* expected = NULL;
+  if (!__atomic_compare_exchange_n(&archive->sorted_entries, &expected, sorted, false,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    free(sorted);
+    sorted = expected;
+  }
+  return sorted;
+}
+
 int32_t StartIteration(ZipArchiveHandle handle, void** cookie_ptr,
                        const ZipString* optional_prefix,
                        const ZipString* optional_suffix) {
@@ -895,6 +965,26 @@ int32_t StartIteration(ZipArchiveHandle handle, void** cookie_ptr,
   cookie->position = 0;
   cookie->archive = archive;
 
+  const uint32_t* sorted = NULL;
+  if (cookie->prefix.name_length != 0) {
+    sorted = GetSortedEntries(archive);
+  }
+  if (sorted != NULL) {
+    // Entries are returned in hash table order, as they are without a
+    // prefix, so the run with the prefix is copied and put in that order.
+    const uint32_t* end = sorted + archive->num_entries;
+    EntryNameLess less = { archive->hash_table };
+    const uint32_t* first = std::lower_bound(sorted, end, cookie->prefix, less);
+    const uint32_t* last = first;
+    while (last != end && archive->hash_table[*last].StartsWith(cookie->prefix)) {
+      ++last;
+    }
+    cookie->match_count = last - first;
+    cookie->matches = new uint32_t[cookie->match_count];
+    std::copy(first, last, cookie->matches);
+    std::sort(cookie->matches, cookie->matches + cookie->match_count);
+  }
+
   *cookie_ptr = cookie ;
   return 0;
 }
@@ -938,6 +1028,25 @@ int32_t Next(void* cookie, ZipEntry* data, ZipString* name) {
   const uint32_t hash_table_length = archive->hash_table_size;
   const ZipString* hash_table = archive->hash_table;
 
+  if (handle->matches != NULL) {
+    for (uint32_t m = currentOffset; m < handle->match_count; ++m) {
+      const uint32_t i = handle->matches[m];
+      if (handle->suffix.name_length == 0 || hash_table[i].EndsWith(handle->suffix)) {
+        handle->position = (m + 1);
+        const int error = FindEntry(archive, i, data);
+        if (!error) {
+          name->name = hash_table[i].name;
+          name->name_length = hash_table[i].name_length;
+        }
+
+        return error;
+      }
+    }
+
+    handle->position = 0;
+    return kIterationEnd;
+  }
+
   for (uint32_t i = currentOffset; i < hash_table_length; ++i) {
     if (hash_table[i].name != NULL &&
         (handle->prefix.name_length == 0 ||
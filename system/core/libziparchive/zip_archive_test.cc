@@ -238,6 +238,40 @@ TEST(ziparchive, IterationWithPrefixAndSuffix) {
   CloseArchive(handle);
 }
 
+TEST(ziparchive, IterationsWithPrefixesShareTheArchive) {
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWrapper(kValidZip, &handle));
+
+  void* b_cookie;
+  void* a_cookie;
+  ZipString b_prefix("b/");
+  ZipString a_prefix("a");
+  ASSERT_EQ(0, StartIteration(handle, &b_cookie, &b_prefix, NULL));
+  ASSERT_EQ(0, StartIteration(handle, &a_cookie, &a_prefix, NULL));
+
+  ZipEntry data;
+  ZipString name;
+
+  ASSERT_EQ(0, Next(b_cookie, &data, &name));
+  AssertNameEquals("b/c.txt", name);
+  ASSERT_EQ(0, Next(a_cookie, &data, &name));
+  AssertNameEquals("a.txt", name);
+  ASSERT_EQ(-1, Next(a_cookie, &data, &name));
+  ASSERT_EQ(0, Next(b_cookie, &data, &name));
+  AssertNameEquals("b/d.txt", name);
+  ASSERT_EQ(0, Next(b_cookie, &data, &name));
+  AssertNameEquals("b/", name);
+  ASSERT_EQ(-1, Next(b_cookie, &data, &name));
+
+  // An iteration starts over once it has ended.
+  ASSERT_EQ(0, Next(b_cookie, &data, &name));
+  AssertNameEquals("b/c.txt", name);
+
+  EndIteration(a_cookie);
+  EndIteration(b_cookie);
+  CloseArchive(handle);
+}
+
 TEST(ziparchive, IterationWithBadPrefixAndSuffix) {
   ZipArchiveHandle handle;
   ASSERT_EQ(0, OpenArchiveWrapper(kValidZip, &handle));